@@ -11,39 +11,71 @@
  */
 
 #include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include <helib/helib.h>
 #include <helib/debugging.h>
 #include "bgv_common.h"
+#include "memory_common.h" // residentKB, resetPeakRSS
 
 namespace {
 
+// The number of bytes that write(str) writes out
+template <typename Write>
+long serializedSize(Write write)
+{
+  std::stringstream ss;
+  write(ss);
+  return ss.str().size();
+}
+
+// Report the size of one object, and the bytes per second of the round trips
+void setIOCounters(benchmark::State& state, long bytes, long objects = 1)
+{
+  state.counters["bytes"] = bytes;
+  state.SetBytesProcessed(state.iterations() * bytes * objects);
+  state.SetItemsProcessed(state.iterations() * objects);
+}
+
 static void benchContextBinaryIO(benchmark::State& state, Meta& meta)
 {
   std::stringstream ss;
+  const long bytes = serializedSize(
+      [&](std::ostream& str) { meta.data->context.writeTo(str); });
 
   for (auto _ : state) {
     meta.data->context.writeTo(ss);
     helib::Context newContext = helib::Context::readFrom(ss);
     ::benchmark::DoNotOptimize(newContext);
   }
+  setIOCounters(state, bytes);
 }
 
 static void benchContextJSONIO(benchmark::State& state, Meta& meta)
 {
   std::stringstream ss;
+  const long bytes = serializedSize(
+      [&](std::ostream& str) { meta.data->context.writeToJSON(str); });
 
   for (auto _ : state) {
     meta.data->context.writeToJSON(ss);
     helib::Context newContext = helib::Context::readFromJSON(ss);
     ::benchmark::DoNotOptimize(newContext);
   }
+  setIOCounters(state, bytes);
 }
 
 static void benchPublicKeyBinaryIO(benchmark::State& state, Meta& meta)
 {
   std::stringstream ss;
+  const long bytes = serializedSize(
+      [&](std::ostream& str) { meta.data->publicKey.writeTo(str); });
 
   for (auto _ : state) {
     meta.data->publicKey.writeTo(ss);
@@ -51,11 +83,14 @@ static void benchPublicKeyBinaryIO(benchmark::State& state, Meta& meta)
         helib::PubKey::readFrom(ss, meta.data->context);
     ::benchmark::DoNotOptimize(newPublicKey);
   }
+  setIOCounters(state, bytes);
 }
 
 static void benchPublicKeyJSONIO(benchmark::State& state, Meta& meta)
 {
   std::stringstream ss;
+  const long bytes = serializedSize(
+      [&](std::ostream& str) { meta.data->publicKey.writeToJSON(str); });
 
   for (auto _ : state) {
     meta.data->publicKey.writeToJSON(ss);
@@ -63,11 +98,14 @@ static void benchPublicKeyJSONIO(benchmark::State& state, Meta& meta)
         helib::PubKey::readFromJSON(ss, meta.data->context);
     ::benchmark::DoNotOptimize(newPublicKey);
   }
+  setIOCounters(state, bytes);
 }
 
 static void benchSecretKeyBinaryIO(benchmark::State& state, Meta& meta)
 {
   std::stringstream ss;
+  const long bytes = serializedSize(
+      [&](std::ostream& str) { meta.data->secretKey.writeTo(str); });
 
   for (auto _ : state) {
     meta.data->secretKey.writeTo(ss);
@@ -75,11 +113,14 @@ static void benchSecretKeyBinaryIO(benchmark::State& state, Meta& meta)
         helib::SecKey::readFrom(ss, meta.data->context);
     ::benchmark::DoNotOptimize(newSecretKey);
   }
+  setIOCounters(state, bytes);
 }
 
 static void benchSecretKeyJSONIO(benchmark::State& state, Meta& meta)
 {
   std::stringstream ss;
+  const long bytes = serializedSize(
+      [&](std::ostream& str) { meta.data->secretKey.writeToJSON(str); });
 
   for (auto _ : state) {
     meta.data->secretKey.writeToJSON(ss);
@@ -87,30 +128,194 @@ static void benchSecretKeyJSONIO(benchmark::State& state, Meta& meta)
         helib::SecKey::readFromJSON(ss, meta.data->context);
     ::benchmark::DoNotOptimize(newSecretKey);
   }
+  setIOCounters(state, bytes);
 }
 
 static void benchCiphertextBinaryIO(benchmark::State& state, Meta& meta)
 {
   std::stringstream ss;
   helib::Ctxt ctxt(meta.data->publicKey);
+  meta.data->publicKey.Encrypt(ctxt, NTL::ZZX(0));
+  const long bytes =
+      serializedSize([&](std::ostream& str) { ctxt.writeTo(str); });
 
   for (auto _ : state) {
     ctxt.writeTo(ss);
     helib::Ctxt newCtxt = helib::Ctxt::readFrom(ss, meta.data->publicKey);
     ::benchmark::DoNotOptimize(newCtxt);
   }
+  setIOCounters(state, bytes);
 }
 
 static void benchCiphertextJSONIO(benchmark::State& state, Meta& meta)
 {
   std::stringstream ss;
   helib::Ctxt ctxt(meta.data->publicKey);
+  meta.data->publicKey.Encrypt(ctxt, NTL::ZZX(0));
+  const long bytes =
+      serializedSize([&](std::ostream& str) { ctxt.writeToJSON(str); });
 
   for (auto _ : state) {
     ctxt.writeToJSON(ss);
     helib::Ctxt newCtxt = helib::Ctxt::readFromJSON(ss, meta.data->publicKey);
     ::benchmark::DoNotOptimize(newCtxt);
   }
+  setIOCounters(state, bytes);
+}
+
+static void benchContextSnapshotIO(benchmark::State& state, Meta& meta)
+{
+  std::stringstream ss;
+  const long bytes = serializedSize(
+      [&](std::ostream& str) { meta.data->context.writeSnapshotTo(str); });
+
+  for (auto _ : state) {
+    meta.data->context.writeSnapshotTo(ss);
+    helib::Context newContext = helib::Context::readSnapshotFrom(ss);
+    ::benchmark::DoNotOptimize(newContext);
+  }
+  setIOCounters(state, bytes);
+}
+
+// A fresh secret-key encryption, written with its random part as a seed
+static void benchCiphertextSeededIO(benchmark::State& state, Meta& meta)
+{
+  std::stringstream ss;
+  helib::Ctxt ctxt(meta.data->secretKey);
+  meta.data->secretKey.Encrypt(ctxt, NTL::ZZX(0));
+  const long bytes =
+      serializedSize([&](std::ostream& str) { ctxt.writeSeededTo(str); });
+
+  for (auto _ : state) {
+    ctxt.writeSeededTo(ss);
+    helib::Ctxt newCtxt = helib::Ctxt::readFrom(ss, meta.data->publicKey);
+    ::benchmark::DoNotOptimize(newCtxt);
+  }
+  setIOCounters(state, bytes);
+}
+
+// A fresh encryption, mod-switched down to what decryption needs
+static void benchCiphertextCompactIO(benchmark::State& state, Meta& meta)
+{
+  std::stringstream ss;
+  helib::Ctxt ctxt(meta.data->publicKey);
+  meta.data->publicKey.Encrypt(ctxt, NTL::ZZX(0));
+  const long bytes =
+      serializedSize([&](std::ostream& str) { ctxt.writeCompact(str); });
+
+  for (auto _ : state) {
+    ctxt.writeCompact(ss);
+    helib::Ctxt newCtxt = helib::Ctxt::readFrom(ss, meta.data->publicKey);
+    ::benchmark::DoNotOptimize(newCtxt);
+  }
+  setIOCounters(state, bytes);
+}
+
+// Writing out state.range(0) ciphertexts to one stream, and reading them in
+static void benchCiphertextBatchIO(benchmark::State& state, Meta& meta)
+{
+  std::stringstream ss;
+  helib::Ctxt ctxt(meta.data->publicKey);
+  meta.data->publicKey.Encrypt(ctxt, NTL::ZZX(0));
+  const std::vector<helib::Ctxt> ctxts(state.range(0), ctxt);
+  std::vector<helib::Ctxt> newCtxts(ctxts.size(), ctxt);
+  const long bytes =
+      serializedSize([&](std::ostream& str) { ctxt.writeTo(str); });
+
+  for (auto _ : state) {
+    for (const helib::Ctxt& c : ctxts)
+      c.writeTo(ss);
+    for (helib::Ctxt& c : newCtxts)
+      c.read(ss);
+    ::benchmark::DoNotOptimize(newCtxts);
+  }
+  setIOCounters(state, bytes, ctxts.size());
+}
+
+// Time reading key with PubKey::readFrom, and report how far the resident
+// set grew above what it was before the read, at its peak
+static void readPublicKey(benchmark::State& state, const helib::PubKey& key)
+{
+  std::stringstream ss;
+  key.writeTo(ss);
+  const long bytes = ss.str().size();
+  long peakGrowth = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    ss.clear();
+    ss.seekg(0);
+    resetPeakRSS();
+    long before = residentKB("VmRSS");
+    state.ResumeTiming();
+
+    helib::PubKey newPublicKey =
+        helib::PubKey::readFrom(ss, key.getContext());
+    ::benchmark::DoNotOptimize(newPublicKey);
+
+    state.PauseTiming();
+    peakGrowth = std::max(peakGrowth, residentKB("VmHWM") - before);
+    state.ResumeTiming();
+  }
+  setIOCounters(state, bytes);
+  state.counters["matrices"] = key.keySWlist().size();
+  state.counters["peak_growth_kb"] = peakGrowth;
+}
+
+static void benchPublicKeyBinaryRead(benchmark::State& state, Meta& meta)
+{
+  readPublicKey(state, meta.data->publicKey);
+}
+
+// The evaluation keys of a bootstrappable context: the 1D and Frobenius
+// matrices and the bootstrapping key
+static void benchBootKeysBinaryRead(benchmark::State& state, Meta& meta)
+{
+  helib::SecKey secretKey(meta.data->secretKey);
+  helib::addFrbMatrices(secretKey);
+  secretKey.genRecryptData();
+  readPublicKey(state, secretKey);
+}
+
+// A key written with writeMappableTo, mapped in place
+static void benchPublicKeyMappedRead(benchmark::State& state, Meta& meta)
+{
+  const std::string path = "IO_mapped_pubkey.bin";
+  {
+    std::ofstream file(path, std::ios::binary);
+    meta.data->publicKey.writeMappableTo(file);
+  }
+  const long bytes = serializedSize([&](std::ostream& str) {
+    meta.data->publicKey.writeMappableTo(str);
+  });
+
+  for (auto _ : state) {
+    helib::PubKey newPublicKey =
+        helib::PubKey::readMapped(path, meta.data->context);
+    ::benchmark::DoNotOptimize(newPublicKey);
+  }
+  std::remove(path.c_str());
+  setIOCounters(state, bytes);
+}
+
+// A key written with writeTo, with its matrices left in the file
+static void benchPublicKeyLazyRead(benchmark::State& state, Meta& meta)
+{
+  const std::string path = "IO_lazy_pubkey.bin";
+  {
+    std::ofstream file(path, std::ios::binary);
+    meta.data->publicKey.writeTo(file);
+  }
+  const long bytes = serializedSize(
+      [&](std::ostream& str) { meta.data->publicKey.writeTo(str); });
+
+  for (auto _ : state) {
+    helib::PubKey newPublicKey =
+        helib::PubKey::readLazy(path, meta.data->context);
+    ::benchmark::DoNotOptimize(newPublicKey);
+  }
+  std::remove(path.c_str());
+  setIOCounters(state, bytes);
 }
 
 Meta fn;
@@ -146,6 +351,33 @@ BENCHMARK_CAPTURE(benchCiphertextJSONIO, no_boot_params, fn(no_boot_params))
     ->Unit(benchmark::kMillisecond)
     ->Iterations(200);
 
+// Other formats
+BENCHMARK_CAPTURE(benchContextSnapshotIO, no_boot_params, fn(no_boot_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchCiphertextSeededIO, no_boot_params, fn(no_boot_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchCiphertextCompactIO, no_boot_params, fn(no_boot_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchCiphertextBatchIO, no_boot_params, fn(no_boot_params))
+    ->Arg(16)
+    ->Arg(256)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(10);
+
+// Loading keys
+BENCHMARK_CAPTURE(benchPublicKeyBinaryRead, no_boot_params, fn(no_boot_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchPublicKeyMappedRead, no_boot_params, fn(no_boot_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchPublicKeyLazyRead, no_boot_params, fn(no_boot_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+
 Params tiny_params(/*m =*/31 * 41,
                    /*p =*/2,
                    /*r =*/1,
@@ -181,6 +413,36 @@ BENCHMARK_CAPTURE(benchCiphertextJSONIO, tiny_params, fn(tiny_params))
     ->Unit(benchmark::kMillisecond)
     ->Iterations(200);
 
+// Other formats
+BENCHMARK_CAPTURE(benchContextSnapshotIO, tiny_params, fn(tiny_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(10);
+BENCHMARK_CAPTURE(benchCiphertextSeededIO, tiny_params, fn(tiny_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchCiphertextCompactIO, tiny_params, fn(tiny_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchCiphertextBatchIO, tiny_params, fn(tiny_params))
+    ->Arg(16)
+    ->Arg(256)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(10);
+
+// Loading keys
+BENCHMARK_CAPTURE(benchPublicKeyBinaryRead, tiny_params, fn(tiny_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(10);
+BENCHMARK_CAPTURE(benchPublicKeyMappedRead, tiny_params, fn(tiny_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(10);
+BENCHMARK_CAPTURE(benchPublicKeyLazyRead, tiny_params, fn(tiny_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(10);
+BENCHMARK_CAPTURE(benchBootKeysBinaryRead, tiny_params, fn(tiny_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(10);
+
 Params small_params(/*m =*/31775,
                     /*p =*/2,
                     /*r =*/1,
@@ -216,6 +478,36 @@ BENCHMARK_CAPTURE(benchCiphertextJSONIO, small_params, fn(small_params))
     ->Unit(benchmark::kMillisecond)
     ->Iterations(200);
 
+// Other formats
+BENCHMARK_CAPTURE(benchContextSnapshotIO, small_params, fn(small_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(benchCiphertextSeededIO, small_params, fn(small_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchCiphertextCompactIO, small_params, fn(small_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchCiphertextBatchIO, small_params, fn(small_params))
+    ->Arg(16)
+    ->Arg(256)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(10);
+
+// Loading keys
+BENCHMARK_CAPTURE(benchPublicKeyBinaryRead, small_params, fn(small_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(benchPublicKeyMappedRead, small_params, fn(small_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(benchPublicKeyLazyRead, small_params, fn(small_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(benchBootKeysBinaryRead, small_params, fn(small_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+
 Params big_params(/*m =*/35113,
                   /*p =*/2,
                   /*r =*/1,
@@ -251,4 +543,34 @@ BENCHMARK_CAPTURE(benchCiphertextJSONIO, big_params, fn(big_params))
     ->Unit(benchmark::kMillisecond)
     ->Iterations(200);
 
+// Other formats
+BENCHMARK_CAPTURE(benchContextSnapshotIO, big_params, fn(big_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(benchCiphertextSeededIO, big_params, fn(big_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchCiphertextCompactIO, big_params, fn(big_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(200);
+BENCHMARK_CAPTURE(benchCiphertextBatchIO, big_params, fn(big_params))
+    ->Arg(16)
+    ->Arg(256)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(10);
+
+// Loading keys
+BENCHMARK_CAPTURE(benchPublicKeyBinaryRead, big_params, fn(big_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(benchPublicKeyMappedRead, big_params, fn(big_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(benchPublicKeyLazyRead, big_params, fn(big_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(benchBootKeysBinaryRead, big_params, fn(big_params))
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+
 } // namespace
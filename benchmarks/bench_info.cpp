@@ -0,0 +1,45 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+// Print, as a JSON object, the version and the build options of the HElib
+// (and NTL) that the benchmarks are linked with. Used by compare.py to tag
+// the results it records.
+
+#include <NTL/version.h>
+#include <helib/version.h>
+
+#include <iostream>
+
+// The vector extension the HElib kernels (FFT and element-wise modular
+// arithmetic) can use on this architecture
+#if defined(__aarch64__) && defined(__ARM_NEON)
+static const char simdArch[] = "neon";
+#elif defined(__x86_64__)
+static const char simdArch[] = "x86-64";
+#else
+static const char simdArch[] = "none";
+#endif
+
+int main()
+{
+  std::cout << "{\n"
+            << "  \"helib_version\": \"" << helib::version::libString()
+            << "\",\n"
+            << "  \"helib_build_flags\": \"" << helib::version::buildFlags()
+            << "\",\n"
+            << "  \"ntl_version\": \"" << NTL_VERSION << "\",\n"
+            << "  \"simd_arch\": \"" << simdArch << "\",\n"
+            << "  \"simd_kernels\": \"" << helib::version::kernels()
+            << "\"\n"
+            << "}\n";
+  return 0;
+}
@@ -0,0 +1,290 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+// The linear transforms by themselves: MatMul1DExec, BlockMatMul1DExec,
+// MatMulFullExec and the EvalMap and ThinEvalMap of bootstrapping. For each
+// there is the time to build it (and upgrade its constants to DoubleCRT,
+// with cached=1), with the memory of the cache, and the time to apply it.
+// With minimal=1 the keys are those of addMinimal{1D,Frb}Matrices and the
+// transforms use their minimal strategy, otherwise the keys are those of
+// addSome1DMatrices and addFrbMatrices.
+
+#include <NTL/BasicThreadPool.h>
+#include <helib/helib.h>
+#include <helib/EvalMap.h>
+#include <helib/matmul.h>
+#include <helib/randomMatrices.h>
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <functional>
+#include <memory>
+
+namespace {
+
+// A context with the factorization of m that EvalMap needs, random
+// matrices, and one secret key for each kind of key set
+struct Linear
+{
+  helib::Context context;
+  const helib::EncryptedArray& ea;
+  NTL::Vec<long> mvec;
+  std::array<std::unique_ptr<helib::SecKey>, 2> keys; // by minimal
+  std::unique_ptr<helib::MatMul1D> matrix;
+  std::unique_ptr<helib::BlockMatMul1D> blockMatrix;
+  std::unique_ptr<helib::MatMulFull> fullMatrix;
+
+  Linear() :
+      context(helib::ContextBuilder<helib::BGV>()
+                  .m(31 * 41)
+                  .p(2)
+                  .r(1)
+                  .gens({1026, 249})
+                  .ords({30, -2})
+                  .bits(300)
+                  .c(2)
+                  .mvec({31, 41})
+                  .build()),
+      ea(context.getEA())
+  {
+    mvec.SetLength(2);
+    mvec[0] = 31;
+    mvec[1] = 41;
+    for (bool minimal : {false, true}) {
+      keys[minimal] = std::make_unique<helib::SecKey>(context);
+      helib::SecKey& secretKey = *keys[minimal];
+      secretKey.GenSecKey();
+      if (minimal) {
+        helib::addMinimal1DMatrices(secretKey);
+        helib::addMinimalFrbMatrices(secretKey);
+      } else {
+        helib::addSome1DMatrices(secretKey);
+        helib::addFrbMatrices(secretKey);
+      }
+    }
+    matrix.reset(helib::buildRandomMatrix(ea, 0));
+    blockMatrix.reset(helib::buildRandomBlockMatrix(ea, 0));
+    fullMatrix.reset(helib::buildRandomFullMatrix(ea));
+  }
+};
+
+Linear& linear()
+{
+  static Linear data;
+  return data;
+}
+
+void applyTo(const helib::MatMulExecBase& exec, helib::Ctxt& ctxt)
+{
+  exec.mul(ctxt);
+}
+
+void applyTo(const helib::EvalMap& map, helib::Ctxt& ctxt) { map.apply(ctxt); }
+
+void applyTo(const helib::ThinEvalMap& map, helib::Ctxt& ctxt)
+{
+  map.apply(ctxt);
+}
+
+// The bytes of DoubleCRT constants held by matrix caches
+long cacheBytes(const helib::Context& context)
+{
+  return context.memoryReport()[helib::MemoryCategory::MATMUL_CACHE].bytes;
+}
+
+void setCounters(benchmark::State& state, const Linear& data, long bytes)
+{
+  state.counters["cache_bytes"] = bytes;
+  state.counters["keys"] = data.keys[state.range(0)]->keySWlist().size();
+}
+
+// Time building the transform made by make(data, minimal), followed by
+// upgrade() if state.range(1) is set
+template <typename T>
+void build(benchmark::State& state,
+           const std::function<std::unique_ptr<T>(const Linear&, bool)>& make)
+{
+  NTL::SetNumThreads(1);
+  const Linear& data = linear();
+  const bool minimal = state.range(0);
+  const bool cached = state.range(1);
+  long bytes = 0;
+
+  for (auto _ : state) {
+    long before = cacheBytes(data.context);
+    std::unique_ptr<T> transform = make(data, minimal);
+    if (cached)
+      transform->upgrade();
+    bytes = cacheBytes(data.context) - before;
+
+    state.PauseTiming();
+    transform.reset();
+    state.ResumeTiming();
+  }
+  setCounters(state, data, bytes);
+}
+
+// Time applying the transform made by make(data, minimal) to a fresh
+// ciphertext
+template <typename T>
+void apply(benchmark::State& state,
+           const std::function<std::unique_ptr<T>(const Linear&, bool)>& make)
+{
+  NTL::SetNumThreads(1);
+  const Linear& data = linear();
+  const bool minimal = state.range(0);
+  const bool cached = state.range(1);
+
+  long before = cacheBytes(data.context);
+  std::unique_ptr<T> transform = make(data, minimal);
+  if (cached)
+    transform->upgrade();
+  const long bytes = cacheBytes(data.context) - before;
+
+  const helib::SecKey& secretKey = *data.keys[minimal];
+  helib::Ctxt ctxt(secretKey);
+  secretKey.Encrypt(ctxt, NTL::ZZX(1));
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    helib::Ctxt copy(ctxt);
+    state.ResumeTiming();
+    applyTo(*transform, copy);
+  }
+  setCounters(state, data, bytes);
+}
+
+std::unique_ptr<helib::MatMul1DExec> makeMatMul1D(const Linear& data,
+                                                  bool minimal)
+{
+  return std::make_unique<helib::MatMul1DExec>(*data.matrix, minimal);
+}
+
+std::unique_ptr<helib::BlockMatMul1DExec> makeBlockMatMul1D(const Linear& data,
+                                                            bool minimal)
+{
+  return std::make_unique<helib::BlockMatMul1DExec>(*data.blockMatrix,
+                                                    minimal);
+}
+
+std::unique_ptr<helib::MatMulFullExec> makeMatMulFull(const Linear& data,
+                                                      bool minimal)
+{
+  return std::make_unique<helib::MatMulFullExec>(*data.fullMatrix, minimal);
+}
+
+template <bool invert>
+std::unique_ptr<helib::EvalMap> makeEvalMap(const Linear& data, bool minimal)
+{
+  return std::make_unique<helib::EvalMap>(data.ea,
+                                          minimal,
+                                          data.mvec,
+                                          invert,
+                                          /*build_cache=*/false);
+}
+
+template <bool invert>
+std::unique_ptr<helib::ThinEvalMap> makeThinEvalMap(const Linear& data,
+                                                    bool minimal)
+{
+  return std::make_unique<helib::ThinEvalMap>(data.ea,
+                                              minimal,
+                                              data.mvec,
+                                              invert,
+                                              /*build_cache=*/false);
+}
+
+// Arguments (minimal, cached)
+void linearArgs(benchmark::internal::Benchmark* b)
+{
+  b->ArgNames({"minimal", "cached"});
+  for (long minimal : {0, 1})
+    for (long cached : {0, 1})
+      b->Args({minimal, cached});
+  b->Unit(benchmark::kMillisecond);
+}
+
+static void matmul1d_build(benchmark::State& state)
+{
+  build<helib::MatMul1DExec>(state, makeMatMul1D);
+}
+
+static void matmul1d_apply(benchmark::State& state)
+{
+  apply<helib::MatMul1DExec>(state, makeMatMul1D);
+}
+
+static void block_matmul1d_build(benchmark::State& state)
+{
+  build<helib::BlockMatMul1DExec>(state, makeBlockMatMul1D);
+}
+
+static void block_matmul1d_apply(benchmark::State& state)
+{
+  apply<helib::BlockMatMul1DExec>(state, makeBlockMatMul1D);
+}
+
+static void matmul_full_build(benchmark::State& state)
+{
+  build<helib::MatMulFullExec>(state, makeMatMulFull);
+}
+
+static void matmul_full_apply(benchmark::State& state)
+{
+  apply<helib::MatMulFullExec>(state, makeMatMulFull);
+}
+
+static void eval_map_build(benchmark::State& state)
+{
+  build<helib::EvalMap>(state, makeEvalMap<false>);
+}
+
+static void eval_map_apply(benchmark::State& state)
+{
+  apply<helib::EvalMap>(state, makeEvalMap<false>);
+}
+
+static void eval_map_inverse_apply(benchmark::State& state)
+{
+  apply<helib::EvalMap>(state, makeEvalMap<true>);
+}
+
+static void thin_eval_map_build(benchmark::State& state)
+{
+  build<helib::ThinEvalMap>(state, makeThinEvalMap<false>);
+}
+
+static void thin_eval_map_apply(benchmark::State& state)
+{
+  apply<helib::ThinEvalMap>(state, makeThinEvalMap<false>);
+}
+
+static void thin_eval_map_inverse_apply(benchmark::State& state)
+{
+  apply<helib::ThinEvalMap>(state, makeThinEvalMap<true>);
+}
+
+BENCHMARK(matmul1d_build)->Apply(linearArgs);
+BENCHMARK(matmul1d_apply)->Apply(linearArgs);
+BENCHMARK(block_matmul1d_build)->Apply(linearArgs);
+BENCHMARK(block_matmul1d_apply)->Apply(linearArgs);
+BENCHMARK(matmul_full_build)->Apply(linearArgs);
+BENCHMARK(matmul_full_apply)->Apply(linearArgs);
+BENCHMARK(eval_map_build)->Apply(linearArgs);
+BENCHMARK(eval_map_apply)->Apply(linearArgs);
+BENCHMARK(eval_map_inverse_apply)->Apply(linearArgs);
+BENCHMARK(thin_eval_map_build)->Apply(linearArgs);
+BENCHMARK(thin_eval_map_apply)->Apply(linearArgs);
+BENCHMARK(thin_eval_map_inverse_apply)->Apply(linearArgs);
+
+} // namespace
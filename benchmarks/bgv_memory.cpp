@@ -0,0 +1,210 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+// The memory taken by key-switching matrices (for each strategy of choosing
+// them), bootstrapping data, matrix caches and ciphertexts, for the
+// parameter sets of the other BGV benchmarks. The counters "bytes", "rows"
+// and "objects" are what Context::memoryReport charges to the owner, and
+// "rss_kb" the growth of the resident set of the process (see
+// memory_common.h). The times are those of building the objects.
+
+#include "bgv_common.h"
+#include "memory_common.h"
+
+#include <helib/helib.h>
+#include <helib/matmul.h>
+#include <helib/randomMatrices.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+
+namespace {
+
+void someMatrices(helib::SecKey& secretKey)
+{
+  helib::addSome1DMatrices(secretKey);
+  helib::addFrbMatrices(secretKey);
+}
+
+void minimalMatrices(helib::SecKey& secretKey)
+{
+  helib::addMinimal1DMatrices(secretKey);
+  helib::addMinimalFrbMatrices(secretKey);
+}
+
+void bsgsMatrices(helib::SecKey& secretKey)
+{
+  helib::addBSGS1DMatrices(secretKey);
+  helib::addBSGSFrbMatrices(secretKey);
+}
+
+// A secret key with the matrices that addMatrices adds, and (given a
+// bootstrappable context) the bootstrapping key
+static void key_footprint(benchmark::State& state,
+                          Meta& meta,
+                          void (*addMatrices)(helib::SecKey&))
+{
+  const helib::Context& context = meta.data->context;
+  for (auto _ : state) {
+    MemoryFootprint footprint(context);
+    helib::SecKey secretKey(context);
+    secretKey.GenSecKey();
+    addMatrices(secretKey);
+    if (context.isBootstrappable())
+      secretKey.genRecryptData();
+
+    state.PauseTiming();
+    footprint.setCounters(state, helib::MemoryCategory::KEYS);
+    state.counters["matrices"] = secretKey.keySWlist().size();
+    state.ResumeTiming();
+  }
+}
+
+// The recryption data (with the EvalMaps) of a bootstrappable context, with
+// its constants cached as DoubleCRT if cache is set. The rss_kb counter
+// is that of the whole context.
+static void recrypt_data_footprint(benchmark::State& state,
+                                   Meta& meta,
+                                   bool cache)
+{
+  const Params& params = meta.data->params;
+  for (auto _ : state) {
+    long rss = residentKB();
+    helib::Context context = helib::ContextBuilder<helib::BGV>()
+                                 .m(params.m)
+                                 .p(params.p)
+                                 .r(params.r)
+                                 .bits(params.qbits)
+                                 .gens(params.gens)
+                                 .ords(params.ords)
+                                 .bootstrappable(true)
+                                 .mvec(params.mvec)
+                                 .buildCache(cache)
+                                 .build();
+
+    state.PauseTiming();
+    const helib::MemoryUsage& usage =
+        context.memoryReport()[helib::MemoryCategory::BOOTSTRAPPING];
+    state.counters["bytes"] = usage.bytes;
+    state.counters["rows"] = usage.rows;
+    state.counters["objects"] = usage.objects;
+    state.counters["rss_kb"] = residentKB() - rss;
+    state.ResumeTiming();
+  }
+}
+
+// A MatMul1DExec along the first dimension, upgraded to DoubleCRT
+static void matmul_cache_footprint(benchmark::State& state, Meta& meta)
+{
+  const helib::EncryptedArray& ea = meta.data->ea;
+  std::unique_ptr<helib::MatMul1D> matrix(helib::buildRandomMatrix(ea, 0));
+  for (auto _ : state) {
+    MemoryFootprint footprint(meta.data->context);
+    helib::MatMul1DExec exec(*matrix);
+    exec.upgrade();
+
+    state.PauseTiming();
+    footprint.setCounters(state, helib::MemoryCategory::MATMUL_CACHE);
+    state.ResumeTiming();
+  }
+}
+
+// A fresh public-key encryption
+static void ctxt_footprint(benchmark::State& state, Meta& meta)
+{
+  for (auto _ : state) {
+    MemoryFootprint footprint(meta.data->context);
+    helib::Ctxt ctxt(meta.data->publicKey);
+    meta.data->publicKey.Encrypt(ctxt, NTL::ZZX(1));
+
+    state.PauseTiming();
+    footprint.setCounters(state, helib::MemoryCategory::CIPHERTEXTS);
+    state.ResumeTiming();
+  }
+}
+
+Meta fn;
+
+// The parameters of bgv_basic
+Params tiny_params(/*m=*/257, /*p=*/2, /*r=*/1, /*qbits=*/360);
+Params small_params(/*m=*/8009, /*p=*/2, /*r=*/1, /*qbits=*/380);
+Params big_params(/*m=*/32003, /*p=*/2, /*r=*/1, /*qbits=*/5800);
+
+// The bootstrappable parameters of bgv_thinboot and IO
+Params tiny_boot_params(/*m =*/31 * 41,
+                        /*p =*/2,
+                        /*r =*/1,
+                        /*bits =*/580,
+                        /*gens =*/std::vector<long>{1026, 249},
+                        /*ords =*/std::vector<long>{30, -2},
+                        /*mvec =*/std::vector<long>{31, 41});
+Params small_boot_params(/*m =*/31775,
+                         /*p =*/2,
+                         /*r =*/1,
+                         /*bits =*/580,
+                         /*gens =*/std::vector<long>{6976, 24806},
+                         /*ords =*/std::vector<long>{40, 30},
+                         /*mvec =*/std::vector<long>{41, 775});
+
+#define HE_MEMORY_CAPTURE(params)                                              \
+  BENCHMARK_CAPTURE(key_footprint, params##_some, fn(params), someMatrices)    \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1);                                                         \
+  BENCHMARK_CAPTURE(key_footprint,                                             \
+                    params##_minimal,                                          \
+                    fn(params),                                                \
+                    minimalMatrices)                                           \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1);                                                         \
+  BENCHMARK_CAPTURE(key_footprint, params##_bsgs, fn(params), bsgsMatrices)    \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1);                                                         \
+  BENCHMARK_CAPTURE(matmul_cache_footprint, params, fn(params))                \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1);                                                         \
+  BENCHMARK_CAPTURE(ctxt_footprint, params, fn(params))                        \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1)
+
+HE_MEMORY_CAPTURE(tiny_params);
+HE_MEMORY_CAPTURE(small_params);
+HE_MEMORY_CAPTURE(big_params);
+HE_MEMORY_CAPTURE(tiny_boot_params);
+HE_MEMORY_CAPTURE(small_boot_params);
+
+BENCHMARK_CAPTURE(recrypt_data_footprint,
+                  tiny_boot_params,
+                  fn(tiny_boot_params),
+                  false)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(recrypt_data_footprint,
+                  tiny_boot_params_cached,
+                  fn(tiny_boot_params),
+                  true)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(recrypt_data_footprint,
+                  small_boot_params,
+                  fn(small_boot_params),
+                  false)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+BENCHMARK_CAPTURE(recrypt_data_footprint,
+                  small_boot_params_cached,
+                  fn(small_boot_params),
+                  true)
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+
+} // namespace
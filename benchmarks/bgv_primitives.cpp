@@ -0,0 +1,319 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+// The primitives that dominate key switching, on their own and on a single
+// thread: the per-prime transforms, breaking into digits, the digit-by-key
+// inner products, automorphisms, mod switching and relinearization. Where
+// the hardware counters can be read, each also reports its cycles,
+// instructions and last-level cache misses (see perf_common.h).
+
+#include <NTL/BasicThreadPool.h>
+#include <helib/helib.h>
+#include "../src/PrimeGenerator.h" // Private header
+#include "perf_common.h"
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <map>
+#include <memory>
+
+namespace {
+
+// A context (m, bits, c) with p = 2, and a secret key with the matrix for
+// relinearizing s^2
+struct Primitives
+{
+  helib::Context context;
+  helib::SecKey secretKey;
+
+  Primitives(long m, long bits, long c) :
+      context(helib::ContextBuilder<helib::BGV>()
+                  .m(m)
+                  .p(2)
+                  .r(1)
+                  .bits(bits)
+                  .c(c)
+                  .build()),
+      secretKey(context)
+  {
+    secretKey.GenSecKey();
+  }
+};
+
+// The data for the arguments (m, bits, c) of state, made on first use
+Primitives& primitives(const benchmark::State& state)
+{
+  static std::map<std::array<long, 3>, std::unique_ptr<Primitives>> cache;
+  std::array<long, 3> key{state.range(0), state.range(1), state.range(2)};
+  std::unique_ptr<Primitives>& data = cache[key];
+  if (!data)
+    data = std::make_unique<Primitives>(key[0], key[1], key[2]);
+  return *data;
+}
+
+void setCounters(benchmark::State& state, const helib::Context& context)
+{
+  state.counters["phim"] = context.getPhiM();
+  state.counters["primes"] = context.getCtxtPrimes().card();
+  state.counters["special"] = context.getSpecialPrimes().card();
+  state.counters["digits"] = context.getDigits().size();
+}
+
+// A fresh ciphertext over the ctxt primes
+helib::Ctxt freshCtxt(const Primitives& data)
+{
+  helib::Ctxt ctxt(data.secretKey);
+  data.secretKey.Encrypt(ctxt, NTL::ZZX(1));
+  return ctxt;
+}
+
+// Arguments (m, bits, c): the number of primes grows with bits, and the
+// number of digits with c
+void primitiveArgs(benchmark::internal::Benchmark* b)
+{
+  b->ArgNames({"m", "bits", "c"});
+  b->Args({4369, 150, 2});
+  b->Args({4369, 150, 3});
+  b->Args({4369, 300, 2});
+  b->Args({21845, 300, 2});
+  b->Args({21845, 600, 2});
+  b->Args({21845, 600, 3});
+  b->Unit(benchmark::kMicrosecond);
+}
+
+// Arguments (m, bits, c) with m a power of two, the only case that HEXL
+// accelerates: with USE_INTEL_HEXL, these compare the HEXL kernels with the
+// built-in ones on the same shapes
+void powerOfTwoArgs(benchmark::internal::Benchmark* b)
+{
+  b->ArgNames({"m", "bits", "c"});
+  b->Args({8192, 300, 2});
+  b->Args({32768, 600, 2});
+  b->Args({32768, 600, 3});
+  b->Unit(benchmark::kMicrosecond);
+}
+
+// Arguments (m, prime bits) of the single-prime transforms
+void transformArgs(benchmark::internal::Benchmark* b)
+{
+  b->ArgNames({"m", "qbits"});
+  for (long m : {4369, 21845})
+    for (long bits : {30, 45, 55})
+      b->Args({m, bits});
+  b->Unit(benchmark::kMicrosecond);
+}
+
+static void cmodulus_fft(benchmark::State& state)
+{
+  NTL::SetNumThreads(1);
+  helib::PAlgebra zms(state.range(0), 2);
+  helib::PrimeGenerator primes(state.range(1), zms.getM());
+  helib::Cmodulus cmod(zms, primes.next(), 0);
+
+  helib::zzX poly;
+  poly.SetLength(zms.getPhiM());
+  for (long i = 0; i < poly.length(); i++)
+    poly[i] = NTL::RandomBnd(1L << 20) - (1L << 19);
+  NTL::vec_long y;
+
+  PerfCounters perf;
+  for (auto _ : state)
+    cmod.FFT(y, poly);
+  perf.setCounters(state);
+  state.counters["phim"] = zms.getPhiM();
+}
+
+static void cmodulus_ifft(benchmark::State& state)
+{
+  NTL::SetNumThreads(1);
+  helib::PAlgebra zms(state.range(0), 2);
+  helib::PrimeGenerator primes(state.range(1), zms.getM());
+  helib::Cmodulus cmod(zms, primes.next(), 0);
+
+  NTL::vec_long y, x;
+  y.SetLength(zms.getPhiM());
+  for (long i = 0; i < y.length(); i++)
+    y[i] = NTL::RandomBnd(cmod.getQ());
+
+  PerfCounters perf;
+  for (auto _ : state)
+    cmod.iFFT(x, y);
+  perf.setCounters(state);
+  state.counters["phim"] = zms.getPhiM();
+}
+
+static void break_into_digits(benchmark::State& state)
+{
+  NTL::SetNumThreads(1);
+  const Primitives& data = primitives(state);
+  const helib::Context& context = data.context;
+  helib::DoubleCRT poly(context, context.getCtxtPrimes());
+  poly.randomize();
+  std::vector<helib::DoubleCRT> digits;
+
+  PerfCounters perf;
+  for (auto _ : state) {
+    poly.breakIntoDigits(digits);
+    benchmark::DoNotOptimize(digits.data());
+  }
+  perf.setCounters(state);
+  setCounters(state, context);
+}
+
+// The work of Ctxt::keySwitchDigits (which is private): regenerating the
+// a_i's unless W keeps them, and the two inner products with the digits
+static void keySwitchDigits(benchmark::State& state, bool materializeA)
+{
+  NTL::SetNumThreads(1);
+  const Primitives& data = primitives(state);
+  const helib::Context& context = data.context;
+  helib::KeySwitch W = data.secretKey.getKeySWmatrix(helib::SKHandle(2, 1, 0));
+  if (materializeA)
+    W.materializeA(context);
+  const auto b = W.residentB();
+
+  helib::DoubleCRT poly(context, context.getCtxtPrimes());
+  poly.randomize();
+  std::vector<helib::DoubleCRT> digits;
+  poly.breakIntoDigits(digits);
+  const helib::IndexSet& s = digits[0].getIndexSet();
+
+  PerfCounters perf;
+  for (auto _ : state) {
+    const std::vector<helib::DoubleCRT>* a = W.getExpandedA();
+    std::vector<helib::DoubleCRT> generated;
+    if (a == nullptr) {
+      generated.assign(
+          digits.size(),
+          helib::DoubleCRT(context,
+                           W.hasIndexedSeed() ? s : context.fullPrimes()));
+      W.generateA(generated);
+      a = &generated;
+    }
+    helib::DoubleCRT sum(context, s);
+    sum.innerProduct(digits, *a);
+    sum.innerProduct(digits, *b);
+    benchmark::DoNotOptimize(sum);
+  }
+  perf.setCounters(state);
+  setCounters(state, context);
+}
+
+static void key_switch_digits(benchmark::State& state)
+{
+  keySwitchDigits(state, /*materializeA=*/false);
+}
+
+static void key_switch_digits_materialized(benchmark::State& state)
+{
+  keySwitchDigits(state, /*materializeA=*/true);
+}
+
+static void dcrt_automorph(benchmark::State& state)
+{
+  NTL::SetNumThreads(1);
+  const Primitives& data = primitives(state);
+  const helib::Context& context = data.context;
+  long k = context.getZMStar().ZmStarGen(0);
+  helib::DoubleCRT poly(context, context.fullPrimes());
+  poly.randomize();
+
+  PerfCounters perf;
+  for (auto _ : state)
+    poly.automorph(k);
+  perf.setCounters(state);
+  setCounters(state, context);
+}
+
+// Adding the special primes, as key switching does
+static void mod_up_to_set(benchmark::State& state)
+{
+  NTL::SetNumThreads(1);
+  const Primitives& data = primitives(state);
+  const helib::Context& context = data.context;
+  const helib::Ctxt ctxt = freshCtxt(data);
+  const helib::IndexSet up = ctxt.getPrimeSet() | context.getSpecialPrimes();
+
+  PerfCounters perf;
+  for (auto _ : state) {
+    state.PauseTiming();
+    perf.pause();
+    helib::Ctxt copy(ctxt);
+    perf.resume();
+    state.ResumeTiming();
+    copy.modUpToSet(up);
+  }
+  perf.setCounters(state);
+  setCounters(state, context);
+}
+
+// Dropping the special primes again, at the end of key switching
+static void mod_down_to_set(benchmark::State& state)
+{
+  NTL::SetNumThreads(1);
+  const Primitives& data = primitives(state);
+  const helib::Context& context = data.context;
+  const helib::Ctxt ctxt = freshCtxt(data);
+  helib::Ctxt up(ctxt);
+  up.modUpToSet(ctxt.getPrimeSet() | context.getSpecialPrimes());
+
+  PerfCounters perf;
+  for (auto _ : state) {
+    state.PauseTiming();
+    perf.pause();
+    helib::Ctxt copy(up);
+    perf.resume();
+    state.ResumeTiming();
+    copy.modDownToSet(ctxt.getPrimeSet());
+  }
+  perf.setCounters(state);
+  setCounters(state, context);
+}
+
+static void relinearize(benchmark::State& state)
+{
+  NTL::SetNumThreads(1);
+  const Primitives& data = primitives(state);
+  const helib::Ctxt ctxt = freshCtxt(data);
+  helib::Ctxt product(ctxt);
+  product.multLowLvl(ctxt); // three parts, (1, s, s^2)
+
+  PerfCounters perf;
+  for (auto _ : state) {
+    state.PauseTiming();
+    perf.pause();
+    helib::Ctxt copy(product);
+    perf.resume();
+    state.ResumeTiming();
+    copy.reLinearize();
+  }
+  perf.setCounters(state);
+  setCounters(state, data.context);
+}
+
+BENCHMARK(cmodulus_fft)->Apply(transformArgs);
+BENCHMARK(cmodulus_ifft)->Apply(transformArgs);
+BENCHMARK(break_into_digits)->Apply(primitiveArgs);
+BENCHMARK(key_switch_digits)->Apply(primitiveArgs);
+BENCHMARK(key_switch_digits_materialized)->Apply(primitiveArgs);
+BENCHMARK(dcrt_automorph)->Apply(primitiveArgs);
+BENCHMARK(mod_up_to_set)->Apply(primitiveArgs);
+BENCHMARK(mod_down_to_set)->Apply(primitiveArgs);
+BENCHMARK(relinearize)->Apply(primitiveArgs);
+BENCHMARK(break_into_digits)->Apply(powerOfTwoArgs);
+BENCHMARK(key_switch_digits)->Apply(powerOfTwoArgs);
+BENCHMARK(dcrt_automorph)->Apply(powerOfTwoArgs);
+BENCHMARK(mod_down_to_set)->Apply(powerOfTwoArgs);
+BENCHMARK(relinearize)->Apply(powerOfTwoArgs);
+
+} // namespace
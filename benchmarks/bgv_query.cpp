@@ -0,0 +1,253 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+// Encrypted queries end to end: Database::contains and Database::getScore
+// of partialMatch.h, and calculateSetIntersection of set.h.
+//
+// The database lookups sweep the number of rows and columns of the
+// database and the shape of the query (see queryExpr), with the query
+// encrypted and the database either encrypted (encrypted_db=1) or not. The
+// set intersections sweep the size of the server set, with the query set
+// either encrypted or not. Besides the latency each run reports the queries
+// per second, the database rows (or set elements) scanned per second and
+// the peak resident set size of the process so far, in kB.
+
+#include <helib/helib.h>
+#include <helib/partialMatch.h>
+#include <helib/query.h>
+#include <helib/set.h>
+
+#include <benchmark/benchmark.h>
+
+#include <sys/resource.h>
+
+#include <memory>
+#include <vector>
+
+namespace {
+
+// The parameters of TestPartialMatch and TestSet
+struct QueryKeys
+{
+  helib::Context context;
+  helib::SecKey secretKey;
+
+  QueryKeys(long m, long p, long bits) :
+      context(helib::ContextBuilder<helib::BGV>()
+                  .m(m)
+                  .p(p)
+                  .r(1)
+                  .bits(bits)
+                  .build()),
+      secretKey(context)
+  {
+    secretKey.GenSecKey();
+    helib::addSome1DMatrices(secretKey);
+    helib::addFrbMatrices(secretKey);
+  }
+};
+
+QueryKeys& lookupKeys()
+{
+  static QueryKeys data(1024, 1087, 700);
+  return data;
+}
+
+QueryKeys& setKeys()
+{
+  static QueryKeys data(771, 2, 700);
+  return data;
+}
+
+// The peak resident set size of the process (in kB on Linux)
+long peakRSS()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+void setCounters(benchmark::State& state, long scanned)
+{
+  state.SetItemsProcessed(state.iterations() * scanned);
+  state.counters["queries"] =
+      benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+  state.counters["peak_rss_kb"] = peakRSS();
+}
+
+// The query over columns [0, cols) of the given kind:
+//  0: c0 && c1 && ... (no OR, so no Fermat step)
+//  1: (c0 || c1) && c2 && ... (a single OR)
+//  2: (c0 || c1) && (c2 || c3) && ... (as many ORs as can be)
+helib::QueryExpr queryExpr(long kind, long cols)
+{
+  auto column = helib::makeQueryExpr;
+  if (kind == 0) {
+    helib::QueryExpr expr = column(0);
+    for (long i = 1; i < cols; i++)
+      expr = expr && column(i);
+    return expr;
+  }
+  helib::QueryExpr expr = column(0) || column(1);
+  for (long i = 2; i < cols; i++)
+    if (kind == 2 && i + 1 < cols) {
+      expr = expr && (column(i) || column(i + 1));
+      i++;
+    } else
+      expr = expr && column(i);
+  return expr;
+}
+
+// A random rows x cols plaintext database, with entries in [0, p)
+helib::Matrix<helib::Ptxt<helib::BGV>> randomDatabase(
+    const helib::Context& context,
+    long rows,
+    long cols)
+{
+  helib::Matrix<helib::Ptxt<helib::BGV>> data(helib::Ptxt<helib::BGV>(context),
+                                              rows,
+                                              cols);
+  std::vector<long> values(context.getEA().size());
+  for (long i = 0; i < rows; i++)
+    for (long j = 0; j < cols; j++) {
+      for (long& v : values)
+        v = NTL::RandomBnd(context.getP());
+      data(i, j) = helib::Ptxt<helib::BGV>(context, values);
+    }
+  return data;
+}
+
+helib::Matrix<helib::Ctxt> encrypt(
+    const helib::SecKey& secretKey,
+    const helib::Matrix<helib::Ptxt<helib::BGV>>& data)
+{
+  helib::Matrix<helib::Ctxt> encrypted(helib::Ctxt(secretKey),
+                                       data.dims(0),
+                                       data.dims(1));
+  for (std::size_t i = 0; i < data.dims(0); i++)
+    for (std::size_t j = 0; j < data.dims(1); j++)
+      secretKey.Encrypt(encrypted(i, j), data(i, j));
+  return encrypted;
+}
+
+// Time run(database, lookupQuery, queryData) on a random database of the
+// arguments (encrypted_db, rows, cols, query) of state, with its first row
+// (encrypted) as the query data
+template <typename Run>
+void lookup(benchmark::State& state, Run run)
+{
+  const QueryKeys& data = lookupKeys();
+  const bool encryptedDB = state.range(0);
+  const long rows = state.range(1);
+  const long cols = state.range(2);
+
+  helib::Matrix<helib::Ptxt<helib::BGV>> plain =
+      randomDatabase(data.context, rows, cols);
+  helib::Matrix<helib::Ptxt<helib::BGV>> queryRow = plain.getRow(0);
+  helib::Matrix<helib::Ctxt> query = encrypt(data.secretKey, queryRow);
+  helib::QueryType lookupQuery =
+      helib::QueryBuilder(queryExpr(state.range(3), cols)).build(cols);
+
+  if (encryptedDB) {
+    helib::Database<helib::Ctxt> database(encrypt(data.secretKey, plain),
+                                          data.context);
+    for (auto _ : state)
+      benchmark::DoNotOptimize(run(database, lookupQuery, query));
+  } else {
+    helib::Database<helib::Ptxt<helib::BGV>> database(plain, data.context);
+    for (auto _ : state)
+      benchmark::DoNotOptimize(run(database, lookupQuery, query));
+  }
+  setCounters(state, rows);
+}
+
+static void database_contains(benchmark::State& state)
+{
+  lookup(state, [](const auto& database, const auto& q, const auto& query) {
+    return database.contains(q, query);
+  });
+}
+
+static void database_get_score(benchmark::State& state)
+{
+  lookup(state, [](const auto& database, const auto& q, const auto& query) {
+    return database.getScore(q, query);
+  });
+}
+
+// A set element as a polynomial, with the bits of x as its coefficients
+NTL::ZZX elementPoly(long x)
+{
+  NTL::ZZX poly;
+  for (long i = 0; x != 0; i++, x >>= 1)
+    SetCoeff(poly, i, x & 1);
+  return poly;
+}
+
+// A server set of 1, ..., n and a query set of random elements up to 2n
+static void set_intersection(benchmark::State& state)
+{
+  const QueryKeys& data = setKeys();
+  const bool encryptedQuery = state.range(0);
+  const long n = state.range(1);
+
+  std::vector<NTL::ZZX> serverSet;
+  serverSet.reserve(n);
+  for (long i = 1; i <= n; i++)
+    serverSet.push_back(elementPoly(i));
+
+  std::vector<NTL::ZZX> elements(data.context.getEA().size());
+  for (NTL::ZZX& element : elements)
+    element = elementPoly(1 + NTL::RandomBnd(2 * n));
+  helib::Ptxt<helib::BGV> querySet(data.context, elements);
+
+  if (encryptedQuery) {
+    helib::Ctxt query(data.secretKey);
+    data.secretKey.Encrypt(query, querySet);
+    for (auto _ : state)
+      benchmark::DoNotOptimize(
+          helib::calculateSetIntersection(query, serverSet));
+  } else {
+    for (auto _ : state)
+      benchmark::DoNotOptimize(
+          helib::calculateSetIntersection(querySet, serverSet));
+  }
+  setCounters(state, n);
+}
+
+// Arguments (encrypted_db, rows, cols, query)
+void lookupArgs(benchmark::internal::Benchmark* b)
+{
+  b->ArgNames({"encrypted_db", "rows", "cols", "query"});
+  for (long encryptedDB : {0, 1})
+    for (long rows : {1, 4, 16})
+      for (long cols : {2, 4, 8})
+        for (long query : {0, 1, 2})
+          b->Args({encryptedDB, rows, cols, query});
+  b->Unit(benchmark::kMillisecond);
+}
+
+// Arguments (encrypted_query, server set size)
+void setArgs(benchmark::internal::Benchmark* b)
+{
+  b->ArgNames({"encrypted_query", "server"});
+  for (long encryptedQuery : {0, 1})
+    for (long n : {16, 64, 256, 1024})
+      b->Args({encryptedQuery, n});
+  b->Unit(benchmark::kMillisecond);
+}
+
+BENCHMARK(database_contains)->Apply(lookupArgs);
+BENCHMARK(database_get_score)->Apply(lookupArgs);
+BENCHMARK(set_intersection)->Apply(setArgs);
+
+} // namespace
@@ -0,0 +1,299 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+// How the parallel operations scale with the number of threads: a 1D
+// matrix multiplication, thin bootstrapping, adding many encrypted numbers
+// and applying an operation to a matrix of ciphertexts, each run with 1, 2,
+// 4, ... threads up to the hardware concurrency. Every run reports its
+// speedup over the 1-thread run of the same workload, and its efficiency
+// (the speedup per thread). The batch variants push several ciphertexts
+// through one call, which measures throughput rather than latency.
+//
+// The threads are those of the NTL thread pool, and with HELIB_THREADS also
+// those of a TaskScheduler (the "scheduler" argument).
+
+#include <NTL/BasicThreadPool.h>
+#include <helib/helib.h>
+#include <helib/binaryArith.h>
+#include <helib/intraSlot.h>
+#include <helib/matmul.h>
+#include <helib/randomMatrices.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// The tiny thin bootstrapping parameters of bgv_thinboot, with the keys for
+// the matrix multiplications and for bootstrapping
+struct Scaling
+{
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::EncryptedArray& ea;
+  std::unique_ptr<helib::MatMul1D> matrix;
+  std::vector<helib::zzX> unpackSlotEncoding;
+
+  Scaling() :
+      context(helib::ContextBuilder<helib::BGV>()
+                  .m(31 * 41)
+                  .p(2)
+                  .r(1)
+                  .gens({1026, 249})
+                  .ords({30, -2})
+                  .bits(580)
+                  .c(2)
+                  .bootstrappable(true)
+                  .skHwt(64)
+                  .mvec({31, 41})
+                  .build()),
+      secretKey(context),
+      ea(context.getEA())
+  {
+    secretKey.GenSecKey();
+    helib::addSome1DMatrices(secretKey);
+    helib::addFrbMatrices(secretKey);
+    secretKey.genRecryptData();
+    matrix.reset(helib::buildRandomMatrix(ea, 0));
+    helib::buildUnpackSlotEncoding(unpackSlotEncoding, ea);
+  }
+
+  helib::Ctxt encryptBits() const
+  {
+    std::vector<long> bits(ea.size());
+    for (long& bit : bits)
+      bit = NTL::RandomBnd(2);
+    helib::Ctxt ctxt(secretKey);
+    ea.encrypt(ctxt, secretKey, bits);
+    return ctxt;
+  }
+};
+
+Scaling& scaling()
+{
+  static Scaling data;
+  return data;
+}
+
+// Use state.range(0) threads, from the NTL pool or (if state.range(1) is
+// set) from a TaskScheduler
+void setThreads(const benchmark::State& state)
+{
+  NTL::SetNumThreads(state.range(0));
+#ifdef HELIB_THREADS
+  helib::SetTaskThreads(state.range(1) ? state.range(0) : 1);
+#endif
+}
+
+void resetThreads()
+{
+#ifdef HELIB_THREADS
+  helib::SetTaskThreads(1);
+#endif
+  NTL::SetNumThreads(1);
+}
+
+// Time work() alone, after an untimed prepare() on each iteration, and set
+// the scaling counters against the 1-thread run of the same workload
+void measure(benchmark::State& state,
+             const std::string& name,
+             long items,
+             const std::function<void()>& prepare,
+             const std::function<void()>& work)
+{
+  // the mean seconds per iteration of the 1-thread runs, by workload; the
+  // thread counts are registered in increasing order, so it is set first
+  static std::map<std::string, double> baseline;
+
+  setThreads(state);
+  double total = 0;
+  for (auto _ : state) {
+    prepare();
+    auto start = std::chrono::steady_clock::now();
+    work();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    state.SetIterationTime(elapsed.count());
+    total += elapsed.count();
+  }
+  resetThreads();
+
+  const long threads = state.range(0);
+  const std::string workload = name + (state.range(1) ? "/scheduler" : "");
+  const double mean = total / state.iterations();
+  if (threads == 1)
+    baseline[workload] = mean;
+
+  state.counters["threads"] = threads;
+  auto it = baseline.find(workload);
+  if (it != baseline.end() && mean > 0) {
+    double speedup = it->second / mean;
+    state.counters["speedup"] = speedup;
+    state.counters["efficiency"] = speedup / threads;
+  }
+  state.SetItemsProcessed(state.iterations() * items);
+}
+
+// Arguments (threads, scheduler): powers of two up to the number of hardware
+// threads, and that number itself
+void threadArgs(benchmark::internal::Benchmark* b)
+{
+  b->ArgNames({"threads", "scheduler"});
+  long max = std::max(1u, std::thread::hardware_concurrency());
+#ifdef HELIB_THREADS
+  std::vector<long> schedulers{0, 1};
+#else
+  std::vector<long> schedulers{0};
+#endif
+  for (long scheduler : schedulers) {
+    long t = 1;
+    for (; t <= max; t *= 2)
+      b->Args({t, scheduler});
+    if (t / 2 != max)
+      b->Args({max, scheduler});
+  }
+  b->UseManualTime();
+  b->Unit(benchmark::kMillisecond);
+}
+
+constexpr long BATCH = 8;
+
+static void matmul1d(benchmark::State& state)
+{
+  Scaling& data = scaling();
+  helib::MatMul1DExec exec(*data.matrix);
+  exec.upgrade();
+  const helib::Ctxt ctxt = data.encryptBits();
+  helib::Ctxt copy(ctxt);
+
+  measure(
+      state,
+      "matmul1d",
+      1,
+      [&] { copy = ctxt; },
+      [&] { exec.mul(copy); });
+}
+
+static void matmul1d_batch(benchmark::State& state)
+{
+  Scaling& data = scaling();
+  helib::MatMul1DExec exec(*data.matrix);
+  exec.upgrade();
+  const std::vector<helib::Ctxt> ctxts(BATCH, data.encryptBits());
+  std::vector<helib::Ctxt> copies;
+
+  measure(
+      state,
+      "matmul1d_batch",
+      BATCH,
+      [&] { copies = ctxts; },
+      [&] { exec.mul(copies); });
+}
+
+// A ciphertext with too little capacity left to square, as it is when a
+// computation bootstraps
+helib::Ctxt exhaustedCtxt(const Scaling& data)
+{
+  helib::Ctxt ctxt = data.encryptBits();
+  while (ctxt.bitCapacity() > 50)
+    ctxt.square();
+  return ctxt;
+}
+
+static void thin_recrypt(benchmark::State& state)
+{
+  Scaling& data = scaling();
+  const helib::Ctxt ctxt = exhaustedCtxt(data);
+  helib::Ctxt copy(ctxt);
+
+  measure(
+      state,
+      "thin_recrypt",
+      1,
+      [&] { copy = ctxt; },
+      [&] { data.secretKey.thinReCrypt(copy); });
+}
+
+static void thin_recrypt_batch(benchmark::State& state)
+{
+  Scaling& data = scaling();
+  const std::vector<helib::Ctxt> ctxts(BATCH, exhaustedCtxt(data));
+  std::vector<helib::Ctxt> copies;
+
+  measure(
+      state,
+      "thin_recrypt_batch",
+      BATCH,
+      [&] { copies = ctxts; },
+      [&] { data.secretKey.thinReCrypt(copies); });
+}
+
+// Adding 8 encrypted 8-bit numbers into a 16-bit sum
+static void add_many_numbers(benchmark::State& state)
+{
+  Scaling& data = scaling();
+  const long numbers = 8, bitSize = 8, outSize = 16;
+  std::vector<std::vector<helib::Ctxt>> summands(numbers);
+  for (std::vector<helib::Ctxt>& bits : summands) {
+    bits.reserve(bitSize);
+    for (long i = 0; i < bitSize; i++)
+      bits.push_back(data.encryptBits());
+  }
+  helib::CtPtrMat_vectorCt summandsWrapper(summands);
+  std::vector<helib::Ctxt> sum;
+
+  measure(
+      state,
+      "add_many_numbers",
+      numbers,
+      [&] { sum.assign(outSize, helib::Ctxt(data.secretKey)); },
+      [&] {
+        helib::CtPtrs_vectorCt sumWrapper(sum);
+        helib::addManyNumbers(sumWrapper,
+                              summandsWrapper,
+                              outSize,
+                              &data.unpackSlotEncoding);
+      });
+}
+
+// Squaring every entry of a 4x4 matrix of ciphertexts
+static void matrix_apply(benchmark::State& state)
+{
+  Scaling& data = scaling();
+  const long dim = 4;
+  const helib::Ctxt ctxt = data.encryptBits();
+  helib::Matrix<helib::Ctxt> entries(ctxt, dim, dim);
+
+  measure(
+      state,
+      "matrix_apply",
+      dim * dim,
+      [&] { entries = helib::Matrix<helib::Ctxt>(ctxt, dim, dim); },
+      [&] { entries.apply([](helib::Ctxt& x) { x.square(); }); });
+}
+
+BENCHMARK(matmul1d)->Apply(threadArgs);
+BENCHMARK(matmul1d_batch)->Apply(threadArgs);
+BENCHMARK(thin_recrypt)->Apply(threadArgs);
+BENCHMARK(thin_recrypt_batch)->Apply(threadArgs);
+BENCHMARK(add_many_numbers)->Apply(threadArgs);
+BENCHMARK(matrix_apply)->Apply(threadArgs);
+
+} // namespace
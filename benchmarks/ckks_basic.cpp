@@ -27,9 +27,12 @@
 
 #include <helib/helib.h>
 #include <helib/debugging.h>
+#include <helib/ctxtMatMul.h>
 
 #include <benchmark/benchmark.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <memory>
 
@@ -235,6 +238,31 @@ static void multiply_and_add_two_ciphertexts(benchmark::State& state,
   }
 }
 
+// The largest square matrices that fit in the slots, up to 32 x 32
+static void multiplying_two_encrypted_matrices(benchmark::State& state,
+                                               Meta& meta)
+{
+  const helib::EncryptedArray& ea = meta.data->ea;
+  long d = std::min(32L, long(std::sqrt(double(ea.size()))));
+  helib::CtxtMatMul matmul(ea, d);
+
+  helib::Ptxt<helib::CKKS> ptxt1(meta.data->context);
+  helib::Ptxt<helib::CKKS> ptxt2(meta.data->context);
+  ptxt1.random();
+  ptxt2.random();
+  helib::Ctxt ctxt1(meta.data->publicKey);
+  helib::Ctxt ctxt2(meta.data->publicKey);
+  meta.data->publicKey.Encrypt(ctxt1, ptxt1);
+  meta.data->publicKey.Encrypt(ctxt2, ptxt2);
+
+  helib::Ctxt product(meta.data->publicKey);
+  for (auto _ : state) {
+    matmul.mul(product, ctxt1, ctxt2);
+    benchmark::DoNotOptimize(product);
+  }
+  state.counters["d"] = d;
+}
+
 Meta fn;
 Params tiny_params(/*m=*/1024, /*precision=*/1, /*qbits=*/360);
 HE_BENCH_CAPTURE(adding_two_ciphertexts, tiny_params, fn);
@@ -247,6 +275,7 @@ HE_BENCH_CAPTURE(rotate_a_ciphertext_by1, tiny_params, fn);
 HE_BENCH_CAPTURE(encrypting_ciphertexts, tiny_params, fn);
 HE_BENCH_CAPTURE(decrypting_ciphertexts, tiny_params, fn);
 HE_BENCH_CAPTURE(multiply_and_add_two_ciphertexts, tiny_params, fn);
+HE_BENCH_CAPTURE(multiplying_two_encrypted_matrices, tiny_params, fn);
 
 Params small_params(/*m=*/16384, /*precision=*/1, /*qbits=*/360);
 HE_BENCH_CAPTURE(adding_two_ciphertexts, small_params, fn);
@@ -259,6 +288,7 @@ HE_BENCH_CAPTURE(rotate_a_ciphertext_by1, small_params, fn);
 HE_BENCH_CAPTURE(encrypting_ciphertexts, small_params, fn);
 HE_BENCH_CAPTURE(decrypting_ciphertexts, small_params, fn);
 HE_BENCH_CAPTURE(multiply_and_add_two_ciphertexts, small_params, fn);
+HE_BENCH_CAPTURE(multiplying_two_encrypted_matrices, small_params, fn);
 
 Params big_params(/*m=*/65536, /*precision=*/1, /*qbits=*/440);
 HE_BENCH_CAPTURE(adding_two_ciphertexts, big_params, fn);
@@ -271,5 +301,6 @@ HE_BENCH_CAPTURE(rotate_a_ciphertext_by1, big_params, fn);
 HE_BENCH_CAPTURE(encrypting_ciphertexts, big_params, fn);
 HE_BENCH_CAPTURE(decrypting_ciphertexts, big_params, fn);
 HE_BENCH_CAPTURE(multiply_and_add_two_ciphertexts, big_params, fn);
+HE_BENCH_CAPTURE(multiplying_two_encrypted_matrices, big_params, fn);
 
 } // namespace
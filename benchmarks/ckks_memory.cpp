@@ -0,0 +1,106 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+// The memory taken by key-switching matrices and ciphertexts for the CKKS
+// parameter sets of ckks_basic, as in bgv_memory.
+
+#include "ckks_common.h"
+#include "memory_common.h"
+
+#include <helib/helib.h>
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+void someMatrices(helib::SecKey& secretKey)
+{
+  helib::addSome1DMatrices(secretKey);
+}
+
+void minimalMatrices(helib::SecKey& secretKey)
+{
+  helib::addMinimal1DMatrices(secretKey);
+}
+
+void bsgsMatrices(helib::SecKey& secretKey)
+{
+  helib::addBSGS1DMatrices(secretKey);
+}
+
+static void ckks_key_footprint(benchmark::State& state,
+                          Meta& meta,
+                          void (*addMatrices)(helib::SecKey&))
+{
+  const helib::Context& context = meta.data->context;
+  for (auto _ : state) {
+    MemoryFootprint footprint(context);
+    helib::SecKey secretKey(context);
+    secretKey.GenSecKey();
+    addMatrices(secretKey);
+
+    state.PauseTiming();
+    footprint.setCounters(state, helib::MemoryCategory::KEYS);
+    state.counters["matrices"] = secretKey.keySWlist().size();
+    state.ResumeTiming();
+  }
+}
+
+static void ckks_ctxt_footprint(benchmark::State& state, Meta& meta)
+{
+  helib::PtxtArray ptxt(meta.data->ea);
+  ptxt.random();
+  for (auto _ : state) {
+    MemoryFootprint footprint(meta.data->context);
+    helib::Ctxt ctxt(meta.data->publicKey);
+    ptxt.encrypt(ctxt);
+
+    state.PauseTiming();
+    footprint.setCounters(state, helib::MemoryCategory::CIPHERTEXTS);
+    state.ResumeTiming();
+  }
+}
+
+Meta fn;
+
+Params tiny_params(/*m=*/1024, /*precision=*/1, /*qbits=*/360);
+Params small_params(/*m=*/16384, /*precision=*/1, /*qbits=*/360);
+Params big_params(/*m=*/65536, /*precision=*/1, /*qbits=*/440);
+
+#define HE_MEMORY_CAPTURE(params)                                              \
+  BENCHMARK_CAPTURE(ckks_key_footprint,                                        \
+                    params##_some,                                             \
+                    fn(params),                                                \
+                    someMatrices)                                              \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1);                                                         \
+  BENCHMARK_CAPTURE(ckks_key_footprint,                                        \
+                    params##_minimal,                                          \
+                    fn(params),                                                \
+                    minimalMatrices)                                           \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1);                                                         \
+  BENCHMARK_CAPTURE(ckks_key_footprint,                                        \
+                    params##_bsgs,                                             \
+                    fn(params),                                                \
+                    bsgsMatrices)                                              \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1);                                                         \
+  BENCHMARK_CAPTURE(ckks_ctxt_footprint, params, fn(params))                   \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1)
+
+HE_MEMORY_CAPTURE(tiny_params);
+HE_MEMORY_CAPTURE(small_params);
+HE_MEMORY_CAPTURE(big_params);
+
+} // namespace
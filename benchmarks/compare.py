@@ -0,0 +1,238 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2020 IBM Corp.
+# This program is Licensed under the Apache License, Version 2.0
+# (the "License"); you may not use this file except in compliance
+# with the License. You may obtain a copy of the License at
+#   http://www.apache.org/licenses/LICENSE-2.0
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License. See accompanying LICENSE file.
+
+"""Run benchmark suites, record the results and compare them to a baseline.
+
+The suites (benchmark executables of this directory) are run with repeated
+measurements, and their Google Benchmark JSON output is merged into one file
+whose context also records the HElib version and build options (from
+helib_bench_info) and the CPU. Given a baseline (such a file from an earlier
+run), each benchmark is compared with Welch's t-test on its repetitions,
+and the script exits with status 1 if any benchmark got slower by more than
+the threshold with significance.
+"""
+
+import argparse
+import json
+import math
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+
+NS_PER_UNIT = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def betacf(a, b, x):
+    """Continued fraction of the incomplete beta function (Lentz)."""
+    tiny = 1e-300
+    c, d = 1.0, 1.0 - (a + b) * x / (a + 1.0)
+    d = 1.0 / (d if abs(d) > tiny else tiny)
+    h = d
+    for m in range(1, 300):
+        for num in (m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m)),
+                    -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))):
+            d = 1.0 + num * d
+            d = 1.0 / (d if abs(d) > tiny else tiny)
+            c = 1.0 + num / c
+            c = c if abs(c) > tiny else tiny
+            h *= d * c
+        if abs(d * c - 1.0) < 1e-12:
+            break
+    return h
+
+
+def betainc(a, b, x):
+    """The regularized incomplete beta function I_x(a, b)."""
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+    front = math.exp(math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b)
+                     + a * math.log(x) + b * math.log(1.0 - x))
+    if x < (a + 1.0) / (a + b + 2.0):
+        return front * betacf(a, b, x) / a
+    return 1.0 - front * betacf(b, a, 1.0 - x) / b
+
+
+def t_sf2(t, df):
+    """Two-sided tail probability of Student's t with df degrees of freedom."""
+    return betainc(df / 2.0, 0.5, df / (df + t * t))
+
+
+def t_quantile(p, df):
+    """The t with a two-sided tail probability of p, by bisection."""
+    lo, hi = 0.0, 1e3
+    for _ in range(200):
+        mid = (lo + hi) / 2.0
+        if t_sf2(mid, df) > p:
+            lo = mid
+        else:
+            hi = mid
+    return hi
+
+
+def summarize(times, alpha):
+    n = len(times)
+    mean = sum(times) / n
+    var = sum((t - mean) ** 2 for t in times) / (n - 1) if n > 1 else 0.0
+    half = t_quantile(alpha, n - 1) * math.sqrt(var / n) if n > 1 else 0.0
+    return {"n": n, "mean": mean, "var": var, "ci": half}
+
+
+def welch_p(a, b):
+    """Two-sided p-value of Welch's t-test on two summaries."""
+    sa, sb = a["var"] / a["n"], b["var"] / b["n"]
+    if a["n"] < 2 or b["n"] < 2 or sa + sb == 0.0:
+        return 0.0 if a["mean"] != b["mean"] else 1.0
+    t = (b["mean"] - a["mean"]) / math.sqrt(sa + sb)
+    df = (sa + sb) ** 2 / (sa ** 2 / (a["n"] - 1) + sb ** 2 / (b["n"] - 1))
+    return t_sf2(abs(t), df)
+
+
+def repetitions(results):
+    """The real times (in ns) of the repetitions of each benchmark."""
+    times = {}
+    for b in results["benchmarks"]:
+        if b.get("run_type", "iteration") != "iteration":
+            continue
+        name = b.get("run_name", b["name"])
+        scale = NS_PER_UNIT[b.get("time_unit", "ns")]
+        times.setdefault(name, []).append(b["real_time"] * scale)
+    return times
+
+
+def cpu_model():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    return line.split(":", 1)[1].strip()
+    except OSError:
+        pass
+    return platform.processor() or platform.machine()
+
+
+def build_info(bin_dir):
+    info_exe = os.path.join(bin_dir, "helib_bench_info")
+    info = {}
+    if os.path.exists(info_exe):
+        info = json.loads(subprocess.check_output([info_exe]).decode())
+    info["cpu_model"] = cpu_model()
+    info["machine"] = platform.machine()
+    return info
+
+
+def run_suites(args):
+    merged = None
+    for suite in args.suites:
+        exe = os.path.join(args.bin_dir, suite)
+        with tempfile.NamedTemporaryFile(suffix=".json", delete=False) as f:
+            out = f.name
+        cmd = [exe,
+               f"--benchmark_repetitions={args.repetitions}",
+               f"--benchmark_out={out}",
+               "--benchmark_out_format=json"]
+        if args.filter:
+            cmd.append(f"--benchmark_filter={args.filter}")
+        subprocess.check_call(cmd)
+        with open(out) as f:
+            results = json.load(f)
+        os.remove(out)
+        if merged is None:
+            merged = results
+        else:
+            merged["benchmarks"] += results["benchmarks"]
+    merged["context"]["helib"] = build_info(args.bin_dir)
+    merged["context"]["suites"] = args.suites
+    return merged
+
+
+def compare(baseline, results, threshold, alpha):
+    """Print the comparison, and return the names of the regressions."""
+    old, new = repetitions(baseline), repetitions(results)
+    regressions = []
+    print(f"{'benchmark':<60} {'baseline':>12} {'current':>12} "
+          f"{'change':>8} {'p':>7}")
+    for name in sorted(new):
+        if name not in old:
+            print(f"{name:<60} {'-':>12} {'(new)':>12}")
+            continue
+        a, b = summarize(old[name], alpha), summarize(new[name], alpha)
+        change = (b["mean"] - a["mean"]) / a["mean"] * 100.0
+        p = welch_p(a, b)
+        slower = change > threshold and p < alpha
+        if slower:
+            regressions.append(name)
+        print(f"{name:<60} {a['mean']:>9.4g}±{a['ci']:<.2g} "
+              f"{b['mean']:>9.4g}±{b['ci']:<.2g} {change:>+7.1f}% {p:>7.3f}"
+              + ("  REGRESSION" if slower else ""))
+    for name in sorted(set(old) - set(new)):
+        print(f"{name:<60} {'(missing)':>12}")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("suites", nargs="*",
+                        help="benchmark executables to run, e.g. bgv_basic")
+    parser.add_argument("--bin-dir", default=".",
+                        help="directory of the benchmark executables")
+    parser.add_argument("--filter", help="passed as --benchmark_filter")
+    parser.add_argument("--repetitions", type=int, default=10,
+                        help="repetitions of each benchmark (default 10)")
+    parser.add_argument("--results",
+                        help="compare this results file instead of running "
+                             "the suites")
+    parser.add_argument("--out", help="write the (merged) results here")
+    parser.add_argument("--baseline", help="results file to compare against")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="slowdown (in percent) that fails the "
+                             "comparison (default 5)")
+    parser.add_argument("--alpha", type=float, default=0.05,
+                        help="significance level of the t-tests, and one "
+                             "minus the level of the confidence intervals "
+                             "(default 0.05)")
+    args = parser.parse_args()
+
+    if args.results:
+        with open(args.results) as f:
+            results = json.load(f)
+    elif args.suites:
+        results = run_suites(args)
+    else:
+        parser.error("give the suites to run, or --results")
+
+    if args.out:
+        with open(args.out, "w") as f:
+            json.dump(results, f, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        old_info = baseline["context"].get("helib", {})
+        new_info = results["context"].get("helib", {})
+        for key in sorted(set(old_info) | set(new_info)):
+            if old_info.get(key) != new_info.get(key):
+                print(f"note: {key} differs: baseline {old_info.get(key)}, "
+                      f"current {new_info.get(key)}")
+        regressions = compare(baseline, results, args.threshold, args.alpha)
+        if regressions:
+            print(f"{len(regressions)} benchmark(s) slower by more than "
+                  f"{args.threshold}%", file=sys.stderr)
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,67 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_MEMORY_COMMON_H
+#define HELIB_MEMORY_COMMON_H
+
+#include <helib/helib.h>
+
+#include <benchmark/benchmark.h>
+
+#include <fstream>
+#include <string>
+
+// The resident set size of the process (VmRSS), or its high-water mark
+// (VmHWM), in kB, as found in /proc/self/status (Linux only, -1 elsewhere)
+inline long residentKB(const std::string& field = "VmRSS")
+{
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line))
+    if (line.compare(0, field.size() + 1, field + ":") == 0)
+      return std::stol(line.substr(field.size() + 1));
+  return -1;
+}
+
+// Make the high-water mark start again from the current resident set
+inline void resetPeakRSS() { std::ofstream("/proc/self/clear_refs") << "5"; }
+
+// What was charged to a context (see Context::memoryReport) and how much the
+// resident set grew, from the construction of the object on
+class MemoryFootprint
+{
+public:
+  explicit MemoryFootprint(const helib::Context& context) :
+      context(context), before(context.memoryReport()), rss(residentKB())
+  {}
+
+  // Set the counters "bytes", "rows" and "objects" to what was charged to
+  // category since construction, and "rss_kb" to the growth of the resident
+  // set (which also counts what is not held in DoubleCRT objects)
+  void setCounters(benchmark::State& state,
+                   helib::MemoryCategory category) const
+  {
+    const helib::MemoryUsage& now = context.memoryReport()[category];
+    const helib::MemoryUsage& then = before[category];
+    state.counters["bytes"] = now.bytes - then.bytes;
+    state.counters["rows"] = now.rows - then.rows;
+    state.counters["objects"] = now.objects - then.objects;
+    state.counters["rss_kb"] = residentKB() - rss;
+  }
+
+private:
+  const helib::Context& context;
+  const helib::MemoryReport before;
+  const long rss;
+};
+
+#endif // HELIB_MEMORY_COMMON_H
@@ -0,0 +1,69 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_PERF_COMMON_H
+#define HELIB_PERF_COMMON_H
+
+#include <helib/perfCounters.h>
+
+#include <benchmark/benchmark.h>
+
+// The hardware events of the calling thread over the timed part of a
+// benchmark: pause() and resume() go with state.PauseTiming() and
+// state.ResumeTiming(). Only what runs on the calling thread is counted, so
+// the benchmarks that use it run on one thread.
+class PerfCounters
+{
+public:
+  PerfCounters() : valid(helib::readPerfCounters(start)) {}
+
+  void pause()
+  {
+    helib::PerfSample now;
+    if (valid && helib::readPerfCounters(now))
+      total += now - start;
+  }
+
+  void resume()
+  {
+    if (valid)
+      helib::readPerfCounters(start);
+  }
+
+  // Set the counters "cycles", "instructions" and "llc_misses" (per
+  // iteration), "ipc", and "miss_bytes" (the memory traffic estimated from
+  // the misses, as a rate). Nothing is set if the counters cannot be used.
+  void setCounters(benchmark::State& state)
+  {
+    pause();
+    if (!valid)
+      return;
+    using benchmark::Counter;
+    state.counters["cycles"] =
+        Counter(total[helib::PerfEvent::CYCLES], Counter::kAvgIterations);
+    state.counters["instructions"] =
+        Counter(total[helib::PerfEvent::INSTRUCTIONS],
+                Counter::kAvgIterations);
+    state.counters["llc_misses"] =
+        Counter(total[helib::PerfEvent::LLC_MISSES], Counter::kAvgIterations);
+    state.counters["ipc"] = total.ipc();
+    state.counters["miss_bytes"] =
+        Counter(total.missBytes(), Counter::kIsRate, Counter::kIs1024);
+  }
+
+private:
+  helib::PerfSample start;
+  helib::PerfSample total;
+  bool valid;
+};
+
+#endif // HELIB_PERF_COMMON_H
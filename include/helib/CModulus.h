@@ -36,8 +36,64 @@
 #include <helib/bluestein.h>
 #include <helib/ClonedPtr.h>
 
+#include <memory>
+
 namespace helib {
 
+namespace simd {
+class NTTTables;
+}
+
+class PrimeFactorFFT;
+class BluesteinNTT;
+class Cmodulus;
+
+/**
+ * @class NTTBackend
+ * @brief Where the transforms of the moduli run
+ *
+ * Every transform of a Cmodulus goes through the installed backend (see
+ * Cmodulus::setNTTBackend), so the transforms of DoubleCRT arithmetic and of
+ * key switching can be handed to other hardware. The transforms of a backend
+ * must give the same results as those of CPUNTTBackend, which the library
+ * uses by default.
+ **/
+class NTTBackend
+{
+public:
+  virtual ~NTTBackend() = default;
+
+  //! @brief y = FFT(y), where y holds the coefficients of a polynomial
+  //! reduced to [0, q). On return it holds the phi(m) evaluations of mod.
+  virtual void forward(const Cmodulus& mod, NTL::vec_long& y) const = 0;
+
+  //! @brief x = FFT^{-1}(y), as phi(m) coefficients in [0, q); x is not y
+  virtual void inverse(const Cmodulus& mod,
+                       NTL::vec_long& x,
+                       const NTL::vec_long& y) const = 0;
+};
+
+//! @brief The transforms of the library itself, run on the calling threads
+class CPUNTTBackend : public NTTBackend
+{
+public:
+  void forward(const Cmodulus& mod, NTL::vec_long& y) const override;
+  void inverse(const Cmodulus& mod,
+               NTL::vec_long& x,
+               const NTL::vec_long& y) const override;
+};
+
+/**
+ * @brief The algorithm for the length-m transforms when m is not a power of
+ * two: a single Bluestein FFT, or the prime-factor/Rader transforms of
+ * PrimeFactorFFT (the Context picks the faster one, see planFFTEngine)
+ **/
+enum class FFTEngine
+{
+  BLUESTEIN,
+  PRIME_FACTOR
+};
+
 /**
  * @class Cmodulus
  * @brief Provides FFT and iFFT routines modulo a single-precision prime
@@ -88,12 +144,35 @@ private:
   // PhimX modulo q, for faster division w/ remainder
   CopiedPtr<zz_pXModulus1> phimx;
 
+  //! Tables for the built-in negacyclic NTT, set whenever m is a power of
+  //! two (except in HEXL builds, which use HEXL's NTT instead). The tables
+  //! are immutable, so copies share them.
+  std::shared_ptr<const simd::NTTTables> nativeNTT;
+
+  //! Tables for the prime-factor transforms, set when they were chosen
+  //! instead of Bluestein's (and shared by copies, like nativeNTT)
+  std::shared_ptr<const PrimeFactorFFT> primeFactorFFT;
+
+  //! Tables for Bluestein's FFT with its convolutions done by the built-in
+  //! NTT, set for odd m when q has the roots of unity this needs (except
+  //! in HEXL builds). Shared by copies, like nativeNTT
+  std::shared_ptr<const BluesteinNTT> bluesteinNTT;
+
   // Allocate memory and compute roots
   void privateInit(const PAlgebra&, long rt);
 
   // auxiliary routine used by the two FFT routines
   void FFT_aux(NTL::vec_long& y, NTL::zz_pX& tmp) const;
 
+  // in-place transform of reduced coefficients, when nativeNTT is set
+  void nativeFFT(NTL::vec_long& y) const;
+
+  // The transforms of CPUNTTBackend
+  void cpuFFTInPlace(NTL::vec_long& y) const;
+  void cpuIFFT(NTL::vec_long& x, const NTL::vec_long& y) const;
+  void cpuIFFT(NTL::zz_pX& x, const NTL::vec_long& y) const;
+  friend class CPUNTTBackend;
+
 public:
 #ifdef HELIB_OPENCL
   SmartPtr<AltFFTPrimeInfo> altFFTInfo;
@@ -107,9 +186,12 @@ public:
   /**
    * @brief Constructor
    * @note Specify m and q, and optionally also the root if q == 0, then the
-   * current context is used
+   * current context is used. The engine is ignored when m is a power of 2
    */
-  Cmodulus(const PAlgebra& zms, long qq, long rt);
+  Cmodulus(const PAlgebra& zms,
+           long qq,
+           long rt,
+           FFTEngine engine = FFTEngine::BLUESTEIN);
 
   //! Copy constructor
   Cmodulus(const Cmodulus& other) { *this = other; };
@@ -126,6 +208,36 @@ public:
   NTL::mulmod_t getQInv() const { return qinv; }
   long getRoot() const { return root; }
   const zz_pXModulus1& getPhimX() const { return *phimx; }
+  FFTEngine getFFTEngine() const
+  {
+    return primeFactorFFT ? FFTEngine::PRIME_FACTOR : FFTEngine::BLUESTEIN;
+  }
+
+  /**
+   * @brief The smallest phi(m) whose native NTTs are split over the threads
+   *
+   * A transform of that size or more done by the built-in power-of-two NTT
+   * is itself spread over the threads (see splitsNTT()), for when there are
+   * fewer primes than threads to run in parallel, as with one ciphertext at
+   * a low level. 0 never splits a transform. The default is 2^14.
+   **/
+  static void setIntraNTTMinSize(long size);
+  static long getIntraNTTMinSize();
+
+  //! @brief Whether the transforms of this prime are split over the threads.
+  //! Never inside a task of a parallel loop (see inParallelTask()), as when
+  //! DoubleCRT does its primes in parallel: the loop already uses the threads
+  bool splitsNTT() const;
+
+  /**
+   * @brief Run the transforms of all the moduli on another backend
+   *
+   * The backend is not owned, and must outlive its use. nullptr restores
+   * the CPU transforms. It should be set before any transform runs, not
+   * while other threads are doing some.
+   **/
+  static void setNTTBackend(const NTTBackend* backend);
+  static const NTTBackend& getNTTBackend();
 
   //! @brief Restore NTL's current modulus
   void restoreModulus() const { context.restore(); }
@@ -139,10 +251,17 @@ public:
   void FFT(NTL::vec_long& y, const zzX& x) const;
   // y = FFT(x)
   void FFT(NTL::vec_long& y, NTL::zz_pX& x) const;
+  // y = FFT(y), where y holds phi(m) coefficients already reduced to [0, q)
+  void FFTInPlace(NTL::vec_long& y) const;
+  // y[k] = FFT(x[k]) for k in [0, n). NTL's modulus is set up once for the
+  // whole batch, and the tables of this prime stay in cache across it.
+  void FFT(NTL::vec_long* const* y, const zzX* const* x, long n) const;
 
   // expects zp context to be set externally
   // x = FFT^{-1}(y)
   void iFFT(NTL::zz_pX& x, const NTL::vec_long& y) const;
+  // x = FFT^{-1}(y), as phi(m) coefficients in [0, q); x must not be y
+  void iFFT(NTL::vec_long& x, const NTL::vec_long& y) const;
 
   // returns thread-local scratch space
   // DIRT: this zz_pX is used for several zz_p moduli,
@@ -15,6 +15,8 @@
  * @file Context.h
  * @brief Keeps the parameters of an instance of the cryptosystem
  **/
+#include <map>
+#include <mutex>
 #include <optional>
 #include <helib/PAlgebra.h>
 #include <helib/CModulus.h>
@@ -26,6 +28,7 @@
 #include <helib/range.h>
 #include <helib/scheme.h>
 #include <helib/JsonWrapper.h>
+#include <helib/memoryReport.h>
 
 #include <NTL/Lazy.h>
 
@@ -88,6 +91,7 @@ long FindM(long k,
 
 class EncryptedArray;
 struct PolyModRing;
+class RNSBaseConverter;
 
 // Forward declaration of ContextBuilder
 template <typename SCHEME>
@@ -96,6 +100,13 @@ class ContextBuilder;
 /**
  * @class Context
  * @brief Maintaining the HE scheme parameters
+ *
+ * Thread safety: once built (and, if needed, after `enableBootStrapping`
+ * and `setDigitExtraction`), a `Context` is not modified by any of its const
+ * methods, and can be shared by any number of threads without locking.
+ * Its lazily built tables (base converters, automorphism permutations) are
+ * created once under a lock and immutable afterwards; NTL's current modulus
+ * and all scratch space are thread-local.
  **/
 class Context
 {
@@ -111,9 +122,18 @@ private:
   // For serialization.
   struct SerializableContent;
 
-  // Cmodulus objects for the different primes
+  // The primes of the chain, in the order they were added.
   // The implementation assumes that the list of
   // primes only grows and no prime is ever modified or removed.
+  std::vector<long> primes;
+
+  // logPrimes[i] = log(primes[i]), computed once when the prime is added
+  // since the noise and capacity estimates of every Ctxt operation sum them
+  std::vector<double> logPrimes;
+
+  // Cmodulus objects for the different primes, moduli[i] is the one for
+  // primes[i]. They are built together by buildModuli once the chain is
+  // complete.
   std::vector<Cmodulus> moduli;
 
   // A helper table to map required modulo-sizes to primeSets
@@ -137,9 +157,32 @@ private:
                       // 0 means "dense"
   long e_param = 0;   // parameters specific to bootstrapping
   long ePrime_param = 0;
+  long maxPrimeBits_param = 0; // 0 means "as wide as the arithmetic allows"
 
   std::shared_ptr<const PowerfulDCRT> pwfl_converter;
 
+  // Tables for fast base extension, built on first use for each pair of
+  // (from, to) prime sets and shared by all threads thereafter (see
+  // getBaseConverter).
+  mutable std::mutex baseConvertersLock;
+  mutable std::map<std::vector<long>, std::shared_ptr<const RNSBaseConverter>>
+      baseConverters;
+
+  // The engine for the transforms modulo all the primes, picked by
+  // planFFTEngine when the first prime is added.
+  FFTEngine fftEngine = FFTEngine::BLUESTEIN;
+  bool fftEnginePlanned = false;
+
+  // The permutations of the evaluation points for the automorphisms that
+  // were applied so far, keyed by k mod m (see getAutomorphPermutation).
+  mutable std::mutex automorphPermsLock;
+  mutable std::map<long, std::shared_ptr<const std::vector<long>>>
+      automorphPerms;
+
+  // The memory held by the DoubleCRT objects over this context, charged by
+  // them as they gain and lose rows (see memoryReport).
+  mutable MemoryAccounts memoryAccounts;
+
   // The structure of a single slot of the plaintext space.
   // Note, this will be Z[X]/(G(x),p^r) for some irreducible factor G of
   // Phi_m(X).
@@ -188,6 +231,9 @@ private:
   // Helper for serialisation.
   static SerializableContent readParamsFrom(std::istream& str);
 
+  // Helper for serialisation, see writeSnapshotTo.
+  static SerializableContent readSnapshotParamsFrom(std::istream& str);
+
   // Helper for serialisation.
   static SerializableContent readParamsFromJSON(const JsonWrapper& str);
 
@@ -197,11 +243,17 @@ private:
   // r BGV: The Hensel lifting parameter. CKKS: The bit precision.
   // gens The generators of `(Z/mZ)^*` (other than `p`).
   // ords The orders of each of the generators of `(Z/mZ)^*`.
+  // precomputed If not null, the factorization of Phi_m(X) mod p^r, see
+  // writeSnapshotTo.
+  // tables If not null, the slow tables of the PAlgebra, see
+  // writeSnapshotTo.
   Context(unsigned long m,
           unsigned long p,
           unsigned long r,
           const std::vector<long>& gens = std::vector<long>(),
-          const std::vector<long>& ords = std::vector<long>());
+          const std::vector<long>& ords = std::vector<long>(),
+          const PAlgebraModFactors* precomputed = nullptr,
+          const PAlgebraTables* tables = nullptr);
 
   // Used by ContextBuilder
   Context(long m,
@@ -216,14 +268,32 @@ private:
   Context(const SerializableContent& content);
 
   // Methods for adding primes.
+  // If nDgts <= 0 and bitsInSpecialPrimes > 0, the number of digits is
+  // chosen as the fewest that the given special primes budget supports.
   void addSpecialPrimes(long nDgts,
                         bool willBeBootstrappable,
                         long bitsInSpecialPrimes);
 
+  // Estimated number of bits in the special primes that is needed to keep
+  // the key-switching noise small, when ciphertexts are broken into nDgts
+  // digits whose largest has log(product)=maxDigitLog.
+  double specialPrimesBitsEstimate(long nDgts,
+                                   double maxDigitLog,
+                                   long p2e) const;
+
   void addCtxtPrimes(long nBits, long targetSize);
 
   void addSmallPrimes(long resolution, long cpSize);
 
+  // Append the prime q to the chain and return its index. The FFT engine
+  // of the chain is planned with q if this is the first prime; the
+  // Cmodulus for q is only built by buildModuli.
+  long addPrime(long q);
+
+  // Build the Cmodulus objects of all the primes that do not have one yet,
+  // in parallel using NTL's thread pool.
+  void buildModuli();
+
   // Add the given prime to the `smallPrimes` set.
   // q The prime to add.
   void addSmallPrime(long q);
@@ -326,6 +396,53 @@ public:
    **/
   const PowerfulDCRT& getPowerfulConverter() const { return *pwfl_converter; }
 
+  //! Upper bound on the number of base converters kept by getBaseConverter
+  static constexpr long MAX_CACHED_BASE_CONVERTERS = 256;
+
+  /**
+   * @brief Get the tables for fast base extension from the primes in `from`
+   * to the primes in `to`, building them on first use.
+   * @param from The primes of the input residues.
+   * @param to The primes to extend to, disjoint from `from`.
+   * @return The converter.
+   * @note The converters are cached on first use, up to
+   * `MAX_CACHED_BASE_CONVERTERS` distinct pairs of prime sets; past that
+   * they are built afresh on every call.
+   **/
+  std::shared_ptr<const RNSBaseConverter>
+  getBaseConverter(const IndexSet& from, const IndexSet& to) const;
+
+  //! Upper bound on the number of automorphism permutations kept by
+  //! getAutomorphPermutation
+  static constexpr long MAX_CACHED_AUTOMORPHS = 256;
+
+  /**
+   * @brief Get the permutation of the evaluation points (the elements of
+   * `Zm*`) induced by the automorphism `X -> X^k`.
+   * @param k An element of `Zm*`.
+   * @return A vector `perm` of length `phi(m)` such that applying the
+   * automorphism to a `DoubleCRT` row maps `row[j]` to `row[perm[j]]`.
+   * @note The permutations are cached on first use, up to
+   * `MAX_CACHED_AUTOMORPHS` distinct values of `k`; past that
+   * they are computed afresh on every call.
+   **/
+  std::shared_ptr<const std::vector<long>>
+  getAutomorphPermutation(long k) const;
+
+  /**
+   * @brief The memory held by the `DoubleCRT` objects over this context, by
+   * owner (see memoryReport.h).
+   * @return The bytes, rows and objects of each category. The `SCRATCH`
+   * category also counts the rows idle in the scratch pools of all threads,
+   * which are shared by all the contexts.
+   * @note The counts of the other threads may be a little out of date.
+   **/
+  MemoryReport memoryReport() const;
+
+  //! @brief The counters updated by the `DoubleCRT` objects over this
+  //! context, for use by `DoubleCRTHelper`.
+  MemoryAccounts& getMemoryAccounts() const { return memoryAccounts; }
+
   /**
    * @brief Get a slot ring.
    * @return A reference to a `std::shared` pointer pointing to a slotRing.
@@ -385,6 +502,14 @@ public:
    **/
   long getHwt() const { return hwt_param; }
 
+  /**
+   * @brief Getter method for the bit size of the largest primes that the
+   * modulus chain may hold.
+   * @return The maximum prime size, which is `HELIB_SP_NBITS` unless a
+   * smaller one was asked for when the chain was built.
+   **/
+  long getMaxPrimeBits() const;
+
   /**
    * @brief Getter method for the e parameter.
    * @return The e parameter.
@@ -689,23 +814,40 @@ public:
    * Default is false.
    * @param alsoThick Flag for initialising additional information needed for
    * thick bootstrapping. Default is true.
+   * @note For CKKS, `mvec` is `{m}`, and `build_cache` and `alsoThick` are
+   * not used. The secret key must be sparse, i.e. the modulus chain must be
+   * built with `skHwt > 0`.
    **/
   void enableBootStrapping(const NTL::Vec<long>& mvec,
                            bool build_cache = false,
                            bool alsoThick = true)
   {
-    assertTrue(e_param > 0,
+    assertTrue(isCKKS() || e_param > 0,
                "enableBootStrapping invoked but willBeBootstrappable "
                "not set in buildModChain");
 
     rcData.init(*this, mvec, alsoThick, build_cache);
   }
 
+  /**
+   * @brief Choose the digit extraction algorithm of recryption, for
+   * thinReCrypt and for each unpacked slot of reCrypt.
+   * @param method The algorithm to use, `DigitExtraction::AUTO` by default.
+   * @note The choice is not serialized with the `Context`.
+   **/
+  void setDigitExtraction(DigitExtraction method)
+  {
+    rcData.digitExtraction = method;
+  }
+
   /**
    * @brief Check if a `Context` is bootstrappable.
    * @return `true` if recryption data is found, `false` otherwise.
    **/
-  bool isBootstrappable() const { return rcData.alMod != nullptr; }
+  bool isBootstrappable() const
+  {
+    return rcData.alMod != nullptr || rcData.ckks != nullptr;
+  }
 
   /**
    * @brief Getter method that returns the handles of both the `ctxtPrimes` and
@@ -764,7 +906,7 @@ public:
    **/
   long ithPrime(unsigned long i) const
   {
-    return (i < moduli.size()) ? moduli[i].getQ() : 0;
+    return (i < primes.size()) ? primes[i] : 0;
   }
 
   /**
@@ -779,7 +921,15 @@ public:
    * @brief Return the total number of small primes in the modulus chain.
    * @return The total number of small primes in the modulus chain.
    **/
-  long numPrimes() const { return moduli.size(); }
+  long numPrimes() const { return primes.size(); }
+
+  /**
+   * @brief The algorithm used for the length-m transforms modulo the primes.
+   * It is chosen by timing the options when the first prime is added, and
+   * only matters when m is not a power of two.
+   * @return The engine of all the `Cmodulus` objects of the chain.
+   **/
+  FFTEngine getFFTEngine() const { return fftEngine; }
 
   /**
    * @brief Check if a number is divisible by any of the primes in the modulus
@@ -790,8 +940,8 @@ public:
    **/
   bool isZeroDivisor(const NTL::ZZ& num) const
   {
-    for (long i : range(moduli.size()))
-      if (divide(num, moduli[i].getQ()))
+    for (long q : primes)
+      if (divide(num, q))
         return true;
     return false;
   }
@@ -804,8 +954,8 @@ public:
    **/
   bool inChain(long p) const
   {
-    for (long i : range(moduli.size()))
-      if (p == moduli[i].getQ())
+    for (long q : primes)
+      if (p == q)
         return true;
     return false;
   }
@@ -830,7 +980,10 @@ public:
    * @param i Index of the desired prime.
    * @return The natural logarithm of the `i`th prime of the modulus chain.
    **/
-  double logOfPrime(unsigned long i) const { return log(ithPrime(i)); }
+  double logOfPrime(unsigned long i) const
+  {
+    return (i < logPrimes.size()) ? logPrimes[i] : log(0.0);
+  }
 
   /**
    * @brief Calculate the natural logarithm of `productOfPrimes(s)` for a given
@@ -936,6 +1089,15 @@ public:
    **/
   void writeTo(std::ostream& str) const;
 
+  /**
+   * @brief A 64-bit hash (FNV-1a) of the output of `writeTo`.
+   * @return The fingerprint of the `Context`.
+   * @note Precomputed data stored next to the context (e.g. the encoded
+   * constants of a matrix multiplication) records this value, to detect
+   * being loaded with a different context.
+   **/
+  unsigned long fingerprint() const;
+
   /**
    * @brief Read from the stream the serialized `Context` object in binary
    * format.
@@ -952,6 +1114,38 @@ public:
    **/
   static Context* readPtrFrom(std::istream& str);
 
+  /**
+   * @brief Write out the `Context` object in binary format, together with
+   * the costliest of the tables derived from it, so that reading it back
+   * does not need to recompute them. This is a superset of writeTo.
+   * @param str Output `std::ostream`.
+   *
+   * The snapshot currently holds the factorization of Phi_m(X) mod p^r into
+   * the slot polynomials, with their CRT coefficients, the slow tables of
+   * the `PAlgebra` (see `PAlgebraTables`), and for a
+   * bootstrappable context the linear maps of recryption, with their
+   * constants in whichever form (zzX or DoubleCRT) they are held.
+   **/
+  void writeSnapshotTo(std::ostream& str) const;
+
+  /**
+   * @brief Read a `Context` object written by writeSnapshotTo, restoring the
+   * tables that it holds rather than computing them.
+   * @param str Input `std::istream`.
+   * @return The deserialized `Context` object.
+   *
+   * The snapshot must come from a trusted source, as the tables are only
+   * checked for their shape.
+   **/
+  static Context readSnapshotFrom(std::istream& str);
+
+  /**
+   * @brief Same as readSnapshotFrom.
+   * @param str Input `std::istream`.
+   * @return Raw pointer to the deserialized `Context` object.
+   **/
+  static Context* readPtrSnapshotFrom(std::istream& str);
+
   /**
    * @brief Write out the `Context` object to the output stream using JSON
    * format.
@@ -992,6 +1186,8 @@ public:
   // FIXME Should this not be private?
   void clearModChain()
   {
+    primes.clear();
+    logPrimes.clear();
     moduli.clear();
     ctxtPrimes.clear();
     specialPrimes.clear();
@@ -1001,13 +1197,15 @@ public:
     hwt_param = 0;
     e_param = 0;
     ePrime_param = 0;
+    maxPrimeBits_param = 0;
   }
 
   /**
    * @brief Build the modulus chain for given `Context` object.
    * @param nBits Total number of bits required for the modulus chain.
    * @param nDgts Number of digits/columns in the key-switching matrix. Default
-   * is 3.
+   * is 3. If `nDgts` is `0` and `bitsInSpecialPrimes` is set, the number of
+   * digits is chosen as the fewest that the special primes budget supports.
    * @param willBeBoostrappable Flag for initializing bootstrapping data.
    *Default is `false`.
    * @param skHwt The Hamming weight of the secret key. Default is 0.
@@ -1015,13 +1213,16 @@ public:
    * is 3.
    * @param bitsInSpecialPrimes The bit size of the special primes in the
    *modulus chain. Default is 0.
+   * @param maxPrimeBits The bit size of the largest primes in the chain, in
+   * `[30, HELIB_SP_NBITS]`. Default is 0, meaning `HELIB_SP_NBITS`.
    **/
   void buildModChain(long nBits,
                      long nDgts = 3,
                      bool willBeBootstrappable = false,
                      long skHwt = 0,
                      long resolution = 3,
-                     long bitsInSpecialPrimes = 0);
+                     long bitsInSpecialPrimes = 0,
+                     long maxPrimeBits = 0);
 
   // should be called if after you build the mod chain in some way
   // *other* than calling buildModChain.
@@ -1075,12 +1276,13 @@ private:
   long skHwt_ = 0;
   long resolution_ = 3;
   long bitsInSpecialPrimes_ = 0;
+  long maxPrimeBits_ = 0; // 0 means HELIB_SP_NBITS
   bool buildModChainFlag_ = true; // Default build the modchain.
 
   double stdev_ = 3.2;
   double scale_ = 10;
 
-  // Boostrap params (BGV only)
+  // Boostrap params (all but bootstrappableFlag_ are BGV only)
   NTL::Vec<long> mvec_;
   bool buildCacheFlag_ = false;
   bool thickFlag_ = false;
@@ -1173,6 +1375,9 @@ public:
    * matrices.
    * @param c The number of columns in the key switching matrix.
    * @return Reference to the `ContextBuilder` object.
+   * @note If `c` is `0` and `bitsInSpecialPrimes` is set, the number of
+   * digits is derived from the special primes budget (hybrid
+   * key-switching), see `hybridKeySwitching`.
    **/
   ContextBuilder& c(long c)
   {
@@ -1252,6 +1457,38 @@ public:
     return *this;
   }
 
+  /**
+   * @brief Caps the bit size of the primes in the modulus chain.
+   * @param bits The bit size of the largest primes, in `[30, HELIB_SP_NBITS]`.
+   * @return Reference to this `ContextBuilder` object.
+   * @note With `maxPrimeBits(50)` every prime is below 2^50, so on CPUs with
+   * AVX-512IFMA all of them use the vectorized NTT and multiply kernels,
+   * without rebuilding with a smaller `HELIB_SP_NBITS`. The chain then needs
+   * more (smaller) primes for the same total number of bits.
+   **/
+  ContextBuilder& maxPrimeBits(long bits)
+  {
+    maxPrimeBits_ = bits;
+    return *this;
+  }
+
+  /**
+   * @brief Selects hybrid key-switching with a given special primes budget.
+   * @param bits The bit size of the special primes in the modulus chain.
+   * @param c The number of digits in the key switching matrices. If `0`
+   * (default) it is chosen as the fewest digits whose key-switching noise the
+   * special primes can absorb.
+   * @return Reference to this `ContextBuilder` object.
+   * @note Fewer digits make key-switching faster and key-switching matrices
+   * smaller, at the cost of a larger special modulus.
+   **/
+  ContextBuilder& hybridKeySwitching(long bits, long c = 0)
+  {
+    bitsInSpecialPrimes_ = bits;
+    c_ = c;
+    return *this;
+  }
+
   /**
    * @brief Sets a flag determining whether the modulus chain will be built.
    * @param `yesno` A `bool` to determine whether the modulus chain should be
@@ -1340,10 +1577,9 @@ public:
    * bootstrappable.
    * @return Reference to this `ContextBuilder` object.
    * @note `ContextBuilder` by default will not be bootstrappable.
-   * @note Only exists when the `SCHEME` is `BGV`.
+   * @note A bootstrappable `CKKS` context has a sparse secret key, of
+   * Hamming weight `skHwt` or `BOOT_DFLT_SK_HWT` by default.
    **/
-  template <typename S = SCHEME,
-            std::enable_if_t<std::is_same<S, BGV>::value>* = nullptr>
   ContextBuilder& bootstrappable(bool yesno = true)
   {
     bootstrappableFlag_ = yesno;
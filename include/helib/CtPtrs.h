@@ -35,6 +35,11 @@ typedef PtrVector_vectorPt<Ctxt> CtPtrs_vectorPt;
 // A slice of CtPtrs
 typedef PtrVector_slice<Ctxt> CtPtrs_slice;
 
+// Contiguous ciphertexts, indexed without virtual calls
+typedef PtrSpan<Ctxt> CtSpan;
+// CtPtrs_span(CtSpan)
+typedef PtrVector_span<Ctxt> CtPtrs_span;
+
 typedef PtrMatrix<Ctxt> CtPtrMat;
 typedef PtrMatrix_Vec<Ctxt> CtPtrMat_VecCt;
 typedef PtrMatrix_vector<Ctxt> CtPtrMat_vectorCt;
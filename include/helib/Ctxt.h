@@ -57,9 +57,11 @@
 
 #include <helib/DoubleCRT.h>
 #include <helib/EncodedPtxt.h>
+#include <helib/SmallVector.h>
 #include <helib/apiAttributes.h>
 
 #include <cfloat> // DBL_MAX
+#include <functional>
 
 namespace helib {
 struct CKKS;
@@ -73,6 +75,7 @@ class PubKey;
 class SecKey;
 
 class PtxtArray;
+class EncodedPtxtCache;
 
 /**
  * @class SKHandle
@@ -263,6 +266,14 @@ inline std::ostream& operator<<(std::ostream& s, const SKHandle& handle)
  **/
 class CtxtPart : public DoubleCRT
 {
+  // The parts of a ciphertext count as CIPHERTEXTS, unless made within a
+  // MemoryScope (those of a public key, say)
+  void chargeToCiphertexts()
+  {
+    if (MemoryScope::current() == MemoryCategory::OTHER)
+      setMemoryCategory(MemoryCategory::CIPHERTEXTS);
+  }
+
 public:
   //! @brief The handle is a public data member
   SKHandle skHandle; // The secret-key polynomial corresponding to this part
@@ -275,23 +286,29 @@ public:
   CtxtPart(const Context& _context, const IndexSet& s) : DoubleCRT(_context, s)
   {
     skHandle.setOne();
+    chargeToCiphertexts();
   }
 
   CtxtPart(const Context& _context,
            const IndexSet& s,
            const SKHandle& otherHandle) :
       DoubleCRT(_context, s), skHandle(otherHandle)
-  {}
+  {
+    chargeToCiphertexts();
+  }
 
   // Copy constructors from the base class
   explicit CtxtPart(const DoubleCRT& other) : DoubleCRT(other)
   {
     skHandle.setOne();
+    chargeToCiphertexts();
   }
 
   CtxtPart(const DoubleCRT& other, const SKHandle& otherHandle) :
       DoubleCRT(other), skHandle(otherHandle)
-  {}
+  {
+    chargeToCiphertexts();
+  }
 
   /**
    * @brief Write out the `CtxtPart` object in binary format.
@@ -369,16 +386,21 @@ struct ZeroCtxtLike_type
 {}; // used to select a constructor
 
 const ZeroCtxtLike_type ZeroCtxtLike = ZeroCtxtLike_type();
+
+struct SharedCopy_type
+{}; // used to select a constructor
+
+const SharedCopy_type SharedCopy = SharedCopy_type();
 //! \endcond
 
 /**
  * @class Ctxt
  * @brief A Ctxt object holds a single ciphertext
  *
- * The class Ctxt includes a std::vector<CtxtPart>: For a Ctxt c, c[i] is the
+ * The class Ctxt includes a vector of CtxtPart: For a Ctxt c, c[i] is the
  * i'th ciphertext part, which can be used also as a DoubleCRT object (since
  * CtxtPart is derived from DoubleCRT). By convention, c[0], the first CtxtPart
- * object in the std::vector, has skHndl that points to 1 (i.e., it is just
+ * object in the vector, has skHndl that points to 1 (i.e., it is just
  * added in upon decryption, without being multiplied by anything).  We
  * maintain the invariance that all the parts of a ciphertext are defined
  * relative to the same set of primes.
@@ -399,10 +421,13 @@ class Ctxt
   friend class PubKey;
   friend class SecKey;
   friend class BasicAutomorphPrecon;
+  friend class Encryptor;
+  friend class SchemeSwitch;
 
   const Context& context;      // points to the parameters of this FHE instance
   const PubKey& pubKey;        // points to the public encryption key;
-  std::vector<CtxtPart> parts; // the ciphertext parts
+  // the ciphertext parts, with room for 1, s, s^2 inside the object
+  SmallVector<CtxtPart, 3> parts;
   IndexSet primeSet; // the primes relative to which the parts are defined
   long ptxtSpace;    // plaintext space for this ciphertext (either p or p^r)
 
@@ -413,10 +438,18 @@ class Ctxt
   NTL::xdouble ratFactor; // rational factor to divide on decryption (for CKKS)
   NTL::xdouble ptxtMag;   // bound on the plaintext size (for CKKS)
 
+  // For fresh secret-key encryptions, parts[1] was expanded from this seed,
+  // so the ciphertext can be written with writeSeededTo. Zero otherwise.
+  NTL::ZZ uniformSeed;
+
   // Create a tensor product of c1,c2. It is assumed that *this,c1,c2
   // are defined relative to the same set of primes and plaintext space,
   // and that *this DOES NOT point to the same object as c1,c2
   void tensorProduct(const Ctxt& c1, const Ctxt& c2);
+  // The parts of the tensor product: three products for two canonical
+  // ciphertexts over the primeSet of *this, one per pair of parts otherwise
+  void tensorCanonical(const Ctxt& c1, const Ctxt& c2);
+  void tensorGeneric(const Ctxt& c1, const Ctxt& c2);
 
   // Add/subtract a ciphertext part to/from a ciphertext. These are private
   // methods, they cannot update the noiseBound so they must be called
@@ -497,6 +530,7 @@ class Ctxt
   // public key, this is needed when we copy the pubEncrKey member between
   // different public keys.
   Ctxt& privateAssign(const Ctxt& other);
+  Ctxt& privateAssign(Ctxt&& other);
 
   // explicitly multiply intFactor by e, which should be
   // in the interval [0, ptxtSpace)
@@ -512,6 +546,9 @@ public:
   // Default copy-constructor
   Ctxt(const Ctxt& other) = default;
 
+  // A move takes the parts of other, leaving it empty
+  Ctxt(Ctxt&& other) = default;
+
   // VJS-FIXME: this was really a messy design choice to not
   // have ciphertext constructors that specify prime sets.
   // The default value of ctxtPrimes is kind of pointless.
@@ -524,6 +561,16 @@ public:
   // constructs a zero ciphertext with same public key and
   // plaintext space as ctxt
 
+  /**
+   * @brief A copy of ctxt whose parts share their rows with those of ctxt,
+   * copy-on-write (see `DoubleCRT::share`).
+   *
+   * This costs no row copies, and the copy takes no memory of its own until
+   * a row is modified. It is meant for copies that are mostly read, or
+   * overwritten whole, since a row is copied again at its first change.
+   **/
+  Ctxt(SharedCopy_type, const Ctxt& ctxt);
+
   //! Dummy encryption, just encodes the plaintext in a Ctxt object
   //! If provided, size should be a high-probability bound
   //! on the L-infty norm of the canonical embedding
@@ -540,6 +587,17 @@ public:
     return privateAssign(other);
   }
 
+  Ctxt& operator=(Ctxt&& other)
+  {
+    assertEq(&context,
+             &other.context,
+             "Cannot assign Ctxts with different context");
+    assertEq(&pubKey,
+             &other.pubKey,
+             "Cannot assign Ctxts with different pubKey");
+    return privateAssign(std::move(other));
+  }
+
   bool operator==(const Ctxt& other) const { return equalsTo(other); }
   bool operator!=(const Ctxt& other) const { return !equalsTo(other); }
 
@@ -567,9 +625,26 @@ public:
 
   void addCtxt(const Ctxt& other, bool negative = false);
 
-  // Multiply by another ciphertext
+  // Multiply by another ciphertext. other is copied only if its plaintext
+  // space or primes must change, and is changed in place if destructive.
   void multLowLvl(const Ctxt& other, bool destructive = false);
 
+  //! @brief Multiply by a ciphertext that is not needed afterwards, changing
+  //! it instead of a copy.
+  void multLowLvl(Ctxt&& other) { multLowLvl(other, true); }
+
+  /**
+   * @brief Add the product `a * b` to `*this`, without re-linearization.
+   * @param a The first factor.
+   * @param b The second factor, may be the same object as `a`.
+   *
+   * The degree-2 parts of all the products are summed, so a sequence of
+   * calls followed by a single `reLinearize()` computes an inner product
+   * with one key-switching operation instead of one per term. `*this` may
+   * be empty on entry, and must not alias `a` or `b`.
+   **/
+  void multiplyAccumulate(const Ctxt& a, const Ctxt& b);
+
   // This is a high-level mul with relinearization
   Ctxt& operator*=(const Ctxt& other)
   {
@@ -577,6 +652,12 @@ public:
     return *this;
   }
 
+  Ctxt& operator*=(Ctxt&& other)
+  {
+    multiplyBy(std::move(other));
+    return *this;
+  }
+
   void automorph(long k); // Apply automorphism F(X) -> F(X^k) (gcd(k,m)=1)
   Ctxt& operator>>=(long k)
   {
@@ -595,6 +676,53 @@ public:
   //! @brief applies the automorphism p^j using smartAutomorphism
   void frobeniusAutomorph(long j);
 
+  /**
+   * @brief Same as `smartAutomorph(k)`, but without leaving the special
+   * primes.
+   * @param k The automorphism X -> X^k to apply, k must be in Zm*.
+   *
+   * When `*this` is in canonical form and still defined over the special
+   * primes (as the output of `BasicAutomorphPrecon::automorph` is), only
+   * the part that must be key-switched is brought down to the ciphertext
+   * primes. The constant part stays where it is and the result is again
+   * defined over the special primes, so several such ciphertexts can be
+   * added together before a single mod-down. Otherwise this is just
+   * `smartAutomorph(k)`.
+   **/
+  void lazySmartAutomorph(long k);
+
+  /**
+   * @brief Same as `smartAutomorph(k)`, but with the key switching deferred.
+   * @param k The automorphism X -> X^k to apply.
+   *
+   * When `*this` is in canonical form and there is a key-switching matrix
+   * straight from s(X^k), only the automorphism is applied: the result has
+   * a part relative to s(X^k). Such ciphertexts can be added together (the
+   * parts relative to the same key are merged) and multiplied by constants,
+   * and they decrypt and serialize as they are. The key switching happens
+   * in the next `reLinearize()`, once per distinct key, which is called by
+   * `multiplyBy` and the other multiplications, `smartAutomorph` and
+   * `cleanUp`. Otherwise this is just `smartAutomorph(k)`.
+   **/
+  void deferredAutomorph(long k);
+
+  /**
+   * @brief Apply many automorphisms to the same ciphertext, sharing a single
+   * digit decomposition between them ("hoisting").
+   * @param ks The automorphisms X -> X^k to apply, each k must be in Zm*.
+   * @param out Output vector, on return out[i] holds `*this` after applying
+   * the automorphism ks[i] followed by re-linearization.
+   *
+   * This is equivalent to copying `*this` and calling `smartAutomorph(ks[i])`
+   * for every i, but `*this` is broken into digits only once. The digits are
+   * then rotated in the evaluation domain and key-switched for each k. When
+   * there is no direct key-switching matrix for some k, the remaining steps
+   * are completed with the usual `smartAutomorph`. The automorphisms are
+   * evaluated in parallel.
+   **/
+  void hoistedAutomorphs(const std::vector<long>& ks,
+                         std::vector<Ctxt>& out) const;
+
   /**
    * @brief Times equals operator with a `ZZX`.
    * @param poly Element by which to multiply.
@@ -740,6 +868,12 @@ public:
    * `helib::DoubleCRT` data.
    **/
   void multByConstant(const FatEncodedPtxt& ptxt);
+  /**
+   * @brief Multiply a `Ctxt` with a specified plaintext constant.
+   * @param ptxt The constant, in the DoubleCRT form cached for the primes
+   * of the ciphertext (made and cached if there is none).
+   **/
+  void multByConstant(const EncodedPtxtCache& ptxt);
 
   /**
    * @brief Multiply a `Ctxt` with an `NTL::ZZ` scalar.
@@ -873,6 +1007,14 @@ public:
    * `helib::DoubleCRT` data.
    **/
   void addConstant(const FatEncodedPtxt& ptxt, bool neg = false);
+  /**
+   * @brief Add to a `Ctxt` a specified plaintext constant.
+   * @param ptxt The constant, in the DoubleCRT form cached for the primes
+   * of the ciphertext (made and cached if there is none).
+   * @param neg Flag to specify if the constant is negative. Default is
+   * `false`.
+   **/
+  void addConstant(const EncodedPtxtCache& ptxt, bool neg = false);
 
   /**
    * @brief Add to a `Ctxt` an `NTL::ZZ` scalar.
@@ -1226,6 +1368,8 @@ public:
 
   // Higher-level multiply routines
   void multiplyBy(const Ctxt& other);
+  //! @brief As above, changing other instead of a copy of it.
+  void multiplyBy(Ctxt&& other);
   void multiplyBy2(const Ctxt& other1, const Ctxt& other2);
   void square() { multiplyBy(*this); }
   void cube() { multiplyBy2(*this, *this); }
@@ -1248,8 +1392,9 @@ public:
 
   void bumpNoiseBound(double factor) { noiseBound *= factor; }
 
-  // CKKS adjustment to protect precision
-  void relin_CKKS_adjust();
+  // CKKS adjustment to protect precision. For a ciphertext that is still
+  // scaled up by the special primes, logScale is the log of their product.
+  void relin_CKKS_adjust(double logScale = 0.0);
 
   void reLinearize(long keyIdx = 0);
   // key-switch to (1,s_i), s_i is the base key with index keyIdx
@@ -1283,6 +1428,53 @@ public:
   double naturalSize() const;       //! "natural size" is size before squaring
   IndexSet naturalPrimeSet() const; //! the corresponding primeSet
 
+  //! @brief Rescale now, by mod-switching down to the primes of
+  //! naturalPrimeSet().
+  //!
+  //! Rescaling is otherwise lazy: a product is left at its full scale,
+  //! adding ciphertexts with the same scale and primeSet does no
+  //! mod-switching, and primes are only dropped right before the next
+  //! multiplication. Call this to shrink a ciphertext earlier, e.g. before
+  //! it is stored or sent.
+  void rescale();
+
+  /**
+   * @brief Mod-switch down to the smallest set of ctxt primes that keeps
+   * (at least) targetBits of capacity.
+   *
+   * The small and special primes are dropped first, as by
+   * dropSmallAndSpecialPrimes(). A ciphertext with less capacity than
+   * targetBits is left at the ctxt primes it has. Fewer primes mean fewer
+   * NTTs in every later operation on the ciphertext, and less memory while
+   * it is kept around.
+   **/
+  void dropToCapacity(long targetBits);
+
+  /**
+   * @brief An estimate of the capacity, in bits, consumed by one more level
+   * of multiplication of this ciphertext by ones in the same state.
+   *
+   * This is the log of the total noise bound that the ciphertext would have
+   * at its natural size: squaring doubles it, and mod-switching back to the
+   * natural size takes off as many bits. It is a heuristic, and does not
+   * account for the noise of the key switching that follows.
+   **/
+  double bitsPerMultiplication() const;
+
+  /**
+   * @brief Drop the primes that are not needed for depth more levels of
+   * multiplication, i.e. dropToCapacity(depth * bitsPerMultiplication() +
+   * extraBits). The default extraBits is a margin for the key switching
+   * noise and for the decryption at the end.
+   *
+   * Mod-down is otherwise lazy, so a long-lived intermediate result carries
+   * all the primes of its last operation until it is multiplied again.
+   * Calling this as soon as the remaining depth of the computation that
+   * uses it is known makes later operations cheaper, and gives the same
+   * results as long as the estimate of bitsPerMultiplication() holds.
+   **/
+  void dropToDepth(long depth, long extraBits = 10);
+
   //! @brief drop all smallPrimes and specialPrimes, adding ctxtPrimes
   //! as necessary to ensure that the scaled noise is above the
   //! modulus-switching added noise term.
@@ -1351,6 +1543,7 @@ public:
     noiseBound = 0.0;
     intFactor = 1;
     ratFactor = ptxtMag = 1.0;
+    uniformSeed = 0;
   }
 
   //! @brief Is this an empty ciphertext without any parts
@@ -1368,6 +1561,10 @@ public:
     return true;
   }
 
+  //! @brief The number of distinct keys s^r(X^t) with t != 1 that parts
+  //! are relative to, each one a key switching left by `deferredAutomorph`
+  long numDeferredKeySwitches() const;
+
   //! @brief Would this ciphertext be decrypted without errors?
   bool isCorrect() const;
 
@@ -1411,6 +1608,39 @@ public:
    **/
   void writeTo(std::ostream& str) const;
 
+  /**
+   * @brief Write out a fresh secret-key encryption in binary format, with
+   * its uniformly random part replaced by the 32-byte seed it was expanded
+   * from. This takes about half the size of writeTo.
+   * @param str Output `std::ostream`.
+   *
+   * Throws a LogicError if the ciphertext was modified since it was
+   * encrypted, or was not encrypted with a `SecKey`. Both formats are
+   * accepted by read and readFrom.
+   **/
+  void writeSeededTo(std::ostream& str) const;
+
+  /**
+   * @brief Write out the `Ctxt` object in a compact binary format, for
+   * sending results that will only be decrypted (or lightly operated on).
+   * @param str Output `std::ostream`.
+   * @param targetBits The capacity (in bits) to keep in excess of what
+   * decryption needs.
+   *
+   * A copy of the ciphertext is first mod-switched down to the smallest set
+   * of ctxt primes that keeps targetBits of capacity (or to
+   * dropSmallAndSpecialPrimes() if it has less than that), then each
+   * residue modulo p_i is packed into NumBits(p_i - 1) bits. The result is
+   * read back by read and readFrom.
+   **/
+  void writeCompact(std::ostream& str, long targetBits = 0) const;
+
+  //! The size of the seed written out by writeSeededTo
+  static constexpr long UNIFORM_SEED_BYTES = 32;
+
+  //! @brief Can the ciphertext (still) be written with writeSeededTo?
+  bool hasSeededForm() const;
+
   /**
    * @brief Read from the stream the serialized `Ctxt` object in binary format.
    * @param str Input `std::istream`.
@@ -1420,7 +1650,7 @@ public:
 
   /**
    * @brief In-place read from the stream the serialized `Ctxt` object in binary
-   * format.
+   * format, as written by either writeTo or writeSeededTo.
    * @param str Input `std::istream`.
    **/
   void read(std::istream& str);
@@ -1470,6 +1700,32 @@ public:
    **/
   void readJSON(const JsonWrapper& j);
 
+  /**
+   * @brief Write out the ciphertext (`Ctxt`) object as a JSON header whose
+   * content is the binary format of writeTo, base64-encoded.
+   * @param str Output `std::ostream`.
+   *
+   * The binary body is encoded as it is written, without building a JSON
+   * document of the residues.
+   **/
+  void writeToHybridJSON(std::ostream& str) const;
+
+  /**
+   * @brief Read from the stream a ciphertext (`Ctxt`) object written by
+   * writeToHybridJSON.
+   * @param str Input `std::istream`.
+   * @param pubKey The `PubKey` to be used.
+   * @return The deserialized `Ctxt` object.
+   **/
+  static Ctxt readFromHybridJSON(std::istream& str, const PubKey& pubKey);
+
+  /**
+   * @brief In-place read from the stream a ciphertext (`Ctxt`) object
+   * written by writeToHybridJSON.
+   * @param str Input `std::istream`.
+   **/
+  void readHybridJSON(std::istream& str);
+
   // scale up c1, c2 so they have the same ratFactor
   static void equalizeRationalFactors(Ctxt& c1, Ctxt& c2);
 
@@ -1482,6 +1738,33 @@ public:
                                    NTL::ZZX& noise) const;
 };
 
+/**
+ * @class BasicAutomorphPrecon
+ * @brief Pre-computation to speed many automorphism on the same ciphertext.
+ *
+ * The expensive part of homomorphic automorphism is breaking the ciphertext
+ * parts into digits. The usual setting is we first rotate the ciphertext
+ * parts, then break them into digits. But when we apply many automorphisms
+ * it is faster to break the original ciphertext into digits, then rotate
+ * the digits (as opposed to first rotate, then break).
+ * An BasicAutomorphPrecon object breaks the original ciphertext and keeps
+ * the digits, then when you call automorph is only needs to apply the
+ * native automorphism and key switching to the digits, which is fast(er).
+ **/
+class BasicAutomorphPrecon
+{
+  Ctxt ctxt;
+  NTL::xdouble noise;
+  std::vector<DoubleCRT> polyDigits;
+
+public:
+  explicit BasicAutomorphPrecon(const Ctxt& _ctxt);
+
+  //! Returns a new ciphertext equal to the original one after applying the
+  //! automorphism X -> X^k followed by re-linearization
+  std::shared_ptr<Ctxt> automorph(long k) const;
+};
+
 // set out=prod_{i=0}^{n-1} v[j], takes depth log n and n-1 products
 // out could point to v[0], but having it pointing to any other v[i]
 // will make the result unpredictable.
@@ -1525,6 +1808,22 @@ inline Ctxt innerProduct(const std::vector<Ctxt>& v1,
   return ret;
 }
 
+//! @brief The product of two ciphertexts, with re-linearization.
+//! @note A temporary left operand is multiplied in place, so in chains such
+//! as `a * b * c` only the first product makes a new ciphertext.
+inline Ctxt operator*(Ctxt&& lhs, const Ctxt& rhs)
+{
+  lhs.multiplyBy(rhs);
+  return std::move(lhs);
+}
+
+inline Ctxt operator*(const Ctxt& lhs, const Ctxt& rhs)
+{
+  Ctxt prod(lhs);
+  prod.multiplyBy(rhs);
+  return prod;
+}
+
 //! frobeniusAutomorph: free function version of frobeniusAutomorph method
 inline void frobeniusAutomorph(Ctxt& ctxt, long j)
 {
@@ -1549,6 +1848,62 @@ inline void negate(Ctxt& ctxt) { ctxt.negate(); }
 //! print to cerr some info about ciphertext
 void CheckCtxt(const Ctxt& c, const char* label);
 
+//! @brief One operation on a ciphertext, as handed to the hook of
+//! setCtxtOpHook
+struct CtxtOpReport
+{
+  //! The operation, such as "multiplyBy", "reLinearize" or "modDownToSet"
+  const char* op = nullptr;
+  //! The ciphertext that was changed
+  const Ctxt* ctxt = nullptr;
+  //! The number of traced operations on the same thread that enclose this
+  //! one: 0 for a call from the application, 1 for the reLinearize called
+  //! by multiplyBy, and so on
+  long depth = 0;
+  //! capacity() in bits, before and after
+  double capacityBefore = 0;
+  double capacityAfter = 0;
+  //! log2 of the noise bound, before and after
+  double noiseBefore = 0;
+  double noiseAfter = 0;
+  //! The number of primes in the prime set, before and after
+  long primesBefore = 0;
+  long primesAfter = 0;
+};
+
+std::ostream& operator<<(std::ostream& str, const CtxtOpReport& report);
+
+//! @brief Hand every traced operation on a ciphertext to hook, once it
+//! completes; an empty hook (the default) turns the tracing off.
+//! @note The hook is called from whichever thread ran the operation, so it
+//! must be thread-safe. Set the hook before computing, not concurrently
+//! with it. Operations that throw are not reported.
+void setCtxtOpHook(std::function<void(const CtxtOpReport&)> hook);
+
+/**
+ * @class CtxtOpTrace
+ * @brief Report the operation `op` on `ctxt` to the hook of setCtxtOpHook
+ * when the object goes out of scope.
+ *
+ * Used by the methods of Ctxt that change a ciphertext, and by the
+ * single-ciphertext reCrypt and thinReCrypt. Without a hook it costs a
+ * single test.
+ **/
+class CtxtOpTrace
+{
+public:
+  CtxtOpTrace(const Ctxt& ctxt, const char* op);
+  ~CtxtOpTrace();
+
+  CtxtOpTrace(const CtxtOpTrace&) = delete;
+  CtxtOpTrace& operator=(const CtxtOpTrace&) = delete;
+
+private:
+  CtxtOpReport report;
+  int uncaught = 0; // the exceptions in flight at the start
+  bool active;
+};
+
 /**
  * @brief Extract the mod-p digits of a mod-p^r ciphertext.
  *
@@ -0,0 +1,138 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_CTXTPOOL_H
+#define HELIB_CTXTPOOL_H
+/**
+ * @file CtxtPool.h
+ * @brief Recycling of whole ciphertexts between requests
+ **/
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <helib/Ctxt.h>
+
+namespace helib {
+
+/**
+ * @class CtxtPool
+ * @brief A thread-safe free list of ciphertexts under one public key
+ *
+ * The ScratchPool already recycles the rows of destroyed DoubleCRT
+ * objects, but a Ctxt that is created and destroyed still allocates its
+ * parts, their index maps and their rows one by one. A ciphertext taken
+ * from a CtxtPool keeps the parts it had when it was returned, and
+ * assigning a ciphertext over the same primes to it copies into the
+ * existing rows without allocating anything.
+ *
+ * acquire() hands out a Handle, which returns the ciphertext to the pool
+ * when it goes out of scope. The pool must outlive its handles. It holds
+ * at most getMaxSize() idle ciphertexts; extra ones are destroyed.
+ **/
+class CtxtPool
+{
+  using Ptr = std::unique_ptr<Ctxt>;
+
+public:
+  //! The default value of getMaxSize()
+  static constexpr long DEFAULT_MAX_SIZE = 1024;
+
+  /**
+   * @class Handle
+   * @brief Exclusive use of a ciphertext of a CtxtPool until destruction
+   **/
+  class Handle
+  {
+    CtxtPool* pool = nullptr;
+    Ptr ctxt;
+
+    Handle(CtxtPool* pool, Ptr ctxt) : pool(pool), ctxt(std::move(ctxt)) {}
+    friend class CtxtPool;
+
+  public:
+    //! @brief An empty handle
+    Handle() = default;
+    Handle(const Handle&) = delete;
+    Handle& operator=(const Handle&) = delete;
+    Handle(Handle&& other) noexcept = default;
+    Handle& operator=(Handle&& other) noexcept
+    {
+      if (this != &other) {
+        reset();
+        pool = other.pool;
+        ctxt = std::move(other.ctxt);
+      }
+      return *this;
+    }
+    ~Handle() { reset(); }
+
+    //! @brief Give the ciphertext back to its pool now
+    void reset();
+
+    Ctxt& operator*() const { return *ctxt; }
+    Ctxt* operator->() const { return ctxt.get(); }
+    Ctxt* get() const { return ctxt.get(); }
+    explicit operator bool() const { return bool(ctxt); }
+  };
+
+  explicit CtxtPool(const PubKey& pubKey, long maxSize = DEFAULT_MAX_SIZE);
+  CtxtPool(const CtxtPool&) = delete;
+  CtxtPool& operator=(const CtxtPool&) = delete;
+
+  /**
+   * @brief Take a ciphertext out of the pool, or make a new one if the pool
+   * is empty.
+   * @note A recycled ciphertext holds whatever it held when it was returned.
+   * It is meant to be assigned to (or encrypted into) before it is used.
+   **/
+  Handle acquire();
+
+  /**
+   * @brief Add ciphertexts to the pool until it holds n of them (or
+   * getMaxSize()).
+   *
+   * They are copies of an encryption of zero under the key, so they have
+   * two parts over the ciphertext primes, and the first requests served by
+   * the pool do not allocate either.
+   **/
+  void reserve(long n);
+
+  //! @brief Destroy the idle ciphertexts
+  void clear();
+
+  //! @brief The number of idle ciphertexts in the pool
+  long size() const;
+
+  long getMaxSize() const { return maxSize; }
+  const PubKey& getPubKey() const { return pubKey; }
+
+  //! @brief The number of acquire() served from the pool, and from new
+  //! ciphertexts
+  long hits() const;
+  long misses() const;
+
+private:
+  const PubKey& pubKey;
+  const long maxSize;
+
+  mutable std::mutex mutex;
+  std::vector<Ptr> idle;
+  long nHits = 0;
+  long nMisses = 0;
+
+  void giveBack(Ptr ctxt);
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_CTXTPOOL_H
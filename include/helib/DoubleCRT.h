@@ -32,8 +32,12 @@
 #include <helib/zzX.h>
 #include <helib/NumbTh.h>
 #include <helib/IndexMap.h>
+#include <helib/ScratchPool.h>
+#include <helib/memoryReport.h>
 #include <helib/timing.h>
 
+#include <atomic>
+
 namespace helib {
 
 class Context;
@@ -49,9 +53,16 @@ class DoubleCRTHelper : public IndexMapInit<NTL::vec_long>
 public:
   DoubleCRTHelper() = delete;
   DoubleCRTHelper(const Context& context);
+  //! A copy is charged to the current MemoryScope, or to the category of
+  //! other outside of scopes
+  DoubleCRTHelper(const DoubleCRTHelper& other);
+  ~DoubleCRTHelper() override;
 
-  /** @brief the init method ensures that all rows have the same size */
-  virtual void init(NTL::vec_long& v) { v.FixLength(val); }
+  /** @brief the init method ensures that all rows have the same size.
+   * Rows are taken from (and released to) the ScratchPool of the thread,
+   * and charged to the memory category of the helper */
+  virtual void init(NTL::vec_long& v);
+  virtual void release(NTL::vec_long& v);
 
   /** @brief clone allocates a new object and copies the content */
   virtual IndexMapInit<NTL::vec_long>* clone() const
@@ -59,8 +70,17 @@ public:
     return new DoubleCRTHelper(*this);
   }
 
+  MemoryCategory getMemoryCategory() const { return category; }
+  //! @brief Move the rows and the object over to another category
+  void setMemoryCategory(MemoryCategory newCategory);
+
 private:
   long val;
+  const Context* context;
+  MemoryCategory category;
+  // The rows currently charged to category. Atomic, since a helper shared
+  // by DoubleCRTs gains rows from the parallel loops that detach them.
+  std::atomic<long> rows{0};
 };
 
 /**
@@ -83,6 +103,12 @@ private:
  * and also modulo Phi_m(X). Arithmetic operations can only be applied to
  * DoubleCRT objects relative to the same context, trying to add/multiply
  * objects that have different Context objects will raise an error.
+ *
+ * The rows are kept as one NTL::vec_long per prime, not in a FlatDoubleCRT:
+ * the FFTs of Cmodulus, the ScratchPool and the callers that swap rows in
+ * and out all work on NTL::vec_long, and an NTL vector cannot point into
+ * the buffer of a FlatDoubleCRT. Code that wants the flat layout converts
+ * to and from a FlatDoubleCRT at its boundaries.
  **/
 class DoubleCRT
 {
@@ -117,6 +143,11 @@ private:
   template <typename Fun>
   DoubleCRT& Op(const NTL::ZZX& poly, Fun fun);
 
+  // *this = sum_k a[k] * b_k over the primes of *this, where bRow(k, i)
+  // points to the residues of b_k modulo the i'th prime
+  template <typename BRow>
+  DoubleCRT& innerProductRows(const std::vector<DoubleCRT>& a, BRow bRow);
+
 public:
   // Constructors and assignment operators
 
@@ -128,6 +159,11 @@ public:
   // Default copy-constructor:
   DoubleCRT(const DoubleCRT& other) = default;
 
+  //! @brief A move takes the rows of other, which is left without any rows
+  //! and without a helper. It may then be destroyed, or assigned to: it
+  //! takes the memory category of what it is assigned.
+  DoubleCRT(DoubleCRT&& other) noexcept = default;
+
   //! @brief Initializing DoubleCRT from a ZZX polynomial
   //! @param poly The ring element itself, zero if not specified
   //! @param _context The context for this DoubleCRT object, use "current active
@@ -181,6 +217,15 @@ public:
 
   DoubleCRT& operator=(const DoubleCRT& other);
 
+  //! @brief Take the rows of other, which keep the memory category of
+  //! *this (or of other, when *this was moved from).
+  DoubleCRT& operator=(DoubleCRT&& other);
+
+  //! @brief Become a copy-on-write copy of other: the rows are shared, and
+  //! a row is only copied when either object first modifies it (see
+  //! `IndexMap::share`). *this keeps its memory category.
+  void share(const DoubleCRT& other);
+
   // Copy only the primes in s \intersect other.getIndexSet()
   //  void partialCopy(const DoubleCRT& other, const IndexSet& s);
 
@@ -229,6 +274,20 @@ public:
   //
   // void toPolyMod(ZZX& p, const ZZ &Q, const IndexSet& s) const;
 
+  //! @brief The coefficients of toPoly() reduced modulo a single-precision
+  //! modulus, in [0, modulus). The CRT is done without multi-precision
+  //! integers: the multiple of P to subtract is estimated in floating point,
+  //! so the result is exact only if all the coefficients of toPoly() are
+  //! well inside (-P/2, P/2), as is the case after decryption.
+  void toPolyMod(zzX& p, long modulus) const;
+
+  //! @brief The coefficients of toPoly() as doubles, with the CRT done in
+  //! 128-bit arithmetic rather than with multi-precision integers. The
+  //! product P of the primes must have at most 126 bits, and as for
+  //! toPolyMod the result can only be relied upon if all the coefficients
+  //! are well inside (-P/2, P/2).
+  void toPolyDouble(std::vector<double>& p) const;
+
   bool operator==(const DoubleCRT& other) const
   {
     assertEq(&context,
@@ -255,7 +314,9 @@ public:
 
   //! @brief Break into n digits,according to the primeSets in context.digits.
   //! See Section 3.1.6 of the design document (re-linearization)
-  //! Returns the sum of the canonical embedding of the digits
+  //! Returns the sum of the canonical embedding of the digits. Building with
+  //! HELIB_FAST_DIGIT_NOISE defined returns a high-probability bound on it
+  //! instead, and adds the primes back with the fast base extension
   NTL::xdouble breakIntoDigits(std::vector<DoubleCRT>& dgts) const;
 
   //! @brief Expand the index set by s1.
@@ -264,6 +325,14 @@ public:
   //! toPoly.
   void addPrimes(const IndexSet& s1, NTL::ZZX* poly_p = 0);
 
+  //! @brief Expand the index set by s1, using fast RNS base extension.
+  //! This avoids the big-integer CRT of addPrimes, at the cost of a lift
+  //! that is only balanced with high probability: a coefficient may be off
+  //! by the product of the current primes (the result is still the same
+  //! integer polynomial modulo all the primes). s1 must be disjoint from the
+  //! current index set.
+  void addPrimesFast(const IndexSet& s1);
+
   //! @brief Expand index set by s1, and multiply by Prod_{q in s1}.
   //! s1 is disjoint from the current index set, returns log(product).
   double addPrimesAndScale(const IndexSet& s1);
@@ -325,6 +394,24 @@ public:
   void Sub(const DoubleCRT& other, bool matchIndexSets = true);
   void Mul(const DoubleCRT& other, bool matchIndexSets = true);
 
+  //! @brief Fused multiply-accumulate, *this += a * b, in a single pass and
+  //! without temporaries. The prime sets of a and b must contain the prime
+  //! set of *this, which is left unchanged
+  DoubleCRT& mulAdd(const DoubleCRT& a, const DoubleCRT& b);
+
+  //! @brief Set *this = sum_i a[i] * b[i], over the current prime set of
+  //! *this. The sum is accumulated lazily and reduced only once per
+  //! coefficient (every few terms for very large primes). b may be longer
+  //! than a, its extra entries are ignored
+  DoubleCRT& innerProduct(const std::vector<DoubleCRT>& a,
+                          const std::vector<DoubleCRT>& b);
+
+  //! @brief Same as above, with b[k][i] pointing to the residues of the
+  //! k'th term modulo the i'th prime, held outside of any DoubleCRT (e.g.
+  //! in a memory-mapped key file)
+  DoubleCRT& innerProduct(const std::vector<DoubleCRT>& a,
+                          const std::vector<IndexMap<const long*>>& b);
+
   // Division by constant
   DoubleCRT& operator/=(const NTL::ZZ& num);
   DoubleCRT& operator/=(long num) { return (*this /= NTL::to_ZZ(num)); }
@@ -350,41 +437,78 @@ public:
   const IndexMap<NTL::vec_long>& getMap() const { return map; }
   const IndexSet& getIndexSet() const { return map.getIndexSet(); }
 
+  //! @brief The category this object is charged to (see memoryReport.h)
+  MemoryCategory getMemoryCategory() const;
+  //! @brief Charge this object and its rows to `category` from now on
+  void setMemoryCategory(MemoryCategory category);
+
   // Choose random DoubleCRT's, either at random or with small/Gaussian
   // coefficients.
 
   //! @brief Fills each row i with random ints mod pi, uses NTL's PRG
   void randomize(const NTL::ZZ* seed = nullptr);
 
+  //! @brief Fills each row i with random ints mod pi, reading prg in order
+  void randomize(PRG& prg);
+
+  //! @brief Fills each row i with random ints mod pi, from a PRG stream
+  //! keyed by (seed, index, pi). Unlike the above, a row does not depend on
+  //! the other primes in the IndexSet or on NTL's PRG state, so the rows
+  //! are generated in parallel
+  void randomize(const NTL::ZZ& seed, long index);
+
   //! Sampling routines:
   //! Each of these return a high probability bound on L-infty norm
-  //! of canonical embedding
+  //! of canonical embedding, and draws from prg (see sample.h)
 
   //! @brief Coefficients are -1/0/1, Prob[0]=1/2
-  double sampleSmall();
-  double sampleSmallBounded();
+  double sampleSmall(PRG& prg = PRG::current());
+  double sampleSmallBounded(PRG& prg = PRG::current());
 
   //! @brief Coefficients are -1/0/1 with pre-specified number of nonzeros
-  double sampleHWt(long Hwt);
-  double sampleHWtBounded(long Hwt);
+  double sampleHWt(long Hwt, PRG& prg = PRG::current());
+  double sampleHWtBounded(long Hwt, PRG& prg = PRG::current());
 
   //! @brief Coefficients are Gaussians
   //! Return a high probability bound on L-infty norm of canonical embedding
-  double sampleGaussian(double stdev = 0.0);
-  double sampleGaussianBounded(double stdev = 0.0);
-  NTL::xdouble sampleGaussianBounded(NTL::xdouble stdev);
+  double sampleGaussian(double stdev = 0.0, PRG& prg = PRG::current());
+  double sampleGaussianBounded(double stdev = 0.0, PRG& prg = PRG::current());
+  NTL::xdouble sampleGaussianBounded(NTL::xdouble stdev,
+                                     PRG& prg = PRG::current());
 
   //! @brief Coefficients are uniform in [-B..B]
-  double sampleUniform(long B);
-  NTL::xdouble sampleUniform(const NTL::ZZ& B);
+  double sampleUniform(long B, PRG& prg = PRG::current());
+  NTL::xdouble sampleUniform(const NTL::ZZ& B, PRG& prg = PRG::current());
 
   // used to implement modulus switching
   void scaleDownToSet(const IndexSet& s, long ptxtSpace, NTL::ZZX& delta);
 
+  // The same, in RNS form: one inverse transform per dropped prime, and one
+  // transform per remaining prime, with single-precision arithmetic only.
+  // fdelta gets delta divided by the product of the dropped primes.
+  void scaleDownToSet(const IndexSet& s,
+                      long ptxtSpace,
+                      std::vector<double>& fdelta);
+
   void FFT(const NTL::ZZX& poly, const IndexSet& s);
   void FFT(const zzX& poly, const IndexSet& s);
   // for internal use
 
+  //! @brief Set this to the polynomial with the given coefficients (at most
+  //! phi(m) of them), keeping the current primes. Each coefficient is reduced
+  //! straight into the rows, with no intermediate polynomial modulo each
+  //! prime.
+  void setCoeffs(const std::vector<long>& coeffs);
+
+  //! @brief Set dcrts[k] to polys[k] modulo the primes in s, for every k.
+  //! The (polynomial, prime) pairs are transformed in parallel, in runs of
+  //! polynomials that share a prime, so NTL's modulus is set up once per run
+  //! rather than once per transform.
+  static void FFTBatch(std::vector<DoubleCRT>& dcrts,
+                       const std::vector<zzX>& polys,
+                       const Context& context,
+                       const IndexSet& s);
+
   void reduce() const {} // place-holder for consistent with AltCRT
 
   // Raw I/O
@@ -410,6 +534,20 @@ public:
    **/
   void read(std::istream& str);
 
+  /**
+   * @brief Write out the `DoubleCRT` object in binary format, with the
+   * residues modulo each prime p_i packed into NumBits(p_i - 1) bits.
+   * @param str Output `std::ostream`.
+   **/
+  void writePackedTo(std::ostream& str) const;
+
+  /**
+   * @brief In-place read from the stream a `DoubleCRT` object written with
+   * writePackedTo.
+   * @param str Input `std::istream`.
+   **/
+  void readPacked(std::istream& str);
+
   /**
    * @brief Write out the ciphertext (`Ctxt`) object to the output
    * stream using JSON format.
@@ -460,6 +598,10 @@ public:
 
   friend std::ostream& operator<<(std::ostream& s, const DoubleCRT& d);
   friend std::istream& operator>>(std::istream& s, DoubleCRT& d);
+
+  // FlatDoubleCRT and MappedRows write directly into the rows of the map
+  friend class FlatDoubleCRT;
+  friend class MappedRows;
 };
 
 inline void conv(DoubleCRT& d, const NTL::ZZX& p) { d = p; }
@@ -12,6 +12,8 @@
 #ifndef HELIB_ENCODED_PTXT_H
 #define HELIB_ENCODED_PTXT_H
 
+#include <atomic>
+
 #include <helib/DoubleCRT.h>
 #include <helib/norms.h>
 
@@ -25,13 +27,42 @@ private:
   long ptxtSpace;
   const Context& context;
 
+  // embeddingLargestCoeff(poly), computed on the first call to getSize()
+  // (or given when encoding), or -1. Threads that race to fill it in compute
+  // the same value.
+  mutable std::atomic<double> size;
+
 public:
   const zzX& getPoly() const { return poly; }
   long getPtxtSpace() const { return ptxtSpace; }
   const Context& getContext() const { return context; }
 
-  EncodedPtxt_BGV(const zzX& poly_, long ptxtSpace_, const Context& context_) :
-      poly(poly_), ptxtSpace(ptxtSpace_), context(context_)
+  //! The largest coefficient of the canonical embedding of getPoly(), which
+  //! bounds the size of the constant. It is computed once per encoding, so a
+  //! constant applied many times (say a diagonal of a matrix) does not pay an
+  //! FFT each time.
+  double getSize() const
+  {
+    double sz = size.load(std::memory_order_relaxed);
+    if (sz < 0) {
+      sz = embeddingLargestCoeff(poly, context.getZMStar());
+      size.store(sz, std::memory_order_relaxed);
+    }
+    return sz;
+  }
+
+  EncodedPtxt_BGV(const zzX& poly_,
+                  long ptxtSpace_,
+                  const Context& context_,
+                  double size_ = -1) :
+      poly(poly_), ptxtSpace(ptxtSpace_), context(context_), size(size_)
+  {}
+
+  EncodedPtxt_BGV(const EncodedPtxt_BGV& other) :
+      poly(other.poly),
+      ptxtSpace(other.ptxtSpace),
+      context(other.context),
+      size(other.size.load(std::memory_order_relaxed))
   {}
 };
 
@@ -78,8 +109,9 @@ or nothing at all.
 * eptxt.getCKKS() returns a read-only reference to the contained
      EncodedPtxt_CKKS object (or throws a std::bad_cast exception)
 
-* eptxt.resetBGV(poly, ptxtSpace, context) replaces the contents
-     of eptxt with a new EncodedPtxt_BGV object
+* eptxt.resetBGV(poly, ptxtSpace, context[, size]) replaces the contents
+     of eptxt with a new EncodedPtxt_BGV object (size, if known, is its
+     canonical embedding norm)
 
 * eptxt.resetCKKS(poly, mag, scale, err, context) replaces the contents
      of eptxt with a new EncodedPtxt_CKKS object
@@ -161,9 +193,12 @@ public:
     return rep->getCKKS();
   }
 
-  void resetBGV(const zzX& poly, long ptxtSpace, const Context& context)
+  void resetBGV(const zzX& poly,
+                long ptxtSpace,
+                const Context& context,
+                double size = -1)
   {
-    rep.reset(new EncodedPtxt_derived_BGV(poly, ptxtSpace, context));
+    rep.reset(new EncodedPtxt_derived_BGV(poly, ptxtSpace, context, size));
   }
 
   void resetCKKS(const zzX& poly,
@@ -199,8 +234,7 @@ public:
   FatEncodedPtxt_BGV(const EncodedPtxt_BGV& eptxt, const IndexSet& s) :
       dcrt(eptxt.getPoly(), eptxt.getContext(), s),
       ptxtSpace(eptxt.getPtxtSpace()),
-      size(embeddingLargestCoeff(eptxt.getPoly(),
-                                 eptxt.getContext().getZMStar()))
+      size(eptxt.getSize())
   {}
 
   FatEncodedPtxt_BGV(const DoubleCRT& dcrt_, long ptxtSpace_, double size_) :
@@ -235,6 +269,19 @@ public:
                       double err_) :
       dcrt(dcrt_), mag(mag_), scale(scale_), err(err_)
   {}
+
+  // The encoding of the slots v with the given scale, built directly in
+  // DoubleCRT form with the primes in s
+  FatEncodedPtxt_CKKS(const std::vector<cx_double>& v,
+                      const Context& context,
+                      const IndexSet& s,
+                      double mag_,
+                      double scale_,
+                      double err_) :
+      dcrt(context, s), mag(mag_), scale(scale_), err(err_)
+  {
+    CKKS_embedInSlots(dcrt, v, context.getZMStar(), scale);
+  }
 };
 
 class FatEncodedPtxt_base
@@ -347,7 +394,44 @@ public:
       rep.reset();
   }
 
+  void resetCKKS(const std::vector<cx_double>& v,
+                 const Context& context,
+                 const IndexSet& s,
+                 double mag,
+                 double scale,
+                 double err)
+  {
+    rep.reset(new FatEncodedPtxt_derived_CKKS(v, context, s, mag, scale, err));
+  }
+
+  void resetBGV(const DoubleCRT& dcrt, long ptxtSpace, double size)
+  {
+    rep.reset(new FatEncodedPtxt_derived_BGV(dcrt, ptxtSpace, size));
+  }
+
+  void resetCKKS(const DoubleCRT& dcrt, double mag, double scale, double err)
+  {
+    rep.reset(new FatEncodedPtxt_derived_CKKS(dcrt, mag, scale, err));
+  }
+
   void reset() { rep.reset(); }
+
+  //! Apply the automorphism X -> X^k to the constant. An automorphism keeps
+  //! the canonical embedding norm, so the size of the constant is unchanged.
+  void automorph(long k)
+  {
+    if (isBGV()) {
+      const FatEncodedPtxt_BGV& bgv = getBGV();
+      DoubleCRT dcrt = bgv.getDCRT();
+      dcrt.automorph(k);
+      resetBGV(dcrt, bgv.getPtxtSpace(), bgv.getSize());
+    } else if (isCKKS()) {
+      const FatEncodedPtxt_CKKS& ckks = getCKKS();
+      DoubleCRT dcrt = ckks.getDCRT();
+      dcrt.automorph(k);
+      resetCKKS(dcrt, ckks.getMag(), ckks.getScale(), ckks.getErr());
+    }
+  }
 };
 
 } // namespace helib
@@ -0,0 +1,102 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_ENCODEDPTXTCACHE_H
+#define HELIB_ENCODEDPTXTCACHE_H
+/**
+ * @file EncodedPtxtCache.h
+ * @brief A constant kept in DoubleCRT form for the prime sets it is used at
+ **/
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include <helib/EncodedPtxt.h>
+
+namespace helib {
+
+/**
+ * @class EncodedPtxtCache
+ * @brief An `EncodedPtxt` with its `FatEncodedPtxt` forms for the prime
+ * sets of the ciphertexts it was used with.
+ *
+ * A constant such as a weight of a model is often multiplied into
+ * ciphertexts at several levels. Multiplying by an `EncodedPtxt` transforms
+ * it to DoubleCRT form over the primes of the ciphertext every time; with
+ * a cache, this is done once per prime set. A form over a superset of the
+ * primes of a ciphertext serves it too (the rows of the other primes are
+ * ignored), so a constant used at decreasing levels is only transformed
+ * for the first one.
+ *
+ * The forms are kept up to getMaxBytes() bytes of rows, the least recently
+ * used being dropped first; the last one made is always kept. The cache is
+ * thread-safe, and the forms are handed out as shared pointers, so a form
+ * dropped while in use stays alive until it is released.
+ **/
+class EncodedPtxtCache
+{
+public:
+  //! The default value of getMaxBytes()
+  static constexpr long DEFAULT_MAX_BYTES = 64L << 20;
+
+  explicit EncodedPtxtCache(const EncodedPtxt& eptxt,
+                            long maxBytes = DEFAULT_MAX_BYTES);
+  EncodedPtxtCache(const EncodedPtxtCache&) = delete;
+  EncodedPtxtCache& operator=(const EncodedPtxtCache&) = delete;
+
+  /**
+   * @brief The constant in DoubleCRT form over (at least) the primes of s.
+   *
+   * A cached form over a superset of s is returned when there is one, and
+   * a new form over s is made and cached otherwise.
+   **/
+  std::shared_ptr<const FatEncodedPtxt> get(const IndexSet& s) const;
+
+  const EncodedPtxt& getEncoded() const { return eptxt; }
+  long getMaxBytes() const { return maxBytes; }
+
+  //! @brief The number of cached forms, and the bytes of their rows
+  long size() const;
+  long bytes() const;
+
+  //! @brief The number of get() served from the cache, and from new forms
+  long hits() const;
+  long misses() const;
+
+  //! @brief Drop the cached forms
+  void clear();
+
+private:
+  struct Entry
+  {
+    IndexSet primes;
+    long bytes;
+    std::shared_ptr<const FatEncodedPtxt> form;
+  };
+
+  const EncodedPtxt eptxt;
+  const long maxBytes;
+
+  // Most recently used first
+  mutable std::mutex mutex;
+  mutable std::list<Entry> entries;
+  mutable long nBytes = 0;
+  mutable long nHits = 0;
+  mutable long nMisses = 0;
+
+  // The entry over a superset of s, moved to the front, or nullptr
+  const Entry* find(const IndexSet& s) const;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_ENCODEDPTXTCACHE_H
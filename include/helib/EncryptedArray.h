@@ -18,6 +18,10 @@
 #include <exception>
 #include <cmath>
 #include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <NTL/Lazy.h>
 #include <NTL/pair.h>
 #include <NTL/SmartPtr.h>
@@ -32,6 +36,7 @@
 namespace helib {
 
 typedef std::complex<double> cx_double;
+typedef std::complex<float> cx_float;
 
 // DIRT: we're using undocumented NTL interfaces here
 //   also...this probably should be defined in NTL, anyway....
@@ -421,6 +426,26 @@ private:
   NTL::Lazy<NTL::Pair<NTL::Mat<R>, NTL::Mat<R>>> normalBasisMatrices;
   // a is the matrix, b is its inverse
 
+  // The masks of the rotations along bad dimensions, as DoubleCRT objects
+  // with the size of their canonical embedding. Built on first use for each
+  // (dimension, amount, prime set), keyed by i, amt then the primes, and
+  // shared by all threads thereafter. Like the base converters of the
+  // context, at most MAX_CACHED_ROTATION_MASKS of them are kept, and masks
+  // past that are built afresh on every call.
+  static constexpr long MAX_CACHED_ROTATION_MASKS = 256;
+  struct RotationMask
+  {
+    DoubleCRT mask;
+    double size;
+  };
+  mutable std::mutex rotationMasksLock;
+  mutable std::map<std::vector<long>, std::shared_ptr<const RotationMask>>
+      rotationMasks;
+
+  std::shared_ptr<const RotationMask> getRotationMask(long i,
+                                                      long amt,
+                                                      const IndexSet& s) const;
+
 public:
   explicit EncryptedArrayDerived(const Context& _context,
                                  const RX& _G,
@@ -439,6 +464,8 @@ public:
     mappingData = other.mappingData;
     linPolyMatrix = other.linPolyMatrix;
     normalBasisMatrices = other.normalBasisMatrices;
+    std::lock_guard<std::mutex> lock(other.rotationMasksLock);
+    rotationMasks = other.rotationMasks;
   }
 
   EncryptedArrayDerived& operator=(const EncryptedArrayDerived&) = delete;
@@ -881,8 +908,10 @@ class EncryptedArrayDerived<PA_cx> : public EncryptedArrayBase
   const Context& context;
   const PAlgebraModCx& alMod;
 
-  zzX iEncoded; // an encoded plaintext with i in all the slots
-  // VJS-FIXME: this is a bad idea...see commenets in EaCx.cpp
+  // An encoded plaintext with i in all the slots, computed on first use.
+  // Once set it is never replaced, so copies and concurrent readers can
+  // share it (see getiEncoded).
+  mutable std::shared_ptr<const zzX> iEncoded;
 
 public:
   static double roundedSize(double x)
@@ -897,20 +926,17 @@ public:
 
   explicit EncryptedArrayDerived(const Context& _context) :
       context(_context), alMod(context.getAlMod().getCx())
-  {
-    clear(iEncoded);
-  }
+  {}
   EncryptedArrayDerived(const Context& _context, const PAlgebraModCx& _alMod) :
       context(_context), alMod(_alMod)
-  {
-    clear(iEncoded);
-  }
+  {}
 
   EncryptedArrayBase* clone() const override
   {
     return new EncryptedArrayDerived(*this);
   }
 
+  //! An encoding of i in all the slots. Safe to call from several threads.
   const zzX& getiEncoded() const;
   PA_tag getTag() const override { return PA_cx_tag; }
   const Context& getContext() const override { return context; }
@@ -922,6 +948,15 @@ public:
   void rotate1D(Ctxt& ctxt, long i, long k, bool dc = false) const override;
   void shift1D(Ctxt& ctxt, long i, long k) const override;
 
+  //! Set out[j] to ctxt rotated by amounts[j], for every j. The rotations
+  //! share a single breaking of ctxt into digits (hoisting) and run in
+  //! parallel. Each one follows the shortest chain of key-switching
+  //! matrices to its automorphism, which the public key keeps for all of
+  //! them (see PubKey::setKeySwitchMap).
+  void rotateMany(std::vector<Ctxt>& out,
+                  const Ctxt& ctxt,
+                  const std::vector<long>& amounts) const;
+
   long getP2R() const override { return alMod.getPPowR(); }
 
   // the following help with some template code
@@ -1207,6 +1242,15 @@ public:
     encode(eptxt, array1, mag, prec);
   }
 
+  //! @brief Same as above, from single-precision slots, which take half the
+  //! memory for bulk data. The transform runs in double precision, without
+  //! making a vector of double slots.
+  void encode(EncodedPtxt& eptxt,
+              const std::vector<cx_float>& array,
+              double mag = -1,
+              OptLong prec = OptLong()) const;
+  // implemented in EaCx.cpp
+
   virtual void encode(EncodedPtxt& eptxt,
                       const PlaintextArray& array,
                       double mag = -1,
@@ -1221,6 +1265,23 @@ public:
     encode(eptxt, array1);
   }
 
+  //! @brief Same as encode(EncodedPtxt&, ...), but straight to the DoubleCRT
+  //! form modulo the primes in s (e.g. the primes of the ciphertext it will
+  //! be multiplied with), without building the integer polynomial.
+  void encode(FatEncodedPtxt& feptxt,
+              const std::vector<cx_double>& array,
+              const IndexSet& s,
+              double mag = -1,
+              OptLong prec = OptLong()) const;
+  // implemented in EaCx.cpp
+
+  void encode(FatEncodedPtxt& feptxt,
+              const PlaintextArray& array,
+              const IndexSet& s,
+              double mag = -1,
+              OptLong prec = OptLong()) const;
+  // implemented in EaCx.cpp
+
   virtual void encodeUnitSelector(EncodedPtxt& eptxt, long i) const override
   {
     std::vector<cx_double> array(this->size(), cx_double(0.0));
@@ -1413,6 +1474,18 @@ public:
                   const SecKey& sKey,
                   std::vector<double>& ptxt) const override;
 
+  //! @brief Same as decrypt, into single-precision slots. Decoding runs in
+  //! double precision, but no vector of double slots is made.
+  void decrypt(const Ctxt& ctxt,
+               const SecKey& sKey,
+               std::vector<cx_float>& ptxt,
+               OptLong prec = OptLong()) const;
+
+  //! @brief Same as rawDecrypt, into single-precision slots
+  void rawDecrypt(const Ctxt& ctxt,
+                  const SecKey& sKey,
+                  std::vector<cx_float>& ptxt) const;
+
   void decrypt(const Ctxt& ctxt,
                const SecKey& sKey,
                PlaintextArray& ptxt,
@@ -1502,6 +1575,38 @@ public:
   //! it assumes that dcrt points to an object that encodes i.
   void extractImPart(Ctxt& c, DoubleCRT* dcrt = nullptr) const;
 
+  //! @name Two real vectors in one ciphertext
+  ///@{
+  //! The slots are complex, so a ciphertext can carry two real vectors re
+  //! and im as the slots re + i*im, which for real data doubles the number
+  //! of values per ciphertext. Additions, rotations, multiplications by
+  //! real constants and real linear maps such as MatMul_CKKS act on both
+  //! vectors at once. Products of two pairs mix them, so split a pair
+  //! before multiplying its vectors with other ciphertexts.
+
+  //! Encrypt re + i*im. Missing entries of re or im are zero.
+  void encryptPair(Ctxt& ctxt,
+                   const PubKey& key,
+                   const std::vector<double>& re,
+                   const std::vector<double>& im,
+                   double useThisSize = -1,
+                   long precision = -1) const;
+
+  //! Decrypt a pair encrypted with encryptPair (or made with joinPair).
+  void decryptPair(const Ctxt& ctxt,
+                   const SecKey& sKey,
+                   std::vector<double>& re,
+                   std::vector<double>& im,
+                   OptLong prec = OptLong()) const;
+
+  //! Set re and im to the encryptions of the two vectors of pair, with a
+  //! single complex conjugation for both.
+  void splitPair(Ctxt& re, Ctxt& im, const Ctxt& pair) const;
+
+  //! Set pair to re + i*im, where re and im encrypt real vectors.
+  void joinPair(Ctxt& pair, const Ctxt& re, const Ctxt& im) const;
+  ///@}
+
   //! @name Linearized polynomials for EncryptedArrayCx
   ///@{
   //! buildLinPolyCoeffs returns in C two encoded constants such that the
@@ -1584,16 +1689,20 @@ class EncryptedArray
 private:
   const PAlgebraMod& alMod;
   ClonedPtr<EncryptedArrayBase> rep;
+  unsigned long id; // see getId
+
+  static unsigned long newId();
 
 public:
   //! constructor: G defaults to the monomial X, PAlgebraMod from context
   EncryptedArray(const Context& context, const NTL::ZZX& G = NTL::ZZX(1, 1)) :
       alMod(context.getAlMod()),
-      rep(buildEncryptedArray(context, context.getAlMod(), G))
+      rep(buildEncryptedArray(context, context.getAlMod(), G)),
+      id(newId())
   {}
   //! constructor: G defaults to F0, PAlgebraMod explicitly given
   EncryptedArray(const Context& context, const PAlgebraMod& _alMod) :
-      alMod(_alMod), rep(buildEncryptedArray(context, _alMod))
+      alMod(_alMod), rep(buildEncryptedArray(context, _alMod)), id(newId())
   {}
 
   // NOTES:
@@ -1665,6 +1774,11 @@ public:
     }
   }
 
+  //! @brief A number telling this array apart from all the others made in
+  //! the process, unlike its address, which a later array may reuse. A copy
+  //! encodes alike, and keeps the number
+  unsigned long getId() const { return id; }
+
   const Context& getContext() const { return rep->getContext(); }
   const PAlgebraMod& getAlMod() const { return alMod; }
   const PAlgebra& getPAlgebra() const { return rep->getPAlgebra(); }
@@ -2230,6 +2344,22 @@ public:
       ea.encode(eptxt, pa); // ignore mag,prec for BGV
   }
 
+  //! @brief The encoding in DoubleCRT form modulo the primes in s. For
+  //! CKKS, this skips the integer polynomial of encode(EncodedPtxt&, ...).
+  void encode(FatEncodedPtxt& feptxt,
+              const IndexSet& s,
+              double mag = -1,
+              OptLong prec = OptLong()) const
+  {
+    if (ea.isCKKS()) {
+      ea.getCx().encode(feptxt, pa, s, mag, prec);
+    } else {
+      EncodedPtxt eptxt;
+      ea.encode(eptxt, pa); // ignore mag,prec for BGV
+      feptxt.expand(eptxt, s);
+    }
+  }
+
   void encrypt(Ctxt& ctxt, double mag = -1, OptLong prec = OptLong()) const
   {
     if (ea.isCKKS()) {
@@ -2242,6 +2372,20 @@ public:
     }
   }
 
+  //! @brief Encrypt over only the primes needed for targetCapacity bits of
+  //! capacity, see `PubKey::Encrypt(Ctxt&, const EncodedPtxt&, long)`
+  void encryptAtCapacity(Ctxt& ctxt,
+                         long targetCapacity,
+                         double mag = -1,
+                         OptLong prec = OptLong()) const
+  {
+    if (ea.isCKKS() && mag < 0)
+      mag = NextPow2(Norm(pa.getData<PA_cx>()));
+    EncodedPtxt eptxt;
+    encode(eptxt, mag, prec);
+    ctxt.getPubKey().Encrypt(ctxt, eptxt, targetCapacity);
+  }
+
   void decrypt(const Ctxt& ctxt, const SecKey& sKey, OptLong prec = OptLong())
   {
     if (ea.isCKKS())
@@ -2309,6 +2453,13 @@ public:
 
   void load(const std::vector<double>& array) { helib::encode(ea, pa, array); }
 
+  // Single-precision slots, as kept by clients of bulk CKKS data
+  void load(const std::vector<cx_float>& array)
+  {
+    std::vector<cx_double> array1(array.begin(), array.end());
+    load(array1);
+  }
+
   void load(int val) { helib::encode(ea, pa, long(val)); }
 
   void load(long val) { helib::encode(ea, pa, val); }
@@ -2390,6 +2541,13 @@ public:
 
   void store(std::vector<double>& array) const { decode(ea, array, pa); }
 
+  void store(std::vector<cx_float>& array) const
+  {
+    std::vector<cx_double> array1;
+    store(array1);
+    array.assign(array1.begin(), array1.end());
+  }
+
   //===============================
 
   // this is here for consistency with Ctxt class
@@ -2623,6 +2781,21 @@ inline double Distance(const PtxtArray& a, const PtxtArray& b)
 inline void totalSums(PtxtArray& a) { totalSums(a.ea, a.pa); }
 inline void runningSums(PtxtArray& a) { runningSums(a.ea, a.pa); }
 
+//! @brief Encode a batch of arrays, in parallel using NTL's thread pool.
+//! eptxts[i] is set to the same encoding as arrays[i].encode(mag, prec).
+void encodeBatch(std::vector<EncodedPtxt>& eptxts,
+                 const std::vector<PtxtArray>& arrays,
+                 double mag = -1,
+                 OptLong prec = OptLong());
+
+//! @brief Same as above, but goes on to the DoubleCRT form of every
+//! encoding modulo the primes in s, ready to be combined with ciphertexts.
+void encodeBatch(std::vector<FatEncodedPtxt>& feptxts,
+                 const std::vector<PtxtArray>& arrays,
+                 const IndexSet& s,
+                 double mag = -1,
+                 OptLong prec = OptLong());
+
 //=====================================
 
 // Following are functions for performing "higher level"
@@ -2649,6 +2822,102 @@ inline void totalSums(Ctxt& ctxt)
   totalSums(ctxt.getContext().getView(), ctxt);
 }
 
+/**
+ * @brief Same as `totalSums` above, one dimension at a time, with up to
+ * `fanOut-1` rotations per step.
+ * @param ea The `EncryptedArray` of the slots.
+ * @param ctxt The ciphertext to sum up.
+ * @param fanOut The most rotations of the same ciphertext added in one step,
+ * plus one. A step breaks its ciphertext into digits once for all of its
+ * rotations (see `Ctxt::hoistedAutomorphs`), so a wider fan-out takes fewer
+ * digit decompositions, in about log_fanOut(n) steps per dimension, for more
+ * key switches. `fanOut = 2` is the doubling of `totalSums` (though per
+ * dimension, and with no rotation crossing the dimensions).
+ *
+ * The fan-out in a dimension is lowered to the largest one whose rotations
+ * all have key-switching matrices, as found in the `PubKey` (all do under
+ * the `HELIB_KSS_FULL` strategy), down to 2.
+ *
+ * A bad dimension (see `EncryptedArray::nativeDimension`) takes no masks
+ * with every rotation: its automorphisms give the sum in its last
+ * coordinate, which is masked once and spread with the same steps. This
+ * takes one multiplication by a constant per bad dimension.
+ **/
+void totalSums(const EncryptedArray& ea, Ctxt& ctxt, long fanOut);
+
+/**
+ * @brief Same as `runningSums` above, with up to `fanOut-1` shifts per step.
+ * @param ea The `EncryptedArray` of the slots.
+ * @param ctxt The ciphertext to sum up.
+ * @param fanOut The most shifts added in one step, plus one.
+ *
+ * When the slots form one dimension, a shift is a rotation followed by a
+ * mask, and the rotations of a step are hoisted, with the fan-out lowered as
+ * for `totalSums` to the rotations that have key-switching matrices.
+ * Otherwise the shifts of a step are done in parallel.
+ **/
+void runningSums(const EncryptedArray& ea, Ctxt& ctxt, long fanOut);
+
+/**
+ * @brief Copies of ctxt shifted along the slots, with no care for what comes
+ * in from outside them.
+ * @param ea The `EncryptedArray` of the slots.
+ * @param out Resized to shifts.size(): out[t] gets slot s+shifts[t] of ctxt
+ * in slot s, for every s such that s+shifts[t] is a slot; the other slots
+ * are left undefined.
+ * @param ctxt The ciphertext to shift.
+ * @param shifts The shifts, of either sign; a zero shift is a copy.
+ *
+ * In one dimension these are the "don't care" rotations, even in a bad
+ * dimension (nothing that is kept wraps around), and they are hoisted.
+ * Otherwise they are rotations by -shifts[t], done in parallel.
+ **/
+void shiftedCopies(const EncryptedArray& ea,
+                   std::vector<Ctxt>& out,
+                   const Ctxt& ctxt,
+                   const std::vector<long>& shifts);
+
+/**
+ * @brief Pack ciphertexts that only use their first `width` slots into one.
+ * @param ea The `EncryptedArray` of the slots.
+ * @param packed The result: slot i*width+j holds slot j of ctxts[i], and the
+ * slots from ctxts.size()*width on are zero.
+ * @param ctxts The ciphertexts, whose slots from width on are ignored.
+ * @param width The number of slots used in each; ctxts.size()*width must
+ * not exceed ea.size().
+ *
+ * Each ciphertext is masked, then rotated into place, in parallel. This
+ * takes one multiplication by a constant per ciphertext and a rotation per
+ * ciphertext but the first. Results returned to a client that only use a
+ * few slots each then take one ciphertext instead of ctxts.size(), which can
+ * be written out compactly (see `Ctxt::writeCompact`).
+ **/
+void packSlots(const EncryptedArray& ea,
+               Ctxt& packed,
+               const std::vector<Ctxt>& ctxts,
+               long width);
+
+/**
+ * @brief The inverse of `packSlots`: ctxts[i] holds slots i*width to
+ * (i+1)*width-1 of packed in its first width slots, and zeros elsewhere.
+ * @param ea The `EncryptedArray` of the slots.
+ * @param ctxts The result, resized to count ciphertexts.
+ * @param packed The packed ciphertext.
+ * @param count The number of ciphertexts to take out.
+ * @param width The number of slots of each.
+ **/
+void unpackSlots(const EncryptedArray& ea,
+                 std::vector<Ctxt>& ctxts,
+                 const Ctxt& packed,
+                 long count,
+                 long width);
+
+//! @brief Replace y by y * y^p * ... * y^{p^{d-1}} in every slot, i.e. by
+//! its norm from GF(p^d) down to GF(p). This is the second step of mapTo01.
+void frobeniusNorm(const EncryptedArray& ea,
+                   Ctxt& ctxt,
+                   bool multithread = true);
+
 //! @brief Map all non-zero slots to 1, leaving zero slots as zero.
 //! Assumes that r=1, and that all the slots contain elements from GF(p^d).
 void mapTo01(const EncryptedArray& ea, Ctxt& ctxt, bool multithread = true);
@@ -2672,6 +2941,15 @@ void incrementalZeroTest(Ctxt* res[],
 // Complexity: O(d + n log d) smart automorphisms
 //             O(n d)
 
+//! @brief The batched version of incrementalZeroTest: res[c][i] is the test
+//! of bits 0..i of ctxts[c]. The linearized-polynomial coefficients are
+//! computed once for all the ciphertexts, which are then tested in parallel.
+//! The vector res is resized and initialized by this function.
+void incrementalZeroTest(std::vector<std::vector<Ctxt>>& res,
+                         const EncryptedArray& ea,
+                         const std::vector<Ctxt>& ctxts,
+                         long n);
+
 /*************** End linear transformation functions ****************/
 /********************************************************************/
 
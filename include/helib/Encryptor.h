@@ -0,0 +1,93 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_ENCRYPTOR_H
+#define HELIB_ENCRYPTOR_H
+/**
+ * @file Encryptor.h
+ * @brief Public-key encryption of many messages into reused storage.
+ **/
+#include <helib/Ctxt.h>
+#include <helib/DoubleCRT.h>
+#include <helib/EncodedPtxt.h>
+#include <helib/zzX.h>
+
+namespace helib {
+
+class PtxtArray;
+
+/**
+ * @class Encryptor
+ * @brief Encrypts under a public key with scratch space of its own.
+ *
+ * PubKey::Encrypt builds the polynomials r, e0, e1 and the plaintext as new
+ * `DoubleCRT` objects, and goes through `NTL::ZZX` on the way, for every
+ * message. An `Encryptor` keeps them (and the encoding of a `PtxtArray`)
+ * from one encryption to the next, and encrypts in place: a ciphertext
+ * that already holds a fresh encryption under the same key, e.g. the
+ * result of the previous call, keeps its rows. Once the first message is
+ * encrypted, encrypting another one of the same kind allocates nothing but
+ * what the encoding of the slots does.
+ *
+ * The ciphertexts are the same as those of PubKey::Encrypt from the same
+ * state of the NTL PRG, except that the zero encryptions precomputed by
+ * PubKey::precomputeZeroEncryptions are not used, and that the size of the
+ * BGV plaintext is not checked against its heuristic bound (which takes a
+ * canonical embedding per message).
+ *
+ * An `Encryptor` is used by one thread at a time; threads encrypting in
+ * parallel each take an `Encryptor` of their own.
+ **/
+class Encryptor
+{
+public:
+  explicit Encryptor(const PubKey& pubKey);
+
+  Encryptor(const Encryptor&) = delete;
+  Encryptor& operator=(const Encryptor&) = delete;
+
+  //! @brief Encrypt eptxt into ctxt, which must be under getPubKey()
+  void encrypt(Ctxt& ctxt, const EncodedPtxt& eptxt);
+
+  //! @brief Encode then encrypt ptxt, as PtxtArray::encrypt does
+  void encrypt(Ctxt& ctxt,
+               const PtxtArray& ptxt,
+               double mag = -1,
+               OptLong prec = OptLong());
+
+  const PubKey& getPubKey() const { return pubKey; }
+
+private:
+  const PubKey& pubKey;
+  const Context& context;
+  double stdev;
+
+  // The scratch polynomials, over the primes of the public key
+  zzX sample;
+  zzX poly;
+  DoubleCRT r;
+  DoubleCRT e;
+  DoubleCRT m;
+  EncodedPtxt encoded;
+
+  // Q mod ptxtSpace for the last BGV plaintext space seen
+  long lastPtxtSpace = 0;
+  long lastQmodP = 0;
+
+  // ctxt = r*pk + p*(e0,e1), as PubKey::encryptZero
+  void encryptZero(Ctxt& ctxt, long ptxtSpace);
+  void encryptBGV(Ctxt& ctxt, const EncodedPtxt_BGV& eptxt);
+  void encryptCKKS(Ctxt& ctxt, const EncodedPtxt_CKKS& eptxt);
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_ENCRYPTOR_H
@@ -73,7 +73,35 @@ public:
   // On by default, off for testing
 
   void upgrade();
+
+  // Upgrade the constants of every step at the primes in s only, see
+  // MatMulExecBase::upgrade. For a map only applied to ciphertexts whose
+  // primes are in s, this takes card(s) rows per constant rather than one
+  // per prime of the context.
+  void upgrade(const IndexSet& s);
+
   void apply(Ctxt& ctxt) const;
+
+  // Apply the transformation to every ciphertext in the vector, letting
+  // each step use the batch multiplication of its matrix.
+  void apply(std::vector<Ctxt>& ctxts) const;
+
+  // Write out the matrices, with their constants in whichever form (zzX
+  // or DoubleCRT) they are currently held, so that the map can be read
+  // back instead of being built again.
+  void writeTo(std::ostream& str) const;
+
+  // Read a map written by writeTo, for the same ea. Throws IOError if it
+  // was written with a different context or EncryptedArray, or for the
+  // other direction than invert.
+  static std::unique_ptr<EvalMap> readFrom(std::istream& str,
+                                           const EncryptedArray& ea,
+                                           bool invert);
+
+private:
+  EvalMap(const EncryptedArray& _ea, bool _invert) :
+      ea(_ea), invert(_invert), nfactors(0)
+  {}
 };
 
 //! @class ThinEvalMap
@@ -100,7 +128,26 @@ public:
               bool build_cache);
 
   void upgrade();
+
+  // See EvalMap::upgrade.
+  void upgrade(const IndexSet& s);
+
   void apply(Ctxt& ctxt) const;
+
+  // Apply the transformation to every ciphertext in the vector, letting
+  // each step use the batch multiplication of its matrix.
+  void apply(std::vector<Ctxt>& ctxts) const;
+
+  // See EvalMap::writeTo and EvalMap::readFrom.
+  void writeTo(std::ostream& str) const;
+  static std::unique_ptr<ThinEvalMap> readFrom(std::istream& str,
+                                               const EncryptedArray& ea,
+                                               bool invert);
+
+private:
+  ThinEvalMap(const EncryptedArray& _ea, bool _invert) :
+      ea(_ea), invert(_invert), nfactors(0)
+  {}
 };
 
 } // namespace helib
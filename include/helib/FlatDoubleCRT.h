@@ -0,0 +1,195 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_FLATDOUBLECRT_H
+#define HELIB_FLATDOUBLECRT_H
+/**
+ * @file FlatDoubleCRT.h
+ * @brief Double-CRT polynomials stored in a single contiguous buffer
+ **/
+#include <memory>
+#include <vector>
+
+#include <helib/DoubleCRT.h>
+#include <helib/hugePages.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+class Context;
+
+/**
+ * @class FlatDoubleCRT
+ * @brief An alternative storage backend for DoubleCRT residues
+ *
+ * A DoubleCRT keeps one heap-allocated NTL::vec_long per prime, looked up
+ * through a hash map. A FlatDoubleCRT keeps the same data in one
+ * 64-byte-aligned buffer of nPrimes rows, each row padded to a multiple of
+ * 64 bytes so that every row starts on a cache-line boundary. Rows are
+ * stored in increasing order of the prime index and looked up through a
+ * dense table, so row access is a single indexed load, the whole object
+ * is copied with one memcpy, and the inner loops over a row are plain
+ * strided loops over aligned memory.
+ *
+ * The class is meant for hot loops that touch many limbs (e.g. key
+ * switching), converting to and from DoubleCRT at the boundaries. It
+ * supports the element-wise arithmetic of DoubleCRT, with the same
+ * index-set rules: the primes of the operand must match these of *this.
+ * DoubleCRT itself does not use this class for its own rows (see the note
+ * in DoubleCRT.h).
+ *
+ * The buffer is a `HugePageBuffer`, charged to the memory category of the
+ * DoubleCRT it is made from (or of the current `MemoryScope`), so that the
+ * flat copies of long-lived data such as keys go to huge pages.
+ **/
+class FlatDoubleCRT
+{
+public:
+  //! Alignment (in bytes) of the buffer and of every row
+  static constexpr long ALIGNMENT = 64;
+
+  /**
+   * @brief Read-only view of the residues modulo a single prime
+   **/
+  class ConstRowView
+  {
+    const long* ptr;
+    long len;
+
+  public:
+    ConstRowView(const long* _ptr, long _len) : ptr(_ptr), len(_len) {}
+
+    long operator[](long j) const { return ptr[j]; }
+    const long* data() const { return ptr; }
+    long length() const { return len; }
+    const long* begin() const { return ptr; }
+    const long* end() const { return ptr + len; }
+  };
+
+  /**
+   * @brief Writable view of the residues modulo a single prime
+   **/
+  class RowView
+  {
+    long* ptr;
+    long len;
+
+  public:
+    RowView(long* _ptr, long _len) : ptr(_ptr), len(_len) {}
+
+    long& operator[](long j) const { return ptr[j]; }
+    long* data() const { return ptr; }
+    long length() const { return len; }
+    long* begin() const { return ptr; }
+    long* end() const { return ptr + len; }
+
+    operator ConstRowView() const { return ConstRowView(ptr, len); }
+  };
+
+private:
+  const Context* context;
+  IndexSet primes;       // the primes held by this object
+  std::vector<long> row; // row[i] = position of prime i in the buffer, or -1
+  long phim;             // number of (meaningful) entries per row
+  long stride;           // phim rounded up to a multiple of ALIGNMENT bytes
+  MemoryCategory category; // decides whether buf goes to huge pages
+  HugePageBuffer buf;
+
+  long* elts() const { return static_cast<long*>(buf.data()); }
+
+  void allocate();
+
+  long rowOf(long i) const
+  {
+#ifdef HELIB_DEBUG
+    assertInRange(i,
+                  0l,
+                  (long)row.size(),
+                  "FlatDoubleCRT: prime index out of range");
+    assertTrue(row[i] >= 0, "FlatDoubleCRT: prime not in the index set");
+#endif
+    return row[i];
+  }
+
+  template <typename Fun>
+  FlatDoubleCRT& Op(const FlatDoubleCRT& other, Fun fun);
+
+public:
+  FlatDoubleCRT() = delete;
+
+  //! @brief An all-zero object over the primes in s, charged to the
+  //! category of the current MemoryScope
+  FlatDoubleCRT(const Context& _context, const IndexSet& s);
+
+  //! @brief Copy the residues of a DoubleCRT into flat storage, charged to
+  //! the category of d
+  explicit FlatDoubleCRT(const DoubleCRT& d);
+
+  FlatDoubleCRT(const FlatDoubleCRT& other);
+  FlatDoubleCRT(FlatDoubleCRT&& other) noexcept = default;
+
+  FlatDoubleCRT& operator=(const FlatDoubleCRT& other);
+  FlatDoubleCRT& operator=(FlatDoubleCRT&& other) noexcept = default;
+
+  //! @brief Copy the residues of a DoubleCRT, resizing as needed
+  FlatDoubleCRT& operator=(const DoubleCRT& d);
+
+  //! @brief Write the residues back into a DoubleCRT. The index set of d is
+  //! replaced by the index set of *this
+  void toDoubleCRT(DoubleCRT& d) const;
+
+  //! @brief Return the residues as a fresh DoubleCRT
+  DoubleCRT toDoubleCRT() const;
+
+  const Context& getContext() const { return *context; }
+  const IndexSet& getIndexSet() const { return primes; }
+  MemoryCategory getMemoryCategory() const { return category; }
+
+  //! @brief The pages the buffer ended up in
+  HugePageKind getHugePageKind() const { return buf.kind(); }
+
+  //! @brief Number of entries per row (phi(m))
+  long getRowLength() const { return phim; }
+
+  //! @brief Distance (in longs) between the starts of consecutive rows
+  long getStride() const { return stride; }
+
+  //! @brief The underlying buffer, of card(primes) * stride longs. Rows are
+  //! in increasing order of their prime index; padding entries are zero
+  long* data() { return elts(); }
+  const long* data() const { return elts(); }
+
+  //! @brief The row of residues modulo the i'th prime of the chain
+  RowView operator[](long i)
+  {
+    return RowView(elts() + rowOf(i) * stride, phim);
+  }
+  ConstRowView operator[](long i) const
+  {
+    return ConstRowView(elts() + rowOf(i) * stride, phim);
+  }
+
+  //! @brief Set all residues to zero
+  FlatDoubleCRT& setZero();
+
+  // Element-wise arithmetic; the index sets must be equal
+  FlatDoubleCRT& operator+=(const FlatDoubleCRT& other);
+  FlatDoubleCRT& operator-=(const FlatDoubleCRT& other);
+  FlatDoubleCRT& operator*=(const FlatDoubleCRT& other);
+
+  //! @brief *this += a * b, in a single pass over the buffers
+  FlatDoubleCRT& addMul(const FlatDoubleCRT& a, const FlatDoubleCRT& b);
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_FLATDOUBLECRT_H
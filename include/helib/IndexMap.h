@@ -16,7 +16,9 @@
  * @brief Implementation of a map indexed by a dynamic set of integers.
  **/
 
+#include <memory>
 #include <unordered_map>
+#include <utility>
 #include <helib/IndexSet.h>
 #include <helib/ClonedPtr.h>
 
@@ -30,6 +32,10 @@ public:
   //! @brief Initialization function, override with initialization code
   virtual void init(T&) = 0;
 
+  //! @brief Called on an element just before it is removed from the map,
+  //! override to recycle its resources. The default does nothing
+  virtual void release(T&) {}
+
   //! @brief Cloning a pointer, override with code to create a fresh copy
   virtual IndexMapInit<T>* clone() const = 0;
   virtual ~IndexMapInit() {} // ensure that derived destructor is called
@@ -39,18 +45,23 @@ public:
 //!
 //! Additionally, it allows new elements of the map to be initialized in a
 //! flexible manner.
+//!
+//! Elements can also be shared between maps, copy-on-write: see share().
 template <typename T>
 class IndexMap
 {
-
-  std::unordered_map<long, T> map;
+  // Each element has its own reference count, so a shared element is
+  // detached by the first non-const access to it, without touching the
+  // others. Parallel loops over distinct elements may detach them at once,
+  // so the initialization object must allow concurrent calls to init.
+  std::unordered_map<long, std::shared_ptr<T>> map;
 
   IndexSet indexSet;
   ClonedPtr<IndexMapInit<T>> init;
 
 public:
   //! @brief The empty map
-  IndexMap();
+  IndexMap() = default;
 
   //! @brief A map with an initialization object.
   //! This associates a method for initializing new elements in the map.
@@ -62,24 +73,111 @@ public:
   //! operator new, and the pointer is "exclusively owned" by the map object.
   explicit IndexMap(IndexMapInit<T>* _init) : init(_init) {}
 
+  //! @brief Copies create their elements through the initialization object
+  //! (if any) before assigning them, and elements are handed to its release
+  //! method when they are removed or the map is destroyed.
+  IndexMap(const IndexMap& other) : indexSet(other.indexSet), init(other.init)
+  {
+    copyElements(other);
+  }
+
+  IndexMap& operator=(const IndexMap& other)
+  {
+    if (this == &other)
+      return *this;
+    releaseAll();
+    map.clear();
+    indexSet = other.indexSet;
+    init = other.init;
+    copyElements(other);
+    return *this;
+  }
+
+  //! @brief Moves take the elements, with the initialization object, and
+  //! leave other empty.
+  IndexMap(IndexMap&& other) noexcept :
+      map(std::move(other.map)),
+      indexSet(std::move(other.indexSet)),
+      init(std::move(other.init))
+  {
+    other.map.clear();
+    other.indexSet = IndexSet();
+  }
+
+  IndexMap& operator=(IndexMap&& other) noexcept
+  {
+    if (this == &other)
+      return *this;
+    releaseAll();
+    map = std::move(other.map);
+    indexSet = std::move(other.indexSet);
+    init = std::move(other.init);
+    other.map.clear();
+    other.indexSet = IndexSet();
+    return *this;
+  }
+
+  ~IndexMap() { releaseAll(); }
+
+  /**
+   * @brief Make *this a copy-on-write copy of other.
+   *
+   * The elements are shared with other rather than copied: an element is
+   * only copied (through the initialization object) at the first non-const
+   * access to it from either map, once it is used by both. Reading other
+   * from several threads while sharing it is safe. *this keeps its
+   * initialization object, or takes one from other if it has none. An
+   * element is handed to the release method of the last map that drops it.
+   **/
+  void share(const IndexMap& other)
+  {
+    if (this == &other)
+      return;
+    releaseAll();
+    map = other.map;
+    indexSet = other.indexSet;
+    if (!init)
+      init = other.init;
+  }
+
+  //! @brief Is element j used by another map too
+  bool isShared(long j) const { return map.at(j).use_count() > 1; }
+
   //! @brief Get the underlying index set
   const IndexSet& getIndexSet() const { return indexSet; }
 
+  //! @brief The initializer of the entries, or nullptr if there is none
+  const IndexMapInit<T>* getInit() const { return init.get(); }
+  IndexMapInit<T>* getInit() { return init.get(); }
+
   //! @brief Access functions: will raise an error
-  //! if j does not belong to the current index set
+  //! if j does not belong to the current index set. Non-const access
+  //! detaches a shared element first.
   T& operator[](long j)
   {
     assertTrue(indexSet.contains(j), "Key not found");
-    return map[j];
+    std::shared_ptr<T>& t = map.find(j)->second;
+    if (t.use_count() > 1)
+      t = fresh(&*t);
+    return *t;
   }
   const T& operator[](long j) const
   {
     assertTrue(indexSet.contains(j), "Key not found");
-    // unordered_map does not support a const [] operator,
-    // so we have to artificially strip away the const-ness here
-    std::unordered_map<long, T>& map1 =
-        const_cast<std::unordered_map<long, T>&>(map);
-    return map1[j];
+    // Every index in the set has its element (see insert), so const access
+    // never modifies the map and is safe from several threads
+    return *map.at(j);
+  }
+
+  //! @brief Access to an element that is about to be overwritten: a shared
+  //! element is replaced by a new one, without copying its value.
+  T& replace(long j)
+  {
+    assertTrue(indexSet.contains(j), "Key not found");
+    std::shared_ptr<T>& t = map.find(j)->second;
+    if (t.use_count() > 1)
+      t = fresh(nullptr);
+    return *t;
   }
 
   //! @brief Insert indexes to the IndexSet.
@@ -89,8 +187,7 @@ public:
   {
     if (!indexSet.contains(j)) {
       indexSet.insert(j);
-      if (init)
-        init->init(map[j]);
+      map[j] = fresh(nullptr);
     }
   }
   void insert(const IndexSet& s)
@@ -103,20 +200,58 @@ public:
   void remove(long j)
   {
     indexSet.remove(j);
-    map.erase(j);
+    erase(j);
   }
   void remove(const IndexSet& s)
   {
     for (long i = s.first(); i <= s.last(); i = s.next(i))
-      map.erase(i);
+      erase(i);
     indexSet.remove(s);
   }
 
   void clear()
   {
+    releaseAll();
     map.clear();
     indexSet.clear();
   }
+
+private:
+  // A new element, initialized, and then assigned from *value if not null
+  std::shared_ptr<T> fresh(const T* value)
+  {
+    auto t = std::make_shared<T>();
+    if (init)
+      init->init(*t);
+    if (value)
+      *t = *value;
+    return t;
+  }
+
+  void erase(long j)
+  {
+    auto it = map.find(j);
+    if (it == map.end())
+      return;
+    if (init && it->second.use_count() == 1)
+      init->release(*it->second);
+    map.erase(it);
+  }
+
+  // Only the elements that no other map uses are released
+  void releaseAll()
+  {
+    if (init)
+      for (auto& elt : map)
+        if (elt.second.use_count() == 1)
+          init->release(*elt.second);
+  }
+
+  void copyElements(const IndexMap& other)
+  {
+    for (long i : indexSet)
+      map[i] = fresh(other.map.at(i).get());
+  }
 };
 
 //! @brief Comparing maps, by comparing all the elements
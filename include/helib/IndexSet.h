@@ -16,6 +16,8 @@
  * @brief A dynamic set of integers
  **/
 
+#include <vector>
+
 #include <helib/NumbTh.h>
 
 #include <helib/JsonWrapper.h>
@@ -31,20 +33,44 @@ namespace helib {
 //! \endcode
 class IndexSet
 {
-  std::vector<bool> rep;
-  // NOTE: modern versions of C++ are supposed
-  // to implement this efficiently as a "specialized template class".
+  // The characteristic function of the set, as a bitmask: bit j%64 of word
+  // j/64 is set iff j is in the set. Small sets (the usual prime sets) fit
+  // in the inline words, so that making and copying them does not allocate;
+  // larger ones spill into the vector, which then holds all the words.
+  using Word = unsigned long long;
+  static constexpr long wordBits = 64;
+  static constexpr long inlineWords = 4;
+
+  Word inlineRep[inlineWords] = {};
+  std::vector<Word> heapRep;
 
   long _first, _last, _card;
 
   // Invariant: if _card == 0, then _first = 0, _last = -1;
   // otherwise, _first (resp. _last) is the lowest (resp. highest)
   // index in the set.
-  // In any case, the std::vector rep always defines the characteristic
-  // function of the set.
+  // In any case, the words define the characteristic function of the set,
+  // all the words (and bits) past _last being zero.
 
-  // private helper function
+  Word* words() { return heapRep.empty() ? inlineRep : heapRep.data(); }
+  const Word* words() const
+  {
+    return heapRep.empty() ? inlineRep : heapRep.data();
+  }
+  long numWords() const
+  {
+    return heapRep.empty() ? inlineWords : long(heapRep.size());
+  }
+  // The word holding j, 0 if past the storage
+  Word wordAt(long w) const { return w < numWords() ? words()[w] : 0; }
+
+  // private helper functions
   void intervalConstructor(long low, long high);
+  void reserveWords(long n);
+  // Set _first, _last and _card from the words
+  void recount();
+  // Make this the empty set, in inline storage (for a moved-from set)
+  void makeEmpty() noexcept;
 
 public:
   /*** constructors ***/
@@ -59,10 +85,18 @@ public:
   explicit IndexSet(long j) { intervalConstructor(j, j); }
 
   // copy constructor: use the built-in copy constructor
+  IndexSet(const IndexSet&) = default;
+
+  //! @brief Move constructor, leaves other empty
+  IndexSet(IndexSet&& other) noexcept;
 
   /*** assignment ***/
 
   // assignment: use the built-in assignment operator
+  IndexSet& operator=(const IndexSet&) = default;
+
+  //! @brief Move assignment, leaves other empty
+  IndexSet& operator=(IndexSet&& other) noexcept;
 
   //! @brief Returns the first element, 0 if the set is empty
   long first() const { return _first; }
@@ -26,6 +26,7 @@
 #include <NTL/BasicThreadPool.h>
 
 #include "assertions.h"
+#include "multicore.h"
 #include "helib.h"
 #include "zeroValue.h"
 
@@ -343,24 +344,7 @@ public:
   Tensor<T, N>& entrywiseOperation(const Tensor<T2, N>& rhs,
                                    std::function<T&(T&, const T2&)> operation)
   {
-    // rhs is not of the same type thus need the dims.
-    std::array<std::size_t, N> rhs_subscripts;
-    for (std::size_t i = 0; i < N; ++i) {
-      rhs_subscripts[i] = rhs.dims(i);
-    }
-
-    // Sanity Check: Are they the same dimensions?
-    if (!std::equal(this->subscripts.lengths.begin(),
-                    this->subscripts.lengths.end(),
-                    rhs_subscripts.begin())) {
-      throw helib::LogicError("Matrix dimensions do not match.");
-    }
-
-    // TODO For now, we do not allow views to operate on views to the same data.
-    if (static_cast<const void*>(&this->data()) ==
-        static_cast<const void*>(&rhs.data())) {
-      throw helib::LogicError("Views point to same underlying data.");
-    }
+    checkEntrywise(rhs);
 
     // Optimisation if they have full view of underlying memmory.
     if (this->full_view && rhs.fullView()) {
@@ -412,24 +396,96 @@ public:
 
   Tensor<T, N>& apply(std::function<void(T& x)> fn)
   {
-    // Optimisation if they have full view of underlying memory.
-    if (this->full_view) {
-      NTL_EXEC_RANGE(long(this->elements_ptr->size()), first, last)
-      for (long i = first; i < last; ++i)
-        fn((*elements_ptr)[i]);
-      NTL_EXEC_RANGE_END
+    forEachEntry(fn);
+    return *this;
+  }
+
+  // Apply fns, in order, to every entry in a single parallel pass, rather
+  // than one pass per function as apply(f).apply(g) takes.
+  template <typename... Fns>
+  Tensor<T, N>& applyChain(Fns&&... fns)
+  {
+    forEachEntry([&](T& x) { (fns(x), ...); });
+    return *this;
+  }
 
+  // Matrix special
+  // The same as entrywiseOperation(rhs, operation).applyChain(fns...), but in
+  // a single parallel pass over the entries.
+  template <typename T2, typename Operation, typename... Fns>
+  Tensor<T, N>& entrywiseChain(const Tensor<T2, N>& rhs,
+                               Operation&& operation,
+                               Fns&&... fns)
+  {
+    checkEntrywise(rhs);
+
+    if (this->full_view && rhs.fullView()) {
+      const std::vector<T2>& rhs_v = rhs.data();
+      HELIB_EXEC_RANGE(long(this->elements_ptr->size()), first, last)
+      for (long i = first; i < last; ++i) {
+        T& x = (*this->elements_ptr)[i];
+        operation(x, rhs_v[i]);
+        (fns(x), ...);
+      }
+      HELIB_EXEC_RANGE_END
     } else {
-      // TODO - again will only work for Matrices.
-      NTL_EXEC_RANGE(this->dims(1), first, last)
+      HELIB_EXEC_RANGE(this->dims(1), first, last)
       for (long j = first; j < last; ++j)
-        for (std::size_t i = 0; i < this->dims(0); ++i)
-          fn(this->operator()(i, j));
-      NTL_EXEC_RANGE_END
+        for (std::size_t i = 0; i < this->dims(0); ++i) {
+          T& x = this->operator()(i, j);
+          operation(x, rhs(i, j));
+          (fns(x), ...);
+        }
+      HELIB_EXEC_RANGE_END
     }
     return *this;
   }
 
+  // Matrix special
+  // A view of the transpose, sharing the entries of this. Unlike transpose()
+  // and inPlaceTranspose(), nothing is copied or moved.
+  Tensor<T, 2> transposedView() const
+  {
+    if (this->subscripts.start.size() != 1)
+      throw LogicError("Cannot take a transposed view of selected columns.");
+    TensorSlice<2> ts(this->subscripts);
+    std::reverse(ts.lengths.begin(), ts.lengths.end());
+    std::reverse(ts.strides.begin(), ts.strides.end());
+    return Tensor<T, 2>(ts, this->elements_ptr);
+  }
+
+  // Matrix special
+  // A view of n rows, all of them the one row of this. As the rows share
+  // their entries, the view is meant to be read, e.g. as the right-hand side
+  // of entrywiseChain, or copied with compact().
+  Tensor<T, 2> repeatedRows(std::size_t n) const
+  {
+    if (this->dims(0) != 1)
+      throw LogicError("Only a row vector can be repeated.");
+    if (this->subscripts.start.size() != 1)
+      throw LogicError("Cannot repeat a view of selected columns.");
+    TensorSlice<2> ts(this->subscripts);
+    ts.lengths.front() = n;
+    ts.strides.front() = 0;
+    ts.size = n * ts.lengths.back();
+    return Tensor<T, 2>(ts, this->elements_ptr);
+  }
+
+  // Matrix special
+  // A copy of the entries seen by this, which owns all of its underlying
+  // entries, unlike deepCopy() of a view which copies them all.
+  Tensor<T, 2> compact() const
+  {
+    auto elements = std::make_shared<std::vector<T>>();
+    elements->reserve(size());
+    for (std::size_t i = 0; i < this->dims(0); ++i)
+      for (std::size_t j = 0; j < this->dims(1); ++j)
+        elements->push_back(this->operator()(i, j));
+    Tensor<T, 2> ret(TensorSlice<2>(this->dims(0), this->dims(1)), elements);
+    ret.full_view = true;
+    return ret;
+  }
+
   // Matrix special
   Tensor<T, 2> transpose() const
   {
@@ -507,11 +563,63 @@ public:
     }
     std::reverse(subscripts.lengths.begin(), subscripts.lengths.end());
     subscripts.strides.front() = subscripts.lengths.back();
+    subscripts.strides.back() = 1;
     subscripts.start = {0};
     return *this;
   }
 
   const std::vector<T>& data() const { return *this->elements_ptr; }
+
+private:
+  template <typename T2>
+  void checkEntrywise(const Tensor<T2, N>& rhs) const
+  {
+    // rhs is not of the same type thus need the dims.
+    std::array<std::size_t, N> rhs_subscripts;
+    for (std::size_t i = 0; i < N; ++i) {
+      rhs_subscripts[i] = rhs.dims(i);
+    }
+
+    // Sanity Check: Are they the same dimensions?
+    if (!std::equal(this->subscripts.lengths.begin(),
+                    this->subscripts.lengths.end(),
+                    rhs_subscripts.begin())) {
+      throw helib::LogicError("Matrix dimensions do not match.");
+    }
+
+    // TODO For now, we do not allow views to operate on views to the same data.
+    if (static_cast<const void*>(&this->data()) ==
+        static_cast<const void*>(&rhs.data())) {
+      throw helib::LogicError("Views point to same underlying data.");
+    }
+  }
+
+  template <typename Fn>
+  void forEachEntry(const Fn& fn)
+  {
+    // A few numbers are not worth waking the threads for, while a single
+    // ciphertext entry is
+    const long work = long(this->size()) *
+                      (std::is_arithmetic<T>::value ? 1 : (1L << 15));
+    // Optimisation if they have full view of underlying memory.
+    if (this->full_view) {
+      HELIB_ADAPTIVE_EXEC_RANGE(work,
+                                long(this->elements_ptr->size()),
+                                first,
+                                last)
+      for (long i = first; i < last; ++i)
+        fn((*elements_ptr)[i]);
+      HELIB_ADAPTIVE_EXEC_RANGE_END
+
+    } else {
+      // TODO - again will only work for Matrices.
+      HELIB_ADAPTIVE_EXEC_RANGE(work, this->dims(1), first, last)
+      for (long j = first; j < last; ++j)
+        for (std::size_t i = 0; i < this->dims(0); ++i)
+          fn(this->operator()(i, j));
+      HELIB_ADAPTIVE_EXEC_RANGE_END
+    }
+  }
 };
 
 // Matrix special - Different types
@@ -532,7 +640,7 @@ inline Tensor<T, 2> operator*(const Tensor<T, 2>& M1, const Tensor<T2, 2>& M2)
 
   // TODO add NTL thread pool.
   // TODO swap += for some binary sum.
-  NTL_EXEC_RANGE(M1.dims(0), first, last)
+  HELIB_EXEC_RANGE(M1.dims(0), first, last)
   for (long i = first; i < last; ++i)
     // for (std::size_t i = 0; i < M1.dims(0); ++i)
     for (std::size_t j = 0; j < M2.dims(1); ++j)
@@ -541,7 +649,7 @@ inline Tensor<T, 2> operator*(const Tensor<T, 2>& M1, const Tensor<T2, 2>& M2)
         R_tmp *= M2(k, j);
         R(i, j) += R_tmp;
       }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 
   HELIB_NTIMER_STOP(MatrixMultiplicationConv);
   return R;
@@ -567,7 +675,7 @@ inline Tensor<T, 2> operator*(const Tensor<T, 2>& M1, const Tensor<T2, 2>& M2)
   }
 
   // TODO swap += for some binary sum.
-  NTL_EXEC_RANGE(M1.dims(0), first, last)
+  HELIB_EXEC_RANGE(M1.dims(0), first, last)
   for (long i = first; i < last; ++i)
     // For reference before NTL threads: for (std::size_t i = 0; i < M1.dims(0);
     // ++i)
@@ -577,12 +685,168 @@ inline Tensor<T, 2> operator*(const Tensor<T, 2>& M1, const Tensor<T2, 2>& M2)
         R_tmp *= M2(k, j);
         R(i, j) += R_tmp;
       }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 
   HELIB_NTIMER_STOP(MatrixMultiplicationNotConv);
   return R;
 }
 
+namespace detail {
+
+// Edge of the (square) output tiles and length of the blocks of the inner
+// dimension used by the blocked Ctxt x plaintext multiplication.
+constexpr std::size_t ctxtMatMulTile = 8;
+constexpr std::size_t ctxtMatMulInnerBlock = 32;
+
+// Halve the tile edge until every thread gets at least one output tile.
+inline std::size_t ctxtMatMulTileEdge(std::size_t rows, std::size_t cols)
+{
+  std::size_t edge = ctxtMatMulTile;
+  std::size_t nthreads = helib::AvailableThreads();
+  while (edge > 1 &&
+         ((rows + edge - 1) / edge) * ((cols + edge - 1) / edge) < nthreads)
+    edge /= 2;
+  return edge;
+}
+
+// acc += a * c, using scratch to hold the product.
+inline void ctxtMulAddConstant(Ctxt& acc,
+                               const Ctxt& a,
+                               const FatEncodedPtxt& c,
+                               Ctxt& scratch)
+{
+  scratch = a;
+  scratch.multByConstant(c);
+  acc += scratch;
+}
+
+inline void ctxtMulAddConstant(Ctxt& acc, const Ctxt& a, long c, Ctxt& scratch)
+{
+  if (c == 0)
+    return;
+  if (c == 1) {
+    acc += a;
+    return;
+  }
+  scratch = a;
+  scratch.multByConstant(c);
+  acc += scratch;
+}
+
+// Blocked multiplication of a Ctxt matrix by a plaintext matrix.
+// The inner dimension is processed in blocks: the entries of the current
+// block of rows of M2 are first converted by prepare (once each), then the
+// output tiles are processed in parallel, each output entry accumulating its
+// terms in place. Every thread reuses a single scratch Ctxt for the products.
+template <typename T2, typename Prepare>
+inline Tensor<Ctxt, 2> blockedCtxtMatMul(const Tensor<Ctxt, 2>& M1,
+                                         const Tensor<T2, 2>& M2,
+                                         Prepare prepare)
+{
+  using Const = decltype(prepare(M2(0, 0)));
+
+  Tensor<Ctxt, 2> R(zeroValue(M1(0, 0)), M1.dims(0), M2.dims(1));
+
+  const std::size_t rows = M1.dims(0);
+  const std::size_t cols = M2.dims(1);
+  const std::size_t inner = M2.dims(0);
+  const std::size_t edge = ctxtMatMulTileEdge(rows, cols);
+  const std::size_t rowTiles = (rows + edge - 1) / edge;
+  const std::size_t colTiles = (cols + edge - 1) / edge;
+
+  std::vector<Const> block;
+  for (std::size_t k0 = 0; k0 < inner; k0 += ctxtMatMulInnerBlock) {
+    const std::size_t kb = std::min(ctxtMatMulInnerBlock, inner - k0);
+
+    block.resize(kb * cols);
+    HELIB_EXEC_RANGE(long(kb * cols), first, last)
+    for (long t = first; t < last; ++t)
+      block[t] = prepare(M2(k0 + t / cols, t % cols));
+    HELIB_EXEC_RANGE_END
+
+    HELIB_EXEC_RANGE(long(rowTiles * colTiles), first, last)
+    Ctxt scratch(ZeroCtxtLike, M1(0, 0));
+    for (long t = first; t < last; ++t) {
+      const std::size_t i0 = (t / colTiles) * edge;
+      const std::size_t j0 = (t % colTiles) * edge;
+      const std::size_t i1 = std::min(i0 + edge, rows);
+      const std::size_t j1 = std::min(j0 + edge, cols);
+      for (std::size_t i = i0; i < i1; ++i)
+        for (std::size_t j = j0; j < j1; ++j)
+          for (std::size_t k = 0; k < kb; ++k)
+            ctxtMulAddConstant(R(i, j),
+                               M1(i, k0 + k),
+                               block[k * cols + j],
+                               scratch);
+    }
+    HELIB_EXEC_RANGE_END
+  }
+
+  return R;
+}
+
+template <typename Scheme>
+inline Tensor<Ctxt, 2> ctxtPtxtMatMul(const Tensor<Ctxt, 2>& M1,
+                                      const Tensor<Ptxt<Scheme>, 2>& M2)
+{
+  if (M1.dims(1) != M2.dims(0)) {
+    throw helib::LogicError(
+        "The number of columns in left matrix (" + std::to_string(M1.dims(1)) +
+        ") do not match the number of rows of the right matrix (" +
+        std::to_string(M2.dims(0)) + ").");
+  }
+
+  // Every constant is brought once over all the primes used by M1.
+  IndexSet s;
+  for (std::size_t i = 0; i < M1.dims(0); ++i)
+    for (std::size_t k = 0; k < M1.dims(1); ++k)
+      s.insert(M1(i, k).getPrimeSet());
+
+  return blockedCtxtMatMul(M1, M2, [&s](const Ptxt<Scheme>& ptxt) {
+    EncodedPtxt eptxt;
+    ptxt.encode(eptxt);
+    return FatEncodedPtxt(eptxt, s);
+  });
+}
+
+} // namespace detail
+
+// Matrix special - Ctxt x plaintext, see detail::blockedCtxtMatMul
+inline Tensor<Ctxt, 2> operator*(const Tensor<Ctxt, 2>& M1,
+                                 const Tensor<Ptxt<BGV>, 2>& M2)
+{
+  HELIB_NTIMER_START(MatrixMultiplicationCtxtPtxt);
+  auto R = detail::ctxtPtxtMatMul(M1, M2);
+  HELIB_NTIMER_STOP(MatrixMultiplicationCtxtPtxt);
+  return R;
+}
+
+// Matrix special - Ctxt x plaintext, see detail::blockedCtxtMatMul
+inline Tensor<Ctxt, 2> operator*(const Tensor<Ctxt, 2>& M1,
+                                 const Tensor<Ptxt<CKKS>, 2>& M2)
+{
+  HELIB_NTIMER_START(MatrixMultiplicationCtxtPtxt);
+  auto R = detail::ctxtPtxtMatMul(M1, M2);
+  HELIB_NTIMER_STOP(MatrixMultiplicationCtxtPtxt);
+  return R;
+}
+
+// Matrix special - Ctxt x long, see detail::blockedCtxtMatMul
+inline Tensor<Ctxt, 2> operator*(const Tensor<Ctxt, 2>& M1,
+                                 const Tensor<long, 2>& M2)
+{
+  HELIB_NTIMER_START(MatrixMultiplicationCtxtLong);
+  if (M1.dims(1) != M2.dims(0)) {
+    throw helib::LogicError(
+        "The number of columns in left matrix (" + std::to_string(M1.dims(1)) +
+        ") do not match the number of rows of the right matrix (" +
+        std::to_string(M2.dims(0)) + ").");
+  }
+  auto R = detail::blockedCtxtMatMul(M1, M2, [](long c) { return c; });
+  HELIB_NTIMER_STOP(MatrixMultiplicationCtxtLong);
+  return R;
+}
+
 template <typename T, typename T2>
 inline Tensor<T, 2> operator-(const Tensor<T, 2>& M1, const Tensor<T2, 2>& M2)
 {
@@ -653,6 +653,62 @@ private:
   RandomState& operator=(const RandomState&); // disable assignment
 };
 
+/**
+ * @class PRG
+ * @brief An explicit pseudorandom stream, for code that should neither
+ * depend on nor disturb the PRG state of the calling thread.
+ *
+ * A PRG is a ChaCha20 stream (NTL::RandomStream) with a key of its own, and
+ * PRG(seed) is the same stream as NTL::SetSeed(seed) makes current. Each key
+ * also has the streams substream(0), substream(1), ..., which can be made
+ * in any order (a stream cipher in counter mode, seekable by index), so
+ * that the parts of one computation can run in parallel and still give the
+ * same result. split() draws the key of a new, independent stream.
+ *
+ * PRG::current() is NTL's current stream of the calling thread. The
+ * functions taking a PRG use it by default, as they did before they took
+ * one. A PRG is used by one thread at a time.
+ **/
+class PRG
+{
+public:
+  static constexpr long KEY_BYTES = NTL_PRG_KEYLEN;
+
+  //! @brief The stream of NTL::SetSeed(seed)
+  explicit PRG(const NTL::ZZ& seed);
+
+  //! @brief The stream of the KEY_BYTES bytes at key
+  explicit PRG(const unsigned char* key);
+
+  PRG(PRG&&) = default;
+  PRG& operator=(PRG&&) = default;
+
+  //! @brief NTL's current stream of the calling thread
+  static PRG& current();
+
+  //! @brief Is this NTL's current stream rather than a stream of its own?
+  bool isCurrent() const { return !own; }
+
+  NTL::RandomStream& stream()
+  {
+    return own ? *own : NTL::GetCurrentRandomStream();
+  }
+
+  void get(unsigned char* bytes, long n) { stream().get(bytes, n); }
+
+  //! @brief A new stream, keyed by KEY_BYTES bytes of this one
+  PRG split();
+
+  //! @brief Stream number index of the key of this PRG (not for current())
+  PRG substream(long index) const;
+
+private:
+  unsigned char key[KEY_BYTES];
+  std::unique_ptr<NTL::RandomStream> own;
+
+  PRG() = default;
+};
+
 //! @brief Advance the input stream beyond white spaces and a single instance of
 //! the char cc
 void seekPastChar(std::istream& str, int cc);
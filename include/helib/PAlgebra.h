@@ -15,6 +15,7 @@
  * @file PAlgebra.h
  * @brief Declarations of the classes PAlgebra
  */
+#include <cstdint>
 #include <exception>
 #include <utility>
 #include <vector>
@@ -45,6 +46,17 @@ struct quarter_FFT
   quarter_FFT(long m);
 };
 
+//! The parts of a PAlgebra that are slow to compute for large m: the bound
+//! polyNormBnd takes O(phi(m)^2) operations, the set T of representatives
+//! the enumeration of Zm* /(p). Context snapshots keep them, so that the
+//! other tables can be rebuilt in linear time. T is re-derived from the
+//! generators and must match them, otherwise the constructor throws IOError.
+struct PAlgebraTables
+{
+  double polyNormBnd = 0;
+  std::vector<long> T;
+};
+
 /**
  * @class PAlgebra
  * @brief The structure of (Z/mZ)* /(p)
@@ -121,14 +133,18 @@ class PAlgebra
   // for the method RecryptData::setAE in recryption.cpp. Also see
   // Appendix A of https://ia.cr/2014/873 (updated version from 2019)
 
-  std::vector<long> T;    // The representatives for the quotient group Zm* /(p)
-  std::vector<long> Tidx; // i=Tidx[t] is the index i s.t. T[i]=t.
-                          // Tidx[t]==-1 if t notin T
+  // The index tables hold 32-bit entries, as the constructor checks that
+  // m < 2^31: for m around 10^5 the tables of size m take half the memory
 
-  std::vector<long> zmsIdx; // if t is the i'th element in Zm* then zmsIdx[t]=i
-                            // zmsIdx[t]==-1 if t notin Zm*
+  std::vector<int32_t> T; // The representatives for the quotient group
+                          // Zm* /(p)
+  std::vector<int32_t> Tidx; // i=Tidx[t] is the index i s.t. T[i]=t.
+                             // Tidx[t]==-1 if t notin T
 
-  std::vector<long> zmsRep; // inverse of zmsIdx
+  std::vector<int32_t> zmsIdx; // if t is the i'th element in Zm* then
+                               // zmsIdx[t]=i, zmsIdx[t]==-1 if t notin Zm*
+
+  std::vector<int32_t> zmsRep; // inverse of zmsIdx
 
   std::shared_ptr<PGFFT> fftInfo; // info for computing m-point complex FFT's
                                   // shard_ptr allows delayed initialization
@@ -146,7 +162,12 @@ public:
   PAlgebra(long mm,
            long pp = 2,
            const std::vector<long>& _gens = std::vector<long>(),
-           const std::vector<long>& _ords = std::vector<long>()); // constructor
+           const std::vector<long>& _ords = std::vector<long>(),
+           const PAlgebraTables* precomputed = nullptr); // constructor
+
+  //! The tables to pass to the constructor to build this again, see
+  //! PAlgebraTables
+  PAlgebraTables getTables() const;
 
   bool operator==(const PAlgebra& other) const;
   bool operator!=(const PAlgebra& other) const { return !(*this == other); }
@@ -448,6 +469,15 @@ public:
 
 //! \endcond
 
+//! The factorization of Phi_m(X) mod p^r and its CRT coefficients, the
+//! costliest part of building a PAlgebraMod. Context snapshots keep them, so
+//! that the tables can be restored without factoring again.
+struct PAlgebraModFactors
+{
+  std::vector<NTL::ZZX> factors;
+  std::vector<NTL::ZZX> crtCoeffs;
+};
+
 //! Virtual base class for PAlgebraMod
 class PAlgebraModBase
 {
@@ -465,6 +495,9 @@ public:
   //! Returns reference to the factorization of Phi_m(X) mod p^r, but as ZZX's
   virtual const std::vector<NTL::ZZX>& getFactorsOverZZ() const = 0;
 
+  //! Returns the factors and CRT coefficients, see PAlgebraModFactors
+  virtual PAlgebraModFactors getFactorization() const = 0;
+
   //! The value r
   virtual long getR() const = 0;
 
@@ -562,6 +595,9 @@ std::shared_ptr<TNode<T>> nullTNode()
 }
 //! \endcond
 
+// Evaluation at the roots of Phi_m(X) by length-m transforms, when d = 1
+class SlotDFT;
+
 //! A concrete instantiation of the virtual class
 template <typename type>
 class PAlgebraModDerived : public PAlgebraModBase
@@ -583,30 +619,43 @@ private:
   std::vector<std::vector<RX>> maskTable;
   std::vector<RX> crtTable;
   std::shared_ptr<TNode<RX>> crtTree;
+  // When d = 1 (and m is odd) the slots are the values at the roots of
+  // Phi_m(X) mod p^r, and CRT_decompose and CRT_reconstruct use this
+  std::shared_ptr<const SlotDFT> slotDFT;
 
   void genMaskTable();
   void genCrtTable();
+  void factorPhimX();
+  void usePrecomputed(const PAlgebraModFactors& precomputed);
 
 public:
   PAlgebraModDerived& operator=(const PAlgebraModDerived&) = delete;
 
-  PAlgebraModDerived(const PAlgebra& zMStar, long r);
+  //! If precomputed is not null, it holds the factorization of Phi_m(X)
+  //! mod p^r (as returned by getFactorization), which is used rather than
+  //! computing it.
+  PAlgebraModDerived(const PAlgebra& zMStar,
+                     long r,
+                     const PAlgebraModFactors* precomputed = nullptr);
 
   PAlgebraModDerived(const PAlgebraModDerived& other) // copy constructor
       :
       zMStar(other.zMStar),
       r(other.r),
       pPowR(other.pPowR),
-      pPowRContext(other.pPowRContext)
+      pPowRContext(other.pPowRContext),
+      factorsOverZZ(other.factorsOverZZ)
   {
     RBak bak;
     bak.save();
     restoreContext();
     PhimXMod = other.PhimXMod;
     factors = other.factors;
+    crtCoeffs = other.crtCoeffs;
     maskTable = other.maskTable;
     crtTable = other.crtTable;
     crtTree = other.crtTree;
+    slotDFT = other.slotDFT;
   }
 
   //! Returns a pointer to a "clone"
@@ -627,6 +676,8 @@ public:
     return factorsOverZZ;
   }
 
+  virtual PAlgebraModFactors getFactorization() const override;
+
   //! The value r
   virtual long getR() const override { return r; }
 
@@ -760,6 +811,13 @@ private:
                 const std::vector<RX>& crt1,
                 long offset,
                 long extent) const;
+
+  // crt[offset + i] = H mod the i'th leaf of tree, for i < extent
+  void remTree(std::vector<RX>& crt,
+               const std::shared_ptr<TNode<RX>>& tree,
+               const RX& H,
+               long offset,
+               long extent) const;
 };
 
 //! A different derived class to be used for the approximate-numbers scheme
@@ -792,6 +850,11 @@ public:
     throw LogicError("PAlgebraModCx::getFactorsOverZZ undefined");
   }
 
+  PAlgebraModFactors getFactorization() const override
+  {
+    throw LogicError("PAlgebraModCx::getFactorization undefined");
+  }
+
   zzX getMask_zzX(UNUSED long i, UNUSED long j) const override
   {
     throw LogicError("PAlgebraModCx::getMask_zzX undefined");
@@ -801,7 +864,10 @@ public:
 typedef PAlgebraModDerived<PA_cx> PAlgebraModCx;
 
 //! Builds a table, of type PA_GF2 if p == 2 and r == 1, and PA_zz_p otherwise
-PAlgebraModBase* buildPAlgebraMod(const PAlgebra& zMStar, long r);
+PAlgebraModBase* buildPAlgebraMod(
+    const PAlgebra& zMStar,
+    long r,
+    const PAlgebraModFactors* precomputed = nullptr);
 
 // A simple wrapper for a pointer to an object of type PAlgebraModBase.
 //
@@ -823,10 +889,12 @@ public:
 
   PAlgebraMod& operator=(const PAlgebraMod&) = delete;
 
-  explicit PAlgebraMod(const PAlgebra& zMStar, long r) :
-      rep(buildPAlgebraMod(zMStar, r))
+  explicit PAlgebraMod(const PAlgebra& zMStar,
+                       long r,
+                       const PAlgebraModFactors* precomputed = nullptr) :
+      rep(buildPAlgebraMod(zMStar, r, precomputed))
   {}
-  // constructor
+  // constructor, see PAlgebraModDerived for precomputed
 
   //! Downcast operator
   //! example: const PAlgebraModDerived<PA_GF2>& rep =
@@ -861,6 +929,11 @@ public:
   {
     return rep->getFactorsOverZZ();
   }
+  //! Returns the factors and CRT coefficients, see PAlgebraModFactors
+  PAlgebraModFactors getFactorization() const
+  {
+    return rep->getFactorization();
+  }
   //! The value r
   long getR() const { return rep->getR(); }
   //! The value p^r
@@ -44,6 +44,16 @@ public:
    void apply(std::complex<double>* v) const { apply(v, v); }
    // same as apply(v, v)
 
+   void apply_many(const std::complex<double>* src, std::complex<double>* dst,
+                   long count) const;
+   // Apply n-point FFT to each of the count consecutive vectors
+   // src[j*n..j*n+n-1], storing results in dst[j*n..j*n+n-1], with
+   // one workspace for the whole batch.
+   // src and dst may be equal, but should not otherwise overlap
+
+   long size() const { return n; }
+   // the transform length n
+
    // Copy/move constructors/assignment ops deleted, as future implementations
    // may not support them.
    PGFFT(const PGFFT&) = delete;
@@ -54,6 +64,10 @@ public:
    static bool
    simd_enabled();
 
+   // The name of the vector code the transforms run, "generic" if none
+   static const char *
+   simd_name();
+
    // Define aligned vectors.
    // This stuff should probably be private, but I'm not sure
    // of the rules for accessing these in the implementation file.
@@ -112,6 +126,10 @@ public:
 
 private:
 
+   void apply(const std::complex<double>* src, std::complex<double>* dst,
+              aligned_vector<std::complex<double>>& x) const;
+   // same as apply(src, dst), with x as workspace
+
    long n;
    long k;
 
@@ -12,6 +12,7 @@
 
 #include <NTL/ZZX.h>
 #include <NTL/ZZ_p.h>
+#include <NTL/lzz_pX.h>
 #include <vector>
 
 #ifndef HELIB_POLYMODRING_H
@@ -58,6 +59,20 @@ struct PolyModRing
    * @brief The plaintext space coefficient modulus, equal to p^r.
    **/
   const long p2r;
+  /**
+   * @brief Whether p^r fits in a single-precision word, as it does in
+   * practice.  If so, slot arithmetic is done with `NTL::zz_p` using
+   * `zzpContext` and `zzpG` instead of `NTL::ZZ_p`.
+   **/
+  const bool singlePrecision;
+  /**
+   * @brief The `NTL::zz_p` context of p^r (empty if not `singlePrecision`).
+   **/
+  const NTL::zz_pContext zzpContext;
+  /**
+   * @brief G reduced modulo p^r (zero if not `singlePrecision`).
+   **/
+  const NTL::zz_pX zzpG;
 
   // Delete the default constructor.
   PolyModRing() = delete;
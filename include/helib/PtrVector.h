@@ -18,6 +18,7 @@
  **/
 #include <stdexcept>
 #include <climits>
+#include <algorithm>
 #include <vector>
 #include <NTL/vector.h>
 
@@ -73,8 +74,102 @@ struct PtrVector
     }
     return nullptr;
   }
+
+  // If the objects are stored one after the other, return a pointer to the
+  // first one (see PtrSpan below), else nullptr
+  virtual T* contiguousData() const { return nullptr; }
 };
 
+/**
+ * @brief A non-virtual view of size() objects stored one after the other.
+ *
+ * It has the indexing interface of PtrVector, so a loop templated on the
+ * type of its arguments runs on either, but an access is a pointer addition
+ * rather than a virtual call. Use asSpan() or withSpans() to take the fast
+ * path when a PtrVector happens to be contiguous.
+ **/
+template <typename T>
+class PtrSpan
+{
+  T* first = nullptr;
+  long sz = 0;
+
+public:
+  PtrSpan() = default;
+  PtrSpan(T* first, long sz) : first(first), sz(sz) {}
+  PtrSpan(std::vector<T>& v) : first(v.data()), sz(long(v.size())) {}
+  PtrSpan(NTL::Vec<T>& v) : first(v.elts()), sz(v.length()) {}
+
+  T* operator[](long i) const { return first + i; }
+  long size() const { return sz; }
+  T* begin() const { return first; }
+  T* end() const { return first + sz; }
+
+  //! @brief The objects from..from+n-1, clamped as for PtrVector_slice
+  PtrSpan subspan(long from, long n = -1) const
+  {
+    from = std::max(0L, std::min(from, sz));
+    if (n < 0 || n > sz - from)
+      n = sz - from;
+    return PtrSpan(first + from, n);
+  }
+};
+
+template <typename T>
+long lsize(const PtrSpan<T>& v)
+{
+  return v.size();
+}
+
+//! @brief Set span to the objects of v and return true if they are stored
+//! one after the other, else return false
+template <typename T>
+bool asSpan(PtrSpan<T>& span, const PtrVector<T>& v)
+{
+  long n = v.size();
+  T* first = (n > 0) ? v.contiguousData() : nullptr;
+  if (n > 0 && first == nullptr)
+    return false;
+  span = PtrSpan<T>(first, n);
+  return true;
+}
+
+//! @brief Call fn on the spans of the vectors if they are all contiguous,
+//! else on the vectors themselves. fn is meant to be a generic lambda, so
+//! its body is compiled once without virtual calls and once with them.
+template <typename T, typename Fn>
+void withSpans(Fn&& fn, const PtrVector<T>& v1)
+{
+  PtrSpan<T> s1;
+  if (asSpan(s1, v1))
+    fn(s1);
+  else
+    fn(v1);
+}
+
+template <typename T, typename Fn>
+void withSpans(Fn&& fn, const PtrVector<T>& v1, const PtrVector<T>& v2)
+{
+  PtrSpan<T> s1, s2;
+  if (asSpan(s1, v1) && asSpan(s2, v2))
+    fn(s1, s2);
+  else
+    fn(v1, v2);
+}
+
+template <typename T, typename Fn>
+void withSpans(Fn&& fn,
+               const PtrVector<T>& v1,
+               const PtrVector<T>& v2,
+               const PtrVector<T>& v3)
+{
+  PtrSpan<T> s1, s2, s3;
+  if (asSpan(s1, v1) && asSpan(s2, v2) && asSpan(s3, v3))
+    fn(s1, s2, s3);
+  else
+    fn(v1, v2, v3);
+}
+
 // This header provides five implementations of these interfaces, but
 // users can define their own as needed. The ones defined here are:
 
@@ -84,6 +179,7 @@ struct PtrVector
 // struct PtrVector_vectorPt;// constructed PtrVector_vectorPt(std::vector<T*>)
 
 // struct PtrVector_slice;// A slice, PtrVector_slice(PtrVector, start, length)
+// struct PtrVector_span; // constructed as PtrVector_span(PtrSpan<T>)
 
 template <typename T>
 long lsize(const PtrVector<T>& v)
@@ -237,6 +333,10 @@ struct PtrVector_VecT : PtrVector<T>
   {
     return ((v.length() > 0) ? &(v[0]) : nullptr);
   }
+  T* contiguousData() const override
+  {
+    return ((v.length() > 0) ? v.elts() : nullptr);
+  }
 };
 
 //! @brief An implementation of PtrVector using vector<T>
@@ -269,6 +369,7 @@ struct PtrVector_vectorT : PtrVector<T>
       last = long(v.size());
     return last - first;
   }
+  T* contiguousData() const override { return v.empty() ? nullptr : v.data(); }
 };
 
 //! @brief An implementation of PtrVector as a slice of another PtrVector
@@ -314,6 +415,39 @@ struct PtrVector_slice : PtrVector<T>
     return orig.numNonNull(start + first, start + std::min(sz, last));
   }
   const T* ptr2nonNull() const override { return orig.ptr2nonNull(); }
+  T* contiguousData() const override
+  {
+    T* first = (sz > 0) ? orig.contiguousData() : nullptr;
+    return (first != nullptr) ? first + start : nullptr;
+  }
+};
+
+//! @brief An implementation of PtrVector over a PtrSpan, to pass a span to
+//! the functions that take a PtrVector
+template <typename T>
+struct PtrVector_span : PtrVector<T>
+{
+  PtrSpan<T> v;
+  PtrVector_span(const PtrSpan<T>& _v) : v(_v) {}
+  T* operator[](long i) const override { return v[i]; }
+  long size() const override { return v.size(); }
+
+  long numNonNull(long first = 0, long last = LONG_MAX) const override
+  {
+    if (first < 0)
+      first = 0;
+    if (last > v.size())
+      last = v.size();
+    return std::max(0L, last - first);
+  }
+  const T* ptr2nonNull() const override
+  {
+    return ((v.size() > 0) ? v[0] : nullptr);
+  }
+  T* contiguousData() const override
+  {
+    return ((v.size() > 0) ? v[0] : nullptr);
+  }
 };
 
 //! @brief An implementation of PtrVector from a single T object
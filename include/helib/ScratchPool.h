@@ -0,0 +1,97 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_SCRATCHPOOL_H
+#define HELIB_SCRATCHPOOL_H
+/**
+ * @file ScratchPool.h
+ * @brief Per-thread recycling of the rows of DoubleCRT objects
+ **/
+#include <iostream>
+
+#include <NTL/vec_long.h>
+
+namespace helib {
+
+/**
+ * @brief Counters of the scratch pools
+ **/
+struct ScratchPoolStats
+{
+  long hits = 0;        // rows taken from a pool
+  long misses = 0;      // rows that had to be allocated
+  long returned = 0;    // rows handed back to a pool
+  long dropped = 0;     // rows freed since the pool was full
+  long pooledRows = 0;  // rows currently held by the pools
+  long pooledBytes = 0; // and their size
+
+  //! @brief The fraction of requests served from a pool
+  double hitRate() const
+  {
+    long total = hits + misses;
+    return (total == 0) ? 0.0 : double(hits) / double(total);
+  }
+};
+
+std::ostream& operator<<(std::ostream& str, const ScratchPoolStats& stats);
+
+/**
+ * @class ScratchPool
+ * @brief Per-thread free lists of DoubleCRT rows
+ *
+ * Every row of a DoubleCRT is a heap-allocated NTL::vec_long of length
+ * phi(m), and key switching, tensor products and relinearization create
+ * and destroy many short-lived DoubleCRT objects. Instead of going back to
+ * malloc each time, the rows of destroyed objects are kept in a free list
+ * of the thread that released them, and new rows are taken from the free
+ * list of the thread that needs them. No locking is involved, so this also
+ * avoids allocator contention between threads.
+ *
+ * The pool of each thread holds at most getMaxBytesPerThread() bytes;
+ * extra rows are freed.
+ **/
+class ScratchPool
+{
+public:
+  //! The default value of getMaxBytesPerThread()
+  static constexpr long DEFAULT_MAX_BYTES_PER_THREAD = 64L << 20;
+
+  //! @brief Make v a vector of length n, reusing a pooled row if one is
+  //! available. v must be empty on entry. If zero is set the row is all
+  //! zero, otherwise its contents are unspecified and may be left over from
+  //! a previous owner
+  static void acquire(NTL::vec_long& v, long n, bool zero = false);
+
+  //! @brief Clear v and hand its storage to the pool of this thread (or
+  //! free it if the pool is full). v is left empty, unless it has a fixed
+  //! length
+  static void release(NTL::vec_long& v);
+
+  //! @brief Free all the rows in the pool of this thread
+  static void clear();
+
+  static void setMaxBytesPerThread(long bytes);
+  static long getMaxBytesPerThread();
+
+  //! @brief The counters of the calling thread
+  static ScratchPoolStats threadStats();
+
+  //! @brief The counters summed over all threads, past and present
+  static ScratchPoolStats totalStats();
+
+  //! @brief Reset the counters of all threads to zero
+  static void resetStats();
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_SCRATCHPOOL_H
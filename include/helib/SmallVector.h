@@ -0,0 +1,255 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_SMALLVECTOR_H
+#define HELIB_SMALLVECTOR_H
+/**
+ * @file SmallVector.h
+ * @brief A vector with room for a few elements inside the object.
+ **/
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace helib {
+
+/**
+ * @class SmallVector
+ * @brief A vector that holds up to `N` elements without allocating, and
+ * moves to the heap beyond that.
+ *
+ * The interface is the part of `std::vector` the library uses. Assignment
+ * assigns to the elements already there (rather than destroying them and
+ * making new ones), so assigning between vectors of the same length reuses
+ * the storage of the elements, as the `DoubleCRT` assignment does when the
+ * primes match.
+ *
+ * `T` need not be default-constructible.
+ **/
+template <typename T, std::size_t N>
+class SmallVector
+{
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  SmallVector() = default;
+
+  SmallVector(const SmallVector& other)
+  {
+    reserve(other.size());
+    for (const T& elem : other) {
+      new (end()) T(elem);
+      count++;
+    }
+  }
+
+  SmallVector(SmallVector&& other) noexcept(
+      std::is_nothrow_move_constructible<T>::value)
+  {
+    takeFrom(other);
+  }
+
+  ~SmallVector()
+  {
+    clear();
+    freeHeap();
+  }
+
+  SmallVector& operator=(const SmallVector& other)
+  {
+    if (this == &other)
+      return *this;
+    size_type n = other.size();
+    size_type common = n < count ? n : count;
+    for (size_type i = 0; i < common; i++)
+      elems[i] = other.elems[i];
+    if (n < count)
+      shrinkTo(n);
+    else {
+      reserve(n);
+      while (count < n) {
+        new (end()) T(other.elems[count]);
+        count++;
+      }
+    }
+    return *this;
+  }
+
+  SmallVector& operator=(SmallVector&& other)
+  {
+    if (this == &other)
+      return *this;
+    clear();
+    freeHeap();
+    takeFrom(other);
+    return *this;
+  }
+
+  size_type size() const { return count; }
+  size_type capacity() const { return cap; }
+  bool empty() const { return count == 0; }
+
+  T& operator[](size_type i) { return elems[i]; }
+  const T& operator[](size_type i) const { return elems[i]; }
+
+  T* data() { return elems; }
+  const T* data() const { return elems; }
+
+  iterator begin() { return elems; }
+  iterator end() { return elems + count; }
+  const_iterator begin() const { return elems; }
+  const_iterator end() const { return elems + count; }
+
+  T& front() { return elems[0]; }
+  const T& front() const { return elems[0]; }
+  T& back() { return elems[count - 1]; }
+  const T& back() const { return elems[count - 1]; }
+
+  void reserve(size_type n)
+  {
+    if (n > cap)
+      grow(n);
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args)
+  {
+    if (count < cap)
+      new (end()) T(std::forward<Args>(args)...);
+    else {
+      // The new element is made before the old ones move, since args may
+      // refer to one of them
+      size_type newCap = cap == 0 ? 1 : 2 * cap;
+      T* buffer = allocate(newCap);
+      new (buffer + count) T(std::forward<Args>(args)...);
+      relocate(buffer, newCap);
+    }
+    return elems[count++];
+  }
+
+  void push_back(const T& elem) { emplace_back(elem); }
+  void push_back(T&& elem) { emplace_back(std::move(elem)); }
+
+  void pop_back() { elems[--count].~T(); }
+
+  //! @brief Remove the element at pos, moving the later ones down.
+  iterator erase(const_iterator pos)
+  {
+    iterator it = elems + (pos - elems);
+    for (iterator next = it + 1; next != end(); ++next)
+      *(next - 1) = std::move(*next);
+    pop_back();
+    return it;
+  }
+
+  void clear() { shrinkTo(0); }
+
+  //! @brief Resize to n elements, the new ones copies of value.
+  void resize(size_type n, const T& value)
+  {
+    if (n <= count) {
+      shrinkTo(n);
+      return;
+    }
+    if (n > cap && &value >= begin() && &value < end()) {
+      T copy(value); // value moves with the elements
+      resize(n, copy);
+      return;
+    }
+    reserve(n);
+    while (count < n) {
+      new (end()) T(value);
+      count++;
+    }
+  }
+
+  //! @brief Make the vector n copies of value, assigning to the elements
+  //! already there.
+  void assign(size_type n, const T& value)
+  {
+    size_type common = n < count ? n : count;
+    for (size_type i = 0; i < common; i++)
+      elems[i] = value;
+    resize(n, value);
+  }
+
+private:
+  alignas(T) unsigned char inlineStorage[N * sizeof(T)];
+  T* elems = reinterpret_cast<T*>(inlineStorage);
+  size_type count = 0;
+  size_type cap = N;
+
+  bool isInline() const
+  {
+    return elems == reinterpret_cast<const T*>(inlineStorage);
+  }
+
+  static T* allocate(size_type n)
+  {
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void freeHeap()
+  {
+    if (!isInline())
+      ::operator delete(elems);
+    elems = reinterpret_cast<T*>(inlineStorage);
+    cap = N;
+  }
+
+  void shrinkTo(size_type n)
+  {
+    while (count > n)
+      elems[--count].~T();
+  }
+
+  // Move the elements to buffer, of capacity newCap, and use it
+  void relocate(T* buffer, size_type newCap)
+  {
+    for (size_type i = 0; i < count; i++) {
+      new (buffer + i) T(std::move(elems[i]));
+      elems[i].~T();
+    }
+    freeHeap();
+    elems = buffer;
+    cap = newCap;
+  }
+
+  void grow(size_type n) { relocate(allocate(n), n); }
+
+  // Take the elements of other (which is left empty), stealing its heap
+  // buffer if it has one
+  void takeFrom(SmallVector& other)
+  {
+    if (other.isInline()) {
+      for (size_type i = 0; i < other.count; i++)
+        new (elems + i) T(std::move(other.elems[i]));
+      count = other.count;
+      other.clear();
+    } else {
+      elems = other.elems;
+      count = other.count;
+      cap = other.cap;
+      other.elems = reinterpret_cast<T*>(other.inlineStorage);
+      other.count = 0;
+      other.cap = N;
+    }
+  }
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_SMALLVECTOR_H
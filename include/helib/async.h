@@ -0,0 +1,173 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_ASYNC_H
+#define HELIB_ASYNC_H
+/**
+ * @file async.h
+ * @brief Asynchronous versions of the `Ctxt` operations.
+ *
+ * Each operation runs as a task on the `TaskScheduler` installed by
+ * `SetTaskThreads`, and returns a `std::future` of its result, so that
+ * independent operations (e.g. the key switching of one ciphertext and the
+ * NTTs of another) overlap. The internal loops of an operation may in turn
+ * run in parallel on the same threads. Without a scheduler, or without
+ * `HELIB_THREADS`, each operation runs on a thread of its own.
+ *
+ * The operations take their ciphertexts by value: move them in if they are
+ * not needed anymore. The `Context` and the keys must outlive the futures.
+ **/
+
+#include <chrono>
+#include <future>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <helib/Ctxt.h>
+#include <helib/EncryptedArray.h>
+#include <helib/multicore.h>
+
+namespace helib {
+
+namespace async {
+
+/**
+ * @brief Run a function asynchronously.
+ * @param f The function to run, taking no arguments.
+ * @return A future of the result of `f`. An exception thrown by `f` is
+ * rethrown by `get()`.
+ **/
+template <typename F>
+std::future<std::invoke_result_t<std::decay_t<F>>> run(F&& f)
+{
+  using R = std::invoke_result_t<std::decay_t<F>>;
+  auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+  std::future<R> result = task->get_future();
+#ifdef HELIB_THREADS
+  if (TaskScheduler* scheduler = GetTaskScheduler()) {
+    scheduler->submit([task] { (*task)(); });
+    return result;
+  }
+#endif
+  std::thread([task] { (*task)(); }).detach();
+  return result;
+}
+
+/**
+ * @brief Wait for a future, running queued tasks in the meantime.
+ * @param result The future to wait for.
+ * @return The result.
+ * @note Use this rather than `result.get()` from within a task, so that the
+ * thread is not blocked while the result is being computed.
+ **/
+template <typename T>
+T get(std::future<T>& result)
+{
+#ifdef HELIB_THREADS
+  if (TaskScheduler* scheduler = GetTaskScheduler())
+    while (result.wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready)
+      if (!scheduler->runPending())
+        std::this_thread::yield();
+#endif
+  return result.get();
+}
+
+//! @brief Asynchronous `a.multiplyBy(b)`.
+inline std::future<Ctxt> multiply(Ctxt a, Ctxt b)
+{
+  return run([a = std::move(a), b = std::move(b)]() mutable {
+    a.multiplyBy(b);
+    return std::move(a);
+  });
+}
+
+//! @brief Asynchronous `a.square()`.
+inline std::future<Ctxt> square(Ctxt a)
+{
+  return run([a = std::move(a)]() mutable {
+    a.square();
+    return std::move(a);
+  });
+}
+
+//! @brief Asynchronous `a += b`.
+inline std::future<Ctxt> add(Ctxt a, Ctxt b)
+{
+  return run([a = std::move(a), b = std::move(b)]() mutable {
+    a += b;
+    return std::move(a);
+  });
+}
+
+//! @brief Asynchronous `a -= b`.
+inline std::future<Ctxt> subtract(Ctxt a, Ctxt b)
+{
+  return run([a = std::move(a), b = std::move(b)]() mutable {
+    a -= b;
+    return std::move(a);
+  });
+}
+
+//! @brief Asynchronous `a.multByConstant(ptxt)`.
+inline std::future<Ctxt> multByConstant(Ctxt a, Ptxt<BGV> ptxt)
+{
+  return run([a = std::move(a), ptxt = std::move(ptxt)]() mutable {
+    a.multByConstant(ptxt);
+    return std::move(a);
+  });
+}
+
+//! @brief Asynchronous `a.reLinearize()`.
+inline std::future<Ctxt> reLinearize(Ctxt a)
+{
+  return run([a = std::move(a)]() mutable {
+    a.reLinearize();
+    return std::move(a);
+  });
+}
+
+//! @brief Asynchronous `a.smartAutomorph(k)`.
+inline std::future<Ctxt> automorph(Ctxt a, long k)
+{
+  return run([a = std::move(a), k]() mutable {
+    a.smartAutomorph(k);
+    return std::move(a);
+  });
+}
+
+//! @brief Asynchronous `rotate(a, k)` with the default `EncryptedArray`.
+inline std::future<Ctxt> rotate(Ctxt a, long k)
+{
+  return run([a = std::move(a), k]() mutable {
+    ::helib::rotate(a, k);
+    return std::move(a);
+  });
+}
+
+//! @brief Asynchronous `a.hoistedAutomorphs(ks, out)`.
+inline std::future<std::vector<Ctxt>> hoistedAutomorphs(Ctxt a,
+                                                        std::vector<long> ks)
+{
+  return run([a = std::move(a), ks = std::move(ks)] {
+    std::vector<Ctxt> out;
+    a.hoistedAutomorphs(ks, out);
+    return out;
+  });
+}
+
+} // namespace async
+
+} // namespace helib
+
+#endif // HELIB_ASYNC_H
@@ -0,0 +1,166 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_BATCHING_H
+#define HELIB_BATCHING_H
+/**
+ * @file batching.h
+ * @brief Coalescing small encrypted requests into shared ciphertexts.
+ *
+ * A request that only uses the first few slots of its ciphertexts still
+ * costs a server as much as a full one. A `RequestBatcher` gathers the
+ * requests made under one public key, moves each of them to slots of its
+ * own of a packed ciphertext, runs the computation once on the packed
+ * ciphertexts, and moves every request's slots of the results back to the
+ * start for it.
+ **/
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <helib/Ctxt.h>
+#include <helib/EncryptedArray.h>
+
+namespace helib {
+
+//! @brief The settings of a `RequestBatcher`.
+struct BatchOptions
+{
+  //! @brief The longest that a request waits for others to share its batch
+  std::chrono::microseconds deadline{2000};
+
+  //! @brief Clear the slots of every input past the width of its request
+  //! before packing it, at the cost of a multiplication by a constant. Only
+  //! skip this if the clients are trusted to leave these slots at zero.
+  bool maskInputs = true;
+
+  //! @brief Clear the slots of every result past the width of its request,
+  //! so that no request sees the results of another one
+  bool maskOutputs = true;
+};
+
+//! @brief The counts of a `RequestBatcher` since its construction.
+struct BatchStats
+{
+  long requests = 0; // requests completed, successfully or not
+  long batches = 0;  // runs of the computation
+  long slots = 0;    // sum of the widths of the requests completed
+};
+
+/**
+ * @class RequestBatcher
+ * @brief Runs a computation once for several requests, each in its own
+ * slots of shared ciphertexts.
+ *
+ * A request is a vector of numInputs() ciphertexts whose values are in
+ * their first `width` slots. The requests are packed one after the other,
+ * in the order of submit(), into ciphertexts of ea.size() slots: the
+ * inputs of the request at offset o are rotated right by o and added up
+ * with those of the other requests. The computation gets the packed
+ * inputs and returns the packed results, which are rotated left by o for
+ * the request at offset o.
+ *
+ * The computation must keep the slots apart: whatever it does to a slot
+ * may only depend on that slot of its inputs, as with the additions,
+ * multiplications and comparisons of `Database::contains` or of a
+ * polynomial evaluation. Rotations and linear maps across the slots mix up
+ * the requests.
+ *
+ * The batches are made and run by a thread of the batcher. A batch runs as
+ * soon as the requests waiting fill all the slots, when the first of them
+ * has waited for the deadline, or on flush().
+ **/
+class RequestBatcher
+{
+public:
+  //! @brief Packed inputs to packed results
+  using Compute = std::function<std::vector<Ctxt>(std::vector<Ctxt>& inputs)>;
+
+  /**
+   * @brief A batcher running compute on packed requests.
+   * @param ea The `EncryptedArray` of the slots. It must outlive the
+   * batcher.
+   * @param numInputs The number of ciphertexts of every request.
+   * @param compute The computation, called with numInputs() ciphertexts.
+   * @param options The deadline and the masking.
+   **/
+  RequestBatcher(const EncryptedArray& ea,
+                 long numInputs,
+                 Compute compute,
+                 BatchOptions options = BatchOptions());
+
+  //! @brief Runs the requests still waiting, then stops the thread
+  ~RequestBatcher();
+
+  RequestBatcher(const RequestBatcher&) = delete;
+  RequestBatcher& operator=(const RequestBatcher&) = delete;
+
+  /**
+   * @brief Submit a request.
+   * @param inputs numInputs() ciphertexts, all under the public key of the
+   * first request ever submitted.
+   * @param width The number of slots used, from 1 to ea.size().
+   * @return A future of the results, in their first width slots. An
+   * exception thrown by the computation is rethrown by every request of
+   * the batch.
+   **/
+  std::future<std::vector<Ctxt>> submit(std::vector<Ctxt> inputs, long width);
+
+  //! @brief Run the requests waiting now without waiting for the deadline
+  void flush();
+
+  long numInputs() const { return arity; }
+  const BatchOptions& getOptions() const { return options; }
+  BatchStats stats() const;
+
+private:
+  struct Request
+  {
+    std::vector<Ctxt> inputs;
+    long width;
+    std::chrono::steady_clock::time_point arrival;
+    std::promise<std::vector<Ctxt>> results;
+  };
+
+  const EncryptedArray& ea;
+  const long arity;
+  const Compute compute;
+  const BatchOptions options;
+
+  mutable std::mutex mutex;
+  std::condition_variable wakeup;
+  std::deque<Request> pending;
+  long pendingSlots = 0;
+  bool flushing = false;
+  bool stopping = false;
+  const PubKey* key = nullptr;
+  BatchStats counts;
+
+  // The masks of the first w slots, by w. Only used by the worker.
+  std::map<long, PtxtArray> masks;
+
+  std::thread worker;
+
+  void run();
+  std::vector<Request> takeBatch();
+  void process(std::vector<Request>& batch);
+  const PtxtArray& mask(long width);
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_BATCHING_H
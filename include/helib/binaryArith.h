@@ -15,6 +15,7 @@
  * @file binaryArith.h
  * @brief Implementing integer addition, multiplication in binary representation
  **/
+#include <functional>
 #include <helib/EncryptedArray.h>
 #include <helib/CtPtrs.h> //  defines CtPtrs, CtPtrMat
 
@@ -149,6 +150,52 @@ void bitwiseAnd(CtPtrs& output,
  **/
 void bitwiseNot(CtPtrs& output, const CtPtrs& input);
 
+/**
+ * @brief The ways `addTwoNumbers` can compute the carries, for n-bit inputs.
+ **/
+enum class AdderStrategy
+{
+  //! Products of the (a[t]+b[t]) terms arranged to keep the levels as high as
+  //! possible (see AddDAG). Depth about log(n), about n^2/2 multiplications.
+  DAG,
+  //! Kogge-Stone prefix adder. Depth about log(n), up to 2n log(n)
+  //! multiplications.
+  KOGGE_STONE,
+  //! Brent-Kung prefix adder. Depth about 2 log(n), about 4n multiplications.
+  BRENT_KUNG,
+  //! Sklansky prefix adder. Depth about log(n), about n log(n)
+  //! multiplications, with a large fan-out.
+  SKLANSKY
+};
+
+/**
+ * @brief The cost of adding two numbers with an `AdderStrategy`.
+ **/
+struct AdderCost
+{
+  //! Multiplicative depth from the input bits to the sum
+  long depth;
+  //! Number of ciphertext multiplications
+  long mults;
+};
+
+/**
+ * @brief Returns the cost of `addTwoNumbers` with the given strategy.
+ * @param strategy the carry computation to use.
+ * @param lhsSize bit size of the left hand side.
+ * @param rhsSize bit size of the right hand side.
+ * @param sizeLimit number of bits to compute on, as in `addTwoNumbers`.
+ * @return the depth and the number of multiplications, assuming that all the
+ * input bits are non-empty and at the same level.
+ *
+ * With bootstrapping between levels, fewer multiplications are often worth
+ * more depth; without it, depth is usually the scarce resource.
+ **/
+AdderCost adderCost(AdderStrategy strategy,
+                    long lhsSize,
+                    long rhsSize,
+                    long sizeLimit = 0);
+
 /**
  * @brief Adds two numbers in binary representation where each ciphertext of the
  * input vector contains a bit.
@@ -159,11 +206,33 @@ void bitwiseNot(CtPtrs& output, const CtPtrs& input);
  * significant end.
  * @param unpackSlotEncoding vector of constants for unpacking, as used in
  * bootstrapping.
+ * @param strategy the carry computation to use, see `adderCost`.
  **/
 void addTwoNumbers(CtPtrs& sum,
                    const CtPtrs& lhs,
                    const CtPtrs& rhs,
                    long sizeLimit = 0,
+                   std::vector<zzX>* unpackSlotEncoding = nullptr,
+                   AdderStrategy strategy = AdderStrategy::DAG);
+
+/**
+ * @brief Adds many pairs of numbers, `sums[k] = lhs[k] + rhs[k]`, in parallel.
+ * @param sums result of the additions, one row per pair.
+ * @param lhs left hand sides of the additions.
+ * @param rhs right hand sides of the additions.
+ * @param sizeLimit number of bits to compute on, as in `addTwoNumbers`.
+ * @param unpackSlotEncoding vector of constants for unpacking, as used in
+ * bootstrapping.
+ *
+ * The pairs that do not have enough levels are bootstrapped together with a
+ * single `packedRecrypt`. Pairs with the same shape (the bit sizes and the
+ * levels of their bits relative to each other) share the same addition plan,
+ * which is also cached across calls.
+ **/
+void addTwoNumbers(CtPtrMat& sums,
+                   const CtPtrMat& lhs,
+                   const CtPtrMat& rhs,
+                   long sizeLimit = 0,
                    std::vector<zzX>* unpackSlotEncoding = nullptr);
 
 /**
@@ -206,6 +275,15 @@ long fifteenOrLess4Four(const CtPtrs& out,
                         const CtPtrs& in,
                         long sizeLimit = 4);
 
+/**
+ * @brief A hook deciding which numbers to recrypt during `addManyNumbers`.
+ *
+ * It is called before every round of 3-for-2 additions with the numbers that
+ * go into that round, and may recrypt any of them (e.g. with
+ * `packedRecrypt`). Each round consumes one multiplicative level.
+ **/
+using RecryptSchedule = std::function<void(const CtPtrMat& numbers)>;
+
 /**
  * @brief Sum an arbitrary amount of numbers in binary representation.
  * @param sum result of the summation.
@@ -214,13 +292,39 @@ long fifteenOrLess4Four(const CtPtrs& out,
  * significant end.
  * @param unpackSlotEncoding vector of constants for unpacking, as used in
  * bootstrapping.
+ * @param schedule decides what to recrypt before each round. If empty, the
+ * default recrypts, once some number is left with less than three levels,
+ * all the numbers of the round that are below ten levels.
  *
- * Calculates the sum of many numbers using the 3-for-2 method.
+ * Calculates the sum of many numbers using the 3-for-2 method. The adders of
+ * one round are independent, and run in parallel when there are at least as
+ * many of them as threads; otherwise each adder runs over the bits in
+ * parallel.
  **/
 void addManyNumbers(CtPtrs& sum,
                     CtPtrMat& numbers,
                     long sizeLimit = 0,
-                    std::vector<zzX>* unpackSlotEncoding = nullptr);
+                    std::vector<zzX>* unpackSlotEncoding = nullptr,
+                    const RecryptSchedule& schedule = nullptr);
+
+/**
+ * @brief The ways `multTwoNumbers` can sum up the partial products.
+ **/
+enum class MultiplierStrategy
+{
+  //! KARATSUBA when the smaller operand has at least 32 bits, DADDA when it
+  //! has at least 8, WALLACE otherwise.
+  AUTO,
+  //! The partial products as numbers, summed with the 3-for-2 method of
+  //! `addManyNumbers`.
+  WALLACE,
+  //! The partial products in columns by weight, reduced with a Dadda tree.
+  //! Same depth as WALLACE with fewer adders.
+  DADDA,
+  //! Three products of half the size (each with AUTO) instead of four, at the
+  //! price of a few more additions and of more depth.
+  KARATSUBA
+};
 
 /**
  * @brief Multiply two numbers in binary representation where each ciphertext of
@@ -234,13 +338,52 @@ void addManyNumbers(CtPtrs& sum,
  * significant end.
  * @param unpackSlotEncoding vector of constants for unpacking, as used in
  * bootstrapping.
+ * @param strategy how to sum up the partial products. It is ignored when
+ * `rhsTwosComplement` is set.
  **/
 void multTwoNumbers(CtPtrs& product,
                     const CtPtrs& lhs,
                     const CtPtrs& rhs,
                     bool rhsTwosComplement = false,
                     long sizeLimit = 0,
-                    std::vector<zzX>* unpackSlotEncoding = nullptr);
+                    std::vector<zzX>* unpackSlotEncoding = nullptr,
+                    MultiplierStrategy strategy = MultiplierStrategy::AUTO);
+
+/**
+ * @brief Decompose the integers in the slots of a mod-2^r ciphertext into
+ * their bits, bit-sliced as the rest of this file expects.
+ * @param bits The bits, resized to nBits. bits[j] holds bit j of every
+ * slot, the LSB first.
+ * @param c A ciphertext with p = 2 whose slots hold integers mod 2^r (only
+ * the free terms of the slots may be nonzero).
+ * @param nBits The number of low bits to extract, from 1 to
+ * c.effectiveR(); 0 (the default) extracts all r of them.
+ * @param reduce If true, every bit is reduced to plaintext space 2, for the
+ * functions of this file. If false, bits[j] keeps plaintext space
+ * 2^{r-j}, which bitRecompose needs to get back the integers mod 2^r.
+ *
+ * The digits are extracted with extractDigits, or with extendExtractDigits
+ * when nBits < r, which raise the digits found so far to the p'th power in
+ * parallel.
+ **/
+void bitDecompose(CtPtrs& bits,
+                  const Ctxt& c,
+                  long nBits = 0,
+                  bool reduce = true);
+
+/**
+ * @brief The integers with the given bits, the inverse of bitDecompose.
+ * @param c The result, sum_j 2^j bits[j].
+ * @param bits Bit-sliced bits, the LSB first, all with p = 2.
+ *
+ * The plaintext space of c is the smallest of 2^j times the plaintext space
+ * of bits[j]. With the bits of bitDecompose(..., reduce=false) it is 2^r
+ * again, while bits of plaintext space 2 (as the results of the functions
+ * of this file are) only give bit 0 mod 2. Lifting a bit mod 2 to a larger
+ * plaintext space takes a bootstrapping that raises it, which the
+ * recryption of this library does not do.
+ **/
+void bitRecompose(Ctxt& c, const CtPtrs& bits);
 
 /**
  * @brief Decrypt the binary numbers that are encrypted in eNums.
@@ -64,5 +64,62 @@ void compareTwoNumbers(Ctxt& mu,
                        bool twosComplement = false,
                        std::vector<zzX>* unpackSlotEncoding = nullptr);
 
+/**
+ * @brief Compares many integers in binary against the same one. Returns
+ * indicator bits `mu[k]`=(`values[k]`>`threshold`) and
+ * `ni[k]`=(`values[k]`<`threshold`).
+ * @param mu Indicator bits `mu[k]`=(`values[k]`>`threshold`).
+ * @param ni Indicator bits `ni[k]`=(`values[k]`<`threshold`).
+ * @param values The numbers to compare, one per row.
+ * @param threshold The number to compare them against.
+ * @param twosComplement When set to `true`, the inputs are signed integers in
+ *2's complement. If set to `false` (default), unsigned comparison is performed.
+ * @param unpackSlotEncoding Vector of constants for unpacking, as used in
+ *bootstrapping.
+ * @note All of `values` must have the size of `threshold`.
+ * @note The work on `threshold` is done once, all the inputs that are too low
+ *are bootstrapped together, and the comparisons run in parallel.
+ **/
+void compareManyToOne(std::vector<Ctxt>& mu,
+                      std::vector<Ctxt>& ni,
+                      const CtPtrMat& values,
+                      const CtPtrs& threshold,
+                      bool twosComplement = false,
+                      std::vector<zzX>* unpackSlotEncoding = nullptr);
+
+/**
+ * @brief Returns the maximum and the minimum of many integers in binary.
+ * @param max Maximum of `numbers`.
+ * @param min Minimum of `numbers`.
+ * @param numbers The numbers, one per row.
+ * @param twosComplement When set to `true`, the inputs are signed integers in
+ *2's complement. If set to `false` (default), unsigned comparison is performed.
+ * @param unpackSlotEncoding Vector of constants for unpacking, as used in
+ *bootstrapping.
+ * @note All of `numbers` must have the same size.
+ * @note Takes about 3n/2 comparisons in log(n)+1 layers, the comparisons of
+ *each layer run in parallel.
+ **/
+void minMaxOfNumbers(CtPtrs& max,
+                     CtPtrs& min,
+                     const CtPtrMat& numbers,
+                     bool twosComplement = false,
+                     std::vector<zzX>* unpackSlotEncoding = nullptr);
+
+/**
+ * @brief Sorts many integers in binary into increasing order, in place.
+ * @param numbers The numbers, one per row.
+ * @param twosComplement When set to `true`, the inputs are signed integers in
+ *2's complement. If set to `false` (default), unsigned comparison is performed.
+ * @param unpackSlotEncoding Vector of constants for unpacking, as used in
+ *bootstrapping.
+ * @note All of `numbers` must have the same size.
+ * @note Uses Batcher's odd-even merge sort, log(n)(log(n)+1)/2 layers of
+ *comparisons which run in parallel.
+ **/
+void sortNumbers(CtPtrMat& numbers,
+                 bool twosComplement = false,
+                 std::vector<zzX>* unpackSlotEncoding = nullptr);
+
 } // namespace helib
 #endif // ifndef HELIB_BINARYCOMPARE_H
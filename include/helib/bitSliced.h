@@ -0,0 +1,127 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_BITSLICED_H
+#define HELIB_BITSLICED_H
+/**
+ * @file bitSliced.h
+ * @brief Binary numbers with all of their bits in the slots of one
+ * ciphertext
+ **/
+#include <vector>
+
+#include <helib/EncryptedArray.h>
+#include <helib/CtPtrs.h>
+
+namespace helib {
+
+/**
+ * @class BitSlicedNums
+ * @brief count() binary numbers of bitSize() bits each, in one ciphertext.
+ *
+ * The functions of binaryArith.h take one ciphertext per bit, with number j
+ * in slot j of every bit. With few or short numbers most of their slots are
+ * wasted. Here bit k of number j is in slot k*count()+j: the bits of a
+ * position form a block of count() consecutive slots, and the slots from
+ * bitSize()*count() on are zero. Moving a carry or a comparison to the next
+ * bit position is a shift of the slots by count(), see `EncryptedArray::shift`.
+ *
+ * An addition (`addBitSliced`) or a comparison (`compareBitSliced`) then
+ * takes O(log(bitSize())) multiplications and shifts of a single ciphertext,
+ * where the one-ciphertext-per-bit versions take O(bitSize()) or more
+ * multiplications, each of them with its key switching.
+ *
+ * @note Only for p=2 and r=1.
+ **/
+class BitSlicedNums
+{
+public:
+  /**
+   * @brief Pack numbers given one ciphertext per bit.
+   * @param ea The `EncryptedArray` of the slots.
+   * @param bits bits[k] holds bit k (LSB first) of number j in slot j, for
+   * j < count. Its other slots are ignored.
+   * @param count The number of numbers, with lsize(bits)*count at most
+   * ea.size().
+   *
+   * Takes one multiplication by a constant and one rotation per bit.
+   **/
+  BitSlicedNums(const EncryptedArray& ea, const CtPtrs& bits, long count);
+
+  /**
+   * @brief The inverse of the constructor.
+   * @param bits Resized to bitSize(). bits[k] gets bit k of number j in slot
+   * j, for j < count(), and zero in its other slots.
+   **/
+  void unpack(CtPtrs& bits) const;
+
+  //! @brief Decrypt the numbers, count() of them, as unsigned integers
+  void decrypt(std::vector<long>& nums, const SecKey& sKey) const;
+
+  long bitSize() const { return nBits; }
+  long count() const { return nNums; }
+  const Ctxt& getCtxt() const { return ctxt; }
+  const EncryptedArray& getEA() const { return *ea; }
+
+  //! @brief The largest count of numbers of bitSize bits that fits in ea
+  static long maxCount(const EncryptedArray& ea, long bitSize)
+  {
+    return ea.size() / bitSize;
+  }
+
+private:
+  const EncryptedArray* ea;
+  long nBits;
+  long nNums;
+  Ctxt ctxt;
+
+  friend void addBitSliced(BitSlicedNums& sum,
+                           const BitSlicedNums& lhs,
+                           const BitSlicedNums& rhs);
+  friend void compareBitSliced(Ctxt& mu,
+                               Ctxt& ni,
+                               const BitSlicedNums& a,
+                               const BitSlicedNums& b);
+};
+
+/**
+ * @brief Add two sets of bit-sliced numbers, modulo 2^bitSize().
+ * @param sum Gets lhs + rhs, with the layout of lhs.
+ * @param lhs The first summands.
+ * @param rhs The second summands, with the same bitSize() and count().
+ *
+ * A Kogge-Stone carry network over the blocks of bit positions: one
+ * multiplication for the generate bits, then log(bitSize()) stages of two
+ * multiplications and two shifts each.
+ **/
+void addBitSliced(BitSlicedNums& sum,
+                  const BitSlicedNums& lhs,
+                  const BitSlicedNums& rhs);
+
+/**
+ * @brief Compare two sets of bit-sliced numbers, as unsigned integers.
+ * @param mu Gets a > b in slot j for number j, and zero in the other slots.
+ * @param ni Gets a < b in the same layout.
+ * @param a The first numbers.
+ * @param b The second numbers, with the same bitSize() and count().
+ *
+ * The (a==b, a>b) pairs of the bit positions are combined in log(bitSize())
+ * stages of two multiplications and two shifts each, from the highest
+ * position down to block 0.
+ **/
+void compareBitSliced(Ctxt& mu,
+                      Ctxt& ni,
+                      const BitSlicedNums& a,
+                      const BitSlicedNums& b);
+
+} // namespace helib
+
+#endif // ifndef HELIB_BITSLICED_H
@@ -0,0 +1,148 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_BOOLEANCIRCUIT_H
+#define HELIB_BOOLEANCIRCUIT_H
+/**
+ * @file booleanCircuit.h
+ * @brief Compiling Boolean netlists into circuits on encrypted bits.
+ **/
+
+#include <istream>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include <helib/CtPtrs.h>
+#include <helib/zzX.h>
+
+namespace helib {
+
+/**
+ * @class BooleanCircuit
+ * @brief A Boolean netlist, compiled for bits encrypted with p = 2, one bit
+ * per ciphertext and one instance of the circuit per slot (as in
+ * binaryArith.h).
+ *
+ * The netlist is rewritten as XORs and ANDs of possibly negated wires, which
+ * are free, then:
+ * - identical gates are merged and constants are folded;
+ * - x&y ^ x&z, with both ANDs used only there, becomes x & (y^z);
+ * - trees of ANDs are rebalanced by the depth of their leaves;
+ * - gates that no output depends on are dropped.
+ *
+ * It is evaluated one AND layer at a time by a `Circuit`, which computes all
+ * the gates of a layer in parallel and re-linearizes each product once.
+ * When the ciphertexts take fewer AND layers than the circuit has, it is cut
+ * into stages of at most that many layers, and the bits that cross each cut
+ * are bootstrapped together with one `packedRecrypt`. The cuts are placed,
+ * by dynamic programming over the layers, so that the fewest bits are
+ * recrypted in all.
+ **/
+class BooleanCircuit
+{
+public:
+  //! @brief The size of a circuit
+  struct Stats
+  {
+    long ands = 0;
+    long xors = 0;
+    long andDepth = 0;
+  };
+
+  /**
+   * @brief Read and compile a netlist in Bristol Fashion, or in the older
+   * Bristol format ("ngates nwires", then "n1 n2 nout").
+   * @param str The netlist. The gates are XOR, AND, INV, EQ, EQW and MAND;
+   * the inputs are the first wires and the outputs the last ones.
+   * @throw IOError if the netlist is malformed.
+   **/
+  explicit BooleanCircuit(std::istream& str);
+
+  //! @brief The number of bits of each input value, in order
+  const std::vector<long>& getInputSizes() const { return inputSizes; }
+  //! @brief The number of bits of each output value, in order
+  const std::vector<long>& getOutputSizes() const { return outputSizes; }
+  long numInputBits() const { return nInputBits; }
+  long numOutputBits() const { return outputs.size(); }
+
+  //! @brief The size of the netlist as read
+  const Stats& getNetlistStats() const { return netlistStats; }
+  //! @brief The size of the compiled circuit
+  const Stats& getStats() const { return stats; }
+
+  /**
+   * @brief Where the circuit is cut for recryption.
+   * @param levels The number of AND layers the ciphertexts take between
+   * recryptions, or -1 for no recryption.
+   * @param numRecrypted If not null, set to the number of bits recrypted in
+   * all.
+   * @return The AND depths after which the crossing bits are recrypted.
+   **/
+  std::vector<long> recryptionCuts(long levels,
+                                   long* numRecrypted = nullptr) const;
+
+  /**
+   * @brief Evaluate the circuit on encrypted bits.
+   * @param out The output bits, wire by wire, resized if needed.
+   * @param in The input bits, wire by wire, with p = 2 and at least levels
+   * AND layers of capacity.
+   * @param levels As in recryptionCuts.
+   * @param unpackSlotEncoding The unpacking constants of bootstrapping, as in
+   * `packedRecrypt`; needed when there are cuts.
+   **/
+  void evaluate(CtPtrs& out,
+                const CtPtrs& in,
+                long levels = -1,
+                const std::vector<zzX>* unpackSlotEncoding = nullptr) const;
+
+  //! @brief Evaluate the compiled circuit on bits in the clear
+  std::vector<long> evaluate(const std::vector<long>& in) const;
+
+private:
+  enum class Kind
+  {
+    CONST, // node 0, the constant 0
+    INPUT,
+    AND,
+    XOR
+  };
+
+  // The operands are literals, 2 * node + 1 if negated
+  struct Node
+  {
+    Kind kind;
+    long a;     // first operand literal, or the input bit
+    long b;     // second operand literal, or -1
+    long depth; // the AND depth
+  };
+
+  std::vector<Node> nodes;
+  std::vector<long> outputs; // literals
+  std::vector<long> inputSizes;
+  std::vector<long> outputSizes;
+  long nInputBits = 0;
+  Stats netlistStats;
+  Stats stats;
+  // Maps (kind, a, b) to the node already computing it
+  std::map<std::tuple<Kind, long, long>, long> hashed;
+
+  long makeInput(long bit);
+  long makeAnd(long x, long y);
+  long makeXor(long x, long y);
+  long record(Kind kind, long a, long b, long depth);
+  std::vector<bool> liveNodes() const;
+  void compile();
+};
+
+} // namespace helib
+
+#endif // HELIB_BOOLEANCIRCUIT_H
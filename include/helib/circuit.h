@@ -0,0 +1,174 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_CIRCUIT_H
+#define HELIB_CIRCUIT_H
+/**
+ * @file circuit.h
+ * @brief Recording a computation on ciphertexts as a DAG, and replaying it.
+ **/
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include <NTL/ZZX.h>
+#include <helib/Ctxt.h>
+#include <helib/costEstimate.h>
+
+namespace helib {
+
+/**
+ * @class Circuit
+ * @brief A computation on ciphertexts, recorded once as a DAG of operations
+ * and then run on any number of inputs.
+ *
+ * Operations on the `Circuit::Wire` proxies only add nodes to the DAG.
+ * Identical operations on the same wires are recorded only once. When the
+ * circuit is run:
+ * - nodes that no output depends on are skipped;
+ * - the nodes of each depth of the DAG are computed in parallel;
+ * - products are only re-linearized when needed, i.e. a sum of products is
+ *   re-linearized once;
+ * - the automorphisms of the same wire are hoisted together;
+ * - the intermediate ciphertexts are freed (or reused in place) after their
+ *   last use.
+ *
+ * Example:
+ * @code
+ * Circuit circuit(context);
+ * Circuit::Wire x = circuit.input();
+ * Circuit::Wire y = circuit.input();
+ * circuit.output(x * y + x.automorph(3) + x.automorph(5));
+ * std::vector<Ctxt> out = circuit.run({ctxt1, ctxt2});
+ * @endcode
+ **/
+class Circuit
+{
+public:
+  /**
+   * @class Wire
+   * @brief A value of the circuit, the result of an input or an operation.
+   * @note A `Wire` refers to its `Circuit`, which must outlive it.
+   **/
+  class Wire
+  {
+  public:
+    Wire operator+(const Wire& other) const;
+    Wire operator-(const Wire& other) const;
+    Wire operator*(const Wire& other) const;
+    Wire operator-() const;
+    Wire operator+(const NTL::ZZX& poly) const;
+    Wire operator*(const NTL::ZZX& poly) const;
+    Wire operator+(long c) const { return *this + NTL::ZZX(c); }
+    Wire operator*(long c) const { return *this * NTL::ZZX(c); }
+
+    Wire& operator+=(const Wire& other) { return *this = *this + other; }
+    Wire& operator-=(const Wire& other) { return *this = *this - other; }
+    Wire& operator*=(const Wire& other) { return *this = *this * other; }
+
+    //! @brief The square of the wire.
+    Wire square() const { return *this * *this; }
+
+    //! @brief The automorphism X -> X^k, as with `Ctxt::smartAutomorph`.
+    Wire automorph(long k) const;
+
+  private:
+    friend class Circuit;
+    Wire(Circuit* circuit, long id) : circuit(circuit), id(id) {}
+
+    Circuit* circuit;
+    long id;
+  };
+
+  /**
+   * @brief Constructor.
+   * @param context The context of the ciphertexts the circuit runs on.
+   **/
+  explicit Circuit(const Context& context) : context(context) {}
+
+  // The wires point back to the circuit
+  Circuit(const Circuit&) = delete;
+  Circuit& operator=(const Circuit&) = delete;
+
+  //! @brief Add an input to the circuit, the `i`'th one added is `inputs[i]`
+  //! of `run`.
+  Wire input();
+
+  //! @brief Add an output to the circuit, the `i`'th one added is the `i`'th
+  //! ciphertext returned by `run`.
+  void output(const Wire& wire);
+
+  /**
+   * @brief Run the circuit.
+   * @param inputs The ciphertexts to run the circuit on, one per input.
+   * @return The outputs of the circuit, in re-linearized form.
+   * @note Can be called any number of times, also concurrently.
+   **/
+  std::vector<Ctxt> run(const std::vector<Ctxt>& inputs) const;
+
+  /**
+   * @brief Estimate the cost of running the circuit, by running it as a dry
+   * run (see costEstimate.h).
+   * @param inputs The ciphertexts to run the circuit on, one per input.
+   * @param model The time of the primitives on this machine.
+   * @return The operations and memory the run takes, and its estimated time.
+   * @note The noise estimates are those of a real run, the data is not.
+   **/
+  CostEstimate estimate(const std::vector<Ctxt>& inputs,
+                        const CostModel& model) const;
+
+  //! @brief The number of distinct operations recorded, inputs included.
+  long numNodes() const { return nodes.size(); }
+
+  //! @brief The number of inputs.
+  long numInputs() const { return nInputs; }
+
+  //! @brief The number of outputs.
+  long numOutputs() const { return outputs.size(); }
+
+private:
+  enum class Op
+  {
+    INPUT,
+    ADD,
+    SUB,
+    NEGATE,
+    MUL,
+    ADD_CONST,
+    MUL_CONST,
+    AUTOMORPH
+  };
+
+  struct Node
+  {
+    Op op;
+    long a;     // first operand, or -1
+    long b;     // second operand, or -1
+    long param; // input index, constant index or automorphism
+  };
+
+  const Context& context;
+  std::vector<Node> nodes;
+  std::vector<NTL::ZZX> constants;
+  std::vector<long> outputs;
+  long nInputs = 0;
+  // Maps (op, a, b, param) to the node already recording it
+  std::map<std::tuple<Op, long, long, long>, long> recorded;
+
+  Wire record(Op op, long a, long b, long param);
+  long constant(const NTL::ZZX& poly);
+  void checkWire(const Wire& wire) const;
+};
+
+} // namespace helib
+
+#endif // HELIB_CIRCUIT_H
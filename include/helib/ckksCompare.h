@@ -0,0 +1,216 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_CKKSCOMPARE_H
+#define HELIB_CKKSCOMPARE_H
+/**
+ * @file ckksCompare.h
+ * @brief Approximate comparisons, max and min of CKKS slots
+ *
+ * The functions of binaryCompare.h compare BGV numbers one bit per
+ * ciphertext. Here the slots of CKKS ciphertexts are compared directly,
+ * through a polynomial approximation of the sign function. All the values
+ * compared must be real and in [0,1], so that their differences are in
+ * [-1,1]; values closer than the epsilon() of the approximation are not
+ * told apart.
+ **/
+#include <vector>
+
+#include <helib/EncryptedArray.h>
+
+namespace helib {
+
+/**
+ * @class SignApproximation
+ * @brief A composite polynomial p, with |p(x) - sign(x)| <= 2^-alpha() for
+ * epsilon() <= |x| <= 1, and |p(x)| <= 1 on [-1,1].
+ *
+ * p is a composition of odd degree-7 polynomials, each of them evaluated by
+ * `chebyshevEval` at depth 3. There are polynomials of two kinds (see Cheon
+ * et al., "Efficient homomorphic comparison methods with optimal
+ * complexity", Asiacrypt 2020):
+ *  - f(x) = (35x - 35x^3 + 21x^5 - 5x^7)/16, which is flat near 1 and makes
+ *    the values close to 1 converge to 1 very fast.
+ *  - g(x) = (4589x - 16577x^3 + 25614x^5 - 12860x^7)/1024, which moves
+ *    small values away from zero about 4.5 times faster than f.
+ *
+ * The constructor picks the stages one by one, each time the kind that
+ * maps [lo,1] (the image of [epsilon,1] by the stages so far) on the
+ * interval with the largest lower end, until that lower end is within
+ * 2^-alpha of 1. That typically gives a few g stages then two or three f
+ * stages, e.g. 4 g and 2 f for epsilon=2^-8 and alpha=10.
+ **/
+class SignApproximation
+{
+public:
+  /**
+   * @brief The approximation of the sign with the given precision.
+   * @param epsilon The smallest |x| for which p(x) approximates sign(x), in
+   * (0,1).
+   * @param alpha The precision of the approximation, in bits, from 1 to 50.
+   *
+   * Throws an `InvalidArgument` if the approximation would take more than
+   * maxStages stages.
+   **/
+  SignApproximation(double epsilon, long alpha);
+
+  double epsilon() const { return eps; }
+  long alpha() const { return bits; }
+  long numStages() const { return stages.size(); }
+
+  //! @brief The multiplicative depth of apply()
+  long depth() const { return 3 * numStages(); }
+
+  //! @brief p(x), on a cleartext x in [-1,1]
+  double operator()(double x) const;
+
+  //! @brief x <- p(x), on the real slots of a CKKS ciphertext, all of them
+  //! in [-1,1]
+  void apply(Ctxt& x) const;
+
+  //! @brief The most stages a SignApproximation takes
+  static constexpr long maxStages = 64;
+
+private:
+  double eps;
+  long bits;
+  // The Chebyshev coefficients of the stages, first stage first
+  std::vector<std::vector<double>> stages;
+};
+
+/**
+ * @brief Compare the slots of two CKKS ciphertexts.
+ * @param out Gets about 1 in the slots where a > b and 0 where a < b, within
+ * 2^-(alpha+1) where |a-b| >= sign.epsilon(). Where |a-b| is smaller, out
+ * gets some value between 0 and 1.
+ * @param a The first values, in [0,1].
+ * @param b The second values, in [0,1].
+ * @param sign The approximation of the sign to use.
+ *
+ * Computes (p(a-b)+1)/2, at depth sign.depth().
+ **/
+void approxGreaterThan(Ctxt& out,
+                       const Ctxt& a,
+                       const Ctxt& b,
+                       const SignApproximation& sign);
+
+//! @brief As above, comparing the slots of a to the threshold t in [0,1]
+void approxGreaterThan(Ctxt& out,
+                       const Ctxt& a,
+                       double t,
+                       const SignApproximation& sign);
+
+/**
+ * @brief The larger of the slots of two CKKS ciphertexts.
+ * @param out Gets max(a, b), as (a+b)/2 + (a-b)/2 * p(a-b), in every slot.
+ * The error is at most |a-b| * 2^-(alpha+1) where |a-b| >= sign.epsilon(),
+ * and less than sign.epsilon()/2 elsewhere.
+ * @param a The first values, in [0,1].
+ * @param b The second values, in [0,1].
+ * @param sign The approximation of the sign to use.
+ *
+ * The depth is sign.depth()+1.
+ **/
+void approxMax(Ctxt& out,
+               const Ctxt& a,
+               const Ctxt& b,
+               const SignApproximation& sign);
+
+//! @brief The smaller of the slots, (a+b)/2 - (a-b)/2 * p(a-b), with the
+//! error and depth of approxMax
+void approxMin(Ctxt& out,
+               const Ctxt& a,
+               const Ctxt& b,
+               const SignApproximation& sign);
+
+/**
+ * @brief Replace every slot of a CKKS ciphertext by the largest of them.
+ * @param ctxt The values, in [0,1].
+ * @param ea The `EncryptedArray` of the slots.
+ * @param sign The approximation of the sign to use.
+ *
+ * Takes the approxMax of ctxt and its rotation by 1, 2, 4, ... slots: after
+ * ceil(log2(n)) rounds every slot holds the max over a cyclic window of at
+ * least n slots, overlapping windows being harmless for a max. The errors of
+ * the rounds add up, and the depth is ceil(log2(n)) * (sign.depth()+1).
+ **/
+void approxMaxOverSlots(Ctxt& ctxt,
+                        const EncryptedArray& ea,
+                        const SignApproximation& sign);
+
+//! @brief As approxMaxOverSlots, with the smallest of the slots
+void approxMinOverSlots(Ctxt& ctxt,
+                        const EncryptedArray& ea,
+                        const SignApproximation& sign);
+
+/**
+ * @brief An indicator of the largest slots of a CKKS ciphertext.
+ * @param out Gets about 1 in the slots within sign.epsilon() of the largest
+ * one, and about 0 in the slots at least 2*sign.epsilon() below it, up to
+ * the error of approxMaxOverSlots. The slots in between get some value
+ * between 0 and 1.
+ * @param ctxt The values, in [0,1].
+ * @param ea The `EncryptedArray` of the slots.
+ * @param sign The approximation of the sign to use.
+ *
+ * Computes (p(x - max + epsilon)+1)/2, at the depth of approxMaxOverSlots
+ * plus sign.depth().
+ **/
+void approxArgmax(Ctxt& out,
+                  const Ctxt& ctxt,
+                  const EncryptedArray& ea,
+                  const SignApproximation& sign);
+
+/**
+ * @brief Keep the slots above a threshold and clear the others.
+ * @param ctxt The values, in [0,1]. Gets x * approxGreaterThan(x, t) in
+ * every slot x: about x where x > t and about zero where x < t, as long as
+ * |x-t| >= sign.epsilon().
+ * @param t The threshold, in [0,1].
+ * @param sign The approximation of the sign to use.
+ *
+ * The depth is sign.depth()+1.
+ **/
+void approxThresholdFilter(Ctxt& ctxt,
+                           double t,
+                           const SignApproximation& sign);
+
+/**
+ * @brief The k largest slots of a CKKS ciphertext, with their positions,
+ * packed in one ciphertext.
+ * @param out Gets the t-th largest value in slot t and its position divided
+ * by n = ea.size() in slot k+t, for t < k, and about zero in the other
+ * slots.
+ * @param scores The values, in [0,1], in all the n slots. Unused slots can
+ * hold zeros, as long as they are not among the k largest.
+ * @param k The number of values to keep, with 2*k at most n.
+ * @param ea The `EncryptedArray` of the slots.
+ * @param sign The approximation of the sign to compare the values with,
+ * with alpha() at least NTL::NumBits(n). The values must be at least
+ * sign.epsilon() apart, or their ranks collide.
+ *
+ * The rank of every slot, the number of larger slots, is the sum of the
+ * approxGreaterThan of the slots and their n-1 rotations: these are
+ * independent, so the depth is sign.depth() whatever n. The slots of rank t
+ * are then selected by a second approximation of the sign, on the ranks,
+ * and moved to slot t by a `totalSums`. The depth is sign.depth() plus the
+ * depth of the sign on the ranks, with epsilon 1/(4n), plus 2; the cost is
+ * that of n-1 comparisons, accumulated into one running rank per thread.
+ **/
+void approxTopK(Ctxt& out,
+                const Ctxt& scores,
+                long k,
+                const EncryptedArray& ea,
+                const SignApproximation& sign);
+
+} // namespace helib
+
+#endif // ifndef HELIB_CKKSCOMPARE_H
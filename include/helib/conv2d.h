@@ -0,0 +1,148 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_CONV2D_H
+#define HELIB_CONV2D_H
+/**
+ * @file conv2d.h
+ * @brief Convolutions and pooling of images laid out in the slots
+ **/
+#include <vector>
+
+#include <helib/EncryptedArray.h>
+
+namespace helib {
+
+/**
+ * @class Conv2D
+ * @brief A 2D convolution layer with its filters encoded once, applied to
+ * one ciphertext per channel.
+ *
+ * An image of height x width pixels takes slot i*width+j for pixel (i, j),
+ * with height*width at most ea.size(); the other slots are ignored. The
+ * convolution is the usual one of neural networks (a correlation), with
+ * stride 1 and zero padding keeping the size of the image ("same"), so
+ * output pixel (i, j) of channel k is the sum of
+ * weights[k][c][u*kw+v] * in[c](i+u-kh/2, j+v-kw/2) over c, u and v.
+ *
+ * Kernel offset (u, v) is a rotation of the input by (u-kh/2)*width +
+ * (v-kw/2) slots. Each input channel is rotated once per offset used by any
+ * output channel, and the rotations are shared by all output channels. When
+ * the slots form one good dimension, the rotations of a channel are all
+ * hoisted (see `Ctxt::hoistedAutomorphs`). Every weight is folded with the
+ * mask of the pixels whose tap falls inside the image, and all of them are
+ * encoded in DoubleCRT form over all the primes, once, when the layer is
+ * built. Zero weights take no constant and no multiplication.
+ *
+ * For BGV, the weights must be integers and are taken modulo the plaintext
+ * space. For CKKS, they are encoded with the largest of their absolute
+ * values as magnitude.
+ **/
+class Conv2D
+{
+public:
+  /**
+   * @brief A convolution from weights[0].size() input channels to
+   * weights.size() output channels.
+   * @param ea The `EncryptedArray` of the slots.
+   * @param height The height of the images.
+   * @param width The width of the images.
+   * @param kh The height of the kernels.
+   * @param kw The width of the kernels.
+   * @param weights weights[k][c] holds the kh x kw kernel (row by row) from
+   * input channel c to output channel k.
+   **/
+  Conv2D(const EncryptedArray& ea,
+         long height,
+         long width,
+         long kh,
+         long kw,
+         const std::vector<std::vector<std::vector<double>>>& weights);
+
+  /**
+   * @brief A depthwise convolution: channel c of the output is channel c of
+   * the input convolved with the kernel weights[c] alone.
+   **/
+  static Conv2D depthwise(const EncryptedArray& ea,
+                          long height,
+                          long width,
+                          long kh,
+                          long kw,
+                          const std::vector<std::vector<double>>& weights);
+
+  /**
+   * @brief Apply the convolution.
+   * @param out The output channels, resized to outChannels().
+   * @param in The input channels, inChannels() of them.
+   **/
+  void apply(std::vector<Ctxt>& out, const std::vector<Ctxt>& in) const;
+
+  long inChannels() const { return nIn; }
+  long outChannels() const { return nOut; }
+
+  //! @brief The number of multiplications by a constant of apply()
+  long numTerms() const { return terms.size(); }
+
+  const EncryptedArray& getEA() const { return ea; }
+
+private:
+  // One product of a rotated input channel by a folded constant
+  struct Term
+  {
+    long out;
+    long in;
+    long tap;
+    FatEncodedPtxt weight;
+  };
+
+  const EncryptedArray& ea;
+  long height, width, kh, kw;
+  long nIn, nOut;
+  std::vector<Term> terms;
+
+  // shifts[tap] is the rotation of the input for kernel offset tap
+  std::vector<long> shifts;
+  // used[c][tap] tells if an output needs channel c rotated by shifts[tap]
+  std::vector<std::vector<bool>> used;
+
+  Conv2D(const EncryptedArray& ea, long height, long width, long kh, long kw);
+
+  void addTerms(const std::vector<long>& outs,
+                const std::vector<long>& ins,
+                const std::vector<const std::vector<double>*>& kernels);
+};
+
+/**
+ * @brief Average pooling over size x size windows, with stride size.
+ * @param ea The `EncryptedArray` of the slots.
+ * @param ctxt The image, laid out as for `Conv2D`, is replaced by the pooled
+ * image: the average of the window at (size*i, size*j) is left in the slot
+ * of its corner pixel, size*i*width + size*j, and all other slots are zero.
+ * @param height The height of the image, a multiple of size.
+ * @param width The width of the image, a multiple of size.
+ * @param size The side of the windows.
+ *
+ * The windows are summed along the rows, then along the columns, which
+ * takes 2*(size-1) rotations, then masked. For CKKS the mask also divides by
+ * size*size. For BGV, where the division is not exact in general, the slots
+ * hold the sums of the windows; a following layer can fold the division into
+ * its weights.
+ **/
+void avgPool2D(const EncryptedArray& ea,
+               Ctxt& ctxt,
+               long height,
+               long width,
+               long size);
+
+} // namespace helib
+
+#endif // ifndef HELIB_CONV2D_H
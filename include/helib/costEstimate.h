@@ -0,0 +1,196 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_COSTESTIMATE_H
+#define HELIB_COSTESTIMATE_H
+/**
+ * @file costEstimate.h
+ * @brief Estimating the cost of a computation with a dry run.
+ *
+ * In a dry run (see `setDryRun`) the `DoubleCRT` operations skip their work.
+ * While a `DryRunEstimate` is alive they also charge what they skipped, in
+ * rows (the `phi(m)` numbers of a polynomial modulo one prime): the NTTs,
+ * the element-wise arithmetic and the automorphisms. Together with the key
+ * switches and the memory the rows take (which a dry run still allocates),
+ * this gives an estimate of the time of the computation from a `CostModel`
+ * of the time of one row of each kind.
+ *
+ * Example:
+ * @code
+ * CostModel model = CostModel::calibrate(context);
+ * std::vector<Ctxt> inputs = ...;
+ * CostEstimate estimate = circuit.estimate(inputs, model);
+ * std::cout << estimate;
+ * @endcode
+ *
+ * The same model also prices the key-switching strategies of `keys.h`, to
+ * choose the matrices to generate for a workload (see `planKeySwitching`).
+ **/
+
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+namespace helib {
+
+class Context;
+
+/**
+ * @class CostModel
+ * @brief The time, in seconds, of the primitives on one row.
+ *
+ * Either calibrated on the machine it runs on, or set from the per-prime
+ * results of the primitive benchmarks (`cmodulus_fft` of `bgv_primitives`
+ * for `nttSeconds`).
+ **/
+struct CostModel
+{
+  double nttSeconds = 0;       //!< A forward or inverse NTT
+  double arithSeconds = 0;     //!< An element-wise operation, such as `*=`
+  double automorphSeconds = 0; //!< An automorphism
+
+  /**
+   * @brief Time the primitives on polynomials of `context`.
+   * @param context The context the estimated computation runs on.
+   * @param reps How many times each primitive is timed.
+   * @note Runs with the dry run off, and takes `3 * reps` operations on a
+   * polynomial over all the ciphertext primes. The times are wall-clock
+   * times with the current number of NTL threads.
+   **/
+  static CostModel calibrate(const Context& context, long reps = 8);
+};
+
+/**
+ * @class CostEstimate
+ * @brief What a dry run charged, and the time estimated from it.
+ **/
+struct CostEstimate
+{
+  long nttRows = 0;        //!< Rows transformed, forward or inverse
+  long arithRows = 0;      //!< Rows of element-wise arithmetic
+  long automorphRows = 0;  //!< Rows permuted by automorphisms
+  long keySwitches = 0;    //!< As counted by `fhe_ops.keySwitches`
+  long allocatedBytes = 0; //!< The rows allocated, in bytes
+  long peakBytes = 0;      //!< The most held at once above the start
+
+  //! @brief The estimated time, the sum over the primitives.
+  //! @note Work that runs concurrently (e.g. the tasks of `Circuit::run`)
+  //! is added up as if it ran one after another.
+  double seconds = 0;
+};
+
+//! @brief Print the counts and the estimated time, one line each.
+std::ostream& operator<<(std::ostream& str, const CostEstimate& estimate);
+
+/**
+ * @class DryRunEstimate
+ * @brief Turn on the dry run and charge the skipped operations, while the
+ * object lives.
+ *
+ * There can be only one at a time. The dry run is set back to what it was
+ * on destruction.
+ **/
+class DryRunEstimate
+{
+public:
+  explicit DryRunEstimate(const CostModel& model);
+  ~DryRunEstimate();
+
+  DryRunEstimate(const DryRunEstimate&) = delete;
+  DryRunEstimate& operator=(const DryRunEstimate&) = delete;
+
+  //! @brief What was charged so far.
+  CostEstimate report() const;
+
+private:
+  CostModel model;
+  bool savedDryRun;
+  long keySwitchesStart;
+};
+
+/**
+ * @class KeySwitchWorkload
+ * @brief How often a computation moves slots along each dimension, indexed
+ * by the dimension (see `EncryptedArray::dimension`). Missing entries are
+ * zero.
+ **/
+struct KeySwitchWorkload
+{
+  std::vector<long> rotations; //!< Rotations by arbitrary amounts
+  std::vector<long> matMuls;   //!< 1D matrix-vector products (`matmul.h`)
+};
+
+/**
+ * @class DimensionPlan
+ * @brief The key-switching strategy chosen for one dimension.
+ **/
+struct DimensionPlan
+{
+  long dim = 0;
+  long order = 0;
+  bool native = true;
+  int strategy = 0;   //!< `HELIB_KSS_FULL`, `HELIB_KSS_BSGS` or `HELIB_KSS_MIN`
+  long matrices = 0;  //!< Key-switching matrices generated for it
+  long bytes = 0;     //!< Their memory
+  double seconds = 0; //!< The estimated time of its part of the workload
+};
+
+/**
+ * @class KeySwitchPlan
+ * @brief The strategies of all the dimensions, as chosen by
+ * `planKeySwitching`, and their totals.
+ **/
+struct KeySwitchPlan
+{
+  std::vector<DimensionPlan> dims;
+  long bytes = 0;
+  double seconds = 0;
+  bool withinBudget = true; //!< Whether bytes fits in the memory budget
+};
+
+/**
+ * @brief Choose the key-switching strategy of every dimension.
+ * @param context The context of the keys.
+ * @param model The time of the primitives, e.g. from `CostModel::calibrate`.
+ * @param workload What the computation does along each dimension.
+ * @param memoryBudget The most bytes of matrices of the dimensions.
+ * @return The plan taking the least estimated time among those whose
+ * matrices fit in memoryBudget. If none fits, the plan with the fewest
+ * bytes, with withinBudget false.
+ *
+ * Each strategy trades memory for time: `HELIB_KSS_FULL` keeps a matrix per
+ * amount and rotates with a single key switch, `HELIB_KSS_BSGS` keeps about
+ * 2*sqrt(order) of them and switches twice, `HELIB_KSS_MIN` keeps one or
+ * two and rotates step by step. The time of a key switch is priced in rows
+ * as the dry run charges them (the digit decomposition, the inner products
+ * with the matrices and the mod-down), at the top level of the context.
+ * The matrices of the re-linearization and of the Frobenius automorphism
+ * are not counted. Apply the plan with `addPlannedMatrices`.
+ **/
+KeySwitchPlan planKeySwitching(const Context& context,
+                               const CostModel& model,
+                               const KeySwitchWorkload& workload,
+                               long memoryBudget);
+
+//! @brief Print the strategy of every dimension and the totals, one line
+//! each.
+std::ostream& operator<<(std::ostream& str, const KeySwitchPlan& plan);
+
+//! \cond FALSE (make doxygen ignore these)
+// The charges of the skipped operations, made in the dry-run branches
+extern std::atomic_bool dryRunEstimating;
+void chargeDryRunRows(long nttRows, long arithRows, long automorphRows);
+void chargeDryRunBytes(long bytes);
+//! \endcond
+
+} // namespace helib
+
+#endif // ifndef HELIB_COSTESTIMATE_H
@@ -0,0 +1,106 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_CTXTMATMUL_H
+#define HELIB_CTXTMATMUL_H
+/**
+ * @file ctxtMatMul.h
+ * @brief Products of two encrypted matrices
+ **/
+#include <utility>
+#include <vector>
+
+#include <helib/EncryptedArray.h>
+
+namespace helib {
+
+/**
+ * @class CtxtMatMul
+ * @brief Multiplies d x d matrices that are both encrypted, with the
+ * permutations of Jiang, Kim, Lauter and Song ("Secure Outsourced Matrix
+ * Computation and Application to Neural Networks", CCS 2018) encoded once.
+ *
+ * A matrix A takes slot i*d+j for entry (i, j), with d*d at most ea.size();
+ * the other slots are ignored, and are zero in the products. With
+ * sigma(A)(i, j) = A(i, i+j), tau(B)(i, j) = B(i+j, j), and phi^k and psi^k
+ * the rotations of the columns and of the rows by k (indices mod d),
+ *   A * B = sum_k phi^k(sigma(A)) . psi^k(tau(B)),  k = 0..d-1,
+ * where . multiplies slot by slot.
+ *
+ * Each permutation is a sum of masked shifts of its input: sigma and tau
+ * take 2d-1 shifts each, and all the phi^k (and all the psi^k) together
+ * take 2d-1 shifts of sigma(A) (of tau(B)), which are hoisted when the slots
+ * form one dimension (see `shiftedCopies`). All the masks are encoded in
+ * DoubleCRT form over all the primes when the object is built. A product
+ * takes two levels of masks and one multiplication; the d products of a sum
+ * are re-linearized once.
+ **/
+class CtxtMatMul
+{
+public:
+  //! @brief Products of d x d matrices in the slots of ea
+  CtxtMatMul(const EncryptedArray& ea, long d);
+
+  //! @brief c = a * b
+  void mul(Ctxt& c, const Ctxt& a, const Ctxt& b) const;
+
+  /**
+   * @brief The product of two block matrices, each block a d x d matrix in
+   * a ciphertext of its own.
+   * @param c The rows x cols blocks of a * b, row by row.
+   * @param a The rows x inner blocks of a, row by row.
+   * @param b The inner x cols blocks of b, row by row.
+   *
+   * Every block of a and b is permuted once, however many products it
+   * takes part in.
+   **/
+  void mul(std::vector<Ctxt>& c,
+           const std::vector<Ctxt>& a,
+           const std::vector<Ctxt>& b,
+           long rows,
+           long inner,
+           long cols) const;
+
+  long getDim() const { return d; }
+  const EncryptedArray& getEA() const { return ea; }
+
+  //! @brief The number of masks (multiplications by a constant) per operand
+  long numMasks() const;
+
+private:
+  // Masked shifts of one input: output o is the sum over the terms of
+  // outs[o] of mask * (copy of the input shifted by shifts[copy])
+  struct Transform
+  {
+    std::vector<long> shifts;
+    std::vector<std::vector<std::pair<long, FatEncodedPtxt>>> outs;
+  };
+
+  const EncryptedArray& ea;
+  long d;
+  Transform sigma, tau, phi, psi;
+
+  // The transform with outputs o for which slot p holds slot sources[o][p]
+  // of the input (for p < d*d), and zero (sources[o][p] = -1) elsewhere
+  Transform buildTransform(
+      const std::vector<std::vector<long>>& sources) const;
+
+  void apply(std::vector<Ctxt>& out, const Transform& t, const Ctxt& in) const;
+
+  // The d ciphertexts phi^k(sigma(in)) of a left operand, or psi^k(tau(in))
+  // of a right one
+  void prepare(std::vector<Ctxt>& out, const Ctxt& in, bool left) const;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_CTXTMATMUL_H
@@ -0,0 +1,141 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_DISTRIBUTED_H
+#define HELIB_DISTRIBUTED_H
+/**
+ * @file distributed.h
+ * @brief Running a batch of ciphertexts, or the terms of a sum, over
+ * several nodes.
+ *
+ * The nodes talk through a `Transport`, which moves opaque messages between
+ * them: an MPI communicator, sockets, or the in-process `LocalTransport`.
+ * Every node calls the same functions in the same order (as with MPI
+ * collectives), node 0 coordinating. The ciphertexts travel in the compact
+ * format of `Ctxt::writeCompact`.
+ *
+ * Each node works with its own `Context` and `PubKey`, which must match
+ * those of the other nodes. A node only needs the key-switching matrices of
+ * the work sent to it, so it can load its keys with `KeySource::fromFiles`
+ * from a key file of its own.
+ **/
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <helib/Ctxt.h>
+
+namespace helib {
+
+/**
+ * @class Transport
+ * @brief Moves messages between the nodes of a computation.
+ *
+ * Messages from one node to another must arrive in the order they were sent.
+ * send() may return before the message is received.
+ **/
+class Transport
+{
+public:
+  virtual ~Transport() = default;
+
+  //! @brief This node, from 0 to size() - 1. Node 0 coordinates.
+  virtual long rank() const = 0;
+
+  //! @brief The number of nodes
+  virtual long size() const = 0;
+
+  //! @brief Send a message to node to
+  virtual void send(long to, std::string message) = 0;
+
+  //! @brief The next message from node from, waiting for it if need be
+  virtual std::string receive(long from) = 0;
+};
+
+/**
+ * @class LocalTransport
+ * @brief The endpoints of nodes that are threads of one process, e.g. for
+ * testing, or for spreading work over the sockets of one host.
+ **/
+class LocalTransport : public Transport
+{
+public:
+  //! @brief The endpoints of nodes 0 to nodes - 1, for one thread each
+  static std::vector<std::unique_ptr<LocalTransport>> group(long nodes);
+
+  long rank() const override { return me; }
+  long size() const override { return shared->nodes; }
+  void send(long to, std::string message) override;
+  std::string receive(long from) override;
+
+private:
+  struct Shared
+  {
+    long nodes;
+    std::mutex mutex;
+    std::condition_variable arrived;
+    // The messages waiting, by receiver then sender
+    std::vector<std::vector<std::deque<std::string>>> queues;
+  };
+
+  std::shared_ptr<Shared> shared;
+  long me;
+
+  LocalTransport(std::shared_ptr<Shared> _shared, long _me) :
+      shared(std::move(_shared)), me(_me)
+  {}
+};
+
+/**
+ * @brief Apply op to a batch of ciphertexts, each node taking a share of it.
+ * @param transport The nodes.
+ * @param ctxts On node 0, the batch, replaced by its results. On the other
+ * nodes, replaced by their share of the results.
+ * @param pubKey The key of this node, for reading the ciphertexts.
+ * @param op The work, applied by every node to its share, e.g. a call to
+ * `PubKey::thinReCrypt` or to `MatMulExecBase::mul`. It gets the
+ * ciphertexts in their order in the batch.
+ * @param keepBits The capacity in bits (in excess of decryption) that the
+ * ciphertexts keep, both ways; -1 keeps what they have.
+ *
+ * The batch is split in order and as evenly as possible, and the results
+ * come back in the same order. If op throws on some node, node 0 rethrows
+ * the first error after all the nodes are done, as a `LogicError` for the
+ * other nodes; the node where it was thrown rethrows it as well.
+ **/
+void distributedApply(Transport& transport,
+                      std::vector<Ctxt>& ctxts,
+                      const PubKey& pubKey,
+                      const std::function<void(std::vector<Ctxt>&)>& op,
+                      long keepBits = -1);
+
+/**
+ * @brief The sum of the ciphertexts partial of all the nodes.
+ * @param transport The nodes.
+ * @param partial The term of this node, e.g. the linear map of the giant
+ * steps or the branches of a matrix that were given to it.
+ * @param keepBits As in distributedApply.
+ * @return On node 0, the sum. On the other nodes, the sum of the terms that
+ * went through them, which is of no further use.
+ *
+ * The terms are added up along a binary tree, in log2(size()) rounds.
+ **/
+Ctxt distributedSum(Transport& transport,
+                    const Ctxt& partial,
+                    long keepBits = -1);
+
+} // namespace helib
+
+#endif // ifndef HELIB_DISTRIBUTED_H
@@ -13,9 +13,12 @@
 #ifndef HELIB_STATS_H
 #define HELIB_STATS_H
 
+#include <functional>
 #include <vector>
 #include <iostream>
 
+#include <helib/multicore.h>
+
 namespace helib {
 
 struct fhe_stats_record
@@ -28,13 +31,27 @@ struct fhe_stats_record
   std::vector<double> saved_values;
   // save all values --- only used if explicitly requested
 
+  //! The updates by value: histogram[i] counts the values v with
+  //! getBucketBound(i-1) < v <= getBucketBound(i), the bounds being powers
+  //! of two. The first and last buckets also take the values out of range.
+  static constexpr long numBuckets = 96;
+  static constexpr long minExponent = -48;
+  long histogram[numBuckets] = {};
+
   static std::vector<fhe_stats_record*> map;
 
   fhe_stats_record(const char* _name);
   void update(double val);
   void save(double val);
+
+  //! The upper bound of histogram[i], the last one is infinite
+  static double getBucketBound(long i);
 };
 
+//! Call fn on every stats record, while no record is updated.
+//! @note fn must not update a record.
+void forEachStatsRecord(const std::function<void(const fhe_stats_record&)>& fn);
+
 #define HELIB_STATS_UPDATE(name, val)                                          \
   do {                                                                         \
     if (fhe_stats) {                                                           \
@@ -51,6 +68,86 @@ struct fhe_stats_record
     }                                                                          \
   } while (0)
 
+//! The count of one operation, in total and by the number of primes of the
+//! ciphertext (or polynomial) it was applied to. Operations over more than
+//! maxPrimes primes are counted with maxPrimes.
+struct fhe_op_counter
+{
+  static constexpr long maxPrimes = 63;
+
+  HELIB_atomic_long total{0};
+  HELIB_atomic_long byPrimes[maxPrimes + 1] = {};
+
+  void add(long nPrimes)
+  {
+    total++;
+    byPrimes[nPrimes < maxPrimes ? (nPrimes < 0 ? 0 : nPrimes) : maxPrimes]++;
+  }
+};
+
+//! Running counts of the most expensive primitives. They are always on:
+//! take a snapshot (see snapshot_op_counts) before and after a computation
+//! and subtract them to get its counts.
+struct fhe_op_counts
+{
+  //! Key-switching operations, each over all the digits of one part
+  HELIB_atomic_long keySwitches{0};
+  //! Forward and inverse NTTs, each modulo a single prime
+  HELIB_atomic_long ntts{0};
+  //! The forward and the inverse NTTs among ntts
+  HELIB_atomic_long ffts{0};
+  HELIB_atomic_long iffts{0};
+
+  //! Calls to Ctxt::keySwitchPart
+  fhe_op_counter keySwitchParts;
+  //! Calls to DoubleCRT::automorph
+  fhe_op_counter automorphs;
+  //! Re-linearizations of ciphertexts not in canonical form
+  fhe_op_counter reLinearizations;
+  //! Calls to Ctxt::modDownToSet that drop primes
+  fhe_op_counter modDowns;
+  //! Bootstrapped ciphertexts, by reCrypt or thinReCrypt
+  fhe_op_counter reCrypts;
+};
+
+extern fhe_op_counts fhe_ops;
+
+//! A copy of an fhe_op_counter, see fhe_op_snapshot
+struct fhe_op_count
+{
+  long total = 0;
+  std::vector<long> byPrimes; // byPrimes[n] is the count over n primes
+
+  fhe_op_count operator-(const fhe_op_count& earlier) const;
+};
+
+//! A copy of the counts of fhe_ops at some point
+struct fhe_op_snapshot
+{
+  long keySwitches = 0;
+  long ntts = 0;
+  long ffts = 0;
+  long iffts = 0;
+  fhe_op_count keySwitchParts;
+  fhe_op_count automorphs;
+  fhe_op_count reLinearizations;
+  fhe_op_count modDowns;
+  fhe_op_count reCrypts;
+
+  //! The counts between `earlier` and this snapshot
+  fhe_op_snapshot operator-(const fhe_op_snapshot& earlier) const;
+};
+
+//! Take a snapshot of fhe_ops
+fhe_op_snapshot snapshot_op_counts();
+
+//! Set all the counts of fhe_ops to zero.
+//! @note Not atomic with respect to the operations running meanwhile.
+void reset_op_counts();
+
+//! Print the non-zero counts of a snapshot, with their breakdown
+void print_op_counts(std::ostream& s, const fhe_op_snapshot& counts);
+
 void print_stats(std::ostream& s);
 
 const std::vector<double>* fetch_saved_values(const char*);
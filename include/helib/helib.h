@@ -20,11 +20,15 @@
 #include <helib/version.h>
 
 #include <helib/DoubleCRT.h>
+#include <helib/FlatDoubleCRT.h>
 #include <helib/Context.h>
 #include <helib/Ctxt.h>
+#include <helib/CtxtPool.h>
+#include <helib/EncodedPtxtCache.h>
 #include <helib/keySwitching.h>
 #include <helib/keys.h>
 #include <helib/EncryptedArray.h>
 #include <helib/Ptxt.h>
+#include <helib/ScratchPool.h>
 
 #endif // HELIB_HELIB_H
@@ -0,0 +1,123 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_HUGEPAGES_H
+#define HELIB_HUGEPAGES_H
+/**
+ * @file hugePages.h
+ * @brief Buffers for long-lived data, placed in huge pages when possible.
+ *
+ * Key-switching matrices and cached constants are many megabytes of
+ * read-mostly data, touched almost at random one row at a time. With 4 KB
+ * pages most of these accesses miss the TLB. A `HugePageBuffer` is instead
+ * backed, in order of preference, by
+ *  - explicit huge pages (`MAP_HUGETLB`, 1 GB then 2 MB), if the system has
+ *    reserved some (see `/proc/sys/vm/nr_hugepages`);
+ *  - transparent huge pages, by a 2 MB-aligned mapping given to the kernel
+ *    with `madvise(MADV_HUGEPAGE)`, unless they are disabled;
+ *  - plain memory, which is also what is used off Linux, for small buffers,
+ *    and for the categories that `HugePagePolicy` does not enable.
+ **/
+
+#include <array>
+
+#include <helib/memoryReport.h>
+
+namespace helib {
+
+//! @brief How the memory of a `HugePageBuffer` is backed.
+enum class HugePageKind : int
+{
+  NONE = 0,    //!< Regular pages
+  TRANSPARENT, //!< Transparent huge pages (as far as the kernel grants them)
+  HUGETLB_2MB, //!< Explicit 2 MB pages
+  HUGETLB_1GB, //!< Explicit 1 GB pages
+  COUNT        //!< The number of kinds, not a kind
+};
+
+//! @brief The name of a kind, such as `"hugetlb-2mb"`.
+const char* hugePageKindName(HugePageKind kind);
+
+/**
+ * @class HugePagePolicy
+ * @brief Which buffers go to huge pages.
+ *
+ * By default the long-lived categories `KEYS`, `MATMUL_CACHE` and
+ * `BOOTSTRAPPING` do, for buffers of at least getMinBytes() bytes. The
+ * settings are global, and only affect the buffers allocated afterwards.
+ **/
+class HugePagePolicy
+{
+public:
+  //! The default of getMinBytes(), one 2 MB page
+  static constexpr long DEFAULT_MIN_BYTES = 2L << 20;
+
+  static void setEnabled(MemoryCategory category, bool enable);
+  static bool isEnabled(MemoryCategory category);
+
+  //! @brief Smaller buffers are left in regular pages, where they waste less
+  static void setMinBytes(long bytes);
+  static long getMinBytes();
+
+  //! @brief Whether to try explicit huge pages before transparent ones (the
+  //! default). Trying costs a failed mmap when none are reserved
+  static void setUseHugeTLB(bool use);
+  static bool getUseHugeTLB();
+};
+
+//! @brief The live buffers and their bytes, by kind.
+struct HugePageStats
+{
+  std::array<long, int(HugePageKind::COUNT)> buffers{};
+  std::array<long, int(HugePageKind::COUNT)> bytes{};
+};
+
+//! @brief The counts over all the `HugePageBuffer` objects alive now.
+HugePageStats hugePageStats();
+
+/**
+ * @class HugePageBuffer
+ * @brief A zero-initialized buffer of size() bytes, aligned to at least 64
+ * bytes, in huge pages if the policy and the system allow it.
+ **/
+class HugePageBuffer
+{
+public:
+  HugePageBuffer() = default;
+
+  //! @brief Allocate bytes bytes, for data charged to category. Throws
+  //! std::bad_alloc if there is no memory at all
+  HugePageBuffer(long bytes, MemoryCategory category);
+
+  ~HugePageBuffer() { release(); }
+
+  HugePageBuffer(const HugePageBuffer&) = delete;
+  HugePageBuffer& operator=(const HugePageBuffer&) = delete;
+
+  HugePageBuffer(HugePageBuffer&& other) noexcept;
+  HugePageBuffer& operator=(HugePageBuffer&& other) noexcept;
+
+  void* data() const { return ptr; }
+  long size() const { return bytes; }
+  HugePageKind kind() const { return pages; }
+
+private:
+  void* ptr = nullptr;
+  long bytes = 0;
+  long mapped = 0; // the length of the mapping, or 0 if from the heap
+  HugePageKind pages = HugePageKind::NONE;
+
+  void release();
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_HUGEPAGES_H
@@ -0,0 +1,211 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_KEYREGISTRY_H
+#define HELIB_KEYREGISTRY_H
+/**
+ * @file keyRegistry.h
+ * @brief A cache of contexts and public keys, for servers with many tenants.
+ *
+ * Every tenant has a `Context` and a `PubKey`, which take seconds to build
+ * and can take gigabytes of memory. A `KeyRegistry` knows how to load the
+ * pair of every tenant, and keeps the recently used pairs loaded while
+ * their memory fits in a budget. Tenants whose contexts have the same
+ * fingerprint share a single `Context` object.
+ **/
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <helib/Context.h>
+#include <helib/keys.h>
+
+namespace helib {
+
+/**
+ * @struct KeySource
+ * @brief How to load the context and the public key of a tenant.
+ **/
+struct KeySource
+{
+  //! @brief Builds the context
+  std::function<std::unique_ptr<Context>()> loadContext;
+
+  //! @brief Builds the key, over the context given.
+  std::function<std::unique_ptr<PubKey>(const Context&)> loadKey;
+
+  //! @brief The expected Context::fingerprint(), or 0 if unknown. When it
+  //! is known and a context with that fingerprint is loaded already,
+  //! loadContext is not called at all.
+  unsigned long contextFingerprint = 0;
+
+  //! @brief The expected PubKey::fingerprint(), or 0 not to check it.
+  //! Checking takes a pass over the whole key.
+  unsigned long keyFingerprint = 0;
+
+  /**
+   * @brief A source reading the context with Context::readSnapshotFrom and
+   * mapping the key with PubKey::readMapped.
+   * @param contextPath A file written by Context::writeSnapshotTo.
+   * @param keyPath A file written by PubKey::writeMappableTo.
+   **/
+  static KeySource fromFiles(const std::string& contextPath,
+                             const std::string& keyPath);
+};
+
+/**
+ * @struct KeyEntry
+ * @brief The loaded context and key of a tenant. The key refers to the
+ * context, which the entry keeps alive with it.
+ **/
+struct KeyEntry
+{
+  std::shared_ptr<const Context> context;
+  std::shared_ptr<const PubKey> publicKey;
+  unsigned long contextFingerprint = 0;
+};
+
+//! @brief The counts of a `KeyRegistry` since its construction.
+struct KeyRegistryStats
+{
+  long hits = 0;           // get() or pin() found the entry loaded
+  long loads = 0;          // entries loaded, or waited for while loading
+  long failedLoads = 0;    // loads that threw
+  long sharedContexts = 0; // loads that reused a context already loaded
+  long evictions = 0;      // entries dropped to fit in the budget
+};
+
+/**
+ * @class KeyRegistry
+ * @brief A thread-safe LRU cache of tenants' contexts and public keys.
+ *
+ * get() returns the entry of a tenant, loading it first if need be. A
+ * tenant is loaded by one thread at a time: the other threads asking for
+ * it wait for that load rather than starting their own. After every load
+ * the least recently used entries that are not pinned are dropped, until
+ * residentBytes() is at most the budget. Dropping an entry only releases
+ * the registry's reference: callers still holding it keep using it, and
+ * the memory is freed when the last of them lets go.
+ *
+ * residentBytes() adds up the memory reports (see memoryReport.h) of the
+ * distinct contexts of the loaded entries, which include their keys, each
+ * taken when the first entry over that context is loaded. The
+ * rows of keys mapped with PubKey::readMapped live in the page cache and
+ * are not counted. Pinned entries are counted but never dropped, so the
+ * budget can be exceeded by them.
+ **/
+class KeyRegistry
+{
+public:
+  //! @brief A registry keeping at most budget bytes of unpinned entries
+  explicit KeyRegistry(long budget);
+
+  KeyRegistry(const KeyRegistry&) = delete;
+  KeyRegistry& operator=(const KeyRegistry&) = delete;
+
+  //! @brief Register a tenant, without loading it. Throws `LogicError` if
+  //! the id is taken
+  void add(const std::string& id, KeySource source);
+
+  //! @brief Forget a tenant along with its entry, if loaded. Throws
+  //! `LogicError` for an unknown id
+  void remove(const std::string& id);
+
+  bool contains(const std::string& id) const;
+  bool isLoaded(const std::string& id) const;
+
+  /**
+   * @brief The entry of a tenant, loaded first if need be.
+   * @param id The tenant.
+   * @return The entry, which stays valid for as long as it is held.
+   *
+   * Throws `LogicError` for an unknown id, `IOError` if a fingerprint of the
+   * source does not match what was loaded, and whatever the source throws.
+   * A failed load is not cached, and the next get() tries again.
+   **/
+  std::shared_ptr<const KeyEntry> get(const std::string& id);
+
+  //! @brief As get(), also keeping the entry loaded until as many calls to
+  //! unpin() as to pin() are made
+  std::shared_ptr<const KeyEntry> pin(const std::string& id);
+
+  //! @brief Undo one pin(). Throws `LogicError` if the tenant is not pinned
+  void unpin(const std::string& id);
+
+  //! @brief Change the budget, dropping entries to fit in it
+  void setBudget(long budget);
+  long getBudget() const;
+
+  //! @brief The memory of the loaded entries, as described above
+  long residentBytes() const;
+
+  //! @brief The number of loaded entries
+  long numLoaded() const;
+
+  KeyRegistryStats stats() const;
+
+private:
+  using EntryPtr = std::shared_ptr<const KeyEntry>;
+
+  struct Slot
+  {
+    KeySource source;
+    unsigned long generation = 0; // tells apart tenants re-added under an id
+    EntryPtr entry;               // null until loaded
+    std::shared_future<EntryPtr> loading; // valid while being loaded
+    long pins = 0;
+    std::list<std::string>::iterator position; // in lru, when loaded
+  };
+
+  mutable std::mutex mutex;
+  long budget;
+  unsigned long generations = 0;
+  std::unordered_map<std::string, Slot> slots;
+  std::list<std::string> lru; // the loaded entries, most recent first
+  std::map<unsigned long, std::weak_ptr<const Context>> contexts;
+  KeyRegistryStats counts;
+
+  // The distinct contexts of the loaded entries, with the number of entries
+  // over each and its bytes when it was first counted, and their total
+  struct ResidentContext
+  {
+    long entries = 0;
+    long bytes = 0;
+  };
+  std::unordered_map<const Context*, ResidentContext> residentContexts;
+  long resident = 0;
+
+  Slot& find(const std::string& id);
+  const Slot& find(const std::string& id) const;
+  std::shared_ptr<const KeyEntry> acquire(const std::string& id, bool pin);
+  EntryPtr load(const KeySource& source);
+  // The context with that fingerprint if one is alive, else loaded (which
+  // may be null), remembered under fingerprint
+  std::shared_ptr<const Context> shareContext(
+      unsigned long fingerprint,
+      std::shared_ptr<const Context> loaded);
+
+  // With the mutex held. The entries taken out are returned, for the
+  // caller to release them after unlocking
+  void insert(Slot& slot, const std::string& id, EntryPtr entry);
+  EntryPtr drop(Slot& slot);
+  std::vector<EntryPtr> trimLocked();
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_KEYREGISTRY_H
@@ -21,12 +21,18 @@
  */
 
 #include <climits>
+#include <memory>
 #include <helib/DoubleCRT.h>
 #include <helib/Context.h>
 #include <helib/Ctxt.h>
+#include <helib/hugePages.h>
 
 namespace helib {
 
+class MappedFile;
+class MappedRows;
+class LazyKeyStore;
+
 /**
  * @class KeySwitch
  * @brief Key-switching matrices
@@ -85,6 +91,8 @@ namespace helib {
  ********************************************************************/
 class KeySwitch
 {
+  friend class PubKey; // attaches the rows of mapped key files
+
 public:
   /**
    * @brief Class label to be added to JSON serialization as object type
@@ -101,6 +109,26 @@ public:
   NTL::xdouble noiseBound; // high probability bound on noise magnitude
   // in each column
 
+private:
+  // The a_i's, when materialized. They are immutable, so copies of the
+  // matrix can share them.
+  std::shared_ptr<const std::vector<DoubleCRT>> expandedA;
+
+  // For keys read with PubKey::readMapped, the b_i's viewed in the mapped
+  // file, and after moveToHugePages, in one buffer; b is then empty
+  std::shared_ptr<const MappedRows> mappedB;
+
+  // For keys read with PubKey::readLazy, the store that reads in the b_i's
+  // (matrix number lazyIndex in it, with lazyCols columns), and b is empty
+  std::shared_ptr<const LazyKeyStore> lazyB;
+  long lazyIndex = -1;
+  long lazyCols = 0;
+
+  // b, or a copy of the mapped or lazily read b_i's
+  std::vector<DoubleCRT> copyOfB() const;
+
+public:
+
   explicit KeySwitch(long sPow = 0,
                      long xPow = 0,
                      long fromID = 0,
@@ -116,6 +144,90 @@ public:
 
   unsigned long NumCols() const;
 
+  //! Seeds with this bit set derive every a_i from PRG streams of its own,
+  //! keyed by (prgSeed, i). Older matrices have 256-bit seeds, and generate
+  //! all the a_i's in sequence from a single stream over all the primes.
+  //! Matrices with such seeds are serialized in a format of their own, so
+  //! that older readers reject them.
+  static constexpr long INDEXED_SEED_BIT = 256;
+
+  //! @brief Choose a fresh random prgSeed, with independent streams
+  void newPRGSeed(PRG& prg = PRG::current());
+
+  //! @brief Is each a_i derived independently from prgSeed?
+  bool hasIndexedSeed() const { return NTL::bit(prgSeed, INDEXED_SEED_BIT); }
+
+  /**
+   * @brief Regenerate the pseudorandom a_i's of the bottom row.
+   * @param a On input, the DoubleCRT objects to fill (at most NumCols() of
+   * them). With an indexed seed they may be defined over any set of primes,
+   * and agree with a_i on those. Otherwise they must be defined over all the
+   * ctxt and special primes, or the PRG goes out of sync.
+   *
+   * With an indexed seed, the a_i's are generated in parallel.
+   **/
+  void generateA(std::vector<DoubleCRT>& a) const;
+
+  /**
+   * @brief Keep the a_i's of the bottom row in memory, over all the ctxt and
+   * special primes, so that key switching no longer regenerates them.
+   *
+   * This roughly doubles the memory used by the matrix. The expanded a_i's
+   * are not serialized, and are not part of the comparison operators.
+   **/
+  void materializeA(const Context& context);
+
+  //! @brief Drop the expanded a_i's, going back to generating them on use
+  void releaseA() { expandedA.reset(); }
+
+  //! @brief The expanded a_i's, or nullptr if they were not materialized
+  const std::vector<DoubleCRT>* getExpandedA() const
+  {
+    return expandedA.get();
+  }
+
+  //! @brief Are the b_i's viewed in place outside of b, in a memory-mapped
+  //! key file or in huge pages (in which case the member b is empty)?
+  bool isMapped() const { return mappedB != nullptr; }
+
+  /**
+   * @brief Move the b_i's into one contiguous buffer, placed in huge pages
+   * if `HugePagePolicy` allows it for keys (see hugePages.h).
+   *
+   * The rows modulo each prime, of all the b_i's, are adjacent, in the
+   * order in which key switching reads them, so that the products of the
+   * digits by the b_i's stream through the buffer from start to end.
+   *
+   * The matrix is then used as a mapped one: isMapped() becomes true, the
+   * member b is emptied, and copies of the matrix share the buffers. Mapped,
+   * lazy and dummy matrices are left as they are.
+   * @return Whether the rows were moved. They may have been moved to
+   * regular pages, see getPageKind().
+   **/
+  bool moveToHugePages();
+
+  //! @brief The kind of pages that hold the mapped b_i's: NONE unless the
+  //! rows were moved to huge pages by moveToHugePages
+  HugePageKind getPageKind() const;
+
+  //! @brief The rows of the mapped b_i's, see DoubleCRT::innerProduct.
+  //! Must only be called if isMapped()
+  const std::vector<IndexMap<const long*>>& getMappedB() const;
+
+  //! @brief Are the b_i's read in from a key file when they are used (in
+  //! which case the member b is empty)?
+  bool isLazy() const { return lazyB != nullptr; }
+
+  //! @brief Are the b_i's in memory? Always true unless isLazy()
+  bool isResident() const;
+
+  /**
+   * @brief The b_i's, reading them in first for lazy matrices. Holding on to
+   * the result keeps them alive, even if the matrix is evicted meanwhile.
+   * Must not be called if isMapped().
+   **/
+  std::shared_ptr<const std::vector<DoubleCRT>> residentB() const;
+
   //! @brief returns a dummy static matrix with toKeyId == -1
   static const KeySwitch& dummy();
   bool isDummy() const;
@@ -141,6 +253,23 @@ public:
    **/
   static KeySwitch readFrom(std::istream& str, const Context& context);
 
+  /**
+   * @brief Write out the `KeySwitch` object as writeTo does, with the
+   * residues of the b_i's modulo each prime p packed into NumBits(p - 1)
+   * bits (see DoubleCRT::writePackedTo).
+   * @param str Output `std::ostream`.
+   **/
+  void writePackedTo(std::ostream& str) const;
+
+  /**
+   * @brief Read from the stream a `KeySwitch` object written by
+   * writePackedTo.
+   * @param str Input `std::istream`.
+   * @param context The `Context` to be used.
+   * @return The deserialized `KeySwitch` object.
+   **/
+  static KeySwitch readPackedFrom(std::istream& str, const Context& context);
+
   /**
    * @brief Write out the switch key (`KeySwitch`) object to the output
    * stream using JSON format.
@@ -187,6 +316,26 @@ public:
    * @param context The `Context` to be used.
    **/
   void readJSON(const JsonWrapper& j, const Context& context);
+
+  /**
+   * @brief Write out the switch key (`KeySwitch`) object as a JSON header
+   * whose content is the binary format of writeTo, base64-encoded.
+   * @param str Output `std::ostream`.
+   *
+   * The binary body is encoded as it is written, without building a JSON
+   * document of the residues.
+   **/
+  void writeToHybridJSON(std::ostream& str) const;
+
+  /**
+   * @brief Read from the stream a switch key (`KeySwitch`) object written by
+   * writeToHybridJSON.
+   * @param str Input `std::istream`.
+   * @param context The `Context` to be used.
+   * @return The deserialized `KeySwitch` object.
+   **/
+  static KeySwitch readFromHybridJSON(std::istream& str,
+                                      const Context& context);
 };
 std::ostream& operator<<(std::ostream& str, const KeySwitch& matrix);
 // We DO NOT have std::istream& operator>>(std::istream& str, KeySwitch&
@@ -253,6 +402,19 @@ void addTheseMatrices(SecKey& sKey,
                       const std::set<long>& automVals,
                       long keyID = 0);
 
+//! Generate the key-switching matrices that were used while recording, see
+//! KeySwitchRecorder, and copy the key-switching strategies of the recorded
+//! key, so that the same computation takes the same paths
+class KeySwitchRecorder;
+void addRecordedMatrices(SecKey& sKey, const KeySwitchRecorder& recorder);
+
+//! Generate the matrices of every dimension with the strategy chosen for it
+//! by planKeySwitching (see costEstimate.h)
+struct KeySwitchPlan;
+void addPlannedMatrices(SecKey& sKey,
+                        const KeySwitchPlan& plan,
+                        long keyID = 0);
+
 } // namespace helib
 
 #endif // HELIB_KEY_SWITCHING_H
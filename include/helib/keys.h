@@ -20,8 +20,14 @@
  * Copyright IBM Corporation 2019 All rights reserved.
  */
 
+#include <functional>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
 #include <helib/keySwitching.h>
 #include <helib/EncodedPtxt.h>
+#include <helib/numa.h>
 
 namespace helib {
 
@@ -37,12 +43,22 @@ namespace helib {
 #define HELIB_KSS_MIN (3)
 // minimal strategy (for g_i, and for g_i^{-ord_i} for bad dims)
 
+class KeySwitchRecorder;
+class PtxtArray;
+
 /**
  * @class PubKey
  * @brief The public key
+ *
+ * Thread safety: once its key-switching matrices are added, a `PubKey` is
+ * only read by encryption and by the operations on its ciphertexts, so one
+ * key can be shared by any number of threads without locking. Lazily loaded
+ * matrices are materialized once under a lock. A `KeySwitchRecorder` must be
+ * attached and detached while no other thread is using the key.
  ********************************************************************/
 class PubKey
 {                         // The public key
+  friend class KeySwitchRecorder;
   const Context& context; // The context
 
 private:
@@ -62,6 +78,11 @@ private:
   // use when re-linearizing s_i(X^n).
   std::vector<std::vector<long>> keySwitchMap;
 
+  // The chains of getAutomorphChain, keyed by keyID*m + k. They are not
+  // copied with the key, and setKeySwitchMap drops them
+  mutable std::mutex automorphChainMutex;
+  mutable std::unordered_map<long, std::vector<long>> automorphChains;
+
   NTL::Vec<long> KS_strategy; // NTL Vec's support I/O, which is more convenient
 
   // bootstrapping data
@@ -69,6 +90,74 @@ private:
   long recryptKeyID; // index of the bootstrapping key
   Ctxt recryptEkey;  // the key itself, encrypted under key #0
 
+  // The stage of reCrypt and thinReCrypt that moves a ciphertext in
+  // canonical form to an encryption under the bootstrapping key of its
+  // raw mod-switch to q=p^e+1
+  void bootKeySwitch(Ctxt& ctxt) const;
+
+  // reCrypt and thinReCrypt of a CKKS ciphertext, see CKKSRecryptData
+  void ckksReCrypt(Ctxt& ctxt) const;
+
+  // When not null, notified of every matrix handed out for key switching
+  mutable KeySwitchRecorder* recorder = nullptr;
+
+  // Random encryptions of zero made ahead of time by
+  // precomputeZeroEncryptions, each one taken by a single encryption
+  mutable std::mutex zeroPoolMutex;
+  mutable std::vector<Ctxt> zeroPool;
+
+  // Set ctxt to r*pk + p*(e0,e1), a fresh random encryption of zero with
+  // noise a multiple of p = ptxtSpace (1 for CKKS), and its noise bound,
+  // modulo the product of primes (a subset of the ctxt primes), drawing its
+  // randomness from prg
+  void encryptZero(Ctxt& ctxt,
+                   long ptxtSpace,
+                   const IndexSet& primes,
+                   PRG& prg = PRG::current()) const;
+
+  // A bound on the noise of encryptZero, known before sampling
+  NTL::xdouble zeroEncryptionNoiseBound(long ptxtSpace) const;
+
+  // The ctxt primes of a fresh ciphertext with the given total noise bound
+  // that leave it targetCapacity bits of capacity (all of them if none do)
+  IndexSet primesForCapacity(long targetCapacity, NTL::xdouble noise) const;
+
+  // The encryptions of EncodedPtxt, over the primes of targetCapacity, or
+  // over all the ctxt primes if it is negative
+  void encryptBGV(Ctxt& ctxt,
+                  const EncodedPtxt_BGV& eptxt,
+                  long targetCapacity) const;
+  void encryptCKKS(Ctxt& ctxt,
+                   const EncodedPtxt_CKKS& eptxt,
+                   long targetCapacity) const;
+
+  // Move a precomputed encryption of zero for ptxtSpace to ctxt, if there is
+  // one left
+  bool takeZeroEncryption(Ctxt& ctxt, long ptxtSpace) const;
+
+  // Per-node copies of keySwitching[i], for i < numaReplicas.size()
+  std::vector<NumaReplicated<KeySwitch>> numaReplicas;
+
+  // The lookups behind getKeySWmatrix and getAnyKeySWmatrix, which do not
+  // notify the recorder
+  const KeySwitch& findKeySWmatrix(const SKHandle& from, long toID) const;
+  const KeySwitch& findAnyKeySWmatrix(const SKHandle& from) const;
+  const KeySwitch& recorded(const KeySwitch& matrix) const;
+
+  // The binary format of writeTo, with the given key-switching matrices
+  void writeWithMatrices(std::ostream& str,
+                         const std::vector<KeySwitch>& matrices) const;
+
+  // The binary format of readFrom. With a store, the b_i's of the matrices
+  // are left in the file, to be read in by the store.
+  static PubKey readWithMatrices(std::istream& str,
+                                 const Context& context,
+                                 const std::shared_ptr<LazyKeyStore>& store);
+
+  // The body of readMapped, for a file or a shared-memory object
+  static PubKey readMappedFrom(const std::shared_ptr<const MappedFile>& file,
+                               const Context& context);
+
 public:
   /**
    * @brief Class label to be added to JSON serialization as object type
@@ -129,6 +218,46 @@ public:
 
   ///@}
 
+  /**
+   * @brief Keep the pseudorandom a_i's of all the current key-switching
+   * matrices in memory, trading memory (about double the size of the
+   * matrices) for the time to regenerate them on every key switch.
+   *
+   * Matrices added later are not affected. The serialized form of the key
+   * still only holds the seeds.
+   **/
+  void materializeKeySwitchA();
+
+  //! @brief Drop the expanded a_i's of all the key-switching matrices
+  void releaseKeySwitchA();
+
+  /**
+   * @brief Move the b_i's of all the current key-switching matrices into
+   * huge pages, where key switching takes far fewer TLB misses (see
+   * `KeySwitch::moveToHugePages` and `HugePagePolicy`).
+   *
+   * Where the system has no huge pages the rows are still made contiguous,
+   * in regular pages. Matrices added later are not affected; call it before
+   * replicateOnNumaNodes, whose copies then share the rows.
+   * @return The bytes of rows that ended up in huge pages.
+   **/
+  long moveKeySwitchToHugePages();
+
+  /**
+   * @brief Keep a copy of each current key-switching matrix on every NUMA
+   * node, and hand out the copy of the node of the calling thread.
+   *
+   * A matrix is copied to a node the first time it is used there (see
+   * `NumaReplicated`). Matrices added later are not replicated, so call it
+   * once the key is complete, and after materializeKeySwitchA if used. The
+   * rows of keys read with readMapped or readLazy are shared, not copied.
+   * Does nothing on a single node machine.
+   **/
+  void replicateOnNumaNodes();
+
+  //! @brief Drop the NUMA copies of the key-switching matrices
+  void releaseNumaReplicas() { numaReplicas.clear(); }
+
   //! @brief Is it possible to re-linearize the automorphism X -> X^k
   //! See Section 3.2.2 in the design document (KeySwitchMap)
   bool isReachable(long k, long keyID = 0) const;
@@ -137,6 +266,12 @@ public:
   //! See Section 3.2.2 in the design document (KeySwitchMap)
   void setKeySwitchMap(long keyId = 0); // Computes the keySwitchMap pointers
 
+  //! @brief The powers of X of the matrices that re-linearize X -> X^k,
+  //! in the order smartAutomorph applies them. Computed from the
+  //! keySwitchMap the first time (k, keyID) is asked for, then cached.
+  //! Throws a LogicError if k is not reachable
+  const std::vector<long>& getAutomorphChain(long k, long keyID = 0) const;
+
   //! @brief get KS strategy for dimension dim
   //! dim == -1 is Frobenius
   long getKSStrategy(long dim) const;
@@ -222,6 +357,67 @@ public:
   virtual void Encrypt(Ctxt& ctxt, const EncodedPtxt_BGV& eptxt) const;
   virtual void Encrypt(Ctxt& ctxt, const EncodedPtxt_CKKS& eptxt) const;
 
+  /**
+   * @brief Encrypt directly at a reduced level.
+   * @param ctxt Ciphertext into which to encrypt.
+   * @param eptxt Plaintext to encrypt.
+   * @param targetCapacity The capacity, in bits, the ciphertext should have.
+   *
+   * The randomness is sampled and transformed only modulo the smallest set
+   * of ctxt primes that leaves targetCapacity bits of capacity to the
+   * result, according to the noise bound of a fresh encryption, which does
+   * not depend on the primes. This is like encrypting over all the ctxt
+   * primes and calling `Ctxt::dropToCapacity(targetCapacity)`, without the
+   * work on the dropped primes and without the noise of the mod-switch. If
+   * there is not enough capacity for targetCapacity, all the ctxt primes are
+   * used.
+   * @note This is always a public-key encryption, also when called on a
+   * `SecKey`. It does not take precomputed encryptions of zero unless all
+   * the primes are used.
+   **/
+  void Encrypt(Ctxt& ctxt, const EncodedPtxt& eptxt, long targetCapacity) const;
+
+  /**
+   * @brief Make `n` random encryptions of zero ahead of time, for the
+   * encryptions of `EncodedPtxt`s to take.
+   *
+   * An encryption that finds one left only adds the plaintext to it, instead
+   * of sampling `r`, `e0` and `e1` and multiplying `r` by the public key.
+   * Each one is used once. The encryptions of zero are made in parallel,
+   * outside of the lock of the pool, so it can be called from a background
+   * thread while other threads encrypt.
+   * @note Only the BGV encryptions to the plaintext space of the key take
+   * them, and encryption with a `SecKey` does not use them. The pool is not
+   * copied with the key nor serialized.
+   **/
+  void precomputeZeroEncryptions(long n) const;
+
+  //! @brief The number of precomputed encryptions of zero not yet used
+  long precomputedZeroEncryptions() const;
+
+  //! @brief Drop the precomputed encryptions of zero
+  void clearZeroEncryptions() const;
+
+  /**
+   * @brief Encrypt many arrays in parallel.
+   * @param ctxts Ciphertexts into which to encrypt, resized to the number of
+   * arrays if needed.
+   * @param ptxts Arrays to encrypt.
+   * @param writer If given, called on the calling thread with `(i,
+   * ctxts[i])` for every `i` in order, as soon as the chunk of
+   * `AvailableThreads()` encryptions that `i` is in is done.
+   * @note Each thread encodes into one `EncodedPtxt` that it reuses, and
+   * ciphertexts already in `ctxts` keep their storage. Every encryption
+   * draws from a PRG stream of its own, seeded in order from the current
+   * stream, so the result does not depend on the number of threads. Uses
+   * the encryptions of `SecKey` when called on one, and the precomputed
+   * encryptions of zero.
+   **/
+  void EncryptBatch(
+      std::vector<Ctxt>& ctxts,
+      const std::vector<PtxtArray>& ptxts,
+      const std::function<void(long, const Ctxt&)>& writer = nullptr) const;
+
   //============================================================
 
   bool isCKKS() const;
@@ -231,8 +427,18 @@ public:
   void reCrypt(Ctxt& ctxt) const;     // bootstrap a ciphertext to reduce noise
   void thinReCrypt(Ctxt& ctxt) const; // bootstrap a "thin" ciphertext, where
   // slots are assumed to contain constants
+  // For CKKS, both bootstrap the whole ciphertext in the same way
+
+  // Bootstrap all of the ciphertexts. Each stage of the recryption is run
+  // over the whole vector before the next one starts, so the linear maps
+  // use the batch matrix multiplication and digit extraction runs on the
+  // ciphertexts in parallel. CKKS ciphertexts are bootstrapped one by one,
+  // in parallel when there are at least as many of them as threads.
+  void reCrypt(std::vector<Ctxt>& ctxts) const;
+  void thinReCrypt(std::vector<Ctxt>& ctxts) const;
 
   friend class SecKey;
+  friend class Encryptor;
   friend std::ostream& operator<<(std::ostream& str, const PubKey& pk);
   friend std::istream& operator>>(std::istream& str, PubKey& pk);
 
@@ -242,6 +448,16 @@ public:
    **/
   void writeTo(std::ostream& str) const;
 
+  /**
+   * @brief A 64-bit hash (FNV-1a) of the output of `writeTo`.
+   * @return The fingerprint of the `PubKey`.
+   * @note The output is hashed as it is written, with no copy of it in
+   * memory. Keys read with readMapped, readShared or readLazy have the
+   * fingerprint of the key that was written, so it can be recorded with the
+   * file and checked after loading it again.
+   **/
+  unsigned long fingerprint() const;
+
   /**
    * @brief Read from the stream the serialized `PubKey` object in binary
    * format.
@@ -250,6 +466,126 @@ public:
    **/
   static PubKey readFrom(std::istream& str, const Context& context);
 
+  /**
+   * @brief Write out the `PubKey` object in a chunked binary format: an
+   * index of (size, CRC-32) pairs, then the key without its key-switching
+   * matrices and then each matrix, as a chunk of its own.
+   * @param str Output `std::ostream`.
+   *
+   * The chunks are encoded in parallel (with NTL's thread pool) and each is
+   * written with a single large write. The format is read by
+   * readChunkedFrom, not by readFrom.
+   **/
+  void writeChunkedTo(std::ostream& str) const;
+
+  /**
+   * @brief Read from the stream a `PubKey` object written by writeChunkedTo.
+   * @param str Input `std::istream`.
+   * @param context The `Context` to be used.
+   * @return The deserialized `PubKey` object.
+   *
+   * The chunks are read in one after the other, then checked against their
+   * CRCs and decoded in parallel. Throws `IOError` if a chunk is corrupt.
+   **/
+  static PubKey readChunkedFrom(std::istream& str, const Context& context);
+
+  /**
+   * @brief Write out the `PubKey` object in the chunked format of
+   * writeChunkedTo, for storage at rest: each key-switching matrix is
+   * written with KeySwitch::writePackedTo, its residues modulo each prime p
+   * in NumBits(p - 1) bits rather than 64.
+   * @param str Output `std::ostream`.
+   *
+   * Every residue saves 64 - NumBits(p - 1) bits, the most with small
+   * primes. The residues are uniform modulo their primes, so a
+   * general-purpose compressor gains next to nothing over the packing.
+   **/
+  void writePackedTo(std::ostream& str) const;
+
+  /**
+   * @brief Read from the stream a `PubKey` object written by writePackedTo.
+   * @param str Input `std::istream`.
+   * @param context The `Context` to be used.
+   * @return The deserialized `PubKey` object.
+   *
+   * The matrices are checked against their CRCs and unpacked in parallel,
+   * each straight into the rows of its `DoubleCRT`s. Throws `IOError` if a
+   * chunk is corrupt.
+   **/
+  static PubKey readPackedFrom(std::istream& str, const Context& context);
+
+  /**
+   * @brief Write out the `PubKey` object in a binary layout whose
+   * key-switching matrices can be memory-mapped and used in place, see
+   * readMapped.
+   * @param str Output `std::ostream`.
+   **/
+  void writeMappableTo(std::ostream& str) const;
+
+  /**
+   * @brief Map a file written by writeMappableTo read-only into memory, and
+   * build a `PubKey` whose key-switching matrices use the b_i's in place.
+   * @param path The file to map.
+   * @param context The `Context` to be used.
+   * @return The `PubKey` object, which keeps the file mapped for as long as
+   * it (or a copy of its matrices) lives.
+   *
+   * The pages of the file are shared by all the processes that map it, and
+   * are only read in when used. The file must come from a trusted source, as
+   * its residues are not validated.
+   **/
+  static PubKey readMapped(const std::string& path, const Context& context);
+
+  /**
+   * @brief Write out the `PubKey` object in the layout of writeMappableTo
+   * into a new named POSIX shared-memory object, see readShared.
+   * @param name The name of the object, of the form "/somename".
+   *
+   * The object lives until removeShared is called (or the host reboots),
+   * and throws `IOError` if the name is already in use. The key is written
+   * straight into the object, which readShared only accepts once it is
+   * complete.
+   **/
+  void writeShared(const std::string& name) const;
+
+  /**
+   * @brief Attach read-only to a shared-memory object written by
+   * writeShared, and build a `PubKey` whose key-switching matrices use the
+   * b_i's in place, as readMapped does for a file.
+   * @param name The name of the object.
+   * @param context The `Context` to be used.
+   * @return The `PubKey` object, which keeps the object mapped for as long
+   * as it (or a copy of its matrices) lives.
+   *
+   * All the processes of a host that attach to the same object share a
+   * single copy of the matrices. Throws `IOError` if the object is still
+   * being written.
+   **/
+  static PubKey readShared(const std::string& name, const Context& context);
+
+  /**
+   * @brief Remove the name of a shared-memory object written by writeShared.
+   * Keys that are attached to it remain valid.
+   * @param name The name of the object.
+   **/
+  static void removeShared(const std::string& name);
+
+  /**
+   * @brief Read a file written by writeTo, leaving the b_i's of the
+   * key-switching matrices in the file until they are first used.
+   * @param path The file to read.
+   * @param context The `Context` to be used.
+   * @param maxResident If positive, at most this many matrices are kept in
+   * memory, evicting the least recently used one.
+   * @return The `PubKey` object, which keeps the file open for as long as it
+   * (or a copy of its matrices) lives.
+   *
+   * The file must not change while the key is in use.
+   **/
+  static PubKey readLazy(const std::string& path,
+                         const Context& context,
+                         long maxResident = 0);
+
   /**
    * @brief Write out the public key (`PubKey`) object to the output
    * stream using JSON format.
@@ -295,6 +631,25 @@ public:
    **/
   void readJSON(const JsonWrapper& j);
 
+  /**
+   * @brief Write out the public key (`PubKey`) object as a JSON header whose
+   * content is the binary format of writeTo, base64-encoded.
+   * @param str Output `std::ostream`.
+   *
+   * The binary body is encoded as it is written, without building a JSON
+   * document of the residues.
+   **/
+  void writeToHybridJSON(std::ostream& str) const;
+
+  /**
+   * @brief Read from the stream a public key (`PubKey`) object written by
+   * writeToHybridJSON.
+   * @param str Input `std::istream`.
+   * @param context The `Context` to be used.
+   * @return The deserialized `PubKey` object.
+   **/
+  static PubKey readFromHybridJSON(std::istream& str, const Context& context);
+
   // defines plaintext space for the bootstrapping encrypted secret key
   static long ePlusR(long p);
 
@@ -303,6 +658,46 @@ public:
   void hackPtxtSpace(long p2r) { pubEncrKey.ptxtSpace = p2r; }
 };
 
+/**
+ * @class KeySwitchRecorder
+ * @brief Records the automorphism matrices s(X^k) -> s(X) that a `PubKey`
+ * hands out for key switching, while the recorder is alive.
+ *
+ * Run a representative computation with a generous key (possibly with
+ * setDryRun(), to go through it quickly), then use addRecordedMatrices to
+ * give another key exactly the matrices that it used. The set is what was
+ * needed with the key-switching strategies of the recorded key, which
+ * addRecordedMatrices copies as well.
+ *
+ * Only one recorder at a time may be attached to a key, and only while no
+ * other thread is using the key. Recording itself is thread-safe.
+ **/
+class KeySwitchRecorder
+{
+public:
+  explicit KeySwitchRecorder(const PubKey& pubKey, long keyID = 0);
+  ~KeySwitchRecorder();
+
+  KeySwitchRecorder(const KeySwitchRecorder&) = delete;
+  KeySwitchRecorder& operator=(const KeySwitchRecorder&) = delete;
+
+  //! @brief The k's of the matrices s_keyID(X^k) -> s_keyID(X) used so far
+  std::set<long> automorphisms() const;
+
+  //! @brief The recorded key
+  const PubKey& getPubKey() const { return pubKey; }
+  long getKeyID() const { return keyID; }
+
+  //! Called by the key for every matrix that it hands out
+  void record(const KeySwitch& matrix);
+
+private:
+  const PubKey& pubKey;
+  const long keyID;
+  mutable std::mutex mutex; // guards vals
+  std::set<long> vals;
+};
+
 /**
  * @class SecKey
  * @brief The secret key
@@ -311,9 +706,25 @@ class SecKey : public PubKey
 { // The secret key
 private:
   friend class KeySwitch;
+  friend class SchemeSwitch;
   std::vector<DoubleCRT> sKeys; // The secret key(s) themselves
   explicit SecKey(const PubKey& pk);
 
+  double seededRLWE(Ctxt& ctxt, const DoubleCRT& sKey, long p) const;
+
+  // The body of GenKeySWmatrix, drawing all its randomness from prg
+  KeySwitch makeKeySWmatrix(long fromSPower,
+                            long fromXPower,
+                            long fromIdx,
+                            long toIdx,
+                            long p,
+                            PRG& prg) const;
+
+  // key = s^r(X^t) for the given handle, over the primes in s
+  void decryptionKey(DoubleCRT& key,
+                     const SKHandle& handle,
+                     const IndexSet& s) const;
+
 public:
   /**
    * @brief Class label to be added to JSON serialization as object type
@@ -363,6 +774,16 @@ public:
                       long toKeyIdx = 0,
                       long ptxtSpace = 0);
 
+  //! Generate the matrices s_fromKeyIdx(X^e) -> s_toKeyIdx(X) for all the e's
+  //! in fromXPowers that are not there yet, in parallel. Each matrix is
+  //! generated from a PRG stream of its own, seeded in order from the current
+  //! stream, so the result does not depend on the number of threads. The
+  //! matrices are added in the order of fromXPowers.
+  void GenKeySWmatrices(const std::vector<long>& fromXPowers,
+                        long fromKeyIdx = 0,
+                        long toKeyIdx = 0,
+                        long ptxtSpace = 0);
+
   // Decryption
   void Decrypt(NTL::ZZX& plaintxt, const Ctxt& ciphertxt) const;
 
@@ -384,6 +805,24 @@ public:
   //! before reduction modulo the ptxtSpace
   void Decrypt(NTL::ZZX& plaintxt, const Ctxt& ciphertxt, NTL::ZZX& f) const;
 
+  //! @brief The raw plaintext sum_i parts[i] * key_i, still in DoubleCRT
+  //! form over the primes of ciphertxt, before any lift to coefficients
+  void decryptToDoubleCRT(DoubleCRT& ptxt, const Ctxt& ciphertxt) const;
+
+  /**
+   * @brief Decrypt many ciphertexts in parallel.
+   * @param ptxts Plaintexts into which to decrypt, resized to the number of
+   * ciphertexts if needed.
+   * @param ctxts Ciphertexts to decrypt.
+   * @note The powers of the secret key are computed once for the whole
+   * batch. For BGV with m a power of two, the decrypted polynomials are
+   * reduced modulo the plaintext space one prime at a time, as
+   * single-precision integers, and never reconstructed modulo the product
+   * of the primes. Otherwise this is the same as decrypting one by one.
+   **/
+  void DecryptBatch(std::vector<PtxtArray>& ptxts,
+                    const std::vector<Ctxt>& ctxts) const;
+
   //! @brief Symmetric encryption using the secret key.
   long skEncrypt(Ctxt& ctxt,
                  const NTL::ZZX& ptxt,
@@ -434,6 +873,21 @@ public:
    **/
   static SecKey readFrom(std::istream& str, const Context& context);
 
+  /**
+   * @brief Write out the `SecKey` object with its public part in the
+   * chunked format of PubKey::writeChunkedTo.
+   * @param str Output `std::ostream`.
+   **/
+  void writeChunkedTo(std::ostream& str) const;
+
+  /**
+   * @brief Read from the stream a `SecKey` object written by writeChunkedTo.
+   * @param str Input `std::istream`.
+   * @param context The `Context` to be used.
+   * @return The deserialized `SecKey` object.
+   **/
+  static SecKey readChunkedFrom(std::istream& str, const Context& context);
+
   /**
    * @brief Write out the secret key (`SecKey`) object to the output
    * stream using JSON format.
@@ -493,8 +947,13 @@ double RLWE(DoubleCRT& c0,
             long p,
             NTL::ZZ* prgSeed = nullptr);
 
-//! Same as RLWE, but assumes that c1 is already chosen by the caller
-double RLWE1(DoubleCRT& c0, const DoubleCRT& c1, const DoubleCRT& s, long p);
+//! Same as RLWE, but assumes that c1 is already chosen by the caller, and
+//! draws the error from prg
+double RLWE1(DoubleCRT& c0,
+             const DoubleCRT& c1,
+             const DoubleCRT& s,
+             long p,
+             PRG& prg = PRG::current());
 
 } // namespace helib
 
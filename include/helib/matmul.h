@@ -137,6 +137,9 @@ typedef MatMul1D_derived<PA_cx> MatMul1D_CKKS;
 // more convenient user interfaces
 // VJS-FIXME: document some of this stuff
 
+// A real matrix acts on the real and imaginary parts of the slots on their
+// own, so MatMul_CKKS also applies to both vectors of a pair (see
+// EncryptedArrayCx::encryptPair) at once.
 class MatMul_CKKS : public MatMul1D_CKKS
 {
 public:
@@ -255,12 +258,41 @@ struct ConstMultiplier;
 // The former occupies less space, but the latter makes for
 // much faster multiplication.
 
+struct ConstMultiplierLRU;
+// Defined in matmul.cpp.
+// A byte budget for DoubleCRT copies of zzX constants, made at the prime
+// set of the ciphertexts they multiply and evicted least recently used
+// first. It can be shared by several caches.
+
+// Counters of a ConstMultiplierLRU
+struct ConstMultiplierCacheStats
+{
+  long hits = 0;      // multiplications by a DoubleCRT copy
+  long misses = 0;    // multiplications that had to convert the zzX
+  long evictions = 0; // copies dropped to stay within the budget
+  long bytes = 0;     // bytes currently held in DoubleCRT copies
+  long budget = 0;
+};
+
 struct ConstMultiplierCache
 {
   std::vector<std::shared_ptr<ConstMultiplier>> multiplier;
 
   // Upgrade zzX constants to DoubleCRT constants.
   void upgrade(const Context& context);
+
+  // Same, with the DoubleCRT constants over the primes in s only. The
+  // constants already upgraded are cut down to the primes in s.
+  void upgrade(const Context& context, const IndexSet& s);
+
+  // Keep DoubleCRT copies of the zzX constants in lru, or none if lru is
+  // null. Must not be called while the constants are in use.
+  void setLRU(const std::shared_ptr<ConstMultiplierLRU>& lru);
+
+  // Binary IO of the constants, in whichever form (zzX or DoubleCRT) they
+  // are currently held.
+  void writeTo(std::ostream& str) const;
+  void read(std::istream& str, const Context& context);
 };
 
 //====================================
@@ -277,12 +309,51 @@ public:
   // Upgrade zzX constants to DoubleCRT constants.
   virtual void upgrade() = 0;
 
+  // Same, keeping the constants over the primes in s only, for an object
+  // that is only used on ciphertexts whose primes are in s (together with
+  // the special primes, which the baby steps carry: s should include them).
+  // A ciphertext with primes outside of s is still multiplied correctly,
+  // but every constant is then encoded again at its primes.
+  virtual void upgrade(const IndexSet& s) = 0;
+
   // If ctxt encrypts a row std::vector v, then this replaces ctxt
   // by an encryption of the row std::vector v*mat, where mat is
   // a matrix provided to the constructor of one of the
   // concrete subclasses MatMul1DExec, BlockMatMul1DExec,
   // MatMulFullExec, BlockMatMulFullExec, defined below.
   virtual void mul(Ctxt& ctxt) const = 0;
+
+  // Same as calling mul on each of the ctxts. The default runs them in
+  // parallel; MatMul1DExec and MatMulFullExec instead go through the
+  // schedule once for the whole batch, so that each constant is encoded for
+  // (and each key-switching matrix is used on) all the ciphertexts in turn.
+  // That takes memory for the baby steps of every ciphertext at once.
+  virtual void mul(std::vector<Ctxt>& ctxts) const;
+
+  // Write out the encoded constants in binary format, together with the
+  // fingerprint of the context and the shape of the EncryptedArray, so they
+  // can be read back (see readFrom and readMapped in the subclasses) instead
+  // of being encoded again. Upgraded constants are written as DoubleCRTs.
+  virtual void writeTo(std::ostream& str) const = 0;
+
+  // A middle ground between the zzX constants and upgrade(): the constants
+  // stay as zzX, and the most recently used ones are also kept as DoubleCRT
+  // at the prime set where they are used, within a budget of bytes (a
+  // budget of 0 keeps none). Constants that were already upgraded are not
+  // affected. Must not be called while the object is in use.
+  void setMemoryBudget(long bytes);
+
+  // The hits, misses and evictions since the last call to setMemoryBudget
+  ConstMultiplierCacheStats getCacheStats() const;
+
+  // The prime sets of the DoubleCRT copies held, most recently used first
+  std::vector<IndexSet> getCachedPrimeSets() const;
+
+protected:
+  virtual void setLRU(const std::shared_ptr<ConstMultiplierLRU>& lru) = 0;
+
+private:
+  std::shared_ptr<ConstMultiplierLRU> lru;
 };
 
 //====================================
@@ -303,9 +374,19 @@ public:
   ConstMultiplierCache cache;
   ConstMultiplierCache cache1; // only for non-native dimension
 
+  // The baby steps (in [0..g)) and giant steps (in [0..ceil(D/g)))
+  // that meet a nonzero diagonal, in increasing order.  If g == 0,
+  // babySteps lists the nonzero diagonals and giantSteps is {0}.
+  // Both are empty for the zero matrix.
+  std::vector<long> babySteps;
+  std::vector<long> giantSteps;
+
   // The constructor encodes all the constants for a given
   // matrix in zzX format.
   // The mat argument defines the entries of the matrix.
+  // All-zero diagonals are skipped by mul, and if few enough diagonals
+  // are nonzero the BSGS strategy is dropped in favour of rotating
+  // directly to each of them.
   // Use the upgrade method (below) to convert to DoubleCRT format.
   // If the minimal flag is set to true, a strategy that relies
   // on a minimal number of key switching matrices will be used;
@@ -313,7 +394,12 @@ public:
   // addMinimal{1D,Frb}Matrices routines declared in helib.h.
   // If the minimal flag is false, it is best to use the
   // addSome{1D,Frb}Matrices routines declared in helib.h.
-  explicit MatMul1DExec(const MatMul1D& mat, bool minimal = false);
+  // The choice of rotating directly costs each rotation by the
+  // key-switching matrices of pubKey, if given, and otherwise by those
+  // addSome1DMatrices generates.
+  explicit MatMul1DExec(const MatMul1D& mat,
+                        bool minimal = false,
+                        const PubKey* pubKey = nullptr);
 
   // VJS-FIXME: it seems that the minimal flag is currently
   // redundant, as the decision is essentially based on
@@ -322,6 +408,7 @@ public:
 
   // Replaces an encryption of row std::vector v by encryption of v*mat
   void mul(Ctxt& ctxt) const override;
+  void mul(std::vector<Ctxt>& ctxts) const override;
 
   // Upgrades encoded constants from zzX to DoubleCRT.
   void upgrade() override
@@ -329,8 +416,39 @@ public:
     cache.upgrade(ea.getContext());
     cache1.upgrade(ea.getContext());
   }
+  void upgrade(const IndexSet& s) override
+  {
+    cache.upgrade(ea.getContext(), s);
+    cache1.upgrade(ea.getContext(), s);
+  }
 
   const EncryptedArray& getEA() const override { return ea; }
+
+  void writeTo(std::ostream& str) const override;
+
+  // Read an object written by writeTo, for the same ea. Throws IOError if
+  // the data was written with a different context or EncryptedArray.
+  static MatMul1DExec readFrom(std::istream& str, const EncryptedArray& ea);
+
+  // Same as readFrom, from a file that is memory-mapped rather than read
+  // through a stream. The file must come from a trusted source.
+  static MatMul1DExec readMapped(const std::string& path,
+                                 const EncryptedArray& ea);
+
+protected:
+  void setLRU(const std::shared_ptr<ConstMultiplierLRU>& lru) override
+  {
+    cache.setLRU(lru);
+    cache1.setLRU(lru);
+  }
+
+private:
+  explicit MatMul1DExec(const EncryptedArray& _ea) : ea(_ea) {}
+  void buildSchedule();
+  void writeBody(std::ostream& str) const;
+  void readBody(std::istream& str);
+
+  friend class MatMulFullExec;
 };
 
 // A more convenient and naturally-named interface for CKKS
@@ -374,6 +492,7 @@ public:
 
   // Replaces an encryption of row std::vector v by encryption of v*mat
   void mul(Ctxt& ctxt) const override;
+  using MatMulExecBase::mul;
 
   // Upgrades encoded constants from zzX to DoubleCRT.
   void upgrade() override
@@ -381,8 +500,35 @@ public:
     cache.upgrade(ea.getContext());
     cache1.upgrade(ea.getContext());
   }
+  void upgrade(const IndexSet& s) override
+  {
+    cache.upgrade(ea.getContext(), s);
+    cache1.upgrade(ea.getContext(), s);
+  }
 
   const EncryptedArray& getEA() const override { return ea; }
+
+  void writeTo(std::ostream& str) const override;
+
+  // See MatMul1DExec::readFrom and MatMul1DExec::readMapped.
+  static BlockMatMul1DExec readFrom(std::istream& str,
+                                    const EncryptedArray& ea);
+  static BlockMatMul1DExec readMapped(const std::string& path,
+                                      const EncryptedArray& ea);
+
+protected:
+  void setLRU(const std::shared_ptr<ConstMultiplierLRU>& lru) override
+  {
+    cache.setLRU(lru);
+    cache1.setLRU(lru);
+  }
+
+private:
+  explicit BlockMatMul1DExec(const EncryptedArray& _ea) : ea(_ea) {}
+  void writeBody(std::ostream& str) const;
+  void readBody(std::istream& str);
+
+  friend class BlockMatMulFullExec;
 };
 
 //====================================
@@ -396,6 +542,16 @@ public:
   bool minimal;
   std::vector<long> dims;
   std::vector<MatMul1DExec> transforms;
+  // If set, and the dimensions but the last one are all good, mul rotates
+  // its input to every transform of the last dimension at once (from a
+  // single digit decomposition, see Ctxt::hoistedAutomorphs) rather than
+  // one dimension after the other. This takes one key switch per transform
+  // instead of one per dimension, given the key-switching matrices of all
+  // the combined rotations (as under the HELIB_KSS_FULL strategy); missing
+  // ones are done in several steps.
+  // Otherwise, with several threads, the rotations of the first dimension
+  // and the transforms below each of them run in parallel.
+  bool flat = false;
 
   // The constructor encodes all the constants for a given
   // matrix in zzX format.
@@ -411,6 +567,7 @@ public:
 
   // Replaces an encryption of row std::vector v by encryption of v*mat
   void mul(Ctxt& ctxt) const override;
+  void mul(std::vector<Ctxt>& ctxts) const override;
 
   // Upgrades encoded constants from zzX to DoubleCRT.
   void upgrade() override
@@ -418,11 +575,39 @@ public:
     for (auto& t : transforms)
       t.upgrade();
   }
+  void upgrade(const IndexSet& s) override
+  {
+    for (auto& t : transforms)
+      t.upgrade(s);
+  }
 
   const EncryptedArray& getEA() const override { return ea; }
 
+  void writeTo(std::ostream& str) const override;
+
+  // See MatMul1DExec::readFrom and MatMul1DExec::readMapped.
+  static MatMulFullExec readFrom(std::istream& str, const EncryptedArray& ea);
+  static MatMulFullExec readMapped(const std::string& path,
+                                   const EncryptedArray& ea);
+
   // This really should be private.
   long rec_mul(Ctxt& acc, const Ctxt& ctxt, long dim, long idx) const;
+  long rec_mul(std::vector<Ctxt>& acc,
+               const std::vector<Ctxt>& ctxts,
+               long dim,
+               long idx) const;
+
+protected:
+  // One budget for all the transforms
+  void setLRU(const std::shared_ptr<ConstMultiplierLRU>& lru) override
+  {
+    for (auto& t : transforms)
+      t.setLRU(lru);
+  }
+
+private:
+  explicit MatMulFullExec(const EncryptedArray& _ea) : ea(_ea) {}
+  void readBody(std::istream& str);
 };
 
 //====================================
@@ -436,6 +621,16 @@ public:
   bool minimal;
   std::vector<long> dims;
   std::vector<BlockMatMul1DExec> transforms;
+  // If set, and the dimensions but the last one are all good, mul rotates
+  // its input to every transform of the last dimension at once (from a
+  // single digit decomposition, see Ctxt::hoistedAutomorphs) rather than
+  // one dimension after the other. This takes one key switch per transform
+  // instead of one per dimension, given the key-switching matrices of all
+  // the combined rotations (as under the HELIB_KSS_FULL strategy); missing
+  // ones are done in several steps.
+  // Otherwise, with several threads, the rotations of the first dimension
+  // and the transforms below each of them run in parallel.
+  bool flat = false;
 
   // The constructor encodes all the constants for a given
   // matrix in zzX format.
@@ -452,6 +647,7 @@ public:
 
   // Replaces an encryption of row std::vector v by encryption of v*mat
   void mul(Ctxt& ctxt) const override;
+  using MatMulExecBase::mul;
 
   // Upgrades encoded constants from zzX to DoubleCRT.
   void upgrade() override
@@ -459,11 +655,36 @@ public:
     for (auto& t : transforms)
       t.upgrade();
   }
+  void upgrade(const IndexSet& s) override
+  {
+    for (auto& t : transforms)
+      t.upgrade(s);
+  }
 
   const EncryptedArray& getEA() const override { return ea; }
 
+  void writeTo(std::ostream& str) const override;
+
+  // See MatMul1DExec::readFrom and MatMul1DExec::readMapped.
+  static BlockMatMulFullExec readFrom(std::istream& str,
+                                      const EncryptedArray& ea);
+  static BlockMatMulFullExec readMapped(const std::string& path,
+                                        const EncryptedArray& ea);
+
   // This really should be private.
   long rec_mul(Ctxt& acc, const Ctxt& ctxt, long dim, long idx) const;
+
+protected:
+  // One budget for all the transforms
+  void setLRU(const std::shared_ptr<ConstMultiplierLRU>& lru) override
+  {
+    for (auto& t : transforms)
+      t.setLRU(lru);
+  }
+
+private:
+  explicit BlockMatMulFullExec(const EncryptedArray& _ea) : ea(_ea) {}
+  void readBody(std::istream& str);
 };
 
 //===================================
@@ -0,0 +1,152 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_MEMORYREPORT_H
+#define HELIB_MEMORYREPORT_H
+/**
+ * @file memoryReport.h
+ * @brief Accounting of the memory held by `DoubleCRT` objects, by owner.
+ *
+ * Each `DoubleCRT` is charged to a `MemoryCategory`, which it takes when it
+ * is made: the category of the outermost `MemoryScope` of the thread
+ * making it, so that for instance the linear maps built while setting up
+ * bootstrapping count as bootstrapping data and not as a matrix cache.
+ * Without a scope a copy keeps the category of the original, ciphertext
+ * parts are charged to `CIPHERTEXTS` and anything else to `OTHER`. The
+ * category of a parallel loop is carried over to the threads that run it,
+ * and an assignment keeps the category of the target.
+ *
+ * The bytes counted are those of the rows (`phi(m)` words per prime), which
+ * is all but a few bytes of a `DoubleCRT`. See `Context::memoryReport`.
+ **/
+
+#include <array>
+#include <atomic>
+#include <iostream>
+
+namespace helib {
+
+//! @brief The owners that memory is charged to.
+enum class MemoryCategory : int
+{
+  OTHER = 0,
+  KEYS,          //!< Secret keys, public keys and key-switching matrices
+  MATMUL_CACHE,  //!< Constants cached by `MatMulExec` objects
+  BOOTSTRAPPING, //!< `RecryptData` and `ThinRecryptData`
+  CIPHERTEXTS,   //!< The parts of `Ctxt` objects
+  SCRATCH,       //!< Temporaries, and the rows idle in a `ScratchPool`
+  COUNT          //!< The number of categories, not a category
+};
+
+//! @brief The name of a category, such as `"keys"`.
+const char* memoryCategoryName(MemoryCategory category);
+
+//! @brief The memory charged to one category.
+struct MemoryUsage
+{
+  long bytes = 0;   // the size of the rows
+  long rows = 0;    // the number of rows
+  long objects = 0; // the number of DoubleCRT objects
+
+  MemoryUsage& operator+=(const MemoryUsage& other);
+};
+
+/**
+ * @class MemoryReport
+ * @brief A snapshot of the memory charged to each category.
+ **/
+struct MemoryReport
+{
+  std::array<MemoryUsage, int(MemoryCategory::COUNT)> usage;
+
+  const MemoryUsage& operator[](MemoryCategory category) const
+  {
+    return usage[int(category)];
+  }
+  MemoryUsage& operator[](MemoryCategory category)
+  {
+    return usage[int(category)];
+  }
+
+  //! @brief The sum over all categories.
+  MemoryUsage total() const;
+};
+
+//! @brief Print one line per category.
+std::ostream& operator<<(std::ostream& str, const MemoryReport& report);
+
+/**
+ * @class MemoryScope
+ * @brief Charge the `DoubleCRT` objects made by the calling thread to
+ * `category` while the scope lives.
+ *
+ * Scopes nest, and the outermost one wins, unless `force` is set (which is
+ * meant for carrying the category of a task over to the thread running it).
+ **/
+class MemoryScope
+{
+public:
+  explicit MemoryScope(MemoryCategory category, bool force = false);
+  ~MemoryScope();
+
+  MemoryScope(const MemoryScope&) = delete;
+  MemoryScope& operator=(const MemoryScope&) = delete;
+
+  //! @brief The category of the calling thread, `OTHER` outside of scopes.
+  static MemoryCategory current();
+
+private:
+  MemoryCategory saved;
+};
+
+/**
+ * @class MemoryAccounts
+ * @brief The counters behind `Context::memoryReport`.
+ *
+ * Updated by `DoubleCRT` objects as they gain and lose rows; safe to use
+ * from several threads.
+ **/
+class MemoryAccounts
+{
+public:
+  MemoryAccounts() = default;
+  MemoryAccounts(const MemoryAccounts&) = delete;
+  MemoryAccounts& operator=(const MemoryAccounts&) = delete;
+
+  void add(MemoryCategory category, long bytes, long rows, long objects)
+  {
+    Counters& c = counters[int(category)];
+    if (bytes != 0)
+      c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (rows != 0)
+      c.rows.fetch_add(rows, std::memory_order_relaxed);
+    if (objects != 0)
+      c.objects.fetch_add(objects, std::memory_order_relaxed);
+  }
+
+  //! @brief The current counts, without the rows idle in the scratch pools.
+  MemoryReport report() const;
+
+private:
+  // One cache line per category, so that threads busy with different
+  // categories do not contend
+  struct alignas(64) Counters
+  {
+    std::atomic<long> bytes{0};
+    std::atomic<long> rows{0};
+    std::atomic<long> objects{0};
+  };
+  std::array<Counters, int(MemoryCategory::COUNT)> counters;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_MEMORYREPORT_H
@@ -0,0 +1,54 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_METRICS_H
+#define HELIB_METRICS_H
+/**
+ * @file metrics.h
+ * @brief Exporting the timers, operation counts and stats records.
+ *
+ * Three sources are exported:
+ * - the timers (see timing.h), as histograms of the call durations in
+ *   seconds, with the hardware events they counted (see perfCounters.h);
+ * - the operation counts of `fhe_ops` (see fhe_stats.h), as counters,
+ *   also broken down by the number of primes;
+ * - the stats records, as histograms of the recorded values, together with
+ *   their maxima.
+ *
+ * To go through them programmatically use `forEachTimer`,
+ * `snapshot_op_counts` and `forEachStatsRecord` instead.
+ **/
+
+#include <iostream>
+
+namespace helib {
+
+/**
+ * @brief Write all the metrics in the Prometheus text exposition format.
+ * @param str The stream to write to.
+ * @note Timers and stats records that were never used are skipped. The
+ * metric names are prefixed with `helib_`.
+ **/
+void writeMetricsPrometheus(std::ostream& str);
+
+/**
+ * @brief Write all the metrics as a JSON object, with the members
+ * `"timers"`, `"ops"` and `"stats"`.
+ * @param str The stream to write to.
+ * @note The histograms only list their non-empty buckets, each as an
+ * upper bound `"le"` (`null` for infinity) with its `"count"`. A timer that
+ * counted hardware events has a `"perf"` object of the totals, by event.
+ **/
+void writeMetricsJSON(std::ostream& str);
+
+} // namespace helib
+
+#endif // HELIB_METRICS_H
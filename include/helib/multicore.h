@@ -17,10 +17,21 @@
 #ifndef HELIB_MULTICORE_H
 #define HELIB_MULTICORE_H
 
+#include <atomic>
+#include <functional>
+
+#include <NTL/BasicThreadPool.h>
+
 #ifdef HELIB_THREADS
 
-#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
+
+#include <helib/memoryReport.h>
 
 namespace helib {
 
@@ -30,8 +41,156 @@ namespace helib {
 #define HELIB_MUTEX_TYPE std::mutex
 #define HELIB_MUTEX_GUARD(mx) std::lock_guard<std::mutex> _lock##__LINE__(mx)
 
+/**
+ * @class TaskScheduler
+ * @brief A work-stealing pool of threads supporting nested fork/join.
+ *
+ * Unlike `NTL::BasicThreadPool`, where a parallel loop nested inside another
+ * one runs serially, tasks may be forked from within running tasks. Each
+ * thread keeps a deque of tasks, running its own from the back and stealing
+ * from the front of the others'. A thread waiting for its tasks to finish
+ * runs other tasks meanwhile, so nesting cannot deadlock.
+ *
+ * Use `SetTaskThreads` to install a scheduler; the `HELIB_EXEC_RANGE` and
+ * `HELIB_EXEC_INDEX` loops then run on it, and fall back to the NTL thread
+ * pool otherwise.
+ *
+ * With NUMA pinning, the workers are split in contiguous blocks over the
+ * NUMA nodes (see numa.h) and pinned to them, and a thread out of work steals
+ * from the threads of its own node before those of the other nodes, so the
+ * subtasks of a task tend to stay on its node.
+ **/
+class TaskScheduler
+{
+public:
+  /**
+   * @brief Constructor.
+   * @param nThreads The number of threads, the calling one included.
+   * @param numaPinned Whether to pin the workers to NUMA nodes.
+   **/
+  explicit TaskScheduler(long nThreads, bool numaPinned = false);
+
+  ~TaskScheduler();
+
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+  //! The number of threads, the calling one included.
+  long NumThreads() const { return queues.size(); }
+
+  //! The NUMA node of worker `i`, where worker 0 is the calling thread. All
+  //! are 0 without NUMA pinning.
+  long NumaNodeOf(long i) const { return nodeOf.at(i); }
+
+  /**
+   * @brief Run `fn(0), ..., fn(n-1)` as tasks, and wait for all of them.
+   * @param n The number of tasks.
+   * @param fn The function to run.
+   * @note May be called from within a task. If some of the tasks throw, the
+   * first exception is rethrown once all the tasks are done.
+   **/
+  void exec(long n, const std::function<void(long)>& fn);
+
+  /**
+   * @brief Queue a task to be run by the pool, without waiting for it.
+   * @param job The task. It must not throw.
+   * @note See `helib::async` for tasks with a result.
+   **/
+  void submit(std::function<void()> job);
+
+  /**
+   * @brief Run one queued task on the calling thread, if there is any.
+   * @return Whether a task was run.
+   * @note Lets a thread that waits for a result help in the meantime.
+   **/
+  bool runPending() { return runOne(self()); }
+
+private:
+  struct Group;
+  struct Task
+  {
+    const std::function<void(long)>* fn;
+    long index;
+    Group* group;
+    // Set instead of fn for the tasks queued by submit
+    std::shared_ptr<std::function<void()>> job;
+    // The trace span that forked the task, see timing.h
+    long traceParent;
+    // The memory category of the thread that forked the task
+    MemoryCategory memoryCategory;
+  };
+  struct Queue
+  {
+    std::mutex mtx;
+    std::deque<Task> tasks;
+  };
+
+  // Queue 0 is shared by the threads outside of the pool, queue i > 0
+  // belongs to the i'th worker.
+  std::vector<std::unique_ptr<Queue>> queues;
+  // The node of each thread, and the queues each one looks in for tasks,
+  // its own first and those of its node next
+  std::vector<long> nodeOf;
+  std::vector<std::vector<long>> stealOrder;
+  bool numaPinned;
+  std::vector<std::thread> workers;
+  std::atomic_long queued{0};
+  std::atomic_bool done{false};
+  std::mutex sleepMtx;
+  std::condition_variable wake;
+
+  long self() const;
+  bool runOne(long self);
+  void run(const Task& task);
+  void workerLoop(long self);
+};
+
+/**
+ * @brief Install a `TaskScheduler` with `n` threads for the
+ * `HELIB_EXEC_RANGE` and `HELIB_EXEC_INDEX` loops.
+ * @param n The number of threads. With `n <= 1` the scheduler is removed and
+ * the loops use the NTL thread pool again.
+ * @param numaPinned Whether to pin the workers to NUMA nodes.
+ * @note Must not be called while a loop is running.
+ **/
+void SetTaskThreads(long n, bool numaPinned = false);
+
+//! The installed scheduler, or `nullptr` if none.
+TaskScheduler* GetTaskScheduler();
+
+/**
+ * @brief The number of threads available to a parallel loop.
+ * @return The number of threads of the installed `TaskScheduler`, or else
+ * `NTL::AvailableThreads()`.
+ * @note With a scheduler installed this is also the case inside a running
+ * loop, as nested loops run in parallel as well.
+ **/
+long AvailableThreads();
+
+//! Run `fn(first, last)` over a partition of `[0, n)`, see `HELIB_EXEC_RANGE`.
+void execRange(long n, const std::function<void(long, long)>& fn);
+
+//! Run `fn(0), ..., fn(cnt-1)` in parallel, see `HELIB_EXEC_INDEX`.
+void execIndex(long cnt, const std::function<void(long)>& fn);
+
 } // namespace helib
 
+// Drop-in replacements for NTL_EXEC_RANGE and NTL_EXEC_INDEX, that run on
+// the installed TaskScheduler (if any) and so may be nested.
+#define HELIB_EXEC_RANGE(n, first, last)                                       \
+  {                                                                            \
+    ::helib::execRange((n), [&](long first, long last) {
+#define HELIB_EXEC_RANGE_END                                                   \
+  });                                                                          \
+  }
+
+#define HELIB_EXEC_INDEX(cnt, index)                                           \
+  {                                                                            \
+    ::helib::execIndex((cnt), [&](long index) {
+#define HELIB_EXEC_INDEX_END                                                   \
+  });                                                                          \
+  }
+
 #else
 
 namespace helib {
@@ -42,8 +201,107 @@ namespace helib {
 #define HELIB_MUTEX_TYPE int
 #define HELIB_MUTEX_GUARD(mx) ((void)mx)
 
+inline long AvailableThreads() { return NTL::AvailableThreads(); }
+
 } // namespace helib
 
+#define HELIB_EXEC_RANGE(n, first, last) NTL_EXEC_RANGE(n, first, last)
+#define HELIB_EXEC_RANGE_END NTL_EXEC_RANGE_END
+#define HELIB_EXEC_INDEX(cnt, index) NTL_EXEC_INDEX(cnt, index)
+#define HELIB_EXEC_INDEX_END NTL_EXEC_INDEX_END
+
 #endif // ifdef HELIB_THREADS
 
+namespace helib {
+
+//! How the `HELIB_ADAPTIVE_EXEC_RANGE` loops choose between running on the
+//! calling thread and being split over the threads.
+enum class ParallelGrainMode
+{
+  //! Split every loop, as `HELIB_EXEC_RANGE` does
+  ALWAYS,
+  //! Split a loop when that saves more time than waking the threads takes
+  ADAPTIVE,
+  //! Split a loop only when that saves several times the wake-up, so that
+  //! small operations never wait for the threads
+  LOW_LATENCY
+};
+
+//! @brief Set the mode of all the adaptive loops. The default is ADAPTIVE.
+void setParallelGrainMode(ParallelGrainMode mode);
+ParallelGrainMode getParallelGrainMode();
+
+//! @brief Set the work (in residues, e.g. phi(m) per prime) from which an
+//! adaptive loop that has not been timed yet is split. The default is 2^15.
+void setParallelGrainWork(long work);
+long getParallelGrainWork();
+
+//! @brief The time, in seconds, of waking AvailableThreads() threads for an
+//! empty loop and waiting for them. Measured on first use, and again when
+//! the number of threads changes.
+double parallelWakeupSeconds();
+
+/**
+ * @class ParallelGrain
+ * @brief What a call site of `HELIB_ADAPTIVE_EXEC_RANGE` learnt of its cost.
+ *
+ * Every run on the calling thread is timed, which gives the seconds per unit
+ * of work of the site. Once known, a loop of w units over t threads is split
+ * if w * secondsPerUnit() * (1 - 1/t) is more than parallelWakeupSeconds()
+ * (four times more in LOW_LATENCY mode). Until then the loop is split if w
+ * is at least getParallelGrainWork().
+ **/
+class ParallelGrain
+{
+public:
+  //! @brief Whether to split a loop of n iterations and work units of work
+  bool split(long work, long n) const;
+
+  //! @brief Account for a run of the loop on the calling thread
+  void recordInline(long work, double seconds);
+  //! @brief Account for a split run of the loop
+  void recordSplit() { splitRuns++; }
+
+  //! @brief The seconds per unit of work, or 0 if never timed
+  double secondsPerUnit() const
+  {
+    return perUnit.load(std::memory_order_relaxed);
+  }
+  long numInline() const { return inlineRuns; }
+  long numSplit() const { return splitRuns; }
+
+private:
+  std::atomic<double> perUnit{0};
+  std::atomic_long inlineRuns{0};
+  std::atomic_long splitRuns{0};
+};
+
+//! Run `fn(first, last)` over `[0, n)`, on the calling thread or split, as
+//! grain decides. See `HELIB_ADAPTIVE_EXEC_RANGE`.
+void adaptiveExecRange(ParallelGrain& grain,
+                       long work,
+                       long n,
+                       const std::function<void(long, long)>& fn);
+
+//! Whether the calling thread is running a task of a parallel loop, of the
+//! installed `TaskScheduler` or of the NTL thread pool. Work that would split
+//! itself over the threads can check this to run serially in the task, as
+//! the loop is already spread over them.
+bool inParallelTask();
+
+} // namespace helib
+
+// A HELIB_EXEC_RANGE for loops whose work can be small: every call site keeps
+// a ParallelGrain, and runs on the calling thread when waking the threads
+// would cost more than the loop saves. work is the size of the loop in
+// residues (or entries) touched, e.g. phi(m) times the number of primes.
+#define HELIB_ADAPTIVE_EXEC_RANGE(work, n, first, last)                        \
+  {                                                                            \
+    static ::helib::ParallelGrain helib_grain_;                                \
+    ::helib::adaptiveExecRange(                                                \
+        helib_grain_, (work), (n), [&](long first, long last) {
+#define HELIB_ADAPTIVE_EXEC_RANGE_END                                          \
+  });                                                                          \
+  }
+
 #endif // ifndef HELIB_MULTICORE_H
@@ -79,6 +79,7 @@ inline NTL::xdouble coeffsL2Norm(const DoubleCRT& f) // l2 norm
 }
 
 typedef std::complex<double> cx_double;
+typedef std::complex<float> cx_float;
 
 //! Computing the L-infinity norm of the canonical embedding
 //! Assumed: deg(f) < phi(m).
@@ -115,6 +116,20 @@ void CKKS_canonicalEmbedding(std::vector<cx_double>& v,
                              const std::vector<double>& f,
                              const PAlgebra& palg);
 
+//! Batched version of the above: vs[i] is the embedding of fs[i]. The
+//! transforms are done a few at a time by PGFFT::apply_many, in parallel.
+void CKKS_canonicalEmbedding(std::vector<std::vector<cx_double>>& vs,
+                             const std::vector<std::vector<double>>& fs,
+                             const PAlgebra& palg);
+
+//! Single-precision version of the above, for bulk data: v is the
+//! embedding of f divided by divisor, rounded to float. The transform and
+//! the division are done in double precision.
+void CKKS_canonicalEmbedding(std::vector<cx_float>& v,
+                             const std::vector<double>& f,
+                             const PAlgebra& palg,
+                             double divisor = 1.0);
+
 //! Requires p==-1 and m==2^k where k >=2.
 //! Computes the inverse of canonical embedding, scaled by scaling
 //! and then rounded to nearest integer.
@@ -123,6 +138,28 @@ void CKKS_embedInSlots(zzX& f,
                        const PAlgebra& palg,
                        double scaling);
 
+//! Same as above, from single-precision slots. The transform is done in
+//! double precision.
+void CKKS_embedInSlots(zzX& f,
+                       const std::vector<cx_float>& v,
+                       const PAlgebra& palg,
+                       double scaling);
+
+//! Batched version of the above: fs[i] is the inverse embedding of vs[i],
+//! with the same scaling for all of them.
+void CKKS_embedInSlots(std::vector<zzX>& fs,
+                       const std::vector<std::vector<cx_double>>& vs,
+                       const PAlgebra& palg,
+                       double scaling);
+
+//! Same as above, but the rounded coefficients are reduced straight into the
+//! residues of f modulo each of its primes, which are then transformed. The
+//! primes of f are left as they are, and its context must use palg.
+void CKKS_embedInSlots(DoubleCRT& f,
+                       const std::vector<cx_double>& v,
+                       const PAlgebra& palg,
+                       double scaling);
+
 } // namespace helib
 
 #endif // ifndef HELIB_NORMS_H
@@ -0,0 +1,91 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_NUMA_H
+#define HELIB_NUMA_H
+/**
+ * @file numa.h
+ * @brief NUMA topology, thread pinning and per-node replicas of read-mostly
+ * data.
+ *
+ * The topology is read from `/sys/devices/system/node` on Linux. Elsewhere,
+ * or if it cannot be read, the machine is taken to be a single node and
+ * pinning is a no-op. No NUMA library is needed: replicas are placed on a
+ * node by being copied from a thread running on it, relying on the
+ * operating system's first-touch page placement.
+ **/
+
+#include <memory>
+#include <vector>
+
+namespace helib {
+
+//! @brief The number of NUMA nodes, at least 1.
+long NumaNodes();
+
+//! @brief The CPUs of NUMA node `node`, where `0 <= node < NumaNodes()`.
+const std::vector<long>& NumaNodeCpus(long node);
+
+//! @brief The NUMA node the calling thread is running on (or is pinned to).
+long CurrentNumaNode();
+
+/**
+ * @brief Restrict the calling thread to the CPUs of NUMA node `node`.
+ * @return Whether the thread was pinned.
+ **/
+bool PinThreadToNumaNode(long node);
+
+/**
+ * @class NumaReplicated
+ * @brief A read-only object with a copy on each NUMA node.
+ * @tparam T The type of the object, which must be copy-constructible.
+ *
+ * The copy for a node is made the first time a thread on that node asks for
+ * it, so that its memory is local to that node. On a single node machine the
+ * object is never copied. `local` is safe to call from several threads; a
+ * `NumaReplicated` must not be copied or assigned while it is in use.
+ **/
+template <typename T>
+class NumaReplicated
+{
+public:
+  explicit NumaReplicated(const T& master) :
+      master(std::make_shared<const T>(master)), replicas(NumaNodes())
+  {}
+
+  //! @brief The object, as copied on the node of the calling thread.
+  const T& local() const
+  {
+    long node = CurrentNumaNode();
+    if (replicas.size() <= 1 || node >= long(replicas.size()))
+      return *master;
+    std::shared_ptr<const T> current = std::atomic_load(&replicas[node]);
+    if (!current) {
+      auto fresh = std::make_shared<const T>(*master);
+      // A racing thread on the same node may have won, then use its copy
+      if (std::atomic_compare_exchange_strong(&replicas[node], &current, fresh))
+        current = std::move(fresh);
+    }
+    // Once set, a replica is never replaced, so this stays valid
+    return *current;
+  }
+
+  //! @brief The object itself.
+  const T& get() const { return *master; }
+
+private:
+  std::shared_ptr<const T> master;
+  mutable std::vector<std::shared_ptr<const T>> replicas;
+};
+
+} // namespace helib
+
+#endif // HELIB_NUMA_H
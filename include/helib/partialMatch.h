@@ -13,11 +13,20 @@
 #ifndef HELIB_PARTIALMATCH_H
 #define HELIB_PARTIALMATCH_H
 
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
 #include <sstream>
+#include <vector>
 
+#include <helib/EncodedPtxt.h>
 #include <helib/Matrix.h>
 #include <helib/PolyMod.h>
+#include <helib/polyEval.h>
 #include <helib/query.h>
+#include <helib/set.h>
 
 // This code is in flux and should be considered very alpha.
 // Not recommended for public use.
@@ -49,16 +58,14 @@ inline Matrix<TXT> calculateMasks(const EncryptedArray& ea,
 
   // Replicate the query once per row of the database
   // TODO: Some such replication will be needed once blocks/bands exist
-  std::vector<long> columns(database.dims(0), 0l);
-  Matrix<TXT>& mask = query;
-  mask.inPlaceTranspose();
-  mask = mask.columns(columns);
-  mask.inPlaceTranspose();
+  Matrix<TXT> mask = query.repeatedRows(database.dims(0)).compact();
 
-  (mask -= database)
-      .apply([&](auto& entry) { mapTo01(ea, entry); })
-      .apply([](auto& entry) { entry.negate(); })
-      .apply([](auto& entry) { entry.addConstant(NTL::ZZX(1l)); });
+  mask.entrywiseChain(
+      database,
+      [](auto& lhs, const auto& rhs) { lhs -= rhs; },
+      [&](auto& entry) { mapTo01(ea, entry); },
+      [](auto& entry) { entry.negate(); },
+      [](auto& entry) { entry.addConstant(NTL::ZZX(1l)); });
 
   return mask;
 }
@@ -86,34 +93,263 @@ Matrix<Ctxt> calculateMasks(const EncryptedArray& ea,
         "Database and query must have same number of columns");
   // TODO: case where query.dims(0) != database.dims(0)
 
-  // Replicate the query once per row of the database
+  // Replicate the query once per row of the database, as a view
   // TODO: Some such replication will be needed once blocks/bands exist
-  std::vector<long> columns(database.dims(0), 0l);
-  Matrix<TXT>& mask = query;
-  mask.inPlaceTranspose();
-  mask = mask.columns(columns);
-  mask.inPlaceTranspose();
+  Matrix<TXT> queries = query.repeatedRows(database.dims(0));
 
   // FIXME: Avoid deep copy
   // Ptxt Query
   if constexpr (std::is_same_v<TXT, Ptxt<BGV>>) {
     auto tmp = database.deepCopy();
-    (tmp -= mask)
-        .apply([&](auto& entry) { mapTo01(ea, entry); })
-        .apply([](auto& entry) { entry.negate(); })
-        .apply([](auto& entry) { entry.addConstant(NTL::ZZX(1l)); });
+    tmp.entrywiseChain(
+        queries,
+        [](auto& lhs, const auto& rhs) { lhs -= rhs; },
+        [&](auto& entry) { mapTo01(ea, entry); },
+        [](auto& entry) { entry.negate(); },
+        [](auto& entry) { entry.addConstant(NTL::ZZX(1l)); });
 
     return tmp;
   } else { // Ctxt Query
-    (mask -= database)
-        .apply([&](auto& entry) { mapTo01(ea, entry); })
-        .apply([](auto& entry) { entry.negate(); })
-        .apply([](auto& entry) { entry.addConstant(NTL::ZZX(1l)); });
+    Matrix<Ctxt> mask = queries.compact();
+    mask.entrywiseChain(
+        database,
+        [](auto& lhs, const auto& rhs) { lhs -= rhs; },
+        [&](auto& entry) { mapTo01(ea, entry); },
+        [](auto& entry) { entry.negate(); },
+        [](auto& entry) { entry.addConstant(NTL::ZZX(1l)); });
 
     return mask;
   }
 }
 
+/**
+ * @brief Encode the entries of a plaintext database once, so that they can be
+ * subtracted from many encrypted queries without being encoded again.
+ * @param database The matrix holding the plaintext database.
+ * @param primes The primes to encode over. These must contain the primes of
+ * every query ciphertext the encodings will be used with.
+ * @return The encoded entries in row-major order.
+ **/
+inline std::vector<FatEncodedPtxt> encodeDatabase(
+    const Matrix<Ptxt<BGV>>& database,
+    const IndexSet& primes)
+{
+  long rows = database.dims(0);
+  long cols = database.dims(1);
+  std::vector<FatEncodedPtxt> encoded(rows * cols);
+  NTL_EXEC_RANGE(rows * cols, first, last)
+  for (long k = first; k < last; ++k) {
+    EncodedPtxt eptxt;
+    database(k / cols, k % cols).encode(eptxt);
+    encoded[k].expand(eptxt, primes);
+  }
+  NTL_EXEC_RANGE_END
+  return encoded;
+}
+
+/**
+ * @brief Given an encrypted query set and a plaintext database with encoded
+ * entries, calculates a mask of {0,1} where 1 signifies a matching element
+ * and 0 otherwise.
+ * @param ea The encrypted array object holding information about the scheme.
+ * @param query The query set to mask against the database. Must be a row
+ * vector of the same dimension as the second dimension of the database matrix.
+ * @param database The matrix holding the plaintext database.
+ * @param encoded The entries of `database` as returned by `encodeDatabase`.
+ * @return The calculated mask. Is the same size as the database.
+ * @note The entries of the mask are computed in parallel.
+ **/
+inline Matrix<Ctxt> calculateMasks(const EncryptedArray& ea,
+                                   const Matrix<Ctxt>& query,
+                                   const Matrix<Ptxt<BGV>>& database,
+                                   const std::vector<FatEncodedPtxt>& encoded)
+{
+  if (query.dims(0) != 1)
+    throw InvalidArgument("Query must be a row vector");
+  if (query.dims(1) != database.dims(1))
+    throw InvalidArgument(
+        "Database and query must have same number of columns");
+  long rows = database.dims(0);
+  long cols = database.dims(1);
+  assertEq<InvalidArgument>(long(encoded.size()),
+                            rows * cols,
+                            "Encodings do not match the database size");
+
+  // Placeholders without rows, every entry is assigned below
+  Matrix<Ctxt> mask(Ctxt(ZeroCtxtLike, query(0, 0)), rows, cols);
+  NTL_EXEC_RANGE(rows * cols, first, last)
+  for (long k = first; k < last; ++k) {
+    Ctxt& entry = mask(k / cols, k % cols);
+    entry = query(0, k % cols);
+    entry.addConstant(encoded[k], /*neg=*/true);
+    mapTo01(ea, entry);
+    entry.negate();
+    entry.addConstant(NTL::ZZX(1l));
+  }
+  NTL_EXEC_RANGE_END
+  return mask;
+}
+
+/**
+ * @class DatabasePowers
+ * @brief The powers `D, D^2, ..., D^{p-1}` of every entry `D` of a plaintext
+ * database, encoded once so that the masks of encrypted queries are computed
+ * mostly with plaintext-ciphertext operations.
+ *
+ * As `binomial(p-1, k) = (-1)^k mod p`, the first step of `mapTo01` on a
+ * difference expands to `(q - D)^{p-1} = sum_{k=0}^{p-1} q^k D^{p-1-k}`. The
+ * powers of each query column are then computed once and shared by all the
+ * rows of the database, instead of raising every difference to `p-1`.
+ * @note This takes `p-1` encodings per entry of the database, so it only
+ * pays off for small `p`.
+ **/
+class DatabasePowers
+{
+public:
+  /**
+   * @brief Constructor.
+   * @param database The matrix holding the plaintext database.
+   * @param primes The primes to encode over. These must contain the primes of
+   * every query ciphertext the encodings will be used with.
+   * @note The entries are encoded in parallel.
+   **/
+  DatabasePowers(const Matrix<Ptxt<BGV>>& database, const IndexSet& primes) :
+      nRows(database.dims(0)), nCols(database.dims(1)), primes(primes)
+  {
+    assertTrue<InvalidArgument>(nRows > 0 && nCols > 0,
+                                "Database must have positive dimensions");
+    const Context& context = database(0, 0).getContext();
+    long p = context.getP();
+    if (context.getAlMod().getPPowR() != p)
+      throw LogicError("DatabasePowers not implemented for r>1");
+    nPowers = p - 1;
+
+    powers.resize(nRows * nCols * nPowers);
+    NTL_EXEC_RANGE(nRows * nCols, first, last)
+    for (long k = first; k < last; ++k) {
+      const Ptxt<BGV>& entry = database(k / nCols, k % nCols);
+      Ptxt<BGV> entryPower = entry;
+      for (long e = 1; e <= nPowers; ++e) {
+        if (e > 1)
+          entryPower *= entry;
+        EncodedPtxt eptxt;
+        entryPower.encode(eptxt);
+        powers[k * nPowers + e - 1].expand(eptxt, primes);
+      }
+    }
+    NTL_EXEC_RANGE_END
+  }
+
+  /**
+   * @brief Returns number of rows in the database.
+   * @return The number of rows in the database.
+   **/
+  long rows() const { return nRows; }
+
+  /**
+   * @brief Returns number of columns in the database.
+   * @return The number of columns in the database.
+   **/
+  long columns() const { return nCols; }
+
+  /**
+   * @brief Returns the highest power stored, i.e. `p-1`.
+   * @return The highest power stored.
+   **/
+  long degree() const { return nPowers; }
+
+  /**
+   * @brief Returns the primes the powers are encoded over.
+   * @return The primes the powers are encoded over.
+   **/
+  const IndexSet& getPrimes() const { return primes; }
+
+  /**
+   * @brief Returns the encoding of an entry raised to a power.
+   * @param i The row of the entry.
+   * @param j The column of the entry.
+   * @param e The power, between `1` and `degree()`.
+   * @return The encoding of the entry `(i, j)` raised to the power `e`.
+   **/
+  const FatEncodedPtxt& power(long i, long j, long e) const
+  {
+    return powers[(i * nCols + j) * nPowers + e - 1];
+  }
+
+private:
+  long nRows;
+  long nCols;
+  long nPowers;
+  IndexSet primes;
+  std::vector<FatEncodedPtxt> powers;
+};
+
+/**
+ * @brief Given an encrypted query set and the precomputed powers of a
+ * plaintext database, calculates a mask of {0,1} where 1 signifies a matching
+ * element and 0 otherwise.
+ * @param ea The encrypted array object holding information about the scheme.
+ * @param query The query set to mask against the database. Must be a row
+ * vector of the same dimension as the second dimension of the database matrix.
+ * @param powers The powers of the entries of the database.
+ * @return The calculated mask. Is the same size as the database.
+ * @note Only the powers of the query are ciphertext multiplications, one set
+ * per column. The entries of the mask are computed in parallel.
+ **/
+inline Matrix<Ctxt> calculateMasks(const EncryptedArray& ea,
+                                   const Matrix<Ctxt>& query,
+                                   const DatabasePowers& powers)
+{
+  if (query.dims(0) != 1)
+    throw InvalidArgument("Query must be a row vector");
+  if (long(query.dims(1)) != powers.columns())
+    throw InvalidArgument(
+        "Database and query must have same number of columns");
+  long rows = powers.rows();
+  long cols = powers.columns();
+  long degree = powers.degree();
+
+  // The powers q, q^2, ..., q^{p-1} of each column of the query
+  std::vector<std::vector<Ctxt>> queryPowers(cols);
+  auto computeQueryPowers = [&](long j) {
+    DynamicCtxtPowers columnPowers(query(0, j), degree);
+    columnPowers.computePowers();
+    queryPowers[j] = columnPowers.getVector();
+  };
+  // With few columns, let each one parallelize over its powers instead
+  if (cols >= NTL::AvailableThreads()) {
+    NTL_EXEC_RANGE(cols, first, last)
+    for (long j = first; j < last; ++j)
+      computeQueryPowers(j);
+    NTL_EXEC_RANGE_END
+  } else {
+    for (long j = 0; j < cols; ++j)
+      computeQueryPowers(j);
+  }
+
+  // Placeholders without rows, every entry is assigned below
+  Matrix<Ctxt> mask(Ctxt(ZeroCtxtLike, query(0, 0)), rows, cols);
+  NTL_EXEC_RANGE(rows * cols, first, last)
+  for (long k = first; k < last; ++k) {
+    long i = k / cols;
+    long j = k % cols;
+    // (q - D)^{p-1} = q^{p-1} + sum_{e=1}^{p-2} q^e D^{p-1-e} + D^{p-1}
+    Ctxt& entry = mask(i, j);
+    entry = queryPowers[j][degree - 1];
+    for (long e = 1; e < degree; ++e) {
+      Ctxt term = queryPowers[j][e - 1];
+      term.multByConstant(powers.power(i, j, degree - e));
+      entry += term;
+    }
+    entry.addConstant(powers.power(i, j, degree));
+    frobeniusNorm(ea, entry);
+    entry.negate();
+    entry.addConstant(NTL::ZZX(1l));
+  }
+  NTL_EXEC_RANGE_END
+  return mask;
+}
+
 /**
  * @brief Given a mask and information about the query to be performed,
  * calculates a score for each matching element signified by the mask.
@@ -143,7 +379,11 @@ inline Matrix<TXT> calculateScores(
   auto ones(mask(0, 0));
   ones.clear();
   ones.addConstant(NTL::ZZX(1L));
-  Matrix<TXT> result(ones, mask.dims(0), 1l);
+  if (index_sets.empty())
+    return Matrix<TXT>(ones, mask.dims(0), 1l);
+
+  std::vector<Matrix<TXT>> factors;
+  factors.reserve(index_sets.size());
   for (std::size_t i = 0; i < index_sets.size(); ++i) {
     const auto& index_set = index_sets.at(i);
     const auto& weight_set = weights.at(i);
@@ -162,14 +402,20 @@ inline Matrix<TXT> calculateScores(
     Matrix<TXT> factor(submatrix * weight_set);
     // factor should in fact be a 1*1 matrix
     factor.apply([&](auto& entry) { entry.addConstant(NTL::ZZX(offset)); });
-    result.template entrywiseOperation<TXT>(
-        factor,
-        [](auto& lhs, const auto& rhs) -> decltype(auto) {
-          lhs.multiplyBy(rhs);
-          return lhs;
-        });
+    factors.push_back(std::move(factor));
   }
-  return result;
+
+  // Multiply the factors in a balanced tree, depth log(#factors) rather
+  // than #factors
+  for (std::size_t step = 1; step < factors.size(); step *= 2)
+    for (std::size_t i = 0; i + step < factors.size(); i += 2 * step)
+      factors[i].template entrywiseOperation<TXT>(
+          factors[i + step],
+          [](auto& lhs, const auto& rhs) -> decltype(auto) {
+            lhs.multiplyBy(rhs);
+            return lhs;
+          });
+  return factors[0];
 }
 
 /**
@@ -197,6 +443,11 @@ inline PolyMod partialMatchEncode(uint32_t input, const Context& context)
  * @tparam TXT The database is templated on `TXT` which can either be a `Ctxt`
  * or a `Ptxt<BGV>`
  * @brief An object representing a database which is a `HElib::Matrix<TXT>`.
+ *
+ * The rows are held in segments, one per matrix given to the constructor or
+ * to `append`, so that growing the database never copies or re-encodes the
+ * rows already in it. Lookups score each segment on its own and stack the
+ * per-row results, in the order of the rows.
  **/
 template <typename TXT>
 class Database
@@ -212,9 +463,20 @@ public:
    * @param c A shared pointer to the context used to create the data.
    **/
   Database(const Matrix<TXT>& M, std::shared_ptr<const Context> c) :
-      data(M), context(c)
+      segments{Segment{M, nullptr}}, context(c)
   {}
 
+  /**
+   * @brief Constructor taking over the matrix, which no longer refers to
+   * the rows.
+   * @param M The `Matrix<TXT>` containing the data of the database.
+   * @param c A shared pointer to the context used to create the data.
+   **/
+  Database(Matrix<TXT>&& M, std::shared_ptr<const Context> c) : context(c)
+  {
+    segments.push_back(Segment{std::move(M), nullptr});
+  }
+
   // FIXME: Should this option really exist?
   /**
    * @brief Constructor.
@@ -225,7 +487,7 @@ public:
    * for scope.
    **/
   Database(const Matrix<TXT>& M, const Context& c) :
-      data(M),
+      segments{Segment{M, nullptr}},
       context(std::shared_ptr<const helib::Context>(&c, [](auto UNUSED p) {}))
   {}
 
@@ -256,18 +518,237 @@ public:
   auto getScore(const QueryType& weighted_query,
                 const Matrix<TXT2>& query_data) const;
 
+  /**
+   * @brief Function for performing a database lookup of many query rows with
+   * the same query expression.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param lookup_query The lookup query expression to perform.
+   * @param queries The query rows to compare with the database.
+   * @return A `std::vector` with the result of `contains` for each query row.
+   * @note The queries are evaluated in parallel. When the database is in
+   * plaintext and the queries are encrypted, the database entries are encoded
+   * only once for all the queries.
+   **/
+  template <typename TXT2>
+  auto contains(const QueryType& lookup_query,
+                const std::vector<Matrix<TXT2>>& queries) const;
+
+  /**
+   * @brief Function for performing a weighted partial match of many query
+   * rows with the same query expression.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param weighted_query The weighted lookup query expression to perform.
+   * @param queries The query rows to compare with the database.
+   * @return A `std::vector` with the result of `getScore` for each query row.
+   * @note See the multi-query `contains`.
+   **/
+  template <typename TXT2>
+  auto getScore(const QueryType& weighted_query,
+                const std::vector<Matrix<TXT2>>& queries) const;
+
+  /**
+   * @brief Count the rows matching a query, as `SELECT COUNT(*) WHERE ...`.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param lookup_query The lookup query expression to perform.
+   * @param query_data The lookup query data to compare with the database.
+   * @param acrossSlots Also add up the counts of all the slots, with
+   * `totalSums`, when the records of the database are spread over the slots.
+   * @return A single `Ctxt` or `Ptxt` with the number of matching rows in
+   * every slot, modulo `p^r`.
+   * @note The result of `contains` on each segment is summed as soon as it is
+   * computed, by `binSumReduction` over its rows.
+   **/
+  template <typename TXT2>
+  auto count(const QueryType& lookup_query,
+             const Matrix<TXT2>& query_data,
+             bool acrossSlots = false) const;
+
+  /**
+   * @brief Sum a column over the rows matching a query, as
+   * `SELECT SUM(value) WHERE ...`.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param lookup_query The lookup query expression to perform.
+   * @param query_data The lookup query data to compare with the database.
+   * @param valueColumn The column to sum, holding its values in the slots.
+   * @param acrossSlots Also add up the sums of all the slots, see `count`.
+   * @return A single `Ctxt` or `Ptxt` with the sum in every slot, modulo
+   * `p^r`.
+   * @note Each match is multiplied by the value of its row as soon as it is
+   * computed, and the products are summed by `binSumReduction`.
+   **/
+  template <typename TXT2>
+  auto sum(const QueryType& lookup_query,
+           const Matrix<TXT2>& query_data,
+           long valueColumn,
+           bool acrossSlots = false) const;
+
+  /**
+   * @brief Count the rows matching a query, grouped by the value of a key
+   * column, as `SELECT key, COUNT(*) WHERE ... GROUP BY key`.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param lookup_query The lookup query expression to perform.
+   * @param query_data The lookup query data to compare with the database.
+   * @param keyColumn The column holding the keys in its slots.
+   * @param groups The values of the keys to count, from a small domain.
+   * @param acrossSlots Also add up the counts of all the slots, see `count`.
+   * @return A `std::vector` with the count of each group, in the order of
+   * `groups`.
+   * @note The indicators of the groups cost a `mapTo01` per row and group,
+   * on plaintexts for a plaintext database.
+   **/
+  template <typename TXT2>
+  auto countBy(const QueryType& lookup_query,
+               const Matrix<TXT2>& query_data,
+               long keyColumn,
+               const std::vector<long>& groups,
+               bool acrossSlots = false) const;
+
+  /**
+   * @brief Sum a column over the rows matching a query, grouped by the value
+   * of a key column, as `SELECT key, SUM(value) WHERE ... GROUP BY key`.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param lookup_query The lookup query expression to perform.
+   * @param query_data The lookup query data to compare with the database.
+   * @param valueColumn The column to sum, holding its values in the slots.
+   * @param keyColumn The column holding the keys in its slots.
+   * @param groups The values of the keys to sum over, from a small domain.
+   * @param acrossSlots Also add up the sums of all the slots, see `count`.
+   * @return A `std::vector` with the sum of each group, in the order of
+   * `groups`.
+   * @note The indicator of the group and the value of a row are multiplied
+   * first, so that each match takes a single multiplication per group.
+   **/
+  template <typename TXT2>
+  auto sumBy(const QueryType& lookup_query,
+             const Matrix<TXT2>& query_data,
+             long valueColumn,
+             long keyColumn,
+             const std::vector<long>& groups,
+             bool acrossSlots = false) const;
+
+  /**
+   * @brief Precompute the powers of the entries of a plaintext database, so
+   * that later lookups with encrypted queries need far fewer ciphertext
+   * multiplications. See `DatabasePowers`.
+   * @param primes The primes to encode over. Queries whose primes are not
+   * contained in `primes` do not use the precomputation.
+   * @note The precomputation is kept up to date by `append` and `update`,
+   * but not if the data is modified through `getData`, call this again in
+   * that case.
+   **/
+  void precomputeMasks(const IndexSet& primes);
+
+  /**
+   * @brief Append rows at the end of the database.
+   * @param M The rows to append, with `columns()` columns.
+   * @note The rows become a new segment: the rows already in the database are
+   * neither copied nor re-encoded. If the masks were precomputed, the powers
+   * of the new rows, and only these, are computed.
+   **/
+  void append(const Matrix<TXT>& M);
+
+  /**
+   * @brief Replace rows of the database.
+   * @param first The first row to replace.
+   * @param M The new rows, replacing the rows `first` to
+   * `first + M.dims(0) - 1`, with `columns()` columns.
+   * @note The entries are written in place, into the matrices the segments
+   * share with the matrices they were built from, as `getData` would. If the
+   * masks were precomputed, they are computed again for the segments holding
+   * the replaced rows, and only for these.
+   **/
+  void update(long first, const Matrix<TXT>& M);
+
+  /**
+   * @brief Returns number of rows in the database.
+   * @return The number of rows in the database.
+   **/
+  long rows() const
+  {
+    long total = 0;
+    for (const Segment& segment : segments)
+      total += segment.data.dims(0);
+    return total;
+  }
+
   // TODO - correct name?
   /**
    * @brief Returns number of columns in the database.
    * @return The number of columns in the database.
    **/
-  long columns() { return data.dims(1); }
+  long columns() const { return segments.front().data.dims(1); }
+
+  /**
+   * @brief Returns the number of segments the rows are held in.
+   * @return The number of segments.
+   **/
+  long numSegments() const { return segments.size(); }
 
+  /**
+   * @brief Returns the rows of one segment.
+   * @param k The index of the segment, in the order of the rows.
+   * @return The matrix holding the rows of segment `k`.
+   **/
+  const Matrix<TXT>& segment(long k) const { return segments.at(k).data; }
+
+  /**
+   * @brief Returns the matrix of all the rows of the database.
+   * @return The matrix holding the data of the database.
+   * @note With several segments, the rows are first copied into a single
+   * segment, and precomputed masks are computed again for it.
+   **/
   Matrix<TXT>& getData();
 
 private:
-  Matrix<TXT> data;
+  // The rows of one matrix given to the constructor or to append, with the
+  // powers of its entries if the masks are precomputed
+  struct Segment
+  {
+    Matrix<TXT> data;
+    std::shared_ptr<const DatabasePowers> powers;
+  };
+
+  std::vector<Segment> segments;
   std::shared_ptr<const Context> context;
+  // The primes given to precomputeMasks, if it was called
+  std::optional<IndexSet> powersPrimes;
+
+  void precompute(Segment& segment) const;
+
+  template <typename TXT2>
+  static bool usePowers(const Segment& segment,
+                        const Matrix<TXT2>& query_data);
+
+  template <typename TXT2>
+  auto segmentScore(const Segment& segment,
+                    const QueryType& weighted_query,
+                    const Matrix<TXT2>& query_data) const;
+
+  template <typename TXT2>
+  auto segmentScores(const Segment& segment,
+                     const QueryType& weighted_query,
+                     const std::vector<Matrix<TXT2>>& queries) const;
+
+  // The sums over the matching rows of the value column (or of one if
+  // valueColumn < 0) for each group of the key column (or for all the rows
+  // if keyColumn < 0)
+  template <typename TXT2>
+  auto aggregate(const QueryType& lookup_query,
+                 const Matrix<TXT2>& query_data,
+                 long valueColumn,
+                 long keyColumn,
+                 const std::vector<long>& groups,
+                 bool acrossSlots) const;
+
+  // The matrix with the rows of parts[0], then those of parts[1], ...
+  template <typename Result>
+  static Result stackRows(const std::vector<Result>& parts);
 };
 
 template <typename TXT>
@@ -293,7 +774,37 @@ template <typename TXT2>
 inline auto Database<TXT>::getScore(const QueryType& weighted_query,
                                     const Matrix<TXT2>& query_data) const
 {
-  auto mask = calculateMasks(context->getEA(), query_data, this->data);
+  if (segments.size() == 1)
+    return segmentScore<TXT2>(segments.front(), weighted_query, query_data);
+
+  using Result = decltype(
+      segmentScore<TXT2>(segments.front(), weighted_query, query_data));
+  std::vector<Result> parts;
+  parts.reserve(segments.size());
+  for (const Segment& segment : segments)
+    parts.push_back(segmentScore<TXT2>(segment, weighted_query, query_data));
+  return stackRows(parts);
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline auto Database<TXT>::segmentScore(const Segment& segment,
+                                        const QueryType& weighted_query,
+                                        const Matrix<TXT2>& query_data) const
+{
+  if constexpr (std::is_same_v<TXT, Ptxt<BGV>> &&
+                std::is_same_v<TXT2, Ctxt>) {
+    if (usePowers(segment, query_data)) {
+      auto mask =
+          calculateMasks(context->getEA(), query_data, *segment.powers);
+      return calculateScores(weighted_query.Fs,
+                             weighted_query.mus,
+                             weighted_query.taus,
+                             mask);
+    }
+  }
+
+  auto mask = calculateMasks(context->getEA(), query_data, segment.data);
 
   auto result = calculateScores(weighted_query.Fs,
                                 weighted_query.mus,
@@ -303,12 +814,596 @@ inline auto Database<TXT>::getScore(const QueryType& weighted_query,
   return result;
 }
 
+template <typename TXT>
+template <typename TXT2>
+inline auto Database<TXT>::contains(
+    const QueryType& lookup_query,
+    const std::vector<Matrix<TXT2>>& queries) const
+{
+  auto results = getScore<TXT2>(lookup_query, queries);
+
+  if (lookup_query.containsOR) {
+    // FLT on the scores
+    for (auto& result : results)
+      result.apply([&](auto& txt) {
+        txt.power(context->getAlMod().getPPowR() - 1);
+        return txt;
+      });
+  }
+
+  return results;
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline auto Database<TXT>::getScore(
+    const QueryType& weighted_query,
+    const std::vector<Matrix<TXT2>>& queries) const
+{
+  if (segments.size() == 1)
+    return segmentScores<TXT2>(segments.front(), weighted_query, queries);
+
+  // The results of every query on every segment, stacked query by query
+  using Result = decltype(
+      segmentScore<TXT2>(segments.front(), weighted_query, queries.front()));
+  long n = queries.size();
+  std::vector<std::vector<Result>> parts(n);
+  for (const Segment& segment : segments) {
+    auto scores = segmentScores<TXT2>(segment, weighted_query, queries);
+    for (long i = 0; i < n; ++i)
+      parts[i].push_back(std::move(scores[i]));
+  }
+  std::vector<Result> results;
+  results.reserve(n);
+  for (const auto& part : parts)
+    results.push_back(stackRows(part));
+  return results;
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline auto Database<TXT>::segmentScores(
+    const Segment& segment,
+    const QueryType& weighted_query,
+    const std::vector<Matrix<TXT2>>& queries) const
+{
+  using Result =
+      decltype(segmentScore<TXT2>(segment, weighted_query, queries.front()));
+  constexpr bool reuseEncodings =
+      std::is_same_v<TXT, Ptxt<BGV>> && std::is_same_v<TXT2, Ctxt>;
+  long n = queries.size();
+
+  // Encode the database once, over the primes of all the queries, unless
+  // its powers have already been precomputed over these primes
+  std::vector<FatEncodedPtxt> encoded;
+  bool encode = false;
+  if constexpr (reuseEncodings) {
+    IndexSet primes;
+    for (const auto& query : queries)
+      for (std::size_t j = 0; j < query.dims(1); ++j)
+        primes.insert(query(0, j).getPrimeSet());
+    encode = n > 0 &&
+             !(segment.powers && primes <= segment.powers->getPrimes());
+    if (encode)
+      encoded = encodeDatabase(segment.data, primes);
+  }
+
+  std::vector<std::shared_ptr<Result>> tmp(n);
+  auto score = [&](long i) {
+    if (encode) {
+      if constexpr (reuseEncodings) {
+        auto mask = calculateMasks(context->getEA(),
+                                   queries[i],
+                                   segment.data,
+                                   encoded);
+        tmp[i] = std::make_shared<Result>(calculateScores(weighted_query.Fs,
+                                                          weighted_query.mus,
+                                                          weighted_query.taus,
+                                                          mask));
+      }
+    } else {
+      tmp[i] = std::make_shared<Result>(
+          segmentScore<TXT2>(segment, weighted_query, queries[i]));
+    }
+  };
+
+  // With few queries, let each one parallelize over the database instead
+  if (n >= NTL::AvailableThreads()) {
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; ++i)
+      score(i);
+    NTL_EXEC_RANGE_END
+  } else {
+    for (long i = 0; i < n; ++i)
+      score(i);
+  }
+
+  std::vector<Result> results;
+  results.reserve(n);
+  for (auto& result : tmp)
+    results.push_back(std::move(*result));
+  return results;
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline auto Database<TXT>::count(const QueryType& lookup_query,
+                                 const Matrix<TXT2>& query_data,
+                                 bool acrossSlots) const
+{
+  return std::move(
+      aggregate<TXT2>(lookup_query, query_data, -1, -1, {}, acrossSlots)
+          .front());
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline auto Database<TXT>::sum(const QueryType& lookup_query,
+                               const Matrix<TXT2>& query_data,
+                               long valueColumn,
+                               bool acrossSlots) const
+{
+  assertInRange<InvalidArgument>(valueColumn,
+                                 0l,
+                                 columns(),
+                                 "Value column does not exist");
+  return std::move(aggregate<TXT2>(lookup_query,
+                                   query_data,
+                                   valueColumn,
+                                   -1,
+                                   {},
+                                   acrossSlots)
+                       .front());
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline auto Database<TXT>::countBy(const QueryType& lookup_query,
+                                   const Matrix<TXT2>& query_data,
+                                   long keyColumn,
+                                   const std::vector<long>& groups,
+                                   bool acrossSlots) const
+{
+  assertInRange<InvalidArgument>(keyColumn,
+                                 0l,
+                                 columns(),
+                                 "Key column does not exist");
+  return aggregate<TXT2>(lookup_query,
+                         query_data,
+                         -1,
+                         keyColumn,
+                         groups,
+                         acrossSlots);
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline auto Database<TXT>::sumBy(const QueryType& lookup_query,
+                                 const Matrix<TXT2>& query_data,
+                                 long valueColumn,
+                                 long keyColumn,
+                                 const std::vector<long>& groups,
+                                 bool acrossSlots) const
+{
+  assertInRange<InvalidArgument>(valueColumn,
+                                 0l,
+                                 columns(),
+                                 "Value column does not exist");
+  assertInRange<InvalidArgument>(keyColumn,
+                                 0l,
+                                 columns(),
+                                 "Key column does not exist");
+  return aggregate<TXT2>(lookup_query,
+                         query_data,
+                         valueColumn,
+                         keyColumn,
+                         groups,
+                         acrossSlots);
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline auto Database<TXT>::aggregate(const QueryType& lookup_query,
+                                     const Matrix<TXT2>& query_data,
+                                     long valueColumn,
+                                     long keyColumn,
+                                     const std::vector<long>& groups,
+                                     bool acrossSlots) const
+{
+  using Entry = std::decay_t<decltype(
+      segmentScore<TXT2>(segments.front(), lookup_query, query_data)(0, 0))>;
+  long nGroups = (keyColumn < 0) ? 1 : groups.size();
+  assertTrue<InvalidArgument>(nGroups > 0, "No groups to aggregate over");
+  const EncryptedArray& ea = context->getEA();
+
+  // The running totals of the groups, over the segments so far
+  std::vector<std::unique_ptr<Entry>> totals(nGroups);
+  for (const Segment& segment : segments) {
+    auto match = segmentScore<TXT2>(segment, lookup_query, query_data);
+    if (lookup_query.containsOR) {
+      // FLT on the scores, as in contains
+      match.apply([&](auto& txt) {
+        txt.power(context->getAlMod().getPPowR() - 1);
+        return txt;
+      });
+    }
+    long rows = segment.data.dims(0);
+
+    // match * [key == group] * value, for every row and group. The
+    // indicator and the value are multiplied first, in the type of the
+    // database, then the match once.
+    std::vector<std::vector<Entry>> terms(nGroups);
+    for (auto& groupTerms : terms)
+      groupTerms.assign(rows, match(0, 0));
+    NTL_EXEC_RANGE(rows * nGroups, first, last)
+    for (long k = first; k < last; ++k) {
+      long i = k / nGroups;
+      long g = k % nGroups;
+      Entry& term = terms[g][i];
+      term = match(i, 0);
+      if (keyColumn < 0) {
+        if (valueColumn >= 0)
+          term *= segment.data(i, valueColumn);
+        continue;
+      }
+      // 1 - (key - group)^{p^r-1}, as in calculateMasks
+      TXT weight = segment.data(i, keyColumn);
+      weight.addConstant(NTL::ZZX(-groups[g]));
+      mapTo01(ea, weight);
+      weight.negate();
+      weight.addConstant(NTL::ZZX(1l));
+      if (valueColumn >= 0)
+        weight *= segment.data(i, valueColumn);
+      term *= weight;
+    }
+    NTL_EXEC_RANGE_END
+
+    for (long g = 0; g < nGroups; ++g) {
+      binSumReduction(terms[g]);
+      if (totals[g])
+        *totals[g] += terms[g].front();
+      else
+        totals[g] = std::make_unique<Entry>(std::move(terms[g].front()));
+    }
+  }
+
+  std::vector<Entry> results;
+  results.reserve(nGroups);
+  for (auto& total : totals) {
+    if (acrossSlots) {
+      if constexpr (std::is_same_v<Entry, Ctxt>)
+        totalSums(ea, *total);
+      else
+        total->totalSums();
+    }
+    results.push_back(std::move(*total));
+  }
+  return results;
+}
+
 template <typename TXT>
 inline Matrix<TXT>& Database<TXT>::getData()
 {
-  return data;
+  if (segments.size() > 1) {
+    std::vector<Matrix<TXT>> parts;
+    parts.reserve(segments.size());
+    for (const Segment& segment : segments)
+      parts.push_back(segment.data);
+    segments.assign(1, Segment{stackRows(parts), nullptr});
+    precompute(segments.front());
+  }
+  return segments.front().data;
+}
+
+template <typename TXT>
+inline void Database<TXT>::precomputeMasks(const IndexSet& primes)
+{
+  static_assert(std::is_same_v<TXT, Ptxt<BGV>>,
+                "Masks can only be precomputed for a plaintext database");
+  powersPrimes = primes;
+  for (Segment& segment : segments)
+    precompute(segment);
+}
+
+template <typename TXT>
+inline void Database<TXT>::append(const Matrix<TXT>& M)
+{
+  assertTrue<InvalidArgument>(M.dims(0) > 0, "No rows to append");
+  assertEq<InvalidArgument>(long(M.dims(1)),
+                            columns(),
+                            "Appended rows must have the database's columns");
+  segments.push_back(Segment{M, nullptr});
+  precompute(segments.back());
+}
+
+template <typename TXT>
+inline void Database<TXT>::update(long first, const Matrix<TXT>& M)
+{
+  long last = first + M.dims(0);
+  assertTrue<InvalidArgument>(first >= 0 && last <= rows(),
+                              "Updated rows are out of the database");
+  assertEq<InvalidArgument>(long(M.dims(1)),
+                            columns(),
+                            "Updated rows must have the database's columns");
+
+  long cols = columns();
+  long start = 0; // The first row of the segment
+  for (Segment& segment : segments) {
+    long end = start + segment.data.dims(0);
+    long from = std::max(first, start);
+    long to = std::min(last, end);
+    if (from < to) {
+      for (long i = from; i < to; ++i)
+        for (long j = 0; j < cols; ++j)
+          segment.data(i - start, j) = M(i - first, j);
+      precompute(segment);
+    }
+    start = end;
+  }
+}
+
+template <typename TXT>
+inline void Database<TXT>::precompute(Segment& segment) const
+{
+  if constexpr (std::is_same_v<TXT, Ptxt<BGV>>) {
+    if (powersPrimes)
+      segment.powers =
+          std::make_shared<const DatabasePowers>(segment.data, *powersPrimes);
+  }
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline bool Database<TXT>::usePowers(const Segment& segment,
+                                     const Matrix<TXT2>& query_data)
+{
+  if (!segment.powers || query_data.dims(0) != 1)
+    return false;
+  IndexSet primes;
+  for (std::size_t j = 0; j < query_data.dims(1); ++j)
+    primes.insert(query_data(0, j).getPrimeSet());
+  return primes <= segment.powers->getPrimes();
 }
 
+template <typename TXT>
+template <typename Result>
+inline Result Database<TXT>::stackRows(const std::vector<Result>& parts)
+{
+  long total = 0;
+  for (const Result& part : parts)
+    total += part.dims(0);
+  long cols = parts.front().dims(1);
+  Result stacked(parts.front()(0, 0), total, cols);
+  long first = 0;
+  for (const Result& part : parts) {
+    for (std::size_t i = 0; i < part.dims(0); ++i)
+      for (long j = 0; j < cols; ++j)
+        stacked(first + i, j) = part(i, j);
+    first += part.dims(0);
+  }
+  return stacked;
+}
+
+/**
+ * @class StreamedDatabase
+ * @tparam TXT The database is templated on `TXT` which can either be a `Ctxt`
+ * or a `Ptxt<BGV>`
+ * @brief A database that is too large to be held in memory, scanned in chunks
+ * of rows.
+ *
+ * The rows are obtained from a user supplied reader, typically backed by a
+ * file. Each chunk is scored as a `Database<TXT>` and the per-row results are
+ * merged, while the next chunk is read on a separate thread. At most two
+ * chunks of the database are held in memory at any time.
+ **/
+template <typename TXT>
+class StreamedDatabase
+{
+public:
+  /**
+   * @brief Function returning the rows `[first, last)` of the database as a
+   * `Matrix<TXT>` with `last - first` rows.
+   * @note The chunks of a scan are requested in increasing order, one at a
+   * time, from a thread other than the caller's. A reader that parallelizes
+   * internally will therefore run serially.
+   **/
+  using ChunkReader = std::function<Matrix<TXT>(long first, long last)>;
+
+  /**
+   * @brief Constructor.
+   * @param rows The number of rows of the database.
+   * @param cols The number of columns of the database.
+   * @param reader The function used to read chunks of rows.
+   * @param c A shared pointer to the context used to create the data.
+   * @param chunkRows The number of rows to read and score at a time.
+   **/
+  StreamedDatabase(long rows,
+                   long cols,
+                   ChunkReader reader,
+                   std::shared_ptr<const Context> c,
+                   long chunkRows) :
+      nRows(rows),
+      nCols(cols),
+      chunkRows(chunkRows),
+      readChunk(std::move(reader)),
+      context(c)
+  {
+    assertTrue<InvalidArgument>(rows > 0 && cols > 0,
+                                "Database must have positive dimensions");
+    assertTrue<InvalidArgument>(chunkRows > 0,
+                                "Chunk size must be positive");
+    assertTrue<InvalidArgument>(bool(readChunk), "Chunk reader is empty");
+  }
+
+  /**
+   * @brief Constructor.
+   * @param rows The number of rows of the database.
+   * @param cols The number of columns of the database.
+   * @param reader The function used to read chunks of rows.
+   * @param c The context object used to create the data.
+   * @param chunkRows The number of rows to read and score at a time.
+   * @note This version accepts a `Context` that this object is not responsible
+   * for i.e. if it is on the stack. The programmer is responsible in this case
+   * for scope.
+   **/
+  StreamedDatabase(long rows,
+                   long cols,
+                   ChunkReader reader,
+                   const Context& c,
+                   long chunkRows) :
+      StreamedDatabase(
+          rows,
+          cols,
+          std::move(reader),
+          std::shared_ptr<const helib::Context>(&c, [](auto UNUSED p) {}),
+          chunkRows)
+  {}
+
+  /**
+   * @brief Function for performing a database lookup given a query expression
+   * and query data, one chunk of rows at a time.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param lookup_query The lookup query expression to perform.
+   * @param query_data The lookup query data to compare with the database.
+   * @param sink Called as `sink(first, result)` with the result of
+   * `Database::contains` on each chunk of rows starting at row `first`.
+   * @note Use this version to keep the results out of memory as well.
+   **/
+  template <typename TXT2, typename Sink>
+  void contains(const QueryType& lookup_query,
+                const Matrix<TXT2>& query_data,
+                Sink&& sink) const
+  {
+    scan(lookup_query, query_data, /*lookup=*/true, sink);
+  }
+
+  /**
+   * @brief Function for performing a weighted partial match given a query
+   * expression and query data, one chunk of rows at a time.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param weighted_query The weighted lookup query expression to perform.
+   * @param query_data The query data to compare with the database.
+   * @param sink Called as `sink(first, result)` with the result of
+   * `Database::getScore` on each chunk of rows starting at row `first`.
+   **/
+  template <typename TXT2, typename Sink>
+  void getScore(const QueryType& weighted_query,
+                const Matrix<TXT2>& query_data,
+                Sink&& sink) const
+  {
+    scan(weighted_query, query_data, /*lookup=*/false, sink);
+  }
+
+  /**
+   * @brief Function for performing a database lookup given a query expression
+   * and query data.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param lookup_query The lookup query expression to perform.
+   * @param query_data The lookup query data to compare with the database.
+   * @return The same result as `Database::contains` on the whole database.
+   **/
+  template <typename TXT2>
+  auto contains(const QueryType& lookup_query,
+                const Matrix<TXT2>& query_data) const
+  {
+    return merge(lookup_query, query_data, /*lookup=*/true);
+  }
+
+  /**
+   * @brief Function for performing a weighted partial match given a query
+   * expression and query data.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param weighted_query The weighted lookup query expression to perform.
+   * @param query_data The query data to compare with the database.
+   * @return The same result as `Database::getScore` on the whole database.
+   **/
+  template <typename TXT2>
+  auto getScore(const QueryType& weighted_query,
+                const Matrix<TXT2>& query_data) const
+  {
+    return merge(weighted_query, query_data, /*lookup=*/false);
+  }
+
+  /**
+   * @brief Returns number of rows in the database.
+   * @return The number of rows in the database.
+   **/
+  long rows() const { return nRows; }
+
+  /**
+   * @brief Returns number of columns in the database.
+   * @return The number of columns in the database.
+   **/
+  long columns() const { return nCols; }
+
+private:
+  long nRows;
+  long nCols;
+  long chunkRows;
+  ChunkReader readChunk;
+  std::shared_ptr<const Context> context;
+
+  std::future<Matrix<TXT>> prefetch(long first) const
+  {
+    long last = std::min(first + chunkRows, nRows);
+    return std::async(std::launch::async,
+                      [this, first, last] { return readChunk(first, last); });
+  }
+
+  template <typename TXT2, typename Sink>
+  void scan(const QueryType& query,
+            const Matrix<TXT2>& query_data,
+            bool lookup,
+            Sink&& sink) const
+  {
+    auto next = prefetch(0);
+    for (long first = 0; first < nRows; first += chunkRows) {
+      Matrix<TXT> chunk = next.get();
+      // Read the next chunk while this one is scored
+      if (first + chunkRows < nRows)
+        next = prefetch(first + chunkRows);
+
+      assertEq<RuntimeError>(long(chunk.dims(0)),
+                             std::min(chunkRows, nRows - first),
+                             "Chunk reader returned the wrong number of rows");
+      assertEq<RuntimeError>(long(chunk.dims(1)),
+                             nCols,
+                             "Chunk reader returned the wrong number of "
+                             "columns");
+      // The database takes over the chunk, which is released with it
+      Database<TXT> database(std::move(chunk), context);
+      if (lookup)
+        sink(first, database.template contains<TXT2>(query, query_data));
+      else
+        sink(first, database.template getScore<TXT2>(query, query_data));
+    }
+  }
+
+  template <typename TXT2>
+  auto merge(const QueryType& query,
+             const Matrix<TXT2>& query_data,
+             bool lookup) const
+  {
+    using Result = decltype(std::declval<const Database<TXT>&>()
+                                .template getScore<TXT2>(query, query_data));
+    std::unique_ptr<Result> result;
+    scan(query, query_data, lookup, [&](long first, const Result& partial) {
+      if (!result)
+        result = std::make_unique<Result>(partial(0, 0),
+                                          nRows,
+                                          long(partial.dims(1)));
+      for (std::size_t i = 0; i < partial.dims(0); ++i)
+        for (std::size_t j = 0; j < partial.dims(1); ++j)
+          (*result)(first + i, j) = partial(i, j);
+    });
+    return std::move(*result);
+  }
+};
+
 } // namespace helib
 
 #endif
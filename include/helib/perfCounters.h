@@ -0,0 +1,117 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_PERFCOUNTERS_H
+#define HELIB_PERFCOUNTERS_H
+/**
+ * @file perfCounters.h
+ * @brief Hardware performance counters, read through Linux `perf_event`.
+ *
+ * Each thread opens its own counters the first time it reads them, counting
+ * the user-space events of that thread only. Where they cannot be opened
+ * (other systems, or a `perf_event_paranoid` setting that forbids it) the
+ * reads fail and nothing is counted; an event the CPU lacks reads as zero.
+ *
+ * With `setPerfCounters(true)`, every timer (see timing.h) also adds up the
+ * events of the thread that runs it, which `printAllTimers` and the metrics
+ * exports then show. Work handed to other threads by a parallel loop is
+ * counted by the timers that run on those threads.
+ **/
+
+#include <array>
+#include <atomic>
+
+namespace helib {
+
+//! @brief The hardware events that are counted.
+enum class PerfEvent : int
+{
+  CYCLES = 0,
+  INSTRUCTIONS,
+  LLC_REFERENCES, //!< Accesses to the last-level cache
+  LLC_MISSES,     //!< Misses of the last-level cache, which go to memory
+  COUNT           //!< The number of events, not an event
+};
+
+constexpr int perfEventCount = int(PerfEvent::COUNT);
+
+//! @brief The name of an event, such as `"llc_misses"`.
+const char* perfEventName(PerfEvent event);
+
+//! @brief The counts of the events, over some stretch of a thread.
+struct PerfSample
+{
+  std::array<unsigned long, perfEventCount> counts{};
+
+  unsigned long operator[](PerfEvent event) const
+  {
+    return counts[int(event)];
+  }
+
+  PerfSample& operator+=(const PerfSample& other);
+  PerfSample operator-(const PerfSample& other) const;
+
+  //! @brief Instructions per cycle, 0 if no cycles were counted.
+  double ipc() const;
+
+  //! @brief The bytes brought in from memory by the LLC misses (one cache
+  //! line, 64 bytes, each), an estimate of the memory traffic.
+  unsigned long missBytes() const
+  {
+    return 64 * (*this)[PerfEvent::LLC_MISSES];
+  }
+};
+
+/**
+ * @brief Read the counters of the calling thread, opening them if needed.
+ * @param sample Set to the counts since they were opened.
+ * @return `false` (leaving `sample` alone) if the counters cannot be used.
+ **/
+bool readPerfCounters(PerfSample& sample);
+
+//! @brief Can the calling thread use the counters?
+bool perfCountersAvailable();
+
+//! @brief Turn the counting of events by the timers on or off.
+//! @return Whether the counters can be used (by the calling thread).
+bool setPerfCounters(bool on);
+
+//! @brief Do the timers count events?
+bool arePerfCountersOn();
+
+/**
+ * @class PerfScope
+ * @brief The events of the calling thread from the construction of the
+ * object on.
+ **/
+class PerfScope
+{
+public:
+  PerfScope() { valid = readPerfCounters(start); }
+
+  //! @brief Were the counters read at construction?
+  bool isValid() const { return valid; }
+
+  //! @brief The events since construction, all zero if not valid.
+  PerfSample elapsed() const;
+
+private:
+  PerfSample start;
+  bool valid;
+};
+
+//! \cond FALSE (make doxygen ignore these)
+extern std::atomic_bool perfCountersOn;
+//! \endcond
+
+} // namespace helib
+
+#endif // ifndef HELIB_PERFCOUNTERS_H
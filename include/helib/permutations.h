@@ -16,6 +16,12 @@
 #ifndef HELIB_PERMUTATIONS_H
 #define HELIB_PERMUTATIONS_H
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
 #include <helib/PAlgebra.h>
 #include <helib/matching.h>
 #include <helib/hypercube.h>
@@ -456,10 +462,19 @@ public:
 };
 typedef FullBinaryTree<SubDimension> OneGeneratorTree; // tree for one generator
 
+//! @brief What a permutation network built from some trees costs to apply.
+struct PermutationCost
+{
+  long automorphisms = 0; //!< The nonzero shifts, over all the layers
+  long keySwitches = 0;   //!< One per automorphism
+  long depth = 0;         //!< The layers, each a level of multiplications
+};
+
 //! A std::vector of generator trees, one per generator in Zm*/(p)
 class GeneratorTrees
 {
   long depth; // How many layers in this permutation network
+  PermutationCost cost; // Of the trees found by buildOptimalTrees
   NTL::Vec<OneGeneratorTree> trees;
   Permut map2cube, map2array;
 
@@ -473,6 +488,7 @@ public:
   //  GeneratorTrees(const Vec<SubDimension>& dims);
 
   long numLayers() const { return depth; } // depth of permutation network
+  const PermutationCost& getCost() const { return cost; }
   long numTrees() const { return trees.length(); }   // how many trees
   long getSize() const { return map2cube.length(); } // hypercube size
 
@@ -505,8 +521,13 @@ public:
 
   //! Compute the trees corresponding to the "optimal" way of breaking
   //! a permutation into dimensions, subject to some constraints. Returns
-  //! the cost (# of 1D shifts) of this solution.
+  //! the cost (# of 1D shifts) of this solution, with its breakdown in
+  //! getCost().
   //! Returns NTL_MAX_LONG if no solution
+  //!
+  //! The trees of single generators are searched in parallel, and kept for
+  //! later calls (with any generators), so that planning again for the same
+  //! context costs only the search over the ways of splitting the budget.
   long buildOptimalTrees(const NTL::Vec<GenDescriptor>& vec, long depthBound);
 
   /**
@@ -562,6 +583,16 @@ class PermNetwork
 {
   NTL::Vec<PermNetLayer> layers;
 
+  // The masks of the layers, encoded over all the primes (and rotated, see
+  // applyToCtxt) the first time the network is applied. Copies of the
+  // network share them. They are kept for one EncryptedArray at a time,
+  // told apart by EncryptedArray::getId(), and handed out as a shared set
+  // that stays valid when the cache moves on to another array.
+  struct Masks;
+  struct MaskCache;
+  std::shared_ptr<MaskCache> masks;
+  std::shared_ptr<const Masks> getMasks(const EncryptedArray& ea) const;
+
   //! Compute one or more layers corresponding to one network of a leaf
   void setLayers4Leaf(long lyrIdx,
                       const ColPerm& p,
@@ -571,11 +602,8 @@ class PermNetwork
                       const Permut& map2cube);
 
 public:
-  PermNetwork(){}; // empty network
-  PermNetwork(const Permut& pi, const GeneratorTrees& trees)
-  {
-    buildNetwork(pi, trees);
-  }
+  PermNetwork(); // empty network
+  PermNetwork(const Permut& pi, const GeneratorTrees& trees);
 
   long depth() const { return layers.length(); }
 
@@ -583,7 +611,10 @@ public:
   //! and prepares the permutation network for this pi
   void buildNetwork(const Permut& pi, const GeneratorTrees& trees);
 
-  //! Apply network to permute a ciphertext
+  //! Apply network to permute a ciphertext. The rotations of each layer
+  //! share one digit decomposition of c, and are multiplied by their masks
+  //! in parallel. The masks are encoded on the first call and kept for the
+  //! later ones (with the same ea).
   void applyToCtxt(Ctxt& c, const EncryptedArray& ea) const;
 
   //! Apply network to array, used mostly for debugging
@@ -594,9 +625,29 @@ public:
 
   const PermNetLayer& getLayer(long i) const { return layers[i]; }
 
+  /**
+   * @brief Write out the layers and their masks for `ea` (encoding them
+   * first if need be) in binary format, with the fingerprint of the context.
+   * @param str Output `std::ostream`.
+   * @param ea The `EncryptedArray` the network is applied with.
+   **/
+  void writeTo(std::ostream& str, const EncryptedArray& ea) const;
+
+  /**
+   * @brief Read a network written by `writeTo`, masks included, so that
+   * nothing is built or encoded again.
+   * @param str Input `std::istream`.
+   * @param ea The `EncryptedArray` the network was written for.
+   * @return The network.
+   **/
+  static PermNetwork readFrom(std::istream& str, const EncryptedArray& ea);
+
   friend std::ostream& operator<<(std::ostream& s, const PermNetwork& net);
 };
 
+//! @brief A 64-bit hash (FNV-1a) of the entries of pi.
+unsigned long permutationHash(const Permut& pi);
+
 // some convenience classes that are easier to work with
 // VJS-FIXME: document these
 
@@ -619,6 +670,12 @@ public:
 
   long getDepth() const { return trees.numLayers(); }
 
+  //! @brief The cost of getCost() broken down into automorphisms, key
+  //! switches and depth.
+  const PermutationCost& getCostBreakdown() const { return trees.getCost(); }
+
+  const EncryptedArray& getEA() const { return ea; }
+
   friend class PermPrecomp;
 };
 
@@ -639,7 +696,79 @@ public:
 
   void apply(PtxtArray& a) const;
 
+  const EncryptedArray& getEA() const { return ea; }
+  const Permut& getPermutation() const { return pi; }
+  const PermNetwork& getNetwork() const { return net; }
+
+  /**
+   * @brief Write out the permutation and its network, masks included.
+   * @param str Output `std::ostream`.
+   **/
+  void writeTo(std::ostream& str) const;
+
+  /**
+   * @brief Read a precomputation written by `writeTo`, for the same `ea`.
+   * @param str Input `std::istream`.
+   * @param ea The `EncryptedArray` it was written for.
+   * @return The precomputation, ready to apply.
+   **/
+  static std::unique_ptr<PermPrecomp> readFrom(std::istream& str,
+                                               const EncryptedArray& ea);
+
   // VJS-FIXME: add support for addMatrices4Network?
+
+private:
+  explicit PermPrecomp(const EncryptedArray& _ea) : ea(_ea) {}
+};
+
+/**
+ * @class PermPrecompCache
+ * @brief Permutation-dependent precomputations, built once per permutation.
+ *
+ * The entries are keyed by the hash of the permutation, the fingerprint of
+ * the context and the depth of the trees. If a directory is given, they are
+ * also written there on the first build and read back (in this or a later
+ * process) instead of being built again. The cache is safe to use from
+ * several threads.
+ **/
+class PermPrecompCache
+{
+public:
+  //! @param directory Where the entries are stored, none if empty.
+  explicit PermPrecompCache(const std::string& directory = "") :
+      directory(directory)
+  {}
+
+  PermPrecompCache(const PermPrecompCache&) = delete;
+  PermPrecompCache& operator=(const PermPrecompCache&) = delete;
+
+  /**
+   * @brief The precomputation of pi, from the cache, from the directory, or
+   * built (and then added to both).
+   * @param pip The permutation-independent precomputation.
+   * @param pi The permutation.
+   * @return The precomputation, valid while `pip.getEA()` is.
+   **/
+  std::shared_ptr<const PermPrecomp> get(const PermIndepPrecomp& pip,
+                                         const Permut& pi);
+
+  //! @brief The number of entries held in memory.
+  long size() const;
+
+  //! @brief Drop the entries held in memory (not those in the directory).
+  void clear();
+
+  //! @brief The file holding pi for the context and depth, or "" if there
+  //! is no directory.
+  std::string path(const PermIndepPrecomp& pip, const Permut& pi) const;
+
+private:
+  // (hash of the permutation, fingerprint of the context, depth)
+  using Key = std::tuple<unsigned long, unsigned long, long>;
+
+  std::string directory;
+  mutable std::mutex mutex;
+  std::map<Key, std::shared_ptr<const PermPrecomp>> entries;
 };
 
 /* EXAMPLE USE:
@@ -16,6 +16,9 @@
  * @brief Homomorphic Polynomial Evaluation
  */
 
+#include <functional>
+#include <mutex>
+#include <vector>
 #include <helib/Context.h>
 #include <helib/Ctxt.h>
 
@@ -36,16 +39,97 @@ void polyEval(Ctxt& ret, NTL::ZZX poly, const Ctxt& x, long k = 0);
 //! @param[in]  x    the point on which to evaluate
 void polyEval(Ctxt& ret, const NTL::Vec<Ctxt>& poly, const Ctxt& x);
 
+//! @brief Evaluate the same cleartext polynomial on many encrypted inputs
+//! @param[out] ret  to hold the return values, ret[i] = poly(xs[i])
+//! @param[in]  poly the degree-d polynomial to evaluate
+//! @param[in]  xs   the points on which to evaluate
+//! @param[in]  k    optional optimization parameter, as in polyEval
+//! The polynomial is reduced and the baby-step parameter chosen once for all
+//! the inputs, which are then evaluated in parallel.
+void polyEvalBatch(std::vector<Ctxt>& ret,
+                   const NTL::ZZX& poly,
+                   const std::vector<Ctxt>& xs,
+                   long k = 0);
+
+//! @brief Evaluate several polynomials on the same input, ret[j] = polys[j](x)
+//! @param[out] ret   the results, resized to polys.size()
+//! @param[in]  polys the polynomials to evaluate
+//! @param[in]  x     the point on which to evaluate
+//! @param[in]  k     optional optimization parameter, as in polyEval; by
+//! default chosen for the largest degree
+//! The powers x..x^k and x^k, x^{2k}, ... are computed once and shared by
+//! all the polynomials, so each one only adds its own scalar multiplications
+//! and the products of its recursion, e.g. for the activations of several
+//! channels of a layer computed from the same ciphertext.
+void polyEvalMany(std::vector<Ctxt>& ret,
+                  const std::vector<NTL::ZZX>& polys,
+                  const Ctxt& x,
+                  long k = 0);
+
+//! @name Chebyshev-basis evaluation (CKKS)
+//! For the approximations that CKKS needs (sigmoid, sign, inverse, ...)
+//! the Chebyshev basis is far better conditioned than the monomial one,
+//! so the same accuracy needs less precision and hence smaller moduli.
+//! A function on [a,b] is approximated by sum_i c_i T_i(y), where
+//! y = (2x-a-b)/(b-a) is the image of x in [-1,1].
+///@{
+
+//! @brief Map x from the interval [a,b] into [-1,1]
+double mapToChebyshevInterval(double x, double a, double b);
+
+//! @brief Map an encrypted x from [a,b] into [-1,1], an affine map that
+//! does not consume any levels
+void mapToChebyshevInterval(Ctxt& x, double a, double b);
+
+//! @brief The coefficients of the degree-d Chebyshev interpolant of f on
+//! [a,b], taken at the d+1 Chebyshev nodes. Returns a vector of size d+1.
+std::vector<double> chebyshevCoefficients(
+    const std::function<double(double)>& f,
+    long d,
+    double a = -1.0,
+    double b = 1.0);
+
+//! @brief Evaluate sum_i coeffs[i] T_i(y) on a cleartext y in [-1,1]
+double evalChebyshevSeries(const std::vector<double>& coeffs, double y);
+
+//! @brief Evaluate a Chebyshev series on an encrypted input in [-1,1]
+//! @param[out] ret    to hold the return value
+//! @param[in]  coeffs the coefficients c_0,...,c_d of sum_i c_i T_i(x)
+//! @param[in]  x      the point on which to evaluate, a CKKS ciphertext
+//! @param[in]  k      optional number of baby steps, a power of two,
+//! defaults to about sqrt(d)
+//! Uses baby-step/giant-step with T_1..T_k and T_k, T_2k, T_4k,...; the
+//! depth is ceil(log2(d+1)). The scalar terms are accumulated with
+//! multByConstant(double), which only changes the scaling factor, and the
+//! sums are multiplied by the giant steps only once they are complete.
+void chebyshevEval(Ctxt& ret,
+                   const std::vector<double>& coeffs,
+                   const Ctxt& x,
+                   long k = 0);
+
+//! @brief Evaluate a Chebyshev approximation of f on an encrypted x in
+//! [a,b]: a shortcut for mapping x into [-1,1] and calling chebyshevEval
+//! with coeffs = chebyshevCoefficients(f, d, a, b)
+void chebyshevEval(Ctxt& ret,
+                   const std::function<double(double)>& f,
+                   long d,
+                   const Ctxt& x,
+                   double a,
+                   double b);
+///@}
+
 // A useful helper class
 
 //! @brief Store powers of X, compute them dynamically as needed.
 // This implementation assumes that the size (# of powers) is determined
 // at initialization time, it is not hard to grow the std::vector as needed,
 // but not clear if there is any application that needs it.
+// The powers can be requested from several threads at once.
 class DynamicCtxtPowers
 {
 private:
-  std::vector<Ctxt> v; // A std::vector storing the powers themselves
+  std::vector<Ctxt> v;       // A std::vector storing the powers themselves
+  std::recursive_mutex mtx; // controls the computation of new powers
 
 public:
   DynamicCtxtPowers(const Ctxt& c, long nPowers)
@@ -62,6 +146,11 @@ public:
   //! @brief Returns the e'th power, computing it as needed
   Ctxt& getPower(long e); // must use e >= 1, else throws an exception
 
+  //! @brief Compute all the powers up to the e'th (all of them if e <= 0).
+  //! The powers X^{2^{i-1}+1}..X^{2^i} only depend on lower ones, so each
+  //! such range is computed in parallel.
+  void computePowers(long e = 0);
+
   //! dp.at(i) and dp[i] both return the i+1st power
   Ctxt& at(long i) { return getPower(i + 1); }
   Ctxt& operator[](long i) { return getPower(i + 1); }
@@ -70,6 +159,7 @@ public:
   long size() const { return v.size(); }
   bool isPowerComputed(long i)
   {
+    std::lock_guard<std::recursive_mutex> lock(mtx);
     return (i > 0 && i <= (long)v.size() && !v[i - 1].isEmpty());
   }
 };
@@ -136,6 +136,10 @@ class PowerfulDCRT
   // a vector of PowerfulConversion tables, one for each modulus
   NTL::Vec<PowerfulConversion> pConvVec;
 
+  // the same tables for each prime of the context, indexed like them, so a
+  // DoubleCRT is converted one row at a time
+  NTL::Vec<PowerfulConversion> dcrtConvVec;
+
   // product_bits[i] is the number of bits in the product of primes [0..i)
   NTL::Vec<long> product_bits;
 
@@ -155,7 +159,8 @@ public:
   const PowerfulConversion& getPConv(long i) const { return pConvVec.at(i); }
 
   // coefficients are reduced to the interval [-Q/2,Q/2], where
-  // Q = product of primes in dcrt.getIndexSet();
+  // Q = product of primes in dcrt.getIndexSet(). Each row of dcrt is
+  // converted modulo its own prime, and only the results are CRT-ed.
   void dcrtToPowerful(NTL::Vec<NTL::ZZ>& powerful, const DoubleCRT& dcrt) const;
 
   void ZZXtoPowerful(NTL::Vec<NTL::ZZ>& powerful, const NTL::ZZX& poly) const;
@@ -239,6 +239,25 @@ inline void addSpacesAroundChars(std::stringstream& ss, const std::string& s)
   }
 }
 
+/**
+ * @struct QueryCost
+ * @brief An estimate of the cost of evaluating a query on one database row.
+ * @note The masks of the query columns are computed separately and cost the
+ * same for all queries, they are not counted here.
+ **/
+struct QueryCost
+{
+  /**
+   * @brief Number of ciphertext-ciphertext multiplications.
+   **/
+  long multiplications = 0;
+
+  /**
+   * @brief Multiplicative depth.
+   **/
+  long depth = 0;
+};
+
 /**
  * @struct QueryType
  * @brief Structure containing all information required for an HE query.
@@ -299,6 +318,43 @@ struct QueryType
             bool isThereAnOR) :
       Fs(index_sets), mus(offsets), taus(weights), containsOR(isThereAnOR)
   {}
+
+  /**
+   * @brief Estimate the cost of evaluating the query on one database row:
+   * the product of the index sets, multiplied in a balanced tree, followed
+   * by the Fermat little theorem map to {0,1} if the query contains an OR.
+   * @param pPowR The plaintext modulus p^r.
+   * @return The estimated number of multiplications and depth.
+   **/
+  QueryCost estimateCost(long pPowR) const
+  {
+    QueryCost cost;
+    long n = Fs.size();
+    if (n > 1) {
+      cost.multiplications = n - 1;
+      cost.depth = NTL::NumBits(n - 1); // ceil(log2(n))
+    }
+    if (containsOR && pPowR > 2) {
+      // Ctxt::power(e) computes X^e = X^{e-k} * X^k, k the largest power
+      // of two smaller than e, with every power computed only once
+      long e = pPowR - 1;
+      std::unordered_set<long> computed{1};
+      std::stack<long> todo;
+      todo.push(e);
+      while (!todo.empty()) {
+        long f = todo.top();
+        todo.pop();
+        if (!computed.insert(f).second)
+          continue;
+        long k = 1L << (NTL::NumBits(f - 1) - 1);
+        cost.multiplications++;
+        todo.push(k);
+        todo.push(f - k);
+      }
+      cost.depth += NTL::NumBits(e - 1); // ceil(log2(e))
+    }
+    return cost;
+  }
 };
 
 /**
@@ -330,14 +386,17 @@ public:
   /**
    * @brief Function for building the `QueryType` object from the expression.
    * @param columns The total number of columns in the column set.
+   * @param optimize Whether to simplify the query before building it, see
+   * `simplifyClauses`. Optimized queries compute the same matches with
+   * fewer (or the same number of) multiplications.
    * @return The resultant `QueryType` object containing information relating to
    * the query.
    **/
-  QueryType build(long columns) const
+  QueryType build(long columns, bool optimize = false) const
   {
 
     // Convert the query to "type 1" by expanding out necessary ORs
-    vecvec expr = expandOr(query_str);
+    vecvec expr = expandOr(query_str, optimize);
     bool containsOR = false;
 
     vecvec Fs(expr.size());
@@ -467,7 +526,39 @@ private:
     std::cout << "\n";
   }
 
-  vecvec expandOr(const std::string& s) const
+  /**
+   * @brief Simplify a conjunction of OR clauses without changing its value:
+   * repeated columns are removed from each clause, repeated clauses are
+   * merged, and clauses that contain another clause are absorbed by it,
+   * since A AND (A OR B) = A. The remaining clauses are sorted by size.
+   * @param clauses The clauses to simplify, in place.
+   **/
+  static void simplifyClauses(vecvec& clauses)
+  {
+    for (auto& clause : clauses) {
+      std::sort(clause.begin(), clause.end());
+      clause.erase(std::unique(clause.begin(), clause.end()), clause.end());
+    }
+    std::sort(clauses.begin(),
+              clauses.end(),
+              [](const auto& a, const auto& b) {
+                return a.size() != b.size() ? a.size() < b.size() : a < b;
+              });
+    clauses.erase(std::unique(clauses.begin(), clauses.end()), clauses.end());
+
+    // Shorter clauses come first, so only those can absorb later ones
+    vecvec kept;
+    for (auto& clause : clauses) {
+      bool absorbed = std::any_of(kept.begin(), kept.end(), [&](const auto& k) {
+        return std::includes(clause.begin(), clause.end(), k.begin(), k.end());
+      });
+      if (!absorbed)
+        kept.push_back(std::move(clause));
+    }
+    clauses = std::move(kept);
+  }
+
+  vecvec expandOr(const std::string& s, bool optimize = false) const
   {
     std::stack<vecvec> convertStack;
 
@@ -483,6 +574,8 @@ private:
         convertStack.pop();
         auto& top = convertStack.top();
         top.insert(top.end(), op.begin(), op.end());
+        if (optimize)
+          simplifyClauses(top);
       } else if (!symbol.compare("||")) {
         // Cartesian-esque product
         auto op1 = convertStack.top();
@@ -499,6 +592,9 @@ private:
             prod.push_back(std::move(x));
           }
 
+        // Simplifying every intermediate result keeps the products small
+        if (optimize)
+          simplifyClauses(prod);
         convertStack.push(std::move(prod));
       } else {
         // Assume it is a number. But sanity check anyway.
@@ -15,6 +15,8 @@
  *  @brief Define some data structures to hold recryption data
  */
 
+#include <functional>
+#include <vector>
 #include <helib/NumbTh.h>
 
 namespace helib {
@@ -28,8 +30,60 @@ class EncryptedArray;
 class EvalMap;
 class ThinEvalMap;
 class PowerfulDCRT;
+class MatMul1DExec;
 class Context;
 class PubKey;
+class Ctxt;
+
+//! @brief The algorithms for the digit extraction step of recryption
+enum class DigitExtraction
+{
+  //! Pick the cheaper of the two below, by the degrees of their polynomials
+  AUTO,
+  //! Lift each digit with the degree-p digit polynomial (x^p for p=2,3)
+  LIFTING,
+  //! Chen and Han's lowest-digit-retain polynomials, evaluated with
+  //! Paterson-Stockmeyer; their depth grows with log(e*(p-1)) per digit
+  //! rather than with log(p) per digit and per lifting
+  DIGIT_RETAIN
+};
+
+//! @class CKKSRecryptData
+//! @brief The data used to bootstrap CKKS ciphertexts
+//!
+//! CKKS is bootstrapped as in Cheon, Han, Kim, Kim and Song, "Bootstrapping
+//! for Approximate Homomorphic Encryption" (Eurocrypt 2018). The ciphertext
+//! is brought down to a small modulus q0 and its parts are lifted to the
+//! full chain, which adds a multiple q0*I of small I to the polynomial it
+//! encrypts. coeffToSlot moves the coefficients to the slots, where I is
+//! removed with the scaled sine (K/2pi)sin(2pi x/K), evaluated as the
+//! imaginary part of exp(i y) for y = 2pi x/(K 2^squarings), by its Taylor
+//! series followed by repeated squaring. slotToCoeff moves the result back.
+//! The secret key must be sparse, so that I stays small.
+class CKKSRecryptData
+{
+public:
+  //! Bound on the coefficients of I
+  long overflowBound;
+
+  //! log2 of the ratio of K = q0/ratFactor to the plaintext magnitude
+  long kappa;
+
+  //! Degree of the Taylor series of exp(i y)
+  long taylorDegree;
+
+  //! Number of squarings that follow the Taylor series
+  long squarings;
+
+  //! The maps from the slots to the real coefficients [0, phi(m)/2) and
+  //! [phi(m)/2, phi(m)), each of them to the first phi(m)/2 slots
+  std::shared_ptr<const MatMul1DExec> coeffToSlot[2];
+
+  //! The maps back from the two halves of the coefficients to the slots
+  std::shared_ptr<const MatMul1DExec> slotToCoeff[2];
+
+  explicit CKKSRecryptData(const Context& context);
+};
 
 //! @class RecryptData
 //! @brief A structure to hold recryption-related data inside the Context
@@ -64,6 +118,14 @@ public:
   //! linPolys for unpacking the slots
   std::vector<NTL::ZZX> unpackSlotEncoding;
 
+  //! The digit extraction algorithm used by reCrypt and thinReCrypt. It is
+  //! not serialized with the context.
+  DigitExtraction digitExtraction = DigitExtraction::AUTO;
+
+  //! The bootstrapping data of CKKS, which has none of the above but
+  //! mvec and skHwt
+  std::shared_ptr<const CKKSRecryptData> ckks = nullptr;
+
   RecryptData()
   {
     skHwt = 0;
@@ -72,12 +134,18 @@ public:
     alsoThick = false;
   }
 
-  //! Initialize the recryption data in the context
+  //! Initialize the recryption data in the context. If maps is not null,
+  //! the linear maps are read from it (see writeMapsTo) rather than built.
   void init(const Context& context,
             const NTL::Vec<long>& mvec_,
             bool enableThick, /*init linear transforms for non-thin*/
             bool build_cache = false,
-            bool minimal = false);
+            bool minimal = false,
+            std::istream* maps = nullptr);
+
+  //! Write out the linear maps, including the constants upgraded to
+  //! DoubleCRT, so that init can read them back instead of building them
+  void writeMapsTo(std::ostream& str) const;
 
   bool operator==(const RecryptData& other) const;
   bool operator!=(const RecryptData& other) const
@@ -101,12 +169,135 @@ public:
   //! linear maps
   std::shared_ptr<const ThinEvalMap> coeffToSlot, slotToCoeff;
 
-  //! Initialize the recryption data in the context
+  //! Initialize the recryption data in the context, reading the linear
+  //! maps from maps if it is not null
   void init(const Context& context,
             const NTL::Vec<long>& mvec_,
             bool alsoThick, /*init linear transforms also for non-thin*/
             bool build_cache = false,
-            bool minimal = false);
+            bool minimal = false,
+            std::istream* maps = nullptr);
+
+  //! Write out the linear maps, those of RecryptData first
+  void writeMapsTo(std::ostream& str) const;
+};
+
+//! @brief The measurements of one stage of reCrypt or thinReCrypt
+struct RecryptStageReport
+{
+  //! The stage, one of "preProcess", "linearTransform1",
+  //! "extractDigitsPacked" and "linearTransform2" for reCrypt, or
+  //! "modDown", "slotToCoeff", "bootKeySwitch", "coeffToSlot" and
+  //! "extractDigitsThin" for thinReCrypt, or "modRaise", "coeffToSlot",
+  //! "evalMod" and "slotToCoeff" for both of them on CKKS
+  const char* stage = nullptr;
+  //! The number of ciphertexts that went through the stage together
+  long ciphertexts = 0;
+  //! Elapsed time in seconds
+  double wallTime = 0;
+  //! Process CPU time in seconds, summed over all the threads
+  double cpuTime = 0;
+  //! Key-switching operations and single-prime NTTs run by the stage
+  long keySwitches = 0;
+  long ntts = 0;
+  //! log2 of the largest noise bound over the ciphertexts, before and after
+  double noiseBefore = 0;
+  double noiseAfter = 0;
+  //! Smallest capacity (in bits) over the ciphertexts, before and after
+  double capacityBefore = 0;
+  double capacityAfter = 0;
+};
+
+std::ostream& operator<<(std::ostream& str, const RecryptStageReport& report);
+
+//! @brief Hand every stage of reCrypt and thinReCrypt to reporter, as the
+//! stage completes; an empty reporter (the default) turns the reports off.
+//! @note The counts come from the process-wide fhe_ops, so they include
+//! the work of other threads that run homomorphic operations meanwhile.
+//! Set the reporter before recrypting, not concurrently with it.
+void setRecryptReporter(
+    std::function<void(const RecryptStageReport&)> reporter);
+
+/**
+ * @class BootstrapPolicy
+ * @brief When to recrypt, decided from the state of the ciphertexts rather
+ * than by hand-tuned calls
+ *
+ * A ciphertext needs recryption once its capacity drops below
+ * threshold(ctxt) = minLevels * ctxt.bitsPerMultiplication() + minBits,
+ * i.e. once it could no longer take minLevels more levels of
+ * multiplication with minBits to spare. As the threshold is computed from
+ * the noise of the ciphertext, it does not have to be retuned when the
+ * parameters change.
+ *
+ * apply() recrypts what needs it right away. The ciphertexts of a
+ * std::vector that need it are recrypted together, by the batched
+ * reCrypt or thinReCrypt. A caller that handles its ciphertexts one at a
+ * time can defer() them instead, and flush() recrypts all the deferred
+ * ones that need it in a single batch.
+ * @note THIN is the same as THICK for CKKS. The deferred ciphertexts are
+ * held by pointer, and must not be moved or destroyed before the flush.
+ * A policy is not thread-safe.
+ **/
+class BootstrapPolicy
+{
+public:
+  enum class Method
+  {
+    THICK, // reCrypt, for ciphertexts that pack arbitrary slots
+    THIN   // thinReCrypt, for ciphertexts whose slots hold constants
+  };
+
+  //! The default value of minBits
+  static constexpr long DEFAULT_MIN_BITS = 10;
+
+  BootstrapPolicy(const PubKey& pubKey,
+                  Method method,
+                  long minLevels,
+                  long minBits = DEFAULT_MIN_BITS);
+
+  //! @brief The capacity in bits below which ctxt needs recryption
+  double threshold(const Ctxt& ctxt) const;
+
+  //! @brief Does ctxt need recryption? Never true for an empty ciphertext
+  bool needsRecryption(const Ctxt& ctxt) const;
+
+  //! @brief Recrypt ctxt if it needs it. Returns whether it was recrypted
+  bool apply(Ctxt& ctxt) const;
+
+  //! @brief Recrypt, in one batch, the ciphertexts that need it. Returns
+  //! how many were recrypted
+  long apply(std::vector<Ctxt>& ctxts) const;
+
+  //! @brief Leave ctxt for the next flush()
+  void defer(Ctxt& ctxt);
+
+  //! @brief Recrypt, in one batch, the deferred ciphertexts that need it
+  //! (each one once), and forget all of them. Returns how many were
+  //! recrypted
+  long flush();
+
+  //! @brief The number of deferred ciphertexts
+  long pending() const { return deferred.size(); }
+
+  //! @brief The number of ciphertexts this policy has recrypted
+  long recrypted() const { return nRecrypted; }
+
+  const PubKey& getPubKey() const { return pubKey; }
+  Method getMethod() const { return method; }
+  long getMinLevels() const { return minLevels; }
+  long getMinBits() const { return minBits; }
+
+private:
+  const PubKey& pubKey;
+  Method method;
+  long minLevels;
+  long minBits;
+  std::vector<Ctxt*> deferred;
+  mutable long nRecrypted = 0;
+
+  // Recrypt the ciphertexts that need it among *ctxts[i], together
+  long recryptNeeded(const std::vector<Ctxt*>& ctxts) const;
 };
 
 #define HELIB_MIN_CAP_FRAC (2.0 / 3.0)
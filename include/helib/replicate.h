@@ -86,6 +86,11 @@ public:
  * based only on the heuristic, which will introduce noise corresponding to
  * O(log log n) levels of recursion, but still gives an algorithm that
  * theoretically runs in time O(n).
+ *
+ * The two rotations of each step of the recursion are hoisted (see
+ * `Ctxt::hoistedAutomorphs`), and the blocks of a dimension are prepared in
+ * parallel, as many at a time as there are NTL threads. The handler is still
+ * called from the calling thread, one replica at a time and in order.
  **/
 void replicateAll(const EncryptedArray& ea,
                   const Ctxt& ctxt,
@@ -166,27 +171,39 @@ public:
 };
 
 class RepAuxDim
-{ // two tables per dimension
+{ // four tables per dimension
 private:
-  std::vector<std::vector<CopiedPtr<FatEncodedPtxt>>> _tab, _tab1;
+  typedef std::vector<std::vector<CopiedPtr<FatEncodedPtxt>>> Table;
+  Table _tab, _tab1, _tabRot, _tabRotC;
 
-public:
-  CopiedPtr<FatEncodedPtxt>& tab(long d, long i)
+  static CopiedPtr<FatEncodedPtxt>& entry(Table& table, long d, long i)
   {
-    if (d >= lsize(_tab))
-      _tab.resize(d + 1);
-    if (i >= lsize(_tab[d]))
-      _tab[d].resize(i + 1);
-    return _tab[d][i];
+    if (d >= lsize(table))
+      table.resize(d + 1);
+    if (i >= lsize(table[d]))
+      table[d].resize(i + 1);
+    return table[d][i];
   }
 
+public:
+  CopiedPtr<FatEncodedPtxt>& tab(long d, long i) { return entry(_tab, d, i); }
+
   CopiedPtr<FatEncodedPtxt>& tab1(long d, long i)
   {
-    if (d >= lsize(_tab1))
-      _tab1.resize(d + 1);
-    if (i >= lsize(_tab1[d]))
-      _tab1[d].resize(i + 1);
-    return _tab1[d][i];
+    return entry(_tab1, d, i);
+  }
+
+  // The mask of tab(d, i), and its complement, rotated to go with the
+  // rotations of the ciphertext (rather than of the masked one) that make
+  // the two halves of the recursion
+  CopiedPtr<FatEncodedPtxt>& tabRot(long d, long i)
+  {
+    return entry(_tabRot, d, i);
+  }
+
+  CopiedPtr<FatEncodedPtxt>& tabRotC(long d, long i)
+  {
+    return entry(_tabRotC, d, i);
   }
 };
 //! @endcond
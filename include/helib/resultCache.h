@@ -0,0 +1,170 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_RESULTCACHE_H
+#define HELIB_RESULTCACHE_H
+/**
+ * @file resultCache.h
+ * @brief Memoizing deterministic operations on stored ciphertexts.
+ *
+ * A server applying the same public transform (a fixed matrix, a
+ * replication, `mapTo01`) to the same stored ciphertexts for many requests
+ * can keep the results, and look them up instead of computing them again.
+ **/
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include <helib/Ctxt.h>
+#include <helib/keys.h>
+
+namespace helib {
+
+//! @brief The counts of a `ResultCache` since its construction.
+struct ResultCacheStats
+{
+  long hits = 0;      // lookups found in memory
+  long diskHits = 0;  // lookups read back from the directory
+  long misses = 0;    // lookups found nowhere
+  long stores = 0;    // results stored
+  long evictions = 0; // results dropped from memory to fit in the budget
+};
+
+/**
+ * @class ResultCache
+ * @brief A bounded, thread-safe cache of the results of operations on
+ * ciphertexts, optionally backed by a directory.
+ *
+ * A result is keyed by its input, the name of the operation and its
+ * parameters. The input is named either by `contentId`, a cryptographic
+ * digest of its serialization, or by a stable id the caller gives it (say,
+ * the name of a database column), which saves hashing it. A caller that
+ * gives its own ids must keep them distinct across the inputs it caches.
+ * The caller must make sure that the operation is deterministic given its
+ * key: the same input, public key and parameters always give the same
+ * result.
+ *
+ * The results are held in memory in the compact format of
+ * `Ctxt::writeCompact`, keeping all their capacity, and the least recently
+ * used ones are dropped when they take more than the budget. If a
+ * directory is given, every result is also written there, and the results
+ * not in memory are read back from it, in this or a later process. The
+ * directory is not bounded.
+ **/
+class ResultCache
+{
+public:
+  /**
+   * @param pubKey The key of the ciphertexts, and of the results.
+   * @param budget The bytes of results kept in memory.
+   * @param directory Where the results are stored, none if empty.
+   **/
+  ResultCache(const PubKey& pubKey,
+              long budget,
+              const std::string& directory = "");
+
+  ResultCache(const ResultCache&) = delete;
+  ResultCache& operator=(const ResultCache&) = delete;
+
+  //! @brief A name for ctxt, the SHA-256 based digest of its serialization
+  //! (64 hexadecimal digits), so that inputs cannot be made to collide
+  static std::string contentId(const Ctxt& ctxt);
+
+  /**
+   * @brief Look a result up.
+   * @param out Set to the result, if found.
+   * @param input The name of the input, see contentId.
+   * @param operation The name of the operation.
+   * @param params Its parameters.
+   * @return Whether the result was found.
+   **/
+  bool lookup(Ctxt& out,
+              const std::string& input,
+              const std::string& operation,
+              const std::string& params = "");
+
+  //! @brief Store result under (input, operation, params), as in lookup
+  void store(const Ctxt& result,
+             const std::string& input,
+             const std::string& operation,
+             const std::string& params = "");
+
+  /**
+   * @brief ctxt = op(ctxt), looked up if it was computed before, else
+   * computed and stored.
+   * @param ctxt The input, then the result.
+   * @param operation The name of op.
+   * @param params The parameters of op.
+   * @param op The operation, in place.
+   * @param inputId A stable name for ctxt, or empty to use contentId(ctxt).
+   * @return Whether the result was found.
+   *
+   * Threads missing on the same key at once all run op.
+   **/
+  bool apply(Ctxt& ctxt,
+             const std::string& operation,
+             const std::string& params,
+             const std::function<void(Ctxt&)>& op,
+             const std::string& inputId = "");
+
+  //! @brief Change the budget, dropping results to fit in it
+  void setBudget(long budget);
+  long getBudget() const;
+
+  //! @brief The bytes of the results held in memory
+  long residentBytes() const;
+
+  //! @brief The number of results held in memory
+  long size() const;
+
+  //! @brief Drop the results held in memory (not those in the directory)
+  void clear();
+
+  ResultCacheStats stats() const;
+
+  //! @brief The file holding the result of the key, or "" if there is no
+  //! directory
+  std::string path(const std::string& input,
+                   const std::string& operation,
+                   const std::string& params = "") const;
+
+private:
+  // (input, operation, params)
+  using Key = std::tuple<std::string, std::string, std::string>;
+
+  struct Entry
+  {
+    std::string bytes; // the result, as written by writeCompact
+    std::list<Key>::iterator position;
+  };
+
+  const PubKey& pubKey;
+  const std::string directory;
+  const unsigned long keyFingerprint; // names the files, with the key
+  mutable std::mutex mutex;
+  long budget;
+  long bytes = 0;
+  std::map<Key, Entry> entries;
+  std::list<Key> lru; // most recent first
+  ResultCacheStats counts;
+
+  std::string path(const Key& key) const;
+  // With the mutex held
+  void insertLocked(const Key& key, std::string bytes);
+  void trimLocked();
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_RESULTCACHE_H
@@ -13,12 +13,20 @@
 #define HELIB_SAMPLE_H
 /**
  * @file sample.h - implementing various sampling routines
+ *
+ * The samplers of zzX polynomials and of continuous Gaussians take a key
+ * from their PRG, and make their samples in blocks of 1024 from the
+ * substreams of that key, in parallel. For a given state of the PRG the
+ * samples therefore do not depend on the number of threads. The PRG is
+ * NTL's current stream of the calling thread (PRG::current()) unless one is
+ * passed in.
  **/
 #include <vector>
 #include <NTL/xdouble.h>
 #include <NTL/ZZX.h>
 #include <NTL/ZZ_pX.h>
 #include <helib/zzX.h>
+#include <helib/NumbTh.h>
 
 namespace helib {
 
@@ -28,52 +36,98 @@ const int HELIB_GAUSS_TRUNC = 8;
 //! Sample a degree-(n-1) poly, with -1/0/+1 coefficients.
 //! Each coefficients is +-1 with probability prob/2 each,
 //! and 0 with probability 1-prob. By default, pr[nonzero]=1/2.
-void sampleSmall(zzX& poly, long n, double prob = 0.5);
-void sampleSmall(NTL::ZZX& poly, long n, double prob = 0.5);
+void sampleSmall(zzX& poly,
+                 long n,
+                 double prob = 0.5,
+                 PRG& prg = PRG::current());
+void sampleSmall(NTL::ZZX& poly,
+                 long n,
+                 double prob = 0.5,
+                 PRG& prg = PRG::current());
 
 //! Sample a degree-(n-1) poly as above, with only Hwt nonzero coefficients
-void sampleHWt(zzX& poly, long n, long Hwt = 100);
-void sampleHWt(NTL::ZZX& poly, long n, long Hwt = 100);
+void sampleHWt(zzX& poly, long n, long Hwt = 100, PRG& prg = PRG::current());
+void sampleHWt(NTL::ZZX& poly,
+               long n,
+               long Hwt = 100,
+               PRG& prg = PRG::current());
 
 //! Sample polynomials with Gaussian coefficients.
-void sampleGaussian(zzX& poly, long n, double stdev);
+//! @note The coefficients are discrete Gaussians of parameter stdev
+//! (truncated at HELIB_GAUSS_TRUNC standard deviations) sampled in constant
+//! time from a table, when `HELIB_GAUSS_TRUNC * stdev <= 128`. For larger
+//! stdev they are rounded continuous Gaussians.
+void sampleGaussian(zzX& poly,
+                    long n,
+                    double stdev,
+                    PRG& prg = PRG::current());
 
 //! Sample a degree-(n-1) ZZX, with coefficients uniform in [-B,B]
-void sampleUniform(zzX& poly, long n, long B = 100);
-void sampleUniform(NTL::ZZX& poly, long n, const NTL::ZZ& B = NTL::ZZ(100L));
+void sampleUniform(zzX& poly,
+                   long n,
+                   long B = 100,
+                   PRG& prg = PRG::current());
+void sampleUniform(NTL::ZZX& poly,
+                   long n,
+                   const NTL::ZZ& B = NTL::ZZ(100L),
+                   PRG& prg = PRG::current());
 
 //! Choose a vector of continuous Gaussians
-void sampleGaussian(std::vector<double>& dvec, long n, double stdev);
+void sampleGaussian(std::vector<double>& dvec,
+                    long n,
+                    double stdev,
+                    PRG& prg = PRG::current());
 
 class Context;
 class PAlgebra;
 // Same as above, but sample mod X^m-1 and then reduce mod Phi_m(X)
-double sampleHWt(zzX& poly, const Context& context, long Hwt = 100);
-double sampleHWtBounded(zzX& poly, const Context& context, long Hwt = 100);
+double sampleHWt(zzX& poly,
+                 const Context& context,
+                 long Hwt = 100,
+                 PRG& prg = PRG::current());
+double sampleHWtBounded(zzX& poly,
+                        const Context& context,
+                        long Hwt = 100,
+                        PRG& prg = PRG::current());
 
 double sampleHWtBoundedEffectiveBound(const Context& context, long Hwt = 100);
 // This just returns the effective bound used by sampleHWt bounded
 
 // Return value is high-probability bound on L-infty norm of canonical embedding
-double sampleSmall(zzX& poly, const Context& context);
+double sampleSmall(zzX& poly,
+                   const Context& context,
+                   PRG& prg = PRG::current());
 // Same as above, but ensure the result is not too much larger than typical
-double sampleSmallBounded(zzX& poly, const Context& context);
+double sampleSmallBounded(zzX& poly,
+                          const Context& context,
+                          PRG& prg = PRG::current());
 
 // Return value is high-probability bound on L-infty norm of canonical embedding
-double sampleGaussian(zzX& poly, const Context& context, double stdev);
+double sampleGaussian(zzX& poly,
+                      const Context& context,
+                      double stdev,
+                      PRG& prg = PRG::current());
 // Same as above, but ensure the result is not too much larger than typical
-double sampleGaussianBounded(zzX& poly, const Context& context, double stdev);
+double sampleGaussianBounded(zzX& poly,
+                             const Context& context,
+                             double stdev,
+                             PRG& prg = PRG::current());
 NTL::xdouble sampleGaussianBounded(NTL::ZZX& poly,
                                    const Context& context,
-                                   NTL::xdouble stdev);
+                                   NTL::xdouble stdev,
+                                   PRG& prg = PRG::current());
 
 // Return value times stdev is the bound used in sampleGaussianBounded
 double sampleGaussianBoundedEffectiveBound(const Context& context);
 
-double sampleUniform(zzX& poly, const Context& context, long B = 100);
+double sampleUniform(zzX& poly,
+                     const Context& context,
+                     long B = 100,
+                     PRG& prg = PRG::current());
 NTL::xdouble sampleUniform(NTL::ZZX& poly,
                            const Context& context,
-                           const NTL::ZZ& B = NTL::ZZ(100L));
+                           const NTL::ZZ& B = NTL::ZZ(100L),
+                           PRG& prg = PRG::current());
 
 //! Helper functions, return a bound B such that for random noise
 //! terms we have Pr[|canonicalEmbed(noise)|_{\infty} > B] < epsilon.
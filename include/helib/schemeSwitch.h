@@ -0,0 +1,89 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_SCHEMESWITCH_H
+#define HELIB_SCHEMESWITCH_H
+/**
+ * @file schemeSwitch.h
+ * @brief Moving ciphertexts between a CKKS context and a BGV context with
+ * the same m.
+ **/
+#include <helib/Ctxt.h>
+#include <helib/keys.h>
+
+namespace helib {
+
+/**
+ * @class SchemeSwitch
+ * @brief Switches ciphertexts from one scheme to the other, under the key
+ * of the other context.
+ *
+ * The two contexts share the ring Z[X]/Phi_m(X), and a ciphertext keeps its
+ * plaintext polynomial mu(X): its integer coefficients, in CKKS, are those of
+ * the polynomial divided by the scale (rounded), and in BGV those of the
+ * plaintext mod p^r. The ciphertext is scaled from the primes of one context
+ * to those of the other, then switched from the key of its own context to
+ * that of the target with a key-switching matrix of the target public key,
+ * which `addKey` generates.
+ *
+ * What the slots hold is not kept: CKKS and BGV place mu(X) in their slots
+ * differently. Moving slots across takes the linear map from the slots to
+ * the coefficients on the source side (e.g. a `MatMulFull`) and its inverse
+ * on the target side; with messages already placed in the coefficients,
+ * nothing else is needed.
+ *
+ * From CKKS, the BGV ciphertext has about as many bits of capacity as the
+ * CKKS ciphertext had bits of precision, i.e. log2(scale / noise), and mu
+ * must be correctly rounded. From BGV, the CKKS ciphertext is over all the
+ * ciphertext primes with scale Q / p^r, so it keeps about log2(p^r / |mu|)
+ * bits of capacity, enough for additions and small constants.
+ **/
+class SchemeSwitch
+{
+public:
+  /**
+   * @brief Add the secret key of fromKey to toKey, with the matrix that
+   * switches from it to the first key of toKey.
+   * @param toKey The secret key of the target context.
+   * @param fromKey The secret key of the source context, with the same m.
+   * @return The ID of the secret key of fromKey among the keys of toKey,
+   * the fromKeyID of the SchemeSwitch objects of toKey.
+   **/
+  static long addKey(SecKey& toKey, const SecKey& fromKey);
+
+  //! @brief Switches to toKey, the key of the target context, from its key
+  //! fromKeyID as returned by addKey
+  SchemeSwitch(const PubKey& toKey, long fromKeyID);
+
+  /**
+   * @brief out = in, switched to the target scheme.
+   * @param out A ciphertext under getPubKey().
+   * @param in A ciphertext of the other context, under its first key.
+   * @param mag From BGV, a bound on the slots of mu (its canonical
+   * embedding), which becomes the ptxtMag of out; it must be below about
+   * p^r / 2. Not used from CKKS, where the ptxtMag of in bounds mu.
+   * @throw LogicError if in has too little capacity, or from CKKS too little
+   * precision, for the switch.
+   **/
+  void apply(Ctxt& out, const Ctxt& in, double mag = -1) const;
+
+  const PubKey& getPubKey() const { return pubKey; }
+  long getFromKeyID() const { return fromKeyID; }
+
+private:
+  const PubKey& pubKey;
+  long fromKeyID;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_SCHEMESWITCH_H
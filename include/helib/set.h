@@ -14,6 +14,7 @@
 #define HELIB_SET_H
 
 #include <helib/SumRegister.h>
+#include <helib/EncryptedArray.h>
 #include <NTL/BasicThreadPool.h>
 
 namespace helib {
@@ -54,22 +55,47 @@ inline void binSumReduction(std::vector<TXT>& ctxtArray)
   }
 }
 
+namespace detail {
+
+// n copies of x. Copies of a ciphertext share its rows, copy-on-write, so
+// they cost nothing here: a row is copied at its first change (by the thread
+// that works on the copy), or never if the copy is overwritten whole
+template <typename TXT>
+inline std::vector<TXT> sharedCopies(const TXT& x, long n)
+{
+  return std::vector<TXT>(n, x);
+}
+
+inline std::vector<Ctxt> sharedCopies(const Ctxt& x, long n)
+{
+  std::vector<Ctxt> copies;
+  copies.reserve(n);
+  for (long i = 0; i < n; ++i)
+    copies.emplace_back(SharedCopy, x);
+  return copies;
+}
+
+} // namespace detail
+
 /**
- * @brief Given two sets, calculates and returns the set intersection.
+ * @brief Given a query set and a server set, calculates a mask of {0,1} where
+ * 1 signifies a query element that is in the server set and 0 otherwise.
  * @tparam TXT type of the query set. Must be a `Ptxt` or `Ctxt`.
  * @param query The query set of type `TXT` where the elements of the set are
  * held in the slots.
  * @param server_set The server set. A vector of integer polynomials.
- * @return A set of the same size as `query` holding the elements in the
- * intersecting set.
+ * @return The mask, of the same size as `query`.
+ * @note The masks of disjoint parts of the server set add up to the mask of
+ * their union, so the server set can be split over several shards, see
+ * `mergeSetIntersection`.
  **/
 template <typename TXT>
-inline TXT calculateSetIntersection(const TXT& query,
-                                    const std::vector<NTL::ZZX>& server_set)
+inline TXT calculateSetMatches(const TXT& query,
+                               const std::vector<NTL::ZZX>& server_set)
 {
   long availableThreads =
       std::min(NTL::AvailableThreads(), long(server_set.size()));
-  std::vector<TXT> interResult(availableThreads, query);
+  std::vector<TXT> interResult = detail::sharedCopies(query, availableThreads);
 
   NTL::PartitionInfo pinfo(server_set.size());
 
@@ -97,7 +123,224 @@ inline TXT calculateSetIntersection(const TXT& query,
 
   // Final binary sum to add the results of the sum registers
   binSumReduction<TXT>(interResult);
-  return interResult.at(0) *= query;
+  return interResult.at(0);
+}
+
+namespace detail {
+
+inline void shiftSlots(Ctxt& ctxt, long k)
+{
+  ctxt.getContext().getEA().shift(ctxt, k);
+}
+
+template <typename Scheme>
+inline void shiftSlots(Ptxt<Scheme>& ptxt, long k)
+{
+  ptxt.shift(k);
+}
+
+// The mask of the first count * width slots
+inline Ptxt<BGV> blockMask(const Context& context, long width, long count)
+{
+  std::vector<long> keep(context.getEA().size(), 0);
+  for (long i = 0; i < count * width; ++i)
+    keep[i] = 1;
+  return Ptxt<BGV>(context, keep);
+}
+
+// Copy the first width slots of txt, which is zero elsewhere, to the blocks
+// 1, ..., count-1 of width slots (and maybe some of the following ones).
+template <typename TXT>
+inline void replicateBlocks(TXT& txt, long width, long count)
+{
+  for (long covered = 1; covered < count; covered *= 2) {
+    TXT shifted(txt);
+    shiftSlots(shifted, covered * width);
+    txt += shifted;
+  }
+}
+
+// Add the blocks 0, ..., count-1 of width slots up into block 0, following
+// the bits of count, with at most 2 log(count) shifts. The slots beyond
+// count * width are not read.
+template <typename TXT>
+inline void foldBlocks(TXT& txt, long width, long count)
+{
+  std::unique_ptr<TXT> result;
+  TXT power(txt); // the sum of the 2^i blocks from block 0 at step i
+  long offset = 0;
+  for (long i = 0; (1L << i) <= count; ++i) {
+    if ((count >> i) & 1) {
+      TXT term(power);
+      shiftSlots(term, -offset * width);
+      if (result)
+        *result += term;
+      else
+        result = std::make_unique<TXT>(std::move(term));
+      offset += 1L << i;
+    }
+    if ((2L << i) <= count) {
+      TXT shifted(power);
+      shiftSlots(shifted, -(1L << i) * width);
+      power += shifted;
+    }
+  }
+  txt = std::move(*result);
+}
+
+} // namespace detail
+
+/**
+ * @brief Same as `calculateSetMatches` above for a query of width elements,
+ * several server elements being compared at once, which are read one by one
+ * from a source.
+ * @tparam TXT type of the query set. Must be a `Ptxt` or `Ctxt`.
+ * @tparam Source A callable taking a `NTL::ZZX&`, which sets it to the next
+ * element of the server set and returns true, or returns false when the
+ * server set is exhausted.
+ * @param query The query set, whose elements are held in its first width
+ * slots. The other slots are ignored.
+ * @param width The number of elements of the query set.
+ * @param next The source of the server set.
+ * @return The mask, in the first width slots. The other slots are zero.
+ *
+ * The query is replicated to the ea.size() / width blocks of width slots
+ * (with log of that many shifts), and each block is compared to a different
+ * server element. An element is then compared to the whole query set in a
+ * fraction of a `mapTo01`, instead of a whole one. The blocks are added up
+ * into the first one at the end. The server set is read a pack of blocks
+ * per thread at a time, and the packs of a round are compared in parallel,
+ * so a server set kept in storage is streamed through in bounded memory.
+ **/
+template <typename TXT, typename Source>
+inline TXT streamSetMatches(const TXT& query, long width, Source&& next)
+{
+  const Context& context = query.getContext();
+  const EncryptedArray& ea = context.getEA();
+  long nslots = ea.size();
+  assertTrue<InvalidArgument>(width > 0 && width <= nslots,
+                              "The query does not fit in the slots");
+  long blocks = nslots / width;
+
+  TXT replicated(query);
+  replicated *= detail::blockMask(context, width, 1);
+  detail::replicateBlocks(replicated, width, blocks);
+
+  long round = NTL::AvailableThreads() * blocks;
+  std::vector<NTL::ZZX> elements;
+  NTL::ZZX element;
+  std::unique_ptr<TXT> total;
+  bool more = true;
+  while (more) {
+    elements.clear();
+    while (long(elements.size()) < round && (more = next(element)))
+      elements.push_back(element);
+    long count = elements.size();
+    long packs = (count + blocks - 1) / blocks;
+    if (packs == 0)
+      break;
+
+    std::vector<TXT> indicators = detail::sharedCopies(replicated, packs);
+    NTL_EXEC_RANGE(packs, first, last)
+    for (long i = first; i < last; ++i) {
+      long begin = i * blocks;
+      long used = std::min(blocks, count - begin);
+      std::vector<NTL::ZZX> pack(nslots);
+      for (long j = 0; j < used; ++j)
+        for (long k = 0; k < width; ++k)
+          pack[j * width + k] = elements[begin + j];
+
+      indicators[i] -= Ptxt<BGV>(context, pack);
+      mapTo01(ea, indicators[i]);
+      indicators[i].negate();
+      indicators[i].addConstant(NTL::ZZX(1L));
+      // The blocks of a partial pack past its elements compared to zero
+      if (used < blocks)
+        indicators[i] *= detail::blockMask(context, width, used);
+    }
+    NTL_EXEC_RANGE_END
+
+    binSumReduction<TXT>(indicators);
+    if (total)
+      *total += indicators.at(0);
+    else
+      total = std::make_unique<TXT>(std::move(indicators.at(0)));
+  }
+
+  if (!total) {
+    // No server elements, and no matches
+    replicated *= detail::blockMask(context, width, 0);
+    return replicated;
+  }
+  detail::foldBlocks(*total, width, blocks);
+  *total *= detail::blockMask(context, width, 1);
+  return std::move(*total);
+}
+
+/**
+ * @brief Same as `streamSetMatches` with the server set in memory.
+ **/
+template <typename TXT>
+inline TXT calculateSetMatches(const TXT& query,
+                               long width,
+                               const std::vector<NTL::ZZX>& server_set)
+{
+  std::size_t i = 0;
+  return streamSetMatches(query, width, [&](NTL::ZZX& element) {
+    if (i == server_set.size())
+      return false;
+    element = server_set[i++];
+    return true;
+  });
+}
+
+/**
+ * @brief Given two sets, calculates and returns the set intersection.
+ * @tparam TXT type of the query set. Must be a `Ptxt` or `Ctxt`.
+ * @param query The query set of type `TXT` where the elements of the set are
+ * held in the slots.
+ * @param server_set The server set. A vector of integer polynomials.
+ * @return A set of the same size as `query` holding the elements in the
+ * intersecting set.
+ **/
+template <typename TXT>
+inline TXT calculateSetIntersection(const TXT& query,
+                                    const std::vector<NTL::ZZX>& server_set)
+{
+  return calculateSetMatches(query, server_set) *= query;
+}
+
+/**
+ * @brief Same as `calculateSetIntersection` above for a query of width
+ * elements, see `streamSetMatches`.
+ **/
+template <typename TXT>
+inline TXT calculateSetIntersection(const TXT& query,
+                                    long width,
+                                    const std::vector<NTL::ZZX>& server_set)
+{
+  return calculateSetMatches(query, width, server_set) *= query;
+}
+
+/**
+ * @brief Given the results of `calculateSetMatches` on disjoint parts of a
+ * server set, calculates the intersection of the query with their union.
+ * @tparam TXT type of the query set. Must be a `Ptxt` or `Ctxt`.
+ * @param query The query set of type `TXT` where the elements of the set are
+ * held in the slots.
+ * @param partials The masks computed on each part of the server set.
+ * @return A set of the same size as `query` holding the elements in the
+ * intersecting set.
+ * @note This function is destructive on `partials`. If the partial masks were
+ * sent with `Ctxt::writeCompact`, they must keep enough capacity for the
+ * final multiplication by `query`.
+ **/
+template <typename TXT>
+inline TXT mergeSetIntersection(const TXT& query, std::vector<TXT>& partials)
+{
+  assertFalse<InvalidArgument>(partials.empty(), "No partial results given");
+  binSumReduction<TXT>(partials);
+  return partials.at(0) *= query;
 }
 
 } // namespace helib
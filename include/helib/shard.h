@@ -0,0 +1,113 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_SHARD_H
+#define HELIB_SHARD_H
+
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include <helib/Ctxt.h>
+#include <helib/Matrix.h>
+
+// This code is in flux and should be considered very alpha.
+// Not recommended for public use.
+
+/**
+ * @file shard.h
+ * @brief Splitting a `Database` (or a server set) over several nodes.
+ *
+ * Each node holds the rows of one shard and evaluates `contains` or
+ * `getScore` on them as a `Database` of its own. The per-row results are sent
+ * back as a `ShardResult`, in the compact ciphertext format, and merged by
+ * `mergeShardResults`. For set intersection, see `calculateSetMatches` and
+ * `mergeSetIntersection` in `set.h`.
+ **/
+
+namespace helib {
+
+/**
+ * @brief The rows held by one of several shards of a database.
+ * @param rows The number of rows of the database.
+ * @param shards The number of shards.
+ * @param index The index of the shard, between `0` and `shards - 1`.
+ * @return The range `[first, last)` of rows of shard `index`.
+ * @note The rows are split in order and as evenly as possible.
+ **/
+std::pair<long, long> shardRows(long rows, long shards, long index);
+
+/**
+ * @brief Returns the rows of a database matrix held by one of several shards.
+ * @tparam TXT The type of the entries of the database.
+ * @param data The matrix holding the whole database.
+ * @param shards The number of shards.
+ * @param index The index of the shard, between `0` and `shards - 1`.
+ * @return A matrix with the rows `shardRows(data.dims(0), shards, index)`.
+ **/
+template <typename TXT>
+inline Matrix<TXT> shardOf(const Matrix<TXT>& data, long shards, long index)
+{
+  auto [first, last] = shardRows(data.dims(0), shards, index);
+  long cols = data.dims(1);
+  Matrix<TXT> shard(data(0, 0), last - first, cols);
+  for (long i = first; i < last; ++i)
+    for (long j = 0; j < cols; ++j)
+      shard(i - first, j) = data(i, j);
+  return shard;
+}
+
+/**
+ * @struct ShardResult
+ * @brief The encrypted result of `contains` or `getScore` on the rows of one
+ * shard of a database.
+ **/
+struct ShardResult
+{
+  //! The first row of the database held by the shard
+  long firstRow;
+  //! The result on the rows of the shard
+  Matrix<Ctxt> result;
+
+  /**
+   * @brief Write out the result in binary format, with each ciphertext in the
+   * compact format of `Ctxt::writeCompact`.
+   * @param str Output `std::ostream`.
+   * @param targetBits The capacity (in bits) to keep in excess of what
+   * decryption needs, as in `Ctxt::writeCompact`.
+   **/
+  void writeTo(std::ostream& str, long targetBits = 0) const;
+
+  /**
+   * @brief Read from the stream a result written by `writeTo`.
+   * @param str Input `std::istream`.
+   * @param pubKey The `PubKey` to be used.
+   * @return The deserialized `ShardResult` object.
+   **/
+  static ShardResult readFrom(std::istream& str, const PubKey& pubKey);
+};
+
+/**
+ * @brief Merge the results of the shards of a database into the result on
+ * the whole database.
+ * @param results The results of the shards, in any order.
+ * @param rows The number of rows of the database.
+ * @return The result on the whole database, one row per database row.
+ * @note Throws an `InvalidArgument` if the shards do not cover the rows
+ * `[0, rows)` exactly once.
+ **/
+Matrix<Ctxt> mergeShardResults(const std::vector<ShardResult>& results,
+                               long rows);
+
+} // namespace helib
+
+#endif // HELIB_SHARD_H
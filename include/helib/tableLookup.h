@@ -16,6 +16,8 @@
  * @brief Code for homomorphic table lookup and fixed-point functions
  **/
 #include <functional>
+#include <vector>
+#include <NTL/ZZX.h>
 #include <helib/EncryptedArray.h>
 #include <helib/CtPtrs.h>
 
@@ -38,6 +40,72 @@ void tableLookup(Ctxt& out,
                  const CtPtrs& idx,
                  std::vector<zzX>* unpackSlotEncoding = nullptr);
 
+//! @brief The subset products of an encrypted index, as computed by
+//! computeAllProducts, held so that many tables can be looked up with the
+//! same index while paying for the products only once.
+class IndexProducts
+{
+  std::vector<Ctxt> products;
+
+public:
+  //! Compute the products for the index bits idx. The number of products
+  //! is 'size' if positive (typically the table size), else 2^lsize(idx).
+  explicit IndexProducts(const CtPtrs& idx,
+                         long size = 0,
+                         std::vector<zzX>* unpackSlotEncoding = nullptr);
+
+  long size() const { return products.size(); }
+  const Ctxt& operator[](long i) const { return products[i]; }
+};
+
+//! Look up the plaintext table T[] with pre-computed index products,
+//! the products must be at least as many as the table entries.
+void tableLookup(Ctxt& out,
+                 const std::vector<zzX>& table,
+                 const IndexProducts& products);
+
+//! Look up several plaintext tables with the same encrypted index,
+//! out[t] is set to tables[t][i]. The index products are computed once
+//! and the tables are then evaluated in parallel.
+void tableLookup(std::vector<Ctxt>& out,
+                 const std::vector<std::vector<zzX>>& tables,
+                 const CtPtrs& idx,
+                 std::vector<zzX>* unpackSlotEncoding = nullptr);
+
+//! @name Table lookup by interpolation
+//! With a large plaintext space p^r, an index can be an integer in the slots
+//! rather than bits. The table is then the polynomial P over Z_{p^r} of
+//! degree less than its size such that P(i) = T[i], and a lookup is one
+//! evaluation of P with Paterson-Stockmeyer (see polyEval). This takes no
+//! bit decomposition, hence no unpacking and no bootstrapping for it, and
+//! about 2*sqrt(size) ciphertext multiplications with depth log2(size).
+///@{
+
+//! @brief Compute the interpolating polynomial of a table.
+//! @param[out] poly The polynomial P with P(i) = table[i] mod p^r.
+//! @param[in] table The values, at most p of them so that the differences
+//! of the points 0,...,lsize(table)-1 are units mod p^r.
+//! @param[in] ea Where p and r are taken from.
+void buildLookupPoly(NTL::ZZX& poly,
+                     const std::vector<long>& table,
+                     const EncryptedArray& ea);
+
+//! @brief out = poly(index) in every slot, where poly is returned by
+//! buildLookupPoly and index holds integers less than the table size.
+//! @param k The optional baby-step parameter of polyEval.
+void tableLookupPoly(Ctxt& out,
+                     const NTL::ZZX& poly,
+                     const Ctxt& index,
+                     long k = 0);
+
+//! @brief out[i] = poly(indices[i]) for many indices with the same table,
+//! evaluated in parallel (see polyEvalBatch)
+void tableLookupPoly(std::vector<Ctxt>& out,
+                     const NTL::ZZX& poly,
+                     const std::vector<Ctxt>& indices,
+                     long k = 0);
+///@}
+
 //! The input is an encrypted table T[] and an array of encrypted bits
 //! I[], holding the binary representation of an index i into T.
 //! This function increments by one the entry T[i].
@@ -27,12 +27,18 @@
  * built-in macro \_\_func\_\_). We can also use the "lower level" methods
  * startFHEtimer(name), stopFHEtimer(name), and resetFHEtimer(name) to add
  * timers with arbitrary names (not necessarily associated with functions).
+ *
+ * After setPerfCounters(true), the timers also count hardware events such as
+ * cycles and cache misses (see perfCounters.h), and printAllTimers shows them.
  **/
 #ifndef HELIB_TIMING_H
 #define HELIB_TIMING_H
 
+#include <atomic>
+#include <functional>
 #include <helib/NumbTh.h>
 #include <helib/multicore.h>
+#include <helib/perfCounters.h>
 
 namespace helib {
 
@@ -51,6 +57,15 @@ public:
   HELIB_atomic_ulong counter;
   HELIB_atomic_long numCalls;
 
+  //! The calls by duration: histogram[i] counts those that took less than
+  //! getBucketBound(i) seconds, and at least getBucketBound(i-1)
+  static constexpr long numBuckets = 40;
+  HELIB_atomic_long histogram[numBuckets] = {};
+
+  //! The hardware events counted during the calls, while the counters are
+  //! on (see perfCounters.h)
+  HELIB_atomic_ulong perfCounts[perfEventCount] = {};
+
   FHEtimer(const char* _name, const char* _loc) :
       name(_name), loc(_loc), counter(0), numCalls(0)
   {
@@ -60,8 +75,38 @@ public:
   void reset();
   double getTime() const;
   long getNumCalls() const;
+
+  //! Add a call that took `amt` clock units
+  void record(unsigned long amt)
+  {
+    counter += amt;
+    numCalls++;
+    long bucket = amt == 0 ? 0 : NTL::NumBits(long(amt));
+    histogram[bucket < numBuckets ? bucket : numBuckets - 1]++;
+  }
+
+  //! Add the events counted during a call
+  void recordPerf(const PerfSample& sample)
+  {
+    for (int i = 0; i < perfEventCount; i++)
+      perfCounts[i] += sample.counts[i];
+  }
+
+  //! The total of one event over the calls
+  unsigned long getPerfCount(PerfEvent event) const
+  {
+    return perfCounts[int(event)];
+  }
+
+  //! The upper bound of histogram[i] in seconds, the last one is infinite
+  static double getBucketBound(long i);
 };
 
+//! Call fn on every timer registered so far.
+//! @note Not to be called concurrently with printAllTimers, which reorders
+//! the timers.
+void forEachTimer(const std::function<void(const FHEtimer&)>& fn);
+
 // backward compatibility: timers are always on
 inline void setTimersOn() {}
 inline void setTimersOff() {}
@@ -77,24 +122,101 @@ void printAllTimers(std::ostream& str = std::cerr);
 // return true if timer was found, false otherwise
 bool printNamedTimer(std::ostream& str, const char* name);
 
+/**
+ * @name Tracing
+ * When tracing is on, every run of a timer is also recorded as a span, with
+ * the thread that ran it and the span it ran within (its parent). Tasks of
+ * the `TaskScheduler` inherit the span they were forked from, so the spans of
+ * one computation form a tree across threads. Each thread records into its
+ * own buffer, without locking.
+ **/
+///@{
+//! @brief Turn the recording of spans on or off.
+void setTracing(bool on);
+
+//! @brief Is the recording of spans on?
+bool isTracing();
+
+//! @brief Drop the recorded spans.
+//! @note Must not be called while timed code runs on other threads.
+void clearTrace();
+
+/**
+ * @brief Write the recorded spans as a Chrome trace (JSON), which can be
+ * opened in Perfetto or chrome://tracing.
+ * @param str The stream to write to.
+ * @note The spans still running are not written. Can be called while other
+ * threads are recording.
+ **/
+void writeChromeTrace(std::ostream& str);
+
+//! @brief The innermost span running on the calling thread, or -1.
+long currentTraceSpan();
+
+//! @brief Make `span` the parent of the spans started by the calling thread
+//! while the object is alive (unless they run within one of their own).
+class TraceParentScope
+{
+public:
+  explicit TraceParentScope(long span);
+  ~TraceParentScope();
+
+  TraceParentScope(const TraceParentScope&) = delete;
+  TraceParentScope& operator=(const TraceParentScope&) = delete;
+
+private:
+  long saved;
+};
+///@}
+
 //! \cond FALSE (make doxygen ignore these classes)
+extern std::atomic_bool tracingOn;
+
+// The bookkeeping of a span of a timer, see auto_timer
+struct TraceMark
+{
+  long id = -1;
+  long parent = -1;
+};
+TraceMark beginTraceSpan();
+void endTraceSpan(const FHEtimer* timer,
+                  const TraceMark& mark,
+                  unsigned long begin,
+                  unsigned long end);
+
 class auto_timer
 {
 public:
   FHEtimer* timer;
   unsigned long amt;
   bool running;
+  TraceMark mark;
+  PerfSample perfStart;
+  bool perfRunning = false;
 
   auto_timer(FHEtimer* _timer) :
       timer(_timer), amt(GetTimerClock()), running(true)
-  {}
+  {
+    if (tracingOn.load(std::memory_order_relaxed))
+      mark = beginTraceSpan();
+    if (perfCountersOn.load(std::memory_order_relaxed))
+      perfRunning = readPerfCounters(perfStart);
+  }
 
   void stop()
   {
+    unsigned long begin = amt;
     amt = GetTimerClock() - amt;
-    timer->counter += amt;
-    timer->numCalls++;
+    timer->record(amt);
     running = false;
+    if (perfRunning) {
+      PerfSample perfEnd;
+      if (readPerfCounters(perfEnd))
+        timer->recordPerf(perfEnd - perfStart);
+      perfRunning = false;
+    }
+    if (mark.id >= 0)
+      endTraceSpan(timer, mark, begin, begin + amt);
   }
 
   ~auto_timer()
@@ -13,6 +13,8 @@
 #ifndef HELIB_VERSION_H
 #define HELIB_VERSION_H
 
+#include <string>
+
 namespace helib {
 
 /**
@@ -71,6 +73,25 @@ struct version
    **/
   static const char* libString();
 
+  /**
+   * @brief Get the options the compiled library was built with.
+   * @return A string such as `"HEXL=OFF THREADS=ON DEBUG=OFF"` listing
+   * whether Intel HEXL, multithreading (`HELIB_THREADS`) and `HELIB_DEBUG`
+   * were enabled.
+   **/
+  static const char* buildFlags();
+
+  /**
+   * @brief Get the versions of the vectorized kernels picked at runtime.
+   * @return A string such as
+   * `"PGFFT=avx2-fma NTT=avx512ifma ELTWISE=avx512f SAMPLE=avx512f"`
+   * naming the instructions used, on this machine, by the complex FFT
+   * (PGFFT), the native NTTs of power-of-two m (IFMA is only used for
+   * primes below 2^50), the element-wise arithmetic of `DoubleCRT` and the
+   * Gaussian sampler: `generic` or `scalar` when they run portable code.
+   **/
+  static std::string kernels();
+
 }; // struct version
 
 } // namespace helib
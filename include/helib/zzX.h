@@ -27,11 +27,12 @@ typedef NTL::Vec<long> zzX;
 inline bool IsZero(const zzX& a) { return a.length() == 0; }
 inline void clear(zzX& a) { a.SetLength(0); }
 
-inline void convert(NTL::zz_pX& x, const zzX& a)
-{
-  NTL::conv(x.rep, a);
-  x.normalize();
-}
+//! The coefficients of a reduced mod the current zz_p modulus
+void convert(NTL::zz_pX& x, const zzX& a);
+
+//! res[i] = a[i] mod q, in [0, q), e.g. the residues of a for a prime of a
+//! DoubleCRT; res may alias a
+void reduceCoeffs(zzX& res, const zzX& a, long q);
 
 void add(zzX& res, const zzX& a, const zzX& b);
 inline zzX operator+(const zzX& a, const zzX& b)
@@ -89,6 +89,37 @@ helib::Database<TXT> readDbFromFile(const std::string& databaseFilePath,
   return helib::Database<TXT>(data, contextp);
 }
 
+// Streams an encrypted database from file, reading chunkRows rows at a time
+inline helib::StreamedDatabase<helib::Ctxt> streamDbFromFile(
+    const std::string& databaseFilePath,
+    const sharedContext& contextp,
+    const helib::PubKey& pk,
+    long chunkRows)
+{
+  auto zero_txt = std::make_shared<helib::Ctxt>(pk);
+  auto reader =
+      std::make_shared<Reader<helib::Ctxt>>(databaseFilePath, *zero_txt);
+  long nrow = reader->getTOC().getRows();
+  long ncol = reader->getTOC().getCols();
+
+  // Only one chunk is read at a time, so the reader can be shared
+  auto readChunk = [zero_txt, reader, ncol](long first, long last) {
+    helib::Matrix<helib::Ctxt> chunk(*zero_txt, last - first, ncol);
+    for (long i = first; i < last; ++i) {
+      for (long j = 0; j < ncol; ++j) {
+        reader->readDatum(chunk(i - first, j), i, j);
+      }
+    }
+    return chunk;
+  };
+
+  return helib::StreamedDatabase<helib::Ctxt>(nrow,
+                                              ncol,
+                                              readChunk,
+                                              contextp,
+                                              chunkRows);
+}
+
 template <typename TXT>
 helib::Matrix<TXT> readQueryFromFile(const std::string& queryFilePath,
                                      const helib::PubKey& pk)
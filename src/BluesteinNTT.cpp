@@ -0,0 +1,102 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+#include "BluesteinNTT.h"
+
+namespace helib {
+
+long BluesteinNTT::nttLength(long n)
+{
+  long K = 1;
+  while (K < 2 * n - 1)
+    K <<= 1;
+  return K;
+}
+
+bool BluesteinNTT::isUsable(long n, long q)
+{
+  if (n < 3 || n % 2 == 0)
+    return false;
+  if (q >= (1L << simd::NTTTables::MAX_MODULUS_BITS))
+    return false;
+  return (q - 1) % (2 * nttLength(n)) == 0;
+}
+
+BluesteinNTT::BluesteinNTT(long _n, long _q, long root, long psi) :
+    n(_n), q(_q), ntt(nttLength(_n), _q, psi)
+{
+  assertTrue<InvalidArgument>(isUsable(n, q),
+                              "BluesteinNTT: no NTT of the length needed");
+  initChirp(fwd, root);
+  initChirp(inv, NTL::InvMod(root, q));
+}
+
+void BluesteinNTT::initChirp(Chirp& chirp, long r) const
+{
+  long K = ntt.size();
+  long rInv = NTL::InvMod(r, q);
+
+  // n is odd, so the exponents i^2/2 of the usual chirp can be taken mod n
+  chirp.powers.resize(n);
+  chirp.powersAux.resize(n);
+  chirp.b.assign(K, 0);
+  for (long i = 0; i < n; i++) {
+    long iSqr = NTL::MulMod(i, i, n);
+    chirp.powers[i] = NTL::PowerMod(r, iSqr, q);
+    chirp.powersAux[i] = NTL::PrepMulModPrecon(chirp.powers[i], q);
+    chirp.b[i] = NTL::PowerMod(rInv, iSqr, q);
+  }
+
+  ntt.forward(chirp.b.data());
+  chirp.bAux.resize(K);
+  for (long i = 0; i < K; i++)
+    chirp.bAux[i] = NTL::PrepMulModPrecon(chirp.b[i], q);
+}
+
+void BluesteinNTT::apply(NTL::zz_pX& x, const Chirp& chirp) const
+{
+  HELIB_TIMER_START;
+
+  long dx = deg(x);
+  if (dx < 0)
+    return;
+  assertTrue(dx < n, "BluesteinNTT: the input has too high a degree");
+
+  long K = ntt.size();
+  NTL_THREAD_LOCAL static std::vector<long> buf;
+  buf.assign(K, 0);
+  long* a = buf.data();
+
+  const long* pw = chirp.powers.data();
+  const NTL::mulmod_precon_t* pwAux = chirp.powersAux.data();
+  for (long i = 0; i <= dx; i++)
+    a[i] = NTL::MulModPrecon(rep(x[i]), pw[i], q, pwAux[i]);
+
+  // The product with b (both of degree below n) has degree at most 2n-2 < K,
+  // so the negacyclic convolution has no wrap-around
+  ntt.forward(a);
+  for (long i = 0; i < K; i++)
+    a[i] = NTL::MulModPrecon(a[i], chirp.b[i], q, chirp.bAux[i]);
+  ntt.inverse(a);
+
+  // reduce mod X^n - 1, then multiply by the chirp again
+  x.rep.SetLength(n);
+  for (long i = 0; i < n; i++) {
+    long c = (i + n < K) ? NTL::AddMod(a[i], a[i + n], q) : a[i];
+    x.rep[i].LoopHole() = NTL::MulModPrecon(c, pw[i], q, pwAux[i]);
+  }
+  x.normalize();
+}
+
+} // namespace helib
@@ -0,0 +1,87 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_BLUESTEINNTT_H
+#define HELIB_BLUESTEINNTT_H
+/**
+ * @file BluesteinNTT.h
+ * @brief Bluestein's FFT for odd m, with its convolution computed by the
+ * built-in NTT
+ **/
+#include <vector>
+
+#include <NTL/lzz_pX.h>
+
+#include "simdKernels.h"
+
+namespace helib {
+
+/**
+ * @class BluesteinNTT
+ * @brief The same transforms as BluesteinFFT for an odd length n, with the
+ * convolution done by simd::NTTTables rather than NTL's fftRep's.
+ *
+ * The convolution of Bluestein's algorithm multiplies two polynomials of
+ * degree below n, so their product, of degree at most 2n-2, is the same
+ * modulo X^K + 1 as modulo X^K - 1 for any K >= 2n-1. It is computed with a
+ * negacyclic NTT of length K = 2^k, that is with Harvey's lazy butterflies
+ * (values kept in [0, 4q)) and Shoup-precomputed twiddles. The transforms
+ * of the chirps b are precomputed along with their Shoup constants, so the
+ * pointwise products are also single Shoup multiplications.
+ *
+ * This needs a primitive 2K-th root of unity modulo q, which isUsable
+ * checks for. The tables do not depend on NTL's current modulus.
+ **/
+class BluesteinNTT
+{
+  // The tables for one direction: the chirp powers[i] = r^{i^2} and the
+  // NTT of b[i] = r^{-i^2}, for r = root (forward) or root^{-1} (inverse)
+  struct Chirp
+  {
+    std::vector<long> powers;
+    std::vector<NTL::mulmod_precon_t> powersAux;
+    std::vector<long> b;
+    std::vector<NTL::mulmod_precon_t> bAux;
+  };
+
+  long n;
+  long q;
+  simd::NTTTables ntt;
+  Chirp fwd, inv;
+
+  void initChirp(Chirp& chirp, long r) const;
+  void apply(NTL::zz_pX& x, const Chirp& chirp) const;
+
+public:
+  //! @brief Can the transforms of length n be done this way modulo q?
+  static bool isUsable(long n, long q);
+
+  //! @brief The length of the NTT used for transforms of length n
+  static long nttLength(long n);
+
+  //! @brief Tables for the transforms of length n (odd) modulo q, with
+  //! root a primitive n-th root of unity and psi a primitive 2K-th root of
+  //! unity, where K = nttLength(n)
+  BluesteinNTT(long n, long q, long root, long psi);
+
+  //! @brief The same as BluesteinFFT(x, n, root, ...), that is unscaled.
+  //! x must be reduced and of degree below n, and is replaced by the
+  //! evaluations. The NTL modulus must be q
+  void FFT(NTL::zz_pX& x) const { apply(x, fwd); }
+
+  //! @brief The same as BluesteinFFT(x, n, root^{-1}, ...)
+  void iFFT(NTL::zz_pX& x) const { apply(x, inv); }
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_BLUESTEINNTT_H
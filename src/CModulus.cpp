@@ -38,15 +38,85 @@
  * (vec_long), that store only the evaluation in primitive m-th
  * roots of unity.
  */
+#include <algorithm>
+#include <atomic>
+
 #include <helib/CModulus.h>
 #include <helib/timing.h>
+#include <helib/fhe_stats.h>
+#include <helib/multicore.h>
 
 #ifdef USE_INTEL_HEXL
 #include "intelExt.h"
+#else
+#include "simdKernels.h"
+#include "BluesteinNTT.h"
 #endif
 
+#include "PrimeFactorFFT.h"
+
 namespace helib {
 
+// The smallest phi(m) whose native NTTs are split over the threads
+static std::atomic<long> intraNTTMinSize(1L << 14);
+
+void Cmodulus::setIntraNTTMinSize(long size)
+{
+  assertTrue<InvalidArgument>(size >= 0, "Negative intra-NTT minimum size");
+  intraNTTMinSize = size;
+}
+
+long Cmodulus::getIntraNTTMinSize() { return intraNTTMinSize; }
+
+bool Cmodulus::splitsNTT() const
+{
+  long minSize = intraNTTMinSize;
+  return nativeNTT && minSize > 0 && long(getPhiM()) >= minSize &&
+         AvailableThreads() > 1 && !inParallelTask();
+}
+
+// The backend all the transforms go through, the CPU one unless another was
+// installed
+static const CPUNTTBackend cpuNTTBackend;
+static std::atomic<const NTTBackend*> nttBackend(&cpuNTTBackend);
+
+void Cmodulus::setNTTBackend(const NTTBackend* backend)
+{
+  nttBackend = backend ? backend : &cpuNTTBackend;
+}
+
+const NTTBackend& Cmodulus::getNTTBackend() { return *nttBackend; }
+
+// Whether the transforms run on the CPU, where the entry points below take
+// their own shortcuts instead of going through the backend
+static bool onCPU() { return nttBackend.load() == &cpuNTTBackend; }
+
+// The transforms are counted where the entry points below do them or hand
+// them to the backend, so that the counts do not depend on the backend
+static void countFFT()
+{
+  fhe_ops.ntts++;
+  fhe_ops.ffts++;
+}
+
+static void countIFFT()
+{
+  fhe_ops.ntts++;
+  fhe_ops.iffts++;
+}
+
+void CPUNTTBackend::forward(const Cmodulus& mod, NTL::vec_long& y) const
+{
+  mod.cpuFFTInPlace(y);
+}
+
+void CPUNTTBackend::inverse(const Cmodulus& mod,
+                            NTL::vec_long& x,
+                            const NTL::vec_long& y) const
+{
+  mod.cpuIFFT(x, y);
+}
+
 // It is assumed that m,q,context, and root are already set. If root is set
 // to zero, it will be computed by the compRoots() method. Then rInv is
 // computed as the inverse of root.
@@ -61,7 +131,10 @@ NTL::zz_pContext BuildContext(long p, long maxroot)
 
 // Constructor: it is assumed that zms is already set with m>1
 // If q == 0, then the current context is used
-Cmodulus::Cmodulus(const PAlgebra& zms, long qq, long rt) :
+Cmodulus::Cmodulus(const PAlgebra& zms,
+                   long qq,
+                   long rt,
+                   FFTEngine engine) :
     q(qq), zMStar(&zms), root(rt)
 {
   assertTrue<InvalidArgument>(zms.getM() > 1,
@@ -134,6 +207,13 @@ Cmodulus::Cmodulus(const PAlgebra& zms, long qq, long rt) :
       w = NTL::MulMod(w, w1, q);
     }
 
+#ifndef USE_INTEL_HEXL
+    // w0 is the primitive 2*phim-th root used by the twisted NTL FFT, so
+    // the native NTT computes exactly the same evaluations
+    if (q < (1L << simd::NTTTables::MAX_MODULUS_BITS))
+      nativeNTT = std::make_shared<const simd::NTTTables>(phim, q, w0);
+#endif
+
     return;
   }
 
@@ -176,8 +256,25 @@ Cmodulus::Cmodulus(const PAlgebra& zms, long qq, long rt) :
   iRb.reset(new NTL::fftRep);
   phimx.reset(new zz_pXModulus1(zms.getM(), phimx_poly));
 
+  if (engine == FFTEngine::PRIME_FACTOR) {
+    primeFactorFFT = std::make_shared<const PrimeFactorFFT>(zms, root);
+    return;
+  }
+
   BluesteinInit(mm, NTL::conv<NTL::zz_p>(root), *powers, powers_aux, *Rb);
   BluesteinInit(mm, NTL::conv<NTL::zz_p>(rInv), *ipowers, ipowers_aux, *iRb);
+
+#ifndef USE_INTEL_HEXL
+  // For odd m, the convolutions can go through the built-in NTT if q has
+  // roots of unity of a high enough order (root must have order m)
+  if (BluesteinNTT::isUsable(mm, q) && NTL::PowerMod(root, mm, q) == 1) {
+    NTL::zz_p psi;
+    FindPrimitiveRoot(psi, 2 * BluesteinNTT::nttLength(mm));
+    if (psi != 0)
+      bluesteinNTT =
+          std::make_shared<const BluesteinNTT>(mm, q, root, NTL::rep(psi));
+  }
+#endif
 }
 
 Cmodulus& Cmodulus::operator=(const Cmodulus& other)
@@ -215,6 +312,9 @@ Cmodulus& Cmodulus::operator=(const Cmodulus& other)
   ipowers = other.ipowers;
   iRb = other.iRb;
   phimx = other.phimx;
+  nativeNTT = other.nativeNTT;
+  primeFactorFFT = other.primeFactorFFT;
+  bluesteinNTT = other.bluesteinNTT;
 
 #ifdef HELIB_OPENCL
   altFFTInfo = other.altFFTInfo;
@@ -386,31 +486,44 @@ void Cmodulus::FFT_aux(NTL::vec_long& y, NTL::zz_pX& tmp) const
 
 #else
 
-    const NTL::zz_p* powers_p = (*powers).rep.elts();
-    const NTL::mulmod_precon_t* powers_aux_p = powers_aux.elts();
-
-    for (long i = 0; i <= dx; i++) {
-      yp[i] = NTL::MulModPrecon(rep(tmp_p[i]),
-                                rep(powers_p[i]),
-                                p,
-                                powers_aux_p[i]);
-    }
-
-    for (long i = dx + 1; i < phim; i++) {
-      yp[i] = 0;
-    }
+    if (nativeNTT) {
+      for (long i = 0; i <= dx; i++)
+        yp[i] = rep(tmp_p[i]);
+      for (long i = dx + 1; i < phim; i++)
+        yp[i] = 0;
+
+      // leaves its output in bit-reversed order, like NTL's FFTFwd
+      if (splitsNTT())
+        nativeNTT->forwardSplit(yp);
+      else
+        nativeNTT->forward(yp);
+    } else {
+      const NTL::zz_p* powers_p = (*powers).rep.elts();
+      const NTL::mulmod_precon_t* powers_aux_p = powers_aux.elts();
+
+      for (long i = 0; i <= dx; i++) {
+        yp[i] = NTL::MulModPrecon(rep(tmp_p[i]),
+                                  rep(powers_p[i]),
+                                  p,
+                                  powers_aux_p[i]);
+      }
+
+      for (long i = dx + 1; i < phim; i++) {
+        yp[i] = 0;
+      }
 
 #ifdef HELIB_OPENCL
-    AltFFTFwd(yp, yp, k - 1, *altFFTInfo);
+      AltFFTFwd(yp, yp, k - 1, *altFFTInfo);
 #else
 
 #ifndef NTL_PROVIDES_TRUNC_FFT
-    NTL::FFTFwd(yp, yp, k - 1, *NTL::zz_pInfo->p_info);
+      NTL::FFTFwd(yp, yp, k - 1, *NTL::zz_pInfo->p_info);
 #else
-    NTL::FFTFwd(yp, yp, k - 1, *NTL::zz_pInfo->p_info);
+      NTL::FFTFwd(yp, yp, k - 1, *NTL::zz_pInfo->p_info);
 #endif
 
 #endif // HELIB_OPENCL
+    }
 
 #endif // USE_INTEL_HEXL
 
@@ -428,11 +541,20 @@ void Cmodulus::FFT_aux(NTL::vec_long& y, NTL::zz_pX& tmp) const
     return;
   }
 
-  NTL::zz_p rt;
-  conv(rt, root); // convert root to zp format
+  if (primeFactorFFT) {
+    // only computes the entries corresponding to primitive roots of unity
+    primeFactorFFT->FFT(y, tmp);
+    return;
+  }
 
   // call the FFT routine
-  BluesteinFFT(tmp, getM(), rt, *powers, powers_aux, *Rb);
+  if (bluesteinNTT)
+    bluesteinNTT->FFT(tmp);
+  else {
+    NTL::zz_p rt;
+    conv(rt, root); // convert root to zp format
+    BluesteinFFT(tmp, getM(), rt, *powers, powers_aux, *Rb);
+  }
 
   // copy the result to the output vector y, keeping only the
   // entries corresponding to primitive roots of unity
@@ -443,9 +565,63 @@ void Cmodulus::FFT_aux(NTL::vec_long& y, NTL::zz_pX& tmp) const
       y[j++] = rep(coeff(tmp, i));
 }
 
+// Hand x, with NTL's modulus set to q, to another backend: as it takes
+// phi(m) coefficients, x is first reduced mod Phi_m(X)
+static void backendFFT(const Cmodulus& mod, NTL::vec_long& y, NTL::zz_pX& x)
+{
+  long phim = mod.getPhiM();
+  rem(x, x, mod.getPhimX());
+  long d = deg(x);
+  y.SetLength(phim);
+  for (long i = 0; i <= d; i++)
+    y[i] = rep(x.rep[i]);
+  for (long i = d + 1; i < phim; i++)
+    y[i] = 0;
+  Cmodulus::getNTTBackend().forward(mod, y);
+}
+
+// The native negacyclic NTT (m a power of two) goes straight from the
+// coefficients in y, reduced mod q, to the evaluations. There is no zz_pX
+// conversion and no reduction mod Phi_m(X) = X^phim + 1 beyond folding in
+// the coefficients of degree >= phim.
+void Cmodulus::nativeFFT(NTL::vec_long& y) const
+{
+  long k = zMStar->getPow2();
+  long phim = 1L << (k - 1);
+  long* yp = y.elts();
+
+  // output in bit-reversed order
+  if (splitsNTT())
+    nativeNTT->forwardSplit(yp);
+  else
+    nativeNTT->forward(yp);
+
+  NTL::vec_long& bit_reversed = Cmodulus::getScratch_vec_long();
+  bit_reversed.SetLength(phim);
+  BitReverseCopy(bit_reversed.elts(), yp, k - 1);
+  std::copy_n(bit_reversed.elts(), phim, yp);
+}
+
 void Cmodulus::FFT(NTL::vec_long& y, const NTL::ZZX& x) const
 {
   HELIB_TIMER_START;
+
+  if (nativeNTT && onCPU()) {
+    long phim = getPhiM();
+    y.SetLength(phim);
+    std::fill_n(y.elts(), phim, 0);
+    for (long i = 0; i <= deg(x); i++) {
+      long c = rem(x.rep[i], q);
+      long j = i % phim;
+      // X^phim = -1 mod Phi_m(X)
+      y[j] = ((i / phim) % 2 == 0) ? NTL::AddMod(y[j], c, q)
+                                     : NTL::SubMod(y[j], c, q);
+    }
+    countFFT();
+    nativeFFT(y);
+    return;
+  }
+
   NTL::zz_pBak bak;
   bak.save();
   context.restore();
@@ -462,6 +638,30 @@ void Cmodulus::FFT(NTL::vec_long& y, const NTL::ZZX& x) const
 void Cmodulus::FFT(NTL::vec_long& y, const zzX& x) const
 {
   HELIB_TIMER_START;
+
+  if (nativeNTT && onCPU()) {
+    long phim = getPhiM();
+    long len = x.length();
+    long head = std::min(len, phim);
+    y.SetLength(phim);
+    simd::EltwiseReduceMod(y.elts(), x.elts(), head, q);
+    std::fill(y.elts() + head, y.elts() + phim, 0);
+    // X^phim = -1 mod Phi_m(X)
+    NTL::vec_long tail;
+    for (long k = phim; k < len; k += phim) {
+      long n = std::min(phim, len - k);
+      tail.SetLength(n);
+      simd::EltwiseReduceMod(tail.elts(), x.elts() + k, n, q);
+      if ((k / phim) % 2 == 0)
+        simd::EltwiseAddMod(y.elts(), y.elts(), tail.elts(), n, q);
+      else
+        simd::EltwiseSubMod(y.elts(), y.elts(), tail.elts(), n, q);
+    }
+    countFFT();
+    nativeFFT(y);
+    return;
+  }
+
   NTL::zz_pBak bak;
   bak.save();
   context.restore();
@@ -474,18 +674,91 @@ void Cmodulus::FFT(NTL::vec_long& y, const zzX& x) const
   FFT(y, tmp);
 }
 
+void Cmodulus::FFT(NTL::vec_long* const* y, const zzX* const* x, long n) const
+{
+  HELIB_TIMER_START;
+
+  if (nativeNTT || !onCPU()) {
+    for (long k = 0; k < n; k++)
+      FFT(*y[k], *x[k]);
+    return;
+  }
+
+  NTL::zz_pBak bak;
+  bak.save();
+  context.restore();
+
+  NTL::zz_pX& tmp = Cmodulus::getScratch_zz_pX();
+  for (long k = 0; k < n; k++) {
+    {
+      HELIB_NTIMER_START(FFT_remainder);
+      convert(tmp, *x[k]);
+    }
+    countFFT();
+    FFT_aux(*y[k], tmp);
+  }
+}
+
+void Cmodulus::FFTInPlace(NTL::vec_long& y) const
+{
+  HELIB_TIMER_START;
+  countFFT();
+  getNTTBackend().forward(*this, y);
+}
+
+void Cmodulus::cpuFFTInPlace(NTL::vec_long& y) const
+{
+  if (nativeNTT) {
+    nativeFFT(y);
+    return;
+  }
+
+  NTL::zz_pBak bak;
+  bak.save();
+  context.restore();
+
+  NTL::zz_pX& tmp = Cmodulus::getScratch_zz_pX();
+  long n = y.length();
+  tmp.rep.SetLength(n);
+  for (long i = 0; i < n; i++)
+    tmp.rep[i].LoopHole() = y[i];
+  tmp.normalize();
+  FFT_aux(y, tmp);
+}
+
 void Cmodulus::FFT(NTL::vec_long& y, NTL::zz_pX& x) const
 {
   HELIB_TIMER_START;
   NTL::zz_pBak bak;
   bak.save();
   context.restore();
-  FFT_aux(y, x);
+  countFFT();
+  if (onCPU())
+    FFT_aux(y, x);
+  else
+    backendFFT(*this, y, x);
 }
 
 void Cmodulus::iFFT(NTL::zz_pX& x, const NTL::vec_long& y) const
 {
   HELIB_TIMER_START;
+  countIFFT();
+  if (onCPU()) {
+    cpuIFFT(x, y);
+    return;
+  }
+
+  NTL::vec_long coeffs;
+  getNTTBackend().inverse(*this, coeffs, y);
+  long phim = getPhiM();
+  x.rep.SetLength(phim);
+  for (long i = 0; i < phim; i++)
+    x.rep[i].LoopHole() = coeffs[i];
+  x.normalize();
+}
+
+void Cmodulus::cpuIFFT(NTL::zz_pX& x, const NTL::vec_long& y) const
+{
   NTL::zz_pBak bak;
   bak.save();
   context.restore();
@@ -522,27 +795,42 @@ void Cmodulus::iFFT(NTL::zz_pX& x, const NTL::vec_long& y) const
 
 #else
 
-    const NTL::zz_p* ipowers_p = (*ipowers).rep.elts();
-    const NTL::mulmod_precon_t* ipowers_aux_p = ipowers_aux.elts();
+    if (nativeNTT) {
+      // takes bit-reversed input, and also scales by 1/phim
+      if (splitsNTT())
+        nativeNTT->inverseSplit(tmp_p);
+      else
+        nativeNTT->inverse(tmp_p);
+
+      x.rep.SetLength(phim);
+      NTL::zz_p* xp = x.rep.elts();
+
+      for (long i = 0; i < phim; ++i) {
+        xp[i].LoopHole() = tmp_p[i];
+      }
+    } else {
+      const NTL::zz_p* ipowers_p = (*ipowers).rep.elts();
+      const NTL::mulmod_precon_t* ipowers_aux_p = ipowers_aux.elts();
 
 #ifdef HELIB_OPENCL
-    AltFFTRev1(tmp_p, yp, k - 1, *altFFTInfo);
+      AltFFTRev1(tmp_p, yp, k - 1, *altFFTInfo);
 #else
 
 #ifndef NTL_PROVIDES_TRUNC_FFT
-    NTL::FFTRev1(tmp_p, yp, k - 1, *NTL::zz_pInfo->p_info);
+      NTL::FFTRev1(tmp_p, yp, k - 1, *NTL::zz_pInfo->p_info);
 #else
-    NTL::FFTRev1(tmp_p, tmp_p, k - 1, *NTL::zz_pInfo->p_info);
+      NTL::FFTRev1(tmp_p, tmp_p, k - 1, *NTL::zz_pInfo->p_info);
 #endif
 
 #endif // HELIB_OPENCL
 
-    x.rep.SetLength(phim);
-    NTL::zz_p* xp = x.rep.elts();
+      x.rep.SetLength(phim);
+      NTL::zz_p* xp = x.rep.elts();
 
-    for (long i = 0; i < phim; ++i) {
-      xp[i].LoopHole() =
-          NTL::MulModPrecon(tmp_p[i], rep(ipowers_p[i]), p, ipowers_aux_p[i]);
+      for (long i = 0; i < phim; ++i) {
+        xp[i].LoopHole() =
+            NTL::MulModPrecon(tmp_p[i], rep(ipowers_p[i]), p, ipowers_aux_p[i]);
+      }
     }
 
 #endif // USE_INTEL_HEXL
@@ -552,18 +840,27 @@ void Cmodulus::iFFT(NTL::zz_pX& x, const NTL::vec_long& y) const
     return;
   } // End of special case if m is power of 2
 
-  NTL::zz_p rt;
   long m = getM();
 
-  // convert input to zpx format, initializing only the coeffs i s.t. (i,m)=1
-  x.rep.SetLength(m);
-  for (long i = 0, j = 0; i < m; i++)
-    if (zMStar->inZmStar(i))
-      x.rep[i].LoopHole() = y[j++]; // DIRT: y[j] already reduced
-  x.normalize();
-  conv(rt, rInv); // convert rInv to zp format
+  if (primeFactorFFT) {
+    primeFactorFFT->iFFT(x, y);
+  } else {
+    NTL::zz_p rt;
+
+    // convert input to zpx format, initializing only the coeffs i with
+    // (i,m)=1
+    x.rep.SetLength(m);
+    for (long i = 0, j = 0; i < m; i++)
+      if (zMStar->inZmStar(i))
+        x.rep[i].LoopHole() = y[j++]; // DIRT: y[j] already reduced
+    x.normalize();
+    conv(rt, rInv); // convert rInv to zp format
 
-  BluesteinFFT(x, m, rt, *ipowers, ipowers_aux, *iRb); // call the FFT routine
+    if (bluesteinNTT)
+      bluesteinNTT->iFFT(x);
+    else
+      BluesteinFFT(x, m, rt, *ipowers, ipowers_aux, *iRb);
+  }
 
   // reduce the result mod (Phi_m(X),q) and copy to the output polynomial x
   {
@@ -577,6 +874,40 @@ void Cmodulus::iFFT(NTL::zz_pX& x, const NTL::vec_long& y) const
   x *= mm_inv;
 }
 
+void Cmodulus::iFFT(NTL::vec_long& x, const NTL::vec_long& y) const
+{
+  HELIB_TIMER_START;
+  assertTrue(&x != &y, "Cmodulus::iFFT: input and output must not alias");
+  countIFFT();
+  getNTTBackend().inverse(*this, x, y);
+}
+
+void Cmodulus::cpuIFFT(NTL::vec_long& x, const NTL::vec_long& y) const
+{
+  long phim = getPhiM();
+
+  if (nativeNTT) {
+    long k = zMStar->getPow2();
+    x.SetLength(phim);
+    BitReverseCopy(x.elts(), y.elts(), k - 1);
+    // also scales by 1/phim
+    if (splitsNTT())
+      nativeNTT->inverseSplit(x.elts());
+    else
+      nativeNTT->inverse(x.elts());
+    return;
+  }
+
+  NTL::zz_pX& tmp = Cmodulus::getScratch_zz_pX();
+  cpuIFFT(tmp, y);
+  x.SetLength(phim);
+  long d = deg(tmp); // copy the coefficients, pad by zeros if needed
+  for (long i = 0; i <= d; i++)
+    x[i] = rep(tmp.rep[i]);
+  for (long i = d + 1; i < phim; i++)
+    x[i] = 0;
+}
+
 NTL::zz_pX& Cmodulus::getScratch_zz_pX()
 {
   NTL_THREAD_LOCAL static NTL::zz_pX scratch;
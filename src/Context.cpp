@@ -13,6 +13,8 @@
 #include <algorithm>
 #include <optional>
 
+#include <NTL/BasicThreadPool.h>
+
 #include <json.hpp>
 using json = ::nlohmann::json;
 
@@ -23,9 +25,13 @@ using json = ::nlohmann::json;
 #include <helib/EncryptedArray.h>
 #include <helib/PolyModRing.h>
 #include <helib/fhe_stats.h>
+#include <helib/timing.h>
+#include <helib/ScratchPool.h>
 
 #include "macro.h"
 #include "PrimeGenerator.h"
+#include "PrimeFactorFFT.h"
+#include "RNSBaseConverter.h"
 #include "binio.h"
 #include "io.h"
 
@@ -81,6 +87,7 @@ struct Context::ModChainParams
   long skHwt;
   long resolution;
   long bitsInSpecialPrimes;
+  long maxPrimeBits;
   double stdev;
   double scale;
 };
@@ -111,6 +118,10 @@ struct Context::SerializableContent
   NTL::Vec<long> mvec;
   bool build_cache;
   bool alsoThick;
+  std::optional<PAlgebraModFactors> factorization; // only in snapshots
+  std::optional<PAlgebraTables> tables;            // only in snapshots
+  // Only in snapshots, the stream to read the bootstrapping linear maps from
+  std::istream* recryptMaps = nullptr;
 };
 
 long FindM(long k,
@@ -284,14 +295,8 @@ bool Context::operator==(const Context& other) const
   if (alMod != other.alMod)
     return false;
 
-  if (moduli.size() != other.moduli.size())
+  if (primes != other.primes)
     return false;
-  for (size_t i = 0; i < moduli.size(); i++) {
-    const Cmodulus& m1 = moduli[i];
-    const Cmodulus& m2 = other.moduli[i];
-    if (m1.getQ() != m2.getQ())
-      return false;
-  }
 
   if (smallPrimes != other.smallPrimes)
     return false;
@@ -386,6 +391,13 @@ void Context::writeTo(std::ostream& str) const
   writeEyeCatcher(str, EyeCatcher::CONTEXT_END);
 }
 
+unsigned long Context::fingerprint() const
+{
+  FingerprintStream str;
+  writeTo(str);
+  return str.hash();
+}
+
 Context::SerializableContent Context::readParamsFrom(std::istream& str)
 {
   const auto header = SerializeHeader<Context>::readFrom(str);
@@ -451,6 +463,110 @@ Context* Context::readPtrFrom(std::istream& str)
   return new Context(readParamsFrom(str));
 }
 
+// The coefficients of polynomials with single-precision coefficients
+static void writeSmallZZXs(std::ostream& str, const std::vector<NTL::ZZX>& v)
+{
+  write_raw_int(str, v.size());
+  for (const NTL::ZZX& f : v) {
+    std::vector<long> coeffs(deg(f) + 1);
+    for (long i : range(coeffs.size()))
+      coeffs[i] = NTL::conv<long>(NTL::coeff(f, i));
+    write_raw_vector(str, coeffs);
+  }
+}
+
+static std::vector<NTL::ZZX> readSmallZZXs(std::istream& str)
+{
+  std::vector<NTL::ZZX> v(read_raw_int(str));
+  for (NTL::ZZX& f : v) {
+    std::vector<long> coeffs;
+    read_raw_vector(str, coeffs);
+    f.SetLength(coeffs.size());
+    for (long i : range(coeffs.size()))
+      f[i] = coeffs[i];
+    f.normalize();
+  }
+  return v;
+}
+
+void Context::writeSnapshotTo(std::ostream& str) const
+{
+  HELIB_TIMER_START;
+  SerializeHeader<Context>().writeTo(str);
+  writeEyeCatcher(str, EyeCatcher::SNAP_BEGIN);
+
+  writeTo(str);
+
+  // The slot factorization (none for CKKS)
+  PAlgebraModFactors factorization;
+  if (!isCKKS())
+    factorization = alMod.getFactorization();
+  writeSmallZZXs(str, factorization.factors);
+  writeSmallZZXs(str, factorization.crtCoeffs);
+
+  // The tables of zMStar that take more than linear time
+  PAlgebraTables tables = zMStar.getTables();
+  write_raw_double(str, tables.polyNormBnd);
+  write_raw_vector(str, tables.T);
+
+  // The linear maps of bootstrapping, if any, follow the snapshot proper.
+  // Those of CKKS are rebuilt when the snapshot is read.
+  bool hasRecryptMaps = isBootstrappable() && !isCKKS();
+  write_raw_int(str, hasRecryptMaps);
+
+  writeEyeCatcher(str, EyeCatcher::SNAP_END);
+
+  if (hasRecryptMaps)
+    rcData.writeMapsTo(str);
+}
+
+Context::SerializableContent Context::readSnapshotParamsFrom(std::istream& str)
+{
+  const auto header = SerializeHeader<Context>::readFrom(str);
+  assertEq<IOError>(header.version,
+                    Binio::VERSION_0_0_1_0,
+                    "Header: version " + header.versionString() +
+                        " not supported");
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::SNAP_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find pre-context snapshot eye catcher");
+
+  SerializableContent content = readParamsFrom(str);
+
+  PAlgebraModFactors factorization;
+  factorization.factors = readSmallZZXs(str);
+  factorization.crtCoeffs = readSmallZZXs(str);
+  if (!factorization.factors.empty())
+    content.factorization = std::move(factorization);
+
+  PAlgebraTables tables;
+  tables.polyNormBnd = read_raw_double(str);
+  read_raw_vector(str, tables.T);
+  content.tables = std::move(tables);
+
+  bool hasRecryptMaps = read_raw_int(str);
+  assertTrue<IOError>(!hasRecryptMaps || content.mvec.length() > 0,
+                      "Snapshot has linear maps but is not bootstrappable");
+
+  eyeCatcherFound = readEyeCatcher(str, EyeCatcher::SNAP_END);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-context snapshot eye catcher");
+
+  if (hasRecryptMaps)
+    content.recryptMaps = &str;
+  return content;
+}
+
+Context Context::readSnapshotFrom(std::istream& str)
+{
+  return Context(readSnapshotParamsFrom(str));
+}
+
+Context* Context::readPtrSnapshotFrom(std::istream& str)
+{
+  return new Context(readSnapshotParamsFrom(str));
+}
+
 Context::SerializableContent Context::readParamsFromJSON(
     const JsonWrapper& jwrap)
 {
@@ -601,9 +717,11 @@ Context::Context(unsigned long m,
                  unsigned long p,
                  unsigned long r,
                  const std::vector<long>& gens,
-                 const std::vector<long>& ords) :
-    zMStar(m, p, gens, ords),
-    alMod(zMStar, r),
+                 const std::vector<long>& ords,
+                 const PAlgebraModFactors* precomputed,
+                 const PAlgebraTables* tables) :
+    zMStar(m, p, gens, ords, tables),
+    alMod(zMStar, r, precomputed),
 
     // VJS-FIXME: I'm not sure this makes sense.
     // This constrictor was provided mainly for bootstrapping.
@@ -664,10 +782,15 @@ Context::Context(long m,
                         mparams->bootstrappableFlag,
                         mparams->skHwt,
                         mparams->resolution,
-                        mparams->bitsInSpecialPrimes);
+                        mparams->bitsInSpecialPrimes,
+                        mparams->maxPrimeBits);
 
     if (mparams->bootstrappableFlag && bparams) {
-      this->enableBootStrapping(bparams->mvec,
+      // m is a power of two for CKKS, so it is its own partition
+      NTL::Vec<long> mvec = bparams->mvec;
+      if (isCKKS() && mvec.length() == 0)
+        mvec.SetLength(1, getM());
+      this->enableBootStrapping(mvec,
                                 bparams->buildCacheFlag,
                                 bparams->thickFlag);
     }
@@ -675,7 +798,13 @@ Context::Context(long m,
 }
 
 Context::Context(const SerializableContent& content) :
-    Context(content.m, content.p, content.r, content.gens, content.ords)
+    Context(content.m,
+            content.p,
+            content.r,
+            content.gens,
+            content.ords,
+            content.factorization ? &*content.factorization : nullptr,
+            content.tables ? &*content.tables : nullptr)
 {
   this->stdev = content.stdev;
   this->scale = content.scale;
@@ -684,10 +813,10 @@ Context::Context(const SerializableContent& content) :
   this->e_param = content.e_param;
   this->ePrime_param = content.ePrime_param;
 
+  // The moduli of a context that is read in keep the default FFT engine
+  this->fftEnginePlanned = true;
   for (long i = 0; i < lsize(content.qs); i++) {
-    long q = content.qs[i];
-
-    this->moduli.emplace_back(this->zMStar, q, 0);
+    this->addPrime(content.qs[i]);
 
     // FIXME: Consider serializing all 3 sets and setting them directly.
     if (content.smallPrimes.contains(i))
@@ -697,15 +826,22 @@ Context::Context(const SerializableContent& content) :
     else
       this->ctxtPrimes.insert(i); // ciphertext prime
   }
+  buildModuli();
 
   endBuildModChain();
 
   // Read in the partition of m into co-prime factors (if bootstrappable)
   if (content.mvec.length() > 0) {
-    // VJS-FIXME: what about the build_cache and alsoThick params?
-    this->enableBootStrapping(content.mvec,
-                              content.build_cache,
-                              content.alsoThick);
+    assertTrue(isCKKS() || e_param > 0,
+               "enableBootStrapping invoked but willBeBootstrappable "
+               "not set in buildModChain");
+    // The linear maps of a snapshot are read rather than built
+    rcData.init(*this,
+                content.mvec,
+                content.alsoThick,
+                content.build_cache,
+                /*minimal=*/false,
+                content.recryptMaps);
   }
 }
 
@@ -722,18 +858,24 @@ static void CheckPrimes(const Context& context,
   }
 }
 
+long Context::getMaxPrimeBits() const
+{
+  return maxPrimeBits_param > 0 ? maxPrimeBits_param : long(HELIB_SP_NBITS);
+}
+
 // Add small primes to get target resolution
 // FIXME: there is some black magic here.
 // we need to better document the strategy.
 void Context::addSmallPrimes(long resolution, long cpSize)
 {
   // cpSize is the size of the ciphertext primes
-  // Sanity-checks, cpSize \in [0.9*HELIB_SP_NBITS, HELIB_SP_NBITS]
+  // Sanity-checks, cpSize \in [0.9*maxBits, maxBits]
+  const long maxBits = getMaxPrimeBits();
   assertTrue(cpSize >= 30, "cpSize is too small (minimum is 30)");
   assertInRange(cpSize * 10,
-                9l * HELIB_SP_NBITS,
-                10l * HELIB_SP_NBITS,
-                "cpSize not in [0.9*HELIB_SP_NBITS, HELIB_SP_NBITS]",
+                9l * maxBits,
+                10l * maxBits,
+                "cpSize not in [0.9*maxPrimeBits, maxPrimeBits]",
                 true);
 
   long m = getM();
@@ -789,38 +931,67 @@ void Context::addSmallPrimes(long resolution, long cpSize)
   }
 }
 
+long Context::addPrime(long q)
+{
+  if (!fftEnginePlanned) {
+    fftEngine = planFFTEngine(zMStar, q);
+    fftEnginePlanned = true;
+  }
+  primes.push_back(q);
+  logPrimes.push_back(std::log(double(q)));
+  return primes.size() - 1;
+}
+
+void Context::buildModuli()
+{
+  HELIB_TIMER_START;
+  long first = moduli.size();
+  long n = lsize(primes) - first;
+  if (n <= 0)
+    return;
+
+  // Each Cmodulus only depends on its own prime (and selects its own
+  // zz_pContext, which is thread-local in NTL), so they can all be
+  // built at once.
+  std::vector<Cmodulus> built(n);
+  NTL_EXEC_RANGE(n, lo, hi)
+  for (long i : range(lo, hi))
+    built[i] = Cmodulus(zMStar, primes[first + i], 0, fftEngine);
+  NTL_EXEC_RANGE_END
+
+  moduli.insert(moduli.end(), built.begin(), built.end());
+}
+
 void Context::addCtxtPrime(long q)
 {
   assertFalse(inChain(q), "Prime q is already in the prime chain");
-  long i = moduli.size(); // The index of the new prime in the list
-  moduli.push_back(Cmodulus(zMStar, q, 0));
+  long i = addPrime(q); // The index of the new prime in the list
   ctxtPrimes.insert(i);
 }
 
 void Context::addSpecialPrime(long q)
 {
   assertFalse(inChain(q), "Special prime q is already in the prime chain");
-  long i = moduli.size(); // The index of the new prime in the list
-  moduli.push_back(Cmodulus(zMStar, q, 0));
+  long i = addPrime(q); // The index of the new prime in the list
   specialPrimes.insert(i);
 }
 
 // Determine the target size of the ctxtPrimes. The target size is
-// set at 2^n, where n is at most HELIB_SP_NBITS and at least
-// ceil(0.9*HELIB_SP_NBITS), so that we don't overshoot nBits by too
+// set at 2^n, where n is at most maxBits (HELIB_SP_NBITS by default) and
+// at least ceil(0.9*maxBits), so that we don't overshoot nBits by too
 // much.
-// The reason that we do not allow to go below 0.9*HELIB_SP_NBITS is
+// The reason that we do not allow to go below 0.9*maxBits is
 // that we need some of the smallPrimes to be sufficiently smaller
 // than the ctxtPrimes, and still we need these smallPrimes to have
 // m'th roots of unity.
-static long ctxtPrimeSize(long nBits)
+static long ctxtPrimeSize(long nBits, long maxBits)
 {
   double bit_loss =
       -std::log1p(-1.0 / double(1L << PrimeGenerator::B)) / std::log(2.0);
   // std::cerr << "*** bit_loss=" << bit_loss;
 
-  // How many primes of size HELIB_SP_NBITS it takes to get to nBits
-  double maxPsize = HELIB_SP_NBITS - bit_loss;
+  // How many primes of size maxBits it takes to get to nBits
+  double maxPsize = maxBits - bit_loss;
   // primes of length len are guaranteed to be at least (1-1/2^B)*2^len,
 
   long nPrimes = long(ceil(nBits / maxPsize));
@@ -831,8 +1002,8 @@ static long ctxtPrimeSize(long nBits)
   // nPrimes primes of length targetSize multiply out to
   // at least nBits bits.
 
-  long targetSize = HELIB_SP_NBITS;
-  while (10 * (targetSize - 1) >= 9 * HELIB_SP_NBITS &&
+  long targetSize = maxBits;
+  while (10 * (targetSize - 1) >= 9 * maxBits &&
          (targetSize - 1) >= 30 &&
          ((targetSize - 1) - bit_loss) * nPrimes >= nBits)
     targetSize--;
@@ -848,13 +1019,14 @@ void Context::addCtxtPrimes(long nBits, long targetSize)
   // We add enough primes of size targetSize until their product is
   // at least 2^{nBits}
 
-  // Sanity-checks, targetSize \in [0.9*HELIB_SP_NBITS, HELIB_SP_NBITS]
+  // Sanity-checks, targetSize \in [0.9*maxBits, maxBits]
+  const long maxBits = getMaxPrimeBits();
   assertTrue(targetSize >= 30,
              "Target prime is too small (minimum size is 30)");
   assertInRange(targetSize * 10,
-                9l * HELIB_SP_NBITS,
-                10l * HELIB_SP_NBITS,
-                "targetSize not in [0.9*HELIB_SP_NBITS, HELIB_SP_NBITS]",
+                9l * maxBits,
+                10l * maxBits,
+                "targetSize not in [0.9*maxPrimeBits, maxPrimeBits]",
                 true);
   const PAlgebra& palg = getZMStar();
   long m = palg.getM();
@@ -871,41 +1043,21 @@ void Context::addCtxtPrimes(long nBits, long targetSize)
   HELIB_STATS_UPDATE("excess-ctxtPrimes", bitlen - nBits);
 }
 
-void Context::addSpecialPrimes(long nDgts,
-                               bool willBeBootstrappable,
-                               long bitsInSpecialPrimes)
+// Split the primes in ctxtPrimes into (at most) nDgts digits, each digit
+// consisting of roughly the same number of primes. Returns the number of
+// digits actually used.
+static long splitIntoDigits(std::vector<IndexSet>& digits,
+                            const IndexSet& ctxtPrimes,
+                            long nDgts)
 {
-  const PAlgebra& palg = getZMStar();
-  long p = std::abs(palg.getP()); // for CKKS, palg.getP() == -1
-  long m = palg.getM();
-  long phim = palg.getPhiM();
-  long p2r = isCKKS() ? 1 : getAlMod().getPPowR();
-
-  long p2e = p2r;
-  if (willBeBootstrappable && !isCKKS()) {
-    // bigger p^e for bootstrapping
-    long e, ePrime;
-    RecryptData::setAE(e, ePrime, *this);
-    p2e *= NTL::power_long(p, e - ePrime);
-
-    // initialize e and ePrime parameters in the context
-    this->e_param = e;
-    this->ePrime_param = ePrime;
-  }
-
-  long nCtxtPrimes = getCtxtPrimes().card();
-  if (nDgts > nCtxtPrimes)
-    nDgts = nCtxtPrimes; // sanity checks
-  if (nDgts <= 0)
-    nDgts = 1;
-
+  digits.clear();
   digits.resize(nDgts); // allocate space
 
   if (nDgts > 1) { // we break ciphertext into a few digits when key-switching
     // NOTE: The code below assumes that all the ctxtPrimes have roughly the
     // same size
 
-    IndexSet remaining = getCtxtPrimes();
+    IndexSet remaining = ctxtPrimes;
     for (long dgt = 0; dgt < nDgts - 1; dgt++) {
       long digitCard = divc(remaining.card(), nDgts - dgt);
       // ceiling(#-of-remaining-primes, #-or-remaining-digits)
@@ -924,66 +1076,137 @@ void Context::addSpecialPrimes(long nDgts,
     } else
       digits[nDgts - 1] = remaining;
   } else { // only one digit
-    digits[0] = getCtxtPrimes();
+    digits[0] = ctxtPrimes;
   }
+  return nDgts;
+}
 
-  double maxDigitLog = 0.0;
-  for (auto& digit : digits) {
-    double size = logOfProduct(digit);
-    if (size > maxDigitLog)
-      maxDigitLog = size;
-  }
+double Context::specialPrimesBitsEstimate(long nDgts,
+                                          double maxDigitLog,
+                                          long p2e) const
+{
+  const PAlgebra& palg = getZMStar();
+  long p = std::abs(palg.getP()); // for CKKS, palg.getP() == -1
+  long m = palg.getM();
+  long phim = palg.getPhiM();
 
-  // Add special primes to the chain for the P factor of key-switching
   double nBits;
-
-  if (bitsInSpecialPrimes)
-    nBits = bitsInSpecialPrimes;
-  else {
 #if 0
-    nBits = (maxDigitLog + std::log(nDgts) + NTL::log(stdev * 2) +
-             std::log(p2e)) /
-            std::log(2.0);
-    // FIXME: Victor says: the above calculation does not make much sense to me
-#else
-    double h;
-    if (getHwt() == 0)
-      h = phim / 2.0;
-    else
-      h = getHwt();
-
-    double log_phim = std::log(phim);
-    if (log_phim < 1)
-      log_phim = 1;
-
-    if (isCKKS()) {
-      // This is based on a smaller noise estimate so as
-      // to better protect precision...this is based on
-      // a noise level equal to the mod switch added noise.
-      // Note that the relin_CKKS_adjust function in Ctxt.cpp
-      // depends on this estimate.
-      nBits = (maxDigitLog + NTL::log(getStdev()) + std::log(nDgts) -
-               0.5 * std::log(h)) /
-              std::log(2.0);
-    } else if (palg.getPow2()) {
-      nBits = (maxDigitLog + std::log(p2e) + NTL::log(getStdev()) +
-               0.5 * std::log(12.0) + std::log(nDgts) -
-               0.5 * std::log(log_phim) - 2 * std::log(p) - std::log(h)) /
-              std::log(2.0);
-    } else {
-      nBits =
-          (maxDigitLog + std::log(m) + std::log(p2e) + NTL::log(getStdev()) +
-           0.5 * std::log(12.0) + std::log(nDgts) - 0.5 * log_phim -
-           0.5 * std::log(log_phim) - 2 * std::log(p) - std::log(h)) /
+  nBits = (maxDigitLog + std::log(nDgts) + NTL::log(stdev * 2) +
+           std::log(p2e)) /
           std::log(2.0);
+  // FIXME: Victor says: the above calculation does not make much sense to me
+#else
+  double h;
+  if (getHwt() == 0)
+    h = phim / 2.0;
+  else
+    h = getHwt();
+
+  double log_phim = std::log(phim);
+  if (log_phim < 1)
+    log_phim = 1;
+
+  if (isCKKS()) {
+    // This is based on a smaller noise estimate so as
+    // to better protect precision...this is based on
+    // a noise level equal to the mod switch added noise.
+    // Note that the relin_CKKS_adjust function in Ctxt.cpp
+    // depends on this estimate.
+    nBits = (maxDigitLog + NTL::log(getStdev()) + std::log(nDgts) -
+             0.5 * std::log(h)) /
+            std::log(2.0);
+  } else if (palg.getPow2()) {
+    nBits = (maxDigitLog + std::log(p2e) + NTL::log(getStdev()) +
+             0.5 * std::log(12.0) + std::log(nDgts) -
+             0.5 * std::log(log_phim) - 2 * std::log(p) - std::log(h)) /
+            std::log(2.0);
+  } else {
+    nBits = (maxDigitLog + std::log(m) + std::log(p2e) + NTL::log(getStdev()) +
+             0.5 * std::log(12.0) + std::log(nDgts) - 0.5 * log_phim -
+             0.5 * std::log(log_phim) - 2 * std::log(p) - std::log(h)) /
+            std::log(2.0);
+  }
+
+  // Both of the above over-estimate nBits by a factor of
+  // log2(scale). That should provide a sufficient safety margin.
+  // See design document
+#endif
+  return nBits;
+}
+
+void Context::addSpecialPrimes(long nDgts,
+                               bool willBeBootstrappable,
+                               long bitsInSpecialPrimes)
+{
+  const PAlgebra& palg = getZMStar();
+  long p = std::abs(palg.getP()); // for CKKS, palg.getP() == -1
+  long m = palg.getM();
+  long p2r = isCKKS() ? 1 : getAlMod().getPPowR();
+
+  long p2e = p2r;
+  if (willBeBootstrappable && !isCKKS()) {
+    // bigger p^e for bootstrapping
+    long e, ePrime;
+    RecryptData::setAE(e, ePrime, *this);
+    p2e *= NTL::power_long(p, e - ePrime);
+
+    // initialize e and ePrime parameters in the context
+    this->e_param = e;
+    this->ePrime_param = ePrime;
+  }
+
+  auto maxDigitLogOf = [this]() {
+    double maxDigitLog = 0.0;
+    for (auto& digit : digits) {
+      double size = logOfProduct(digit);
+      if (size > maxDigitLog)
+        maxDigitLog = size;
     }
+    return maxDigitLog;
+  };
 
-    // Both of the above over-estimate nBits by a factor of
-    // log2(scale). That should provide a sufficient safety margin.
-    // See design document
+  long nCtxtPrimes = getCtxtPrimes().card();
+  if (nDgts > nCtxtPrimes)
+    nDgts = nCtxtPrimes; // sanity checks
 
-#endif
+  if (nDgts <= 0 && bitsInSpecialPrimes > 0) {
+    // Hybrid key-switching: the number of digits is derived from the
+    // special-primes budget, using the fewest digits that the budget
+    // can support. Fewer digits mean faster key-switching and smaller keys.
+    bool fits = false;
+    for (nDgts = 1; !fits && nDgts <= nCtxtPrimes; nDgts++) {
+      long nUsed = splitIntoDigits(digits, getCtxtPrimes(), nDgts);
+      fits = (specialPrimesBitsEstimate(nUsed, maxDigitLogOf(), p2e) <=
+              bitsInSpecialPrimes);
+    }
+    nDgts--; // undo the last increment of the loop
+    if (!fits)
+      Warning(__func__ + std::string(": the special primes budget of ") +
+              std::to_string(bitsInSpecialPrimes) +
+              " bits is too small even with one digit per ctxt prime");
   }
+  if (nDgts <= 0)
+    nDgts = 1;
+
+  nDgts = splitIntoDigits(digits, getCtxtPrimes(), nDgts);
+  double maxDigitLog = maxDigitLogOf();
+
+  // Add special primes to the chain for the P factor of key-switching
+  double nBits;
+
+  if (bitsInSpecialPrimes) {
+    nBits = bitsInSpecialPrimes;
+    double estimate = specialPrimesBitsEstimate(nDgts, maxDigitLog, p2e);
+    if (nBits < estimate)
+      Warning(__func__ + std::string(": bitsInSpecialPrimes=") +
+              std::to_string(bitsInSpecialPrimes) +
+              " is below the estimated " +
+              std::to_string(long(ceil(estimate))) + " bits needed for " +
+              std::to_string(nDgts) +
+              " digits, key-switching noise may be too large");
+  } else
+    nBits = specialPrimesBitsEstimate(nDgts, maxDigitLog, p2e);
 
   if (nBits < 1)
     nBits = 1;
@@ -991,8 +1214,9 @@ void Context::addSpecialPrimes(long nDgts,
   double bit_loss =
       -std::log1p(-1.0 / double(1L << PrimeGenerator::B)) / std::log(2.0);
 
-  // How many primes of size HELIB_SP_NBITS it takes to get to nBits
-  double maxPsize = HELIB_SP_NBITS - bit_loss;
+  // How many primes of size maxBits it takes to get to nBits
+  const long maxBits = getMaxPrimeBits();
+  double maxPsize = maxBits - bit_loss;
   // primes of length len are guaranteed to be at least (1-1/2^B)*2^len,
 
   long nPrimes = long(ceil(nBits / maxPsize));
@@ -1003,8 +1227,8 @@ void Context::addSpecialPrimes(long nDgts,
   // nPrimes primes of length targetSize multiply out to
   // at least nBits bits.
 
-  long targetSize = HELIB_SP_NBITS;
-  while ((targetSize - 1) >= 0.55 * HELIB_SP_NBITS && (targetSize - 1) >= 30 &&
+  long targetSize = maxBits;
+  while ((targetSize - 1) >= 0.55 * maxBits && (targetSize - 1) >= 30 &&
          ((targetSize - 1) - bit_loss) * nPrimes >= nBits)
     targetSize--;
 
@@ -1039,17 +1263,23 @@ void Context::buildModChain(long nBits,
                             bool willBeBootstrappable,
                             long skHwt,
                             long resolution,
-                            long bitsInSpecialPrimes)
+                            long bitsInSpecialPrimes,
+                            long maxPrimeBits)
 {
   // Cannot build modulus chain with nBits < 0
   assertTrue<InvalidArgument>(nBits > 0,
                               "Cannot initialise modulus chain with nBits < 1");
 
-  assertTrue(skHwt >= 0, "invalid skHwt parameter");
+  if (maxPrimeBits == 0)
+    maxPrimeBits = HELIB_SP_NBITS;
+  assertInRange<InvalidArgument>(maxPrimeBits,
+                                 30l,
+                                 long(HELIB_SP_NBITS),
+                                 "maxPrimeBits must be in [30, HELIB_SP_NBITS]",
+                                 true);
+  maxPrimeBits_param = maxPrimeBits;
 
-  // ignore for CKKS
-  if (isCKKS())
-    willBeBootstrappable = false;
+  assertTrue(skHwt >= 0, "invalid skHwt parameter");
 
   if (skHwt == 0) {
     // default skHwt: if bootstrapping, set to BOOT_DFLT_SK_HWT
@@ -1060,10 +1290,11 @@ void Context::buildModChain(long nBits,
   // initialize hwt param in context
   hwt_param = skHwt;
 
-  long pSize = ctxtPrimeSize(nBits);
+  long pSize = ctxtPrimeSize(nBits, maxPrimeBits);
   addSmallPrimes(resolution, pSize);
   addCtxtPrimes(nBits, pSize);
   addSpecialPrimes(nDgts, willBeBootstrappable, bitsInSpecialPrimes);
+  buildModuli();
 
   CheckPrimes(*this, smallPrimes, "smallPrimes");
   CheckPrimes(*this, ctxtPrimes, "ctxtPrimes");
@@ -1075,8 +1306,7 @@ void Context::buildModChain(long nBits,
 void Context::addSmallPrime(long q)
 {
   assertFalse(inChain(q), "Small prime q is already in the prime chain");
-  long i = moduli.size(); // The index of the new prime in the list
-  moduli.push_back(Cmodulus(zMStar, q, 0));
+  long i = addPrime(q); // The index of the new prime in the list
   smallPrimes.insert(i);
 }
 
@@ -1091,6 +1321,75 @@ void Context::endBuildModChain()
   pwfl_converter = std::make_shared<PowerfulDCRT>(*this, mmvec);
 }
 
+std::shared_ptr<const RNSBaseConverter>
+Context::getBaseConverter(const IndexSet& from, const IndexSet& to) const
+{
+  // The key lists the primes of from, then a separator, then these of to
+  std::vector<long> key;
+  key.reserve(card(from) + card(to) + 1);
+  for (long i : from)
+    key.push_back(i);
+  key.push_back(-1);
+  for (long i : to)
+    key.push_back(i);
+
+  {
+    std::lock_guard<std::mutex> lock(baseConvertersLock);
+    auto it = baseConverters.find(key);
+    if (it != baseConverters.end())
+      return it->second;
+  }
+
+  auto conv = std::make_shared<const RNSBaseConverter>(*this, from, to);
+
+  std::lock_guard<std::mutex> lock(baseConvertersLock);
+  if (long(baseConverters.size()) >= MAX_CACHED_BASE_CONVERTERS)
+    return conv;
+  // Another thread may have added it in the meantime, keep the first one
+  return baseConverters.emplace(std::move(key), std::move(conv)).first->second;
+}
+
+std::shared_ptr<const std::vector<long>>
+Context::getAutomorphPermutation(long k) const
+{
+  long m = zMStar.getM();
+  k = mcMod(k, m);
+  assertTrue<InvalidArgument>(zMStar.inZmStar(k), "k is not in Zm*");
+
+  {
+    std::lock_guard<std::mutex> lock(automorphPermsLock);
+    auto it = automorphPerms.find(k);
+    if (it != automorphPerms.end())
+      return it->second;
+  }
+
+  // perm[j] = the index of rep(j)*k mod m, so new[j] = old[perm[j]]
+  long phim = zMStar.getPhiM();
+  auto perm = std::make_shared<std::vector<long>>(phim);
+  NTL::mulmod_precon_t precon = NTL::PrepMulModPrecon(k, m);
+  for (long j : range(phim)) {
+    long rep =
+        NTL::MulModPrecon(zMStar.repInZmstar_unchecked(j), k, m, precon);
+    (*perm)[j] = zMStar.indexInZmstar_unchecked(rep);
+  }
+
+  std::lock_guard<std::mutex> lock(automorphPermsLock);
+  if (long(automorphPerms.size()) >= MAX_CACHED_AUTOMORPHS)
+    return perm;
+  // Another thread may have added it in the meantime, keep the first one
+  return automorphPerms.emplace(k, std::move(perm)).first->second;
+}
+
+MemoryReport Context::memoryReport() const
+{
+  MemoryReport report = memoryAccounts.report();
+  ScratchPoolStats pools = ScratchPool::totalStats();
+  MemoryUsage& scratch = report[MemoryCategory::SCRATCH];
+  scratch.rows += pools.pooledRows;
+  scratch.bytes += pools.pooledBytes;
+  return report;
+}
+
 // Helper for the build and buildPtr methods
 template <typename SCHEME>
 const std::pair<std::optional<Context::ModChainParams>,
@@ -1105,6 +1404,7 @@ ContextBuilder<SCHEME>::makeParamsArgs() const
                                                          skHwt_,
                                                          resolution_,
                                                          bitsInSpecialPrimes_,
+                                                         maxPrimeBits_,
                                                          stdev_,
                                                          scale_})
           : std::nullopt;
@@ -1147,6 +1447,7 @@ std::ostream& operator<<<BGV>(std::ostream& os, const ContextBuilder<BGV>& cb)
                   {"skHwt", cb.skHwt_},
                   {"resolution", cb.resolution_},
                   {"bitsInSpecialPrimes", cb.bitsInSpecialPrimes_},
+                  {"maxPrimeBits", cb.maxPrimeBits_},
                   {"bootstrappableFlag", cb.bootstrappableFlag_},
                   {"mvec", cb.mvec_},
                   {"buildCacheFlag", cb.buildCacheFlag_},
@@ -1168,7 +1469,9 @@ std::ostream& operator<<<CKKS>(std::ostream& os, const ContextBuilder<CKKS>& cb)
                   {"bits", cb.bits_},
                   {"skHwt", cb.skHwt_},
                   {"resolution", cb.resolution_},
-                  {"bitsInSpecialPrimes", cb.bitsInSpecialPrimes_}};
+                  {"bitsInSpecialPrimes", cb.bitsInSpecialPrimes_},
+                  {"maxPrimeBits", cb.maxPrimeBits_},
+                  {"bootstrappableFlag", cb.bootstrappableFlag_}};
   os << toTypedJson<ContextBuilder<CKKS>>(j);
   return os;
 }
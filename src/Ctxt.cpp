@@ -12,6 +12,9 @@
 #include <NTL/BasicThreadPool.h>
 #include <NTL/ZZ.h>
 
+#include <exception>
+#include <optional>
+
 #include "io.h"
 #include "binio.h"
 #include "macro.h"
@@ -23,6 +26,7 @@
 #include <helib/CtPtrs.h>
 #include <helib/EncryptedArray.h>
 #include <helib/Ptxt.h>
+#include <helib/EncodedPtxtCache.h>
 
 #include <helib/debugging.h>
 #include <helib/norms.h>
@@ -100,6 +104,58 @@ void SKHandle::readJSON(const JsonWrapper& jw)
 std::set<long>* FHEglobals::automorphVals = nullptr;
 std::set<long>* FHEglobals::automorphVals2 = nullptr;
 
+static std::function<void(const CtxtOpReport&)> ctxtOpHook;
+static thread_local long ctxtOpDepth = 0;
+
+void setCtxtOpHook(std::function<void(const CtxtOpReport&)> hook)
+{
+  ctxtOpHook = std::move(hook);
+}
+
+std::ostream& operator<<(std::ostream& str, const CtxtOpReport& report)
+{
+  return str << report.op << ": depth=" << report.depth
+             << " capacity=" << report.capacityBefore << "->"
+             << report.capacityAfter << " noise=" << report.noiseBefore
+             << "->" << report.noiseAfter << " primes=" << report.primesBefore
+             << "->" << report.primesAfter;
+}
+
+// log2 of the noise bound, 0 for an empty ciphertext
+static double log2NoiseBound(const Ctxt& ctxt)
+{
+  NTL::xdouble bound = ctxt.getNoiseBound();
+  return (bound > 0) ? NTL::log(bound) / std::log(2.0) : 0.0;
+}
+
+CtxtOpTrace::CtxtOpTrace(const Ctxt& ctxt, const char* op) :
+    active(bool(ctxtOpHook))
+{
+  if (!active)
+    return;
+  report.op = op;
+  report.ctxt = &ctxt;
+  report.depth = ctxtOpDepth++;
+  report.capacityBefore = ctxt.capacity();
+  report.noiseBefore = log2NoiseBound(ctxt);
+  report.primesBefore = ctxt.getPrimeSet().card();
+  uncaught = std::uncaught_exceptions();
+}
+
+CtxtOpTrace::~CtxtOpTrace()
+{
+  if (!active)
+    return;
+  ctxtOpDepth--;
+  if (std::uncaught_exceptions() > uncaught)
+    return; // unwinding, the ciphertext may be half-way changed
+  const Ctxt& ctxt = *report.ctxt;
+  report.capacityAfter = ctxt.capacity();
+  report.noiseAfter = log2NoiseBound(ctxt);
+  report.primesAfter = ctxt.getPrimeSet().card();
+  ctxtOpHook(report);
+}
+
 long Ctxt::effectiveR() const
 {
   long p = context.getP();
@@ -113,6 +169,21 @@ long Ctxt::effectiveR() const
   return 0; // just to keep the compiler happy
 }
 
+long Ctxt::numDeferredKeySwitches() const
+{
+  std::vector<const SKHandle*> seen;
+  for (const CtxtPart& part : parts) {
+    if (part.skHandle.getPowerOfX() == 1)
+      continue;
+    bool found = false;
+    for (const SKHandle* handle : seen)
+      found = found || (*handle == part.skHandle);
+    if (!found)
+      seen.push_back(&part.skHandle);
+  }
+  return seen.size();
+}
+
 bool Ctxt::isCorrect() const
 {
   NTL::xdouble xQ = NTL::xexp(getContext().logOfProduct(getPrimeSet()));
@@ -186,48 +257,60 @@ bool Ctxt::verifyPrimeSet() const
 }
 
 // Multiply vector of digits by key-switching matrix and add to *this.
-// It is assumed that W has at least as many b[i]'s as there are digits.
-// The vector of digits is modified in place.
+// It is assumed that W has at least as many b[i]'s as there are digits,
+// and that all the digits are defined over the same primes.
+// Both inner products are computed with DoubleCRT::innerProduct, which
+// needs no temporaries and reduces each sum only once.
 void Ctxt::keySwitchDigits(const KeySwitch& W, std::vector<DoubleCRT>& digits)
-{ // An object to hold the pseudorandom ai's, note that it must be defined
-  // with the maximum number of levels, else the PRG will go out of sync.
-  // FIXME: This is a bug waiting to happen.
-
-  DoubleCRT ai(context, context.getCtxtPrimes() | context.getSpecialPrimes());
-
-  // Subsequent ai's use the evolving RNG state
-  RandomState state; // backup the NTL PRG seed
-  NTL::SetSeed(W.prgSeed);
-
-  // Add the columns in, one by one
-  DoubleCRT tmpDCRT(context, IndexSet::emptySet());
-  for (size_t i = 0; i < digits.size(); i++) {
-    HELIB_NTIMER_START(KS_loop);
-    ai.randomize();
-    tmpDCRT = digits[i];
-
-    // The operations below all use the IndexSet of tmpDCRT
+{
+  if (digits.empty())
+    return;
 
-    // add digit*a[i] with a handle pointing to base of W.toKeyID
-    {
-      HELIB_NTIMER_START(KS_loop_1);
-      tmpDCRT.Mul(ai, /*matchIndexSet=*/false);
-    }
-    {
-      HELIB_NTIMER_START(KS_loop_2);
-      this->addPart(tmpDCRT, SKHandle(1, 1, W.toKeyID), /*matchPrimeSet=*/true);
-    }
-    // add digit*b[i] with a handle pointing to one
-    {
-      HELIB_NTIMER_START(KS_loop_3);
-      digits[i].Mul(W.b[i], /*matchIndexSet=*/false);
-    }
-    {
-      HELIB_NTIMER_START(KS_loop_4);
-      this->addPart(digits[i], SKHandle(), /*matchPrimeSet=*/true);
-    }
+  fhe_ops.keySwitches++;
+
+  // The pseudorandom ai's, unless W keeps them in memory. With an indexed
+  // seed they are only generated modulo the primes of the digits, otherwise
+  // they must be defined with the maximum number of levels, else the PRG
+  // will go out of sync.
+  // The temporaries below are charged to SCRATCH, while the parts they are
+  // added to are ciphertext parts
+  const bool scratch = MemoryScope::current() == MemoryCategory::OTHER;
+  const std::vector<DoubleCRT>* ai = W.getExpandedA();
+  std::vector<DoubleCRT> generated;
+  if (ai == nullptr) {
+    HELIB_NTIMER_START(KS_loop_prg);
+    const IndexSet aPrimes =
+        W.hasIndexedSeed() ? digits[0].getIndexSet() : context.fullPrimes();
+    DoubleCRT zero(context, aPrimes);
+    if (scratch)
+      zero.setMemoryCategory(MemoryCategory::SCRATCH);
+    generated.assign(digits.size(), zero);
+    W.generateA(generated);
+    ai = &generated;
+  }
+
+  // The operations below all use the IndexSet of the digits
+  DoubleCRT sum(context, digits[0].getIndexSet());
+  if (scratch)
+    sum.setMemoryCategory(MemoryCategory::SCRATCH);
+
+  // add sum_i digit[i]*a[i] with a handle pointing to base of W.toKeyID
+  {
+    HELIB_NTIMER_START(KS_loop_1);
+    sum.innerProduct(digits, *ai);
+  }
+  this->addPart(sum, SKHandle(1, 1, W.toKeyID), /*matchPrimeSet=*/true);
+
+  // add sum_i digit[i]*b[i] with a handle pointing to one
+  {
+    HELIB_NTIMER_START(KS_loop_3);
+    if (W.isMapped())
+      sum.innerProduct(digits, W.getMappedB()); // in place, in the key file
+    else
+      sum.innerProduct(digits, *W.residentB()); // kept alive while in use
   }
-} // restore random state upon destruction of the RandomState, see NumbTh.h
+  this->addPart(sum, SKHandle(), /*matchPrimeSet=*/true);
+}
 
 bool CtxtPart::operator==(const CtxtPart& other) const
 {
@@ -307,6 +390,24 @@ Ctxt::Ctxt(ZeroCtxtLike_type, const Ctxt& ctxt) :
   ratFactor = ptxtMag = 1.0;
 }
 
+Ctxt::Ctxt(SharedCopy_type, const Ctxt& ctxt) :
+    context(ctxt.context),
+    pubKey(ctxt.pubKey),
+    primeSet(ctxt.primeSet),
+    ptxtSpace(ctxt.ptxtSpace),
+    noiseBound(ctxt.noiseBound),
+    intFactor(ctxt.intFactor),
+    ratFactor(ctxt.ratFactor),
+    ptxtMag(ctxt.ptxtMag),
+    uniformSeed(ctxt.uniformSeed)
+{
+  parts.reserve(ctxt.parts.size());
+  for (const CtxtPart& part : ctxt.parts) {
+    parts.emplace_back(context, IndexSet(), part.skHandle);
+    parts.back().share(part);
+  }
+}
+
 // A private assignment method that does not check equality of context or
 // public key, this needed for example when we copy the pubEncrKey member
 // between different public keys.
@@ -316,6 +417,7 @@ Ctxt& Ctxt::privateAssign(const Ctxt& other)
   if (this == &other)
     return *this; // both point to the same object
 
+  // Assigns part by part, so parts over the same primes keep their rows
   parts = other.parts;
   primeSet = other.primeSet;
   ptxtSpace = other.ptxtSpace;
@@ -323,6 +425,23 @@ Ctxt& Ctxt::privateAssign(const Ctxt& other)
   intFactor = other.intFactor;
   ratFactor = other.ratFactor;
   ptxtMag = other.ptxtMag;
+  uniformSeed = other.uniformSeed;
+  return *this;
+}
+
+Ctxt& Ctxt::privateAssign(Ctxt&& other)
+{
+  if (this == &other)
+    return *this;
+
+  parts = std::move(other.parts); // other is left empty
+  primeSet = other.primeSet;
+  ptxtSpace = other.ptxtSpace;
+  noiseBound = other.noiseBound;
+  intFactor = other.intFactor;
+  ratFactor = other.ratFactor;
+  ptxtMag = other.ptxtMag;
+  uniformSeed = std::move(other.uniformSeed);
   return *this;
 }
 
@@ -345,6 +464,7 @@ void Ctxt::mulIntFactor(long e)
 // have s<=primeSet. s must contain either all special primes or none of them.
 void Ctxt::modUpToSet(const IndexSet& s)
 {
+  CtxtOpTrace trace(*this, "modUpToSet");
   IndexSet setDiff =
       s / primeSet; // set minus (primes in s but not in primeSet)
   if (empty(setDiff))
@@ -352,7 +472,7 @@ void Ctxt::modUpToSet(const IndexSet& s)
 
   // scale up all the parts to use also the primes in setDiff
   double f = 0.0;
-  for (long i = 0; i < lsize(parts); i++) {
+  for (long i = 0; i < long(parts.size()); i++) {
     // addPrimesAndScale returns the log of the product of added primes,
     // all calls return the same value = log(prod. of primes in setDiff)
     f = parts[i].addPrimesAndScale(setDiff);
@@ -393,6 +513,7 @@ void Ctxt::bringToSet(const IndexSet& s)
 void Ctxt::modDownToSet(const IndexSet& s)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "modDownToSet");
   IndexSet intersection = primeSet & s;
   if (empty(intersection)) {
     std::stringstream ss;
@@ -402,6 +523,7 @@ void Ctxt::modDownToSet(const IndexSet& s)
   IndexSet setDiff = primeSet / intersection; // set-minus
   if (empty(setDiff))
     return; // nothing to do, removing no primes
+  fhe_ops.modDowns.add(primeSet.card());
 
   // Scale down all the parts: use either a simple "drop down" (just removing
   // primes, i.e., reducing the ctxt modulo the smaller modulus), or a "real
@@ -462,22 +584,15 @@ void Ctxt::modDownToSet(const IndexSet& s)
     Warning("Ctxt::modDownToSet: DEGENERATE DROP");
   } else { // do real mod switching
 #if 1
-    NTL::ZZX delta;
-    NTL::ZZ diff = context.productOfPrimes(setDiff);
-    NTL::xdouble xdiff = NTL::conv<NTL::xdouble>(diff);
-
     long nparts = parts.size();
 
+    // The scale down stays in RNS form, and gives delta/diff directly
     std::vector<std::vector<double>> fdeltas(nparts);
     for (long i : range(nparts)) {
       CtxtPart& part = parts[i];
       std::vector<double>& fdelta = fdeltas[i];
-      part.scaleDownToSet(intersection, ptxtSpace, delta);
-      fdelta.resize(delta.rep.length());
-      for (long j : range(delta.rep.length())) {
-        fdelta[j] =
-            NTL::conv<double>(NTL::conv<NTL::xdouble>(delta.rep[j]) / xdiff);
-
+      part.scaleDownToSet(intersection, ptxtSpace, fdelta);
+      for (long j : range(lsize(fdelta))) {
         // sanity check: |fdelta[j]| <= ptxtSpace/2
         if (std::fabs(fdelta[j]) > double(ptxtSpace) / 2.0 + 0.0001) {
           std::stringstream ss;
@@ -575,6 +690,7 @@ void Ctxt::blindCtxt(const NTL::ZZX& poly)
 // Reduce plaintext space to a divisor of the original plaintext space
 void Ctxt::reducePtxtSpace(long newPtxtSpace)
 {
+  CtxtOpTrace trace(*this, "reducePtxtSpace");
   long g = NTL::GCD(ptxtSpace, newPtxtSpace);
 
   // NOTE: Will trigger an error if called for CKKS ciphertext
@@ -588,6 +704,7 @@ void Ctxt::reducePtxtSpace(long newPtxtSpace)
 // modulus-switching added noise term.
 void Ctxt::dropSmallAndSpecialPrimes()
 {
+  CtxtOpTrace trace(*this, "dropSmallAndSpecialPrimes");
   if (primeSet.disjointFrom(context.getSmallPrimes())) {
     // nothing to do except drop the special primes, if any
     modDownToSet(context.getCtxtPrimes());
@@ -661,7 +778,7 @@ void Ctxt::dropSmallAndSpecialPrimes()
   }
 }
 
-void Ctxt::relin_CKKS_adjust()
+void Ctxt::relin_CKKS_adjust(double logScale)
 {
   if (isCKKS()) {
     // we have to increase the noise if it's too small,
@@ -698,11 +815,11 @@ void Ctxt::relin_CKKS_adjust()
     constexpr double fudge_factor = 8;
     // increase bound by fudge_factor, based on experimentation
 
-    double gamma = beta * fudge_factor;
+    NTL::xdouble gamma = beta * fudge_factor * NTL::xexp(logScale);
 
     if (gamma > noiseBound) {
       // xf = ceil(beta/noiseBound)
-      long xf = long(std::ceil(gamma / convert<double>(noiseBound)));
+      long xf = long(std::ceil(convert<double>(gamma / noiseBound)));
       for (auto& part : parts)
         part *= xf;
       noiseBound *= xf; // Increase noiseBound
@@ -720,10 +837,12 @@ void Ctxt::relin_CKKS_adjust()
 void Ctxt::reLinearize(long keyID)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "reLinearize");
   // Special case: if *this is empty or already re-linearized then do nothing
   if (this->isEmpty() || this->inCanonicalForm(keyID))
     return;
     // this->reduce();
+  fhe_ops.reLinearizations.add(primeSet.card());
 
 #if 0
   // HERE
@@ -805,6 +924,7 @@ Ctxt& Ctxt::cleanUp()
 void Ctxt::keySwitchPart(const CtxtPart& p, const KeySwitch& W)
 {
   HELIB_TIMER_START;
+  fhe_ops.keySwitchParts.add(p.getIndexSet().card());
 
   // no special primes in the input part
   assertTrue(
@@ -895,6 +1015,7 @@ void Ctxt::addPart(const DoubleCRT& part,
 // Add a constant polynomial
 void Ctxt::addConstant(const DoubleCRT& dcrt, double size)
 {
+  CtxtOpTrace trace(*this, "addConstant");
   if (isCKKS()) {
     addConstantCKKS(dcrt, NTL::to_xdouble(size));
     return;
@@ -952,6 +1073,7 @@ void Ctxt::addConstantCKKS(const DoubleCRT& dcrt,
                            NTL::xdouble size,
                            NTL::xdouble factor)
 {
+  CtxtOpTrace trace(*this, "addConstantCKKS");
   // VJS-FIXME: this routine has a number of issues and should
   // be deprecated in favor of the new EncodedPtxt-based routines
   if (size <= 0)
@@ -1189,6 +1311,7 @@ void addSomePrimes(Ctxt& c)
 
 void Ctxt::negate()
 {
+  CtxtOpTrace trace(*this, "negate");
   for (size_t i = 0; i < parts.size(); i++)
     parts[i].Negate();
 }
@@ -1406,6 +1529,7 @@ static NTL::xdouble NoiseNorm(NTL::xdouble noise1,
 void Ctxt::addCtxt(const Ctxt& other, bool negative)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "addCtxt");
 
   // Sanity check: same context and public key
   assertEq(&context, &other.context, "Context mismatch");
@@ -1434,13 +1558,20 @@ void Ctxt::addCtxt(const Ctxt& other, bool negative)
 
   const Ctxt* other_pt = &other;
 
+  // A copy of other, only made (once) if other must be changed. Most
+  // additions never need it
+  std::optional<Ctxt> tmp;
+  auto modifiableOther = [&]() -> Ctxt& {
+    if (!tmp) {
+      tmp.emplace(other);
+      other_pt = &*tmp;
+    }
+    return *tmp;
+  };
+
   // make other ptxtSpace match
-  Ctxt tmp(pubKey, other.ptxtSpace); // a temporary empty ciphertext
-  if (ptxtSpace != other_pt->ptxtSpace) {
-    tmp = other;
-    tmp.reducePtxtSpace(ptxtSpace);
-    other_pt = &tmp;
-  }
+  if (ptxtSpace != other_pt->ptxtSpace)
+    modifiableOther().reducePtxtSpace(ptxtSpace);
 
   // Match the prime-sets, mod-UP the arguments if needed
   IndexSet s = other_pt->primeSet / primeSet; // set-minus
@@ -1448,13 +1579,8 @@ void Ctxt::addCtxt(const Ctxt& other, bool negative)
     modUpToSet(s);
 
   s = primeSet / other_pt->primeSet; // set-minus
-  if (!empty(s)) { // need to mod-UP the other, use a temporary copy
-    if (other_pt != &tmp) {
-      tmp = other;
-      other_pt = &tmp;
-    }
-    tmp.modUpToSet(s);
-  }
+  if (!empty(s)) // need to mod-UP the other, use a temporary copy
+    modifiableOther().modUpToSet(s);
 
   // std::cerr << "*** " << ratFactor << " " << other_pt->ratFactor << "\n";
 
@@ -1464,13 +1590,10 @@ void Ctxt::addCtxt(const Ctxt& other, bool negative)
   // noiseBound is actually computed accurately.
   // if (isCKKS() && !closeToOne(ratFactor / other_pt->ratFactor,
   // getContext().getAlMod().getPPowR() * 2)) {
-  if (isCKKS()) {
-    if (other_pt != &tmp) {
-      tmp = other;
-      other_pt = &tmp;
-    }
-    equalizeRationalFactors(*this, tmp);
-  }
+  // At the same scale there is nothing to equalize (and nothing to copy),
+  // which is the common case of adding up products of the same depth.
+  if (isCKKS() && ratFactor != other_pt->ratFactor)
+    equalizeRationalFactors(*this, modifiableOther());
   long e1 = 1, e2 = 1;
   if (!isCKKS() && intFactor != other_pt->intFactor) { // harmonize factors
     long f1 = intFactor;
@@ -1525,13 +1648,8 @@ void Ctxt::addCtxt(const Ctxt& other, bool negative)
     assertEq(NTL::GCD(e2, ptxtSpace), 1l, "e2 and ptxtSpace not co-prime");
   }
 
-  if (e2 != 1) {
-    if (other_pt != &tmp) {
-      tmp = other;
-      other_pt = &tmp;
-    }
-    tmp.mulIntFactor(e2);
-  }
+  if (e2 != 1)
+    modifiableOther().mulIntFactor(e2);
   if (e1 != 1)
     mulIntFactor(e1);
 
@@ -1573,7 +1691,65 @@ void Ctxt::tensorProduct(const Ctxt& c1, const Ctxt& c2)
     intFactor = NTL::MulMod(intFactor, q, ptxtSp);
   }
 
-  // The actual tensoring
+  // Two canonical ciphertexts (a0 + a1*s)(b0 + b1*s) over the same primes:
+  // the middle part is (a0+a1)(b0+b1) - a0b0 - a1b1, one product less
+  if (c1.parts.size() == 2 && c2.parts.size() == 2 &&
+      c1.inCanonicalForm(-1) && c2.inCanonicalForm(-1) &&
+      c1.parts[1].skHandle == c2.parts[1].skHandle &&
+      c1.parts[0].getIndexSet() == primeSet &&
+      c1.parts[1].getIndexSet() == primeSet &&
+      c2.parts[0].getIndexSet() == primeSet &&
+      c2.parts[1].getIndexSet() == primeSet) {
+    tensorCanonical(c1, c2);
+  } else {
+    tensorGeneric(c1, c2);
+  }
+
+  // Compute the noise estimate of the product
+  if (isCKKS()) { // we have totalNoiseBound = factor*ptxt + noiseBound
+    noiseBound = c1.noiseBound * c2.ptxtMag * c2.ratFactor +
+                 c2.noiseBound * c1.ptxtMag * c1.ratFactor +
+                 c1.noiseBound * c2.noiseBound;
+    ratFactor = c1.ratFactor * c2.ratFactor;
+    ptxtMag = c1.ptxtMag * c2.ptxtMag;
+  } else // BGV
+    noiseBound = c1.noiseBound * c2.noiseBound;
+}
+
+void Ctxt::tensorCanonical(const Ctxt& c1, const Ctxt& c2)
+{
+  const CtxtPart& a0 = c1.parts[0];
+  const CtxtPart& a1 = c1.parts[1];
+  const CtxtPart& b0 = c2.parts[0];
+  const CtxtPart& b1 = c2.parts[1];
+
+  SKHandle h0, h1, h2;
+  if (!h0.mul(a0.skHandle, b0.skHandle) || !h1.mul(a0.skHandle, b1.skHandle) ||
+      !h2.mul(a1.skHandle, b1.skHandle))
+    throw LogicError("Ctxt::tensorProduct: cannot multiply secret-key handles");
+
+  parts.reserve(3);
+  parts.emplace_back(a0, h0);
+  parts.emplace_back(a0, h1);
+  parts.emplace_back(a1, h2);
+  CtxtPart& p0 = parts[0];
+  CtxtPart& p1 = parts[1];
+  CtxtPart& p2 = parts[2];
+
+  // All the index sets are the same, so nothing needs matching
+  p0.Mul(b0, /*matchIndexSets=*/false);
+  p2.Mul(b1, /*matchIndexSets=*/false);
+
+  DoubleCRT bSum(b0);
+  bSum.Add(b1, /*matchIndexSets=*/false);
+  p1.Add(a1, /*matchIndexSets=*/false);
+  p1.Mul(bSum, /*matchIndexSets=*/false);
+  p1.Sub(p0, /*matchIndexSets=*/false);
+  p1.Sub(p2, /*matchIndexSets=*/false);
+}
+
+void Ctxt::tensorGeneric(const Ctxt& c1, const Ctxt& c2)
+{
   CtxtPart tmpPart(context, IndexSet::emptySet()); // a scratch CtxtPart
   for (long i : range(c1.parts.size())) {
     CtxtPart thisPart = c1.parts[i];
@@ -1595,16 +1771,6 @@ void Ctxt::tensorProduct(const Ctxt& c1, const Ctxt& c2)
         parts.push_back(tmpPart);
     }
   }
-
-  // Compute the noise estimate of the product
-  if (isCKKS()) { // we have totalNoiseBound = factor*ptxt + noiseBound
-    noiseBound = c1.noiseBound * c2.ptxtMag * c2.ratFactor +
-                 c2.noiseBound * c1.ptxtMag * c1.ratFactor +
-                 c1.noiseBound * c2.noiseBound;
-    ratFactor = c1.ratFactor * c2.ratFactor;
-    ptxtMag = c1.ptxtMag * c2.ptxtMag;
-  } else // BGV
-    noiseBound = c1.noiseBound * c2.noiseBound;
 }
 
 void computeIntervalForMul(double& lo,
@@ -1677,10 +1843,88 @@ IndexSet Ctxt::naturalPrimeSet() const
   return context.getModSizeTable().getSet4Size(lo, hi, primeSet, isCKKS());
 }
 
+void Ctxt::rescale()
+{
+  HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "rescale");
+  if (isEmpty())
+    return;
+
+  IndexSet target = naturalPrimeSet() & primeSet;
+  if (!empty(target) && target != primeSet)
+    modDownToSet(target);
+}
+
+
+void Ctxt::dropToCapacity(long targetBits)
+{
+  HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "dropToCapacity");
+  assertTrue<InvalidArgument>(targetBits >= 0,
+                              "Ctxt::dropToCapacity: negative targetBits");
+  if (isEmpty())
+    return;
+
+  dropSmallAndSpecialPrimes();
+
+  // Switching down to a modulus q' scales the noise N by q'/q, and adds
+  // A = modSwitchAddedNoiseBound(), so the capacity afterwards is
+  // log2(q' / (N q'/q + A)). We want it (at least) one bit above
+  // targetBits, i.e. log q' >= log A + T log 2 - log(1 - 2^T N/q)
+  double T = targetBits + 1;
+  double cap = capacity();
+  if (cap > T + 1) {
+    double logA = log(modSwitchAddedNoiseBound());
+    double low = logA + T * log(2.0) - log1p(-exp2(T - cap));
+    // For CKKS, also keep the added noise below the current noise, so
+    // that precision is not lost
+    if (isCKKS() && getNoiseBound() > 0.0)
+      low = std::max(low, logOfPrimeSet() + logA - log(getNoiseBound()));
+
+    double maxPrime = 0;
+    for (long i : context.getCtxtPrimes())
+      maxPrime = std::max(maxPrime, context.logOfPrime(i));
+
+    if (low < logOfPrimeSet()) {
+      IndexSet target = context.getModSizeTable().getSet4Size(
+          low, low + maxPrime, primeSet, /*reverse=*/true);
+      if (!empty(target) && target <= primeSet)
+        modDownToSet(target);
+    }
+  }
+}
+
+double Ctxt::bitsPerMultiplication() const
+{
+  if (isEmpty())
+    return 0.0;
+
+  // Mod-switching to the natural size scales the total noise bound by the
+  // ratio of the moduli
+  double logNatural = naturalSize();
+  double logNoise =
+      NTL::log(std::max(totalNoiseBound(), NTL::to_xdouble(1.0)));
+  double logNoiseAtNatural =
+      logNoise + std::min(0.0, logNatural - logOfPrimeSet());
+  logNoiseAtNatural =
+      std::max(logNoiseAtNatural, log(modSwitchAddedNoiseBound()));
+  return logNoiseAtNatural / log(2.0);
+}
+
+void Ctxt::dropToDepth(long depth, long extraBits)
+{
+  assertTrue<InvalidArgument>(depth >= 0 && extraBits >= 0,
+                              "Ctxt::dropToDepth: negative depth or bits");
+  if (isEmpty())
+    return;
+  dropToCapacity(long(std::ceil(depth * bitsPerMultiplication())) + extraBits);
+}
+
 // Low-level multiply routine. It does not include re-linearization.
 void Ctxt::multLowLvl(const Ctxt& other_orig, bool destructive)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "multLowLvl");
 
   // Special case: if *this is empty then do nothing
   if (this->isEmpty())
@@ -1699,20 +1943,31 @@ void Ctxt::multLowLvl(const Ctxt& other_orig, bool destructive)
     assertEq(other_orig.getPtxtSpace(), 1l, "Plaintext spaces incompatible");
   }
 
-  Ctxt* other_pt = nullptr;
+  // Parts left relative to s(X^t) by deferredAutomorph cannot be multiplied,
+  // so their key switching is done now
+  if (numDeferredKeySwitches() > 0)
+    reLinearize();
+
+  const Ctxt* other_pt = &other_orig;
   std::unique_ptr<Ctxt> ct;        // scratch space if needed
   if (this == &other_orig) {       // squaring
     bringToSet(naturalPrimeSet()); // drop to the "natural" primeSet
-    other_pt = this;
   } else { // real multiplication
 
-    // If this is a non-destructive call, make a copy of other
-    if (destructive)
-      other_pt = (Ctxt*)&other_orig;  // cast away const-ness
-    else {                            // work with a copy
-      ct.reset(new Ctxt(other_orig)); // make a copy
-      other_pt = ct.get();            // point to it
-    }
+    // other is changed only if it must be: in place if this is a
+    // destructive call, and otherwise in a copy made then
+    Ctxt* writable = destructive ? const_cast<Ctxt*>(&other_orig) : nullptr;
+    auto writableOther = [&]() -> Ctxt& {
+      if (!writable) {
+        ct.reset(new Ctxt(other_orig)); // make a copy
+        writable = ct.get();
+        other_pt = writable; // and work with it from now on
+      }
+      return *writable;
+    };
+
+    if (other_pt->numDeferredKeySwitches() > 0)
+      writableOther().reLinearize();
 
     // equalize plaintext spaces
     if (!isCKKS()) {
@@ -1720,7 +1975,8 @@ void Ctxt::multLowLvl(const Ctxt& other_orig, bool destructive)
       assertTrue(g > 1, "Plaintext spaces are co-prime");
 
       reducePtxtSpace(g);
-      other_pt->reducePtxtSpace(g);
+      if (other_pt->ptxtSpace != g)
+        writableOther().reducePtxtSpace(g);
       // VJS-NOTE: fixes bug where intFactor was not reduced
     }
 
@@ -1742,13 +1998,30 @@ void Ctxt::multLowLvl(const Ctxt& other_orig, bool destructive)
 
     // drop the prime sets of *this and other
     bringToSet(commonPrimeSet);
-    other_pt->bringToSet(commonPrimeSet);
+    if (other_pt->primeSet != commonPrimeSet)
+      writableOther().bringToSet(commonPrimeSet);
   }
 
   // Perform the actual tensor product
   Ctxt tmpCtxt(pubKey, ptxtSpace);
   tmpCtxt.tensorProduct(*this, *other_pt);
-  *this = tmpCtxt;
+  *this = std::move(tmpCtxt); // take its parts rather than copy them
+}
+
+void Ctxt::multiplyAccumulate(const Ctxt& a, const Ctxt& b)
+{
+  HELIB_TIMER_START;
+  assertTrue(this != &a && this != &b,
+             "Ctxt::multiplyAccumulate: the accumulator must not alias a "
+             "factor");
+
+  // An empty factor stands for zero, so there is nothing to add
+  if (a.isEmpty() || b.isEmpty())
+    return;
+
+  Ctxt prod(a);
+  prod.multLowLvl(b); // makes its own copy of b, so b may be a
+  *this += prod;      // parts with the same key handle are merged
 }
 
 // Higher-level multiply routines that include also modulus-switching
@@ -1757,6 +2030,7 @@ void Ctxt::multLowLvl(const Ctxt& other_orig, bool destructive)
 void Ctxt::multiplyBy(const Ctxt& other)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "multiplyBy");
   // Special case: if *this is empty then do nothing
   if (this->isEmpty())
     return;
@@ -1773,9 +2047,29 @@ void Ctxt::multiplyBy(const Ctxt& other)
 #endif
 }
 
+void Ctxt::multiplyBy(Ctxt&& other)
+{
+  HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "multiplyBy");
+  if (this->isEmpty())
+    return;
+
+  if (other.isEmpty()) {
+    *this = std::move(other);
+    return;
+  }
+
+  this->multLowLvl(other, true); // other is not needed afterwards
+  reLinearize();
+#ifdef HELIB_DEBUG
+  checkNoise(*this, *dbgKey, "reLinearize " + std::to_string(size_t(this)));
+#endif
+}
+
 void Ctxt::multiplyBy2(const Ctxt& other1, const Ctxt& other2)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "multiplyBy2");
   // Special case: if *this is empty then do nothing
   if (this->isEmpty())
     return;
@@ -1801,7 +2095,7 @@ void Ctxt::multiplyBy2(const Ctxt& other1, const Ctxt& other2)
     else
       tmp.multLowLvl(other2);
 
-    this->multLowLvl(tmp);
+    this->multLowLvl(std::move(tmp));
     reLinearize(); // re-linearize after all the multiplications
     return;
   }
@@ -1819,7 +2113,7 @@ void Ctxt::multiplyBy2(const Ctxt& other1, const Ctxt& other2)
   if (this == second) { // handle pointer collision
     Ctxt tmp = *second;
     this->multLowLvl(*first);
-    this->multLowLvl(tmp);
+    this->multLowLvl(std::move(tmp));
   } else {
     this->multLowLvl(*first);
     this->multLowLvl(*second);
@@ -1832,6 +2126,7 @@ void Ctxt::multiplyBy2(const Ctxt& other1, const Ctxt& other2)
 void Ctxt::multByConstant(const DoubleCRT& dcrt, double size)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "multByConstant");
   // Special case: if *this is empty then do nothing
   if (this->isEmpty())
     return;
@@ -1907,6 +2202,7 @@ void Ctxt::multByConstantCKKS(const DoubleCRT& dcrt,
                               NTL::xdouble factor,
                               double roundingErr)
 {
+  CtxtOpTrace trace(*this, "multByConstantCKKS");
   // VJS-FIXME: this routine has a number of issues and should
   // be deprecated in favor of the new EncodedPtxt-based routines
 
@@ -1970,6 +2266,13 @@ void Ctxt::multByConstant(const FatEncodedPtxt& feptxt)
     throw LogicError("multByConstant: bad FatEncodedPtxt");
 }
 
+void Ctxt::multByConstant(const EncodedPtxtCache& ptxt)
+{
+  if (isEmpty())
+    return;
+  multByConstant(*ptxt.get(primeSet));
+}
+
 void Ctxt::multByConstant(const FatEncodedPtxt_BGV& ptxt)
 {
   HELIB_TIMER_START;
@@ -2032,6 +2335,7 @@ void Ctxt::multByConstant(const FatEncodedPtxt_CKKS& ptxt)
 // Mul by a scalar constant
 void Ctxt::multByConstant(const NTL::ZZ& c)
 {
+  CtxtOpTrace trace(*this, "multByConstant");
   if (isCKKS()) {
     multByConstant(NTL::to_xdouble(c));
   } else { // BGV
@@ -2088,6 +2392,7 @@ void Ctxt::multByConstant(double c)
 
 void Ctxt::multByConstant(NTL::xdouble c)
 {
+  CtxtOpTrace trace(*this, "multByConstant");
   if (isCKKS()) {
     // Special case: if *this is empty then do nothing
     if (this->isEmpty())
@@ -2142,6 +2447,11 @@ void Ctxt::addConstant(const FatEncodedPtxt& feptxt, bool neg)
     throw LogicError("addConstant: bad FatEncodedPtxt");
 }
 
+void Ctxt::addConstant(const EncodedPtxtCache& ptxt, bool neg)
+{
+  addConstant(*ptxt.get(primeSet), neg);
+}
+
 void Ctxt::addConstant(const FatEncodedPtxt_BGV& ptxt, bool neg)
 {
   HELIB_TIMER_START;
@@ -2212,11 +2522,15 @@ void Ctxt::addConstant(const EncodedPtxt_BGV& ptxt, bool neg)
 
   // NOTE: if f == 1 but ptxtSpace != ptxt.getPtxtSpace(),
   // then this will perform balanced remaindering mod ptxtSpace
-  if (f != 1 || ptxtSpace != ptxt.getPtxtSpace())
+  bool scaled = (f != 1 || ptxtSpace != ptxt.getPtxtSpace());
+  if (scaled)
     balanced_MulMod(poly, poly, f, ptxtSpace);
 
   DoubleCRT dcrt(poly, context, primeSet);
-  NTL::xdouble size = embeddingLargestCoeff(poly, context.getZMStar());
+  // An unscaled constant has the size cached with its encoding
+  NTL::xdouble size = scaled
+                          ? embeddingLargestCoeff(poly, context.getZMStar())
+                          : NTL::xdouble(ptxt.getSize());
 
   noiseBound += size;
 
@@ -2389,6 +2703,7 @@ void Ctxt::addConstant(NTL::xdouble c, bool neg)
 // FIXME: is this still needed/used?
 void Ctxt::divideBy2()
 {
+  CtxtOpTrace trace(*this, "divideBy2");
   // Special case: if *this is empty then do nothing
   if (this->isEmpty())
     return;
@@ -2414,6 +2729,7 @@ void Ctxt::divideBy2()
 // As a side-effect, the plaintext space is reduced from p^r to p^{r-1}.
 void Ctxt::divideByP()
 {
+  CtxtOpTrace trace(*this, "divideByP");
   // Special case: if *this is empty then do nothing
   if (this->isEmpty())
     return;
@@ -2437,6 +2753,7 @@ void Ctxt::divideByP()
 void Ctxt::automorph(long k) // Apply automorphism F(X)->F(X^k) (gcd(k,m)=1)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "automorph");
   // Special case: if *this is empty then do nothing
   if (this->isEmpty())
     return;
@@ -2462,6 +2779,7 @@ void Ctxt::automorph(long k) // Apply automorphism F(X)->F(X^k) (gcd(k,m)=1)
 void Ctxt::smartAutomorph(long k)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "smartAutomorph");
 
   // A hack: record this automorphism rather than actually performing it
   if (isSetAutomorphVals()) { // defined in NumbTh.h
@@ -2480,11 +2798,8 @@ void Ctxt::smartAutomorph(long k)
   assertTrue(context.getZMStar().inZmStar(k), "k must be in Zm*");
 
   long keyID = getKeyID();
-  // must have key-switching matrices for it
-  if (!pubKey.isReachable(k, keyID)) {
-    throw LogicError("no key-switching matrices for k=" + std::to_string(k) +
-                     ", keyID=" + std::to_string(keyID));
-  }
+  // must have key-switching matrices for it, throws otherwise
+  const std::vector<long>& chain = pubKey.getAutomorphChain(k, keyID);
 
   if (!inCanonicalForm(keyID)) { // Re-linearize the input, if needed
     reLinearize(keyID);
@@ -2496,10 +2811,8 @@ void Ctxt::smartAutomorph(long k)
   // Please leave these print statements in (but commented out).
   // They are useful for debugging.
   // std::cerr << "*** smartAutomorph:";
-  while (k != 1) {
-    // std::cerr << " " << k;
-    const KeySwitch& matrix = pubKey.getNextKSWmatrix(k, keyID);
-    long amt = matrix.fromKey.getPowerOfX();
+  for (long amt : chain) {
+    // std::cerr << " " << amt;
 
     // A hack: record this automorphism rather than actually performing it
     if (isSetAutomorphVals2()) { // defined in NumbTh.h
@@ -2508,12 +2821,117 @@ void Ctxt::smartAutomorph(long k)
     }
     automorph(amt);
     reLinearize(keyID);
-    k = NTL::MulMod(k, NTL::InvMod(amt, m), m);
   }
   // std::cerr << "\n";
   HELIB_TIMER_STOP;
 }
 
+void Ctxt::lazySmartAutomorph(long k)
+{
+  HELIB_TIMER_START;
+
+  // A hack: record this automorphism rather than actually performing it
+  if (isSetAutomorphVals()) { // defined in NumbTh.h
+    recordAutomorphVal(k);
+    return;
+  }
+
+  long m = context.getM();
+  k = mcMod(k, m);
+
+  if (this->isEmpty() || k == 1)
+    return;
+
+  const IndexSet& specialPrimes = context.getSpecialPrimes();
+  long keyID = getKeyID();
+  if (!(specialPrimes <= primeSet) ||
+      !primeSet.disjointFrom(context.getSmallPrimes()) ||
+      !inCanonicalForm(keyID)) {
+    smartAutomorph(k);
+    return;
+  }
+
+  assertTrue(context.getZMStar().inZmStar(k), "k must be in Zm*");
+  if (!pubKey.isReachable(k, keyID)) {
+    throw LogicError("no key-switching matrices for k=" + std::to_string(k) +
+                     ", keyID=" + std::to_string(keyID));
+  }
+
+  double logProd = context.logOfProduct(specialPrimes);
+  relin_CKKS_adjust(logProd);
+
+  IndexSet ctxtPrimes = primeSet / specialPrimes;
+  NTL::xdouble h = NTL::conv<NTL::xdouble>(pubKey.getSKeyBound(keyID));
+
+  while (k != 1) {
+    const KeySwitch& W = pubKey.getNextKSWmatrix(k, keyID);
+    long amt = W.fromKey.getPowerOfX();
+
+    // A hack: record this automorphism rather than actually performing it
+    if (isSetAutomorphVals2()) { // defined in NumbTh.h
+      recordAutomorphVal2(amt);
+      return;
+    }
+    automorph(amt);
+
+    // Take out the part relative to s(X^amt) and scale it down by the
+    // special primes. Rounding adds delta*s(X^amt), with delta small and
+    // divisible by the plaintext space, and key switching multiplies the
+    // result back up, which is the same noise that a full mod-down and
+    // re-linearization would add in the extended modulus.
+    long idx = parts[0].skHandle.isOne() ? 1 : 0;
+    CtxtPart part = parts[idx];
+    parts.erase(parts.begin() + idx);
+
+    std::vector<double> fdelta;
+    part.scaleDownToSet(ctxtPrimes, ptxtSpace, fdelta);
+    NTL::xdouble addedNoise = NTL::xexp(logProd) * h *
+                              context.noiseBoundForUniform(
+                                  double(ptxtSpace) / 2.0,
+                                  context.getZMStar().getPhiM());
+
+    if (ptxtSpace > 1) // CKKS has ptxtSpace == 1
+      reducePtxtSpace(W.ptxtSpace);
+
+    std::vector<DoubleCRT> polyDigits;
+    NTL::xdouble ksNoise = part.breakIntoDigits(polyDigits) * W.noiseBound;
+    keySwitchDigits(W, polyDigits);
+
+    double ratio = NTL::conv<double>(ksNoise / noiseBound);
+    HELIB_STATS_UPDATE("KS-noise-ratio", ratio);
+    if (ratio > 1) {
+      Warning("KS-noise-ratio=" + std::to_string(ratio));
+    }
+
+    noiseBound += addedNoise + ksNoise;
+    k = NTL::MulMod(k, NTL::InvMod(amt, m), m);
+  }
+}
+
+void Ctxt::deferredAutomorph(long k)
+{
+  HELIB_TIMER_START;
+
+  // A hack: record this automorphism rather than actually performing it
+  if (isSetAutomorphVals()) { // defined in NumbTh.h
+    recordAutomorphVal(k);
+    return;
+  }
+
+  long m = context.getM();
+  k = mcMod(k, m);
+  if (this->isEmpty() || k == 1)
+    return;
+
+  // The key switching can only be left for later if it takes one step
+  long keyID = getKeyID();
+  if (!inCanonicalForm(keyID) || !pubKey.haveKeySWmatrix(1, k, keyID, keyID)) {
+    smartAutomorph(k);
+    return;
+  }
+  automorph(k);
+}
+
 //  Complex conjugate, same as automorph(m-1)
 void Ctxt::complexConj()
 {
@@ -2526,6 +2944,7 @@ void Ctxt::complexConj()
 void Ctxt::frobeniusAutomorph(long j)
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(*this, "frobeniusAutomorph");
   // Special case: if *this is empty then do nothing
   if (this->isEmpty() || j == 0)
     return;
@@ -2544,6 +2963,159 @@ void Ctxt::frobeniusAutomorph(long j)
   }
 }
 
+// Apply many automorphisms to *this, breaking it into digits only once
+void Ctxt::hoistedAutomorphs(const std::vector<long>& ks,
+                             std::vector<Ctxt>& out) const
+{
+  HELIB_TIMER_START;
+  long n = ks.size();
+  std::vector<std::shared_ptr<Ctxt>> results(n);
+
+  if (n == 1) {
+    // Nothing to share, avoid the extra copies made by the precon object
+    results[0] = std::make_shared<Ctxt>(*this);
+    results[0]->smartAutomorph(ks[0]);
+  } else if (n > 1 && isSetAutomorphVals()) {
+    // Only record the automorphisms, as BasicAutomorphPrecon::automorph
+    // would, but on this thread: the set is not safe to insert into from
+    // the threads
+    for (long i = 0; i < n; i++) {
+      recordAutomorphVal(mcMod(ks[i], context.getM()));
+      results[i] = std::make_shared<Ctxt>(*this);
+    }
+  } else if (n > 1) {
+    BasicAutomorphPrecon precon(*this);
+
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++)
+      results[i] = precon.automorph(mcMod(ks[i], context.getM()));
+    NTL_EXEC_RANGE_END
+  }
+
+  out.clear();
+  out.reserve(n);
+  for (const auto& res : results)
+    out.push_back(*res);
+}
+
+BasicAutomorphPrecon::BasicAutomorphPrecon(const Ctxt& _ctxt) :
+    ctxt(_ctxt), noise(1.0)
+{
+  HELIB_TIMER_START;
+  if (ctxt.parts.size() >= 1)
+    assertTrue(ctxt.parts[0].skHandle.isOne(),
+               "Invalid ciphertext (secret key handle for part 0 is not one)");
+  if (ctxt.parts.size() <= 1)
+    return; // nothing to do
+
+  ctxt.cleanUp();
+  const Context& context = ctxt.getContext();
+  const PubKey& pubKey = ctxt.getPubKey();
+  long keyID = ctxt.getKeyID();
+
+  // The call to cleanUp() should ensure that this assertion passes.
+  assertTrue(ctxt.inCanonicalForm(keyID),
+             "Ciphertext is not in canonical form");
+
+  ctxt.relin_CKKS_adjust();
+
+  // Compute the number of digits that we need and the estimated
+  // added noise from switching this ciphertext.
+
+  NTL::xdouble addedNoise = ctxt.parts[1].breakIntoDigits(polyDigits);
+  NTL::xdouble max_ks_noise(0.0);
+  for (const KeySwitch& ks : pubKey.keySWlist()) {
+    if (max_ks_noise < ks.noiseBound)
+      max_ks_noise = ks.noiseBound;
+  }
+  addedNoise *= max_ks_noise;
+
+  double logProd = context.logOfProduct(context.getSpecialPrimes());
+  noise = ctxt.getNoiseBound() * NTL::xexp(logProd);
+
+  double ratio = NTL::conv<double>(addedNoise / noise);
+
+  HELIB_STATS_UPDATE("KS-noise-ratio-hoist", ratio);
+  if (ratio > 1) {
+    Warning("KS-noise-ratio-hoist=" + std::to_string(ratio));
+  }
+  // std::stderr << "*** HOIST INIT\n";
+  // fprintf(stderr, "   KS-log-noise-ratio-hoist: %f\n",
+  // log(addedNoise/noise)/log(2.0));
+
+  noise += addedNoise;
+}
+
+std::shared_ptr<Ctxt> BasicAutomorphPrecon::automorph(long k) const
+{
+  HELIB_TIMER_START;
+
+  // A hack: record this automorphism rather than actually performing it
+  if (isSetAutomorphVals()) { // defined in NumbTh.h
+    recordAutomorphVal(k);
+    return std::make_shared<Ctxt>(ctxt);
+  }
+
+  if (k == 1 || ctxt.isEmpty())
+    return std::make_shared<Ctxt>(ctxt); // nothing to do
+
+  const Context& context = ctxt.getContext();
+  const PubKey& pubKey = ctxt.getPubKey();
+
+  // empty ctxt
+  std::shared_ptr<Ctxt> result = std::make_shared<Ctxt>(ZeroCtxtLike, ctxt);
+  result->noiseBound = noise; // noise estimate
+  result->intFactor = ctxt.intFactor;
+
+  result->primeSet = ctxt.primeSet | context.getSpecialPrimes();
+  // VJS-NOTE: added this to make addPart work
+
+  if (ctxt.isCKKS()) {
+    result->ptxtMag = ctxt.ptxtMag;
+    double logProd = context.logOfProduct(context.getSpecialPrimes());
+    result->ratFactor = ctxt.ratFactor * NTL::xexp(logProd);
+  }
+
+  if (ctxt.parts.size() == 1) { // only constant part, no need to key-switch
+    CtxtPart tmpPart = ctxt.parts[0];
+    tmpPart.automorph(k);
+    tmpPart.addPrimesAndScale(context.getSpecialPrimes());
+    result->addPart(tmpPart, /*matchPrimeSet=*/true);
+    return result;
+  }
+
+  // Ensure that we have a key-switching matrices for this automorphism
+  long keyID = ctxt.getKeyID();
+  if (!pubKey.isReachable(k, keyID)) {
+    throw LogicError("no key-switching matrices for k=" + std::to_string(k) +
+                     ", keyID=" + std::to_string(keyID));
+  }
+
+  // Get the first key-switching matrix for this automorphism
+  const KeySwitch& W = pubKey.getNextKSWmatrix(k, keyID);
+  long amt = W.fromKey.getPowerOfX();
+
+  // Start by rotating the constant part, no need to key-switch it
+  CtxtPart tmpPart = ctxt.parts[0];
+  tmpPart.automorph(amt);
+  tmpPart.addPrimesAndScale(context.getSpecialPrimes());
+  result->addPart(tmpPart, /*matchPrimeSet=*/true);
+
+  // Then rotate the digits and key-switch them
+  std::vector<DoubleCRT> tmpDigits = polyDigits;
+  for (auto&& tmp : tmpDigits) // rotate each of the digits
+    tmp.automorph(amt);
+
+  result->keySwitchDigits(W, tmpDigits); // key-switch the digits
+
+  long m = context.getM();
+  if ((amt - k) % m != 0) { // amt != k (mod m), more automorphisms to do
+    k = NTL::MulMod(k, NTL::InvMod(amt, m), m); // k *= amt^{-1} mod m
+    result->smartAutomorph(k);                  // call usual smartAutomorph
+  }
+  return result;
+}
+
 /********************************************************************/
 // Utility methods
 
@@ -2590,7 +3162,7 @@ void Ctxt::writeTo(std::ostream& str) const
     1.  long ptxtSpace
     2.  NTL::xdouble noiseBound
     3.  IndexSet primeSet;
-    4.  std::vector<CtxtPart> parts;
+    4.  vector<CtxtPart> parts;
   */
 
   write_raw_int(str, ptxtSpace);
@@ -2604,6 +3176,83 @@ void Ctxt::writeTo(std::ostream& str) const
   writeEyeCatcher(str, EyeCatcher::CTXT_END);
 }
 
+bool Ctxt::hasSeededForm() const
+{
+  if (NTL::IsZero(uniformSeed) || parts.size() != 2 ||
+      primeSet != context.getCtxtPrimes() || !parts[0].skHandle.isOne() ||
+      !parts[1].skHandle.isBase(parts[1].skHandle.getSecretKeyID()) ||
+      parts[1].getIndexSet() != primeSet)
+    return false;
+
+  // Any homomorphic operation would have changed parts[1]
+  DoubleCRT expanded(context, primeSet);
+  expanded.randomize(uniformSeed, /*index=*/0);
+  return expanded == parts[1];
+}
+
+void Ctxt::writeSeededTo(std::ostream& str) const
+{
+  assertTrue<LogicError>(hasSeededForm(),
+                         "Ctxt::writeSeededTo: not a fresh secret-key "
+                         "encryption");
+
+  SerializeHeader<Ctxt>().writeTo(str);
+  writeEyeCatcher(str, EyeCatcher::SEEDED_BEGIN);
+
+  /*  Writing out in binary, as in writeTo except for parts:
+    1.  CtxtPart parts[0]
+    2.  SKHandle of parts[1]
+    3.  the seed of parts[1], in UNIFORM_SEED_BYTES bytes
+  */
+
+  write_raw_int(str, ptxtSpace);
+  write_raw_int(str, intFactor);
+  write_raw_xdouble(str, ptxtMag);
+  write_raw_xdouble(str, ratFactor);
+  write_raw_xdouble(str, noiseBound);
+  primeSet.writeTo(str);
+  parts[0].writeTo(str);
+  parts[1].skHandle.writeTo(str);
+
+  unsigned char seed[UNIFORM_SEED_BYTES];
+  NTL::BytesFromZZ(seed, uniformSeed, UNIFORM_SEED_BYTES);
+  str.write(reinterpret_cast<const char*>(seed), UNIFORM_SEED_BYTES);
+
+  writeEyeCatcher(str, EyeCatcher::SEEDED_END);
+}
+
+void Ctxt::writeCompact(std::ostream& str, long targetBits) const
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(targetBits >= 0,
+                              "Ctxt::writeCompact: negative targetBits");
+
+  Ctxt tmp(*this);
+  tmp.dropToCapacity(targetBits);
+
+  SerializeHeader<Ctxt>().writeTo(str);
+  writeEyeCatcher(str, EyeCatcher::COMPACT_BEGIN);
+
+  /*  Writing out in binary, as in writeTo except for parts:
+    1.  long number of parts
+    2.  for each part, the bit-packed DoubleCRT then the SKHandle
+  */
+
+  write_raw_int(str, tmp.ptxtSpace);
+  write_raw_int(str, tmp.intFactor);
+  write_raw_xdouble(str, tmp.ptxtMag);
+  write_raw_xdouble(str, tmp.ratFactor);
+  write_raw_xdouble(str, tmp.noiseBound);
+  tmp.primeSet.writeTo(str);
+  write_raw_int(str, tmp.parts.size());
+  for (const CtxtPart& part : tmp.parts) {
+    part.writePackedTo(str);
+    part.skHandle.writeTo(str);
+  }
+
+  writeEyeCatcher(str, EyeCatcher::COMPACT_END);
+}
+
 Ctxt Ctxt::readFrom(std::istream& str, const PubKey& pubKey)
 {
   // We rely here on Ctxt's in place read function.
@@ -2620,8 +3269,12 @@ void Ctxt::read(std::istream& str)
                     "Header: version " + header.versionString() +
                         " not supported");
 
-  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::CTXT_BEGIN);
-  assertTrue<IOError>(eyeCatcherFound,
+  // Any format, as written by writeTo, writeSeededTo or writeCompact
+  std::array<char, EyeCatcher::SIZE> eye;
+  str.read(eye.data(), EyeCatcher::SIZE);
+  bool seeded = (eye == EyeCatcher::SEEDED_BEGIN);
+  bool compact = (eye == EyeCatcher::COMPACT_BEGIN);
+  assertTrue<IOError>(seeded || compact || eye == EyeCatcher::CTXT_BEGIN,
                       "Could not find pre-ciphertext eye catcher");
 
   ptxtSpace = read_raw_int(str);
@@ -2630,12 +3283,37 @@ void Ctxt::read(std::istream& str)
   ratFactor = read_raw_xdouble(str);
   noiseBound = read_raw_xdouble(str);
   primeSet = IndexSet::readFrom(str);
-  // Using inplace parts deserialization as read_raw_vector will do a resize,
-  // then reads the parts in-place, so may re-use memory.
   CtxtPart blankCtxtPart(context, IndexSet::emptySet());
-  read_raw_vector(str, parts, blankCtxtPart);
+  if (seeded) {
+    parts.resize(1, blankCtxtPart);
+    parts[0].read(str);
+    parts.emplace_back(context, primeSet, SKHandle::readFrom(str));
+
+    unsigned char seed[UNIFORM_SEED_BYTES];
+    str.read(reinterpret_cast<char*>(seed), UNIFORM_SEED_BYTES);
+    NTL::ZZFromBytes(uniformSeed, seed, UNIFORM_SEED_BYTES);
+    parts[1].randomize(uniformSeed, /*index=*/0); // expand the uniform part
+  } else if (compact) {
+    long nParts = read_raw_int(str);
+    assertInRange<IOError>(nParts, 0l, 1l << 16, "Bad number of ctxt parts");
+    parts.resize(nParts, blankCtxtPart);
+    for (CtxtPart& part : parts) {
+      part.readPacked(str);
+      part.skHandle = SKHandle::readFrom(str);
+    }
+    uniformSeed = 0;
+  } else {
+    // Using inplace parts deserialization as read_raw_vector will do a
+    // resize, then reads the parts in-place, so may re-use memory.
+    read_raw_vector(str, parts, blankCtxtPart);
+    uniformSeed = 0;
+  }
 
-  eyeCatcherFound = readEyeCatcher(str, EyeCatcher::CTXT_END);
+  bool eyeCatcherFound =
+      readEyeCatcher(str,
+                     seeded    ? EyeCatcher::SEEDED_END
+                     : compact ? EyeCatcher::COMPACT_END
+                               : EyeCatcher::CTXT_END);
   assertTrue<IOError>(eyeCatcherFound,
                       "Could not find post-ciphertext eye catcher");
 }
@@ -2712,6 +3390,24 @@ void Ctxt::readJSON(const JsonWrapper& jw)
   executeRedirectJsonError<void>(body);
 }
 
+void Ctxt::writeToHybridJSON(std::ostream& str) const
+{
+  writeHybridJSON(str, *this);
+}
+
+Ctxt Ctxt::readFromHybridJSON(std::istream& str, const PubKey& pubKey)
+{
+  return helib::readHybridJSON<Ctxt>(
+      str,
+      [&](std::istream& body) { return Ctxt::readFrom(body, pubKey); });
+}
+
+void Ctxt::readHybridJSON(std::istream& str)
+{
+  helib::readHybridJSON<Ctxt>(str,
+                              [this](std::istream& body) { read(body); });
+}
+
 void CtxtPart::writeTo(std::ostream& str) const
 {
   this->DoubleCRT::writeTo(str); // CtxtPart is a child.
@@ -2884,11 +3580,8 @@ void innerProduct(Ctxt& result, const CtPtrs& v1, const CtPtrs& v2)
   }
   result = *v1[0];
   result.multLowLvl(*v2[0]);
-  for (long i = 1; i < n; i++) {
-    Ctxt tmp = *v1[i];
-    tmp.multLowLvl(*v2[i]);
-    result += tmp;
-  }
+  for (long i = 1; i < n; i++)
+    result.multiplyAccumulate(*v1[i], *v2[i]);
   result.reLinearize();
 }
 
@@ -3083,8 +3776,8 @@ void Ctxt::addedNoiseForCKKSDecryption(const SecKey& sk,
   // NOTE: the added noise is generated using pseudorandom bits
   // derived from a hash of sk and the ciphertext *this.
   // In the current implementation, we do this by writing
-  // sk and *this to a string, and using that string to seed NTL's PRG.
-  // NTL's setSeed routine will hash this string using a
+  // sk and *this to a string, and using that string to key a PRG.
+  // NTL's DeriveKey routine will hash this string using a
   // cryptographically strong hash function.
   // If we model the hash function as a random oracle,
   // this is a cryptographically sound construction.
@@ -3093,9 +3786,6 @@ void Ctxt::addedNoiseForCKKSDecryption(const SecKey& sk,
   // sk should contain a PRF key, and (2) perhaps we should support
   // different PRF's and PRG's.
 
-  NTL::RandomStreamPush push{};
-  // save NTL's current PRG state
-
   std::stringstream ss;
   sk.writeSecKeyDerivedASCII(ss);
   // write everything but the pubKey part, as we do not want to write
@@ -3103,15 +3793,19 @@ void Ctxt::addedNoiseForCKKSDecryption(const SecKey& sk,
   ss << *this;
   // write the ciphertext itself
   std::string s = ss.str();
-  NTL::SetSeed((const unsigned char*)s.c_str(), s.size());
-  // Set current PRG seed, which hashes sk and ctxt to derive the seed.
-  // NOTE: that SetSeed requires unsigned char*, while c_str()
+  unsigned char key[PRG::KEY_BYTES];
+  NTL::DeriveKey(key,
+                 PRG::KEY_BYTES,
+                 (const unsigned char*)s.c_str(),
+                 s.size());
+  // The stream NTL::SetSeed(s) would make current, which hashes sk and ctxt
+  // to derive the key, without touching NTL's current PRG state.
+  // NOTE: that DeriveKey requires unsigned char*, while c_str()
   // returns a char*; this is fine, as this kind of "type punning"
   // is explicitly allowed by the C++ standard.
+  PRG prg(key);
 
-  sampleGaussianBounded(noise, context, sigma);
-
-  // on block exit, NTL's old PRG state is restored
+  sampleGaussianBounded(noise, context, sigma, prg);
 }
 
 void extractRealPart(Ctxt& c)
@@ -0,0 +1,117 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* CtxtPool.cpp - a free list of ciphertexts under one public key
+ */
+#include <algorithm>
+
+#include <helib/CtxtPool.h>
+#include <helib/keys.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+void CtxtPool::Handle::reset()
+{
+  if (ctxt)
+    pool->giveBack(std::move(ctxt));
+  pool = nullptr;
+}
+
+CtxtPool::CtxtPool(const PubKey& pubKey, long maxSize) :
+    pubKey(pubKey), maxSize(maxSize)
+{
+  assertTrue<InvalidArgument>(maxSize >= 0,
+                              "CtxtPool: the maximum size is negative");
+}
+
+CtxtPool::Handle CtxtPool::acquire()
+{
+  Ptr ctxt;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!idle.empty()) {
+      ctxt = std::move(idle.back());
+      idle.pop_back();
+      nHits++;
+    } else
+      nMisses++;
+  }
+  if (!ctxt)
+    ctxt = std::make_unique<Ctxt>(pubKey);
+  return Handle(this, std::move(ctxt));
+}
+
+void CtxtPool::giveBack(Ptr ctxt)
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (long(idle.size()) < maxSize) {
+      idle.push_back(std::move(ctxt));
+      return;
+    }
+  }
+  // the pool is full, ctxt is destroyed outside of the lock
+}
+
+void CtxtPool::reserve(long n)
+{
+  n = std::min(n, maxSize);
+  long missing = n - size();
+  if (missing <= 0)
+    return;
+
+  // Made outside of the lock, so the pool keeps serving other threads
+  Ctxt zero(pubKey);
+  pubKey.Encrypt(zero, NTL::ZZX(0));
+  std::vector<Ptr> fresh;
+  fresh.reserve(missing);
+  for (long i = 0; i < missing; i++)
+    fresh.push_back(std::make_unique<Ctxt>(zero));
+
+  std::lock_guard<std::mutex> guard(mutex);
+  for (auto& ctxt : fresh) {
+    if (long(idle.size()) >= maxSize)
+      break;
+    idle.push_back(std::move(ctxt));
+  }
+}
+
+void CtxtPool::clear()
+{
+  std::vector<Ptr> dropped;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    dropped.swap(idle);
+  }
+  // dropped, and the ciphertexts in it, are destroyed outside of the lock
+}
+
+long CtxtPool::size() const
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  return idle.size();
+}
+
+long CtxtPool::hits() const
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  return nHits;
+}
+
+long CtxtPool::misses() const
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  return nMisses;
+}
+
+} // namespace helib
@@ -32,20 +32,27 @@
  * in use. The list of primes is defined by the data member modChain, which is
  * a vector of Cmodulus objects.
  */
+#include <algorithm>
+#include <utility>
+
 #include <NTL/ZZVec.h>
 #include <NTL/BasicThreadPool.h>
 
 #include "binio.h"
 #include "io.h"
 #include "intelExt.h"
+#include "simdKernels.h"
+#include "RNSBaseConverter.h"
 
 #include <helib/timing.h>
+#include <helib/costEstimate.h>
 #include <helib/sample.h>
 #include <helib/DoubleCRT.h>
 #include <helib/Context.h>
 #include <helib/norms.h>
 #include <helib/fhe_stats.h>
 #include <helib/log.h>
+#include <helib/multicore.h>
 
 namespace helib {
 
@@ -60,6 +67,18 @@ static long MakeIndexVector(const IndexSet& s, NTL::Vec<long>& v)
   return sz;
 }
 
+// The work of a loop doing a transform mod each prime of v, for
+// HELIB_ADAPTIVE_EXEC_RANGE. With fewer primes than threads, and transforms
+// that split over the threads themselves (see Cmodulus::splitsNTT), it is 0,
+// so that the primes are done one after the other with all the threads each.
+static long nttWork(const Context& context, const NTL::Vec<long>& v, long phim)
+{
+  long n = v.length();
+  if (n > 0 && n < AvailableThreads() && context.ithModulus(v[0]).splitsNTT())
+    return 0;
+  return n * phim;
+}
+
 // representing an integer polynomial as DoubleCRT. If the number of moduli
 // to use is not specified, the resulting object uses all the moduli in
 // the context. If the coefficients of poly are larger than the product of
@@ -76,12 +95,13 @@ void DoubleCRT::FFT(const NTL::ZZX& poly, const IndexSet& s)
   NTL::Vec<long>& ivec = tls_ivec;
 
   long icard = MakeIndexVector(s, ivec);
-  NTL_EXEC_RANGE(icard, first, last)
+  long work = nttWork(context, ivec, context.getPhiM());
+  HELIB_ADAPTIVE_EXEC_RANGE(work, icard, first, last)
   for (long j = first; j < last; j++) {
     long i = ivec[j];
     context.ithModulus(i).FFT(map[i], poly);
   }
-  NTL_EXEC_RANGE_END
+  HELIB_ADAPTIVE_EXEC_RANGE_END
 }
 
 // FIXME: "code bloat": this just replicates the above with NTL::ZZX -> zzX
@@ -96,14 +116,99 @@ void DoubleCRT::FFT(const zzX& poly, const IndexSet& s)
   NTL::Vec<long>& ivec = tls_ivec;
 
   long icard = MakeIndexVector(s, ivec);
-  NTL_EXEC_RANGE(icard, first, last)
+  long work = nttWork(context, ivec, context.getPhiM());
+  HELIB_ADAPTIVE_EXEC_RANGE(work, icard, first, last)
   for (long j = first; j < last; j++) {
     long i = ivec[j];
     context.ithModulus(i).FFT(map[i], poly);
   }
+  HELIB_ADAPTIVE_EXEC_RANGE_END
+}
+
+void DoubleCRT::FFTBatch(std::vector<DoubleCRT>& dcrts,
+                         const std::vector<zzX>& polys,
+                         const Context& context,
+                         const IndexSet& s)
+{
+  HELIB_TIMER_START;
+  assertTrue(empty(s) || s.last() < context.numPrimes(),
+             "s must end with a smaller element than context.numPrimes()");
+
+  long n = polys.size();
+  dcrts.assign(n, DoubleCRT(context, IndexSet::emptySet()));
+
+  // Constant polynomials need no transform
+  std::vector<long> todo;
+  for (long k : range(n)) {
+    dcrts[k].map.insert(s);
+    if (lsize(polys[k]) > 1)
+      todo.push_back(k);
+    else if (!isDryRun())
+      dcrts[k] = (lsize(polys[k]) == 1) ? polys[k][0] : 0;
+  }
+  if (empty(s) || todo.empty())
+    return;
+  if (isDryRun()) {
+    chargeDryRunRows(todo.size() * s.card(), 0, 0);
+    return;
+  }
+
+  NTL::Vec<long> ivec;
+  long icard = MakeIndexVector(s, ivec);
+
+  // Each job transforms a run of up to RUN polynomials modulo one prime
+  const long RUN = 8;
+  long nRuns = divc(todo.size(), RUN);
+  NTL_EXEC_RANGE(icard * nRuns, first, last)
+  std::vector<NTL::vec_long*> rows(RUN);
+  std::vector<const zzX*> input(RUN);
+  for (long job : range(first, last)) {
+    long i = ivec[job / nRuns];
+    long start = (job % nRuns) * RUN;
+    long len = std::min<long>(RUN, todo.size() - start);
+    for (long t : range(len)) {
+      rows[t] = &dcrts[todo[start + t]].map[i];
+      input[t] = &polys[todo[start + t]];
+    }
+    context.ithModulus(i).FFT(rows.data(), input.data(), len);
+  }
   NTL_EXEC_RANGE_END
 }
 
+void DoubleCRT::setCoeffs(const std::vector<long>& coeffs)
+{
+  HELIB_TIMER_START;
+
+  long phim = context.getPhiM();
+  long n = coeffs.size();
+  assertTrue(n <= phim, "DoubleCRT::setCoeffs: too many coefficients");
+
+  const IndexSet& s = map.getIndexSet();
+  if (empty(s))
+    return;
+
+  static thread_local NTL::Vec<long> tls_ivec;
+  NTL::Vec<long>& ivec = tls_ivec;
+
+  long icard = MakeIndexVector(s, ivec);
+  HELIB_ADAPTIVE_EXEC_RANGE(nttWork(context, ivec, phim), icard, first, last)
+  for (long j = first; j < last; j++) {
+    long i = ivec[j];
+    const Cmodulus& mod = context.ithModulus(i);
+    long q = mod.getQ();
+    NTL::vec_long& row = map[i];
+    row.SetLength(phim);
+    long* rp = row.elts();
+    for (long k = 0; k < n; k++) {
+      long c = coeffs[k] % q;
+      rp[k] = (c < 0) ? c + q : c;
+    }
+    std::fill(rp + n, rp + phim, 0);
+    mod.FFTInPlace(row);
+  }
+  HELIB_ADAPTIVE_EXEC_RANGE_END
+}
+
 // a "sanity check" function, verifies consistency of matrix with current
 // moduli chain an error is raised if they are not consistent
 void DoubleCRT::verify()
@@ -196,28 +301,80 @@ struct MulFun
   }
 };
 #else
+// The built-in kernels pick an AVX-512 implementation at runtime if the
+// CPU supports it, and fall back to scalar NTL arithmetic otherwise
 struct AddFun
 {
-  long apply(long a, long b, long n) const { return NTL::AddMod(a, b, n); }
+  void apply(long* result,
+             const long* a,
+             const long* b,
+             long size,
+             long modulus) const
+  {
+    simd::EltwiseAddMod(result, a, b, size, modulus);
+  }
+
+  void apply(long* result,
+             const long* a,
+             long scalar,
+             long size,
+             long modulus) const
+  {
+    simd::EltwiseAddMod(result, a, scalar, size, modulus);
+  }
 };
 
 struct SubFun
 {
-  long apply(long a, long b, long n) const { return NTL::SubMod(a, b, n); }
+  void apply(long* result,
+             const long* a,
+             const long* b,
+             long size,
+             long modulus) const
+  {
+    simd::EltwiseSubMod(result, a, b, size, modulus);
+  }
+
+  void apply(long* result,
+             const long* a,
+             long scalar,
+             long size,
+             long modulus) const
+  {
+    simd::EltwiseSubMod(result, a, scalar, size, modulus);
+  }
 };
 
 struct MulFun
 {
-  long apply(long a, long b, long n) const { return NTL::MulMod(a, b, n); }
+  void apply(long* result,
+             const long* a,
+             const long* b,
+             long size,
+             long modulus) const
+  {
+    simd::EltwiseMultMod(result, a, b, size, modulus);
+  }
+
+  void apply(long* result,
+             const long* a,
+             long scalar,
+             long size,
+             long modulus) const
+  {
+    simd::EltwiseMultMod(result, a, scalar, size, modulus);
+  }
 };
-#endif
+#endif // USE_INTEL_HEXL
 
 // Generic operation, Fnc is AddMod, SubMod, or MulMod (from NTL's ZZ module)
 template <typename Fun>
 DoubleCRT& DoubleCRT::Op(const DoubleCRT& other, Fun fun, bool matchIndexSets)
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(0, map.getIndexSet().card(), 0);
     return *this;
+  }
 
   if (&context != &other.context)
     throw RuntimeError("DoubleCRT::Op: incompatible objects");
@@ -262,12 +419,7 @@ DoubleCRT& DoubleCRT::Op(const DoubleCRT& other, Fun fun, bool matchIndexSets)
     NTL::vec_long& row = map[i];
     const NTL::vec_long& other_row = (*other_map)[i];
 
-#ifdef USE_INTEL_HEXL
     fun.apply(row.elts(), row.elts(), other_row.elts(), phim, pi);
-#else
-    for (long j : range(phim))
-      row[j] = fun.apply(row[j], other_row[j], pi);
-#endif
   }
   return *this;
 }
@@ -279,8 +431,10 @@ DoubleCRT& DoubleCRT::do_mul(const DoubleCRT& other, bool matchIndexSets)
 {
   HELIB_TIMER_START;
 
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(0, map.getIndexSet().card(), 0);
     return *this;
+  }
 
   if (&context != &other.context)
     throw RuntimeError("DoubleCRT::Op: incompatible objects");
@@ -329,8 +483,12 @@ DoubleCRT& DoubleCRT::do_mul(const DoubleCRT& other, bool matchIndexSets)
     intel::EltwiseMultMod(row.elts(), row.elts(), other_row.elts(), phim, pi);
 #else
     NTL::mulmod_t pi_inv = context.ithModulus(i).getQInv();
-    for (long j : range(phim))
-      row[j] = MulMod(row[j], other_row[j], pi, pi_inv);
+    simd::EltwiseMultMod(row.elts(),
+                         row.elts(),
+                         other_row.elts(),
+                         phim,
+                         pi,
+                         pi_inv);
 #endif // USE_INTEL_HEXL
   }
   return *this;
@@ -339,8 +497,10 @@ DoubleCRT& DoubleCRT::do_mul(const DoubleCRT& other, bool matchIndexSets)
 template <typename Fun>
 DoubleCRT& DoubleCRT::Op(const NTL::ZZ& num, Fun fun)
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(0, map.getIndexSet().card(), 0);
     return *this;
+  }
 
   const IndexSet& s = map.getIndexSet();
   long phim = context.getPhiM();
@@ -350,20 +510,17 @@ DoubleCRT& DoubleCRT::Op(const NTL::ZZ& num, Fun fun)
     long n = rem(num, pi); // n = num % pi
     NTL::vec_long& row = map[i];
 
-#ifdef USE_INTEL_HEXL
     fun.apply(row.elts(), row.elts(), n, phim, pi);
-#else
-    for (long j : range(phim))
-      row[j] = fun.apply(row[j], n, pi);
-#endif
   }
   return *this;
 }
 
 DoubleCRT& DoubleCRT::Negate(const DoubleCRT& other)
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(0, other.map.getIndexSet().card(), 0);
     return *this;
+  }
 
   if (&context != &other.context)
     throw RuntimeError("DoubleCRT Negate: incompatible contexts");
@@ -386,8 +543,12 @@ DoubleCRT& DoubleCRT::Negate(const DoubleCRT& other)
 template <typename Fun>
 DoubleCRT& DoubleCRT::Op(const NTL::ZZX& poly, Fun fun)
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    // The transform of poly, then the operation
+    long rows = map.getIndexSet().card();
+    chargeDryRunRows(rows, rows, 0);
     return *this;
+  }
 
   const IndexSet& s = map.getIndexSet();
   DoubleCRT other(poly, context, s); // other defined wrt same primes as *this
@@ -474,6 +635,216 @@ void DoubleCRT::Mul(const DoubleCRT& other, bool matchIndexSets)
   do_mul(other, matchIndexSets);
 }
 
+DoubleCRT& DoubleCRT::mulAdd(const DoubleCRT& a, const DoubleCRT& b)
+{
+  HELIB_TIMER_START;
+
+  if (isDryRun()) {
+    chargeDryRunRows(0, map.getIndexSet().card(), 0);
+    return *this;
+  }
+
+  if (&context != &a.context || &context != &b.context)
+    throw RuntimeError("DoubleCRT::mulAdd: incompatible objects");
+
+  const IndexSet& s = map.getIndexSet();
+  if (!(s <= a.map.getIndexSet() && s <= b.map.getIndexSet()))
+    throw RuntimeError("DoubleCRT::mulAdd: operands miss some primes");
+
+  long phim = context.getPhiM();
+
+  for (long i : s) {
+    long pi = context.ithPrime(i);
+    long* row = map[i].elts();
+    const long* a_row = a.map[i].elts();
+    const long* b_row = b.map[i].elts();
+
+#ifdef USE_INTEL_HEXL
+    intel::EltwiseMulAddMod(row, a_row, b_row, phim, pi);
+#else
+    NTL::mulmod_t pi_inv = context.ithModulus(i).getQInv();
+    for (long j : range(phim)) {
+      long prod = NTL::MulMod(a_row[j], b_row[j], pi, pi_inv);
+      row[j] = NTL::AddMod(row[j], prod, pi);
+    }
+#endif // USE_INTEL_HEXL
+  }
+  return *this;
+}
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+// Reduce a lazily accumulated sum of products acc < 2^64 * q to [0, q).
+// With acc = hi * 2^64 + lo and hi < q, that is hi * (2^64 mod q) + lo.
+static inline long reduceLazySum(uint128_t acc,
+                                 long q,
+                                 long r64,
+                                 NTL::mulmod_precon_t r64_precon,
+                                 NTL::sp_reduce_struct q_red)
+{
+  long hi = long((unsigned long)(acc >> 64));
+  long lo = NTL::rem((unsigned long)acc, q, q_red);
+  return NTL::AddMod(NTL::MulModPrecon(hi, r64, q, r64_precon), lo, q);
+}
+
+// Fetch the cache line at p for reading, ahead of its use
+static inline void prefetchRead(const void* p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(p, 0, 3);
+#else
+  (void)p;
+#endif
+}
+
+template <typename BRow>
+DoubleCRT& DoubleCRT::innerProductRows(const std::vector<DoubleCRT>& a,
+                                       BRow bRow)
+{
+  HELIB_TIMER_START;
+
+  if (isDryRun()) {
+    chargeDryRunRows(0, map.getIndexSet().card() * long(a.size()), 0);
+    return *this;
+  }
+
+  const IndexSet& s = map.getIndexSet();
+  for (long k : range(a.size())) {
+    if (&context != &a[k].context)
+      throw RuntimeError("DoubleCRT::innerProduct: incompatible objects");
+    if (!(s <= a[k].map.getIndexSet()))
+      throw RuntimeError("DoubleCRT::innerProduct: operands miss some primes");
+  }
+
+  long phim = context.getPhiM();
+  long nTerms = a.size();
+
+  static thread_local NTL::Vec<long> tls_ivec;
+  NTL::Vec<long>& ivec = tls_ivec;
+
+#ifdef USE_INTEL_HEXL
+  // One multiply-accumulate kernel per term and prime, over whole rows
+  long icard = MakeIndexVector(s, ivec);
+  HELIB_ADAPTIVE_EXEC_RANGE(icard * nTerms * phim, icard, first, last)
+  for (long jj = first; jj < last; jj++) {
+    long i = ivec[jj];
+    long pi = context.ithPrime(i);
+    long* row = map[i].elts();
+    if (nTerms == 0) {
+      std::fill_n(row, phim, 0);
+      continue;
+    }
+    intel::EltwiseMultMod(row, a[0].map[i].elts(), bRow(0, i), phim, pi);
+    for (long k = 1; k < nTerms; k++)
+      intel::EltwiseMulAddMod(row, a[k].map[i].elts(), bRow(k, i), phim, pi);
+  }
+  HELIB_ADAPTIVE_EXEC_RANGE_END
+#else
+  // The 2*nTerms rows of a prime are each read sequentially, but all at
+  // once, which the hardware prefetchers do not follow well: every row is
+  // fetched AHEAD entries in advance, and near the end of the rows of a
+  // prime, the start of the rows of the next one
+  constexpr long LINE = 64 / sizeof(long);
+  constexpr long AHEAD = 8 * LINE;
+
+  long icard = MakeIndexVector(s, ivec);
+  HELIB_ADAPTIVE_EXEC_RANGE(icard * nTerms * phim, icard, first, last)
+  std::vector<const long*> a_rows(nTerms), b_rows(nTerms);
+  std::vector<const long*> a_next(nTerms), b_next(nTerms);
+  for (long jj = first; jj < last; jj++) {
+    long i = ivec[jj];
+    long pi = context.ithPrime(i);
+    NTL::mulmod_t pi_inv = context.ithModulus(i).getQInv();
+    NTL::sp_reduce_struct pi_red = NTL::sp_PrepRem(pi);
+    long r64 = NTL::AddMod(NTL::rem(~0UL, pi, pi_red), 1, pi);
+    NTL::mulmod_precon_t r64_precon = NTL::PrepMulModPrecon(r64, pi, pi_inv);
+    long* row = map[i].elts();
+
+    if (jj == first)
+      for (long k : range(nTerms)) {
+        a_rows[k] = a[k].map[i].elts();
+        b_rows[k] = bRow(k, i);
+      }
+    else { // looked up with the previous prime
+      a_rows.swap(a_next);
+      b_rows.swap(b_next);
+    }
+    bool haveNext = (jj + 1 < last);
+    if (haveNext)
+      for (long k : range(nTerms)) {
+        a_next[k] = a[k].map[ivec[jj + 1]].elts();
+        b_next[k] = bRow(k, ivec[jj + 1]);
+      }
+
+    // The products are summed unreduced in 128 bits. Each one is below
+    // pi^2, so up to maxTerms of them (plus a reduced carry) keep the high
+    // word of the sum below pi
+    long maxTerms = std::min(1L << 20, long(~0UL / (unsigned long)pi) - 1);
+
+    for (long j : range(phim)) {
+      if (j % LINE == 0) {
+        long ahead = j + AHEAD;
+        if (ahead < phim)
+          for (long k : range(nTerms)) {
+            prefetchRead(a_rows[k] + ahead);
+            prefetchRead(b_rows[k] + ahead);
+          }
+        else if (haveNext && ahead - phim < phim)
+          for (long k : range(nTerms)) {
+            prefetchRead(a_next[k] + (ahead - phim));
+            prefetchRead(b_next[k] + (ahead - phim));
+          }
+      }
+
+      uint128_t acc = 0;
+      for (long k = 0; k < nTerms;) {
+        long end = std::min(nTerms, k + maxTerms);
+        for (; k < end; k++)
+          acc += uint128_t((unsigned long)a_rows[k][j]) *
+                 (unsigned long)b_rows[k][j];
+        if (k < nTerms)
+          acc = (unsigned long)reduceLazySum(acc, pi, r64, r64_precon, pi_red);
+      }
+      row[j] = reduceLazySum(acc, pi, r64, r64_precon, pi_red);
+    }
+  }
+  HELIB_ADAPTIVE_EXEC_RANGE_END
+#endif // USE_INTEL_HEXL
+  return *this;
+}
+
+DoubleCRT& DoubleCRT::innerProduct(const std::vector<DoubleCRT>& a,
+                                   const std::vector<DoubleCRT>& b)
+{
+  if (a.size() > b.size())
+    throw RuntimeError("DoubleCRT::innerProduct: b is shorter than a");
+
+  const IndexSet& s = map.getIndexSet();
+  for (long k : range(a.size())) {
+    if (&context != &b[k].context)
+      throw RuntimeError("DoubleCRT::innerProduct: incompatible objects");
+    if (!(s <= b[k].map.getIndexSet()))
+      throw RuntimeError("DoubleCRT::innerProduct: operands miss some primes");
+  }
+
+  return innerProductRows(
+      a, [&b](long k, long i) { return b[k].map[i].elts(); });
+}
+
+DoubleCRT& DoubleCRT::innerProduct(const std::vector<DoubleCRT>& a,
+                                   const std::vector<IndexMap<const long*>>& b)
+{
+  if (a.size() > b.size())
+    throw RuntimeError("DoubleCRT::innerProduct: b is shorter than a");
+
+  const IndexSet& s = map.getIndexSet();
+  for (long k : range(a.size()))
+    if (!(s <= b[k].getIndexSet()))
+      throw RuntimeError("DoubleCRT::innerProduct: operands miss some primes");
+
+  return innerProductRows(a, [&b](long k, long i) { return b[k][i]; });
+}
+
 // break *this into n digits,according to the primeSets in context.digits
 // returns the sum of the canonical embedding norms of the digits
 NTL::xdouble DoubleCRT::breakIntoDigits(std::vector<DoubleCRT>& digits) const
@@ -502,15 +873,37 @@ NTL::xdouble DoubleCRT::breakIntoDigits(std::vector<DoubleCRT>& digits) const
   assertTrue(n <= (long)context.getDigits().size(),
              "n cannot be larger than the size of context.digits");
 
-  digits.resize(n, DoubleCRT(context, IndexSet::emptySet()));
-  if (isDryRun())
+  // The digits are temporaries, charged to SCRATCH outside of scopes
+  DoubleCRT blank(context, IndexSet::emptySet());
+  if (MemoryScope::current() == MemoryCategory::OTHER)
+    blank.setMemoryCategory(MemoryCategory::SCRATCH);
+  digits.resize(n, blank);
+  if (isDryRun()) {
+    // Each digit is transformed back, extended to the other primes (each new
+    // row summing over the primes of the digit) and transformed again
+    for (long i : range(n)) {
+      IndexSet digitPrimes = getIndexSet() & context.getDigit(i);
+      long in = digitPrimes.card();
+      long out = (allPrimes / digitPrimes).card();
+      chargeDryRunRows(in + out, in * out, 0);
+    }
     return NTL::conv<NTL::xdouble>(0.0);
+  }
 
+  // Each digit starts as the rows of *this modulo the digit primes, copied
+  // straight into it (rather than copying all the rows and dropping some)
+  std::vector<std::pair<long, long>> jobs; // (digit, prime) pairs
   for (long i : range(n)) {
-    digits[i] = *this;
-    IndexSet notInDigit = digits[i].getIndexSet() / context.getDigit(i);
-    digits[i].removePrimes(notInDigit); // reduce modulo the digit primes
+    IndexSet digitPrimes = getIndexSet() & context.getDigit(i);
+    digits[i].removePrimes(digits[i].getIndexSet() / digitPrimes);
+    digits[i].map.insert(digitPrimes / digits[i].getIndexSet());
+    for (long t : digitPrimes)
+      jobs.emplace_back(i, t);
   }
+  NTL_EXEC_RANGE(long(jobs.size()), first, last)
+  for (long k : range(first, last))
+    digits[jobs[k].first].map[jobs[k].second] = map[jobs[k].second];
+  NTL_EXEC_RANGE_END
 
   NTL::xdouble noise(0.0);
 
@@ -518,15 +911,17 @@ NTL::xdouble DoubleCRT::breakIntoDigits(std::vector<DoubleCRT>& digits) const
     HELIB_NTIMER_START(addPrimes_5);
     IndexSet notInDigit = allPrimes / digits[i].getIndexSet();
 
-#if 0
-// This version coumputes a high-probability bound
+#ifdef HELIB_FAST_DIGIT_NOISE
+    // This version computes a high-probability bound, which lets us use the
+    // fast base extension (it does not give us the digit as a polynomial).
+    // It is opt-in: the noise estimate is no longer the measured one.
 
     double digitSize = context.logOfProduct(digits[i].getIndexSet());
     NTL::xdouble norm_bnd =
-      context.noiseBoundForUniform( NTL::xexp(digitSize)/2.0, phim );
+        context.noiseBoundForUniform(NTL::xexp(digitSize) / 2.0, phim);
     noise += norm_bnd;
 
-    digits[i].addPrimes(notInDigit); // add back all the primes
+    digits[i].addPrimesFast(notInDigit); // add back all the primes
 
 #else
     // This version computes an "exact" value
@@ -549,11 +944,32 @@ NTL::xdouble DoubleCRT::breakIntoDigits(std::vector<DoubleCRT>& digits) const
 
 #endif
 
+    // digits[j] = (digits[j] - digits[i]) / pi for the later digits, in a
+    // single pass over each of their rows
     NTL::ZZ pi = context.productOfPrimes(context.getDigit(i));
-    for (long j : range(i + 1, digits.size())) {
-      digits[j].Sub(digits[i], /*matchIndexSets=*/false);
-      digits[j] /= pi;
+    jobs.clear();
+    for (long j : range(i + 1, digits.size()))
+      for (long t : digits[j].getIndexSet())
+        jobs.emplace_back(j, t);
+    NTL_EXEC_RANGE(long(jobs.size()), first, last)
+    for (long k : range(first, last)) {
+      long t = jobs[k].second;
+      long q = context.ithPrime(t);
+      long piInv = NTL::InvMod(rem(pi, q), q);
+      long* row = digits[jobs[k].first].map[t].elts();
+      const long* sub = digits[i].map[t].elts();
+#ifdef USE_INTEL_HEXL
+      intel::EltwiseSubMulMod(row, row, sub, piInv, phim, q);
+#else
+      NTL::mulmod_precon_t precon = NTL::PrepMulModPrecon(piInv, q);
+      for (long c : range(phim))
+        row[c] = NTL::MulModPrecon(NTL::SubMod(row[c], sub[c], q),
+                                   piInv,
+                                   q,
+                                   precon);
+#endif // USE_INTEL_HEXL
     }
+    NTL_EXEC_RANGE_END
   }
   HELIB_TIMER_STOP;
 
@@ -588,8 +1004,10 @@ void DoubleCRT::addPrimes(const IndexSet& s1, NTL::ZZX* poly_p)
     *poly_p = poly;
 
   map.insert(s1); // add new rows to the map
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(s1.card(), 0, 0);
     return;
+  }
 
   // fill in new rows
   if (deg(poly) <= 0)       // special case for a constant polynomial
@@ -598,6 +1016,85 @@ void DoubleCRT::addPrimes(const IndexSet& s1, NTL::ZZX* poly_p)
     FFT(poly, s1);
 }
 
+// Expand index set by s1 without going through the ZZX representation:
+// the coefficients modulo the current primes are extended to the new primes
+// with single-precision arithmetic only, then transformed back.
+void DoubleCRT::addPrimesFast(const IndexSet& s1)
+{
+  HELIB_TIMER_START;
+
+  if (empty(s1))
+    return; // nothing to do
+  // s1 is disjoint from *this
+  assertTrue(disjoint(s1, map.getIndexSet()),
+             "addPrimes can only be called on a disjoint set");
+
+  if (empty(getIndexSet())) { // special case for empty DCRT
+    map.insert(s1);           // just add new rows to the map and return
+    SetZero();
+    return;
+  }
+  IndexSet s0 = getIndexSet();
+  map.insert(s1); // add new rows to the map
+  if (isDryRun()) {
+    chargeDryRunRows(s0.card() + s1.card(), s0.card() * s1.card(), 0);
+    return;
+  }
+
+  std::shared_ptr<const RNSBaseConverter> convPtr =
+      context.getBaseConverter(s0, s1);
+  const RNSBaseConverter& conv = *convPtr;
+  long phim = context.getPhiM();
+
+  // coefficients modulo the old primes (in), and the new ones (out)
+  static thread_local NTL::Vec<long> tls_ivec;
+  static thread_local NTL::Vec<long> tls_ovec;
+  static thread_local NTL::Vec<zzX> tls_inrows;
+  static thread_local NTL::Vec<zzX> tls_outrows;
+  NTL::Vec<long>& ivec = tls_ivec;
+  NTL::Vec<long>& ovec = tls_ovec;
+  NTL::Vec<zzX>& inrows = tls_inrows;
+  NTL::Vec<zzX>& outrows = tls_outrows;
+
+  long icard = MakeIndexVector(s0, ivec);
+  long ocard = MakeIndexVector(s1, ovec);
+  inrows.SetLength(icard);
+  outrows.SetLength(ocard);
+  std::vector<const long*> inptr(icard);
+  std::vector<long*> outptr(ocard);
+  for (long j : range(icard)) {
+    inrows[j].SetLength(phim);
+    inptr[j] = inrows[j].elts();
+  }
+  for (long j : range(ocard)) {
+    outrows[j].SetLength(phim);
+    outptr[j] = outrows[j].elts();
+  }
+
+  {
+    HELIB_NTIMER_START(addPrimesFast_iFFT);
+    HELIB_ADAPTIVE_EXEC_RANGE(nttWork(context, ivec, phim), icard, first, last)
+    for (long j = first; j < last; j++)
+      context.ithModulus(ivec[j]).iFFT(inrows[j], std::as_const(map)[ivec[j]]);
+    HELIB_ADAPTIVE_EXEC_RANGE_END
+  }
+
+  {
+    HELIB_NTIMER_START(addPrimesFast_convert);
+    HELIB_ADAPTIVE_EXEC_RANGE(phim * (icard + ocard), phim, first, last)
+    conv.convert(outptr.data(), inptr.data(), first, last);
+    HELIB_ADAPTIVE_EXEC_RANGE_END
+  }
+
+  {
+    HELIB_NTIMER_START(addPrimesFast_FFT);
+    HELIB_ADAPTIVE_EXEC_RANGE(nttWork(context, ovec, phim), ocard, first, last)
+    for (long j = first; j < last; j++)
+      context.ithModulus(ovec[j]).FFT(map[ovec[j]], outrows[j]);
+    HELIB_ADAPTIVE_EXEC_RANGE_END
+  }
+}
+
 // Expand index set by s1, and multiply by \prod{q \in s1}. s1 is assumed to
 // be disjoint from the current index set. Returns the logarithm of product.
 double DoubleCRT::addPrimesAndScale(const IndexSet& s1)
@@ -647,9 +1144,71 @@ double DoubleCRT::addPrimesAndScale(const IndexSet& s1)
 }
 
 // *****************************************************
-DoubleCRTHelper::DoubleCRTHelper(const Context& context)
+DoubleCRTHelper::DoubleCRTHelper(const Context& context) :
+    val(context.getPhiM()),
+    context(&context),
+    category(MemoryScope::current())
 {
-  val = context.getPhiM();
+  context.getMemoryAccounts().add(category, 0, 0, 1);
+}
+
+DoubleCRTHelper::DoubleCRTHelper(const DoubleCRTHelper& other) :
+    val(other.val), context(other.context), category(MemoryScope::current())
+{
+  if (category == MemoryCategory::OTHER)
+    category = other.category;
+  context->getMemoryAccounts().add(category, 0, 0, 1);
+}
+
+DoubleCRTHelper::~DoubleCRTHelper()
+{
+  // Normally no rows are left, since IndexMap releases them all
+  long left = rows.load(std::memory_order_relaxed);
+  context->getMemoryAccounts().add(category,
+                                   -left * val * long(sizeof(long)),
+                                   -left,
+                                   -1);
+}
+
+void DoubleCRTHelper::init(NTL::vec_long& v)
+{
+  ScratchPool::acquire(v, val);
+  rows.fetch_add(1, std::memory_order_relaxed);
+  context->getMemoryAccounts().add(category, val * sizeof(long), 1, 0);
+  if (isDryRun())
+    chargeDryRunBytes(val * sizeof(long));
+}
+
+void DoubleCRTHelper::release(NTL::vec_long& v)
+{
+  ScratchPool::release(v);
+  rows.fetch_sub(1, std::memory_order_relaxed);
+  context->getMemoryAccounts().add(category, -val * long(sizeof(long)), -1, 0);
+  if (isDryRun())
+    chargeDryRunBytes(-val * long(sizeof(long)));
+}
+
+void DoubleCRTHelper::setMemoryCategory(MemoryCategory newCategory)
+{
+  if (newCategory == category)
+    return;
+  MemoryAccounts& accounts = context->getMemoryAccounts();
+  long count = rows.load(std::memory_order_relaxed);
+  long bytes = count * val * sizeof(long);
+  accounts.add(category, -bytes, -count, -1);
+  accounts.add(newCategory, bytes, count, 1);
+  category = newCategory;
+}
+
+MemoryCategory DoubleCRT::getMemoryCategory() const
+{
+  return static_cast<const DoubleCRTHelper*>(map.getInit())
+      ->getMemoryCategory();
+}
+
+void DoubleCRT::setMemoryCategory(MemoryCategory category)
+{
+  static_cast<DoubleCRTHelper*>(map.getInit())->setMemoryCategory(category);
 }
 
 DoubleCRT::DoubleCRT(const NTL::ZZX& poly,
@@ -662,8 +1221,10 @@ DoubleCRT::DoubleCRT(const NTL::ZZX& poly,
              "s must end with a smaller element than context.numPrimes()");
 
   map.insert(s);
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(deg(poly) <= 0 ? 0 : s.card(), 0, 0);
     return;
+  }
 
   // convert the integer polynomial to FFT representation modulo the primes
   if (deg(poly) <= 0)       // special case for a constant polynomial
@@ -722,8 +1283,10 @@ DoubleCRT::DoubleCRT(const zzX& poly,
              "s must end with a smaller element than context.numPrimes()");
 
   map.insert(s);
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(lsize(poly) <= 1 ? 0 : s.card(), 0, 0);
     return;
+  }
 
   // convert the integer polynomial to FFT representation modulo the primes
   if (lsize(poly) <= 1) // special case for a constant polynomial
@@ -821,13 +1384,21 @@ DoubleCRT& DoubleCRT::operator=(const DoubleCRT& other)
   if (&context != &other.context)
     throw RuntimeError("DoubleCRT assignment: incompatible contexts");
 
+  // A moved-from *this has no helper, and no category of its own to keep
+  if (map.getInit() == nullptr) {
+    map = other.map;
+    return *this;
+  }
+
   if (map.getIndexSet() != other.map.getIndexSet()) {
-    map = other.map; // copy the data
+    MemoryCategory category = getMemoryCategory();
+    map = other.map;             // copy the data
+    setMemoryCategory(category); // but keep the owner of *this
   } else {
     const IndexSet& s = map.getIndexSet();
     long phim = context.getPhiM();
     for (long i : s) {
-      NTL::vec_long& row = map[i];
+      NTL::vec_long& row = map.replace(i); // not copied first if shared
       const NTL::vec_long& other_row = other.map[i];
       for (long j : range(phim))
         row[j] = other_row[j];
@@ -836,10 +1407,39 @@ DoubleCRT& DoubleCRT::operator=(const DoubleCRT& other)
   return *this;
 }
 
+void DoubleCRT::share(const DoubleCRT& other)
+{
+  if (&context != &other.context)
+    throw RuntimeError("DoubleCRT::share: incompatible contexts");
+  map.share(other.map);
+}
+
+DoubleCRT& DoubleCRT::operator=(DoubleCRT&& other)
+{
+  if (this == &other)
+    return *this;
+
+  if (&context != &other.context)
+    throw RuntimeError("DoubleCRT assignment: incompatible contexts");
+
+  // A moved-from *this has no helper, and no category of its own to keep
+  if (map.getInit() == nullptr) {
+    map = std::move(other.map);
+    return *this;
+  }
+
+  MemoryCategory category = getMemoryCategory();
+  map = std::move(other.map);  // take the rows, and their helper
+  setMemoryCategory(category); // but keep the owner of *this
+  return *this;
+}
+
 DoubleCRT& DoubleCRT::operator=(const NTL::ZZX& poly)
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(deg(poly) <= 0 ? 0 : map.getIndexSet().card(), 0, 0);
     return *this;
+  }
 
   const IndexSet& s = map.getIndexSet();
   if (deg(poly) <= 0)       // special case for a constant polynomial
@@ -851,8 +1451,10 @@ DoubleCRT& DoubleCRT::operator=(const NTL::ZZX& poly)
 
 DoubleCRT& DoubleCRT::operator=(const zzX& poly)
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(lsize(poly) <= 1 ? 0 : map.getIndexSet().card(), 0, 0);
     return *this;
+  }
 
   const IndexSet& s = map.getIndexSet();
   // convert the integer polynomial to FFT representation modulo the primes
@@ -866,8 +1468,10 @@ DoubleCRT& DoubleCRT::operator=(const zzX& poly)
 DoubleCRT& DoubleCRT::operator=(const NTL::ZZ& num)
 {
   const IndexSet& s = map.getIndexSet();
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(0, s.card(), 0);
     return *this;
+  }
 
   long phim = context.getPhiM();
 
@@ -925,8 +1529,12 @@ long DoubleCRT::getOneRow(NTL::Vec<long>& row, long idx, bool positive) const
 void DoubleCRT::toPoly(NTL::ZZX& poly, const IndexSet& s, bool positive) const
 {
   HELIB_TIMER_START;
-  if (isDryRun())
+  if (isDryRun()) {
+    // The inverse transforms, then the CRT over the rows
+    long rows = (map.getIndexSet() & s).card();
+    chargeDryRunRows(rows, rows, 0);
     return;
+  }
 
   IndexSet s1 = map.getIndexSet() & s;
   if (empty(s1)) { // nothing to do
@@ -1118,11 +1726,101 @@ void DoubleCRT::toPoly(NTL::ZZX& p, bool positive) const
   toPoly(p, s, positive);
 }
 
+void DoubleCRT::toPolyMod(zzX& poly, long modulus) const
+{
+  HELIB_TIMER_START;
+  if (isDryRun()) {
+    long rows = map.getIndexSet().card();
+    chargeDryRunRows(rows, rows, 0);
+    return;
+  }
+
+  const IndexSet& s = map.getIndexSet();
+  if (empty(s)) {
+    clear(poly);
+    return;
+  }
+  long phim = context.getPhiM();
+
+  static thread_local NTL::Vec<long> tls_ivec;
+  static thread_local NTL::Vec<NTL::vec_long> tls_rows;
+  NTL::Vec<long>& ivec = tls_ivec;
+  NTL::Vec<NTL::vec_long>& rows = tls_rows; // coefficients mod each prime
+
+  long icard = MakeIndexVector(s, ivec);
+  rows.SetLength(icard);
+
+  HELIB_ADAPTIVE_EXEC_RANGE(nttWork(context, ivec, phim), icard, first, last)
+  for (long j : range(first, last))
+    context.ithModulus(ivec[j]).iFFT(rows[j], map[ivec[j]]);
+  HELIB_ADAPTIVE_EXEC_RANGE_END
+
+  // Extend the residues to the single modulus, a block of coefficients at a
+  // time, instead of reconstructing the integers modulo the product
+  RNSBaseConverter conv(context, s, std::vector<long>{modulus});
+  std::vector<const long*> in(icard);
+  for (long j : range(icard))
+    in[j] = rows[j].elts();
+  poly.SetLength(phim);
+  long* out = poly.elts();
+
+  HELIB_ADAPTIVE_EXEC_RANGE(phim * icard, phim, first, last)
+  conv.convert(&out, in.data(), first, last);
+  HELIB_ADAPTIVE_EXEC_RANGE_END
+
+  normalize(poly);
+}
+
+void DoubleCRT::toPolyDouble(std::vector<double>& poly) const
+{
+  HELIB_TIMER_START;
+  if (isDryRun()) {
+    long rows = map.getIndexSet().card();
+    chargeDryRunRows(rows, 0, 0);
+    return;
+  }
+
+  const IndexSet& s = map.getIndexSet();
+  long phim = context.getPhiM();
+  poly.assign(phim, 0.0);
+  if (empty(s))
+    return;
+
+  static thread_local NTL::Vec<long> tls_ivec;
+  static thread_local NTL::Vec<NTL::vec_long> tls_rows;
+  NTL::Vec<long>& ivec = tls_ivec;
+  NTL::Vec<NTL::vec_long>& rows = tls_rows; // coefficients mod each prime
+
+  RNSBaseConverter conv(context, s, std::vector<long>());
+  assertTrue<InvalidArgument>(
+      conv.getFromBits() <= RNSBaseConverter::MAX_LIFT_BITS,
+      "toPolyDouble: product of the primes exceeds 2^126");
+
+  long icard = MakeIndexVector(s, ivec);
+  rows.SetLength(icard);
+
+  HELIB_ADAPTIVE_EXEC_RANGE(nttWork(context, ivec, phim), icard, first, last)
+  for (long j : range(first, last))
+    context.ithModulus(ivec[j]).iFFT(rows[j], map[ivec[j]]);
+  HELIB_ADAPTIVE_EXEC_RANGE_END
+
+  std::vector<const long*> in(icard);
+  for (long j : range(icard))
+    in[j] = rows[j].elts();
+  double* out = poly.data();
+
+  HELIB_ADAPTIVE_EXEC_RANGE(phim * icard, phim, first, last)
+  conv.toDouble(out, in.data(), first, last);
+  HELIB_ADAPTIVE_EXEC_RANGE_END
+}
+
 // Division by constant
 DoubleCRT& DoubleCRT::operator/=(const NTL::ZZ& num)
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(0, map.getIndexSet().card(), 0);
     return *this;
+  }
 
   const IndexSet& s = map.getIndexSet();
   long phim = context.getPhiM();
@@ -1131,9 +1829,13 @@ DoubleCRT& DoubleCRT::operator/=(const NTL::ZZ& num)
     long pi = context.ithPrime(i);
     long n = NTL::InvMod(rem(num, pi), pi); // n = num^{-1} mod pi
     NTL::vec_long& row = map[i];
+#ifdef USE_INTEL_HEXL
+    intel::EltwiseMultMod(row.elts(), row.elts(), n, phim, pi);
+#else
     NTL::mulmod_precon_t precon = NTL::PrepMulModPrecon(n, pi);
     for (long j : range(phim))
       row[j] = NTL::MulModPrecon(row[j], n, pi, precon);
+#endif // USE_INTEL_HEXL
   }
   return *this;
 }
@@ -1141,8 +1843,10 @@ DoubleCRT& DoubleCRT::operator/=(const NTL::ZZ& num)
 // Small-exponent polynomial exponentiation
 void DoubleCRT::Exp(long e)
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(0, map.getIndexSet().card() * NTL::NumBits(e), 0);
     return;
+  }
 
   const IndexSet& s = map.getIndexSet();
   long phim = context.getPhiM();
@@ -1159,45 +1863,48 @@ void DoubleCRT::Exp(long e)
 #if 1
 void DoubleCRT::automorph(long k)
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(0, 0, map.getIndexSet().card());
     return;
+  }
+  fhe_ops.automorphs.add(map.getIndexSet().card());
 
   const PAlgebra& zMStar = context.getZMStar();
   if (!zMStar.inZmStar(k))
     throw RuntimeError("DoubleCRT::automorph: k not in Zm*");
 
-  long m = zMStar.getM();
+  // new[j] = old[perm[j]], the permutation is cached in the context
+  std::shared_ptr<const std::vector<long>> perm =
+      context.getAutomorphPermutation(k);
+  const long* idx = perm->data();
   long phim = context.getPhiM();
-  std::vector<long> tmp(m); // temporary array of size m
-  NTL::mulmod_precon_t precon = NTL::PrepMulModPrecon(k, m);
-
-  const IndexSet& s = map.getIndexSet();
-
-  // go over the rows, permute them one at a time
-  for (long i : s) {
-    NTL::vec_long& row = map[i];
-
-    // Compute new[j] = old[j*k mod m]
 
-    // for (long j=1; j<m; j++) { // 1st pass: copy to temporary array
-    //   long idx = zMStar.indexInZmstar_unchecked(j);
-    //   if (idx>=0) tmp[j] = row[idx];
-    // }
-    // for (long j=1; j<m; j++) { // 2nd pass: copy back from temporary array
-    //   long idx = zMStar.indexInZmstar_unchecked(j);
-    //   if (idx>=0) row[idx] = tmp[NTL::MulModPrecon(j,k,m,precon)];
-    //                                        // new[j] = old[j*k mod m]
-    // }
+  // The rows are gathered into rows from the scratch pool, which then take
+  // their place, and the old rows go back to the pool. The gather goes over
+  // the permutation in blocks, applying each block to all the rows while it
+  // is still in cache.
+  static thread_local NTL::Vec<long> tls_ivec;
+  NTL::Vec<long>& ivec = tls_ivec;
 
-    // slightly faster...
+  long icard = MakeIndexVector(map.getIndexSet(), ivec);
+  NTL::Vec<NTL::vec_long> rows;
+  rows.SetLength(icard);
+  for (long j : range(icard))
+    ScratchPool::acquire(rows[j], phim);
+
+  const long BLOCK = 2048;
+  for (long b = 0; b < phim; b += BLOCK) {
+    long len = std::min(BLOCK, phim - b);
+    for (long j : range(icard))
+      simd::Gather(rows[j].elts() + b,
+                   std::as_const(map)[ivec[j]].elts(),
+                   idx + b,
+                   len);
+  }
 
-    for (long j : range(phim)) { // 1st pass: copy to temporary array
-      tmp[zMStar.repInZmstar_unchecked(j)] = row[j];
-    }
-    for (long j : range(phim)) { // 2nd pass: copy back from temp array
-      row[j] =
-          tmp[NTL::MulModPrecon(zMStar.repInZmstar_unchecked(j), k, m, precon)];
-    }
+  for (long j : range(icard)) {
+    map[ivec[j]].swap(rows[j]);
+    ScratchPool::release(rows[j]);
   }
 }
 
@@ -1239,8 +1946,10 @@ void DoubleCRT::automorph(long k)
 // Compute the complex conjugate, this is the same as automorph(m-1)
 void DoubleCRT::complexConj()
 {
-  if (isDryRun())
+  if (isDryRun()) {
+    chargeDryRunRows(0, 0, map.getIndexSet().card());
     return;
+  }
 
   long phim = context.getPhiM();
   const IndexSet& s = map.getIndexSet();
@@ -1254,21 +1963,13 @@ void DoubleCRT::complexConj()
   }
 }
 
-// fills each row i with random integers mod pi
-void DoubleCRT::randomize(const NTL::ZZ* seed)
+// Fills row with random integers mod pi from the stream, by rejection
+// sampling of k-bit integers, k = NumBits(pi-1)
+static void RandomizeRow(NTL::vec_long& row,
+                         long pi,
+                         long phim,
+                         NTL::RandomStream& stream)
 {
-  HELIB_TIMER_START;
-
-  if (isDryRun())
-    return;
-
-  if (seed != nullptr)
-    SetSeed(*seed);
-
-  const IndexSet& s = map.getIndexSet();
-  long phim = context.getPhiM();
-
-  NTL::RandomStream& stream = NTL::GetCurrentRandomStream();
   const long bufsz = 2048;
 
   NTL::Vec<unsigned char> buf_storage;
@@ -1276,38 +1977,35 @@ void DoubleCRT::randomize(const NTL::ZZ* seed)
 
   unsigned char* buf = buf_storage.elts();
 
-  for (long i : s) {
-    long pi = context.ithPrime(i);
-    long k = NTL::NumBits(pi - 1);
-    long nb = (k + 7) / 8;
-    unsigned long mask = (1UL << k) - 1UL;
+  long k = NTL::NumBits(pi - 1);
+  long nb = (k + 7) / 8;
+  unsigned long mask = (1UL << k) - 1UL;
 
-    NTL::vec_long& row = map[i];
-    long j = 0;
+  long j = 0;
 
-    for (;;) {
-      {
-        HELIB_NTIMER_START(randomize_stream);
-        stream.get(buf, bufsz);
-      }
+  for (;;) {
+    {
+      HELIB_NTIMER_START(randomize_stream);
+      stream.get(buf, bufsz);
+    }
 
-      for (long pos = 0; pos <= bufsz - nb; pos += nb) {
+    for (long pos = 0; pos <= bufsz - nb; pos += nb) {
 
-        // "Duff's device" used to avoid loops
-        // Commented out. Reference of the operation done as loop.
-        //  unsigned long utmp = 0;
-        //  for (long cnt = nb-1;  cnt >= 0; cnt--)
-        //    utmp = (utmp << 8) | buf[pos+cnt];
+      // "Duff's device" used to avoid loops
+      // Commented out. Reference of the operation done as loop.
+      //  unsigned long utmp = 0;
+      //  for (long cnt = nb-1;  cnt >= 0; cnt--)
+      //    utmp = (utmp << 8) | buf[pos+cnt];
 
 #if (defined(__GNUC__) || defined(__clang__))
-        unsigned long utmp = buf[pos + nb - 1];
+      unsigned long utmp = buf[pos + nb - 1];
 
-        {
+      {
 
-          // This is gcc non-standard. Works also on clang and icc.
-          // It's only about 2-3% faster than Duff.
+        // This is gcc non-standard. Works also on clang and icc.
+        // It's only about 2-3% faster than Duff.
 
-          // The pragma below disables the gcc warning temporarily.
+        // The pragma below disables the gcc warning temporarily.
 
 #pragma GCC diagnostic push
 #ifdef __GNUC__
@@ -1317,146 +2015,213 @@ void DoubleCRT::randomize(const NTL::ZZ* seed)
 #pragma GCC diagnostic ignored "-Wpedantic"
 #endif
 #endif
-          static void* dispatch_table[] =
-              {&&L0, &&L1, &&L2, &&L3, &&L4, &&L5, &&L6, &&L7, &&L8};
+        static void* dispatch_table[] =
+            {&&L0, &&L1, &&L2, &&L3, &&L4, &&L5, &&L6, &&L7, &&L8};
 
-          goto* dispatch_table[nb];
+        goto* dispatch_table[nb];
 #pragma GCC diagnostic pop
 
-        L8:
-          utmp = (utmp << 8) | buf[pos + 6];
-        L7:
-          utmp = (utmp << 8) | buf[pos + 5];
-        L6:
-          utmp = (utmp << 8) | buf[pos + 4];
-        L5:
-          utmp = (utmp << 8) | buf[pos + 3];
-        L4:
-          utmp = (utmp << 8) | buf[pos + 2];
-        L3:
-          utmp = (utmp << 8) | buf[pos + 1];
-        L2:
-          utmp = (utmp << 8) | buf[pos + 0];
-        L1:;
-        L0:;
-        }
+      L8:
+        utmp = (utmp << 8) | buf[pos + 6];
+      L7:
+        utmp = (utmp << 8) | buf[pos + 5];
+      L6:
+        utmp = (utmp << 8) | buf[pos + 4];
+      L5:
+        utmp = (utmp << 8) | buf[pos + 3];
+      L4:
+        utmp = (utmp << 8) | buf[pos + 2];
+      L3:
+        utmp = (utmp << 8) | buf[pos + 1];
+      L2:
+        utmp = (utmp << 8) | buf[pos + 0];
+      L1:;
+      L0:;
+      }
 
 #else
-        // Duff's device about 25% faster
-        unsigned long utmp = buf[pos + nb - 1];
-        switch (nb) {
-        case 8:
-          utmp = (utmp << 8) | buf[pos + 6];
-        case 7:
-          utmp = (utmp << 8) | buf[pos + 5];
-        case 6:
-          utmp = (utmp << 8) | buf[pos + 4];
-        case 5:
-          utmp = (utmp << 8) | buf[pos + 3];
-        case 4:
-          utmp = (utmp << 8) | buf[pos + 2];
-        case 3:
-          utmp = (utmp << 8) | buf[pos + 1];
-        case 2:
-          utmp = (utmp << 8) | buf[pos + 0];
-        }
+      // Duff's device about 25% faster
+      unsigned long utmp = buf[pos + nb - 1];
+      switch (nb) {
+      case 8:
+        utmp = (utmp << 8) | buf[pos + 6];
+      case 7:
+        utmp = (utmp << 8) | buf[pos + 5];
+      case 6:
+        utmp = (utmp << 8) | buf[pos + 4];
+      case 5:
+        utmp = (utmp << 8) | buf[pos + 3];
+      case 4:
+        utmp = (utmp << 8) | buf[pos + 2];
+      case 3:
+        utmp = (utmp << 8) | buf[pos + 1];
+      case 2:
+        utmp = (utmp << 8) | buf[pos + 0];
+      }
 #endif
 
-        utmp = (utmp & mask);
+      utmp = (utmp & mask);
 
-        long tmp = utmp;
+      long tmp = utmp;
 
-        row[j] = tmp;
-        j += (tmp < pi);
-        if (j >= phim)
-          break;
-      }
+      row[j] = tmp;
+      j += (tmp < pi);
       if (j >= phim)
         break;
     }
+    if (j >= phim)
+      break;
   }
 }
 
+// fills each row i with random integers mod pi
+void DoubleCRT::randomize(const NTL::ZZ* seed)
+{
+  if (seed != nullptr && !isDryRun())
+    SetSeed(*seed);
+  randomize(PRG::current());
+}
+
+void DoubleCRT::randomize(PRG& prg)
+{
+  HELIB_TIMER_START;
+
+  if (isDryRun()) {
+    chargeDryRunRows(0, map.getIndexSet().card(), 0);
+    return;
+  }
+
+  long phim = context.getPhiM();
+  NTL::RandomStream& stream = prg.stream();
+  for (long i : map.getIndexSet())
+    RandomizeRow(map[i], context.ithPrime(i), phim, stream);
+}
+
+// The key of the stream for the row modulo pi, derived from the bytes of
+// (seed, index, pi)
+static void RowStreamKey(unsigned char* key,
+                         const NTL::ZZ& seed,
+                         long index,
+                         long pi)
+{
+  long nbytes = NTL::NumBytes(seed);
+  NTL::Vec<unsigned char> data;
+  data.SetLength(nbytes + 16);
+  NTL::BytesFromZZ(data.elts(), seed, nbytes);
+  for (long b = 0; b < 8; b++) {
+    data[nbytes + b] = (unsigned long)index >> (8 * b);
+    data[nbytes + 8 + b] = (unsigned long)pi >> (8 * b);
+  }
+  NTL::DeriveKey(key, NTL_PRG_KEYLEN, data.elts(), data.length());
+}
+
+void DoubleCRT::randomize(const NTL::ZZ& seed, long index)
+{
+  HELIB_TIMER_START;
+
+  if (isDryRun()) {
+    chargeDryRunRows(0, map.getIndexSet().card(), 0);
+    return;
+  }
+
+  static thread_local NTL::Vec<long> tls_ivec;
+  NTL::Vec<long>& ivec = tls_ivec;
+
+  long phim = context.getPhiM();
+  long icard = MakeIndexVector(map.getIndexSet(), ivec);
+  HELIB_ADAPTIVE_EXEC_RANGE(icard * phim, icard, first, last)
+  for (long j = first; j < last; j++) {
+    long i = ivec[j];
+    long pi = context.ithPrime(i);
+    unsigned char key[NTL_PRG_KEYLEN];
+    RowStreamKey(key, seed, index, pi);
+    NTL::RandomStream stream(key);
+    RandomizeRow(map[i], pi, phim, stream);
+  }
+  HELIB_ADAPTIVE_EXEC_RANGE_END
+}
+
 // Coefficients are -1/0/1, Prob[0]=1/2
-double DoubleCRT::sampleSmall()
+double DoubleCRT::sampleSmall(PRG& prg)
 {
   zzX poly;
   // degree-(phi(m)-1) polynomial
-  double retval = ::helib::sampleSmall(poly, context);
+  double retval = ::helib::sampleSmall(poly, context, prg);
   *this = poly; // convert to DoubleCRT
   return retval;
 }
 
-double DoubleCRT::sampleSmallBounded()
+double DoubleCRT::sampleSmallBounded(PRG& prg)
 {
   zzX poly;
   // degree-(phi(m)-1) polynomial
-  double retval = ::helib::sampleSmallBounded(poly, context);
+  double retval = ::helib::sampleSmallBounded(poly, context, prg);
   *this = poly; // convert to DoubleCRT
   return retval;
 }
 
 // Coefficients are -1/0/1 with pre-specified number of nonzeros
-double DoubleCRT::sampleHWt(long Hwt)
+double DoubleCRT::sampleHWt(long Hwt, PRG& prg)
 {
   zzX poly;
-  double retval = ::helib::sampleHWt(poly, context, Hwt);
+  double retval = ::helib::sampleHWt(poly, context, Hwt, prg);
   *this = poly; // convert to DoubleCRT
   return retval;
 }
 
 // Coefficients are -1/0/1 with pre-specified number of nonzeros
-double DoubleCRT::sampleHWtBounded(long Hwt)
+double DoubleCRT::sampleHWtBounded(long Hwt, PRG& prg)
 {
   zzX poly;
-  double retval = ::helib::sampleHWtBounded(poly, context, Hwt);
+  double retval = ::helib::sampleHWtBounded(poly, context, Hwt, prg);
   *this = poly; // convert to DoubleCRT
   return retval;
 }
 
 // Coefficients are Gaussians
-double DoubleCRT::sampleGaussian(double stdev)
+double DoubleCRT::sampleGaussian(double stdev, PRG& prg)
 {
   if (stdev == 0.0)
     stdev = to_double(context.getStdev());
   zzX poly;
-  double retval = ::helib::sampleGaussian(poly, context, stdev);
+  double retval = ::helib::sampleGaussian(poly, context, stdev, prg);
   *this = poly; // convert to DoubleCRT
   return retval;
 }
 
-double DoubleCRT::sampleGaussianBounded(double stdev)
+double DoubleCRT::sampleGaussianBounded(double stdev, PRG& prg)
 {
   if (stdev == 0.0)
     stdev = to_double(context.getStdev());
   zzX poly;
-  double retval = ::helib::sampleGaussianBounded(poly, context, stdev);
+  double retval = ::helib::sampleGaussianBounded(poly, context, stdev, prg);
   *this = poly; // convert to DoubleCRT
   return retval;
 }
 
-NTL::xdouble DoubleCRT::sampleGaussianBounded(NTL::xdouble stdev)
+NTL::xdouble DoubleCRT::sampleGaussianBounded(NTL::xdouble stdev, PRG& prg)
 {
   NTL::ZZX poly;
-  NTL::xdouble retval = ::helib::sampleGaussianBounded(poly, context, stdev);
+  NTL::xdouble retval =
+      ::helib::sampleGaussianBounded(poly, context, stdev, prg);
   *this = poly; // convert to DoubleCRT
   return retval;
 }
 
 // Coefficients are uniform in [-B..B]
 
-double DoubleCRT::sampleUniform(long B)
+double DoubleCRT::sampleUniform(long B, PRG& prg)
 {
   zzX poly;
-  double retval = ::helib::sampleUniform(poly, context, B);
+  double retval = ::helib::sampleUniform(poly, context, B, prg);
   *this = poly;
   return retval;
 }
 
-NTL::xdouble DoubleCRT::sampleUniform(const NTL::ZZ& B)
+NTL::xdouble DoubleCRT::sampleUniform(const NTL::ZZ& B, PRG& prg)
 {
   NTL::ZZX poly;
-  NTL::xdouble retval = ::helib::sampleUniform(poly, context, B);
+  NTL::xdouble retval = ::helib::sampleUniform(poly, context, B, prg);
   *this = poly;
   return retval;
 }
@@ -1475,6 +2240,10 @@ void DoubleCRT::scaleDownToSet(const IndexSet& s,
             getIndexSet(),
             "s and the index set must have some intersection");
   if (isDryRun()) {
+    // The inverse transforms of the dropped rows, and the transforms and
+    // arithmetic of the correction on the remaining ones
+    long remaining = getIndexSet().card() - diff.card();
+    chargeDryRunRows(diff.card() + remaining, diff.card() + remaining, 0);
     removePrimes(diff); // remove the primes from consideration
     return;
   }
@@ -1515,6 +2284,114 @@ void DoubleCRT::scaleDownToSet(const IndexSet& s,
                       // actually scales it down
 }
 
+void DoubleCRT::scaleDownToSet(const IndexSet& s,
+                               long ptxtSpace,
+                               std::vector<double>& fdelta)
+{
+  HELIB_TIMER_START;
+
+  IndexSet diff = getIndexSet() / s;
+  fdelta.clear();
+  if (empty(diff))
+    return; // nothing to do
+
+  assertTrue(ptxtSpace >= 1, "ptxtSpace must be at least 1");
+  // cannot mod-down to the empty set
+  assertNeq(diff,
+            getIndexSet(),
+            "s and the index set must have some intersection");
+  IndexSet kept = getIndexSet() / diff;
+  if (isDryRun()) {
+    // The inverse transforms of the dropped rows, the transforms of the
+    // correction on the remaining ones, and the base conversion between them
+    chargeDryRunRows(diff.card() + kept.card(), diff.card() * kept.card(), 0);
+    removePrimes(diff);
+    return;
+  }
+
+  // The tables for the pair of prime sets are kept by the context
+  std::shared_ptr<const RNSBaseConverter> convPtr =
+      context.getBaseConverter(diff, kept);
+  const RNSBaseConverter& conv = *convPtr;
+  long phim = context.getPhiM();
+
+  static thread_local NTL::Vec<long> tls_ivec;
+  static thread_local NTL::Vec<long> tls_ovec;
+  static thread_local NTL::Vec<zzX> tls_inrows;
+  static thread_local NTL::Vec<zzX> tls_outrows;
+  NTL::Vec<long>& ivec = tls_ivec;
+  NTL::Vec<long>& ovec = tls_ovec;
+  NTL::Vec<zzX>& inrows = tls_inrows;
+  NTL::Vec<zzX>& outrows = tls_outrows;
+
+  long icard = MakeIndexVector(diff, ivec);
+  long ocard = MakeIndexVector(kept, ovec);
+  inrows.SetLength(icard);
+  outrows.SetLength(ocard);
+  std::vector<const long*> inptr(icard);
+  std::vector<long*> outptr(ocard);
+  for (long j : range(icard)) {
+    inrows[j].SetLength(phim);
+    inptr[j] = inrows[j].elts();
+  }
+  for (long j : range(ocard)) {
+    outrows[j].SetLength(phim);
+    outptr[j] = outrows[j].elts();
+  }
+
+  {
+    HELIB_NTIMER_START(scaleDownToSet_iFFT);
+    HELIB_ADAPTIVE_EXEC_RANGE(nttWork(context, ivec, phim), icard, first, last)
+    for (long j = first; j < last; j++)
+      context.ithModulus(ivec[j]).iFFT(inrows[j], std::as_const(map)[ivec[j]]);
+    HELIB_ADAPTIVE_EXEC_RANGE_END
+  }
+
+  fdelta.resize(phim);
+  {
+    HELIB_NTIMER_START(scaleDownToSet_convert);
+    HELIB_ADAPTIVE_EXEC_RANGE(phim * (icard + ocard), phim, first, last)
+    conv.modDownCorrection(outptr.data(),
+                           fdelta.data(),
+                           ptxtSpace,
+                           inptr.data(),
+                           first,
+                           last);
+    HELIB_ADAPTIVE_EXEC_RANGE_END
+  }
+
+  removePrimes(diff);
+
+  // row = (row - delta) / Q, with delta taken to the evaluation domain
+  {
+    HELIB_NTIMER_START(scaleDownToSet_FFT);
+    HELIB_ADAPTIVE_EXEC_RANGE(nttWork(context, ovec, phim), ocard, first, last)
+    NTL_THREAD_LOCAL static NTL::vec_long tmp;
+    for (long j = first; j < last; j++) {
+      long q = context.ithPrime(ovec[j]);
+      long qInv = conv.getQInvModTo(j);
+      context.ithModulus(ovec[j]).FFT(tmp, outrows[j]);
+      NTL::vec_long& row = map[ovec[j]];
+#ifdef USE_INTEL_HEXL
+      intel::EltwiseSubMulMod(row.elts(),
+                              row.elts(),
+                              tmp.elts(),
+                              qInv,
+                              phim,
+                              q);
+#else
+      NTL::mulmod_precon_t qInvPrecon = conv.getQInvModToPrecon(j);
+      for (long h : range(phim))
+        row[h] = NTL::MulModPrecon(NTL::SubMod(row[h], tmp[h], q),
+                                   qInv,
+                                   q,
+                                   qInvPrecon);
+#endif // USE_INTEL_HEXL
+    }
+    HELIB_ADAPTIVE_EXEC_RANGE_END
+  }
+}
+
 std::ostream& operator<<(std::ostream& str, const DoubleCRT& d)
 {
   str << d.writeToJSON();
@@ -1560,6 +2437,35 @@ void DoubleCRT::read(std::istream& str)
   }
 }
 
+void DoubleCRT::writePackedTo(std::ostream& str) const
+{
+  const IndexSet& set = map.getIndexSet();
+  set.writeTo(str);
+
+  for (long i : set)
+    write_packed_vec_long(str, map[i], NTL::NumBits(context.ithPrime(i) - 1));
+}
+
+void DoubleCRT::readPacked(std::istream& str)
+{
+  IndexSet set = IndexSet::readFrom(str);
+  assertTrue<IOError>(set <= context.allPrimes(),
+                      "DoubleCRT::readPacked: unknown primes");
+  map.clear();
+  map.insert(set);
+
+  for (long i : set) {
+    long pi = context.ithPrime(i);
+    read_packed_vec_long(str, map[i], NTL::NumBits(pi - 1));
+    assertEq<IOError>(map[i].length(),
+                      context.getPhiM(),
+                      "DoubleCRT::readPacked: bad row length");
+    for (long j : range(map[i].length()))
+      assertTrue<IOError>(map[i][j] < pi,
+                          "DoubleCRT::readPacked: residue out of range");
+  }
+}
+
 void DoubleCRT::writeToJSON(std::ostream& str) const
 {
   str << this->writeToJSON();
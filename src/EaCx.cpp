@@ -25,38 +25,178 @@
 #include <helib/log.h>
 #include <helib/fhe_stats.h>
 
+#include "RNSBaseConverter.h"
+#include "internal_symbols.h" // DECRYPT_ON_PWFL_BASIS
+
 namespace helib {
 
 static constexpr cx_double the_imaginary_i = cx_double(0.0, 1.0);
 
-// decodes the given ZZX
-static void CKKS_decode(const NTL::ZZX& pp,
-                        NTL::xdouble xfactor,
-                        const PAlgebra& palg,
-                        std::vector<cx_double>& ptxt)
+// ptxt = the canonical embedding of coeffs, divided by factor
+static void CKKS_embedScaledDown(std::vector<cx_double>& ptxt,
+                                 const std::vector<double>& coeffs,
+                                 const PAlgebra& palg,
+                                 double factor)
+{
+  CKKS_canonicalEmbedding(ptxt, coeffs, palg);
+  for (cx_double& cx : ptxt) // divide by the factor
+    cx /= factor;
+}
+
+static void CKKS_embedScaledDown(std::vector<cx_float>& ptxt,
+                                 const std::vector<double>& coeffs,
+                                 const PAlgebra& palg,
+                                 double factor)
+{
+  CKKS_canonicalEmbedding(ptxt, coeffs, palg, factor);
+}
+
+// The eps of the noise that decrypt adds against plaintext leakage
+static double CKKS_decryptionEps(const Ctxt& ctxt, OptLong prec)
+{
+  // This mitigates against the attack in
+  // "On the Security of Homomorphic Encryption on Approximate Numbers",
+  // by Baiyu Li and Daniele Micciancio.
+
+  // We add noise so that the scaled error increases by at most eps (with some
+  // futher adjustments made in addedNoiseForCKKSDecryption to maintain a
+  // certain level of security as the cost of accuracy).
+
+  // We compute eps, which by default is ctxt.errorBound().
+  double eps = ctxt.errorBound();
+  if (prec.isDefined()) {
+    double eps1 = std::ldexp(1.0, -prec); // eps = 2^{-r}
+    if (eps1 < eps)
+      Warning("CKKS decryption: 2^{-prec} < ctxt.errorBound(): "
+              "potential security risk");
+    eps = eps1;
+  }
+  return eps;
+}
+
+// The coefficients of the plaintext of ctxt as doubles, to be divided by
+// factor, without reconstructing them as big integers. The raw plaintext is
+// scaled down (exactly, in RNS form) by as many of its primes as keep the
+// rounding well below eps, and the rest, of at most MAX_LIFT_BITS bits, is
+// lifted in 128-bit arithmetic. Returns false when that is not possible,
+// i.e. when the plaintext is far larger than its noise or the primes left
+// are too many.
+static bool CKKS_liftToDoubles(std::vector<double>& coeffs,
+                               double& factor,
+                               const Ctxt& ctxt,
+                               const SecKey& sKey,
+                               double eps)
+{
+  const Context& context = ctxt.getContext();
+  if (DECRYPT_ON_PWFL_BASIS && !context.getZMStar().getPow2())
+    return false; // the lift must be reduced on the powerful basis
+  if (eps <= 0)
+    return false;
+
+  // A rounding of at most 1/2 on each coefficient moves the slots by at most
+  // phi(m)/2 (before the division by ratFactor); keep that below eps/2^10
+  NTL::xdouble ratFactor = ctxt.getRatFactor();
+  double maxLogDropped = NTL::log(ratFactor) + std::log(eps) -
+                         std::log(double(context.getPhiM())) -
+                         10 * std::log(2.0);
+  const double maxLogKept = RNSBaseConverter::MAX_LIFT_BITS * std::log(2.0);
+
+  // Drop the primes from the top of the set, as long as the rounding allows
+  const IndexSet& primes = ctxt.getPrimeSet();
+  IndexSet kept = primes;
+  double logKept = context.logOfProduct(primes);
+  double logDropped = 0;
+  for (long i = primes.last(); i >= primes.first() && logKept > maxLogKept;
+       i = primes.prev(i)) {
+    double logQ = context.logOfPrime(i);
+    if (logDropped + logQ > maxLogDropped)
+      continue;
+    kept.remove(i);
+    logKept -= logQ;
+    logDropped += logQ;
+  }
+  if (empty(kept) || logKept > maxLogKept ||
+      NTL::NumBits(context.productOfPrimes(kept)) >
+          RNSBaseConverter::MAX_LIFT_BITS)
+    return false;
+
+  DoubleCRT ptxt(context, primes);
+  sKey.decryptToDoubleCRT(ptxt, ctxt);
+  NTL::xdouble dropped(1.0);
+  if (kept != primes) {
+    for (long i : primes / kept)
+      dropped *= double(context.ithPrime(i));
+    std::vector<double> fdelta;
+    ptxt.scaleDownToSet(kept, 1, fdelta); // round(x / dropped)
+  }
+  ptxt.toPolyDouble(coeffs);
+  factor = NTL::to_double(ratFactor / dropped);
+  return true;
+}
+
+// The ZZX route, for what CKKS_liftToDoubles does not handle
+static void CKKS_liftToDoubles(std::vector<double>& coeffs,
+                               double& factor,
+                               const NTL::ZZX& pp,
+                               NTL::xdouble xfactor)
 {
   const long MAX_BITS = 400;
   long nBits = NTL::MaxBits(pp) - MAX_BITS;
-  double factor;
 
   // This logic prevents floating point overflow
   if (nBits <= 0) {
-    CKKS_canonicalEmbedding(ptxt, pp, palg);
+    convert(coeffs, pp.rep);
     factor = NTL::to_double(xfactor);
   } else {
     long dpp = deg(pp);
-    std::vector<double> pp_scaled(dpp + 1);
+    coeffs.resize(dpp + 1);
     NTL::ZZ tmp;
     for (long i : range(dpp + 1)) {
       RightShift(tmp, pp.rep[i], nBits);
-      pp_scaled[i] = NTL::to_double(tmp);
+      coeffs[i] = NTL::to_double(tmp);
     }
-    CKKS_canonicalEmbedding(ptxt, pp_scaled, palg);
     factor = NTL::to_double(xfactor / NTL::power2_xdouble(nBits));
   }
+}
 
-  for (cx_double& cx : ptxt) // divide by the factor
-    cx /= factor;
+// ptxt = the decryption of ctxt, with the noise against plaintext leakage
+// if noisy is set
+template <typename T>
+static void CKKS_decrypt(std::vector<std::complex<T>>& ptxt,
+                         const Ctxt& ctxt,
+                         const SecKey& sKey,
+                         const PAlgebra& palg,
+                         bool noisy,
+                         OptLong prec = OptLong())
+{
+  HELIB_TIMER_START;
+  assertEq(&sKey.getContext(),
+           &ctxt.getContext(),
+           "Cannot decrypt with non-matching context");
+
+  double eps = noisy ? CKKS_decryptionEps(ctxt, prec) : ctxt.errorBound();
+  std::vector<double> coeffs;
+  double factor;
+  if (CKKS_liftToDoubles(coeffs, factor, ctxt, sKey, eps)) {
+    if (noisy) {
+      // The noise is as large as the plaintext, it is scaled down with it
+      NTL::ZZX noise;
+      ctxt.addedNoiseForCKKSDecryption(sKey, eps, noise);
+      double scale = NTL::to_double(factor / ctxt.getRatFactor());
+      for (long i : range(deg(noise) + 1))
+        coeffs[i] += NTL::to_double(noise.rep[i]) * scale;
+    }
+  } else {
+    NTL::ZZX pp;
+    sKey.Decrypt(pp, ctxt);
+    if (noisy) {
+      NTL::ZZX noise;
+      ctxt.addedNoiseForCKKSDecryption(sKey, eps, noise);
+      pp += noise;
+    }
+    CKKS_liftToDoubles(coeffs, factor, pp, ctxt.getRatFactor());
+  }
+  CKKS_embedScaledDown(ptxt, coeffs, palg, factor);
 }
 
 void EncryptedArrayCx::rawDecrypt(const Ctxt& ctxt,
@@ -66,14 +206,7 @@ void EncryptedArrayCx::rawDecrypt(const Ctxt& ctxt,
   assertEq(&getContext(),
            &ctxt.getContext(),
            "Cannot decrypt with non-matching context");
-
-  NTL::ZZX pp;
-  sKey.Decrypt(pp, ctxt);
-
-  NTL::xdouble xfactor = ctxt.getRatFactor();
-  const PAlgebra& palg = getPAlgebra();
-
-  CKKS_decode(pp, xfactor, palg, ptxt);
+  CKKS_decrypt(ptxt, ctxt, sKey, getPAlgebra(), /*noisy=*/false);
 }
 
 void EncryptedArrayCx::rawDecrypt(const Ctxt& ctxt,
@@ -93,39 +226,28 @@ void EncryptedArrayCx::decrypt(const Ctxt& ctxt,
   assertEq(&getContext(),
            &ctxt.getContext(),
            "Cannot decrypt with non-matching context");
+  CKKS_decrypt(ptxt, ctxt, sKey, getPAlgebra(), /*noisy=*/true, prec);
+}
 
-  NTL::ZZX pp;
-  sKey.Decrypt(pp, ctxt);
-
-  // This mitigates against the attack in
-  // "On the Security of Homomorphic Encryption on Approximate Numbers",
-  // by Baiyu Li and Daniele Micciancio.
-
-  // We add noise so that the scaled error increases by at most eps (with some
-  // futher adjustments made in addedNoiseForCKKSDecryption to maintain a
-  // certain level of security as the cost of accuracy).
-
-  // First, we compute eps, which by default is ctxt.errorBound().
-  double eps = ctxt.errorBound();
-  if (prec.isDefined()) {
-    double eps1 = std::ldexp(1.0, -prec); // eps = 2^{-r}
-    if (eps1 < eps)
-      Warning("CKKS decryption: 2^{-prec} < ctxt.errorBound(): "
-              "potential security risk");
-    eps = eps1;
-  }
-
-  // Second, we compute the noise itself as a ZZX
-  NTL::ZZX noise;
-  ctxt.addedNoiseForCKKSDecryption(sKey, eps, noise);
-
-  // Third, we add the noise to the raw plaintext
-  pp += noise;
+void EncryptedArrayCx::decrypt(const Ctxt& ctxt,
+                               const SecKey& sKey,
+                               std::vector<cx_float>& ptxt,
+                               OptLong prec) const
+{
+  assertEq(&getContext(),
+           &ctxt.getContext(),
+           "Cannot decrypt with non-matching context");
+  CKKS_decrypt(ptxt, ctxt, sKey, getPAlgebra(), /*noisy=*/true, prec);
+}
 
-  // Finally, we decode the adjusted plaintext
-  NTL::xdouble xfactor = ctxt.getRatFactor();
-  const PAlgebra& palg = getPAlgebra();
-  CKKS_decode(pp, xfactor, palg, ptxt);
+void EncryptedArrayCx::rawDecrypt(const Ctxt& ctxt,
+                                  const SecKey& sKey,
+                                  std::vector<cx_float>& ptxt) const
+{
+  assertEq(&getContext(),
+           &ctxt.getContext(),
+           "Cannot decrypt with non-matching context");
+  CKKS_decrypt(ptxt, ctxt, sKey, getPAlgebra(), /*noisy=*/false);
 }
 
 void EncryptedArrayCx::decrypt(const Ctxt& ctxt,
@@ -226,6 +348,33 @@ void EncryptedArrayCx::rotate(Ctxt& ctxt, long amt) const
              "CKKS rotation not supported in multi-dimensional hypercube");
   rotate1D(ctxt, 0, amt, true);
 }
+void EncryptedArrayCx::rotateMany(std::vector<Ctxt>& out,
+                                  const Ctxt& ctxt,
+                                  const std::vector<long>& amounts) const
+{
+  assertTrue(dimension() == 1,
+             "CKKS rotation not supported in multi-dimensional hypercube");
+  helib::assertEq(&context, &ctxt.getContext(), "Context mismatch");
+
+  out.assign(amounts.size(), ctxt);
+  if (ctxt.isEmpty())
+    return;
+
+  const PAlgebra& palg = getPAlgebra();
+  long ord = sizeOfDimension(0);
+  BasicAutomorphPrecon precon(ctxt);
+
+  NTL_EXEC_RANGE(lsize(amounts), first, last)
+  for (long j : range(first, last)) {
+    long amt = mcMod(amounts[j], ord);
+    if (amt == 0)
+      continue;
+    out[j] = *precon.automorph(palg.genToPow(0, amt));
+    out[j].dropSmallAndSpecialPrimes(); // as after a plain rotation
+  }
+  NTL_EXEC_RANGE_END
+}
+
 void EncryptedArrayCx::shift(Ctxt& ctxt, long amt) const
 {
   assertTrue(dimension() == 1,
@@ -235,10 +384,13 @@ void EncryptedArrayCx::shift(Ctxt& ctxt, long amt) const
 
 //====== New Encoding Functions ====
 
-void EncryptedArrayCx::encode(EncodedPtxt& eptxt,
-                              const std::vector<cx_double>& array,
-                              double mag,
-                              OptLong prec) const
+// The magnitude, error and scale of the encoding of array
+static void encodingParams(const EncryptedArrayCx& ea,
+                           const std::vector<cx_double>& array,
+                           double& mag,
+                           double& err,
+                           double& scale,
+                           OptLong prec)
 {
   double actual_mag = Norm(array);
   if (mag < 0)
@@ -249,7 +401,7 @@ void EncryptedArrayCx::encode(EncodedPtxt& eptxt,
           "EncryptedArrayCx::encode: actual magnitude exceeds mag parameter");
   }
 
-  double err = defaultErr();
+  err = ea.defaultErr();
   // For now, we use defaultErr().  We may want to eventually
   // allow APIs that use a different err value (such as the *actual*
   // err value).  However, if we encrypt this encoding, we
@@ -257,7 +409,16 @@ void EncryptedArrayCx::encode(EncodedPtxt& eptxt,
   // not want to have yet another esteric parameter for the user
   // to worry about.  We can revisit this later.
 
-  double scale = defaultScale(err, prec); // default scale
+  scale = ea.defaultScale(err, prec); // default scale
+}
+
+void EncryptedArrayCx::encode(EncodedPtxt& eptxt,
+                              const std::vector<cx_double>& array,
+                              double mag,
+                              OptLong prec) const
+{
+  double err, scale;
+  encodingParams(*this, array, mag, err, scale, prec);
 
   zzX poly;
   CKKS_embedInSlots(poly, array, getPAlgebra(), scale);
@@ -277,6 +438,53 @@ void EncryptedArrayCx::encode(EncodedPtxt& eptxt,
   HELIB_STATS_UPDATE("CKKS_encode_ratio", ratio);
 }
 
+void EncryptedArrayCx::encode(EncodedPtxt& eptxt,
+                              const std::vector<cx_float>& array,
+                              double mag,
+                              OptLong prec) const
+{
+  double actual_mag = 0;
+  for (const cx_float& x : array)
+    actual_mag = std::max(actual_mag, double(std::abs(x)));
+  if (mag < 0)
+    mag = actual_mag;
+  else if (actual_mag > mag)
+    Warning(
+        "EncryptedArrayCx::encode: actual magnitude exceeds mag parameter");
+
+  double err = defaultErr();
+  double scale = defaultScale(err, prec);
+
+  // No error check here: the slots only carry single precision anyway
+  zzX poly;
+  CKKS_embedInSlots(poly, array, getPAlgebra(), scale);
+  eptxt.resetCKKS(poly, mag, scale, err, getContext());
+}
+
+void EncryptedArrayCx::encode(FatEncodedPtxt& feptxt,
+                              const std::vector<cx_double>& array,
+                              const IndexSet& s,
+                              double mag,
+                              OptLong prec) const
+{
+  HELIB_TIMER_START;
+  double err, scale;
+  encodingParams(*this, array, mag, err, scale, prec);
+
+  // No error check here: it would need the coefficients, which is what
+  // this path avoids building
+  feptxt.resetCKKS(array, getContext(), s, mag, scale, err);
+}
+
+void EncryptedArrayCx::encode(FatEncodedPtxt& feptxt,
+                              const PlaintextArray& array,
+                              const IndexSet& s,
+                              double mag,
+                              OptLong prec) const
+{
+  encode(feptxt, array.getData<PA_cx>(), s, mag, prec);
+}
+
 void EncryptedArrayCx::encode(EncodedPtxt& eptxt,
                               const PlaintextArray& array,
                               double mag,
@@ -373,13 +581,18 @@ double EncryptedArrayCx::encodei(zzX& ptxt, long precision) const
 
 const zzX& EncryptedArrayCx::getiEncoded() const
 {
-  // VJS-FIXME: this is NOT thread-safe
-  // It also seems like it is not used anywhere, so I suggest we
-  // get rid of it...
-
-  if (lsize(iEncoded) <= 0)              // encoded-i not yet initialized
-    encodei(const_cast<zzX&>(iEncoded)); // temporarily suspend cont-ness
-  return iEncoded;
+  // Threads racing to initialize it all encode i, and all but the first
+  // discard theirs. Once set, the pointer is never replaced, so the returned
+  // reference stays valid for the lifetime of this object.
+  std::shared_ptr<const zzX> current = std::atomic_load(&iEncoded);
+  if (!current) {
+    auto encoded = std::make_shared<zzX>();
+    encodei(*encoded);
+    std::shared_ptr<const zzX> fresh = std::move(encoded);
+    if (std::atomic_compare_exchange_strong(&iEncoded, &current, fresh))
+      current = std::move(fresh);
+  }
+  return *current;
 }
 
 void EncryptedArrayCx::decode(std::vector<cx_double>& array,
@@ -449,6 +662,67 @@ void EncryptedArrayCx::extractImPart(Ctxt& c, DoubleCRT* iDcrtPtr) const
   c *= 0.5;                        // divide by two
 }
 
+void EncryptedArrayCx::encryptPair(Ctxt& ctxt,
+                                   const PubKey& key,
+                                   const std::vector<double>& re,
+                                   const std::vector<double>& im,
+                                   double useThisSize,
+                                   long precision) const
+{
+  assertTrue<InvalidArgument>(lsize(re) <= size() && lsize(im) <= size(),
+                              "Cannot encrypt a pair longer than the number "
+                              "of slots");
+  std::vector<cx_double> slots(size(), cx_double(0.0));
+  for (long i : range(lsize(re)))
+    slots[i].real(re[i]);
+  for (long i : range(lsize(im)))
+    slots[i].imag(im[i]);
+  encrypt(ctxt, key, slots, useThisSize, precision);
+}
+
+void EncryptedArrayCx::decryptPair(const Ctxt& ctxt,
+                                   const SecKey& sKey,
+                                   std::vector<double>& re,
+                                   std::vector<double>& im,
+                                   OptLong prec) const
+{
+  std::vector<cx_double> slots;
+  decrypt(ctxt, sKey, slots, prec);
+  re.resize(slots.size());
+  im.resize(slots.size());
+  for (long i : range(lsize(slots))) {
+    re[i] = slots[i].real();
+    im[i] = slots[i].imag();
+  }
+}
+
+void EncryptedArrayCx::splitPair(Ctxt& re, Ctxt& im, const Ctxt& pair) const
+{
+  Ctxt conj = pair;
+  conj.complexConj(); // conj(pair) = re - i*im
+  Ctxt diff = conj;
+  diff -= pair; // conj(pair) - pair = -2*i*im
+
+  re = pair;
+  re += conj; // pair + conj(pair) = 2*re
+  re *= 0.5;
+
+  PtxtArray halfI(getContext(), cx_double(0.0, 0.5));
+  im = std::move(diff);
+  im *= halfI; // -2*i*im * i/2 = im
+}
+
+void EncryptedArrayCx::joinPair(Ctxt& pair,
+                                const Ctxt& re,
+                                const Ctxt& im) const
+{
+  PtxtArray i(getContext(), cx_double(0.0, 1.0));
+  Ctxt tmp = im;
+  tmp *= i;
+  tmp += re;
+  pair = std::move(tmp);
+}
+
 void EncryptedArrayCx::buildLinPolyCoeffs(std::vector<zzX>& C,
                                           const cx_double& oneImage,
                                           const cx_double& iImage,
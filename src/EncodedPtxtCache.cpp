@@ -0,0 +1,114 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* EncodedPtxtCache.cpp - a constant kept in DoubleCRT form per prime set
+ */
+#include <vector>
+
+#include <helib/EncodedPtxtCache.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+EncodedPtxtCache::EncodedPtxtCache(const EncodedPtxt& eptxt, long maxBytes) :
+    eptxt(eptxt), maxBytes(maxBytes)
+{
+  assertTrue<InvalidArgument>(eptxt.isBGV() || eptxt.isCKKS(),
+                              "EncodedPtxtCache: empty EncodedPtxt");
+  assertTrue<InvalidArgument>(maxBytes >= 0,
+                              "EncodedPtxtCache: the maximum size is negative");
+}
+
+const EncodedPtxtCache::Entry* EncodedPtxtCache::find(const IndexSet& s) const
+{
+  for (auto it = entries.begin(); it != entries.end(); ++it)
+    if (s <= it->primes) {
+      entries.splice(entries.begin(), entries, it);
+      return &entries.front();
+    }
+  return nullptr;
+}
+
+std::shared_ptr<const FatEncodedPtxt> EncodedPtxtCache::get(
+    const IndexSet& s) const
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (const Entry* entry = find(s)) {
+      nHits++;
+      return entry->form;
+    }
+    nMisses++;
+  }
+
+  // Made outside of the lock, so the cache keeps serving other threads
+  HELIB_NTIMER_START(EncodedPtxtCache_expand);
+  auto form = std::make_shared<const FatEncodedPtxt>(eptxt, s);
+  HELIB_NTIMER_STOP(EncodedPtxtCache_expand);
+  long rowBytes = eptxt.isBGV() ? eptxt.getBGV().getContext().getPhiM()
+                                : eptxt.getCKKS().getContext().getPhiM();
+  rowBytes *= sizeof(long);
+
+  // The dropped forms not in use are destroyed after the lock is released
+  std::vector<Entry> dropped;
+  std::lock_guard<std::mutex> guard(mutex);
+  // Another thread may have made one in the meantime
+  if (const Entry* entry = find(s))
+    return entry->form;
+
+  entries.push_front(Entry{s, s.card() * rowBytes, form});
+  nBytes += entries.front().bytes;
+  while (nBytes > maxBytes && entries.size() > 1) {
+    nBytes -= entries.back().bytes;
+    dropped.push_back(std::move(entries.back()));
+    entries.pop_back();
+  }
+  return form;
+}
+
+long EncodedPtxtCache::size() const
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  return entries.size();
+}
+
+long EncodedPtxtCache::bytes() const
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  return nBytes;
+}
+
+long EncodedPtxtCache::hits() const
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  return nHits;
+}
+
+long EncodedPtxtCache::misses() const
+{
+  std::lock_guard<std::mutex> guard(mutex);
+  return nMisses;
+}
+
+void EncodedPtxtCache::clear()
+{
+  std::list<Entry> dropped;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    dropped.swap(entries);
+    nBytes = 0;
+  }
+  // the forms not in use are destroyed outside of the lock
+}
+
+} // namespace helib
@@ -12,8 +12,13 @@
 /* EncryptedArray.cpp - Data-movement operations on arrays of slots
  */
 #include <algorithm>
+#include <atomic>
+
+#include <NTL/BasicThreadPool.h>
+
 #include <helib/zzX.h>
 #include <helib/EncryptedArray.h>
+#include <helib/keys.h>
 #include <helib/timing.h>
 #include <helib/ClonedPtr.h>
 #include <helib/norms.h>
@@ -23,6 +28,12 @@
 
 namespace helib {
 
+unsigned long EncryptedArray::newId()
+{
+  static std::atomic<unsigned long> last{0};
+  return last.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
 EncryptedArrayBase* buildEncryptedArray(const Context& context,
                                         const PAlgebraMod& alMod,
                                         const NTL::ZZX& G)
@@ -101,29 +112,76 @@ void EncryptedArrayDerived<type>::rotate1D(Ctxt& ctxt,
   helib::assertTrue(maskTable[i].size() > 0,
                     "Found non-positive sized mask table entry");
 
-  ctxt.smartAutomorph(zMStar.genToPow(i, amt));
-  // ctxt = \rho_i^{amt}(originalCtxt)
-
-  Ctxt T(ctxt);
-  T.smartAutomorph(zMStar.genToPow(i, -ord));
-  // T = \rho_i^{amt-ord}(originalCtxt).
-  // This strategy is geared toward the
-  // assumption that we have the key switch matrix
-  // for \rho_i^{-ord}
+  long k1 = zMStar.genToPow(i, amt);
+  long k2 = zMStar.genToPow(i, amt - ord);
+  const PubKey& pubKey = ctxt.getPubKey();
+  long keyID = ctxt.getKeyID();
+  Ctxt T(ZeroCtxtLike, ctxt);
+  if (pubKey.haveKeySWmatrix(1, k1, keyID, keyID) &&
+      pubKey.haveKeySWmatrix(1, k2, keyID, keyID)) {
+    // Both automorphisms have matrices of their own (as the full 1D
+    // matrices of a bad dimension do), so they share one digit
+    // decomposition of the original ciphertext
+    std::vector<Ctxt> rotated;
+    ctxt.hoistedAutomorphs({k1, k2}, rotated);
+    ctxt = rotated[0];
+    T = rotated[1];
+  } else {
+    ctxt.smartAutomorph(k1);
+    // ctxt = \rho_i^{amt}(originalCtxt)
+
+    T = ctxt;
+    T.smartAutomorph(zMStar.genToPow(i, -ord));
+    // T = \rho_i^{amt-ord}(originalCtxt).
+    // This strategy is geared toward the
+    // assumption that we have the key switch matrix
+    // for \rho_i^{-ord}
+  }
 
-  const RX& mask = maskTable[i][amt];
-  zzX mask_poly = balanced_zzX(mask);
-  double sz = embeddingLargestCoeff(mask_poly, zMStar);
-  DoubleCRT m1(mask_poly, context, ctxt.getPrimeSet() | T.getPrimeSet());
   // m1 will be used to multiply both ctxt and T
+  std::shared_ptr<const RotationMask> m1 =
+      getRotationMask(i, amt, ctxt.getPrimeSet() | T.getPrimeSet());
 
   // Compute ctxt = ctxt*m1 + T - T*m1
-  ctxt.multByConstant(m1, sz);
+  ctxt.multByConstant(m1->mask, m1->size);
   ctxt += T;
-  T.multByConstant(m1, sz);
+  T.multByConstant(m1->mask, m1->size);
   ctxt -= T;
 }
 
+template <typename type>
+std::shared_ptr<const typename EncryptedArrayDerived<type>::RotationMask>
+EncryptedArrayDerived<type>::getRotationMask(long i,
+                                             long amt,
+                                             const IndexSet& s) const
+{
+  std::vector<long> key = {i, amt};
+  for (long j : s)
+    key.push_back(j);
+
+  {
+    std::lock_guard<std::mutex> lock(rotationMasksLock);
+    auto it = rotationMasks.find(key);
+    if (it != rotationMasks.end())
+      return it->second;
+  }
+
+  // Built outside the lock, a mask racing with another copy of itself is
+  // just dropped
+  RBak bak;
+  bak.save();
+  tab.restoreContext();
+  zzX mask_poly = balanced_zzX(tab.getMaskTable()[i][amt]);
+  double sz = embeddingLargestCoeff(mask_poly, getPAlgebra());
+  auto mask = std::make_shared<const RotationMask>(
+      RotationMask{DoubleCRT(mask_poly, context, s), sz});
+
+  std::lock_guard<std::mutex> lock(rotationMasksLock);
+  if (long(rotationMasks.size()) >= MAX_CACHED_ROTATION_MASKS)
+    return mask;
+  return rotationMasks.emplace(std::move(key), std::move(mask)).first->second;
+}
+
 // Shift k positions along the i'th dimension with zero fill.
 // Negative shift amount denotes shift in the opposite direction.
 template <typename type>
@@ -690,6 +748,69 @@ std::ostream& operator<<(std::ostream& os, const PtxtArray& pa)
   return os;
 }
 
+void encodeBatch(std::vector<EncodedPtxt>& eptxts,
+                 const std::vector<PtxtArray>& arrays,
+                 double mag,
+                 OptLong prec)
+{
+  HELIB_TIMER_START;
+  long n = arrays.size();
+  eptxts.resize(n);
+
+  // Every encoding selects the NTL moduli it needs (which are thread-local)
+  // and only reads the tables of its EncryptedArray
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i : range(first, last))
+    arrays[i].encode(eptxts[i], mag, prec);
+  NTL_EXEC_RANGE_END
+}
+
+void encodeBatch(std::vector<FatEncodedPtxt>& feptxts,
+                 const std::vector<PtxtArray>& arrays,
+                 const IndexSet& s,
+                 double mag,
+                 OptLong prec)
+{
+  HELIB_TIMER_START;
+  long n = arrays.size();
+  feptxts.resize(n);
+  if (n == 0)
+    return;
+
+  const Context& context = arrays[0].ea.getContext();
+  bool sameContext = true;
+  for (long i : range(n))
+    sameContext = sameContext && &arrays[i].ea.getContext() == &context;
+
+  if (context.isCKKS() || !sameContext) {
+    // The CKKS encodings are built straight in DoubleCRT form
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i : range(first, last))
+      arrays[i].encode(feptxts[i], s, mag, prec);
+    NTL_EXEC_RANGE_END
+    return;
+  }
+
+  // BGV: encode everything, then take all the polynomials to DoubleCRT form
+  // in one batch of transforms
+  std::vector<EncodedPtxt> eptxts;
+  encodeBatch(eptxts, arrays, mag, prec);
+
+  std::vector<zzX> polys(n);
+  std::vector<double> sizes(n);
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i : range(first, last)) {
+    polys[i] = eptxts[i].getBGV().getPoly();
+    sizes[i] = eptxts[i].getBGV().getSize();
+  }
+  NTL_EXEC_RANGE_END
+
+  std::vector<DoubleCRT> dcrts;
+  DoubleCRT::FFTBatch(dcrts, polys, context, s);
+  for (long i : range(n))
+    feptxts[i].resetBGV(dcrts[i], eptxts[i].getBGV().getPtxtSpace(), sizes[i]);
+}
+
 // Other functions...
 
 void runningSums(const EncryptedArray& ea, Ctxt& ctxt)
@@ -735,6 +856,305 @@ void totalSums(const EncryptedArray& ea, Ctxt& ctxt)
   }
 }
 
+namespace {
+
+// One step of sumOverDimension: add to ctxt its rotations by the shifts, or
+// those of the original ciphertext
+struct SumStep
+{
+  bool ofOrig;
+  std::vector<long> shifts;
+};
+
+// The steps that take ctxt to sum_{t<n} rho^t(ctxt), in base radix. While
+// ctxt holds sum_{t<e} rho^t(orig) (e starts at the leading digit of n), each
+// next digit b of n turns e into radix*e with the rotations by j*e (j <
+// radix) of ctxt, then into radix*e+b with those of orig. Rotating orig
+// rather than ctxt keeps the depth (and noise) low, as in totalSums above.
+std::vector<SumStep> planTotalSums(long n, long radix)
+{
+  std::vector<long> digits; // least significant first
+  for (long v = n; v > 0; v /= radix)
+    digits.push_back(v % radix);
+
+  std::vector<SumStep> steps;
+  long e = digits.back();
+  steps.push_back(SumStep{true, {}});
+  for (long t = 1; t < e; t++)
+    steps.back().shifts.push_back(t);
+  for (long i = lsize(digits) - 2; i >= 0; i--) {
+    steps.push_back(SumStep{false, {}});
+    for (long j = 1; j < radix; j++)
+      steps.back().shifts.push_back(j * e);
+    e *= radix;
+    steps.push_back(SumStep{true, {}});
+    for (long t = 0; t < digits[i]; t++)
+      steps.back().shifts.push_back(e + t);
+    e += digits[i];
+  }
+  return steps;
+}
+
+// The steps of runningSums in one dimension, in base radix: the window e of
+// the sums grows to radix*e with the shifts by j*e (j < radix) of ctxt
+std::vector<SumStep> planRunningSums(long n, long radix)
+{
+  std::vector<SumStep> steps;
+  for (long e = 1; e < n; e *= radix) {
+    steps.push_back(SumStep{false, {}});
+    for (long j = 1; j < radix && j * e < n; j++)
+      steps.back().shifts.push_back(j * e);
+  }
+  return steps;
+}
+
+// The largest radix up to fanOut whose plan only rotates by amounts with a
+// key-switching matrix in dimension d (all of them have one under the
+// HELIB_KSS_FULL strategy), or 2 (the doubling of the original methods) if
+// none does
+long sumsRadix(const EncryptedArray& ea,
+               const Ctxt& ctxt,
+               long d,
+               long fanOut,
+               std::vector<SumStep> (*plan)(long, long))
+{
+  const PubKey& pubKey = ctxt.getPubKey();
+  long n = ea.sizeOfDimension(d);
+  long radix = std::min(fanOut, n);
+  if (pubKey.getKSStrategy(d) == HELIB_KSS_FULL)
+    return radix;
+
+  long keyID = ctxt.getKeyID();
+  for (; radix > 2; radix--) {
+    bool haveKeys = true;
+    for (const SumStep& step : plan(n, radix))
+      for (long shift : step.shifts)
+        haveKeys = haveKeys &&
+                   pubKey.haveKeySWmatrix(1,
+                                          ea.getPAlgebra().genToPow(d, shift),
+                                          keyID,
+                                          keyID);
+    if (haveKeys)
+      break;
+  }
+  return radix;
+}
+
+// Add to sum the automorphisms X -> X^{g^shift} of the ciphertext of
+// precon, with g the generator of dimension d, evaluated in parallel
+void addRotations(Ctxt& sum,
+                  const BasicAutomorphPrecon& precon,
+                  const EncryptedArray& ea,
+                  long d,
+                  const std::vector<long>& shifts)
+{
+  std::vector<std::shared_ptr<Ctxt>> terms(shifts.size());
+  NTL_EXEC_RANGE(lsize(shifts), first, last)
+  for (long i = first; i < last; i++)
+    terms[i] = precon.automorph(ea.getPAlgebra().genToPow(d, shifts[i]));
+  NTL_EXEC_RANGE_END
+  for (const auto& term : terms)
+    sum += *term;
+}
+
+// ctxt = sum_{t<n} rho^t(ctxt), with rho the automorphism X -> X^g of the
+// generator g of dimension d and n its order. The automorphisms compose
+// exactly, so in a native dimension this is the sum along the dimension,
+// and in a bad one it is the sum only in the last coordinate (the others
+// having some of their terms wrap around).
+void sumOverDimension(const EncryptedArray& ea,
+                      Ctxt& ctxt,
+                      long d,
+                      long fanOut)
+{
+  long n = ea.sizeOfDimension(d);
+  long radix = sumsRadix(ea, ctxt, d, fanOut, planTotalSums);
+
+  BasicAutomorphPrecon orig(ctxt);
+  for (const SumStep& step : planTotalSums(n, radix)) {
+    if (step.shifts.empty())
+      continue;
+    if (step.ofOrig)
+      addRotations(ctxt, orig, ea, d, step.shifts);
+    else
+      addRotations(ctxt, BasicAutomorphPrecon(ctxt), ea, d, step.shifts);
+  }
+}
+
+} // namespace
+
+void totalSums(const EncryptedArray& ea, Ctxt& ctxt, long fanOut)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(fanOut >= 2, "totalSums: fanOut must be >= 2");
+
+  for (long d = 0; d < ea.dimension(); d++) {
+    long n = ea.sizeOfDimension(d);
+    if (n == 1)
+      continue;
+    sumOverDimension(ea, ctxt, d, fanOut);
+    if (ea.nativeDimension(d))
+      continue;
+
+    // Only the last coordinate has the sum. Keep it, and spread it with the
+    // same automorphisms: rho^{t+1-n} takes it to coordinate t without
+    // wrapping around, so that sum_{t<n} rho^t followed by rho^{1-n} fills
+    // the dimension.
+    std::vector<bool> last(ea.size());
+    for (long i = 0; i < ea.size(); i++)
+      last[i] = (ea.coordinate(d, i) == n - 1);
+    EncodedPtxt mask;
+    ea.encode(mask, last);
+    ctxt.multByConstant(mask);
+    sumOverDimension(ea, ctxt, d, fanOut);
+    ctxt.smartAutomorph(ea.getPAlgebra().genToPow(d, 1 - n));
+  }
+}
+
+void runningSums(const EncryptedArray& ea, Ctxt& ctxt, long fanOut)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(fanOut >= 2,
+                              "runningSums: fanOut must be >= 2");
+  long n = ea.size();
+  if (n == 1)
+    return;
+
+  if (ea.dimension() != 1) {
+    // The shifts cross the dimensions, each is a rotation in every one of
+    // them and masks. The shifts of a step are done in parallel.
+    for (long e = 1; e < n; e *= fanOut) {
+      long count = std::min(fanOut, (n + e - 1) / e) - 1;
+      std::vector<Ctxt> shifted(count, ctxt);
+      NTL_EXEC_RANGE(count, first, last)
+      for (long j = first; j < last; j++)
+        ea.shift(shifted[j], (j + 1) * e);
+      NTL_EXEC_RANGE_END
+      for (const Ctxt& term : shifted)
+        ctxt += term;
+    }
+    return;
+  }
+
+  // In one dimension, a shift by s is the "don't care" rotation by s with
+  // the first s slots masked out, even in a bad dimension (what wraps
+  // around is masked). The rotations of a step are hoisted.
+  long radix = sumsRadix(ea, ctxt, 0, fanOut, planRunningSums);
+  for (const SumStep& step : planRunningSums(n, radix)) {
+    long count = lsize(step.shifts);
+    std::vector<long> ks(count);
+    for (long j = 0; j < count; j++)
+      ks[j] = ea.getPAlgebra().genToPow(0, step.shifts[j]);
+    std::vector<Ctxt> shifted;
+    ctxt.hoistedAutomorphs(ks, shifted);
+
+    NTL_EXEC_RANGE(count, first, last)
+    for (long j = first; j < last; j++) {
+      long shamt = step.shifts[j];
+      std::vector<bool> keep(n);
+      for (long i = 0; i < n; i++)
+        keep[i] = (ea.coordinate(0, i) >= shamt);
+      EncodedPtxt mask;
+      ea.encode(mask, keep);
+      shifted[j].multByConstant(mask);
+    }
+    NTL_EXEC_RANGE_END
+    for (const Ctxt& term : shifted)
+      ctxt += term;
+  }
+}
+
+void shiftedCopies(const EncryptedArray& ea,
+                   std::vector<Ctxt>& out,
+                   const Ctxt& ctxt,
+                   const std::vector<long>& shifts)
+{
+  long count = lsize(shifts);
+  if (ea.dimension() == 1) {
+    std::vector<long> ks;
+    std::vector<long> where;
+    for (long t = 0; t < count; t++)
+      if (shifts[t] != 0) {
+        ks.push_back(ea.getPAlgebra().genToPow(0, -shifts[t]));
+        where.push_back(t);
+      }
+    std::vector<Ctxt> rotated;
+    if (!ks.empty())
+      ctxt.hoistedAutomorphs(ks, rotated);
+
+    out.assign(count, ctxt);
+    for (long i : range(lsize(where)))
+      out[where[i]] = std::move(rotated[i]);
+    return;
+  }
+
+  out.assign(count, ctxt);
+  NTL_EXEC_RANGE(count, first, last)
+  for (long t = first; t < last; t++)
+    ea.rotate(out[t], -shifts[t]);
+  NTL_EXEC_RANGE_END
+}
+
+void packSlots(const EncryptedArray& ea,
+               Ctxt& packed,
+               const std::vector<Ctxt>& ctxts,
+               long width)
+{
+  HELIB_TIMER_START;
+  long count = lsize(ctxts);
+  assertTrue<InvalidArgument>(count > 0, "packSlots: no ciphertexts");
+  assertTrue<InvalidArgument>(width > 0 && count * width <= ea.size(),
+                              "packSlots: the slots do not fit");
+
+  // Keep the first width slots, which then rotate into place without
+  // wrapping around
+  std::vector<bool> keep(ea.size());
+  for (long j = 0; j < width; j++)
+    keep[j] = true;
+  EncodedPtxt mask;
+  ea.encode(mask, keep);
+
+  std::vector<Ctxt> terms(ctxts);
+  NTL_EXEC_RANGE(count, first, last)
+  for (long i = first; i < last; i++) {
+    terms[i].multByConstant(mask);
+    if (i > 0)
+      ea.rotate(terms[i], i * width);
+  }
+  NTL_EXEC_RANGE_END
+
+  packed = terms[0];
+  for (long i = 1; i < count; i++)
+    packed += terms[i];
+}
+
+void unpackSlots(const EncryptedArray& ea,
+                 std::vector<Ctxt>& ctxts,
+                 const Ctxt& packed,
+                 long count,
+                 long width)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(count > 0, "unpackSlots: no ciphertexts");
+  assertTrue<InvalidArgument>(width > 0 && count * width <= ea.size(),
+                              "unpackSlots: the slots do not fit");
+
+  std::vector<bool> keep(ea.size());
+  for (long j = 0; j < width; j++)
+    keep[j] = true;
+  EncodedPtxt mask;
+  ea.encode(mask, keep);
+
+  ctxts.assign(count, packed);
+  NTL_EXEC_RANGE(count, first, last)
+  for (long i = first; i < last; i++) {
+    if (i > 0)
+      ea.rotate(ctxts[i], -i * width);
+    ctxts[i].multByConstant(mask);
+  }
+  NTL_EXEC_RANGE_END
+}
+
 // Linearized polynomials.
 // L describes a linear map M by describing its action on the standard
 // power basis: M(x^j mod G) = (L[j] mod G), for j = 0..d-1.
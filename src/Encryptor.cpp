@@ -0,0 +1,156 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* Encryptor.cpp - public-key encryption into reused storage
+ */
+#include <cmath>
+
+#include <helib/Encryptor.h>
+#include <helib/EncryptedArray.h>
+#include <helib/keys.h>
+#include <helib/sample.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+Encryptor::Encryptor(const PubKey& _pubKey) :
+    pubKey(_pubKey),
+    context(_pubKey.getContext()),
+    stdev(NTL::to_double(context.getStdev())),
+    r(context, _pubKey.pubEncrKey.getPrimeSet()),
+    e(context, _pubKey.pubEncrKey.getPrimeSet()),
+    m(context, _pubKey.pubEncrKey.getPrimeSet())
+{
+  // As in PubKey::encryptZero
+  if (context.getZMStar().getPow2() == 0) // not power of two
+    stdev *= std::sqrt(context.getM());
+}
+
+void Encryptor::encrypt(Ctxt& ctxt, const EncodedPtxt& eptxt)
+{
+  if (eptxt.isBGV())
+    encryptBGV(ctxt, eptxt.getBGV());
+  else if (eptxt.isCKKS())
+    encryptCKKS(ctxt, eptxt.getCKKS());
+  else
+    throw LogicError("Encryptor: bad EncodedPtxt");
+}
+
+void Encryptor::encrypt(Ctxt& ctxt,
+                        const PtxtArray& ptxt,
+                        double mag,
+                        OptLong prec)
+{
+  if (ptxt.ea.isCKKS() && mag < 0)
+    mag = NextPow2(Norm(ptxt.pa.getData<PA_cx>()));
+  ptxt.encode(encoded, mag, prec);
+  encrypt(ctxt, encoded);
+}
+
+void Encryptor::encryptZero(Ctxt& ctxt, long ptxtSpace)
+{
+  // Assigned part by part: a ciphertext over the same primes keeps its rows
+  ctxt = pubKey.pubEncrKey;
+  ctxt.noiseBound = 0;
+
+  // The same samples, in the same order, as PubKey::encryptZero
+  double r_bound = sampleSmallBounded(sample, context);
+  r = sample;
+  ctxt.noiseBound += r_bound * pubKey.pubEncrKey.noiseBound;
+
+  for (std::size_t i = 0; i < ctxt.parts.size(); i++) {
+    CtxtPart& part = ctxt.parts[i];
+    part *= r;
+
+    NTL::xdouble e_bound = sampleGaussianBounded(sample, context, stdev);
+    e = sample;
+    if (ptxtSpace > 1) {
+      e *= ptxtSpace;
+      e_bound *= ptxtSpace;
+    }
+    if (i == 1)
+      e_bound *= pubKey.getSKeyBound(part.skHandle.getSecretKeyID());
+
+    part += e;
+    ctxt.noiseBound += e_bound;
+  }
+}
+
+void Encryptor::encryptBGV(Ctxt& ctxt, const EncodedPtxt_BGV& eptxt)
+{
+  HELIB_TIMER_START;
+  assertTrue(!pubKey.isCKKS(), "Encryptor: mismatched BGV ptxt / CKKS ctxt");
+  assertEq(&pubKey, &ctxt.getPubKey(), "Encryptor: public key mismatch");
+  assertEq(&context, &eptxt.getContext(), "Encryptor: context mismatch");
+
+  long ptxtSpace = eptxt.getPtxtSpace();
+  long keySpace = pubKey.pubEncrKey.ptxtSpace;
+  if (ptxtSpace != keySpace) { // plaintext-space mismatch
+    ptxtSpace = NTL::GCD(ptxtSpace, keySpace);
+    if (ptxtSpace <= 1)
+      throw RuntimeError("Plaintext-space mismatch on encryption");
+  }
+  if (ptxtSpace != lastPtxtSpace) {
+    lastQmodP = rem(context.productOfPrimes(pubKey.pubEncrKey.getPrimeSet()),
+                    ptxtSpace);
+    lastPtxtSpace = ptxtSpace;
+  }
+
+  encryptZero(ctxt, ptxtSpace);
+
+  // add in the plaintext, balanced mod ptxtSpace as in PubKey::Encrypt
+  balanced_MulMod(poly, eptxt.getPoly(), lastQmodP, ptxtSpace);
+  m = poly;
+  ctxt.parts[0] += m;
+  ctxt.noiseBound += context.noiseBoundForMod(ptxtSpace, context.getPhiM());
+
+  ctxt.ptxtSpace = ptxtSpace;
+  ctxt.intFactor = 1;
+  ctxt.ratFactor = ctxt.ptxtMag = 1.0;
+}
+
+void Encryptor::encryptCKKS(Ctxt& ctxt, const EncodedPtxt_CKKS& eptxt)
+{
+  HELIB_TIMER_START;
+  assertTrue(pubKey.isCKKS(), "Encryptor: mismatched CKKS ptxt / BGV ctxt");
+  assertEq(&pubKey, &ctxt.getPubKey(), "Encryptor: public key mismatch");
+  assertEq(&context, &eptxt.getContext(), "Encryptor: context mismatch");
+
+  double mag = eptxt.getMag();
+  double scale = eptxt.getScale();
+  double err = eptxt.getErr();
+  assertTrue(mag > 0, "CKKS encryption: mag <= 0");
+  assertTrue(scale > 0, "CKKS encryption: scale <= 0");
+  assertTrue(err > 0, "CKKS encryption: err <= 0");
+
+  encryptZero(ctxt, 1);
+  NTL::xdouble error_bound = ctxt.noiseBound;
+
+  // The extra scaling factor of PubKey::Encrypt, applied mod the primes
+  long ef = NTL::conv<long>(ceil(error_bound / err));
+  m = eptxt.getPoly();
+  if (ef > 1) {
+    m *= ef;
+    scale *= ef;
+    err *= ef;
+  }
+  ctxt.parts[0] += m;
+
+  ctxt.ptxtMag = mag;
+  ctxt.ratFactor = scale;
+  ctxt.noiseBound = error_bound + err;
+  ctxt.ptxtSpace = 1;
+  ctxt.intFactor = 1;
+}
+
+} // namespace helib
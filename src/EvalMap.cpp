@@ -12,9 +12,12 @@
 #include <helib/EvalMap.h>
 #include <helib/apiAttributes.h>
 
+#include "binio.h"
+
 // needed to get NTL's TraceMap functions...needed for ThinEvalMap
 #include <NTL/lzz_pXFactoring.h>
 #include <NTL/GF2XFactoring.h>
+#include <NTL/BasicThreadPool.h>
 
 namespace helib {
 
@@ -167,6 +170,13 @@ void EvalMap::upgrade()
     matvec[i]->upgrade();
 }
 
+void EvalMap::upgrade(const IndexSet& s)
+{
+  mat1->upgrade(s);
+  for (long i = 0; i < matvec.length(); i++)
+    matvec[i]->upgrade(s);
+}
+
 // Applying the evaluation (or its inverse) map to a ciphertext
 void EvalMap::apply(Ctxt& ctxt) const
 {
@@ -183,6 +193,21 @@ void EvalMap::apply(Ctxt& ctxt) const
   }
 }
 
+void EvalMap::apply(std::vector<Ctxt>& ctxts) const
+{
+  if (!invert) { // forward direction
+    mat1->mul(ctxts);
+
+    for (long i = matvec.length() - 1; i >= 0; i--)
+      matvec[i]->mul(ctxts);
+  } else { // inverse transformation
+    for (long i = 0; i < matvec.length(); i++)
+      matvec[i]->mul(ctxts);
+
+    mat1->mul(ctxts);
+  }
+}
+
 static void init_representatives(NTL::Vec<long>& representatives,
                                  long dim,
                                  const NTL::Vec<long>& mvec,
@@ -645,6 +670,13 @@ void ThinEvalMap::upgrade()
       matvec[i]->upgrade();
 }
 
+void ThinEvalMap::upgrade(const IndexSet& s)
+{
+  for (long i = 0; i < matvec.length(); i++)
+    if (matvec[i])
+      matvec[i]->upgrade(s);
+}
+
 // Applying the evaluation (or its inverse) map to a ciphertext
 void ThinEvalMap::apply(Ctxt& ctxt) const
 {
@@ -659,6 +691,23 @@ void ThinEvalMap::apply(Ctxt& ctxt) const
   }
 }
 
+void ThinEvalMap::apply(std::vector<Ctxt>& ctxts) const
+{
+  if (!invert) { // forward direction
+    for (long i = matvec.length() - 1; i >= 0; i--)
+      if (matvec[i])
+        matvec[i]->mul(ctxts);
+  } else { // inverse transformation
+    for (long i = 0; i < matvec.length(); i++)
+      matvec[i]->mul(ctxts);
+
+    NTL_EXEC_RANGE(lsize(ctxts), first, last)
+    for (long i = first; i < last; i++)
+      traceMap(ctxts[i]);
+    NTL_EXEC_RANGE_END
+  }
+}
+
 // The callback interface for the matrix-multiplication routines.
 
 //! \cond FALSE (make doxygen ignore these classes)
@@ -915,4 +964,82 @@ static MatMul1D* buildThinStep1Matrix(const EncryptedArray& ea,
 }
 //! \endcond
 
+//===================================
+// Binary IO of the maps
+
+static void readEvalMapBegin(std::istream& str, bool invert)
+{
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::EVALMAP_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find pre-evalmap eye catcher");
+  assertEq<IOError>(read_raw_int(str) != 0,
+                    invert,
+                    "EvalMap: written for the other direction");
+}
+
+static void readEvalMapEnd(std::istream& str)
+{
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::EVALMAP_END);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-evalmap eye catcher");
+}
+
+void EvalMap::writeTo(std::ostream& str) const
+{
+  writeEyeCatcher(str, EyeCatcher::EVALMAP_BEGIN);
+  write_raw_int(str, invert);
+  write_raw_int(str, nfactors);
+  mat1->writeTo(str);
+  for (long i = 0; i < matvec.length(); i++)
+    matvec[i]->writeTo(str);
+  writeEyeCatcher(str, EyeCatcher::EVALMAP_END);
+}
+
+std::unique_ptr<EvalMap> EvalMap::readFrom(std::istream& str,
+                                           const EncryptedArray& ea,
+                                           bool invert)
+{
+  readEvalMapBegin(str, invert);
+  std::unique_ptr<EvalMap> ret(new EvalMap(ea, invert));
+  ret->nfactors = read_raw_int(str);
+  assertTrue<IOError>(ret->nfactors > 0, "EvalMap: bad number of factors");
+  ret->mat1.reset(
+      new BlockMatMul1DExec(BlockMatMul1DExec::readFrom(str, ea)));
+  ret->matvec.SetLength(ret->nfactors - 1);
+  for (long i = 0; i < ret->matvec.length(); i++)
+    ret->matvec[i].reset(new MatMul1DExec(MatMul1DExec::readFrom(str, ea)));
+  readEvalMapEnd(str);
+  return ret;
+}
+
+void ThinEvalMap::writeTo(std::ostream& str) const
+{
+  writeEyeCatcher(str, EyeCatcher::EVALMAP_BEGIN);
+  write_raw_int(str, invert);
+  write_raw_int(str, nfactors);
+  // Some of the matrices may be missing
+  for (long i = 0; i < matvec.length(); i++) {
+    write_raw_int(str, bool(matvec[i]));
+    if (matvec[i])
+      matvec[i]->writeTo(str);
+  }
+  writeEyeCatcher(str, EyeCatcher::EVALMAP_END);
+}
+
+std::unique_ptr<ThinEvalMap> ThinEvalMap::readFrom(std::istream& str,
+                                                   const EncryptedArray& ea,
+                                                   bool invert)
+{
+  readEvalMapBegin(str, invert);
+  std::unique_ptr<ThinEvalMap> ret(new ThinEvalMap(ea, invert));
+  ret->nfactors = read_raw_int(str);
+  assertTrue<IOError>(ret->nfactors > 0, "ThinEvalMap: bad number of factors");
+  ret->matvec.SetLength(ret->nfactors);
+  for (long i = 0; i < ret->matvec.length(); i++)
+    if (read_raw_int(str))
+      ret->matvec[i].reset(new MatMul1DExec(MatMul1DExec::readFrom(str, ea)));
+  readEvalMapEnd(str);
+  return ret;
+}
+
 } // namespace helib
@@ -0,0 +1,259 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* FlatDoubleCRT.cpp - contiguous storage for double-CRT residues
+ */
+#include <cstring>
+
+#include <helib/FlatDoubleCRT.h>
+#include <helib/Context.h>
+#include <helib/timing.h>
+#include <helib/costEstimate.h>
+#include <helib/exceptions.h>
+
+#include "simdKernels.h"
+
+namespace helib {
+
+// Build the dense prime->row table and (re)allocate a zeroed buffer
+void FlatDoubleCRT::allocate()
+{
+  row.assign(context->numPrimes(), -1);
+  long r = 0;
+  for (long i : primes)
+    row[i] = r++;
+
+  long perLine = ALIGNMENT / sizeof(long);
+  stride = ((phim + perLine - 1) / perLine) * perLine;
+
+  // The buffer comes zeroed, and aligned to a page or to a cache line
+  buf = HugePageBuffer(); // free the old buffer first
+  buf = HugePageBuffer(r * stride * sizeof(long), category);
+}
+
+FlatDoubleCRT::FlatDoubleCRT(const Context& _context, const IndexSet& s) :
+    context(&_context),
+    primes(s),
+    phim(_context.getPhiM()),
+    stride(0),
+    category(MemoryScope::current())
+{
+  assertTrue(s.last() < context->numPrimes(),
+             "FlatDoubleCRT: index set outside the modulus chain");
+  allocate();
+}
+
+FlatDoubleCRT::FlatDoubleCRT(const DoubleCRT& d) :
+    context(&d.getContext()),
+    primes(d.getIndexSet()),
+    phim(d.getContext().getPhiM()),
+    stride(0),
+    category(d.getMemoryCategory())
+{
+  allocate();
+  *this = d;
+}
+
+FlatDoubleCRT::FlatDoubleCRT(const FlatDoubleCRT& other) :
+    context(other.context),
+    primes(other.primes),
+    row(other.row),
+    phim(other.phim),
+    stride(other.stride),
+    category(other.category),
+    buf(other.buf.size(), category)
+{
+  if (buf.size() > 0)
+    std::memcpy(buf.data(), other.buf.data(), buf.size());
+}
+
+FlatDoubleCRT& FlatDoubleCRT::operator=(const FlatDoubleCRT& other)
+{
+  if (this == &other)
+    return *this;
+
+  if (context != other.context || primes != other.primes) {
+    context = other.context;
+    primes = other.primes;
+    phim = other.phim;
+    allocate();
+  }
+  long total = primes.card() * stride;
+  if (total > 0)
+    std::memcpy(elts(), other.elts(), total * sizeof(long));
+  return *this;
+}
+
+FlatDoubleCRT& FlatDoubleCRT::operator=(const DoubleCRT& d)
+{
+  HELIB_TIMER_START;
+
+  if (context != &d.getContext() || primes != d.getIndexSet()) {
+    context = &d.getContext();
+    primes = d.getIndexSet();
+    phim = context->getPhiM();
+    allocate();
+  }
+
+  if (isDryRun())
+    return *this;
+
+  const IndexMap<NTL::vec_long>& map = d.getMap();
+  for (long i : primes)
+    std::memcpy(elts() + row[i] * stride,
+                map[i].elts(),
+                phim * sizeof(long));
+  return *this;
+}
+
+void FlatDoubleCRT::toDoubleCRT(DoubleCRT& d) const
+{
+  HELIB_TIMER_START;
+
+  if (&d.context != context)
+    throw RuntimeError("FlatDoubleCRT::toDoubleCRT: incompatible objects");
+
+  if (d.getIndexSet() != primes) {
+    d.map.clear();
+    d.map.insert(primes);
+  }
+
+  if (isDryRun())
+    return;
+
+  for (long i : primes)
+    std::memcpy(d.map[i].elts(),
+                elts() + row[i] * stride,
+                phim * sizeof(long));
+}
+
+DoubleCRT FlatDoubleCRT::toDoubleCRT() const
+{
+  DoubleCRT d(*context, primes);
+  toDoubleCRT(d);
+  return d;
+}
+
+FlatDoubleCRT& FlatDoubleCRT::setZero()
+{
+  long total = primes.card() * stride;
+  if (total > 0)
+    std::memset(elts(), 0, total * sizeof(long));
+  return *this;
+}
+
+namespace {
+
+struct FlatAddFun
+{
+  void apply(long* dst, const long* src, long n, long q, NTL::mulmod_t) const
+  {
+    simd::EltwiseAddMod(dst, dst, src, n, q);
+  }
+};
+
+struct FlatSubFun
+{
+  void apply(long* dst, const long* src, long n, long q, NTL::mulmod_t) const
+  {
+    simd::EltwiseSubMod(dst, dst, src, n, q);
+  }
+};
+
+struct FlatMulFun
+{
+  void apply(long* dst,
+             const long* src,
+             long n,
+             long q,
+             NTL::mulmod_t qinv) const
+  {
+    simd::EltwiseMultMod(dst, dst, src, n, q, qinv);
+  }
+};
+
+} // namespace
+
+// Generic element-wise operation. Since both buffers share the same layout,
+// the loop walks the rows in lockstep without any lookup.
+template <typename Fun>
+FlatDoubleCRT& FlatDoubleCRT::Op(const FlatDoubleCRT& other, Fun fun)
+{
+  if (isDryRun()) {
+    chargeDryRunRows(0, primes.card(), 0);
+    return *this;
+  }
+
+  if (context != other.context)
+    throw RuntimeError("FlatDoubleCRT::Op: incompatible objects");
+  if (primes != other.primes)
+    throw RuntimeError("FlatDoubleCRT::Op: index sets differ");
+
+  long r = 0;
+  for (long i : primes) {
+    const Cmodulus& mod = context->ithModulus(i);
+    long q = mod.getQ();
+    NTL::mulmod_t qinv = mod.getQInv();
+    fun.apply(elts() + r * stride,
+              other.elts() + r * stride,
+              phim,
+              q,
+              qinv);
+    r++;
+  }
+  return *this;
+}
+
+FlatDoubleCRT& FlatDoubleCRT::operator+=(const FlatDoubleCRT& other)
+{
+  return Op(other, FlatAddFun());
+}
+
+FlatDoubleCRT& FlatDoubleCRT::operator-=(const FlatDoubleCRT& other)
+{
+  return Op(other, FlatSubFun());
+}
+
+FlatDoubleCRT& FlatDoubleCRT::operator*=(const FlatDoubleCRT& other)
+{
+  return Op(other, FlatMulFun());
+}
+
+FlatDoubleCRT& FlatDoubleCRT::addMul(const FlatDoubleCRT& a,
+                                     const FlatDoubleCRT& b)
+{
+  if (isDryRun()) {
+    chargeDryRunRows(0, primes.card(), 0);
+    return *this;
+  }
+
+  if (context != a.context || context != b.context)
+    throw RuntimeError("FlatDoubleCRT::addMul: incompatible objects");
+  if (primes != a.primes || primes != b.primes)
+    throw RuntimeError("FlatDoubleCRT::addMul: index sets differ");
+
+  long r = 0;
+  for (long i : primes) {
+    const Cmodulus& mod = context->ithModulus(i);
+    long q = mod.getQ();
+    NTL::mulmod_t qinv = mod.getQInv();
+    long* dst = elts() + r * stride;
+    const long* pa = a.elts() + r * stride;
+    const long* pb = b.elts() + r * stride;
+    for (long j = 0; j < phim; j++)
+      dst[j] = NTL::AddMod(dst[j], NTL::MulMod(pa[j], pb[j], q, qinv), q);
+    r++;
+  }
+  return *this;
+}
+
+} // namespace helib
@@ -10,6 +10,9 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 
+#include <algorithm>
+#include <utility>
+
 #include <helib/IndexSet.h>
 #include "binio.h"
 #include "io.h"
@@ -22,6 +25,55 @@ const IndexSet& IndexSet::emptySet()
   return empty;
 }
 
+namespace {
+
+inline long popcount(unsigned long long w) { return __builtin_popcountll(w); }
+
+// The lowest and highest set bits of a non-zero word
+inline long lowBit(unsigned long long w) { return __builtin_ctzll(w); }
+inline long highBit(unsigned long long w) { return 63 - __builtin_clzll(w); }
+
+// The bits j%64 and above of a word, and those up to j%64
+inline unsigned long long bitsFrom(long j) { return ~0ULL << (j & 63); }
+inline unsigned long long bitsUpTo(long j)
+{
+  return ~0ULL >> (63 - (j & 63));
+}
+
+} // namespace
+
+void IndexSet::reserveWords(long n)
+{
+  if (n <= numWords())
+    return;
+  if (heapRep.empty()) {
+    heapRep.assign(n, 0);
+    for (long w = 0; w < inlineWords; w++) {
+      heapRep[w] = inlineRep[w];
+      inlineRep[w] = 0;
+    }
+  } else {
+    heapRep.resize(n, 0);
+  }
+}
+
+void IndexSet::recount()
+{
+  const Word* rep = words();
+  long n = numWords();
+  _card = 0;
+  _first = 0;
+  _last = -1;
+  for (long w = 0; w < n; w++) {
+    if (rep[w] == 0)
+      continue;
+    if (_card == 0)
+      _first = w * wordBits + lowBit(rep[w]);
+    _last = w * wordBits + highBit(rep[w]);
+    _card += popcount(rep[w]);
+  }
+}
+
 // constructs an interval, low to high
 void IndexSet::intervalConstructor(long low, long high)
 {
@@ -34,11 +86,14 @@ void IndexSet::intervalConstructor(long low, long high)
     _last = -1;
     _card = 0;
   } else {
-    rep.resize(high + 1);
-    for (long i = 0; i < low; i++)
-      rep[i] = false;
-    for (long i = low; i <= high; i++)
-      rep[i] = true;
+    reserveWords(high / wordBits + 1);
+    Word* rep = words();
+    long lowWord = low / wordBits;
+    long highWord = high / wordBits;
+    for (long w = lowWord; w <= highWord; w++)
+      rep[w] = ~0ULL;
+    rep[lowWord] &= bitsFrom(low);
+    rep[highWord] &= bitsUpTo(high);
 
     _first = low;
     _last = high;
@@ -55,9 +110,13 @@ long IndexSet::next(long j) const
   if (j < _first)
     return _first;
   j++;
-  while (rep[j] == false)
-    j++;
-  return j;
+  // j <= _last, so a set bit is found before the end of the words
+  const Word* rep = words();
+  long w = j / wordBits;
+  Word bits = rep[w] & bitsFrom(j);
+  while (bits == 0)
+    bits = rep[++w];
+  return w * wordBits + lowBit(bits);
 }
 
 long IndexSet::prev(long j) const
@@ -69,22 +128,32 @@ long IndexSet::prev(long j) const
   if (j <= _first)
     return j - 1;
   j--;
-  while (rep[j] == false)
-    j--;
-  return j;
+  const Word* rep = words();
+  long w = j / wordBits;
+  Word bits = rep[w] & bitsUpTo(j);
+  while (bits == 0)
+    bits = rep[--w];
+  return w * wordBits + highBit(bits);
 }
 
 bool IndexSet::contains(long j) const
 {
   if (j < _first || j > _last)
     return false;
-  return rep[j];
+  return (words()[j / wordBits] >> (j % wordBits)) & 1;
 }
 
 bool IndexSet::contains(const IndexSet& s) const
 {
-  for (long i = s.first(); i <= s.last(); i = s.next(i))
-    if (!contains(i))
+  if (s.card() == 0)
+    return true;
+  if (s.card() > card() || s.first() < first() || s.last() > last())
+    return false;
+
+  const Word* rep = words();
+  const Word* srep = s.words();
+  for (long w = s.first() / wordBits; w <= s.last() / wordBits; w++)
+    if ((srep[w] & ~rep[w]) != 0)
       return false;
   return true;
 }
@@ -95,8 +164,12 @@ bool IndexSet::disjointFrom(const IndexSet& s) const
   if (card() == 0 || s.card() == 0 || last() < s.first() || s.last() < first())
     return true;
 
-  for (long i = s.first(); i <= s.last(); i = s.next(i))
-    if (contains(i))
+  const Word* rep = words();
+  const Word* srep = s.words();
+  long from = std::max(first(), s.first()) / wordBits;
+  long to = std::min(last(), s.last()) / wordBits;
+  for (long w = from; w <= to; w++)
+    if ((rep[w] & srep[w]) != 0)
       return false;
   return true;
 }
@@ -111,16 +184,57 @@ bool IndexSet::operator==(const IndexSet& s) const
     return false;
   if (_last != s._last)
     return false;
+  if (_card == 0)
+    return true;
 
-  return equal(rep.begin() + _first,
-               rep.begin() + _last + 1,
-               s.rep.begin() + _first);
-  // NOTE: maybe vector<bool> optimizes this???
+  const Word* rep = words();
+  const Word* srep = s.words();
+  for (long w = _first / wordBits; w <= _last / wordBits; w++)
+    if (rep[w] != srep[w])
+      return false;
+  return true;
+}
+
+IndexSet::IndexSet(IndexSet&& other) noexcept :
+    heapRep(std::move(other.heapRep)),
+    _first(other._first),
+    _last(other._last),
+    _card(other._card)
+{
+  std::copy_n(other.inlineRep, inlineWords, inlineRep);
+  other.makeEmpty();
+}
+
+IndexSet& IndexSet::operator=(IndexSet&& other) noexcept
+{
+  if (this != &other) {
+    heapRep = std::move(other.heapRep);
+    std::copy_n(other.inlineRep, inlineWords, inlineRep);
+    _first = other._first;
+    _last = other._last;
+    _card = other._card;
+    other.makeEmpty();
+  }
+  return *this;
+}
+
+void IndexSet::makeEmpty() noexcept
+{
+  heapRep.clear();
+  std::fill_n(inlineRep, inlineWords, Word(0));
+  _first = 0;
+  _last = -1;
+  _card = 0;
 }
 
 void IndexSet::clear()
 {
-  rep.resize(0);
+  // Keep the storage, for the elements inserted next
+  if (_card != 0) {
+    Word* rep = words();
+    for (long w = _first / wordBits; w <= _last / wordBits; w++)
+      rep[w] = 0;
+  }
   _first = 0;
   _last = -1;
   _card = 0;
@@ -130,12 +244,9 @@ void IndexSet::insert(long j)
 {
   assertTrue<InvalidArgument>(j >= 0, "Cannot insert in negative index");
 
-  long oldSize = rep.size();
-  if (j >= oldSize) {
-    rep.resize(j + 1);
-    for (long i = oldSize; i <= j; i++)
-      rep[i] = false;
-  }
+  reserveWords(j / wordBits + 1);
+  Word& word = words()[j / wordBits];
+  Word bit = 1ULL << (j % wordBits);
 
   if (_card == 0) {
     _first = _last = j;
@@ -145,20 +256,18 @@ void IndexSet::insert(long j)
       _last = j;
     if (j < _first)
       _first = j;
-    if (rep[j] == false)
+    if ((word & bit) == 0)
       _card++;
   }
 
-  rep[j] = true;
+  word |= bit;
 }
 
 void IndexSet::remove(long j)
 {
   assertTrue<InvalidArgument>(j >= 0, "Cannot remove from negative index");
 
-  if (j >= (long)rep.size())
-    return;
-  if (rep[j] == false)
+  if (!contains(j))
     return;
 
   long newFirst = _first, newLast = _last;
@@ -176,7 +285,7 @@ void IndexSet::remove(long j)
   _first = newFirst;
   _last = newLast;
   _card--;
-  rep[j] = false;
+  words()[j / wordBits] &= ~(1ULL << (j % wordBits));
 }
 
 void IndexSet::insert(const IndexSet& s)
@@ -190,10 +299,15 @@ void IndexSet::insert(const IndexSet& s)
     return;
   }
 
-  for (long i = s.last(); i >= s.first(); i = s.prev(i))
-    insert(i);
-  // NOTE: traversal done from high to low so as to trigger at
-  // at most one resize
+  reserveWords(s.last() / wordBits + 1);
+  Word* rep = words();
+  const Word* srep = s.words();
+  for (long w = s.first() / wordBits; w <= s.last() / wordBits; w++) {
+    _card += popcount(srep[w] & ~rep[w]);
+    rep[w] |= srep[w];
+  }
+  _first = std::min(_first, s.first());
+  _last = std::max(_last, s.last());
 }
 
 void IndexSet::remove(const IndexSet& s)
@@ -202,31 +316,33 @@ void IndexSet::remove(const IndexSet& s)
     clear();
     return;
   }
-  if (s.card() == 0)
-    return;
-  if (card() == 0)
+  if (disjointFrom(s))
     return;
 
-  for (long i = s.first(); i <= s.last(); i = s.next(i))
-    remove(i);
-  // NOTE: traversal order should not matter here
+  Word* rep = words();
+  const Word* srep = s.words();
+  long from = std::max(first(), s.first()) / wordBits;
+  long to = std::min(last(), s.last()) / wordBits;
+  for (long w = from; w <= to; w++)
+    rep[w] &= ~srep[w];
+  recount();
 }
 
 void IndexSet::retain(const IndexSet& s)
 {
   if (this == &s)
     return;
-  if (s.card() == 0) {
+  if (card() == 0)
+    return;
+  if (disjointFrom(s)) {
     clear();
     return;
   }
-  if (card() == 0)
-    return;
 
-  for (long i = first(); i <= last(); i = next(i)) {
-    if (!s.contains(i))
-      remove(i);
-  }
+  Word* rep = words();
+  for (long w = _first / wordBits; w <= _last / wordBits; w++)
+    rep[w] &= s.wordAt(w);
+  recount();
 }
 
 // union
@@ -0,0 +1,106 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <helib/exceptions.h>
+#include <helib/keySwitching.h>
+#include <helib/timing.h>
+
+#include "binio.h"
+#include "LazyKeyStore.h"
+
+namespace helib {
+
+LazyKeyStore::LazyKeyStore(const Context& context,
+                           const std::string& path,
+                           long maxResident) :
+    context(context),
+    maxResident(maxResident),
+    file(path, std::ios::binary)
+{
+  assertTrue<IOError>(file.is_open(), "LazyKeyStore: cannot open " + path);
+}
+
+long LazyKeyStore::index(std::istream& str, KeySwitch& matrix, long& nCols)
+{
+  int indexed =
+      readEyeCatcher(str, EyeCatcher::SKM_BEGIN, EyeCatcher::SKI_BEGIN);
+  assertTrue<IOError>(indexed >= 0, "Could not find pre-secret key eyecatcher");
+
+  matrix.fromKey = SKHandle::readFrom(str);
+  matrix.toKeyID = read_raw_int(str);
+  matrix.ptxtSpace = read_raw_int(str);
+
+  // Note where the b_i's start, and move past them
+  offsets.push_back(str.tellg());
+  nCols = read_raw_int(str);
+  assertInRange<IOError>(nCols,
+                         0l,
+                         long(context.getDigits().size()),
+                         "LazyKeyStore: bad number of columns",
+                         /*right_inclusive=*/true);
+  for (long j = 0; j < nCols; j++) {
+    IndexSet s = IndexSet::readFrom(str);
+    assertTrue<IOError>(s <= context.allPrimes(),
+                        "LazyKeyStore: unknown primes");
+    for (long i = 0; i < s.card(); i++)
+      skip_ntl_vec_long(str);
+  }
+
+  read_raw_ZZ(str, matrix.prgSeed);
+  assertTrue<IOError>(matrix.hasIndexedSeed() == bool(indexed),
+                      "LazyKeyStore: seed does not match the format");
+  matrix.noiseBound = read_raw_xdouble(str);
+
+  bool eyeCatcherFound =
+      readEyeCatcher(str, indexed ? EyeCatcher::SKI_END : EyeCatcher::SKM_END);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-secret key eyecatcher");
+
+  resident.emplace_back();
+  lruPos.emplace_back(lru.end());
+  return offsets.size() - 1;
+}
+
+std::shared_ptr<const std::vector<DoubleCRT>> LazyKeyStore::load(long i) const
+{
+  MemoryScope memoryScope(MemoryCategory::KEYS);
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (resident[i] != nullptr) {
+    lru.splice(lru.begin(), lru, lruPos[i]);
+    return resident[i];
+  }
+
+  HELIB_TIMER_START;
+  file.clear();
+  file.seekg(offsets[i]);
+  resident[i] = std::make_shared<const std::vector<DoubleCRT>>(
+      read_raw_vector<DoubleCRT>(file, context));
+  assertTrue<IOError>(bool(file), "LazyKeyStore: cannot read matrix");
+  lru.push_front(i);
+  lruPos[i] = lru.begin();
+
+  if (maxResident > 0 && long(lru.size()) > maxResident) {
+    long victim = lru.back();
+    lru.pop_back();
+    resident[victim].reset();
+    lruPos[victim] = lru.end();
+  }
+  return resident[i];
+}
+
+bool LazyKeyStore::isResident(long i) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return resident[i] != nullptr;
+}
+
+} // namespace helib
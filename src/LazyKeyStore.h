@@ -0,0 +1,83 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_LAZYKEYSTORE_H
+#define HELIB_LAZYKEYSTORE_H
+/**
+ * @file LazyKeyStore.h
+ * @brief Key-switching matrices that are read from a key file on first use
+ **/
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <helib/DoubleCRT.h>
+
+namespace helib {
+
+class KeySwitch;
+
+/**
+ * @class LazyKeyStore
+ * @brief The top rows (the b_i's) of the key-switching matrices of a
+ * `PubKey` file written by PubKey::writeTo, read in when they are used.
+ *
+ * The store keeps the offset of every matrix in the file. At most
+ * maxResident matrices are kept in memory (if maxResident > 0), evicting
+ * the least recently used one. Evicted rows stay alive for as long as a key
+ * switch that uses them holds on to them. All methods are thread-safe.
+ **/
+class LazyKeyStore
+{
+public:
+  LazyKeyStore(const Context& context,
+               const std::string& path,
+               long maxResident);
+
+  LazyKeyStore(const LazyKeyStore&) = delete;
+  LazyKeyStore& operator=(const LazyKeyStore&) = delete;
+
+  /**
+   * @brief Read one KeySwitch from str, in the format of KeySwitch::writeTo,
+   * moving past its b_i's instead of reading them. The b_i's are registered
+   * with the store, and the index of the matrix in the store is returned.
+   * @param str The key file, positioned at the matrix.
+   * @param matrix The matrix to fill, except for its b_i's.
+   * @param nCols Set to the number of b_i's.
+   **/
+  long index(std::istream& str, KeySwitch& matrix, long& nCols);
+
+  //! @brief The b_i's of matrix number i, read in if they are not resident
+  std::shared_ptr<const std::vector<DoubleCRT>> load(long i) const;
+
+  //! @brief Are the b_i's of matrix number i in memory?
+  bool isResident(long i) const;
+
+private:
+  const Context& context;
+  const long maxResident;
+
+  std::vector<std::streamoff> offsets; // where the b_i's of each matrix are
+
+  mutable std::mutex mutex; // guards the members below
+  mutable std::ifstream file;
+  mutable std::vector<std::shared_ptr<const std::vector<DoubleCRT>>> resident;
+  mutable std::list<long> lru; // the resident matrices, most recent first
+  mutable std::vector<std::list<long>::iterator> lruPos;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_LAZYKEYSTORE_H
@@ -0,0 +1,257 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <cerrno>
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <helib/exceptions.h>
+#include <helib/Context.h>
+
+#include "MappedKeys.h"
+
+namespace helib {
+
+static int openReadOnly(const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw IOError("MappedFile: cannot open " + path + ": " +
+                  std::strerror(errno));
+  return fd;
+}
+
+MappedFile::MappedFile(const std::string& path) :
+    MappedFile(openReadOnly(path), path)
+{}
+
+MappedFile::MappedFile(int fd, const std::string& what)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int err = errno;
+    close(fd);
+    throw IOError("MappedFile: cannot stat " + what + ": " +
+                  std::strerror(err));
+  }
+  length = st.st_size;
+
+  void* addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  int err = errno;
+  close(fd); // the mapping stays valid
+  if (addr == MAP_FAILED)
+    throw IOError("MappedFile: cannot map " + what + ": " +
+                  std::strerror(err));
+  base = static_cast<const unsigned char*>(addr);
+}
+
+std::shared_ptr<const MappedFile> MappedFile::openShared(
+    const std::string& name)
+{
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    throw IOError("MappedFile: cannot open shared memory " + name + ": " +
+                  std::strerror(errno));
+
+  // The flag is set after everything else was written, so the size is final
+  // once it is seen
+  std::uint32_t ready = 0;
+  ssize_t n = pread(fd, &ready, sizeof(ready), MappedKeyLayout::READY_OFFSET);
+  if (n != ssize_t(sizeof(ready)) || ready != MappedKeyLayout::READY) {
+    close(fd);
+    throw IOError("MappedFile: shared memory " + name +
+                  " is still being written");
+  }
+  return std::shared_ptr<const MappedFile>(
+      new MappedFile(fd, "shared memory " + name));
+}
+
+namespace {
+
+// A streambuf writing through a buffer to a file descriptor
+class FdOutBuf : public std::streambuf
+{
+public:
+  explicit FdOutBuf(int fd) : fd(fd), buffer(1L << 20)
+  {
+    setp(buffer.data(), buffer.data() + buffer.size());
+  }
+
+  //! Write out the buffer, false on error (see errno)
+  bool flush()
+  {
+    const char* p = pbase();
+    while (ok && p < pptr()) {
+      ssize_t n = write(fd, p, pptr() - p);
+      if (n < 0 && errno == EINTR)
+        continue;
+      ok = n > 0;
+      if (ok)
+        p += n;
+    }
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return ok;
+  }
+
+protected:
+  int_type overflow(int_type c) override
+  {
+    if (!flush())
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+      sputc(traits_type::to_char_type(c));
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override { return flush() ? 0 : -1; }
+
+private:
+  int fd;
+  std::vector<char> buffer;
+  bool ok = true;
+};
+
+} // namespace
+
+void MappedFile::createShared(const std::string& name,
+                              const std::function<void(std::ostream&)>& fill)
+{
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    throw IOError("MappedFile: cannot create shared memory " + name + ": " +
+                  std::strerror(errno));
+
+  // Serialized straight into the object, which is not ready until the flag
+  // is written at the end
+  bool ok = false;
+  int err = 0;
+  try {
+    FdOutBuf buf(fd);
+    std::ostream str(&buf);
+    fill(str);
+    const std::uint32_t ready = MappedKeyLayout::READY;
+    ok = str.good() && buf.flush() &&
+         pwrite(fd, &ready, sizeof(ready), MappedKeyLayout::READY_OFFSET) ==
+             ssize_t(sizeof(ready));
+    err = errno;
+  } catch (...) {
+    close(fd);
+    shm_unlink(name.c_str());
+    throw;
+  }
+  close(fd);
+  if (!ok) {
+    shm_unlink(name.c_str()); // do not leave a partial object behind
+    throw IOError("MappedFile: cannot write shared memory " + name + ": " +
+                  std::strerror(err));
+  }
+}
+
+void MappedFile::removeShared(const std::string& name)
+{
+  if (shm_unlink(name.c_str()) != 0)
+    throw IOError("MappedFile: cannot remove shared memory " + name + ": " +
+                  std::strerror(errno));
+}
+
+MappedFile::~MappedFile()
+{
+  munmap(const_cast<unsigned char*>(base), length);
+}
+
+std::vector<DoubleCRT> MappedRows::toDoubleCRTs() const
+{
+  long phim = context.getPhiM();
+  std::vector<DoubleCRT> b;
+  b.reserve(cols.size());
+  for (const IndexMap<const long*>& col : cols) {
+    b.emplace_back(context, col.getIndexSet());
+    for (long i : col.getIndexSet()) {
+      NTL::vec_long& row = b.back().map[i];
+      std::memcpy(row.elts(), col[i], phim * sizeof(long));
+    }
+  }
+  return b;
+}
+
+namespace {
+
+// The buffer of inOneBuffer, charged to the memory accounts of the context
+// for as long as it lives, as the DoubleCRT rows it replaces were
+struct AccountedBuffer
+{
+  const Context& context;
+  MemoryCategory category;
+  long rows;
+  HugePageBuffer buffer;
+
+  AccountedBuffer(const Context& context,
+                  MemoryCategory category,
+                  long rows,
+                  long size) :
+      context(context), category(category), rows(rows), buffer(size, category)
+  {
+    context.getMemoryAccounts().add(category, bytes(), rows, 1);
+  }
+
+  ~AccountedBuffer()
+  {
+    context.getMemoryAccounts().add(category, -bytes(), -rows, -1);
+  }
+
+  long bytes() const { return rows * context.getPhiM() * sizeof(long); }
+};
+
+} // namespace
+
+std::shared_ptr<const MappedRows> MappedRows::inOneBuffer(
+    const Context& context,
+    const std::vector<DoubleCRT>& b)
+{
+  long phim = context.getPhiM();
+  long stride = MappedKeyLayout::rowBytes(phim) / sizeof(long);
+  IndexSet primes;
+  long nRows = 0;
+  for (const DoubleCRT& bj : b) {
+    primes.insert(bj.getIndexSet());
+    nRows += card(bj.getIndexSet());
+  }
+
+  MemoryCategory category =
+      b.empty() ? MemoryScope::current() : b[0].getMemoryCategory();
+  auto owner = std::make_shared<AccountedBuffer>(context,
+                                                 category,
+                                                 nRows,
+                                                 nRows * stride * sizeof(long));
+  auto rows = std::make_shared<MappedRows>(context, owner);
+  rows->pages = owner->buffer.kind();
+  rows->cols.resize(b.size());
+
+  long* next = static_cast<long*>(owner->buffer.data());
+  for (long i : primes)
+    for (long j = 0; j < lsize(b); j++) {
+      if (!b[j].getIndexSet().contains(i))
+        continue;
+      std::memcpy(next, b[j].map[i].elts(), phim * sizeof(long));
+      rows->cols[j].insert(i);
+      rows->cols[j][i] = next;
+      next += stride;
+    }
+  return rows;
+}
+
+} // namespace helib
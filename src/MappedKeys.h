@@ -0,0 +1,158 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_MAPPEDKEYS_H
+#define HELIB_MAPPEDKEYS_H
+/**
+ * @file MappedKeys.h
+ * @brief A binary layout for public keys whose key-switching matrices can be
+ * memory-mapped read-only, and used in place
+ *
+ * The layout of a mapped key file is (all integers are 64-bit little-endian,
+ * and offsets are from the start of the file):
+ *
+ *     0   SerializeHeader<PubKey>
+ *     24  EyeCatcher::MAPPED_BEGIN
+ *     28  4 zero bytes in files; in shared-memory objects,
+ *         MappedKeyLayout::READY once the object is completely written
+ *     32  layout version (MappedKeyLayout::VERSION)
+ *     40  phi(m)
+ *     48  size of the metadata
+ *     56  offset of the rows, a multiple of MappedKeyLayout::ALIGNMENT
+ *     64  metadata: the PubKey in the format of PubKey::writeTo, where every
+ *         KeySwitch has an empty b, then for each KeySwitch, its number of
+ *         columns followed by the IndexSet of each column
+ *  rows   for each KeySwitch, column and prime of that column (in order),
+ *         the phi(m) residues, each row padded to a multiple of ALIGNMENT
+ *         bytes, then EyeCatcher::MAPPED_END
+ *
+ * The residues are not validated when the file is mapped, since that would
+ * read every page of it: mapped files must come from a trusted source.
+ **/
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <helib/DoubleCRT.h>
+#include <helib/hugePages.h>
+#include <helib/IndexMap.h>
+
+namespace helib {
+
+struct MappedKeyLayout
+{
+  static constexpr long VERSION = 1;
+  static constexpr long ALIGNMENT = 64;
+  static constexpr long METADATA_OFFSET = 64;
+  static constexpr long READY_OFFSET = 28;
+  static constexpr std::uint32_t READY = 1;
+
+  //! The size of a row of phim residues, padded to ALIGNMENT bytes
+  static long rowBytes(long phim)
+  {
+    long bytes = phim * sizeof(long);
+    return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  }
+};
+
+/**
+ * @class MappedFile
+ * @brief A file mapped read-only into memory, for as long as the object
+ * lives. Pages are shared with every other process mapping the same file.
+ *
+ * The file may also be a named POSIX shared-memory object (see shm_open),
+ * which lives in memory rather than on disk until it is removed. Such an
+ * object holds a mapped key file, which is only marked ready (see
+ * MappedKeyLayout::READY_OFFSET) once it is completely written, so that no
+ * process maps it before that.
+ **/
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  //! @brief Map the shared-memory object `name` (e.g. "/helib-keys").
+  //! Throws if it is not marked ready yet.
+  static std::shared_ptr<const MappedFile> openShared(const std::string& name);
+
+  //! @brief Create the shared-memory object `name`, readable by every
+  //! process of the user, fill it with what `fill` writes to the stream it
+  //! is given, and mark it ready. Throws if the name is already in use.
+  static void createShared(const std::string& name,
+                           const std::function<void(std::ostream&)>& fill);
+
+  //! @brief Remove the name `name`. Existing mappings stay valid, and the
+  //! memory is released once the last of them goes away.
+  static void removeShared(const std::string& name);
+
+  const unsigned char* data() const { return base; }
+  long size() const { return length; }
+
+private:
+  // Map the open file descriptor fd, which is closed in any case
+  MappedFile(int fd, const std::string& what);
+
+  const unsigned char* base;
+  long length;
+};
+
+/**
+ * @class MappedRows
+ * @brief The top row (the b_i's) of a key-switching matrix, viewed in place
+ * in a MappedFile, or in a single buffer holding a copy of them (see
+ * inOneBuffer).
+ **/
+class MappedRows
+{
+public:
+  //! @param owner Keeps the rows alive, e.g. the MappedFile they are in
+  MappedRows(const Context& context, std::shared_ptr<const void> owner) :
+      context(context), owner(std::move(owner))
+  {}
+
+  //! cols[j][i] points to the residues of b_j modulo the i'th prime
+  std::vector<IndexMap<const long*>> cols;
+
+  //! The pages of the rows made by inOneBuffer
+  HugePageKind pages = HugePageKind::NONE;
+
+  //! @brief Copies of the b_i's, for the paths that need a DoubleCRT
+  std::vector<DoubleCRT> toDoubleCRTs() const;
+
+  /**
+   * @brief The b_i's copied into one HugePageBuffer, in huge pages if the
+   * HugePagePolicy of their category allows it.
+   *
+   * The rows are prime-major, then digit-major: the rows of all the b_i's
+   * modulo a prime are adjacent, in the order in which the multiply-
+   * accumulate of key switching (DoubleCRT::innerProduct) reads them, and
+   * the primes follow each other in increasing order. Each row is padded as
+   * in a mapped file (MappedKeyLayout::rowBytes).
+   **/
+  static std::shared_ptr<const MappedRows> inOneBuffer(
+      const Context& context,
+      const std::vector<DoubleCRT>& b);
+
+private:
+  const Context& context;
+  std::shared_ptr<const void> owner; // keeps the rows mapped or allocated
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_MAPPEDKEYS_H
@@ -1068,6 +1068,49 @@ void interpolateMod(NTL::ZZX& poly,
   recursiveInterpolateMod(poly, x, ytmp, xmod, ymod, p, p2e);
 }
 
+PRG::PRG(const NTL::ZZ& seed)
+{
+  // As NTL::SetSeed(seed): the key derived from the bytes of seed
+  long nbytes = NTL::NumBytes(seed);
+  NTL::Vec<unsigned char> data;
+  data.SetLength(nbytes);
+  NTL::BytesFromZZ(data.elts(), seed, nbytes);
+  NTL::DeriveKey(key, KEY_BYTES, data.elts(), nbytes);
+  own = std::make_unique<NTL::RandomStream>(key);
+}
+
+PRG::PRG(const unsigned char* _key)
+{
+  std::copy(_key, _key + KEY_BYTES, key);
+  own = std::make_unique<NTL::RandomStream>(key);
+}
+
+PRG& PRG::current()
+{
+  static thread_local PRG prg;
+  return prg;
+}
+
+PRG PRG::split()
+{
+  unsigned char newKey[KEY_BYTES];
+  get(newKey, KEY_BYTES);
+  return PRG(newKey);
+}
+
+PRG PRG::substream(long index) const
+{
+  assertTrue<LogicError>(bool(own), "PRG::substream: not for current()");
+  // The key derived from the bytes of (key, index)
+  unsigned char data[KEY_BYTES + 8];
+  std::copy(key, key + KEY_BYTES, data);
+  for (long i = 0; i < 8; i++)
+    data[KEY_BYTES + i] = (unsigned long)index >> (8 * i);
+  unsigned char subKey[KEY_BYTES];
+  NTL::DeriveKey(subKey, KEY_BYTES, data, sizeof(data));
+  return PRG(subKey);
+}
+
 // advance the input stream beyond white spaces and a single instance of cc
 void seekPastChar(std::istream& str, int cc)
 {
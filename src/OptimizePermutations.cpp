@@ -13,12 +13,19 @@
  * @brief Implementation of optimized permutation networks
  */
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <initializer_list>
 #include <list>
-#include <sstream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include <NTL/vector.h>
+#include <NTL/BasicThreadPool.h>
 #include <helib/NumbTh.h>
 #include <helib/EncryptedArray.h>
 #include <helib/permutations.h>
@@ -33,6 +40,17 @@ class ClassHash
 public:
   size_t operator()(const T& t) const { return t.hash(); }
 };
+
+// The hash of the fields of a memo key, FNV-1a over whole words
+static size_t hashFields(std::initializer_list<long> fields)
+{
+  std::uint64_t hash = 14695981039346656037ULL;
+  for (long field : fields) {
+    hash ^= std::uint64_t(field);
+    hash *= 1099511628211ULL;
+  }
+  return size_t(hash);
+}
 //! \endcond
 
 // routines for finding optimal level-collapsing strategies for Benes networks
@@ -239,12 +257,7 @@ public:
     budget = _budget;
   }
 
-  size_t hash() const
-  {
-    std::stringstream s;
-    s << i << " " << budget;
-    return std::hash<std::string>()(s.str());
-  }
+  size_t hash() const { return hashFields({i, budget}); }
 
   bool operator==(const BenesMemoKey& other) const
   {
@@ -270,6 +283,20 @@ public:
 typedef std::
     unordered_map<BenesMemoKey, BenesMemoEntry, ClassHash<BenesMemoKey>>
         BenesMemoTable;
+
+// The tables of the Benes networks of one size, for a good or a bad
+// generator. The entries of the memo table do not depend on the budget the
+// search started from, so they serve all the calls of optimalBenes with this
+// size, rather than being built again for each one.
+struct BenesTables
+{
+  long nlev = 0;
+  NTL::Vec<NTL::Vec<long>> costTab;
+  BenesMemoTable memoTab;
+};
+
+// The tables of every (n, good) met so far
+typedef std::map<std::pair<long, bool>, BenesTables> BenesTablesMap;
 //! \endcond
 
 // A dynamic program (implemented as a recursive routine with memoization) for
@@ -355,23 +382,29 @@ BenesMemoEntry optimalBenesAux(long i,
 //      are collapsed: if solution = [s_1 s_2 ... s_k], then k <= budget,
 //      and the first s_1 levels are collapsed, the next s_2 levels
 //      are collapsed, etc.
+//   benesTables = the tables of the sizes met so far, reused here
 void optimalBenes(long n,
                   long budget,
                   bool good,
                   long& cost,
-                  LongNodePtr& solution)
+                  LongNodePtr& solution,
+                  BenesTablesMap& benesTables)
 {
-  long k = GeneralBenesNetwork::depth(n); // k = ceiling(log_2 n)
-  long nlev = 2 * k - 1; // before collapsing, we have 2k-1 levels
-
-  NTL::Vec<NTL::Vec<long>> costTab;
-  // costTab[i][j] to holds the cost of collapsing levels i..i+j
-
-  buildBenesCostTable(n, k, good, costTab);
-  // Compute the cost for all (n choose 2) possible ways to collapse levels.
+  BenesTables& tables = benesTables[std::make_pair(n, good)];
+  if (tables.nlev == 0) { // a new size, build its cost table
+    long k = GeneralBenesNetwork::depth(n); // k = ceiling(log_2 n)
+    tables.nlev = 2 * k - 1; // before collapsing, we have 2k-1 levels
+
+    // costTab[i][j] to holds the cost of collapsing levels i..i+j
+    buildBenesCostTable(n, k, good, tables.costTab);
+    // Compute the cost for all (n choose 2) possible ways to collapse levels.
+  }
 
-  BenesMemoTable memoTab;
-  BenesMemoEntry t = optimalBenesAux(0, budget, nlev, costTab, memoTab);
+  BenesMemoEntry t = optimalBenesAux(0,
+                                     budget,
+                                     tables.nlev,
+                                     tables.costTab,
+                                     tables.memoTab);
   // Compute the optimal collapsing of layers in a width-n Benes network
 
   cost = t.cost;
@@ -484,12 +517,7 @@ public:
     mid = _mid;
   }
 
-  size_t hash() const
-  {
-    std::stringstream s;
-    s << order << " " << good << " " << budget << " " << mid;
-    return std::hash<std::string>()(s.str());
-  }
+  size_t hash() const { return hashFields({order, good, budget, mid}); }
 
   bool operator==(const LowerMemoKey& other) const
   {
@@ -517,6 +545,13 @@ typedef std::
     unordered_map<LowerMemoKey, LowerMemoEntry, ClassHash<LowerMemoKey>>
         LowerMemoTable;
 
+// The tables of the search for the trees of single generators
+struct LowerSearch
+{
+  LowerMemoTable lowerMemoTable;
+  BenesTablesMap benesTables;
+};
+
 // list structure for managing generators
 
 class GenNode;
@@ -586,12 +621,7 @@ public:
     mid = _mid;
   }
 
-  size_t hash() const
-  {
-    std::stringstream s;
-    s << i << " " << budget << " " << mid;
-    return std::hash<std::string>()(s.str());
-  }
+  size_t hash() const { return hashFields({i, budget, mid}); }
 
   bool operator==(const UpperMemoKey& other) const
   {
@@ -626,13 +656,14 @@ LowerMemoEntry optimalLower(long order,
                             bool good,
                             long budget,
                             long mid,
-                            LowerMemoTable& lowerMemoTable)
+                            LowerSearch& search)
 {
   assertTrue<InvalidArgument>(order > 1, "Order must be greater than 1");
   assertTrue<InvalidArgument>(mid == 0 || mid == 1, "mid value is not 1 or 2");
   assertTrue<InvalidArgument>(budget > 0, "No budget left");
 
   // Did we already solve this problem? If so just return the solution.
+  LowerMemoTable& lowerMemoTable = search.lowerMemoTable;
   LowerMemoTable::iterator find =
       lowerMemoTable.find(LowerMemoKey(order, good, budget, mid));
 
@@ -655,19 +686,34 @@ LowerMemoEntry optimalLower(long order,
     if (mid == 1) {
       // this is the middle node, so just one Benes network
 
-      optimalBenes(order, budget, good, cost, benesSolution1);
+      optimalBenes(order,
+                   budget,
+                   good,
+                   cost,
+                   benesSolution1,
+                   search.benesTables);
       benesSolution2 = LongNodePtr();
     } else {
       // not the middle node, so we need two Benes networks.
       // if budget is odd, we split it unevenly
 
       long cost1, cost2;
-      optimalBenes(order, budget / 2, good, cost1, benesSolution1);
+      optimalBenes(order,
+                   budget / 2,
+                   good,
+                   cost1,
+                   benesSolution1,
+                   search.benesTables);
       if (budget % 2 == 0) { // both networks have the same budget
         cost2 = cost1;
         benesSolution2 = benesSolution1;
       } else { // one network has budget larger by one than the other
-        optimalBenes(order, budget - budget / 2, good, cost2, benesSolution2);
+        optimalBenes(order,
+                     budget - budget / 2,
+                     good,
+                     cost2,
+                     benesSolution2,
+                     search.benesTables);
       }
 
       cost = cost1 + cost2;
@@ -710,14 +756,14 @@ LowerMemoEntry optimalLower(long order,
         // nodes if we have it, and to none of the nodes if we don't
         for (long mid1 = 0; mid1 <= mid; mid1++) {
           LowerMemoEntry s1 =
-              optimalLower(order1, good1, budget1, mid1, lowerMemoTable);
+              optimalLower(order1, good1, budget1, mid1, search);
           // FIXME: If s1.cost==NTL_MAX_LONG we do not need to compute
           //        the cost of s2
           LowerMemoEntry s2 = optimalLower(order / order1,
                                            good2,
                                            budget - budget1,
                                            mid - mid1,
-                                           lowerMemoTable);
+                                           search);
           if (s1.cost != NTL_MAX_LONG && s2.cost != NTL_MAX_LONG &&
               s1.cost + s2.cost < cost) {
             cost = s1.cost + s2.cost;
@@ -743,7 +789,7 @@ UpperMemoEntry optimalUpperAux(const NTL::Vec<GenDescriptor>& vec,
                                long budget,
                                long mid,
                                UpperMemoTable& upperMemoTable,
-                               LowerMemoTable& lowerMemoTable)
+                               LowerSearch& lowerSearch)
 {
   assertInRange<InvalidArgument>(i,
                                  0l,
@@ -788,7 +834,7 @@ UpperMemoEntry optimalUpperAux(const NTL::Vec<GenDescriptor>& vec,
                                         vec[i].good,
                                         budget1,
                                         mid1,
-                                        lowerMemoTable);
+                                        lowerSearch);
         // FIXME: If s.cost==NTL_MAX_LONG we do not need to compute
         //        the cost of t
 
@@ -798,7 +844,7 @@ UpperMemoEntry optimalUpperAux(const NTL::Vec<GenDescriptor>& vec,
                                            budget - budget1,
                                            mid - mid1,
                                            upperMemoTable,
-                                           lowerMemoTable);
+                                           lowerSearch);
         if (s.cost != NTL_MAX_LONG && t.cost != NTL_MAX_LONG &&
             s.cost + t.cost < bestCost) {
           bestCost = s.cost + t.cost;
@@ -938,6 +984,52 @@ static long copyToGenTree(OneGeneratorTree& gTree, SplitNodePtr& solution)
   return len;
 }
 
+// The solutions of optimalLower depend only on their key, not on the other
+// generators, so they are kept for all the calls of buildOptimalTrees.
+static std::mutex lowerSearchMutex;
+static LowerSearch& sharedLowerSearch()
+{
+  static LowerSearch search;
+  return search;
+}
+
+// Solve optimalLower(order, good, budget, mid) for all the budgets up to
+// depthBound and both values of mid, for each generator whose tree is not in
+// the shared tables yet. The trees are searched in parallel, each in tables
+// of its own, and the solutions are then added to the shared tables.
+// The caller holds lowerSearchMutex.
+static void solveGeneratorTrees(const NTL::Vec<GenDescriptor>& gens,
+                                long depthBound)
+{
+  LowerSearch& shared = sharedLowerSearch();
+  std::vector<std::pair<long, bool>> todo;
+  for (long i = 0; i < gens.length(); i++) {
+    std::pair<long, bool> tree(gens[i].order, gens[i].good);
+    if (std::find(todo.begin(), todo.end(), tree) != todo.end())
+      continue;
+    bool solved = true;
+    for (long budget = 1; budget <= depthBound && solved; budget++)
+      for (long mid = 0; mid <= 1 && solved; mid++)
+        solved = shared.lowerMemoTable.count(
+            LowerMemoKey(tree.first, tree.second, budget, mid));
+    if (!solved)
+      todo.push_back(tree);
+  }
+
+  std::vector<LowerSearch> searches(todo.size());
+  NTL_EXEC_RANGE(long(todo.size()), first, last)
+  for (long j = first; j < last; j++)
+    for (long budget = 1; budget <= depthBound; budget++)
+      for (long mid = 0; mid <= 1; mid++)
+        optimalLower(todo[j].first, todo[j].second, budget, mid, searches[j]);
+  NTL_EXEC_RANGE_END
+
+  // A key has the same solution in every table that has it
+  for (const LowerSearch& search : searches)
+    shared.lowerMemoTable.insert(search.lowerMemoTable.begin(),
+                                 search.lowerMemoTable.end());
+}
+
 // Compute the trees corresponding to the "optimal" way of breaking
 // a permutation into dimensions, subject to some constraints
 long GeneratorTrees::buildOptimalTrees(const NTL::Vec<GenDescriptor>& gens,
@@ -960,12 +1052,21 @@ long GeneratorTrees::buildOptimalTrees(const NTL::Vec<GenDescriptor>& gens,
       trees[i].collapseToRoot();
   }
 
-  UpperMemoTable upperMemoTable;
-  LowerMemoTable lowerMemoTable;
-
-  // Compute a solution in { t.cost, t.solution }
-  UpperMemoEntry t =
-      optimalUpperAux(gens, 0, depthBound, 1, upperMemoTable, lowerMemoTable);
+  UpperMemoEntry t;
+  {
+    std::lock_guard<std::mutex> lock(lowerSearchMutex);
+    solveGeneratorTrees(gens, depthBound);
+
+    // Compute a solution in { t.cost, t.solution }, with the trees of the
+    // generators all found in the shared tables
+    UpperMemoTable upperMemoTable;
+    t = optimalUpperAux(gens,
+                        0,
+                        depthBound,
+                        1,
+                        upperMemoTable,
+                        sharedLowerSearch());
+  }
 
   // Copy the solution into the trees
   GenNodePtr midPtr;
@@ -987,6 +1088,7 @@ long GeneratorTrees::buildOptimalTrees(const NTL::Vec<GenDescriptor>& gens,
     // NTL_MAX_LONG
 
     depth = 0;
+    cost = PermutationCost();
     trees.kill();
     map2cube.kill();
     map2array.kill();
@@ -999,6 +1101,11 @@ long GeneratorTrees::buildOptimalTrees(const NTL::Vec<GenDescriptor>& gens,
   // Compute the mapping from array to cube and back
   ComputeCubeMapping();
 
+  // Each shift but the zero one is an automorphism and a key switch
+  cost.automorphisms = t.cost;
+  cost.keySwitches = t.cost;
+  cost.depth = depth;
+
 #ifdef HELIB_DEBUG
   NTL::Vec<long> dims; // The "crude" cube dimensions, one dimension per tree
   getCubeDims(dims);
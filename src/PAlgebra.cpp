@@ -16,6 +16,7 @@
 #include <helib/hypercube.h>
 #include <helib/timing.h>
 #include <helib/range.h>
+#include <helib/bluestein.h>
 
 #include <NTL/ZZXFactoring.h>
 #include <NTL/GF2EXFactoring.h>
@@ -443,13 +444,16 @@ PAlgebraModDerived<PA_cx>::PAlgebraModDerived(const PAlgebra& palg, long _r) :
 PAlgebra::PAlgebra(long mm,
                    long pp,
                    const std::vector<long>& _gens,
-                   const std::vector<long>& _ords) :
+                   const std::vector<long>& _ords,
+                   const PAlgebraTables* precomputed) :
     m(mm), p(pp), cM(1.0) // default value for the ring constant
 {
   assertInRange<InvalidArgument>(mm,
                                  2l,
                                  NTL_SP_BOUND,
                                  "mm is not in [2, NTL_SP_BOUND)");
+  // The index tables are 32-bit
+  assertTrue<InvalidArgument>(mm <= INT32_MAX, "mm is not below 2^31");
   if (pp == -1) // pp==-1 signals using the complex field for plaintext
     pp = m - 1;
   else {
@@ -487,7 +491,7 @@ PAlgebra::PAlgebra(long mm,
 
   resize(native, lsize(tmpOrds));
   resize(frob_perturb, lsize(tmpOrds));
-  std::vector<long> p_subgp(mm);
+  std::vector<int32_t> p_subgp(mm);
   for (long i : range(mm))
     p_subgp[i] = -1;
   long pmodm = pp % mm;
@@ -524,7 +528,10 @@ PAlgebra::PAlgebra(long mm,
     normBnd *= 2.0L * cotan(PI / (2.0L * u)) / u;
   }
 
-  polyNormBnd = calcPolyNormBnd(mm);
+  if (precomputed != nullptr && !isDryRun())
+    polyNormBnd = precomputed->polyNormBnd;
+  else
+    polyNormBnd = calcPolyNormBnd(mm);
 
   // Allocate space for the various arrays
   resize(T, getNSlots());
@@ -549,28 +556,54 @@ PAlgebra::PAlgebra(long mm,
   // It doesn't seem like it to me, VJS.
   // The comment about reverse order is correct, SH.
 
-  // buffer is initialized to all-zero, which represents 1=\prod_i gi^0
-  std::vector<long> buffer(gens.size()); // temporary holds exponents
+  // The exponent vectors are enumerated with nextExpVector, keeping the
+  // partial products prefix[j] = \prod_{i<j} gi^{ei} mod m of the current
+  // vector, so that each representative costs one multiplication (amortized)
+  // instead of an exponentiation. This is linear in the number of slots, so
+  // a precomputed T is not trusted but checked against the enumeration.
+  long ngens = gens.size();
+  std::vector<long> buffer(ngens); // all-zero represents 1=\prod_i gi^0
+  std::vector<long> prefix(ngens + 1, 1);
 
   long ctr = 0;
-  long i = 0;
   do {
-    ctr++;
-    long t = exponentiate(buffer);
+    long t = isDryRun() ? 1 : prefix[ngens];
 
     // sanity check for user-supplied gens
     assertEq(NTL::GCD(t, mm), 1l, "Bad user-supplied generator");
-    assertEq(Tidx[t], -1l, "Slot at index t has already been assigned");
-
-    T[i] = t;      // The i'th element in T it t
-    Tidx[t] = i++; // the index of t in T is i
-
-    // increment buffer by one (in lexicographic order)
-  } while (nextExpVector(buffer)); // until we cover all the group
+    assertEq(long(Tidx[t]), -1l, "Slot at index t has already been assigned");
+    assertTrue(ctr < getNSlots(), "Bad user-supplied generator set");
+
+    T[ctr] = t;      // The ctr'th element in T it t
+    Tidx[t] = ctr++; // the index of t in T is ctr
+
+    // increment buffer by one (in lexicographic order): the first coordinate
+    // that changes is the last one that is not at its maximum
+    long j = ngens - 1;
+    while (j >= 0 && buffer[j] == OrderOf(j) - 1)
+      j--;
+    if (!nextExpVector(buffer))
+      break; // we covered all the group
+    prefix[j + 1] = NTL::MulMod(prefix[j + 1], gens[j], mm);
+    for (long k = j + 1; k < ngens; k++)
+      prefix[k + 1] = prefix[k];
+  } while (true);
 
   // sanity check for user-supplied gens
   assertEq(ctr, getNSlots(), "Bad user-supplied generator set");
 
+  if (precomputed != nullptr && !isDryRun()) {
+    // The representatives saved with the tables must be those of the gens
+    assertEq<IOError>(lsize(precomputed->T),
+                      getNSlots(),
+                      "Precomputed tables: wrong number of slots");
+    for (long i : range(getNSlots()))
+      assertEq<IOError>(precomputed->T[i],
+                        long(T[i]),
+                        "Precomputed tables: representatives do not match "
+                        "the generators");
+  }
+
   PhimX = Cyclotomic(mm); // compute and store Phi_m(X)
   //  pp_factorize(mFactors,mm); // prime-power factorization from NumbTh.cpp
 
@@ -586,6 +619,14 @@ PAlgebra::PAlgebra(long mm,
     quarter_fftInfo = std::make_shared<quarter_FFT>(mm);
 }
 
+PAlgebraTables PAlgebra::getTables() const
+{
+  PAlgebraTables tables;
+  tables.polyNormBnd = polyNormBnd;
+  tables.T.assign(T.begin(), T.end());
+  return tables;
+}
+
 bool comparePAlgebra(const PAlgebra& palg,
                      unsigned long m,
                      unsigned long p,
@@ -642,7 +683,9 @@ long PAlgebra::genToPow(long i, long j) const
 
 ************************************************************************/
 
-PAlgebraModBase* buildPAlgebraMod(const PAlgebra& zMStar, long r)
+PAlgebraModBase* buildPAlgebraMod(const PAlgebra& zMStar,
+                                  long r,
+                                  const PAlgebraModFactors* precomputed)
 {
   long p = zMStar.getP();
 
@@ -653,9 +696,9 @@ PAlgebraModBase* buildPAlgebraMod(const PAlgebra& zMStar, long r)
                               "Modulus p is less than 2 (nor -1 for CKKS)");
   assertTrue<InvalidArgument>(r > 0, "Hensel lifting r is less than 1");
   if (p == 2 && r == 1)
-    return new PAlgebraModDerived<PA_GF2>(zMStar, r);
+    return new PAlgebraModDerived<PA_GF2>(zMStar, r, precomputed);
   else
-    return new PAlgebraModDerived<PA_zz_p>(zMStar, r);
+    return new PAlgebraModDerived<PA_zz_p>(zMStar, r, precomputed);
 }
 
 template <typename T>
@@ -677,17 +720,136 @@ NTL::zz_pEX FrobeniusMap(const NTL::zz_pEXModulus& F)
   return PowerXMod(NTL::zz_pE::cardinality(), F);
 }
 
+// With d = 1, every Ft = X - a_t is linear, and a_t = b^{1/t} for the root
+// b = a_1 of F1, a primitive m-th root of unity mod p^r. So the slots of H
+// are some of the entries of the length-m DFT of H with root b, and H can
+// be recovered from them by an inverse DFT reduced mod Phi_m(X). For odd m
+// a root of order m is all Bluestein's algorithm needs.
+class SlotDFT
+{
+public:
+  long m;
+  std::vector<long> exps; // slot i holds H(b^{exps[i]})
+  NTL::zz_p mInv;
+  // BluesteinFFT(root) is the DFT with root^2, so these are square roots
+  // of b and b^{-1}
+  NTL::zz_p fwdRoot, invRoot;
+  NTL::zz_pX powers, ipowers;
+  NTL::Vec<NTL::mulmod_precon_t> powers_aux, ipowers_aux;
+  NTL::fftRep Rb, iRb;
+};
+
+// Returns null unless d = 1 and m is odd. The modulus must be p^r
+static std::shared_ptr<const SlotDFT> buildSlotDFT(
+    const PAlgebra& zMStar,
+    const NTL::vec_zz_pX& factors)
+{
+  long m = zMStar.getM();
+  long nSlots = zMStar.getNSlots();
+  if (zMStar.getOrdP() != 1 || m < 3 || m % 2 == 0)
+    return nullptr;
+
+  auto dft = std::make_shared<SlotDFT>();
+  dft->m = m;
+  NTL::zz_p b = -ConstTerm(factors[0]);
+  dft->exps.resize(nSlots);
+  for (long i : range(nSlots)) {
+    long e = NTL::InvMod(zMStar.ith_rep(i), m);
+    if (power(b, e) != -ConstTerm(factors[i]))
+      return nullptr; // not the ordering we expect, use the generic code
+    dft->exps[i] = e;
+  }
+
+  dft->mInv = inv(NTL::to_zz_p(m));
+  dft->fwdRoot = power(b, (m + 1) / 2); // its square is b^{m+1} = b
+  dft->invRoot = inv(dft->fwdRoot);
+  BluesteinInit(m, dft->fwdRoot, dft->powers, dft->powers_aux, dft->Rb);
+  BluesteinInit(m, dft->invRoot, dft->ipowers, dft->ipowers_aux, dft->iRb);
+  return dft;
+}
+
+static std::shared_ptr<const SlotDFT> buildSlotDFT(const PAlgebra&,
+                                                   const NTL::vec_GF2X&)
+{
+  return nullptr; // p = 2 has d > 1 for every m > 1
+}
+
+// crt[i] = H(b^{exps[i]}), for H of any degree
+static bool slotDFTDecompose(const SlotDFT* dft,
+                             std::vector<NTL::zz_pX>& crt,
+                             const NTL::zz_pX& H)
+{
+  if (dft == nullptr)
+    return false;
+
+  long m = dft->m;
+  NTL::zz_pX x;
+  if (deg(H) < m)
+    x = H;
+  else { // reduce mod X^m - 1, which keeps the values at the m-th roots
+    x.rep.SetLength(m);
+    for (long i : range(m))
+      clear(x.rep[i]);
+    for (long i : range(deg(H) + 1))
+      x.rep[i % m] += H.rep[i];
+    x.normalize();
+  }
+
+  BluesteinFFT(x, m, dft->fwdRoot, dft->powers, dft->powers_aux, dft->Rb);
+  for (long i : range(lsize(crt)))
+    conv(crt[i], coeff(x, dft->exps[i]));
+  return true;
+}
+
+static bool slotDFTDecompose(const SlotDFT*,
+                             std::vector<NTL::GF2X>&,
+                             const NTL::GF2X&)
+{
+  return false;
+}
+
+// H = g mod Phi_m(X), for the g of degree below m with g(b^{exps[i]}) =
+// crt[i] and g(b^j) = 0 at the other m-th roots
+static bool slotDFTReconstruct(const SlotDFT* dft,
+                               NTL::zz_pX& H,
+                               const std::vector<NTL::zz_pX>& crt,
+                               const NTL::zz_pXModulus& PhimXMod)
+{
+  if (dft == nullptr)
+    return false;
+
+  long m = dft->m;
+  NTL::zz_pX y;
+  y.rep.SetLength(m);
+  for (long j : range(m))
+    clear(y.rep[j]);
+  for (long i : range(lsize(crt)))
+    y.rep[dft->exps[i]] = ConstTerm(crt[i]);
+  y.normalize();
+
+  BluesteinFFT(y, m, dft->invRoot, dft->ipowers, dft->ipowers_aux, dft->iRb);
+  y *= dft->mInv;
+  rem(H, y, PhimXMod);
+  return true;
+}
+
+static bool slotDFTReconstruct(const SlotDFT*,
+                               NTL::GF2X&,
+                               const std::vector<NTL::GF2X>&,
+                               const NTL::GF2XModulus&)
+{
+  return false;
+}
+
 template <typename type>
-PAlgebraModDerived<type>::PAlgebraModDerived(const PAlgebra& _zMStar, long _r) :
+PAlgebraModDerived<type>::PAlgebraModDerived(
+    const PAlgebra& _zMStar,
+    long _r,
+    const PAlgebraModFactors* precomputed) :
     zMStar(_zMStar), r(_r)
 
 {
   long p = zMStar.getP();
-  long m = zMStar.getM();
-
-  // For dry-run, use a tiny m value for the PAlgebra tables
-  if (isDryRun())
-    m = (p == 3) ? 4 : 3;
 
   assertTrue<InvalidArgument>(r > 0l, "Hensel lifting r is less than 1");
 
@@ -700,6 +862,79 @@ PAlgebraModDerived<type>::PAlgebraModDerived(const PAlgebra& _zMStar, long _r) :
 
   RBak bak;
   bak.save();
+
+  if (precomputed != nullptr && !isDryRun())
+    usePrecomputed(*precomputed);
+  else
+    factorPhimX();
+
+  // set factorsOverZZ
+  resize(factorsOverZZ, nSlots);
+  for (long i = 0; i < nSlots; i++)
+    conv(factorsOverZZ[i], factors[i]);
+
+  genCrtTable();
+  genMaskTable();
+  if (!isDryRun())
+    slotDFT = buildSlotDFT(zMStar, factors);
+}
+
+template <typename type>
+void PAlgebraModDerived<type>::usePrecomputed(
+    const PAlgebraModFactors& precomputed)
+{
+  long nSlots = zMStar.getNSlots();
+  assertTrue<InvalidArgument>(lsize(precomputed.factors) == nSlots &&
+                                  lsize(precomputed.crtCoeffs) == nSlots,
+                              "Precomputed factorization: wrong number of "
+                              "factors");
+
+  SetModulus(pPowR);
+  RX phimxmod;
+  conv(phimxmod, zMStar.getPhimX());
+  build(PhimXMod, phimxmod);
+  pPowRContext.save();
+
+  resize(factors, nSlots);
+  resize(crtCoeffs, nSlots);
+  for (long i = 0; i < nSlots; i++) {
+    conv(factors[i], precomputed.factors[i]);
+    conv(crtCoeffs[i], precomputed.crtCoeffs[i]);
+    assertEq<InvalidArgument>(deg(factors[i]),
+                              zMStar.getOrdP(),
+                              "Precomputed factorization: wrong degree");
+  }
+}
+
+template <typename type>
+PAlgebraModFactors PAlgebraModDerived<type>::getFactorization() const
+{
+  RBak bak;
+  bak.save();
+  restoreContext();
+
+  PAlgebraModFactors ret;
+  ret.factors = factorsOverZZ;
+  resize(ret.crtCoeffs, lsize(crtCoeffs));
+  for (long i = 0; i < lsize(crtCoeffs); i++)
+    conv(ret.crtCoeffs[i], crtCoeffs[i]);
+  return ret;
+}
+
+// Computes the factors of Phi_m(X) mod p^r and their CRT coefficients,
+// leaving the modulus set to p^r
+template <typename type>
+void PAlgebraModDerived<type>::factorPhimX()
+{
+  long p = zMStar.getP();
+  long m = zMStar.getM();
+
+  // For dry-run, use a tiny m value for the PAlgebra tables
+  if (isDryRun())
+    m = (p == 3) ? 4 : 3;
+
+  long nSlots = zMStar.getNSlots();
+
   SetModulus(p);
 
   // Compute the factors Ft of Phi_m(X) mod p, for all t \in T
@@ -723,14 +958,21 @@ PAlgebraModDerived<type>::PAlgebraModDerived(const PAlgebra& _zMStar, long _r) :
   // We make the lexicographically smallest factor have index 0.
   // The remaining factors are ordered according to their representatives.
 
+  // The factors are independent of each other, and found in parallel. The
+  // modulus is thread-local, so every thread sets it first
+  RContext context;
+  context.save();
   RXModulus F1(localFactors[0]);
-  for (long i = 1; i < nSlots; i++) {
+  NTL_EXEC_RANGE(nSlots - 1, first, last)
+  context.restore();
+  for (long i = first + 1; i <= last; i++) {
     long t = zMStar.ith_rep(i);      // Ft is minimal poly of x^{1/t} mod F1
     long tInv = NTL::InvMod(t, m);   // tInv = t^{-1} mod m
     RX X2tInv = PowerXMod(tInv, F1); // X2tInv = X^{1/t} mod F1
     NTL::IrredPolyMod(localFactors[i], X2tInv, F1);
     // IrredPolyMod(X,P,Q) returns in X the minimal polynomial of P mod Q
   }
+  NTL_EXEC_RANGE_END
   /* Debugging sanity-check #1: we should have Ft= GCD(F1(X^t),Phi_m(X))
   for (i=1; i<nSlots; i++) {
     long t = T[i];
@@ -749,11 +991,14 @@ PAlgebraModDerived<type>::PAlgebraModDerived(const PAlgebra& _zMStar, long _r) :
 
     // Compute the CRT coefficients for the Ft's
     resize(crtCoeffs, nSlots);
-    for (long i = 0; i < nSlots; i++) {
+    NTL_EXEC_RANGE(nSlots, first, last)
+    context.restore();
+    for (long i = first; i < last; i++) {
       RX te = phimxmod / factors[i];        // \prod_{j\ne i} Fj
       te %= factors[i];                     // \prod_{j\ne i} Fj mod Fi
       InvMod(crtCoeffs[i], te, factors[i]); // \prod_{j\ne i} Fj^{-1} mod Fi
     }
+    NTL_EXEC_RANGE_END
   } else {
     PAlgebraLift(zMStar.getPhimX(), localFactors, factors, crtCoeffs, r);
     RX phimxmod1;
@@ -761,14 +1006,6 @@ PAlgebraModDerived<type>::PAlgebraModDerived(const PAlgebra& _zMStar, long _r) :
     build(PhimXMod, phimxmod1);
     pPowRContext.save();
   }
-
-  // set factorsOverZZ
-  resize(factorsOverZZ, nSlots);
-  for (long i = 0; i < nSlots; i++)
-    conv(factorsOverZZ[i], factors[i]);
-
-  genCrtTable();
-  genMaskTable();
 }
 
 // Assumes current zz_p modulus is p^r
@@ -870,16 +1107,24 @@ void PAlgebraLift(const NTL::ZZX& phimx,
   for (long i = 0; i < nSlots; i++) // Convert from ZZX to zz_pX
     conv(factors[i], vzz[i]);
 
-  // Finally compute the CRT coefficients for the factors
+  // Finally compute the CRT coefficients for the factors, in parallel
   resize(crtc, nSlots);
-  for (long i = 0; i < nSlots; i++) {
+  NTL::zz_pContext context;
+  context.save();
+  NTL_EXEC_RANGE(nSlots, first, last)
+  context.restore();
+  for (long i = first; i < last; i++) {
     NTL::zz_pX& fct = factors[i];
     NTL::zz_pX te = phimxmod / fct;   // \prod_{j\ne i} Fj
     te %= fct;                        // \prod_{j\ne i} Fj mod Fi
     InvModpr(crtc[i], te, fct, p, r); // \prod_{j\ne i} Fj^{-1} mod Fi
   }
+  NTL_EXEC_RANGE_END
 }
 
+// The number of slots from which CRT_decompose uses the remainder tree
+static constexpr long SLOT_REMAINDER_TREE_MIN = 8;
+
 // Returns a vector crt[] such that crt[i] = p mod Ft (with t = T[i])
 template <typename type>
 void PAlgebraModDerived<type>::CRT_decompose(std::vector<RX>& crt,
@@ -892,6 +1137,17 @@ void PAlgebraModDerived<type>::CRT_decompose(std::vector<RX>& crt,
     return;
   }
   resize(crt, nSlots);
+  if (slotDFTDecompose(slotDFT.get(), crt, H))
+    return;
+
+  if (nSlots >= SLOT_REMAINDER_TREE_MIN) {
+    // Reduce mod the products of the factors down the tree of
+    // CRT_reconstruct, rather than reducing H mod every factor
+    RX H1;
+    rem(H1, H, PhimXMod);
+    remTree(crt, crtTree, H1, 0, nSlots);
+    return;
+  }
   for (long i = 0; i < nSlots; i++)
     rem(crt[i], H, factors[i]); // crt[i] = H % factors[i]
 }
@@ -1032,7 +1288,7 @@ void PAlgebraModDerived<type>::CRT_reconstruct(RX& H,
     for (long i = 0; i < nslots; i++)
       if (!IsZero(crt[i]))
         H += ctab[i];
-  } else {
+  } else if (!slotDFTReconstruct(slotDFT.get(), H, crt, PhimXMod)) {
     std::vector<RX> crt1;
     resize(crt1, nslots);
     for (long i = 0; i < nslots; i++)
@@ -1352,11 +1608,16 @@ void PAlgebraModDerived<type>::genCrtTable()
 
   long nslots = zMStar.getNSlots();
   resize(crtTable, nslots);
-  for (long i = 0; i < nslots; i++) {
+  RContext context;
+  context.save();
+  NTL_EXEC_RANGE(nslots, first, last)
+  context.restore();
+  for (long i = first; i < last; i++) {
     RX allBut_i = PhimXMod / factors[i]; // = \prod_{j \ne i }Fj
     allBut_i *= crtCoeffs[i]; // = 1 mod Fi and = 0 mod Fj for j \ne i
     crtTable[i] = allBut_i;
   }
+  NTL_EXEC_RANGE_END
 
   buildTree(crtTree, 0, nslots);
 }
@@ -1400,6 +1661,25 @@ void PAlgebraModDerived<type>::evalTree(RX& res,
   }
 }
 
+template <typename type>
+void PAlgebraModDerived<type>::remTree(std::vector<RX>& crt,
+                                       const std::shared_ptr<TNode<RX>>& tree,
+                                       const RX& H,
+                                       long offset,
+                                       long extent) const
+{
+  if (extent == 1) {
+    rem(crt[offset], H, tree->data);
+    return;
+  }
+  long half = extent / 2;
+  RX tmp;
+  rem(tmp, H, tree->left->data);
+  remTree(crt, tree->left, tmp, offset, half);
+  rem(tmp, H, tree->right->data);
+  remTree(crt, tree->right, tmp, offset + half, extent - half);
+}
+
 // Explicit instantiation
 
 template class PAlgebraModDerived<PA_GF2>;
@@ -47,10 +47,34 @@ See below for more details.
 //#warning "HAVE_AVX2"
 #endif
 
-#if defined(HAVE_AVX) || defined(HAVE_AVX2)
+// Set by PGFFT_avx2.cpp, whose target pragma does not define the macros
+#ifdef PGFFT_VARIANT_AVX2
+#define HAVE_AVX
+#define HAVE_AVX2
+#endif
+
+// On AArch64, NEON (always there) holds a PD4 in two 128-bit registers
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define HAVE_NEON
+#endif
+
+#if defined(HAVE_AVX) || defined(HAVE_AVX2) || defined(HAVE_NEON)
 #define USE_PD4
 #endif
 
+#if defined(HAVE_AVX2) || defined(HAVE_NEON)
+#define HAVE_PD4_FMA
+#endif
+
+#endif
+
+// PGFFT_avx2.cpp compiles this file again with AVX2 and FMA enabled, and
+// PGFFT_VARIANT=pgfft_avx2 putting the transforms in that namespace. A
+// build for an older baseline calls them on the CPUs that have AVX2 and FMA.
+#if !defined(PGFFT_VARIANT) && !defined(HAVE_AVX2) && \
+    !defined(PGFFT_DISABLE_SIMD) && !defined(HELIB_NO_NATIVE_SIMD) && \
+    defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PGFFT_DISPATCH_AVX2
 #endif
 
 
@@ -61,10 +85,18 @@ See below for more details.
 #include <cstdlib>
 #include <limits>
 
-#ifdef USE_PD4
+#if defined(USE_PD4) && !defined(HAVE_NEON)
 #include <immintrin.h>
 #endif
 
+#ifdef HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef PGFFT_DISPATCH_AVX2
+#include "simdKernels.h"
+#endif
+
 namespace helib {
 
 using std::vector;
@@ -77,12 +109,34 @@ typedef complex<double> cmplx_t;
 typedef long double ldbl;
 //typedef double ldbl;
 
-#ifdef USE_PD4
+#ifndef PGFFT_VARIANT
+#if defined(USE_PD4)
 bool PGFFT::simd_enabled() { return true; }
+#elif defined(PGFFT_DISPATCH_AVX2)
+bool PGFFT::simd_enabled() { return simd::haveAVX2(); }
 #else
 bool PGFFT::simd_enabled() { return false; }
 #endif
 
+const char *PGFFT::simd_name()
+{
+#if defined(HAVE_AVX2)
+   return "avx2-fma";
+#elif defined(HAVE_NEON)
+   return "neon";
+#else
+#if defined(PGFFT_DISPATCH_AVX2)
+   if (simd::haveAVX2()) return "avx2-fma";
+#endif
+#if defined(HAVE_AVX)
+   return "avx";
+#else
+   return "generic";
+#endif
+#endif
+}
+#endif
+
 
 #if (PGFFT_USE_EXPLICIT_MUL)
 
@@ -127,7 +181,10 @@ CMUL(cmplx_t a, cmplx_t b)
 
 **************************************************************/
 
-#ifdef USE_PD4
+#ifndef PGFFT_VARIANT
+
+// The AVX2 transforms need the alignment too
+#if defined(USE_PD4) || defined(PGFFT_DISPATCH_AVX2)
 
 #define PGFFT_ALIGN (64)
 
@@ -182,13 +239,17 @@ PGFFT::aligned_deallocate(void *p)
 
 #endif
 
+#endif // PGFFT_VARIANT
+
 /**************************************************************
 
    Packed Double abstraction layer
 
 **************************************************************/
 
-
+#ifdef PGFFT_VARIANT
+namespace PGFFT_VARIANT {
+#endif
 
 namespace {
 
@@ -196,7 +257,7 @@ namespace {
 
 //=================== PD4 implementation ===============
 
-#if defined(USE_PD4)
+#if defined(USE_PD4) && !defined(HAVE_NEON)
 
 struct PD4 {
    __m256d data;
@@ -303,7 +364,7 @@ inline PD4&
 operator/=(PD4& a, PD4 b)
 { a = a / b; return a; }
 
-#ifdef HAVE_AVX2
+#ifdef HAVE_PD4_FMA
 
 // a*b+c (fused)
 inline PD4
@@ -341,6 +402,169 @@ fmsubadd(PD4 a, PD4 b, PD4 c)
 #endif
 
 
+#endif
+
+
+//=================== PD4 implementation (NEON) ===============
+
+#if defined(HAVE_NEON)
+
+// Slots 0,1 in lo and 2,3 in hi. The permutations of the AVX version all
+// stay within 128-bit lanes, so each of them is one instruction per half.
+struct PD4 {
+   float64x2_t lo, hi;
+
+
+   PD4() = default;
+   PD4(double x) : lo(vdupq_n_f64(x)), hi(vdupq_n_f64(x)) { }
+   PD4(float64x2_t _lo, float64x2_t _hi) : lo(_lo), hi(_hi) { }
+   PD4(double d0, double d1, double d2, double d3)
+   {
+      const double d[4] = { d0, d1, d2, d3 };
+      lo = vld1q_f64(d);
+      hi = vld1q_f64(d+2);
+   }
+
+   static PD4 load(const double *p)
+   { return PD4(vld1q_f64(p), vld1q_f64(p+2)); }
+
+   // load from unaligned address (NEON loads need no alignment)
+   static PD4 loadu(const double *p) { return load(p); }
+};
+
+inline void
+load(PD4& x, const double *p)
+{ x = PD4::load(p); }
+
+// load from unaligned address
+inline void
+loadu(PD4& x, const double *p)
+{ x = PD4::loadu(p); }
+
+inline void
+store(double *p, PD4 a)
+{ vst1q_f64(p, a.lo); vst1q_f64(p+2, a.hi); }
+
+// store to unaligned address
+inline void
+storeu(double *p, PD4 a)
+{ store(p, a); }
+
+
+// swap even/odd slots
+// e.g., 0123 -> 1032
+inline PD4
+swap2(PD4 a)
+{ return PD4(vextq_f64(a.lo, a.lo, 1), vextq_f64(a.hi, a.hi, 1)); }
+
+// 0123 -> 0022
+inline PD4
+dup2even(PD4 a)
+{ return PD4(vtrn1q_f64(a.lo, a.lo), vtrn1q_f64(a.hi, a.hi)); }
+
+// 0123 -> 1133
+inline PD4
+dup2odd(PD4 a)
+{ return PD4(vtrn2q_f64(a.lo, a.lo), vtrn2q_f64(a.hi, a.hi)); }
+
+// blend even/odd slots
+// 0123, 4567 -> 0527
+inline PD4
+blend2(PD4 a, PD4 b)
+{
+   return PD4(vcopyq_laneq_f64(a.lo, 1, b.lo, 1),
+              vcopyq_laneq_f64(a.hi, 1, b.hi, 1));
+}
+
+// 0123, 4567 -> 0426
+inline PD4
+blend_even(PD4 a, PD4 b)
+{ return PD4(vzip1q_f64(a.lo, b.lo), vzip1q_f64(a.hi, b.hi)); }
+
+
+// 0123, 4567 -> 1537
+inline PD4
+blend_odd(PD4 a, PD4 b)
+{ return PD4(vzip2q_f64(a.lo, b.lo), vzip2q_f64(a.hi, b.hi)); }
+
+
+inline void
+clear(PD4& x)
+{ x.lo = x.hi = vdupq_n_f64(0); }
+
+inline PD4
+operator+(PD4 a, PD4 b)
+{ return PD4(vaddq_f64(a.lo, b.lo), vaddq_f64(a.hi, b.hi)); }
+
+inline PD4
+operator-(PD4 a, PD4 b)
+{ return PD4(vsubq_f64(a.lo, b.lo), vsubq_f64(a.hi, b.hi)); }
+
+inline PD4
+operator*(PD4 a, PD4 b)
+{ return PD4(vmulq_f64(a.lo, b.lo), vmulq_f64(a.hi, b.hi)); }
+
+inline PD4
+operator/(PD4 a, PD4 b)
+{ return PD4(vdivq_f64(a.lo, b.lo), vdivq_f64(a.hi, b.hi)); }
+
+inline PD4&
+operator+=(PD4& a, PD4 b)
+{ a = a + b; return a; }
+
+inline PD4&
+operator-=(PD4& a, PD4 b)
+{ a = a - b; return a; }
+
+inline PD4&
+operator*=(PD4& a, PD4 b)
+{ a = a * b; return a; }
+
+inline PD4&
+operator/=(PD4& a, PD4 b)
+{ a = a / b; return a; }
+
+// a*b+c (fused)
+inline PD4
+fused_muladd(PD4 a, PD4 b, PD4 c)
+{ return PD4(vfmaq_f64(c.lo, a.lo, b.lo), vfmaq_f64(c.hi, a.hi, b.hi)); }
+
+// a*b-c (fused)
+inline PD4
+fused_mulsub(PD4 a, PD4 b, PD4 c)
+{
+   return PD4(vfmaq_f64(vnegq_f64(c.lo), a.lo, b.lo),
+              vfmaq_f64(vnegq_f64(c.hi), a.hi, b.hi));
+}
+
+// -a*b+c (fused)
+inline PD4
+fused_negmuladd(PD4 a, PD4 b, PD4 c)
+{ return PD4(vfmsq_f64(c.lo, a.lo, b.lo), vfmsq_f64(c.hi, a.hi, b.hi)); }
+
+// (a0,a1,a2,a3), (b0,b1,b2,b3), (c0,c1,c2,c3) ->
+// (a0*b0-c0, a1*b1+c1, a2*b2-c2, a3*b3+c3)
+// Negating the even slots of c is exact, so this is still one rounding
+inline PD4
+fmaddsub(PD4 a, PD4 b, PD4 c)
+{
+   const double s[2] = { -1.0, 1.0 };
+   float64x2_t sign = vld1q_f64(s);
+   return PD4(vfmaq_f64(vmulq_f64(c.lo, sign), a.lo, b.lo),
+              vfmaq_f64(vmulq_f64(c.hi, sign), a.hi, b.hi));
+}
+
+// (a0,a1,a2,a3), (b0,b1,b2,b3), (c0,c1,c2,c3) ->
+// (a0*b0+c0, a1*b1-c1, a2*b2+c2, a3*b3-c3)
+inline PD4
+fmsubadd(PD4 a, PD4 b, PD4 c)
+{
+   const double s[2] = { 1.0, -1.0 };
+   float64x2_t sign = vld1q_f64(s);
+   return PD4(vfmaq_f64(vmulq_f64(c.lo, sign), a.lo, b.lo),
+              vfmaq_f64(vmulq_f64(c.hi, sign), a.hi, b.hi));
+}
+
 #endif
 
 }
@@ -513,7 +737,7 @@ do  \
 
 #ifdef USE_PD4
 
-#ifdef HAVE_AVX2
+#ifdef HAVE_PD4_FMA
 
 static inline PD4
 complex_mul(PD4 ab, PD4 cd)
@@ -1293,9 +1517,9 @@ pow2_precomp(long n, vector<long>& rev, vector<long>& rev1, vector<aligned_vecto
 static void
 pow2_comp(const cmplx_t* src, cmplx_t* dst,
                   long n, long k, const vector<long>& rev, const vector<long>& rev1,
-                  const vector<aligned_vector<cmplx_t>>& tab)
+                  const vector<aligned_vector<cmplx_t>>& tab,
+                  aligned_vector<cmplx_t>& x)
 {
-   aligned_vector<cmplx_t> x;
    x.assign(src, src+n);
 
    new_fft(&x[0], k, tab);
@@ -1360,11 +1584,12 @@ static void
 bluestein_comp(const cmplx_t* src, cmplx_t* dst,
                   long n, long k, const aligned_vector<cmplx_t>& powers,
                   const aligned_vector<cmplx_t>& Rb,
-                  const vector<aligned_vector<cmplx_t>>& tab)
+                  const vector<aligned_vector<cmplx_t>>& tab,
+                  aligned_vector<cmplx_t>& x)
 {
    long N = 1L << k;
 
-   aligned_vector<cmplx_t> x(N);
+   x.resize(N);
 
    for (long i = 0; i < n; i++)
       x[i] = MUL(src[i], powers[i]);
@@ -1462,11 +1687,12 @@ static void
 bluestein_comp1(const cmplx_t* src, cmplx_t* dst,
                   long n, long k, const aligned_vector<cmplx_t>& powers,
                   const aligned_vector<cmplx_t>& Rb,
-                  const vector<aligned_vector<cmplx_t>>& tab)
+                  const vector<aligned_vector<cmplx_t>>& tab,
+                  aligned_vector<cmplx_t>& x)
 {
    long N = 1L << k;
 
-   aligned_vector<cmplx_t> x(N);
+   x.resize(N);
 
    for (long i = 0; i < n; i++)
       x[i] = MUL(src[i], powers[i]);
@@ -1518,30 +1744,35 @@ static long choose_strategy(long n)
    return PGFFT_STRATEGY_TBLUE;
 }
 
-PGFFT::PGFFT(long n_)
+// The transform of src into dst, as in PGFFT::apply. It is external in the
+// AVX2 build, for the generic one to call.
+#ifndef PGFFT_VARIANT
+static
+#endif
+void apply_strategy(long strategy, const cmplx_t* src, cmplx_t* dst,
+                    long n, long k,
+                    const vector<long>& rev, const vector<long>& rev1,
+                    const aligned_vector<cmplx_t>& powers,
+                    const aligned_vector<cmplx_t>& Rb,
+                    const vector<aligned_vector<cmplx_t>>& tab,
+                    aligned_vector<cmplx_t>& x)
 {
-   assert(n_ > 0);
-   n = n_;
-
-   strategy = choose_strategy(n);
-
-   //std::cout << strategy << "\n";
-
    switch (strategy) {
 
    case PGFFT_STRATEGY_NULL:
+      if (dst != src) dst[0] = src[0];
       break;
 
    case PGFFT_STRATEGY_POW2:
-      k = pow2_precomp(n, rev, rev1, tab);
+      pow2_comp(src, dst, n, k, rev, rev1, tab, x);
       break;
 
    case PGFFT_STRATEGY_BLUE:
-      k = bluestein_precomp(n, powers, Rb, tab);
+      bluestein_comp(src, dst, n, k, powers, Rb, tab, x);
       break;
 
    case PGFFT_STRATEGY_TBLUE:
-      k = bluestein_precomp1(n, powers, Rb, tab);
+      bluestein_comp1(src, dst, n, k, powers, Rb, tab, x);
       break;
 
    default: ;
@@ -1549,23 +1780,46 @@ PGFFT::PGFFT(long n_)
    }
 }
 
-void PGFFT::apply(const cmplx_t* src, cmplx_t* dst) const
+#ifdef PGFFT_VARIANT
+} // namespace PGFFT_VARIANT
+#else
+
+#ifdef PGFFT_DISPATCH_AVX2
+namespace pgfft_avx2 {
+void apply_strategy(long strategy, const cmplx_t* src, cmplx_t* dst,
+                    long n, long k,
+                    const vector<long>& rev, const vector<long>& rev1,
+                    const aligned_vector<cmplx_t>& powers,
+                    const aligned_vector<cmplx_t>& Rb,
+                    const vector<aligned_vector<cmplx_t>>& tab,
+                    aligned_vector<cmplx_t>& x);
+}
+#endif
+
+PGFFT::PGFFT(long n_)
 {
+   assert(n_ > 0);
+   n = n_;
+
+   strategy = choose_strategy(n);
+
+   //std::cout << strategy << "\n";
+
    switch (strategy) {
 
    case PGFFT_STRATEGY_NULL:
       break;
 
    case PGFFT_STRATEGY_POW2:
-      pow2_comp(src, dst, n, k, rev, rev1, tab);
+      k = pow2_precomp(n, rev, rev1, tab);
       break;
 
    case PGFFT_STRATEGY_BLUE:
-      bluestein_comp(src, dst, n, k, powers, Rb, tab);
+      k = bluestein_precomp(n, powers, Rb, tab);
       break;
 
    case PGFFT_STRATEGY_TBLUE:
-      bluestein_comp1(src, dst, n, k, powers, Rb, tab);
+      k = bluestein_precomp1(n, powers, Rb, tab);
       break;
 
    default: ;
@@ -1573,6 +1827,35 @@ void PGFFT::apply(const cmplx_t* src, cmplx_t* dst) const
    }
 }
 
+void PGFFT::apply(const cmplx_t* src, cmplx_t* dst) const
+{
+   aligned_vector<cmplx_t> x;
+   apply(src, dst, x);
+}
+
+void PGFFT::apply_many(const cmplx_t* src, cmplx_t* dst, long count) const
+{
+   // one workspace for the whole batch
+   aligned_vector<cmplx_t> x;
+   for (long j = 0; j < count; j++)
+      apply(src + j*n, dst + j*n, x);
+}
+
+void PGFFT::apply(const cmplx_t* src, cmplx_t* dst,
+                  aligned_vector<cmplx_t>& x) const
+{
+#ifdef PGFFT_DISPATCH_AVX2
+   if (simd::haveAVX2()) {
+      pgfft_avx2::apply_strategy(strategy, src, dst, n, k, rev, rev1,
+                                 powers, Rb, tab, x);
+      return;
+   }
+#endif
+   apply_strategy(strategy, src, dst, n, k, rev, rev1, powers, Rb, tab, x);
+}
+
+#endif // PGFFT_VARIANT
+
 }
 
 
@@ -0,0 +1,55 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* PGFFT_avx2.cpp - the transforms of PGFFT.cpp compiled with AVX2 and FMA,
+ * for PGFFT::apply to call when the CPU running it has them. There is
+ * nothing to compile when the whole library is already built for AVX2 and
+ * FMA, or not for x86-64.
+ *
+ * The instructions are enabled by a pragma after the headers, rather than
+ * by -mavx2 -mfma for the file: the inline functions of the headers (of
+ * std::vector, say) are then compiled for the baseline, as the linker may
+ * keep this copy of them for the whole library.
+ */
+#if !defined(PGFFT_DISABLE_SIMD) && !defined(HELIB_NO_NATIVE_SIMD) &&         \
+    defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) &&        \
+    !(defined(__AVX2__) && defined(__FMA__))
+
+#include <helib/PGFFT.h>
+#include <cassert>
+#include <cstdlib>
+#include <limits>
+#include <immintrin.h>
+
+// The tables are computed by the generic build, so its precomputation
+// routines are not used here
+#pragma GCC diagnostic ignored "-Wunused-function"
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))),             \
+                             apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+#define PGFFT_VARIANT pgfft_avx2
+#define PGFFT_VARIANT_AVX2
+#include "PGFFT.cpp"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
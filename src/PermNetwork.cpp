@@ -9,14 +9,53 @@
  * See the License for the specific language governing permissions and
  * limitations under the License. See accompanying LICENSE file.
  */
+#include <cstdint>
+#include <mutex>
+
 #include <NTL/ZZ.h>
+#include <NTL/BasicThreadPool.h>
 #include <helib/Context.h>
 #include <helib/Ctxt.h>
 #include <helib/permutations.h>
 #include <helib/EncryptedArray.h>
+#include <helib/timing.h>
+
+#include "binio.h"
 
 namespace helib {
 
+// One mask of a layer, already rotated by the automorphism X -> X^k of its
+// shift: rotating then multiplying by the rotated mask is the same as
+// multiplying by the mask then rotating, as the original code did
+struct PermNetMask
+{
+  long shamt; // the shift of the slots selected by the mask
+  long k;     // X -> X^k is that shift, k = 1 when there is none
+  FatEncodedPtxt mask;
+};
+
+// The masks of all the layers, for the EncryptedArray with id eaId. A set
+// is never changed once built, so it can be read without holding the lock
+struct PermNetwork::Masks
+{
+  unsigned long eaId = 0;
+  std::vector<std::vector<PermNetMask>> layers;
+};
+
+struct PermNetwork::MaskCache
+{
+  std::mutex mutex; // guards the build
+  std::shared_ptr<const Masks> built;
+};
+
+PermNetwork::PermNetwork() : masks(std::make_shared<MaskCache>()) {}
+
+PermNetwork::PermNetwork(const Permut& pi, const GeneratorTrees& trees) :
+    masks(std::make_shared<MaskCache>())
+{
+  buildNetwork(pi, trees);
+}
+
 std::ostream& operator<<(std::ostream& s, const PermNetwork& net)
 {
   s << "[";
@@ -76,6 +115,7 @@ void PermNetwork::setLayers4Leaf(long lyrIdx,
 // Build a full permutation network
 void PermNetwork::buildNetwork(const Permut& pi, const GeneratorTrees& trees)
 {
+  masks = std::make_shared<MaskCache>(); // any copies keep the old masks
   if (trees.numTrees() == 0) { // the identity permutation, nothing to do
     layers.SetLength(0);
     return;
@@ -213,12 +253,19 @@ static std::pair<long, bool> makeMask(std::vector<bool>& mask,
   return std::make_pair(fstNonZeroIdx, found);
 }
 
-// Apply a permutation network to a ciphertext
-void PermNetwork::applyToCtxt(Ctxt& c, const EncryptedArray& ea) const
+std::shared_ptr<const PermNetwork::Masks> PermNetwork::getMasks(
+    const EncryptedArray& ea) const
 {
-  const PAlgebra& al = ea.getPAlgebra();
+  std::lock_guard<std::mutex> lock(masks->mutex);
+  if (masks->built && masks->built->eaId == ea.getId())
+    return masks->built;
 
-  // Apply the layers, one at a time
+  // A new set, so that the callers still using the old one are unaffected
+  auto result = std::make_shared<Masks>();
+  result->eaId = ea.getId();
+  const PAlgebra& al = ea.getPAlgebra();
+  const IndexSet allPrimes = ea.getContext().fullPrimes();
+  result->layers.assign(layers.length(), std::vector<PermNetMask>());
   for (long i = 0; i < layers.length(); i++) {
     const PermNetLayer& lyr = layers[i];
     if (lyr.isID)
@@ -227,35 +274,210 @@ void PermNetwork::applyToCtxt(Ctxt& c, const EncryptedArray& ea) const
     // This layer is shifted via powers of g^e mod m
     long g2e = NTL::PowerMod(al.ZmStarGen(lyr.genIdx), lyr.e, al.getM());
 
+    // The masks of the shift amounts, in the order they are found
+    std::vector<std::vector<bool>> slotMasks;
+    std::vector<PermNetMask>& terms = result->layers[i];
     NTL::Vec<long> unused = lyr.shifts;          // copy to a new vector
     std::vector<bool> mask(lyr.shifts.length()); // buffer to hold masks
-    Ctxt sum(c.getPubKey(), c.getPtxtSpace());   // an empty ciphertext
-
     long shamt = 0;
-    bool frst = true;
     while (true) {
       std::pair<long, bool> ret = makeMask(mask, unused, shamt); // compute mask
       if (ret.second) { // non-empty mask
-        Ctxt tmp = c;
-        EncodedPtxt maskPoly;
-        ea.encode(maskPoly, mask);    // encode mask as polynomial
-        tmp.multByConstant(maskPoly); // multiply by mask
-        if (shamt != 0)               // rotate if the shift amount is nonzero
-          tmp.smartAutomorph(NTL::PowerMod(g2e, shamt, al.getM()));
-        if (frst) {
-          sum = tmp;
-          frst = false;
-        } else
-          sum += tmp;
+        long k = shamt == 0 ? 1 : NTL::PowerMod(g2e, shamt, al.getM());
+        terms.push_back(PermNetMask{shamt, k, FatEncodedPtxt()});
+        slotMasks.push_back(mask);
       }
       if (ret.first >= 0)
         shamt = unused[ret.first]; // next shift amount to use
-
       else
         break; // unused is all-zero, done with this layer
     }
-    c = sum; // update the ciphertext c before the next layer
+
+    NTL_EXEC_RANGE(long(terms.size()), first, last)
+    for (long j = first; j < last; j++) {
+      EncodedPtxt maskPoly;
+      ea.encode(maskPoly, slotMasks[j]); // encode mask as polynomial
+      terms[j].mask.expand(maskPoly, allPrimes);
+      if (terms[j].k != 1)
+        terms[j].mask.automorph(terms[j].k);
+    }
+    NTL_EXEC_RANGE_END
+  }
+  masks->built = result;
+  return result;
+}
+
+// Apply a permutation network to a ciphertext
+void PermNetwork::applyToCtxt(Ctxt& c, const EncryptedArray& ea) const
+{
+  HELIB_TIMER_START;
+  if (c.isEmpty())
+    return;
+  std::shared_ptr<const Masks> cache = getMasks(ea);
+
+  // Apply the layers, one at a time
+  for (long i = 0; i < layers.length(); i++) {
+    const std::vector<PermNetMask>& terms = cache->layers[i];
+    if (terms.empty())
+      continue; // this layer is the identity permutation
+
+    // The rotations of the layer, sharing one digit decomposition of c
+    std::vector<long> ks;
+    for (const PermNetMask& term : terms)
+      if (term.shamt != 0)
+        ks.push_back(term.k);
+    std::vector<Ctxt> rotated;
+    if (!ks.empty())
+      c.hoistedAutomorphs(ks, rotated);
+
+    // Line each rotation up with its term, then multiply by the masks
+    std::vector<Ctxt> products;
+    products.reserve(terms.size());
+    long next = 0;
+    for (const PermNetMask& term : terms) {
+      if (term.shamt == 0)
+        products.push_back(c);
+      else
+        products.push_back(std::move(rotated[next++]));
+    }
+
+    NTL_EXEC_RANGE(long(terms.size()), first, last)
+    for (long j = first; j < last; j++)
+      products[j].multByConstant(terms[j].mask);
+    NTL_EXEC_RANGE_END
+
+    Ctxt sum = std::move(products[0]);
+    for (std::size_t j = 1; j < products.size(); j++)
+      sum += products[j];
+    c = std::move(sum); // update the ciphertext c before the next layer
+  }
+}
+
+static void writeMask(std::ostream& str, const FatEncodedPtxt& mask)
+{
+  write_raw_int(str, mask.isCKKS());
+  if (mask.isBGV()) {
+    const FatEncodedPtxt_BGV& bgv = mask.getBGV();
+    bgv.getDCRT().writeTo(str);
+    write_raw_int(str, bgv.getPtxtSpace());
+    write_raw_double(str, bgv.getSize());
+  } else {
+    const FatEncodedPtxt_CKKS& ckks = mask.getCKKS();
+    ckks.getDCRT().writeTo(str);
+    write_raw_double(str, ckks.getMag());
+    write_raw_double(str, ckks.getScale());
+    write_raw_double(str, ckks.getErr());
+  }
+}
+
+static void readMask(std::istream& str, FatEncodedPtxt& mask, const Context& c)
+{
+  bool ckks = read_raw_int(str);
+  assertEq<IOError>(ckks, c.isCKKS(), "PermNetwork: mask of another scheme");
+  DoubleCRT dcrt = DoubleCRT::readFrom(str, c);
+  if (!ckks) {
+    long ptxtSpace = read_raw_int(str);
+    double size = read_raw_double(str);
+    mask.resetBGV(dcrt, ptxtSpace, size);
+  } else {
+    double mag = read_raw_double(str);
+    double scale = read_raw_double(str);
+    double err = read_raw_double(str);
+    mask.resetCKKS(dcrt, mag, scale, err);
+  }
+}
+
+void PermNetwork::writeTo(std::ostream& str, const EncryptedArray& ea) const
+{
+  std::shared_ptr<const Masks> cache = getMasks(ea);
+
+  writeEyeCatcher(str, EyeCatcher::PERMNET_BEGIN);
+  write_raw_int(str, ea.getContext().fingerprint());
+  write_raw_int(str, ea.size());
+  write_raw_int(str, layers.length());
+  for (long i = 0; i < layers.length(); i++) {
+    const PermNetLayer& lyr = layers[i];
+    write_raw_int(str, lyr.genIdx);
+    write_raw_int(str, lyr.e);
+    write_raw_int(str, lyr.isID);
+    write_ntl_vec_long(str, lyr.shifts);
+
+    const std::vector<PermNetMask>& terms = cache->layers[i];
+    write_raw_int(str, terms.size());
+    for (const PermNetMask& term : terms) {
+      write_raw_int(str, term.shamt);
+      write_raw_int(str, term.k);
+      writeMask(str, term.mask);
+    }
+  }
+  writeEyeCatcher(str, EyeCatcher::PERMNET_END);
+}
+
+PermNetwork PermNetwork::readFrom(std::istream& str, const EncryptedArray& ea)
+{
+  HELIB_TIMER_START;
+  const Context& context = ea.getContext();
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::PERMNET_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find pre-permnet eye catcher");
+  unsigned long fingerprint = read_raw_int(str);
+  assertEq<IOError>(fingerprint,
+                    context.fingerprint(),
+                    "PermNetwork: written for a different context");
+  assertEq<IOError>(long(read_raw_int(str)),
+                    ea.size(),
+                    "PermNetwork: written for a different EncryptedArray");
+
+  PermNetwork net;
+  long depth = read_raw_int(str);
+  assertTrue<IOError>(depth >= 0, "PermNetwork: bad depth");
+  net.layers.SetLength(depth);
+  auto masks = std::make_shared<Masks>();
+  masks->eaId = ea.getId();
+  masks->layers.resize(depth);
+  for (long i = 0; i < depth; i++) {
+    PermNetLayer& lyr = net.layers[i];
+    lyr.genIdx = read_raw_int(str);
+    assertInRange<IOError>(lyr.genIdx,
+                           0l,
+                           ea.getPAlgebra().numOfGens(),
+                           "PermNetwork: bad generator",
+                           true);
+    lyr.e = read_raw_int(str);
+    lyr.isID = read_raw_int(str);
+    read_ntl_vec_long(str, lyr.shifts);
+
+    std::vector<PermNetMask>& terms = masks->layers[i];
+    long n = read_raw_int(str);
+    assertTrue<IOError>(n >= 0 && n <= lyr.shifts.length() + 1,
+                        "PermNetwork: bad number of masks");
+    terms.resize(n);
+    for (PermNetMask& term : terms) {
+      term.shamt = read_raw_int(str);
+      term.k = read_raw_int(str);
+      assertTrue<IOError>(ea.getPAlgebra().inZmStar(term.k),
+                          "PermNetwork: bad automorphism");
+      readMask(str, term.mask, context);
+    }
+  }
+  eyeCatcherFound = readEyeCatcher(str, EyeCatcher::PERMNET_END);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-permnet eye catcher");
+  net.masks->built = std::move(masks);
+  return net;
+}
+
+unsigned long permutationHash(const Permut& pi)
+{
+  std::uint64_t hash = 14695981039346656037ULL; // FNV-1a offset basis
+  for (long i = 0; i < pi.length(); i++) {
+    std::uint64_t entry = pi[i];
+    for (int byte = 0; byte < 8; byte++) {
+      hash ^= (entry >> (8 * byte)) & 0xff;
+      hash *= 1099511628211ULL; // FNV-1a prime
+    }
   }
+  return hash;
 }
 
 } // namespace helib
@@ -14,6 +14,7 @@
 #include <helib/exceptions.h>
 #include <NTL/ZZX.h>
 #include <NTL/ZZ_p.h>
+#include <NTL/lzz_pX.h>
 #include <vector>
 #include <helib/NumbTh.h>
 
@@ -21,6 +22,22 @@
 
 namespace helib {
 
+namespace {
+
+// Whether a and b are both constants of a ring whose p^r fits in a word, as
+// every slot is when d == 1, so that they can be operated on as longs.
+bool wordConstants(const NTL::ZZX& a,
+                   const NTL::ZZX& b,
+                   const PolyModRing& ring)
+{
+  return ring.singlePrecision && NTL::deg(a) <= 0 && NTL::deg(b) <= 0;
+}
+
+// The (reduced) constant term of a as a long
+long word(const NTL::ZZX& a) { return NTL::conv<long>(NTL::ConstTerm(a)); }
+
+} // namespace
+
 PolyMod::PolyMod() : ringDescriptor(nullptr) {}
 PolyMod::PolyMod(const std::shared_ptr<PolyModRing>& ringDescriptor) :
     PolyMod(NTL::ZZX(0), ringDescriptor)
@@ -217,6 +234,13 @@ PolyMod PolyMod::operator-(const NTL::ZZX& rhs) const
 PolyMod& PolyMod::operator*=(const PolyMod& otherPoly)
 {
   assertInterop(*this, otherPoly);
+  if (wordConstants(this->data, otherPoly.data, *ringDescriptor)) {
+    NTL::conv(this->data,
+              NTL::MulMod(word(this->data),
+                          word(otherPoly.data),
+                          ringDescriptor->p2r));
+    return *this;
+  }
   this->data *= otherPoly.data;
   this->modularReduce();
   return *this;
@@ -241,6 +265,13 @@ PolyMod& PolyMod::operator*=(const NTL::ZZX& otherPoly)
 PolyMod& PolyMod::operator+=(const PolyMod& otherPoly)
 {
   assertInterop(*this, otherPoly);
+  if (wordConstants(this->data, otherPoly.data, *ringDescriptor)) {
+    NTL::conv(this->data,
+              NTL::AddMod(word(this->data),
+                          word(otherPoly.data),
+                          ringDescriptor->p2r));
+    return *this;
+  }
   this->data += otherPoly.data;
   this->modularReduce();
   return *this;
@@ -265,6 +296,13 @@ PolyMod& PolyMod::operator+=(const NTL::ZZX& otherPoly)
 PolyMod& PolyMod::operator-=(const PolyMod& otherPoly)
 {
   assertInterop(*this, otherPoly);
+  if (wordConstants(this->data, otherPoly.data, *ringDescriptor)) {
+    NTL::conv(this->data,
+              NTL::SubMod(word(this->data),
+                          word(otherPoly.data),
+                          ringDescriptor->p2r));
+    return *this;
+  }
   this->data -= otherPoly.data;
   this->modularReduce();
   return *this;
@@ -372,6 +410,20 @@ std::ostream& operator<<(std::ostream& os, const PolyMod& poly)
 
 void PolyMod::modularReduce()
 {
+  const PolyModRing& ring = *ringDescriptor;
+  if (ring.singlePrecision) {
+    if (NTL::deg(this->data) <= 0 && NTL::deg(ring.G) > 0) {
+      // A constant is already reduced modulo G.
+      NTL::conv(this->data, NTL::rem(NTL::ConstTerm(this->data), ring.p2r));
+      return;
+    }
+    NTL::zz_pPush push(ring.zzpContext);
+    NTL::zz_pX poly_mod_p2r;
+    NTL::conv(poly_mod_p2r, this->data);
+    NTL::rem(poly_mod_p2r, poly_mod_p2r, ring.zzpG);
+    NTL::conv(this->data, poly_mod_p2r);
+    return;
+  }
   NTL::ZZ_pContext pContext;
   pContext.save();
   NTL::ZZ_p::init(NTL::ZZ(ringDescriptor->p2r));
@@ -15,8 +15,30 @@
 
 namespace helib {
 
+namespace {
+
+NTL::zz_pX reduceModulus(const NTL::zz_pContext& context,
+                         bool singlePrecision,
+                         const NTL::ZZX& G)
+{
+  NTL::zz_pX result;
+  if (singlePrecision) {
+    NTL::zz_pPush push(context);
+    NTL::conv(result, G);
+  }
+  return result;
+}
+
+} // namespace
+
 PolyModRing::PolyModRing(long p, long r, const NTL::ZZX& G) :
-    p(p), r(r), G(G), p2r(pow(p, r))
+    p(p),
+    r(r),
+    G(G),
+    p2r(pow(p, r)),
+    singlePrecision(p2r > 1 && p2r < NTL_SP_BOUND),
+    zzpContext(singlePrecision ? NTL::zz_pContext(p2r) : NTL::zz_pContext()),
+    zzpG(reduceModulus(zzpContext, singlePrecision, G))
 {}
 
 bool PolyModRing::operator==(const PolyModRing& rhs) const noexcept
@@ -0,0 +1,350 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* PrimeFactorFFT.cpp - prime-factor (Good-Thomas) and Rader transforms
+ * for composite m, and the planner that picks them over Bluestein
+ */
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include <helib/assertions.h>
+#include <helib/timing.h>
+
+#include "PrimeFactorFFT.h"
+
+namespace helib {
+
+bool PrimeFactorFFT::isUseful(long m)
+{
+  NTL::Vec<NTL::Pair<long, long>> factors;
+  factorize(factors, m);
+  return factors.length() > 1 || factors[0].b == 1;
+}
+
+PrimeFactorFFT::PrimeFactorFFT(const PAlgebra& zms, long root) :
+    m(zms.getM()), q(NTL::zz_p::modulus())
+{
+  assertFalse(zms.getPow2() != 0,
+              "PrimeFactorFFT: m must not be a power of two");
+
+  // The prime-power factors, in ascending order, give the coordinates
+  NTL::Vec<NTL::Pair<long, long>> pp;
+  factorize(pp, m);
+  std::vector<std::pair<long, long>> sorted; // (p^e, p)
+  for (long i = 0; i < pp.length(); i++)
+    sorted.emplace_back(NTL::power_long(pp[i].a, pp[i].b), pp[i].a);
+  std::sort(sorted.begin(), sorted.end());
+
+  long nDims = sorted.size();
+  std::vector<long> factors(nDims), primes(nDims), strides(nDims);
+  for (long k = nDims - 1, s = 1; k >= 0; k--) {
+    factors[k] = sorted[k].first;
+    primes[k] = sorted[k].second;
+    strides[k] = s;
+    s *= factors[k];
+  }
+
+  // Coefficient n goes to coordinates n (m/m_k)^{-1} mod m_k, and the
+  // evaluation at index i is found at coordinates i mod m_k
+  inOffset.assign(m, 0);
+  outOffset.assign(m, 0);
+  for (long k = 0; k < nDims; k++) {
+    long mk = factors[k];
+    long t = NTL::InvMod((m / mk) % mk, mk);
+    for (long n = 0; n < m; n++) {
+      inOffset[n] += NTL::MulMod(n % mk, t, mk) * strides[k];
+      outOffset[n] += (n % mk) * strides[k];
+    }
+  }
+
+  long phim = zms.getPhiM();
+  unitIn.resize(phim);
+  unitOut.resize(phim);
+  for (long j = 0; j < phim; j++) {
+    long i = zms.repInZmstar_unchecked(j);
+    unitIn[j] = inOffset[i];
+    unitOut[j] = outOffset[i];
+  }
+
+  buildPasses(forwardPasses, factors, primes, strides, root, true);
+  buildPasses(inversePasses,
+              factors,
+              primes,
+              strides,
+              NTL::InvMod(root, q),
+              false);
+}
+
+// The forward passes go through the coordinates in ascending order, and
+// only the evaluations in Zm* are needed, so the columns that already have
+// a coordinate i_k = 0 mod p_k (k earlier) can be skipped. The inverse
+// passes go in descending order, and the input is zero outside of Zm*, so
+// the columns that still have a coordinate n_k = 0 mod p_k (k earlier, not
+// yet transformed) are zero. Either way, a column along coordinate d is
+// needed iff its coordinates k < d are all units.
+void PrimeFactorFFT::buildPasses(std::vector<Pass>& passes,
+                                 const std::vector<long>& factors,
+                                 const std::vector<long>& primes,
+                                 const std::vector<long>& strides,
+                                 long r,
+                                 bool forward)
+{
+  long nDims = factors.size();
+  long omega = NTL::MulMod(r, r, q); // BluesteinFFT(r) is DFT(r^2)
+
+  passes.resize(nDims);
+  for (long i = 0; i < nDims; i++) {
+    long d = forward ? i : nDims - 1 - i;
+    Pass& pass = passes[i];
+    long L = factors[d];
+    long omegaL = NTL::PowerMod(omega, m / L, q); // of order L
+
+    pass.L = L;
+    pass.stride = strides[d];
+    for (long off = 0; off < m; off++) {
+      if ((off / strides[d]) % L != 0)
+        continue;
+      bool needed = true;
+      for (long k = 0; k < d && needed; k++)
+        needed = ((off / strides[k]) % factors[k]) % primes[k] != 0;
+      if (needed)
+        pass.columns.push_back(off);
+    }
+
+    if (L <= DIRECT_MAX_LENGTH) {
+      pass.kind = Pass::DIRECT;
+      pass.w.resize(L);
+      pass.wPrecon.resize(L);
+      for (long t = 0, w = 1; t < L; t++) {
+        pass.w[t] = w;
+        pass.wPrecon[t] = NTL::PrepMulModPrecon(w, q);
+        w = NTL::MulMod(w, omegaL, q);
+      }
+    } else if (L == primes[d]) {
+      pass.kind = Pass::RADER;
+      long g = primroot(L, L - 1);
+      pass.raderOut.resize(L - 1);
+      pass.raderIn.resize(L - 1);
+      for (long u = 0, gu = 1; u < L - 1; u++) {
+        pass.raderOut[u] = gu;
+        gu = NTL::MulMod(gu, g, L);
+      }
+      for (long v = 0; v < L - 1; v++)
+        pass.raderIn[v] = pass.raderOut[(L - 1 - v) % (L - 1)];
+
+      // When L-1 is a power of two, NTL's FFT computes the cyclic
+      // convolution directly. Otherwise, compute the linear convolution
+      // and fold it.
+      long k = NTL::NextPowerOfTwo(L - 1);
+      pass.cyclic = ((1L << k) == L - 1);
+      pass.k = pass.cyclic ? k : NTL::NextPowerOfTwo(2 * L - 3);
+
+      NTL::zz_pX c;
+      c.rep.SetLength(L - 1);
+      for (long v = 0; v < L - 1; v++)
+        c.rep[v].LoopHole() = NTL::PowerMod(omegaL, pass.raderOut[v], q);
+      c.normalize();
+      pass.kernel.SetSize(pass.k);
+      TofftRep(pass.kernel, c, pass.k);
+    } else {
+      pass.kind = Pass::BLUESTEIN;
+      // BluesteinFFT(rho) is DFT(rho^2), where rho must have order L for
+      // odd L, and order 2L for even L
+      long rho = (L % 2 != 0) ? NTL::PowerMod(omegaL, (L + 1) / 2, q)
+                              : NTL::PowerMod(r, m / L, q);
+      conv(pass.rho, rho);
+      BluesteinInit(L, pass.rho, pass.powers, pass.powers_aux, pass.Rb);
+    }
+  }
+}
+
+static NTL::zz_pX& getScratchColumn()
+{
+  NTL_THREAD_LOCAL static NTL::zz_pX scratch;
+  return scratch;
+}
+
+void PrimeFactorFFT::Pass::apply(long* out, const long* in, long q) const
+{
+  switch (kind) {
+  case DIRECT:
+    for (long i = 0; i < L; i++) {
+      long acc = 0;
+      for (long n = 0, t = 0; n < L; n++) {
+        long prod = NTL::MulModPrecon(in[n], w[t], q, wPrecon[t]);
+        acc = NTL::AddMod(acc, prod, q);
+        t += i;
+        if (t >= L)
+          t -= L;
+      }
+      out[i] = acc;
+    }
+    break;
+
+  case RADER: {
+    long sum = 0;
+    for (long n = 0; n < L; n++)
+      sum = NTL::AddMod(sum, in[n], q);
+
+    NTL::zz_pX& a = getScratchColumn();
+    a.rep.SetLength(L - 1);
+    for (long v = 0; v < L - 1; v++)
+      a.rep[v].LoopHole() = in[raderIn[v]];
+    a.normalize();
+
+    if (!IsZero(a)) {
+      NTL::fftRep& R = Cmodulus::getScratch_fftRep(k);
+      if (cyclic)
+        TofftRep(R, a, k);
+      else
+        TofftRep_trunc(R, a, k, 2 * L - 3);
+      mul(R, R, kernel);
+      FromfftRep(a, R, 0, cyclic ? L - 2 : 2 * L - 4);
+    }
+
+    out[0] = sum;
+    for (long u = 0; u < L - 1; u++) {
+      long c = rep(coeff(a, u));
+      if (!cyclic)
+        c = NTL::AddMod(c, rep(coeff(a, u + L - 1)), q);
+      out[raderOut[u]] = NTL::AddMod(in[0], c, q);
+    }
+    break;
+  }
+
+  case BLUESTEIN: {
+    NTL::zz_pX& a = getScratchColumn();
+    a.rep.SetLength(L);
+    for (long n = 0; n < L; n++)
+      a.rep[n].LoopHole() = in[n];
+    a.normalize();
+
+    BluesteinFFT(a, L, rho, powers, powers_aux, Rb);
+    for (long i = 0; i < L; i++)
+      out[i] = rep(coeff(a, i));
+    break;
+  }
+  }
+}
+
+void PrimeFactorFFT::transform(long* data,
+                               const std::vector<Pass>& passes) const
+{
+  NTL_THREAD_LOCAL static std::vector<long> in, out;
+
+  for (const Pass& pass : passes) {
+    long L = pass.L;
+    long s = pass.stride;
+    in.resize(L);
+    out.resize(L);
+    for (long base : pass.columns) {
+      long* col = data + base;
+      for (long n = 0; n < L; n++)
+        in[n] = col[n * s];
+      pass.apply(out.data(), in.data(), q);
+      for (long n = 0; n < L; n++)
+        col[n * s] = out[n];
+    }
+  }
+}
+
+static std::vector<long>& getScratchData()
+{
+  NTL_THREAD_LOCAL static std::vector<long> scratch;
+  return scratch;
+}
+
+void PrimeFactorFFT::FFT(NTL::vec_long& y, const NTL::zz_pX& x) const
+{
+  HELIB_TIMER_START;
+  std::vector<long>& data = getScratchData();
+  data.assign(m, 0);
+
+  // x is taken mod X^m - 1
+  for (long n = 0; n <= deg(x); n++) {
+    long& d = data[inOffset[n % m]];
+    d = NTL::AddMod(d, rep(x.rep[n]), q);
+  }
+
+  transform(data.data(), forwardPasses);
+
+  long phim = unitOut.size();
+  y.SetLength(phim);
+  for (long j = 0; j < phim; j++)
+    y[j] = data[unitOut[j]];
+}
+
+void PrimeFactorFFT::iFFT(NTL::zz_pX& x, const NTL::vec_long& y) const
+{
+  HELIB_TIMER_START;
+  std::vector<long>& data = getScratchData();
+  data.assign(m, 0);
+
+  long phim = unitIn.size();
+  for (long j = 0; j < phim; j++)
+    data[unitIn[j]] = y[j];
+
+  transform(data.data(), inversePasses);
+
+  x.rep.SetLength(m);
+  for (long n = 0; n < m; n++)
+    x.rep[n].LoopHole() = data[outOffset[n]];
+  x.normalize();
+}
+
+// The best time of a few FFT/iFFT round trips, to filter out noise
+static double timeRoundTrip(const Cmodulus& cm, const NTL::zz_pX& x)
+{
+  constexpr long RUNS = 3;
+
+  NTL::vec_long y;
+  NTL::zz_pX tmp;
+  double best = std::numeric_limits<double>::infinity();
+  for (long i = 0; i < RUNS; i++) {
+    tmp = x;
+    auto start = std::chrono::steady_clock::now();
+    cm.FFT(y, tmp);
+    cm.iFFT(tmp, y);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+FFTEngine planFFTEngine(const PAlgebra& zms, long q)
+{
+  HELIB_TIMER_START;
+  if (zms.getPow2() != 0 || !PrimeFactorFFT::isUseful(zms.getM()))
+    return FFTEngine::BLUESTEIN;
+
+  Cmodulus bluestein(zms, q, 0, FFTEngine::BLUESTEIN);
+  Cmodulus primeFactor(zms, q, 0, FFTEngine::PRIME_FACTOR);
+
+  // Any input will do, but avoid drawing from NTL's PRG
+  NTL::zz_pBak bak;
+  bak.save();
+  bluestein.restoreModulus();
+  NTL::zz_pX x;
+  x.rep.SetLength(zms.getPhiM());
+  for (long i = 0; i < x.rep.length(); i++)
+    x.rep[i] = 1 + i * i;
+  x.normalize();
+
+  double tBluestein = timeRoundTrip(bluestein, x);
+  double tPrimeFactor = timeRoundTrip(primeFactor, x);
+  return (tPrimeFactor < tBluestein) ? FFTEngine::PRIME_FACTOR
+                                     : FFTEngine::BLUESTEIN;
+}
+
+} // namespace helib
@@ -0,0 +1,141 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_PRIMEFACTORFFT_H
+#define HELIB_PRIMEFACTORFFT_H
+/**
+ * @file PrimeFactorFFT.h
+ * @brief Length-m transforms for composite m, using the Good-Thomas
+ * prime-factor mapping and Rader's algorithm for the large prime factors
+ **/
+#include <vector>
+
+#include <NTL/lzz_pX.h>
+
+#include <helib/CModulus.h>
+
+namespace helib {
+
+/**
+ * @class PrimeFactorFFT
+ * @brief The same transforms as BluesteinFFT (evaluation at the powers of
+ * r^2, r the root of a Cmodulus), computed as a multi-dimensional DFT.
+ *
+ * With m = m_1 * ... * m_K the factorization of m into prime powers,
+ * coefficient n is placed at coordinates n_k = n (m/m_k)^{-1} mod m_k and
+ * the evaluation at index i is read from coordinates i mod m_k (the
+ * Good-Thomas mapping), which turns the length-m DFT into length-m_k DFTs
+ * along each coordinate, with no twiddle factors in between. The
+ * one-dimensional DFTs are computed directly when m_k is small, with
+ * Rader's algorithm (a cyclic convolution of length m_k - 1) when m_k is a
+ * larger prime, and with Bluestein's algorithm otherwise.
+ *
+ * The transforms are also truncated: the forward direction only computes
+ * the evaluations in Zm*, and so skips the columns of the later passes
+ * that lie in a slice i_k = 0 mod p_k. Similarly, the input of the inverse
+ * direction is zero outside of Zm*, so the columns of the earlier passes
+ * that lie in a slice n_k = 0 mod p_k are skipped.
+ *
+ * The tables are relative to the NTL zz_p modulus that is current at
+ * construction, which must also be current when calling FFT and iFFT.
+ **/
+class PrimeFactorFFT
+{
+public:
+  //! Prime-power factors up to this length use the quadratic-time DFT
+  static constexpr long DIRECT_MAX_LENGTH = 16;
+
+  //! @brief Can this be faster than a single Bluestein transform? This is
+  //! the case unless m is a prime power p^e with e > 1
+  static bool isUseful(long m);
+
+  /**
+   * @brief Build the tables
+   * @param zms The structure of Zm*, m must not be a power of two
+   * @param root A primitive m-th root of unity (if m is odd) or 2m-th root
+   * of unity (if m is even), as in Cmodulus
+   **/
+  PrimeFactorFFT(const PAlgebra& zms, long root);
+
+  //! @brief y = the evaluations of x at the powers of root^2 in Zm*
+  void FFT(NTL::vec_long& y, const NTL::zz_pX& x) const;
+
+  //! @brief x = the unscaled inverse transform of y (whose entries are the
+  //! evaluations in Zm*), of degree < m and not reduced mod Phi_m(X)
+  void iFFT(NTL::zz_pX& x, const NTL::vec_long& y) const;
+
+private:
+  // A length-L DFT along one coordinate
+  struct Pass
+  {
+    enum Kind
+    {
+      DIRECT,
+      RADER,
+      BLUESTEIN
+    } kind;
+
+    long L;      // the length
+    long stride; // the distance between consecutive entries of a column
+    std::vector<long> columns; // the offsets of the columns that are needed
+
+    // DIRECT: w[t] = omega^t, for omega the root of this coordinate
+    std::vector<long> w;
+    std::vector<NTL::mulmod_precon_t> wPrecon;
+
+    // RADER: for a generator g of Z_L^*, the cyclic convolution of
+    // x[g^{-v}] and omega^{g^v} gives the output at index g^u
+    std::vector<long> raderIn;  // raderIn[v] = g^{-v} mod L
+    std::vector<long> raderOut; // raderOut[u] = g^u mod L
+    long k;                     // log of the size of the FFT
+    bool cyclic;                // is 2^k = L-1, so no folding is needed
+    NTL::fftRep kernel;         // the FFT of omega^{g^v}
+
+    // BLUESTEIN: tables for BluesteinFFT with root rho, rho^2 = omega
+    NTL::zz_p rho;
+    NTL::zz_pX powers;
+    NTL::Vec<NTL::mulmod_precon_t> powers_aux;
+    NTL::fftRep Rb;
+
+    void apply(long* out, const long* in, long q) const;
+  };
+
+  long m;
+  long q;
+
+  std::vector<long> inOffset;  // inOffset[n] = position of coefficient n
+  std::vector<long> outOffset; // outOffset[i] = position of evaluation i
+  std::vector<long> unitIn;    // inOffset[i], for the i's in Zm*
+  std::vector<long> unitOut;   // outOffset[i], for the i's in Zm*
+
+  std::vector<Pass> forwardPasses;
+  std::vector<Pass> inversePasses;
+
+  void buildPasses(std::vector<Pass>& passes,
+                   const std::vector<long>& factors,
+                   const std::vector<long>& primes,
+                   const std::vector<long>& strides,
+                   long r,
+                   bool forward);
+
+  void transform(long* data, const std::vector<Pass>& passes) const;
+};
+
+/**
+ * @brief Choose the engine for the transforms of all the primes of a
+ * Context, by timing an FFT/iFFT round trip modulo q with each option.
+ **/
+FFTEngine planFFTEngine(const PAlgebra& zms, long q);
+
+} // namespace helib
+
+#endif // ifndef HELIB_PRIMEFACTORFFT_H
@@ -673,6 +673,18 @@ Ptxt<BGV>& Ptxt<BGV>::automorph(long k)
                            "Cannot call automorph on default-constructed Ptxt");
   assertTrue<RuntimeError>(context->getZMStar().inZmStar(k),
                            "k must be an element in Zm*");
+  const PAlgebra& zMStar = context->getZMStar();
+  if (context->getOrdP() == 1) {
+    // Every slot is a constant, so the automorphism only moves them: the
+    // slot of t goes to the slot of k * t.
+    std::vector<SlotType> moved_slots(size());
+    for (long i = 0; i < lsize(); ++i) {
+      long t = NTL::MulMod(zMStar.ith_rep(i), k, zMStar.getM());
+      moved_slots[zMStar.indexOfRep(t)] = std::move(slots[i]);
+    }
+    slots = std::move(moved_slots);
+    return *this;
+  }
   NTL::ZZX poly;
   switch (context->getEA().getTag()) {
   case PA_GF2_tag: {
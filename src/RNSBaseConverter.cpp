@@ -0,0 +1,267 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* RNSBaseConverter.cpp - fast RNS base extension
+ */
+#include <helib/Context.h>
+#include <helib/assertions.h>
+
+#include "RNSBaseConverter.h"
+
+namespace helib {
+
+__extension__ typedef unsigned __int128 uint128_t;
+__extension__ typedef __int128 int128_t;
+
+// words = |a| mod 2^128, low word first
+static void low128(unsigned long* words, const NTL::ZZ& a)
+{
+  unsigned char bytes[16];
+  NTL::BytesFromZZ(bytes, a, 16); // little-endian
+  for (long w = 0; w < 2; w++) {
+    words[w] = 0;
+    for (long b = 7; b >= 0; b--)
+      words[w] = (words[w] << 8) | bytes[8 * w + b];
+  }
+}
+
+static uint128_t toUint128(const unsigned long* words)
+{
+  return (uint128_t(words[1]) << 64) | words[0];
+}
+
+RNSBaseConverter::RNSBaseConverter(const Context& context,
+                                   const IndexSet& _from,
+                                   const IndexSet& _to) :
+    from(_from), to(_to)
+{
+  assertTrue(disjoint(from, to),
+             "RNSBaseConverter: the two prime sets must be disjoint");
+
+  for (long k : to)
+    toPrimes.push_back(context.ithPrime(k));
+  init(context);
+}
+
+RNSBaseConverter::RNSBaseConverter(const Context& context,
+                                   const IndexSet& _from,
+                                   const std::vector<long>& moduli) :
+    from(_from), toPrimes(moduli)
+{
+  for (long p : toPrimes)
+    assertInRange(p,
+                  2l,
+                  NTL_SP_BOUND,
+                  "RNSBaseConverter: modulus is not single-precision");
+  init(context);
+}
+
+void RNSBaseConverter::init(const Context& context)
+{
+  NTL::ZZ prod = context.productOfPrimes(from); // Q
+  long nFrom = card(from);
+  long nTo = toPrimes.size();
+
+  fromPrimes.resize(nFrom);
+  qHatInv.resize(nFrom);
+  qHatInvPrecon.resize(nFrom);
+  qRecip.resize(nFrom);
+  toPrimesInv.resize(nTo);
+  toPrimesRed.resize(nTo);
+  qHatModP.resize(nFrom * nTo);
+  qHatModPPrecon.resize(nFrom * nTo);
+  qModP.resize(nTo);
+  qInvModP.resize(nTo);
+  qInvModPPrecon.resize(nTo);
+
+  long j;
+  for (j = 0; j < nTo; j++) {
+    long p = toPrimes[j];
+    toPrimesInv[j] = NTL::PrepMulMod(p);
+    toPrimesRed[j] = NTL::sp_PrepRem(p);
+    qModP[j] = NTL::rem(prod, p);
+    qInvModP[j] = (NTL::GCD(qModP[j], p) == 1) ? NTL::InvMod(qModP[j], p) : 0;
+    qInvModPPrecon[j] = NTL::PrepMulModPrecon(qInvModP[j], p);
+  }
+
+  qBits = NTL::NumBits(prod);
+  qHatMod128.resize(2 * nFrom);
+  low128(qMod128, prod);
+
+  NTL::ZZ qHat;
+  long i = 0;
+  for (long k : from) {
+    long q = context.ithPrime(k);
+    fromPrimes[i] = q;
+    qRecip[i] = 1 / double(q);
+
+    NTL::div(qHat, prod, q); // Q/q_i
+    long t = NTL::InvMod(NTL::rem(qHat, q), q);
+    qHatInv[i] = t;
+    qHatInvPrecon[i] = NTL::PrepMulModPrecon(t, q);
+    low128(&qHatMod128[2 * i], qHat);
+
+    for (j = 0; j < nTo; j++) {
+      long p = toPrimes[j];
+      long r = NTL::rem(qHat, p);
+      qHatModP[j * nFrom + i] = r;
+      qHatModPPrecon[j * nFrom + i] = NTL::PrepMulModPrecon(r, p);
+    }
+    i++;
+  }
+}
+
+void RNSBaseConverter::convert(long* const* out,
+                               const long* const* in,
+                               long first,
+                               long last) const
+{
+  long nFrom = fromPrimes.size();
+  long nTo = toPrimes.size();
+  std::vector<long> y(nFrom);
+
+  for (long h = first; h < last; h++) {
+    // y_i = x_i * (Q/q_i)^{-1} mod q_i, and v = round(sum_i y_i/q_i)
+    double frac = 0.5;
+    for (long i = 0; i < nFrom; i++) {
+      long yi = NTL::MulModPrecon(in[i][h],
+                                  qHatInv[i],
+                                  fromPrimes[i],
+                                  qHatInvPrecon[i]);
+      y[i] = yi;
+      frac += double(yi) * qRecip[i];
+    }
+    long v = long(frac);
+
+    // x mod p_j = sum_i y_i * (Q/q_i) - v * Q mod p_j
+    for (long j = 0; j < nTo; j++) {
+      long p = toPrimes[j];
+      const long* m = &qHatModP[j * nFrom];
+      const NTL::mulmod_precon_t* mPrecon = &qHatModPPrecon[j * nFrom];
+      long acc = 0;
+      for (long i = 0; i < nFrom; i++) {
+        long yi = NTL::rem((unsigned long)y[i], p, toPrimesRed[j]);
+        acc = NTL::AddMod(acc, NTL::MulModPrecon(yi, m[i], p, mPrecon[i]), p);
+      }
+      out[j][h] =
+          NTL::SubMod(acc, NTL::MulMod(v, qModP[j], p, toPrimesInv[j]), p);
+    }
+  }
+}
+
+void RNSBaseConverter::modDownCorrection(long* const* out,
+                                         double* frac,
+                                         long t,
+                                         const long* const* in,
+                                         long first,
+                                         long last) const
+{
+  long nFrom = fromPrimes.size();
+  long nTo = toPrimes.size();
+  std::vector<long> y(nFrom);
+
+  // (Q/q_i) mod t, Q mod t and Q^{-1} mod t, as products of the primes
+  std::vector<long> qHatModT(nFrom, 1);
+  long qModT = 1;
+  long qInvModT = 0;
+  if (t > 1) {
+    for (long i = 0; i < nFrom; i++) {
+      long qi = fromPrimes[i] % t;
+      qModT = NTL::MulMod(qModT, qi, t);
+      for (long k = 0; k < nFrom; k++)
+        if (k != i)
+          qHatModT[k] = NTL::MulMod(qHatModT[k], qi, t);
+    }
+    qInvModT = NTL::InvMod(qModT, t);
+  }
+  long t_over_2 = t / 2;
+  bool t_even = t % 2 == 0;
+
+  for (long h = first; h < last; h++) {
+    double sum = 0;
+    for (long i = 0; i < nFrom; i++) {
+      long yi = NTL::MulModPrecon(in[i][h],
+                                  qHatInv[i],
+                                  fromPrimes[i],
+                                  qHatInvPrecon[i]);
+      y[i] = yi;
+      sum += double(yi) * qRecip[i];
+    }
+    long v = long(sum + 0.5);
+    double f = sum - v; // x/Q
+
+    // c = x Q^{-1} mod t, balanced with ties going against the sign of x,
+    // as in DoubleCRT::scaleDownToSet
+    long c = 0;
+    if (t > 1) {
+      long xModT = 0;
+      for (long i = 0; i < nFrom; i++)
+        xModT =
+            NTL::AddMod(xModT, NTL::MulMod(y[i] % t, qHatModT[i], t), t);
+      xModT = NTL::SubMod(xModT, NTL::MulMod(v % t, qModT, t), t);
+      c = NTL::MulMod(xModT, qInvModT, t);
+      if (c > t_over_2 ||
+          (t_even && c == t_over_2 &&
+           (f < 0 || (f == 0 && NTL::RandomBnd(2)))))
+        c -= t;
+    }
+    frac[h] = f - c;
+
+    // delta mod p_j = x - c*Q = sum_i y_i * (Q/q_i) - (v + c) * Q mod p_j
+    for (long j = 0; j < nTo; j++) {
+      long p = toPrimes[j];
+      const long* m = &qHatModP[j * nFrom];
+      const NTL::mulmod_precon_t* mPrecon = &qHatModPPrecon[j * nFrom];
+      long acc = 0;
+      for (long i = 0; i < nFrom; i++) {
+        long yi = NTL::rem((unsigned long)y[i], p, toPrimesRed[j]);
+        acc = NTL::AddMod(acc, NTL::MulModPrecon(yi, m[i], p, mPrecon[i]), p);
+      }
+      long vc = v + c;
+      vc = (vc < 0) ? vc + p : vc; // |v + c| <= nFrom + t/2 < p
+      out[j][h] =
+          NTL::SubMod(acc, NTL::MulMod(vc, qModP[j], p, toPrimesInv[j]), p);
+    }
+  }
+}
+
+void RNSBaseConverter::toDouble(double* out,
+                                const long* const* in,
+                                long first,
+                                long last) const
+{
+  assertTrue(qBits <= MAX_LIFT_BITS,
+             "RNSBaseConverter::toDouble: Q exceeds 2^MAX_LIFT_BITS");
+  long nFrom = fromPrimes.size();
+  std::vector<uint128_t> qHat(nFrom);
+  for (long i = 0; i < nFrom; i++)
+    qHat[i] = toUint128(&qHatMod128[2 * i]);
+  uint128_t q = toUint128(qMod128);
+
+  for (long h = first; h < last; h++) {
+    // x = sum_i y_i * (Q/q_i) - v * Q, with v = round(sum_i y_i/q_i)
+    double frac = 0.5;
+    uint128_t acc = 0;
+    for (long i = 0; i < nFrom; i++) {
+      long yi = NTL::MulModPrecon(in[i][h],
+                                  qHatInv[i],
+                                  fromPrimes[i],
+                                  qHatInvPrecon[i]);
+      frac += double(yi) * qRecip[i];
+      acc += uint128_t((unsigned long)yi) * qHat[i]; // mod 2^128
+    }
+    acc -= uint128_t((unsigned long)long(frac)) * q;
+    out[h] = double(int128_t(acc)); // |x| <= Q/2 < 2^127
+  }
+}
+
+} // namespace helib
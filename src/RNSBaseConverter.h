@@ -0,0 +1,147 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_RNSBASECONVERTER_H
+#define HELIB_RNSBASECONVERTER_H
+/**
+ * @file RNSBaseConverter.h
+ * @brief Fast RNS base extension between two sets of primes
+ **/
+#include <vector>
+
+#include <NTL/ZZ.h>
+
+#include <helib/IndexSet.h>
+
+namespace helib {
+
+class Context;
+
+/**
+ * @class RNSBaseConverter
+ * @brief Precomputed tables for extending residues modulo the primes in one
+ * set (of product Q) to residues modulo the primes in another set.
+ *
+ * Given the residues x_i = x mod q_i, the integer x is recovered as
+ *   x = sum_i y_i (Q/q_i) - v Q,  with y_i = x_i (Q/q_i)^{-1} mod q_i,
+ * and v = round(sum_i y_i/q_i) computed in floating point (as in
+ * Halevi-Polyakov-Shoup). Each term is then reduced modulo the new primes
+ * directly, using only single-precision arithmetic.
+ *
+ * The result is the balanced lift of x, in (-Q/2, Q/2], except when the
+ * fractional part of sum_i y_i/q_i is within rounding error of 1/2, in
+ * which case it may be off by Q. Either way the output is the same integer
+ * modulo all the new primes, so it can be used wherever any small lift
+ * will do (e.g. the digits in key switching). The new moduli need not be
+ * primes of the chain, nor primes at all.
+ **/
+class RNSBaseConverter
+{
+  IndexSet from;
+  IndexSet to;
+
+  std::vector<long> fromPrimes; // q_i
+  std::vector<long> qHatInv;    // (Q/q_i)^{-1} mod q_i
+  std::vector<NTL::mulmod_precon_t> qHatInvPrecon;
+  std::vector<double> qRecip; // 1/q_i
+
+  std::vector<long> toPrimes; // p_j
+  std::vector<NTL::mulmod_t> toPrimesInv;
+  std::vector<NTL::sp_reduce_struct> toPrimesRed;
+  std::vector<long> qHatModP; // qHatModP[j * #from + i] = (Q/q_i) mod p_j
+  std::vector<NTL::mulmod_precon_t> qHatModPPrecon;
+  std::vector<long> qModP; // Q mod p_j
+  std::vector<long> qInvModP; // Q^{-1} mod p_j, or 0 if they are not coprime
+  std::vector<NTL::mulmod_precon_t> qInvModPPrecon;
+  // (Q/q_i) mod 2^128 and Q mod 2^128, as (low, high) pairs of 64-bit words
+  std::vector<unsigned long> qHatMod128;
+  unsigned long qMod128[2];
+  long qBits; // the number of bits of Q
+
+  void init(const Context& context);
+
+public:
+  RNSBaseConverter(const Context& context,
+                   const IndexSet& _from,
+                   const IndexSet& _to);
+
+  //! Convert to residues modulo arbitrary single-precision moduli (e.g. the
+  //! plaintext space), rather than primes of the chain. getTo() is empty.
+  RNSBaseConverter(const Context& context,
+                   const IndexSet& _from,
+                   const std::vector<long>& moduli);
+
+  const IndexSet& getFrom() const { return from; }
+  const IndexSet& getTo() const { return to; }
+
+  /**
+   * @brief Convert the coefficients in positions [first, last).
+   * @param out out[j] points to the coefficients modulo the j'th prime of to.
+   * @param in in[i] points to the coefficients modulo the i'th prime of from,
+   * reduced to [0, q_i).
+   **/
+  void convert(long* const* out,
+               const long* const* in,
+               long first,
+               long last) const;
+
+  /**
+   * @brief The correction of a scale down by Q, for the coefficients in
+   * positions [first, last).
+   * @param out out[j] gets delta mod the j'th prime of to, where delta is the
+   * balanced lift x of the coefficient modulo Q, made divisible by t by
+   * subtracting the balanced c*Q with c = x Q^{-1} mod t. The coefficient
+   * minus delta is then divisible by Q and t.
+   * @param frac frac[h] gets delta/Q, of absolute value at most t/2 (up to
+   * floating point error).
+   * @param t The plaintext space, or 1 for none (then delta = x).
+   * @param in As for convert.
+   *
+   * This is the same correction as in DoubleCRT::scaleDownToSet, with
+   * single-precision arithmetic only.
+   **/
+  void modDownCorrection(long* const* out,
+                         double* frac,
+                         long t,
+                         const long* const* in,
+                         long first,
+                         long last) const;
+
+  /**
+   * @brief The balanced lifts of the coefficients in positions [first, last),
+   * as doubles.
+   * @param out out[h] gets the lift x of the h'th coefficient modulo Q.
+   * @param in As for convert.
+   *
+   * The sum that gives x is computed modulo 2^128, which is exact since Q
+   * has at most MAX_LIFT_BITS bits. As for convert, x may be off by Q if it
+   * is close to Q/2, so only the lifts of coefficients well inside
+   * (-Q/2, Q/2) can be relied upon.
+   **/
+  void toDouble(double* out, const long* const* in, long first, long last)
+      const;
+
+  //! The largest Q handled by toDouble, in bits
+  static constexpr long MAX_LIFT_BITS = 126;
+  long getFromBits() const { return qBits; }
+
+  //! Q^{-1} modulo the j'th prime of to, and its Shoup constant
+  long getQInvModTo(long j) const { return qInvModP[j]; }
+  NTL::mulmod_precon_t getQInvModToPrecon(long j) const
+  {
+    return qInvModPPrecon[j];
+  }
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_RNSBASECONVERTER_H
@@ -0,0 +1,250 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* ScratchPool.cpp - per-thread free lists of DoubleCRT rows
+ */
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+#include <helib/ScratchPool.h>
+
+namespace helib {
+
+namespace {
+
+// The counters are only written by their own thread, but may be read by
+// others in totalStats, hence the (relaxed) atomics
+struct Counters
+{
+  std::atomic<long> hits{0};
+  std::atomic<long> misses{0};
+  std::atomic<long> returned{0};
+  std::atomic<long> dropped{0};
+  // The content of the pool rather than events, so left alone by reset
+  std::atomic<long> pooledRows{0};
+  std::atomic<long> pooledBytes{0};
+
+  ScratchPoolStats get() const
+  {
+    ScratchPoolStats stats;
+    stats.hits = hits.load(std::memory_order_relaxed);
+    stats.misses = misses.load(std::memory_order_relaxed);
+    stats.returned = returned.load(std::memory_order_relaxed);
+    stats.dropped = dropped.load(std::memory_order_relaxed);
+    stats.pooledRows = pooledRows.load(std::memory_order_relaxed);
+    stats.pooledBytes = pooledBytes.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  void reset()
+  {
+    hits.store(0, std::memory_order_relaxed);
+    misses.store(0, std::memory_order_relaxed);
+    returned.store(0, std::memory_order_relaxed);
+    dropped.store(0, std::memory_order_relaxed);
+  }
+};
+
+// Only the owner thread writes, so no read-modify-write is needed
+void bump(std::atomic<long>& counter, long amount = 1)
+{
+  counter.store(counter.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+}
+
+void accumulate(ScratchPoolStats& total, const ScratchPoolStats& stats)
+{
+  total.hits += stats.hits;
+  total.misses += stats.misses;
+  total.returned += stats.returned;
+  total.dropped += stats.dropped;
+  total.pooledRows += stats.pooledRows;
+  total.pooledBytes += stats.pooledBytes;
+}
+
+// The counters of all live threads, and the sum for threads that exited
+struct Registry
+{
+  std::mutex lock;
+  std::set<Counters*> live;
+  ScratchPoolStats retired;
+};
+
+Registry& registry()
+{
+  // Never destroyed, since thread-local pools may unregister after the
+  // destruction of static objects
+  static Registry* reg = new Registry;
+  return *reg;
+}
+
+std::atomic<long> maxBytesPerThread(
+    ScratchPool::DEFAULT_MAX_BYTES_PER_THREAD);
+
+// The free rows of a given length
+struct FreeList
+{
+  NTL::Vec<NTL::vec_long> rows; // rows[0..count-1] are available
+  long count = 0;
+};
+
+// Set once the pool of this thread is destroyed: DoubleCRT objects with
+// static or thread storage may still release rows after that
+thread_local bool poolDestroyed = false;
+
+struct ThreadPool
+{
+  Counters counters;
+  std::unordered_map<long, FreeList> lists; // indexed by row length
+  long bytes = 0;                           // total size of the free rows
+
+  ThreadPool()
+  {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    reg.live.insert(&counters);
+  }
+
+  ~ThreadPool()
+  {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    counters.pooledRows = 0; // the rows are freed with the pool
+    counters.pooledBytes = 0;
+    accumulate(reg.retired, counters.get());
+    reg.live.erase(&counters);
+    poolDestroyed = true;
+  }
+};
+
+// The pool of this thread, or nullptr during thread exit
+ThreadPool* threadPool()
+{
+  if (poolDestroyed)
+    return nullptr;
+  static thread_local ThreadPool pool;
+  return &pool;
+}
+
+} // namespace
+
+void ScratchPool::acquire(NTL::vec_long& v, long n, bool zero)
+{
+  ThreadPool* pool = threadPool();
+  if (pool == nullptr) {
+    v.SetLength(n);
+    if (zero)
+      std::fill_n(v.elts(), n, 0L);
+    return;
+  }
+  auto it = pool->lists.find(n);
+  if (it != pool->lists.end() && it->second.count > 0) {
+    FreeList& list = it->second;
+    v.swap(list.rows[--list.count]);
+    pool->bytes -= n * sizeof(long);
+    bump(pool->counters.hits);
+    bump(pool->counters.pooledRows, -1);
+    pool->counters.pooledBytes.store(pool->bytes, std::memory_order_relaxed);
+  } else {
+    v.SetLength(n);
+    bump(pool->counters.misses);
+  }
+  // Only the callers that read a row before writing it pay for clearing it
+  if (zero)
+    std::fill_n(v.elts(), n, 0L);
+}
+
+void ScratchPool::release(NTL::vec_long& v)
+{
+  long n = v.length();
+  if (v.fixed())
+    return; // cannot be swapped out, nor killed
+  if (n == 0) {
+    v.kill();
+    return;
+  }
+
+  ThreadPool* pool = threadPool();
+  if (pool == nullptr) {
+    v.kill();
+    return;
+  }
+  long size = n * sizeof(long);
+  if (pool->bytes + size > maxBytesPerThread.load(std::memory_order_relaxed)) {
+    bump(pool->counters.dropped);
+    v.kill();
+    return;
+  }
+  FreeList& list = pool->lists[n];
+  if (list.count == list.rows.length())
+    list.rows.SetLength(list.count + 1);
+  list.rows[list.count++].swap(v); // the slot is empty, so v becomes empty
+  pool->bytes += size;
+  bump(pool->counters.returned);
+  bump(pool->counters.pooledRows);
+  pool->counters.pooledBytes.store(pool->bytes, std::memory_order_relaxed);
+}
+
+void ScratchPool::clear()
+{
+  ThreadPool* pool = threadPool();
+  if (pool == nullptr)
+    return;
+  pool->lists.clear();
+  pool->bytes = 0;
+  pool->counters.pooledRows = 0;
+  pool->counters.pooledBytes = 0;
+}
+
+void ScratchPool::setMaxBytesPerThread(long bytes)
+{
+  maxBytesPerThread = bytes;
+}
+
+long ScratchPool::getMaxBytesPerThread() { return maxBytesPerThread; }
+
+ScratchPoolStats ScratchPool::threadStats()
+{
+  ThreadPool* pool = threadPool();
+  return (pool == nullptr) ? ScratchPoolStats() : pool->counters.get();
+}
+
+ScratchPoolStats ScratchPool::totalStats()
+{
+  Registry& reg = registry();
+  std::lock_guard<std::mutex> guard(reg.lock);
+  ScratchPoolStats total = reg.retired;
+  for (const Counters* c : reg.live)
+    accumulate(total, c->get());
+  return total;
+}
+
+void ScratchPool::resetStats()
+{
+  Registry& reg = registry();
+  std::lock_guard<std::mutex> guard(reg.lock);
+  reg.retired = ScratchPoolStats();
+  for (Counters* c : reg.live)
+    c->reset();
+}
+
+std::ostream& operator<<(std::ostream& str, const ScratchPoolStats& stats)
+{
+  return str << "hits=" << stats.hits << " misses=" << stats.misses
+             << " returned=" << stats.returned << " dropped=" << stats.dropped
+             << " hit-rate=" << stats.hitRate();
+}
+
+} // namespace helib
@@ -0,0 +1,201 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* batching.cpp - coalescing small encrypted requests into shared ciphertexts
+ */
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+#include <helib/batching.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+RequestBatcher::RequestBatcher(const EncryptedArray& _ea,
+                               long numInputs,
+                               Compute _compute,
+                               BatchOptions _options) :
+    ea(_ea),
+    arity(numInputs),
+    compute(std::move(_compute)),
+    options(_options)
+{
+  assertTrue<InvalidArgument>(arity > 0,
+                              "RequestBatcher: requests need some inputs");
+  assertTrue<InvalidArgument>(bool(compute),
+                              "RequestBatcher: no computation");
+  assertTrue<InvalidArgument>(options.deadline.count() >= 0,
+                              "RequestBatcher: negative deadline");
+  worker = std::thread([this] { run(); });
+}
+
+RequestBatcher::~RequestBatcher()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeup.notify_all();
+  worker.join();
+}
+
+std::future<std::vector<Ctxt>> RequestBatcher::submit(std::vector<Ctxt> inputs,
+                                                      long width)
+{
+  assertEq<InvalidArgument>(long(inputs.size()),
+                            arity,
+                            "RequestBatcher: wrong number of inputs");
+  assertInRange<InvalidArgument>(width,
+                                 1L,
+                                 ea.size(),
+                                 "RequestBatcher: width not in [1, nslots]",
+                                 /*right_inclusive=*/true);
+  for (const Ctxt& ctxt : inputs)
+    assertTrue<InvalidArgument>(&ctxt.getContext() == &ea.getContext(),
+                                "RequestBatcher: input of another context");
+
+  Request request;
+  request.inputs = std::move(inputs);
+  request.width = width;
+  request.arrival = std::chrono::steady_clock::now();
+  std::future<std::vector<Ctxt>> results = request.results.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    assertTrue<LogicError>(!stopping, "RequestBatcher: stopping");
+    const PubKey* requestKey = &request.inputs[0].getPubKey();
+    if (key == nullptr)
+      key = requestKey;
+    for (const Ctxt& ctxt : request.inputs)
+      assertTrue<InvalidArgument>(&ctxt.getPubKey() == key,
+                                  "RequestBatcher: input under another key");
+    pendingSlots += width;
+    pending.push_back(std::move(request));
+  }
+  wakeup.notify_all();
+  return results;
+}
+
+void RequestBatcher::flush()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    flushing = true;
+  }
+  wakeup.notify_all();
+}
+
+BatchStats RequestBatcher::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return counts;
+}
+
+void RequestBatcher::run()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    wakeup.wait(lock, [this] { return stopping || !pending.empty(); });
+    if (pending.empty())
+      return; // stopping, with nothing left to run
+
+    auto ready = [this] {
+      return stopping || flushing || pendingSlots >= ea.size();
+    };
+    wakeup.wait_until(lock, pending.front().arrival + options.deadline, ready);
+
+    std::vector<Request> batch = takeBatch();
+    if (pending.empty())
+      flushing = false;
+    lock.unlock();
+    process(batch);
+    lock.lock();
+    counts.requests += batch.size();
+    counts.batches++;
+    for (const Request& request : batch)
+      counts.slots += request.width;
+  }
+}
+
+// The longest prefix of the requests waiting that fits in the slots
+std::vector<RequestBatcher::Request> RequestBatcher::takeBatch()
+{
+  std::vector<Request> batch;
+  long used = 0;
+  while (!pending.empty() && used + pending.front().width <= ea.size()) {
+    used += pending.front().width;
+    batch.push_back(std::move(pending.front()));
+    pending.pop_front();
+  }
+  pendingSlots -= used;
+  return batch;
+}
+
+const PtxtArray& RequestBatcher::mask(long width)
+{
+  auto it = masks.find(width);
+  if (it == masks.end()) {
+    std::vector<long> ones(ea.size(), 0);
+    std::fill_n(ones.begin(), width, 1);
+    it = masks.emplace(width, PtxtArray(ea, ones)).first;
+  }
+  return it->second;
+}
+
+void RequestBatcher::process(std::vector<Request>& batch)
+{
+  HELIB_TIMER_START;
+  long nslots = ea.size();
+  try {
+    std::vector<long> offsets(batch.size());
+    for (long r = 1; r < long(batch.size()); r++)
+      offsets[r] = offsets[r - 1] + batch[r - 1].width;
+
+    std::vector<Ctxt> packed;
+    packed.reserve(arity);
+    for (long i = 0; i < arity; i++) {
+      Ctxt sum(ZeroCtxtLike, batch[0].inputs[i]);
+      for (long r = 0; r < long(batch.size()); r++) {
+        Ctxt& input = batch[r].inputs[i];
+        if (options.maskInputs && batch[r].width < nslots)
+          input.multByConstant(mask(batch[r].width));
+        if (offsets[r] != 0)
+          ea.rotate(input, offsets[r]);
+        sum += input;
+      }
+      packed.push_back(std::move(sum));
+    }
+
+    std::vector<Ctxt> outputs = compute(packed);
+
+    for (long r = 0; r < long(batch.size()); r++) {
+      std::vector<Ctxt> results(outputs);
+      for (Ctxt& result : results) {
+        if (offsets[r] != 0)
+          ea.rotate(result, nslots - offsets[r]);
+        if (options.maskOutputs && batch[r].width < nslots)
+          result.multByConstant(mask(batch[r].width));
+      }
+      batch[r].results.set_value(std::move(results));
+    }
+  } catch (...) {
+    // The requests whose results are set already are not affected
+    for (Request& request : batch)
+      try {
+        request.results.set_exception(std::current_exception());
+      } catch (const std::future_error&) {
+      }
+  }
+}
+
+} // namespace helib
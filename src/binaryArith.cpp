@@ -20,8 +20,10 @@
 #include <stdexcept>
 #include <atomic>
 #include <mutex> // std::mutex, std::unique_lock
+#include <memory>
 
 #include <NTL/BasicThreadPool.h>
+#include <helib/multicore.h>
 #include <helib/binaryArith.h>
 
 #ifdef HELIB_DEBUG
@@ -86,6 +88,18 @@ public:
       ct(other.ct)
   {}
 
+  DAGnode(const DAGnode& other) :
+      // copy constructor, for copying a plan: the ciphertext is not copied
+      // and the parents still point into the other plan
+      idx(other.idx),
+      isQ(other.isQ),
+      level(other.level),
+      childrenLeft(long(other.childrenLeft)),
+      parent1(other.parent1),
+      parent2(other.parent2),
+      ct(nullptr)
+  {}
+
   std::string nodeName() const
   {
     return (std::string(isQ ? "Q(" : "P(") + std::to_string(idx.first) + ',' +
@@ -129,10 +143,19 @@ class AddDAG
 {
   std::mutex scratch_mtx;           // controls access to scratch vector
   std::vector<ScratchCell> scratch; // scratch space for ciphertexts
-  std::map<NodeIdx, DAGnode> p;     // p[i,j]= prod_{t=j}^i (a[t]+b[t])
-  std::map<NodeIdx, DAGnode> q; // q[i,j]= a[j]b[j]*prod_{t=j+1}^i (a[t]+b[t])
+  std::vector<DAGnode> nodes;       // all the nodes, never reallocated
+  std::vector<DAGnode*> p; // p[i*bSize+j]= prod_{t=j}^i (a[t]+b[t])
+  std::vector<DAGnode*> q; // q[i*bSize+j]= a[j]b[j]*prod_{t=j+1}^i (a[t]+b[t])
   long aSize, bSize;
 
+  // Add a node to the plan, and return a pointer to it
+  DAGnode* addNode(DAGnode&& node)
+  {
+    assertTrue(nodes.size() < nodes.capacity(), "AddDAG node space exhausted");
+    nodes.push_back(std::move(node));
+    return &nodes.back();
+  }
+
   Ctxt* allocateCtxtLike(const Ctxt& c); // Allocate a new ciphertext if needed
   void markAsAvailable(DAGnode* node);   // Mark temporary Ctxt object as unused
   const Ctxt& getCtxt(DAGnode* node,     // Compute a new Ctxt if need
@@ -152,8 +175,30 @@ public:
   //! Build a plan to add a and b
   void init(const CtPtrs& a, const CtPtrs& b);
 
+  //! Build a plan from the bit capacities of the bits of a and b, with
+  //! LONG_MAX for an empty bit
+  void init(const std::vector<long>& aLvls, const std::vector<long>& bLvls);
+
   // Build the addition DAG
   AddDAG(const CtPtrs& a, const CtPtrs& b) { init(a, b); }
+  AddDAG(const std::vector<long>& aLvls, const std::vector<long>& bLvls)
+  {
+    init(aLvls, bLvls);
+  }
+
+  //! Copy a plan that was not applied yet, e.g. one from the plan cache
+  AddDAG(const AddDAG& other);
+
+  //! Add offset to the level of every non-empty node
+  void shiftLevels(long offset)
+  {
+    for (DAGnode& node : nodes)
+      if (node.level != LONG_MAX)
+        node.level += offset;
+  }
+
+  //! The depth and the number of multiplications of apply
+  AdderCost cost(long sizeLimit = 0) const;
 
   //! Perform the actual addition
   void apply(CtPtrs& sum, const CtPtrs& a, const CtPtrs& b, long sizeLimit = 0);
@@ -168,22 +213,22 @@ public:
   //! Returns a pointer to the a 'p' node of index (i,j)
   DAGnode* findP(long i, long j) const
   { // returns nullptr if not exists
-    auto it = p.find(NodeIdx(i, j));
-    if (it == p.end()) {
+    DAGnode* node = (i >= 0 && i < bSize && j >= 0 && j < bSize)
+                        ? p[i * bSize + j]
+                        : nullptr;
+    if (node == nullptr)
       std::cerr << "  findP(" << i << ',' << j << ") not found" << std::endl;
-      return nullptr; // not found
-    }
-    return (DAGnode*)&(it->second);
+    return node;
   }
   //! Returns a pointer to the a 'q' node of index (i,j)
   DAGnode* findQ(long i, long j) const
   { // returns nullptr if not exists
-    auto it = q.find(NodeIdx(i, j));
-    if (it == q.end()) {
+    DAGnode* node = (i >= 0 && i < bSize && j >= 0 && j < bSize)
+                        ? q[i * bSize + j]
+                        : nullptr;
+    if (node == nullptr)
       std::cerr << "  findQ(" << i << ',' << j << ") not found" << std::endl;
-      return nullptr; // not found
-    }
-    return (DAGnode*)&(it->second);
+    return node;
   }
 #ifdef HELIB_DEBUG
   void printAddDAG(bool printCT = false);
@@ -208,36 +253,48 @@ inline long defaultQmiddle(long delta)
 }
 
 //! Build a plan to add a and b
-void AddDAG::init(const CtPtrs& aa, const CtPtrs& bb)
+static std::vector<long> inputLevels(const CtPtrs& a);
+
+void AddDAG::init(const CtPtrs& a, const CtPtrs& b)
+{
+  init(inputLevels(a), inputLevels(b));
+}
+
+void AddDAG::init(const std::vector<long>& aaLvls,
+                  const std::vector<long>& bbLvls)
 {
   // make sure that lsize(b) >= lsize(a)
-  const CtPtrs& a = (lsize(bb) >= lsize(aa)) ? aa : bb;
-  const CtPtrs& b = (lsize(bb) >= lsize(aa)) ? bb : aa;
+  const std::vector<long>& aLvls =
+      (lsize(bbLvls) >= lsize(aaLvls)) ? aaLvls : bbLvls;
+  const std::vector<long>& bLvls =
+      (lsize(bbLvls) >= lsize(aaLvls)) ? bbLvls : aaLvls;
 
-  aSize = lsize(a);
-  bSize = lsize(b);
+  aSize = lsize(aLvls);
+  bSize = lsize(bLvls);
   assertTrue<InvalidArgument>(aSize >= 1, "a must not be empty");
 
+  // Room for all the p[i,j]'s and q[i,j]'s, so that the nodes never move
+  nodes.clear();
+  nodes.reserve(bSize * (bSize + 1) / 2 + aSize * bSize);
+  p.assign(bSize * bSize, nullptr);
+  q.assign(bSize * bSize, nullptr);
+
   // Initialize the p[i,i]'s and q[i,i]'s
-  p.clear();
-  q.clear();
   for (long i = 0; i < bSize; i++) {
     NodeIdx idx(i, i);
     // The level of b[i]
-    long lvl =
-        (b.isSet(i) && !(b[i]->isEmpty())) ? b[i]->bitCapacity() : LONG_MAX;
+    long lvl = bLvls[i];
     if (i < aSize) {
       // The level of a[i]
-      long aLvl =
-          (a.isSet(i) && !(a[i]->isEmpty())) ? a[i]->bitCapacity() : LONG_MAX;
+      long aLvl = aLvls[i];
       lvl = std::min(lvl, aLvl);
       if (lvl == LONG_MAX ||
           aLvl == LONG_MAX) // is either a[i] or b[i] is empty
-        q.emplace(idx, DAGnode(idx, true, LONG_MAX, 1));
+        q[i * bSize + i] = addNode(DAGnode(idx, true, LONG_MAX, 1));
       else
-        q.emplace(idx, DAGnode(idx, true, lvl - 1, 1));
+        q[i * bSize + i] = addNode(DAGnode(idx, true, lvl - 1, 1));
     }
-    p.emplace(idx, DAGnode(idx, false, lvl, 1));
+    p[i * bSize + i] = addNode(DAGnode(idx, false, lvl, 1));
   }
 
   // Initialize p[i,j] for bSize>=i>j>0
@@ -270,7 +327,8 @@ void AddDAG::init(const CtPtrs& aa, const CtPtrs& bb)
         }
       }
       NodeIdx idx(i, j);
-      p.emplace(idx, DAGnode(idx, false, maxLvl, 0, prnt1, prnt2));
+      p[i * bSize + j] =
+          addNode(DAGnode(idx, false, maxLvl, 0, prnt1, prnt2));
       prnt1->childrenLeft++;
       prnt2->childrenLeft++;
     }
@@ -313,12 +371,125 @@ void AddDAG::init(const CtPtrs& aa, const CtPtrs& bb)
       if (prnt1 == nullptr)
         continue; // cannot create node
       NodeIdx idx(i, j);
-      q.emplace(idx, DAGnode(idx, true, maxLvl, 1, prnt1, prnt2));
+      q[i * bSize + j] = addNode(DAGnode(idx, true, maxLvl, 1, prnt1, prnt2));
       prnt1->childrenLeft++;
       prnt2->childrenLeft++;
     }
 }
 
+AddDAG::AddDAG(const AddDAG& other) :
+    nodes(other.nodes), aSize(other.aSize), bSize(other.bSize)
+{
+  // Point the parents and the lookup tables into our own nodes
+  auto ours = [this, &other](DAGnode* node) {
+    return node ? &nodes[node - other.nodes.data()] : nullptr;
+  };
+  nodes.reserve(other.nodes.capacity());
+  for (DAGnode& node : nodes) {
+    node.parent1 = ours(node.parent1);
+    node.parent2 = ours(node.parent2);
+  }
+  p.resize(other.p.size());
+  q.resize(other.q.size());
+  for (std::size_t i = 0; i < p.size(); i++) {
+    p[i] = ours(other.p[i]);
+    q[i] = ours(other.q[i]);
+  }
+}
+
+// Plans already built, keyed by the levels of the input bits relative to the
+// lowest of them. The plan only depends on the differences between the levels
+// as long as they all stay positive, so the cached plans are built from
+// levels that start at addPlanBase(bSize) and shifted to the actual levels.
+typedef std::pair<std::vector<long>, std::vector<long>> AddPlanKey;
+static std::mutex addPlanCacheMtx;
+static std::map<AddPlanKey, std::shared_ptr<const AddDAG>> addPlanCache;
+static constexpr std::size_t ADD_PLAN_CACHE_SIZE = 256;
+
+// High enough for all the levels of a plan for bSize-bit inputs to be positive
+static long addPlanBase(long bSize) { return (bSize + 2) * BPL_ESTIMATE; }
+
+static std::vector<long> inputLevels(const CtPtrs& a)
+{
+  std::vector<long> lvls(lsize(a));
+  for (long i = 0; i < lsize(a); i++)
+    lvls[i] =
+        (a.isSet(i) && !(a[i]->isEmpty())) ? a[i]->bitCapacity() : LONG_MAX;
+  return lvls;
+}
+
+//! Returns a plan to add a and b, reusing a cached one with the same shape
+static std::unique_ptr<AddDAG> makeAddPlan(const CtPtrs& a, const CtPtrs& b)
+{
+  AddPlanKey key(inputLevels(a), inputLevels(b));
+  long bSize = std::max(lsize(a), lsize(b));
+  long minLvl = std::min(findMinBitCapacity(a), findMinBitCapacity(b));
+  if (minLvl == LONG_MAX || minLvl < addPlanBase(bSize)) // nothing to share
+    return std::unique_ptr<AddDAG>(new AddDAG(key.first, key.second));
+
+  long offset = minLvl - addPlanBase(bSize);
+  for (std::vector<long>* lvls : {&key.first, &key.second})
+    for (long& lvl : *lvls)
+      if (lvl != LONG_MAX)
+        lvl -= offset;
+
+  std::shared_ptr<const AddDAG> plan;
+  {
+    std::lock_guard<std::mutex> lck(addPlanCacheMtx);
+    auto it = addPlanCache.find(key);
+    if (it != addPlanCache.end())
+      plan = it->second;
+  }
+  if (!plan) { // build it outside the lock, another thread may do the same
+    plan = std::make_shared<const AddDAG>(key.first, key.second);
+    std::lock_guard<std::mutex> lck(addPlanCacheMtx);
+    if (addPlanCache.size() >= ADD_PLAN_CACHE_SIZE)
+      addPlanCache.clear();
+    addPlanCache.emplace(key, plan);
+  }
+  std::unique_ptr<AddDAG> copy(new AddDAG(*plan));
+  copy->shiftLevels(offset);
+  return copy;
+}
+
+// The nodes that apply adds up, each computed once: the internal ones with
+// one multiplication of their parents, the q[i,i]'s with a[i]*b[i]
+AdderCost AddDAG::cost(long sizeLimit) const
+{
+  if (sizeLimit == 0)
+    sizeLimit = bSize + 1;
+
+  AdderCost total{0, 0};
+  std::map<const DAGnode*, long> depth;
+  std::function<long(const DAGnode*)> visit = [&](const DAGnode* node) {
+    if (node == nullptr)
+      return 0l;
+    auto it = depth.find(node);
+    if (it != depth.end())
+      return it->second;
+    long d = 0;
+    if (node->level != LONG_MAX) { // identically zero nodes cost nothing
+      if (node->parent1 != nullptr && node->parent2 != nullptr) {
+        d = std::max(visit(node->parent1), visit(node->parent2)) + 1;
+        total.mults++;
+      } else if (node->isQ) {
+        d = 1;
+        total.mults++;
+      }
+    }
+    depth.emplace(node, d);
+    return d;
+  };
+  // Past bit bSize there is nothing to add
+  for (long i = 0; i < std::min(sizeLimit, bSize + 1); i++) {
+    if (i < bSize)
+      total.depth = std::max(total.depth, visit(findP(i, i)));
+    for (long j = std::min(i - 1, aSize - 1); j >= 0; --j)
+      total.depth = std::max(total.depth, visit(findQ(i - 1, j)));
+  }
+  return total;
+}
+
 //! Apply the DAG to actually compute the sum
 void AddDAG::apply(CtPtrs& sum,
                    const CtPtrs& aa,
@@ -339,7 +510,7 @@ void AddDAG::apply(CtPtrs& sum,
     sum[i]->clear();
 
   // Allow multi-threading in this loop
-  NTL_EXEC_RANGE(sizeLimit, first, last)
+  HELIB_EXEC_RANGE(sizeLimit, first, last)
   for (long i = first; i < last; i++) { //  for (long i=0; i<sizeLimit; i++) {
     if (i < bSize)
       addCtxtFromNode(*(sum[i]), this->findP(i, i), a, b);
@@ -349,7 +520,7 @@ void AddDAG::apply(CtPtrs& sum,
         addCtxtFromNode(*(sum[i]), node, a, b);
     }
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 }
 
 //! Get the ciphertext for a node, computing it as needed
@@ -502,8 +673,12 @@ std::vector<long> longToBitVector(long num, long bitSize)
 //! Apply mask across the vector of bits slot-wise.
 void binaryMask(CtPtrs& bits, const Ctxt& mask)
 {
-  for (long i = 0; i < bits.size(); ++i)
-    bits[i]->multiplyBy(mask);
+  withSpans(
+      [&](const auto& bits) {
+        for (long i = 0; i < bits.size(); ++i)
+          bits[i]->multiplyBy(mask);
+      },
+      bits);
 }
 
 //! Implementation of output = cond ? trueValue : falseValue
@@ -527,8 +702,13 @@ void binaryCond(CtPtrs& output,
   CtPtrs_vectorCt falseCopyWrapper(falseCopy);
   binaryMask(falseCopyWrapper, negated_cond);
   // TODO: Change this to use bit-wise XOR
-  for (long i = 0; i < output.size(); ++i)
-    *output[i] += falseCopy[i];
+  withSpans(
+      [](const auto& output, const auto& falseCopy) {
+        for (long i = 0; i < output.size(); ++i)
+          *output[i] += *falseCopy[i];
+      },
+      output,
+      falseCopyWrapper);
 }
 
 //! Concatenate two binary numbers into a single `CtPtrs` object.
@@ -537,10 +717,16 @@ void concatBinaryNums(CtPtrs& output, const CtPtrs& a, const CtPtrs& b)
   assertEq(output.size(),
            a.size() + b.size(),
            "output must be of size a.size() + b.size()");
-  for (long i = 0; i < a.size(); ++i)
-    *output[i] = *a[i];
-  for (long i = 0; i < b.size(); ++i)
-    *output[i + a.size()] = *b[i];
+  withSpans(
+      [](const auto& output, const auto& a, const auto& b) {
+        for (long i = 0; i < a.size(); ++i)
+          *output[i] = *a[i];
+        for (long i = 0; i < b.size(); ++i)
+          *output[i + a.size()] = *b[i];
+      },
+      output,
+      a,
+      b);
 }
 
 //! Split a binary number into two separate binary numbers.
@@ -549,10 +735,16 @@ void splitBinaryNums(CtPtrs& leftSplit, CtPtrs& rightSplit, const CtPtrs& input)
   assertEq(leftSplit.size() + rightSplit.size(),
            input.size(),
            "Output sizes must sum to input.size()");
-  for (long i = 0; i < leftSplit.size(); ++i)
-    *leftSplit[i] = *input[i];
-  for (long i = 0; i < rightSplit.size(); ++i)
-    *rightSplit[i] = *input[i + leftSplit.size()];
+  withSpans(
+      [](const auto& leftSplit, const auto& rightSplit, const auto& input) {
+        for (long i = 0; i < leftSplit.size(); ++i)
+          *leftSplit[i] = *input[i];
+        for (long i = 0; i < rightSplit.size(); ++i)
+          *rightSplit[i] = *input[i + leftSplit.size()];
+      },
+      leftSplit,
+      rightSplit,
+      input);
 }
 
 //! Shift binary numbers to the left by `shamt`
@@ -562,10 +754,15 @@ void leftBitwiseShift(CtPtrs& output, const CtPtrs& input, const long shamt)
   assertEq(output.size(),
            input.size(),
            "output and input must have the same size.");
-  for (long i = 0; i < output.size() - shamt; ++i)
-    *output[i + shamt] = *input[i];
-  for (long i = 0; i < shamt; ++i)
-    output[i]->clear();
+  withSpans(
+      [shamt](const auto& output, const auto& input) {
+        for (long i = 0; i < output.size() - shamt; ++i)
+          *output[i + shamt] = *input[i];
+        for (long i = 0; i < shamt; ++i)
+          output[i]->clear();
+      },
+      output,
+      input);
 }
 
 //! Rotate binary numbers by `rotamt`.
@@ -576,8 +773,13 @@ void bitwiseRotate(CtPtrs& output, const CtPtrs& input, long rotamt)
            "output and input must be the same size.");
   long bitSize = input.size();
   rotamt = mcMod(rotamt, bitSize);
-  for (long i = 0; i < output.size(); ++i)
-    *output[i] = *input[mcMod(i - rotamt, bitSize)];
+  withSpans(
+      [=](const auto& output, const auto& input) {
+        for (long i = 0; i < output.size(); ++i)
+          *output[i] = *input[mcMod(i - rotamt, bitSize)];
+      },
+      output,
+      input);
 }
 
 //! Compute a bitwise XOR between `lhs` and `rhs`.
@@ -586,8 +788,13 @@ void bitwiseXOR(CtPtrs& output, const CtPtrs& lhs, const CtPtrs& rhs)
   assertEq(output.size(), lhs.size(), "output and lhs must be the same size.");
   assertEq(lhs.size(), rhs.size(), "lhs and rhs must be the same size.");
   vecCopy(output, lhs);
-  for (long i = 0; i < rhs.size(); ++i)
-    *output[i] += *rhs[i];
+  withSpans(
+      [](const auto& output, const auto& rhs) {
+        for (long i = 0; i < rhs.size(); ++i)
+          *output[i] += *rhs[i];
+      },
+      output,
+      rhs);
 }
 
 //! Compute a bitwise OR between `lhs` and `rhs`.
@@ -599,10 +806,16 @@ void bitwiseOr(CtPtrs& output, const CtPtrs& lhs, const CtPtrs& rhs)
   // Start output off as lhs & rhs
   bitwiseAnd(output, lhs, rhs);
   // Now add on lhs and rhs
-  for (long i = 0; i < rhs.size(); ++i) {
-    *output[i] += *lhs[i];
-    *output[i] += *rhs[i];
-  }
+  withSpans(
+      [](const auto& output, const auto& lhs, const auto& rhs) {
+        for (long i = 0; i < rhs.size(); ++i) {
+          *output[i] += *lhs[i];
+          *output[i] += *rhs[i];
+        }
+      },
+      output,
+      lhs,
+      rhs);
 }
 
 //! Compute a bitwise AND between `lhs` and `rhs`.
@@ -611,8 +824,13 @@ void bitwiseAnd(CtPtrs& output, const CtPtrs& lhs, const CtPtrs& rhs)
   assertEq(output.size(), lhs.size(), "output and lhs must be the same size.");
   assertEq(lhs.size(), rhs.size(), "lhs and rhs must be the same size.");
   vecCopy(output, lhs);
-  for (long i = 0; i < rhs.size(); ++i)
-    output[i]->multiplyBy(*rhs[i]);
+  withSpans(
+      [](const auto& output, const auto& rhs) {
+        for (long i = 0; i < rhs.size(); ++i)
+          output[i]->multiplyBy(*rhs[i]);
+      },
+      output,
+      rhs);
 }
 
 //! Compute a bitwise AND between `input` and `mask`.
@@ -624,9 +842,13 @@ void bitwiseAnd(CtPtrs& output,
            input.size(),
            "output and input must be the same size.");
   vecCopy(output, input);
-  for (long i = 0; i < output.size(); ++i)
-    if (!mask[i])
-      output[i]->clear();
+  withSpans(
+      [&](const auto& output) {
+        for (long i = 0; i < output.size(); ++i)
+          if (!mask[i])
+            output[i]->clear();
+      },
+      output);
 }
 
 //! Compute a bitwise NOT of `input`.
@@ -636,8 +858,217 @@ void bitwiseNot(CtPtrs& output, const CtPtrs& input)
            input.size(),
            "input and output must have the same size");
   vecCopy(output, input);
-  for (long i = 0; i < output.size(); ++i)
-    output[i]->addConstant(NTL::ZZ(1L));
+  withSpans(
+      [](const auto& output) {
+        for (long i = 0; i < output.size(); ++i)
+          output[i]->addConstant(NTL::ZZ(1L));
+      },
+      output);
+}
+
+typedef std::vector<std::vector<std::pair<long, long>>> PrefixStages;
+
+// The stages of a parallel-prefix carry network over n bit positions. A pair
+// (i,k) combines the generate/propagate prefix ending at i with the one
+// ending at k<i right before it, (G_i,P_i) <- (G_i + P_i*G_k, P_i*P_k).
+// The pairs of a stage are independent, they read the values from before
+// the stage. After the last stage, G_i covers all of 0..i.
+static PrefixStages prefixStages(AdderStrategy strategy, long n)
+{
+  PrefixStages stages;
+  auto addStage = [&stages](std::vector<std::pair<long, long>>&& stage) {
+    if (!stage.empty())
+      stages.push_back(std::move(stage));
+  };
+  switch (strategy) {
+  case AdderStrategy::KOGGE_STONE:
+    for (long d = 1; d < n; d *= 2) {
+      std::vector<std::pair<long, long>> stage;
+      for (long i = d; i < n; i++)
+        stage.emplace_back(i, i - d);
+      addStage(std::move(stage));
+    }
+    break;
+  case AdderStrategy::SKLANSKY:
+    for (long d = 1; d < n; d *= 2) {
+      std::vector<std::pair<long, long>> stage;
+      for (long i = d; i < n; i++)
+        if (i & d) // combine with the end of the block of 2d under i
+          stage.emplace_back(i, (i & ~(2 * d - 1)) + d - 1);
+      addStage(std::move(stage));
+    }
+    break;
+  case AdderStrategy::BRENT_KUNG: {
+    long d = 1;
+    for (; 2 * d - 1 < n; d *= 2) { // up-sweep: the prefixes ending at 2^e-1
+      std::vector<std::pair<long, long>> stage;
+      for (long i = 2 * d - 1; i < n; i += 2 * d)
+        stage.emplace_back(i, i - d);
+      addStage(std::move(stage));
+    }
+    for (d /= 2; d >= 1; d /= 2) { // down-sweep: fill in the others
+      std::vector<std::pair<long, long>> stage;
+      for (long i = 3 * d - 1; i < n; i += 2 * d)
+        stage.emplace_back(i, i - d);
+      addStage(std::move(stage));
+    }
+    break;
+  }
+  default:
+    throw InvalidArgument("Not a prefix adder strategy");
+  }
+  return stages;
+}
+
+// Simulates the prefix network of strategy, with the same rules as
+// prefixAddTwoNumbers for what is identically zero or not needed
+static AdderCost prefixAdderCost(AdderStrategy strategy,
+                                 long aSize,
+                                 long bSize,
+                                 long sizeLimit)
+{
+  long n = std::min(bSize, sizeLimit - 1); // the positions with a carry out
+  AdderCost cost{0, 0};
+  if (n <= 0)
+    return cost;
+
+  // generate: depth 1 where a[i]*b[i] is computed, zero past a
+  std::vector<long> dG(n), dP(n, 0), start(n);
+  std::vector<bool> zeroG(n);
+  for (long i = 0; i < n; i++) {
+    zeroG[i] = (i >= aSize);
+    dG[i] = zeroG[i] ? 0 : 1;
+    start[i] = i;
+    if (!zeroG[i])
+      cost.mults++;
+  }
+  for (const auto& stage : prefixStages(strategy, n)) {
+    std::vector<long> dG2 = dG, dP2 = dP, start2 = start;
+    std::vector<bool> zeroG2 = zeroG;
+    for (const auto& [i, k] : stage) {
+      if (!zeroG[k]) {
+        dG2[i] = std::max(dG[i], std::max(dP[i], dG[k]) + 1);
+        zeroG2[i] = false;
+        cost.mults++;
+      }
+      if (start[k] > 0) { // P is only needed while the prefix is partial
+        dP2[i] = std::max(dP[i], dP[k]) + 1;
+        cost.mults++;
+      }
+      start2[i] = start[k];
+    }
+    dG.swap(dG2);
+    dP.swap(dP2);
+    start.swap(start2);
+    zeroG.swap(zeroG2);
+  }
+  cost.depth = *std::max_element(dG.begin(), dG.end());
+  return cost;
+}
+
+AdderCost adderCost(AdderStrategy strategy,
+                    long lhsSize,
+                    long rhsSize,
+                    long sizeLimit)
+{
+  long aSize = std::min(lhsSize, rhsSize);
+  long bSize = std::max(lhsSize, rhsSize);
+  if (aSize < 1)
+    return AdderCost{0, 0};
+  if (sizeLimit == 0)
+    sizeLimit = bSize + 1;
+
+  if (strategy != AdderStrategy::DAG)
+    return prefixAdderCost(strategy, aSize, bSize, sizeLimit);
+
+  // Plan for fresh inputs, with room for the depth of any plan
+  long lvl = (bSize + 2) * BPL_ESTIMATE;
+  AddDAG plan(std::vector<long>(aSize, lvl), std::vector<long>(bSize, lvl));
+  return plan.cost(sizeLimit);
+}
+
+// Add a and b with a prefix network of generate (a[i]*b[i]) and propagate
+// (a[i]+b[i]) bits. Mod 2 the two are never both one, so the OR of the
+// usual carry recurrence is a XOR, i.e. an addition.
+static void prefixAddTwoNumbers(CtPtrs& sum,
+                                const CtPtrs& aa,
+                                const CtPtrs& bb,
+                                long sizeLimit,
+                                AdderStrategy strategy)
+{
+  // make sure that lsize(b) >= lsize(a)
+  const CtPtrs& a = (lsize(bb) >= lsize(aa)) ? aa : bb;
+  const CtPtrs& b = (lsize(bb) >= lsize(aa)) ? bb : aa;
+  long aSize = lsize(a);
+  long bSize = lsize(b);
+  if (sizeLimit == 0)
+    sizeLimit = bSize + 1;
+
+  const Ctxt* ct_ptr = b.ptr2nonNull();
+  if (ct_ptr == nullptr)
+    ct_ptr = a.ptr2nonNull();
+  if (ct_ptr == nullptr) { // both are zero
+    setLengthZero(sum);
+    return;
+  }
+  Ctxt zero(ZeroCtxtLike, *ct_ptr);
+
+  long m = std::min(bSize, sizeLimit);     // the positions with a sum bit
+  long n = std::min(bSize, sizeLimit - 1); // those with a carry out
+  std::vector<Ctxt> bits(m, zero), G(std::max(n, 0l), zero);
+  HELIB_EXEC_RANGE(m, first, last)
+  for (long i = first; i < last; i++) {
+    if (b.isSet(i))
+      bits[i] = *b[i];
+    if (i < aSize && a.isSet(i)) {
+      bits[i] += *a[i];
+      if (i < n && b.isSet(i)) {
+        G[i] = *a[i];
+        G[i].multiplyBy(*b[i]);
+      }
+    }
+  }
+  HELIB_EXEC_RANGE_END
+
+  std::vector<Ctxt> P(bits.begin(), bits.begin() + std::max(n, 0l));
+  std::vector<long> start(std::max(n, 0l));
+  for (long i = 0; i < n; i++)
+    start[i] = i;
+
+  for (const auto& stage : prefixStages(strategy, n)) {
+    long nPairs = lsize(stage);
+    std::vector<Ctxt> G2(nPairs, zero), P2(nPairs, zero);
+    HELIB_EXEC_RANGE(nPairs, first, last)
+    for (long t = first; t < last; t++) {
+      long i = stage[t].first, k = stage[t].second;
+      G2[t] = P[i];
+      G2[t].multiplyBy(G[k]);
+      G2[t] += G[i];
+      if (start[k] > 0) { // P is only needed while the prefix is partial
+        P2[t] = P[i];
+        P2[t].multiplyBy(P[k]);
+      }
+    }
+    HELIB_EXEC_RANGE_END
+    std::vector<long> start2 = start;
+    for (long t = 0; t < nPairs; t++) {
+      long i = stage[t].first, k = stage[t].second;
+      G[i] = G2[t];
+      P[i] = P2[t];
+      start2[i] = start[k];
+    }
+    start.swap(start2);
+  }
+
+  // sum[i] = a[i]+b[i]+carry[i], where carry[i] = G[i-1] covers 0..i-1
+  std::vector<Ctxt> out(sizeLimit, zero);
+  for (long i = 0; i < sizeLimit; i++) {
+    if (i < m)
+      out[i] = bits[i];
+    if (i >= 1 && i - 1 < n)
+      out[i] += G[i - 1];
+  }
+  vecCopy(sum, out);
 }
 
 //! Add two integers in binary representation
@@ -645,7 +1076,8 @@ void addTwoNumbers(CtPtrs& sum,
                    const CtPtrs& lhs,
                    const CtPtrs& rhs,
                    long sizeLimit,
-                   std::vector<zzX>* unpackSlotEncoding)
+                   std::vector<zzX>* unpackSlotEncoding,
+                   AdderStrategy strategy)
 {
   HELIB_TIMER_START;
   if (lsize(lhs) < 1) {
@@ -656,23 +1088,98 @@ void addTwoNumbers(CtPtrs& sum,
     return;
   }
 
+  if (strategy != AdderStrategy::DAG) {
+    // Ensure that we have enough levels for the whole network, and one
+    // more as for the DAG below, bootstrap otherwise
+    AdderCost cost = adderCost(strategy, lsize(lhs), lsize(rhs), sizeLimit);
+    long needed = (cost.depth + 1) * BPL_ESTIMATE;
+    if (findMinBitCapacity({&lhs, &rhs}) < needed) {
+      packedRecrypt(lhs, rhs, unpackSlotEncoding);
+      if (findMinBitCapacity({&lhs, &rhs}) < needed)
+        throw LogicError("not enough levels for prefix adder");
+    }
+    prefixAddTwoNumbers(sum, lhs, rhs, sizeLimit, strategy);
+    return;
+  }
+
   // Work out the order of multiplications to compute all the carry bits
-  AddDAG addPlan(lhs, rhs);
+  std::unique_ptr<AddDAG> addPlan = makeAddPlan(lhs, rhs);
 
 #ifdef HELIB_DEBUG // print plan
-  addPlan.printAddDAG();
+  addPlan->printAddDAG();
 #endif
 
   // Ensure that we have enough levels to compute everything,
   // bootstrap otherwise
-  if (addPlan.lowLvl() < BPL_ESTIMATE) {
+  if (addPlan->lowLvl() < BPL_ESTIMATE) {
     packedRecrypt(lhs, rhs, unpackSlotEncoding);
-    addPlan.init(lhs, rhs);                // Re-compute the DAG
-    if (addPlan.lowLvl() < BPL_ESTIMATE) { // still not enough levels
+    addPlan = makeAddPlan(lhs, rhs);        // Re-compute the DAG
+    if (addPlan->lowLvl() < BPL_ESTIMATE) { // still not enough levels
       throw LogicError("not enough levels for addition DAG");
     }
   }
-  addPlan.apply(sum, lhs, rhs, sizeLimit); // perform the actual addition
+  addPlan->apply(sum, lhs, rhs, sizeLimit); // perform the actual addition
+}
+
+//! Add many pairs of integers, sums[k] = lhs[k] + rhs[k]
+void addTwoNumbers(CtPtrMat& sums,
+                   const CtPtrMat& lhs,
+                   const CtPtrMat& rhs,
+                   long sizeLimit,
+                   std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  assertEq(lsize(lhs), lsize(rhs), "lhs and rhs must have the same size");
+  assertEq(lsize(sums), lsize(lhs), "sums and lhs must have the same size");
+  long n = lsize(lhs);
+
+  // Build the plans for all the pairs
+  std::vector<std::unique_ptr<AddDAG>> plans(n);
+  HELIB_EXEC_RANGE(n, first, last)
+  for (long k = first; k < last; k++)
+    if (lsize(lhs[k]) >= 1 && lsize(rhs[k]) >= 1)
+      plans[k] = makeAddPlan(lhs[k], rhs[k]);
+  HELIB_EXEC_RANGE_END
+
+  // Bootstrap the inputs of all the pairs that are too low in one go
+  std::vector<long> low;
+  std::vector<Ctxt*> lowBits;
+  for (long k = 0; k < n; k++) {
+    if (!plans[k] || plans[k]->lowLvl() >= BPL_ESTIMATE)
+      continue;
+    low.push_back(k);
+    for (const CtPtrs* num : {&lhs[k], &rhs[k]})
+      for (long i = 0; i < lsize(*num); i++)
+        if (num->isSet(i) && !(*num)[i]->isEmpty())
+          lowBits.push_back((*num)[i]);
+  }
+  if (!lowBits.empty()) {
+    assertNotNull<InvalidArgument>(unpackSlotEncoding,
+                                   "unpackSlotEncoding must not be null");
+    assertTrue(lowBits[0]->getPubKey().isBootstrappable(),
+               "public key must be bootstrappable for recryption");
+    packedRecrypt(CtPtrs_vectorPt(lowBits),
+                  *unpackSlotEncoding,
+                  lowBits[0]->getContext().getEA());
+    for (long k : low) {
+      plans[k] = makeAddPlan(lhs[k], rhs[k]); // Re-compute the DAG
+      if (plans[k]->lowLvl() < BPL_ESTIMATE)  // still not enough levels
+        throw LogicError("not enough levels for addition DAG");
+    }
+  }
+
+  // Perform the actual additions, the nested parallel loops of apply run
+  // serially when there are several pairs
+  HELIB_EXEC_RANGE(n, first, last)
+  for (long k = first; k < last; k++) {
+    if (plans[k])
+      plans[k]->apply(sums[k], lhs[k], rhs[k], sizeLimit);
+    else if (lsize(lhs[k]) < 1)
+      vecCopy(sums[k], rhs[k], sizeLimit);
+    else
+      vecCopy(sums[k], lhs[k], sizeLimit);
+  }
+  HELIB_EXEC_RANGE_END
 }
 
 // Negate a binary number that is already in 2's complement. Note: input must
@@ -851,7 +1358,7 @@ static void three4Two(CtPtrs& lsb,
   resize(tmpLsb, lsbSize, Ctxt(ZeroCtxtLike, *ctptr));
   resize(tmpMsb, msbSize, Ctxt(ZeroCtxtLike, *ctptr));
 
-  NTL_EXEC_RANGE(msbSize - 1, first, last)
+  HELIB_EXEC_RANGE(msbSize - 1, first, last)
   for (long i = first; i < last; i++) {
     if (i < lsize(*p1))
       three4Two(&tmpLsb[i], &tmpMsb[i + 1], (*p1)[i], (*p2)[i], (*p3)[i]);
@@ -860,7 +1367,7 @@ static void three4Two(CtPtrs& lsb,
     } else if (p3->isSet(i))
       tmpLsb[i] = *((*p3)[i]);
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 
   if (msbSize == lsbSize) { // we only computed upto lsbSize-1, do the last LSB
     if (p1->isSet(lsbSize - 1))
@@ -895,7 +1402,8 @@ struct PtrMatrix_PtPtrVector : PtrMatrix<T>
 void addManyNumbers(CtPtrs& sum,
                     CtPtrMat& numbers,
                     long sizeLimit,
-                    std::vector<zzX>* unpackSlotEncoding)
+                    std::vector<zzX>* unpackSlotEncoding,
+                    const RecryptSchedule& schedule)
 {
 #ifdef HELIB_DEBUG
   std::cout << " addManyNumbers: " << numbers.size()
@@ -922,9 +1430,18 @@ void addManyNumbers(CtPtrs& sum,
 
   // use 3-for-2 repeatedly until only two numbers are leff to add
   while (leftInQ > 2) {
-    // If any number is too low level, then bootstrap everything
-    PtrMatrix_PtPtrVector<Ctxt> wrapper(numPtrs);
-    if (findMinBitCapacity(wrapper) < 3 * ct_ptr->getContext().BPL()) {
+    long nTriples = leftInQ / 3;
+    long leftOver = leftInQ - (3 * nTriples);
+
+    // Only the numbers that are added in this round need the capacity for
+    // it, the leftovers are recrypted (if at all) in the next round
+    std::vector<CtPtrs*> inRound(numPtrs.begin(),
+                                 numPtrs.begin() + 3 * nTriples);
+    PtrMatrix_PtPtrVector<Ctxt> wrapper(inRound);
+    if (schedule)
+      schedule(wrapper);
+    else if (findMinBitCapacity(wrapper) < 3 * ct_ptr->getContext().BPL()) {
+      // If any number is too low level, then bootstrap everything
       assertNotNull<InvalidArgument>(unpackSlotEncoding,
                                      "unpackSlotEncoding must not be null");
       assertTrue(bootstrappable,
@@ -933,8 +1450,6 @@ void addManyNumbers(CtPtrs& sum,
       packedRecrypt(wrapper, *unpackSlotEncoding, ea, /*belowLvl=*/10);
     }
     // Prepare a vector for pointers to the output of this iteration
-    long nTriples = leftInQ / 3;
-    long leftOver = leftInQ - (3 * nTriples);
     std::vector<CtPtrs*> numPtrs2(2 * nTriples + leftOver);
 
     if (leftOver > 0) { // copy the leftover pointers
@@ -942,11 +1457,11 @@ void addManyNumbers(CtPtrs& sum,
       if (leftOver > 1)
         numPtrs2[1] = numPtrs[3 * nTriples + 1];
     }
-    // Allow multi-threading in this loop
-    //    NTL_EXEC_RANGE(nTriples, first, last)
-    //    for (long i=first; i<last; i++) {   // call the three-for-two
-    //    procedure
-    for (long i = 0; i < nTriples; i++) { // call the three-for-two procedure
+
+    // The three-for-two adders of a round are independent. With fewer of
+    // them than threads, run them one by one and let each parallelize over
+    // its bits instead (in a parallel loop the inner one runs serially).
+    auto addTriple = [&](long i) {
       three4Two(*numPtrs[3 * i],
                 *numPtrs[3 * i + 1], // three4Two works in-place
                 *numPtrs[3 * i],
@@ -956,8 +1471,16 @@ void addManyNumbers(CtPtrs& sum,
 
       numPtrs2[leftOver + 2 * i] = numPtrs[3 * i]; // copy the output pointers
       numPtrs2[leftOver + 2 * i + 1] = numPtrs[3 * i + 1];
+    };
+    if (nTriples >= helib::AvailableThreads()) {
+      HELIB_EXEC_RANGE(nTriples, first, last)
+      for (long i = first; i < last; i++)
+        addTriple(i);
+      HELIB_EXEC_RANGE_END
+    } else {
+      for (long i = 0; i < nTriples; i++)
+        addTriple(i);
     }
-    //    NTL_EXEC_RANGE_END
     numPtrs.swap(numPtrs2);   // swap input/output vectors
     leftInQ = lsize(numPtrs); // update the size
   }
@@ -991,14 +1514,14 @@ static void multByNegative(CtPtrs& product,
       }
   long nPairs = lsize(pairs);
 
-  NTL_EXEC_RANGE(nPairs, first, last)
+  HELIB_EXEC_RANGE(nPairs, first, last)
   for (long idx = first; idx < last; idx++) {
     long i, j;
     std::tie(i, j) = pairs[idx];
     numbers[i][j] = *(b[j - i]);
     numbers[i][j].multiplyBy(*(a[i])); // multiply by the bit of a
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 
   // sign extension
   for (long i = 0; i < nNums; i++)
@@ -1021,15 +1544,233 @@ static void multByNegative(CtPtrs& product,
   addManyNumbers(product, nums, resSize, unpackSlotEncoding);
 }
 
+// The operand sizes from which MultiplierStrategy::AUTO switches algorithm
+static constexpr long DADDA_MIN_BITS = 8;
+static constexpr long KARATSUBA_MIN_BITS = 32;
+
+// Multiply lhs by rhs with a Dadda tree: the partial products lhs[i]*rhs[j]
+// are kept in columns by weight, and each stage uses just enough full and
+// half adders to bring all the columns down to the next height in the
+// sequence 2,3,4,6,9,13,... The adders of a stage run in parallel, and the
+// last two rows are added with addTwoNumbers.
+static void daddaMult(CtPtrs& product,
+                      const CtPtrs& lhs,
+                      const CtPtrs& rhs,
+                      long resSize,
+                      std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  const Ctxt* ct_ptr = lhs.ptr2nonNull();
+  const Context& context = ct_ptr->getContext();
+  Ctxt zero(ZeroCtxtLike, *ct_ptr);
+
+  std::vector<std::pair<long, long>> pairs;
+  for (long i = 0; i < lsize(lhs); i++)
+    for (long j = 0; j < lsize(rhs) && i + j < resSize; j++)
+      if (lhs.isSet(i) && !lhs[i]->isEmpty() && rhs.isSet(j) &&
+          !rhs[j]->isEmpty())
+        pairs.push_back(std::pair<long, long>(i, j));
+  long nPairs = lsize(pairs);
+  std::vector<Ctxt> partials(nPairs, zero);
+  HELIB_EXEC_RANGE(nPairs, first, last)
+  for (long idx = first; idx < last; idx++) {
+    long i, j;
+    std::tie(i, j) = pairs[idx];
+    partials[idx] = *(lhs[i]);
+    partials[idx].multiplyBy(*(rhs[j]));
+  }
+  HELIB_EXEC_RANGE_END
+
+  // cols[k] holds the (non-empty) bits of weight 2^k
+  std::vector<std::vector<Ctxt>> cols(resSize);
+  for (long idx = 0; idx < nPairs; idx++)
+    cols[pairs[idx].first + pairs[idx].second].push_back(partials[idx]);
+  auto maxHeight = [&cols]() {
+    long h = 0;
+    for (const std::vector<Ctxt>& col : cols)
+      h = std::max(h, lsize(col));
+    return h;
+  };
+
+  struct Adder
+  {
+    long col, first, nIn; // adds cols[col][first..first+nIn-1]
+  };
+  for (long height = maxHeight(); height > 2; height = maxHeight()) {
+    // If any bit is too low level, then bootstrap everything
+    std::vector<Ctxt*> allBits;
+    for (std::vector<Ctxt>& col : cols)
+      for (Ctxt& ct : col)
+        allBits.push_back(&ct);
+    CtPtrs_vectorPt allPtrs(allBits);
+    if (findMinBitCapacity(allPtrs) < 3 * context.BPL()) {
+      assertNotNull<InvalidArgument>(unpackSlotEncoding,
+                                     "unpackSlotEncoding must not be null");
+      assertTrue(ct_ptr->getPubKey().isBootstrappable(),
+                 "public key must be bootstrappable for recryption");
+      packedRecrypt(allPtrs, *unpackSlotEncoding, context.getEA(), 10);
+    }
+
+    // The target height of this stage
+    long d = 2;
+    while (3 * d / 2 < height)
+      d = 3 * d / 2;
+
+    // Plan the adders, counting the carries coming in from the column below
+    std::vector<Adder> adders;
+    std::vector<long> used(resSize, 0), carriesIn(resSize + 1, 0);
+    for (long c = 0; c < resSize; c++) {
+      long h = lsize(cols[c]) + carriesIn[c];
+      while (h > d && lsize(cols[c]) - used[c] >= 2) {
+        long nIn = (h == d + 1 || lsize(cols[c]) - used[c] == 2) ? 2 : 3;
+        adders.push_back(Adder{c, used[c], nIn});
+        used[c] += nIn;
+        h -= nIn - 1;
+        carriesIn[c + 1]++;
+      }
+    }
+
+    long nAdders = lsize(adders);
+    std::vector<Ctxt> sums(nAdders, zero), carries(nAdders, zero);
+    HELIB_EXEC_RANGE(nAdders, first, last)
+    for (long t = first; t < last; t++) {
+      const std::vector<Ctxt>& col = cols[adders[t].col];
+      long f = adders[t].first;
+      bool needCarry = (adders[t].col + 1 < resSize); // else it is dropped
+      if (adders[t].nIn == 3 && needCarry)
+        three4Two(sums[t], carries[t], col[f], col[f + 1], col[f + 2]);
+      else {
+        sums[t] = col[f];
+        sums[t] += col[f + 1];
+        if (adders[t].nIn == 3)
+          sums[t] += col[f + 2];
+        else if (needCarry) {
+          carries[t] = col[f];
+          carries[t].multiplyBy(col[f + 1]);
+        }
+      }
+    }
+    HELIB_EXEC_RANGE_END
+
+    std::vector<std::vector<Ctxt>> next(resSize);
+    for (long c = 0; c < resSize; c++)
+      next[c].assign(cols[c].begin() + used[c], cols[c].end());
+    for (long t = 0; t < nAdders; t++) {
+      next[adders[t].col].push_back(sums[t]);
+      if (adders[t].col + 1 < resSize)
+        next[adders[t].col + 1].push_back(carries[t]);
+    }
+    cols.swap(next);
+  }
+
+  std::vector<Ctxt> row0(resSize, zero), row1(resSize, zero);
+  for (long c = 0; c < resSize; c++) {
+    if (lsize(cols[c]) > 0)
+      row0[c] = cols[c][0];
+    if (lsize(cols[c]) > 1)
+      row1[c] = cols[c][1];
+  }
+  addTwoNumbers(product,
+                CtPtrs_vectorCt(row0),
+                CtPtrs_vectorCt(row1),
+                resSize,
+                unpackSlotEncoding);
+}
+
+// Multiply lhs by rhs with Karatsuba: for x = x1*2^h + x0, y = y1*2^h + y0,
+// x*y = z2*2^{2h} + (z1 - z0 - z2)*2^h + z0 where z0 = x0*y0, z2 = x1*y1 and
+// z1 = (x0+x1)*(y0+y1), so three half-size products replace four. Everything
+// is computed mod 2^resSize, and the additions use a Sklansky adder since
+// they are what Karatsuba pays for the saved products.
+static void karatsubaMult(CtPtrs& product,
+                          const CtPtrs& lhs,
+                          const CtPtrs& rhs,
+                          long resSize,
+                          std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  // The bits above resSize do not affect the product mod 2^resSize
+  CtPtrs_slice x(lhs, 0, std::min(lsize(lhs), resSize));
+  CtPtrs_slice y(rhs, 0, std::min(lsize(rhs), resSize));
+  long h = std::min(lsize(x), lsize(y)) / 2;
+  if (h < 1) { // nothing to split
+    daddaMult(product, x, y, resSize, unpackSlotEncoding);
+    return;
+  }
+  long W = resSize - h; // the size of the upper part, at least h
+  Ctxt zero(ZeroCtxtLike, *(lhs.ptr2nonNull()));
+  CtPtrs_slice x0(x, 0, h), x1(x, h), y0(y, 0, h), y1(y, h);
+
+  auto mult = [&](std::vector<Ctxt>& out,
+                  const CtPtrs& a,
+                  const CtPtrs& b,
+                  long limit) {
+    CtPtrs_vectorCt out_wrapper(out);
+    multTwoNumbers(out_wrapper, a, b, false, limit, unpackSlotEncoding);
+  };
+  auto add = [&](std::vector<Ctxt>& out,
+                 const CtPtrs& a,
+                 const CtPtrs& b,
+                 long limit) {
+    limit = std::min(limit, std::max(lsize(a), lsize(b)) + 1);
+    CtPtrs_vectorCt out_wrapper(out);
+    addTwoNumbers(out_wrapper,
+                  a,
+                  b,
+                  limit,
+                  unpackSlotEncoding,
+                  AdderStrategy::SKLANSKY);
+  };
+
+  std::vector<Ctxt> z0, z1, z2, sx, sy, s;
+  mult(z0, x0, y0, 2 * h);
+  mult(z2, x1, y1, W); // all of it is needed for the middle term
+  add(sx, x0, x1, W);
+  add(sy, y0, y1, W);
+  mult(z1, CtPtrs_vectorCt(sx), CtPtrs_vectorCt(sy), W);
+  add(s, CtPtrs_vectorCt(z0), CtPtrs_vectorCt(z2), W);
+
+  // The middle term z1 - s = NOT(NOT(z1) + s) mod 2^W
+  std::vector<Ctxt> notZ1(W, zero), mid;
+  for (long i = 0; i < W; i++) {
+    if (i < lsize(z1))
+      notZ1[i] = z1[i];
+    notZ1[i].addConstant(NTL::ZZ(1L));
+  }
+  add(mid, CtPtrs_vectorCt(notZ1), CtPtrs_vectorCt(s), W);
+  mid.resize(W, zero);
+  for (Ctxt& bit : mid)
+    bit.addConstant(NTL::ZZ(1L));
+
+  // z0 / 2^h + z2 * 2^h, the two do not overlap
+  std::vector<Ctxt> top(W, zero), hi;
+  for (long k = 0; k < W; k++) {
+    if (k < h && h + k < lsize(z0))
+      top[k] = z0[h + k];
+    else if (k >= h && k - h < lsize(z2))
+      top[k] = z2[k - h];
+  }
+  add(hi, CtPtrs_vectorCt(top), CtPtrs_vectorCt(mid), W);
+
+  std::vector<Ctxt> out(resSize, zero);
+  for (long k = 0; k < h && k < lsize(z0); k++)
+    out[k] = z0[k];
+  for (long k = 0; k < W && k < lsize(hi); k++)
+    out[h + k] = hi[k];
+  vecCopy(product, out);
+}
+
 // Multiply two integers (i.e. an array of bits) lhs, rhs.
 // Computes the pairwise products x_{i,j} = lhs_i * rhs_j
-// then sums the prodcuts using the 3-for-2 method.
+// then sums the prodcuts using the 3-for-2 method, a Dadda tree, or
+// Karatsuba's method on top of these.
 void multTwoNumbers(CtPtrs& product,
                     const CtPtrs& lhs,
                     const CtPtrs& rhs,
                     bool rhsTwosComplement,
                     long sizeLimit,
-                    std::vector<zzX>* unpackSlotEncoding)
+                    std::vector<zzX>* unpackSlotEncoding,
+                    MultiplierStrategy strategy)
 {
   HELIB_TIMER_START;
   long lhsSize = lsize(lhs);
@@ -1054,7 +1795,7 @@ void multTwoNumbers(CtPtrs& product,
       return;
     }
     vecCopy(product, rhs, resSize);
-    for (long i = 0; i < resSize; i++)
+    for (long i = 0; i < lsize(product); i++)
       product[i]->multiplyBy(*(lhs[0]));
     return;
   }
@@ -1069,8 +1810,8 @@ void multTwoNumbers(CtPtrs& product,
       return;
     }
     vecCopy(product, lhs, resSize);
-    for (long i = 0; i < resSize; i++)
-      lhs[i]->multiplyBy(*(rhs[0]));
+    for (long i = 0; i < lsize(product); i++)
+      product[i]->multiplyBy(*(rhs[0]));
     return;
   }
 
@@ -1081,6 +1822,23 @@ void multTwoNumbers(CtPtrs& product,
   lhsSize = lsize(temp_lhs);
   rhsSize = lsize(temp_rhs);
 
+  if (strategy == MultiplierStrategy::AUTO) {
+    if (rhsSize >= KARATSUBA_MIN_BITS)
+      strategy = MultiplierStrategy::KARATSUBA;
+    else if (rhsSize >= DADDA_MIN_BITS)
+      strategy = MultiplierStrategy::DADDA;
+    else
+      strategy = MultiplierStrategy::WALLACE;
+  }
+  if (strategy == MultiplierStrategy::KARATSUBA) {
+    karatsubaMult(product, temp_lhs, temp_rhs, resSize, unpackSlotEncoding);
+    return;
+  }
+  if (strategy == MultiplierStrategy::DADDA) {
+    daddaMult(product, temp_lhs, temp_rhs, resSize, unpackSlotEncoding);
+    return;
+  }
+
   NTL::Vec<NTL::Vec<Ctxt>> numbers(NTL::INIT_SIZE,
                                    std::min(lsize(rhs), resSize));
   const Ctxt* ct_ptr = lhs.ptr2nonNull();
@@ -1096,14 +1854,14 @@ void multTwoNumbers(CtPtrs& product,
         pairs.push_back(std::pair<long, long>(i, j));
     }
   long nPairs = lsize(pairs);
-  NTL_EXEC_RANGE(nPairs, first, last)
+  HELIB_EXEC_RANGE(nPairs, first, last)
   for (long idx = first; idx < last; idx++) {
     long i, j;
     std::tie(i, j) = pairs[idx];
     numbers[i][j] = *(lhs[j - i]);
     numbers[i][j].multiplyBy(*(rhs[i])); // multiply by the bit of rhs
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 
   CtPtrMat_VecCt nums(numbers); // A wrapper around numbers
 #ifdef HELIB_DEBUG
@@ -1236,8 +1994,8 @@ static void fifteen4Four(const CtPtrs& out, const CtPtrs& in, long sizeLimit)
   Ctxt& e3 = c2;
   Ctxt& e4 = f2;
 
-  long nThreads = std::min(NTL::AvailableThreads(), 3L);
-  NTL_EXEC_INDEX(nThreads, index) // run these three lines in parallel
+  long nThreads = std::min(helib::AvailableThreads(), 3L);
+  HELIB_EXEC_INDEX(nThreads, index) // run these three lines in parallel
   switch (index) {
   case 0:
     three4Two(&b1, &b2, in[0], in[1], in[2]); // b2 b1 = 3for2(in[0..2])
@@ -1252,14 +2010,14 @@ static void fifteen4Four(const CtPtrs& out, const CtPtrs& in, long sizeLimit)
   default:
     three4Two(&b5, &b6, in[6], in[7], in[8]); // b6 b5 = 3for2(in[6..8])
   }
-  NTL_EXEC_INDEX_END
+  HELIB_EXEC_INDEX_END
 
   three4Two(c1, c2, b1, b3, b5); // c2 c1 = 3for2(b1,b3,b5)
 
   three4Two(c3, c4, b2, b4, b6); // c4 c3 = 3for2(b2,b4,b6)
 
-  nThreads = std::min(NTL::AvailableThreads(), 2L);
-  NTL_EXEC_INDEX(nThreads, index) // run these two lines in parallel
+  nThreads = std::min(helib::AvailableThreads(), 2L);
+  HELIB_EXEC_INDEX(nThreads, index) // run these two lines in parallel
   switch (index) {
   case 0:
     three4Two(&b7, &b8, in[9], in[10], in[11]); // b8 b7 = 3for2(in[9..11])
@@ -1269,9 +2027,9 @@ static void fifteen4Four(const CtPtrs& out, const CtPtrs& in, long sizeLimit)
   default:
     three4Two(&b9, &b10, in[12], in[13], in[14]); // b10 b9 = 3for2(in[12..14])
   }
-  NTL_EXEC_INDEX_END
+  HELIB_EXEC_INDEX_END
 
-  NTL_EXEC_INDEX(nThreads, index) // run these two lines in parallel
+  HELIB_EXEC_INDEX(nThreads, index) // run these two lines in parallel
   switch (index) {
   case 0:
     three4Two(d1, d2, b7, b9, c1); // d2 d1 = 3for2(b7,b9,c1)
@@ -1282,11 +2040,11 @@ static void fifteen4Four(const CtPtrs& out, const CtPtrs& in, long sizeLimit)
     if (sizeLimit >= 2)
       three4Two(d3, d4, b8, b10, c2); // d4 d3 = 3for2(b8,b10,c2)
   }
-  NTL_EXEC_INDEX_END
+  HELIB_EXEC_INDEX_END
   if (sizeLimit < 2)
     return;
 
-  NTL_EXEC_INDEX(nThreads, index) // run these two blocks in parallel
+  HELIB_EXEC_INDEX(nThreads, index) // run these two blocks in parallel
   switch (index) {
   case 0:
     three4Two(e1, e2, c3, d2, d3); // e2 e1 = 3for2(c3,d2,d3)
@@ -1300,7 +2058,7 @@ static void fifteen4Four(const CtPtrs& out, const CtPtrs& in, long sizeLimit)
       e4.multiplyBy(c4); // e4 = c4 * d4 (e4 alias d4)
     }
   }
-  NTL_EXEC_INDEX_END
+  HELIB_EXEC_INDEX_END
   if (sizeLimit < 3)
     return;
 
@@ -1341,6 +2099,62 @@ long fifteenOrLess4Four(const CtPtrs& out, const CtPtrs& in, long sizeLimit)
   return numNonNull;
 }
 
+void bitDecompose(CtPtrs& bits, const Ctxt& c, long nBits, bool reduce)
+{
+  HELIB_TIMER_START;
+  assertEq(c.getContext().getP(),
+           2l,
+           "bitDecompose requires ciphertexts with p = 2");
+  long r = c.effectiveR();
+  assertInRange(nBits,
+                0l,
+                r,
+                "bitDecompose: nBits must be in [0, effectiveR]",
+                /*right_inclusive=*/true);
+  if (nBits == 0)
+    nBits = r;
+
+  std::vector<Ctxt> digits;
+  if (nBits < r)
+    extendExtractDigits(digits, c, nBits, r - nBits);
+  else
+    extractDigits(digits, c, nBits);
+  if (reduce)
+    for (Ctxt& digit : digits)
+      digit.reducePtxtSpace(2);
+  vecCopy(bits, digits);
+}
+
+void bitRecompose(Ctxt& c, const CtPtrs& bits)
+{
+  HELIB_TIMER_START;
+  long n = bits.size();
+  assertTrue<InvalidArgument>(n > 0, "bitRecompose: no bits");
+  assertEq(bits[0]->getContext().getP(),
+           2l,
+           "bitRecompose requires ciphertexts with p = 2");
+
+  // The terms 2^j bits[j] are scaled independently of each other
+  std::vector<Ctxt> terms;
+  vecCopy(terms, bits);
+  HELIB_EXEC_RANGE(n, first, last)
+  for (long j = first; j < last; j++)
+    if (j > 0)
+      terms[j].multByP(j);
+  HELIB_EXEC_RANGE_END
+
+  long ptxtSpace = terms[0].getPtxtSpace();
+  for (const Ctxt& term : terms)
+    ptxtSpace = std::min(ptxtSpace, term.getPtxtSpace());
+  c = terms[0];
+  c.reducePtxtSpace(ptxtSpace);
+  for (long j = 1; j < n; j++) {
+    if (terms[j].getPtxtSpace() != ptxtSpace)
+      terms[j].reducePtxtSpace(ptxtSpace);
+    c += terms[j];
+  }
+}
+
 /********************************************************************/
 /***************** test/debugging functions *************************/
 
@@ -14,6 +14,8 @@
  * @brief Implementing integer comparison in binary representation.
  */
 #include <algorithm>
+#include <utility>
+#include <vector>
 
 #include <NTL/BasicThreadPool.h>
 #include <helib/binaryArith.h>
@@ -31,8 +33,12 @@ namespace helib {
 void runningSums(CtPtrs& v)
 {
   HELIB_TIMER_START;
-  for (long i = lsize(v) - 1; i > 0; i--)
-    *v[i - 1] += *v[i];
+  withSpans(
+      [](const auto& v) {
+        for (long i = lsize(v) - 1; i > 0; i--)
+          *v[i - 1] += *v[i];
+      },
+      v);
 }
 
 // a recursive function that computes
@@ -113,15 +119,21 @@ static void compEqGt(CtPtrs& aeqb,
   // First compute the local bits e[i]=(a[i]==b[i]), gt[i]=(a[i]>b[i])
   HELIB_NTIMER_START(compEqGt1);
   long aSize = lsize(a);
-  NTL_EXEC_RANGE(aSize, first, last)
-  for (long i = first; i < last; i++) {
-    *aeqb[i] = *b[i];               // b
-    aeqb[i]->addConstant(one, 1.0); // b+1
-    *agtb[i] = *aeqb[i];            // b+1
-    *aeqb[i] += *a[i];              // a+b+1
-    agtb[i]->multiplyBy(*a[i]);     // a(b+1)
-  }
-  NTL_EXEC_RANGE_END
+  withSpans(
+      [&](const auto& aeqb, const auto& agtb, const auto& a) {
+        NTL_EXEC_RANGE(aSize, first, last)
+        for (long i = first; i < last; i++) {
+          *aeqb[i] = *b[i];               // b
+          aeqb[i]->addConstant(one, 1.0); // b+1
+          *agtb[i] = *aeqb[i];            // b+1
+          *aeqb[i] += *a[i];              // a+b+1
+          agtb[i]->multiplyBy(*a[i]);     // a(b+1)
+        }
+        NTL_EXEC_RANGE_END
+      },
+      aeqb,
+      agtb,
+      a);
   HELIB_NTIMER_STOP(compEqGt1);
 
   // NOTE: Usually there isn't much gain in multi-threading the loop below,
@@ -236,17 +248,23 @@ void compareTwoNumbersImplementation(CtPtrs& max,
     return;
   }
 
-  NTL_EXEC_RANGE(aSize, first, last)
-  for (long i = first; i < last; i++) {
-    *max[i] = *a[i];
-    *max[i] -= *b[i];
-    max[i]->multiplyBy(*ag[i]);
+  withSpans(
+      [&](const auto& max, const auto& min, const auto& ag) {
+        NTL_EXEC_RANGE(aSize, first, last)
+        for (long i = first; i < last; i++) {
+          *max[i] = *a[i];
+          *max[i] -= *b[i];
+          max[i]->multiplyBy(*ag[i]);
 
-    *min[i] = *max[i];
-    *max[i] += *b[i];
-    *min[i] -= *a[i];
-  }
-  NTL_EXEC_RANGE_END
+          *min[i] = *max[i];
+          *max[i] += *b[i];
+          *min[i] -= *a[i];
+        }
+        NTL_EXEC_RANGE_END
+      },
+      max,
+      min,
+      ag);
   for (long i = aSize; i < bSize; i++)
     *max[i] = *b[i];
   HELIB_NTIMER_STOP(compResults);
@@ -294,4 +312,255 @@ void compareTwoNumbers(Ctxt& mu,
                                   true);
 }
 
+void compareManyToOne(std::vector<Ctxt>& mu,
+                      std::vector<Ctxt>& ni,
+                      const CtPtrMat& values,
+                      const CtPtrs& threshold,
+                      bool twosComplement,
+                      std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  long n = lsize(values);
+  long bSize = lsize(threshold);
+  const Ctxt* ct_ptr = threshold.ptr2nonNull();
+  assertNotNull<InvalidArgument>(ct_ptr, "threshold must not be empty");
+  for (long k = 0; k < n; k++)
+    assertEq<InvalidArgument>(lsize(values[k]),
+                              bSize,
+                              "values must have the size of the threshold");
+  const Context& context = ct_ptr->getContext();
+  const Ctxt zeroCtxt(ZeroCtxtLike, *ct_ptr);
+  mu.assign(n, zeroCtxt);
+  ni.assign(n, zeroCtxt);
+  if (n < 1)
+    return;
+
+  // Check that we have enough levels, bootstrap all the low ones together
+  long needed = NTL::NumBits(bSize + 1) + 2;
+  auto minCapacity = [&]() {
+    return std::min(findMinBitCapacity(values), findMinBitCapacity(threshold));
+  };
+  if (minCapacity() < needed * context.BPL()) {
+    assertNotNull<InvalidArgument>(unpackSlotEncoding,
+                                   "unpackSlotEncoding must not be null");
+    assertTrue(ct_ptr->getPubKey().isBootstrappable(),
+               "public key must be bootstrappable for recryption");
+    std::vector<Ctxt*> bits;
+    for (long i = 0; i < bSize; i++)
+      if (threshold.isSet(i))
+        bits.push_back(threshold[i]);
+    for (long k = 0; k < n; k++)
+      for (long i = 0; i < bSize; i++)
+        if (values[k].isSet(i))
+          bits.push_back(values[k][i]);
+    packedRecrypt(CtPtrs_vectorPt(bits),
+                  *unpackSlotEncoding,
+                  context.getEA(),
+                  needed);
+  }
+  if (minCapacity() < (NTL::NumBits(bSize) + 1) * context.BPL())
+    // the bare minimum
+    throw LogicError("not enough levels for comparison");
+
+  // The shared operand enters the local bits only through t[i]+1, so this
+  // is computed once for all the values
+  DoubleCRT one(context, context.allPrimes());
+  one += 1L;
+  std::vector<Ctxt> notT(bSize, zeroCtxt);
+  for (long i = 0; i < bSize; i++) {
+    notT[i] = *threshold[i];
+    notT[i].addConstant(one, 1.0); // t+1
+  }
+
+  auto compareOne = [&](long k) {
+    const CtPtrs& a = values[k];
+    // e[i]=(a[i]==t[i]) = a+t+1, gt[i]=(a[i]>t[i]) = a(t+1)
+    std::vector<Ctxt> e(notT), gt(notT);
+    for (long i = 0; i < bSize; i++) {
+      e[i] += *a[i];
+      gt[i].multiplyBy(*a[i]);
+    }
+    CtPtrs_vectorCt eq(e), gr(gt);
+    compProducts(CtPtrs_slice(eq, 0), CtPtrs_slice(gr, 0));
+    runningSums(gr); // now gt[i] = (a>t upto bit i)
+
+    mu[k] = gt[0]; // a > t
+    ni[k] = gt[0];
+    ni[k].addConstant(NTL::ZZ(1L)); // a <= t
+    ni[k] += e[0];                  // a < t
+    if (twosComplement) { // flip both iff the sign bits differ
+      (mu[k] += *a[bSize - 1]) += *threshold[bSize - 1];
+      (ni[k] += *a[bSize - 1]) += *threshold[bSize - 1];
+    }
+  };
+
+  // Too few values to keep all the threads busy, let each comparison
+  // parallelize over its bits instead
+  if (n >= NTL::AvailableThreads()) {
+    NTL_EXEC_RANGE(n, first, last)
+    for (long k = first; k < last; k++)
+      compareOne(k);
+    NTL_EXEC_RANGE_END
+  } else {
+    for (long k = 0; k < n; k++)
+      compareOne(k);
+  }
+}
+
+typedef std::vector<std::pair<long, long>> ComparatorLayer;
+
+// The comparators of Batcher's odd-even merge sort on n inputs, grouped in
+// layers of disjoint pairs (lo,hi)
+static std::vector<ComparatorLayer> sortingLayers(long n)
+{
+  std::vector<ComparatorLayer> layers;
+  for (long p = 1; p < n; p <<= 1)
+    for (long k = p; k >= 1; k >>= 1) {
+      ComparatorLayer layer;
+      for (long j = k % p; j + k < n; j += 2 * k)
+        for (long i = 0; i < std::min(k, n - j - k); i++)
+          if ((i + j) / (2 * p) == (i + j + k) / (2 * p))
+            layer.emplace_back(i + j, i + j + k);
+      if (!layer.empty())
+        layers.push_back(layer);
+    }
+  return layers;
+}
+
+// Replace nums[lo], nums[hi] by their min and max, for all the pairs of the
+// layer. The numbers must all have the same size.
+static void compareExchange(std::vector<std::vector<Ctxt>>& nums,
+                            const ComparatorLayer& layer,
+                            bool twosComplement,
+                            std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  long nPairs = lsize(layer);
+  if (nPairs < 1)
+    return;
+
+  // Bootstrap the low numbers of the whole layer together, rather than
+  // pair by pair in compareTwoNumbers
+  std::vector<Ctxt*> bits;
+  for (const std::pair<long, long>& pr : layer)
+    for (long idx : {pr.first, pr.second})
+      for (Ctxt& ct : nums[idx])
+        bits.push_back(&ct);
+  CtPtrs_vectorPt bitPtrs(bits);
+  const Context& context = bits[0]->getContext();
+  long needed = NTL::NumBits(lsize(nums[layer[0].first]) + 1) + 2;
+  if (findMinBitCapacity(bitPtrs) < needed * context.BPL()) {
+    assertNotNull<InvalidArgument>(unpackSlotEncoding,
+                                   "unpackSlotEncoding must not be null");
+    assertTrue(bits[0]->getPubKey().isBootstrappable(),
+               "public key must be bootstrappable for recryption");
+    packedRecrypt(bitPtrs, *unpackSlotEncoding, context.getEA(), needed);
+  }
+
+  auto exchange = [&](long t) {
+    std::vector<Ctxt>& lo = nums[layer[t].first];
+    std::vector<Ctxt>& hi = nums[layer[t].second];
+    std::vector<Ctxt> mx, mn;
+    CtPtrs_vectorCt maxWrapper(mx), minWrapper(mn);
+    Ctxt mu(ZeroCtxtLike, lo[0]), ni(ZeroCtxtLike, lo[0]);
+    compareTwoNumbers(maxWrapper,
+                      minWrapper,
+                      mu,
+                      ni,
+                      CtPtrs_vectorCt(lo),
+                      CtPtrs_vectorCt(hi),
+                      twosComplement,
+                      unpackSlotEncoding);
+    lo = mn;
+    hi = mx;
+  };
+  if (nPairs >= NTL::AvailableThreads()) {
+    NTL_EXEC_RANGE(nPairs, first, last)
+    for (long t = first; t < last; t++)
+      exchange(t);
+    NTL_EXEC_RANGE_END
+  } else {
+    for (long t = 0; t < nPairs; t++)
+      exchange(t);
+  }
+}
+
+// Copy the numbers out of a matrix, checking that they have the same size
+static std::vector<std::vector<Ctxt>> copyNumbers(const CtPtrMat& numbers)
+{
+  std::vector<std::vector<Ctxt>> nums(lsize(numbers));
+  for (long k = 0; k < lsize(numbers); k++) {
+    assertTrue<InvalidArgument>(lsize(numbers[k]) >= 1,
+                                "numbers must not be empty");
+    assertEq<InvalidArgument>(lsize(numbers[k]),
+                              lsize(numbers[0]),
+                              "numbers must have the same size");
+    vecCopy(nums[k], numbers[k]);
+  }
+  return nums;
+}
+
+void minMaxOfNumbers(CtPtrs& max,
+                     CtPtrs& min,
+                     const CtPtrMat& numbers,
+                     bool twosComplement,
+                     std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(lsize(numbers) >= 1,
+                              "there must be at least one number");
+  std::vector<std::vector<Ctxt>> nums = copyNumbers(numbers);
+  if (lsize(nums) == 1) {
+    vecCopy(max, nums[0]);
+    vecCopy(min, nums[0]);
+    return;
+  }
+  if (lsize(nums) % 2 == 1) // a copy of the last one does not change anything
+    nums.push_back(nums.back());
+
+  // Compare the numbers in pairs, then run a tournament among the smaller
+  // ones for the min and among the larger ones for the max. The two
+  // tournaments share the layers of comparisons.
+  ComparatorLayer layer;
+  std::vector<long> minIdx, maxIdx;
+  for (long k = 0; k < lsize(nums); k += 2) {
+    layer.emplace_back(k, k + 1);
+    minIdx.push_back(k);
+    maxIdx.push_back(k + 1);
+  }
+  compareExchange(nums, layer, twosComplement, unpackSlotEncoding);
+
+  while (lsize(minIdx) > 1) {
+    layer.clear();
+    std::vector<long> nextMin, nextMax;
+    for (long t = 0; t + 1 < lsize(minIdx); t += 2) {
+      layer.emplace_back(minIdx[t], minIdx[t + 1]);
+      layer.emplace_back(maxIdx[t], maxIdx[t + 1]);
+      nextMin.push_back(minIdx[t]);
+      nextMax.push_back(maxIdx[t + 1]);
+    }
+    if (lsize(minIdx) % 2 == 1) {
+      nextMin.push_back(minIdx.back());
+      nextMax.push_back(maxIdx.back());
+    }
+    compareExchange(nums, layer, twosComplement, unpackSlotEncoding);
+    minIdx.swap(nextMin);
+    maxIdx.swap(nextMax);
+  }
+  vecCopy(max, nums[maxIdx[0]]);
+  vecCopy(min, nums[minIdx[0]]);
+}
+
+void sortNumbers(CtPtrMat& numbers,
+                 bool twosComplement,
+                 std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  std::vector<std::vector<Ctxt>> nums = copyNumbers(numbers);
+  for (const ComparatorLayer& layer : sortingLayers(lsize(nums)))
+    compareExchange(nums, layer, twosComplement, unpackSlotEncoding);
+  for (long k = 0; k < lsize(numbers); k++)
+    vecCopy(numbers[k], nums[k]);
+}
+
 } // namespace helib
@@ -9,6 +9,10 @@
  * See the License for the specific language governing permissions and
  * limitations under the License. See accompanying LICENSE file.
  */
+#include <algorithm>
+
+#include <NTL/BasicThreadPool.h>
+
 #include "binio.h"
 #include <helib/assertions.h>
 #include <sys/types.h> // byte order macros in a platform-independent way.
@@ -24,6 +28,17 @@ bool readEyeCatcher(std::istream& str,
   return eye == expect;
 }
 
+int readEyeCatcher(std::istream& str,
+                   const std::array<char, EyeCatcher::SIZE>& first,
+                   const std::array<char, EyeCatcher::SIZE>& second)
+{
+  std::array<char, EyeCatcher::SIZE> eye;
+  str.read(eye.data(), EyeCatcher::SIZE);
+  if (eye == first)
+    return 0;
+  return (eye == second) ? 1 : -1;
+}
+
 void writeEyeCatcher(std::ostream& str,
                      const std::array<char, EyeCatcher::SIZE>& eye)
 {
@@ -145,6 +160,76 @@ void read_ntl_vec_long(std::istream& str, NTL::vec_long& vl)
   }
 }
 
+void skip_ntl_vec_long(std::istream& str)
+{
+  int sizeOfVL = read_raw_int32(str);
+  int intSize = read_raw_int32(str);
+  assertTrue<InvalidArgument>(intSize == Binio::BIT64 ||
+                                  intSize == Binio::BIT32,
+                              "intSize must be 32 or 64 bit for binary IO");
+  str.seekg(std::streamoff(sizeOfVL) * intSize, std::ios_base::cur);
+}
+
+void write_packed_vec_long(std::ostream& str,
+                           const NTL::vec_long& vl,
+                           long nbits)
+{
+  assertInRange<InvalidArgument>(nbits,
+                                 1l,
+                                 64l,
+                                 "nbits must be in [1, 64) for packed IO");
+  write_raw_int32(str, vl.length());
+  write_raw_int32(str, nbits);
+
+  std::vector<unsigned char> bytes((vl.length() * nbits + 7) / 8, 0);
+  unsigned long mask = (1UL << nbits) - 1;
+  long pos = 0; // in bits
+  for (long i = 0; i < vl.length(); i++) {
+    unsigned long v = static_cast<unsigned long>(vl[i]);
+    assertTrue<InvalidArgument>((v & ~mask) == 0,
+                                "Value does not fit in nbits for packed IO");
+    for (long done = 0; done < nbits;) {
+      long shift = pos % 8;
+      long take = std::min(8 - shift, nbits - done);
+      bytes[pos / 8] |= ((v >> done) & ((1UL << take) - 1)) << shift;
+      done += take;
+      pos += take;
+    }
+  }
+  str.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+void read_packed_vec_long(std::istream& str, NTL::vec_long& vl, long nbits)
+{
+  int sizeOfVL = read_raw_int32(str);
+  int bitsRead = read_raw_int32(str);
+  assertEq<IOError>(long(bitsRead),
+                    nbits,
+                    "Packed vector does not have the expected bit width");
+  assertTrue<IOError>(sizeOfVL >= 0 && nbits > 0 && nbits < 64,
+                      "Bad packed vector header");
+
+  std::vector<unsigned char> bytes((long(sizeOfVL) * nbits + 7) / 8);
+  str.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+  assertTrue<IOError>(bool(str), "Truncated packed vector");
+
+  vl.SetLength(sizeOfVL);
+  long pos = 0; // in bits
+  for (long i = 0; i < sizeOfVL; i++) {
+    unsigned long v = 0;
+    for (long done = 0; done < nbits;) {
+      long shift = pos % 8;
+      long take = std::min(8 - shift, nbits - done);
+      v |= ((static_cast<unsigned long>(bytes[pos / 8]) >> shift) &
+            ((1UL << take) - 1))
+           << done;
+      done += take;
+      pos += take;
+    }
+    vl[i] = v;
+  }
+}
+
 void write_raw_double(std::ostream& str, const double d)
 {
   // FIXME: this is not portable:
@@ -248,4 +333,79 @@ void write_raw_vector<double>(std::ostream& str, const std::vector<double>& v)
     write_raw_double(str, n);
 }
 
+uint32_t crc32(const char* data, std::size_t len)
+{
+  static const std::array<uint32_t, 256> table = []() {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  uint32_t crc = 0xFFFFFFFFu;
+  for (std::size_t i = 0; i < len; i++)
+    crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^
+          (crc >> 8);
+  return crc ^ 0xFFFFFFFFu;
+}
+
+void write_chunks(std::ostream& str, const std::vector<std::string>& chunks)
+{
+  long n = chunks.size();
+  std::vector<uint32_t> crcs(n);
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i = first; i < last; i++)
+    crcs[i] = crc32(chunks[i].data(), chunks[i].size());
+  NTL_EXEC_RANGE_END
+
+  writeEyeCatcher(str, EyeCatcher::CHUNKS_BEGIN);
+  write_raw_int(str, n);
+  for (long i = 0; i < n; i++) {
+    write_raw_int(str, chunks[i].size());
+    write_raw_int(str, crcs[i]);
+  }
+  for (const std::string& chunk : chunks)
+    str.write(chunk.data(), chunk.size());
+  writeEyeCatcher(str, EyeCatcher::CHUNKS_END);
+}
+
+std::vector<std::string> read_chunks(std::istream& str)
+{
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::CHUNKS_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound, "Could not find pre-chunks eyecatcher");
+
+  long n = read_raw_int(str);
+  assertTrue<IOError>(n >= 0, "Negative number of chunks");
+  std::vector<long> sizes(n);
+  std::vector<uint32_t> crcs(n);
+  for (long i = 0; i < n; i++) {
+    sizes[i] = read_raw_int(str);
+    crcs[i] = read_raw_int(str);
+    assertTrue<IOError>(sizes[i] >= 0, "Negative chunk size");
+  }
+
+  std::vector<std::string> chunks(n);
+  for (long i = 0; i < n; i++) {
+    chunks[i].resize(sizes[i]);
+    str.read(&chunks[i][0], sizes[i]);
+    assertTrue<IOError>(bool(str), "Truncated chunk");
+  }
+
+  std::vector<char> ok(n);
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i = first; i < last; i++)
+    ok[i] = (crc32(chunks[i].data(), chunks[i].size()) == crcs[i]);
+  NTL_EXEC_RANGE_END
+  for (long i = 0; i < n; i++)
+    assertTrue<IOError>(ok[i], "CRC mismatch in chunk " + std::to_string(i));
+
+  eyeCatcherFound = readEyeCatcher(str, EyeCatcher::CHUNKS_END);
+  assertTrue<IOError>(eyeCatcherFound, "Could not find post-chunks eyecatcher");
+  return chunks;
+}
+
 } // namespace helib
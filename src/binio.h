@@ -17,7 +17,9 @@
 #include <type_traits>
 #include <cstdint>
 #include <sstream>
+#include <string>
 #include <helib/assertions.h>
+#include <helib/SmallVector.h>
 #include <helib/version.h>
 
 #include <NTL/xdouble.h>
@@ -41,14 +43,41 @@ struct EyeCatcher
   static constexpr std::array<char, SIZE> HEADER_END    = {']','H','E','|'};
   static constexpr std::array<char, SIZE> CONTEXT_BEGIN = {'|','C','N','['};
   static constexpr std::array<char, SIZE> CONTEXT_END   = {']','C','N','|'};
+  static constexpr std::array<char, SIZE> SNAP_BEGIN    = {'|','C','T','['};
+  static constexpr std::array<char, SIZE> SNAP_END      = {']','C','T','|'};
   static constexpr std::array<char, SIZE> CTXT_BEGIN    = {'|','C','X','['};
   static constexpr std::array<char, SIZE> CTXT_END      = {']','C','X','|'};
+  static constexpr std::array<char, SIZE> SEEDED_BEGIN  = {'|','C','S','['};
+  static constexpr std::array<char, SIZE> SEEDED_END    = {']','C','S','|'};
+  static constexpr std::array<char, SIZE> COMPACT_BEGIN = {'|','C','P','['};
+  static constexpr std::array<char, SIZE> COMPACT_END   = {']','C','P','|'};
+  static constexpr std::array<char, SIZE> MAPPED_BEGIN  = {'|','M','K','['};
+  static constexpr std::array<char, SIZE> MAPPED_END    = {']','M','K','|'};
   static constexpr std::array<char, SIZE> PK_BEGIN      = {'|','P','K','['};
   static constexpr std::array<char, SIZE> PK_END        = {']','P','K','|'};
   static constexpr std::array<char, SIZE> SK_BEGIN      = {'|','S','K','['};
   static constexpr std::array<char, SIZE> SK_END        = {']','S','K','|'};
   static constexpr std::array<char, SIZE> SKM_BEGIN     = {'|','K','M','['};
   static constexpr std::array<char, SIZE> SKM_END       = {']','K','M','|'};
+  // Key-switching matrices whose seed has KeySwitch::INDEXED_SEED_BIT set
+  static constexpr std::array<char, SIZE> SKI_BEGIN     = {'|','K','I','['};
+  static constexpr std::array<char, SIZE> SKI_END       = {']','K','I','|'};
+  static constexpr std::array<char, SIZE> MATMUL_BEGIN  = {'|','M','M','['};
+  static constexpr std::array<char, SIZE> MATMUL_END    = {']','M','M','|'};
+  static constexpr std::array<char, SIZE> EVALMAP_BEGIN = {'|','E','M','['};
+  static constexpr std::array<char, SIZE> EVALMAP_END   = {']','E','M','|'};
+  static constexpr std::array<char, SIZE> RECRYPT_BEGIN = {'|','R','C','['};
+  static constexpr std::array<char, SIZE> RECRYPT_END   = {']','R','C','|'};
+  static constexpr std::array<char, SIZE> SHARD_BEGIN   = {'|','S','D','['};
+  static constexpr std::array<char, SIZE> SHARD_END     = {']','S','D','|'};
+  static constexpr std::array<char, SIZE> PERMNET_BEGIN = {'|','P','N','['};
+  static constexpr std::array<char, SIZE> PERMNET_END   = {']','P','N','|'};
+  static constexpr std::array<char, SIZE> CHUNKS_BEGIN  = {'|','C','K','['};
+  static constexpr std::array<char, SIZE> CHUNKS_END    = {']','C','K','|'};
+  static constexpr std::array<char, SIZE> PACKED_BEGIN  = {'|','P','D','['};
+  static constexpr std::array<char, SIZE> PACKED_END    = {']','P','D','|'};
+  static constexpr std::array<char, SIZE> DIST_BEGIN    = {'|','D','X','['};
+  static constexpr std::array<char, SIZE> DIST_END      = {']','D','X','|'};
   // clang-format on
 };
 
@@ -63,6 +92,7 @@ class Context;
 class PubKey;
 class SecKey;
 class Ctxt;
+class MatMulExecBase;
 
 template <>
 inline constexpr char nameToStructId<Context>()
@@ -84,6 +114,11 @@ inline constexpr char nameToStructId<Ctxt>()
 {
   return 20;
 }
+template <>
+inline constexpr char nameToStructId<MatMulExecBase>()
+{
+  return 25;
+}
 
 // Already broken into bytes, thus should be the same written and read in bog
 // or little endian.
@@ -148,6 +183,11 @@ struct SerializeHeader
 
 bool readEyeCatcher(std::istream& str,
                     const std::array<char, EyeCatcher::SIZE>& expect);
+// Read an eye catcher that may be either of two: return 0 for first, 1 for
+// second, or -1 if it is neither
+int readEyeCatcher(std::istream& str,
+                   const std::array<char, EyeCatcher::SIZE>& first,
+                   const std::array<char, EyeCatcher::SIZE>& second);
 void writeEyeCatcher(std::ostream& str,
                      const std::array<char, EyeCatcher::SIZE>& eye);
 
@@ -155,6 +195,16 @@ void write_ntl_vec_long(std::ostream& str,
                         const NTL::vec_long& vl,
                         long intSize = Binio::BIT64);
 void read_ntl_vec_long(std::istream& str, NTL::vec_long& vl);
+// Move past a vector written by write_ntl_vec_long, without reading it
+void skip_ntl_vec_long(std::istream& str);
+
+// Bit-packed vectors of values in [0, 2^nbits), with 0 < nbits < 64.
+// The values are written in little-endian bit order, using
+// ceil(length * nbits / 8) bytes after the length and nbits.
+void write_packed_vec_long(std::ostream& str,
+                           const NTL::vec_long& vl,
+                           long nbits);
+void read_packed_vec_long(std::istream& str, NTL::vec_long& vl, long nbits);
 
 long read_raw_int(std::istream& str);
 int read_raw_int32(std::istream& str);
@@ -170,6 +220,52 @@ NTL::xdouble read_raw_xdouble(std::istream& str);
 void write_raw_ZZ(std::ostream& str, const NTL::ZZ& zz);
 void read_raw_ZZ(std::istream& str, NTL::ZZ& zz);
 
+// The CRC-32 (IEEE 802.3 polynomial) of len bytes
+uint32_t crc32(const char* data, std::size_t len);
+
+// The buffer of a FingerprintStream, a base class of it so that it is
+// constructed before the std::ostream that is handed a pointer to it
+struct FingerprintBuffer : std::streambuf
+{
+  uint64_t hash = 14695981039346656037ULL; // FNV-1a offset basis
+
+  void add(unsigned char c)
+  {
+    hash ^= c;
+    hash *= 1099511628211ULL; // FNV-1a prime
+  }
+  int_type overflow(int_type c) override
+  {
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+      add(traits_type::to_char_type(c));
+    return traits_type::not_eof(c);
+  }
+  std::streamsize xsputn(const char* s, std::streamsize n) override
+  {
+    for (std::streamsize i = 0; i < n; i++)
+      add(s[i]);
+    return n;
+  }
+};
+
+// An output stream that keeps the 64-bit FNV-1a hash of what is written to
+// it and discards the bytes, so that large objects can be hashed through
+// their writeTo without holding their serialization in memory
+class FingerprintStream : private FingerprintBuffer, public std::ostream
+{
+public:
+  FingerprintStream() : FingerprintBuffer(), std::ostream(this) {}
+  uint64_t hash() const { return FingerprintBuffer::hash; }
+};
+
+// Chunked blocks: the number of chunks, an index of (size, CRC-32) pairs,
+// then the chunks back to back, each with a single write. The index lets a
+// reader take the chunks apart before decoding any of them, so they can be
+// encoded and decoded concurrently.
+void write_chunks(std::ostream& str, const std::vector<std::string>& chunks);
+// Reads the chunks, and throws IOError if the CRC of any of them is wrong
+std::vector<std::string> read_chunks(std::istream& str);
+
 template <typename T>
 void write_raw_vector(std::ostream& str, const std::vector<T>& v)
 {
@@ -200,6 +296,28 @@ void read_raw_vector(std::istream& str, std::vector<T>& v, T& init)
   }
 }
 
+// The same, for the parts of a ciphertext
+template <typename T, std::size_t N>
+void write_raw_vector(std::ostream& str, const SmallVector<T, N>& v)
+{
+  write_raw_int(str, v.size());
+
+  for (const T& n : v) {
+    n.writeTo(str);
+  }
+}
+
+template <typename T, std::size_t N>
+void read_raw_vector(std::istream& str, SmallVector<T, N>& v, T& init)
+{
+  long sz = read_raw_int(str);
+  v.resize(sz, init);
+
+  for (auto& n : v) {
+    n.read(str);
+  }
+}
+
 // FIXME: Change other method adding _inplace or this to read_return to
 // distinguish them
 template <typename T, typename CTy>
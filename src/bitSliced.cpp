@@ -0,0 +1,212 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* bitSliced.cpp - binary numbers with all of their bits in one ciphertext
+ */
+#include <algorithm>
+
+#include <NTL/BasicThreadPool.h>
+
+#include <helib/bitSliced.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+// An encoding of one in the slots of blocks first..last-1 of count slots
+static void blockMask(EncodedPtxt& mask,
+                      const EncryptedArray& ea,
+                      long count,
+                      long first,
+                      long last)
+{
+  std::vector<long> slots(ea.size(), 0);
+  for (long i = first * count; i < last * count; i++)
+    slots[i] = 1;
+  ea.encode(mask, slots);
+}
+
+static const Ctxt& someBit(const CtPtrs& bits)
+{
+  const Ctxt* ct = bits.ptr2nonNull();
+  assertNotNull<InvalidArgument>(ct, "No bits to pack");
+  return *ct;
+}
+
+static void assertMatching(const BitSlicedNums& a, const BitSlicedNums& b)
+{
+  assertTrue<InvalidArgument>(&a.getEA() == &b.getEA() &&
+                                  a.bitSize() == b.bitSize() &&
+                                  a.count() == b.count(),
+                              "Bit-sliced numbers with different layouts");
+}
+
+BitSlicedNums::BitSlicedNums(const EncryptedArray& ea,
+                             const CtPtrs& bits,
+                             long count) :
+    ea(&ea),
+    nBits(lsize(bits)),
+    nNums(count),
+    ctxt(ZeroCtxtLike, someBit(bits))
+{
+  HELIB_TIMER_START;
+  assertEq<InvalidArgument>(ea.getContext().getAlMod().getPPowR(),
+                            2L,
+                            "Bit-sliced numbers need p=2 and r=1");
+  assertTrue<InvalidArgument>(nBits > 0 && nNums > 0 &&
+                                  nBits * nNums <= ea.size(),
+                              "The bits of the numbers do not fit in a ctxt");
+
+  EncodedPtxt mask;
+  blockMask(mask, ea, nNums, 0, 1);
+  std::vector<Ctxt> blocks(nBits, ctxt);
+  NTL_EXEC_RANGE(nBits, first, last)
+  for (long k = first; k < last; k++) {
+    blocks[k] = *bits[k];
+    blocks[k].multByConstant(mask);
+    if (k > 0)
+      ea.rotate(blocks[k], k * nNums);
+  }
+  NTL_EXEC_RANGE_END
+  for (const Ctxt& block : blocks)
+    ctxt += block;
+}
+
+void BitSlicedNums::unpack(CtPtrs& bits) const
+{
+  HELIB_TIMER_START;
+  resize(bits, nBits, ctxt);
+
+  EncodedPtxt mask;
+  blockMask(mask, *ea, nNums, 0, 1);
+  NTL_EXEC_RANGE(nBits, first, last)
+  for (long k = first; k < last; k++) {
+    *bits[k] = ctxt;
+    if (k > 0)
+      ea->rotate(*bits[k], -k * nNums);
+    bits[k]->multByConstant(mask);
+  }
+  NTL_EXEC_RANGE_END
+}
+
+void BitSlicedNums::decrypt(std::vector<long>& nums, const SecKey& sKey) const
+{
+  std::vector<long> slots;
+  ea->decrypt(ctxt, sKey, slots);
+  nums.assign(nNums, 0);
+  for (long k = 0; k < nBits; k++)
+    for (long j = 0; j < nNums; j++)
+      nums[j] |= (slots[k * nNums + j] & 1) << k;
+}
+
+void addBitSliced(BitSlicedNums& sum,
+                  const BitSlicedNums& lhs,
+                  const BitSlicedNums& rhs)
+{
+  HELIB_TIMER_START;
+  assertMatching(lhs, rhs);
+  const EncryptedArray& ea = lhs.getEA();
+  long n = lhs.count();
+  long nBits = lhs.bitSize();
+
+  // g[k] = a[k]*b[k] generates a carry and p[k] = a[k]+b[k] propagates one
+  Ctxt g(lhs.ctxt);
+  g.multiplyBy(rhs.ctxt);
+  Ctxt p(lhs.ctxt);
+  p += rhs.ctxt;
+  Ctxt partial(p);
+
+  // After the stage of shift s, g[k] is the carry out of bit k from bits
+  // max(0,k-2s+1)..k. Blocks below s have nothing to combine with, the zero
+  // shifted into them leaves g as it is. Their p becomes zero, which is
+  // harmless: their g already covers bit 0, where there is no carry in.
+  for (long s = 1; s < nBits; s *= 2) {
+    Ctxt gs(g);
+    ea.shift(gs, s * n);
+    gs.multiplyBy(p);
+    g += gs;
+    if (2 * s < nBits) {
+      Ctxt ps(p);
+      ea.shift(ps, s * n);
+      p.multiplyBy(ps);
+    }
+  }
+
+  // The carry into bit k is the carry out of bit k-1. The shift also moves
+  // the carry out of the top bit, and garbage left by the stages, past the
+  // numbers, where they are cleared if there are slots left.
+  ea.shift(g, n);
+  partial += g;
+  if (nBits * n < ea.size()) {
+    EncodedPtxt mask;
+    blockMask(mask, ea, n, 0, nBits);
+    partial.multByConstant(mask);
+  }
+
+  sum.ea = &ea;
+  sum.nBits = nBits;
+  sum.nNums = n;
+  sum.ctxt = std::move(partial);
+}
+
+void compareBitSliced(Ctxt& mu,
+                      Ctxt& ni,
+                      const BitSlicedNums& a,
+                      const BitSlicedNums& b)
+{
+  HELIB_TIMER_START;
+  assertMatching(a, b);
+  const EncryptedArray& ea = a.getEA();
+  long n = a.count();
+  long nBits = a.bitSize();
+
+  // The local bits e[k] = (a[k]==b[k]) = a[k]+b[k]+1 and
+  // g[k] = (a[k]>b[k]) = a[k]*(b[k]+1), kept at zero past the numbers
+  EncodedPtxt ones;
+  blockMask(ones, ea, n, 0, nBits);
+  Ctxt e(b.ctxt);
+  e.addConstant(ones);
+  Ctxt g(a.ctxt);
+  g.multiplyBy(e);
+  e += a.ctxt;
+
+  // After the stage of shift s, (e[k], g[k]) compare bits k..k+2s-1 (or
+  // up to the top bit). The higher half comes down from block k+s; blocks
+  // without one get the identity (1, 0) instead: a zero for g, and a one
+  // added to the zero shifted into e.
+  for (long s = 1; s < nBits; s *= 2) {
+    Ctxt gs(g);
+    ea.shift(gs, -s * n);
+    Ctxt es(e);
+    ea.shift(es, -s * n);
+    EncodedPtxt identity;
+    blockMask(identity, ea, n, std::max(nBits - s, 0L), nBits);
+    es.addConstant(identity);
+
+    // (e, g) <- (es*e, gs + es*g)
+    g.multiplyBy(es);
+    g += gs;
+    e.multiplyBy(es);
+  }
+
+  // a<b is neither a>b nor a==b
+  EncodedPtxt first;
+  blockMask(first, ea, n, 0, 1);
+  ni = g;
+  ni += e;
+  ni.multByConstant(first);
+  ni.addConstant(first);
+  mu = std::move(g);
+  mu.multByConstant(first);
+}
+
+} // namespace helib
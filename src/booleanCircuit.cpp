@@ -0,0 +1,511 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <helib/booleanCircuit.h>
+#include <helib/circuit.h>
+#include <helib/Context.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+// The next line of str that is not blank, split into tokens
+static bool readTokens(std::istream& str, std::vector<std::string>& tokens)
+{
+  std::string line;
+  while (std::getline(str, line)) {
+    std::istringstream words(line);
+    tokens.clear();
+    for (std::string word; words >> word;)
+      tokens.push_back(word);
+    if (!tokens.empty())
+      return true;
+  }
+  return false;
+}
+
+static long readNumber(const std::string& token)
+{
+  std::size_t end = 0;
+  long value = -1;
+  try {
+    value = std::stol(token, &end);
+  } catch (const std::exception&) {
+  }
+  assertTrue<IOError>(end == token.size() && value >= 0,
+                      "BooleanCircuit: bad number " + token);
+  return value;
+}
+
+BooleanCircuit::BooleanCircuit(std::istream& str)
+{
+  HELIB_TIMER_START;
+  nodes.push_back(Node{Kind::CONST, -1, -1, 0});
+
+  std::vector<std::string> header, ins, line;
+  assertTrue<IOError>(readTokens(str, header) && header.size() == 2,
+                      "BooleanCircuit: bad header");
+  long nGates = readNumber(header[0]);
+  long nWires = readNumber(header[1]);
+  assertTrue<IOError>(readTokens(str, ins) && ins.size() >= 2,
+                      "BooleanCircuit: bad inputs");
+  bool haveGate = readTokens(str, line);
+
+  // Bristol Fashion has a line for the outputs, the older format a single
+  // count after those of the inputs
+  if (haveGate && std::isdigit(line.back()[0])) {
+    assertTrue<IOError>(lsize(ins) == readNumber(ins[0]) + 1 &&
+                            lsize(line) == readNumber(line[0]) + 1,
+                        "BooleanCircuit: bad inputs or outputs");
+    for (std::size_t i = 1; i < ins.size(); i++)
+      inputSizes.push_back(readNumber(ins[i]));
+    for (std::size_t i = 1; i < line.size(); i++)
+      outputSizes.push_back(readNumber(line[i]));
+    haveGate = readTokens(str, line);
+  } else {
+    for (std::size_t i = 0; i + 1 < ins.size(); i++)
+      inputSizes.push_back(readNumber(ins[i]));
+    outputSizes.push_back(readNumber(ins.back()));
+  }
+  for (long size : inputSizes)
+    nInputBits += size;
+  long nOutputBits = 0;
+  for (long size : outputSizes)
+    nOutputBits += size;
+  assertTrue<IOError>(nInputBits <= nWires && nOutputBits <= nWires,
+                      "BooleanCircuit: more inputs or outputs than wires");
+
+  // The literal on each wire, and its AND depth as read
+  std::vector<long> wire(nWires, -1);
+  std::vector<long> depth(nWires, 0);
+  for (long i = 0; i < nInputBits; i++)
+    wire[i] = makeInput(i);
+  auto wireIndex = [&](const std::string& token, bool defined) {
+    long w = readNumber(token);
+    assertTrue<IOError>(w < nWires && (wire[w] >= 0) == defined,
+                        "BooleanCircuit: bad wire " + token);
+    return w;
+  };
+
+  for (long g = 0; g < nGates; g++) {
+    assertTrue<IOError>(haveGate && line.size() >= 4,
+                        "BooleanCircuit: missing gates");
+    long nIn = readNumber(line[0]);
+    long nOut = readNumber(line[1]);
+    const std::string& gate = line.back();
+    assertTrue<IOError>(lsize(line) == nIn + nOut + 3 && nOut > 0,
+                        "BooleanCircuit: bad gate " + gate);
+
+    std::vector<long> a, c;
+    for (long i = 0; i < nIn; i++)
+      a.push_back(gate == "EQ" ? readNumber(line[2 + i])
+                               : wireIndex(line[2 + i], true));
+    for (long i = 0; i < nOut; i++)
+      c.push_back(wireIndex(line[2 + nIn + i], false));
+
+    if ((gate == "XOR" || gate == "AND") && nIn == 2 && nOut == 1) {
+      bool isAnd = gate == "AND";
+      wire[c[0]] = isAnd ? makeAnd(wire[a[0]], wire[a[1]])
+                         : makeXor(wire[a[0]], wire[a[1]]);
+      depth[c[0]] = std::max(depth[a[0]], depth[a[1]]) + isAnd;
+      (isAnd ? netlistStats.ands : netlistStats.xors)++;
+    } else if ((gate == "INV" || gate == "EQW") && nIn == 1 && nOut == 1) {
+      wire[c[0]] = wire[a[0]] ^ long(gate == "INV");
+      depth[c[0]] = depth[a[0]];
+    } else if (gate == "EQ" && nIn == 1 && nOut == 1 && a[0] <= 1) {
+      wire[c[0]] = a[0]; // the constant 0 or 1
+    } else if (gate == "MAND" && nIn == 2 * nOut) {
+      for (long i = 0; i < nOut; i++) {
+        wire[c[i]] = makeAnd(wire[a[i]], wire[a[nOut + i]]);
+        depth[c[i]] = std::max(depth[a[i]], depth[a[nOut + i]]) + 1;
+      }
+      netlistStats.ands += nOut;
+    } else {
+      throw IOError("BooleanCircuit: bad gate " + gate);
+    }
+    haveGate = readTokens(str, line);
+  }
+
+  for (long w = nWires - nOutputBits; w < nWires; w++) {
+    assertTrue<IOError>(wire[w] >= 0, "BooleanCircuit: undefined output");
+    outputs.push_back(wire[w]);
+    netlistStats.andDepth = std::max(netlistStats.andDepth, depth[w]);
+  }
+  compile();
+}
+
+long BooleanCircuit::record(Kind kind, long a, long b, long depth)
+{
+  auto key = std::make_tuple(kind, a, b);
+  auto it = hashed.find(key);
+  if (it != hashed.end())
+    return 2 * it->second;
+  long id = nodes.size();
+  nodes.push_back(Node{kind, a, b, depth});
+  hashed.emplace(key, id);
+  return 2 * id;
+}
+
+long BooleanCircuit::makeInput(long bit)
+{
+  return record(Kind::INPUT, bit, -1, 0);
+}
+
+long BooleanCircuit::makeAnd(long x, long y)
+{
+  if (x > y)
+    std::swap(x, y);
+  if (x == 0 || x == (y ^ 1))
+    return 0;
+  if (x == 1 || x == y)
+    return y;
+  long depth = std::max(nodes[x >> 1].depth, nodes[y >> 1].depth) + 1;
+  return record(Kind::AND, x, y, depth);
+}
+
+long BooleanCircuit::makeXor(long x, long y)
+{
+  // The negations move to the result
+  long negated = (x ^ y) & 1;
+  x &= ~1L;
+  y &= ~1L;
+  if (x > y)
+    std::swap(x, y);
+  if (x == y)
+    return negated;
+  if (x == 0)
+    return y ^ negated;
+  long depth = std::max(nodes[x >> 1].depth, nodes[y >> 1].depth);
+  return record(Kind::XOR, x, y, depth) ^ negated;
+}
+
+std::vector<bool> BooleanCircuit::liveNodes() const
+{
+  // The operands come before the gates, so a backward pass suffices
+  std::vector<bool> live(nodes.size(), false);
+  for (long lit : outputs)
+    live[lit >> 1] = true;
+  for (long v = lsize(nodes) - 1; v > 0; v--)
+    if (live[v] && nodes[v].kind != Kind::INPUT) {
+      live[nodes[v].a >> 1] = true;
+      live[nodes[v].b >> 1] = true;
+    }
+  return live;
+}
+
+void BooleanCircuit::compile()
+{
+  HELIB_TIMER_START;
+  std::vector<bool> live = liveNodes();
+  const std::vector<Node> old = nodes;
+  const long n = old.size();
+  auto isGate = [&](long v) {
+    return old[v].kind == Kind::AND || old[v].kind == Kind::XOR;
+  };
+
+  // The uses of each gate, and its consumer when it is used once
+  std::vector<long> uses(n, 0);
+  std::vector<long> consumer(n, -1);
+  for (long v = 0; v < n; v++)
+    if (live[v] && isGate(v))
+      for (long lit : {old[v].a, old[v].b}) {
+        uses[lit >> 1]++;
+        consumer[lit >> 1] = v;
+      }
+  for (long lit : outputs) {
+    uses[lit >> 1]++;
+    consumer[lit >> 1] = -1;
+  }
+  auto usedOnceBy = [&](long lit, long v) {
+    long u = lit >> 1;
+    return !(lit & 1) && old[u].kind == Kind::AND && uses[u] == 1 &&
+           consumer[u] == v;
+  };
+
+  // x&y ^ x&z -> x & (y^z): the XORs factored, with the shared operand first
+  std::vector<std::vector<long>> factor(n);
+  std::vector<bool> factored(n, false);
+  for (long v = 0; v < n; v++) {
+    if (!live[v] || old[v].kind != Kind::XOR || !usedOnceBy(old[v].a, v) ||
+        !usedOnceBy(old[v].b, v))
+      continue;
+    const Node& p = old[old[v].a >> 1];
+    const Node& q = old[old[v].b >> 1];
+    for (long x : {p.a, p.b})
+      if (factor[v].empty() && (x == q.a || x == q.b))
+        factor[v] = {x, x == p.a ? p.b : p.a, x == q.a ? q.b : q.a};
+    if (!factor[v].empty())
+      factored[old[v].a >> 1] = factored[old[v].b >> 1] = true;
+  }
+
+  // The ANDs merged into the AND tree they are used in
+  std::vector<bool> absorbed(n, false);
+  for (long v = 0; v < n; v++)
+    if (live[v] && old[v].kind == Kind::AND && !factored[v])
+      for (long lit : {old[v].a, old[v].b})
+        if (usedOnceBy(lit, v) && !factored[lit >> 1])
+          absorbed[lit >> 1] = true;
+
+  // Rebuild the live gates, in order
+  nodes.assign(1, Node{Kind::CONST, -1, -1, 0});
+  hashed.clear();
+  std::vector<long> lit(n, 0);
+  auto map = [&](long l) { return lit[l >> 1] ^ (l & 1); };
+  for (long v = 1; v < n; v++) {
+    if (!live[v] || absorbed[v] || factored[v])
+      continue;
+    const Node& node = old[v];
+    if (node.kind == Kind::INPUT) {
+      lit[v] = makeInput(node.a);
+    } else if (node.kind == Kind::XOR && !factor[v].empty()) {
+      lit[v] = makeAnd(map(factor[v][0]),
+                       makeXor(map(factor[v][1]), map(factor[v][2])));
+    } else if (node.kind == Kind::XOR) {
+      lit[v] = makeXor(map(node.a), map(node.b));
+    } else {
+      // The leaves of the AND tree, joined two shallowest first
+      using Leaf = std::pair<long, long>; // (depth, literal)
+      std::priority_queue<Leaf, std::vector<Leaf>, std::greater<Leaf>> leaves;
+      std::vector<long> todo = {node.a, node.b};
+      while (!todo.empty()) {
+        long l = todo.back();
+        todo.pop_back();
+        if (!(l & 1) && absorbed[l >> 1]) {
+          todo.push_back(old[l >> 1].a);
+          todo.push_back(old[l >> 1].b);
+        } else {
+          leaves.emplace(nodes[map(l) >> 1].depth, map(l));
+        }
+      }
+      while (leaves.size() > 1) {
+        long x = leaves.top().second;
+        leaves.pop();
+        long y = leaves.top().second;
+        leaves.pop();
+        long xy = makeAnd(x, y);
+        leaves.emplace(nodes[xy >> 1].depth, xy);
+      }
+      lit[v] = leaves.top().second;
+    }
+  }
+  for (long& l : outputs)
+    l = map(l);
+
+  live = liveNodes();
+  stats = Stats();
+  for (long v = 1; v < lsize(nodes); v++) {
+    if (!live[v])
+      continue;
+    if (nodes[v].kind == Kind::AND)
+      stats.ands++;
+    else if (nodes[v].kind == Kind::XOR)
+      stats.xors++;
+    stats.andDepth = std::max(stats.andDepth, nodes[v].depth);
+  }
+}
+
+std::vector<long> BooleanCircuit::recryptionCuts(long levels,
+                                                 long* numRecrypted) const
+{
+  if (numRecrypted)
+    *numRecrypted = 0;
+  const long depth = stats.andDepth;
+  if (levels < 1 || depth <= levels)
+    return {};
+
+  // The last depths at which the gates of each depth are used
+  std::vector<bool> live = liveNodes();
+  std::vector<long> lastUse(nodes.size(), -1);
+  for (long v = 1; v < lsize(nodes); v++)
+    if (live[v] && nodes[v].kind != Kind::INPUT)
+      for (long lit : {nodes[v].a, nodes[v].b})
+        lastUse[lit >> 1] = std::max(lastUse[lit >> 1], nodes[v].depth);
+  std::vector<std::vector<long>> lastUses(depth + 1);
+  for (long v = 1; v < lsize(nodes); v++)
+    if (live[v] && nodes[v].kind != Kind::INPUT)
+      lastUses[nodes[v].depth].push_back(lastUse[v]);
+
+  // The bits recrypted at cut c after a cut (or the start) at p: the gates
+  // deeper than p, and no deeper than c, used after c. Those of depth 0 are
+  // sums of inputs, which need no recryption.
+  auto crossing = [&](long p, long c) {
+    long count = 0;
+    for (long d = p + 1; d <= c; d++)
+      for (long use : lastUses[d])
+        count += use > c;
+    return count;
+  };
+
+  // best[c]: the fewest bits recrypted up to a cut at c, from[c] the cut
+  // before it (0 for the start)
+  std::vector<long> best(depth, LONG_MAX);
+  std::vector<long> from(depth, 0);
+  best[0] = 0;
+  for (long c = 1; c < depth; c++)
+    for (long p = std::max(0L, c - levels); p < c; p++)
+      if (best[p] < LONG_MAX && best[p] + crossing(p, c) < best[c]) {
+        best[c] = best[p] + crossing(p, c);
+        from[c] = p;
+      }
+  long last = depth - levels;
+  for (long p = last + 1; p < depth; p++)
+    if (best[p] < best[last])
+      last = p;
+
+  std::vector<long> cuts;
+  if (numRecrypted)
+    *numRecrypted = best[last];
+  for (long c = last; c > 0; c = from[c])
+    cuts.push_back(c);
+  std::reverse(cuts.begin(), cuts.end());
+  return cuts;
+}
+
+void BooleanCircuit::evaluate(CtPtrs& out,
+                              const CtPtrs& in,
+                              long levels,
+                              const std::vector<zzX>* unpackSlotEncoding) const
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(in.size() == nInputBits && nInputBits > 0,
+                              "BooleanCircuit: wrong number of input bits");
+  const Ctxt& model = *in[0];
+  assertEq<InvalidArgument>(model.getPtxtSpace(),
+                            2L,
+                            "BooleanCircuit: the bits must be mod 2");
+  std::vector<long> cuts = recryptionCuts(levels);
+  assertTrue<InvalidArgument>(cuts.empty() || unpackSlotEncoding,
+                              "BooleanCircuit: no unpacking constants");
+  const Context& context = model.getContext();
+
+  // The stage of each gate, and the last depth at which it is used
+  const long n = nodes.size();
+  std::vector<bool> live = liveNodes();
+  std::vector<long> stage(n, 0);
+  std::vector<long> lastUse(n, -1);
+  auto isGate = [&](long v) {
+    return live[v] &&
+           (nodes[v].kind == Kind::AND || nodes[v].kind == Kind::XOR);
+  };
+  for (long v = 0; v < n; v++)
+    if (isGate(v)) {
+      stage[v] = std::lower_bound(cuts.begin(), cuts.end(), nodes[v].depth) -
+                 cuts.begin();
+      for (long lit : {nodes[v].a, nodes[v].b})
+        lastUse[lit >> 1] = std::max(lastUse[lit >> 1], nodes[v].depth);
+    }
+
+  // The values from the inputs and the earlier stages
+  std::vector<const Ctxt*> value(n, nullptr);
+  for (long v = 0; v < n; v++)
+    if (live[v] && nodes[v].kind == Kind::INPUT)
+      value[v] = in[nodes[v].a];
+  std::vector<std::unique_ptr<Ctxt>> kept;
+  resize(out, numOutputBits(), model);
+
+  const long nStages = cuts.size() + 1;
+  for (long s = 0; s < nStages; s++) {
+    Circuit circuit(context);
+    std::vector<Ctxt> args;
+    std::map<long, Circuit::Wire> wires;
+    auto wireOf = [&](long lit) {
+      auto it = wires.find(lit >> 1);
+      if (it == wires.end()) {
+        args.push_back(*value[lit >> 1]);
+        it = wires.emplace(lit >> 1, circuit.input()).first;
+      }
+      return (lit & 1) ? it->second + 1 : it->second;
+    };
+    for (long v = 0; v < n; v++)
+      if (isGate(v) && stage[v] == s) {
+        Circuit::Wire x = wireOf(nodes[v].a);
+        Circuit::Wire y = wireOf(nodes[v].b);
+        wires.emplace(v, nodes[v].kind == Kind::AND ? x * y : x + y);
+      }
+
+    // The outputs of the circuit computed here, then the gates used after
+    // the cut that ends this stage
+    std::vector<long> outBits, crossing;
+    for (long j = 0; j < numOutputBits(); j++)
+      if (isGate(outputs[j] >> 1) && stage[outputs[j] >> 1] == s) {
+        circuit.output(wireOf(outputs[j]));
+        outBits.push_back(j);
+      }
+    for (long v = 0; v < n && s + 1 < nStages; v++)
+      if (isGate(v) && stage[v] == s && lastUse[v] > cuts[s]) {
+        circuit.output(wires.at(v));
+        crossing.push_back(v);
+      }
+    if (circuit.numOutputs() == 0)
+      continue;
+
+    std::vector<Ctxt> results = circuit.run(args);
+    for (std::size_t i = 0; i < outBits.size(); i++)
+      *out[outBits[i]] = std::move(results[i]);
+    std::vector<Ctxt*> recrypt;
+    long start = s > 0 ? cuts[s - 1] : 0;
+    for (std::size_t i = 0; i < crossing.size(); i++) {
+      kept.emplace_back(new Ctxt(std::move(results[outBits.size() + i])));
+      value[crossing[i]] = kept.back().get();
+      if (nodes[crossing[i]].depth > start)
+        recrypt.push_back(kept.back().get());
+    }
+    if (!recrypt.empty()) {
+      CtPtrs_vectorPt ptrs(recrypt);
+      packedRecrypt(ptrs, *unpackSlotEncoding, context.getEA());
+    }
+  }
+
+  // The outputs that are inputs or constants
+  for (long j = 0; j < numOutputBits(); j++) {
+    const Node& node = nodes[outputs[j] >> 1];
+    if (node.kind == Kind::INPUT)
+      *out[j] = *in[node.a];
+    else if (node.kind == Kind::CONST)
+      *out[j] = Ctxt(ZeroCtxtLike, model);
+    else
+      continue;
+    if (outputs[j] & 1)
+      out[j]->addConstant(NTL::ZZX(1));
+  }
+}
+
+std::vector<long> BooleanCircuit::evaluate(const std::vector<long>& in) const
+{
+  assertEq<InvalidArgument>(lsize(in),
+                            nInputBits,
+                            "BooleanCircuit: wrong number of input bits");
+  std::vector<long> bit(nodes.size(), 0);
+  auto value = [&](long lit) { return bit[lit >> 1] ^ (lit & 1); };
+  for (long v = 1; v < lsize(nodes); v++) {
+    const Node& node = nodes[v];
+    if (node.kind == Kind::INPUT)
+      bit[v] = in[node.a] & 1;
+    else if (node.kind == Kind::AND)
+      bit[v] = value(node.a) & value(node.b);
+    else
+      bit[v] = value(node.a) ^ value(node.b);
+  }
+  std::vector<long> result;
+  for (long lit : outputs)
+    result.push_back(value(lit));
+  return result;
+}
+
+} // namespace helib
@@ -0,0 +1,274 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <memory>
+#include <NTL/BasicThreadPool.h>
+#include <helib/circuit.h>
+#include <helib/multicore.h>
+#include <helib/Context.h>
+#include <helib/timing.h>
+
+namespace helib {
+
+void Circuit::checkWire(const Wire& wire) const
+{
+  assertEq<InvalidArgument>(static_cast<const Circuit*>(wire.circuit),
+                            this,
+                            "Wire belongs to another circuit");
+}
+
+long Circuit::constant(const NTL::ZZX& poly)
+{
+  auto it = std::find(constants.begin(), constants.end(), poly);
+  if (it != constants.end())
+    return it - constants.begin();
+  constants.push_back(poly);
+  return constants.size() - 1;
+}
+
+Circuit::Wire Circuit::record(Op op, long a, long b, long param)
+{
+  // Commutative operations are recorded once for both orders
+  if ((op == Op::ADD || op == Op::MUL) && b < a)
+    std::swap(a, b);
+  auto key = std::make_tuple(op, a, b, param);
+  auto it = recorded.find(key);
+  if (it != recorded.end())
+    return Wire(this, it->second);
+
+  long id = nodes.size();
+  nodes.push_back(Node{op, a, b, param});
+  recorded.emplace(key, id);
+  return Wire(this, id);
+}
+
+Circuit::Wire Circuit::input() { return record(Op::INPUT, -1, -1, nInputs++); }
+
+void Circuit::output(const Wire& wire)
+{
+  checkWire(wire);
+  outputs.push_back(wire.id);
+}
+
+Circuit::Wire Circuit::Wire::operator+(const Wire& other) const
+{
+  circuit->checkWire(other);
+  return circuit->record(Op::ADD, id, other.id, 0);
+}
+
+Circuit::Wire Circuit::Wire::operator-(const Wire& other) const
+{
+  circuit->checkWire(other);
+  return circuit->record(Op::SUB, id, other.id, 0);
+}
+
+Circuit::Wire Circuit::Wire::operator*(const Wire& other) const
+{
+  circuit->checkWire(other);
+  return circuit->record(Op::MUL, id, other.id, 0);
+}
+
+Circuit::Wire Circuit::Wire::operator-() const
+{
+  return circuit->record(Op::NEGATE, id, -1, 0);
+}
+
+Circuit::Wire Circuit::Wire::operator+(const NTL::ZZX& poly) const
+{
+  return circuit->record(Op::ADD_CONST, id, -1, circuit->constant(poly));
+}
+
+Circuit::Wire Circuit::Wire::operator*(const NTL::ZZX& poly) const
+{
+  return circuit->record(Op::MUL_CONST, id, -1, circuit->constant(poly));
+}
+
+Circuit::Wire Circuit::Wire::automorph(long k) const
+{
+  long m = circuit->context.getM();
+  k = mcMod(k, m);
+  assertTrue<InvalidArgument>(circuit->context.getZMStar().inZmStar(k),
+                              "Automorphism must be in Zm*");
+  if (k == 1)
+    return *this;
+  return circuit->record(Op::AUTOMORPH, id, -1, k);
+}
+
+std::vector<Ctxt> Circuit::run(const std::vector<Ctxt>& inputs) const
+{
+  HELIB_TIMER_START;
+  assertEq<InvalidArgument>(long(inputs.size()),
+                            nInputs,
+                            "Wrong number of inputs to the circuit");
+  for (const Ctxt& input : inputs)
+    assertTrue<InvalidArgument>(&input.getContext() == &context,
+                                "Input from another context");
+  long n = nodes.size();
+
+  // The live nodes, and how many times each one is used. Nodes are recorded
+  // after their operands, so a backward pass suffices.
+  std::vector<long> uses(n, 0);
+  std::vector<bool> live(n, false);
+  for (long id : outputs) {
+    live[id] = true;
+    uses[id]++;
+  }
+  for (long id = n - 1; id >= 0; id--) {
+    if (!live[id])
+      continue;
+    for (long arg : {nodes[id].a, nodes[id].b})
+      if (arg >= 0) {
+        live[arg] = true;
+        uses[arg]++;
+      }
+  }
+
+  // Products are left with a degree-2 part, and so are linear combinations
+  // of them. They must be re-linearized before being multiplied, permuted
+  // or output.
+  std::vector<bool> canonical(n, false);
+  for (long id : outputs)
+    canonical[id] = true;
+  std::vector<long> depth(n, 0);
+  std::vector<bool> raw(n, false);
+  for (long id = 0; id < n; id++) {
+    const Node& node = nodes[id];
+    if (!live[id])
+      continue;
+    if (node.op == Op::MUL || node.op == Op::AUTOMORPH) {
+      canonical[node.a] = true;
+      if (node.b >= 0)
+        canonical[node.b] = true;
+    }
+  }
+  for (long id = 0; id < n; id++) {
+    const Node& node = nodes[id];
+    if (!live[id] || node.op == Op::INPUT)
+      continue;
+    depth[id] = 1 + std::max(depth[node.a], node.b >= 0 ? depth[node.b] : 0);
+    if (node.op == Op::MUL)
+      raw[id] = true;
+    else if (node.op != Op::AUTOMORPH)
+      raw[id] = (raw[node.a] && !canonical[node.a]) ||
+                (node.b >= 0 && raw[node.b] && !canonical[node.b]);
+  }
+
+  // The tasks of each depth: single nodes, or all the automorphisms of the
+  // same operand, that are hoisted together
+  long maxDepth = n > 0 ? *std::max_element(depth.begin(), depth.end()) : 0;
+  std::vector<std::vector<std::vector<long>>> levels(maxDepth + 1);
+  for (long id = 0; id < n; id++) {
+    if (!live[id] || nodes[id].op == Op::INPUT)
+      continue;
+    auto& level = levels[depth[id]];
+    if (nodes[id].op == Op::AUTOMORPH) {
+      auto group = std::find_if(level.begin(), level.end(), [&](auto& task) {
+        return nodes[task[0]].op == Op::AUTOMORPH &&
+               nodes[task[0]].a == nodes[id].a;
+      });
+      if (group != level.end()) {
+        group->push_back(id);
+        continue;
+      }
+    }
+    level.push_back({id});
+  }
+
+  std::vector<std::unique_ptr<Ctxt>> values(n);
+  auto value = [&](long id) -> const Ctxt& {
+    if (nodes[id].op == Op::INPUT)
+      return inputs[nodes[id].param];
+    return *values[id];
+  };
+  // Start from a copy of the operand, or take it over at its last use
+  auto operand = [&](long id) {
+    long a = nodes[id].a;
+    if (nodes[a].op != Op::INPUT && uses[a] == 1)
+      return std::move(values[a]);
+    return std::make_unique<Ctxt>(value(a));
+  };
+
+  auto compute = [&](const std::vector<long>& task) {
+    const Node& first = nodes[task[0]];
+    if (first.op == Op::AUTOMORPH && task.size() > 1) {
+      std::vector<long> ks;
+      for (long id : task)
+        ks.push_back(nodes[id].param);
+      std::vector<Ctxt> results;
+      value(first.a).hoistedAutomorphs(ks, results);
+      for (std::size_t i = 0; i < task.size(); i++)
+        values[task[i]] = std::make_unique<Ctxt>(std::move(results[i]));
+      return;
+    }
+
+    long id = task[0];
+    std::unique_ptr<Ctxt> result = operand(id);
+    switch (first.op) {
+    case Op::ADD:
+      *result += value(first.b);
+      break;
+    case Op::SUB:
+      *result -= value(first.b);
+      break;
+    case Op::NEGATE:
+      result->negate();
+      break;
+    case Op::MUL:
+      result->multLowLvl(value(first.b));
+      break;
+    case Op::ADD_CONST:
+      result->addConstant(constants[first.param]);
+      break;
+    case Op::MUL_CONST:
+      result->multByConstant(constants[first.param]);
+      break;
+    case Op::AUTOMORPH:
+      result->smartAutomorph(first.param);
+      break;
+    case Op::INPUT:
+      break;
+    }
+    if (raw[id] && canonical[id])
+      result->reLinearize();
+    values[id] = std::move(result);
+  };
+
+  for (const auto& level : levels) {
+    HELIB_EXEC_RANGE(long(level.size()), first, last)
+    for (long t = first; t < last; t++)
+      compute(level[t]);
+    HELIB_EXEC_RANGE_END
+
+    // Free the operands after their last use
+    for (const auto& task : level)
+      for (long id : task)
+        for (long arg : {nodes[id].a, nodes[id].b})
+          if (arg >= 0 && --uses[arg] == 0)
+            values[arg].reset();
+  }
+
+  std::vector<Ctxt> result;
+  result.reserve(outputs.size());
+  for (long id : outputs)
+    result.push_back(value(id));
+  return result;
+}
+
+CostEstimate Circuit::estimate(const std::vector<Ctxt>& inputs,
+                              const CostModel& model) const
+{
+  DryRunEstimate dryRun(model);
+  run(inputs);
+  return dryRun.report();
+}
+
+} // namespace helib
@@ -0,0 +1,313 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* ckksCompare.cpp - approximate comparisons, max and min of CKKS slots
+ */
+#include <algorithm>
+#include <cmath>
+
+#include <NTL/BasicThreadPool.h>
+#include <helib/multicore.h>
+
+#include <helib/ckksCompare.h>
+#include <helib/polyEval.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+// The two odd stage polynomials, by their coefficients of x, x^3, x^5, x^7
+static const double fStage[4] = {35 / 16.0,
+                                 -35 / 16.0,
+                                 21 / 16.0,
+                                 -5 / 16.0};
+static const double gStage[4] = {4589 / 1024.0,
+                                 -16577 / 1024.0,
+                                 25614 / 1024.0,
+                                 -12860 / 1024.0};
+
+static double evalOdd(const double* c, double x)
+{
+  double x2 = x * x;
+  return x * (c[0] + x2 * (c[1] + x2 * (c[2] + x2 * c[3])));
+}
+
+// The smallest value of the stage on [lo,1], on a fine grid. The stages are
+// smooth enough for the grid not to miss anything that matters.
+static double minOn(const double* c, double lo)
+{
+  const long n = 4096;
+  double least = evalOdd(c, 1.0);
+  for (long i = 0; i < n; i++)
+    least = std::min(least, evalOdd(c, lo + (1 - lo) * i / n));
+  return least;
+}
+
+SignApproximation::SignApproximation(double epsilon, long alpha) :
+    eps(epsilon), bits(alpha)
+{
+  assertTrue<InvalidArgument>(epsilon > 0 && epsilon < 1,
+                              "SignApproximation: epsilon not in (0,1)");
+  assertTrue<InvalidArgument>(alpha >= 1 && alpha <= 50,
+                              "SignApproximation: alpha not in [1,50]");
+
+  double lo = epsilon;
+  double target = std::ldexp(1.0, -alpha);
+  while (1 - lo > target) {
+    assertTrue<InvalidArgument>(numStages() < maxStages,
+                                "SignApproximation: too many stages");
+    double gLo = minOn(gStage, lo);
+    double fLo = minOn(fStage, lo);
+    const double* c = (gLo > fLo) ? gStage : fStage;
+    lo = std::max(gLo, fLo);
+
+    // Interpolation at 8 nodes is exact for a degree-7 polynomial; the
+    // coefficients of the even T_i are zero but for rounding
+    std::vector<double> coeffs =
+        chebyshevCoefficients([c](double x) { return evalOdd(c, x); }, 7);
+    for (long i = 0; i < lsize(coeffs); i += 2)
+      coeffs[i] = 0;
+    stages.push_back(std::move(coeffs));
+  }
+}
+
+double SignApproximation::operator()(double x) const
+{
+  for (const std::vector<double>& coeffs : stages)
+    x = evalChebyshevSeries(coeffs, x);
+  return x;
+}
+
+void SignApproximation::apply(Ctxt& x) const
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(x.isCKKS(),
+                              "SignApproximation: not a CKKS ciphertext");
+  for (const std::vector<double>& coeffs : stages) {
+    Ctxt y(ZeroCtxtLike, x);
+    chebyshevEval(y, coeffs, x);
+    x = std::move(y);
+  }
+}
+
+void approxGreaterThan(Ctxt& out,
+                       const Ctxt& a,
+                       const Ctxt& b,
+                       const SignApproximation& sign)
+{
+  HELIB_TIMER_START;
+  Ctxt d(a);
+  d -= b;
+  sign.apply(d);
+  d.addConstant(1.0);
+  d.multByConstant(0.5);
+  out = std::move(d);
+}
+
+void approxGreaterThan(Ctxt& out,
+                       const Ctxt& a,
+                       double t,
+                       const SignApproximation& sign)
+{
+  HELIB_TIMER_START;
+  Ctxt d(a);
+  d.addConstant(-t);
+  sign.apply(d);
+  d.addConstant(1.0);
+  d.multByConstant(0.5);
+  out = std::move(d);
+}
+
+// (a+b)/2 + s*(a-b)/2 * p(a-b), with s = 1 for the max and s = -1 for the min
+static void maxOrMin(Ctxt& out,
+                     const Ctxt& a,
+                     const Ctxt& b,
+                     const SignApproximation& sign,
+                     bool max)
+{
+  Ctxt d(a);
+  d -= b;
+  Ctxt p(d);
+  sign.apply(p);
+  p.multiplyBy(d);
+  if (!max)
+    p.negate();
+  p += a;
+  p += b;
+  p.multByConstant(0.5);
+  out = std::move(p);
+}
+
+void approxMax(Ctxt& out,
+               const Ctxt& a,
+               const Ctxt& b,
+               const SignApproximation& sign)
+{
+  HELIB_TIMER_START;
+  maxOrMin(out, a, b, sign, true);
+}
+
+void approxMin(Ctxt& out,
+               const Ctxt& a,
+               const Ctxt& b,
+               const SignApproximation& sign)
+{
+  HELIB_TIMER_START;
+  maxOrMin(out, a, b, sign, false);
+}
+
+static void foldOverSlots(Ctxt& ctxt,
+                          const EncryptedArray& ea,
+                          const SignApproximation& sign,
+                          bool max)
+{
+  for (long s = 1; s < ea.size(); s *= 2) {
+    Ctxt rotated(ctxt);
+    ea.rotate(rotated, s);
+    maxOrMin(ctxt, ctxt, rotated, sign, max);
+  }
+}
+
+void approxMaxOverSlots(Ctxt& ctxt,
+                        const EncryptedArray& ea,
+                        const SignApproximation& sign)
+{
+  HELIB_TIMER_START;
+  foldOverSlots(ctxt, ea, sign, true);
+}
+
+void approxMinOverSlots(Ctxt& ctxt,
+                        const EncryptedArray& ea,
+                        const SignApproximation& sign)
+{
+  HELIB_TIMER_START;
+  foldOverSlots(ctxt, ea, sign, false);
+}
+
+void approxArgmax(Ctxt& out,
+                  const Ctxt& ctxt,
+                  const EncryptedArray& ea,
+                  const SignApproximation& sign)
+{
+  HELIB_TIMER_START;
+  Ctxt largest(ctxt);
+  approxMaxOverSlots(largest, ea, sign);
+
+  // x - max is in [-1,0], and moving it up by epsilon keeps it in [-1,1]
+  Ctxt d(ctxt);
+  d -= largest;
+  d.addConstant(sign.epsilon());
+  sign.apply(d);
+  d.addConstant(1.0);
+  d.multByConstant(0.5);
+  out = std::move(d);
+}
+
+void approxThresholdFilter(Ctxt& ctxt,
+                           double t,
+                           const SignApproximation& sign)
+{
+  HELIB_TIMER_START;
+  Ctxt above(ZeroCtxtLike, ctxt);
+  approxGreaterThan(above, ctxt, t, sign);
+  ctxt.multiplyBy(above);
+}
+
+void approxTopK(Ctxt& out,
+                const Ctxt& scores,
+                long k,
+                const EncryptedArray& ea,
+                const SignApproximation& sign)
+{
+  HELIB_TIMER_START;
+  long n = ea.size();
+  assertTrue<InvalidArgument>(k > 0 && 2 * k <= n,
+                              "approxTopK: k and the indices do not fit");
+  assertTrue<InvalidArgument>(sign.alpha() >= NTL::NumBits(n),
+                              "approxTopK: sign too coarse for the ranks");
+
+  // rank/n, with an error of at most (n-1)*2^-(alpha+1) <= 1/4 on the rank,
+  // far enough from the thresholds (t+1/2)/n for a sign of epsilon 1/(4n).
+  // Each thread adds its comparisons into one running rank, so only one
+  // ciphertext per thread is resident rather than one per rotation.
+  NTL::PartitionInfo pinfo(n - 1, AvailableThreads());
+  long cnt = pinfo.NumIntervals();
+  std::vector<Ctxt> partial(cnt, Ctxt(ZeroCtxtLike, scores));
+  HELIB_EXEC_INDEX(cnt, index)
+  long first, last;
+  pinfo.interval(first, last, index);
+  for (long r = first; r < last; r++) {
+    Ctxt larger(scores);
+    ea.rotate(larger, r + 1);
+    approxGreaterThan(larger, larger, scores, sign);
+    if (r == first)
+      partial[index] = std::move(larger);
+    else
+      partial[index] += larger;
+  }
+  HELIB_EXEC_INDEX_END
+  Ctxt rank(std::move(partial[0]));
+  for (long j = 1; j < cnt; j++)
+    rank += partial[j];
+  partial.clear();
+  rank.multByConstant(1.0 / n);
+
+  // above[t] is about [rank > t] and the rank-t indicator is
+  // above[t-1] - above[t]. The final totalSums adds up n errors of the
+  // indicators, hence the extra bits of precision.
+  SignApproximation rankSign(0.25 / n,
+                             std::min(sign.alpha() + NTL::NumBits(n), 50L));
+  std::vector<Ctxt> above(k, Ctxt(ZeroCtxtLike, scores));
+  NTL_EXEC_RANGE(k, first, last)
+  for (long t = first; t < last; t++)
+    approxGreaterThan(above[t], rank, (t + 0.5) / n, rankSign);
+  NTL_EXEC_RANGE_END
+
+  std::vector<double> positions(n);
+  for (long i = 0; i < n; i++)
+    positions[i] = double(i) / n;
+  PtxtArray iota(ea, positions);
+
+  std::vector<Ctxt> parts(2 * k, Ctxt(ZeroCtxtLike, scores));
+  NTL_EXEC_RANGE(k, first, last)
+  for (long t = first; t < last; t++) {
+    Ctxt selected(above[t]);
+    selected.negate();
+    if (t == 0)
+      selected.addConstant(1.0);
+    else
+      selected += above[t - 1];
+
+    Ctxt& value = parts[t];
+    value = selected;
+    value.multiplyBy(scores);
+    Ctxt& position = parts[k + t];
+    position = std::move(selected);
+    position.multByConstant(iota);
+  }
+  NTL_EXEC_RANGE_END
+
+  // Sum every part over the slots and keep it in its own slot
+  NTL_EXEC_RANGE(2 * k, first, last)
+  for (long s = first; s < last; s++) {
+    totalSums(ea, parts[s]);
+    std::vector<double> slot(n, 0.0);
+    slot[s] = 1.0;
+    parts[s].multByConstant(PtxtArray(ea, slot));
+  }
+  NTL_EXEC_RANGE_END
+  out = std::move(parts[0]);
+  for (long s = 1; s < 2 * k; s++)
+    out += parts[s];
+}
+
+} // namespace helib
@@ -0,0 +1,239 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* conv2d.cpp - convolutions and pooling of images laid out in the slots
+ */
+#include <algorithm>
+#include <cmath>
+
+#include <NTL/BasicThreadPool.h>
+
+#include <helib/conv2d.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+Conv2D::Conv2D(const EncryptedArray& ea,
+               long height,
+               long width,
+               long kh,
+               long kw) :
+    ea(ea), height(height), width(width), kh(kh), kw(kw), nIn(0), nOut(0)
+{
+  assertTrue<InvalidArgument>(height > 0 && width > 0 &&
+                                  height * width <= ea.size(),
+                              "Conv2D: the image does not fit in the slots");
+  assertTrue<InvalidArgument>(kh > 0 && kw > 0,
+                              "Conv2D: the kernel has no taps");
+
+  shifts.resize(kh * kw);
+  for (long u = 0; u < kh; u++)
+    for (long v = 0; v < kw; v++)
+      shifts[u * kw + v] = (u - kh / 2) * width + (v - kw / 2);
+}
+
+Conv2D::Conv2D(const EncryptedArray& ea,
+               long height,
+               long width,
+               long kh,
+               long kw,
+               const std::vector<std::vector<std::vector<double>>>& weights) :
+    Conv2D(ea, height, width, kh, kw)
+{
+  assertTrue<InvalidArgument>(!weights.empty() && !weights[0].empty(),
+                              "Conv2D: no channels");
+  nOut = weights.size();
+  nIn = weights[0].size();
+
+  std::vector<long> outs, ins;
+  std::vector<const std::vector<double>*> kernels;
+  for (long k = 0; k < nOut; k++) {
+    assertEq<InvalidArgument>(lsize(weights[k]),
+                              nIn,
+                              "Conv2D: inconsistent number of input channels");
+    for (long c = 0; c < nIn; c++) {
+      outs.push_back(k);
+      ins.push_back(c);
+      kernels.push_back(&weights[k][c]);
+    }
+  }
+  addTerms(outs, ins, kernels);
+}
+
+Conv2D Conv2D::depthwise(const EncryptedArray& ea,
+                         long height,
+                         long width,
+                         long kh,
+                         long kw,
+                         const std::vector<std::vector<double>>& weights)
+{
+  assertTrue<InvalidArgument>(!weights.empty(), "Conv2D: no channels");
+  Conv2D conv(ea, height, width, kh, kw);
+  conv.nIn = conv.nOut = weights.size();
+
+  std::vector<long> channels(conv.nIn);
+  std::vector<const std::vector<double>*> kernels(conv.nIn);
+  for (long c = 0; c < conv.nIn; c++) {
+    channels[c] = c;
+    kernels[c] = &weights[c];
+  }
+  conv.addTerms(channels, channels, kernels);
+  return conv;
+}
+
+void Conv2D::addTerms(const std::vector<long>& outs,
+                      const std::vector<long>& ins,
+                      const std::vector<const std::vector<double>*>& kernels)
+{
+  HELIB_TIMER_START;
+  long taps = kh * kw;
+  bool ckks = ea.getContext().isCKKS();
+
+  double mag = 0;
+  for (const std::vector<double>* kernel : kernels) {
+    assertEq<InvalidArgument>(lsize(*kernel),
+                              taps,
+                              "Conv2D: a kernel has the wrong size");
+    for (double w : *kernel) {
+      assertTrue<InvalidArgument>(ckks || w == std::round(w),
+                                  "Conv2D: BGV weights must be integers");
+      mag = std::max(mag, std::abs(w));
+    }
+  }
+
+  used.assign(nIn, std::vector<bool>(taps, false));
+  std::vector<PtxtArray> constants;
+  for (long i : range(lsize(kernels))) {
+    for (long tap = 0; tap < taps; tap++) {
+      double w = (*kernels[i])[tap];
+      if (w == 0)
+        continue;
+
+      // The weight in the pixels whose tap falls inside the image
+      long du = tap / kw - kh / 2;
+      long dv = tap % kw - kw / 2;
+      std::vector<double> slots(ea.size(), 0);
+      for (long r = std::max(0L, -du); r < std::min(height, height - du); r++)
+        for (long s = std::max(0L, -dv); s < std::min(width, width - dv); s++)
+          slots[r * width + s] = w;
+
+      if (ckks)
+        constants.emplace_back(ea, slots);
+      else
+        constants.emplace_back(
+            ea,
+            std::vector<long>(slots.begin(), slots.end()));
+      terms.push_back(Term{outs[i], ins[i], tap, FatEncodedPtxt()});
+      used[ins[i]][tap] = true;
+    }
+  }
+
+  // All the constants go to DoubleCRT form in one batch
+  std::vector<FatEncodedPtxt> encoded;
+  encodeBatch(encoded,
+              constants,
+              ea.getContext().fullPrimes(),
+              (ckks && mag > 0) ? mag : -1);
+  for (long i : range(lsize(terms)))
+    terms[i].weight = std::move(encoded[i]);
+}
+
+void Conv2D::apply(std::vector<Ctxt>& out, const std::vector<Ctxt>& in) const
+{
+  HELIB_TIMER_START;
+  assertEq<InvalidArgument>(lsize(in),
+                            nIn,
+                            "Conv2D: wrong number of input channels");
+
+  // The rotations of every input channel, shared by all output channels
+  long taps = kh * kw;
+  std::vector<std::vector<Ctxt>> rotated(nIn);
+  std::vector<std::vector<long>> tapsOf(nIn);
+  for (long c = 0; c < nIn; c++) {
+    std::vector<long> wanted;
+    for (long tap = 0; tap < taps; tap++)
+      if (used[c][tap]) {
+        wanted.push_back(shifts[tap]);
+        tapsOf[c].push_back(tap);
+      }
+    shiftedCopies(ea, rotated[c], in[c], wanted);
+  }
+
+  // Where rotated[c] holds the tap
+  std::vector<std::vector<long>> slotOf(nIn, std::vector<long>(taps, -1));
+  for (long c = 0; c < nIn; c++)
+    for (long i : range(lsize(tapsOf[c])))
+      slotOf[c][tapsOf[c][i]] = i;
+
+  out.assign(nOut, Ctxt(ZeroCtxtLike, in[0]));
+  NTL_EXEC_RANGE(nOut, first, last)
+  for (long k = first; k < last; k++) {
+    bool empty = true;
+    for (const Term& term : terms) {
+      if (term.out != k)
+        continue;
+      Ctxt product(rotated[term.in][slotOf[term.in][term.tap]]);
+      product.multByConstant(term.weight);
+      if (empty)
+        out[k] = std::move(product);
+      else
+        out[k] += product;
+      empty = false;
+    }
+  }
+  NTL_EXEC_RANGE_END
+}
+
+void avgPool2D(const EncryptedArray& ea,
+               Ctxt& ctxt,
+               long height,
+               long width,
+               long size)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(size > 0 && height % size == 0 &&
+                                  width % size == 0,
+                              "avgPool2D: the windows do not tile the image");
+  assertTrue<InvalidArgument>(height * width <= ea.size(),
+                              "avgPool2D: the image does not fit in the slots");
+  if (size == 1)
+    return;
+
+  // Sum the windows along the rows, then along the columns
+  for (long step : {1L, width}) {
+    std::vector<long> shifts(size - 1);
+    for (long v = 1; v < size; v++)
+      shifts[v - 1] = v * step;
+    std::vector<Ctxt> shifted;
+    shiftedCopies(ea, shifted, ctxt, shifts);
+    for (const Ctxt& term : shifted)
+      ctxt += term;
+  }
+
+  // Keep the corners of the windows, which hold their sums
+  bool ckks = ea.getContext().isCKKS();
+  double scale = ckks ? 1.0 / (size * size) : 1.0;
+  std::vector<double> keep(ea.size(), 0);
+  for (long i = 0; i < height; i += size)
+    for (long j = 0; j < width; j += size)
+      keep[i * width + j] = scale;
+
+  EncodedPtxt mask;
+  if (ckks)
+    ea.encode(mask, keep);
+  else
+    ea.encode(mask, std::vector<long>(keep.begin(), keep.end()));
+  ctxt.multByConstant(mask);
+}
+
+} // namespace helib
@@ -0,0 +1,360 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <chrono>
+
+#include <helib/costEstimate.h>
+#include <helib/Context.h>
+#include <helib/DoubleCRT.h>
+#include <helib/fhe_stats.h>
+#include <helib/keys.h>
+#include <helib/keySwitching.h>
+#include <helib/range.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+std::atomic_bool dryRunEstimating{false};
+
+namespace {
+
+// The charges since the DryRunEstimate was made
+struct DryRunCharges
+{
+  std::atomic_long nttRows{0};
+  std::atomic_long arithRows{0};
+  std::atomic_long automorphRows{0};
+  std::atomic_long allocatedBytes{0};
+  std::atomic_long currentBytes{0};
+  std::atomic_long peakBytes{0};
+
+  void clear()
+  {
+    nttRows = 0;
+    arithRows = 0;
+    automorphRows = 0;
+    allocatedBytes = 0;
+    currentBytes = 0;
+    peakBytes = 0;
+  }
+};
+
+DryRunCharges charges;
+
+} // namespace
+
+void chargeDryRunRows(long nttRows, long arithRows, long automorphRows)
+{
+  if (!dryRunEstimating.load(std::memory_order_relaxed))
+    return;
+  charges.nttRows.fetch_add(nttRows, std::memory_order_relaxed);
+  charges.arithRows.fetch_add(arithRows, std::memory_order_relaxed);
+  charges.automorphRows.fetch_add(automorphRows, std::memory_order_relaxed);
+}
+
+void chargeDryRunBytes(long bytes)
+{
+  if (!dryRunEstimating.load(std::memory_order_relaxed))
+    return;
+  if (bytes > 0)
+    charges.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+  long current = charges.currentBytes.fetch_add(bytes) + bytes;
+  long peak = charges.peakBytes.load();
+  while (current > peak &&
+         !charges.peakBytes.compare_exchange_weak(peak, current))
+    ;
+}
+
+CostModel CostModel::calibrate(const Context& context, long reps)
+{
+  assertTrue<InvalidArgument>(reps > 0, "CostModel::calibrate: reps < 1");
+  assertFalse(dryRunEstimating.load(),
+              "CostModel::calibrate: called during a DryRunEstimate");
+  bool savedDryRun = isDryRun();
+  setDryRun(false);
+
+  const IndexSet& primes = context.getCtxtPrimes();
+  const double rows = double(reps) * primes.card();
+  zzX poly;
+  poly.SetLength(context.getPhiM());
+  for (long i = 0; i < poly.length(); i++)
+    poly[i] = NTL::RandomBnd(3) - 1;
+  DoubleCRT a(context, primes);
+  DoubleCRT b(context, primes);
+  a.randomize();
+  b.randomize();
+  const PAlgebra& zMStar = context.getZMStar();
+  long k = zMStar.numOfGens() > 0 ? zMStar.ZmStarGen(0) : zMStar.getM() - 1;
+
+  // The seconds per row of work, run reps times
+  auto perRow = [rows, reps](auto work) {
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < reps; i++)
+      work();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / rows;
+  };
+
+  CostModel model;
+  model.nttSeconds = perRow([&] { DoubleCRT c(poly, context, primes); });
+  model.arithSeconds = perRow([&] { a *= b; });
+  model.automorphSeconds = perRow([&] { a.automorph(k); });
+
+  setDryRun(savedDryRun);
+  return model;
+}
+
+std::ostream& operator<<(std::ostream& str, const CostEstimate& estimate)
+{
+  return str << "ntt_rows=" << estimate.nttRows
+             << " arith_rows=" << estimate.arithRows
+             << " automorph_rows=" << estimate.automorphRows
+             << " key_switches=" << estimate.keySwitches << "\n"
+             << "allocated_bytes=" << estimate.allocatedBytes
+             << " peak_bytes=" << estimate.peakBytes << "\n"
+             << "estimated_seconds=" << estimate.seconds << "\n";
+}
+
+DryRunEstimate::DryRunEstimate(const CostModel& model) :
+    model(model),
+    savedDryRun(isDryRun()),
+    keySwitchesStart(fhe_ops.keySwitches)
+{
+  assertFalse(dryRunEstimating.load(),
+              "DryRunEstimate: another one is alive");
+  charges.clear();
+  setDryRun(true);
+  dryRunEstimating = true;
+}
+
+DryRunEstimate::~DryRunEstimate()
+{
+  dryRunEstimating = false;
+  setDryRun(savedDryRun);
+}
+
+CostEstimate DryRunEstimate::report() const
+{
+  CostEstimate estimate;
+  estimate.nttRows = charges.nttRows;
+  estimate.arithRows = charges.arithRows;
+  estimate.automorphRows = charges.automorphRows;
+  estimate.keySwitches = fhe_ops.keySwitches - keySwitchesStart;
+  estimate.allocatedBytes = charges.allocatedBytes;
+  estimate.peakBytes = charges.peakBytes;
+  estimate.seconds = estimate.nttRows * model.nttSeconds +
+                     estimate.arithRows * model.arithSeconds +
+                     estimate.automorphRows * model.automorphSeconds;
+  return estimate;
+}
+
+namespace {
+
+// The time of the parts of a key switch of a ciphertext at the top level,
+// priced as the dry run charges them
+struct KeySwitchCosts
+{
+  double decompose = 0; // breaking a part into digits, over all the primes
+  double hoisted = 0;   // a key switch whose digits are broken already
+  double full = 0;      // an automorphism and a key switch
+  long matrixBytes = 0; // a key-switching matrix
+};
+
+KeySwitchCosts keySwitchCosts(const Context& context, const CostModel& model)
+{
+  const IndexSet& ctxtPrimes = context.getCtxtPrimes();
+  const long L = ctxtPrimes.card();
+  const long K = context.getSpecialPrimes().card();
+  const long all = L + K;
+  const long phim = context.getPhiM();
+  long digits = 0;
+  double decompose = 0;
+  for (const IndexSet& digit : context.getDigits()) {
+    long in = (ctxtPrimes & digit).card();
+    if (in == 0)
+      continue;
+    digits++;
+    // As breakIntoDigits charges it: the digit in, the other primes out
+    decompose +=
+        all * model.nttSeconds + in * (all - in) * model.arithSeconds;
+  }
+
+  // The inner products of the digits with the two parts of the matrix, and
+  // the mod-down of their two results
+  double innerProducts = 2.0 * digits * all * model.arithSeconds;
+  double modDown = 2.0 * (L + K) * model.nttSeconds +
+                   2.0 * K * L * model.arithSeconds;
+
+  KeySwitchCosts costs;
+  costs.decompose = decompose;
+  costs.hoisted = digits * all * model.automorphSeconds + innerProducts +
+                  modDown;
+  costs.full = 2.0 * L * model.automorphSeconds + decompose + innerProducts +
+               modDown;
+  // Only the b parts are kept, the a parts come from their seeds
+  costs.matrixBytes = digits * all * phim * long(sizeof(long));
+  return costs;
+}
+
+DimensionPlan priceStrategy(const KeySwitchCosts& costs,
+                            long rotations,
+                            long matMuls,
+                            long dim,
+                            long order,
+                            bool native,
+                            int strategy)
+{
+  const long g = KSGiantStepSize(order);
+  const long giant = (order + g - 1) / g; // ceiling(order/g)
+  // A bad dimension takes two automorphisms where a native one takes one
+  const double bad = native ? 1 : 2;
+
+  DimensionPlan plan;
+  plan.dim = dim;
+  plan.order = order;
+  plan.native = native;
+  plan.strategy = strategy;
+  double perRotation = 0;
+  double perMatMul = 0;
+  switch (strategy) {
+  case HELIB_KSS_FULL:
+    plan.matrices = order - 1;
+    perRotation = bad * costs.full;
+    perMatMul = costs.decompose + bad * (order - 1) * costs.hoisted;
+    break;
+  case HELIB_KSS_BSGS:
+    plan.matrices = (g - 1) + (giant - 1);
+    perRotation = 2 * bad * costs.full;
+    perMatMul = costs.decompose +
+                bad * ((g - 1) * costs.hoisted + (giant - 1) * costs.full);
+    break;
+  case HELIB_KSS_MIN: {
+    // Steps of 1 and, for large orders, of g: on average half of each
+    bool giantMatrix = order > HELIB_KEYSWITCH_MIN_THRESH;
+    plan.matrices = giantMatrix ? 2 : 1;
+    double steps = giantMatrix ? (g - 1 + giant - 1) / 2.0 : (order - 1) / 2.0;
+    perRotation = bad * std::max(steps, 1.0) * costs.full;
+    perMatMul = bad * (order - 1) * costs.full;
+    break;
+  }
+  default:
+    throw InvalidArgument("priceStrategy: unknown strategy");
+  }
+  if (!native)
+    plan.matrices++; // the matrix of g^{-order}
+  plan.bytes = plan.matrices * costs.matrixBytes;
+  plan.seconds = rotations * perRotation + matMuls * perMatMul;
+  return plan;
+}
+
+const char* strategyName(int strategy)
+{
+  switch (strategy) {
+  case HELIB_KSS_FULL:
+    return "full";
+  case HELIB_KSS_BSGS:
+    return "bsgs";
+  case HELIB_KSS_MIN:
+    return "min";
+  default:
+    return "unknown";
+  }
+}
+
+} // namespace
+
+KeySwitchPlan planKeySwitching(const Context& context,
+                               const CostModel& model,
+                               const KeySwitchWorkload& workload,
+                               long memoryBudget)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(memoryBudget >= 0,
+                              "planKeySwitching: negative memory budget");
+  const PAlgebra& zMStar = context.getZMStar();
+  const long n = zMStar.numOfGens();
+  assertTrue<InvalidArgument>(long(workload.rotations.size()) <= n &&
+                                  long(workload.matMuls.size()) <= n,
+                              "planKeySwitching: workload of more dimensions "
+                              "than the context has");
+  const KeySwitchCosts costs = keySwitchCosts(context, model);
+  auto count = [](const std::vector<long>& v, long i) {
+    return i < long(v.size()) ? v[i] : 0L;
+  };
+
+  // The three strategies priced for every dimension
+  const int strategies[] = {HELIB_KSS_FULL, HELIB_KSS_BSGS, HELIB_KSS_MIN};
+  std::vector<std::vector<DimensionPlan>> options(n);
+  for (long i : range(n))
+    for (int strategy : strategies)
+      options[i].push_back(priceStrategy(costs,
+                                         count(workload.rotations, i),
+                                         count(workload.matMuls, i),
+                                         i,
+                                         zMStar.OrderOf(i),
+                                         zMStar.SameOrd(i),
+                                         strategy));
+
+  // There are few dimensions: try every combination of the 3^n
+  KeySwitchPlan best;
+  bool found = false;
+  std::vector<long> choice(n, 0);
+  for (;;) {
+    KeySwitchPlan plan;
+    for (long i : range(n)) {
+      const DimensionPlan& dim = options[i][choice[i]];
+      plan.dims.push_back(dim);
+      plan.bytes += dim.bytes;
+      plan.seconds += dim.seconds;
+    }
+    plan.withinBudget = plan.bytes <= memoryBudget;
+    bool better;
+    if (!found)
+      better = true;
+    else if (plan.withinBudget != best.withinBudget)
+      better = plan.withinBudget;
+    else if (plan.withinBudget)
+      better = plan.seconds < best.seconds ||
+               (plan.seconds == best.seconds && plan.bytes < best.bytes);
+    else
+      better = plan.bytes < best.bytes ||
+               (plan.bytes == best.bytes && plan.seconds < best.seconds);
+    if (better) {
+      best = std::move(plan);
+      found = true;
+    }
+
+    long i = 0;
+    while (i < n && ++choice[i] == 3)
+      choice[i++] = 0;
+    if (i == n)
+      break;
+  }
+  return best;
+}
+
+std::ostream& operator<<(std::ostream& str, const KeySwitchPlan& plan)
+{
+  for (const DimensionPlan& dim : plan.dims)
+    str << "dim=" << dim.dim << " order=" << dim.order
+        << (dim.native ? "" : " (bad)")
+        << " strategy=" << strategyName(dim.strategy)
+        << " matrices=" << dim.matrices << " bytes=" << dim.bytes
+        << " estimated_seconds=" << dim.seconds << "\n";
+  return str << "total_bytes=" << plan.bytes
+             << " estimated_seconds=" << plan.seconds
+             << (plan.withinBudget ? "" : " (over budget)") << "\n";
+}
+
+} // namespace helib
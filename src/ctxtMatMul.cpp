@@ -0,0 +1,225 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* ctxtMatMul.cpp - products of two encrypted matrices
+ */
+#include <map>
+
+#include <NTL/BasicThreadPool.h>
+
+#include <helib/ctxtMatMul.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+CtxtMatMul::CtxtMatMul(const EncryptedArray& ea, long d) : ea(ea), d(d)
+{
+  assertTrue<InvalidArgument>(d > 0 && d * d <= ea.size(),
+                              "CtxtMatMul: the matrices do not fit");
+  long n = d * d;
+
+  // sigma(A)(i, j) = A(i, i+j) and tau(B)(i, j) = B(i+j, j)
+  std::vector<std::vector<long>> sigmaSrc(1, std::vector<long>(n));
+  std::vector<std::vector<long>> tauSrc(1, std::vector<long>(n));
+  // phi^k(A)(i, j) = A(i, j+k) and psi^k(B)(i, j) = B(i+k, j)
+  std::vector<std::vector<long>> phiSrc(d, std::vector<long>(n));
+  std::vector<std::vector<long>> psiSrc(d, std::vector<long>(n));
+  for (long i = 0; i < d; i++)
+    for (long j = 0; j < d; j++) {
+      long p = i * d + j;
+      sigmaSrc[0][p] = i * d + (i + j) % d;
+      tauSrc[0][p] = ((i + j) % d) * d + j;
+      for (long k = 0; k < d; k++) {
+        phiSrc[k][p] = i * d + (j + k) % d;
+        psiSrc[k][p] = ((i + k) % d) * d + j;
+      }
+    }
+
+  sigma = buildTransform(sigmaSrc);
+  tau = buildTransform(tauSrc);
+  phi = buildTransform(phiSrc);
+  psi = buildTransform(psiSrc);
+}
+
+long CtxtMatMul::numMasks() const
+{
+  long count = 0;
+  for (const Transform* t : {&sigma, &phi})
+    for (const auto& out : t->outs)
+      count += out.size();
+  return count;
+}
+
+CtxtMatMul::Transform CtxtMatMul::buildTransform(
+    const std::vector<std::vector<long>>& sources) const
+{
+  bool ckks = ea.getContext().isCKKS();
+  long nOut = sources.size();
+  Transform t;
+  t.outs.resize(nOut);
+
+  // One mask per output and shift, with a one where the slot comes from
+  std::map<long, long> copyOf; // shift -> index in t.shifts
+  std::vector<std::vector<long>> masks;
+  for (long o = 0; o < nOut; o++) {
+    std::map<long, long> maskOf; // copy -> index in t.outs[o]
+    for (long p : range(lsize(sources[o]))) {
+      if (sources[o][p] < 0)
+        continue;
+      long shift = sources[o][p] - p;
+      auto it = copyOf.find(shift);
+      if (it == copyOf.end()) {
+        it = copyOf.emplace(shift, lsize(t.shifts)).first;
+        t.shifts.push_back(shift);
+      }
+      auto jt = maskOf.find(it->second);
+      if (jt == maskOf.end()) {
+        jt = maskOf.emplace(it->second, lsize(masks)).first;
+        masks.emplace_back(ea.size(), 0);
+        t.outs[o].emplace_back(it->second, FatEncodedPtxt());
+      }
+      masks[jt->second][p] = 1;
+    }
+  }
+
+  // All the masks go to DoubleCRT form in one batch
+  std::vector<PtxtArray> constants;
+  for (const std::vector<long>& mask : masks) {
+    if (ckks)
+      constants.emplace_back(ea, std::vector<double>(mask.begin(), mask.end()));
+    else
+      constants.emplace_back(ea, mask);
+  }
+  std::vector<FatEncodedPtxt> encoded;
+  encodeBatch(encoded,
+              constants,
+              ea.getContext().fullPrimes(),
+              ckks ? 1.0 : -1);
+  long next = 0;
+  for (auto& out : t.outs)
+    for (auto& term : out)
+      term.second = std::move(encoded[next++]);
+  return t;
+}
+
+void CtxtMatMul::apply(std::vector<Ctxt>& out,
+                       const Transform& t,
+                       const Ctxt& in) const
+{
+  std::vector<Ctxt> copies;
+  shiftedCopies(ea, copies, in, t.shifts);
+
+  // The products of all the outputs, in parallel
+  std::vector<std::pair<long, const std::pair<long, FatEncodedPtxt>*>> terms;
+  for (long o : range(lsize(t.outs)))
+    for (const auto& term : t.outs[o])
+      terms.emplace_back(o, &term);
+  std::vector<Ctxt> products(terms.size(), Ctxt(ZeroCtxtLike, in));
+  NTL_EXEC_RANGE(lsize(terms), first, last)
+  for (long i = first; i < last; i++) {
+    products[i] = copies[terms[i].second->first];
+    products[i].multByConstant(terms[i].second->second);
+  }
+  NTL_EXEC_RANGE_END
+
+  out.assign(t.outs.size(), Ctxt(ZeroCtxtLike, in));
+  std::vector<bool> empty(t.outs.size(), true);
+  for (long i : range(lsize(terms))) {
+    long o = terms[i].first;
+    if (empty[o])
+      out[o] = std::move(products[i]);
+    else
+      out[o] += products[i];
+    empty[o] = false;
+  }
+}
+
+void CtxtMatMul::prepare(std::vector<Ctxt>& out,
+                         const Ctxt& in,
+                         bool left) const
+{
+  std::vector<Ctxt> permuted;
+  apply(permuted, left ? sigma : tau, in);
+  apply(out, left ? phi : psi, permuted[0]);
+}
+
+void CtxtMatMul::mul(Ctxt& c, const Ctxt& a, const Ctxt& b) const
+{
+  std::vector<Ctxt> result;
+  mul(result, {a}, {b}, 1, 1, 1);
+  c = std::move(result[0]);
+}
+
+void CtxtMatMul::mul(std::vector<Ctxt>& c,
+                     const std::vector<Ctxt>& a,
+                     const std::vector<Ctxt>& b,
+                     long rows,
+                     long inner,
+                     long cols) const
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(rows > 0 && inner > 0 && cols > 0,
+                              "CtxtMatMul: no blocks");
+  assertEq<InvalidArgument>(lsize(a),
+                            rows * inner,
+                            "CtxtMatMul: wrong number of blocks of a");
+  assertEq<InvalidArgument>(lsize(b),
+                            inner * cols,
+                            "CtxtMatMul: wrong number of blocks of b");
+
+  // Every block is permuted once, a block of a into the phi^k(sigma(.)),
+  // one of b into the psi^k(tau(.))
+  std::vector<std::vector<Ctxt>> left(a.size()), right(b.size());
+  for (long i : range(lsize(a)))
+    prepare(left[i], a[i], /*left=*/true);
+  for (long i : range(lsize(b)))
+    prepare(right[i], b[i], /*left=*/false);
+
+  // c(I, J) = sum_K sum_k left(I, K)[k] . right(K, J)[k], re-linearized once
+  long nOut = rows * cols;
+  long nTerms = inner * d;
+  auto product = [&](long o, long t) {
+    long K = t / d;
+    Ctxt term = left[(o / cols) * inner + K][t % d];
+    term.multLowLvl(right[K * cols + o % cols][t % d]);
+    return term;
+  };
+
+  c.assign(nOut, Ctxt(ZeroCtxtLike, a[0]));
+  if (nOut >= NTL::AvailableThreads()) {
+    NTL_EXEC_RANGE(nOut, first, last)
+    for (long o = first; o < last; o++) {
+      c[o] = product(o, 0);
+      for (long t = 1; t < nTerms; t++)
+        c[o] += product(o, t);
+      c[o].reLinearize();
+    }
+    NTL_EXEC_RANGE_END
+  } else {
+    // Too few outputs to keep all the threads busy, compute the terms of
+    // each in parallel instead
+    for (long o = 0; o < nOut; o++) {
+      std::vector<Ctxt> terms(nTerms, Ctxt(ZeroCtxtLike, a[0]));
+      NTL_EXEC_RANGE(nTerms, first, last)
+      for (long t = first; t < last; t++)
+        terms[t] = product(o, t);
+      NTL_EXEC_RANGE_END
+      c[o] = std::move(terms[0]);
+      for (long t = 1; t < nTerms; t++)
+        c[o] += terms[t];
+      c[o].reLinearize();
+    }
+  }
+}
+
+} // namespace helib
@@ -0,0 +1,240 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* distributed.cpp - running batches of ciphertexts over several nodes
+ */
+#include <exception>
+#include <sstream>
+#include <utility>
+
+#include <helib/distributed.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+#include "binio.h"
+
+namespace helib {
+
+std::vector<std::unique_ptr<LocalTransport>> LocalTransport::group(long nodes)
+{
+  assertTrue<InvalidArgument>(nodes > 0, "LocalTransport: no nodes");
+  auto shared = std::make_shared<Shared>();
+  shared->nodes = nodes;
+  shared->queues.assign(nodes, std::vector<std::deque<std::string>>(nodes));
+
+  std::vector<std::unique_ptr<LocalTransport>> endpoints;
+  for (long i = 0; i < nodes; i++)
+    endpoints.emplace_back(new LocalTransport(shared, i));
+  return endpoints;
+}
+
+void LocalTransport::send(long to, std::string message)
+{
+  assertInRange<InvalidArgument>(to, 0L, size(), "LocalTransport: no node");
+  {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->queues[to][me].push_back(std::move(message));
+  }
+  shared->arrived.notify_all();
+}
+
+std::string LocalTransport::receive(long from)
+{
+  assertInRange<InvalidArgument>(from, 0L, size(), "LocalTransport: no node");
+  std::unique_lock<std::mutex> lock(shared->mutex);
+  std::deque<std::string>& queue = shared->queues[me][from];
+  shared->arrived.wait(lock, [&queue] { return !queue.empty(); });
+  std::string message = std::move(queue.front());
+  queue.pop_front();
+  return message;
+}
+
+namespace {
+
+enum MessageKind : long
+{
+  CTXTS = 0,
+  ERROR = 1
+};
+
+// The targetBits of writeCompact keeping keepBits, or all the capacity
+long compactBits(const Ctxt& ctxt, long keepBits)
+{
+  return keepBits < 0 ? ctxt.bitCapacity() + 2 : keepBits;
+}
+
+/*  A message, in binary:
+  1.  long kind
+  2.  for CTXTS, long count then count compact ciphertexts;
+      for ERROR, long length then length bytes of what()
+*/
+
+std::string ctxtsMessage(const std::vector<Ctxt>& ctxts,
+                         long begin,
+                         long end,
+                         long keepBits)
+{
+  std::ostringstream str;
+  writeEyeCatcher(str, EyeCatcher::DIST_BEGIN);
+  write_raw_int(str, CTXTS);
+  write_raw_int(str, end - begin);
+  for (long i = begin; i < end; i++)
+    ctxts[i].writeCompact(str, compactBits(ctxts[i], keepBits));
+  writeEyeCatcher(str, EyeCatcher::DIST_END);
+  return str.str();
+}
+
+std::string errorMessage(const std::string& what)
+{
+  std::ostringstream str;
+  writeEyeCatcher(str, EyeCatcher::DIST_BEGIN);
+  write_raw_int(str, ERROR);
+  write_raw_int(str, what.size());
+  str.write(what.data(), what.size());
+  writeEyeCatcher(str, EyeCatcher::DIST_END);
+  return str.str();
+}
+
+// The ciphertexts of a message, appended to ctxts. Returns false and sets
+// error for an ERROR message
+bool readMessage(const std::string& message,
+                 const PubKey& pubKey,
+                 std::vector<Ctxt>& ctxts,
+                 std::string& error)
+{
+  std::istringstream str(message);
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::DIST_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find pre-distributed-message eye catcher");
+
+  long kind = read_raw_int(str);
+  long count = read_raw_int(str);
+  assertTrue<IOError>((kind == CTXTS || kind == ERROR) && count >= 0,
+                      "Invalid distributed message");
+  if (kind == ERROR) {
+    error.resize(count);
+    str.read(&error[0], count);
+  } else {
+    ctxts.reserve(ctxts.size() + count);
+    for (long i = 0; i < count; i++) {
+      ctxts.emplace_back(pubKey);
+      ctxts.back().read(str);
+    }
+  }
+
+  eyeCatcherFound = readEyeCatcher(str, EyeCatcher::DIST_END);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-distributed-message eye catcher");
+  return kind == CTXTS;
+}
+
+} // namespace
+
+void distributedApply(Transport& transport,
+                      std::vector<Ctxt>& ctxts,
+                      const PubKey& pubKey,
+                      const std::function<void(std::vector<Ctxt>&)>& op,
+                      long keepBits)
+{
+  HELIB_TIMER_START;
+  const long nodes = transport.size();
+  if (nodes == 1) {
+    op(ctxts);
+    return;
+  }
+
+  if (transport.rank() != 0) {
+    std::exception_ptr failure;
+    std::string message;
+    try {
+      std::vector<Ctxt> share;
+      std::string error;
+      readMessage(transport.receive(0), pubKey, share, error);
+      op(share);
+      message = ctxtsMessage(share, 0, share.size(), keepBits);
+      ctxts = std::move(share);
+    } catch (const std::exception& e) {
+      failure = std::current_exception();
+      message = errorMessage(e.what());
+    }
+    transport.send(0, std::move(message));
+    if (failure)
+      std::rethrow_exception(failure);
+    return;
+  }
+
+  // The share of node i is [n * i / nodes, n * (i + 1) / nodes)
+  const long n = ctxts.size();
+  for (long i = 1; i < nodes; i++)
+    transport.send(i,
+                   ctxtsMessage(ctxts,
+                                n * i / nodes,
+                                n * (i + 1) / nodes,
+                                keepBits));
+
+  std::vector<Ctxt> results(ctxts.begin(), ctxts.begin() + n / nodes);
+  std::exception_ptr failure;
+  try {
+    op(results);
+  } catch (...) {
+    failure = std::current_exception();
+  }
+
+  // Every node is heard from, even after a failure, so none is left waiting
+  std::string firstError;
+  for (long i = 1; i < nodes; i++) {
+    std::string error;
+    try {
+      if (!readMessage(transport.receive(i), pubKey, results, error) &&
+          firstError.empty())
+        firstError = "node " + std::to_string(i) + ": " + error;
+    } catch (...) {
+      if (!failure)
+        failure = std::current_exception();
+    }
+  }
+  if (failure)
+    std::rethrow_exception(failure);
+  assertTrue<LogicError>(firstError.empty(), "distributedApply: " + firstError);
+  ctxts = std::move(results);
+}
+
+Ctxt distributedSum(Transport& transport, const Ctxt& partial, long keepBits)
+{
+  HELIB_TIMER_START;
+  const long nodes = transport.size();
+  const long me = transport.rank();
+  Ctxt sum(partial);
+
+  // In the round of step s, the nodes at odd multiples of s send their sums
+  // to the node s below them
+  for (long step = 1; step < nodes; step *= 2) {
+    if (me % (2 * step) == step) {
+      std::vector<Ctxt> out{sum};
+      transport.send(me - step, ctxtsMessage(out, 0, 1, keepBits));
+      break;
+    }
+    if (me + step < nodes) {
+      std::vector<Ctxt> in;
+      std::string error;
+      bool ok = readMessage(transport.receive(me + step),
+                            partial.getPubKey(),
+                            in,
+                            error);
+      assertTrue<IOError>(ok && in.size() == 1,
+                          "distributedSum: expected one term");
+      sum += in[0];
+    }
+  }
+  return sum;
+}
+
+} // namespace helib
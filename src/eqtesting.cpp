@@ -38,37 +38,39 @@
 
 namespace helib {
 
-// Map all non-zero slots to 1, leaving zero slots as zero.
-// Assumes that r=1, and that all the slot contain elements from GF(p^d).
-//
-// We compute x^{p^d-1} = x^{(1+p+...+p^{d-1})*(p-1)} by setting y=x^{p-1}
-// and then outputting y * y^p * ... * y^{p^{d-1}}, with exponentiation to
-// powers of p done via Frobenius.
-
-void mapTo01(const EncryptedArray& ea, Ctxt& ctxt, bool multithread)
+// Set ctxt to the "norm" y * y^p * ... * y^{p^{d-1}}. The d-1 Frobenius maps
+// are all applied to the same ciphertext, so it is broken into digits only
+// once and the maps are applied from the shared digits (in parallel), then
+// the product is taken with depth log d.
+static void hoistedFrobeniusNorm(Ctxt& ctxt, long d)
 {
-  long p = ctxt.getPtxtSpace();
-  if (p != ea.getPAlgebra().getP()) // ptxt space is p^r for r>1
-    throw LogicError("mapTo01 not implemented for r>1");
+  if (d <= 1 || ctxt.isEmpty())
+    return;
+  const Context& context = ctxt.getContext();
+  long m = context.getM();
+  long p = context.getP();
 
-  if (p > 2)
-    ctxt.power(p - 1); // set y = x^{p-1}
+  std::vector<long> ks(d - 1);
+  for (long j = 1; j < d; j++)
+    ks[j - 1] = NTL::PowerMod(p % m, j, m);
+
+  std::vector<Ctxt> v;
+  ctxt.hoistedAutomorphs(ks, v);
+  v.insert(v.begin(), ctxt);
+  totalProduct(ctxt, v);
+}
+
+// Replace y by its "norm" y * y^p * ... * y^{p^{d-1}}, with exponentiation
+// to powers of p done via Frobenius.
+void frobeniusNorm(const EncryptedArray& ea, Ctxt& ctxt, bool multithread)
+{
   long d = ea.getDegree();
   // TODO: investigate this trade off more thoroughly
   // Computing in parallel over t threads has runtime approximately
   // (d - 1)/t, whereas single thread has runtime approx log(d)
   if ((NTL::AvailableThreads() > 1) && multithread) {
-    // Compute O(d) Frobenius automorphisms in parallel    
-    if (d > 1) {
-      // compute the d - 1 automorphisms in parallel
-      std::vector<Ctxt> v(d, ctxt);
-      NTL_EXEC_RANGE(d - 1, first, last)
-      for (long i = first; i < last; i++)
-        v[i + 1].frobeniusAutomorph(i + 1);
-      NTL_EXEC_RANGE_END
-      // and compute the product of the d automorphisms
-      totalProduct(ctxt, v);
-    }
+    // Compute O(d) hoisted Frobenius automorphisms in parallel
+    hoistedFrobeniusNorm(ctxt, d);
   } else {
     // Compute of the "norm" y * y^p * ... * y^{p^{d-1}}
     //  using O(log d) automorphisms, rather than O(d).
@@ -89,6 +91,24 @@ void mapTo01(const EncryptedArray& ea, Ctxt& ctxt, bool multithread)
   }
 }
 
+// Map all non-zero slots to 1, leaving zero slots as zero.
+// Assumes that r=1, and that all the slot contain elements from GF(p^d).
+//
+// We compute x^{p^d-1} = x^{(1+p+...+p^{d-1})*(p-1)} by setting y=x^{p-1}
+// and then outputting y * y^p * ... * y^{p^{d-1}}, with exponentiation to
+// powers of p done via Frobenius.
+
+void mapTo01(const EncryptedArray& ea, Ctxt& ctxt, bool multithread)
+{
+  long p = ctxt.getPtxtSpace();
+  if (p != ea.getPAlgebra().getP()) // ptxt space is p^r for r>1
+    throw LogicError("mapTo01 not implemented for r>1");
+
+  if (p > 2)
+    ctxt.power(p - 1); // set y = x^{p-1}
+  frobeniusNorm(ea, ctxt, multithread);
+}
+
 template <typename Scheme>
 void mapTo01(const EncryptedArray&, Ptxt<Scheme>& ptxt)
 {
@@ -99,13 +119,20 @@ template void mapTo01(const EncryptedArray&, Ptxt<BGV>& ptxt);
 template void mapTo01(const EncryptedArray&, Ptxt<CKKS>& ptxt);
 
 // computes ctxt^{2^d-1} using a method that takes
-// O(log d) automorphisms and multiplications
+// O(log d) automorphisms and multiplications. With several threads, the
+// d-1 automorphisms of the input are hoisted and run in parallel instead,
+// with the same trade off as in mapTo01.
 void fastPower(Ctxt& ctxt, long d)
 {
   assertEq(ctxt.getPtxtSpace(), 2l, "ptxtSpace must be 2");
   if (d <= 1)
     return;
 
+  if (NTL::AvailableThreads() > 1) {
+    hoistedFrobeniusNorm(ctxt, d);
+    return;
+  }
+
   Ctxt orig = ctxt;
 
   long k = NTL::NumBits(d);
@@ -125,27 +152,18 @@ void fastPower(Ctxt& ctxt, long d)
   }
 }
 
-// ===> This function only works for p=2, r=1 <===
-// Test if prefixes of bits in slots are all zero: Set slot j of res[i] to 0
-// if bits 0..i of j'th slot in ctxt are all zero, else it is set to 1
-// It is assumed that res and the res[i]'s are initialized by the caller.
-// Complexity: O(d + n log d) smart automorphisms
-//             O(n d)
-void incrementalZeroTest(Ctxt* res[],
-                         const EncryptedArray& ea,
-                         const Ctxt& ctxt,
-                         long n)
+// The encoded coefficients of the linearized polynomials that select bits
+// 0..i of each slot, for i=0..n-1. They only depend on ea and n.
+static void zeroTestCoeffs(std::vector<std::vector<NTL::ZZX>>& Coeff,
+                           const EncryptedArray& ea,
+                           long n)
 {
-  HELIB_TIMER_START;
   long nslots = ea.size();
   long d = ea.getDegree();
-
-  // compute linearized polynomial coefficients
-
-  std::vector<std::vector<NTL::ZZX>> Coeff;
   Coeff.resize(n);
 
-  for (long i = 0; i < n; i++) {
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i = first; i < last; i++) {
     // coefficients for mask on bits 0..i
     // L[j] = X^j for j = 0..i, L[j] = 0 for j = i+1..d-1
 
@@ -171,14 +189,28 @@ void incrementalZeroTest(Ctxt* res[],
       ea.encode(Coeff[i][j], T);
     }
   }
+  NTL_EXEC_RANGE_END
+}
 
-  std::vector<Ctxt> Conj(d, ctxt);
-  // initialize Cong[j] to ctxt^{2^j}
-  for (long j = 0; j < d; j++) {
-    Conj[j].smartAutomorph(1L << j);
-  }
+// The zero test of one ciphertext, given the coefficients
+static void zeroTestOne(Ctxt* res[],
+                        const std::vector<std::vector<NTL::ZZX>>& Coeff,
+                        const EncryptedArray& ea,
+                        const Ctxt& ctxt,
+                        long n)
+{
+  long d = ea.getDegree();
 
-  for (long i = 0; i < n; i++) {
+  // Conj[j] = ctxt^{2^j}, all automorphisms of ctxt so they are hoisted
+  std::vector<long> ks(d);
+  for (long j = 0; j < d; j++)
+    ks[j] = 1L << j;
+  std::vector<Ctxt> Conj;
+  ctxt.hoistedAutomorphs(ks, Conj);
+
+  // The n tests are independent
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i = first; i < last; i++) {
     res[i]->clear();
     for (long j = 0; j < d; j++) {
       Ctxt tmp = Conj[j];
@@ -191,7 +223,59 @@ void incrementalZeroTest(Ctxt* res[],
 
     fastPower(*res[i], d);
   }
-  HELIB_TIMER_STOP;
+  NTL_EXEC_RANGE_END
+}
+
+// ===> This function only works for p=2, r=1 <===
+// Test if prefixes of bits in slots are all zero: Set slot j of res[i] to 0
+// if bits 0..i of j'th slot in ctxt are all zero, else it is set to 1
+// It is assumed that res and the res[i]'s are initialized by the caller.
+// Complexity: O(d + n log d) smart automorphisms
+//             O(n d)
+void incrementalZeroTest(Ctxt* res[],
+                         const EncryptedArray& ea,
+                         const Ctxt& ctxt,
+                         long n)
+{
+  HELIB_TIMER_START;
+  std::vector<std::vector<NTL::ZZX>> Coeff;
+  zeroTestCoeffs(Coeff, ea, n);
+  zeroTestOne(res, Coeff, ea, ctxt, n);
+}
+
+// The batched version: the coefficients are computed once, and the
+// ciphertexts are tested in parallel
+void incrementalZeroTest(std::vector<std::vector<Ctxt>>& res,
+                         const EncryptedArray& ea,
+                         const std::vector<Ctxt>& ctxts,
+                         long n)
+{
+  HELIB_TIMER_START;
+  long nCtxts = ctxts.size();
+  res.resize(nCtxts);
+  for (long c = 0; c < nCtxts; c++)
+    res[c].assign(n, Ctxt(ZeroCtxtLike, ctxts[c]));
+  if (nCtxts == 0 || n <= 0)
+    return;
+
+  std::vector<std::vector<NTL::ZZX>> Coeff;
+  zeroTestCoeffs(Coeff, ea, n);
+
+  std::vector<std::vector<Ctxt*>> ptrs(nCtxts, std::vector<Ctxt*>(n));
+  for (long c = 0; c < nCtxts; c++)
+    for (long i = 0; i < n; i++)
+      ptrs[c][i] = &res[c][i];
+
+  // With few ciphertexts, let each test parallelize internally instead
+  if (nCtxts >= NTL::AvailableThreads()) {
+    NTL_EXEC_RANGE(nCtxts, first, last)
+    for (long c = first; c < last; c++)
+      zeroTestOne(ptrs[c].data(), Coeff, ea, ctxts[c], n);
+    NTL_EXEC_RANGE_END
+  } else {
+    for (long c = 0; c < nCtxts; c++)
+      zeroTestOne(ptrs[c].data(), Coeff, ea, ctxts[c], n);
+  }
 }
 
 } // namespace helib
@@ -13,6 +13,7 @@
  */
 #include <NTL/ZZ.h>
 #include <NTL/ZZ_p.h>
+#include <NTL/BasicThreadPool.h>
 #include <helib/EncryptedArray.h>
 #include <helib/polyEval.h>
 #include <helib/debugging.h>
@@ -88,21 +89,25 @@ void extractDigits(std::vector<Ctxt>& digits, const Ctxt& c, long r)
   fprintf(stderr, "***\n");
 #endif
   for (long i = 0; i < r; i++) {
-    tmp = c;
-    for (long j = 0; j < i; j++) {
-
+    // The digits found so far are raised to the p-th power independently of
+    // each other, so these chains run in parallel
+    NTL_EXEC_RANGE(i, first, last)
+    for (long j = first; j < last; j++) {
       if (p == 2)
         digits[j].square();
       else if (p == 3)
         digits[j].cube();
       else
         polyEval(digits[j], x2p, digits[j]);
-        // "in spirit" digits[j] = digits[j]^p
+      // "in spirit" digits[j] = digits[j]^p
+    }
+    NTL_EXEC_RANGE_END
 
+    tmp = c;
+    for (long j = 0; j < i; j++) {
 #ifdef HELIB_DEBUG
       fprintf(stderr, "%5ld", digits[j].bitCapacity());
 #endif
-
       tmp -= digits[j];
       tmp.divideByP();
     }
@@ -254,26 +259,35 @@ void extendExtractDigits(std::vector<Ctxt>& digits,
   fprintf(stderr, "***\n");
 #endif
   for (long i : range(r)) {
+    // optimization: where digits[j] is better than digits0[j], just use it.
+    // The other digits0[j] are raised to the p-th power independently of
+    // each other, in parallel.
+    std::vector<char> useDigits(i);
+    for (long j : range(i))
+      useDigits[j] = digits[j].capacity() >= digits0[j].capacity();
+    NTL_EXEC_RANGE(i, first, last)
+    for (long j = first; j < last; j++) {
+      if (useDigits[j])
+        continue;
+      if (p == 2)
+        digits0[j].square();
+      else if (p == 3)
+        digits0[j].cube();
+      else
+        polyEval(digits0[j],
+                 x2p,
+                 digits0[j]); // "in spirit" digits0[j] = digits0[j]^p
+    }
+    NTL_EXEC_RANGE_END
+
     tmp = c;
     for (long j : range(i)) {
-      if (digits[j].capacity() >= digits0[j].capacity()) {
-        // optimization: digits[j] is better than digits0[j],
-        // so just use it
-
+      if (useDigits[j]) {
         tmp -= digits[j];
 #ifdef HELIB_DEBUG
         fprintf(stderr, "%5ld*", digits[j].bitCapacity());
 #endif
       } else {
-        if (p == 2)
-          digits0[j].square();
-        else if (p == 3)
-          digits0[j].cube();
-        else
-          polyEval(digits0[j],
-                   x2p,
-                   digits0[j]); // "in spirit" digits0[j] = digits0[j]^p
-
         tmp -= digits0[j];
 #ifdef HELIB_DEBUG
         fprintf(stderr, "%5ld ", digits0[j].bitCapacity());
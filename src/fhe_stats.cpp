@@ -13,6 +13,7 @@
 #include <helib/fhe_stats.h>
 #include <helib/multicore.h>
 #include <algorithm>
+#include <cmath>
 #include <utility>
 #include <cstring>
 
@@ -20,6 +21,8 @@ namespace helib {
 
 bool fhe_stats = false;
 
+fhe_op_counts fhe_ops;
+
 static std::vector<fhe_stats_record*> stats_map;
 static HELIB_MUTEX_TYPE stats_mutex;
 
@@ -33,11 +36,37 @@ fhe_stats_record::fhe_stats_record(const char* _name) :
 
 void fhe_stats_record::update(double val)
 {
+  // The smallest e with val <= 2^e
+  long bucket = 0;
+  if (val > 0 && std::isfinite(val)) {
+    int e = std::ilogb(val);
+    if (val > std::ldexp(1.0, e))
+      e++;
+    bucket = std::min(std::max(e - minExponent, 0L), numBuckets - 1);
+  } else if (val > 0) {
+    bucket = numBuckets - 1;
+  }
+
   HELIB_MUTEX_GUARD(stats_mutex);
   count++;
   sum += val;
   if (val > max)
     max = val;
+  histogram[bucket]++;
+}
+
+double fhe_stats_record::getBucketBound(long i)
+{
+  if (i >= numBuckets - 1)
+    return HUGE_VAL;
+  return std::ldexp(1.0, minExponent + i);
+}
+
+void forEachStatsRecord(const std::function<void(const fhe_stats_record&)>& fn)
+{
+  HELIB_MUTEX_GUARD(stats_mutex);
+  for (const fhe_stats_record* record : stats_map)
+    fn(*record);
 }
 
 void fhe_stats_record::save(double val)
@@ -77,4 +106,102 @@ const std::vector<double>* fetch_saved_values(const char* name)
   return 0;
 }
 
+static fhe_op_count snapshot(const fhe_op_counter& counter)
+{
+  fhe_op_count result;
+  result.total = counter.total;
+  result.byPrimes.resize(fhe_op_counter::maxPrimes + 1);
+  for (long i = 0; i <= fhe_op_counter::maxPrimes; i++)
+    result.byPrimes[i] = counter.byPrimes[i];
+  return result;
+}
+
+static void reset(fhe_op_counter& counter)
+{
+  counter.total = 0;
+  for (auto& count : counter.byPrimes)
+    count = 0;
+}
+
+fhe_op_count fhe_op_count::operator-(const fhe_op_count& earlier) const
+{
+  fhe_op_count result(*this);
+  result.total -= earlier.total;
+  for (std::size_t i = 0; i < earlier.byPrimes.size(); i++)
+    if (i < result.byPrimes.size())
+      result.byPrimes[i] -= earlier.byPrimes[i];
+  return result;
+}
+
+fhe_op_snapshot fhe_op_snapshot::operator-(const fhe_op_snapshot& earlier) const
+{
+  fhe_op_snapshot result;
+  result.keySwitches = keySwitches - earlier.keySwitches;
+  result.ntts = ntts - earlier.ntts;
+  result.ffts = ffts - earlier.ffts;
+  result.iffts = iffts - earlier.iffts;
+  result.keySwitchParts = keySwitchParts - earlier.keySwitchParts;
+  result.automorphs = automorphs - earlier.automorphs;
+  result.reLinearizations = reLinearizations - earlier.reLinearizations;
+  result.modDowns = modDowns - earlier.modDowns;
+  result.reCrypts = reCrypts - earlier.reCrypts;
+  return result;
+}
+
+fhe_op_snapshot snapshot_op_counts()
+{
+  fhe_op_snapshot result;
+  result.keySwitches = fhe_ops.keySwitches;
+  result.ntts = fhe_ops.ntts;
+  result.ffts = fhe_ops.ffts;
+  result.iffts = fhe_ops.iffts;
+  result.keySwitchParts = snapshot(fhe_ops.keySwitchParts);
+  result.automorphs = snapshot(fhe_ops.automorphs);
+  result.reLinearizations = snapshot(fhe_ops.reLinearizations);
+  result.modDowns = snapshot(fhe_ops.modDowns);
+  result.reCrypts = snapshot(fhe_ops.reCrypts);
+  return result;
+}
+
+void reset_op_counts()
+{
+  fhe_ops.keySwitches = 0;
+  fhe_ops.ntts = 0;
+  fhe_ops.ffts = 0;
+  fhe_ops.iffts = 0;
+  reset(fhe_ops.keySwitchParts);
+  reset(fhe_ops.automorphs);
+  reset(fhe_ops.reLinearizations);
+  reset(fhe_ops.modDowns);
+  reset(fhe_ops.reCrypts);
+}
+
+static void print_op_count(std::ostream& s,
+                           const char* name,
+                           const fhe_op_count& count)
+{
+  if (count.total == 0)
+    return;
+  s << name << "=" << count.total << " [";
+  const char* sep = "";
+  for (std::size_t i = 0; i < count.byPrimes.size(); i++)
+    if (count.byPrimes[i] != 0) {
+      s << sep << i << " primes: " << count.byPrimes[i];
+      sep = ", ";
+    }
+  s << "]\n";
+}
+
+void print_op_counts(std::ostream& s, const fhe_op_snapshot& counts)
+{
+  s << "||||| op counts |||||\n";
+  s << "keySwitches=" << counts.keySwitches << " ntts=" << counts.ntts
+    << " (ffts=" << counts.ffts << " iffts=" << counts.iffts << ")\n";
+  print_op_count(s, "keySwitchParts", counts.keySwitchParts);
+  print_op_count(s, "automorphs", counts.automorphs);
+  print_op_count(s, "reLinearizations", counts.reLinearizations);
+  print_op_count(s, "modDowns", counts.modDowns);
+  print_op_count(s, "reCrypts", counts.reCrypts);
+}
+
 } // namespace helib
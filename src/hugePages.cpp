@@ -0,0 +1,266 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* hugePages.cpp - buffers in huge pages, with a fallback to regular ones
+ */
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include <helib/hugePages.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+namespace {
+
+constexpr long SIZE_2MB = 2L << 20;
+constexpr long SIZE_1GB = 1L << 30;
+constexpr long HEAP_ALIGNMENT = 64;
+
+constexpr unsigned bit(MemoryCategory category)
+{
+  return 1u << int(category);
+}
+
+std::atomic<unsigned> enabledCategories(bit(MemoryCategory::KEYS) |
+                                        bit(MemoryCategory::MATMUL_CACHE) |
+                                        bit(MemoryCategory::BOOTSTRAPPING));
+std::atomic<long> minBytes(HugePagePolicy::DEFAULT_MIN_BYTES);
+std::atomic<bool> useHugeTLB(true);
+
+struct Counters
+{
+  std::atomic<long> buffers{0};
+  std::atomic<long> bytes{0};
+};
+std::array<Counters, int(HugePageKind::COUNT)> counters;
+
+void count(HugePageKind kind, long buffers, long bytes)
+{
+  counters[int(kind)].buffers.fetch_add(buffers, std::memory_order_relaxed);
+  counters[int(kind)].bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+long roundUp(long n, long unit) { return (n + unit - 1) / unit * unit; }
+
+#if defined(__linux__)
+
+// Transparent huge pages may be switched off for the whole system
+bool transparentEnabled()
+{
+  static const bool enabled = [] {
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string line;
+    std::getline(file, line);
+    return !line.empty() && line.find("[never]") == std::string::npos;
+  }();
+  return enabled;
+}
+
+// A mapping of len bytes, in explicit pages of pageSize bytes, or nullptr if
+// there are not enough of them
+void* mapHugeTLB(long len, long pageSize)
+{
+#ifdef MAP_HUGETLB
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+  // The page size is given by its log2, in the bits from MAP_HUGE_SHIFT on
+  int logSize = (pageSize == SIZE_1GB) ? 30 : 21;
+  void* p = mmap(nullptr,
+                 len,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                     (logSize << MAP_HUGE_SHIFT),
+                 -1,
+                 0);
+  return (p == MAP_FAILED) ? nullptr : p;
+#else
+  (void)len;
+  (void)pageSize;
+  return nullptr;
+#endif
+}
+
+// A 2 MB-aligned mapping of len bytes (a multiple of 2 MB), marked for
+// transparent huge pages, or nullptr. advised tells whether the kernel
+// took the hint.
+void* mapTransparent(long len, bool& advised)
+{
+  long total = len + SIZE_2MB;
+  void* p = mmap(nullptr,
+                 total,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1,
+                 0);
+  if (p == MAP_FAILED)
+    return nullptr;
+
+  // Trim the mapping down to the aligned part
+  std::uintptr_t start = reinterpret_cast<std::uintptr_t>(p);
+  std::uintptr_t aligned = roundUp(start, SIZE_2MB);
+  std::uintptr_t end = aligned + len;
+  if (aligned > start)
+    munmap(p, aligned - start);
+  if (start + total > end)
+    munmap(reinterpret_cast<void*>(end), start + total - end);
+
+  void* q = reinterpret_cast<void*>(aligned);
+  advised = (madvise(q, len, MADV_HUGEPAGE) == 0);
+  return q;
+}
+
+#endif // defined(__linux__)
+
+} // namespace
+
+const char* hugePageKindName(HugePageKind kind)
+{
+  static const char* names[] = {"none",
+                                "transparent",
+                                "hugetlb-2mb",
+                                "hugetlb-1gb"};
+  assertInRange(int(kind),
+                0,
+                int(HugePageKind::COUNT),
+                "hugePageKindName: no such kind");
+  return names[int(kind)];
+}
+
+void HugePagePolicy::setEnabled(MemoryCategory category, bool enable)
+{
+  if (enable)
+    enabledCategories.fetch_or(bit(category));
+  else
+    enabledCategories.fetch_and(~bit(category));
+}
+
+bool HugePagePolicy::isEnabled(MemoryCategory category)
+{
+  return (enabledCategories.load() & bit(category)) != 0;
+}
+
+void HugePagePolicy::setMinBytes(long bytes) { minBytes = bytes; }
+long HugePagePolicy::getMinBytes() { return minBytes; }
+
+void HugePagePolicy::setUseHugeTLB(bool use) { useHugeTLB = use; }
+bool HugePagePolicy::getUseHugeTLB() { return useHugeTLB; }
+
+HugePageStats hugePageStats()
+{
+  HugePageStats stats;
+  for (int i = 0; i < int(HugePageKind::COUNT); i++) {
+    stats.buffers[i] = counters[i].buffers.load(std::memory_order_relaxed);
+    stats.bytes[i] = counters[i].bytes.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+HugePageBuffer::HugePageBuffer(long _bytes, MemoryCategory category) :
+    bytes(_bytes)
+{
+  assertTrue<InvalidArgument>(bytes >= 0, "HugePageBuffer: negative size");
+  if (bytes == 0)
+    return;
+
+#if defined(__linux__)
+  if (HugePagePolicy::isEnabled(category) &&
+      bytes >= HugePagePolicy::getMinBytes()) {
+    // Explicit pages are only used when rounding up to a whole number of
+    // them wastes at most an eighth of the buffer
+    if (HugePagePolicy::getUseHugeTLB())
+      for (long pageSize : {SIZE_1GB, SIZE_2MB}) {
+        long len = roundUp(bytes, pageSize);
+        if (len - bytes > bytes / 8)
+          continue;
+        ptr = mapHugeTLB(len, pageSize);
+        if (ptr) {
+          mapped = len;
+          pages = (pageSize == SIZE_1GB) ? HugePageKind::HUGETLB_1GB
+                                         : HugePageKind::HUGETLB_2MB;
+          break;
+        }
+      }
+
+    if (!ptr && transparentEnabled()) {
+      long len = roundUp(bytes, SIZE_2MB);
+      bool advised = false;
+      ptr = mapTransparent(len, advised);
+      if (ptr) {
+        mapped = len;
+        pages = advised ? HugePageKind::TRANSPARENT : HugePageKind::NONE;
+      }
+    }
+  }
+#else
+  (void)category;
+#endif
+
+  if (!ptr) {
+    // std::aligned_alloc requires the size to be a multiple of the alignment
+    long len = roundUp(bytes, HEAP_ALIGNMENT);
+    ptr = std::aligned_alloc(HEAP_ALIGNMENT, len);
+    if (ptr == nullptr)
+      throw std::bad_alloc();
+    std::memset(ptr, 0, len); // mappings come zeroed already
+  }
+  count(pages, 1, bytes);
+}
+
+HugePageBuffer::HugePageBuffer(HugePageBuffer&& other) noexcept :
+    ptr(std::exchange(other.ptr, nullptr)),
+    bytes(std::exchange(other.bytes, 0)),
+    mapped(std::exchange(other.mapped, 0)),
+    pages(std::exchange(other.pages, HugePageKind::NONE))
+{}
+
+HugePageBuffer& HugePageBuffer::operator=(HugePageBuffer&& other) noexcept
+{
+  if (this != &other) {
+    release();
+    ptr = std::exchange(other.ptr, nullptr);
+    bytes = std::exchange(other.bytes, 0);
+    mapped = std::exchange(other.mapped, 0);
+    pages = std::exchange(other.pages, HugePageKind::NONE);
+  }
+  return *this;
+}
+
+void HugePageBuffer::release()
+{
+  if (ptr == nullptr)
+    return;
+  count(pages, -1, -bytes);
+#if defined(__linux__)
+  if (mapped > 0)
+    munmap(ptr, mapped);
+  else
+#endif
+    std::free(ptr);
+  ptr = nullptr;
+  bytes = 0;
+  mapped = 0;
+  pages = HugePageKind::NONE;
+}
+
+} // namespace helib
@@ -15,6 +15,7 @@
 #include <functional>
 #include <shared_mutex>
 #include <mutex>
+#include <vector>
 
 namespace intel {
 
@@ -174,6 +175,49 @@ void EltwiseMultMod(long* result,
                              /*input_mod_factor=*/1);
 }
 
+void EltwiseSubMulMod(long* result,
+                      const long* operand1,
+                      const long* operand2,
+                      long scalar,
+                      long n,
+                      long modulus)
+{
+  intel::hexl::EltwiseSubMod(reinterpret_cast<uint64_t*>(result),
+                             reinterpret_cast<const uint64_t*>(operand1),
+                             reinterpret_cast<const uint64_t*>(operand2),
+                             n,
+                             modulus);
+  intel::hexl::EltwiseFMAMod(reinterpret_cast<uint64_t*>(result),
+                             reinterpret_cast<const uint64_t*>(result),
+                             scalar,
+                             nullptr,
+                             n,
+                             modulus,
+                             /*input_mod_factor=*/1);
+}
+
+void EltwiseMulAddMod(long* result,
+                      const long* operand1,
+                      const long* operand2,
+                      long n,
+                      long modulus)
+{
+  // HEXL only fuses a multiplication by a scalar with the addition
+  thread_local std::vector<uint64_t> product;
+  product.resize(n);
+  intel::hexl::EltwiseMultMod(product.data(),
+                              reinterpret_cast<const uint64_t*>(operand1),
+                              reinterpret_cast<const uint64_t*>(operand2),
+                              n,
+                              modulus,
+                              /*input_mod_factor=*/1);
+  intel::hexl::EltwiseAddMod(reinterpret_cast<uint64_t*>(result),
+                             reinterpret_cast<const uint64_t*>(result),
+                             product.data(),
+                             n,
+                             modulus);
+}
+
 } // namespace intel
 
 #endif // USE_INTEL_HEXL
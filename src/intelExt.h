@@ -56,6 +56,23 @@ void EltwiseMultMod(long* result,
                     long n,
                     long modulus);
 
+// result = (operand1 - operand2) * scalar, the exact division of the
+// mod-down and digit-decomposition steps, with scalar the inverse of the
+// divisor modulo modulus
+void EltwiseSubMulMod(long* result,
+                      const long* operand1,
+                      const long* operand2,
+                      long scalar,
+                      long n,
+                      long modulus);
+
+// result += operand1 * operand2, the accumulation of an inner product
+void EltwiseMulAddMod(long* result,
+                      const long* operand1,
+                      const long* operand2,
+                      long n,
+                      long modulus);
+
 } // namespace intel
 
 #endif // HELIB_INTELEXT_H
@@ -69,6 +69,23 @@ void buildUnpackSlotEncoding(std::vector<zzX>& unpackSlotEncoding,
   ea.dispatch<buildUnpackSlotEncoding_pa_impl>(unpackSlotEncoding);
 }
 
+// Convert the unpack constants to DoubleCRT over the primes of ctxt
+static void unpackConstantsToDCRT(
+    std::vector<std::shared_ptr<DoubleCRT>>& coeff_vector,
+    const std::vector<zzX>& unpackSlotEncoding,
+    const Ctxt& ctxt)
+{
+  long d = unpackSlotEncoding.size();
+  coeff_vector.resize(d);
+  NTL_EXEC_RANGE(d, first, last)
+  for (long i = first; i < last; i++) {
+    coeff_vector[i] = std::make_shared<DoubleCRT>(unpackSlotEncoding[i],
+                                                  ctxt.getContext(),
+                                                  ctxt.getPrimeSet());
+  }
+  NTL_EXEC_RANGE_END
+}
+
 template <typename type>
 class unpack_pa_impl
 {
@@ -80,32 +97,41 @@ public:
                     const Ctxt& ctxt,
                     const std::vector<zzX>& unpackSlotEncoding)
   {
-    long d = ea.getDegree(); // size of each slot
+    std::vector<std::shared_ptr<DoubleCRT>> coeff_vector;
+    unpackConstantsToDCRT(coeff_vector, unpackSlotEncoding, ctxt);
+    apply(ea, unpacked, ctxt, coeff_vector);
+  }
 
-    // ctxt.cleanUp();
+  static void apply(
+      const EncryptedArrayDerived<type>& ea,
+      const CtPtrs& unpacked,
+      const Ctxt& ctxt,
+      const std::vector<std::shared_ptr<DoubleCRT>>& coeff_vector)
+  {
+    long d = ea.getDegree(); // size of each slot
+    const Context& context = ctxt.getContext();
+    long m = context.getM();
+    long p = context.getP();
 
-    // Convert the unpack constants to doubleCRT
-    std::vector<std::shared_ptr<DoubleCRT>> coeff_vector(d);
-    for (long i = 0; i < d; i++) {
-      coeff_vector[i] = std::make_shared<DoubleCRT>(unpackSlotEncoding[i],
-                                                    ctxt.getContext(),
-                                                    ctxt.getPrimeSet());
-    }
-    // Compute the d Frobenius automorphisms of ctxt (use multi-threading)
+    // Compute the d Frobenius automorphisms of ctxt (use multi-threading).
+    // They all act on ctxt, so it is broken into digits only once.
     std::vector<Ctxt> frob(d, Ctxt(ZeroCtxtLike, ctxt));
-    NTL_EXEC_RANGE(d, first, last)
-    for (long j = first; j < last; j++) { // process jth Frobenius
-      frob[j] = ctxt;
-      frob[j].frobeniusAutomorph(j);
-      frob[j].cleanUp();
-      // NOTE: Why do we apply cleanup after the Frobenius?
+    {
+      BasicAutomorphPrecon precon(ctxt);
+      NTL_EXEC_RANGE(d, first, last)
+      for (long j = first; j < last; j++) { // process jth Frobenius
+        frob[j] = *precon.automorph(NTL::PowerMod(p % m, j, m));
+        frob[j].cleanUp();
+        // NOTE: Why do we apply cleanup after the Frobenius?
+      }
+      NTL_EXEC_RANGE_END
     }
-    NTL_EXEC_RANGE_END
 
     // compute the unpacked ciphertexts: the j'th slot of unpacked[i]
     // contains the i'th coefficient from the j'th clot of ctxt
+    NTL_EXEC_RANGE(unpacked.size(), first, last)
     Ctxt tmp1(ZeroCtxtLike, ctxt);
-    for (long i = 0; i < unpacked.size(); i++) {
+    for (long i = first; i < last; i++) {
       *(unpacked[i]) = frob[0];
       unpacked[i]->multByConstant(*coeff_vector[i]);
       for (long j = 1; j < d; j++) {
@@ -113,7 +139,8 @@ public:
         tmp1.multByConstant(*coeff_vector[mcMod(i + j, d)]);
         *(unpacked[i]) += tmp1;
       }
-    } // NOTE: why aren't we using multi-threading here?
+    }
+    NTL_EXEC_RANGE_END
   }
 };
 
@@ -146,13 +173,19 @@ long unpack(const CtPtrs& unpacked,
              "Not enough ciphertexts. (Packed size * d < unpacked size)");
   long offset = 0;
   long idx = 0;
+  // The constants are converted again only if the primes change
+  std::vector<std::shared_ptr<DoubleCRT>> coeff_vector;
+  IndexSet coeffPrimes;
   while (num2unpack > 0) {
     if (num2unpack < d)
       d = num2unpack;
     const CtPtrs_slice nextSlice(unpacked, offset, d);
-    ea.dispatch<unpack_pa_impl>(nextSlice,
-                                *(packed[idx++]),
-                                unpackSlotEncoding);
+    const Ctxt& ctxt = *(packed[idx++]);
+    if (coeff_vector.empty() || coeffPrimes != ctxt.getPrimeSet()) {
+      unpackConstantsToDCRT(coeff_vector, unpackSlotEncoding, ctxt);
+      coeffPrimes = ctxt.getPrimeSet();
+    }
+    ea.dispatch<unpack_pa_impl>(nextSlice, ctxt, coeff_vector);
     num2unpack -= d;
     offset += d;
   }
@@ -168,31 +201,49 @@ class repack_pa_impl
 public:
   PA_INJECT(type)
 
+  // powInSlots holds the constants X^{p^i} in all slots that were already
+  // encoded, and is extended as needed, so they are encoded only once
   static void apply(const EncryptedArrayDerived<type>& ea,
                     Ctxt& ctxt,
-                    const CtPtrs& unpacked)
+                    const CtPtrs& unpacked,
+                    std::vector<zzX>& powInSlots)
   {
-    RBak bak;
-    bak.save();
-    ea.restoreContext();     // the NTL context for mod p^r
-    long nslots = ea.size(); // how many slots
+    long n = unpacked.size();
+    if (lsize(powInSlots) < n) {
+      RBak bak;
+      bak.save();
+      ea.restoreContext();     // the NTL context for mod p^r
+      long nslots = ea.size(); // how many slots
+
+      const NTL::Mat<R>& CB = ea.getNormalBasisMatrix();
+      // CB contains a description of the normal-basis transformation
+
+      RX pow;
+      std::vector<RX> powVec(nslots);
+      for (long i = lsize(powInSlots); i < n; i++) {
+        conv(pow, CB[i]); // convert CB[i] from Vec<R> to RX
+        for (long j = 0; j < nslots; j++)
+          powVec[j] = pow;
+        powInSlots.emplace_back();
+        ea.encode(powInSlots.back(), powVec); // X^{p^i} in all slots
+      }
+    }
 
-    const NTL::Mat<R>& CB = ea.getNormalBasisMatrix();
-    // CB contains a description of the normal-basis transformation
+    if (n == 0) {
+      ctxt.clear();
+      return;
+    }
+    std::vector<Ctxt> terms(n, Ctxt(ZeroCtxtLike, *(unpacked[0])));
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++) {
+      terms[i] = *(unpacked[i]);
+      terms[i].multByConstant(powInSlots[i]); // unpacked[i] * X^{p^i}
+    }
+    NTL_EXEC_RANGE_END
 
-    RX pow;
-    zzX powInSlots;
-    std::vector<RX> powVec(nslots);
     ctxt.clear();
-    for (long i = 0; i < unpacked.size(); i++) {
-      conv(pow, CB[i]); // convert CB[i] from Vec<R> to RX
-      for (long j = 0; j < nslots; j++)
-        powVec[j] = pow;
-      ea.encode(powInSlots, powVec); // a constant with X^{p^i} in all slots
-      Ctxt tmp(*(unpacked[i]));
-      tmp.multByConstant(powInSlots); // accumulate unpacked[i] * X^{p^i}
-      ctxt += tmp;
-    }
+    for (const Ctxt& term : terms)
+      ctxt += term;
   }
 };
 
@@ -203,7 +254,8 @@ HELIB_NO_CKKS_IMPL(repack_pa_impl)
 // A wrapper function, calls the apply method of the class above
 void repack(Ctxt& packed, const CtPtrs& unpacked, const EncryptedArray& ea)
 {
-  ea.dispatch<repack_pa_impl>(packed, unpacked);
+  std::vector<zzX> powInSlots;
+  ea.dispatch<repack_pa_impl>(packed, unpacked, powInSlots);
 }
 
 // pack many ciphertexts, returns the number of packed ciphertexts
@@ -218,11 +270,12 @@ long repack(const CtPtrs& packed,
              "Not enough ciphertexts. (Packed size * d < unpacked size)");
   long offset = 0;
   long idx = 0;
+  std::vector<zzX> powInSlots; // shared by all the packed ciphertexts
   while (num2pack > 0) {
     if (num2pack < d)
       d = num2pack;
     const CtPtrs_slice nextSlice(unpacked, offset, d);
-    ea.dispatch<repack_pa_impl>(*(packed[idx++]), nextSlice);
+    ea.dispatch<repack_pa_impl>(*(packed[idx++]), nextSlice, powInSlots);
     num2pack -= d;
     offset += d;
   }
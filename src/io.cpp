@@ -10,6 +10,9 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 
+#include <algorithm>
+#include <iterator>
+
 #include <helib/NumbTh.h>
 #include <helib/exceptions.h>
 #include "io.h"
@@ -81,3 +84,95 @@ void from_json(const json& j, NTL::ZZX& poly)
 }
 
 } // namespace NTL
+
+namespace helib {
+
+static const char base64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void Base64OutBuf::put(unsigned char c)
+{
+  pending[nPending++] = c;
+  if (nPending < 3)
+    return;
+  char quad[4] = {base64Alphabet[pending[0] >> 2],
+                  base64Alphabet[((pending[0] & 3) << 4) | (pending[1] >> 4)],
+                  base64Alphabet[((pending[1] & 15) << 2) | (pending[2] >> 6)],
+                  base64Alphabet[pending[2] & 63]};
+  out.write(quad, 4);
+  nPending = 0;
+}
+
+Base64OutBuf::int_type Base64OutBuf::overflow(int_type c)
+{
+  if (finished)
+    return traits_type::eof();
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+    put(traits_type::to_char_type(c));
+  return traits_type::not_eof(c);
+}
+
+std::streamsize Base64OutBuf::xsputn(const char* s, std::streamsize n)
+{
+  if (finished)
+    return 0;
+  for (std::streamsize i = 0; i < n; i++)
+    put(s[i]);
+  return n;
+}
+
+void Base64OutBuf::finish()
+{
+  if (finished)
+    return;
+  finished = true;
+  if (nPending == 0)
+    return;
+  unsigned char b1 = (nPending > 1) ? pending[1] : 0;
+  char quad[4] = {base64Alphabet[pending[0] >> 2],
+                  base64Alphabet[((pending[0] & 3) << 4) | (b1 >> 4)],
+                  (nPending > 1) ? base64Alphabet[(b1 & 15) << 2] : '=',
+                  '='};
+  out.write(quad, 4);
+  nPending = 0;
+}
+
+std::string base64Decode(const std::string& text)
+{
+  if (text.size() % 4 != 0)
+    throw IOError("Bad base64 text: its length is not a multiple of 4");
+
+  signed char value[256];
+  std::fill(std::begin(value), std::end(value), -1);
+  for (int i = 0; i < 64; i++)
+    value[static_cast<unsigned char>(base64Alphabet[i])] = i;
+
+  std::string bytes;
+  bytes.reserve(text.size() / 4 * 3);
+  for (std::size_t i = 0; i < text.size(); i += 4) {
+    bool last = (i + 4 == text.size());
+    long pad = 0;
+    if (last && text[i + 3] == '=')
+      pad = (text[i + 2] == '=') ? 2 : 1;
+
+    unsigned long group = 0;
+    for (long k = 0; k < 4; k++) {
+      if (k >= 4 - pad) {
+        group <<= 6;
+        continue;
+      }
+      int v = value[static_cast<unsigned char>(text[i + k])];
+      if (v < 0)
+        throw IOError("Bad base64 text: unexpected character");
+      group = (group << 6) | v;
+    }
+    bytes.push_back(char(group >> 16));
+    if (pad < 2)
+      bytes.push_back(char((group >> 8) & 255));
+    if (pad < 1)
+      bytes.push_back(char(group & 255));
+  }
+  return bytes;
+}
+
+} // namespace helib
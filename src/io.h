@@ -21,6 +21,11 @@
  */
 
 #include <complex>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
 
 #include <json.hpp>
 using json = ::nlohmann::json;
@@ -30,6 +35,7 @@ using json = ::nlohmann::json;
 
 #include <helib/exceptions.h>
 #include <helib/JsonWrapper.h>
+#include <helib/SmallVector.h>
 #include <helib/version.h>
 
 // For our convenience, this helps us.
@@ -157,6 +163,31 @@ inline json writeVectorToJSON(const std::vector<T>& ts)
   return js;
 }
 
+// The same, for the parts of a ciphertext
+template <typename T, std::size_t N>
+inline void readVectorFromJSON(const json::array_t& j,
+                               SmallVector<T, N>& v,
+                               T& init)
+{
+  std::vector<json> jvec = j;
+
+  v.resize(jvec.size(), init);
+
+  for (std::size_t i = 0; i < jvec.size(); i++) {
+    v[i].readJSON(wrap(jvec[i]));
+  }
+}
+
+template <typename T, std::size_t N>
+inline json writeVectorToJSON(const SmallVector<T, N>& ts)
+{
+  std::vector<json> js;
+  for (const auto& t : ts) {
+    js.emplace_back(unwrap(t.writeToJSON()));
+  }
+  return js;
+}
+
 template <typename T>
 static inline json toTypedJson(const json& tc)
 {
@@ -205,6 +236,74 @@ inline T executeRedirectJsonError(const TCALL& f)
   }
 }
 
+// === Hybrid JSON: a typed JSON header around a base64 binary body ===
+
+// The "encoding" of the content of a hybrid JSON object
+inline const std::string_view hybridJsonEncoding = "binio+base64";
+
+// A streambuf that base64-encodes what is written to it straight into
+// another stream, so a binary body is never held in memory
+class Base64OutBuf : public std::streambuf
+{
+public:
+  explicit Base64OutBuf(std::ostream& out) : out(out) {}
+  ~Base64OutBuf() override { finish(); }
+
+  // Write out the last (padded) group. Nothing may be written after this.
+  void finish();
+
+protected:
+  int_type overflow(int_type c) override;
+  std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+private:
+  std::ostream& out;
+  unsigned char pending[3];
+  int nPending = 0;
+  bool finished = false;
+
+  void put(unsigned char c);
+};
+
+// Decode base64 text, throwing IOError on malformed input
+std::string base64Decode(const std::string& text);
+
+// Write obj as {typed JSON header, "content": base64 of obj.writeTo(...)},
+// streaming the body
+template <typename T>
+inline void writeHybridJSON(std::ostream& str, const T& obj)
+{
+  json header = toTypedJson<T>(json());
+  header.erase("content");
+  header["encoding"] = hybridJsonEncoding;
+  std::string h = header.dump();
+  h.pop_back(); // the closing brace
+  str << h << ",\"content\":\"";
+  {
+    Base64OutBuf buf(str);
+    std::ostream body(&buf);
+    obj.writeTo(body);
+    buf.finish();
+  }
+  str << "\"}";
+}
+
+// Read the body of an object written by writeHybridJSON<T>, and pass it
+// as a binary stream to readBinary
+template <typename T, typename F>
+inline auto readHybridJSON(std::istream& str, const F& readBinary)
+{
+  std::istringstream body(executeRedirectJsonError<std::string>([&]() {
+    json j;
+    str >> j;
+    std::string encoding = j.at("encoding").get<std::string>();
+    if (encoding != hybridJsonEncoding)
+      throw IOError("Unknown encoding of hybrid JSON content: " + encoding);
+    return base64Decode(fromTypedJson<T>(j).get<std::string>());
+  }));
+  return readBinary(body);
+}
+
 } // namespace helib
 
 #endif // HELIB_IO_H
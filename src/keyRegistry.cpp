@@ -0,0 +1,317 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* keyRegistry.cpp - an LRU cache of the contexts and keys of many tenants
+ */
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include <helib/keyRegistry.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+KeySource KeySource::fromFiles(const std::string& contextPath,
+                               const std::string& keyPath)
+{
+  KeySource source;
+  source.loadContext = [contextPath]() {
+    std::ifstream str(contextPath, std::ios::binary);
+    assertTrue<IOError>(str.is_open(),
+                        "KeySource: could not open " + contextPath);
+    return std::unique_ptr<Context>(Context::readPtrSnapshotFrom(str));
+  };
+  source.loadKey = [keyPath](const Context& context) {
+    return std::make_unique<PubKey>(PubKey::readMapped(keyPath, context));
+  };
+  return source;
+}
+
+KeyRegistry::KeyRegistry(long _budget) : budget(_budget)
+{
+  assertTrue<InvalidArgument>(budget >= 0, "KeyRegistry: negative budget");
+}
+
+KeyRegistry::Slot& KeyRegistry::find(const std::string& id)
+{
+  auto it = slots.find(id);
+  assertTrue<LogicError>(it != slots.end(), "KeyRegistry: no tenant " + id);
+  return it->second;
+}
+
+const KeyRegistry::Slot& KeyRegistry::find(const std::string& id) const
+{
+  auto it = slots.find(id);
+  assertTrue<LogicError>(it != slots.end(), "KeyRegistry: no tenant " + id);
+  return it->second;
+}
+
+void KeyRegistry::add(const std::string& id, KeySource source)
+{
+  assertTrue<InvalidArgument>(bool(source.loadKey),
+                              "KeyRegistry: no way to load the key");
+  std::lock_guard<std::mutex> lock(mutex);
+  assertTrue<LogicError>(slots.count(id) == 0,
+                         "KeyRegistry: tenant " + id + " already added");
+  Slot& slot = slots[id];
+  slot.source = std::move(source);
+  slot.generation = ++generations;
+}
+
+void KeyRegistry::remove(const std::string& id)
+{
+  EntryPtr entry; // released after unlocking
+  std::lock_guard<std::mutex> lock(mutex);
+  Slot& slot = find(id);
+  if (slot.entry)
+    entry = drop(slot);
+  slots.erase(id);
+}
+
+bool KeyRegistry::contains(const std::string& id) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return slots.count(id) != 0;
+}
+
+bool KeyRegistry::isLoaded(const std::string& id) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return bool(find(id).entry);
+}
+
+std::shared_ptr<const KeyEntry> KeyRegistry::get(const std::string& id)
+{
+  return acquire(id, false);
+}
+
+std::shared_ptr<const KeyEntry> KeyRegistry::pin(const std::string& id)
+{
+  return acquire(id, true);
+}
+
+void KeyRegistry::unpin(const std::string& id)
+{
+  std::vector<EntryPtr> dropped;
+  std::lock_guard<std::mutex> lock(mutex);
+  Slot& slot = find(id);
+  assertTrue<LogicError>(slot.pins > 0, "KeyRegistry: " + id + " not pinned");
+  slot.pins--;
+  dropped = trimLocked();
+}
+
+void KeyRegistry::setBudget(long _budget)
+{
+  assertTrue<InvalidArgument>(_budget >= 0, "KeyRegistry: negative budget");
+  std::vector<EntryPtr> dropped;
+  std::lock_guard<std::mutex> lock(mutex);
+  budget = _budget;
+  dropped = trimLocked();
+}
+
+long KeyRegistry::getBudget() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return budget;
+}
+
+long KeyRegistry::residentBytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return resident;
+}
+
+long KeyRegistry::numLoaded() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return lru.size();
+}
+
+KeyRegistryStats KeyRegistry::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return counts;
+}
+
+std::shared_ptr<const KeyEntry> KeyRegistry::acquire(const std::string& id,
+                                                     bool pin)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  Slot& slot = find(id);
+  if (pin)
+    slot.pins++;
+  if (slot.entry) {
+    counts.hits++;
+    lru.splice(lru.begin(), lru, slot.position);
+    return slot.entry;
+  }
+  counts.loads++;
+
+  // The slot may be removed (and its id added again) while unlocked
+  const unsigned long generation = slot.generation;
+  auto sameSlot = [this, &id, generation]() -> Slot* {
+    auto it = slots.find(id);
+    if (it == slots.end() || it->second.generation != generation)
+      return nullptr;
+    return &it->second;
+  };
+
+  if (slot.loading.valid()) {
+    std::shared_future<EntryPtr> pending = slot.loading;
+    lock.unlock();
+    try {
+      return pending.get();
+    } catch (...) {
+      lock.lock();
+      Slot* s = sameSlot();
+      if (s && pin)
+        s->pins--;
+      throw;
+    }
+  }
+
+  std::promise<EntryPtr> promise;
+  slot.loading = promise.get_future().share();
+  const KeySource source = slot.source;
+  lock.unlock();
+
+  EntryPtr entry;
+  try {
+    entry = load(source);
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+    lock.lock();
+    counts.failedLoads++;
+    if (Slot* s = sameSlot()) {
+      s->loading = std::shared_future<EntryPtr>();
+      if (pin)
+        s->pins--;
+    }
+    throw;
+  }
+
+  std::vector<EntryPtr> dropped;
+  lock.lock();
+  if (Slot* s = sameSlot()) {
+    s->loading = std::shared_future<EntryPtr>();
+    insert(*s, id, entry);
+    dropped = trimLocked();
+  }
+  lock.unlock();
+  promise.set_value(entry);
+  return entry;
+}
+
+std::shared_ptr<const Context> KeyRegistry::shareContext(
+    unsigned long fingerprint,
+    std::shared_ptr<const Context> loaded)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<const Context> known;
+  auto it = contexts.find(fingerprint);
+  if (it != contexts.end())
+    known = it->second.lock();
+  if (known) {
+    counts.sharedContexts++;
+    return known;
+  }
+  if (loaded)
+    contexts[fingerprint] = loaded;
+  return loaded;
+}
+
+KeyRegistry::EntryPtr KeyRegistry::load(const KeySource& source)
+{
+  HELIB_TIMER_START;
+  unsigned long fingerprint = source.contextFingerprint;
+  std::shared_ptr<const Context> context;
+  if (fingerprint != 0)
+    context = shareContext(fingerprint, nullptr);
+  if (!context) {
+    assertTrue<LogicError>(bool(source.loadContext),
+                           "KeyRegistry: no way to load the context");
+    std::shared_ptr<const Context> loaded(source.loadContext());
+    unsigned long actual = loaded->fingerprint();
+    if (fingerprint != 0)
+      assertEq<IOError>(actual,
+                        fingerprint,
+                        "KeyRegistry: context fingerprint mismatch");
+    fingerprint = actual;
+    // Another thread may have loaded the same context meanwhile
+    context = shareContext(fingerprint, std::move(loaded));
+  }
+
+  std::shared_ptr<const PubKey> key(source.loadKey(*context));
+  assertTrue<LogicError>(&key->getContext() == context.get(),
+                         "KeyRegistry: key loaded over another context");
+  if (source.keyFingerprint != 0)
+    assertEq<IOError>(key->fingerprint(),
+                      source.keyFingerprint,
+                      "KeyRegistry: key fingerprint mismatch");
+
+  auto entry = std::make_shared<KeyEntry>();
+  entry->context = std::move(context);
+  entry->publicKey = std::move(key);
+  entry->contextFingerprint = fingerprint;
+  return entry;
+}
+
+void KeyRegistry::insert(Slot& slot, const std::string& id, EntryPtr entry)
+{
+  ResidentContext& context = residentContexts[entry->context.get()];
+  if (context.entries++ == 0) {
+    context.bytes = entry->context->memoryReport().total().bytes;
+    resident += context.bytes;
+  }
+  slot.entry = std::move(entry);
+  lru.push_front(id);
+  slot.position = lru.begin();
+}
+
+KeyRegistry::EntryPtr KeyRegistry::drop(Slot& slot)
+{
+  auto it = residentContexts.find(slot.entry->context.get());
+  if (--it->second.entries == 0) {
+    resident -= it->second.bytes;
+    residentContexts.erase(it);
+  }
+  lru.erase(slot.position);
+  return std::move(slot.entry);
+}
+
+std::vector<KeyRegistry::EntryPtr> KeyRegistry::trimLocked()
+{
+  std::vector<EntryPtr> dropped;
+  while (resident > budget) {
+    auto victim = lru.end();
+    for (auto it = lru.end(); it != lru.begin();) {
+      --it;
+      if (slots.at(*it).pins == 0) {
+        victim = it;
+        break;
+      }
+    }
+    if (victim == lru.end())
+      break; // what is left is pinned
+    dropped.push_back(drop(slots.at(*victim)));
+    counts.evictions++;
+  }
+
+  for (auto it = contexts.begin(); it != contexts.end();)
+    it = it->second.expired() ? contexts.erase(it) : std::next(it);
+  return dropped;
+}
+
+} // namespace helib
@@ -20,12 +20,16 @@
 #include <helib/permutations.h>
 
 #include "binio.h"
+#include "LazyKeyStore.h"
+#include "MappedKeys.h"
 #include "io.h"
 
 #include <helib/keySwitching.h>
+#include <helib/costEstimate.h>
 #include <helib/keys.h>
 #include <helib/apiAttributes.h>
 #include <helib/log.h>
+#include <helib/timing.h>
 
 namespace helib {
 
@@ -58,25 +62,119 @@ bool KeySwitch::operator==(const KeySwitch& other) const
   if (prgSeed != other.prgSeed)
     return false;
 
-  if (b.size() != other.b.size())
+  if (NumCols() != other.NumCols())
     return false;
-  for (size_t i = 0; i < b.size(); i++)
-    if (b[i] != other.b[i])
-      return false;
-
-  return true;
+  if (isMapped() || other.isMapped())
+    return copyOfB() == other.copyOfB();
+  return *residentB() == *other.residentB();
 }
 bool KeySwitch::operator!=(const KeySwitch& other) const
 {
   return !(*this == other);
 }
 
-unsigned long KeySwitch::NumCols() const { return b.size(); }
+unsigned long KeySwitch::NumCols() const
+{
+  if (isMapped())
+    return mappedB->cols.size();
+  return isLazy() ? lazyCols : b.size();
+}
+
+const std::vector<IndexMap<const long*>>& KeySwitch::getMappedB() const
+{
+  assertTrue(isMapped(), "KeySwitch::getMappedB: not a mapped matrix");
+  return mappedB->cols;
+}
+
+std::vector<DoubleCRT> KeySwitch::copyOfB() const
+{
+  return isMapped() ? mappedB->toDoubleCRTs() : *residentB();
+}
+
+bool KeySwitch::moveToHugePages()
+{
+  if (isMapped() || isLazy() || isDummy() || b.empty())
+    return false;
+  mappedB = MappedRows::inOneBuffer(b[0].getContext(), b);
+  b.clear();
+  return true;
+}
+
+HugePageKind KeySwitch::getPageKind() const
+{
+  return isMapped() ? mappedB->pages : HugePageKind::NONE;
+}
+
+bool KeySwitch::isResident() const
+{
+  return !isLazy() || lazyB->isResident(lazyIndex);
+}
+
+std::shared_ptr<const std::vector<DoubleCRT>> KeySwitch::residentB() const
+{
+  assertFalse(isMapped(), "KeySwitch::residentB: mapped matrix");
+  if (isLazy())
+    return lazyB->load(lazyIndex);
+  // No owner: the result points at b, and must not outlive this matrix
+  return std::shared_ptr<const std::vector<DoubleCRT>>(
+      std::shared_ptr<const std::vector<DoubleCRT>>(), &b);
+}
 
 bool KeySwitch::isDummy() const { return (toKeyID == -1); }
 
+void KeySwitch::newPRGSeed(PRG& prg)
+{
+  // a random 256-bit seed
+  unsigned char bytes[INDEXED_SEED_BIT / 8];
+  prg.get(bytes, sizeof(bytes));
+  NTL::ZZFromBytes(prgSeed, bytes, sizeof(bytes));
+  NTL::SetBit(prgSeed, INDEXED_SEED_BIT);
+}
+
+void KeySwitch::generateA(std::vector<DoubleCRT>& a) const
+{
+  HELIB_TIMER_START;
+
+  if (hasIndexedSeed()) {
+    for (long i : range(a.size()))
+      a[i].randomize(prgSeed, i); // parallel over the primes
+    return;
+  }
+
+  // Subsequent ai's use the evolving RNG state
+  for (const DoubleCRT& ai : a)
+    assertEq(ai.getIndexSet(),
+             ai.getContext().fullPrimes(),
+             "KeySwitch::generateA: legacy seeds need all the primes");
+  PRG prg(prgSeed); // the stream of NTL::SetSeed(prgSeed)
+  for (DoubleCRT& ai : a)
+    ai.randomize(prg);
+}
+
+void KeySwitch::materializeA(const Context& context)
+{
+  MemoryScope memoryScope(MemoryCategory::KEYS);
+  if (isDummy())
+    return;
+
+  auto a = std::make_shared<std::vector<DoubleCRT>>(
+      NumCols(),
+      DoubleCRT(context, context.fullPrimes()));
+  generateA(*a);
+  expandedA = a;
+}
+
 void KeySwitch::verify(SecKey& sk)
 {
+  if (isMapped() || isLazy()) {
+    KeySwitch copy(*this);
+    copy.b = copyOfB();
+    copy.mappedB.reset();
+    copy.lazyB.reset();
+    copy.verify(sk);
+    return;
+  }
+
   long fromSPower = fromKey.getPowerOfS();
   long fromXPower = fromKey.getPowerOfX();
   long fromIdx = fromKey.getSecretKeyID();
@@ -128,15 +226,7 @@ void KeySwitch::verify(SecKey& sk)
 
   std::vector<DoubleCRT> a;
   a.resize(n, DoubleCRT(context, fullPrimes)); // defined modulo all primes
-
-  {
-    RandomState state;
-
-    SetSeed(prgSeed);
-    for (long i = 0; i < n; i++)
-      a[i].randomize();
-
-  } // the RandomState destructor "restores the state" (see NumbTh.h)
+  generateA(a);
 
   std::vector<NTL::ZZX> A, B;
 
@@ -193,9 +283,22 @@ void KeySwitch::readMatrix(std::istream& str, const Context& context)
   this->readJSON(str, context);
 }
 
+// Matrices with an indexed seed derive their a_i's differently, so they
+// are written between eye catchers of their own, which older readers
+// reject rather than regenerate the wrong a_i's
+static const std::array<char, EyeCatcher::SIZE>& beginCatcher(bool indexed)
+{
+  return indexed ? EyeCatcher::SKI_BEGIN : EyeCatcher::SKM_BEGIN;
+}
+
+static const std::array<char, EyeCatcher::SIZE>& endCatcher(bool indexed)
+{
+  return indexed ? EyeCatcher::SKI_END : EyeCatcher::SKM_END;
+}
+
 void KeySwitch::writeTo(std::ostream& str) const
 {
-  writeEyeCatcher(str, EyeCatcher::SKM_BEGIN);
+  writeEyeCatcher(str, beginCatcher(hasIndexedSeed()));
   /*
       Write out raw
       1. SKHandle fromKey;
@@ -210,18 +313,23 @@ void KeySwitch::writeTo(std::ostream& str) const
   write_raw_int(str, toKeyID);
   write_raw_int(str, ptxtSpace);
 
-  write_raw_vector(str, b);
+  if (isMapped())
+    write_raw_vector(str, copyOfB());
+  else
+    write_raw_vector(str, *residentB());
 
   write_raw_ZZ(str, prgSeed);
   write_raw_xdouble(str, noiseBound);
 
-  writeEyeCatcher(str, EyeCatcher::SKM_END);
+  writeEyeCatcher(str, endCatcher(hasIndexedSeed()));
 }
 
 KeySwitch KeySwitch::readFrom(std::istream& str, const Context& context)
 {
-  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::SKM_BEGIN);
-  assertTrue(eyeCatcherFound, "Could not find pre-secret key eyecatcher");
+  MemoryScope memoryScope(MemoryCategory::KEYS);
+  int indexed =
+      readEyeCatcher(str, EyeCatcher::SKM_BEGIN, EyeCatcher::SKI_BEGIN);
+  assertTrue(indexed >= 0, "Could not find pre-secret key eyecatcher");
 
   KeySwitch ret;
 
@@ -230,16 +338,82 @@ KeySwitch KeySwitch::readFrom(std::istream& str, const Context& context)
   ret.ptxtSpace = read_raw_int(str);
   ret.b = read_raw_vector<DoubleCRT>(str, context);
   read_raw_ZZ(str, ret.prgSeed);
+  assertTrue<IOError>(ret.hasIndexedSeed() == bool(indexed),
+                      "KeySwitch::readFrom: seed does not match the format");
   ret.noiseBound = read_raw_xdouble(str);
 
-  eyeCatcherFound = readEyeCatcher(str, EyeCatcher::SKM_END);
+  bool eyeCatcherFound = readEyeCatcher(str, endCatcher(indexed));
   assertTrue(eyeCatcherFound, "Could not find post-secret key eyecatcher");
 
   return ret;
 }
 
+void KeySwitch::writePackedTo(std::ostream& str) const
+{
+  writeEyeCatcher(str, beginCatcher(hasIndexedSeed()));
+  // As writeTo, with the rows of the b_i's packed
+  fromKey.writeTo(str);
+  write_raw_int(str, toKeyID);
+  write_raw_int(str, ptxtSpace);
+
+  auto writeRows = [&str](const std::vector<DoubleCRT>& rows) {
+    write_raw_int(str, lsize(rows));
+    for (const DoubleCRT& bi : rows)
+      bi.writePackedTo(str);
+  };
+  if (isMapped())
+    writeRows(copyOfB());
+  else
+    writeRows(*residentB());
+
+  write_raw_ZZ(str, prgSeed);
+  write_raw_xdouble(str, noiseBound);
+
+  writeEyeCatcher(str, endCatcher(hasIndexedSeed()));
+}
+
+KeySwitch KeySwitch::readPackedFrom(std::istream& str, const Context& context)
+{
+  MemoryScope memoryScope(MemoryCategory::KEYS);
+  int indexed =
+      readEyeCatcher(str, EyeCatcher::SKM_BEGIN, EyeCatcher::SKI_BEGIN);
+  assertTrue<IOError>(indexed >= 0, "Could not find pre-secret key eyecatcher");
+
+  KeySwitch ret;
+
+  ret.fromKey = SKHandle::readFrom(str);
+  ret.toKeyID = read_raw_int(str);
+  ret.ptxtSpace = read_raw_int(str);
+  long n = read_raw_int(str);
+  assertInRange<IOError>(n,
+                         0L,
+                         lsize(context.getDigits()),
+                         "KeySwitch::readPackedFrom: bad number of digits",
+                         /*right_inclusive=*/true);
+  ret.b.assign(n, DoubleCRT(context, IndexSet::emptySet()));
+  for (DoubleCRT& bi : ret.b)
+    bi.readPacked(str); // straight into the rows of bi
+  read_raw_ZZ(str, ret.prgSeed);
+  assertTrue<IOError>(ret.hasIndexedSeed() == bool(indexed),
+                      "KeySwitch::readPackedFrom: seed does not match the "
+                      "format");
+  ret.noiseBound = read_raw_xdouble(str);
+
+  bool eyeCatcherFound = readEyeCatcher(str, endCatcher(indexed));
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-secret key eyecatcher");
+
+  return ret;
+}
+
 void KeySwitch::writeToJSON(std::ostream& str) const { str << writeToJSON(); }
 
+// As for the eye catchers, indexed seeds go under a key of their own
+static const char* seedKey(bool indexed)
+{
+  return indexed ? "indexedPrgSeed" : "prgSeed";
+}
+
 JsonWrapper KeySwitch::writeToJSON() const
 {
   /*
@@ -251,11 +425,13 @@ JsonWrapper KeySwitch::writeToJSON() const
    * 5. ZZ prgSeed;
    * 6. xdouble noiseBound;
    */
+  json bj = isMapped() ? writeVectorToJSON(copyOfB())
+                       : writeVectorToJSON(*residentB());
   json j = {{"fromKey", unwrap(this->fromKey.writeToJSON())},
             {"toKeyID", this->toKeyID},
             {"ptxtSpace", this->ptxtSpace},
-            {"b", writeVectorToJSON(b)},
-            {"prgSeed", prgSeed},
+            {"b", bj},
+            {seedKey(hasIndexedSeed()), prgSeed},
             {"noiseBound", noiseBound}};
 
   return wrap(toTypedJson<KeySwitch>(j));
@@ -284,14 +460,34 @@ void KeySwitch::readJSON(std::istream& str, const Context& context)
 
 void KeySwitch::readJSON(const JsonWrapper& jw, const Context& context)
 {
+  MemoryScope memoryScope(MemoryCategory::KEYS);
   json j = fromTypedJson<KeySwitch>(unwrap(jw));
 
   this->fromKey = SKHandle::readFromJSON(wrap(j.at("fromKey")));
   this->toKeyID = j.at("toKeyID");
   this->ptxtSpace = j.at("ptxtSpace");
   this->b = readVectorFromJSON<DoubleCRT>(j.at("b"), context);
-  this->prgSeed = j.at("prgSeed").get<NTL::ZZ>();
+  bool indexed = (j.find(seedKey(true)) != j.end());
+  this->prgSeed = j.at(seedKey(indexed)).get<NTL::ZZ>();
+  assertTrue<IOError>(hasIndexedSeed() == indexed,
+                      "KeySwitch::readJSON: seed does not match the format");
   this->noiseBound = j.at("noiseBound").get<NTL::xdouble>();
+  this->expandedA.reset(); // they belong to the previous seed
+  this->mappedB.reset();
+  this->lazyB.reset();
+}
+
+void KeySwitch::writeToHybridJSON(std::ostream& str) const
+{
+  writeHybridJSON(str, *this);
+}
+
+KeySwitch KeySwitch::readFromHybridJSON(std::istream& str,
+                                        const Context& context)
+{
+  return readHybridJSON<KeySwitch>(str, [&](std::istream& body) {
+    return KeySwitch::readFrom(body, context);
+  });
 }
 
 long KSGiantStepSize(long D)
@@ -310,11 +506,13 @@ void addAllMatrices(SecKey& sKey, long keyID)
   long m = context.getM();
 
   // key-switching matrices for the automorphisms
+  std::vector<long> vals;
   for (long i = 0; i < m; i++) {
     if (!context.getZMStar().inZmStar(i))
       continue;
-    sKey.GenKeySWmatrix(1, i, keyID, keyID);
+    vals.push_back(i);
   }
+  sKey.GenKeySWmatrices(vals, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 
@@ -375,10 +573,11 @@ static void add1Dmats4dim(SecKey& sKey, long i, long keyID)
 */
 }
 #else
-// adds all matrices for dim i.
+// lists all matrices for dim i, to be generated with
+// SecKey::GenKeySWmatrices.
 // i == -1 => Frobenius (NOTE: in matmul1D, i ==#gens means something else,
 //   so it is best to avoid that).
-static void add1Dmats4dim(SecKey& sKey, long i, long keyID)
+static void add1Dmats4dim(SecKey& sKey, long i, std::vector<long>& vals)
 {
   const PAlgebra& zMStar = sKey.getContext().getZMStar();
   long ord;
@@ -394,10 +593,10 @@ static void add1Dmats4dim(SecKey& sKey, long i, long keyID)
   }
 
   for (long j = 1; j < ord; j++)
-    sKey.GenKeySWmatrix(1, zMStar.genToPow(i, j), keyID, keyID);
+    vals.push_back(zMStar.genToPow(i, j));
 
   if (!native)
-    sKey.GenKeySWmatrix(1, zMStar.genToPow(i, -ord), keyID, keyID);
+    vals.push_back(zMStar.genToPow(i, -ord));
 
   sKey.setKSStrategy(i, HELIB_KSS_FULL);
 }
@@ -528,7 +727,7 @@ MAUTO
 static void addSome1Dmats4dim(SecKey& sKey,
                               long i,
                               UNUSED long bound,
-                              long keyID)
+                              std::vector<long>& vals)
 {
   const PAlgebra& zMStar = sKey.getContext().getZMStar();
   long ord;
@@ -547,14 +746,14 @@ static void addSome1Dmats4dim(SecKey& sKey,
 
   // baby steps
   for (long j = 1; j < g; j++)
-    sKey.GenKeySWmatrix(1, zMStar.genToPow(i, j), keyID, keyID);
+    vals.push_back(zMStar.genToPow(i, j));
 
   // giant steps
   for (long j = g; j < ord; j += g)
-    sKey.GenKeySWmatrix(1, zMStar.genToPow(i, j), keyID, keyID);
+    vals.push_back(zMStar.genToPow(i, j));
 
   if (!native)
-    sKey.GenKeySWmatrix(1, zMStar.genToPow(i, -ord), keyID, keyID);
+    vals.push_back(zMStar.genToPow(i, -ord));
 
   sKey.setKSStrategy(i, HELIB_KSS_BSGS);
 
@@ -575,13 +774,15 @@ void addSome1DMatrices(SecKey& sKey, long bound, long keyID)
   const Context& context = sKey.getContext();
 
   // key-switching matrices for the automorphisms
+  std::vector<long> vals;
   for (long i : range(context.getZMStar().numOfGens())) {
     // For generators of small order, add all the powers
     if (bound >= context.getZMStar().OrderOf(i))
-      add1Dmats4dim(sKey, i, keyID);
+      add1Dmats4dim(sKey, i, vals);
     else // For generators of large order, add only some of the powers
-      addSome1Dmats4dim(sKey, i, bound, keyID);
+      addSome1Dmats4dim(sKey, i, bound, vals);
   }
+  sKey.GenKeySWmatrices(vals, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 
@@ -599,11 +800,13 @@ void addBSGS1DMatrices(SecKey& sKey, long keyID)
 void addSomeFrbMatrices(SecKey& sKey, long bound, long keyID)
 {
   const Context& context = sKey.getContext();
+  std::vector<long> vals;
   if (bound >= LONG(context.getOrdP()))
-    add1Dmats4dim(sKey, -1, keyID);
+    add1Dmats4dim(sKey, -1, vals);
   else // For generators of large order, add only some of the powers
-    addSome1Dmats4dim(sKey, -1, bound, keyID);
+    addSome1Dmats4dim(sKey, -1, bound, vals);
 
+  sKey.GenKeySWmatrices(vals, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 
@@ -669,6 +872,7 @@ void addMatrices4Network(SecKey& sKey, const PermNetwork& net, long keyID)
   const Context& context = sKey.getContext();
   long m = context.getM();
 
+  std::vector<long> vals;
   for (long i = 0; i < net.depth(); i++) {
     long e = net.getLayer(i).getE();
     long gIdx = net.getLayer(i).getGenIdx();
@@ -678,20 +882,58 @@ void addMatrices4Network(SecKey& sKey, const PermNetwork& net, long keyID)
     for (long j = 0; j < shamts.length(); j++) {
       if (shamts[j] == 0)
         continue;
-      long val = NTL::PowerMod(g2e, shamts[j], m);
-      sKey.GenKeySWmatrix(1, val, keyID, keyID);
+      vals.push_back(NTL::PowerMod(g2e, shamts[j], m));
     }
   }
+  sKey.GenKeySWmatrices(vals, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 
 void addTheseMatrices(SecKey& sKey, const std::set<long>& automVals, long keyID)
 {
-  std::set<long>::iterator it;
-  for (it = automVals.begin(); it != automVals.end(); ++it) {
-    long k = *it;
-    sKey.GenKeySWmatrix(1, k, keyID, keyID);
+  std::vector<long> vals(automVals.begin(), automVals.end());
+  sKey.GenKeySWmatrices(vals, keyID, keyID);
+  sKey.setKeySwitchMap(); // re-compute the key-switching map
+}
+
+void addRecordedMatrices(SecKey& sKey, const KeySwitchRecorder& recorder)
+{
+  const PubKey& recordedKey = recorder.getPubKey();
+  assertTrue<InvalidArgument>(&sKey.getContext() == &recordedKey.getContext(),
+                              "addRecordedMatrices: context mismatch");
+
+  for (long dim : range(-1, sKey.getContext().getZMStar().numOfGens()))
+    sKey.setKSStrategy(dim, recordedKey.getKSStrategy(dim));
+  addTheseMatrices(sKey, recorder.automorphisms(), recorder.getKeyID());
+}
+
+void addPlannedMatrices(SecKey& sKey, const KeySwitchPlan& plan, long keyID)
+{
+  const PAlgebra& zMStar = sKey.getContext().getZMStar();
+  assertEq<InvalidArgument>(long(plan.dims.size()),
+                            zMStar.numOfGens(),
+                            "addPlannedMatrices: plan of another context");
+
+  std::vector<long> vals;
+  for (const DimensionPlan& dim : plan.dims) {
+    assertEq<InvalidArgument>(dim.order,
+                              zMStar.OrderOf(dim.dim),
+                              "addPlannedMatrices: plan of another context");
+    switch (dim.strategy) {
+    case HELIB_KSS_FULL:
+      add1Dmats4dim(sKey, dim.dim, vals);
+      break;
+    case HELIB_KSS_BSGS:
+      addSome1Dmats4dim(sKey, dim.dim, 0, vals);
+      break;
+    case HELIB_KSS_MIN:
+      addMinimal1Dmats4dim(sKey, dim.dim, keyID);
+      break;
+    default:
+      throw InvalidArgument("addPlannedMatrices: unknown strategy");
+    }
   }
+  sKey.GenKeySWmatrices(vals, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 
@@ -9,13 +9,18 @@
  * See the License for the specific language governing permissions and
  * limitations under the License. See accompanying LICENSE file.
  */
+#include <algorithm>
+#include <functional>
 #include <queue>
+#include <unordered_set>
 
 #include <helib/keys.h>
 #include <helib/timing.h>
 #include <helib/EncryptedArray.h>
 #include <helib/Ptxt.h>
 #include "binio.h"
+#include "LazyKeyStore.h"
+#include "MappedKeys.h"
 #include <helib/sample.h>
 #include <helib/norms.h>
 #include <helib/apiAttributes.h>
@@ -30,7 +35,11 @@ namespace helib {
 /******** Utility function to generate RLWE instances *********/
 
 // Assumes that c1 is already chosen by the caller
-double RLWE1(DoubleCRT& c0, const DoubleCRT& c1, const DoubleCRT& s, long p)
+double RLWE1(DoubleCRT& c0,
+             const DoubleCRT& c1,
+             const DoubleCRT& s,
+             long p,
+             PRG& prg)
 // Returns a high-probability bound on the L-infty norm
 // of the canonical embedding of the decryption of (c0, c1) w/r/to s
 {
@@ -46,7 +55,7 @@ double RLWE1(DoubleCRT& c0, const DoubleCRT& c1, const DoubleCRT& s, long p)
   double stdev = to_double(context.getStdev());
   if (palg.getPow2() == 0) // not power of two
     stdev *= sqrt(palg.getM());
-  double bound = c0.sampleGaussianBounded(stdev);
+  double bound = c0.sampleGaussianBounded(stdev, prg);
 
   // Set c0 =  p*e - c1*s.
   // It is assumed that c0,c1 are defined with respect to the same set of
@@ -108,8 +117,14 @@ void PubKey::clear()
   skBounds.clear();
   keySwitching.clear();
   keySwitchMap.clear();
+  {
+    std::lock_guard<std::mutex> lock(automorphChainMutex);
+    automorphChains.clear();
+  }
+  numaReplicas.clear();
   recryptKeyID = -1;
   recryptEkey.clear();
+  clearZeroEncryptions();
 }
 
 void PubKey::setKeySwitchMap(long keyId)
@@ -138,6 +153,10 @@ void PubKey::setKeySwitchMap(long keyId)
 
   // initialize keySwitchMap[keyId] with m empty entries (with -1 in them)
   keySwitchMap.at(keyId).assign(m, -1);
+  {
+    std::lock_guard<std::mutex> lock(automorphChainMutex);
+    automorphChains.clear();
+  }
 
   // A standard BFS implementation using a FIFO queue (complexity O(V+E))
 
@@ -164,7 +183,43 @@ void PubKey::setKeySwitchMap(long keyId)
   }
 }
 
+const std::vector<long>& PubKey::getAutomorphChain(long k, long keyID) const
+{
+  long m = context.getM();
+  k = mcMod(k, m);
+  if (k == 1) {
+    static const std::vector<long> noChain;
+    return noChain;
+  }
+  if (!isReachable(k, keyID))
+    throw LogicError("no key-switching matrices for k=" + std::to_string(k) +
+                     ", keyID=" + std::to_string(keyID));
+
+  long key = keyID * m + k;
+  std::lock_guard<std::mutex> lock(automorphChainMutex);
+  auto found = automorphChains.find(key);
+  if (found != automorphChains.end())
+    return found->second;
+
+  // Follow the BFS tree of setKeySwitchMap from k back to 1
+  std::vector<long> chain;
+  while (k != 1) {
+    long amt = keySwitching.at(keySwitchMap[keyID][k]).fromKey.getPowerOfX();
+    chain.push_back(amt);
+    k = NTL::MulMod(k, NTL::InvMod(amt, m), m);
+  }
+  // References to the elements of an unordered_map stay valid when more
+  // are inserted
+  return automorphChains.emplace(key, std::move(chain)).first->second;
+}
+
 const KeySwitch& PubKey::getKeySWmatrix(const SKHandle& from, long toIdx) const
+{
+  return recorded(findKeySWmatrix(from, toIdx));
+}
+
+const KeySwitch& PubKey::findKeySWmatrix(const SKHandle& from,
+                                         long toIdx) const
 {
   // First try to use the keySwitchMap
   if (from.getPowerOfS() == 1 && from.getSecretKeyID() == toIdx &&
@@ -186,6 +241,11 @@ const KeySwitch& PubKey::getKeySWmatrix(const SKHandle& from, long toIdx) const
 }
 
 const KeySwitch& PubKey::getAnyKeySWmatrix(const SKHandle& from) const
+{
+  return recorded(findAnyKeySWmatrix(from));
+}
+
+const KeySwitch& PubKey::findAnyKeySWmatrix(const SKHandle& from) const
 {
   // First try to use the keySwitchMap
   if (from.getPowerOfS() == 1 &&
@@ -274,6 +334,46 @@ double PubKey::getSKeyBound(long keyID) const { return skBounds.at(keyID); }
 
 const std::vector<KeySwitch>& PubKey::keySWlist() const { return keySwitching; }
 
+void PubKey::materializeKeySwitchA()
+{
+  HELIB_TIMER_START;
+  MemoryScope memoryScope(MemoryCategory::KEYS);
+  for (KeySwitch& matrix : keySwitching)
+    matrix.materializeA(context);
+}
+
+void PubKey::releaseKeySwitchA()
+{
+  for (KeySwitch& matrix : keySwitching)
+    matrix.releaseA();
+}
+
+long PubKey::moveKeySwitchToHugePages()
+{
+  HELIB_TIMER_START;
+  long rowBytes = context.getPhiM() * sizeof(long);
+  long bytes = 0;
+  for (KeySwitch& matrix : keySwitching) {
+    long rows = 0;
+    for (const DoubleCRT& bi : matrix.b)
+      rows += card(bi.getIndexSet());
+    if (matrix.moveToHugePages() &&
+        matrix.getPageKind() != HugePageKind::NONE)
+      bytes += rows * rowBytes;
+  }
+  return bytes;
+}
+
+void PubKey::replicateOnNumaNodes()
+{
+  numaReplicas.clear();
+  if (NumaNodes() == 1)
+    return;
+  numaReplicas.reserve(keySwitching.size());
+  for (const KeySwitch& matrix : keySwitching)
+    numaReplicas.emplace_back(matrix);
+}
+
 const KeySwitch& PubKey::getKeySWmatrix(long fromSPower,
                                         long fromXPower,
                                         long fromID,
@@ -284,7 +384,7 @@ const KeySwitch& PubKey::getKeySWmatrix(long fromSPower,
 
 bool PubKey::haveKeySWmatrix(const SKHandle& from, long toID) const
 {
-  return getKeySWmatrix(from, toID).toKeyID >= 0;
+  return findKeySWmatrix(from, toID).toKeyID >= 0;
 }
 
 bool PubKey::haveKeySWmatrix(long fromSPower,
@@ -297,13 +397,55 @@ bool PubKey::haveKeySWmatrix(long fromSPower,
 
 bool PubKey::haveAnyKeySWmatrix(const SKHandle& from) const
 {
-  return getAnyKeySWmatrix(from).toKeyID >= 0;
+  return findAnyKeySWmatrix(from).toKeyID >= 0;
 }
 
 const KeySwitch& PubKey::getNextKSWmatrix(long fromXPower, long fromID) const
 {
   long matIdx = keySwitchMap.at(fromID).at(fromXPower);
-  return (matIdx >= 0 ? keySwitching.at(matIdx) : KeySwitch::dummy());
+  return recorded(matIdx >= 0 ? keySwitching.at(matIdx) : KeySwitch::dummy());
+}
+
+const KeySwitch& PubKey::recorded(const KeySwitch& matrix) const
+{
+  if (recorder != nullptr)
+    recorder->record(matrix);
+  // Hand out the copy of our node, for the matrices that have them
+  if (!numaReplicas.empty()) {
+    const KeySwitch* first = keySwitching.data();
+    std::less_equal<const KeySwitch*> lessEq;
+    if (lessEq(first, &matrix) &&
+        lessEq(&matrix, first + numaReplicas.size() - 1))
+      return numaReplicas[&matrix - first].local();
+  }
+  return matrix;
+}
+
+KeySwitchRecorder::KeySwitchRecorder(const PubKey& pubKey, long keyID) :
+    pubKey(pubKey), keyID(keyID)
+{
+  assertTrue(pubKey.recorder == nullptr,
+             "KeySwitchRecorder: the key is already being recorded");
+  pubKey.recorder = this;
+}
+
+KeySwitchRecorder::~KeySwitchRecorder() { pubKey.recorder = nullptr; }
+
+std::set<long> KeySwitchRecorder::automorphisms() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return vals;
+}
+
+void KeySwitchRecorder::record(const KeySwitch& matrix)
+{
+  const SKHandle& from = matrix.fromKey;
+  if (matrix.isDummy() || matrix.toKeyID != keyID ||
+      from.getSecretKeyID() != keyID || from.getPowerOfS() != 1)
+    return; // not an automorphism matrix of this key
+
+  std::lock_guard<std::mutex> lock(mutex);
+  vals.insert(from.getPowerOfX());
 }
 
 bool PubKey::isReachable(long k, long keyID) const
@@ -623,82 +765,63 @@ void PubKey::Encrypt(Ctxt& ciphertxt, const Ptxt<CKKS>& plaintxt) const
   Encrypt(ciphertxt, eptxt);
 }
 
-void PubKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_BGV& eptxt) const
+void PubKey::encryptZero(Ctxt& ctxt,
+                         long ptxtSpace,
+                         const IndexSet& primes,
+                         PRG& prg) const
 {
   HELIB_TIMER_START;
-
-  assertTrue(!isCKKS(), "Encrypt: mismatched BGV ptxt / CKKS ctxt");
-  assertEq(this, &ctxt.pubKey, "Encrypt: public key mismatch");
-  assertEq(&context, &eptxt.getContext(), "Encrypt: context mismatch");
-
-  long ptxtSpace = eptxt.getPtxtSpace();
-  NTL::ZZX ptxt;
-
-  convert(ptxt, eptxt.getPoly());
-
-  // The rest of the code is copy/pasted from the
-  // original Encrypt code, except that for now, highNoise
-  // is not implemented.  We can put it back if necessary.
-  // We may eventually want to completely deprecate the original
-  // Encrypt code, which is why it is copy/pasted for now.
-  // We could also just invoke
-  //    Encrypt(ctxt, ptxt, ptxtSpace, /*highNoise=*/false);
-  // at this point for the same effect.
-
-  // VJS-FIXME: I really should get rid of the unnecessary
-  // connversions from zzX to ZZX...I've added a zzX version
-  // of balanced_mulMod...but I also need zzX versions
-  // of DoubleCRT += and friends.
-
-  if (ptxtSpace != pubEncrKey.ptxtSpace) { // plaintext-space mismatch
-    ptxtSpace = NTL::GCD(ptxtSpace, pubEncrKey.ptxtSpace);
-    if (ptxtSpace <= 1)
-      throw RuntimeError("Plaintext-space mismatch on encryption");
-  }
+  assertTrue(primes <= pubEncrKey.primeSet,
+             "encryptZero: the primes are not under the public key");
 
   // generate a random encryption of zero from the public encryption key
   ctxt = pubEncrKey; // already an encryption of zero, just not a random one
                      // ctxt with two parts, each with all the ctxtPrimes
   ctxt.noiseBound = 0;
 
+  // The public key modulo fewer primes is a public key for their product,
+  // with the same noise, and r, e0 and e1 are only taken over those primes
+  if (primes != pubEncrKey.primeSet) {
+    IndexSet dropped = pubEncrKey.primeSet / primes;
+    for (CtxtPart& part : ctxt.parts)
+      part.removePrimes(dropped);
+    ctxt.primeSet = primes;
+  }
+
   // choose a random small scalar r and a small random error vector (e0,e1),
-  // then set ctxt = r*pk + p*(e0,e1) + (ptxt,0),
-  // where pk = pubEncrKey, and p = ptxtSpace.
+  // then set ctxt = r*pk + p*(e0,e1), where pk = pubEncrKey, and
+  // p = ptxtSpace.
 
   // The resulting ciphertext decrypts to
-  //   r*<sk,pk> + p*(e0 + sk1*e1) + ptxt,
+  //   r*<sk,pk> + p*(e0 + sk1*e1),
   // where sk = (1, sk1) is the secret key.
   // This leads to a noise bound of:
   //   r_bound*pubEncrKey.noiseBound
   //     + p*e0_bound + p*e1_bound*getSKeyBound()
-  //     + ptxt_bound
   //  Here, r_bound, e0_bound, and e1_bound are values
   //  returned by the corresponding sampling routines.
-  //  ptxt_bound is somewhat heuristically set assuming
-  //  that the coefficients of the ciphertext are uniformly
-  //  and independently chosen from the interval [-p/2, p/2].
 
-  DoubleCRT e(context, context.getCtxtPrimes());
-  DoubleCRT r(context, context.getCtxtPrimes());
-  double r_bound = r.sampleSmallBounded();
+  DoubleCRT e(context, primes);
+  DoubleCRT r(context, primes);
+  double r_bound = r.sampleSmallBounded(prg); // r is a {0,+-1} polynomial
 
   ctxt.noiseBound += r_bound * pubEncrKey.noiseBound;
 
-  // std::cerr << "*** r_bound*pubEncrKey.noiseBound " << r_bound *
-  // pubEncrKey.noiseBound << "\n";
-
   double stdev = to_double(context.getStdev());
+  // VJS-NOTE: this should never happen for CKKS
   if (context.getZMStar().getPow2() == 0) // not power of two
     stdev *= sqrt(context.getM());
 
   for (size_t i = 0; i < ctxt.parts.size(); i++) { // add noise to all the parts
     ctxt.parts[i] *= r;
-    NTL::xdouble e_bound;
 
-    e_bound = e.sampleGaussianBounded(stdev);
+    NTL::xdouble e_bound = e.sampleGaussianBounded(stdev, prg);
+    // zero-mean Gaussian, sigma=stdev
 
-    e *= ptxtSpace;
-    e_bound *= ptxtSpace;
+    if (ptxtSpace > 1) {
+      e *= ptxtSpace;
+      e_bound *= ptxtSpace;
+    }
 
     if (i == 1) {
       e_bound *= getSKeyBound(ctxt.parts[i].skHandle.getSecretKeyID());
@@ -706,9 +829,192 @@ void PubKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_BGV& eptxt) const
 
     ctxt.parts[i] += e;
     ctxt.noiseBound += e_bound;
+  }
+}
 
-    // std::cerr << "*** e_bound " << e_bound << "\n";
+NTL::xdouble PubKey::zeroEncryptionNoiseBound(long ptxtSpace) const
+{
+  // The bounds of sampleSmallBounded and sampleGaussianBounded, which do not
+  // depend on the primes
+  long phim = context.getPhiM();
+  double r_bound = std::sqrt(phim * std::log(phim) / 2.0);
+
+  double stdev = to_double(context.getStdev());
+  if (context.getZMStar().getPow2() == 0) // not power of two
+    stdev *= sqrt(context.getM());
+  NTL::xdouble e_bound =
+      NTL::to_xdouble(stdev * sampleGaussianBoundedEffectiveBound(context));
+  if (ptxtSpace > 1)
+    e_bound *= ptxtSpace;
+
+  long keyID = pubEncrKey.getKeyID();
+  return r_bound * pubEncrKey.noiseBound + e_bound +
+         e_bound * getSKeyBound(keyID);
+}
+
+IndexSet PubKey::primesForCapacity(long targetCapacity,
+                                   NTL::xdouble noise) const
+{
+  // As in Ctxt::dropToCapacity, keep one bit above targetCapacity
+  const IndexSet& all = context.getCtxtPrimes();
+  double low = NTL::log(noise) + (targetCapacity + 1) * std::log(2.0);
+  if (low >= context.logOfProduct(all))
+    return all;
+
+  double maxPrime = 0;
+  for (long i : all)
+    maxPrime = std::max(maxPrime, context.logOfPrime(i));
+  IndexSet primes = context.getModSizeTable().getSet4Size(low,
+                                                          low + maxPrime,
+                                                          all,
+                                                          /*reverse=*/true);
+  if (empty(primes) || !(primes <= all))
+    return all;
+  return primes;
+}
+
+bool PubKey::takeZeroEncryption(Ctxt& ctxt, long ptxtSpace) const
+{
+  if (ptxtSpace != (isCKKS() ? 1 : pubEncrKey.ptxtSpace))
+    return false;
+
+  std::lock_guard<std::mutex> lock(zeroPoolMutex);
+  if (zeroPool.empty())
+    return false;
+  ctxt = std::move(zeroPool.back());
+  zeroPool.pop_back();
+  return true;
+}
+
+void PubKey::precomputeZeroEncryptions(long n) const
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(n >= 0, "precomputeZeroEncryptions: n < 0");
+  long ptxtSpace = isCKKS() ? 1 : pubEncrKey.ptxtSpace;
+
+  // Every encryption gets a PRG stream of its own, split in order from the
+  // current stream, so the result does not depend on the number of threads
+  std::vector<PRG> prgs;
+  prgs.reserve(n);
+  for (long i = 0; i < n; i++)
+    prgs.push_back(PRG::current().split());
+
+  std::vector<Ctxt> fresh(n, Ctxt(*this));
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i : range(first, last))
+    encryptZero(fresh[i], ptxtSpace, context.getCtxtPrimes(), prgs[i]);
+  NTL_EXEC_RANGE_END
+
+  std::lock_guard<std::mutex> lock(zeroPoolMutex);
+  zeroPool.insert(zeroPool.end(),
+                  std::make_move_iterator(fresh.begin()),
+                  std::make_move_iterator(fresh.end()));
+}
+
+long PubKey::precomputedZeroEncryptions() const
+{
+  std::lock_guard<std::mutex> lock(zeroPoolMutex);
+  return zeroPool.size();
+}
+
+void PubKey::clearZeroEncryptions() const
+{
+  std::lock_guard<std::mutex> lock(zeroPoolMutex);
+  zeroPool.clear();
+}
+
+void PubKey::EncryptBatch(
+    std::vector<Ctxt>& ctxts,
+    const std::vector<PtxtArray>& ptxts,
+    const std::function<void(long, const Ctxt&)>& writer) const
+{
+  HELIB_TIMER_START;
+  long n = ptxts.size();
+  if (long(ctxts.size()) != n) {
+    ctxts.clear();
+    ctxts.reserve(n);
+    for (long i = 0; i < n; i++)
+      ctxts.emplace_back(*this);
+  }
+  for (const Ctxt& ctxt : ctxts)
+    assertEq(this, &ctxt.pubKey, "EncryptBatch: public key mismatch");
+
+  // Every encryption gets a PRG stream of its own, seeded in order from the
+  // current stream, so the result does not depend on the number of threads
+  std::vector<NTL::ZZ> seeds(n);
+  for (NTL::ZZ& seed : seeds)
+    NTL::RandomBits(seed, 256);
+
+  // Without a writer the batch is a single chunk
+  long chunk = writer ? std::max(1L, NTL::AvailableThreads()) : n;
+  for (long start = 0; start < n; start += chunk) {
+    long end = std::min(n, start + chunk);
+    NTL_EXEC_RANGE(end - start, first, last)
+    EncodedPtxt eptxt; // reused by all the encryptions of this thread
+    for (long i : range(start + first, start + last)) {
+      RandomState state; // restores the PRG state of this thread
+      NTL::SetSeed(seeds[i]);
+      ptxts[i].encode(eptxt);
+      Encrypt(ctxts[i], eptxt);
+    }
+    NTL_EXEC_RANGE_END
+
+    if (writer)
+      for (long i : range(start, end))
+        writer(i, ctxts[i]);
   }
+}
+
+void PubKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_BGV& eptxt) const
+{
+  encryptBGV(ctxt, eptxt, -1);
+}
+
+void PubKey::encryptBGV(Ctxt& ctxt,
+                        const EncodedPtxt_BGV& eptxt,
+                        long targetCapacity) const
+{
+  HELIB_TIMER_START;
+
+  assertTrue(!isCKKS(), "Encrypt: mismatched BGV ptxt / CKKS ctxt");
+  assertEq(this, &ctxt.pubKey, "Encrypt: public key mismatch");
+  assertEq(&context, &eptxt.getContext(), "Encrypt: context mismatch");
+
+  long ptxtSpace = eptxt.getPtxtSpace();
+  NTL::ZZX ptxt;
+
+  convert(ptxt, eptxt.getPoly());
+
+  // The rest of the code is copy/pasted from the
+  // original Encrypt code, except that for now, highNoise
+  // is not implemented.  We can put it back if necessary.
+  // We may eventually want to completely deprecate the original
+  // Encrypt code, which is why it is copy/pasted for now.
+  // We could also just invoke
+  //    Encrypt(ctxt, ptxt, ptxtSpace, /*highNoise=*/false);
+  // at this point for the same effect.
+
+  // VJS-FIXME: I really should get rid of the unnecessary
+  // connversions from zzX to ZZX...I've added a zzX version
+  // of balanced_mulMod...but I also need zzX versions
+  // of DoubleCRT += and friends.
+
+  if (ptxtSpace != pubEncrKey.ptxtSpace) { // plaintext-space mismatch
+    ptxtSpace = NTL::GCD(ptxtSpace, pubEncrKey.ptxtSpace);
+    if (ptxtSpace <= 1)
+      throw RuntimeError("Plaintext-space mismatch on encryption");
+  }
+
+  // ctxt = r*pk + p*(e0,e1), with p = ptxtSpace, precomputed if possible
+  IndexSet primes = context.getCtxtPrimes();
+  if (targetCapacity >= 0)
+    primes = primesForCapacity(
+        targetCapacity,
+        zeroEncryptionNoiseBound(ptxtSpace) +
+            context.noiseBoundForMod(ptxtSpace, context.getPhiM()));
+  if (primes != context.getCtxtPrimes() ||
+      !takeZeroEncryption(ctxt, ptxtSpace))
+    encryptZero(ctxt, ptxtSpace, primes);
 
   // add in the plaintext
   // FIXME: we should really randomize ptxt, so that each coefficient
@@ -754,6 +1060,13 @@ void PubKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_BGV& eptxt) const
 }
 
 void PubKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_CKKS& eptxt) const
+{
+  encryptCKKS(ctxt, eptxt, -1);
+}
+
+void PubKey::encryptCKKS(Ctxt& ctxt,
+                         const EncodedPtxt_CKKS& eptxt,
+                         long targetCapacity) const
 {
   assertTrue(isCKKS(), "Encrypt: mismatched CKKS ptxt / BGV ctxt");
   assertEq(this, &ctxt.pubKey, "Public key and context public key mismatch");
@@ -769,11 +1082,6 @@ void PubKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_CKKS& eptxt) const
   assertTrue(scale > 0, "CKKS encryption: scale <= 0");
   assertTrue(err > 0, "CKKS encryption: err <= 0");
 
-  long m = context.getM();
-
-  // generate a random encryption of zero from the public encryption key
-  ctxt = pubEncrKey; // already an encryption of zero, just not a random one
-
   // choose a random small scalar r and a small random error vector
   // (e0,e1), then set ctxt = r*pk + (e0,e1) + (ef*ptxt,0), where
   // pk = pubEncrKey, and ef (the "extra factor") is described below
@@ -794,33 +1102,19 @@ void PubKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_CKKS& eptxt) const
   // the scaled noise added by encryption is less than the scaled
   // noise already present in the encoded ptxt.
 
-  DoubleCRT e(context, context.getCtxtPrimes());
-  DoubleCRT r(context, context.getCtxtPrimes());
-
-  double r_bound = r.sampleSmallBounded(); // r is a {0,+-1} polynomial
-
-  NTL::xdouble error_bound = r_bound * pubEncrKey.noiseBound;
-
-  double stdev = to_double(context.getStdev());
-
-  // VJS-NOTE: this should never happen for CKKS
-  if (context.getZMStar().getPow2() == 0) // not power of two
-    stdev *= sqrt(m);
-
-  for (size_t i = 0; i < ctxt.parts.size(); i++) {
-    // add noise to all the parts
-
-    ctxt.parts[i] *= r;
-
-    double e_bound = e.sampleGaussianBounded(stdev);
-    // zero-mean Gaussian, sigma=stdev
-
-    ctxt.parts[i] += e;
-    if (i == 1) {
-      e_bound *= getSKeyBound(ctxt.parts[i].skHandle.getSecretKeyID());
-    }
-    error_bound += e_bound;
+  // The encryption of zero r*pk + (e0,e1), precomputed if possible. For a
+  // target capacity, the noise and scale of the result are estimated
+  // ahead, as below, from the bound on the noise of the encryption of zero
+  IndexSet primes = context.getCtxtPrimes();
+  if (targetCapacity >= 0) {
+    NTL::xdouble bound = zeroEncryptionNoiseBound(1);
+    double ef = std::max(1.0, NTL::conv<double>(ceil(bound / err)));
+    primes = primesForCapacity(targetCapacity,
+                               bound + ef * (err + mag * scale));
   }
+  if (primes != context.getCtxtPrimes() || !takeZeroEncryption(ctxt, 1))
+    encryptZero(ctxt, 1, primes);
+  NTL::xdouble error_bound = ctxt.noiseBound;
 
   // Compute the extra scaling factor, if needed
 
@@ -855,6 +1149,20 @@ void PubKey::Encrypt(Ctxt& ctxt, const EncodedPtxt& eptxt) const
     throw LogicError("Encrypt: bad EncodedPtxt");
 }
 
+void PubKey::Encrypt(Ctxt& ctxt,
+                     const EncodedPtxt& eptxt,
+                     long targetCapacity) const
+{
+  assertTrue<InvalidArgument>(targetCapacity >= 0,
+                              "Encrypt: negative target capacity");
+  if (eptxt.isBGV())
+    encryptBGV(ctxt, eptxt.getBGV(), targetCapacity);
+  else if (eptxt.isCKKS())
+    encryptCKKS(ctxt, eptxt.getCKKS(), targetCapacity);
+  else
+    throw LogicError("Encrypt: bad EncodedPtxt");
+}
+
 bool PubKey::isCKKS() const
 {
   return (getContext().getAlMod().getTag() == PA_cx_tag);
@@ -879,6 +1187,19 @@ std::istream& operator>>(std::istream& str, PubKey& pk)
 }
 
 void PubKey::writeTo(std::ostream& str) const
+{
+  writeWithMatrices(str, keySwitching);
+}
+
+unsigned long PubKey::fingerprint() const
+{
+  FingerprintStream str;
+  writeTo(str);
+  return str.hash();
+}
+
+void PubKey::writeWithMatrices(std::ostream& str,
+                               const std::vector<KeySwitch>& matrices) const
 {
   SerializeHeader<PubKey>().writeTo(str);
   writeEyeCatcher(str, EyeCatcher::PK_BEGIN);
@@ -898,7 +1219,7 @@ void PubKey::writeTo(std::ostream& str) const
   write_raw_vector(str, this->skBounds);
 
   // Keyswitch Matrices
-  write_raw_vector(str, this->keySwitching);
+  write_raw_vector(str, matrices);
 
   long sz = this->keySwitchMap.size();
   write_raw_int(str, sz);
@@ -915,6 +1236,14 @@ void PubKey::writeTo(std::ostream& str) const
 
 PubKey PubKey::readFrom(std::istream& str, const Context& context)
 {
+  return readWithMatrices(str, context, nullptr);
+}
+
+PubKey PubKey::readWithMatrices(std::istream& str,
+                                const Context& context,
+                                const std::shared_ptr<LazyKeyStore>& store)
+{
+  MemoryScope memoryScope(MemoryCategory::KEYS);
   const auto header = SerializeHeader<PubKey>::readFrom(str);
   assertEq<IOError>(header.version,
                     Binio::VERSION_0_0_1_0,
@@ -939,7 +1268,15 @@ PubKey PubKey::readFrom(std::istream& str, const Context& context)
   read_raw_vector(str, ret.skBounds); // Using in-place function for performance
 
   // Keyswitch Matrices
-  ret.keySwitching = read_raw_vector<KeySwitch, Context>(str, context);
+  if (store == nullptr)
+    ret.keySwitching = read_raw_vector<KeySwitch, Context>(str, context);
+  else {
+    ret.keySwitching.resize(read_raw_int(str));
+    for (KeySwitch& W : ret.keySwitching) {
+      W.lazyIndex = store->index(str, W, W.lazyCols);
+      W.lazyB = store;
+    }
+  }
 
   long sz = read_raw_int(str);
   ret.keySwitchMap.clear();
@@ -966,6 +1303,310 @@ PubKey PubKey::readFrom(std::istream& str, const Context& context)
   return ret;
 }
 
+void PubKey::writeChunkedTo(std::ostream& str) const
+{
+  // Chunk 0 is the key in the format of writeTo with no matrices, and chunk
+  // i+1 is keySwitching[i]
+  long n = keySwitching.size();
+  std::vector<std::string> chunks(n + 1);
+  NTL_EXEC_RANGE(n + 1, first, last)
+  for (long i : range(first, last)) {
+    std::ostringstream chunk;
+    if (i == 0)
+      writeWithMatrices(chunk, std::vector<KeySwitch>());
+    else
+      keySwitching[i - 1].writeTo(chunk);
+    chunks[i] = chunk.str();
+  }
+  NTL_EXEC_RANGE_END
+
+  SerializeHeader<PubKey>().writeTo(str);
+  write_chunks(str, chunks);
+}
+
+PubKey PubKey::readChunkedFrom(std::istream& str, const Context& context)
+{
+  MemoryScope memoryScope(MemoryCategory::KEYS);
+  const auto header = SerializeHeader<PubKey>::readFrom(str);
+  assertEq<IOError>(header.version,
+                    Binio::VERSION_0_0_1_0,
+                    "Header: version " + header.versionString() +
+                        " not supported");
+
+  std::vector<std::string> chunks = read_chunks(str);
+  assertTrue<IOError>(!chunks.empty(), "No public key chunk");
+
+  long n = lsize(chunks) - 1;
+  std::vector<KeySwitch> matrices(n);
+  NTL_EXEC_RANGE(n, first, last)
+  MemoryScope threadScope(MemoryCategory::KEYS);
+  for (long i : range(first, last)) {
+    std::istringstream chunk(chunks[i + 1]);
+    matrices[i] = KeySwitch::readFrom(chunk, context);
+    std::string().swap(chunks[i + 1]);
+  }
+  NTL_EXEC_RANGE_END
+
+  std::istringstream body(chunks[0]);
+  PubKey ret = readWithMatrices(body, context, nullptr);
+  ret.keySwitching = std::move(matrices);
+  for (long i = ret.skBounds.size() - 1; i >= 0; i--)
+    ret.setKeySwitchMap(i);
+  return ret;
+}
+
+void PubKey::writePackedTo(std::ostream& str) const
+{
+  // The chunks of writeChunkedTo, with the matrices packed
+  long n = keySwitching.size();
+  std::vector<std::string> chunks(n + 1);
+  NTL_EXEC_RANGE(n + 1, first, last)
+  for (long i : range(first, last)) {
+    std::ostringstream chunk;
+    if (i == 0)
+      writeWithMatrices(chunk, std::vector<KeySwitch>());
+    else
+      keySwitching[i - 1].writePackedTo(chunk);
+    chunks[i] = chunk.str();
+  }
+  NTL_EXEC_RANGE_END
+
+  SerializeHeader<PubKey>().writeTo(str);
+  writeEyeCatcher(str, EyeCatcher::PACKED_BEGIN);
+  write_chunks(str, chunks);
+  writeEyeCatcher(str, EyeCatcher::PACKED_END);
+}
+
+PubKey PubKey::readPackedFrom(std::istream& str, const Context& context)
+{
+  MemoryScope memoryScope(MemoryCategory::KEYS);
+  const auto header = SerializeHeader<PubKey>::readFrom(str);
+  assertEq<IOError>(header.version,
+                    Binio::VERSION_0_0_1_0,
+                    "Header: version " + header.versionString() +
+                        " not supported");
+  assertTrue<IOError>(readEyeCatcher(str, EyeCatcher::PACKED_BEGIN),
+                      "Could not find pre-packed key eyecatcher");
+
+  std::vector<std::string> chunks = read_chunks(str);
+  assertTrue<IOError>(!chunks.empty(), "No public key chunk");
+  assertTrue<IOError>(readEyeCatcher(str, EyeCatcher::PACKED_END),
+                      "Could not find post-packed key eyecatcher");
+
+  long n = lsize(chunks) - 1;
+  std::vector<KeySwitch> matrices(n);
+  NTL_EXEC_RANGE(n, first, last)
+  MemoryScope threadScope(MemoryCategory::KEYS);
+  for (long i : range(first, last)) {
+    std::istringstream chunk(chunks[i + 1]);
+    matrices[i] = KeySwitch::readPackedFrom(chunk, context);
+    std::string().swap(chunks[i + 1]);
+  }
+  NTL_EXEC_RANGE_END
+
+  std::istringstream body(chunks[0]);
+  PubKey ret = readWithMatrices(body, context, nullptr);
+  ret.keySwitching = std::move(matrices);
+  for (long i = ret.skBounds.size() - 1; i >= 0; i--)
+    ret.setKeySwitchMap(i);
+  return ret;
+}
+
+// Rows are viewed in place, so they must be in the byte order of the file
+static void assertLittleEndian(const char* where)
+{
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+  throw LogicError(std::string(where) + ": needs a little-endian platform");
+#else
+  (void)where;
+#endif
+}
+
+static void writeZeros(std::ostream& str, long n)
+{
+  static const char zeros[MappedKeyLayout::ALIGNMENT] = {};
+  for (; n > 0; n -= MappedKeyLayout::ALIGNMENT)
+    str.write(zeros, std::min(n, MappedKeyLayout::ALIGNMENT));
+}
+
+void PubKey::writeMappableTo(std::ostream& str) const
+{
+  HELIB_TIMER_START;
+  assertLittleEndian("PubKey::writeMappableTo");
+
+  long phim = context.getPhiM();
+  long rowBytes = MappedKeyLayout::rowBytes(phim);
+
+  // The metadata: this key with empty b's, then the prime sets of the b's
+  std::vector<KeySwitch> shells;
+  shells.reserve(keySwitching.size());
+  for (const KeySwitch& W : keySwitching) {
+    shells.emplace_back(W.fromKey, W.fromKey.getSecretKeyID(), W.toKeyID,
+                        W.ptxtSpace);
+    shells.back().prgSeed = W.prgSeed;
+    shells.back().noiseBound = W.noiseBound;
+  }
+  std::stringstream meta;
+  writeWithMatrices(meta, shells);
+  for (const KeySwitch& W : keySwitching) {
+    write_raw_int(meta, W.NumCols());
+    if (W.isMapped())
+      for (const IndexMap<const long*>& col : W.getMappedB())
+        col.getIndexSet().writeTo(meta);
+    else
+      for (const DoubleCRT& bj : *W.residentB())
+        bj.getIndexSet().writeTo(meta);
+  }
+  std::string metadata = meta.str();
+  long metaSize = metadata.size();
+  long rowsOffset = MappedKeyLayout::METADATA_OFFSET + metaSize;
+  rowsOffset = (rowsOffset + MappedKeyLayout::ALIGNMENT - 1) /
+               MappedKeyLayout::ALIGNMENT * MappedKeyLayout::ALIGNMENT;
+
+  SerializeHeader<PubKey>().writeTo(str);
+  writeEyeCatcher(str, EyeCatcher::MAPPED_BEGIN);
+  write_raw_int32(str, 0);
+  write_raw_int(str, MappedKeyLayout::VERSION);
+  write_raw_int(str, phim);
+  write_raw_int(str, metaSize);
+  write_raw_int(str, rowsOffset);
+  str.write(metadata.data(), metaSize);
+  writeZeros(str, rowsOffset - MappedKeyLayout::METADATA_OFFSET - metaSize);
+
+  for (const KeySwitch& W : keySwitching) {
+    // One lazy matrix at a time is read in
+    std::shared_ptr<const std::vector<DoubleCRT>> bs;
+    if (!W.isMapped())
+      bs = W.residentB();
+    for (long j : range(W.NumCols())) {
+      const IndexSet& s = W.isMapped() ? W.getMappedB()[j].getIndexSet()
+                                       : (*bs)[j].getIndexSet();
+      for (long i : s) {
+        const long* row =
+            W.isMapped() ? W.getMappedB()[j][i] : (*bs)[j].getMap()[i].elts();
+        str.write(reinterpret_cast<const char*>(row), phim * sizeof(long));
+        writeZeros(str, rowBytes - phim * long(sizeof(long)));
+      }
+    }
+  }
+  writeEyeCatcher(str, EyeCatcher::MAPPED_END);
+}
+
+PubKey PubKey::readMapped(const std::string& path, const Context& context)
+{
+  return readMappedFrom(std::make_shared<const MappedFile>(path), context);
+}
+
+void PubKey::writeShared(const std::string& name) const
+{
+  HELIB_TIMER_START;
+  MappedFile::createShared(name,
+                           [this](std::ostream& str) { writeMappableTo(str); });
+}
+
+PubKey PubKey::readShared(const std::string& name, const Context& context)
+{
+  return readMappedFrom(MappedFile::openShared(name), context);
+}
+
+void PubKey::removeShared(const std::string& name)
+{
+  MappedFile::removeShared(name);
+}
+
+PubKey PubKey::readMappedFrom(const std::shared_ptr<const MappedFile>& file,
+                              const Context& context)
+{
+  HELIB_TIMER_START;
+  MemoryScope memoryScope(MemoryCategory::KEYS);
+  assertLittleEndian("PubKey::readMapped");
+
+  const unsigned char* base = file->data();
+  long size = file->size();
+  assertTrue<IOError>(size >= MappedKeyLayout::METADATA_OFFSET,
+                      "PubKey::readMapped: file too short");
+
+  std::istringstream head(
+      std::string(reinterpret_cast<const char*>(base),
+                  MappedKeyLayout::METADATA_OFFSET));
+  const auto header = SerializeHeader<PubKey>::readFrom(head);
+  assertEq<IOError>(header.version,
+                    Binio::VERSION_0_0_1_0,
+                    "Header: version " + header.versionString() +
+                        " not supported");
+  bool eyeCatcherFound = readEyeCatcher(head, EyeCatcher::MAPPED_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find pre-mapped key eyecatcher");
+  read_raw_int32(head); // padding
+  assertEq<IOError>(read_raw_int(head),
+                    MappedKeyLayout::VERSION,
+                    "PubKey::readMapped: unsupported layout version");
+  long phim = read_raw_int(head);
+  assertEq<IOError>(phim,
+                    context.getPhiM(),
+                    "PubKey::readMapped: phi(m) mismatch");
+  long metaSize = read_raw_int(head);
+  long rowsOffset = read_raw_int(head);
+  assertTrue<IOError>(metaSize >= 0 &&
+                          rowsOffset >=
+                              MappedKeyLayout::METADATA_OFFSET + metaSize &&
+                          rowsOffset % MappedKeyLayout::ALIGNMENT == 0 &&
+                          rowsOffset <= size,
+                      "PubKey::readMapped: bad layout");
+
+  std::istringstream meta(std::string(
+      reinterpret_cast<const char*>(base) + MappedKeyLayout::METADATA_OFFSET,
+      metaSize));
+  PubKey ret = PubKey::readFrom(meta, context);
+
+  // Point the b_i's of every matrix at their rows
+  long rowBytes = MappedKeyLayout::rowBytes(phim);
+  long rowsEnd = size - EyeCatcher::SIZE;
+  long pos = rowsOffset;
+  for (KeySwitch& W : ret.keySwitching) {
+    long nCols = read_raw_int(meta);
+    assertInRange<IOError>(nCols,
+                           0l,
+                           long(context.getDigits().size()),
+                           "PubKey::readMapped: bad number of columns",
+                           /*right_inclusive=*/true);
+    auto rows = std::make_shared<MappedRows>(context, file);
+    rows->cols.resize(nCols);
+    for (IndexMap<const long*>& col : rows->cols) {
+      IndexSet s = IndexSet::readFrom(meta);
+      assertTrue<IOError>(s <= context.allPrimes(),
+                          "PubKey::readMapped: unknown primes");
+      for (long i : s) {
+        assertTrue<IOError>(pos + rowBytes <= rowsEnd,
+                            "PubKey::readMapped: file too short");
+        col.insert(i);
+        col[i] = reinterpret_cast<const long*>(base + pos);
+        pos += rowBytes;
+      }
+    }
+    W.b.clear();
+    W.mappedB = rows;
+  }
+  assertTrue<IOError>(pos == rowsEnd &&
+                          std::equal(EyeCatcher::MAPPED_END.begin(),
+                                     EyeCatcher::MAPPED_END.end(),
+                                     base + pos),
+                      "Could not find post-mapped key eyecatcher");
+  return ret;
+}
+
+PubKey PubKey::readLazy(const std::string& path,
+                        const Context& context,
+                        long maxResident)
+{
+  HELIB_TIMER_START;
+  std::ifstream str(path, std::ios::binary);
+  assertTrue<IOError>(str.is_open(), "PubKey::readLazy: cannot open " + path);
+
+  auto store = std::make_shared<LazyKeyStore>(context, path, maxResident);
+  return readWithMatrices(str, context, store);
+}
+
 void PubKey::writeToJSON(std::ostream& str) const
 {
   executeRedirectJsonError<void>([&]() { str << writeToJSON(); });
@@ -1016,6 +1657,7 @@ void PubKey::readJSON(std::istream& str)
 
 void PubKey::readJSON(const JsonWrapper& tjw)
 {
+  MemoryScope memoryScope(MemoryCategory::KEYS);
   auto body = [&, this]() {
     json j = fromTypedJson<PubKey>(unwrap(tjw));
     Context ser_context = Context::readFromJSON(wrap(j.at("context")));
@@ -1053,6 +1695,18 @@ void PubKey::readJSON(const JsonWrapper& tjw)
   executeRedirectJsonError<void>(body);
 }
 
+void PubKey::writeToHybridJSON(std::ostream& str) const
+{
+  writeHybridJSON(str, *this);
+}
+
+PubKey PubKey::readFromHybridJSON(std::istream& str, const Context& context)
+{
+  return readHybridJSON<PubKey>(str, [&](std::istream& body) {
+    return PubKey::readFrom(body, context);
+  });
+}
+
 /******************** SecKey implementation **********************/
 /********************************************************************/
 
@@ -1094,6 +1748,7 @@ long SecKey::ImportSecKey(const DoubleCRT& sKey,
                           long ptxtSpace,
                           long maxDegKswitch)
 {
+  MemoryScope memoryScope(MemoryCategory::KEYS);
   if (sKeys.empty()) { // 1st secret-key, generate corresponding public key
     if (ptxtSpace < 2)
       ptxtSpace = isCKKS() ? 1 : context.getAlMod().getPPowR();
@@ -1131,6 +1786,7 @@ long SecKey::ImportSecKey(const DoubleCRT& sKey,
 
 long SecKey::GenSecKey(long ptxtSpace, long maxDegKswitch)
 {
+  MemoryScope memoryScope(MemoryCategory::KEYS);
   long hwt = context.getHwt();
 
   DoubleCRT newSk(context,
@@ -1156,6 +1812,7 @@ void SecKey::GenKeySWmatrix(long fromSPower,
                             long p)
 {
   HELIB_TIMER_START;
+  MemoryScope memoryScope(MemoryCategory::KEYS);
 
   // sanity checks
   if (fromSPower <= 0 || fromXPower <= 0)
@@ -1167,6 +1824,59 @@ void SecKey::GenKeySWmatrix(long fromSPower,
   if (haveKeySWmatrix(fromSPower, fromXPower, fromIdx, toIdx))
     return; // nothing to do here
 
+  // Push the new matrix onto our list
+  keySwitching.push_back(makeKeySWmatrix(fromSPower,
+                                         fromXPower,
+                                         fromIdx,
+                                         toIdx,
+                                         p,
+                                         PRG::current()));
+}
+
+void SecKey::GenKeySWmatrices(const std::vector<long>& fromXPowers,
+                              long fromIdx,
+                              long toIdx,
+                              long p)
+{
+  HELIB_TIMER_START;
+
+  // The matrices that are still missing, each one only once
+  std::vector<long> todo;
+  std::unordered_set<long> seen;
+  for (long fromXPower : fromXPowers) {
+    if (fromXPower <= 0 || (fromXPower == 1 && fromIdx == toIdx))
+      continue;
+    if (haveKeySWmatrix(1, fromXPower, fromIdx, toIdx))
+      continue;
+    if (seen.insert(fromXPower).second)
+      todo.push_back(fromXPower);
+  }
+
+  // Every matrix gets a PRG stream of its own, split in order from the
+  // current stream, so the result does not depend on the number of threads
+  std::vector<PRG> prgs;
+  prgs.reserve(todo.size());
+  for (std::size_t i = 0; i < todo.size(); i++)
+    prgs.push_back(PRG::current().split());
+
+  std::vector<KeySwitch> matrices(todo.size());
+  NTL_EXEC_RANGE(long(todo.size()), first, last)
+  for (long i : range(first, last))
+    matrices[i] = makeKeySWmatrix(1, todo[i], fromIdx, toIdx, p, prgs[i]);
+  NTL_EXEC_RANGE_END
+
+  keySwitching.insert(keySwitching.end(),
+                      std::make_move_iterator(matrices.begin()),
+                      std::make_move_iterator(matrices.end()));
+}
+
+KeySwitch SecKey::makeKeySWmatrix(long fromSPower,
+                                  long fromXPower,
+                                  long fromIdx,
+                                  long toIdx,
+                                  long p,
+                                  PRG& prg) const
+{
   DoubleCRT fromKey = sKeys.at(fromIdx);    // copy object, not a reference
   const DoubleCRT& toKey = sKeys.at(toIdx); // this can be a reference
 
@@ -1179,7 +1889,7 @@ void SecKey::GenKeySWmatrix(long fromSPower,
   //   of the secret key as being mod p^r)
 
   KeySwitch ksMatrix(fromSPower, fromXPower, fromIdx, toIdx);
-  RandomBits(ksMatrix.prgSeed, 256); // a random 256-bit seed
+  ksMatrix.newPRGSeed(prg);
 
   long n = context.getDigits().size();
 
@@ -1193,12 +1903,7 @@ void SecKey::GenKeySWmatrix(long fromSPower,
       n,
       DoubleCRT(context, context.getCtxtPrimes() | context.getSpecialPrimes()));
 
-  {
-    RandomState state;
-    SetSeed(ksMatrix.prgSeed);
-    for (long i = 0; i < n; i++)
-      a[i].randomize();
-  } // restore state upon destruction of state
+  ksMatrix.generateA(a);
 
   // Record the plaintext space for this key-switching matrix
   if (isCKKS())
@@ -1225,7 +1930,7 @@ void SecKey::GenKeySWmatrix(long fromSPower,
   // generate the RLWE instances with pseudorandom ai's
 
   for (long i = 0; i < n; i++) {
-    ksMatrix.noiseBound = RLWE1(ksMatrix.b[i], a[i], toKey, p);
+    ksMatrix.noiseBound = RLWE1(ksMatrix.b[i], a[i], toKey, p, prg);
   }
   // Add in the multiples of the fromKey secret key
   fromKey *= context.productOfPrimes(context.getSpecialPrimes());
@@ -1234,9 +1939,6 @@ void SecKey::GenKeySWmatrix(long fromSPower,
     fromKey *= context.productOfPrimes(context.getDigit(i));
   }
 
-  // Push the new matrix onto our list
-  keySwitching.push_back(ksMatrix);
-
 #if 0
   // HERE
   std::cout
@@ -1245,6 +1947,8 @@ void SecKey::GenKeySWmatrix(long fromSPower,
     << toIdx << " " << p << " "
     << (log(ksMatrix.noiseBound)/log(2.0)) << "\n";
 #endif
+
+  return ksMatrix;
 }
 
 // Decryption
@@ -1317,9 +2021,7 @@ void SecKey::Decrypt<CKKS>(Ptxt<CKKS>& plaintxt,
 }
 #endif
 
-void SecKey::Decrypt(NTL::ZZX& plaintxt,
-                     const Ctxt& ciphertxt,
-                     NTL::ZZX& f) const // plaintext before modular reduction
+void SecKey::decryptToDoubleCRT(DoubleCRT& ptxt, const Ctxt& ciphertxt) const
 {
   HELIB_TIMER_START;
 
@@ -1347,7 +2049,7 @@ void SecKey::Decrypt(NTL::ZZX& plaintxt,
 
   const IndexSet& ptxtPrimes = ciphertxt.primeSet;
 
-  DoubleCRT ptxt(context, ptxtPrimes); // Set to zero
+  ptxt = DoubleCRT(context, ptxtPrimes); // Set to zero
 
   // for each ciphertext part, fetch the right key, multiply and add
   for (size_t i = 0; i < ciphertxt.parts.size(); i++) {
@@ -1357,24 +2059,23 @@ void SecKey::Decrypt(NTL::ZZX& plaintxt,
       continue;
     }
 
-    long keyIdx = part.skHandle.getSecretKeyID();
-    DoubleCRT key = sKeys.at(keyIdx); // copy object, not a reference
-    key.setPrimes(ptxtPrimes);
-    // need to equalize the prime sets without changing prime set of ciphertext.
-    // Note that ciphertext may contain small primes, which are not in key.
-
-    long xPower = part.skHandle.getPowerOfX();
-    long sPower = part.skHandle.getPowerOfS();
-    if (xPower > 1) {
-      key.automorph(xPower); // s(X^t)
-    }
-    if (sPower > 1) {
-      key.Exp(sPower); // s^r(X^t)
-    }
+    DoubleCRT key(context, ptxtPrimes);
+    decryptionKey(key, part.skHandle, ptxtPrimes);
 
     key *= part;
     ptxt += key;
   }
+}
+
+void SecKey::Decrypt(NTL::ZZX& plaintxt,
+                     const Ctxt& ciphertxt,
+                     NTL::ZZX& f) const // plaintext before modular reduction
+{
+  HELIB_TIMER_START;
+
+  DoubleCRT ptxt(context, ciphertxt.primeSet);
+  decryptToDoubleCRT(ptxt, ciphertxt);
+
   // convert to coefficient representation & reduce modulo the plaintext space
 
   if (DECRYPT_ON_PWFL_BASIS && !getContext().getZMStar().getPow2()) {
@@ -1412,6 +2113,131 @@ void SecKey::Decrypt(NTL::ZZX& plaintxt,
   }
 }
 
+void SecKey::decryptionKey(DoubleCRT& key,
+                           const SKHandle& handle,
+                           const IndexSet& s) const
+{
+  key = sKeys.at(handle.getSecretKeyID()); // copy object, not a reference
+  key.setPrimes(s);
+  // need to equalize the prime sets without changing prime set of ciphertext.
+  // Note that ciphertext may contain small primes, which are not in key.
+
+  long xPower = handle.getPowerOfX();
+  long sPower = handle.getPowerOfS();
+  if (xPower > 1) {
+    key.automorph(xPower); // s(X^t)
+  }
+  if (sPower > 1) {
+    key.Exp(sPower); // s^r(X^t)
+  }
+}
+
+void SecKey::DecryptBatch(std::vector<PtxtArray>& ptxts,
+                          const std::vector<Ctxt>& ctxts) const
+{
+  HELIB_TIMER_START;
+  long n = ctxts.size();
+  if (long(ptxts.size()) != n) {
+    ptxts.clear();
+    ptxts.reserve(n);
+    for (long i = 0; i < n; i++)
+      ptxts.emplace_back(context);
+  }
+
+  // Only BGV on the polynomial basis can be reduced mod the plaintext space
+  // prime by prime. CKKS needs the actual coefficients, and the powerful
+  // basis needs its own (multi-precision) reduction mod Q.
+  bool fast = !isCKKS() &&
+              (!DECRYPT_ON_PWFL_BASIS || context.getZMStar().getPow2() != 0);
+  if (!fast) {
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i : range(first, last))
+      ptxts[i].decrypt(ctxts[i], *this);
+    NTL_EXEC_RANGE_END
+    return;
+  }
+
+  // The powers of the secret key needed by the batch, one per distinct
+  // (handle, prime set) pair. They are computed up front and then only read.
+  std::vector<std::pair<SKHandle, IndexSet>> keyIds;
+  std::vector<std::shared_ptr<const DoubleCRT>> keys;
+  for (const Ctxt& ctxt : ctxts) {
+    assertEq(&context, &ctxt.getContext(), "Context mismatch");
+    for (const CtxtPart& part : ctxt.parts) {
+      if (part.skHandle.isOne())
+        continue;
+      std::pair<SKHandle, IndexSet> id(part.skHandle, ctxt.primeSet);
+      if (std::find(keyIds.begin(), keyIds.end(), id) != keyIds.end())
+        continue;
+      auto key = std::make_shared<DoubleCRT>(context, ctxt.primeSet);
+      decryptionKey(*key, part.skHandle, ctxt.primeSet);
+      keyIds.push_back(id);
+      keys.push_back(key);
+    }
+  }
+
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i : range(first, last)) {
+    const Ctxt& ctxt = ctxts[i];
+    const EncryptedArray& ea = ptxts[i].getView();
+    long ptxtSpace = ctxt.getPtxtSpace();
+    if (ptxtSpace < ea.getP2R())
+      throw LogicError("SecKey::DecryptBatch: bad plaintext modulus");
+
+    if (!ctxt.isCorrect()) {
+      std::string message = "Decrypting with too much noise";
+#ifdef HELIB_DEBUG
+      Warning(message);
+#else
+      throw LogicError(message);
+#endif
+    }
+
+    DoubleCRT ptxt(context, ctxt.primeSet); // Set to zero
+    for (const CtxtPart& part : ctxt.parts) {
+      if (part.skHandle.isOne()) {
+        ptxt += part;
+        continue;
+      }
+      std::pair<SKHandle, IndexSet> id(part.skHandle, ctxt.primeSet);
+      long k = std::find(keyIds.begin(), keyIds.end(), id) - keyIds.begin();
+      ptxt.mulAdd(*keys[k], part);
+    }
+
+    zzX poly;
+    ptxt.toPolyMod(poly, ptxtSpace);
+
+    // multiply by (intFactor * Q)^{-1} mod p, as in Decrypt
+    if (ptxtSpace > 2) {
+      long factor = 1;
+      for (long j : ctxt.primeSet)
+        factor =
+            NTL::MulMod(factor, context.ithPrime(j) % ptxtSpace, ptxtSpace);
+      factor = NTL::MulMod(factor, ctxt.intFactor, ptxtSpace);
+      if (factor != 1) {
+        factor = NTL::InvMod(factor, ptxtSpace);
+        for (long j : range(poly.length()))
+          poly[j] = NTL::MulMod(poly[j], factor, ptxtSpace);
+      }
+    }
+
+    NTL::ZZX pp;
+    convert(pp, poly);
+    ea.decode(ptxts[i].pa, pp);
+  }
+  NTL_EXEC_RANGE_END
+}
+
+// Sample a new RLWE instance into the parts of a fresh ciphertext, with
+// parts[1] expanded from a new seed so that Ctxt::writeSeededTo can stand
+// the seed in for it
+double SecKey::seededRLWE(Ctxt& ctxt, const DoubleCRT& sKey, long p) const
+{
+  NTL::RandomBits(ctxt.uniformSeed, 8 * Ctxt::UNIFORM_SEED_BYTES);
+  ctxt.parts[1].randomize(ctxt.uniformSeed, /*index=*/0);
+  return RLWE1(ctxt.parts[0], ctxt.parts[1], sKey, p);
+}
+
 // Encryption using the secret key, this is useful, e.g., to put an
 // encryption of the secret key into the public key.
 long SecKey::skEncrypt(Ctxt& ctxt,
@@ -1460,7 +2286,7 @@ long SecKey::skEncrypt(Ctxt& ctxt,
 
   const DoubleCRT& sKey = sKeys.at(skIdx); // get key
   // Sample a new RLWE instance
-  ctxt.noiseBound = RLWE(ctxt.parts[0], ctxt.parts[1], sKey, ptxtSpace);
+  ctxt.noiseBound = seededRLWE(ctxt, sKey, ptxtSpace);
 
   if (isCKKS()) {
 
@@ -1580,7 +2406,7 @@ void SecKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_BGV& eptxt) const
 
   // Sample a new RLWE instance
   const DoubleCRT& sKey = sKeys.at(skIdx);
-  ctxt.noiseBound = RLWE(ctxt.parts[0], ctxt.parts[1], sKey, ptxtSpace);
+  ctxt.noiseBound = seededRLWE(ctxt, sKey, ptxtSpace);
 
   // The logic here has changed to be identical
   // to that used in public key encryption
@@ -1641,7 +2467,7 @@ void SecKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_CKKS& eptxt) const
 
   // Sample a new RLWE instance
   const DoubleCRT& sKey = sKeys.at(skIdx);
-  double error_bound = RLWE(ctxt.parts[0], ctxt.parts[1], sKey, 1);
+  double error_bound = seededRLWE(ctxt, sKey, 1);
 
   // This follows the same logic in PubKey::Encrypt(EncodedPtxt_CKKS).
   // See documentation there
@@ -1670,6 +2496,7 @@ void SecKey::Encrypt(Ctxt& ctxt, const EncodedPtxt_CKKS& eptxt) const
 // Generate bootstrapping data if needed, returns index of key
 long SecKey::genRecryptData()
 {
+  MemoryScope memoryScope(MemoryCategory::KEYS);
   if (recryptKeyID >= 0)
     return recryptKeyID;
 
@@ -1677,6 +2504,16 @@ long SecKey::genRecryptData()
   assertTrue(context.isBootstrappable(),
              "Cannot generate recrypt data for non-bootstrappable context");
 
+  // CKKS is bootstrapped under the main key, which the context makes
+  // sparse. It only needs the matrices of the rotations and of the
+  // conjugation for its linear maps.
+  if (isCKKS()) {
+    assertTrue(!sKeys.empty(), "The main secret key is missing");
+    addSome1DMatrices(*this);
+    addSomeFrbMatrices(*this);
+    return (recryptKeyID = 0);
+  }
+
   long p2ePr = context.getRcData().alMod->getPPowR(); // p^{e-e'+r}
   long p2r = context.getAlMod().getPPowR();           // p^r
 
@@ -1744,6 +2581,7 @@ void SecKey::writeTo(std::ostream& str) const
 
 SecKey SecKey::readFrom(std::istream& str, const Context& context)
 {
+  MemoryScope memoryScope(MemoryCategory::KEYS);
   const auto header = SerializeHeader<SecKey>::readFrom(str);
   assertEq<IOError>(header.version,
                     Binio::VERSION_0_0_1_0,
@@ -1767,6 +2605,37 @@ SecKey SecKey::readFrom(std::istream& str, const Context& context)
   return ret;
 }
 
+void SecKey::writeChunkedTo(std::ostream& str) const
+{
+  SerializeHeader<SecKey>().writeTo(str);
+  writeEyeCatcher(str, EyeCatcher::SK_BEGIN);
+  this->PubKey::writeChunkedTo(str);
+  write_raw_vector<DoubleCRT>(str, this->sKeys);
+  writeEyeCatcher(str, EyeCatcher::SK_END);
+}
+
+SecKey SecKey::readChunkedFrom(std::istream& str, const Context& context)
+{
+  MemoryScope memoryScope(MemoryCategory::KEYS);
+  const auto header = SerializeHeader<SecKey>::readFrom(str);
+  assertEq<IOError>(header.version,
+                    Binio::VERSION_0_0_1_0,
+                    "Header: version " + header.versionString() +
+                        " not supported");
+
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::SK_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find pre-secret key eyecatcher");
+
+  SecKey ret(PubKey::readChunkedFrom(str, context));
+  ret.sKeys = read_raw_vector<DoubleCRT>(str, context);
+
+  eyeCatcherFound = readEyeCatcher(str, EyeCatcher::SK_END);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-secret key eyecatcher");
+  return ret;
+}
+
 void SecKey::writeToJSON(std::ostream& str) const
 {
   executeRedirectJsonError<void>([&]() { str << writeToJSON(); });
@@ -1812,6 +2681,7 @@ void SecKey::readJSON(std::istream& str)
 
 void SecKey::readJSON(const JsonWrapper& tjw)
 {
+  MemoryScope memoryScope(MemoryCategory::KEYS);
   executeRedirectJsonError<void>([&]() {
     json j = fromTypedJson<SecKey>(unwrap(tjw));
     this->clear();
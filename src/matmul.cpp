@@ -12,12 +12,18 @@
 #include <cstddef>
 #include <tuple>
 #include <algorithm>
+#include <list>
+#include <mutex>
 #include <NTL/BasicThreadPool.h>
+#include <helib/multicore.h>
 #include <helib/matmul.h>
 #include <helib/norms.h>
 #include <helib/fhe_stats.h>
 #include <helib/apiAttributes.h>
 
+#include "binio.h"
+#include "MappedKeys.h"
+
 namespace helib {
 
 int fhe_test_force_bsgs = 0;
@@ -44,145 +50,6 @@ static bool comp_hoist(bool hoist)
 /********************************************************************/
 /****************** Auxiliary stuff: should go elsewhere   **********/
 
-/**
- * @class BasicAutomorphPrecon
- * @brief Pre-computation to speed many automorphism on the same ciphertext.
- *
- * The expensive part of homomorphic automorphism is breaking the ciphertext
- * parts into digits. The usual setting is we first rotate the ciphertext
- * parts, then break them into digits. But when we apply many automorphisms
- * it is faster to break the original ciphertext into digits, then rotate
- * the digits (as opposed to first rotate, then break).
- * An BasicAutomorphPrecon object breaks the original ciphertext and keeps
- * the digits, then when you call automorph is only needs to apply the
- * native automorphism and key switching to the digits, which is fast(er).
- **/
-class BasicAutomorphPrecon
-{
-  Ctxt ctxt;
-  NTL::xdouble noise;
-  std::vector<DoubleCRT> polyDigits;
-
-public:
-  BasicAutomorphPrecon(const Ctxt& _ctxt) : ctxt(_ctxt), noise(1.0)
-  {
-    HELIB_TIMER_START;
-    if (ctxt.parts.size() >= 1)
-      assertTrue(
-          ctxt.parts[0].skHandle.isOne(),
-          "Invalid ciphertext (secret key handle for part 0 is not one)");
-    if (ctxt.parts.size() <= 1)
-      return; // nothing to do
-
-    ctxt.cleanUp();
-    const Context& context = ctxt.getContext();
-    const PubKey& pubKey = ctxt.getPubKey();
-    long keyID = ctxt.getKeyID();
-
-    // The call to cleanUp() should ensure that this assertion passes.
-    assertTrue(ctxt.inCanonicalForm(keyID),
-               "Ciphertext is not in canonical form");
-
-    ctxt.relin_CKKS_adjust();
-
-    // Compute the number of digits that we need and the estimated
-    // added noise from switching this ciphertext.
-
-    NTL::xdouble addedNoise = ctxt.parts[1].breakIntoDigits(polyDigits);
-    NTL::xdouble max_ks_noise(0.0);
-    for (const KeySwitch& ks : pubKey.keySWlist()) {
-      if (max_ks_noise < ks.noiseBound)
-        max_ks_noise = ks.noiseBound;
-    }
-    addedNoise *= max_ks_noise;
-
-    double logProd = context.logOfProduct(context.getSpecialPrimes());
-    noise = ctxt.getNoiseBound() * NTL::xexp(logProd);
-
-    double ratio = NTL::conv<double>(addedNoise / noise);
-
-    HELIB_STATS_UPDATE("KS-noise-ratio-hoist", ratio);
-    if (ratio > 1) {
-      Warning("KS-noise-ratio-hoist=" + std::to_string(ratio));
-    }
-    // std::stderr << "*** HOIST INIT\n";
-    // fprintf(stderr, "   KS-log-noise-ratio-hoist: %f\n",
-    // log(addedNoise/noise)/log(2.0));
-
-    noise += addedNoise;
-  }
-
-  std::shared_ptr<Ctxt> automorph(long k) const
-  {
-    HELIB_TIMER_START;
-
-    // A hack: record this automorphism rather than actually performing it
-    if (isSetAutomorphVals()) { // defined in NumbTh.h
-      recordAutomorphVal(k);
-      return std::make_shared<Ctxt>(ctxt);
-    }
-
-    if (k == 1 || ctxt.isEmpty())
-      return std::make_shared<Ctxt>(ctxt); // nothing to do
-
-    const Context& context = ctxt.getContext();
-    const PubKey& pubKey = ctxt.getPubKey();
-
-    // empty ctxt
-    std::shared_ptr<Ctxt> result = std::make_shared<Ctxt>(ZeroCtxtLike, ctxt);
-    result->noiseBound = noise; // noise estimate
-    result->intFactor = ctxt.intFactor;
-
-    result->primeSet = ctxt.primeSet | context.getSpecialPrimes();
-    // VJS-NOTE: added this to make addPart work
-
-    if (ctxt.isCKKS()) {
-      result->ptxtMag = ctxt.ptxtMag;
-      double logProd = context.logOfProduct(context.getSpecialPrimes());
-      result->ratFactor = ctxt.ratFactor * NTL::xexp(logProd);
-    }
-
-    if (ctxt.parts.size() == 1) { // only constant part, no need to key-switch
-      CtxtPart tmpPart = ctxt.parts[0];
-      tmpPart.automorph(k);
-      tmpPart.addPrimesAndScale(context.getSpecialPrimes());
-      result->addPart(tmpPart, /*matchPrimeSet=*/true);
-      return result;
-    }
-
-    // Ensure that we have a key-switching matrices for this automorphism
-    long keyID = ctxt.getKeyID();
-    if (!pubKey.isReachable(k, keyID)) {
-      throw LogicError("no key-switching matrices for k=" + std::to_string(k) +
-                       ", keyID=" + std::to_string(keyID));
-    }
-
-    // Get the first key-switching matrix for this automorphism
-    const KeySwitch& W = pubKey.getNextKSWmatrix(k, keyID);
-    long amt = W.fromKey.getPowerOfX();
-
-    // Start by rotating the constant part, no need to key-switch it
-    CtxtPart tmpPart = ctxt.parts[0];
-    tmpPart.automorph(amt);
-    tmpPart.addPrimesAndScale(context.getSpecialPrimes());
-    result->addPart(tmpPart, /*matchPrimeSet=*/true);
-
-    // Then rotate the digits and key-switch them
-    std::vector<DoubleCRT> tmpDigits = polyDigits;
-    for (auto&& tmp : tmpDigits) // rotate each of the digits
-      tmp.automorph(amt);
-
-    result->keySwitchDigits(W, tmpDigits); // key-switch the digits
-
-    long m = context.getM();
-    if ((amt - k) % m != 0) { // amt != k (mod m), more automorphisms to do
-      k = NTL::MulMod(k, NTL::InvMod(amt, m), m); // k *= amt^{-1} mod m
-      result->smartAutomorph(k);                  // call usual smartAutomorph
-    }
-    return result;
-  }
-};
-
 class GeneralAutomorphPrecon
 {
 public:
@@ -264,12 +131,12 @@ public:
     precon.resize(h);
 
     // parallel for k in [0..h)
-    NTL_EXEC_RANGE(h, first, last)
+    HELIB_EXEC_RANGE(h, first, last)
     for (long k = first; k < last; k++) {
       std::shared_ptr<Ctxt> p = precon0.automorph(zMStar.genToPow(dim, g * k));
       precon[k] = std::make_shared<BasicAutomorphPrecon>(*p);
     }
-    NTL_EXEC_RANGE_END
+    HELIB_EXEC_RANGE_END
   }
 
   std::shared_ptr<Ctxt> automorph(long i) const override
@@ -314,16 +181,134 @@ std::shared_ptr<GeneralAutomorphPrecon> buildGeneralAutomorphPrecon(
 /********************************************************************/
 /****************** Linear transformation classes *******************/
 
+struct ConstMultiplierLRU
+{
+  std::mutex mutex; // guards everything below, and the hot copies
+  std::list<const ConstMultiplier*> order; // most recently used first
+  ConstMultiplierCacheStats stats;
+
+  explicit ConstMultiplierLRU(long budget) { stats.budget = budget; }
+};
+
 struct ConstMultiplier
 { // stores a constant in either zzX or DoubleCRT format
 
-  virtual ~ConstMultiplier() {}
+  virtual ~ConstMultiplier()
+  {
+    if (lru) {
+      std::lock_guard<std::mutex> lock(lru->mutex);
+      if (hot)
+        dropHot();
+    }
+  }
 
   virtual void mul(Ctxt& ctxt) const = 0;
 
   virtual std::shared_ptr<ConstMultiplier> upgrade(
       const Context& context) const = 0;
   // Upgrade to DCRT. Returns null if no upgrade required
+
+  virtual std::shared_ptr<ConstMultiplier> upgradeTo(
+      UNUSED const Context& context,
+      UNUSED const IndexSet& s) const
+  {
+    return nullptr;
+  }
+  // Upgrade to DCRT with the primes in s. Returns null if no upgrade required
+
+  virtual std::shared_ptr<ConstMultiplier> narrowTo(
+      UNUSED const IndexSet& s) const
+  {
+    return nullptr;
+  }
+  // A DCRT constant with only its primes in s. Returns null if it has no
+  // other primes, or none in s
+
+  virtual void writeTo(std::ostream& str) const = 0;
+  // Writes the kind of the constant (see below), then its data
+
+  // For zzX constants with an LRU: a DoubleCRT copy at the primes hotSet,
+  // and its position in lru->order. All guarded by lru->mutex.
+  std::shared_ptr<ConstMultiplierLRU> lru;
+  mutable std::shared_ptr<const ConstMultiplier> hot;
+  mutable IndexSet hotSet;
+  mutable long hotBytes = 0;
+  mutable std::list<const ConstMultiplier*>::iterator hotPos;
+
+  void dropHot() const
+  {
+    lru->order.erase(hotPos);
+    lru->stats.bytes -= hotBytes;
+    hot.reset();
+  }
+
+  // Multiply by the DoubleCRT copy at the primes of ctxt, making (and
+  // keeping, if it fits the budget) one if needed
+  void mulTiered(Ctxt& ctxt) const
+  {
+    const IndexSet& s = ctxt.getPrimeSet();
+    std::shared_ptr<const ConstMultiplier> h;
+    {
+      std::lock_guard<std::mutex> lock(lru->mutex);
+      if (hot && hotSet == s) {
+        lru->stats.hits++;
+        lru->order.splice(lru->order.begin(), lru->order, hotPos);
+        h = hot;
+      } else {
+        lru->stats.misses++;
+      }
+    }
+
+    if (!h) {
+      // Convert outside of the lock, other constants may be in use
+      const Context& context = ctxt.getContext();
+      {
+        MemoryScope memoryScope(MemoryCategory::MATMUL_CACHE);
+        h = upgradeTo(context, s);
+      }
+      long bytes = card(s) * context.getPhiM() * sizeof(long);
+
+      std::lock_guard<std::mutex> lock(lru->mutex);
+      if (hot)
+        dropHot(); // a copy at another level, or made by another thread
+      ConstMultiplierCacheStats& stats = lru->stats;
+      if (bytes <= stats.budget) {
+        while (stats.bytes + bytes > stats.budget) {
+          lru->order.back()->dropHot();
+          stats.evictions++;
+        }
+        hot = h;
+        hotSet = s;
+        hotBytes = bytes;
+        lru->order.push_front(this);
+        hotPos = lru->order.begin();
+        stats.bytes += bytes;
+      }
+    }
+
+    h->mul(ctxt);
+  }
+};
+
+// A DCRT constant at the primes in s, when it was upgraded at fewer of them
+// (see MatMulExecBase::upgrade). The coefficients of the constants are
+// small enough to be recovered from any of their primes.
+static DoubleCRT encodeAt(const DoubleCRT& data, const IndexSet& s)
+{
+  HELIB_TIMER_START;
+  NTL::ZZX poly;
+  data.toPoly(poly);
+  return DoubleCRT(poly, data.getContext(), s);
+}
+
+// The kinds of constants, as written by ConstMultiplier::writeTo
+enum ConstMultiplierKind : long
+{
+  CONST_MULTIPLIER_NONE = 0,
+  CONST_MULTIPLIER_ZZX = 1,
+  CONST_MULTIPLIER_DCRT = 2,
+  CONST_MULTIPLIER_ZZX_CKKS = 3,
+  CONST_MULTIPLIER_DCRT_CKKS = 4
 };
 
 struct ConstMultiplier_DoubleCRT : ConstMultiplier
@@ -335,13 +320,44 @@ struct ConstMultiplier_DoubleCRT : ConstMultiplier
       data(_data), sz(_sz)
   {}
 
-  void mul(Ctxt& ctxt) const override { ctxt.multByConstant(data, sz); }
+  ConstMultiplier_DoubleCRT(std::istream& str, const Context& context) :
+      data(context, IndexSet::emptySet())
+  {
+    data.read(str);
+    assertTrue<IOError>(data.getIndexSet() <= context.allPrimes(),
+                        "ConstMultiplier: unknown primes");
+    sz = read_raw_double(str);
+  }
+
+  void mul(Ctxt& ctxt) const override
+  {
+    if (ctxt.getPrimeSet() <= data.getIndexSet())
+      ctxt.multByConstant(data, sz);
+    else
+      ctxt.multByConstant(encodeAt(data, ctxt.getPrimeSet()), sz);
+  }
 
   std::shared_ptr<ConstMultiplier> upgrade(
       UNUSED const Context& context) const override
   {
     return nullptr;
   }
+
+  std::shared_ptr<ConstMultiplier> narrowTo(const IndexSet& s) const override
+  {
+    if (data.getIndexSet() <= s || data.getIndexSet().disjointFrom(s))
+      return nullptr;
+    DoubleCRT narrow(data);
+    narrow.removePrimes(data.getIndexSet() / s);
+    return std::make_shared<ConstMultiplier_DoubleCRT>(narrow, sz);
+  }
+
+  void writeTo(std::ostream& str) const override
+  {
+    write_raw_int(str, CONST_MULTIPLIER_DCRT);
+    data.writeTo(str);
+    write_raw_double(str, sz);
+  }
 };
 
 struct ConstMultiplier_zzX : ConstMultiplier
@@ -350,15 +366,39 @@ struct ConstMultiplier_zzX : ConstMultiplier
 
   ConstMultiplier_zzX(const zzX& _data) : data(_data) {}
 
-  void mul(Ctxt& ctxt) const override { ctxt.multByConstant(data); }
+  explicit ConstMultiplier_zzX(std::istream& str)
+  {
+    read_ntl_vec_long(str, data);
+  }
+
+  void mul(Ctxt& ctxt) const override
+  {
+    if (lru)
+      mulTiered(ctxt);
+    else
+      ctxt.multByConstant(data);
+  }
+
+  void writeTo(std::ostream& str) const override
+  {
+    write_raw_int(str, CONST_MULTIPLIER_ZZX);
+    write_ntl_vec_long(str, data);
+  }
 
   std::shared_ptr<ConstMultiplier> upgrade(
       const Context& context) const override
+  {
+    return upgradeTo(context, context.fullPrimes());
+  }
+
+  std::shared_ptr<ConstMultiplier> upgradeTo(
+      const Context& context,
+      const IndexSet& s) const override
   {
     double sz = embeddingLargestCoeff(data, context.getZMStar());
 
     return std::make_shared<ConstMultiplier_DoubleCRT>(
-        DoubleCRT(data, context, context.fullPrimes()),
+        DoubleCRT(data, context, s),
         sz);
   }
 };
@@ -407,18 +447,122 @@ void DestMulAdd(Ctxt& x, const std::shared_ptr<ConstMultiplier>& a, Ctxt& b)
   }
 }
 
+// acc[t] += a*b[t] for every t. The constant is converted to DoubleCRT
+// once for each distinct prime set among the b[t], rather than once per
+// ciphertext, and then applied to all of them in parallel.
+static void BatchMulAdd(std::vector<Ctxt>& acc,
+                        const std::shared_ptr<ConstMultiplier>& a,
+                        const std::vector<const Ctxt*>& b)
+{
+  if (!a)
+    return;
+
+  long n = b.size();
+  const Context& context = b[0]->getContext();
+
+  std::vector<IndexSet> sets;
+  std::vector<std::shared_ptr<ConstMultiplier>> forms;
+  std::vector<const ConstMultiplier*> use(n);
+  for (long t : range(n)) {
+    const IndexSet& s = b[t]->getPrimeSet();
+    long f = std::find(sets.begin(), sets.end(), s) - sets.begin();
+    if (f == long(sets.size())) {
+      sets.push_back(s);
+      forms.push_back(a->upgradeTo(context, s));
+    }
+    use[t] = forms[f] ? forms[f].get() : a.get();
+  }
+
+  HELIB_EXEC_RANGE(n, first, last)
+  for (long t : range(first, last)) {
+    Ctxt tmp(*b[t]);
+    use[t]->mul(tmp);
+    acc[t] += tmp;
+  }
+  HELIB_EXEC_RANGE_END
+}
+
 void ConstMultiplierCache::upgrade(const Context& context)
 {
   HELIB_TIMER_START;
+  MemoryScope memoryScope(MemoryCategory::MATMUL_CACHE);
 
   long n = multiplier.size();
-  NTL_EXEC_RANGE(n, first, last)
+  HELIB_EXEC_RANGE(n, first, last)
   for (long i : range(first, last)) {
     if (multiplier[i])
       if (auto newptr = multiplier[i]->upgrade(context))
         multiplier[i] = std::shared_ptr<ConstMultiplier>(newptr);
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
+}
+
+void ConstMultiplierCache::upgrade(const Context& context, const IndexSet& s)
+{
+  HELIB_TIMER_START;
+  MemoryScope memoryScope(MemoryCategory::MATMUL_CACHE);
+
+  long n = multiplier.size();
+  HELIB_EXEC_RANGE(n, first, last)
+  for (long i : range(first, last)) {
+    if (!multiplier[i])
+      continue;
+    auto newptr = multiplier[i]->upgradeTo(context, s);
+    if (!newptr)
+      newptr = multiplier[i]->narrowTo(s);
+    if (newptr)
+      multiplier[i] = newptr;
+  }
+  HELIB_EXEC_RANGE_END
+}
+
+void ConstMultiplierCache::setLRU(
+    const std::shared_ptr<ConstMultiplierLRU>& lru)
+{
+  for (auto& m : multiplier) {
+    if (!m)
+      continue;
+    if (m->lru) {
+      std::lock_guard<std::mutex> lock(m->lru->mutex);
+      if (m->hot)
+        m->dropHot();
+    }
+    m->lru = lru;
+  }
+}
+
+void MatMulExecBase::setMemoryBudget(long bytes)
+{
+  assertTrue(bytes >= 0, "setMemoryBudget: negative budget");
+  lru = std::make_shared<ConstMultiplierLRU>(bytes);
+  setLRU(lru);
+}
+
+void MatMulExecBase::mul(std::vector<Ctxt>& ctxts) const
+{
+  HELIB_EXEC_RANGE(long(ctxts.size()), first, last)
+  for (long t : range(first, last))
+    mul(ctxts[t]);
+  HELIB_EXEC_RANGE_END
+}
+
+ConstMultiplierCacheStats MatMulExecBase::getCacheStats() const
+{
+  if (!lru)
+    return ConstMultiplierCacheStats();
+  std::lock_guard<std::mutex> lock(lru->mutex);
+  return lru->stats;
+}
+
+std::vector<IndexSet> MatMulExecBase::getCachedPrimeSets() const
+{
+  std::vector<IndexSet> sets;
+  if (!lru)
+    return sets;
+  std::lock_guard<std::mutex> lock(lru->mutex);
+  for (const ConstMultiplier* m : lru->order)
+    sets.push_back(m->hotSet);
+  return sets;
 }
 
 static inline long dimSz(const EncryptedArray& ea, long dim)
@@ -601,6 +745,54 @@ template void MatMul1D_derived<PA_zz_p>::processDiagonal(
 
 #define ALT_MATMUL (1)
 
+// Given which diagonals are nonzero, decide whether the BSGS strategy
+// with giant step g still beats rotating straight to each nonzero
+// diagonal.  Only the baby and giant steps that meet a nonzero diagonal
+// are counted, since those are the only ones MatMul1DExec::mul performs.
+// We do not look for a different g: the key-switching matrices from
+// addSome1DMatrices are generated for g == KSGiantStepSize(D), and any
+// other split would need extra key switches per giant step.
+//
+// A straight rotation by i takes one key switch if there is a matrix for
+// it, and otherwise two (a baby step and a giant step). The matrices are
+// looked up in pubKey if given, and are otherwise those that
+// addSome1DMatrices generates: all of them for D up to
+// HELIB_KEYSWITCH_THRESH, and the baby and giant steps of g past that.
+static long sparseGiantStepSize(const std::vector<bool>& nonzero,
+                                long g,
+                                const PAlgebra& zMStar,
+                                long dim,
+                                const PubKey* pubKey)
+{
+  if (g == 0)
+    return 0;
+
+  long D = nonzero.size();
+  std::vector<bool> baby(g, false);
+  std::vector<bool> giant(divc(D, g), false);
+  long direct = 0;
+  for (long i : range(D)) {
+    if (!nonzero[i])
+      continue;
+    baby[i % g] = true;
+    giant[i / g] = true;
+    if (i == 0)
+      continue;
+    bool haveMatrix =
+        pubKey ? pubKey->haveKeySWmatrix(1, zMStar.genToPow(dim, i))
+               : (D <= HELIB_KEYSWITCH_THRESH || i < g || i % g == 0);
+    direct += haveMatrix ? 1 : 2;
+  }
+
+  long bsgs = 0;
+  for (long j : range(1, baby.size()))
+    bsgs += baby[j];
+  for (long k : range(1, giant.size()))
+    bsgs += giant[k];
+
+  return (direct <= bsgs) ? 0 : g;
+}
+
 template <typename type>
 struct MatMul1DExec_construct
 {
@@ -610,7 +802,9 @@ struct MatMul1DExec_construct
                     const MatMul1D& mat_basetype,
                     std::vector<std::shared_ptr<ConstMultiplier>>& vec,
                     std::vector<std::shared_ptr<ConstMultiplier>>& vec1,
-                    long g)
+                    long& g,
+                    bool minimal,
+                    const PubKey* pubKey)
   {
     const MatMul1D_partial<type>& mat =
         dynamic_cast<const MatMul1D_partial<type>&>(mat_basetype);
@@ -623,6 +817,17 @@ struct MatMul1DExec_construct
     bak.save();
     ea.getTab().restoreContext();
 
+    // The diagonals are pre-rotated according to the BSGS schedule,
+    // so we need all of them before we settle on g
+    std::vector<RX> diags(D);
+    std::vector<bool> nonzero(D);
+    for (long i : range(D)) {
+      mat.processDiagonal(diags[i], i, ea);
+      nonzero[i] = !IsZero(diags[i]);
+    }
+    if (!minimal)
+      g = sparseGiantStepSize(nonzero, g, ea.getPAlgebra(), dim, pubKey);
+
     if (native) {
 
       vec.resize(D);
@@ -637,9 +842,7 @@ struct MatMul1DExec_construct
           k = 1;
         }
 
-        RX poly;
-        mat.processDiagonal(poly, i, ea);
-        vec[i] = build_ConstMultiplier(poly, dim, -g * k, ea);
+        vec[i] = build_ConstMultiplier(diags[i], dim, -g * k, ea);
       }
     } else {
       vec.resize(D);
@@ -655,8 +858,7 @@ struct MatMul1DExec_construct
           k = 1;
         }
 
-        RX poly;
-        mat.processDiagonal(poly, i, ea);
+        const RX& poly = diags[i];
 
         if (IsZero(poly)) {
           vec[i] = nullptr;
@@ -750,13 +952,62 @@ struct ConstMultiplier_DoubleCRT_CKKS : ConstMultiplier
     feptxt.expand(eptxt, s);
   }
 
-  void mul(Ctxt& ctxt) const override { ctxt *= feptxt; }
+  ConstMultiplier_DoubleCRT_CKKS(std::istream& str, const Context& context)
+  {
+    DoubleCRT dcrt(context, IndexSet::emptySet());
+    dcrt.read(str);
+    assertTrue<IOError>(dcrt.getIndexSet() <= context.allPrimes(),
+                        "ConstMultiplier: unknown primes");
+    double mag = read_raw_double(str);
+    double scale = read_raw_double(str);
+    double err = read_raw_double(str);
+    feptxt.resetCKKS(dcrt, mag, scale, err);
+  }
+
+  ConstMultiplier_DoubleCRT_CKKS(const FatEncodedPtxt_CKKS& rep,
+                                 const DoubleCRT& dcrt)
+  {
+    feptxt.resetCKKS(dcrt, rep.getMag(), rep.getScale(), rep.getErr());
+  }
+
+  void mul(Ctxt& ctxt) const override
+  {
+    const FatEncodedPtxt_CKKS& rep = feptxt.getCKKS();
+    if (ctxt.getPrimeSet() <= rep.getDCRT().getIndexSet())
+      ctxt *= feptxt;
+    else
+      ConstMultiplier_DoubleCRT_CKKS(rep,
+                                     encodeAt(rep.getDCRT(),
+                                              ctxt.getPrimeSet()))
+          .mul(ctxt);
+  }
 
   std::shared_ptr<ConstMultiplier> upgrade(
       UNUSED const Context& context) const override
   {
     return nullptr;
   }
+
+  std::shared_ptr<ConstMultiplier> narrowTo(const IndexSet& s) const override
+  {
+    const FatEncodedPtxt_CKKS& rep = feptxt.getCKKS();
+    const IndexSet& primes = rep.getDCRT().getIndexSet();
+    if (primes <= s || primes.disjointFrom(s))
+      return nullptr;
+    DoubleCRT narrow(rep.getDCRT());
+    narrow.removePrimes(primes / s);
+    return std::make_shared<ConstMultiplier_DoubleCRT_CKKS>(rep, narrow);
+  }
+
+  void writeTo(std::ostream& str) const override
+  {
+    const FatEncodedPtxt_CKKS& rep = feptxt.getCKKS();
+    write_raw_int(str, CONST_MULTIPLIER_DCRT_CKKS);
+    rep.getDCRT().writeTo(str);
+    write_raw_double(str, rep.getMag());
+    write_raw_double(str, rep.getScale());
+    write_raw_double(str, rep.getErr());
+  }
 };
 
 struct ConstMultiplier_zzX_CKKS : ConstMultiplier
@@ -769,14 +1020,45 @@ struct ConstMultiplier_zzX_CKKS : ConstMultiplier
     ea.encode(eptxt, diag);
   }
 
-  void mul(Ctxt& ctxt) const override { ctxt *= eptxt; }
+  ConstMultiplier_zzX_CKKS(std::istream& str, const Context& context)
+  {
+    zzX poly;
+    read_ntl_vec_long(str, poly);
+    double mag = read_raw_double(str);
+    double scale = read_raw_double(str);
+    double err = read_raw_double(str);
+    eptxt.resetCKKS(poly, mag, scale, err, context);
+  }
+
+  void mul(Ctxt& ctxt) const override
+  {
+    if (lru)
+      mulTiered(ctxt);
+    else
+      ctxt *= eptxt;
+  }
 
   std::shared_ptr<ConstMultiplier> upgrade(
       const Context& context) const override
   {
-    return std::make_shared<ConstMultiplier_DoubleCRT_CKKS>(
-        eptxt,
-        context.fullPrimes());
+    return upgradeTo(context, context.fullPrimes());
+  }
+
+  std::shared_ptr<ConstMultiplier> upgradeTo(
+      UNUSED const Context& context,
+      const IndexSet& s) const override
+  {
+    return std::make_shared<ConstMultiplier_DoubleCRT_CKKS>(eptxt, s);
+  }
+
+  void writeTo(std::ostream& str) const override
+  {
+    const EncodedPtxt_CKKS& rep = eptxt.getCKKS();
+    write_raw_int(str, CONST_MULTIPLIER_ZZX_CKKS);
+    write_ntl_vec_long(str, rep.getPoly());
+    write_raw_double(str, rep.getMag());
+    write_raw_double(str, rep.getScale());
+    write_raw_double(str, rep.getErr());
   }
 };
 
@@ -804,7 +1086,9 @@ static void MatMul1DExec_construct_CKKS(
     const EncryptedArrayCx& ea,
     const MatMul1D& mat_basetype,
     std::vector<std::shared_ptr<ConstMultiplier>>& vec,
-    long g)
+    long& g,
+    bool minimal,
+    const PubKey* pubKey)
 {
   const MatMul1D_CKKS& mat = dynamic_cast<const MatMul1D_CKKS&>(mat_basetype);
 
@@ -815,6 +1099,15 @@ static void MatMul1DExec_construct_CKKS(
   if (dim != 0 || D != ea.size() || !native)
     throw LogicError("MatMul1DExec_construct_CKKS: bad params");
 
+  std::vector<std::vector<std::complex<double>>> diags(D);
+  std::vector<bool> nonzero(D);
+  for (long i : range(D)) {
+    mat.processDiagonal(diags[i], i, ea);
+    nonzero[i] = Norm(diags[i]) != 0.0;
+  }
+  if (!minimal)
+    g = sparseGiantStepSize(nonzero, g, ea.getPAlgebra(), dim, pubKey);
+
   vec.resize(D);
 
   for (long i : range(D)) {
@@ -827,9 +1120,7 @@ static void MatMul1DExec_construct_CKKS(
       k = 1;
     }
 
-    std::vector<std::complex<double>> diag;
-    mat.processDiagonal(diag, i, ea);
-    vec[i] = build_ConstMultiplier_CKKS(diag, -g * k, ea);
+    vec[i] = build_ConstMultiplier_CKKS(diags[i], -g * k, ea);
   }
 }
 
@@ -842,7 +1133,9 @@ static void MatMul1DExec_construct_CKKS(
 //    set to 1 to always use BSGS
 //    set to infty to never use BSGS
 
-MatMul1DExec::MatMul1DExec(const MatMul1D& mat, bool _minimal) :
+MatMul1DExec::MatMul1DExec(const MatMul1D& mat,
+                           bool _minimal,
+                           const PubKey* pubKey) :
     ea(mat.getEA()), minimal(_minimal)
 {
   HELIB_NTIMER_START(MatMul1DExec);
@@ -872,13 +1165,45 @@ MatMul1DExec::MatMul1DExec(const MatMul1D& mat, bool _minimal) :
     g = KSGiantStepSize(D); // use BSGS
 
   if (ea.getTag() == PA_cx_tag) {
-    MatMul1DExec_construct_CKKS(ea.getCx(), mat, cache.multiplier, g);
+    MatMul1DExec_construct_CKKS(ea.getCx(),
+                                mat,
+                                cache.multiplier,
+                                g,
+                                minimal,
+                                pubKey);
   } else {
     ea.dispatch<MatMul1DExec_construct>(mat,
                                         cache.multiplier,
                                         cache1.multiplier,
-                                        g);
+                                        g,
+                                        minimal,
+                                        pubKey);
   }
+
+  buildSchedule();
+}
+
+void MatMul1DExec::buildSchedule()
+{
+  babySteps.clear();
+  giantSteps.clear();
+
+  std::vector<bool> baby(g ? g : D, false);
+  std::vector<bool> giant(g ? divc(D, g) : 1, false);
+  for (long i : range(D)) {
+    if (!cache.multiplier[i] && (native || !cache1.multiplier[i]))
+      continue;
+    baby[g ? i % g : i] = true;
+    giant[g ? i / g : 0] = true;
+  }
+
+  for (long j : range(baby.size()))
+    if (baby[j])
+      babySteps.push_back(j);
+  if (!babySteps.empty())
+    for (long k : range(giant.size()))
+      if (giant[k])
+        giantSteps.push_back(k);
 }
 
 /***************************************************************************
@@ -924,15 +1249,18 @@ So putting it all together
 
 ***************************************************************************/
 
+// Sets v[j] = rot^j(ctxt) for each j in steps; the other entries of v
+// are left alone.
 void GenBabySteps(std::vector<std::shared_ptr<Ctxt>>& v,
                   const Ctxt& ctxt,
                   long dim,
-                  bool clean)
+                  bool clean,
+                  const std::vector<long>& steps)
 {
-  long n = v.size();
-  assertTrue<InvalidArgument>(n > 0, "Empty vector v");
+  long n = steps.size();
+  assertTrue<InvalidArgument>(n > 0, "Empty vector of baby steps");
 
-  if (n == 1) {
+  if (n == 1 && steps[0] == 0) {
     v[0] = std::make_shared<Ctxt>(ctxt);
     if (clean)
       v[0]->cleanUp();
@@ -948,25 +1276,27 @@ void GenBabySteps(std::vector<std::shared_ptr<Ctxt>>& v,
       ctxt.getPubKey().getKSStrategy(dim) != HELIB_KSS_UNKNOWN) {
     BasicAutomorphPrecon precon(ctxt);
 
-    NTL_EXEC_RANGE(n, first, last)
-    for (long j : range(first, last)) {
+    HELIB_EXEC_RANGE(n, first, last)
+    for (long t : range(first, last)) {
+      long j = steps[t];
       v[j] = precon.automorph(zMStar.genToPow(dim, j));
       if (clean)
         v[j]->cleanUp();
     }
-    NTL_EXEC_RANGE_END
+    HELIB_EXEC_RANGE_END
   } else {
     Ctxt ctxt0(ctxt);
     ctxt0.cleanUp();
 
-    NTL_EXEC_RANGE(n, first, last)
-    for (long j : range(first, last)) {
+    HELIB_EXEC_RANGE(n, first, last)
+    for (long t : range(first, last)) {
+      long j = steps[t];
       v[j] = std::make_shared<Ctxt>(ctxt0);
       v[j]->smartAutomorph(zMStar.genToPow(dim, j));
       if (clean)
         v[j]->cleanUp();
     }
-    NTL_EXEC_RANGE_END
+    HELIB_EXEC_RANGE_END
   }
 }
 
@@ -982,6 +1312,12 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
 
   ctxt.cleanUp();
 
+  if (babySteps.empty()) {
+    // all diagonals are zero
+    ctxt = Ctxt(ZeroCtxtLike, ctxt);
+    return;
+  }
+
   bool iterative = false;
   if (ctxt.getPubKey().getKSStrategy(dim) == HELIB_KSS_MIN)
     iterative = true;
@@ -995,13 +1331,13 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
 
         std::vector<Ctxt> baby_steps(g, Ctxt(ZeroCtxtLike, ctxt));
         baby_steps[0] = ctxt;
-        for (long j : range(1, g)) {
+        for (long j : range(1, babySteps.back() + 1)) {
           baby_steps[j] = baby_steps[j - 1];
           baby_steps[j].smartAutomorph(zMStar.genToPow(dim, 1));
           baby_steps[j].cleanUp();
         }
 
-        long h = divc(D, g);
+        long h = giantSteps.back() + 1;
         Ctxt sum(ZeroCtxtLike, ctxt);
         for (long k = h - 1; k >= 0; k--) {
           if (k < h - 1) {
@@ -1009,7 +1345,7 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
             sum.cleanUp();
           }
 
-          for (long j : range(g)) {
+          for (long j : babySteps) {
             long i = j + g * k;
             if (i >= D)
               break;
@@ -1021,24 +1357,27 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
 
       } else {
 
-        long h = divc(D, g);
+        long h = giantSteps.size();
         std::vector<std::shared_ptr<Ctxt>> baby_steps(g);
-        GenBabySteps(baby_steps, ctxt, dim, true);
+        // The baby steps stay over the special primes, and so does each
+        // giant step: it is only brought down for key switching
+        GenBabySteps(baby_steps, ctxt, dim, false, babySteps);
 
-        NTL::PartitionInfo pinfo(h);
+        NTL::PartitionInfo pinfo(h, helib::AvailableThreads());
         long cnt = pinfo.NumIntervals();
 
         std::vector<Ctxt> acc(cnt, Ctxt(ZeroCtxtLike, ctxt));
 
-        // parallel for loop: k in [0..h)
-        NTL_EXEC_INDEX(cnt, index)
+        // parallel for loop over the giant steps
+        HELIB_EXEC_INDEX(cnt, index)
         long first, last;
         pinfo.interval(first, last, index);
 
-        for (long k : range(first, last)) {
+        for (long t : range(first, last)) {
+          long k = giantSteps[t];
           Ctxt acc_inner(ZeroCtxtLike, ctxt);
 
-          for (long j : range(g)) {
+          for (long j : babySteps) {
             long i = j + g * k;
             if (i >= D)
               break;
@@ -1046,10 +1385,10 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
           }
 
           if (k > 0)
-            acc_inner.smartAutomorph(zMStar.genToPow(dim, g * k));
+            acc_inner.lazySmartAutomorph(zMStar.genToPow(dim, g * k));
           acc[index] += acc_inner;
         }
-        NTL_EXEC_INDEX_END
+        HELIB_EXEC_INDEX_END
 
         ctxt = acc[0];
         for (long i : range(1, cnt))
@@ -1061,7 +1400,7 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
 
         std::vector<Ctxt> baby_steps(g, Ctxt(ZeroCtxtLike, ctxt));
         baby_steps[0] = ctxt;
-        for (long j : range(1, g)) {
+        for (long j : range(1, babySteps.back() + 1)) {
           baby_steps[j] = baby_steps[j - 1];
           baby_steps[j].smartAutomorph(zMStar.genToPow(dim, 1));
           baby_steps[j].cleanUp();
@@ -1071,13 +1410,13 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
         baby_steps1[0] = ctxt;
         baby_steps1[0].smartAutomorph(zMStar.genToPow(dim, -D));
 
-        for (long j : range(1, g)) {
+        for (long j : range(1, babySteps.back() + 1)) {
           baby_steps1[j] = baby_steps1[j - 1];
           baby_steps1[j].smartAutomorph(zMStar.genToPow(dim, 1));
           baby_steps1[j].cleanUp();
         }
 
-        long h = divc(D, g);
+        long h = giantSteps.back() + 1;
         Ctxt sum(ZeroCtxtLike, ctxt);
         for (long k = h - 1; k >= 0; k--) {
           if (k < h - 1) {
@@ -1085,7 +1424,7 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
             sum.cleanUp();
           }
 
-          for (long j : range(g)) {
+          for (long j : babySteps) {
             long i = j + g * k;
             if (i >= D)
               break;
@@ -1095,31 +1434,32 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
         }
         ctxt = sum;
       } else {
-        long h = divc(D, g);
+        long h = giantSteps.size();
         std::vector<std::shared_ptr<Ctxt>> baby_steps(g);
         std::vector<std::shared_ptr<Ctxt>> baby_steps1(g);
 
-        GenBabySteps(baby_steps, ctxt, dim, false);
+        GenBabySteps(baby_steps, ctxt, dim, false, babySteps);
 
         Ctxt ctxt1(ctxt);
         ctxt1.smartAutomorph(zMStar.genToPow(dim, -D));
-        GenBabySteps(baby_steps1, ctxt1, dim, false);
+        GenBabySteps(baby_steps1, ctxt1, dim, false, babySteps);
 
-        NTL::PartitionInfo pinfo(h);
+        NTL::PartitionInfo pinfo(h, helib::AvailableThreads());
         long cnt = pinfo.NumIntervals();
 
         std::vector<Ctxt> acc(cnt, Ctxt(ZeroCtxtLike, ctxt));
 
-        // parallel for loop: k in [0..h)
-        NTL_EXEC_INDEX(cnt, index)
+        // parallel for loop over the giant steps
+        HELIB_EXEC_INDEX(cnt, index)
 
         long first, last;
         pinfo.interval(first, last, index);
 
-        for (long k : range(first, last)) {
+        for (long t : range(first, last)) {
+          long k = giantSteps[t];
           Ctxt acc_inner(ZeroCtxtLike, ctxt);
 
-          for (long j : range(g)) {
+          for (long j : babySteps) {
             long i = j + g * k;
             if (i >= D)
               break;
@@ -1128,13 +1468,13 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
           }
 
           if (k > 0) {
-            acc_inner.smartAutomorph(zMStar.genToPow(dim, g * k));
+            acc_inner.lazySmartAutomorph(zMStar.genToPow(dim, g * k));
           }
 
           acc[index] += acc_inner;
         }
 
-        NTL_EXEC_INDEX_END
+        HELIB_EXEC_INDEX_END
 
         for (long i : range(1, cnt))
           acc[0] += acc[i];
@@ -1145,13 +1485,13 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
 
         std::vector<Ctxt> baby_steps(g, Ctxt(ZeroCtxtLike, ctxt));
         baby_steps[0] = ctxt;
-        for (long j : range(1, g)) {
+        for (long j : range(1, babySteps.back() + 1)) {
           baby_steps[j] = baby_steps[j - 1];
           baby_steps[j].smartAutomorph(zMStar.genToPow(dim, 1));
           baby_steps[j].cleanUp();
         }
 
-        long h = divc(D, g);
+        long h = giantSteps.back() + 1;
         Ctxt sum(ZeroCtxtLike, ctxt);
         Ctxt sum1(ZeroCtxtLike, ctxt);
         for (long k = h - 1; k >= 0; k--) {
@@ -1162,7 +1502,7 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
             sum1.cleanUp();
           }
 
-          for (long j : range(g)) {
+          for (long j : babySteps) {
             long i = j + g * k;
             if (i >= D)
               break;
@@ -1174,27 +1514,28 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
         sum += sum1;
         ctxt = sum;
       } else {
-        long h = divc(D, g);
+        long h = giantSteps.size();
         std::vector<std::shared_ptr<Ctxt>> baby_steps(g);
-        GenBabySteps(baby_steps, ctxt, dim, true);
+        GenBabySteps(baby_steps, ctxt, dim, true, babySteps);
 
-        NTL::PartitionInfo pinfo(h);
+        NTL::PartitionInfo pinfo(h, helib::AvailableThreads());
         long cnt = pinfo.NumIntervals();
 
         std::vector<Ctxt> acc(cnt, Ctxt(ZeroCtxtLike, ctxt));
         std::vector<Ctxt> acc1(cnt, Ctxt(ZeroCtxtLike, ctxt));
 
-        // parallel for loop: k in [0..h)
-        NTL_EXEC_INDEX(cnt, index)
+        // parallel for loop over the giant steps
+        HELIB_EXEC_INDEX(cnt, index)
 
         long first, last;
         pinfo.interval(first, last, index);
 
-        for (long k : range(first, last)) {
+        for (long t : range(first, last)) {
+          long k = giantSteps[t];
           Ctxt acc_inner(ZeroCtxtLike, ctxt);
           Ctxt acc_inner1(ZeroCtxtLike, ctxt);
 
-          for (long j : range(g)) {
+          for (long j : babySteps) {
             long i = j + g * k;
             if (i >= D)
               break;
@@ -1210,7 +1551,7 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
           acc[index] += acc_inner;
           acc1[index] += acc_inner1;
         }
-        NTL_EXEC_INDEX_END
+        HELIB_EXEC_INDEX_END
 
         for (long i : range(1, cnt))
           acc[0] += acc[i];
@@ -1228,23 +1569,23 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
       std::shared_ptr<GeneralAutomorphPrecon> precon =
           buildGeneralAutomorphPrecon(ctxt, dim, ea);
 
-      NTL::PartitionInfo pinfo(D);
+      NTL::PartitionInfo pinfo(babySteps.size(),
+                               helib::AvailableThreads());
       long cnt = pinfo.NumIntervals();
 
       std::vector<Ctxt> acc(cnt, Ctxt(ZeroCtxtLike, ctxt));
 
-      // parallel for loop: i in [0..D)
-      NTL_EXEC_INDEX(cnt, index)
+      // parallel for loop over the nonzero diagonals
+      HELIB_EXEC_INDEX(cnt, index)
       long first, last;
       pinfo.interval(first, last, index);
 
-      for (long i : range(first, last)) {
-        if (cache.multiplier[i]) {
-          std::shared_ptr<Ctxt> tmp = precon->automorph(i);
-          DestMulAdd(acc[index], cache.multiplier[i], *tmp);
-        }
+      for (long t : range(first, last)) {
+        long i = babySteps[t];
+        std::shared_ptr<Ctxt> tmp = precon->automorph(i);
+        DestMulAdd(acc[index], cache.multiplier[i], *tmp);
       }
-      NTL_EXEC_INDEX_END
+      HELIB_EXEC_INDEX_END
 
       ctxt = acc[0];
       for (long i : range(1, cnt)) {
@@ -1254,25 +1595,25 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
       std::shared_ptr<GeneralAutomorphPrecon> precon =
           buildGeneralAutomorphPrecon(ctxt, dim, ea);
 
-      NTL::PartitionInfo pinfo(D);
+      NTL::PartitionInfo pinfo(babySteps.size(),
+                               helib::AvailableThreads());
       long cnt = pinfo.NumIntervals();
 
       std::vector<Ctxt> acc(cnt, Ctxt(ZeroCtxtLike, ctxt));
       std::vector<Ctxt> acc1(cnt, Ctxt(ZeroCtxtLike, ctxt));
 
-      // parallel for loop: i in [0..D)
-      NTL_EXEC_INDEX(cnt, index)
+      // parallel for loop over the nonzero diagonals
+      HELIB_EXEC_INDEX(cnt, index)
       long first, last;
       pinfo.interval(first, last, index);
 
-      for (long i : range(first, last)) {
-        if (cache.multiplier[i] || cache1.multiplier[i]) {
-          std::shared_ptr<Ctxt> tmp = precon->automorph(i);
-          MulAdd(acc[index], cache.multiplier[i], *tmp);
-          DestMulAdd(acc1[index], cache1.multiplier[i], *tmp);
-        }
+      for (long t : range(first, last)) {
+        long i = babySteps[t];
+        std::shared_ptr<Ctxt> tmp = precon->automorph(i);
+        MulAdd(acc[index], cache.multiplier[i], *tmp);
+        DestMulAdd(acc1[index], cache1.multiplier[i], *tmp);
       }
-      NTL_EXEC_INDEX_END
+      HELIB_EXEC_INDEX_END
 
       for (long i : range(1, cnt))
         acc[0] += acc[i];
@@ -1288,7 +1629,7 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
       Ctxt acc(ZeroCtxtLike, ctxt);
       Ctxt sh_ctxt(ctxt);
 
-      for (long i : range(D)) {
+      for (long i : range(babySteps.back() + 1)) {
         if (i > 0) {
           sh_ctxt.smartAutomorph(zMStar.genToPow(dim, 1));
           sh_ctxt.cleanUp();
@@ -1302,7 +1643,7 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
       Ctxt acc1(ZeroCtxtLike, ctxt);
       Ctxt sh_ctxt(ctxt);
 
-      for (long i : range(D)) {
+      for (long i : range(babySteps.back() + 1)) {
         if (i > 0) {
           sh_ctxt.smartAutomorph(zMStar.genToPow(dim, 1));
           sh_ctxt.cleanUp();
@@ -1318,6 +1659,101 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
   }
 }
 
+// The batch version follows the same schedule as mul(Ctxt&), but with the
+// loop over the ciphertexts innermost: each constant is encoded once for
+// the whole batch, and each giant step uses its key-switching matrices on
+// all the ciphertexts in turn. Only the native, non-iterative strategies
+// are batched; the others run mul(Ctxt&) on each ciphertext in parallel.
+void MatMul1DExec::mul(std::vector<Ctxt>& ctxts) const
+{
+  HELIB_NTIMER_START(mul_MatMul1DExec_batch);
+
+  long n = ctxts.size();
+  if (n == 0)
+    return;
+
+  for (const Ctxt& ctxt : ctxts)
+    assertEq(&ea.getContext(),
+             &ctxt.getContext(),
+             "Cannot multiply ciphertexts with context different to "
+             "encrypted array one");
+
+  bool iterative = false;
+  for (const Ctxt& ctxt : ctxts)
+    if (ctxt.getPubKey().getKSStrategy(dim) == HELIB_KSS_MIN)
+      iterative = true;
+
+  if (n == 1 || !native || iterative || babySteps.empty()) {
+    MatMulExecBase::mul(ctxts);
+    return;
+  }
+
+  const PAlgebra& zMStar = ea.getPAlgebra();
+
+  std::vector<Ctxt> acc;
+  acc.reserve(n);
+  for (const Ctxt& ctxt : ctxts)
+    acc.emplace_back(ZeroCtxtLike, ctxt);
+  std::vector<const Ctxt*> b(n);
+
+  if (g != 0) {
+    // baby_steps[t][j] = rot^j(ctxts[t]), over the special primes
+    std::vector<std::vector<std::shared_ptr<Ctxt>>> baby_steps(n);
+    HELIB_EXEC_RANGE(n, first, last)
+    for (long t : range(first, last)) {
+      ctxts[t].cleanUp();
+      baby_steps[t].resize(g);
+      GenBabySteps(baby_steps[t], ctxts[t], dim, false, babySteps);
+    }
+    HELIB_EXEC_RANGE_END
+
+    std::vector<Ctxt> acc_inner(acc);
+    for (long k : giantSteps) {
+      for (long t : range(n))
+        acc_inner[t] = Ctxt(ZeroCtxtLike, ctxts[t]);
+
+      for (long j : babySteps) {
+        long i = j + g * k;
+        if (i >= D)
+          break;
+        for (long t : range(n))
+          b[t] = baby_steps[t][j].get();
+        BatchMulAdd(acc_inner, cache.multiplier[i], b);
+      }
+
+      HELIB_EXEC_RANGE(n, first, last)
+      for (long t : range(first, last)) {
+        if (k > 0)
+          acc_inner[t].lazySmartAutomorph(zMStar.genToPow(dim, g * k));
+        acc[t] += acc_inner[t];
+      }
+      HELIB_EXEC_RANGE_END
+    }
+  } else {
+    std::vector<std::shared_ptr<GeneralAutomorphPrecon>> precon(n);
+    HELIB_EXEC_RANGE(n, first, last)
+    for (long t : range(first, last)) {
+      ctxts[t].cleanUp();
+      precon[t] = buildGeneralAutomorphPrecon(ctxts[t], dim, ea);
+    }
+    HELIB_EXEC_RANGE_END
+
+    std::vector<std::shared_ptr<Ctxt>> rotated(n);
+    for (long i : babySteps) {
+      HELIB_EXEC_RANGE(n, first, last)
+      for (long t : range(first, last))
+        rotated[t] = precon[t]->automorph(i);
+      HELIB_EXEC_RANGE_END
+
+      for (long t : range(n))
+        b[t] = rotated[t].get();
+      BatchMulAdd(acc, cache.multiplier[i], b);
+    }
+  }
+
+  ctxts.swap(acc);
+}
+
 // ========================== BlockMatMul1D stuff =====================
 
 template <typename type>
@@ -1776,7 +2212,7 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
   if (ctxt.getPubKey().getKSStrategy(dim1) == HELIB_KSS_MIN)
     iterative1 = true;
   if (ctxt.getPubKey().getKSStrategy(dim1) != HELIB_KSS_FULL &&
-      NTL::AvailableThreads() == 1)
+      helib::AvailableThreads() == 1)
     iterative1 = true;
 
   if (native) {
@@ -1801,7 +2237,7 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
           buildGeneralAutomorphPrecon(ctxt, dim0, ea);
 
       long par_buf_sz = 1;
-      if (NTL::AvailableThreads() > 1)
+      if (helib::AvailableThreads() > 1)
         par_buf_sz = std::min(d0, par_buf_max);
 
       std::vector<std::shared_ptr<Ctxt>> par_buf(par_buf_sz);
@@ -1812,16 +2248,16 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
         // for i in [first_i..last_i), generate automorphism i and store
         // in par_buf[i-first_i]
 
-        NTL_EXEC_RANGE(last_i - first_i, first, last)
+        HELIB_EXEC_RANGE(last_i - first_i, first, last)
 
         for (long idx : range(first, last)) {
           long i = idx + first_i;
           par_buf[idx] = precon->automorph(i);
         }
 
-        NTL_EXEC_RANGE_END
+        HELIB_EXEC_RANGE_END
 
-        NTL_EXEC_RANGE(d1, first, last)
+        HELIB_EXEC_RANGE(d1, first, last)
 
         for (long j : range(first, last)) {
           for (long i : range(first_i, last_i)) {
@@ -1829,7 +2265,7 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
           }
         }
 
-        NTL_EXEC_RANGE_END
+        HELIB_EXEC_RANGE_END
       }
     }
 
@@ -1846,13 +2282,13 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
 
     } else {
 
-      NTL::PartitionInfo pinfo(d1);
+      NTL::PartitionInfo pinfo(d1, helib::AvailableThreads());
       long cnt = pinfo.NumIntervals();
 
       std::vector<Ctxt> sum(cnt, Ctxt(ZeroCtxtLike, ctxt));
 
       // for j in [0..d1)
-      NTL_EXEC_INDEX(cnt, index)
+      HELIB_EXEC_INDEX(cnt, index)
       long first, last;
       pinfo.interval(first, last, index);
       for (long j : range(first, last)) {
@@ -1860,7 +2296,7 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
           acc[j].smartAutomorph(zMStar.genToPow(dim1, j));
         sum[index] += acc[j];
       }
-      NTL_EXEC_INDEX_END
+      HELIB_EXEC_INDEX_END
 
       ctxt = sum[0];
       for (long i : range(1, cnt))
@@ -1890,7 +2326,7 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
           buildGeneralAutomorphPrecon(ctxt, dim0, ea);
 
       long par_buf_sz = 1;
-      if (NTL::AvailableThreads() > 1)
+      if (helib::AvailableThreads() > 1)
         par_buf_sz = std::min(d0, par_buf_max);
 
       std::vector<std::shared_ptr<Ctxt>> par_buf(par_buf_sz);
@@ -1901,16 +2337,16 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
         // for i in [first_i..last_i), generate automorphism i and store
         // in par_buf[i-first_i]
 
-        NTL_EXEC_RANGE(last_i - first_i, first, last)
+        HELIB_EXEC_RANGE(last_i - first_i, first, last)
 
         for (long idx : range(first, last)) {
           long i = idx + first_i;
           par_buf[idx] = precon->automorph(i);
         }
 
-        NTL_EXEC_RANGE_END
+        HELIB_EXEC_RANGE_END
 
-        NTL_EXEC_RANGE(d1, first, last)
+        HELIB_EXEC_RANGE(d1, first, last)
 
         for (long j : range(first, last)) {
           for (long i : range(first_i, last_i)) {
@@ -1921,7 +2357,7 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
           }
         }
 
-        NTL_EXEC_RANGE_END
+        HELIB_EXEC_RANGE_END
       }
     }
 
@@ -1944,14 +2380,14 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
       ctxt += sum1;
     } else {
 
-      NTL::PartitionInfo pinfo(d1);
+      NTL::PartitionInfo pinfo(d1, helib::AvailableThreads());
       long cnt = pinfo.NumIntervals();
 
       std::vector<Ctxt> sum(cnt, Ctxt(ZeroCtxtLike, ctxt));
       std::vector<Ctxt> sum1(cnt, Ctxt(ZeroCtxtLike, ctxt));
 
       // for j in [0..d1)
-      NTL_EXEC_INDEX(cnt, index)
+      HELIB_EXEC_INDEX(cnt, index)
       long first, last;
       pinfo.interval(first, last, index);
       for (long j : range(first, last)) {
@@ -1962,7 +2398,7 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
         sum[index] += acc[j];
         sum1[index] += acc1[j];
       }
-      NTL_EXEC_INDEX_END
+      HELIB_EXEC_INDEX_END
 
       for (long i : range(1, cnt))
         sum[0] += sum[i];
@@ -2137,6 +2573,211 @@ MatMulFullExec::MatMulFullExec(const MatMulFull& mat, bool _minimal) :
   ea.dispatch<MatMulFullExec_construct>(ea, mat, transforms, minimal, dims);
 }
 
+// In a bad dimension, tmp = rot^i(ctxt) and tmp1 = rot^{i-D}(ctxt) are
+// combined into a rotation by i, using the mask for dimension dim.
+// tmp1 is destroyed.
+static void combineRotations(Ctxt& tmp,
+                             Ctxt& tmp1,
+                             long dim,
+                             long i,
+                             const EncryptedArray& ea)
+{
+  const PAlgebra& zMStar = ea.getPAlgebra();
+  zzX mask = ea.getAlMod().getMask_zzX(dim, i);
+  double sz = embeddingLargestCoeff(mask, zMStar);
+
+  DoubleCRT m1(mask, ea.getContext(), tmp.getPrimeSet() | tmp1.getPrimeSet());
+
+  // Compute tmp = tmp*m1 + tmp1 - tmp1*m1
+  tmp.multByConstant(m1, sz);
+  tmp += tmp1;
+  tmp1.multByConstant(m1, sz);
+  tmp -= tmp1;
+}
+
+// Are transforms[first..last) all the zero matrix?
+static bool allZero(const std::vector<MatMul1DExec>& transforms,
+                    long first,
+                    long last)
+{
+  for (long i : range(first, last))
+    if (!transforms[i].babySteps.empty())
+      return false;
+  return true;
+}
+
+// rotated[i] is set to ctxt rotated by i in dimension dim, for the i with
+// wanted[i], and left empty otherwise. These are the same rotations as those
+// of rec_mul, with those made from a shared precon done in parallel.
+static void rotationsOfDim(std::vector<std::unique_ptr<Ctxt>>& rotated,
+                           const Ctxt& ctxt,
+                           long dim,
+                           const std::vector<bool>& wanted,
+                           const EncryptedArray& ea)
+{
+  long sdim = ea.sizeOfDimension(dim);
+  bool native = ea.nativeDimension(dim);
+  const PAlgebra& zMStar = ea.getPAlgebra();
+  rotated.clear();
+  rotated.resize(sdim);
+
+  if (ctxt.getPubKey().getKSStrategy(dim) == HELIB_KSS_MIN) {
+    // one step at a time, with the only key-switching matrix there is
+    Ctxt sh_ctxt = ctxt;
+    Ctxt sh_ctxt1 = ctxt;
+    if (!native)
+      sh_ctxt1.smartAutomorph(zMStar.genToPow(dim, -sdim));
+    for (long i : range(sdim)) {
+      if (i > 0) {
+        sh_ctxt.smartAutomorph(zMStar.genToPow(dim, 1));
+        if (!native)
+          sh_ctxt1.smartAutomorph(zMStar.genToPow(dim, 1));
+      }
+      if (!wanted[i])
+        continue;
+      rotated[i] = std::make_unique<Ctxt>(sh_ctxt);
+      if (!native && i > 0) {
+        Ctxt tmp1 = sh_ctxt1;
+        combineRotations(*rotated[i], tmp1, dim, i, ea);
+      }
+    }
+    return;
+  }
+
+  std::shared_ptr<GeneralAutomorphPrecon> precon =
+      buildGeneralAutomorphPrecon(ctxt, dim, ea);
+  std::shared_ptr<GeneralAutomorphPrecon> precon1;
+  if (!native) {
+    Ctxt ctxt1 = ctxt;
+    ctxt1.smartAutomorph(zMStar.genToPow(dim, -sdim));
+    precon1 = buildGeneralAutomorphPrecon(ctxt1, dim, ea);
+  }
+
+  HELIB_EXEC_RANGE(sdim, first, last)
+  for (long i : range(first, last)) {
+    if (!wanted[i])
+      continue;
+    if (!native && i == 0) {
+      rotated[i] = std::make_unique<Ctxt>(ctxt);
+      continue;
+    }
+    std::shared_ptr<Ctxt> tmp = precon->automorph(i);
+    if (!native) {
+      std::shared_ptr<Ctxt> tmp1 = precon1->automorph(i);
+      combineRotations(*tmp, *tmp1, dim, i, ea);
+    }
+    rotated[i] = std::make_unique<Ctxt>(std::move(*tmp));
+  }
+  HELIB_EXEC_RANGE_END
+}
+
+// The branches of the first dimension of a full transform are independent:
+// branch i rotates ctxt by i in that dimension and goes on with the
+// transforms [i*leaves, (i+1)*leaves). They are all run in parallel, each
+// into its own accumulator. skip(first, last) tells if transforms
+// [first, last) can be skipped.
+template <typename Exec, typename Skip>
+static void parallelFullMul(const Exec& exec,
+                            Ctxt& acc,
+                            const Ctxt& ctxt,
+                            Skip skip)
+{
+  const EncryptedArray& ea = exec.ea;
+  long dim = exec.dims[0];
+  long sdim = ea.sizeOfDimension(dim);
+  long leaves = 1;
+  for (long t : range(1, ea.dimension() - 1))
+    leaves *= ea.sizeOfDimension(exec.dims[t]);
+
+  std::vector<bool> wanted(sdim);
+  for (long i : range(sdim))
+    wanted[i] = !skip(i * leaves, (i + 1) * leaves);
+  std::vector<std::unique_ptr<Ctxt>> rotated;
+  rotationsOfDim(rotated, ctxt, dim, wanted, ea);
+
+  std::vector<std::unique_ptr<Ctxt>> partial(sdim);
+  HELIB_EXEC_RANGE(sdim, first, last)
+  for (long i : range(first, last)) {
+    if (!rotated[i])
+      continue;
+    partial[i] = std::make_unique<Ctxt>(ZeroCtxtLike, ctxt);
+    exec.rec_mul(*partial[i], *rotated[i], 1, i * leaves);
+    rotated[i].reset();
+  }
+  HELIB_EXEC_RANGE_END
+
+  for (const std::unique_ptr<Ctxt>& p : partial)
+    if (p)
+      acc += *p;
+}
+
+// The flat evaluation of a full transform (see MatMulFullExec::flat): the
+// input of transform idx, rotated by (i_0, ..., i_{n-2}) in the dimensions
+// dims[0], ..., dims[n-2], is a single automorphism of ctxt, and all of them
+// are hoisted. Returns false (having done nothing) unless these dimensions
+// are all good.
+template <typename Exec, typename Skip>
+static bool flatFullMul(const Exec& exec,
+                        Ctxt& acc,
+                        const Ctxt& ctxt,
+                        Skip skip)
+{
+  const EncryptedArray& ea = exec.ea;
+  const PAlgebra& zMStar = ea.getPAlgebra();
+  long m = zMStar.getM();
+  long ndims = ea.dimension();
+  for (long t : range(ndims - 1))
+    if (!ea.nativeDimension(exec.dims[t]))
+      return false;
+
+  long count = lsize(exec.transforms);
+  std::vector<long> ks;
+  std::vector<long> idxes;
+  for (long idx : range(count)) {
+    if (skip(idx, idx + 1))
+      continue;
+    // The digits of idx, the last of the rotated dimensions first
+    long k = 1;
+    long rest = idx;
+    for (long t = ndims - 2; t >= 0; t--) {
+      long sdim = ea.sizeOfDimension(exec.dims[t]);
+      k = NTL::MulMod(k, zMStar.genToPow(exec.dims[t], rest % sdim), m);
+      rest /= sdim;
+    }
+    ks.push_back(k);
+    idxes.push_back(idx);
+  }
+  if (ks.empty())
+    return true;
+
+  std::vector<Ctxt> rotated;
+  ctxt.hoistedAutomorphs(ks, rotated);
+
+  long n = lsize(ks);
+  HELIB_EXEC_RANGE(n, first, last)
+  for (long j : range(first, last))
+    exec.transforms[idxes[j]].mul(rotated[j]);
+  HELIB_EXEC_RANGE_END
+
+  for (const Ctxt& term : rotated)
+    acc += term;
+  return true;
+}
+
+template <typename Exec, typename Skip>
+static void fullMul(const Exec& exec, Ctxt& acc, const Ctxt& ctxt, Skip skip)
+{
+  if (exec.ea.dimension() > 1) {
+    if (exec.flat && flatFullMul(exec, acc, ctxt, skip))
+      return;
+    if (helib::AvailableThreads() > 1) {
+      parallelFullMul(exec, acc, ctxt, skip);
+      return;
+    }
+  }
+  exec.rec_mul(acc, ctxt, 0, 0);
+}
+
 long MatMulFullExec::rec_mul(Ctxt& acc,
                              const Ctxt& ctxt,
                              long dim_idx,
@@ -2145,9 +2786,11 @@ long MatMulFullExec::rec_mul(Ctxt& acc,
   if (dim_idx >= ea.dimension() - 1) {
     // Last dimension (recursion edge condition)
 
-    Ctxt tmp = ctxt;
-    transforms[idx].mul(tmp);
-    acc += tmp;
+    if (!transforms[idx].babySteps.empty()) {
+      Ctxt tmp = ctxt;
+      transforms[idx].mul(tmp);
+      acc += tmp;
+    }
 
     idx++;
 
@@ -2157,6 +2800,12 @@ long MatMulFullExec::rec_mul(Ctxt& acc,
     bool native = ea.nativeDimension(dim);
     const PAlgebra& zMStar = ea.getPAlgebra();
 
+    // number of transforms below each recursive call; rotations that
+    // only feed zero transforms are skipped
+    long leaves = 1;
+    for (long t : range(dim_idx + 1, ea.dimension() - 1))
+      leaves *= ea.sizeOfDimension(dims[t]);
+
     bool iterative = false;
     if (ctxt.getPubKey().getKSStrategy(dim) == HELIB_KSS_MIN)
       iterative = true;
@@ -2168,6 +2817,10 @@ long MatMulFullExec::rec_mul(Ctxt& acc,
             buildGeneralAutomorphPrecon(ctxt, dim, ea);
 
         for (long i : range(sdim)) {
+          if (allZero(transforms, idx, idx + leaves)) {
+            idx += leaves;
+            continue;
+          }
           std::shared_ptr<Ctxt> tmp = precon->automorph(i);
           idx = rec_mul(acc, *tmp, dim_idx + 1, idx);
         }
@@ -2182,23 +2835,12 @@ long MatMulFullExec::rec_mul(Ctxt& acc,
         for (long i : range(sdim)) {
           if (i == 0)
             idx = rec_mul(acc, ctxt, dim_idx + 1, idx);
+          else if (allZero(transforms, idx, idx + leaves))
+            idx += leaves;
           else {
             std::shared_ptr<Ctxt> tmp = precon->automorph(i);
             std::shared_ptr<Ctxt> tmp1 = precon1->automorph(i);
-
-            zzX mask = ea.getAlMod().getMask_zzX(dim, i);
-            double sz = embeddingLargestCoeff(mask, zMStar);
-
-            DoubleCRT m1(mask,
-                         ea.getContext(),
-                         tmp->getPrimeSet() | tmp1->getPrimeSet());
-
-            // Compute tmp = tmp*m1 + tmp1 - tmp1*m1
-            tmp->multByConstant(m1, sz);
-            *tmp += *tmp1;
-            tmp1->multByConstant(m1, sz);
-            *tmp -= *tmp1;
-
+            combineRotations(*tmp, *tmp1, dim, i, ea);
             idx = rec_mul(acc, *tmp, dim_idx + 1, idx);
           }
         }
@@ -2211,7 +2853,10 @@ long MatMulFullExec::rec_mul(Ctxt& acc,
         for (long offset : range(sdim)) {
           if (offset > 0)
             sh_ctxt.smartAutomorph(zMStar.genToPow(dim, 1));
-          idx = rec_mul(acc, sh_ctxt, dim_idx + 1, idx);
+          if (allZero(transforms, idx, idx + leaves))
+            idx += leaves;
+          else
+            idx = rec_mul(acc, sh_ctxt, dim_idx + 1, idx);
         }
       } else {
         Ctxt sh_ctxt = ctxt;
@@ -2225,22 +2870,14 @@ long MatMulFullExec::rec_mul(Ctxt& acc,
             sh_ctxt.smartAutomorph(zMStar.genToPow(dim, 1));
             sh_ctxt1.smartAutomorph(zMStar.genToPow(dim, 1));
 
-            zzX mask = ea.getAlMod().getMask_zzX(dim, offset);
-            double sz = embeddingLargestCoeff(mask, zMStar);
+            if (allZero(transforms, idx, idx + leaves)) {
+              idx += leaves;
+              continue;
+            }
 
             Ctxt tmp = sh_ctxt;
             Ctxt tmp1 = sh_ctxt1;
-
-            DoubleCRT m1(mask,
-                         ea.getContext(),
-                         tmp.getPrimeSet() | tmp1.getPrimeSet());
-
-            // Compute tmp = tmp*m1 + tmp1 - tmp1*m1
-            tmp.multByConstant(m1, sz);
-            tmp += tmp1;
-            tmp1.multByConstant(m1, sz);
-            tmp -= tmp1;
-
+            combineRotations(tmp, tmp1, dim, offset, ea);
             idx = rec_mul(acc, tmp, dim_idx + 1, idx);
           }
         }
@@ -2267,11 +2904,170 @@ void MatMulFullExec::mul(Ctxt& ctxt) const
   ctxt.cleanUp();
 
   Ctxt acc(ZeroCtxtLike, ctxt);
-  rec_mul(acc, ctxt, 0, 0);
+  auto skip = [this](long first, long last) {
+    return allZero(transforms, first, last);
+  };
+  fullMul(*this, acc, ctxt, skip);
 
   ctxt = acc;
 }
 
+// Same recursion as above, for a batch of ciphertexts: the rotations at
+// each level are done for all of them together, so that the leaves can
+// use the batch version of MatMul1DExec::mul.
+long MatMulFullExec::rec_mul(std::vector<Ctxt>& acc,
+                             const std::vector<Ctxt>& ctxts,
+                             long dim_idx,
+                             long idx) const
+{
+  long n = ctxts.size();
+
+  if (dim_idx >= ea.dimension() - 1) {
+    // Last dimension (recursion edge condition)
+
+    if (!transforms[idx].babySteps.empty()) {
+      std::vector<Ctxt> tmp(ctxts);
+      transforms[idx].mul(tmp);
+      for (long t : range(n))
+        acc[t] += tmp[t];
+    }
+
+    return idx + 1;
+  }
+
+  long dim = dims[dim_idx];
+  long sdim = ea.sizeOfDimension(dim);
+  bool native = ea.nativeDimension(dim);
+  const PAlgebra& zMStar = ea.getPAlgebra();
+
+  long leaves = 1;
+  for (long t : range(dim_idx + 1, ea.dimension() - 1))
+    leaves *= ea.sizeOfDimension(dims[t]);
+
+  bool iterative = false;
+  for (const Ctxt& ctxt : ctxts)
+    if (ctxt.getPubKey().getKSStrategy(dim) == HELIB_KSS_MIN)
+      iterative = true;
+
+  std::vector<Ctxt> rotated(ctxts);
+
+  if (!iterative) {
+    std::vector<std::shared_ptr<GeneralAutomorphPrecon>> precon(n);
+    std::vector<std::shared_ptr<GeneralAutomorphPrecon>> precon1(n);
+    HELIB_EXEC_RANGE(n, first, last)
+    for (long t : range(first, last)) {
+      precon[t] = buildGeneralAutomorphPrecon(ctxts[t], dim, ea);
+      if (!native) {
+        Ctxt ctxt1 = ctxts[t];
+        ctxt1.smartAutomorph(zMStar.genToPow(dim, -sdim));
+        precon1[t] = buildGeneralAutomorphPrecon(ctxt1, dim, ea);
+      }
+    }
+    HELIB_EXEC_RANGE_END
+
+    for (long i : range(sdim)) {
+      if (allZero(transforms, idx, idx + leaves)) {
+        idx += leaves;
+        continue;
+      }
+      if (!native && i == 0) {
+        idx = rec_mul(acc, ctxts, dim_idx + 1, idx);
+        continue;
+      }
+
+      HELIB_EXEC_RANGE(n, first, last)
+      for (long t : range(first, last)) {
+        std::shared_ptr<Ctxt> tmp = precon[t]->automorph(i);
+        if (!native) {
+          std::shared_ptr<Ctxt> tmp1 = precon1[t]->automorph(i);
+          combineRotations(*tmp, *tmp1, dim, i, ea);
+        }
+        rotated[t] = *tmp;
+      }
+      HELIB_EXEC_RANGE_END
+
+      idx = rec_mul(acc, rotated, dim_idx + 1, idx);
+    }
+  } else {
+    std::vector<Ctxt> sh_ctxt(ctxts);
+    std::vector<Ctxt> sh_ctxt1(native ? 0 : n, ctxts[0]);
+    if (!native) {
+      HELIB_EXEC_RANGE(n, first, last)
+      for (long t : range(first, last)) {
+        sh_ctxt1[t] = ctxts[t];
+        sh_ctxt1[t].smartAutomorph(zMStar.genToPow(dim, -sdim));
+      }
+      HELIB_EXEC_RANGE_END
+    }
+
+    for (long offset : range(sdim)) {
+      if (offset > 0) {
+        HELIB_EXEC_RANGE(n, first, last)
+        for (long t : range(first, last)) {
+          sh_ctxt[t].smartAutomorph(zMStar.genToPow(dim, 1));
+          if (!native)
+            sh_ctxt1[t].smartAutomorph(zMStar.genToPow(dim, 1));
+        }
+        HELIB_EXEC_RANGE_END
+      }
+
+      if (allZero(transforms, idx, idx + leaves)) {
+        idx += leaves;
+        continue;
+      }
+      if (native || offset == 0) {
+        idx = rec_mul(acc, native ? sh_ctxt : ctxts, dim_idx + 1, idx);
+        continue;
+      }
+
+      HELIB_EXEC_RANGE(n, first, last)
+      for (long t : range(first, last)) {
+        rotated[t] = sh_ctxt[t];
+        Ctxt tmp1 = sh_ctxt1[t];
+        combineRotations(rotated[t], tmp1, dim, offset, ea);
+      }
+      HELIB_EXEC_RANGE_END
+
+      idx = rec_mul(acc, rotated, dim_idx + 1, idx);
+    }
+  }
+
+  return idx;
+}
+
+void MatMulFullExec::mul(std::vector<Ctxt>& ctxts) const
+{
+  HELIB_NTIMER_START(mul_MatMulFullExec_batch);
+
+  long n = ctxts.size();
+  if (n <= 1) {
+    MatMulExecBase::mul(ctxts);
+    return;
+  }
+
+  for (const Ctxt& ctxt : ctxts)
+    assertEq(&ea.getContext(),
+             &ctxt.getContext(),
+             "Cannot multiply ciphertexts with context different to "
+             "encrypted array one");
+
+  assertTrue(ea.size() > 1l, "Number of slots is less than 2");
+
+  std::vector<Ctxt> acc;
+  acc.reserve(n);
+  for (const Ctxt& ctxt : ctxts)
+    acc.emplace_back(ZeroCtxtLike, ctxt);
+
+  HELIB_EXEC_RANGE(n, first, last)
+  for (long t : range(first, last))
+    ctxts[t].cleanUp();
+  HELIB_EXEC_RANGE_END
+
+  rec_mul(acc, ctxts, 0, 0);
+
+  ctxts.swap(acc);
+}
+
 // ================= BlockMatMulFull stuff ===============
 
 // lightly massaged version of MatMulFull code...some unfortunate
@@ -2610,7 +3406,8 @@ void BlockMatMulFullExec::mul(Ctxt& ctxt) const
   ctxt.cleanUp();
 
   Ctxt acc(ZeroCtxtLike, ctxt);
-  rec_mul(acc, ctxt, 0, 0);
+  auto skip = [](long, long) { return false; };
+  fullMul(*this, acc, ctxt, skip);
 
   ctxt = acc;
 }
@@ -2960,4 +3757,333 @@ void traceMap(Ctxt& ctxt)
   }
 }
 
+//===================================
+// Binary IO of the encoded constants
+
+static std::shared_ptr<ConstMultiplier> readConstMultiplier(
+    std::istream& str,
+    const Context& context)
+{
+  switch (read_raw_int(str)) {
+  case CONST_MULTIPLIER_NONE:
+    return nullptr;
+  case CONST_MULTIPLIER_ZZX:
+    return std::make_shared<ConstMultiplier_zzX>(str);
+  case CONST_MULTIPLIER_DCRT:
+    return std::make_shared<ConstMultiplier_DoubleCRT>(str, context);
+  case CONST_MULTIPLIER_ZZX_CKKS:
+    return std::make_shared<ConstMultiplier_zzX_CKKS>(str, context);
+  case CONST_MULTIPLIER_DCRT_CKKS:
+    return std::make_shared<ConstMultiplier_DoubleCRT_CKKS>(str, context);
+  default:
+    throw IOError("ConstMultiplier: unknown kind of constant");
+  }
+}
+
+void ConstMultiplierCache::writeTo(std::ostream& str) const
+{
+  write_raw_int(str, multiplier.size());
+  for (const auto& m : multiplier) {
+    if (m)
+      m->writeTo(str);
+    else
+      write_raw_int(str, CONST_MULTIPLIER_NONE);
+  }
+}
+
+void ConstMultiplierCache::read(std::istream& str, const Context& context)
+{
+  MemoryScope memoryScope(MemoryCategory::MATMUL_CACHE);
+  long n = read_raw_int(str);
+  assertTrue<IOError>(n >= 0, "ConstMultiplierCache: bad size");
+  multiplier.clear();
+  multiplier.reserve(n);
+  for (long i = 0; i < n; i++)
+    multiplier.push_back(readConstMultiplier(str, context));
+}
+
+// The kinds of MatMulExecBase objects, as written in the preamble
+enum MatMulExecKind : long
+{
+  MATMUL_EXEC_1D = 1,
+  MATMUL_EXEC_BLOCK_1D = 2,
+  MATMUL_EXEC_FULL = 3,
+  MATMUL_EXEC_BLOCK_FULL = 4
+};
+
+// The preamble identifies the context (by its fingerprint), the shape of
+// the EncryptedArray and the kind of object that follows
+static void writeMatMulPreamble(std::ostream& str,
+                                const EncryptedArray& ea,
+                                MatMulExecKind kind)
+{
+  SerializeHeader<MatMulExecBase>().writeTo(str);
+  writeEyeCatcher(str, EyeCatcher::MATMUL_BEGIN);
+
+  write_raw_int(str, ea.getContext().fingerprint());
+  write_raw_int(str, ea.getTag());
+  write_raw_int(str, ea.getDegree());
+  write_raw_int(str, ea.size());
+  write_raw_int(str, kind);
+}
+
+static void readMatMulPreamble(std::istream& str,
+                               const EncryptedArray& ea,
+                               MatMulExecKind kind)
+{
+  const auto header = SerializeHeader<MatMulExecBase>::readFrom(str);
+  assertEq<IOError>(header.version,
+                    Binio::VERSION_0_0_1_0,
+                    "Header: version " + header.versionString() +
+                        " not supported");
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::MATMUL_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find pre-matmul beginning eyecatcher");
+
+  unsigned long fingerprint = read_raw_int(str);
+  assertEq<IOError>(fingerprint,
+                    ea.getContext().fingerprint(),
+                    "MatMulExec: written for a different context");
+  long tag = read_raw_int(str);
+  long degree = read_raw_int(str);
+  long size = read_raw_int(str);
+  assertTrue<IOError>(tag == ea.getTag() && degree == ea.getDegree() &&
+                          size == ea.size(),
+                      "MatMulExec: written for a different EncryptedArray");
+  assertEq<IOError>(read_raw_int(str),
+                    long(kind),
+                    "MatMulExec: written for another kind of matrix");
+}
+
+static void writeMatMulEnd(std::ostream& str)
+{
+  writeEyeCatcher(str, EyeCatcher::MATMUL_END);
+}
+
+static void readMatMulEnd(std::istream& str)
+{
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::MATMUL_END);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-matmul eyecatcher");
+}
+
+// A read-only std::streambuf over the bytes of a mapped file, so that the
+// constants are copied out of the mapping with no intermediate buffer
+class MappedStreamBuf : public std::streambuf
+{
+public:
+  explicit MappedStreamBuf(const MappedFile& file)
+  {
+    char* base = const_cast<char*>(reinterpret_cast<const char*>(file.data()));
+    setg(base, base, base + file.size());
+  }
+};
+
+template <typename Exec>
+static Exec readMappedMatMul(const std::string& path, const EncryptedArray& ea)
+{
+  HELIB_TIMER_START;
+  MappedFile file(path);
+  MappedStreamBuf buf(file);
+  std::istream str(&buf);
+  return Exec::readFrom(str, ea);
+}
+
+void MatMul1DExec::writeBody(std::ostream& str) const
+{
+  write_raw_int(str, dim);
+  write_raw_int(str, D);
+  write_raw_int(str, native);
+  write_raw_int(str, minimal);
+  write_raw_int(str, g);
+  cache.writeTo(str);
+  cache1.writeTo(str);
+}
+
+void MatMul1DExec::readBody(std::istream& str)
+{
+  dim = read_raw_int(str);
+  D = read_raw_int(str);
+  native = read_raw_int(str);
+  minimal = read_raw_int(str);
+  g = read_raw_int(str);
+  assertInRange<IOError>(dim,
+                         0l,
+                         ea.dimension(),
+                         "MatMul1DExec: bad dimension",
+                         true);
+  assertEq<IOError>(D, dimSz(ea, dim), "MatMul1DExec: bad dimension size");
+  assertInRange<IOError>(g, 0l, D, "MatMul1DExec: bad giant step", true);
+  cache.read(str, ea.getContext());
+  cache1.read(str, ea.getContext());
+  assertEq<IOError>(long(cache.multiplier.size()),
+                    D,
+                    "MatMul1DExec: bad number of diagonals");
+  if (!native)
+    assertEq<IOError>(long(cache1.multiplier.size()),
+                      D,
+                      "MatMul1DExec: bad number of diagonals");
+  buildSchedule();
+}
+
+void MatMul1DExec::writeTo(std::ostream& str) const
+{
+  writeMatMulPreamble(str, ea, MATMUL_EXEC_1D);
+  writeBody(str);
+  writeMatMulEnd(str);
+}
+
+MatMul1DExec MatMul1DExec::readFrom(std::istream& str,
+                                    const EncryptedArray& ea)
+{
+  readMatMulPreamble(str, ea, MATMUL_EXEC_1D);
+  MatMul1DExec ret(ea);
+  ret.readBody(str);
+  readMatMulEnd(str);
+  return ret;
+}
+
+MatMul1DExec MatMul1DExec::readMapped(const std::string& path,
+                                      const EncryptedArray& ea)
+{
+  return readMappedMatMul<MatMul1DExec>(path, ea);
+}
+
+void BlockMatMul1DExec::writeBody(std::ostream& str) const
+{
+  write_raw_int(str, dim);
+  write_raw_int(str, D);
+  write_raw_int(str, d);
+  write_raw_int(str, native);
+  write_raw_int(str, strategy);
+  cache.writeTo(str);
+  cache1.writeTo(str);
+}
+
+void BlockMatMul1DExec::readBody(std::istream& str)
+{
+  dim = read_raw_int(str);
+  D = read_raw_int(str);
+  d = read_raw_int(str);
+  native = read_raw_int(str);
+  strategy = read_raw_int(str);
+  assertInRange<IOError>(dim,
+                         0l,
+                         ea.dimension(),
+                         "BlockMatMul1DExec: bad dimension",
+                         true);
+  assertEq<IOError>(D,
+                    dimSz(ea, dim),
+                    "BlockMatMul1DExec: bad dimension size");
+  cache.read(str, ea.getContext());
+  cache1.read(str, ea.getContext());
+}
+
+void BlockMatMul1DExec::writeTo(std::ostream& str) const
+{
+  writeMatMulPreamble(str, ea, MATMUL_EXEC_BLOCK_1D);
+  writeBody(str);
+  writeMatMulEnd(str);
+}
+
+BlockMatMul1DExec BlockMatMul1DExec::readFrom(std::istream& str,
+                                              const EncryptedArray& ea)
+{
+  readMatMulPreamble(str, ea, MATMUL_EXEC_BLOCK_1D);
+  BlockMatMul1DExec ret(ea);
+  ret.readBody(str);
+  readMatMulEnd(str);
+  return ret;
+}
+
+BlockMatMul1DExec BlockMatMul1DExec::readMapped(const std::string& path,
+                                                const EncryptedArray& ea)
+{
+  return readMappedMatMul<BlockMatMul1DExec>(path, ea);
+}
+
+void MatMulFullExec::writeTo(std::ostream& str) const
+{
+  writeMatMulPreamble(str, ea, MATMUL_EXEC_FULL);
+  write_raw_int(str, minimal);
+  write_raw_vector(str, dims);
+  write_raw_int(str, transforms.size());
+  for (const auto& t : transforms)
+    t.writeBody(str);
+  writeMatMulEnd(str);
+}
+
+void MatMulFullExec::readBody(std::istream& str)
+{
+  minimal = read_raw_int(str);
+  read_raw_vector<long>(str, dims);
+  long n = read_raw_int(str);
+  assertTrue<IOError>(n >= 0, "MatMulFullExec: bad number of transforms");
+  transforms.clear();
+  transforms.reserve(n);
+  for (long i = 0; i < n; i++) {
+    MatMul1DExec t(ea);
+    t.readBody(str);
+    transforms.push_back(t);
+  }
+}
+
+MatMulFullExec MatMulFullExec::readFrom(std::istream& str,
+                                        const EncryptedArray& ea)
+{
+  readMatMulPreamble(str, ea, MATMUL_EXEC_FULL);
+  MatMulFullExec ret(ea);
+  ret.readBody(str);
+  readMatMulEnd(str);
+  return ret;
+}
+
+MatMulFullExec MatMulFullExec::readMapped(const std::string& path,
+                                          const EncryptedArray& ea)
+{
+  return readMappedMatMul<MatMulFullExec>(path, ea);
+}
+
+void BlockMatMulFullExec::writeTo(std::ostream& str) const
+{
+  writeMatMulPreamble(str, ea, MATMUL_EXEC_BLOCK_FULL);
+  write_raw_int(str, minimal);
+  write_raw_vector(str, dims);
+  write_raw_int(str, transforms.size());
+  for (const auto& t : transforms)
+    t.writeBody(str);
+  writeMatMulEnd(str);
+}
+
+void BlockMatMulFullExec::readBody(std::istream& str)
+{
+  minimal = read_raw_int(str);
+  read_raw_vector<long>(str, dims);
+  long n = read_raw_int(str);
+  assertTrue<IOError>(n >= 0, "BlockMatMulFullExec: bad number of transforms");
+  transforms.clear();
+  transforms.reserve(n);
+  for (long i = 0; i < n; i++) {
+    BlockMatMul1DExec t(ea);
+    t.readBody(str);
+    transforms.push_back(t);
+  }
+}
+
+BlockMatMulFullExec BlockMatMulFullExec::readFrom(std::istream& str,
+                                                  const EncryptedArray& ea)
+{
+  readMatMulPreamble(str, ea, MATMUL_EXEC_BLOCK_FULL);
+  BlockMatMulFullExec ret(ea);
+  ret.readBody(str);
+  readMatMulEnd(str);
+  return ret;
+}
+
+BlockMatMulFullExec BlockMatMulFullExec::readMapped(const std::string& path,
+                                                    const EncryptedArray& ea)
+{
+  return readMappedMatMul<BlockMatMulFullExec>(path, ea);
+}
+
 } // namespace helib
@@ -0,0 +1,87 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <iomanip>
+
+#include <helib/memoryReport.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+static thread_local MemoryCategory currentCategory = MemoryCategory::OTHER;
+
+const char* memoryCategoryName(MemoryCategory category)
+{
+  static const char* names[] = {"other",
+                                "keys",
+                                "matmul-cache",
+                                "bootstrapping",
+                                "ciphertexts",
+                                "scratch"};
+  assertInRange(int(category),
+                0,
+                int(MemoryCategory::COUNT),
+                "memoryCategoryName: no such category");
+  return names[int(category)];
+}
+
+MemoryUsage& MemoryUsage::operator+=(const MemoryUsage& other)
+{
+  bytes += other.bytes;
+  rows += other.rows;
+  objects += other.objects;
+  return *this;
+}
+
+MemoryUsage MemoryReport::total() const
+{
+  MemoryUsage sum;
+  for (const MemoryUsage& u : usage)
+    sum += u;
+  return sum;
+}
+
+std::ostream& operator<<(std::ostream& str, const MemoryReport& report)
+{
+  for (int i = 0; i < int(MemoryCategory::COUNT); i++) {
+    const MemoryUsage& u = report.usage[i];
+    str << std::setw(14) << std::left
+        << memoryCategoryName(MemoryCategory(i)) << std::right
+        << " bytes=" << u.bytes << " rows=" << u.rows
+        << " objects=" << u.objects << "\n";
+  }
+  return str;
+}
+
+MemoryScope::MemoryScope(MemoryCategory category, bool force) :
+    saved(currentCategory)
+{
+  if (force || currentCategory == MemoryCategory::OTHER)
+    currentCategory = category;
+}
+
+MemoryScope::~MemoryScope() { currentCategory = saved; }
+
+MemoryCategory MemoryScope::current() { return currentCategory; }
+
+MemoryReport MemoryAccounts::report() const
+{
+  MemoryReport report;
+  for (int i = 0; i < int(MemoryCategory::COUNT); i++) {
+    const Counters& c = counters[i];
+    report.usage[i].bytes = c.bytes.load(std::memory_order_relaxed);
+    report.usage[i].rows = c.rows.load(std::memory_order_relaxed);
+    report.usage[i].objects = c.objects.load(std::memory_order_relaxed);
+  }
+  return report;
+}
+
+} // namespace helib
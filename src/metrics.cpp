@@ -0,0 +1,244 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <json.hpp>
+#include <helib/metrics.h>
+#include <helib/fhe_stats.h>
+#include <helib/timing.h>
+
+using json = ::nlohmann::json;
+
+namespace helib {
+
+namespace {
+
+// The counters of a snapshot, with their names
+std::vector<std::pair<const char*, long>> plainCounts(
+    const fhe_op_snapshot& ops)
+{
+  return {{"keySwitches", ops.keySwitches},
+          {"ntts", ops.ntts},
+          {"ffts", ops.ffts},
+          {"iffts", ops.iffts}};
+}
+
+std::vector<std::pair<const char*, const fhe_op_count*>> brokenDownCounts(
+    const fhe_op_snapshot& ops)
+{
+  return {{"keySwitchParts", &ops.keySwitchParts},
+          {"automorphs", &ops.automorphs},
+          {"reLinearizations", &ops.reLinearizations},
+          {"modDowns", &ops.modDowns},
+          {"reCrypts", &ops.reCrypts}};
+}
+
+// A label value, escaped as the Prometheus format requires
+std::string label(const char* value)
+{
+  std::string result = "\"";
+  for (; *value != '\0'; value++) {
+    if (*value == '\\' || *value == '"')
+      result += '\\';
+    if (*value == '\n')
+      result += "\\n";
+    else
+      result += *value;
+  }
+  return result + "\"";
+}
+
+std::string bound(double le)
+{
+  if (std::isinf(le))
+    return "\"+Inf\"";
+  std::ostringstream str;
+  str.precision(17);
+  str << '"' << le << '"';
+  return str.str();
+}
+
+// A histogram, with all its buckets, made cumulative
+template <typename Counts, typename Bound>
+void writeHistogram(std::ostream& str,
+                    const std::string& metric,
+                    const std::string& labels,
+                    const Counts& counts,
+                    long numBuckets,
+                    Bound getBound,
+                    double sum)
+{
+  long cumulative = 0;
+  for (long i = 0; i < numBuckets; i++) {
+    cumulative += counts[i];
+    str << metric << "_bucket{" << labels << ",le=" << bound(getBound(i))
+        << "} " << cumulative << "\n";
+  }
+  str << metric << "_sum{" << labels << "} " << sum << "\n";
+  str << metric << "_count{" << labels << "} " << cumulative << "\n";
+}
+
+template <typename Counts, typename Bound>
+json histogramToJSON(const Counts& counts, long numBuckets, Bound getBound)
+{
+  json buckets = json::array();
+  for (long i = 0; i < numBuckets; i++) {
+    long n = counts[i];
+    if (n == 0)
+      continue;
+    double le = getBound(i);
+    buckets.push_back({{"le", std::isinf(le) ? json(nullptr) : json(le)},
+                       {"count", n}});
+  }
+  return buckets;
+}
+
+} // namespace
+
+void writeMetricsPrometheus(std::ostream& str)
+{
+  std::streamsize precision = str.precision(17);
+
+  str << "# HELP helib_timer_seconds Durations of the timed functions.\n"
+      << "# TYPE helib_timer_seconds histogram\n";
+  forEachTimer([&](const FHEtimer& timer) {
+    if (timer.getNumCalls() == 0)
+      return;
+    std::string labels =
+        "name=" + label(timer.name) + ",loc=" + label(timer.loc);
+    writeHistogram(str,
+                   "helib_timer_seconds",
+                   labels,
+                   timer.histogram,
+                   FHEtimer::numBuckets,
+                   FHEtimer::getBucketBound,
+                   timer.getTime());
+  });
+
+  str << "# HELP helib_timer_perf_events_total Hardware events counted by "
+         "the timed functions.\n"
+      << "# TYPE helib_timer_perf_events_total counter\n";
+  forEachTimer([&](const FHEtimer& timer) {
+    for (int i = 0; i < perfEventCount; i++) {
+      unsigned long count = timer.getPerfCount(PerfEvent(i));
+      if (count != 0)
+        str << "helib_timer_perf_events_total{name=" << label(timer.name)
+            << ",loc=" << label(timer.loc)
+            << ",event=" << label(perfEventName(PerfEvent(i))) << "} "
+            << count << "\n";
+    }
+  });
+
+  fhe_op_snapshot ops = snapshot_op_counts();
+  str << "# HELP helib_ops_total Calls to the most expensive primitives.\n"
+      << "# TYPE helib_ops_total counter\n";
+  for (const auto& count : plainCounts(ops))
+    str << "helib_ops_total{op=" << label(count.first) << "} " << count.second
+        << "\n";
+  for (const auto& count : brokenDownCounts(ops))
+    str << "helib_ops_total{op=" << label(count.first) << "} "
+        << count.second->total << "\n";
+  str << "# HELP helib_ops_by_primes_total Calls to the primitives, by the "
+         "number of primes of their operand.\n"
+      << "# TYPE helib_ops_by_primes_total counter\n";
+  for (const auto& count : brokenDownCounts(ops))
+    for (std::size_t i = 0; i < count.second->byPrimes.size(); i++)
+      if (count.second->byPrimes[i] != 0)
+        str << "helib_ops_by_primes_total{op=" << label(count.first)
+            << ",primes=\"" << i << "\"} " << count.second->byPrimes[i]
+            << "\n";
+
+  str << "# HELP helib_stat Values recorded by HELIB_STATS_UPDATE.\n"
+      << "# TYPE helib_stat histogram\n";
+  std::ostringstream maxima;
+  forEachStatsRecord([&](const fhe_stats_record& record) {
+    if (record.count == 0)
+      return;
+    std::string labels = "name=" + label(record.name);
+    writeHistogram(str,
+                   "helib_stat",
+                   labels,
+                   record.histogram,
+                   fhe_stats_record::numBuckets,
+                   fhe_stats_record::getBucketBound,
+                   record.sum);
+    maxima.precision(17);
+    maxima << "helib_stat_max{" << labels << "} " << record.max << "\n";
+  });
+  str << "# HELP helib_stat_max The largest value recorded.\n"
+      << "# TYPE helib_stat_max gauge\n"
+      << maxima.str();
+
+  str.precision(precision);
+}
+
+void writeMetricsJSON(std::ostream& str)
+{
+  json timers = json::array();
+  forEachTimer([&](const FHEtimer& timer) {
+    if (timer.getNumCalls() == 0)
+      return;
+    json entry = {{"name", timer.name},
+                  {"loc", timer.loc},
+                  {"seconds", timer.getTime()},
+                  {"calls", timer.getNumCalls()},
+                  {"histogram",
+                   histogramToJSON(timer.histogram,
+                                   FHEtimer::numBuckets,
+                                   FHEtimer::getBucketBound)}};
+    json perf = json::object();
+    for (int i = 0; i < perfEventCount; i++) {
+      unsigned long count = timer.getPerfCount(PerfEvent(i));
+      if (count != 0)
+        perf[perfEventName(PerfEvent(i))] = count;
+    }
+    if (!perf.empty())
+      entry["perf"] = perf;
+    timers.push_back(entry);
+  });
+
+  fhe_op_snapshot snapshot = snapshot_op_counts();
+  json ops = json::object();
+  for (const auto& count : plainCounts(snapshot))
+    ops[count.first] = count.second;
+  for (const auto& count : brokenDownCounts(snapshot)) {
+    json byPrimes = json::object();
+    for (std::size_t i = 0; i < count.second->byPrimes.size(); i++)
+      if (count.second->byPrimes[i] != 0)
+        byPrimes[std::to_string(i)] = count.second->byPrimes[i];
+    ops[count.first] = {{"total", count.second->total},
+                        {"byPrimes", byPrimes}};
+  }
+
+  json stats = json::array();
+  forEachStatsRecord([&](const fhe_stats_record& record) {
+    if (record.count == 0)
+      return;
+    stats.push_back({{"name", record.name},
+                     {"count", record.count},
+                     {"sum", record.sum},
+                     {"max", record.max},
+                     {"histogram",
+                      histogramToJSON(record.histogram,
+                                      fhe_stats_record::numBuckets,
+                                      fhe_stats_record::getBucketBound)}});
+  });
+
+  str << json{{"timers", timers}, {"ops", ops}, {"stats", stats}}.dump()
+      << "\n";
+}
+
+} // namespace helib
@@ -0,0 +1,406 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <helib/multicore.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include <helib/assertions.h>
+
+#ifdef HELIB_THREADS
+
+#include <exception>
+#include <helib/numa.h>
+#include <helib/timing.h>
+
+namespace helib {
+
+// The tasks forked by one call to exec
+struct TaskScheduler::Group
+{
+  std::atomic_long pending;
+  std::mutex errorMtx;
+  std::exception_ptr error;
+};
+
+// The scheduler that the current thread is a worker of, and its index
+static thread_local const TaskScheduler* workerOf = nullptr;
+static thread_local long workerIndex = 0;
+// The number of tasks the current thread is running, one inside the other
+static thread_local long taskDepth = 0;
+
+TaskScheduler::TaskScheduler(long nThreads, bool numaPinned) :
+    numaPinned(numaPinned)
+{
+  assertTrue<InvalidArgument>(nThreads > 0, "Must have a positive nThreads");
+  long nodes = numaPinned ? NumaNodes() : 1;
+  for (long i = 0; i < nThreads; i++) {
+    queues.push_back(std::make_unique<Queue>());
+    nodeOf.push_back(i * nodes / nThreads);
+  }
+  for (long i = 0; i < nThreads; i++) {
+    std::vector<long> order;
+    for (bool sameNode : {true, false})
+      for (long k = 0; k < nThreads; k++) {
+        long j = (i + k) % nThreads;
+        if ((nodeOf[j] == nodeOf[i]) == sameNode)
+          order.push_back(j);
+      }
+    stealOrder.push_back(order);
+  }
+  for (long i = 1; i < nThreads; i++)
+    workers.emplace_back([this, i] { workerLoop(i); });
+}
+
+TaskScheduler::~TaskScheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(sleepMtx);
+    done = true;
+  }
+  wake.notify_all();
+  for (auto& worker : workers)
+    worker.join();
+}
+
+long TaskScheduler::self() const
+{
+  return workerOf == this ? workerIndex : 0;
+}
+
+void TaskScheduler::run(const Task& task)
+{
+  TraceParentScope scope(task.traceParent);
+  MemoryScope memoryScope(task.memoryCategory, /*force=*/true);
+  taskDepth++;
+  if (task.job) {
+    (*task.job)();
+    taskDepth--;
+    return;
+  }
+  try {
+    (*task.fn)(task.index);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(task.group->errorMtx);
+    if (!task.group->error)
+      task.group->error = std::current_exception();
+  }
+  taskDepth--;
+  task.group->pending--;
+}
+
+// Run one task: the newest of our own queue, or else the oldest of another
+// queue. Returns false if there was none.
+bool TaskScheduler::runOne(long self)
+{
+  const std::vector<long>& order = stealOrder[self];
+  for (std::size_t k = 0; k < order.size(); k++) {
+    Queue& queue = *queues[order[k]];
+    Task task;
+    {
+      std::lock_guard<std::mutex> lock(queue.mtx);
+      if (queue.tasks.empty())
+        continue;
+      if (k == 0) {
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+      } else {
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+      }
+    }
+    queued--;
+    run(task);
+    return true;
+  }
+  return false;
+}
+
+void TaskScheduler::workerLoop(long self)
+{
+  workerOf = this;
+  workerIndex = self;
+  if (numaPinned)
+    PinThreadToNumaNode(nodeOf[self]);
+  for (;;) {
+    if (runOne(self))
+      continue;
+    std::unique_lock<std::mutex> lock(sleepMtx);
+    wake.wait(lock, [this] { return done || queued > 0; });
+    if (done)
+      return;
+  }
+}
+
+void TaskScheduler::exec(long n, const std::function<void(long)>& fn)
+{
+  if (n <= 0)
+    return;
+
+  Group group;
+  group.pending = n;
+  long me = self();
+  long parent = currentTraceSpan();
+  MemoryCategory category = MemoryScope::current();
+  if (n > 1) {
+    Queue& queue = *queues[me];
+    {
+      std::lock_guard<std::mutex> lock(queue.mtx);
+      // Pushed in reverse, so that our own pops start from task 1
+      for (long i = n - 1; i >= 1; i--)
+        queue.tasks.push_back(Task{&fn, i, &group, nullptr, parent, category});
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleepMtx);
+      queued += n - 1;
+    }
+    wake.notify_all();
+  }
+
+  run(Task{&fn, 0, &group, nullptr, parent, category});
+  // Help with the other tasks (ours or not) until ours are all done
+  while (group.pending > 0)
+    if (!runOne(me))
+      std::this_thread::yield();
+
+  if (group.error)
+    std::rethrow_exception(group.error);
+}
+
+void TaskScheduler::submit(std::function<void()> job)
+{
+  Queue& queue = *queues[self()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mtx);
+    queue.tasks.push_back(Task{
+        nullptr,
+        0,
+        nullptr,
+        std::make_shared<std::function<void()>>(std::move(job)),
+        currentTraceSpan(),
+        MemoryScope::current()});
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleepMtx);
+    queued++;
+  }
+  wake.notify_one();
+}
+
+static std::unique_ptr<TaskScheduler> taskScheduler;
+
+void SetTaskThreads(long n, bool numaPinned)
+{
+  taskScheduler.reset();
+  if (n > 1)
+    taskScheduler = std::make_unique<TaskScheduler>(n, numaPinned);
+}
+
+TaskScheduler* GetTaskScheduler() { return taskScheduler.get(); }
+
+long AvailableThreads()
+{
+  TaskScheduler* scheduler = GetTaskScheduler();
+  return scheduler ? scheduler->NumThreads() : NTL::AvailableThreads();
+}
+
+void execRange(long n, const std::function<void(long, long)>& fn)
+{
+  TaskScheduler* scheduler = GetTaskScheduler();
+  if (!scheduler) {
+    MemoryCategory category = MemoryScope::current();
+    NTL_EXEC_RANGE(n, first, last)
+    MemoryScope memoryScope(category, /*force=*/true);
+    fn(first, last);
+    NTL_EXEC_RANGE_END
+    return;
+  }
+  if (n <= 0)
+    return;
+
+  NTL::PartitionInfo pinfo(n, scheduler->NumThreads());
+  long cnt = pinfo.NumIntervals();
+  if (cnt == 1) {
+    fn(0, n);
+    return;
+  }
+  scheduler->exec(cnt, [&](long index) {
+    long first, last;
+    pinfo.interval(first, last, index);
+    fn(first, last);
+  });
+}
+
+void execIndex(long cnt, const std::function<void(long)>& fn)
+{
+  TaskScheduler* scheduler = GetTaskScheduler();
+  if (!scheduler) {
+    MemoryCategory category = MemoryScope::current();
+    NTL_EXEC_INDEX(cnt, index)
+    MemoryScope memoryScope(category, /*force=*/true);
+    fn(index);
+    NTL_EXEC_INDEX_END
+    return;
+  }
+  scheduler->exec(cnt, fn);
+}
+
+} // namespace helib
+
+#endif // ifdef HELIB_THREADS
+
+namespace helib {
+
+namespace {
+
+std::atomic<ParallelGrainMode> grainMode{ParallelGrainMode::ADAPTIVE};
+std::atomic_long grainWork{1L << 15};
+
+// Whether a loop started now is nested in a loop of the NTL thread pool,
+// which runs it on the calling thread anyway
+bool nestedInNTLPool()
+{
+#ifdef HELIB_THREADS
+  if (GetTaskScheduler())
+    return false;
+#endif
+  NTL::BasicThreadPool* pool = NTL::GetThreadPool();
+  return pool && pool->active();
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+} // namespace
+
+void setParallelGrainMode(ParallelGrainMode mode) { grainMode = mode; }
+
+ParallelGrainMode getParallelGrainMode() { return grainMode; }
+
+void setParallelGrainWork(long work)
+{
+  assertTrue<InvalidArgument>(work >= 0, "Grain work must be non-negative");
+  grainWork = work;
+}
+
+long getParallelGrainWork() { return grainWork; }
+
+namespace {
+
+// The last measurement of parallelWakeupSeconds(), and the number of threads
+// it was taken with. wakeupSeconds is stored before wakeupThreads, so that a
+// reader that sees the current thread count also sees its time.
+std::atomic<long> wakeupThreads{0};
+std::atomic<double> wakeupSeconds{0};
+
+void measureWakeup(long nThreads)
+{
+  // A warm-up loop, then the average of the timed ones
+  const long reps = 16;
+  auto start = std::chrono::steady_clock::now();
+  for (long r = 0; r <= reps; r++) {
+    if (r == 1)
+      start = std::chrono::steady_clock::now();
+    HELIB_EXEC_RANGE(nThreads, first, last)
+    (void)first;
+    (void)last;
+    HELIB_EXEC_RANGE_END
+  }
+  wakeupSeconds.store(secondsSince(start) / reps, std::memory_order_relaxed);
+  wakeupThreads.store(nThreads, std::memory_order_release);
+}
+
+} // namespace
+
+double parallelWakeupSeconds()
+{
+  static std::once_flag first;
+  static std::mutex remeasure;
+
+  long nThreads = AvailableThreads();
+  std::call_once(first, [nThreads] { measureWakeup(nThreads); });
+  if (wakeupThreads.load(std::memory_order_acquire) != nThreads) {
+    // Only taken once the number of threads has changed
+    std::lock_guard<std::mutex> lock(remeasure);
+    if (wakeupThreads.load(std::memory_order_relaxed) != nThreads)
+      measureWakeup(nThreads);
+  }
+  return wakeupSeconds.load(std::memory_order_relaxed);
+}
+
+bool ParallelGrain::split(long work, long n) const
+{
+  if (n <= 1)
+    return false;
+  ParallelGrainMode mode = getParallelGrainMode();
+  if (mode == ParallelGrainMode::ALWAYS)
+    return true;
+  long nThreads = std::min(AvailableThreads(), n);
+  if (nThreads <= 1 || nestedInNTLPool())
+    return false;
+
+  const double margin = (mode == ParallelGrainMode::LOW_LATENCY) ? 4 : 1;
+  double seconds = secondsPerUnit();
+  if (seconds == 0)
+    return work >= margin * getParallelGrainWork();
+  double saving = work * seconds * (1 - 1.0 / nThreads);
+  return saving > margin * parallelWakeupSeconds();
+}
+
+void ParallelGrain::recordInline(long work, double seconds)
+{
+  inlineRuns++;
+  if (work <= 0)
+    return;
+  // A moving average, so that the site follows changes of the machine load
+  double sample = seconds / work;
+  double old = perUnit.load(std::memory_order_relaxed);
+  perUnit.store(old == 0 ? sample : 0.75 * old + 0.25 * sample,
+                std::memory_order_relaxed);
+}
+
+void adaptiveExecRange(ParallelGrain& grain,
+                       long work,
+                       long n,
+                       const std::function<void(long, long)>& fn)
+{
+  if (n <= 0)
+    return;
+  if (!grain.split(work, n)) {
+    auto start = std::chrono::steady_clock::now();
+    fn(0, n);
+    grain.recordInline(work, secondsSince(start));
+    return;
+  }
+  grain.recordSplit();
+  HELIB_EXEC_RANGE(n, first, last)
+  fn(first, last);
+  HELIB_EXEC_RANGE_END
+}
+
+bool inParallelTask()
+{
+#ifdef HELIB_THREADS
+  if (GetTaskScheduler())
+    return taskDepth > 0;
+#endif
+  NTL::BasicThreadPool* pool = NTL::GetThreadPool();
+  return pool && pool->active();
+}
+
+} // namespace helib
@@ -16,6 +16,8 @@
 #include <cmath>
 #include <algorithm>
 
+#include <NTL/BasicThreadPool.h>
+
 #include <helib/NumbTh.h>
 #include <helib/DoubleCRT.h>
 #include <helib/norms.h>
@@ -492,33 +494,115 @@ NTL::xdouble embeddingLargestCoeff(const NTL::ZZX& f, const PAlgebra& palg)
 // logic.  We can revisit this if this code ever becomes a bottleneck,
 // but this does not seem to be a significant issue at the moment.
 
-void CKKS_canonicalEmbedding(std::vector<cx_double>& v,
-                             const std::vector<double>& in,
-                             const PAlgebra& palg)
+// The number of vectors whose half FFTs are done by one apply_many in the
+// batched versions below, which bounds their workspace to a few vectors
+// per thread
+static constexpr long EMBED_BATCH = 8;
+
+static void checkCanonicalEmbeddingArgs(long sz, const PAlgebra& palg)
 {
-  HELIB_TIMER_START;
+  if (!(palg.getP() == -1 && palg.getPow2() >= 2 && sz <= palg.getM() / 2))
+    throw LogicError("bad args to CKKS_canonicalEmbedding");
+}
 
+// buf[0..m/2) = in * pow, so that its half FFT gives the embedding
+static void loadCanonicalEmbedding(cx_double* buf,
+                                   const std::vector<double>& in,
+                                   const PAlgebra& palg)
+{
   long sz = in.size();
   long m = palg.getM();
+  const cx_double* pow = &palg.getHalfFFTInfo().pow[0];
 
-  if (!(palg.getP() == -1 && palg.getPow2() >= 2 && sz <= m / 2))
-    throw LogicError("bad args to CKKS_canonicalEmbedding");
-
-  const half_FFT& hfft = palg.getHalfFFTInfo();
-  const cx_double* pow = &hfft.pow[0];
-
-  std::vector<cx_double> buf(m / 2);
   for (long i : range(0, sz))
     buf[i] = in[i] * pow[i];
   for (long i : range(sz, m / 2))
     buf[i] = 0;
-  hfft.fft.apply(&buf[0]);
+}
 
+static void storeCanonicalEmbedding(std::vector<cx_double>& v,
+                                    const cx_double* buf,
+                                    const PAlgebra& palg)
+{
+  long m = palg.getM();
   v.resize(m / 4);
   for (long i : range(m / 4))
     v[m / 4 - i - 1] = buf[palg.ith_rep(i) >> 1];
 }
 
+// Same, divided by divisor before rounding to float
+static void storeCanonicalEmbedding(std::vector<cx_float>& v,
+                                    const cx_double* buf,
+                                    const PAlgebra& palg,
+                                    double divisor)
+{
+  long m = palg.getM();
+  v.resize(m / 4);
+  for (long i : range(m / 4))
+    v[m / 4 - i - 1] = cx_float(buf[palg.ith_rep(i) >> 1] / divisor);
+}
+
+void CKKS_canonicalEmbedding(std::vector<cx_double>& v,
+                             const std::vector<double>& in,
+                             const PAlgebra& palg)
+{
+  HELIB_TIMER_START;
+
+  checkCanonicalEmbeddingArgs(in.size(), palg);
+
+  NTL_THREAD_LOCAL static std::vector<cx_double> buf;
+  buf.resize(palg.getM() / 2);
+  loadCanonicalEmbedding(buf.data(), in, palg);
+  palg.getHalfFFTInfo().fft.apply(buf.data());
+  storeCanonicalEmbedding(v, buf.data(), palg);
+}
+
+void CKKS_canonicalEmbedding(std::vector<cx_float>& v,
+                             const std::vector<double>& in,
+                             const PAlgebra& palg,
+                             double divisor)
+{
+  HELIB_TIMER_START;
+
+  checkCanonicalEmbeddingArgs(in.size(), palg);
+
+  NTL_THREAD_LOCAL static std::vector<cx_double> buf;
+  buf.resize(palg.getM() / 2);
+  loadCanonicalEmbedding(buf.data(), in, palg);
+  palg.getHalfFFTInfo().fft.apply(buf.data());
+  storeCanonicalEmbedding(v, buf.data(), palg, divisor);
+}
+
+void CKKS_canonicalEmbedding(std::vector<std::vector<cx_double>>& vs,
+                             const std::vector<std::vector<double>>& ins,
+                             const PAlgebra& palg)
+{
+  HELIB_TIMER_START;
+
+  long n = lsize(ins);
+  for (const auto& in : ins)
+    checkCanonicalEmbeddingArgs(in.size(), palg);
+
+  long len = palg.getM() / 2;
+  const PGFFT& fft = palg.getHalfFFTInfo().fft;
+  vs.resize(n);
+
+  long nBatches = divc(n, EMBED_BATCH);
+  NTL_EXEC_RANGE(nBatches, first, last)
+  NTL_THREAD_LOCAL static std::vector<cx_double> buf;
+  buf.resize(EMBED_BATCH * len);
+  for (long b : range(first, last)) {
+    long lo = b * EMBED_BATCH;
+    long cnt = std::min(EMBED_BATCH, n - lo);
+    for (long j : range(cnt))
+      loadCanonicalEmbedding(&buf[j * len], ins[lo + j], palg);
+    fft.apply_many(buf.data(), buf.data(), cnt);
+    for (long j : range(cnt))
+      storeCanonicalEmbedding(vs[lo + j], &buf[j * len], palg);
+  }
+  NTL_EXEC_RANGE_END
+}
+
 void CKKS_canonicalEmbedding(std::vector<cx_double>& v,
                              const zzX& f,
                              const PAlgebra& palg)
@@ -571,38 +655,46 @@ void CKKS_canonicalEmbedding(std::vector<cx_double>& v,
 // then applies D^{-1} * DFT^{-1}, and then reverses the expanding
 // step by dropping the complex part.
 
-void CKKS_embedInSlots(zzX& f,
-                       const std::vector<cx_double>& v,
-                       const PAlgebra& palg,
-                       double scaling)
-
+static void checkEmbedInSlotsArgs(const PAlgebra& palg)
 {
-  HELIB_TIMER_START;
+  if (!(palg.getP() == -1 && palg.getPow2() >= 2))
+    throw LogicError("bad args to CKKS_canonicalEmbedding");
+}
 
+// buf[0..m/2) = v with the missing conjugates reinserted, so that its half
+// FFT gives the coefficients up to the factors pow and m/2
+template <typename T>
+static void loadEmbedInSlots(cx_double* buf,
+                             const std::vector<std::complex<T>>& v,
+                             const PAlgebra& palg)
+{
   long v_sz = v.size();
   long m = palg.getM();
 
-  if (!(palg.getP() == -1 && palg.getPow2() >= 2))
-    throw LogicError("bad args to CKKS_canonicalEmbedding");
-
-  std::vector<cx_double> buf(m / 2, cx_double(0));
+  std::fill(buf, buf + m / 2, cx_double(0));
   for (long i : range(m / 4)) {
     long j = palg.ith_rep(i);
     long ii = m / 4 - i - 1;
     if (ii < v_sz) {
-      buf[j >> 1] = std::conj(v[ii]);
-      buf[(m - j) >> 1] = v[ii];
+      buf[j >> 1] = std::conj(cx_double(v[ii]));
+      buf[(m - j) >> 1] = cx_double(v[ii]);
     }
   }
+}
 
-  const half_FFT& hfft = palg.getHalfFFTInfo();
-  const cx_double* pow = &hfft.pow[0];
+// The m/2 coefficients f from the transformed buf, scaled by scaling and
+// rounded to the nearest integer
+static void storeEmbedInSlots(long* f,
+                              const cx_double* buf,
+                              const PAlgebra& palg,
+                              double scaling)
+{
+  long m = palg.getM();
+  const cx_double* pow = &palg.getHalfFFTInfo().pow[0];
 
   scaling /= (m / 2);
   // This is becuase DFT^{-1} = 1/(m/2) times a DFT matrix for conj(V)
 
-  hfft.fft.apply(&buf[0]);
-  f.SetLength(m / 2);
   for (long i : range(m / 2)) {
     double f_i = std::round(MUL(buf[i], pow[i]).real() * scaling);
     f[i] = f_i;
@@ -610,10 +702,92 @@ void CKKS_embedInSlots(zzX& f,
       throw LogicError("overflow in encoding");
     }
   }
+}
+
+// The m/2 coefficients of the inverse of the canonical embedding of v,
+// scaled by scaling and rounded to the nearest integer
+template <typename T>
+static void CKKS_embedInSlots(long* f,
+                              const std::vector<std::complex<T>>& v,
+                              const PAlgebra& palg,
+                              double scaling)
+{
+  HELIB_TIMER_START;
 
+  checkEmbedInSlotsArgs(palg);
+
+  NTL_THREAD_LOCAL static std::vector<cx_double> buf;
+  buf.resize(palg.getM() / 2);
+  loadEmbedInSlots(buf.data(), v, palg);
+  palg.getHalfFFTInfo().fft.apply(buf.data());
+  storeEmbedInSlots(f, buf.data(), palg, scaling);
+}
+
+void CKKS_embedInSlots(zzX& f,
+                       const std::vector<cx_double>& v,
+                       const PAlgebra& palg,
+                       double scaling)
+
+{
+  f.SetLength(palg.getM() / 2);
+  CKKS_embedInSlots(f.elts(), v, palg, scaling);
   normalize(f);
 }
 
+void CKKS_embedInSlots(zzX& f,
+                       const std::vector<cx_float>& v,
+                       const PAlgebra& palg,
+                       double scaling)
+{
+  f.SetLength(palg.getM() / 2);
+  CKKS_embedInSlots(f.elts(), v, palg, scaling);
+  normalize(f);
+}
+
+void CKKS_embedInSlots(std::vector<zzX>& fs,
+                       const std::vector<std::vector<cx_double>>& vs,
+                       const PAlgebra& palg,
+                       double scaling)
+{
+  HELIB_TIMER_START;
+
+  checkEmbedInSlotsArgs(palg);
+
+  long n = lsize(vs);
+  long len = palg.getM() / 2;
+  const PGFFT& fft = palg.getHalfFFTInfo().fft;
+  fs.resize(n);
+
+  long nBatches = divc(n, EMBED_BATCH);
+  NTL_EXEC_RANGE(nBatches, first, last)
+  NTL_THREAD_LOCAL static std::vector<cx_double> buf;
+  buf.resize(EMBED_BATCH * len);
+  for (long b : range(first, last)) {
+    long lo = b * EMBED_BATCH;
+    long cnt = std::min(EMBED_BATCH, n - lo);
+    for (long j : range(cnt))
+      loadEmbedInSlots(&buf[j * len], vs[lo + j], palg);
+    fft.apply_many(buf.data(), buf.data(), cnt);
+    for (long j : range(cnt)) {
+      zzX& f = fs[lo + j];
+      f.SetLength(len);
+      storeEmbedInSlots(f.elts(), &buf[j * len], palg, scaling);
+      normalize(f);
+    }
+  }
+  NTL_EXEC_RANGE_END
+}
+
+void CKKS_embedInSlots(DoubleCRT& f,
+                       const std::vector<cx_double>& v,
+                       const PAlgebra& palg,
+                       double scaling)
+{
+  std::vector<long> coeffs(palg.getM() / 2);
+  CKKS_embedInSlots(coeffs.data(), v, palg, scaling);
+  f.setCoeffs(coeffs);
+}
+
 // === obsolete versions of canonical embedding and inverse ===
 
 // These are less efficient, and seem to have some logic errors.
@@ -0,0 +1,145 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <helib/numa.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+namespace {
+
+// Parse a list of the form "0-3,8,10-11", as in the files of sysfs
+std::vector<long> parseCpuList(const std::string& list)
+{
+  std::vector<long> result;
+  std::istringstream str(list);
+  std::string range;
+  while (std::getline(str, range, ',')) {
+    if (range.empty() || range == "\n")
+      continue;
+    std::size_t dash = range.find('-');
+    try {
+      long first = std::stol(range.substr(0, dash));
+      long last = dash == std::string::npos ? first
+                                            : std::stol(range.substr(dash + 1));
+      for (long i = first; i <= last; i++)
+        result.push_back(i);
+    } catch (const std::exception&) {
+      return {};
+    }
+  }
+  return result;
+}
+
+std::string readLine(const std::string& path)
+{
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+struct NumaTopology
+{
+  std::vector<std::vector<long>> cpus; // the CPUs of each node
+  std::vector<long> nodeOfCpu;         // the node of each CPU
+
+  NumaTopology()
+  {
+#if defined(__linux__)
+    const std::string root = "/sys/devices/system/node/";
+    for (long node : parseCpuList(readLine(root + "online"))) {
+      std::vector<long> list = parseCpuList(
+          readLine(root + "node" + std::to_string(node) + "/cpulist"));
+      if (!list.empty())
+        cpus.push_back(list);
+    }
+#endif
+    if (cpus.empty()) { // a single node, with all the CPUs
+      long n = std::max(1u, std::thread::hardware_concurrency());
+      cpus.emplace_back();
+      for (long i = 0; i < n; i++)
+        cpus[0].push_back(i);
+    }
+    for (std::size_t node = 0; node < cpus.size(); node++)
+      for (long cpu : cpus[node]) {
+        if (cpu >= long(nodeOfCpu.size()))
+          nodeOfCpu.resize(cpu + 1, 0);
+        nodeOfCpu[cpu] = node;
+      }
+  }
+};
+
+const NumaTopology& topology()
+{
+  static const NumaTopology instance;
+  return instance;
+}
+
+// The node the calling thread was pinned to, or -1
+thread_local long pinnedNode = -1;
+
+} // namespace
+
+long NumaNodes() { return topology().cpus.size(); }
+
+const std::vector<long>& NumaNodeCpus(long node)
+{
+  assertInRange(node, 0l, NumaNodes(), "No such NUMA node");
+  return topology().cpus[node];
+}
+
+long CurrentNumaNode()
+{
+  if (pinnedNode >= 0)
+    return pinnedNode;
+  if (NumaNodes() == 1)
+    return 0;
+#if defined(__linux__)
+  long cpu = sched_getcpu();
+  const std::vector<long>& nodeOfCpu = topology().nodeOfCpu;
+  if (cpu >= 0 && cpu < long(nodeOfCpu.size()))
+    return nodeOfCpu[cpu];
+#endif
+  return 0;
+}
+
+bool PinThreadToNumaNode(long node)
+{
+  const std::vector<long>& cpus = NumaNodeCpus(node);
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (long cpu : cpus)
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    return false;
+  pinnedNode = node;
+  return true;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+} // namespace helib
@@ -0,0 +1,176 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <helib/perfCounters.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+std::atomic_bool perfCountersOn{false};
+
+const char* perfEventName(PerfEvent event)
+{
+  static const char* names[] = {"cycles",
+                                "instructions",
+                                "llc_references",
+                                "llc_misses"};
+  assertInRange(int(event),
+                0,
+                perfEventCount,
+                "perfEventName: no such event");
+  return names[int(event)];
+}
+
+PerfSample& PerfSample::operator+=(const PerfSample& other)
+{
+  for (int i = 0; i < perfEventCount; i++)
+    counts[i] += other.counts[i];
+  return *this;
+}
+
+PerfSample PerfSample::operator-(const PerfSample& other) const
+{
+  PerfSample diff;
+  for (int i = 0; i < perfEventCount; i++)
+    diff.counts[i] = counts[i] - other.counts[i];
+  return diff;
+}
+
+double PerfSample::ipc() const
+{
+  unsigned long cycles = (*this)[PerfEvent::CYCLES];
+  if (cycles == 0)
+    return 0;
+  return double((*this)[PerfEvent::INSTRUCTIONS]) / cycles;
+}
+
+PerfSample PerfScope::elapsed() const
+{
+  PerfSample now;
+  if (!valid || !readPerfCounters(now))
+    return PerfSample();
+  return now - start;
+}
+
+#ifdef __linux__
+
+namespace {
+
+// The counters of one thread: a group led by the first event that could be
+// opened, so that all of them are read with one system call
+struct ThreadCounters
+{
+  bool opened = false;
+  int leader = -1;
+  int fds[perfEventCount];
+  // The position of each event in the values of the group, or -1
+  int position[perfEventCount];
+  int members = 0;
+
+  ThreadCounters()
+  {
+    for (int i = 0; i < perfEventCount; i++) {
+      fds[i] = -1;
+      position[i] = -1;
+    }
+  }
+
+  ~ThreadCounters()
+  {
+    for (int fd : fds)
+      if (fd >= 0)
+        close(fd);
+  }
+
+  void open()
+  {
+    static const std::uint64_t configs[] = {PERF_COUNT_HW_CPU_CYCLES,
+                                            PERF_COUNT_HW_INSTRUCTIONS,
+                                            PERF_COUNT_HW_CACHE_REFERENCES,
+                                            PERF_COUNT_HW_CACHE_MISSES};
+    opened = true;
+    for (int i = 0; i < perfEventCount; i++) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[i];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      // pid 0 and cpu -1: the calling thread, on any CPU
+      long fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+      if (fd < 0)
+        continue;
+      fds[i] = int(fd);
+      if (leader < 0)
+        leader = int(fd);
+      position[i] = members++;
+    }
+  }
+
+  bool read(PerfSample& sample)
+  {
+    if (!opened)
+      open();
+    if (leader < 0)
+      return false;
+    // The number of values, then the values
+    std::uint64_t values[1 + perfEventCount];
+    ssize_t size = ::read(leader, values, sizeof(values));
+    if (size < ssize_t(sizeof(std::uint64_t)) ||
+        values[0] != std::uint64_t(members))
+      return false;
+    for (int i = 0; i < perfEventCount; i++)
+      sample.counts[i] = position[i] < 0 ? 0 : values[1 + position[i]];
+    return true;
+  }
+};
+
+thread_local ThreadCounters threadCounters;
+
+} // namespace
+
+bool readPerfCounters(PerfSample& sample)
+{
+  return threadCounters.read(sample);
+}
+
+#else
+
+bool readPerfCounters(PerfSample&) { return false; }
+
+#endif
+
+bool perfCountersAvailable()
+{
+  PerfSample sample;
+  return readPerfCounters(sample);
+}
+
+bool setPerfCounters(bool on)
+{
+  perfCountersOn = on;
+  return perfCountersAvailable();
+}
+
+bool arePerfCountersOn() { return perfCountersOn; }
+
+} // namespace helib
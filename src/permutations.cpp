@@ -10,8 +10,17 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
 #include <helib/permutations.h>
 #include <helib/EncryptedArray.h>
+#include <helib/Context.h>
+#include <helib/log.h>
+
+#include "binio.h"
 
 namespace helib {
 
@@ -583,4 +592,99 @@ void PermPrecomp::apply(PtxtArray& a) const
   ea.dispatch<perm_pa_impl>(a.pa, pi);
 }
 
+void PermPrecomp::writeTo(std::ostream& str) const
+{
+  write_ntl_vec_long(str, pi);
+  net.writeTo(str, ea);
+}
+
+std::unique_ptr<PermPrecomp> PermPrecomp::readFrom(std::istream& str,
+                                                   const EncryptedArray& ea)
+{
+  std::unique_ptr<PermPrecomp> ret(new PermPrecomp(ea));
+  read_ntl_vec_long(str, ret->pi);
+  assertEq<IOError>(ret->pi.length(),
+                    ea.size(),
+                    "PermPrecomp: permutation of the wrong size");
+  ret->net = PermNetwork::readFrom(str, ea);
+  return ret;
+}
+
+std::string PermPrecompCache::path(const PermIndepPrecomp& pip,
+                                   const Permut& pi) const
+{
+  if (directory.empty())
+    return "";
+  std::ostringstream name;
+  name << directory << "/perm-" << std::hex << std::setfill('0')
+       << std::setw(16) << pip.getEA().getContext().fingerprint() << "-"
+       << std::setw(16) << permutationHash(pi) << std::dec << "-d"
+       << pip.getDepth() << ".bin";
+  return name.str();
+}
+
+std::shared_ptr<const PermPrecomp> PermPrecompCache::get(
+    const PermIndepPrecomp& pip,
+    const Permut& pi)
+{
+  const EncryptedArray& ea = pip.getEA();
+  Key key(permutationHash(pi), ea.getContext().fingerprint(), pip.getDepth());
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = entries.find(key);
+  // A different permutation with the same hash, or the same context loaded
+  // again, misses
+  if (it != entries.end() && &it->second->getEA() == &ea &&
+      it->second->getPermutation() == pi)
+    return it->second;
+
+  std::shared_ptr<const PermPrecomp> entry;
+  std::string file = path(pip, pi);
+  if (!file.empty()) {
+    std::ifstream in(file, std::ios::binary);
+    if (in) {
+      try {
+        std::shared_ptr<const PermPrecomp> read =
+            PermPrecomp::readFrom(in, ea);
+        if (read->getPermutation() == pi)
+          entry = read;
+      } catch (const IOError& e) {
+        Warning(std::string("PermPrecompCache: rebuilding ") + file + ": " +
+                e.what());
+      }
+    }
+  }
+
+  if (!entry) {
+    auto built = std::make_shared<PermPrecomp>(pip, pi);
+    if (!file.empty()) {
+      // Written to the side and renamed, so that a reader never sees half
+      // of a file
+      std::string tmp = file + ".tmp";
+      {
+        std::ofstream out(tmp, std::ios::binary);
+        built->writeTo(out);
+      }
+      if (std::rename(tmp.c_str(), file.c_str()) != 0)
+        Warning("PermPrecompCache: could not write " + file);
+    }
+    entry = built;
+  }
+
+  entries[key] = entry;
+  return entry;
+}
+
+long PermPrecompCache::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+void PermPrecompCache::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+}
+
 } // namespace helib
@@ -9,14 +9,18 @@
  * See the License for the specific language governing permissions and
  * limitations under the License. See accompanying LICENSE file.
  */
+#include <cmath>
+#include <NTL/BasicThreadPool.h>
 #include <helib/Context.h>
 #include <helib/polyEval.h>
+#include <helib/timing.h>
 
 namespace helib {
 
 // Returns the e'th power of X, computing it as needed
 Ctxt& DynamicCtxtPowers::getPower(long e)
 {
+  std::lock_guard<std::recursive_mutex> lock(mtx);
   if (v.at(e - 1).isEmpty()) { // Not computed yet, compute it now
 
     // largest power of two smaller than e
@@ -28,6 +32,29 @@ Ctxt& DynamicCtxtPowers::getPower(long e)
   return v[e - 1];
 }
 
+// Compute X^1..X^e, with the same products as getPower
+void DynamicCtxtPowers::computePowers(long e)
+{
+  if (e <= 0)
+    e = size();
+  assertTrue<InvalidArgument>(e <= size(), "Not enough room for the powers");
+
+  std::lock_guard<std::recursive_mutex> lock(mtx);
+  for (long k = 1; k < e; k *= 2) {
+    // X^{k+1}..X^{2k} are X^{j-k}*X^k, which are all computed already
+    long n = std::min(2 * k, e) - k;
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++) {
+      long j = k + 1 + i;
+      if (v[j - 1].isEmpty()) {
+        v[j - 1] = v[j - k - 1];
+        v[j - 1].multiplyBy(v[k - 1]);
+      }
+    }
+    NTL_EXEC_RANGE_END
+  }
+}
+
 // Local functions for polynomial evaluation in some special cases
 static void simplePolyEval(Ctxt& ret,
                            const NTL::ZZX& poly,
@@ -125,48 +152,39 @@ static void recursivePolyEval(Ctxt& ret,
   ret += tmp;
 }
 
-// Main entry point: Evaluate a cleartext polynomial on an encrypted input
-void polyEval(Ctxt& ret, NTL::ZZX poly, const Ctxt& x, long k)
-// Note: poly is passed by value, so caller keeps the original
+// How many baby steps: set k~sqrt(n/2), rounded up/down to a power of two
+static long defaultBabySteps(long d)
 {
-  if (deg(poly) <= 2) {  // nothing to optimize here
-    if (deg(poly) < 1) { // A constant
-      ret.clear();
-      ret.addConstant(coeff(poly, 0));
-    } else { // A linear or quadratic polynomial
-      DynamicCtxtPowers babyStep(x, deg(poly));
-      simplePolyEval(ret, poly, babyStep);
-    }
-    return;
-  }
+  long kk = (long)sqrt(d / 2.0);
+  long k = 1L << NTL::NextPowerOfTwo(kk);
 
-  // How many baby steps: set k~sqrt(n/2), rounded up/down to a power of two
-
-  // FIXME: There may be some room for optimization here: it may be possible
-  // to choose k as something other than a power of two and still maintain
-  // optimal depth, in principle we can try all possible values of k between
-  // two consecutive powers of two and choose the one that gives the least
-  // number of multiplies, conditioned on minimum depth.
-
-  if (k <= 0) {
-    long kk = (long)sqrt(deg(poly) / 2.0);
-    k = 1L << NTL::NextPowerOfTwo(kk);
+  // heuristic: if k>>kk then use a smaller power of two
+  if ((k == 16 && d > 167) || (k > 16 && k > (1.44 * kk)))
+    k /= 2;
+  return k;
+}
 
-    // heuristic: if k>>kk then use a smaller power of two
-    if ((k == 16 && deg(poly) > 167) || (k > 16 && k > (1.44 * kk)))
-      k /= 2;
-  }
-#ifdef HELIB_DEBUG
-  std::cerr << "  k=" << k;
-#endif
+// How many giant steps X^k, X^{2k}, ... polyEvalFromPowers may use for a
+// polynomial of degree d > k
+static long giantStepsFor(long d, long k)
+{
+  long n = divc(d, k);
+  return (n == (1L << NTL::NextPowerOfTwo(n))) ? std::max(1L, n / 2) : n;
+}
 
+// Evaluate poly, of degree > babyStep.size() = k, from powers that may be
+// shared with other evaluations: babyStep holds X..X^k, and giantStep holds
+// X^k, X^{2k}, ... with at least giantStepsFor(deg(poly), k) powers
+static void polyEvalFromPowers(Ctxt& ret,
+                               NTL::ZZX poly,
+                               long k,
+                               DynamicCtxtPowers& babyStep,
+                               DynamicCtxtPowers& giantStep)
+{
   long n = divc(deg(poly), k); // n = ceil(deg(p)/k), deg(p) >= k*n
-  DynamicCtxtPowers babyStep(x, k);
-  const Ctxt& x2k = babyStep.getPower(k);
 
   // Special case when deg(p)>k*(2^e -1)
   if (n == (1L << NTL::NextPowerOfTwo(n))) { // n is a power of two
-    DynamicCtxtPowers giantStep(x2k, n / 2);
     degPowerOfTwo(ret, poly, k, babyStep, giantStep);
     return;
   }
@@ -174,7 +192,7 @@ void polyEval(Ctxt& ret, NTL::ZZX poly, const Ctxt& x, long k)
   // If n is not a power of two, ensure that poly is monic and that
   // its degree is divisible by k, then call the recursive procedure
 
-  const NTL::ZZ p = NTL::to_ZZ(x.getPtxtSpace());
+  const NTL::ZZ p = NTL::to_ZZ(babyStep[0].getPtxtSpace());
   NTL::ZZ top = LeadCoeff(poly);
   NTL::ZZ topInv; // the inverse mod p of the top coefficient of poly (if any)
   bool divisible = (n * k == deg(poly)); // is the degree divisible by k?
@@ -197,9 +215,6 @@ void polyEval(Ctxt& ret, NTL::ZZX poly, const Ctxt& x, long k)
     SetCoeff(poly, n * k); // set the top coefficient of X^{n*k} to one
   }
 
-  long t = IsZero(extra) ? divc(n, 2) : n;
-  DynamicCtxtPowers giantStep(x2k, t);
-
   if (!IsOne(top)) {
     poly *= topInv; // Multiply by topInv to make into a monic polynomial
     for (long i = 0; i <= n * k; i++)
@@ -219,6 +234,42 @@ void polyEval(Ctxt& ret, NTL::ZZX poly, const Ctxt& x, long k)
   }
 }
 
+// Main entry point: Evaluate a cleartext polynomial on an encrypted input
+void polyEval(Ctxt& ret, NTL::ZZX poly, const Ctxt& x, long k)
+// Note: poly is passed by value, so caller keeps the original
+{
+  if (deg(poly) <= 2) {  // nothing to optimize here
+    if (deg(poly) < 1) { // A constant
+      ret.clear();
+      ret.addConstant(coeff(poly, 0));
+    } else { // A linear or quadratic polynomial
+      DynamicCtxtPowers babyStep(x, deg(poly));
+      simplePolyEval(ret, poly, babyStep);
+    }
+    return;
+  }
+
+  // How many baby steps: set k~sqrt(n/2), rounded up/down to a power of two
+
+  // FIXME: There may be some room for optimization here: it may be possible
+  // to choose k as something other than a power of two and still maintain
+  // optimal depth, in principle we can try all possible values of k between
+  // two consecutive powers of two and choose the one that gives the least
+  // number of multiplies, conditioned on minimum depth.
+
+  if (k <= 0)
+    k = defaultBabySteps(deg(poly));
+#ifdef HELIB_DEBUG
+  std::cerr << "  k=" << k;
+#endif
+
+  DynamicCtxtPowers babyStep(x, k);
+  babyStep.computePowers(); // nearly all of them are used
+  DynamicCtxtPowers giantStep(babyStep.getPower(k),
+                              giantStepsFor(deg(poly), k));
+  polyEvalFromPowers(ret, poly, k, babyStep, giantStep);
+}
+
 // Simple evaluation sum f_i * X^i, assuming that babyStep has enough powers
 static void simplePolyEval(Ctxt& ret,
                            const NTL::ZZX& poly,
@@ -294,16 +345,23 @@ static void PatersonStockmeyer(Ctxt& ret,
     rem(s[i], s[i], p);
   s.normalize();
 
-  // Evaluate recursively poly = (c+X^{kt})*q + s'
-  PatersonStockmeyer(ret, q, k, t / 2, delta, babyStep, giantStep);
-
+  // Evaluate recursively poly = (c+X^{kt})*q + s', the three parts
+  // are independent
   Ctxt tmp(ret.getPubKey(), ret.getPtxtSpace());
-  simplePolyEval(tmp, c, babyStep);
-  tmp += giantStep.getPower(t);
+  Ctxt tmp2(ret.getPubKey(), ret.getPtxtSpace());
+  NTL_EXEC_RANGE(3, first, last)
+  for (long i = first; i < last; i++) {
+    if (i == 0)
+      PatersonStockmeyer(ret, q, k, t / 2, delta, babyStep, giantStep);
+    else if (i == 1) {
+      simplePolyEval(tmp, c, babyStep);
+      tmp += giantStep.getPower(t);
+    } else
+      PatersonStockmeyer(tmp2, s, k, t / 2, delta, babyStep, giantStep);
+  }
+  NTL_EXEC_RANGE_END
   ret.multiplyBy(tmp);
-
-  PatersonStockmeyer(tmp, s, k, t / 2, delta, babyStep, giantStep);
-  ret += tmp;
+  ret += tmp2;
 }
 
 // This procedure assumes that k*(2^e +1) > deg(poly) > k*(2^e -1),
@@ -325,15 +383,21 @@ static void degPowerOfTwo(Ctxt& ret,
   SetCoeff(r, (n - 1) * k);                   // monic, degree == k(2^e-1)
   q -= 1;
 
-  PatersonStockmeyer(ret, r, k, n / 2, 0, babyStep, giantStep);
-
   Ctxt tmp(ret.getPubKey(), ret.getPtxtSpace());
-  simplePolyEval(tmp, q, babyStep); // evaluate q
-
-  // multiply by X^{k(n-1)} with minimum depth
-  for (long i = 1; i < n; i *= 2) {
-    tmp.multiplyBy(giantStep.getPower(i));
+  NTL_EXEC_RANGE(2, first, last)
+  for (long j = first; j < last; j++) {
+    if (j == 0)
+      PatersonStockmeyer(ret, r, k, n / 2, 0, babyStep, giantStep);
+    else {
+      simplePolyEval(tmp, q, babyStep); // evaluate q
+
+      // multiply by X^{k(n-1)} with minimum depth
+      for (long i = 1; i < n; i *= 2) {
+        tmp.multiplyBy(giantStep.getPower(i));
+      }
+    }
   }
+  NTL_EXEC_RANGE_END
   ret += tmp;
 }
 
@@ -376,18 +440,319 @@ static void recursivePolyEval(Ctxt& ret,
   q -= 1;
   SetCoeff(r, u); // degree == u
 
-  PatersonStockmeyer(ret, q, k, t / 2, 0, babyStep, giantStep);
-
-  Ctxt tmp = giantStep.getPower(u / k);
-  if (delta != 0) { // if u is not divisible by k then compute it
-    tmp.multiplyBy(babyStep.getPower(delta));
+  Ctxt tmp(ret.getPubKey(), ret.getPtxtSpace());
+  Ctxt tmp2(ret.getPubKey(), ret.getPtxtSpace());
+  NTL_EXEC_RANGE(3, first, last)
+  for (long i = first; i < last; i++) {
+    if (i == 0)
+      PatersonStockmeyer(ret, q, k, t / 2, 0, babyStep, giantStep);
+    else if (i == 1) {
+      tmp = giantStep.getPower(u / k);
+      if (delta != 0) { // if u is not divisible by k then compute it
+        tmp.multiplyBy(babyStep.getPower(delta));
+      }
+    } else
+      recursivePolyEval(tmp2, r, k, babyStep, giantStep);
   }
+  NTL_EXEC_RANGE_END
   ret.multiplyBy(tmp);
+  ret += tmp2;
+}
+
+// Evaluate the same cleartext polynomial on many encrypted inputs
+void polyEvalBatch(std::vector<Ctxt>& ret,
+                   const NTL::ZZX& poly,
+                   const std::vector<Ctxt>& xs,
+                   long k)
+{
+  long n = xs.size();
+  if (&ret != &xs)
+    ret = xs; // just to get n ciphertexts with the right keys
+  if (n < 1)
+    return;
+
+  // Reduce the coefficients and choose the baby steps once for all inputs
+  NTL::ZZX reduced;
+  const NTL::ZZ p = NTL::to_ZZ(xs[0].getPtxtSpace());
+  for (long i = 0; i <= deg(poly); i++)
+    SetCoeff(reduced, i, rem(coeff(poly, i), p));
+  reduced.normalize();
+  if (k <= 0 && deg(reduced) > 2)
+    k = defaultBabySteps(deg(reduced));
+
+  // Too few inputs to keep all the threads busy, let each evaluation
+  // parallelize internally instead
+  if (n >= NTL::AvailableThreads()) {
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++)
+      polyEval(ret[i], reduced, ret[i], k);
+    NTL_EXEC_RANGE_END
+  } else {
+    for (long i = 0; i < n; i++)
+      polyEval(ret[i], reduced, ret[i], k);
+  }
+}
+
+void polyEvalMany(std::vector<Ctxt>& ret,
+                  const std::vector<NTL::ZZX>& polys,
+                  const Ctxt& x,
+                  long k)
+{
+  long n = polys.size();
+
+  // Reduce the coefficients, and choose the baby steps for the largest degree
+  const NTL::ZZ p = NTL::to_ZZ(x.getPtxtSpace());
+  std::vector<NTL::ZZX> reduced(n);
+  long maxDeg = 0;
+  for (long j = 0; j < n; j++) {
+    for (long i = 0; i <= deg(polys[j]); i++)
+      SetCoeff(reduced[j], i, rem(coeff(polys[j], i), p));
+    reduced[j].normalize();
+    maxDeg = std::max(maxDeg, deg(reduced[j]));
+  }
+  if (k <= 0)
+    k = (maxDeg > 2) ? defaultBabySteps(maxDeg) : maxDeg;
+  k = std::max(k, 1L);
+
+  // The powers are taken before ret is touched, as x may be one of its
+  // elements
+  DynamicCtxtPowers babyStep(x, k);
+  babyStep.computePowers();
+  long nGiant = 1;
+  for (long j = 0; j < n; j++)
+    if (deg(reduced[j]) > k)
+      nGiant = std::max(nGiant, giantStepsFor(deg(reduced[j]), k));
+  DynamicCtxtPowers giantStep(babyStep.getPower(k), nGiant);
+  ret.assign(n, Ctxt(ZeroCtxtLike, babyStep[0]));
+
+  // Both sets of powers are shared by all the evaluations, each computed
+  // once by whichever evaluation needs it first
+  auto evalOne = [&](long j) {
+    if (deg(reduced[j]) <= k)
+      simplePolyEval(ret[j], reduced[j], babyStep);
+    else
+      polyEvalFromPowers(ret[j], reduced[j], k, babyStep, giantStep);
+  };
+  if (n >= NTL::AvailableThreads()) {
+    NTL_EXEC_RANGE(n, first, last)
+    for (long j = first; j < last; j++)
+      evalOne(j);
+    NTL_EXEC_RANGE_END
+  } else {
+    for (long j = 0; j < n; j++)
+      evalOne(j);
+  }
+}
+
+/********************************************************************/
+/****************** Chebyshev-basis evaluation (CKKS) ***************/
+
+double mapToChebyshevInterval(double x, double a, double b)
+{
+  assertTrue<InvalidArgument>(a < b, "Empty interval [a,b]");
+  return (2 * x - a - b) / (b - a);
+}
+
+void mapToChebyshevInterval(Ctxt& x, double a, double b)
+{
+  assertTrue<InvalidArgument>(a < b, "Empty interval [a,b]");
+  if (a == -1.0 && b == 1.0)
+    return; // nothing to do
+  x.multByConstant(2 / (b - a));
+  x.addConstant(-(a + b) / (b - a));
+}
+
+// c_i = (2/(d+1)) sum_j f(x_j) T_i(y_j), with the nodes y_j = cos(theta_j),
+// theta_j = pi(j+1/2)/(d+1), x_j their pre-images in [a,b], and c_0 halved
+std::vector<double> chebyshevCoefficients(
+    const std::function<double(double)>& f,
+    long d,
+    double a,
+    double b)
+{
+  assertTrue<InvalidArgument>(d >= 0, "Negative degree");
+  assertTrue<InvalidArgument>(a < b, "Empty interval [a,b]");
+  const double pi = std::acos(-1.0);
+  long n = d + 1;
+
+  std::vector<double> fx(n);
+  for (long j = 0; j < n; j++) {
+    double y = std::cos(pi * (j + 0.5) / n);
+    fx[j] = f((y * (b - a) + a + b) / 2);
+  }
+  std::vector<double> coeffs(n);
+  for (long i = 0; i < n; i++) {
+    double sum = 0;
+    for (long j = 0; j < n; j++)
+      sum += fx[j] * std::cos(pi * i * (j + 0.5) / n);
+    coeffs[i] = 2 * sum / n;
+  }
+  coeffs[0] /= 2;
+  return coeffs;
+}
+
+// Clenshaw's recurrence
+double evalChebyshevSeries(const std::vector<double>& coeffs, double y)
+{
+  double b1 = 0, b2 = 0;
+  for (long i = lsize(coeffs) - 1; i >= 1; i--) {
+    double b0 = 2 * y * b1 - b2 + coeffs[i];
+    b2 = b1;
+    b1 = b0;
+  }
+  return (coeffs.empty() ? 0.0 : coeffs[0]) + y * b1 - b2;
+}
+
+// Set ret = 2*a*b - c, with c = T_0 = 1 if c is null
+static void chebyshevProduct(Ctxt& ret,
+                             const Ctxt& a,
+                             const Ctxt& b,
+                             const Ctxt* c)
+{
+  ret = a;
+  ret.multiplyBy(b);
+  ret.multByConstant(2.0);
+  if (c == nullptr)
+    ret.addConstant(-1.0);
+  else
+    ret -= *c;
+}
+
+// Evaluate a series of degree < k using the baby steps T_1..T_{k-1},
+// only scalar multiplications and additions: no new levels are consumed
+static void chebyshevLinear(Ctxt& ret,
+                            const std::vector<double>& c,
+                            const std::vector<Ctxt>& baby)
+{
+  ret.clear();
+  for (long i = 1; i < lsize(c); i++) {
+    if (c[i] == 0)
+      continue;
+    Ctxt tmp(baby[i]);
+    tmp.multByConstant(c[i]);
+    ret += tmp;
+  }
+  if (ret.isEmpty()) { // an encryption of zero with a valid scaling factor
+    ret = baby[1];
+    ret -= baby[1];
+  }
+  if (!c.empty())
+    ret.addConstant(c[0]);
+}
+
+// Evaluate sum_i c_i T_i, the giant steps are giant[i] = T_{k*2^i}
+static void chebyshevRecursive(Ctxt& ret,
+                               const std::vector<double>& c,
+                               long k,
+                               const std::vector<Ctxt>& baby,
+                               const std::vector<Ctxt>& giant)
+{
+  long deg = lsize(c) - 1;
+  while (deg > 0 && c[deg] == 0)
+    deg--;
+  if (deg < k) {
+    chebyshevLinear(ret, std::vector<double>(c.begin(), c.begin() + deg + 1),
+                    baby);
+    return;
+  }
 
-  recursivePolyEval(tmp, r, k, babyStep, giantStep);
+  // The largest giant step m = k*2^i <= deg, so deg < 2m
+  long i = 0;
+  while ((k << (i + 1)) <= deg)
+    i++;
+  long m = k << i;
+
+  // Divide by T_m: 2 T_m T_j = T_{m+j} + T_{m-j} gives
+  // sum_{n>=m} c_n T_n = T_m * q(x) - sum_{j>0} c_{m+j} T_{m-j}
+  std::vector<double> q(deg - m + 1), r(c.begin(), c.begin() + m);
+  q[0] = c[m];
+  for (long j = 1; j <= deg - m; j++) {
+    q[j] = 2 * c[m + j];
+    r[m - j] -= c[m + j];
+  }
+
+  // The quotient and remainder are independent
+  Ctxt tmp(ZeroCtxtLike, ret);
+  NTL_EXEC_RANGE(2, first, last)
+  for (long part = first; part < last; part++) {
+    if (part == 0)
+      chebyshevRecursive(tmp, q, k, baby, giant);
+    else
+      chebyshevRecursive(ret, r, k, baby, giant);
+  }
+  NTL_EXEC_RANGE_END
+  tmp.multiplyBy(giant[i]); // the only non-scalar multiply at this level
   ret += tmp;
 }
 
+void chebyshevEval(Ctxt& ret,
+                   const std::vector<double>& coeffs,
+                   const Ctxt& x,
+                   long k)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(x.isCKKS(), "Chebyshev evaluation is for CKKS");
+  assertFalse<InvalidArgument>(coeffs.empty(), "No coefficients");
+  long deg = lsize(coeffs) - 1;
+  while (deg > 0 && coeffs[deg] == 0)
+    deg--;
+
+  if (k <= 0) // about sqrt(deg), a power of two
+    k = 1L << ((NTL::NumBits(deg) + 1) / 2);
+  assertTrue<InvalidArgument>(k == (1L << (NTL::NumBits(k) - 1)),
+                              "Number of baby steps must be a power of two");
+
+  // Baby steps T_1..T_{min(k,deg)}. For h a power of two and h < j <= 2h,
+  // T_j = 2 T_h T_{j-h} - T_{2h-j}, and these only depend on T_1..T_h
+  long nBaby = std::max(1L, std::min(k, deg));
+  std::vector<Ctxt> baby(nBaby + 1, Ctxt(ZeroCtxtLike, x));
+  baby[1] = x;
+  for (long h = 1; h < nBaby; h *= 2) {
+    long n = std::min(2 * h, nBaby) - h;
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++) {
+      long j = h + 1 + i;
+      chebyshevProduct(baby[j],
+                       baby[h],
+                       baby[j - h],
+                       (j == 2 * h) ? nullptr : &baby[2 * h - j]);
+    }
+    NTL_EXEC_RANGE_END
+  }
+
+  // Giant steps T_k, T_2k, T_4k,... up to deg, with T_2m = 2 T_m^2 - 1
+  std::vector<Ctxt> giant;
+  if (deg >= k) {
+    giant.push_back(baby[k]);
+    while ((k << lsize(giant)) <= deg) {
+      Ctxt tmp(ZeroCtxtLike, x);
+      chebyshevProduct(tmp, giant.back(), giant.back(), nullptr);
+      giant.push_back(tmp);
+    }
+  }
+
+  Ctxt tmp(ZeroCtxtLike, x); // ret may alias x
+  chebyshevRecursive(tmp,
+                     std::vector<double>(coeffs.begin(),
+                                         coeffs.begin() + deg + 1),
+                     k,
+                     baby,
+                     giant);
+  ret = tmp;
+}
+
+void chebyshevEval(Ctxt& ret,
+                   const std::function<double(double)>& f,
+                   long d,
+                   const Ctxt& x,
+                   double a,
+                   double b)
+{
+  Ctxt y(x);
+  mapToChebyshevInterval(y, a, b);
+  chebyshevEval(ret, chebyshevCoefficients(f, d, a, b), y);
+}
+
 // raise ciphertext to some power
 void Ctxt::power(long e)
 {
@@ -304,6 +304,12 @@ PowerfulDCRT::PowerfulDCRT(const Context& _context,
     NTL::zz_p::FFTInit(i);
     pConvVec[i].initPConv(indexes); // initialize tables
   }
+
+  dcrtConvVec.SetLength(context.numPrimes());
+  for (long i : range(context.numPrimes())) {
+    context.ithModulus(i).restoreModulus();
+    dcrtConvVec[i].initPConv(indexes);
+  }
 }
 
 void PowerfulDCRT::ZZXtoPowerful(NTL::Vec<NTL::ZZ>& out,
@@ -393,19 +399,55 @@ void PowerfulDCRT::powerfulToZZX(NTL::ZZX& poly,
 void PowerfulDCRT::dcrtToPowerful(NTL::Vec<NTL::ZZ>& powerful,
                                   const DoubleCRT& dcrt) const
 {
-  NTL::ZZX poly;
-  dcrt.toPoly(poly);
-
-  if (triv) {
-    long phim = context.getPhiM();
-    NTL::VectorCopy(powerful, poly, phim);
+  if (triv || isDryRun()) {
+    NTL::ZZX poly;
+    dcrt.toPoly(poly);
+    if (triv) {
+      long phim = context.getPhiM();
+      NTL::VectorCopy(powerful, poly, phim);
+      return;
+    }
+    NTL::Vec<NTL::ZZ> pwfl;
+    this->ZZXtoPowerful(pwfl, poly);
+    NTL::ZZ Q = context.productOfPrimes(dcrt.getIndexSet());
+    vecRed(powerful, pwfl, Q, /*abs=*/false);
     return;
   }
 
-  NTL::Vec<NTL::ZZ> pwfl;
-  this->ZZXtoPowerful(pwfl, poly);
-  NTL::ZZ Q = context.productOfPrimes(dcrt.getIndexSet());
-  vecRed(powerful, pwfl, Q, /*abs=*/false);
+  // The conversion is linear over the integers, so it commutes with the
+  // reduction modulo each prime: convert every row on its own, rather than
+  // lifting dcrt to big integers and converting them modulo enough FFT
+  // primes to hold them.
+  const IndexSet& s = dcrt.getIndexSet();
+  std::vector<long> ivec;
+  for (long i : s)
+    ivec.push_back(i);
+  long icard = ivec.size();
+  NTL::Vec<NTL::vec_zz_p> rows;
+  rows.SetLength(icard);
+
+  NTL_EXEC_RANGE(icard, first, last)
+  NTL::zz_pPush push; // backup NTL's current modulus
+  NTL::zz_pX poly;
+  HyperCube<NTL::zz_p> pwfl(indexes.shortSig);
+  for (long j : range(first, last)) {
+    const Cmodulus& mod = context.ithModulus(ivec[j]);
+    mod.restoreModulus();
+    mod.iFFT(poly, dcrt.getMap()[ivec[j]]);
+    dcrtConvVec[ivec[j]].polyToPowerful(pwfl, poly);
+    rows[j] = pwfl.getData();
+  }
+  NTL_EXEC_RANGE_END
+
+  NTL::zz_pPush push; // backup NTL's current modulus
+  NTL::Vec<NTL::ZZ> res;
+  res.SetLength(context.getPhiM());
+  NTL::ZZ product{1};
+  for (long j : range(icard)) {
+    context.ithModulus(ivec[j]).restoreModulus();
+    NTL::CRT(res, product, rows[j]);
+  }
+  vecRed(powerful, res, product, /*abs=*/false);
   // reduce to interval [-Q/2,+Q/2]
 }
 
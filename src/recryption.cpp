@@ -10,10 +10,14 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 #include <NTL/BasicThreadPool.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
 
 #include <helib/recryption.h>
 #include <helib/EncryptedArray.h>
 #include <helib/EvalMap.h>
+#include <helib/matmul.h>
 #include <helib/powerful.h>
 #include <helib/CtPtrs.h>
 #include <helib/intraSlot.h>
@@ -22,6 +26,9 @@
 #include <helib/debugging.h>
 #include <helib/fhe_stats.h>
 #include <helib/log.h>
+#include <helib/multicore.h>
+
+#include "binio.h"
 
 #ifdef HELIB_DEBUG
 
@@ -53,6 +60,79 @@ static void checkRecryptBounds_v(const std::vector<NTL::ZZX>& v,
 
 namespace helib {
 
+static std::function<void(const RecryptStageReport&)> recryptReporter;
+
+void setRecryptReporter(
+    std::function<void(const RecryptStageReport&)> reporter)
+{
+  recryptReporter = std::move(reporter);
+}
+
+std::ostream& operator<<(std::ostream& str, const RecryptStageReport& report)
+{
+  return str << report.stage << ": ctxts=" << report.ciphertexts
+             << " wall=" << report.wallTime << " cpu=" << report.cpuTime
+             << " keySwitches=" << report.keySwitches
+             << " ntts=" << report.ntts << " noise=" << report.noiseBefore
+             << "->" << report.noiseAfter
+             << " capacity=" << report.capacityBefore << "->"
+             << report.capacityAfter;
+}
+
+// Measures the stages of a recryption of n ciphertexts, from start to
+// stop, and hands each one to the reporter. Does nothing without one.
+class RecryptStageProbe
+{
+  const Ctxt* cts;
+  long n;
+  RecryptStageReport report;
+  std::chrono::steady_clock::time_point wallStart;
+  std::clock_t cpuStart;
+  long keySwitchesStart;
+  long nttsStart;
+
+  void measure(double& noise, double& capacity) const
+  {
+    noise = -DBL_MAX;
+    capacity = DBL_MAX;
+    for (long i : range(n)) {
+      double bits = NTL::log(cts[i].getNoiseBound()) / std::log(2.0);
+      noise = std::max(noise, bits);
+      capacity = std::min(capacity, cts[i].capacity());
+    }
+  }
+
+public:
+  RecryptStageProbe(const Ctxt* cts, long n) : cts(cts), n(n) {}
+
+  void start(const char* stage)
+  {
+    if (!recryptReporter)
+      return;
+    report.stage = stage;
+    report.ciphertexts = n;
+    measure(report.noiseBefore, report.capacityBefore);
+    keySwitchesStart = fhe_ops.keySwitches;
+    nttsStart = fhe_ops.ntts;
+    cpuStart = std::clock();
+    wallStart = std::chrono::steady_clock::now();
+  }
+
+  void stop()
+  {
+    if (!recryptReporter)
+      return;
+    std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - wallStart;
+    report.wallTime = wall.count();
+    report.cpuTime = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    report.keySwitches = fhe_ops.keySwitches - keySwitchesStart;
+    report.ntts = fhe_ops.ntts - nttsStart;
+    measure(report.noiseAfter, report.capacityAfter);
+    recryptReporter(report);
+  }
+};
+
 // Return in poly a polynomial with X^i encoded in all the slots
 static void x2iInSlots(NTL::ZZX& poly,
                        long i,
@@ -266,14 +346,95 @@ bool RecryptData::operator==(const RecryptData& other) const
   return true;
 }
 
+static void readRecryptMapsBegin(std::istream& str, bool expectMaps)
+{
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::RECRYPT_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find pre-recryption-maps eye catcher");
+  assertEq<IOError>(read_raw_int(str) != 0,
+                    expectMaps,
+                    "RecryptData: linear maps do not match the context");
+}
+
+static void readRecryptMapsEnd(std::istream& str)
+{
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::RECRYPT_END);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-recryption-maps eye catcher");
+}
+
+void RecryptData::writeMapsTo(std::ostream& str) const
+{
+  writeEyeCatcher(str, EyeCatcher::RECRYPT_BEGIN);
+  write_raw_int(str, firstMap != nullptr);
+  if (firstMap) {
+    firstMap->writeTo(str);
+    secondMap->writeTo(str);
+  }
+  writeEyeCatcher(str, EyeCatcher::RECRYPT_END);
+}
+
+CKKSRecryptData::CKKSRecryptData(const Context& context)
+{
+  const PAlgebra& zMStar = context.getZMStar();
+  long m = zMStar.getM();
+  long n = zMStar.getPhiM() / 2; // the number of slots
+  const double pi = std::acos(-1.0);
+
+  // I = round((c0 + c1 s)/q0) is bounded as the recryption overflow of BGV
+  overflowBound = std::ceil(context.boundForRecryption());
+
+  // The sine errs by about (2pi)^2/6 2^{-2 kappa} of the plaintext
+  // magnitude, and the r bits of precision of the slots holding x, which are
+  // up to (overflowBound+1) 2^kappa times larger than the plaintext, give
+  // the other term of the error. This kappa takes both to the same size,
+  // 2.72 being log2((2pi)^2/6).
+  long r = context.getAlMod().getR();
+  double logBound = std::log2(overflowBound + 1.0);
+  kappa = std::max(1L, long(std::ceil((r - logBound + 2.72) / 3)));
+
+  // |y| is then at most 1/4, where the series errs by less than 2^-31
+  taylorDegree = 7;
+  squarings = long(std::ceil(std::log2(2 * pi * (overflowBound + 1)))) + 2;
+
+  // Slot j holds f(zeta_j) for the root zeta_j = e^{2 pi i t_j/m}, which the
+  // embedding of X gives away
+  std::vector<cx_double> roots;
+  CKKS_canonicalEmbedding(roots, std::vector<double>{0.0, 1.0}, zMStar);
+  std::vector<long> t(n);
+  for (long j : range(n))
+    t[j] = mcMod(std::lround(std::arg(roots[j]) * m / (2 * pi)), m);
+  std::vector<cx_double> omega(m); // omega[k] = e^{2 pi i k/m}
+  for (long k : range(m))
+    omega[k] = std::polar(1.0, 2 * pi * k / m);
+
+  // The roots come in conjugate pairs, so the coefficients of the real f
+  // are f_k = Re((1/n) sum_j f(zeta_j) zeta_j^{-k}). Entry (i, j) of a
+  // matrix maps input slot i to output slot j.
+  for (long h : range(2)) {
+    MatMul_CKKS_Complex toSlots(context, [&](long j, long k) {
+      return omega[mcMod(-t[j] * (k + h * n), m)] / double(n);
+    });
+    coeffToSlot[h] = std::make_shared<EncodedMatMul_CKKS>(toSlots);
+
+    MatMul_CKKS_Complex toCoeffs(context, [&](long k, long j) {
+      return omega[mcMod(t[j] * (k + h * n), m)];
+    });
+    slotToCoeff[h] = std::make_shared<EncodedMatMul_CKKS>(toCoeffs);
+  }
+}
+
 // The main method
 void RecryptData::init(const Context& context,
                        const NTL::Vec<long>& mvec_,
                        bool enableThick,
                        bool build_cache_,
-                       bool minimal)
+                       bool minimal,
+                       std::istream* maps)
 {
-  if (alMod != nullptr) { // were we called for a second time?
+  MemoryScope memoryScope(MemoryCategory::BOOTSTRAPPING);
+  // were we called for a second time?
+  if (alMod != nullptr || ckks != nullptr) {
     std::cerr << "@Warning: multiple calls to RecryptData::init\n";
     return;
   }
@@ -301,6 +462,15 @@ void RecryptData::init(const Context& context,
   }
 
   skHwt = context.getHwt();
+
+  // CKKS has no digits to extract, and no maps are written for it
+  if (context.isCKKS()) {
+    assertTrue<LogicError>(skHwt > 0,
+                           "Bootstrapping CKKS needs a sparse secret key");
+    ckks = std::make_shared<CKKSRecryptData>(context);
+    return;
+  }
+
   e = context.getE();
   ePrime = context.getEPrime();
 
@@ -313,8 +483,14 @@ void RecryptData::init(const Context& context,
 
   p2dConv = std::make_shared<PowerfulDCRT>(context, mvec);
 
-  if (!enableThick)
+  if (maps)
+    readRecryptMapsBegin(*maps, enableThick);
+
+  if (!enableThick) {
+    if (maps)
+      readRecryptMapsEnd(*maps);
     return;
+  }
 
   // Initialize the linear polynomial for unpacking the slots
   NTL::zz_pBak bak;
@@ -342,6 +518,12 @@ void RecryptData::init(const Context& context,
       v[k] = C[j];
     ea->encode(unpackSlotEncoding[j], v);
   }
+  if (maps) {
+    firstMap = EvalMap::readFrom(*maps, *ea, true);
+    secondMap = EvalMap::readFrom(*maps, context.getEA(), false);
+    readRecryptMapsEnd(*maps);
+    return;
+  }
   firstMap = std::make_shared<EvalMap>(*ea, minimal, mvec, true, build_cache);
   secondMap = std::make_shared<EvalMap>(context.getEA(),
                                         minimal,
@@ -353,68 +535,72 @@ void RecryptData::init(const Context& context,
 /********************************************************************/
 /********************************************************************/
 
-// Extract digits from fully packed slots
+// Extract digits from fully packed slots, with the given algorithm for the
+// digits of each unpacked slot
 void extractDigitsPacked(Ctxt& ctxt,
                          long botHigh,
                          long r,
                          long ePrime,
-                         const std::vector<NTL::ZZX>& unpackSlotEncoding);
+                         const std::vector<NTL::ZZX>& unpackSlotEncoding,
+                         DigitExtraction method);
 
 // Extract digits from unpacked slots
-void extractDigitsThin(Ctxt& ctxt, long botHigh, long r, long ePrime);
-
-// bootstrap a ciphertext to reduce noise
-void PubKey::reCrypt(Ctxt& ctxt) const
+void extractDigitsThin(Ctxt& ctxt,
+                       long botHigh,
+                       long r,
+                       long ePrime,
+                       DigitExtraction method);
+
+// The driver of the batch versions of reCrypt and thinReCrypt. The empty
+// and dummy ciphertexts are handed to single, which deals with them on the
+// spot, and all the others go through stages together.
+template <typename Trivial, typename Single, typename Stages>
+static void recryptBatch(std::vector<Ctxt>& ctxts,
+                         Trivial trivial,
+                         Single single,
+                         Stages stages)
 {
-  HELIB_TIMER_START;
+  std::vector<long> idx;
+  for (long i : range(lsize(ctxts))) {
+    if (trivial(ctxts[i]))
+      single(ctxts[i]);
+    else
+      idx.push_back(i);
+  }
 
-  // Some sanity checks for dummy ciphertext
-  long ptxtSpace = ctxt.getPtxtSpace();
-  if (ctxt.isEmpty())
+  if (idx.empty())
     return;
-  if (ctxt.parts.size() == 1 && ctxt.parts[0].skHandle.isOne()) {
-    // Dummy encryption, just ensure that it is reduced mod p
-    NTL::ZZX poly = to_ZZX(ctxt.parts[0]);
-    for (long i = 0; i < poly.rep.length(); i++)
-      poly[i] = NTL::to_ZZ(rem(poly[i], ptxtSpace));
-    poly.normalize();
-    ctxt.DummyEncrypt(poly);
+  if (lsize(idx) == 1) {
+    single(ctxts[idx[0]]);
+    return;
+  }
+  for (long i : idx)
+    fhe_ops.reCrypts.add(ctxts[i].getPrimeSet().card());
+  if (lsize(idx) == lsize(ctxts)) {
+    stages(ctxts);
     return;
   }
 
-  // check that we have bootstrapping data
-  assertTrue(recryptKeyID >= 0l, "No bootstrapping data");
-
-  long p = getContext().getP();
-  long r = getContext().getAlMod().getR();
-  long p2r = getContext().getAlMod().getPPowR();
+  // Only some of them need bootstrapping, work on copies of those
+  std::vector<Ctxt> batch;
+  batch.reserve(idx.size());
+  for (long i : idx)
+    batch.push_back(ctxts[i]);
+  stages(batch);
+  for (long j : range(lsize(idx)))
+    ctxts[idx[j]] = batch[j];
+}
 
-  long intFactor = ctxt.intFactor;
+void PubKey::bootKeySwitch(Ctxt& ctxt) const
+{
+  long p = context.getP();
+  long p2r = context.getAlMod().getPPowR();
 
   // the bootstrapping key is encrypted relative to plaintext space p^{e-e'+r}.
-  const RecryptData& rcData = getContext().getRcData();
-  long e = rcData.e;
+  const RecryptData& rcData = context.getRcData();
   long ePrime = rcData.ePrime;
   long p2ePrime = NTL::power_long(p, ePrime);
-  long q = NTL::power_long(p, e) + 1;
-  assertTrue(e >= r, "rcData.e must be at least alMod.r");
-
-#ifdef HELIB_DEBUG
-  std::cerr << "reCrypt: p=" << p << ", r=" << r << ", e=" << e
-            << " ePrime=" << ePrime << ", q=" << q << std::endl;
-  CheckCtxt(ctxt, "init");
-#endif
-
-  // can only bootstrap ciphertext with plaintext-space dividing p^r
-  assertEq(p2r % ptxtSpace, 0l, "ptxtSpace must divide p^r when bootstrapping");
-
-  ctxt.dropSmallAndSpecialPrimes();
-
-#ifdef HELIB_DEBUG
-  CheckCtxt(ctxt, "after mod down");
-#endif
-
-  HELIB_NTIMER_START(AAA_preProcess);
+  long q = NTL::power_long(p, rcData.e) + 1;
 
   // Make sure that this ciphertext is in canonical form
   if (!ctxt.inCanonicalForm())
@@ -497,43 +683,247 @@ void PubKey::reCrypt(Ctxt& ctxt) const
   }
 
   // NOTE: here we lose the intFactor associated with ctxt.
-  // We will restore it below.
+  // It is up to the caller to restore it.
   ctxt = recryptEkey;
 
   ctxt.multByConstant(zzParts[1]);
   ctxt.addConstant(zzParts[0]);
+}
+
+// Replace the real slots x = u + K I of ctxt, where |I| <= overflowBound and
+// u is small next to K, with (K/2pi)sin(2pi x/K), which is close to u
+static void ckksEvalMod(Ctxt& ctxt,
+                        const CKKSRecryptData& data,
+                        const NTL::xdouble& K)
+{
+  const double pi = std::acos(-1.0);
+  long d = data.taylorDegree;
+
+  // y = 2pi x/(K 2^squarings)
+  ctxt *= NTL::xdouble(2 * pi) / (K * NTL::power2_xdouble(data.squarings));
+
+  // The powers y^k, each at depth ceil(log2 k)
+  std::vector<Ctxt> powers(d + 1, ctxt);
+  for (long k : range(2, d + 1)) {
+    powers[k] = powers[k / 2];
+    powers[k].multiplyBy(powers[k - k / 2]);
+  }
+
+  // The Taylor series of exp(i y) = cos(y) + i sin(y)
+  Ctxt re(ZeroCtxtLike, ctxt), im(ZeroCtxtLike, ctxt);
+  double factorial = 1;
+  for (long k : range(1, d + 1)) {
+    factorial *= k;
+    Ctxt term = powers[k];
+    term *= ((k / 2) % 2 ? -1.0 : 1.0) / factorial;
+    (k % 2 ? im : re) += term;
+  }
+  re += 1.0;
+  im *= PtxtArray(ctxt.getContext(), std::complex<double>(0.0, 1.0));
+  re += im;
+
+  // exp(i y 2^squarings) = exp(2pi i x/K)
+  for (long j = 0; j < data.squarings; j++)
+    re.square();
+
+  extractImPart(re);
+  re *= K / (2 * pi);
+  ctxt = std::move(re);
+}
+
+void PubKey::ckksReCrypt(Ctxt& ctxt) const
+{
+  HELIB_TIMER_START;
+
+  // A dummy encryption has no noise to remove
+  if (ctxt.isEmpty() ||
+      (ctxt.parts.size() == 1 && ctxt.parts[0].skHandle.isOne()))
+    return;
+
+  // check that we have bootstrapping data
+  assertTrue(recryptKeyID >= 0l, "No bootstrapping data");
+  assertTrue(context.getRcData().ckks != nullptr,
+             "The context is not bootstrappable");
+  const CKKSRecryptData& data = *context.getRcData().ckks;
+  fhe_ops.reCrypts.add(ctxt.getPrimeSet().card());
+
+  // The refreshed ciphertext encrypts the same values, with the same bound
+  NTL::xdouble ptxtMag = ctxt.getPtxtMag();
+
+  RecryptStageProbe probe(&ctxt, 1);
+  probe.start("modRaise");
+  HELIB_NTIMER_START(AAA_modRaise);
+
+  // Bring ctxt to the form c0 + c1 s under the main key, and to the small
+  // modulus q0 at which K = q0/ratFactor is still 2^kappa times ptxtMag
+  ctxt.reLinearize();
+  ctxt.dropToCapacity(data.kappa);
+  NTL::xdouble K = NTL::xexp(ctxt.logOfPrimeSet()) / ctxt.ratFactor;
+  NTL::xdouble target = ptxtMag * NTL::power2_xdouble(data.kappa);
+
+  // Multiplying the parts by an integer c divides K by c, so that K ends up
+  // within a factor of 2 of target. A larger K would scale up the error of
+  // the sine.
+  NTL::ZZ c = NTL::conv<NTL::ZZ>(NTL::floor(K / target));
+  if (c > 1) {
+    NTL::xdouble xc = NTL::conv<NTL::xdouble>(c);
+    for (auto& part : ctxt.parts)
+      part *= c;
+    ctxt.ratFactor *= xc;
+    ctxt.noiseBound *= xc;
+    K /= xc;
+  } else if (K < target) {
+    Warning("CKKS reCrypt: little capacity is left, the result may be "
+            "imprecise");
+  }
+
+  // Lift the parts to all the ciphertext primes. The polynomial they
+  // encrypt gains q0 I, so its coefficients x are those of the plaintext
+  // plus K I, and the slots are phi(m) times larger at most.
+  for (auto& part : ctxt.parts)
+    part.addPrimes(context.getCtxtPrimes() / part.getIndexSet());
+  ctxt.primeSet = context.getCtxtPrimes();
+  NTL::xdouble coeffBound = K * double(data.overflowBound + 1);
+  ctxt.ptxtMag = coeffBound * double(context.getPhiM());
+
+  HELIB_NTIMER_STOP(AAA_modRaise);
+  probe.stop();
+
+  // ctxt gets the coefficients [0, phi(m)/2) and high the others
+  probe.start("coeffToSlot");
+  HELIB_NTIMER_START(AAA_coeffToSlot);
+  Ctxt high(ctxt);
+  data.coeffToSlot[0]->mul(ctxt);
+  data.coeffToSlot[1]->mul(high);
+  extractRealPart(ctxt);
+  extractRealPart(high);
+  ctxt.setPtxtMag(coeffBound);
+  high.setPtxtMag(coeffBound);
+  HELIB_NTIMER_STOP(AAA_coeffToSlot);
+  probe.stop();
+
+  probe.start("evalMod");
+  HELIB_NTIMER_START(AAA_evalMod);
+  ckksEvalMod(ctxt, data, K);
+  ckksEvalMod(high, data, K);
+  ctxt.setPtxtMag(ptxtMag);
+  high.setPtxtMag(ptxtMag);
+  HELIB_NTIMER_STOP(AAA_evalMod);
+  probe.stop();
+
+  probe.start("slotToCoeff");
+  HELIB_NTIMER_START(AAA_slotToCoeff);
+  data.slotToCoeff[0]->mul(ctxt);
+  data.slotToCoeff[1]->mul(high);
+  ctxt += high;
+  ctxt.setPtxtMag(ptxtMag);
+  HELIB_NTIMER_STOP(AAA_slotToCoeff);
+  probe.stop();
+}
+
+// bootstrap a ciphertext to reduce noise
+void PubKey::reCrypt(Ctxt& ctxt) const
+{
+  HELIB_TIMER_START;
+  CtxtOpTrace trace(ctxt, "reCrypt");
+
+  if (context.isCKKS()) {
+    ckksReCrypt(ctxt);
+    return;
+  }
+
+  // Some sanity checks for dummy ciphertext
+  long ptxtSpace = ctxt.getPtxtSpace();
+  if (ctxt.isEmpty())
+    return;
+  if (ctxt.parts.size() == 1 && ctxt.parts[0].skHandle.isOne()) {
+    // Dummy encryption, just ensure that it is reduced mod p
+    NTL::ZZX poly = to_ZZX(ctxt.parts[0]);
+    for (long i = 0; i < poly.rep.length(); i++)
+      poly[i] = NTL::to_ZZ(rem(poly[i], ptxtSpace));
+    poly.normalize();
+    ctxt.DummyEncrypt(poly);
+    return;
+  }
+
+  // check that we have bootstrapping data
+  assertTrue(recryptKeyID >= 0l, "No bootstrapping data");
+  fhe_ops.reCrypts.add(ctxt.getPrimeSet().card());
+
+  long r = getContext().getAlMod().getR();
+  long p2r = getContext().getAlMod().getPPowR();
+
+  long intFactor = ctxt.intFactor;
+
+  // the bootstrapping key is encrypted relative to plaintext space p^{e-e'+r}.
+  const RecryptData& rcData = getContext().getRcData();
+  long e = rcData.e;
+  long ePrime = rcData.ePrime;
+  assertTrue(e >= r, "rcData.e must be at least alMod.r");
+
+#ifdef HELIB_DEBUG
+  long p = getContext().getP();
+  long q = NTL::power_long(p, e) + 1;
+  std::cerr << "reCrypt: p=" << p << ", r=" << r << ", e=" << e
+            << " ePrime=" << ePrime << ", q=" << q << std::endl;
+  CheckCtxt(ctxt, "init");
+#endif
+
+  // can only bootstrap ciphertext with plaintext-space dividing p^r
+  assertEq(p2r % ptxtSpace, 0l, "ptxtSpace must divide p^r when bootstrapping");
+
+  RecryptStageProbe probe(&ctxt, 1);
+  probe.start("preProcess");
+
+  ctxt.dropSmallAndSpecialPrimes();
+
+#ifdef HELIB_DEBUG
+  CheckCtxt(ctxt, "after mod down");
+#endif
+
+  HELIB_NTIMER_START(AAA_preProcess);
+
+  bootKeySwitch(ctxt);
 
 #ifdef HELIB_DEBUG
   CheckCtxt(ctxt, "after preProcess");
 #endif
   HELIB_NTIMER_STOP(AAA_preProcess);
+  probe.stop();
 
   // Move the powerful-basis coefficients to the plaintext slots
+  probe.start("linearTransform1");
   HELIB_NTIMER_START(AAA_LinearTransform1);
   ctxt.getContext().getRcData().firstMap->apply(ctxt);
   HELIB_NTIMER_STOP(AAA_LinearTransform1);
+  probe.stop();
 
 #ifdef HELIB_DEBUG
   CheckCtxt(ctxt, "after LinearTransform1");
 #endif
 
   // Extract the digits e-e'+r-1,...,e-e' (from fully packed slots)
+  probe.start("extractDigitsPacked");
   HELIB_NTIMER_START(AAA_extractDigitsPacked);
   extractDigitsPacked(ctxt,
                       e - ePrime,
                       r,
                       ePrime,
-                      context.getRcData().unpackSlotEncoding);
+                      context.getRcData().unpackSlotEncoding,
+                      rcData.digitExtraction);
   HELIB_NTIMER_STOP(AAA_extractDigitsPacked);
+  probe.stop();
 
 #ifdef HELIB_DEBUG
   CheckCtxt(ctxt, "after extractDigitsPacked");
 #endif
 
   // Move the slots back to powerful-basis coefficients
+  probe.start("linearTransform2");
   HELIB_NTIMER_START(AAA_LinearTransform2);
   ctxt.getContext().getRcData().secondMap->apply(ctxt);
   HELIB_NTIMER_STOP(AAA_LinearTransform2);
+  probe.stop();
 
 #ifdef HELIB_DEBUG
   CheckCtxt(ctxt, "after linearTransform2");
@@ -544,6 +934,109 @@ void PubKey::reCrypt(Ctxt& ctxt) const
     ctxt.intFactor = NTL::MulMod(ctxt.intFactor, intFactor, ptxtSpace);
 }
 
+// bootstrap ciphertexts, one stage at a time over all of them
+void PubKey::reCrypt(std::vector<Ctxt>& ctxts) const
+{
+  HELIB_TIMER_START;
+
+  // CKKS ciphertexts are bootstrapped on their own. With at least as many
+  // of them as threads, each thread takes whole ciphertexts, rather than
+  // splitting the loops inside each one. The stage reports time a single
+  // ciphertext, so they are kept serial while a reporter is set.
+  if (context.isCKKS()) {
+    long n = lsize(ctxts);
+    if (n > 1 && n >= AvailableThreads() && !recryptReporter) {
+      NTL_EXEC_RANGE(n, first, last)
+      for (long i = first; i < last; i++)
+        ckksReCrypt(ctxts[i]);
+      NTL_EXEC_RANGE_END
+    } else {
+      for (Ctxt& ctxt : ctxts)
+        ckksReCrypt(ctxt);
+    }
+    return;
+  }
+
+  auto trivial = [](const Ctxt& ctxt) {
+    return ctxt.isEmpty() ||
+           (ctxt.parts.size() == 1 && ctxt.parts[0].skHandle.isOne());
+  };
+  auto single = [this](Ctxt& ctxt) { reCrypt(ctxt); };
+
+  auto stages = [this](std::vector<Ctxt>& cts) {
+    // check that we have bootstrapping data
+    assertTrue(recryptKeyID >= 0l, "No bootstrapping data");
+
+    long r = context.getAlMod().getR();
+    long p2r = context.getAlMod().getPPowR();
+
+    const RecryptData& rcData = context.getRcData();
+    long e = rcData.e;
+    long ePrime = rcData.ePrime;
+    assertTrue(e >= r, "rcData.e must be at least alMod.r");
+
+    long n = lsize(cts);
+    std::vector<long> ptxtSpaces(n), intFactors(n);
+    for (long i : range(n)) {
+      ptxtSpaces[i] = cts[i].getPtxtSpace();
+      intFactors[i] = cts[i].intFactor;
+      // can only bootstrap ciphertext with plaintext-space dividing p^r
+      assertEq(p2r % ptxtSpaces[i],
+               0l,
+               "ptxtSpace must divide p^r when bootstrapping");
+    }
+
+    RecryptStageProbe probe(cts.data(), n);
+    probe.start("preProcess");
+    HELIB_NTIMER_START(AAA_preProcess);
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++) {
+      cts[i].dropSmallAndSpecialPrimes();
+      bootKeySwitch(cts[i]);
+    }
+    NTL_EXEC_RANGE_END
+    HELIB_NTIMER_STOP(AAA_preProcess);
+    probe.stop();
+
+    // Move the powerful-basis coefficients to the plaintext slots
+    probe.start("linearTransform1");
+    HELIB_NTIMER_START(AAA_LinearTransform1);
+    rcData.firstMap->apply(cts);
+    HELIB_NTIMER_STOP(AAA_LinearTransform1);
+    probe.stop();
+
+    // Extract the digits e-e'+r-1,...,e-e' (from fully packed slots)
+    probe.start("extractDigitsPacked");
+    HELIB_NTIMER_START(AAA_extractDigitsPacked);
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++)
+      extractDigitsPacked(cts[i],
+                          e - ePrime,
+                          r,
+                          ePrime,
+                          rcData.unpackSlotEncoding,
+                          rcData.digitExtraction);
+    NTL_EXEC_RANGE_END
+    HELIB_NTIMER_STOP(AAA_extractDigitsPacked);
+    probe.stop();
+
+    // Move the slots back to powerful-basis coefficients
+    probe.start("linearTransform2");
+    HELIB_NTIMER_START(AAA_LinearTransform2);
+    rcData.secondMap->apply(cts);
+    HELIB_NTIMER_STOP(AAA_LinearTransform2);
+    probe.stop();
+
+    // restore intFactor
+    for (long i : range(n))
+      if (intFactors[i] != 1)
+        cts[i].intFactor =
+            NTL::MulMod(cts[i].intFactor, intFactors[i], ptxtSpaces[i]);
+  };
+
+  recryptBatch(ctxts, trivial, single, stages);
+}
+
 #ifdef HELIB_BOOT_THREADS
 
 // Extract digits from fully packed slots, multithreaded version
@@ -551,7 +1044,8 @@ void extractDigitsPacked(Ctxt& ctxt,
                          long botHigh,
                          long r,
                          long ePrime,
-                         const std::vector<NTL::ZZX>& unpackSlotEncoding)
+                         const std::vector<NTL::ZZX>& unpackSlotEncoding,
+                         DigitExtraction method)
 {
   HELIB_TIMER_START;
 
@@ -570,7 +1064,8 @@ void extractDigitsPacked(Ctxt& ctxt,
     coeff_vector_sz.resize(d);
 
     HELIB_NTIMER_START(unpack1);
-    for (long i = 0; i < d; i++) {
+    NTL_EXEC_RANGE(d, first, last)
+    for (long i = first; i < last; i++) {
       coeff_vector[i] = std::make_shared<DoubleCRT>(unpackSlotEncoding[i],
                                                     ctxt.getContext(),
                                                     ctxt.getPrimeSet());
@@ -578,26 +1073,34 @@ void extractDigitsPacked(Ctxt& ctxt,
           embeddingLargestCoeff(unpackSlotEncoding[i],
                                 ctxt.getContext().getZMStar()));
     }
+    NTL_EXEC_RANGE_END
     HELIB_NTIMER_STOP(unpack1);
 
+    // The d-1 Frobenius maps of ctxt share one digit decomposition, and are
+    // key-switched in parallel
     HELIB_NTIMER_START(unpack2);
-    std::vector<Ctxt> frob(d, Ctxt(ZeroCtxtLike, ctxt));
-
-    NTL_EXEC_RANGE(d, first, last)
-    // FIXME: implement using hoisting!
-    for (long j = first; j < last; j++) { // process jth Frobenius
-      frob[j] = ctxt;
-      frob[j].frobeniusAutomorph(j);
+    const Context& context = ctxt.getContext();
+    long m = context.getM();
+    long p = context.getP();
+    std::vector<long> ks(d - 1);
+    for (long j = 1; j < d; j++)
+      ks[j - 1] = NTL::PowerMod(p % m, j, m);
+    std::vector<Ctxt> frob;
+    if (d > 1)
+      ctxt.hoistedAutomorphs(ks, frob);
+    NTL_EXEC_RANGE(d - 1, first, last)
+    for (long j = first; j < last; j++)
       frob[j].cleanUp();
-      // FIXME: not clear if we should call cleanUp here
-    }
     NTL_EXEC_RANGE_END
-
+    frob.insert(frob.begin(), ctxt);
     HELIB_NTIMER_STOP(unpack2);
 
+    // Every component is a combination of all the Frobenius maps, computed
+    // in parallel with a scratch ciphertext per thread
     HELIB_NTIMER_START(unpack3);
+    NTL_EXEC_RANGE(d, first, last)
     Ctxt tmp1(ZeroCtxtLike, ctxt);
-    for (long i = 0; i < d; i++) {
+    for (long i = first; i < last; i++) {
       for (long j = 0; j < d; j++) {
         tmp1 = frob[j];
         tmp1.multByConstant(*coeff_vector[mcMod(i + j, d)],
@@ -605,6 +1108,7 @@ void extractDigitsPacked(Ctxt& ctxt,
         unpacked[i] += tmp1;
       }
     }
+    NTL_EXEC_RANGE_END
     HELIB_NTIMER_STOP(unpack3);
   }
   HELIB_NTIMER_STOP(unpack);
@@ -615,7 +1119,7 @@ void extractDigitsPacked(Ctxt& ctxt,
 
   NTL_EXEC_RANGE(d, first, last)
   for (long i = first; i < last; i++) {
-    extractDigitsThin(unpacked[i], botHigh, r, ePrime);
+    extractDigitsThin(unpacked[i], botHigh, r, ePrime, method);
   }
   NTL_EXEC_RANGE_END
 
@@ -647,7 +1151,8 @@ void extractDigitsPacked(Ctxt& ctxt,
                          long botHigh,
                          long r,
                          long ePrime,
-                         const std::vector<NTL::ZZX>& unpackSlotEncoding)
+                         const std::vector<NTL::ZZX>& unpackSlotEncoding,
+                         DigitExtraction method)
 {
   HELIB_TIMER_START;
 
@@ -698,7 +1203,7 @@ void extractDigitsPacked(Ctxt& ctxt,
   //#endif
 
   for (long i = 0; i < (long)unpacked.size(); i++) {
-    extractDigitsThin(unpacked[i], botHigh, r, ePrime);
+    extractDigitsThin(unpacked[i], botHigh, r, ePrime, method);
   }
 
   //#ifdef HELIB_DEBUG
@@ -734,10 +1239,9 @@ void packedRecrypt(const CtPtrs& cPtrs,
 
   repack(CtPtrs_vectorCt(cts), cPtrs, ea); // pack ciphertexts
   //  cout << "@"<< lsize(cts)<<std::flush;
-  for (Ctxt& c : cts) {   // then recrypt them
+  for (Ctxt& c : cts)     // then recrypt them
     c.reducePtxtSpace(2); // we only have recryption data for binary ctxt
-    pKey.reCrypt(c);
-  }
+  pKey.reCrypt(cts);
   unpack(cPtrs, CtPtrs_vectorCt(cts), ea, unpackConsts);
 }
 
@@ -770,27 +1274,83 @@ void packedRecrypt(const CtPtrMat& m,
 
 //===================== Thin Bootstrapping stuff ==================
 
+#define DROP_BEFORE_THIN_RECRYPT
+#define THIN_RECRYPT_NLEVELS (3)
+
+// The primes of the ciphertexts entering slotToCoeff in thinReCrypt. Going
+// through the map only drops primes (the special ones aside), so these are
+// all the primes its constants are used at.
+static IndexSet thinRecryptPrimes(const Context& context)
+{
+#ifdef DROP_BEFORE_THIN_RECRYPT
+  // experimental code...we should drop down to a reasonably low level
+  // before doing the first linear map.
+  long first = context.getCtxtPrimes().first();
+  long last = std::min(context.getCtxtPrimes().last(),
+                       first + THIN_RECRYPT_NLEVELS - 1);
+  return IndexSet(first, last);
+#else
+  return context.getCtxtPrimes();
+#endif
+}
+
 void ThinRecryptData::init(const Context& context,
                            const NTL::Vec<long>& mvec_,
                            bool alsoThick,
                            bool build_cache_,
-                           bool minimal)
+                           bool minimal,
+                           std::istream* maps)
 {
-  RecryptData::init(context, mvec_, alsoThick, build_cache_, minimal);
-  coeffToSlot =
-      std::make_shared<ThinEvalMap>(*ea, minimal, mvec, true, build_cache);
-  slotToCoeff = std::make_shared<ThinEvalMap>(context.getEA(),
-                                              minimal,
-                                              mvec,
-                                              false,
-                                              build_cache);
+  MemoryScope memoryScope(MemoryCategory::BOOTSTRAPPING);
+  RecryptData::init(context, mvec_, alsoThick, build_cache_, minimal, maps);
+  if (context.isCKKS())
+    return;
+  std::shared_ptr<ThinEvalMap> first, second;
+  if (maps) {
+    readRecryptMapsBegin(*maps, true);
+    first = ThinEvalMap::readFrom(*maps, *ea, true);
+    second = ThinEvalMap::readFrom(*maps, context.getEA(), false);
+    readRecryptMapsEnd(*maps);
+  } else {
+    first = std::make_shared<ThinEvalMap>(*ea, minimal, mvec, true, false);
+    second = std::make_shared<ThinEvalMap>(context.getEA(),
+                                           minimal,
+                                           mvec,
+                                           false,
+                                           false);
+  }
+
+  // Every map is upgraded at the primes thinReCrypt applies it at, together
+  // with the special primes of the baby steps: slotToCoeff runs at the few
+  // primes of thinRecryptPrimes, coeffToSlot at those of the recryption
+  // key (at most the ciphertext primes)
+  if (build_cache) {
+    first->upgrade(context.getCtxtPrimes() | context.getSpecialPrimes());
+    second->upgrade(thinRecryptPrimes(context) | context.getSpecialPrimes());
+  }
+  coeffToSlot = first;
+  slotToCoeff = second;
+}
+
+void ThinRecryptData::writeMapsTo(std::ostream& str) const
+{
+  RecryptData::writeMapsTo(str);
+  writeEyeCatcher(str, EyeCatcher::RECRYPT_BEGIN);
+  write_raw_int(str, true);
+  coeffToSlot->writeTo(str);
+  slotToCoeff->writeTo(str);
+  writeEyeCatcher(str, EyeCatcher::RECRYPT_END);
 }
 
 // Extract digits from thinly packed slots
 
 long fhe_force_chen_han = 0;
 
-void extractDigitsThin(Ctxt& ctxt, long botHigh, long r, long ePrime)
+void extractDigitsThin(Ctxt& ctxt,
+                       long botHigh,
+                       long r,
+                       long ePrime,
+                       DigitExtraction method)
 {
   HELIB_TIMER_START;
 
@@ -808,7 +1368,9 @@ void extractDigitsThin(Ctxt& ctxt, long botHigh, long r, long ePrime)
   //     or p^{bot-1}p^{r-1} if p==2, r > 1, and bot+r > 2
 
   bool use_chen_han = false;
-  if (r > 1) {
+  if (method == DigitExtraction::DIGIT_RETAIN)
+    use_chen_han = true;
+  else if (method == DigitExtraction::AUTO && r > 1) {
     double chen_han_cost = log(p - 1) + log(r);
     double basic_cost;
     if (p == 2 && r > 2 && botHigh + r > 2)
@@ -940,6 +1502,12 @@ struct PubKeyHack
 void PubKey::thinReCrypt(Ctxt& ctxt) const
 {
   HELIB_TIMER_START;
+  CtxtOpTrace trace(ctxt, "thinReCrypt");
+
+  if (context.isCKKS()) {
+    ckksReCrypt(ctxt);
+    return;
+  }
 
   // Some sanity checks for dummy ciphertext
   long ptxtSpace = ctxt.getPtxtSpace();
@@ -958,8 +1526,8 @@ void PubKey::thinReCrypt(Ctxt& ctxt) const
 
   // check that we have bootstrapping data
   assertTrue(recryptKeyID >= 0l, "Bootstrapping data not present");
+  fhe_ops.reCrypts.add(ctxt.getPrimeSet().card());
 
-  long p = ctxt.getContext().getP();
   long r = ctxt.getContext().getAlMod().getR();
   long p2r = ctxt.getContext().getAlMod().getPPowR();
 
@@ -970,8 +1538,6 @@ void PubKey::thinReCrypt(Ctxt& ctxt) const
   // the bootstrapping key is encrypted relative to plaintext space p^{e-e'+r}.
   long e = trcData.e;
   long ePrime = trcData.ePrime;
-  long p2ePrime = NTL::power_long(p, ePrime);
-  long q = NTL::power_long(p, e) + 1;
   assertTrue(e >= r, "trcData.e must be at least alMod.r");
 
   // can only bootstrap ciphertext with plaintext-space dividing p^r
@@ -983,148 +1549,258 @@ void PubKey::thinReCrypt(Ctxt& ctxt) const
   CheckCtxt(ctxt, "init");
 #endif
 
+  RecryptStageProbe probe(&ctxt, 1);
+  probe.start("modDown");
+
   ctxt.dropSmallAndSpecialPrimes();
 
-#define DROP_BEFORE_THIN_RECRYPT
-#define THIN_RECRYPT_NLEVELS (3)
 #ifdef DROP_BEFORE_THIN_RECRYPT
-  // experimental code...we should drop down to a reasonably low level
-  // before doing the first linear map.
-  long first = context.getCtxtPrimes().first();
-  long last = std::min(context.getCtxtPrimes().last(),
-                       first + THIN_RECRYPT_NLEVELS - 1);
-  ctxt.bringToSet(IndexSet(first, last));
+  ctxt.bringToSet(thinRecryptPrimes(context));
 #endif
+  probe.stop();
 
 #ifdef HELIB_DEBUG
   CheckCtxt(ctxt, "after mod down");
 #endif
 
   // Move the slots to powerful-basis coefficients
+  probe.start("slotToCoeff");
   HELIB_NTIMER_START(AAA_slotToCoeff);
   trcData.slotToCoeff->apply(ctxt);
   HELIB_NTIMER_STOP(AAA_slotToCoeff);
+  probe.stop();
 
 #ifdef HELIB_DEBUG
   CheckCtxt(ctxt, "after slotToCoeff");
 #endif
 
+  probe.start("bootKeySwitch");
   HELIB_NTIMER_START(AAA_bootKeySwitch);
 
-  // Make sure that this ciphertext is in canonical form
-  if (!ctxt.inCanonicalForm())
-    ctxt.reLinearize();
-
-  // Mod-switch down if needed
-  IndexSet s = ctxt.getPrimeSet() / context.getSpecialPrimes();
-  assertTrue(s <= context.getCtxtPrimes(), "prime set is messed up");
-  if (s.card() > 3) { // leave only first three ciphertext primes
-    long first = s.first();
-    IndexSet s3(first, first + 2);
-    s.retain(s3);
-  }
-  ctxt.modDownToSet(s);
-
-  // key-switch to the bootstrapping key
-  ctxt.reLinearize(recryptKeyID);
+  bootKeySwitch(ctxt);
 
 #ifdef HELIB_DEBUG
-  CheckCtxt(ctxt, "after key switching");
+  CheckCtxt(ctxt, "after bootKeySwitch");
 #endif
 
-  // "raw mod-switch" to the bootstrapping mosulus q=p^e+1.
-  std::vector<NTL::ZZX> zzParts; // the mod-switched parts, in ZZX format
-
-  double mfac = ctxt.getContext().getZMStar().getNormBnd();
-  double noise_est = ctxt.rawModSwitch(zzParts, q) * mfac;
-  // noise_est is an upper bound on the L-infty norm of the scaled noise
-  // in the pwrfl basis
-  double noise_bnd =
-      HELIB_MIN_CAP_FRAC * p2r * ctxt.getContext().boundForRecryption();
-  // noise_bnd is the bound assumed in selecting the parameters
-  double noise_rat = noise_est / noise_bnd;
+  HELIB_NTIMER_STOP(AAA_bootKeySwitch);
+  probe.stop();
 
-  HELIB_STATS_UPDATE("raw-mod-switch-noise", noise_rat);
+  // Move the powerful-basis coefficients to the plaintext slots
+  probe.start("coeffToSlot");
+  HELIB_NTIMER_START(AAA_coeffToSlot);
+  trcData.coeffToSlot->apply(ctxt);
+  HELIB_NTIMER_STOP(AAA_coeffToSlot);
+  probe.stop();
 
-  if (noise_rat > 1) {
-    // TODO: Turn the following preprocessor logics into a warnOrThrow function
-    std::string message =
-        "rawModSwitch scaled noise exceeds bound: " + std::to_string(noise_rat);
 #ifdef HELIB_DEBUG
-    Warning(message);
-#else
-    throw LogicError(message);
+  CheckCtxt(ctxt, "after coeffToSlot");
 #endif
-  }
 
-  assertEq(zzParts.size(),
-           (std::size_t)2,
-           "Exactly 2 parts required for mod-switching in thin bootstrapping");
+  // Extract the digits e-e'+r-1,...,e-e' (from fully packed slots)
+  probe.start("extractDigitsThin");
+  HELIB_NTIMER_START(AAA_extractDigitsThin);
+  extractDigitsThin(ctxt,
+                    e - ePrime,
+                    r,
+                    ePrime,
+                    trcData.digitExtraction);
+  HELIB_NTIMER_STOP(AAA_extractDigitsThin);
+  probe.stop();
 
 #ifdef HELIB_DEBUG
-  if (dbgKey) {
-    checkRecryptBounds(zzParts, dbgKey->getRecryptKey(), ctxt.getContext(), q);
-  }
+  CheckCtxt(ctxt, "after extractDigitsThin");
 #endif
 
-  std::vector<NTL::ZZX> v;
-  v.resize(2);
+  // restore intFactor
+  if (intFactor != 1)
+    ctxt.intFactor = NTL::MulMod(ctxt.intFactor, intFactor, ptxtSpace);
+}
 
-  // Add multiples of q to make the zzParts divisible by p^{e'}
-  for (long i : range(2)) {
-    // make divisible by p^{e'}
+// bootstrap "thin" ciphertexts, one stage at a time over all of them
+void PubKey::thinReCrypt(std::vector<Ctxt>& ctxts) const
+{
+  HELIB_TIMER_START;
 
-    newMakeDivisible(zzParts[i], p2ePrime, q, ctxt.getContext(), v[i]);
+  if (context.isCKKS()) {
+    reCrypt(ctxts);
+    return;
   }
 
-#ifdef HELIB_DEBUG
-  if (dbgKey) {
-    checkRecryptBounds_v(v, dbgKey->getRecryptKey(), ctxt.getContext(), q);
-    checkCriticalValue(zzParts,
-                       dbgKey->getRecryptKey(),
-                       ctxt.getContext().getRcData(),
-                       q);
-  }
+  auto trivial = [](const Ctxt& ctxt) {
+    return ctxt.isEmpty() ||
+           (ctxt.parts.size() == 1 && ctxt.parts[0].skHandle.isOne());
+  };
+  auto single = [this](Ctxt& ctxt) { thinReCrypt(ctxt); };
+
+  auto stages = [this](std::vector<Ctxt>& cts) {
+    // check that we have bootstrapping data
+    assertTrue(recryptKeyID >= 0l, "Bootstrapping data not present");
+
+    long r = context.getAlMod().getR();
+    long p2r = context.getAlMod().getPPowR();
+
+    const ThinRecryptData& trcData = context.getRcData();
+    long e = trcData.e;
+    long ePrime = trcData.ePrime;
+    assertTrue(e >= r, "trcData.e must be at least alMod.r");
+
+    long n = lsize(cts);
+    std::vector<long> ptxtSpaces(n), intFactors(n);
+    for (long i : range(n)) {
+      ptxtSpaces[i] = cts[i].getPtxtSpace();
+      intFactors[i] = cts[i].intFactor;
+      // can only bootstrap ciphertext with plaintext-space dividing p^r
+      assertEq(p2r % ptxtSpaces[i],
+               0l,
+               "ptxtSpace must divide p^r when thin bootstrapping");
+    }
+
+#ifdef DROP_BEFORE_THIN_RECRYPT
+    IndexSet lowSet = thinRecryptPrimes(context);
 #endif
 
-  for (long i : range(zzParts.size())) {
-    zzParts[i] /= p2ePrime; // divide by p^{e'}
-  }
+    RecryptStageProbe probe(cts.data(), n);
+    probe.start("modDown");
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++) {
+      cts[i].dropSmallAndSpecialPrimes();
+#ifdef DROP_BEFORE_THIN_RECRYPT
+      cts[i].bringToSet(lowSet);
+#endif
+    }
+    NTL_EXEC_RANGE_END
+    probe.stop();
+
+    // Move the slots to powerful-basis coefficients
+    probe.start("slotToCoeff");
+    HELIB_NTIMER_START(AAA_slotToCoeff);
+    trcData.slotToCoeff->apply(cts);
+    HELIB_NTIMER_STOP(AAA_slotToCoeff);
+    probe.stop();
+
+    probe.start("bootKeySwitch");
+    HELIB_NTIMER_START(AAA_bootKeySwitch);
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++)
+      bootKeySwitch(cts[i]);
+    NTL_EXEC_RANGE_END
+    HELIB_NTIMER_STOP(AAA_bootKeySwitch);
+    probe.stop();
+
+    // Move the powerful-basis coefficients to the plaintext slots
+    probe.start("coeffToSlot");
+    HELIB_NTIMER_START(AAA_coeffToSlot);
+    trcData.coeffToSlot->apply(cts);
+    HELIB_NTIMER_STOP(AAA_coeffToSlot);
+    probe.stop();
+
+    // Extract the digits e-e'+r-1,...,e-e', one ciphertext per thread
+    probe.start("extractDigitsThin");
+    HELIB_NTIMER_START(AAA_extractDigitsThin);
+    NTL_EXEC_RANGE(n, first, last)
+    for (long i = first; i < last; i++)
+      extractDigitsThin(cts[i],
+                        e - ePrime,
+                        r,
+                        ePrime,
+                        trcData.digitExtraction);
+    NTL_EXEC_RANGE_END
+    HELIB_NTIMER_STOP(AAA_extractDigitsThin);
+    probe.stop();
 
-  // NOTE: here we lose the intFactor associated with ctxt.
-  // We will restore it below.
-  ctxt = recryptEkey;
+    // restore intFactor
+    for (long i : range(n))
+      if (intFactors[i] != 1)
+        cts[i].intFactor =
+            NTL::MulMod(cts[i].intFactor, intFactors[i], ptxtSpaces[i]);
+  };
 
-  ctxt.multByConstant(zzParts[1]);
-  ctxt.addConstant(zzParts[0]);
+  recryptBatch(ctxts, trivial, single, stages);
+}
 
-#ifdef HELIB_DEBUG
-  CheckCtxt(ctxt, "after bootKeySwitch");
-#endif
+BootstrapPolicy::BootstrapPolicy(const PubKey& pubKey,
+                                 Method method,
+                                 long minLevels,
+                                 long minBits) :
+    pubKey(pubKey), method(method), minLevels(minLevels), minBits(minBits)
+{
+  assertTrue<InvalidArgument>(minLevels >= 0 && minBits >= 0,
+                              "BootstrapPolicy: negative levels or bits");
+}
 
-  HELIB_NTIMER_STOP(AAA_bootKeySwitch);
+double BootstrapPolicy::threshold(const Ctxt& ctxt) const
+{
+  return minLevels * ctxt.bitsPerMultiplication() + minBits;
+}
 
-  // Move the powerful-basis coefficients to the plaintext slots
-  HELIB_NTIMER_START(AAA_coeffToSlot);
-  trcData.coeffToSlot->apply(ctxt);
-  HELIB_NTIMER_STOP(AAA_coeffToSlot);
+bool BootstrapPolicy::needsRecryption(const Ctxt& ctxt) const
+{
+  return !ctxt.isEmpty() && ctxt.capacity() < threshold(ctxt);
+}
 
-#ifdef HELIB_DEBUG
-  CheckCtxt(ctxt, "after coeffToSlot");
-#endif
+long BootstrapPolicy::recryptNeeded(const std::vector<Ctxt*>& ctxts) const
+{
+  // Move the ciphertexts to recrypt into a batch, and back afterwards
+  std::vector<Ctxt*> needed;
+  for (Ctxt* ctxt : ctxts)
+    if (needsRecryption(*ctxt))
+      needed.push_back(ctxt);
+  if (needed.empty())
+    return 0;
+
+  std::vector<Ctxt> batch;
+  batch.reserve(needed.size());
+  for (Ctxt* ctxt : needed)
+    batch.push_back(std::move(*ctxt));
+
+  if (method == Method::THIN)
+    pubKey.thinReCrypt(batch);
+  else
+    pubKey.reCrypt(batch);
+
+  for (long i : range(lsize(needed)))
+    *needed[i] = std::move(batch[i]);
+  nRecrypted += needed.size();
+  return needed.size();
+}
 
-  // Extract the digits e-e'+r-1,...,e-e' (from fully packed slots)
-  HELIB_NTIMER_START(AAA_extractDigitsThin);
-  extractDigitsThin(ctxt, e - ePrime, r, ePrime);
-  HELIB_NTIMER_STOP(AAA_extractDigitsThin);
+bool BootstrapPolicy::apply(Ctxt& ctxt) const
+{
+  if (!needsRecryption(ctxt))
+    return false;
+  if (method == Method::THIN)
+    pubKey.thinReCrypt(ctxt);
+  else
+    pubKey.reCrypt(ctxt);
+  nRecrypted++;
+  return true;
+}
 
-#ifdef HELIB_DEBUG
-  CheckCtxt(ctxt, "after extractDigitsThin");
-#endif
+long BootstrapPolicy::apply(std::vector<Ctxt>& ctxts) const
+{
+  std::vector<Ctxt*> all;
+  all.reserve(ctxts.size());
+  for (Ctxt& ctxt : ctxts)
+    all.push_back(&ctxt);
+  return recryptNeeded(all);
+}
 
-  // restore intFactor
-  if (intFactor != 1)
-    ctxt.intFactor = NTL::MulMod(ctxt.intFactor, intFactor, ptxtSpace);
+void BootstrapPolicy::defer(Ctxt& ctxt)
+{
+  assertEq(&ctxt.getPubKey(),
+           &pubKey,
+           "BootstrapPolicy: the ciphertext is under another key");
+  deferred.push_back(&ctxt);
+}
+
+long BootstrapPolicy::flush()
+{
+  std::vector<Ctxt*> all;
+  all.swap(deferred);
+  std::sort(all.begin(), all.end());
+  all.erase(std::unique(all.begin(), all.end()), all.end());
+  return recryptNeeded(all);
 }
 
 #ifdef HELIB_DEBUG
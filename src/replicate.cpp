@@ -10,6 +10,10 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 
+#include <algorithm>
+
+#include <NTL/BasicThreadPool.h>
+
 #include <helib/replicate.h>
 #include <helib/timing.h>
 #include <helib/ClonedPtr.h>
@@ -300,6 +304,47 @@ static void SelectRangeDim(const EncryptedArray& ea,
   ctxt.multByConstant(mask);
 }
 
+// Generate the mask of the slots whose coordinate c in dimension d has
+// c < extent and bit k of c zero, at repAux.tab(d, k+1), if not there yet.
+// Also generate the rotated masks that go with it: the mask rotated by 2^k
+// at tabRot(d, k+1), and its complement rotated by -2^k at tabRotC(d, k+1).
+static void makeHalfMasks(const EncryptedArray& ea,
+                          RepAuxDim& repAux,
+                          long d,
+                          long extent,
+                          long k)
+{
+  if (repAux.tab(d, k + 1))
+    return;
+
+  long nSlots = ea.size();
+  long dSize = ea.sizeOfDimension(d);
+  std::vector<bool> maskArray(nSlots, false);
+  std::vector<bool> complement(nSlots, true);
+  for (long i = 0; i < nSlots; i++) {
+    long c = ea.coordinate(d, i);
+    if (c < extent && NTL::bit(c, k) == 0) {
+      maskArray[i] = true;
+      complement[i] = false;
+    }
+  }
+
+  const IndexSet allPrimes = ea.getContext().fullPrimes();
+  const PAlgebra& zMStar = ea.getPAlgebra();
+  EncodedPtxt mask;
+  ea.encode(mask, maskArray);
+  repAux.tabRot(d, k + 1).reset(new FatEncodedPtxt(mask, allPrimes));
+  repAux.tabRot(d, k + 1)->automorph(zMStar.genToPow(d, 1L << k));
+
+  EncodedPtxt maskC;
+  ea.encode(maskC, complement);
+  repAux.tabRotC(d, k + 1).reset(new FatEncodedPtxt(maskC, allPrimes));
+  repAux.tabRotC(d, k + 1)->automorph(zMStar.genToPow(d, dSize - (1L << k)));
+
+  // store the mask itself last, it marks the others as ready
+  repAux.tab(d, k + 1).reset(new FatEncodedPtxt(mask, allPrimes));
+}
+
 // replicateOneBlock: assumes that all slots are zero, except for one
 // "block" whose coordinates in dimension d lie in the interval
 //            [ pos*blockSize .. pos*(blockSize+1) -1 ]
@@ -390,7 +435,6 @@ static void recursiveReplicateDim(const EncryptedArray& ea,
   }
 
   long dSize = ea.sizeOfDimension(d);
-  long nSlots = ea.size();
 
   if (k == 0) { // last level in this dimension: blocks of size 2^k=1
 
@@ -430,64 +474,62 @@ static void recursiveReplicateDim(const EncryptedArray& ea,
   }
 
   k--;
-  Ctxt ctxt_masked = ctxt;
-
-  {   // artificial scope to minimize storage in the recursion
-    { // another artificial scope (SHAI: this seems redundant)
-
-      // generate mask at index k+1, if not there yet
-
-      if (!repAux.tab(d, k + 1)) { // need to generate
-        std::vector<bool> maskArray(nSlots, false);
-        for (long i = 0; i < nSlots; i++) {
-          long c = ea.coordinate(d, i);
-          if (c < extent && NTL::bit(c, k) == 0)
-            maskArray[i] = true;
-        }
-        // store this mask in the repAux table
-        EncodedPtxt mask;
-        ea.encode(mask, maskArray);
-        repAux.tab(d, k + 1).reset(
-            new FatEncodedPtxt(mask, ea.getContext().fullPrimes()));
-      }
-
-      // Apply mask to zero out slots in ctxt
-      ctxt_masked.multByConstant(*repAux.tab(d, k + 1));
-    }
-
-    Ctxt ctxt_left = ctxt_masked;
-    ea.rotate1D(ctxt_left, d, 1L << k, /*don't-care-flag=*/true);
+  long shamt = 1L << k;
+  bool right = pos + shamt < limit; // is there a right half to process?
+  makeHalfMasks(ea, repAux, d, extent, k);
+
+  // Let M be the mask at tab(d, k+1), M' = 1-M its complement, and rho the
+  // rotation by 2^k in dimension d (a "don't care" one, as in rotate1D).
+  // The halves are
+  //     left = ctxt*M + rho(ctxt*M),  right = ctxt*M' + rho^{-1}(ctxt*M'),
+  // and as rho(ctxt*M) = rho(ctxt)*rho(M), both rotations are of ctxt, so
+  // they share one digit decomposition.
+  std::vector<long> ks(1, ea.getPAlgebra().genToPow(d, shamt));
+  if (right)
+    ks.push_back(ea.getPAlgebra().genToPow(d, dSize - shamt));
+  std::vector<Ctxt> rotated;
+  ctxt.hoistedAutomorphs(ks, rotated);
+
+  const FatEncodedPtxt* rotatedMasks[] = {&*repAux.tabRot(d, k + 1),
+                                          &*repAux.tabRotC(d, k + 1)};
+  NTL_EXEC_RANGE(long(rotated.size()), first, last)
+  for (long j = first; j < last; j++)
+    rotated[j].multByConstant(*rotatedMasks[j]);
+  NTL_EXEC_RANGE_END
+
+  Ctxt ctxt_left = std::move(rotated[0]);
+  {
+    // artificial scope to minimize storage in the recursion
+    Ctxt ctxt_masked = ctxt;
+    ctxt_masked.multByConstant(*repAux.tab(d, k + 1));
     ctxt_left += ctxt_masked;
-
-    recursiveReplicateDim(ea,
-                          ctxt_left,
-                          d,
-                          extent,
-                          k,
-                          pos,
-                          limit,
-                          dimProd,
-                          recBound,
-                          repAux,
-                          handler);
+    if (right) {
+      rotated[1] += ctxt;
+      rotated[1] -= ctxt_masked;
+    }
   }
 
-  pos += (1L << k);
-  if (pos >= limit)
-    return;
+  recursiveReplicateDim(ea,
+                        ctxt_left,
+                        d,
+                        extent,
+                        k,
+                        pos,
+                        limit,
+                        dimProd,
+                        recBound,
+                        repAux,
+                        handler);
 
-  Ctxt ctxt_right = ctxt;
-  ctxt_right -= ctxt_masked;
-  ctxt_masked = ctxt_right; // reuse ctxt_masked as a temp
-  ea.rotate1D(ctxt_masked, d, -(1L << k), /*don't-care-flag=*/true);
-  ctxt_right += ctxt_masked;
+  if (!right)
+    return;
 
   recursiveReplicateDim(ea,
-                        ctxt_right,
+                        rotated[1],
                         d,
                         extent,
                         k,
-                        pos,
+                        pos + shamt,
                         limit,
                         dimProd,
                         recBound,
@@ -600,27 +642,42 @@ void replicateAllNextDim(const EncryptedArray& ea,
                           repAux,
                           handler);
   } else { // replicate the slots in each block separately
-    for (long pos = 0; pos < numBlocks; pos++) {
-      Ctxt ctxt2 = ctxt1;
-      // zero-out all the slots outside the current block
-      SelectRangeDim(ea, ctxt2, pos * blockSize, (pos + 1) * blockSize, d);
-
-      // replicate the current block across this dimension using a simple
-      // shift-and-add procedure.
-      replicateOneBlock(ea, ctxt2, pos, blockSize, d);
+    // The blocks are independent, so a batch of them (one per thread) is
+    // prepared in parallel, and then the recursion is run on each in order
+    long batchSize = std::max(1L, NTL::AvailableThreads());
+    for (long start = 0; start < numBlocks; start += batchSize) {
+      long count = std::min(batchSize, numBlocks - start);
+      std::vector<Ctxt> blocks(count, ctxt1);
+
+      NTL_EXEC_RANGE(count, first, last)
+      for (long j = first; j < last; j++) {
+        long pos = start + j;
+        // zero-out all the slots outside the current block
+        SelectRangeDim(ea,
+                       blocks[j],
+                       pos * blockSize,
+                       (pos + 1) * blockSize,
+                       d);
+
+        // replicate the current block across this dimension using a simple
+        // shift-and-add procedure.
+        replicateOneBlock(ea, blocks[j], pos, blockSize, d);
+      }
+      NTL_EXEC_RANGE_END
 
       // now call the recursive replication to do the rest of the work
-      recursiveReplicateDim(ea,
-                            ctxt2,
-                            d,
-                            extent,
-                            k,
-                            0,
-                            extent,
-                            dimProd,
-                            recBound,
-                            repAux,
-                            handler);
+      for (const Ctxt& block : blocks)
+        recursiveReplicateDim(ea,
+                              block,
+                              d,
+                              extent,
+                              k,
+                              0,
+                              extent,
+                              dimProd,
+                              recBound,
+                              repAux,
+                              handler);
     }
   }
 
@@ -0,0 +1,273 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* resultCache.cpp - a bounded cache of the results of operations on
+ * ciphertexts, optionally backed by a directory
+ */
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include <helib/resultCache.h>
+#include <helib/log.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+#include "binio.h"
+
+namespace helib {
+
+static std::string hex(unsigned long x)
+{
+  std::ostringstream str;
+  str << std::hex << std::setfill('0') << std::setw(16) << x;
+  return str.str();
+}
+
+ResultCache::ResultCache(const PubKey& _pubKey,
+                         long _budget,
+                         const std::string& _directory) :
+    pubKey(_pubKey),
+    directory(_directory),
+    // A pass over the whole key, only needed to name the files
+    keyFingerprint(_directory.empty() ? 0 : _pubKey.fingerprint()),
+    budget(_budget)
+{
+  assertTrue<InvalidArgument>(budget >= 0, "ResultCache: negative budget");
+}
+
+std::string ResultCache::contentId(const Ctxt& ctxt)
+{
+  // The memory entries are matched on this id alone, so it is derived with
+  // the SHA-256 behind NTL's DeriveKey: an input made to collide with
+  // another must not be served its result
+  std::ostringstream str;
+  ctxt.writeTo(str);
+  const std::string bytes = str.str();
+  unsigned char digest[32];
+  NTL::DeriveKey(digest,
+                 sizeof(digest),
+                 reinterpret_cast<const unsigned char*>(bytes.data()),
+                 bytes.size());
+
+  std::ostringstream id;
+  id << std::hex << std::setfill('0');
+  for (unsigned char c : digest)
+    id << std::setw(2) << int(c);
+  return id.str();
+}
+
+std::string ResultCache::path(const std::string& input,
+                              const std::string& operation,
+                              const std::string& params) const
+{
+  return path(Key(input, operation, params));
+}
+
+std::string ResultCache::path(const Key& key) const
+{
+  if (directory.empty())
+    return "";
+  FingerprintStream str;
+  for (const std::string& s :
+       {std::get<0>(key), std::get<1>(key), std::get<2>(key)}) {
+    write_raw_int(str, s.size());
+    str << s;
+  }
+  return directory + "/result-" + hex(keyFingerprint) + "-" + hex(str.hash()) +
+         ".bin";
+}
+
+bool ResultCache::lookup(Ctxt& out,
+                         const std::string& input,
+                         const std::string& operation,
+                         const std::string& params)
+{
+  HELIB_TIMER_START;
+  assertEq(&out.getPubKey(), &pubKey, "ResultCache: out is under another key");
+  const Key key(input, operation, params);
+
+  std::string found;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+      counts.hits++;
+      lru.splice(lru.begin(), lru, it->second.position);
+      found = it->second.bytes;
+    }
+  }
+  if (!found.empty()) {
+    std::istringstream str(found);
+    out.read(str);
+    return true;
+  }
+
+  std::string file = path(key);
+  if (!file.empty()) {
+    std::ifstream in(file, std::ios::binary);
+    if (in) {
+      try {
+        // The key is written along with the result, against hash collisions
+        std::vector<std::string> chunks = read_chunks(in);
+        assertEq<IOError>(long(chunks.size()),
+                          4L,
+                          "ResultCache: wrong number of chunks");
+        if (Key(chunks[0], chunks[1], chunks[2]) == key) {
+          std::istringstream str(chunks[3]);
+          out.read(str);
+          std::lock_guard<std::mutex> lock(mutex);
+          counts.diskHits++;
+          insertLocked(key, std::move(chunks[3]));
+          return true;
+        }
+      } catch (const IOError& e) {
+        Warning(std::string("ResultCache: ignoring ") + file + ": " +
+                e.what());
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  counts.misses++;
+  return false;
+}
+
+void ResultCache::store(const Ctxt& result,
+                        const std::string& input,
+                        const std::string& operation,
+                        const std::string& params)
+{
+  HELIB_TIMER_START;
+  assertEq(&result.getPubKey(),
+           &pubKey,
+           "ResultCache: result is under another key");
+  assertTrue<InvalidArgument>(!result.isEmpty(), "ResultCache: empty result");
+  const Key key(input, operation, params);
+
+  // Keeping all of the capacity, the compact format only drops the small
+  // and special primes and packs the residues
+  std::ostringstream str;
+  result.writeCompact(str, std::max(0L, long(result.capacity())));
+  std::string bytes = str.str();
+
+  std::string file = path(key);
+  if (!file.empty()) {
+    // Written to the side and renamed, so that a reader never sees half of
+    // a file. Each writer has a file of its own to the side, since threads
+    // and processes missing on the same key at once all store it.
+    std::string tmp =
+        file + "." + std::to_string(getpid()) + "." +
+        hex(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+        ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
+    write_chunks(out, {input, operation, params, bytes});
+    out.close();
+    if (!out || std::rename(tmp.c_str(), file.c_str()) != 0) {
+      std::remove(tmp.c_str());
+      Warning("ResultCache: could not write " + file);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  counts.stores++;
+  insertLocked(key, std::move(bytes));
+}
+
+bool ResultCache::apply(Ctxt& ctxt,
+                        const std::string& operation,
+                        const std::string& params,
+                        const std::function<void(Ctxt&)>& op,
+                        const std::string& inputId)
+{
+  std::string input = inputId.empty() ? contentId(ctxt) : inputId;
+  if (lookup(ctxt, input, operation, params))
+    return true;
+  op(ctxt);
+  store(ctxt, input, operation, params);
+  return false;
+}
+
+void ResultCache::setBudget(long _budget)
+{
+  assertTrue<InvalidArgument>(_budget >= 0, "ResultCache: negative budget");
+  std::lock_guard<std::mutex> lock(mutex);
+  budget = _budget;
+  trimLocked();
+}
+
+long ResultCache::getBudget() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return budget;
+}
+
+long ResultCache::residentBytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return bytes;
+}
+
+long ResultCache::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+void ResultCache::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  lru.clear();
+  bytes = 0;
+}
+
+ResultCacheStats ResultCache::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return counts;
+}
+
+void ResultCache::insertLocked(const Key& key, std::string value)
+{
+  auto it = entries.find(key);
+  if (it == entries.end()) {
+    lru.push_front(key);
+    it = entries.emplace(key, Entry{std::string(), lru.begin()}).first;
+  } else {
+    bytes -= it->second.bytes.size();
+    lru.splice(lru.begin(), lru, it->second.position);
+  }
+  bytes += value.size();
+  it->second.bytes = std::move(value);
+  trimLocked();
+}
+
+void ResultCache::trimLocked()
+{
+  while (bytes > budget && !lru.empty()) {
+    auto it = entries.find(lru.back());
+    bytes -= it->second.bytes.size();
+    entries.erase(it);
+    lru.pop_back();
+    counts.evictions++;
+  }
+}
+
+} // namespace helib
@@ -10,6 +10,9 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 /* sample.cpp - implementing various sampling routines */
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <vector>
 #include <NTL/ZZX.h>
 #include <NTL/ZZ_pX.h>
@@ -19,14 +22,157 @@
 #include <helib/sample.h>
 #include <helib/norms.h>
 #include <helib/apiAttributes.h>
+#include "simdKernels.h"
 
 #include <helib/powerful.h>
 // only used in experimental Hwt sampler
 
 namespace helib {
 
+namespace {
+
+// The samples are made in blocks of this many, each from a ChaCha20 stream
+// (NTL's RandomStream) of its own, so that the blocks can be made in parallel
+// and the result only depends on the caller's stream
+constexpr long SAMPLE_BLOCK = 1024;
+
+// The discrete Gaussian uses a table of at most this many entries, above it
+// rounded continuous Gaussians are used
+constexpr long GAUSS_CDT_MAX = 128;
+
+// 64-bit words read from a stream, many at a time
+class WordStream
+{
+public:
+  explicit WordStream(NTL::RandomStream& stream) : stream(stream) {}
+
+  std::uint64_t next()
+  {
+    if (pos == WORDS)
+      refill();
+    return words[pos++];
+  }
+
+private:
+  static constexpr long WORDS = 64;
+
+  NTL::RandomStream& stream;
+  std::uint64_t words[WORDS];
+  long pos = WORDS;
+
+  void refill()
+  {
+    unsigned char bytes[8 * WORDS];
+    stream.get(bytes, sizeof(bytes));
+    for (long i = 0; i < WORDS; i++) {
+      std::uint64_t w = 0;
+      for (long b = 7; b >= 0; b--)
+        w = (w << 8) | bytes[8 * i + b];
+      words[i] = w;
+    }
+    pos = 0;
+  }
+};
+
+// Call fill(words, lo, hi) on the blocks [lo, hi) of [0, n) in parallel,
+// words reading the stream of the block: substream b of a key drawn from prg
+template <typename Fill>
+void sampleBlocks(PRG& prg, long n, const Fill& fill)
+{
+  const PRG base = prg.split();
+
+  long nBlocks = divc(n, SAMPLE_BLOCK);
+  NTL_EXEC_RANGE(nBlocks, first, last)
+  for (long b = first; b < last; b++) {
+    PRG block = base.substream(b);
+    WordStream words(block.stream());
+    long lo = b * SAMPLE_BLOCK;
+    fill(words, lo, std::min(n, lo + SAMPLE_BLOCK));
+  }
+  NTL_EXEC_RANGE_END
+}
+
+// A uniform integer in [0, bound), by rejection of the masked words.
+// mask must be 2^k - 1 with 2^k >= bound.
+long uniformBelow(WordStream& words, long bound, std::uint64_t mask)
+{
+  long u;
+  do
+    u = words.next() & mask;
+  while (u >= bound);
+  return u;
+}
+
+// The mask of NumBits(bound-1) bits, for uniformBelow
+std::uint64_t maskFor(long bound)
+{
+  return (std::uint64_t(1) << NTL::NumBits(bound - 1)) - 1;
+}
+
+// Two independent Normal(0,1) variables by the Box-Muller method, truncated
+// at HELIB_GAUSS_TRUNC standard deviations
+void normalPair(WordStream& words, double& x, double& y)
+{
+  constexpr double ULP = 1.0 / 9007199254740992.0; // 2^{-53}
+  double r1 = (words.next() >> 11) * ULP;          // uniform in [0,1)
+  double r2 = ((words.next() >> 11) + 1) * ULP;    // uniform in (0,1]
+  double theta = 2.0 * PI * r1;
+  double rr = std::min(std::sqrt(-2.0 * std::log(r2)),
+                       double(HELIB_GAUSS_TRUNC));
+  x = rr * std::cos(theta);
+  y = rr * std::sin(theta);
+}
+
+template <typename T>
+void sampleNormals(std::vector<T>& dvec, long n, const T& stdev, PRG& prg)
+{
+  if (n <= 0)
+    n = lsize(dvec);
+  if (n <= 0)
+    return;
+
+  dvec.resize(n); // allocate space for n variables
+
+  // The blocks have even lengths, so the pairs do not straddle them
+  sampleBlocks(prg, n, [&](WordStream& words, long lo, long hi) {
+    for (long i = lo; i < hi; i += 2) {
+      double x, y;
+      normalPair(words, x, y);
+      dvec[i] = stdev * x;
+      if (i + 1 < hi)
+        dvec[i + 1] = stdev * y;
+    }
+  });
+}
+
+// The cumulative distribution of |x| for x a discrete Gaussian of parameter
+// stdev (Pr[x] proportional to exp(-x^2/(2 stdev^2))), truncated at
+// HELIB_GAUSS_TRUNC standard deviations, in units of 2^{-63}. For u uniform
+// in [0, 2^63), |x| is the number of entries at most u.
+std::vector<std::uint64_t> gaussianCDT(double stdev)
+{
+  long size = std::max(0L, long(std::ceil(HELIB_GAUSS_TRUNC * stdev)));
+  std::vector<long double> weight(size + 1);
+  long double total = 0;
+  for (long k = 0; k <= size; k++) {
+    long double e = -(long double)(k * k) / (2.0L * stdev * stdev);
+    weight[k] = (k == 0 ? 1 : 2) * std::exp(e); // x = k or -k
+    total += weight[k];
+  }
+
+  std::vector<std::uint64_t> cdt(size);
+  long double sum = 0;
+  for (long k = 0; k < size; k++) {
+    sum += weight[k];
+    cdt[k] = std::uint64_t(sum / total * 9223372036854775808.0L); // 2^63
+  }
+  return cdt;
+}
+
+} // namespace
+
 // Sample a degree-(n-1) poly, with only Hwt nonzero coefficients
-void sampleHWt(zzX& poly, long n, long Hwt)
+void sampleHWt(zzX& poly, long n, long Hwt, PRG& prg)
 {
   if (n <= 0)
     n = lsize(poly);
@@ -42,29 +188,33 @@ void sampleHWt(zzX& poly, long n, long Hwt)
   for (long i = 0; i < n; i++)
     poly[i] = 0;
 
+  PRG stream = prg.split();
+  WordStream words(stream.stream());
+  std::uint64_t mask = maskFor(n); // at most 31 bits, the top bit is free
+
   long i = 0;
   while (i < Hwt) { // continue until exactly Hwt nonzero coefficients
-    long u = NTL::RandomBnd(n);             // The next coefficient to choose
-    if (poly[u] == 0) {                     // if we didn't choose it already
-      long b = NTL::RandomBits_long(2) & 2; // b random in {0,2}
-      poly[u] = b - 1;                      //   random in {-1,1}
+    std::uint64_t w = words.next();
+    long u = w & mask;                 // The next coefficient to choose
+    if (u < n && poly[u] == 0) {       // if we didn't choose it already
+      poly[u] = long(w >> 62 & 2) - 1; // random in {-1,1}
 
       i++; // count another nonzero coefficient
     }
   }
 }
 // Sample a degree-(n-1) NTL::ZZX, with only Hwt nonzero coefficients
-void sampleHWt(NTL::ZZX& poly, long n, long Hwt)
+void sampleHWt(NTL::ZZX& poly, long n, long Hwt, PRG& prg)
 {
   zzX pp;
-  sampleHWt(pp, n, Hwt);
+  sampleHWt(pp, n, Hwt, prg);
   convert(poly, pp);
 }
 
 // Sample a degree-(n-1) poly, with -1/0/+1 coefficients.
 // Each coefficients is +-1 with probability prob/2 each,
 // and 0 with probability 1-prob. By default, pr[nonzero]=1/2.
-void sampleSmall(zzX& poly, long n, double prob)
+void sampleSmall(zzX& poly, long n, double prob, PRG& prg)
 {
   if (n <= 0)
     n = lsize(poly);
@@ -85,113 +235,78 @@ void sampleSmall(zzX& poly, long n, double prob)
 
   long threshold = round(hiMask * prob); // threshold/2^15 = Pr[nonzero]
 
-  NTL_EXEC_RANGE(n, first, last)
-  for (long i = first; i < last; i++) {
-    long u = NTL::RandomBits_long(bitSize); // a random 16-bit number
-    long uLo = u & loMask;                  // bottom 15 bits
-    long uHi = u & hiMask;                  // top bit
-
-    // with probability threshold/2^15, choose between +-1
-    if (uLo < threshold) {                  // compare low 15 bits to threshold
-      poly[i] = (uHi >> (bitSize - 2)) - 1; // topBit*2 - 1 \in {+-1}
+  // Four 16-bit numbers from each word, without branches
+  sampleBlocks(prg, n, [&](WordStream& words, long lo, long hi) {
+    for (long i = lo; i < hi; i += 4) {
+      std::uint64_t w = words.next();
+      for (long j = i; j < std::min(i + 4, hi); j++, w >>= bitSize) {
+        long uLo = w & loMask;                    // bottom 15 bits
+        long uHi = (w & hiMask) >> (bitSize - 2); // top bit, times 2
+        // +-1 with probability threshold/2^15, else zero
+        poly[j] = long(uLo < threshold) * (uHi - 1);
+      }
     }
-
-    // with probability 1-prob, set to zero
-    else
-      poly[i] = 0;
-  }
-  NTL_EXEC_RANGE_END
+  });
 }
-void sampleSmall(NTL::ZZX& poly, long n, double prob)
+void sampleSmall(NTL::ZZX& poly, long n, double prob, PRG& prg)
 {
   zzX pp;
-  sampleSmall(pp, n, prob);
+  sampleSmall(pp, n, prob, prg);
   convert(poly.rep, pp);
   poly.normalize();
 }
 
 // Choose a vector of continuous Gaussians
-void sampleGaussian(std::vector<double>& dvec, long n, double stdev)
+void sampleGaussian(std::vector<double>& dvec,
+                    long n,
+                    double stdev,
+                    PRG& prg)
 {
-  if (n <= 0)
-    n = lsize(dvec);
-  if (n <= 0)
-    return;
-
-  dvec.resize(n); // allocate space for n variables
-
-  // Uses the Box-Muller method to get two Normal(0,stdev^2) variables
-  for (long i = 0; i < n; i += 2) {
-    // r1, r2 are "uniform in (0,1)"
-    double r1 = RandomReal();
-    double r2 = RandomReal();
-    while (r2 == 0)
-      r2 = RandomReal();
-    double theta = 2.0 * PI * r1;
-    double rr = std::sqrt(-2.0 * log(r2));
-    if (rr > HELIB_GAUSS_TRUNC) {
-      // sanity-check, truncate at HELIB_GAUSS_TRUNC standard deviations
-      rr = HELIB_GAUSS_TRUNC;
-    }
-
-    // Generate two Gaussians RV's
-    dvec[i] = stdev * rr * std::cos(theta);
-    if (i + 1 < n)
-      dvec[i + 1] = stdev * rr * std::sin(theta);
-  }
+  sampleNormals(dvec, n, stdev, prg);
 }
 
-void sampleGaussian(std::vector<NTL::xdouble>& dvec, long n, NTL::xdouble stdev)
+void sampleGaussian(std::vector<NTL::xdouble>& dvec,
+                    long n,
+                    NTL::xdouble stdev,
+                    PRG& prg)
 {
-  if (n <= 0)
-    n = lsize(dvec);
-  if (n <= 0)
-    return;
-
-  dvec.resize(n); // allocate space for n variables
-
-  // Uses the Box-Muller method to get two Normal(0,stdev^2) variables
-  for (long i = 0; i < n; i += 2) {
-    // r1, r2 are "uniform in (0,1)"
-    double r1 = RandomReal();
-    double r2 = RandomReal();
-    while (r2 == 0)
-      r2 = RandomReal();
-    double theta = 2.0 * PI * r1;
-    double rr = std::sqrt(-2.0 * log(r2));
-    if (rr > HELIB_GAUSS_TRUNC) {
-      // sanity-check, truncate at HELIB_GAUSS_TRUNC standard deviations
-      rr = HELIB_GAUSS_TRUNC;
-    }
-
-    // Generate two Gaussians RV's
-    dvec[i] = stdev * rr * std::cos(theta);
-    if (i + 1 < n)
-      dvec[i + 1] = stdev * rr * std::sin(theta);
-  }
+  sampleNormals(dvec, n, stdev, prg);
 }
 
-// Sample a degree-(n-1) NTL::ZZX, with rounded Gaussian coefficients
-void sampleGaussian(zzX& poly, long n, double stdev)
+// Sample a degree-(n-1) NTL::ZZX, with discrete Gaussian coefficients
+void sampleGaussian(zzX& poly, long n, double stdev, PRG& prg)
 {
   if (n <= 0)
     return;
-  std::vector<double> dvec;
-  sampleGaussian(dvec, n, stdev); // sample continuous Gaussians
-
-  // round and copy to coefficients of poly
   poly.SetLength(n); // allocate space for degree-(n-1) polynomial
-  for (long i = 0; i < n; i++)
-    poly[i] = long(round(dvec[i])); // round to nearest integer
+
+  if (HELIB_GAUSS_TRUNC * stdev <= GAUSS_CDT_MAX) {
+    // The kernel scans the whole table for each coefficient, and applies a
+    // random sign arithmetically, so the time does not depend on the samples
+    std::vector<std::uint64_t> cdt = gaussianCDT(stdev);
+    sampleBlocks(prg, n, [&](WordStream& words, long lo, long hi) {
+      std::uint64_t w[SAMPLE_BLOCK];
+      for (long i = lo; i < hi; i++)
+        w[i - lo] = words.next();
+      simd::SampleCDT(poly.elts() + lo, w, hi - lo, cdt.data(), lsize(cdt));
+    });
+  } else {
+    std::vector<double> dvec;
+    sampleGaussian(dvec, n, stdev, prg); // sample continuous Gaussians
+
+    // round and copy to coefficients of poly
+    for (long i = 0; i < n; i++)
+      poly[i] = long(round(dvec[i])); // round to nearest integer
+  }
   normalize(poly);
 }
 
-void sampleGaussian(NTL::ZZX& poly, long n, NTL::xdouble stdev)
+void sampleGaussian(NTL::ZZX& poly, long n, NTL::xdouble stdev, PRG& prg)
 {
   if (n <= 0)
     return;
   std::vector<NTL::xdouble> dvec;
-  sampleGaussian(dvec, n, stdev); // sample continuous Gaussians
+  sampleGaussian(dvec, n, stdev, prg); // sample continuous Gaussians
 
   // round and copy to coefficients of poly
   poly.SetLength(n); // allocate space for degree-(n-1) polynomial
@@ -201,7 +316,7 @@ void sampleGaussian(NTL::ZZX& poly, long n, NTL::xdouble stdev)
 }
 
 // Sample a degree-(n-1) zzX, with coefficients uniform in [-B,B]
-void sampleUniform(zzX& poly, long n, long B)
+void sampleUniform(zzX& poly, long n, long B, PRG& prg)
 {
   assertTrue<InvalidArgument>(B > 0l, "Invalid coefficient interval");
   if (n <= 0)
@@ -210,12 +325,16 @@ void sampleUniform(zzX& poly, long n, long B)
     return;
   poly.SetLength(n); // allocate space for degree-(n-1) polynomial
 
-  for (long i = 0; i < n; i++)
-    poly[i] = NTL::RandomBnd(2 * B + 1) - B;
+  long bound = 2 * B + 1;
+  std::uint64_t mask = maskFor(bound);
+  sampleBlocks(prg, n, [&](WordStream& words, long lo, long hi) {
+    for (long i = lo; i < hi; i++)
+      poly[i] = uniformBelow(words, bound, mask) - B;
+  });
 }
 
 // Sample a degree-(n-1) NTL::ZZX, with coefficients uniform in [-B,B]
-void sampleUniform(NTL::ZZX& poly, long n, const NTL::ZZ& B)
+void sampleUniform(NTL::ZZX& poly, long n, const NTL::ZZ& B, PRG& prg)
 {
   assertTrue<InvalidArgument>(static_cast<bool>(B > 0l),
                               "Invalid coefficient interval");
@@ -226,10 +345,20 @@ void sampleUniform(NTL::ZZX& poly, long n, const NTL::ZZ& B)
   clear(poly);
   poly.SetMaxLength(n); // allocate space for degree-(n-1) polynomial
 
+  // By rejection of NumBits(UB)-bit integers read from the stream
   NTL::ZZ UB = 2 * B + 1;
+  long k = NTL::NumBits(UB);
+  long nbytes = (k + 7) / 8;
+  NTL::Vec<unsigned char> bytes;
+  bytes.SetLength(nbytes);
+  NTL::ZZ tmp;
   for (long i = n - 1; i >= 0; i--) {
-    NTL::ZZ tmp = RandomBnd(UB) - B;
-    SetCoeff(poly, i, tmp);
+    do {
+      prg.get(bytes.elts(), nbytes);
+      NTL::ZZFromBytes(tmp, bytes.elts(), nbytes);
+      NTL::trunc(tmp, tmp, k);
+    } while (tmp >= UB);
+    SetCoeff(poly, i, tmp - B);
   }
 }
 
@@ -238,19 +367,19 @@ void sampleUniform(NTL::ZZX& poly, long n, const NTL::ZZ& B)
  * X^m-1 and then reduce mod Phi_m(X). The exception is when m is
  * a power of two, where we still sample directly mod Phi_m(X).
  ********************************************************************/
-double sampleHWt(zzX& poly, const Context& context, long Hwt)
+double sampleHWt(zzX& poly, const Context& context, long Hwt, PRG& prg)
 {
   const PAlgebra& palg = context.getZMStar();
   double retval;
 
   if (palg.getPow2() == 0) { // not power of two
     long m = palg.getM();
-    sampleHWt(poly, m, Hwt);
+    sampleHWt(poly, m, Hwt, prg);
     reduceModPhimX(poly, palg);
     retval = context.noiseBoundForHWt(Hwt, m);
   } else { // power of two
     long phim = palg.getPhiM();
-    sampleHWt(poly, phim, Hwt);
+    sampleHWt(poly, phim, Hwt, prg);
     retval = context.noiseBoundForHWt(Hwt, phim);
   }
 
@@ -266,7 +395,10 @@ double sampleHWtBoundedEffectiveBound(const Context& context, long Hwt)
   return sqrt(Hwt * log(context.getPhiM()));
 }
 
-double sampleHWtBounded(zzX& poly, const Context& context, long Hwt)
+double sampleHWtBounded(zzX& poly,
+                        const Context& context,
+                        long Hwt,
+                        PRG& prg)
 {
   double bound = sampleHWtBoundedEffectiveBound(context, Hwt);
   const PAlgebra& palg = context.getZMStar();
@@ -275,7 +407,7 @@ double sampleHWtBounded(zzX& poly, const Context& context, long Hwt)
   double val;
   long count = 0;
   do {
-    sampleHWt(poly, context, Hwt);
+    sampleHWt(poly, context, Hwt, prg);
     val = embeddingLargestCoeff(poly, palg);
   } while (++count < 1000 && val > bound); // repeat until <= bound
 #else
@@ -290,7 +422,7 @@ double sampleHWtBounded(zzX& poly, const Context& context, long Hwt)
   cout << "sampleHWtBounded:\n";
 
   for (long i = 0; i < count; i++) {
-    sampleHWt(poly1, context, Hwt);
+    sampleHWt(poly1, context, Hwt, prg);
     val1 = embeddingLargestCoeff(poly1, palg);
     if (val1 <= bound) {
       succ++;
@@ -317,7 +449,7 @@ double sampleHWtBounded(zzX& poly, const Context& context, long Hwt)
   return bound;
 }
 
-double sampleSmall(zzX& poly, const Context& context)
+double sampleSmall(zzX& poly, const Context& context, PRG& prg)
 {
   const PAlgebra& palg = context.getZMStar();
   double retval;
@@ -325,13 +457,13 @@ double sampleSmall(zzX& poly, const Context& context)
   if (palg.getPow2() == 0) { // not power of two
     long m = palg.getM();
     long phim = palg.getPhiM();
-    sampleSmall(poly, m, phim / (2.0 * m)); // nonzero with prob phi(m)/2m
+    sampleSmall(poly, m, phim / (2.0 * m), prg); // nonzero with prob phi(m)/2m
     // FIXME: does this probability make sense?  What is the goal there??
     reduceModPhimX(poly, palg);
     retval = context.noiseBoundForSmall(phim / (2.0 * m), m);
   } else { // power of two
     long phim = palg.getPhiM();
-    sampleSmall(poly, phim);
+    sampleSmall(poly, phim, 0.5, prg);
     retval = context.noiseBoundForSmall(0.5, phim);
   }
 
@@ -339,7 +471,7 @@ double sampleSmall(zzX& poly, const Context& context)
 }
 
 // Same as above, but ensure the result is not too much larger than typical
-double sampleSmallBounded(zzX& poly, const Context& context)
+double sampleSmallBounded(zzX& poly, const Context& context, PRG& prg)
 {
   const PAlgebra& palg = context.getZMStar();
   long phim = palg.getPhiM();
@@ -354,7 +486,7 @@ double sampleSmallBounded(zzX& poly, const Context& context)
   double val;
   long count = 0;
   do {
-    sampleSmall(poly, context);
+    sampleSmall(poly, context, prg);
     val = embeddingLargestCoeff(poly, palg);
   } while (++count < 1000 && val > bound); // repeat until <= bound
 #else
@@ -369,7 +501,7 @@ double sampleSmallBounded(zzX& poly, const Context& context)
   cout << "sampleSmallBounded:\n";
 
   for (long i = 0; i < count; i++) {
-    sampleSmall(poly1, context);
+    sampleSmall(poly1, context, prg);
     val1 = embeddingLargestCoeff(poly1, palg);
     if (val1 <= bound) {
       succ++;
@@ -395,14 +527,17 @@ double sampleSmallBounded(zzX& poly, const Context& context)
   return bound;
 }
 
-double sampleGaussian(zzX& poly, const Context& context, double stdev)
+double sampleGaussian(zzX& poly,
+                      const Context& context,
+                      double stdev,
+                      PRG& prg)
 {
   const PAlgebra& palg = context.getZMStar();
   double retval;
 
   if (palg.getPow2() == 0) { // not power of two
     long m = palg.getM();
-    sampleGaussian(poly, m, stdev);
+    sampleGaussian(poly, m, stdev, prg);
     reduceModPhimX(poly, palg);
     // VJS-FIXME: in most (all?) uses of this routine,
     // we eventually convert to DoubleCRT, so do we really need
@@ -410,7 +545,7 @@ double sampleGaussian(zzX& poly, const Context& context, double stdev)
     retval = context.noiseBoundForGaussian(stdev, m);
   } else { // power of two
     long phim = palg.getPhiM();
-    sampleGaussian(poly, phim, stdev);
+    sampleGaussian(poly, phim, stdev, prg);
     retval = context.noiseBoundForGaussian(stdev, phim);
   }
 
@@ -419,7 +554,8 @@ double sampleGaussian(zzX& poly, const Context& context, double stdev)
 
 NTL::xdouble sampleGaussian(NTL::ZZX& poly,
                             const Context& context,
-                            NTL::xdouble stdev)
+                            NTL::xdouble stdev,
+                            PRG& prg)
 {
   const PAlgebra& palg = context.getZMStar();
   NTL::xdouble retval;
@@ -427,7 +563,7 @@ NTL::xdouble sampleGaussian(NTL::ZZX& poly,
   if (palg.getPow2() == 0) { // not power of two
     // NOTE: this branch is currently not used anywhere
     long m = palg.getM();
-    sampleGaussian(poly, m, stdev);
+    sampleGaussian(poly, m, stdev, prg);
     NTL::rem(poly, poly, palg.getPhimX());
     // VJS-FIXME: in most (all?) uses of this routine,
     // we eventually convert to DoubleCRT, so do we really need
@@ -435,7 +571,7 @@ NTL::xdouble sampleGaussian(NTL::ZZX& poly,
     retval = context.noiseBoundForGaussian(stdev, m);
   } else { // power of two
     long phim = palg.getPhiM();
-    sampleGaussian(poly, phim, stdev);
+    sampleGaussian(poly, phim, stdev, prg);
     retval = context.noiseBoundForGaussian(stdev, phim);
   }
 
@@ -456,7 +592,10 @@ double sampleGaussianBoundedEffectiveBound(const Context& context)
 }
 
 // Same as above, but ensure the result is not too much larger than typical
-double sampleGaussianBounded(zzX& poly, const Context& context, double stdev)
+double sampleGaussianBounded(zzX& poly,
+                             const Context& context,
+                             double stdev,
+                             PRG& prg)
 {
   const PAlgebra& palg = context.getZMStar();
 
@@ -466,7 +605,7 @@ double sampleGaussianBounded(zzX& poly, const Context& context, double stdev)
   double val;
   long count = 0;
   do {
-    sampleGaussian(poly, context, stdev);
+    sampleGaussian(poly, context, stdev, prg);
     val = embeddingLargestCoeff(poly, palg);
   } while (++count < 1000 && val > bound); // repeat until <=bound
 #else
@@ -481,7 +620,7 @@ double sampleGaussianBounded(zzX& poly, const Context& context, double stdev)
   std::cout << "sampleGaussianBounded:\n";
 
   for (long i = 0; i < count; i++) {
-    sampleGaussian(poly1, context, stdev);
+    sampleGaussian(poly1, context, stdev, prg);
     val1 = embeddingLargestCoeff(poly1, palg);
     if (val1 <= bound) {
       succ++;
@@ -510,7 +649,8 @@ double sampleGaussianBounded(zzX& poly, const Context& context, double stdev)
 
 NTL::xdouble sampleGaussianBounded(NTL::ZZX& poly,
                                    const Context& context,
-                                   NTL::xdouble stdev)
+                                   NTL::xdouble stdev,
+                                   PRG& prg)
 {
   const PAlgebra& palg = context.getZMStar();
 
@@ -519,7 +659,7 @@ NTL::xdouble sampleGaussianBounded(NTL::ZZX& poly,
   NTL::xdouble val;
   long count = 0;
   do {
-    sampleGaussian(poly, context, stdev);
+    sampleGaussian(poly, context, stdev, prg);
     val = embeddingLargestCoeff(poly, palg);
   } while (++count < 1000 && val > bound); // repeat until <=bound
 
@@ -532,19 +672,19 @@ NTL::xdouble sampleGaussianBounded(NTL::ZZX& poly,
   return bound;
 }
 
-double sampleUniform(zzX& poly, const Context& context, long B)
+double sampleUniform(zzX& poly, const Context& context, long B, PRG& prg)
 {
   const PAlgebra& palg = context.getZMStar();
   double retval;
 
   if (palg.getPow2() == 0) { // not power of two
     long m = palg.getM();
-    sampleUniform(poly, m, B);
+    sampleUniform(poly, m, B, prg);
     reduceModPhimX(poly, palg);
     retval = context.noiseBoundForUniform(B, m);
   } else { // power of two
     long phim = palg.getPhiM();
-    sampleUniform(poly, phim, B);
+    sampleUniform(poly, phim, B, prg);
     retval = context.noiseBoundForUniform(B, phim);
   }
 
@@ -553,19 +693,20 @@ double sampleUniform(zzX& poly, const Context& context, long B)
 
 NTL::xdouble sampleUniform(NTL::ZZX& poly,
                            const Context& context,
-                           const NTL::ZZ& B)
+                           const NTL::ZZ& B,
+                           PRG& prg)
 {
   const PAlgebra& palg = context.getZMStar();
   NTL::xdouble retval;
 
   if (palg.getPow2() == 0) { // not power of two
     long m = palg.getM();
-    sampleUniform(poly, m, B);
+    sampleUniform(poly, m, B, prg);
     NTL::rem(poly, poly, palg.getPhimX());
     retval = context.noiseBoundForUniform(NTL::conv<NTL::xdouble>(B), m);
   } else { // power of two
     long phim = palg.getPhiM();
-    sampleUniform(poly, phim, B);
+    sampleUniform(poly, phim, B, prg);
     retval = context.noiseBoundForUniform(NTL::conv<NTL::xdouble>(B), phim);
   }
 
@@ -0,0 +1,185 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* schemeSwitch.cpp - moving ciphertexts between CKKS and BGV
+ */
+#include <cmath>
+#include <cstdlib>
+
+#include <NTL/BasicThreadPool.h>
+
+#include <helib/schemeSwitch.h>
+#include <helib/timing.h>
+#include <helib/assertions.h>
+
+namespace helib {
+
+// round(num * [mult * a]_den / den) * post for the coefficients a of part,
+// lifted to (-den/2, den/2], as a polynomial over the primes s of context
+static DoubleCRT switchPart(const DoubleCRT& part,
+                            const NTL::ZZ& mult,
+                            const NTL::ZZ& num,
+                            const NTL::ZZ& den,
+                            long post,
+                            const Context& context,
+                            const IndexSet& s)
+{
+  NTL::ZZX poly;
+  part.toPoly(poly);
+  const NTL::ZZ half = den / 2;
+  const bool reduce = !NTL::IsOne(mult);
+
+  NTL_EXEC_RANGE(NTL::deg(poly) + 1, first, last)
+  NTL::ZZ a;
+  for (long i = first; i < last; i++) {
+    a = poly.rep[i];
+    if (reduce) {
+      a *= mult;
+      a %= den;
+      if (a > half)
+        a -= den;
+    }
+    a *= num;
+    a += half;
+    NTL::div(a, a, den); // rounds down
+    if (post != 1)
+      a *= post;
+    poly.rep[i] = a;
+  }
+  NTL_EXEC_RANGE_END
+
+  poly.normalize();
+  return DoubleCRT(poly, context, s);
+}
+
+long SchemeSwitch::addKey(SecKey& toKey, const SecKey& fromKey)
+{
+  const Context& context = toKey.getContext();
+  assertEq(fromKey.getContext().getM(),
+           context.getM(),
+           "SchemeSwitch: the contexts have different m");
+  assertTrue<InvalidArgument>(!toKey.sKeys.empty() && !fromKey.sKeys.empty(),
+                              "SchemeSwitch: a key has no secret key");
+
+  // The same small polynomial, over the primes of the target
+  NTL::ZZX s;
+  fromKey.sKeys[0].toPoly(s);
+  DoubleCRT sKey(s,
+                 context,
+                 context.getCtxtPrimes() | context.getSpecialPrimes());
+  long keyID = toKey.ImportSecKey(sKey,
+                                  fromKey.getSKeyBound(0),
+                                  /*ptxtSpace=*/0,
+                                  /*maxDegKswitch=*/1);
+  toKey.GenKeySWmatrix(/*fromSPower=*/1,
+                       /*fromXPower=*/1,
+                       /*fromIdx=*/keyID,
+                       /*toIdx=*/0);
+  return keyID;
+}
+
+SchemeSwitch::SchemeSwitch(const PubKey& toKey, long fromKeyID) :
+    pubKey(toKey), fromKeyID(fromKeyID)
+{
+  assertTrue<InvalidArgument>(fromKeyID > 0 && toKey.keyExists(fromKeyID),
+                              "SchemeSwitch: no such key");
+  assertTrue<InvalidArgument>(toKey.haveKeySWmatrix(1, 1, fromKeyID, 0),
+                              "SchemeSwitch: no key-switching matrix");
+}
+
+void SchemeSwitch::apply(Ctxt& out, const Ctxt& in, double mag) const
+{
+  HELIB_TIMER_START;
+  const Context& from = in.getContext();
+  const Context& to = pubKey.getContext();
+  assertEq(&out.getPubKey(), &pubKey, "SchemeSwitch: out is not under the key");
+  assertTrue<InvalidArgument>(from.isCKKS() != to.isCKKS(),
+                              "SchemeSwitch: the schemes are the same");
+  assertEq(from.getM(),
+           to.getM(),
+           "SchemeSwitch: the contexts have different m");
+  assertTrue<InvalidArgument>(from.isCKKS() || mag > 0,
+                              "SchemeSwitch: no bound on the BGV plaintext");
+
+  Ctxt ctxt(in);
+  ctxt.reLinearize();
+  assertTrue<InvalidArgument>(!ctxt.isEmpty(),
+                              "SchemeSwitch: empty ciphertext");
+
+  const IndexSet& s = to.getCtxtPrimes();
+  NTL::ZZ qFrom = from.productOfPrimes(ctxt.getPrimeSet());
+  NTL::ZZ qTo = to.productOfPrimes(s);
+  NTL::xdouble xqFrom = NTL::conv<NTL::xdouble>(qFrom);
+  NTL::xdouble xqTo = NTL::conv<NTL::xdouble>(qTo);
+
+  NTL::ZZ mult = NTL::conv<NTL::ZZ>(1);
+  NTL::ZZ num;
+  long post = 1;
+  out.parts.clear();
+  out.primeSet = s;
+  if (from.isCKKS()) {
+    // With j = round(q / (t * scale)) and the parts scaled by j * Q / q, the
+    // plaintext is about (Q / t) * mu: times t, it is -Q * mu + t * e mod Q
+    long t = pubKey.getPtxtSpace();
+    NTL::xdouble scale = ctxt.getRatFactor();
+    NTL::ZZ j =
+        NTL::conv<NTL::ZZ>(NTL::floor(xqFrom / (double(t) * scale) + 0.5));
+    num = j * qTo;
+    post = t;
+
+    NTL::xdouble xj = NTL::conv<NTL::xdouble>(j);
+    NTL::xdouble rho = xj * xqTo / xqFrom;
+    // |t * floor(j * Q * scale / q) - Q|, the factor of mu mod Q, with room
+    // for the rounding of scale and of j in double precision
+    NTL::xdouble drift = NTL::fabs(double(t) * xj * scale / xqFrom - 1.0);
+    NTL::xdouble f = xqTo * (drift + std::ldexp(1.0, -50)) + double(t);
+    NTL::xdouble mu = ctxt.getPtxtMag();
+    out.noiseBound = f * mu + double(t) * (mu + rho * ctxt.getNoiseBound());
+    out.ptxtSpace = t;
+    out.intFactor = t - 1; // raw = -Q * mu, and Decrypt removes Q
+    out.ratFactor = out.ptxtMag = 1.0;
+  } else {
+    // raw = intFactor * q * mu + t * e mod q, and times c / t with
+    // c = -1/intFactor mod t, it is (q / t) * mu + c * raw / t mod q
+    long t = ctxt.getPtxtSpace();
+    long c = NTL::NegateMod(NTL::InvMod(ctxt.intFactor % t, t), t);
+    if (c > t / 2)
+      c -= t;
+    NTL::ZZ tInv = NTL::InvMod(NTL::conv<NTL::ZZ>(t) % qFrom, qFrom);
+    mult = (NTL::conv<NTL::ZZ>(c) * tInv) % qFrom;
+    num = qTo;
+
+    out.noiseBound =
+        xqTo / xqFrom * (std::abs(c) / double(t)) * ctxt.getNoiseBound();
+    out.ptxtSpace = 1;
+    out.intFactor = 1;
+    out.ratFactor = xqTo / double(t);
+    out.ptxtMag = mag;
+  }
+
+  for (const CtxtPart& part : ctxt.parts) {
+    SKHandle handle;
+    if (part.skHandle.isOne())
+      handle.setOne();
+    else
+      handle = SKHandle(1, 1, fromKeyID);
+    out.parts.emplace_back(
+        switchPart(part, mult, num, qFrom, post, to, s), handle);
+  }
+  out.noiseBound += out.modSwitchAddedNoiseBound();
+  assertTrue<LogicError>(out.isCorrect(),
+                         "SchemeSwitch: too little capacity or precision");
+
+  out.reLinearize(0);
+}
+
+} // namespace helib
@@ -0,0 +1,111 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <NTL/BasicThreadPool.h>
+#include <helib/shard.h>
+#include <helib/keys.h>
+#include "binio.h"
+
+namespace helib {
+
+std::pair<long, long> shardRows(long rows, long shards, long index)
+{
+  assertTrue<InvalidArgument>(shards > 0, "Must have a positive shard count");
+  assertTrue<InvalidArgument>(shards <= rows,
+                              "Cannot have more shards than rows");
+  assertInRange(index, 0l, shards, "Shard index out of range");
+
+  // The same split as the intervals of the thread pool
+  NTL::PartitionInfo pinfo(rows, shards);
+  long first, last;
+  pinfo.interval(first, last, index);
+  return {first, last};
+}
+
+void ShardResult::writeTo(std::ostream& str, long targetBits) const
+{
+  writeEyeCatcher(str, EyeCatcher::SHARD_BEGIN);
+
+  /*  Writing out in binary:
+    1.  long firstRow
+    2.  long rows, long cols
+    3.  rows * cols compact ciphertexts, in row-major order
+  */
+
+  write_raw_int(str, firstRow);
+  write_raw_int(str, result.dims(0));
+  write_raw_int(str, result.dims(1));
+  for (std::size_t i = 0; i < result.dims(0); ++i)
+    for (std::size_t j = 0; j < result.dims(1); ++j)
+      result(i, j).writeCompact(str, targetBits);
+
+  writeEyeCatcher(str, EyeCatcher::SHARD_END);
+}
+
+ShardResult ShardResult::readFrom(std::istream& str, const PubKey& pubKey)
+{
+  bool eyeCatcherFound = readEyeCatcher(str, EyeCatcher::SHARD_BEGIN);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find pre-shard-result eye catcher");
+
+  long firstRow = read_raw_int(str);
+  long rows = read_raw_int(str);
+  long cols = read_raw_int(str);
+  assertTrue<IOError>(firstRow >= 0 && rows > 0 && cols > 0,
+                      "Invalid shard result dimensions");
+  ShardResult shard{firstRow, Matrix<Ctxt>(Ctxt(pubKey), rows, cols)};
+  for (long i = 0; i < rows; ++i)
+    for (long j = 0; j < cols; ++j)
+      shard.result(i, j).read(str);
+
+  eyeCatcherFound = readEyeCatcher(str, EyeCatcher::SHARD_END);
+  assertTrue<IOError>(eyeCatcherFound,
+                      "Could not find post-shard-result eye catcher");
+  return shard;
+}
+
+Matrix<Ctxt> mergeShardResults(const std::vector<ShardResult>& results,
+                               long rows)
+{
+  assertFalse<InvalidArgument>(results.empty(), "No shard results given");
+
+  // Order the shards by their first row, and check that they tile [0, rows)
+  std::vector<const ShardResult*> sorted;
+  for (const auto& shard : results)
+    sorted.push_back(&shard);
+  std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) {
+    return a->firstRow < b->firstRow;
+  });
+  long cols = sorted.front()->result.dims(1);
+  long next = 0;
+  for (const auto* shard : sorted) {
+    assertEq<InvalidArgument>(shard->firstRow,
+                              next,
+                              "Shard results do not cover the rows exactly");
+    assertEq<InvalidArgument>(long(shard->result.dims(1)),
+                              cols,
+                              "Shard results have different widths");
+    next += shard->result.dims(0);
+  }
+  assertEq<InvalidArgument>(next,
+                            rows,
+                            "Shard results do not cover the rows exactly");
+
+  Matrix<Ctxt> merged(sorted.front()->result(0, 0), rows, cols);
+  for (const auto* shard : sorted)
+    for (std::size_t i = 0; i < shard->result.dims(0); ++i)
+      for (long j = 0; j < cols; ++j)
+        merged(shard->firstRow + i, j) = shard->result(i, j);
+  return merged;
+}
+
+} // namespace helib
@@ -0,0 +1,1244 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+/* simdKernels.cpp - built-in NTT and element-wise kernels, with AVX-512
+ * versions selected at runtime.
+ */
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+#include "simdKernels.h"
+
+#include <helib/assertions.h>
+#include <helib/apiAttributes.h>
+#include <helib/multicore.h>
+#include <helib/PGFFT.h>
+#include <helib/version.h>
+
+#if !defined(HELIB_NO_NATIVE_SIMD) && defined(__x86_64__) &&                  \
+    (defined(__GNUC__) || defined(__clang__))
+#define HELIB_SIMD_X86
+#include <immintrin.h>
+// GCC mis-reports the _mm512_undefined_* placeholders inside the intrinsic
+// headers when they are inlined into target("avx512*") functions
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#define HELIB_TARGET_AVX2 __attribute__((target("avx2")))
+#define HELIB_TARGET_AVX512F __attribute__((target("avx512f")))
+#define HELIB_TARGET_AVX512IFMA                                                \
+  __attribute__((target("avx512f,avx512dq,avx512ifma")))
+#endif
+
+// NEON is part of the AArch64 baseline, so it needs no runtime check
+#if !defined(HELIB_NO_NATIVE_SIMD) && defined(__aarch64__) &&                 \
+    defined(__ARM_NEON)
+#define HELIB_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace helib {
+
+namespace simd {
+
+static const uint64_t MASK52 = (uint64_t(1) << 52) - 1;
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+//============= CPU feature detection =============
+
+#ifdef HELIB_SIMD_X86
+static bool cpuHasAVX512F()
+{
+  static const bool have = __builtin_cpu_supports("avx512f");
+  return have;
+}
+
+static bool cpuHasAVX512IFMA()
+{
+  static const bool have = __builtin_cpu_supports("avx512f") &&
+                           __builtin_cpu_supports("avx512dq") &&
+                           __builtin_cpu_supports("avx512ifma");
+  return have;
+}
+
+// FMA is not used by the kernels here, but it is by the AVX2 build of PGFFT
+static bool cpuHasAVX2()
+{
+  static const bool have =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return have;
+}
+#else
+static bool cpuHasAVX512F() { return false; }
+static bool cpuHasAVX512IFMA() { return false; }
+static bool cpuHasAVX2() { return false; }
+#endif
+
+static std::atomic<bool> simdEnabled(true);
+
+void setEnabled(bool enable) { simdEnabled = enable; }
+bool isEnabled() { return simdEnabled; }
+
+bool haveAVX512F() { return isEnabled() && cpuHasAVX512F(); }
+bool haveAVX512IFMA() { return isEnabled() && cpuHasAVX512IFMA(); }
+bool haveAVX2() { return isEnabled() && cpuHasAVX2(); }
+
+#ifdef HELIB_SIMD_NEON
+bool haveNEON() { return isEnabled(); }
+#else
+bool haveNEON() { return false; }
+#endif
+
+bool useIFMA(long q)
+{
+  return q > 0 && q < (1L << IFMA_MODULUS_BITS) && haveAVX512IFMA();
+}
+
+//============= Element-wise kernels =============
+
+#ifdef HELIB_SIMD_X86
+
+// For a, b in [0, q): a+b-q wraps around iff a+b < q, so an unsigned min
+// selects the reduced value; similarly for a-b+q.
+
+HELIB_TARGET_AVX512F
+static long addModAVX512(long* result,
+                         const long* a,
+                         const long* b,
+                         long n,
+                         long q)
+{
+  const __m512i vq = _mm512_set1_epi64(q);
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i va = _mm512_loadu_si512(a + i);
+    __m512i vb = _mm512_loadu_si512(b + i);
+    __m512i s = _mm512_add_epi64(va, vb);
+    s = _mm512_min_epu64(s, _mm512_sub_epi64(s, vq));
+    _mm512_storeu_si512(result + i, s);
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX512F
+static long addModAVX512(long* result,
+                         const long* a,
+                         long scalar,
+                         long n,
+                         long q)
+{
+  const __m512i vq = _mm512_set1_epi64(q);
+  const __m512i vb = _mm512_set1_epi64(scalar);
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i va = _mm512_loadu_si512(a + i);
+    __m512i s = _mm512_add_epi64(va, vb);
+    s = _mm512_min_epu64(s, _mm512_sub_epi64(s, vq));
+    _mm512_storeu_si512(result + i, s);
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX512F
+static long subModAVX512(long* result,
+                         const long* a,
+                         const long* b,
+                         long n,
+                         long q)
+{
+  const __m512i vq = _mm512_set1_epi64(q);
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i va = _mm512_loadu_si512(a + i);
+    __m512i vb = _mm512_loadu_si512(b + i);
+    __m512i d = _mm512_sub_epi64(va, vb);
+    d = _mm512_min_epu64(d, _mm512_add_epi64(d, vq));
+    _mm512_storeu_si512(result + i, d);
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX512F
+static long subModAVX512(long* result,
+                         const long* a,
+                         long scalar,
+                         long n,
+                         long q)
+{
+  const __m512i vq = _mm512_set1_epi64(q);
+  const __m512i vb = _mm512_set1_epi64(scalar);
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i va = _mm512_loadu_si512(a + i);
+    __m512i d = _mm512_sub_epi64(va, vb);
+    d = _mm512_min_epu64(d, _mm512_add_epi64(d, vq));
+    _mm512_storeu_si512(result + i, d);
+  }
+  return i;
+}
+
+// a*b mod q for a, b in [0, q), q < 2^50. The quotient is estimated in
+// double precision (off by at most one), and the remainder is computed
+// exactly from the low 52 bits of a*b and quot*q.
+HELIB_TARGET_AVX512IFMA
+static inline __m512i mulModIFMA(__m512i va,
+                                 __m512i vb,
+                                 __m512i vq,
+                                 __m512d dqinv)
+{
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i mask = _mm512_set1_epi64(MASK52);
+
+  __m512d da = _mm512_cvtepu64_pd(va);
+  __m512d db = _mm512_cvtepu64_pd(vb);
+  __m512d dquot = _mm512_mul_pd(_mm512_mul_pd(da, db), dqinv);
+  __m512i quot = _mm512_cvttpd_epu64(dquot);
+
+  __m512i lo = _mm512_madd52lo_epu64(zero, va, vb);
+  __m512i lq = _mm512_madd52lo_epu64(zero, quot, vq);
+  __m512i r = _mm512_and_si512(_mm512_sub_epi64(lo, lq), mask);
+
+  // r is a*b - quot*q mod 2^52, with the true value in [-q, 2q)
+  // sign-extend from 52 bits, then move into [0, q)
+  r = _mm512_srai_epi64(_mm512_slli_epi64(r, 12), 12);
+  r = _mm512_min_epu64(r, _mm512_add_epi64(r, vq));
+  r = _mm512_min_epu64(r, _mm512_sub_epi64(r, vq));
+  return r;
+}
+
+HELIB_TARGET_AVX512IFMA
+static long mulModIFMA(long* result,
+                       const long* a,
+                       const long* b,
+                       long n,
+                       long q)
+{
+  const __m512i vq = _mm512_set1_epi64(q);
+  const __m512d dqinv = _mm512_set1_pd(1.0 / double(q));
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i va = _mm512_loadu_si512(a + i);
+    __m512i vb = _mm512_loadu_si512(b + i);
+    _mm512_storeu_si512(result + i, mulModIFMA(va, vb, vq, dqinv));
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX512IFMA
+static long mulModIFMA(long* result,
+                       const long* a,
+                       long scalar,
+                       long n,
+                       long q)
+{
+  const __m512i vq = _mm512_set1_epi64(q);
+  const __m512d dqinv = _mm512_set1_pd(1.0 / double(q));
+  const __m512i vb = _mm512_set1_epi64(scalar);
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i va = _mm512_loadu_si512(a + i);
+    _mm512_storeu_si512(result + i, mulModIFMA(va, vb, vq, dqinv));
+  }
+  return i;
+}
+
+// a mod q for a in (-q, q): as unsigned, a < a+q when a >= 0, and a+q < a
+// otherwise. A block with a value outside that range is left to the caller.
+HELIB_TARGET_AVX512F
+static long reduceModAVX512(long* result, const long* a, long n, long q)
+{
+  const __m512i vq = _mm512_set1_epi64(q);
+  const __m512i shift = _mm512_set1_epi64(q - 1);
+  const __m512i width = _mm512_set1_epi64(2 * q - 1);
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i va = _mm512_loadu_si512(a + i);
+    __m512i inRange = _mm512_add_epi64(va, shift);
+    if (_mm512_cmplt_epu64_mask(inRange, width) != 0xFF)
+      break;
+    __m512i r = _mm512_min_epu64(va, _mm512_add_epi64(va, vq));
+    _mm512_storeu_si512(result + i, r);
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX512F
+static long gatherAVX512(long* result,
+                         const long* src,
+                         const long* index,
+                         long n)
+{
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i vidx = _mm512_loadu_si512(index + i);
+    _mm512_storeu_si512(result + i, _mm512_i64gather_epi64(vidx, src, 8));
+  }
+  return i;
+}
+
+// AVX2 has no unsigned 64-bit min. As q < 2^62, the sums and differences
+// fit in a signed word, and q is added back where they went negative.
+
+HELIB_TARGET_AVX2
+static inline __m256i loadAVX2(const long* p)
+{
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+HELIB_TARGET_AVX2
+static inline void storeAVX2(long* p, __m256i v)
+{
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+// x + q where x < 0, else x
+HELIB_TARGET_AVX2
+static inline __m256i correctAVX2(__m256i x, __m256i vq)
+{
+  __m256i negative = _mm256_cmpgt_epi64(_mm256_setzero_si256(), x);
+  return _mm256_add_epi64(x, _mm256_and_si256(vq, negative));
+}
+
+HELIB_TARGET_AVX2
+static long addModAVX2(long* result,
+                       const long* a,
+                       const long* b,
+                       long n,
+                       long q)
+{
+  const __m256i vq = _mm256_set1_epi64x(q);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i s = _mm256_add_epi64(loadAVX2(a + i), loadAVX2(b + i));
+    storeAVX2(result + i, correctAVX2(_mm256_sub_epi64(s, vq), vq));
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX2
+static long addModAVX2(long* result,
+                       const long* a,
+                       long scalar,
+                       long n,
+                       long q)
+{
+  const __m256i vq = _mm256_set1_epi64x(q);
+  const __m256i vb = _mm256_set1_epi64x(scalar - q);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i s = _mm256_add_epi64(loadAVX2(a + i), vb);
+    storeAVX2(result + i, correctAVX2(s, vq));
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX2
+static long subModAVX2(long* result,
+                       const long* a,
+                       const long* b,
+                       long n,
+                       long q)
+{
+  const __m256i vq = _mm256_set1_epi64x(q);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i d = _mm256_sub_epi64(loadAVX2(a + i), loadAVX2(b + i));
+    storeAVX2(result + i, correctAVX2(d, vq));
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX2
+static long subModAVX2(long* result,
+                       const long* a,
+                       long scalar,
+                       long n,
+                       long q)
+{
+  const __m256i vq = _mm256_set1_epi64x(q);
+  const __m256i vb = _mm256_set1_epi64x(scalar);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i d = _mm256_sub_epi64(loadAVX2(a + i), vb);
+    storeAVX2(result + i, correctAVX2(d, vq));
+  }
+  return i;
+}
+
+// As reduceModAVX512, with -q < a < q checked by two signed compares
+HELIB_TARGET_AVX2
+static long reduceModAVX2(long* result, const long* a, long n, long q)
+{
+  const __m256i vq = _mm256_set1_epi64x(q);
+  const __m256i vminusq = _mm256_set1_epi64x(-q);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i va = loadAVX2(a + i);
+    __m256i inRange = _mm256_and_si256(_mm256_cmpgt_epi64(va, vminusq),
+                                       _mm256_cmpgt_epi64(vq, va));
+    if (_mm256_movemask_epi8(inRange) != -1)
+      break;
+    storeAVX2(result + i, correctAVX2(va, vq));
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX2
+static long gatherAVX2(long* result, const long* src, const long* index, long n)
+{
+  const long long* base = reinterpret_cast<const long long*>(src);
+  long i = 0;
+  for (; i + 4 <= n; i += 4)
+    storeAVX2(result + i, _mm256_i64gather_epi64(base, loadAVX2(index + i), 8));
+  return i;
+}
+
+// (x ^ -sign) + sign, i.e. x or -x
+HELIB_TARGET_AVX2
+static inline __m256i applySignAVX2(__m256i x, __m256i sign)
+{
+  __m256i mask = _mm256_sub_epi64(_mm256_setzero_si256(), sign);
+  return _mm256_add_epi64(_mm256_xor_si256(x, mask), sign);
+}
+
+// cdt[k] > u is a signed compare once the top bits of both are flipped,
+// and it adds -1 to the count of size
+HELIB_TARGET_AVX2
+static long sampleCDTAVX2(long* result,
+                          const uint64_t* words,
+                          long n,
+                          const uint64_t* cdt,
+                          long size)
+{
+  const uint64_t top = uint64_t(1) << 63;
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i vtop = _mm256_set1_epi64x(top);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i w =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+    __m256i u = _mm256_xor_si256(_mm256_srli_epi64(w, 1), vtop);
+    __m256i x = _mm256_set1_epi64x(size);
+    for (long k = 0; k < size; k++) {
+      __m256i c = _mm256_set1_epi64x(cdt[k] ^ top);
+      x = _mm256_add_epi64(x, _mm256_cmpgt_epi64(c, u));
+    }
+    storeAVX2(result + i, applySignAVX2(x, _mm256_and_si256(w, one)));
+  }
+  return i;
+}
+
+HELIB_TARGET_AVX512F
+static long sampleCDTAVX512(long* result,
+                            const uint64_t* words,
+                            long n,
+                            const uint64_t* cdt,
+                            long size)
+{
+  const __m512i one = _mm512_set1_epi64(1);
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i w = _mm512_loadu_si512(words + i);
+    __m512i u = _mm512_srli_epi64(w, 1);
+    __m512i x = _mm512_setzero_si512();
+    for (long k = 0; k < size; k++) {
+      __mmask8 counted =
+          _mm512_cmpge_epu64_mask(u, _mm512_set1_epi64(cdt[k]));
+      x = _mm512_mask_add_epi64(x, counted, x, one);
+    }
+    __m512i sign = _mm512_and_si512(w, one);
+    __m512i mask = _mm512_sub_epi64(_mm512_setzero_si512(), sign);
+    x = _mm512_add_epi64(_mm512_xor_si512(x, mask), sign);
+    _mm512_storeu_si512(result + i, x);
+  }
+  return i;
+}
+
+#endif // HELIB_SIMD_X86
+
+#ifdef HELIB_SIMD_NEON
+
+// NEON has no unsigned 64-bit min, so the reduced value is chosen by a
+// compare and a bit select, two lanes at a time.
+
+static long addModNEON(long* result,
+                       const long* a,
+                       const long* b,
+                       long n,
+                       long q)
+{
+  const uint64x2_t vq = vdupq_n_u64(q);
+  long i = 0;
+  for (; i + 2 <= n; i += 2) {
+    uint64x2_t va = vld1q_u64(reinterpret_cast<const uint64_t*>(a + i));
+    uint64x2_t vb = vld1q_u64(reinterpret_cast<const uint64_t*>(b + i));
+    uint64x2_t s = vaddq_u64(va, vb);
+    s = vbslq_u64(vcgeq_u64(s, vq), vsubq_u64(s, vq), s);
+    vst1q_u64(reinterpret_cast<uint64_t*>(result + i), s);
+  }
+  return i;
+}
+
+static long addModNEON(long* result,
+                       const long* a,
+                       long scalar,
+                       long n,
+                       long q)
+{
+  const uint64x2_t vq = vdupq_n_u64(q);
+  const uint64x2_t vb = vdupq_n_u64(scalar);
+  long i = 0;
+  for (; i + 2 <= n; i += 2) {
+    uint64x2_t va = vld1q_u64(reinterpret_cast<const uint64_t*>(a + i));
+    uint64x2_t s = vaddq_u64(va, vb);
+    s = vbslq_u64(vcgeq_u64(s, vq), vsubq_u64(s, vq), s);
+    vst1q_u64(reinterpret_cast<uint64_t*>(result + i), s);
+  }
+  return i;
+}
+
+static long subModNEON(long* result,
+                       const long* a,
+                       const long* b,
+                       long n,
+                       long q)
+{
+  const uint64x2_t vq = vdupq_n_u64(q);
+  long i = 0;
+  for (; i + 2 <= n; i += 2) {
+    uint64x2_t va = vld1q_u64(reinterpret_cast<const uint64_t*>(a + i));
+    uint64x2_t vb = vld1q_u64(reinterpret_cast<const uint64_t*>(b + i));
+    uint64x2_t d = vsubq_u64(va, vb);
+    d = vbslq_u64(vcgtq_u64(vb, va), vaddq_u64(d, vq), d);
+    vst1q_u64(reinterpret_cast<uint64_t*>(result + i), d);
+  }
+  return i;
+}
+
+static long subModNEON(long* result,
+                       const long* a,
+                       long scalar,
+                       long n,
+                       long q)
+{
+  const uint64x2_t vq = vdupq_n_u64(q);
+  const uint64x2_t vb = vdupq_n_u64(scalar);
+  long i = 0;
+  for (; i + 2 <= n; i += 2) {
+    uint64x2_t va = vld1q_u64(reinterpret_cast<const uint64_t*>(a + i));
+    uint64x2_t d = vsubq_u64(va, vb);
+    d = vbslq_u64(vcgtq_u64(vb, va), vaddq_u64(d, vq), d);
+    vst1q_u64(reinterpret_cast<uint64_t*>(result + i), d);
+  }
+  return i;
+}
+
+static long reduceModNEON(long* result, const long* a, long n, long q)
+{
+  const int64x2_t vq = vdupq_n_s64(q);
+  const uint64x2_t shift = vdupq_n_u64(q - 1);
+  const uint64x2_t width = vdupq_n_u64(2 * q - 1);
+  long i = 0;
+  for (; i + 2 <= n; i += 2) {
+    int64x2_t va = vld1q_s64(reinterpret_cast<const int64_t*>(a + i));
+    uint64x2_t inRange =
+        vcltq_u64(vaddq_u64(vreinterpretq_u64_s64(va), shift), width);
+    if ((vgetq_lane_u64(inRange, 0) & vgetq_lane_u64(inRange, 1)) == 0)
+      break;
+    // add q where a < 0
+    int64x2_t r = vaddq_s64(va, vandq_s64(vq, vshrq_n_s64(va, 63)));
+    vst1q_s64(reinterpret_cast<int64_t*>(result + i), r);
+  }
+  return i;
+}
+
+// A true compare is all ones, i.e. -1, so subtracting it counts cdt[k] <= u
+static long sampleCDTNEON(long* result,
+                          const uint64_t* words,
+                          long n,
+                          const uint64_t* cdt,
+                          long size)
+{
+  const uint64x2_t one = vdupq_n_u64(1);
+  const uint64x2_t zero = vdupq_n_u64(0);
+  long i = 0;
+  for (; i + 2 <= n; i += 2) {
+    uint64x2_t w = vld1q_u64(words + i);
+    uint64x2_t u = vshrq_n_u64(w, 1);
+    uint64x2_t x = zero;
+    for (long k = 0; k < size; k++)
+      x = vsubq_u64(x, vcgeq_u64(u, vdupq_n_u64(cdt[k])));
+    uint64x2_t sign = vandq_u64(w, one);
+    uint64x2_t mask = vsubq_u64(zero, sign);
+    x = vaddq_u64(veorq_u64(x, mask), sign);
+    vst1q_u64(reinterpret_cast<uint64_t*>(result + i), x);
+  }
+  return i;
+}
+
+// NEON has no gather instruction, so Gather stays scalar on AArch64: two
+// lane inserts per vector cost as much as the scalar loads they replace.
+
+#endif // HELIB_SIMD_NEON
+
+// Each public kernel runs the vector loop (if any) over a prefix of the
+// input, and finishes the tail with scalar code.
+
+void EltwiseAddMod(long* result, const long* a, const long* b, long n, long q)
+{
+  long i = 0;
+#ifdef HELIB_SIMD_X86
+  if (haveAVX512F())
+    i = addModAVX512(result, a, b, n, q);
+  else if (haveAVX2())
+    i = addModAVX2(result, a, b, n, q);
+#endif
+#ifdef HELIB_SIMD_NEON
+  if (haveNEON())
+    i = addModNEON(result, a, b, n, q);
+#endif
+  for (; i < n; i++)
+    result[i] = NTL::AddMod(a[i], b[i], q);
+}
+
+void EltwiseAddMod(long* result, const long* a, long scalar, long n, long q)
+{
+  long i = 0;
+#ifdef HELIB_SIMD_X86
+  if (haveAVX512F())
+    i = addModAVX512(result, a, scalar, n, q);
+  else if (haveAVX2())
+    i = addModAVX2(result, a, scalar, n, q);
+#endif
+#ifdef HELIB_SIMD_NEON
+  if (haveNEON())
+    i = addModNEON(result, a, scalar, n, q);
+#endif
+  for (; i < n; i++)
+    result[i] = NTL::AddMod(a[i], scalar, q);
+}
+
+void EltwiseSubMod(long* result, const long* a, const long* b, long n, long q)
+{
+  long i = 0;
+#ifdef HELIB_SIMD_X86
+  if (haveAVX512F())
+    i = subModAVX512(result, a, b, n, q);
+  else if (haveAVX2())
+    i = subModAVX2(result, a, b, n, q);
+#endif
+#ifdef HELIB_SIMD_NEON
+  if (haveNEON())
+    i = subModNEON(result, a, b, n, q);
+#endif
+  for (; i < n; i++)
+    result[i] = NTL::SubMod(a[i], b[i], q);
+}
+
+void EltwiseSubMod(long* result, const long* a, long scalar, long n, long q)
+{
+  long i = 0;
+#ifdef HELIB_SIMD_X86
+  if (haveAVX512F())
+    i = subModAVX512(result, a, scalar, n, q);
+  else if (haveAVX2())
+    i = subModAVX2(result, a, scalar, n, q);
+#endif
+#ifdef HELIB_SIMD_NEON
+  if (haveNEON())
+    i = subModNEON(result, a, scalar, n, q);
+#endif
+  for (; i < n; i++)
+    result[i] = NTL::SubMod(a[i], scalar, q);
+}
+
+void EltwiseMultMod(long* result,
+                    const long* a,
+                    const long* b,
+                    long n,
+                    long q,
+                    NTL::mulmod_t qinv)
+{
+  long i = 0;
+#ifdef HELIB_SIMD_X86
+  if (useIFMA(q))
+    i = mulModIFMA(result, a, b, n, q);
+#endif
+  for (; i < n; i++)
+    result[i] = NTL::MulMod(a[i], b[i], q, qinv);
+}
+
+void EltwiseMultMod(long* result, const long* a, const long* b, long n, long q)
+{
+  EltwiseMultMod(result, a, b, n, q, NTL::PrepMulMod(q));
+}
+
+void EltwiseMultMod(long* result, const long* a, long scalar, long n, long q)
+{
+  long i = 0;
+#ifdef HELIB_SIMD_X86
+  if (useIFMA(q))
+    i = mulModIFMA(result, a, scalar, n, q);
+#endif
+  NTL::mulmod_precon_t precon = NTL::PrepMulModPrecon(scalar, q);
+  for (; i < n; i++)
+    result[i] = NTL::MulModPrecon(a[i], scalar, q, precon);
+}
+
+void EltwiseReduceMod(long* result, const long* a, long n, long q)
+{
+  long i = 0;
+  while (i < n) {
+#ifdef HELIB_SIMD_X86
+    if (haveAVX512F())
+      i += reduceModAVX512(result + i, a + i, n - i, q);
+    else if (haveAVX2())
+      i += reduceModAVX2(result + i, a + i, n - i, q);
+#endif
+#ifdef HELIB_SIMD_NEON
+    if (haveNEON())
+      i += reduceModNEON(result + i, a + i, n - i, q);
+#endif
+    // One value at a time up to the next vector block, or to the end
+    long stop = std::min(n, i + 8);
+    for (; i < stop; i++) {
+      long r = a[i] % q;
+      result[i] = (r < 0) ? r + q : r;
+    }
+  }
+}
+
+void Gather(long* result, const long* src, const long* index, long n)
+{
+  long i = 0;
+#ifdef HELIB_SIMD_X86
+  if (haveAVX512F())
+    i = gatherAVX512(result, src, index, n);
+  else if (haveAVX2())
+    i = gatherAVX2(result, src, index, n);
+#endif
+  for (; i < n; i++)
+    result[i] = src[index[i]];
+}
+
+void SampleCDT(long* result,
+               const uint64_t* words,
+               long n,
+               const uint64_t* cdt,
+               long size)
+{
+  long i = 0;
+#ifdef HELIB_SIMD_X86
+  if (haveAVX512F())
+    i = sampleCDTAVX512(result, words, n, cdt, size);
+  else if (haveAVX2())
+    i = sampleCDTAVX2(result, words, n, cdt, size);
+#endif
+#ifdef HELIB_SIMD_NEON
+  if (haveNEON())
+    i = sampleCDTNEON(result, words, n, cdt, size);
+#endif
+  for (; i < n; i++) {
+    uint64_t u = words[i] >> 1;
+    long sign = words[i] & 1;
+    long x = 0;
+    for (long k = 0; k < size; k++)
+      x += long(u >= cdt[k]);
+    result[i] = (x ^ -sign) + sign; // x or -x
+  }
+}
+
+//============= NTT =============
+
+static long bitReverse(long x, long bits)
+{
+  long r = 0;
+  for (long i = 0; i < bits; i++) {
+    r = (r << 1) | (x & 1);
+    x >>= 1;
+  }
+  return r;
+}
+
+// Shoup precomputation for 52-bit inputs: floor(w * 2^52 / q)
+static uint64_t precon52(uint64_t w, uint64_t q)
+{
+  return uint64_t(((uint128_t)w << 52) / q);
+}
+
+// Shoup precomputation for 64-bit inputs: floor(w * 2^64 / q)
+static uint64_t precon64(uint64_t w, uint64_t q)
+{
+  return uint64_t(((uint128_t)w << 64) / q);
+}
+
+// Returns x*w mod q in [0, 2q), for any 64-bit x and wp = precon64(w, q).
+// The arithmetic wraps mod 2^64, which is fine since the result is < 2q.
+static inline uint64_t mulShoupLazy(uint64_t x,
+                                    uint64_t w,
+                                    uint64_t wp,
+                                    uint64_t q)
+{
+  uint64_t quot = uint64_t(((uint128_t)x * wp) >> 64);
+  return x * w - quot * q;
+}
+
+static inline uint64_t reduce2q(uint64_t x, uint64_t twoq)
+{
+  return (x >= twoq) ? x - twoq : x;
+}
+
+NTTTables::NTTTables(long _n, long _q, long psi) : n(_n), q(_q)
+{
+  assertTrue<InvalidArgument>(n > 0 && (n & (n - 1)) == 0,
+                              "NTTTables: n must be a power of two");
+  assertTrue<InvalidArgument>(_q > 0 && _q < (1L << MAX_MODULUS_BITS),
+                              "NTTTables: modulus too large");
+  logn = 0;
+  while ((1L << logn) < n)
+    logn++;
+  ifmaTables = (_q < (1L << IFMA_MODULUS_BITS));
+
+  long psiInv = NTL::InvMod(psi, _q);
+
+  // powers of psi and psi^{-1}, in bit-reversed order
+  std::vector<long> pw(n), ipw(n);
+  pw[0] = ipw[0] = 1;
+  for (long i = 1; i < n; i++) {
+    pw[i] = NTL::MulMod(pw[i - 1], psi, _q);
+    ipw[i] = NTL::MulMod(ipw[i - 1], psiInv, _q);
+  }
+
+  psiPowers.resize(n);
+  psiPrecon.resize(n);
+  psiInvPowers.resize(n);
+  psiInvPrecon.resize(n);
+  if (ifmaTables) {
+    psiPrecon52.resize(n);
+    psiInvPrecon52.resize(n);
+  }
+  for (long i = 0; i < n; i++) {
+    long j = bitReverse(i, logn);
+    psiPowers[i] = pw[j];
+    psiPrecon[i] = precon64(pw[j], q);
+    psiInvPowers[i] = ipw[j];
+    psiInvPrecon[i] = precon64(ipw[j], q);
+    if (ifmaTables) {
+      psiPrecon52[i] = precon52(pw[j], q);
+      psiInvPrecon52[i] = precon52(ipw[j], q);
+    }
+  }
+
+  nInv = NTL::InvMod(n % _q, _q);
+  nInvPrecon = precon64(nInv, q);
+}
+
+// One scalar forward (Cooley-Tukey) stage with butterflies of half-size t,
+// on the first len entries of each half (len = t for the whole stage).
+// Values enter and leave in [0, 4q). For T != 0 the half-size and len are
+// the constant T (and t, len are ignored), so the short inner loops of the
+// last stages are fully unrolled by the compiler.
+template <long T>
+static void forwardStage(uint64_t* a,
+                         long m,
+                         long t,
+                         long len,
+                         const uint64_t* w,
+                         const uint64_t* wp,
+                         uint64_t q)
+{
+  const long tt = (T != 0) ? T : t;
+  const long ll = (T != 0) ? T : len;
+  const uint64_t twoq = 2 * q;
+  for (long i = 0; i < m; i++) {
+    uint64_t wi = w[m + i];
+    uint64_t wpi = wp[m + i];
+    uint64_t* x = a + 2 * i * tt;
+    uint64_t* y = x + tt;
+    for (long j = 0; j < ll; j++) {
+      uint64_t X = reduce2q(x[j], twoq);
+      uint64_t U = mulShoupLazy(y[j], wi, wpi, q);
+      x[j] = X + U;
+      y[j] = X - U + twoq;
+    }
+  }
+}
+
+// One scalar inverse (Gentleman-Sande) stage with butterflies of half-size
+// t, on len entries and specialized on T as forwardStage. Values enter and
+// leave in [0, 2q).
+template <long T>
+static void inverseStage(uint64_t* a,
+                         long h,
+                         long t,
+                         long len,
+                         const uint64_t* w,
+                         const uint64_t* wp,
+                         uint64_t q)
+{
+  const long tt = (T != 0) ? T : t;
+  const long ll = (T != 0) ? T : len;
+  const uint64_t twoq = 2 * q;
+  for (long i = 0; i < h; i++) {
+    uint64_t wi = w[h + i];
+    uint64_t wpi = wp[h + i];
+    uint64_t* x = a + 2 * i * tt;
+    uint64_t* y = x + tt;
+    for (long j = 0; j < ll; j++) {
+      uint64_t U = x[j];
+      uint64_t V = y[j];
+      x[j] = reduce2q(U + V, twoq);
+      y[j] = mulShoupLazy(U - V + twoq, wi, wpi, q);
+    }
+  }
+}
+
+#ifdef HELIB_SIMD_X86
+
+// One forward (Cooley-Tukey) stage with butterflies of half-size t, on
+// the first len entries of each half, a multiple of 8. Values enter and
+// leave in [0, 4q).
+HELIB_TARGET_AVX512IFMA
+static void forwardStageIFMA(uint64_t* a,
+                             long m,
+                             long t,
+                             long len,
+                             const uint64_t* w,
+                             const uint64_t* wp,
+                             uint64_t q)
+{
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i mask = _mm512_set1_epi64(MASK52);
+  const __m512i vq = _mm512_set1_epi64(q);
+  const __m512i v2q = _mm512_set1_epi64(2 * q);
+
+  for (long i = 0; i < m; i++) {
+    uint64_t* x = a + 2 * i * t;
+    uint64_t* y = x + t;
+    const __m512i vw = _mm512_set1_epi64(w[m + i]);
+    const __m512i vwp = _mm512_set1_epi64(wp[m + i]);
+    for (long j = 0; j < len; j += 8) {
+      __m512i X = _mm512_loadu_si512(x + j);
+      __m512i Y = _mm512_loadu_si512(y + j);
+      X = _mm512_min_epu64(X, _mm512_sub_epi64(X, v2q));
+
+      __m512i quot = _mm512_madd52hi_epu64(zero, Y, vwp);
+      __m512i T = _mm512_sub_epi64(_mm512_madd52lo_epu64(zero, Y, vw),
+                                   _mm512_madd52lo_epu64(zero, quot, vq));
+      T = _mm512_and_si512(T, mask);
+
+      _mm512_storeu_si512(x + j, _mm512_add_epi64(X, T));
+      _mm512_storeu_si512(y + j,
+                          _mm512_add_epi64(_mm512_sub_epi64(X, T), v2q));
+    }
+  }
+}
+
+// One inverse (Gentleman-Sande) stage with butterflies of half-size t, on
+// len entries as forwardStageIFMA. Values enter and leave in [0, 2q).
+HELIB_TARGET_AVX512IFMA
+static void inverseStageIFMA(uint64_t* a,
+                             long h,
+                             long t,
+                             long len,
+                             const uint64_t* w,
+                             const uint64_t* wp,
+                             uint64_t q)
+{
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i mask = _mm512_set1_epi64(MASK52);
+  const __m512i vq = _mm512_set1_epi64(q);
+  const __m512i v2q = _mm512_set1_epi64(2 * q);
+
+  for (long i = 0; i < h; i++) {
+    uint64_t* x = a + 2 * i * t;
+    uint64_t* y = x + t;
+    const __m512i vw = _mm512_set1_epi64(w[h + i]);
+    const __m512i vwp = _mm512_set1_epi64(wp[h + i]);
+    for (long j = 0; j < len; j += 8) {
+      __m512i U = _mm512_loadu_si512(x + j);
+      __m512i V = _mm512_loadu_si512(y + j);
+
+      __m512i S = _mm512_add_epi64(U, V);
+      S = _mm512_min_epu64(S, _mm512_sub_epi64(S, v2q));
+      __m512i D = _mm512_add_epi64(_mm512_sub_epi64(U, V), v2q);
+
+      __m512i quot = _mm512_madd52hi_epu64(zero, D, vwp);
+      __m512i T = _mm512_sub_epi64(_mm512_madd52lo_epu64(zero, D, vw),
+                                   _mm512_madd52lo_epu64(zero, quot, vq));
+      T = _mm512_and_si512(T, mask);
+
+      _mm512_storeu_si512(x + j, S);
+      _mm512_storeu_si512(y + j, T);
+    }
+  }
+}
+
+#endif // HELIB_SIMD_X86
+
+// A forward stage over m groups of butterflies of half-size t, on the first
+// len entries of each half, with the twiddles w[m + i] (IFMA: w and wp52)
+// for group i
+static void forwardRun(uint64_t* a,
+                       long m,
+                       long t,
+                       long len,
+                       const uint64_t* w,
+                       const uint64_t* wp,
+                       UNUSED const uint64_t* wp52,
+                       uint64_t q,
+                       UNUSED bool vec)
+{
+#ifdef HELIB_SIMD_X86
+  if (vec && len % 8 == 0) {
+    forwardStageIFMA(a, m, t, len, w, wp52, q);
+    return;
+  }
+#endif
+  // The unrolled stages only do whole stages
+  switch (len == t ? t : 0) {
+  case 1:
+    forwardStage<1>(a, m, t, len, w, wp, q);
+    break;
+  case 2:
+    forwardStage<2>(a, m, t, len, w, wp, q);
+    break;
+  case 4:
+    forwardStage<4>(a, m, t, len, w, wp, q);
+    break;
+  default:
+    forwardStage<0>(a, m, t, len, w, wp, q);
+  }
+}
+
+// As forwardRun, for the inverse stage over h groups
+static void inverseRun(uint64_t* a,
+                       long h,
+                       long t,
+                       long len,
+                       const uint64_t* w,
+                       const uint64_t* wp,
+                       UNUSED const uint64_t* wp52,
+                       uint64_t q,
+                       UNUSED bool vec)
+{
+#ifdef HELIB_SIMD_X86
+  if (vec && len % 8 == 0) {
+    inverseStageIFMA(a, h, t, len, w, wp52, q);
+    return;
+  }
+#endif
+  // The unrolled stages only do whole stages
+  switch (len == t ? t : 0) {
+  case 1:
+    inverseStage<1>(a, h, t, len, w, wp, q);
+    break;
+  case 2:
+    inverseStage<2>(a, h, t, len, w, wp, q);
+    break;
+  case 4:
+    inverseStage<4>(a, h, t, len, w, wp, q);
+    break;
+  default:
+    inverseStage<0>(a, h, t, len, w, wp, q);
+  }
+}
+
+void NTTTables::forward(long* data) const
+{
+  uint64_t* a = reinterpret_cast<uint64_t*>(data);
+  bool vec = ifmaTables && haveAVX512IFMA();
+
+  long t = n;
+  for (long m = 1; m < n; m <<= 1) {
+    t >>= 1;
+    forwardRun(a,
+               m,
+               t,
+               t,
+               psiPowers.data(),
+               psiPrecon.data(),
+               psiPrecon52.data(),
+               q,
+               vec);
+  }
+
+  // [0, 4q) -> [0, q)
+  const uint64_t twoq = 2 * q;
+  for (long i = 0; i < n; i++) {
+    uint64_t x = reduce2q(a[i], twoq);
+    a[i] = (x >= q) ? x - q : x;
+  }
+}
+
+void NTTTables::inverse(long* data) const
+{
+  uint64_t* a = reinterpret_cast<uint64_t*>(data);
+  bool vec = ifmaTables && haveAVX512IFMA();
+
+  long t = 1;
+  for (long m = n; m > 1; m >>= 1) {
+    inverseRun(a,
+               m >> 1,
+               t,
+               t,
+               psiInvPowers.data(),
+               psiInvPrecon.data(),
+               psiInvPrecon52.data(),
+               q,
+               vec);
+    t <<= 1;
+  }
+
+  // scale by 1/n and reduce [0, 2q) -> [0, q)
+  for (long i = 0; i < n; i++) {
+    uint64_t x = mulShoupLazy(a[i], nInv, nInvPrecon, q);
+    a[i] = (x >= q) ? x - q : x;
+  }
+}
+
+// The split transforms see the n entries as B rows (blocks) of n/B
+// contiguous entries. The stages of half-size t >= n/B pair up entries in
+// the same column (the same index mod n/B), and the later stages entries
+// in the same row, so a forward transform is a pass over the columns then
+// one over the rows, and an inverse transform the other way around. Every
+// pass splits over the threads.
+
+void NTTTables::forwardSplit(long* data) const
+{
+  uint64_t* a = reinterpret_cast<uint64_t*>(data);
+  bool vec = ifmaTables && haveAVX512IFMA();
+  const long B = 1L << (logn / 2);
+  const long cols = n / B;
+  const uint64_t twoq = 2 * q;
+  const uint64_t* w = psiPowers.data();
+  const uint64_t* wp = psiPrecon.data();
+
+  // Each thread does the same columns of every group, in blocks of 8 so
+  // that they can go through the IFMA stages
+  const long blk = (cols % 8 == 0) ? 8 : 1;
+  HELIB_EXEC_RANGE(cols / blk, first, last)
+  long len = (last - first) * blk;
+  for (long m = 1, t = n / 2; m < B; m <<= 1, t >>= 1)
+    for (long base = 0; base < t; base += cols)
+      forwardRun(a + base + first * blk,
+                 m,
+                 t,
+                 len,
+                 w,
+                 wp,
+                 psiPrecon52.data(),
+                 q,
+                 vec);
+  HELIB_EXEC_RANGE_END
+
+  // Row b holds the groups [b*m/B, (b+1)*m/B) of the stage of m groups
+  HELIB_EXEC_RANGE(B, first, last)
+  for (long b = first; b < last; b++) {
+    uint64_t* row = a + b * cols;
+    for (long m = B, t = cols / 2; m < n; m <<= 1, t >>= 1) {
+      long off = m + b * (m / B) - m / B;
+      forwardRun(row,
+                 m / B,
+                 t,
+                 t,
+                 w + off,
+                 wp + off,
+                 psiPrecon52.data() + (vec ? off : 0),
+                 q,
+                 vec);
+    }
+    for (long i = 0; i < cols; i++) {
+      uint64_t x = reduce2q(row[i], twoq);
+      row[i] = (x >= q) ? x - q : x;
+    }
+  }
+  HELIB_EXEC_RANGE_END
+}
+
+void NTTTables::inverseSplit(long* data) const
+{
+  uint64_t* a = reinterpret_cast<uint64_t*>(data);
+  bool vec = ifmaTables && haveAVX512IFMA();
+  const long B = 1L << (logn / 2);
+  const long cols = n / B;
+  const uint64_t* w = psiInvPowers.data();
+  const uint64_t* wp = psiInvPrecon.data();
+
+  HELIB_EXEC_RANGE(B, first, last)
+  for (long b = first; b < last; b++) {
+    uint64_t* row = a + b * cols;
+    for (long h = n / 2, t = 1; h >= B; h >>= 1, t <<= 1) {
+      long off = h + b * (h / B) - h / B;
+      inverseRun(row,
+                 h / B,
+                 t,
+                 t,
+                 w + off,
+                 wp + off,
+                 psiInvPrecon52.data() + (vec ? off : 0),
+                 q,
+                 vec);
+    }
+  }
+  HELIB_EXEC_RANGE_END
+
+  // The columns in blocks of 8, as in forwardSplit
+  const long blk = (cols % 8 == 0) ? 8 : 1;
+  HELIB_EXEC_RANGE(cols / blk, first, last)
+  long len = (last - first) * blk;
+  for (long h = B / 2, t = cols; h >= 1; h >>= 1, t <<= 1)
+    for (long base = 0; base < t; base += cols)
+      inverseRun(a + base + first * blk,
+                 h,
+                 t,
+                 len,
+                 w,
+                 wp,
+                 psiInvPrecon52.data(),
+                 q,
+                 vec);
+
+  // scale by 1/n and reduce [0, 2q) -> [0, q), down the columns
+  for (long base = 0; base < n; base += cols)
+    for (long j = base + first * blk; j < base + last * blk; j++) {
+      uint64_t x = mulShoupLazy(a[j], nInv, nInvPrecon, q);
+      a[j] = (x >= q) ? x - q : x;
+    }
+  HELIB_EXEC_RANGE_END
+}
+
+} // namespace simd
+
+std::string version::kernels()
+{
+#ifdef USE_INTEL_HEXL
+  const char* ntt = "hexl";
+  const char* eltwise = "hexl";
+#else
+  const char* ntt = simd::haveAVX512IFMA() ? "avx512ifma" : "scalar";
+  const char* eltwise = simd::haveAVX512F() ? "avx512f"
+                        : simd::haveAVX2()  ? "avx2"
+                        : simd::haveNEON()  ? "neon"
+                                            : "scalar";
+#endif
+  const char* sample = simd::haveAVX512F() ? "avx512f"
+                       : simd::haveAVX2()  ? "avx2"
+                       : simd::haveNEON()  ? "neon"
+                                           : "scalar";
+  return std::string("PGFFT=") + PGFFT::simd_name() + " NTT=" + ntt +
+         " ELTWISE=" + eltwise + " SAMPLE=" + sample;
+}
+
+} // namespace helib
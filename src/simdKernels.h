@@ -0,0 +1,182 @@
+/* Copyright (C) 2012-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef HELIB_SIMDKERNELS_H
+#define HELIB_SIMDKERNELS_H
+/**
+ * @file simdKernels.h
+ * @brief Built-in vectorized NTT and element-wise modular kernels
+ *
+ * These kernels do not depend on any external library. On x86-64 builds
+ * with GCC or Clang, AVX-512 and AVX2 versions are compiled next to
+ * portable ones and the fast path is picked at runtime by querying CPUID,
+ * so a single binary runs on every machine. Define HELIB_NO_NATIVE_SIMD to
+ * compile the portable versions only. `version::kernels()` reports the
+ * versions picked on the running machine.
+ *
+ * The element-wise add/sub/reduce kernels and the Gaussian sampler need
+ * AVX-512F or AVX2 and work for any single-precision modulus. The
+ * multiplication and NTT kernels need
+ * AVX-512IFMA and a modulus of fewer than IFMA_MODULUS_BITS bits (build
+ * with -DHELIB_SP_NBITS=49 to get primes of that size); for larger
+ * moduli they fall back to scalar code.
+ *
+ * On AArch64 the element-wise add/sub/reduce kernels and the Gaussian
+ * sampler also have NEON versions. The multiplication and NTT kernels stay
+ * scalar there, since NEON has no 64x64->128-bit multiply to vectorize the
+ * Shoup reductions with, and so does the gather, which NEON has no
+ * instruction for.
+ **/
+#include <cstdint>
+#include <vector>
+
+#include <NTL/ZZ.h>
+
+namespace helib {
+
+namespace simd {
+
+//! Moduli must be below 2^IFMA_MODULUS_BITS for the IFMA kernels: the
+//! lazy butterflies keep values in [0, 4q), which must fit in 52 bits
+constexpr long IFMA_MODULUS_BITS = 50;
+
+//! @brief Does the CPU (and OS) support AVX-512F?
+bool haveAVX512F();
+
+//! @brief Does the CPU (and OS) support AVX-512IFMA and AVX-512DQ?
+bool haveAVX512IFMA();
+
+//! @brief Does the CPU (and OS) support AVX2 and FMA?
+bool haveAVX2();
+
+//! @brief Is this an AArch64 build with the NEON kernels?
+bool haveNEON();
+
+//! @brief Globally enable or disable the vectorized kernels (they are on
+//! by default). Mostly useful for testing and benchmarking
+void setEnabled(bool enable);
+bool isEnabled();
+
+//! @brief Will the IFMA kernels be used for this modulus?
+bool useIFMA(long q);
+
+// Element-wise kernels, result[i] = op(a[i], b[i]) mod q.
+// The inputs must be reduced mod q, and result may alias a or b.
+
+void EltwiseAddMod(long* result, const long* a, const long* b, long n, long q);
+void EltwiseAddMod(long* result, const long* a, long scalar, long n, long q);
+
+void EltwiseSubMod(long* result, const long* a, const long* b, long n, long q);
+void EltwiseSubMod(long* result, const long* a, long scalar, long n, long q);
+
+void EltwiseMultMod(long* result,
+                    const long* a,
+                    const long* b,
+                    long n,
+                    long q,
+                    NTL::mulmod_t qinv);
+void EltwiseMultMod(long* result,
+                    const long* a,
+                    const long* b,
+                    long n,
+                    long q);
+void EltwiseMultMod(long* result,
+                    const long* a,
+                    long scalar,
+                    long n,
+                    long q);
+
+//! @brief result[i] = a[i] mod q, in [0, q), for any a[i]. It is fastest
+//! when |a[i]| < q, as for the coefficients of most plaintexts; result may
+//! alias a
+void EltwiseReduceMod(long* result, const long* a, long n, long q);
+
+//! @brief result[i] = src[index[i]] for i < n. The indexes must be in range
+//! for src, and result must not overlap src
+void Gather(long* result, const long* src, const long* index, long n);
+
+/**
+ * @brief Discrete Gaussian samples from random words, by a scan of the
+ * cumulative distribution table cdt[0..size) of their absolute value.
+ *
+ * With u = words[i] >> 1, result[i] is the number of k with cdt[k] <= u,
+ * negated if the low bit of words[i] is set. The whole table is scanned for
+ * every sample, so the time does not depend on the samples.
+ **/
+void SampleCDT(long* result,
+               const uint64_t* words,
+               long n,
+               const uint64_t* cdt,
+               long size);
+
+/**
+ * @class NTTTables
+ * @brief Precomputed tables for a length-n negacyclic NTT modulo q
+ *
+ * n must be a power of two, q < 2^MAX_MODULUS_BITS a prime with
+ * q = 1 (mod 2n), and psi a primitive 2n-th root of unity mod q.
+ *
+ * forward() maps the coefficients a_0..a_{n-1} (in natural order) to the
+ * evaluations a(psi^{2j+1}), stored in bit-reversed order of j.
+ * inverse() is its inverse, including the scaling by 1/n: it takes
+ * evaluations in bit-reversed order and returns coefficients in natural
+ * order. Both work in place on values reduced mod q. The twist by the
+ * powers of psi is folded into the butterflies, so there is no separate
+ * pre- or post-multiplication pass.
+ *
+ * The transforms use Harvey-style lazy butterflies with Shoup-precomputed
+ * twiddles. For q < 2^IFMA_MODULUS_BITS they are vectorized with
+ * AVX-512IFMA when available at runtime.
+ *
+ * forwardSplit() and inverseSplit() compute the same transforms with the
+ * work of each one spread over the threads (as a pass over sqrt(n) columns
+ * then one over sqrt(n) rows), for when a single transform is what stands
+ * between the caller and its result.
+ **/
+class NTTTables
+{
+public:
+  //! The lazy butterflies keep values in [0, 4q), which must fit in 64 bits
+  static constexpr long MAX_MODULUS_BITS = 62;
+
+private:
+  long n;
+  long logn;
+  uint64_t q;
+  bool ifmaTables;                    // q is small enough for IFMA
+  std::vector<uint64_t> psiPowers;    // psi^{brv(i)}
+  std::vector<uint64_t> psiPrecon;    // floor(psi^{brv(i)} 2^64 / q)
+  std::vector<uint64_t> psiInvPowers; // psi^{-brv(i)}
+  std::vector<uint64_t> psiInvPrecon;
+  std::vector<uint64_t> psiPrecon52; // floor(psi^{brv(i)} 2^52 / q), IFMA
+  std::vector<uint64_t> psiInvPrecon52;
+  uint64_t nInv;
+  uint64_t nInvPrecon;
+
+public:
+  NTTTables(long n, long q, long psi);
+
+  long size() const { return n; }
+  long modulus() const { return q; }
+
+  void forward(long* a) const;
+  void inverse(long* a) const;
+
+  void forwardSplit(long* a) const;
+  void inverseSplit(long* a) const;
+};
+
+} // namespace simd
+
+} // namespace helib
+
+#endif // ifndef HELIB_SIMDKERNELS_H
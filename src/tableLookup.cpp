@@ -18,7 +18,10 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <NTL/BasicThreadPool.h>
+#include <NTL/lzz_pX.h>
+#include <helib/multicore.h>
 #include <helib/intraSlot.h>
+#include <helib/polyEval.h>
 #include <helib/tableLookup.h>
 
 #ifdef HELIB_DEBUG
@@ -95,14 +98,141 @@ void tableLookup(Ctxt& out,
   computeAllProducts(pWrap, idx, unpackSlotEncoding);
 
   // Compute the sum b_i * T[i]
-  NTL_EXEC_RANGE(lsize(table), first, last)
+  HELIB_EXEC_RANGE(lsize(table), first, last)
   for (long i = first; i < last; i++)
     products[i].multByConstant(table[i]); // p[i] = p[i]*T[i]
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
   for (long i = 0; i < lsize(table); i++)
     out += products[i];
 }
 
+IndexProducts::IndexProducts(const CtPtrs& idx,
+                             long size,
+                             std::vector<zzX>* unpackSlotEncoding)
+{
+  const Ctxt* ct = idx.ptr2nonNull(); // find some non-null Ctxt
+  assertNotNull<InvalidArgument>(ct, "Invalid index (no non-null Ctxt)");
+  if (size > 0)
+    products.resize(size, Ctxt(ZeroCtxtLike, *ct));
+
+  CtPtrs_vectorCt pWrap(products); // resized by computeAllProducts if empty
+  computeAllProducts(pWrap, idx, unpackSlotEncoding);
+}
+
+// Compute the sum b_i * T[i] into out, without touching the b_i's.
+// Each thread accumulates a partial sum over its own range of entries.
+static void lookupSum(Ctxt& out,
+                      const std::vector<zzX>& table,
+                      const IndexProducts& products)
+{
+  long n = lsize(table);
+  out.clear();
+  if (n == 0)
+    return;
+
+  // allocate threads to handle n entries
+  NTL::PartitionInfo pinfo(n, helib::AvailableThreads());
+  long cnt = pinfo.NumIntervals(); // how many threads are allocated
+  std::vector<Ctxt> partial(cnt, Ctxt(ZeroCtxtLike, products[0]));
+  HELIB_EXEC_INDEX(cnt, index)
+  long first, last;
+  pinfo.interval(first, last, index);
+  for (long i = first; i < last; i++) {
+    Ctxt tmp(products[i]);
+    tmp.multByConstant(table[i]); // b_i * T[i]
+    partial[index] += tmp;
+  }
+  HELIB_EXEC_INDEX_END
+  for (long j = 0; j < cnt; j++)
+    out += partial[j];
+}
+
+// Look up a table with pre-computed index products
+void tableLookup(Ctxt& out,
+                 const std::vector<zzX>& table,
+                 const IndexProducts& products)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(lsize(table) <= products.size(),
+                              "Table is larger than the index products");
+  lookupSum(out, table, products);
+}
+
+// Look up many tables with the same index, computing its products once
+void tableLookup(std::vector<Ctxt>& out,
+                 const std::vector<std::vector<zzX>>& tables,
+                 const CtPtrs& idx,
+                 std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  long nTables = lsize(tables);
+  if (nTables == 0) {
+    out.clear();
+    return;
+  }
+  long size = 0;
+  for (const auto& table : tables)
+    size = std::max(size, lsize(table));
+  IndexProducts products(idx, size, unpackSlotEncoding);
+
+  if (lsize(out) != nTables)
+    out.assign(nTables, Ctxt(ZeroCtxtLike, *idx.ptr2nonNull()));
+
+  // With few tables, let each one parallelize internally instead
+  if (nTables >= helib::AvailableThreads()) {
+    HELIB_EXEC_RANGE(nTables, first, last)
+    for (long t = first; t < last; t++)
+      lookupSum(out[t], tables[t], products);
+    HELIB_EXEC_RANGE_END
+  } else {
+    for (long t = 0; t < nTables; t++)
+      lookupSum(out[t], tables[t], products);
+  }
+}
+
+void buildLookupPoly(NTL::ZZX& poly,
+                     const std::vector<long>& table,
+                     const EncryptedArray& ea)
+{
+  HELIB_TIMER_START;
+  const Context& context = ea.getContext();
+  long n = lsize(table);
+  assertTrue<InvalidArgument>(n > 0 && n <= context.getP(),
+                              "The table must have between 1 and p entries");
+
+  // The points 0..n-1 differ by less than p, so Z_{p^r} is as good as a
+  // field for interpolating at them
+  NTL::zz_pPush push(context.getAlMod().getPPowR());
+  NTL::vec_zz_p points, values;
+  points.SetLength(n);
+  values.SetLength(n);
+  for (long i = 0; i < n; i++) {
+    points[i] = i;
+    values[i] = table[i];
+  }
+  NTL::zz_pX f;
+  NTL::interpolate(f, points, values);
+  NTL::conv(poly, f);
+}
+
+void tableLookupPoly(Ctxt& out,
+                     const NTL::ZZX& poly,
+                     const Ctxt& index,
+                     long k)
+{
+  HELIB_TIMER_START;
+  polyEval(out, poly, index, k);
+}
+
+void tableLookupPoly(std::vector<Ctxt>& out,
+                     const NTL::ZZX& poly,
+                     const std::vector<Ctxt>& indices,
+                     long k)
+{
+  HELIB_TIMER_START;
+  polyEvalBatch(out, poly, indices, k);
+}
+
 // A counterpart of tableLookup. The input is an encrypted table T[]
 // and an array of encrypted bits I[], holding the binary representation
 // of an index i into T.  This function increments by one the entry T[i].
@@ -122,10 +252,14 @@ void tableWriteIn(const CtPtrs& table,
   computeAllProducts(pWrap, idx, unpackSlotEncoding);
 
   // increment each entry of T[i] by products[i]
-  NTL_EXEC_RANGE(lsize(table), first, last)
-  for (long i = first; i < last; i++)
-    *table[i] += products[i];
-  NTL_EXEC_RANGE_END
+  withSpans(
+      [&](const auto& table) {
+        HELIB_EXEC_RANGE(lsize(table), first, last)
+        for (long i = first; i < last; i++)
+          *table[i] += products[i];
+        HELIB_EXEC_RANGE_END
+      },
+      table);
 }
 
 // The function buildLookupTable is documented in tableLookup.h.
@@ -250,22 +384,43 @@ static void recursiveProducts(const CtPtrs& products, const CtPtrs_slice& array)
     std::vector<Ctxt> products1(k, Ctxt(ZeroCtxtLike, *ct));
     std::vector<Ctxt> products2(l, Ctxt(ZeroCtxtLike, *ct));
 
-    // compute first part of the array
-    recursiveProducts(CtPtrs_vectorCt(products1), CtPtrs_slice(array, 0, n1));
-
-    // recursive call on second part of array
-    recursiveProducts(CtPtrs_vectorCt(products2),
-                      CtPtrs_slice(array, n1, nBits - n1));
+    // The two parts are independent. Computing them side by side only pays
+    // off when neither has enough products to keep all the threads busy,
+    // otherwise each part is computed in turn with its own parallel loop.
+    if (std::max(k, l) <= helib::AvailableThreads()) {
+      HELIB_EXEC_RANGE(2, first, last)
+      for (long part = first; part < last; part++) {
+        if (part == 0)
+          recursiveProducts(CtPtrs_vectorCt(products1),
+                            CtPtrs_slice(array, 0, n1));
+        else
+          recursiveProducts(CtPtrs_vectorCt(products2),
+                            CtPtrs_slice(array, n1, nBits - n1));
+      }
+      HELIB_EXEC_RANGE_END
+    } else {
+      // compute first part of the array
+      recursiveProducts(CtPtrs_vectorCt(products1),
+                        CtPtrs_slice(array, 0, n1));
+
+      // recursive call on second part of array
+      recursiveProducts(CtPtrs_vectorCt(products2),
+                        CtPtrs_slice(array, n1, nBits - n1));
+    }
 
     // multiplication to get all subset products
-    NTL_EXEC_RANGE(lsize(products), first, last)
-    for (long ii = first; ii < last; ii++) {
-      long j = ii / k;
-      long i = ii - j * k;
-      *products[ii] = products1[i];
-      products[ii]->multiplyBy(products2[j]);
-    }
-    NTL_EXEC_RANGE_END
+    withSpans(
+        [&](const auto& products) {
+          HELIB_EXEC_RANGE(lsize(products), first, last)
+          for (long ii = first; ii < last; ii++) {
+            long j = ii / k;
+            long i = ii - j * k;
+            *products[ii] = products1[i];
+            products[ii]->multiplyBy(products2[j]);
+          }
+          HELIB_EXEC_RANGE_END
+        },
+        products);
   }
 }
 
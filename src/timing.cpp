@@ -11,8 +11,13 @@
  */
 #include <algorithm>
 #include <utility>
+#include <cmath>
 #include <cstring>
 #include <ctime>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <helib/timing.h>
 
 namespace helib {
@@ -43,6 +48,25 @@ unsigned long GetTimerClock() { return clock(); }
 const unsigned long CLOCK_SCALE = (unsigned long)CLOCKS_PER_SEC;
 #endif
 
+// The events counted by a timer, if any, as " (cycles=.., ..., ipc=..)"
+static void printPerfCounts(std::ostream& str, const FHEtimer& timer)
+{
+  PerfSample sample;
+  bool any = false;
+  for (int i = 0; i < perfEventCount; i++) {
+    sample.counts[i] = timer.getPerfCount(PerfEvent(i));
+    any = any || sample.counts[i] != 0;
+  }
+  if (!any)
+    return;
+  const char* sep = " (";
+  for (int i = 0; i < perfEventCount; i++) {
+    str << sep << perfEventName(PerfEvent(i)) << "=" << sample.counts[i];
+    sep = ", ";
+  }
+  str << ", ipc=" << sample.ipc() << ")";
+}
+
 bool timer_compare(const FHEtimer* a, const FHEtimer* b)
 {
   return strcmp(a->name, b->name) < 0;
@@ -62,6 +86,28 @@ void FHEtimer::reset()
 {
   numCalls = 0;
   counter = 0;
+  for (auto& count : histogram)
+    count = 0;
+  for (auto& count : perfCounts)
+    count = 0;
+}
+
+double FHEtimer::getBucketBound(long i)
+{
+  if (i >= numBuckets - 1)
+    return HUGE_VAL;
+  return std::ldexp(1.0, i) / CLOCK_SCALE;
+}
+
+void forEachTimer(const std::function<void(const FHEtimer&)>& fn)
+{
+  std::vector<const FHEtimer*> timers;
+  {
+    HELIB_MUTEX_GUARD(timerMapMx);
+    timers.assign(timerMap.begin(), timerMap.end());
+  }
+  for (const FHEtimer* timer : timers)
+    fn(*timer);
 }
 
 // Read the value of a timer (in seconds)
@@ -99,7 +145,9 @@ void printAllTimers(std::ostream& str)
     }
 
     str << "  " << name << ": " << t << " / " << n << " = " << ave << "   ["
-        << loc << "]\n";
+        << loc << "]";
+    printPerfCounts(str, *timerMap[i]);
+    str << "\n";
   }
 }
 
@@ -124,7 +172,9 @@ bool printNamedTimer(std::ostream& str, const char* name)
         double ave = t / n;
 
         str << "  " << name << ": " << t << " / " << n << " = " << ave << "   ["
-            << timerMap[i]->loc << "]\n";
+            << timerMap[i]->loc << "]";
+        printPerfCounts(str, *timerMap[i]);
+        str << "\n";
       } else {
         str << "  " << name << " -- [" << timerMap[i]->loc << "]\n";
       }
@@ -134,4 +184,178 @@ bool printNamedTimer(std::ostream& str, const char* name)
   return false;
 }
 
+//=============== Tracing ===============
+
+std::atomic_bool tracingOn{false};
+
+namespace {
+
+struct TraceSpan
+{
+  const FHEtimer* timer;
+  long id;
+  long parent;
+  unsigned long begin;
+  unsigned long end;
+};
+
+// A block of the spans of one thread. Only that thread appends to it, and
+// publishes each span by increasing count, so readers need no lock.
+struct TraceChunk
+{
+  static constexpr long capacity = 1024;
+  TraceSpan spans[capacity];
+  std::atomic_long count{0};
+  std::atomic<TraceChunk*> next{nullptr};
+};
+
+struct ThreadTrace
+{
+  long tid;
+  long generation;
+  TraceChunk head;
+  TraceChunk* tail = &head;
+
+  ThreadTrace(long tid, long generation) : tid(tid), generation(generation) {}
+
+  ~ThreadTrace()
+  {
+    TraceChunk* chunk = head.next.load();
+    while (chunk != nullptr) {
+      TraceChunk* next = chunk->next.load();
+      delete chunk;
+      chunk = next;
+    }
+  }
+
+  void append(const TraceSpan& span)
+  {
+    long n = tail->count.load(std::memory_order_relaxed);
+    if (n == TraceChunk::capacity) {
+      TraceChunk* chunk = new TraceChunk;
+      tail->next.store(chunk, std::memory_order_release);
+      tail = chunk;
+      n = 0;
+    }
+    tail->spans[n] = span;
+    tail->count.store(n + 1, std::memory_order_release);
+  }
+};
+
+std::mutex traceMx; // guards traces and nextTid
+std::vector<std::shared_ptr<ThreadTrace>> traces;
+long nextTid = 0;
+// Increased by clearTrace, so that the threads start new buffers
+std::atomic_long traceGeneration{0};
+std::atomic_long nextSpanId{0};
+
+thread_local std::shared_ptr<ThreadTrace> threadTrace;
+thread_local long currentSpan = -1;
+thread_local long threadId = -1;
+
+ThreadTrace& myTrace()
+{
+  long generation = traceGeneration.load(std::memory_order_acquire);
+  if (!threadTrace || threadTrace->generation != generation) {
+    std::lock_guard<std::mutex> lock(traceMx);
+    if (threadId < 0)
+      threadId = nextTid++;
+    threadTrace = std::make_shared<ThreadTrace>(threadId, generation);
+    traces.push_back(threadTrace);
+  }
+  return *threadTrace;
+}
+
+void writeJSONString(std::ostream& str, const char* s)
+{
+  str << '"';
+  for (; *s != '\0'; s++) {
+    if (*s == '"' || *s == '\\')
+      str << '\\';
+    str << *s;
+  }
+  str << '"';
+}
+
+} // namespace
+
+void setTracing(bool on) { tracingOn = on; }
+
+bool isTracing() { return tracingOn; }
+
+void clearTrace()
+{
+  std::lock_guard<std::mutex> lock(traceMx);
+  traces.clear();
+  traceGeneration++;
+}
+
+long currentTraceSpan() { return currentSpan; }
+
+TraceParentScope::TraceParentScope(long span) : saved(currentSpan)
+{
+  currentSpan = span;
+}
+
+TraceParentScope::~TraceParentScope() { currentSpan = saved; }
+
+TraceMark beginTraceSpan()
+{
+  TraceMark mark;
+  mark.id = nextSpanId++;
+  mark.parent = currentSpan;
+  currentSpan = mark.id;
+  return mark;
+}
+
+void endTraceSpan(const FHEtimer* timer,
+                  const TraceMark& mark,
+                  unsigned long begin,
+                  unsigned long end)
+{
+  currentSpan = mark.parent;
+  myTrace().append(TraceSpan{timer, mark.id, mark.parent, begin, end});
+}
+
+void writeChromeTrace(std::ostream& str)
+{
+  std::vector<std::shared_ptr<ThreadTrace>> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(traceMx);
+    snapshot = traces;
+  }
+
+  const double toMicros = 1e6 / CLOCK_SCALE;
+  const char* sep = "\n";
+  std::ios_base::fmtflags flags = str.flags();
+  std::streamsize precision = str.precision();
+  str << std::fixed << std::setprecision(3);
+  str << "{\"traceEvents\":[";
+  for (const auto& trace : snapshot) {
+    str << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+        << "\"tid\":" << trace->tid << ",\"args\":{\"name\":\"thread "
+        << trace->tid << "\"}}";
+    sep = ",\n";
+    for (const TraceChunk* chunk = &trace->head; chunk != nullptr;
+         chunk = chunk->next.load(std::memory_order_acquire)) {
+      long n = chunk->count.load(std::memory_order_acquire);
+      for (long i = 0; i < n; i++) {
+        const TraceSpan& span = chunk->spans[i];
+        str << sep << "{\"name\":";
+        writeJSONString(str, span.timer->name);
+        str << ",\"cat\":\"helib\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+            << trace->tid << ",\"ts\":" << span.begin * toMicros
+            << ",\"dur\":" << (span.end - span.begin) * toMicros
+            << ",\"args\":{\"id\":" << span.id
+            << ",\"parent\":" << span.parent << ",\"loc\":";
+        writeJSONString(str, span.timer->loc);
+        str << "}}";
+      }
+    }
+  }
+  str << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  str.flags(flags);
+  str.precision(precision);
+}
+
 } // namespace helib
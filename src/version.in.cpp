@@ -7,4 +7,25 @@ static constexpr char versionInLib[] = "v@PROJECT_VERSION@";
 
 const char* version::libString() { return versionInLib; }
 
+// The options the library was compiled with, as seen by the library itself
+static constexpr char buildFlagsInLib[] =
+#ifdef USE_INTEL_HEXL
+    "HEXL=ON"
+#else
+    "HEXL=OFF"
+#endif
+#ifdef HELIB_THREADS
+    " THREADS=ON"
+#else
+    " THREADS=OFF"
+#endif
+#ifdef HELIB_DEBUG
+    " DEBUG=ON"
+#else
+    " DEBUG=OFF"
+#endif
+    ;
+
+const char* version::buildFlags() { return buildFlagsInLib; }
+
 } // namespace helib
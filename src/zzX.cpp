@@ -13,6 +13,7 @@
  * @file zzX.cpp - manipulating polynomials with single-precision coefficient
  *               It is assumed that the result is also single-precision
  **/
+#include <algorithm>
 #include <mutex>
 #include <map>
 
@@ -21,6 +22,8 @@
 #include <helib/zzX.h>
 #include <helib/range.h>
 
+#include "simdKernels.h"
+
 namespace helib {
 
 void MulMod(zzX& res, const zzX& a, const zzX& b, const PAlgebra& palg)
@@ -42,24 +45,56 @@ void add(zzX& res, const zzX& a, const zzX& b)
   // The shorter one is aa, the longer is bb
   const zzX& aa = (lsize(a) < lsize(b)) ? a : b;
   const zzX& bb = (lsize(a) < lsize(b)) ? b : a;
-  res.SetLength(lsize(bb));
-  for (long i = 0; i < lsize(aa); i++)
-    res[i] = aa[i] + bb[i];
-  for (long i = lsize(aa); i < lsize(bb); i++)
-    res[i] = bb[i];
+  long na = lsize(aa), nb = lsize(bb);
+  res.SetLength(nb);
+  long* r = res.elts();
+  const long* x = aa.elts();
+  const long* y = bb.elts();
+  // Plain loops over the raw arrays, which the compiler vectorizes
+  for (long i = 0; i < na; i++)
+    r[i] = x[i] + y[i];
+  if (r != y)
+    std::copy(y + na, y + nb, r + na);
 }
+
 void mul(zzX& res, const zzX& a, long b)
 {
-  res.SetLength(lsize(a));
-  for (long i = 0; i < lsize(a); i++)
-    res[i] *= a[i] * b;
+  long n = lsize(a);
+  res.SetLength(n);
+  long* r = res.elts();
+  const long* x = a.elts();
+  for (long i = 0; i < n; i++)
+    r[i] = x[i] * b;
 }
 
 void div(zzX& res, const zzX& a, long b)
 {
-  res.SetLength(lsize(a));
-  for (long i = 0; i < lsize(a); i++)
-    res[i] = a[i] / b;
+  long n = lsize(a);
+  res.SetLength(n);
+  long* r = res.elts();
+  const long* x = a.elts();
+  for (long i = 0; i < n; i++)
+    r[i] = x[i] / b;
+}
+
+void convert(NTL::zz_pX& x, const zzX& a)
+{
+  // A zz_p is a long in [0, p), so the coefficients are reduced in place
+  static_assert(sizeof(NTL::zz_p) == sizeof(long), "zz_p is not a long");
+  long n = lsize(a);
+  x.rep.SetLength(n);
+  simd::EltwiseReduceMod(reinterpret_cast<long*>(x.rep.elts()),
+                         a.elts(),
+                         n,
+                         NTL::zz_p::modulus());
+  x.normalize();
+}
+
+void reduceCoeffs(zzX& res, const zzX& a, long q)
+{
+  long n = lsize(a);
+  res.SetLength(n);
+  simd::EltwiseReduceMod(res.elts(), a.elts(), n, q);
 }
 
 void normalize(zzX& f)
@@ -491,6 +491,50 @@ TEST_P(GTestBinaryArith, product)
 #endif
 }
 
+TEST_P(GTestBinaryArith, productWithEachMultiplier)
+{
+  const helib::EncryptedArray& ea = context.getEA();
+  long mask = (outSize ? ((1L << outSize) - 1) : -1);
+
+  long multiplicand_data = NTL::RandomBits_long(bitSize);
+  long multiplier_data = NTL::RandomBits_long(bitSize2);
+
+  NTL::Vec<helib::Ctxt> encrypted_multiplicand, encrypted_multiplier;
+  helib::resize(encrypted_multiplicand, bitSize, helib::Ctxt(secKey));
+  for (long i = 0; i < bitSize; i++)
+    secKey.Encrypt(encrypted_multiplicand[i],
+                   NTL::ZZX((multiplicand_data >> i) & 1));
+  helib::resize(encrypted_multiplier, bitSize2, helib::Ctxt(secKey));
+  for (long i = 0; i < bitSize2; i++)
+    secKey.Encrypt(encrypted_multiplier[i],
+                   NTL::ZZX((multiplier_data >> i) & 1));
+
+  // Karatsuba trades depth for multiplications, so it needs recryption to
+  // run on small operands
+  std::vector<helib::MultiplierStrategy> strategies = {
+      helib::MultiplierStrategy::WALLACE,
+      helib::MultiplierStrategy::DADDA};
+  if (bootstrap)
+    strategies.push_back(helib::MultiplierStrategy::KARATSUBA);
+
+  for (helib::MultiplierStrategy strategy : strategies) {
+    NTL::Vec<helib::Ctxt> encrypted_product;
+    std::vector<long> decrypted_result;
+    helib::CtPtrs_VecCt output_wrapper(encrypted_product);
+    helib::multTwoNumbers(output_wrapper,
+                          helib::CtPtrs_VecCt(encrypted_multiplicand),
+                          helib::CtPtrs_VecCt(encrypted_multiplier),
+                          /*negative=*/false,
+                          outSize,
+                          &unpackSlotEncoding,
+                          strategy);
+    helib::decryptBinaryNums(decrypted_result, output_wrapper, secKey, ea);
+    EXPECT_EQ(decrypted_result[0], (multiplicand_data * multiplier_data) & mask)
+        << "strategy " << static_cast<int>(strategy) << ": "
+        << multiplicand_data << "*" << multiplier_data;
+  }
+}
+
 TEST_P(GTestBinaryArith, add)
 {
   // Randomly generate a pair of numbers of a specified bit size and then
@@ -587,6 +631,153 @@ TEST_P(GTestBinaryArith, add)
 #endif
 }
 
+TEST_P(GTestBinaryArith, addWithEachPrefixAdder)
+{
+  const helib::EncryptedArray& ea = context.getEA();
+  long mask = (outSize ? ((1L << outSize) - 1) : -1);
+
+  long addend_data = NTL::RandomBits_long(bitSize);
+  long augend_data = NTL::RandomBits_long(bitSize2);
+
+  NTL::Vec<helib::Ctxt> encrypted_addend, encrypted_augend;
+  helib::resize(encrypted_addend, bitSize, helib::Ctxt(secKey));
+  for (long i = 0; i < bitSize; i++)
+    secKey.Encrypt(encrypted_addend[i], NTL::ZZX((addend_data >> i) & 1));
+  helib::resize(encrypted_augend, bitSize2, helib::Ctxt(secKey));
+  for (long i = 0; i < bitSize2; i++)
+    secKey.Encrypt(encrypted_augend[i], NTL::ZZX((augend_data >> i) & 1));
+
+  for (helib::AdderStrategy strategy : {helib::AdderStrategy::KOGGE_STONE,
+                                        helib::AdderStrategy::BRENT_KUNG,
+                                        helib::AdderStrategy::SKLANSKY}) {
+    NTL::Vec<helib::Ctxt> encrypted_sum;
+    std::vector<long> decrypted_result;
+    helib::CtPtrs_VecCt output_wrapper(encrypted_sum);
+    helib::addTwoNumbers(output_wrapper,
+                         helib::CtPtrs_VecCt(encrypted_addend),
+                         helib::CtPtrs_VecCt(encrypted_augend),
+                         outSize,
+                         &unpackSlotEncoding,
+                         strategy);
+    helib::decryptBinaryNums(decrypted_result, output_wrapper, secKey, ea);
+    EXPECT_EQ(decrypted_result[0], (addend_data + augend_data) & mask)
+        << "strategy " << static_cast<int>(strategy) << ": " << addend_data
+        << "+" << augend_data;
+  }
+}
+
+TEST_P(GTestBinaryArith, bitSlicedNumbersAddAndCompare)
+{
+  const helib::EncryptedArray& ea = context.getEA();
+  long count = helib::BitSlicedNums::maxCount(ea, bitSize);
+  if (count < 1)
+    return;
+
+  std::vector<long> a_data(count), b_data(count);
+  for (long j = 0; j < count; j++) {
+    a_data[j] = NTL::RandomBits_long(bitSize);
+    b_data[j] = (j % 3 == 0) ? a_data[j] : NTL::RandomBits_long(bitSize);
+  }
+
+  // One ciphertext per bit, number j in slot j
+  std::vector<helib::Ctxt> a_bits(bitSize, helib::Ctxt(secKey));
+  std::vector<helib::Ctxt> b_bits(bitSize, helib::Ctxt(secKey));
+  for (long k = 0; k < bitSize; k++) {
+    std::vector<long> a_slots(ea.size(), 0), b_slots(ea.size(), 0);
+    for (long j = 0; j < count; j++) {
+      a_slots[j] = (a_data[j] >> k) & 1;
+      b_slots[j] = (b_data[j] >> k) & 1;
+    }
+    ea.encrypt(a_bits[k], secKey, a_slots);
+    ea.encrypt(b_bits[k], secKey, b_slots);
+  }
+
+  helib::BitSlicedNums a(ea, helib::CtPtrs_vectorCt(a_bits), count);
+  helib::BitSlicedNums b(ea, helib::CtPtrs_vectorCt(b_bits), count);
+  std::vector<long> decrypted;
+  a.decrypt(decrypted, secKey);
+  EXPECT_EQ(decrypted, a_data);
+
+  long mask = (1L << bitSize) - 1;
+  helib::BitSlicedNums sum(a);
+  helib::addBitSliced(sum, a, b);
+  sum.decrypt(decrypted, secKey);
+  for (long j = 0; j < count; j++)
+    EXPECT_EQ(decrypted[j], (a_data[j] + b_data[j]) & mask) << "j=" << j;
+
+  // Back to one ciphertext per bit
+  std::vector<helib::Ctxt> sum_bits;
+  helib::CtPtrs_vectorCt sum_wrapper(sum_bits);
+  sum.unpack(sum_wrapper);
+  ASSERT_EQ(helib::lsize(sum_bits), bitSize);
+  std::vector<long> slots;
+  for (long k = 0; k < bitSize; k++) {
+    ea.decrypt(sum_bits[k], secKey, slots);
+    for (long j = 0; j < ea.size(); j++)
+      EXPECT_EQ(slots[j], j < count ? (decrypted[j] >> k) & 1 : 0);
+  }
+
+  helib::Ctxt mu(secKey), ni(secKey);
+  helib::compareBitSliced(mu, ni, a, b);
+  std::vector<long> mu_slots, ni_slots;
+  ea.decrypt(mu, secKey, mu_slots);
+  ea.decrypt(ni, secKey, ni_slots);
+  for (long j = 0; j < ea.size(); j++) {
+    bool used = j < count;
+    EXPECT_EQ(mu_slots[j], long(used && a_data[j] > b_data[j])) << "j=" << j;
+    EXPECT_EQ(ni_slots[j], long(used && a_data[j] < b_data[j])) << "j=" << j;
+  }
+}
+
+TEST_P(GTestBinaryArith, addManyPairsOfNumbers)
+{
+  const helib::EncryptedArray& ea = context.getEA();
+  long mask = (outSize ? ((1L << outSize) - 1) : -1);
+  const long num_pairs = 3;
+
+  // Pairs of the same shape share their addition plan, both within the call
+  // and with the single pair addition below
+  std::vector<long> addend_data, augend_data;
+  std::vector<std::vector<helib::Ctxt>> encrypted_addends, encrypted_augends;
+  for (long k = 0; k < num_pairs; k++) {
+    addend_data.push_back(NTL::RandomBits_long(bitSize));
+    augend_data.push_back(NTL::RandomBits_long(bitSize2));
+    encrypted_addends.emplace_back(bitSize, helib::Ctxt(secKey));
+    for (long i = 0; i < bitSize; i++)
+      secKey.Encrypt(encrypted_addends[k][i],
+                     NTL::ZZX((addend_data[k] >> i) & 1));
+    encrypted_augends.emplace_back(bitSize2, helib::Ctxt(secKey));
+    for (long i = 0; i < bitSize2; i++)
+      secKey.Encrypt(encrypted_augends[k][i],
+                     NTL::ZZX((augend_data[k] >> i) & 1));
+  }
+
+  std::vector<std::vector<helib::Ctxt>> encrypted_sums(num_pairs);
+  helib::CtPtrMat_vectorCt sums_wrapper(encrypted_sums);
+  helib::addTwoNumbers(sums_wrapper,
+                       helib::CtPtrMat_vectorCt(encrypted_addends),
+                       helib::CtPtrMat_vectorCt(encrypted_augends),
+                       outSize,
+                       &unpackSlotEncoding);
+  for (long k = 0; k < num_pairs; k++) {
+    std::vector<long> decrypted_result;
+    helib::decryptBinaryNums(decrypted_result, sums_wrapper[k], secKey, ea);
+    EXPECT_EQ(decrypted_result[0], (addend_data[k] + augend_data[k]) & mask)
+        << "pair " << k << ": " << addend_data[k] << "+" << augend_data[k];
+  }
+
+  std::vector<helib::Ctxt> encrypted_sum;
+  helib::CtPtrs_vectorCt sum_wrapper(encrypted_sum);
+  helib::addTwoNumbers(sum_wrapper,
+                       helib::CtPtrs_vectorCt(encrypted_addends[0]),
+                       helib::CtPtrs_vectorCt(encrypted_augends[0]),
+                       outSize,
+                       &unpackSlotEncoding);
+  std::vector<long> decrypted_result;
+  helib::decryptBinaryNums(decrypted_result, sum_wrapper, secKey, ea);
+  EXPECT_EQ(decrypted_result[0], (addend_data[0] + augend_data[0]) & mask);
+}
+
 TEST_P(GTestBinaryArith, addManyNumbers)
 {
   // Randomly generate a vector of numbers of a specified bit size and then
@@ -672,6 +863,55 @@ TEST_P(GTestBinaryArith, addManyNumbers)
   }
 }
 
+TEST_P(GTestBinaryArith, addManyNumbersCallsTheRecryptScheduleEveryRound)
+{
+  const long num_summands = 6;
+  const helib::EncryptedArray& ea = context.getEA();
+  long mask = (outSize ? ((1L << outSize) - 1) : -1);
+
+  std::vector<long> summands_data;
+  std::vector<std::vector<helib::Ctxt>> encrypted_summands(num_summands);
+  for (long i = 0; i < num_summands; ++i) {
+    summands_data.push_back(NTL::RandomBits_long(bitSize));
+    helib::resize(encrypted_summands[i], bitSize, helib::Ctxt(secKey));
+    for (long j = 0; j < bitSize; j++) {
+      secKey.Encrypt(encrypted_summands[i][j],
+                     NTL::ZZX((summands_data[i] >> j) & 1));
+      if (bootstrap)
+        encrypted_summands[i][j].bringToSet(context.getCtxtPrimes(5));
+    }
+  }
+
+  // Only the numbers added in a round are handed to the schedule, the
+  // leftovers wait for the next one: 6 -> 4 (+0), 4 -> 3 (+1), 3 -> 2
+  std::vector<long> round_sizes;
+  const helib::RecryptSchedule schedule = [&](const helib::CtPtrMat& nums) {
+    round_sizes.push_back(nums.size());
+    if (bootstrap && helib::findMinBitCapacity(nums) < 3 * context.BPL())
+      helib::packedRecrypt(nums, unpackSlotEncoding, ea, /*belowLvl=*/10);
+  };
+
+  std::vector<helib::Ctxt> encrypted_sum;
+  std::vector<long> decrypted_result;
+  {
+    helib::CtPtrs_vectorCt output_wrapper(encrypted_sum);
+    helib::CtPtrMat_vectorCt summands_wrapper(encrypted_summands);
+    helib::addManyNumbers(output_wrapper,
+                          summands_wrapper,
+                          outSize,
+                          &unpackSlotEncoding,
+                          schedule);
+    helib::decryptBinaryNums(decrypted_result, output_wrapper, secKey, ea);
+  }
+
+  EXPECT_EQ(round_sizes, std::vector<long>({6, 3, 3}));
+  long plaintext_sum = std::accumulate(summands_data.begin(),
+                                       summands_data.end(),
+                                       0l,
+                                       std::plus<long>());
+  EXPECT_EQ(decrypted_result[0], plaintext_sum & mask);
+}
+
 TEST_P(GTestBinaryArith, negateNegatesCorrectly)
 {
   // Randomly generate a number in 2's complement and negate it.
@@ -1235,6 +1475,81 @@ TEST_P(GTestBinaryArith, bitwiseNotNotsCorrectly)
   EXPECT_THROW(do_not(), helib::LogicError);
 }
 
+TEST(GTestBinaryArith, adderCostTradesDepthForMultiplications)
+{
+  const long n = 16;
+  helib::AdderCost ks =
+      helib::adderCost(helib::AdderStrategy::KOGGE_STONE, n, n);
+  helib::AdderCost bk =
+      helib::adderCost(helib::AdderStrategy::BRENT_KUNG, n, n);
+  helib::AdderCost sk = helib::adderCost(helib::AdderStrategy::SKLANSKY, n, n);
+  helib::AdderCost dag = helib::adderCost(helib::AdderStrategy::DAG, n, n);
+
+  // One level for the a[i]*b[i] and log(n) for the prefixes
+  EXPECT_EQ(ks.depth, 5);
+  EXPECT_EQ(sk.depth, 5);
+  EXPECT_GT(bk.depth, ks.depth);
+  EXPECT_LT(bk.mults, sk.mults);
+  EXPECT_LT(sk.mults, ks.mults);
+  EXPECT_LT(ks.mults, dag.mults);
+  EXPECT_LE(dag.depth, bk.depth);
+
+  // The operands are interchangeable, and a 1-bit output needs no carries
+  helib::AdderCost bk2 =
+      helib::adderCost(helib::AdderStrategy::BRENT_KUNG, 4, n);
+  helib::AdderCost bk3 =
+      helib::adderCost(helib::AdderStrategy::BRENT_KUNG, n, 4);
+  EXPECT_EQ(bk2.depth, bk3.depth);
+  EXPECT_EQ(bk2.mults, bk3.mults);
+  EXPECT_EQ(helib::adderCost(helib::AdderStrategy::SKLANSKY, n, n, 1).mults, 0);
+}
+
+TEST(GTestBinaryArith, bitDecomposeAndRecomposeRoundTrip)
+{
+  const long r = 6;
+  helib::Context context = helib::ContextBuilder<helib::BGV>()
+                               .m(127)
+                               .p(2)
+                               .r(r)
+                               .bits(600)
+                               .build();
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  const helib::PubKey& publicKey = secretKey;
+  const helib::EncryptedArray& ea = context.getEA();
+
+  std::vector<long> values(ea.size());
+  for (long& value : values)
+    value = NTL::RandomBnd(1L << r);
+  helib::Ctxt ctxt(publicKey);
+  helib::PtxtArray(ea, values).encrypt(ctxt);
+
+  std::vector<helib::Ctxt> bits;
+  helib::CtPtrs_vectorCt wrapper(bits);
+  helib::bitDecompose(wrapper, ctxt);
+  ASSERT_EQ(long(bits.size()), r);
+  for (const helib::Ctxt& bit : bits)
+    EXPECT_EQ(bit.getPtxtSpace(), 2);
+  std::vector<long> decrypted;
+  helib::decryptBinaryNums(decrypted, wrapper, secretKey, ea);
+  EXPECT_EQ(decrypted, values);
+
+  // The low bits only, through extendExtractDigits
+  helib::bitDecompose(wrapper, ctxt, 3);
+  ASSERT_EQ(bits.size(), 3u);
+  helib::decryptBinaryNums(decrypted, wrapper, secretKey, ea);
+  for (std::size_t i = 0; i < values.size(); i++)
+    EXPECT_EQ(decrypted[i], values[i] % 8);
+
+  helib::bitDecompose(wrapper, ctxt, 0, /*reduce=*/false);
+  helib::Ctxt recomposed(publicKey);
+  helib::bitRecompose(recomposed, wrapper);
+  EXPECT_EQ(recomposed.getPtxtSpace(), 1L << r);
+  helib::PtxtArray result(ea);
+  result.decrypt(recomposed, secretKey);
+  EXPECT_EQ(result, helib::PtxtArray(ea, values));
+}
+
 INSTANTIATE_TEST_SUITE_P(
     smallParameterSizesRepeated,
     GTestBinaryArith,
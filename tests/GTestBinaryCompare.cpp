@@ -583,6 +583,93 @@ TEST_P(GTestBinaryCompare,
       << ", mu=" << slotsMu[0] << ", ni=" << slotsNi[0] << std::endl;
 }
 
+TEST_P(GTestBinaryCompare, comparingManyNumbersToOneWorksCorrectly)
+{
+  const helib::EncryptedArray& ea = context.getEA();
+  const long numValues = 4;
+
+  long pt = NTL::RandomBits_long(bitSize);
+  std::vector<long> pValues(numValues);
+  std::vector<std::vector<helib::Ctxt>> encValues(numValues);
+  std::vector<helib::Ctxt> encThreshold(bitSize, helib::Ctxt(secKey));
+  for (long i = 0; i < bitSize; i++) {
+    secKey.Encrypt(encThreshold[i], NTL::ZZX((pt >> i) & 1));
+    if (bootstrap) // put them at a lower level
+      encThreshold[i].bringToSet(context.getCtxtPrimes(5));
+  }
+  for (long k = 0; k < numValues; k++) {
+    // Make sure that at least one value is equal to the threshold
+    pValues[k] = (k == 0) ? pt : NTL::RandomBits_long(bitSize);
+    encValues[k].resize(bitSize, helib::Ctxt(secKey));
+    for (long i = 0; i < bitSize; i++) {
+      secKey.Encrypt(encValues[k][i], NTL::ZZX((pValues[k] >> i) & 1));
+      if (bootstrap) // put them at a lower level
+        encValues[k][i].bringToSet(context.getCtxtPrimes(5));
+    }
+  }
+
+  std::vector<helib::Ctxt> mu, ni;
+  helib::compareManyToOne(mu,
+                          ni,
+                          helib::CtPtrMat_vectorCt(encValues),
+                          helib::CtPtrs_vectorCt(encThreshold),
+                          false,
+                          &unpackSlotEncoding);
+  ASSERT_EQ(helib::lsize(mu), numValues);
+  ASSERT_EQ(helib::lsize(ni), numValues);
+  for (long k = 0; k < numValues; k++) {
+    std::vector<long> slotsMu, slotsNi;
+    ea.decrypt(mu[k], secKey, slotsMu);
+    ea.decrypt(ni[k], secKey, slotsNi);
+    EXPECT_EQ(std::make_pair(slotsMu[0], slotsNi[0]),
+              std::make_pair((long)(pValues[k] > pt), (long)(pValues[k] < pt)))
+        << "Comparison error: value=" << pValues[k] << ", threshold=" << pt;
+  }
+}
+
+TEST_P(GTestBinaryCompare, sortingAndMinMaxOfManyNumbersWorkCorrectly)
+{
+  const helib::EncryptedArray& ea = context.getEA();
+  // Without bootstrapping there are only levels for one layer of comparisons
+  const long numValues = bootstrap ? 5 : 2;
+
+  std::vector<long> pValues(numValues);
+  std::vector<std::vector<helib::Ctxt>> encValues(numValues);
+  for (long k = 0; k < numValues; k++) {
+    pValues[k] = NTL::RandomBits_long(bitSize);
+    encValues[k].resize(bitSize, helib::Ctxt(secKey));
+    for (long i = 0; i < bitSize; i++) {
+      secKey.Encrypt(encValues[k][i], NTL::ZZX((pValues[k] >> i) & 1));
+      if (bootstrap) // put them at a lower level
+        encValues[k][i].bringToSet(context.getCtxtPrimes(5));
+    }
+  }
+
+  std::vector<helib::Ctxt> eMax, eMin;
+  std::vector<long> slotsMax, slotsMin;
+  {
+    helib::CtPtrs_vectorCt wMax(eMax), wMin(eMin);
+    helib::minMaxOfNumbers(wMax,
+                           wMin,
+                           helib::CtPtrMat_vectorCt(encValues),
+                           false,
+                           &unpackSlotEncoding);
+    decryptBinaryNums(slotsMax, wMax, secKey, ea);
+    decryptBinaryNums(slotsMin, wMin, secKey, ea);
+  }
+  EXPECT_EQ(slotsMax[0], *std::max_element(pValues.begin(), pValues.end()));
+  EXPECT_EQ(slotsMin[0], *std::min_element(pValues.begin(), pValues.end()));
+
+  helib::CtPtrMat_vectorCt wValues(encValues);
+  helib::sortNumbers(wValues, false, &unpackSlotEncoding);
+  std::sort(pValues.begin(), pValues.end());
+  for (long k = 0; k < numValues; k++) {
+    std::vector<long> slots;
+    decryptBinaryNums(slots, wValues[k], secKey, ea);
+    EXPECT_EQ(slots[0], pValues[k]) << "Sorting error at position " << k;
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(
     smallParamaterSizesRepeated,
     GTestBinaryCompare,
@@ -347,6 +347,45 @@ TEST_P(GTestFatboot, correctlyPerformsFatboot)
     helib::print_stats(std::cout);
 }
 
+TEST_P(GTestFatboot, reCryptHonoursTheDigitExtractionChoice)
+{
+  context.buildModChain(bits,
+                        c,
+                        /*willBeBootstrappable=*/true,
+                        /*t=*/skHwt);
+  context.enableBootStrapping(mvec, useCache);
+  helib::setDryRun(helib_test::dry);
+
+  helib::SecKey secretKey(context);
+  helib::PubKey& publicKey = secretKey;
+  secretKey.GenSecKey();
+  helib::addSome1DMatrices(secretKey);
+  helib::addFrbMatrices(secretKey);
+  secretKey.genRecryptData();
+
+  long p2r = context.getAlMod().getPPowR();
+  NTL::zz_p::init(p2r);
+  NTL::ZZX ptxt_poly = helib::convert<NTL::ZZX>(
+      helib::balanced_zzX(NTL::random_zz_pX(context.getPhiM())));
+  NTL::ZZX expected;
+  helib::PolyRed(expected, ptxt_poly, p2r, true);
+
+  // The global override would hide the choice, TearDown restores it
+  helib::fhe_force_chen_han = 0;
+  for (helib::DigitExtraction method : {helib::DigitExtraction::LIFTING,
+                                        helib::DigitExtraction::DIGIT_RETAIN}) {
+    context.setDigitExtraction(method);
+    helib::Ctxt c1(publicKey);
+    secretKey.Encrypt(c1, ptxt_poly, p2r);
+    publicKey.reCrypt(c1);
+
+    NTL::ZZX decrypted;
+    secretKey.Decrypt(decrypted, c1);
+    EXPECT_EQ(expected, decrypted) << "method " << static_cast<int>(method);
+  }
+  context.setDigitExtraction(helib::DigitExtraction::AUTO);
+}
+
 // LEGACY TEST DEFAULT PARAMETERS:
 // long p=2;
 // long r=1;
@@ -122,6 +122,42 @@ TEST_P(GTestPAlgebra, readsAndWritesContextsAsStrings)
   EXPECT_EQ(context, c1);
 }
 
+TEST(GTestPAlgebraCRT, fastCRTMatchesReductionModEveryFactor)
+{
+  // m, p, r: d = 1 (the slot DFT) with r = 1 and r > 1, then d > 1 with
+  // enough slots for the remainder tree
+  const long cases[][3] = {{45, 181, 1},
+                           {45, 181, 2},
+                           {63, 127, 1},
+                           {91, 3, 2}};
+  for (const auto& c : cases) {
+    helib::Context context = helib::ContextBuilder<helib::BGV>()
+                                 .m(c[0])
+                                 .p(c[1])
+                                 .r(c[2])
+                                 .buildModChain(false)
+                                 .build();
+    const auto& alMod = context.getAlMod().getDerived(helib::PA_zz_p());
+    NTL::zz_pBak bak;
+    bak.save();
+    alMod.restoreContext();
+
+    long nSlots = context.getNSlots();
+    NTL::zz_pX H;
+    random(H, context.getPhiM());
+    std::vector<NTL::zz_pX> crt;
+    alMod.CRT_decompose(crt, H);
+    ASSERT_EQ(long(crt.size()), nSlots);
+    for (long i = 0; i < nSlots; i++)
+      EXPECT_EQ(crt[i], H % alMod.getFactors()[i])
+          << "m=" << c[0] << " p=" << c[1] << " r=" << c[2] << " slot " << i;
+
+    NTL::zz_pX H2;
+    alMod.CRT_reconstruct(H2, crt);
+    EXPECT_EQ(H2, H) << "m=" << c[0] << " p=" << c[1] << " r=" << c[2];
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(
     smallParameters,
     GTestPAlgebra,
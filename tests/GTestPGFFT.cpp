@@ -333,4 +333,33 @@ TEST(GTestPGFFT, PGFFTWorksInRange10000to20000Points)
     TestIt(n);
   }
 }
+
+TEST(GTestPGFFT, applyManyMatchesOneApplyPerVector)
+{
+  SetSeed();
+
+  // powers of two, plain and truncated Bluestein, and the trivial length
+  for (long n : {1, 64, 97, 100, 1000}) {
+    helib::PGFFT pgfft(n);
+    const long count = 5;
+
+    vector<cmplx_t> src(n * count);
+    for (auto& x : src)
+      x = cmplx_t(RandomBnd(20) - 10, RandomBnd(20) - 10);
+
+    vector<cmplx_t> expected(src);
+    for (long j = 0; j < count; j++)
+      pgfft.apply(&expected[j * n]);
+
+    vector<cmplx_t> dst(n * count);
+    pgfft.apply_many(src.data(), dst.data(), count);
+    vector<cmplx_t> inPlace(src);
+    pgfft.apply_many(inPlace.data(), inPlace.data(), count);
+
+    for (long i = 0; i < n * count; i++) {
+      EXPECT_EQ(dst[i], expected[i]) << "n=" << n << " i=" << i;
+      EXPECT_EQ(inPlace[i], expected[i]) << "n=" << n << " i=" << i;
+    }
+  }
+}
 } // namespace
@@ -176,6 +176,89 @@ TEST_P(GTestPolyEval, evaluatePolynomialOnCiphertext)
   }
 }
 
+TEST_P(GTestPolyEval, evaluatePolynomialOnManyCiphertexts)
+{
+  const long n = 3;
+  std::vector<std::vector<long>> x(n);
+  std::vector<helib::Ctxt> inCtxts(n, helib::Ctxt(publicKey));
+  for (long j = 0; j < n; j++) {
+    ea->random(x[j]);
+    ea->encrypt(inCtxts[j], publicKey, x[j]);
+  }
+
+  NTL::ZZX poly;
+  for (long i = d; i >= 0; i--)
+    SetCoeff(poly, i, NTL::RandomBnd(p2r)); // coefficients are random
+  if (isMonic)
+    SetCoeff(poly, d); // set top coefficient to 1
+
+  // Evaluate poly on all the ciphertexts at once
+  std::vector<helib::Ctxt> outCtxts;
+  helib::polyEvalBatch(outCtxts, poly, inCtxts, k);
+  ASSERT_EQ(outCtxts.size(), (std::size_t)n);
+
+  // Check the results
+  for (long j = 0; j < n; j++) {
+    std::vector<long> y;
+    ea->decrypt(outCtxts[j], secretKey, y);
+    for (long i = 0; i < ea->size(); i++) {
+      EXPECT_EQ(helib::polyEvalMod(poly, x[j][i], p2r), y[i])
+          << "plaintext poly MISMATCH on input " << j << "\n";
+    }
+  }
+}
+
+TEST_P(GTestPolyEval, manyPolynomialsShareThePowers)
+{
+  std::vector<long> x;
+  ea->random(x);
+  helib::Ctxt inCtxt(publicKey);
+  ea->encrypt(inCtxt, publicKey, x);
+
+  // Polynomials of several degrees, some below the baby steps
+  const std::vector<long> degrees = {d, d / 2 + 1, 2, 0};
+  std::vector<NTL::ZZX> polys(degrees.size());
+  for (std::size_t j = 0; j < degrees.size(); j++) {
+    for (long i = degrees[j]; i >= 0; i--)
+      SetCoeff(polys[j], i, NTL::RandomBnd(p2r));
+    if (isMonic)
+      SetCoeff(polys[j], degrees[j]);
+  }
+
+  std::vector<helib::Ctxt> outCtxts;
+  helib::polyEvalMany(outCtxts, polys, inCtxt, k);
+  ASSERT_EQ(outCtxts.size(), polys.size());
+
+  for (std::size_t j = 0; j < polys.size(); j++) {
+    std::vector<long> y;
+    ea->decrypt(outCtxts[j], secretKey, y);
+    for (long i = 0; i < ea->size(); i++) {
+      EXPECT_EQ(helib::polyEvalMod(polys[j], x[i], p2r), y[i])
+          << "plaintext poly MISMATCH for polynomial " << j << "\n";
+    }
+  }
+}
+
+TEST_P(GTestPolyEval, computingAllPowersMatchesComputingThemOnDemand)
+{
+  std::vector<long> x;
+  ea->random(x);
+  helib::Ctxt inCtxt(publicKey);
+  ea->encrypt(inCtxt, publicKey, x);
+
+  const long nPowers = 5;
+  helib::DynamicCtxtPowers powers(inCtxt, nPowers);
+  powers.computePowers();
+  for (long e = 1; e <= nPowers; e++) {
+    EXPECT_TRUE(powers.isPowerComputed(e));
+    std::vector<long> y;
+    ea->decrypt(powers.getPower(e), secretKey, y);
+    for (long i = 0; i < ea->size(); i++)
+      EXPECT_EQ(NTL::PowerMod(x[i] % p2r, e, p2r), y[i])
+          << "power " << e << " MISMATCH\n";
+  }
+}
+
 std::vector<Parameters> getParameters()
 {
   std::vector<Parameters> allParams;
@@ -114,6 +114,24 @@ TEST_P(GTestPowerful, highLevelConversionWorks)
   EXPECT_EQ(poly1, poly2);
 }
 
+TEST_P(GTestPowerful, dcrtConversionMatchesConversionOfThePolynomial)
+{
+  helib::PowerfulDCRT p2d(context, mvec);
+  helib::DoubleCRT dcrt(context, context.getCtxtPrimes());
+  NTL::ZZX poly;
+  NTL::Vec<NTL::ZZ> pwfl, unreduced, expected;
+
+  dcrt.randomize();
+  dcrt.toPoly(poly);
+  p2d.ZZXtoPowerful(unreduced, poly);
+  NTL::ZZ Q = context.productOfPrimes(context.getCtxtPrimes());
+  helib::vecRed(expected, unreduced, Q, /*abs=*/false);
+
+  p2d.dcrtToPowerful(pwfl, dcrt);
+
+  EXPECT_EQ(pwfl, expected);
+}
+
 INSTANTIATE_TEST_SUITE_P(standardParameters,
                          GTestPowerful,
                          ::testing::Values(
@@ -10,6 +10,7 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 #include <iostream>
+#include <type_traits>
 #include <NTL/tools.h>
 #include <helib/NumbTh.h>
 #include <helib/PtrVector.h>
@@ -216,4 +217,57 @@ TEST_F(GTestPtrVector, pointerVectorsRemainConsistent)
   }
 }
 
+TEST_F(GTestPtrVector, contiguousVectorsAreSeenAsSpans)
+{
+  std::vector<MyClass> v1(vLength, zero);
+  NTL::Vec<MyClass> v2(NTL::INIT_SIZE, vLength, zero);
+  std::vector<MyClass*> v3(vLength, &zero);
+
+  MyPtrVec_vector vv1(v1);
+  MyPtrVec_Vec vv2(v2);
+  MyPtrVec_vectorPt vv3(v3);
+  MyPtrVec_slice vs1(vv1, 2, 3);
+  MyPtrVec_slice vs3(vv3, 2, 3);
+
+  helib::PtrSpan<MyClass> span;
+  ASSERT_TRUE(helib::asSpan(span, vv1));
+  EXPECT_EQ(span.begin(), &v1[0]);
+  EXPECT_EQ(span.size(), vLength);
+  ASSERT_TRUE(helib::asSpan(span, vv2));
+  EXPECT_EQ(span.begin(), &v2[0]);
+  ASSERT_TRUE(helib::asSpan(span, vs1));
+  EXPECT_EQ(span.begin(), &v1[2]);
+  EXPECT_EQ(span.size(), 3);
+  EXPECT_FALSE(helib::asSpan(span, vv3));
+  EXPECT_FALSE(helib::asSpan(span, vs3));
+
+  helib::PtrSpan<MyClass> sub = helib::PtrSpan<MyClass>(v1).subspan(4);
+  EXPECT_EQ(sub[0], &v1[4]);
+  EXPECT_EQ(sub.size(), 2);
+  EXPECT_EQ(sub.subspan(1, 5).size(), 1);
+  EXPECT_EQ(sub.subspan(3).size(), 0);
+
+  // A span wrapped back into a PtrVector is still contiguous
+  helib::PtrVector_span<MyClass> vsp(sub);
+  EXPECT_EQ(vsp[1], &v1[5]);
+  EXPECT_EQ(vsp.numNonNull(), 2);
+  ASSERT_TRUE(helib::asSpan(span, vsp));
+  EXPECT_EQ(span.begin(), &v1[4]);
+
+  // withSpans takes the span path only when all the vectors are contiguous
+  long spans = 0;
+  auto count = [&](const auto& out, const auto& in) {
+    if (std::is_same_v<std::decay_t<decltype(out)>, helib::PtrSpan<MyClass>>)
+      spans++;
+    for (long i = 0; i < lsize(out); i++)
+      out[i]->set(in[i]->get() + 1);
+  };
+  helib::withSpans(count, vs1, vv1);
+  EXPECT_EQ(spans, 1);
+  helib::withSpans(count, vs1, vs3);
+  EXPECT_EQ(spans, 1);
+  for (long i = 0; i < 3; i++)
+    EXPECT_EQ(v1[2 + i].get(), 1);
+}
+
 } // namespace
@@ -321,6 +321,56 @@ TEST_P(GTestTableLookup, lookupFunctionsCorrectly)
   }
 }
 
+TEST_P(GTestTableLookup, lookupOfManyTablesFunctionsCorrectly)
+{
+  // Build tables for a few functions, all indexed by the same bits
+  const std::vector<std::function<double(double)>> fs = {
+      [](double x) { return 1 / (x + 1.0); },
+      [](double x) { return x / 2; },
+      [](double x) { return 1 - 1 / (x + 2.0); }};
+  std::vector<std::vector<helib::zzX>> tables(fs.size());
+  for (std::size_t t = 0; t < fs.size(); t++)
+    helib::buildLookupTable(tables[t],
+                            fs[t],
+                            bitSize,
+                            /*scale_in=*/0,
+                            /*sign_in=*/0,
+                            outSize,
+                            /*scale_out=*/1 - outSize,
+                            /*sign_out=*/0,
+                            secretKey.getContext().getEA());
+
+  for (long count = 0; count < nTests; count++) {
+    long index = NTL::RandomBnd(1L << bitSize);
+    std::vector<helib::Ctxt> ei(bitSize, helib::Ctxt(secretKey));
+    encryptIndex(ei, index, secretKey); // encrypt the index
+
+    std::vector<helib::Ctxt> out;
+    helib::tableLookup(out, tables, helib::CtPtrs_vectorCt(ei));
+    ASSERT_EQ(out.size(), tables.size());
+
+    // The same products should also serve a single table
+    helib::IndexProducts products(helib::CtPtrs_vectorCt(ei));
+    helib::Ctxt single(secretKey);
+    helib::tableLookup(single, tables[0], products);
+
+    for (std::size_t t = 0; t < tables.size(); t++) {
+      NTL::ZZX poly;
+      secretKey.Decrypt(poly, out[t]);
+      helib::zzX poly2;
+      helib::convert(poly2, poly);
+      EXPECT_EQ(poly2, tables[t][index])
+          << "testLookup error: decrypted table " << t << " at " << index;
+    }
+    NTL::ZZX poly;
+    secretKey.Decrypt(poly, single);
+    helib::zzX poly2;
+    helib::convert(poly2, poly);
+    EXPECT_EQ(poly2, tables[0][index])
+        << "testLookup error: decrypted T[" << index << "]\n";
+  }
+}
+
 TEST_P(GTestTableLookup, writeinFunctionsCorrectly)
 {
   long tSize = 1L << bitSize; // table size
@@ -431,6 +431,154 @@ TEST_P(GTestThinBootstrapping, correctlyPerformsThinBootstrapping)
   EXPECT_EQ(val1, val2);
 }
 
+TEST_P(GTestThinBootstrapping, thinReCryptsAVectorOfCiphertexts)
+{
+  NTL::ZZX GG;
+  GG = context.getAlMod().getFactorsOverZZ()[0];
+  std::shared_ptr<helib::EncryptedArray> ea(
+      std::make_shared<helib::EncryptedArray>(context, GG));
+
+  helib::setupDebugGlobals(&secretKey, ea);
+
+  NTL::zz_p::init(p2r);
+  const long nctxts = 3;
+  std::vector<std::vector<NTL::ZZX>> vals(nctxts);
+  std::vector<helib::Ctxt> ctxts(nctxts + 1, helib::Ctxt(publicKey));
+  for (long j = 0; j < nctxts; j++) {
+    vals[j].resize(nslots);
+    for (long i = 0; i < nslots; i++)
+      vals[j][i] = NTL::conv<NTL::ZZX>(
+          NTL::conv<NTL::ZZ>(rep(NTL::random_zz_p())));
+    ea->encrypt(ctxts[j], publicKey, vals[j]);
+  }
+  // The last one is left empty, which is passed through as is
+
+  publicKey.thinReCrypt(ctxts);
+
+  for (long j = 0; j < nctxts; j++) {
+    std::vector<NTL::ZZX> decrypted;
+    ea->decrypt(ctxts[j], secretKey, decrypted);
+    EXPECT_EQ(vals[j], decrypted) << "ciphertext " << j;
+  }
+  EXPECT_TRUE(ctxts[nctxts].isEmpty());
+}
+
+TEST_P(GTestThinBootstrapping, bootstrapPolicyRecryptsOnlyWhatNeedsIt)
+{
+  NTL::ZZX GG;
+  GG = context.getAlMod().getFactorsOverZZ()[0];
+  std::shared_ptr<helib::EncryptedArray> ea(
+      std::make_shared<helib::EncryptedArray>(context, GG));
+
+  helib::setupDebugGlobals(&secretKey, ea);
+
+  NTL::zz_p::init(p2r);
+  const long nctxts = 3;
+  std::vector<std::vector<NTL::ZZX>> vals(nctxts);
+  std::vector<helib::Ctxt> ctxts(nctxts, helib::Ctxt(publicKey));
+  for (long j = 0; j < nctxts; j++) {
+    vals[j].resize(nslots);
+    for (long i = 0; i < nslots; i++)
+      vals[j][i] = NTL::conv<NTL::ZZX>(
+          NTL::conv<NTL::ZZ>(rep(NTL::random_zz_p())));
+    ea->encrypt(ctxts[j], publicKey, vals[j]);
+  }
+
+  // Only the first ciphertext is below the threshold
+  long full = ctxts[1].bitCapacity();
+  ctxts[0].dropToCapacity(full / 2);
+  ASSERT_LT(ctxts[0].bitCapacity(), full - 4);
+  helib::BootstrapPolicy policy(publicKey,
+                                helib::BootstrapPolicy::Method::THIN,
+                                /*minLevels=*/0,
+                                /*minBits=*/full - 2);
+  EXPECT_TRUE(policy.needsRecryption(ctxts[0]));
+  EXPECT_FALSE(policy.needsRecryption(ctxts[1]));
+  EXPECT_FALSE(policy.needsRecryption(helib::Ctxt(publicKey)));
+  EXPECT_FALSE(policy.apply(ctxts[2]));
+
+  policy.defer(ctxts[0]);
+  policy.defer(ctxts[1]);
+  policy.defer(ctxts[0]);
+  EXPECT_EQ(policy.pending(), 3);
+  EXPECT_EQ(policy.flush(), 1);
+  EXPECT_EQ(policy.pending(), 0);
+  EXPECT_EQ(policy.recrypted(), 1);
+
+  for (long j = 0; j < nctxts; j++) {
+    std::vector<NTL::ZZX> decrypted;
+    ea->decrypt(ctxts[j], secretKey, decrypted);
+    EXPECT_EQ(vals[j], decrypted) << "ciphertext " << j;
+  }
+}
+
+TEST_P(GTestThinBootstrapping, thinReCryptHonoursTheDigitExtractionChoice)
+{
+  NTL::ZZX GG;
+  GG = context.getAlMod().getFactorsOverZZ()[0];
+  std::shared_ptr<helib::EncryptedArray> ea(
+      std::make_shared<helib::EncryptedArray>(context, GG));
+
+  helib::setupDebugGlobals(&secretKey, ea);
+
+  NTL::zz_p::init(p2r);
+  std::vector<NTL::ZZX> val(nslots);
+  for (long i = 0; i < nslots; i++)
+    val[i] = NTL::conv<NTL::ZZX>(NTL::conv<NTL::ZZ>(rep(NTL::random_zz_p())));
+
+  for (helib::DigitExtraction method : {helib::DigitExtraction::LIFTING,
+                                        helib::DigitExtraction::DIGIT_RETAIN}) {
+    context.setDigitExtraction(method);
+    helib::Ctxt c(publicKey);
+    ea->encrypt(c, publicKey, val);
+    publicKey.thinReCrypt(c);
+
+    std::vector<NTL::ZZX> decrypted;
+    ea->decrypt(c, secretKey, decrypted);
+    EXPECT_EQ(val, decrypted) << "method " << static_cast<int>(method);
+  }
+  context.setDigitExtraction(helib::DigitExtraction::AUTO);
+}
+
+TEST_P(GTestThinBootstrapping, thinReCryptReportsItsStages)
+{
+  NTL::ZZX GG;
+  GG = context.getAlMod().getFactorsOverZZ()[0];
+  std::shared_ptr<helib::EncryptedArray> ea(
+      std::make_shared<helib::EncryptedArray>(context, GG));
+
+  std::vector<helib::RecryptStageReport> reports;
+  helib::setRecryptReporter(
+      [&reports](const helib::RecryptStageReport& report) {
+        reports.push_back(report);
+      });
+
+  std::vector<NTL::ZZX> val(nslots, NTL::ZZX(1));
+  helib::Ctxt c(publicKey);
+  ea->encrypt(c, publicKey, val);
+  publicKey.thinReCrypt(c);
+  helib::setRecryptReporter(nullptr);
+
+  const std::vector<std::string> stages = {"modDown",
+                                           "slotToCoeff",
+                                           "bootKeySwitch",
+                                           "coeffToSlot",
+                                           "extractDigitsThin"};
+  ASSERT_EQ(reports.size(), stages.size());
+  for (std::size_t i = 0; i < stages.size(); i++) {
+    EXPECT_EQ(reports[i].stage, stages[i]);
+    EXPECT_EQ(reports[i].ciphertexts, 1);
+    EXPECT_GE(reports[i].wallTime, 0);
+  }
+  EXPECT_EQ(reports[0].keySwitches, 0);
+  EXPECT_GE(reports[2].keySwitches, 1);
+  EXPECT_GT(reports[3].keySwitches, 0);
+  EXPECT_GT(reports[4].ntts, 0);
+  // Digit extraction consumes most of the capacity that recryption adds
+  EXPECT_GT(reports[2].capacityAfter, reports[2].capacityBefore);
+  EXPECT_LT(reports[4].capacityAfter, reports[4].capacityBefore);
+}
+
 INSTANTIATE_TEST_SUITE_P(typicalParameters,
                          GTestThinBootstrapping,
                          ::testing::Values(
@@ -325,6 +325,53 @@ TEST_P(GTestThinEvalMap, thinEvalMapIsCorrect)
   HELIB_NTIMER_STOP(ALL);
 }
 
+TEST_P(GTestThinEvalMap, thinEvalMapUpgradedAtFewPrimesIsCorrect)
+{
+  NTL::ZZX GG;
+  GG = context.getAlMod().getFactorsOverZZ()[0];
+  helib::EncryptedArray ea(context, GG);
+
+  NTL::zz_p::init(context.getAlMod().getPPowR());
+  std::vector<NTL::ZZX> val1(nslots);
+  for (long i = 0; i < nslots; i++)
+    val1[i] = NTL::conv<NTL::ZZX>(NTL::conv<NTL::ZZ>(rep(NTL::random_zz_p())));
+
+  helib::Ctxt ctxt(publicKey);
+  ea.encrypt(ctxt, publicKey, val1);
+  helib::Ctxt full(ctxt);
+
+  // The three lowest ciphertext primes, as thinReCrypt uses
+  long first = context.getCtxtPrimes().first();
+  long last = std::min(context.getCtxtPrimes().last(), first + 2);
+  helib::IndexSet low(first, last);
+  ctxt.bringToSet(low);
+
+  helib::ThinEvalMap map(ea,
+                         /*minimal=*/false,
+                         mvec,
+                         /*invert=*/false,
+                         /*build_cache=*/false);
+  helib::ThinEvalMap imap(ea,
+                          /*minimal=*/false,
+                          mvec,
+                          /*invert=*/true,
+                          /*build_cache=*/false);
+  map.upgrade(low | context.getSpecialPrimes());
+  imap.upgrade(low | context.getSpecialPrimes());
+
+  map.apply(ctxt);
+  imap.apply(ctxt);
+  std::vector<NTL::ZZX> val2;
+  ea.decrypt(ctxt, secretKey, val2);
+  EXPECT_EQ(val1, val2);
+
+  // A ciphertext with more primes than the constants still comes out right
+  map.apply(full);
+  imap.apply(full);
+  ea.decrypt(full, secretKey, val2);
+  EXPECT_EQ(val1, val2);
+}
+
 // clang-format off
 INSTANTIATE_TEST_SUITE_P(variousParameters, GTestThinEvalMap, ::testing::Values(
     //SLOW
@@ -289,6 +289,27 @@ TEST_P(TestBGV, rawMultiplicationOfCiphertextsWorks)
   EXPECT_FALSE(c1.inCanonicalForm());
 }
 
+TEST_P(TestBGV, rawMultiplicationOfNonCanonicalCiphertextsWorks)
+{
+  helib::PtxtArray p1(ea), p2(ea), p3(ea);
+  p1.random();
+  p2.random();
+
+  helib::Ctxt c1(publicKey), c2(publicKey);
+  p1.encrypt(c1);
+  p2.encrypt(c2);
+
+  // A square, then a product of three parts by two
+  c1.multLowLvl(c1);
+  c1.multLowLvl(c2);
+  p1 *= p1;
+  p1 *= p2;
+
+  p3.decrypt(c1, secretKey);
+
+  EXPECT_EQ(p1, p3);
+}
+
 TEST_P(TestBGV, highLevelMultiplicationOfCiphertextsWorks)
 {
   helib::PtxtArray p1(ea), p2(ea), p3(ea);
@@ -10,11 +10,17 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 #include <cmath> // isinf
+#include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <sstream>
+#include <utility> // swap
 #include <helib/helib.h>
 #include <helib/debugging.h>
+#include <helib/keyRegistry.h>
+#include <helib/resultCache.h>
 #include <binio.h>
+#include <MappedKeys.h>
 
 #include "test_common.h"
 #include "gtest/gtest.h"
@@ -198,6 +204,24 @@ TEST(TestBinIO, headerSerializationDeserialization)
   EXPECT_TRUE(!memcmp(&header, &DeserialisedHeader, sizeof(header)));
 }
 
+TEST(TestBinIO, packedVectorsRoundTrip)
+{
+  for (long nbits : {1l, 17l, 63l}) {
+    NTL::vec_long vl;
+    vl.SetLength(37);
+    for (long i = 0; i < vl.length(); i++)
+      vl[i] = NTL::RandomBits_long(nbits);
+
+    std::stringstream ss;
+    helib::write_packed_vec_long(ss, vl, nbits);
+    EXPECT_EQ(ss.str().size(), 8u + (37 * nbits + 7) / 8);
+
+    NTL::vec_long read;
+    helib::read_packed_vec_long(ss, read, nbits);
+    EXPECT_EQ(read, vl);
+  }
+}
+
 TEST_P(TestBinIO_BGV, singleFunctionSerialization)
 {
   std::stringstream str;
@@ -266,6 +290,71 @@ TEST_P(TestBinIO_BGV, readContextPtrFromDeserializeCorrectly)
   EXPECT_EQ(context, *deserialized_contextp);
 }
 
+TEST_P(TestBinIO_BGV, contextSnapshotRestoresTheSlotFactorization)
+{
+  std::stringstream str;
+  context.writeSnapshotTo(str);
+
+  helib::Context restored = helib::Context::readSnapshotFrom(str);
+  EXPECT_EQ(context, restored);
+  EXPECT_EQ(restored.getAlMod().getFactorsOverZZ(),
+            context.getAlMod().getFactorsOverZZ());
+
+  // Slots of the restored context work as usual
+  helib::SecKey sk(restored);
+  sk.GenSecKey();
+  addSome1DMatrices(sk);
+  helib::PtxtArray ptxt(restored), expected(restored), decrypted(restored);
+  ptxt.random();
+  helib::Ctxt ctxt(sk);
+  ptxt.encrypt(ctxt);
+  ctxt.multiplyBy(ctxt);
+  restored.getEA().rotate(ctxt, 1);
+
+  expected = ptxt;
+  expected *= ptxt;
+  rotate(expected, 1);
+  decrypted.decrypt(ctxt, sk);
+  EXPECT_EQ(decrypted, expected);
+}
+
+TEST_P(TestBinIO_BGV, contextSnapshotRestoresThePAlgebraTables)
+{
+  std::stringstream str;
+  context.writeSnapshotTo(str);
+  helib::Context restored = helib::Context::readSnapshotFrom(str);
+
+  const helib::PAlgebra& expected = context.getZMStar();
+  const helib::PAlgebra& actual = restored.getZMStar();
+  EXPECT_EQ(actual.getPolyNormBnd(), expected.getPolyNormBnd());
+  for (long i = 0; i < expected.getNSlots(); i++) {
+    EXPECT_EQ(actual.ith_rep(i), expected.ith_rep(i));
+    EXPECT_EQ(actual.indexOfRep(expected.ith_rep(i)), i);
+  }
+  for (long t = 0; t < expected.getM(); t++)
+    EXPECT_EQ(actual.indexInZmstar(t), expected.indexInZmstar(t));
+
+  // A representative out of range is rejected
+  helib::PAlgebraTables tables = expected.getTables();
+  tables.T.back() = expected.getM();
+  EXPECT_THROW(helib::PAlgebra(expected.getM(),
+                               expected.getP(),
+                               {},
+                               {},
+                               &tables),
+               helib::IOError);
+
+  // So are representatives that are valid but not those of the generators
+  tables = expected.getTables();
+  std::swap(tables.T[0], tables.T[1]);
+  EXPECT_THROW(helib::PAlgebra(expected.getM(),
+                               expected.getP(),
+                               {},
+                               {},
+                               &tables),
+               helib::IOError);
+}
+
 TEST(TestBinIO_BGV, readContextFromDeserializeCorrectlyBootstrappable)
 {
   // clang-format off
@@ -291,6 +380,36 @@ TEST(TestBinIO_BGV, readContextFromDeserializeCorrectlyBootstrappable)
   EXPECT_TRUE(deserialized_context.isBootstrappable());
 }
 
+TEST(TestBinIO_BGV, contextSnapshotRestoresTheRecryptionMaps)
+{
+  // clang-format off
+  helib::Context context = helib::ContextBuilder<helib::BGV>()
+      .m(1271)
+      .p(2)
+      .r(1)
+      .gens({1026, 249})
+      .ords({30, -2})
+      .bits(30)
+      .bootstrappable(true)
+      .buildCache(true)
+      .mvec(helib::convert<NTL::Vec<long>>(std::vector<long>({31, 41})))
+      .build();
+  // clang-format on
+
+  std::stringstream str;
+  context.writeSnapshotTo(str);
+
+  helib::Context restored = helib::Context::readSnapshotFrom(str);
+  EXPECT_EQ(context, restored);
+  ASSERT_TRUE(restored.isBootstrappable());
+
+  // The maps read back, upgraded constants included, are those written
+  std::stringstream written, reread;
+  context.getRcData().writeMapsTo(written);
+  restored.getRcData().writeMapsTo(reread);
+  EXPECT_EQ(written.str(), reread.str());
+}
+
 TEST_P(TestBinIO_BGV, canPerformOperationWithDeserializedContext)
 {
   std::stringstream ss;
@@ -412,6 +531,79 @@ TEST_P(TestBinIO_BGV, readKeysFromDeserializeCorrectly)
   EXPECT_EQ(secretKey, deserialized_sk);
 }
 
+TEST_P(TestBinIO_BGV, chunkedKeysRoundTripInParallel)
+{
+  long nthreads = NTL::AvailableThreads();
+  NTL::SetNumThreads(4);
+
+  std::stringstream str;
+  publicKey.writeChunkedTo(str);
+  helib::PubKey deserialized_pk = helib::PubKey::readChunkedFrom(str, context);
+  EXPECT_EQ(publicKey, deserialized_pk);
+
+  str.str("");
+  str.clear();
+  secretKey.writeChunkedTo(str);
+  std::string bytes = str.str();
+  helib::SecKey deserialized_sk = helib::SecKey::readChunkedFrom(str, context);
+  EXPECT_EQ(secretKey, deserialized_sk);
+  NTL::SetNumThreads(nthreads);
+
+  // The matrices still switch keys after the trip
+  helib::PtxtArray ptxt(context);
+  ptxt.random();
+  helib::Ctxt ctxt(deserialized_pk);
+  ptxt.encrypt(ctxt);
+  ctxt.multiplyBy(ctxt);
+  ptxt *= ptxt;
+  helib::PtxtArray decrypted(context);
+  decrypted.decrypt(ctxt, deserialized_sk);
+  EXPECT_EQ(decrypted, ptxt);
+
+  // The matrices make up most of the key, so a flipped byte in the middle
+  // lands in one of their chunks
+  bytes[bytes.size() / 2] ^= 1;
+  std::stringstream corrupt(bytes);
+  EXPECT_THROW(helib::SecKey::readChunkedFrom(corrupt, context),
+               helib::IOError);
+}
+
+TEST_P(TestBinIO_BGV, packedPublicKeysAreSmallerAndReadBackEqual)
+{
+  const long nthreads = NTL::AvailableThreads();
+  NTL::SetNumThreads(4);
+
+  std::stringstream chunked, packed;
+  publicKey.writeChunkedTo(chunked);
+  publicKey.writePackedTo(packed);
+  EXPECT_LT(packed.str().size(), chunked.str().size());
+  std::string bytes = packed.str();
+
+  helib::PubKey deserialized = helib::PubKey::readPackedFrom(packed, context);
+  NTL::SetNumThreads(nthreads);
+  EXPECT_EQ(publicKey, deserialized);
+
+  // The matrices still switch keys after the trip
+  helib::PtxtArray ptxt(context);
+  ptxt.random();
+  helib::Ctxt ctxt(deserialized);
+  ptxt.encrypt(ctxt);
+  ctxt.multiplyBy(ctxt);
+  ptxt *= ptxt;
+  helib::PtxtArray decrypted(context);
+  decrypted.decrypt(ctxt, secretKey);
+  EXPECT_EQ(decrypted, ptxt);
+
+  bytes[bytes.size() / 2] ^= 1;
+  std::stringstream corrupt(bytes);
+  EXPECT_THROW(helib::PubKey::readPackedFrom(corrupt, context),
+               helib::IOError);
+
+  // Neither format reads the other
+  std::stringstream other(chunked.str());
+  EXPECT_THROW(helib::PubKey::readPackedFrom(other, context), helib::IOError);
+}
+
 TEST_P(TestBinIO_BGV, readKeyPtrsFromDeserializeCorrectly)
 {
   std::stringstream str;
@@ -434,6 +626,287 @@ TEST_P(TestBinIO_BGV, readKeyPtrsFromDeserializeCorrectly)
   EXPECT_EQ(secretKey, *deserialized_skp);
 }
 
+TEST_P(TestBinIO_BGV, mappedPublicKeyIsUsedInPlace)
+{
+  const std::string path = "TestBinIO_mapped_pubkey.bin";
+  {
+    std::ofstream file(path, std::ios::binary);
+    publicKey.writeMappableTo(file);
+  }
+
+  {
+    helib::PubKey mapped = helib::PubKey::readMapped(path, context);
+    for (const helib::KeySwitch& W : mapped.keySWlist())
+      EXPECT_TRUE(W.isMapped());
+    EXPECT_EQ(mapped, publicKey);
+
+    helib::PtxtArray ptxt(ea), expected(ea), decrypted(ea);
+    ptxt.random();
+    helib::Ctxt ctxt(mapped);
+    ptxt.encrypt(ctxt);
+    ctxt.multiplyBy(ctxt);
+    ea.rotate(ctxt, 1);
+
+    expected = ptxt;
+    expected *= ptxt;
+    rotate(expected, 1);
+    decrypted.decrypt(ctxt, secretKey);
+    EXPECT_EQ(decrypted, expected);
+
+    // Written back out in the usual format, nothing is lost
+    std::stringstream fromMapped, fromOriginal;
+    mapped.writeTo(fromMapped);
+    publicKey.writeTo(fromOriginal);
+    EXPECT_EQ(fromMapped.str(), fromOriginal.str());
+  }
+
+  std::remove(path.c_str());
+}
+
+TEST_P(TestBinIO_BGV, keyRegistryLoadsSharesAndEvictsTenants)
+{
+  const std::string contextPath = "TestBinIO_registry_context.bin";
+  const std::string keyPath = "TestBinIO_registry_pubkey.bin";
+  {
+    std::ofstream file(contextPath, std::ios::binary);
+    context.writeSnapshotTo(file);
+  }
+  {
+    std::ofstream file(keyPath, std::ios::binary);
+    publicKey.writeMappableTo(file);
+  }
+
+  {
+    helib::KeyRegistry registry(1L << 40);
+    registry.add("a", helib::KeySource::fromFiles(contextPath, keyPath));
+    helib::KeySource source = helib::KeySource::fromFiles(contextPath, keyPath);
+    source.contextFingerprint = context.fingerprint();
+    source.keyFingerprint = publicKey.fingerprint();
+    registry.add("b", source);
+    source.keyFingerprint++;
+    registry.add("c", source);
+    EXPECT_THROW(registry.add("a", source), helib::LogicError);
+    EXPECT_THROW(registry.get("d"), helib::LogicError);
+
+    // The fingerprints do not depend on the object, nor on the format read
+    auto a = registry.get("a");
+    EXPECT_EQ(*a->context, context);
+    EXPECT_EQ(a->contextFingerprint, context.fingerprint());
+    EXPECT_EQ(a->publicKey->fingerprint(), publicKey.fingerprint());
+    EXPECT_EQ(registry.get("a"), a);
+
+    // b has the same context as a, and shares it
+    auto b = registry.get("b");
+    EXPECT_EQ(b->context, a->context);
+    EXPECT_NE(b->publicKey, a->publicKey);
+    EXPECT_THROW(registry.get("c"), helib::IOError);
+    EXPECT_FALSE(registry.isLoaded("c"));
+
+    helib::KeyRegistryStats stats = registry.stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.loads, 3);
+    EXPECT_EQ(stats.failedLoads, 1);
+    EXPECT_EQ(stats.sharedContexts, 2);
+    EXPECT_EQ(registry.numLoaded(), 2);
+    EXPECT_GT(registry.residentBytes(), 0);
+
+    // With no budget only the pinned tenant stays, and dropped entries
+    // remain usable by their holders
+    registry.pin("a");
+    registry.setBudget(0);
+    EXPECT_TRUE(registry.isLoaded("a"));
+    EXPECT_FALSE(registry.isLoaded("b"));
+    EXPECT_EQ(b->publicKey->fingerprint(), publicKey.fingerprint());
+    registry.unpin("a");
+    EXPECT_FALSE(registry.isLoaded("a"));
+    EXPECT_THROW(registry.unpin("a"), helib::LogicError);
+    EXPECT_EQ(registry.stats().evictions, 2);
+
+    // Loading b again finds the context still held through a
+    auto again = registry.get("b");
+    EXPECT_EQ(again->context, a->context);
+    registry.remove("b");
+    EXPECT_FALSE(registry.contains("b"));
+  }
+
+  std::remove(contextPath.c_str());
+  std::remove(keyPath.c_str());
+}
+
+TEST_P(TestBinIO_BGV, resultCacheMemoizesOperationsInMemoryAndOnDisk)
+{
+  helib::Ptxt<helib::BGV> ptxt(context);
+  ptxt.random();
+  helib::Ctxt stored(publicKey);
+  publicKey.Encrypt(stored, ptxt);
+  helib::Ptxt<helib::BGV> expected = ptxt;
+  expected *= 3L;
+  long runs = 0;
+  auto triple = [&runs](helib::Ctxt& ctxt) {
+    runs++;
+    ctxt.multByConstant(NTL::ZZX(3));
+  };
+  auto decrypt = [this](const helib::Ctxt& ctxt) {
+    helib::Ptxt<helib::BGV> decrypted(context);
+    secretKey.Decrypt(decrypted, ctxt);
+    return decrypted;
+  };
+
+  const std::string id = helib::ResultCache::contentId(stored);
+  EXPECT_EQ(helib::ResultCache::contentId(helib::Ctxt(stored)), id);
+  EXPECT_EQ(id.size(), 64u);
+  {
+    helib::ResultCache cache(publicKey, 1L << 30, ".");
+    helib::Ctxt ctxt = stored;
+    EXPECT_FALSE(cache.apply(ctxt, "times", "3", triple));
+    helib::Ctxt again = stored;
+    EXPECT_TRUE(cache.apply(again, "times", "3", triple));
+    EXPECT_EQ(runs, 1);
+    EXPECT_EQ(decrypt(again), expected);
+
+    // Other parameters miss, and the input is named by its content
+    helib::Ctxt other = stored;
+    EXPECT_FALSE(cache.apply(other, "times", "4", triple));
+    EXPECT_EQ(runs, 2);
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_GT(cache.residentBytes(), 0);
+    helib::Ctxt byId(publicKey);
+    EXPECT_TRUE(cache.lookup(byId, id, "times", "3"));
+    EXPECT_EQ(decrypt(byId), expected);
+
+    // With no budget, the results are read back from the directory
+    cache.setBudget(0);
+    EXPECT_EQ(cache.size(), 0);
+    helib::Ctxt fromDisk = stored;
+    EXPECT_TRUE(cache.apply(fromDisk, "times", "3", triple));
+    EXPECT_EQ(runs, 2);
+    EXPECT_EQ(decrypt(fromDisk), expected);
+
+    helib::ResultCacheStats stats = cache.stats();
+    EXPECT_EQ(stats.hits, 2);
+    EXPECT_EQ(stats.diskHits, 1);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.stores, 2);
+    EXPECT_EQ(stats.evictions, 3);
+
+    std::remove(cache.path(id, "times", "3").c_str());
+    std::remove(cache.path(id, "times", "4").c_str());
+  }
+}
+
+TEST_P(TestBinIO_BGV, sharedPublicKeyOutlivesItsName)
+{
+  const std::string name = "/TestBinIO_shared_pubkey";
+  publicKey.writeShared(name);
+  EXPECT_THROW(publicKey.writeShared(name), helib::IOError);
+
+  // A worker rebuilds the context from a snapshot and attaches to the keys
+  std::stringstream snapshot;
+  context.writeSnapshotTo(snapshot);
+  helib::Context workerContext = helib::Context::readSnapshotFrom(snapshot);
+  helib::PubKey shared = helib::PubKey::readShared(name, workerContext);
+  helib::PubKey::removeShared(name);
+  EXPECT_THROW(helib::PubKey::readShared(name, workerContext),
+               helib::IOError);
+
+  for (const helib::KeySwitch& W : shared.keySWlist())
+    EXPECT_TRUE(W.isMapped());
+
+  helib::PtxtArray ptxt(ea), expected(ea), decrypted(ea);
+  ptxt.random();
+  helib::Ctxt ctxt(shared);
+  ptxt.encrypt(ctxt);
+  ctxt.multiplyBy(ctxt);
+  workerContext.getView().rotate(ctxt, 1);
+
+  expected = ptxt;
+  expected *= ptxt;
+  rotate(expected, 1);
+  std::stringstream ctxtStr;
+  ctxt.writeTo(ctxtStr);
+  helib::Ctxt result = helib::Ctxt::readFrom(ctxtStr, publicKey);
+  decrypted.decrypt(result, secretKey);
+  EXPECT_EQ(decrypted, expected);
+}
+
+TEST_P(TestBinIO_BGV, sharedPublicKeyIsOnlyReadOnceComplete)
+{
+  const std::string name = "/TestBinIO_partial_pubkey";
+  std::stringstream key;
+  publicKey.writeMappableTo(key);
+  const std::string bytes = key.str();
+
+  // Readers attaching while the object is being written are turned away
+  bool rejected = false;
+  helib::MappedFile::createShared(name, [&](std::ostream& str) {
+    str.write(bytes.data(), bytes.size() / 2);
+    str.flush();
+    try {
+      helib::PubKey::readShared(name, context);
+    } catch (const helib::IOError&) {
+      rejected = true;
+    }
+    str.write(bytes.data() + bytes.size() / 2,
+              bytes.size() - bytes.size() / 2);
+  });
+  EXPECT_TRUE(rejected);
+  helib::PubKey shared = helib::PubKey::readShared(name, context);
+  helib::PubKey::removeShared(name);
+  EXPECT_EQ(shared.keySWlist().size(), publicKey.keySWlist().size());
+  for (const helib::KeySwitch& W : shared.keySWlist())
+    EXPECT_TRUE(W.isMapped());
+
+  // A writer that fails leaves nothing behind
+  EXPECT_THROW(helib::MappedFile::createShared(
+                   name,
+                   [](std::ostream&) { throw helib::IOError("failed"); }),
+               helib::IOError);
+  EXPECT_THROW(helib::PubKey::readShared(name, context), helib::IOError);
+}
+
+TEST_P(TestBinIO_BGV, lazyPublicKeyReadsMatricesOnUse)
+{
+  const std::string path = "TestBinIO_lazy_pubkey.bin";
+  {
+    std::ofstream file(path, std::ios::binary);
+    publicKey.writeTo(file);
+  }
+
+  {
+    const long maxResident = 1;
+    helib::PubKey lazy = helib::PubKey::readLazy(path, context, maxResident);
+    auto countResident = [&lazy]() {
+      long count = 0;
+      for (const helib::KeySwitch& W : lazy.keySWlist()) {
+        EXPECT_TRUE(W.isLazy());
+        count += W.isResident();
+      }
+      return count;
+    };
+    EXPECT_EQ(countResident(), 0);
+
+    helib::PtxtArray ptxt(ea), expected(ea), decrypted(ea);
+    ptxt.random();
+    helib::Ctxt ctxt(lazy);
+    ptxt.encrypt(ctxt);
+    ctxt.multiplyBy(ctxt);
+    ea.rotate(ctxt, 1);
+    EXPECT_GT(countResident(), 0);
+    EXPECT_LE(countResident(), maxResident);
+
+    expected = ptxt;
+    expected *= ptxt;
+    rotate(expected, 1);
+    decrypted.decrypt(ctxt, secretKey);
+    EXPECT_EQ(decrypted, expected);
+
+    EXPECT_EQ(lazy, publicKey);
+    EXPECT_LE(countResident(), maxResident);
+  }
+
+  std::remove(path.c_str());
+}
+
 TEST_P(TestBinIO_BGV, canEncryptWithDeserializedPublicKey)
 {
   std::stringstream ss;
@@ -600,6 +1073,62 @@ TEST_P(TestBinIO_BGV, readCiphertextAndReadCiphertextInPlaceAreEquivalent)
   EXPECT_EQ(inplace_ctxt, deserialized_ctxt);
 }
 
+TEST_P(TestBinIO_BGV, seededCiphertextIsExpandedWhenRead)
+{
+  helib::PtxtArray ptxt(ea), decrypted(ea);
+  ptxt.random();
+  helib::Ctxt ctxt(secretKey);
+  ptxt.encrypt(ctxt);
+  EXPECT_TRUE(ctxt.hasSeededForm());
+
+  std::stringstream full, seeded;
+  ctxt.writeTo(full);
+  ctxt.writeSeededTo(seeded);
+  EXPECT_LT(3 * seeded.str().size(), 2 * full.str().size());
+
+  helib::Ctxt deserialized_ctxt = helib::Ctxt::readFrom(seeded, publicKey);
+  EXPECT_TRUE(ctxt.equalsTo(deserialized_ctxt, /*comparePkeys=*/false));
+  decrypted.decrypt(deserialized_ctxt, secretKey);
+  EXPECT_EQ(decrypted, ptxt);
+
+  // Once the ciphertext is operated on, only the full form is left
+  ctxt *= 2l;
+  EXPECT_FALSE(ctxt.hasSeededForm());
+  EXPECT_THROW(ctxt.writeSeededTo(seeded), helib::LogicError);
+
+  helib::Ctxt pkCtxt(publicKey);
+  ptxt.encrypt(pkCtxt);
+  EXPECT_FALSE(pkCtxt.hasSeededForm());
+}
+
+TEST_P(TestBinIO_BGV, compactCiphertextIsSmallerAndDecrypts)
+{
+  helib::PtxtArray ptxt(ea), decrypted(ea);
+  ptxt.random();
+  helib::Ctxt ctxt(publicKey);
+  ptxt.encrypt(ctxt);
+
+  std::stringstream full, compact;
+  ctxt.writeTo(full);
+  ctxt.writeCompact(compact);
+  EXPECT_LT(compact.str().size(), full.str().size());
+
+  helib::Ctxt deserialized_ctxt = helib::Ctxt::readFrom(compact, publicKey);
+  EXPECT_TRUE(deserialized_ctxt.getPrimeSet() <= ctxt.getPrimeSet());
+  decrypted.decrypt(deserialized_ctxt, secretKey);
+  EXPECT_EQ(decrypted, ptxt);
+
+  // Asking for more capacity keeps more of the primes
+  std::stringstream roomy;
+  ctxt.writeCompact(roomy, /*targetBits=*/20);
+  helib::Ctxt roomy_ctxt = helib::Ctxt::readFrom(roomy, publicKey);
+  if (ctxt.capacity() > 22)
+    EXPECT_GE(roomy_ctxt.capacity(), 20.0);
+  EXPECT_GE(roomy_ctxt.capacity(), deserialized_ctxt.capacity());
+  decrypted.decrypt(roomy_ctxt, secretKey);
+  EXPECT_EQ(decrypted, ptxt);
+}
+
 TEST_P(TestBinIO_BGV, canPerformOperationsOnDeserializedCiphertext)
 {
   std::stringstream ss1, ss2;
@@ -15,7 +15,10 @@
 
 #include <helib/norms.h>
 #include <helib/helib.h>
+#include <helib/polyEval.h>
+#include <helib/ckksCompare.h>
 #include <helib/debugging.h>
+#include <helib/schemeSwitch.h>
 
 #include "gtest/gtest.h"
 #include "test_common.h"
@@ -304,6 +307,65 @@ TEST_P(TestCKKS, multiplyingPolyConstantToCiphertextWorks)
   EXPECT_EQ(pm, c1.getPtxtMag());
 }
 
+TEST_P(TestCKKS, multiplyingFatPolyConstantToCiphertextWorks)
+{
+  helib::Ctxt c1(publicKey);
+  std::vector<std::complex<double>> vd1, vd2, vd3;
+  helib::FatEncodedPtxt feptxt; // Encoding held as a DoubleCRT
+  NTL::xdouble rf, pm;
+
+  ea.random(vd1);
+  ea.random(vd2);
+  ea.encrypt(c1, publicKey, vd1);
+  rf = c1.getRatFactor();
+  pm = c1.getPtxtMag();
+  helib::PtxtArray pa(context, vd2);
+  // Encode directly modulo the primes of the ciphertext
+  pa.encode(feptxt, c1.getPrimeSet(), /*mag*/ 1.0);
+  c1 *= feptxt;
+  ea.decrypt(c1, secretKey, vd3);
+
+  mul(vd1, vd2);
+  rf *= ea.encodeScalingFactor();
+
+  EXPECT_TRUE(cx_equals(vd3, vd1, epsilon))
+      << "  max(vd1)=" << helib::largestCoeff(vd1)
+      << ", max(vd3)=" << helib::largestCoeff(vd3)
+      << ", maxDiff=" << calcMaxDiff(vd1, vd3) << std::endl
+      << std::endl;
+  EXPECT_EQ(rf, c1.getRatFactor());
+  EXPECT_EQ(pm, c1.getPtxtMag());
+}
+
+TEST_P(TestCKKS, singlePrecisionSlotsRoundTrip)
+{
+  std::vector<std::complex<double>> vd1;
+  ea.random(vd1);
+  std::vector<helib::cx_float> vf1(vd1.begin(), vd1.end()), vf2;
+
+  helib::EncodedPtxt eptxt;
+  ea.encode(eptxt, vf1, /*mag*/ 1.0);
+  helib::Ctxt c1(publicKey);
+  publicKey.Encrypt(c1, eptxt);
+  ea.decrypt(c1, secretKey, vf2);
+
+  // Both sides are rounded to float
+  double tolerance = std::max(epsilon, 1e-5);
+  std::vector<std::complex<double>> expected(vf1.begin(), vf1.end());
+  std::vector<std::complex<double>> actual(vf2.begin(), vf2.end());
+  EXPECT_TRUE(cx_equals(actual, expected, tolerance))
+      << "  maxDiff=" << calcMaxDiff(actual, expected) << std::endl;
+
+  // Through a PtxtArray
+  helib::PtxtArray pa(context, vf1);
+  pa.encrypt(c1);
+  pa.decryptComplex(c1, secretKey);
+  pa.store(vf2);
+  actual.assign(vf2.begin(), vf2.end());
+  EXPECT_TRUE(cx_equals(actual, expected, tolerance))
+      << "  maxDiff=" << calcMaxDiff(actual, expected) << std::endl;
+}
+
 TEST_P(TestCKKS, addingDoubleToCiphertextWorks)
 {
   helib::Ctxt c1(publicKey);
@@ -389,6 +451,33 @@ TEST_P(TestCKKS, gettingTheComplexConjugateWorks)
   EXPECT_EQ(pm, c1.getPtxtMag());
 }
 
+TEST_P(TestCKKS, aPairOfRealVectorsCanBeSplitAndJoined)
+{
+  helib::Ctxt pair(publicKey), re(publicKey), im(publicKey);
+  std::vector<double> vre, vim, vre2, vim2;
+
+  ea.random(vre);
+  ea.random(vim);
+  ea.encryptPair(pair, publicKey, vre, vim);
+  ea.splitPair(re, im, pair);
+  ea.decrypt(re, secretKey, vre2);
+  ea.decrypt(im, secretKey, vim2);
+
+  for (long i = 0; i < ea.size(); ++i) {
+    EXPECT_NEAR(vre2[i], vre[i], epsilon) << "i = " << i;
+    EXPECT_NEAR(vim2[i], vim[i], epsilon) << "i = " << i;
+  }
+
+  re += re;
+  ea.joinPair(pair, re, im);
+  ea.decryptPair(pair, secretKey, vre2, vim2);
+
+  for (long i = 0; i < ea.size(); ++i) {
+    EXPECT_NEAR(vre2[i], 2 * vre[i], 2 * epsilon) << "i = " << i;
+    EXPECT_NEAR(vim2[i], vim[i], 2 * epsilon) << "i = " << i;
+  }
+}
+
 TEST_P(TestCKKS, rotatingCiphertextWorks)
 {
   helib::Ctxt c1(publicKey);
@@ -414,6 +503,28 @@ TEST_P(TestCKKS, rotatingCiphertextWorks)
   EXPECT_EQ(pm, c1.getPtxtMag());
 }
 
+TEST_P(TestCKKS, rotatingByManyAmountsAtOnceWorks)
+{
+  helib::Ctxt c1(publicKey);
+  std::vector<std::complex<double>> vd1, vd2;
+  const std::vector<long> amounts = {0, 1, -1, 3, 5, ea.size() + 2};
+
+  ea.random(vd1);
+  ea.encrypt(c1, publicKey, vd1);
+  std::vector<helib::Ctxt> rotated;
+  ea.rotateMany(rotated, c1, amounts);
+
+  ASSERT_EQ(rotated.size(), amounts.size());
+  for (std::size_t j = 0; j < amounts.size(); ++j) {
+    std::vector<std::complex<double>> expected = vd1;
+    rotate(expected, amounts[j]);
+    ea.decrypt(rotated[j], secretKey, vd2);
+    EXPECT_TRUE(cx_equals(vd2, expected, epsilon))
+        << "  amount=" << amounts[j]
+        << ", maxDiff=" << calcMaxDiff(expected, vd2) << std::endl;
+  }
+}
+
 TEST_P(TestCKKS, addingCiphertextsWorks)
 {
   helib::Ctxt c1(publicKey), c2(publicKey);
@@ -531,6 +642,86 @@ TEST_P(TestCKKS, highLevelMultiplicationOfCiphertextsWorks)
   EXPECT_TRUE(c1.inCanonicalForm());
 }
 
+TEST_P(TestCKKS, addingProductsAtTheSameScaleKeepsTheirPrimeSet)
+{
+  helib::Ctxt c1(publicKey), c2(publicKey);
+  std::vector<std::complex<double>> vd1, vd2, vd3;
+
+  ea.random(vd1);
+  ea.random(vd2);
+  ea.encrypt(c1, publicKey, vd1);
+  ea.encrypt(c2, publicKey, vd2);
+  helib::Ctxt prod1(c1), prod2(c1);
+  prod1.multiplyBy(c2);
+  prod2.multiplyBy(c2);
+  helib::IndexSet primes = prod1.getPrimeSet();
+  prod1 += prod2;
+  ea.decrypt(prod1, secretKey, vd3);
+
+  mul(vd1, vd2);
+  mul(vd1, 2.0);
+
+  EXPECT_EQ(prod1.getPrimeSet(), primes);
+  EXPECT_TRUE(cx_equals(vd3, vd1, epsilon))
+      << "  max(vd1)=" << helib::largestCoeff(vd1)
+      << ", max(vd3)=" << helib::largestCoeff(vd3)
+      << ", maxDiff=" << calcMaxDiff(vd1, vd3) << std::endl
+      << std::endl;
+}
+
+TEST_P(TestCKKS, rescalingAProductKeepsItsValue)
+{
+  helib::Ctxt c1(publicKey), c2(publicKey);
+  std::vector<std::complex<double>> vd1, vd2, vd3;
+
+  ea.random(vd1);
+  ea.random(vd2);
+  ea.encrypt(c1, publicKey, vd1);
+  ea.encrypt(c2, publicKey, vd2);
+  c1.multiplyBy(c2);
+  helib::IndexSet primes = c1.getPrimeSet();
+  c1.rescale();
+  ea.decrypt(c1, secretKey, vd3);
+
+  mul(vd1, vd2);
+
+  EXPECT_TRUE(c1.getPrimeSet() <= primes);
+  EXPECT_TRUE(cx_equals(vd3, vd1, epsilon))
+      << "  max(vd1)=" << helib::largestCoeff(vd1)
+      << ", max(vd3)=" << helib::largestCoeff(vd3)
+      << ", maxDiff=" << calcMaxDiff(vd1, vd3) << std::endl
+      << std::endl;
+}
+
+TEST_P(TestCKKS, rawDecryptionMatchesTheBigIntegerReconstruction)
+{
+  helib::Ctxt c1(publicKey), c2(publicKey);
+  std::vector<std::complex<double>> vd1, vd2;
+  ea.random(vd1);
+  ea.random(vd2);
+  ea.encrypt(c1, publicKey, vd1);
+  ea.encrypt(c2, publicKey, vd2);
+
+  // A fresh ciphertext, and one on fewer primes after a rescale
+  helib::Ctxt c3 = c1;
+  c3.multiplyBy(c2);
+  c3.rescale();
+  for (const helib::Ctxt* c : {&c1, &c3}) {
+    std::vector<std::complex<double>> decrypted;
+    ea.rawDecrypt(*c, secretKey, decrypted);
+
+    NTL::ZZX pp;
+    secretKey.Decrypt(pp, *c);
+    std::vector<std::complex<double>> expected;
+    helib::CKKS_canonicalEmbedding(expected, pp, ea.getPAlgebra());
+    mul(expected, 1 / NTL::to_double(c->getRatFactor()));
+
+    EXPECT_TRUE(cx_equals(decrypted, expected, c->errorBound()))
+        << "  maxDiff=" << calcMaxDiff(decrypted, expected)
+        << ", errorBound=" << c->errorBound() << std::endl;
+  }
+}
+
 TEST_P(TestCKKS, squaringCiphertextWorks)
 {
   helib::Ctxt ctxt(publicKey);
@@ -618,6 +809,208 @@ TEST_P(TestCKKS, multiplyBySmallNegativeConstantFollowedByOperationWorks)
       << std::endl;
 }
 
+TEST_P(TestCKKS, recryptingWithoutBootstrappingDataThrows)
+{
+  helib::Ctxt c1(publicKey);
+  std::vector<std::complex<double>> vd1;
+
+  ea.random(vd1);
+  ea.encrypt(c1, publicKey, vd1);
+  EXPECT_THROW(publicKey.reCrypt(c1), helib::LogicError);
+  EXPECT_THROW(publicKey.thinReCrypt(c1), helib::LogicError);
+
+  std::vector<helib::Ctxt> cs(2, c1);
+  EXPECT_THROW(publicKey.reCrypt(cs), helib::LogicError);
+}
+
+TEST_P(TestCKKS, chebyshevEvaluationOfCiphertextWorks)
+{
+  // A degree-7 approximation of the sigmoid on [-4,4], depth 3
+  const double a = -4.0, b = 4.0;
+  auto sigmoid = [](double x) { return 1 / (1 + std::exp(-x)); };
+  std::vector<double> coeffs = helib::chebyshevCoefficients(sigmoid, 7, a, b);
+
+  std::vector<std::complex<double>> vd1, vd2;
+  ea.random(vd1, b);
+  for (auto& x : vd1)
+    x = std::real(x); // inputs are real and in [a,b]
+  std::vector<std::complex<double>> expected(vd1.size());
+  for (std::size_t i = 0; i < vd1.size(); i++)
+    expected[i] = helib::evalChebyshevSeries(
+        coeffs,
+        helib::mapToChebyshevInterval(std::real(vd1[i]), a, b));
+
+  helib::Ctxt c1(publicKey), c2(publicKey);
+  ea.encrypt(c1, publicKey, vd1);
+  helib::mapToChebyshevInterval(c1, a, b);
+  helib::chebyshevEval(c2, coeffs, c1);
+  ea.decrypt(c2, secretKey, vd2);
+
+  EXPECT_TRUE(cx_equals(vd2, expected, epsilon))
+      << "  max(expected)=" << helib::largestCoeff(expected)
+      << ", max(vd2)=" << helib::largestCoeff(vd2)
+      << ", maxDiff=" << calcMaxDiff(expected, vd2) << std::endl
+      << std::endl;
+}
+
+TEST_P(TestCKKS, approximateComparisonAndMaxOfCiphertextsWork)
+{
+  // A single f stage, depth 3, which is enough for |a-b| >= 1/2
+  helib::SignApproximation sign(0.5, 2);
+  ASSERT_EQ(sign.numStages(), 1);
+
+  std::vector<std::complex<double>> va(ea.size()), vb(ea.size());
+  std::vector<std::complex<double>> gt(ea.size()), mx(ea.size());
+  for (long i = 0; i < ea.size(); i++) {
+    double a = (i % 2) ? 0.9 : 0.1;
+    double b = 1 - a;
+    double p = sign(a - b);
+    va[i] = a;
+    vb[i] = b;
+    gt[i] = (p + 1) / 2;
+    mx[i] = (a + b) / 2 + (a - b) / 2 * p;
+    // Within the precision of the approximation of the true answers
+    EXPECT_NEAR(std::real(gt[i]), a > b ? 1 : 0, 0.125);
+    EXPECT_NEAR(std::real(mx[i]), std::max(a, b), 0.1);
+  }
+
+  helib::Ctxt ca(publicKey), cb(publicKey), out(publicKey);
+  ea.encrypt(ca, publicKey, va);
+  ea.encrypt(cb, publicKey, vb);
+  std::vector<std::complex<double>> result;
+
+  helib::approxGreaterThan(out, ca, cb, sign);
+  ea.decrypt(out, secretKey, result);
+  EXPECT_TRUE(cx_equals(result, gt, epsilon))
+      << "  maxDiff=" << calcMaxDiff(gt, result) << std::endl;
+
+  helib::approxMax(out, ca, cb, sign);
+  ea.decrypt(out, secretKey, result);
+  EXPECT_TRUE(cx_equals(result, mx, epsilon))
+      << "  maxDiff=" << calcMaxDiff(mx, result) << std::endl;
+}
+
+TEST(TestCKKS, chebyshevCoefficientsInterpolateAtTheNodes)
+{
+  const double pi = std::acos(-1.0);
+  const long d = 9;
+  auto f = [](double x) { return std::exp(x) * std::sin(3 * x); };
+  std::vector<double> coeffs = helib::chebyshevCoefficients(f, d, 1.0, 3.0);
+  ASSERT_EQ(helib::lsize(coeffs), d + 1);
+  for (long j = 0; j <= d; j++) {
+    double y = std::cos(pi * (j + 0.5) / (d + 1));
+    double x = (y * 2.0 + 4.0) / 2;
+    EXPECT_NEAR(helib::evalChebyshevSeries(coeffs, y), f(x), 1e-9);
+    EXPECT_NEAR(helib::mapToChebyshevInterval(x, 1.0, 3.0), y, 1e-12);
+  }
+}
+
+TEST(TestCKKS, signApproximationIsWithinItsPrecision)
+{
+  std::vector<std::pair<double, long>> params{{1.0 / 16, 8}, {1.0 / 256, 10}};
+  for (auto [epsilon, alpha] : params) {
+    helib::SignApproximation sign(epsilon, alpha);
+    EXPECT_EQ(sign.depth(), 3 * sign.numStages());
+    double bound = std::ldexp(1.0, -alpha);
+    for (long i = -4096; i <= 4096; i++) {
+      double x = i / 4096.0;
+      double p = sign(x);
+      EXPECT_LE(std::abs(p), 1 + 1e-9) << "x=" << x;
+      if (std::abs(x) >= epsilon)
+        EXPECT_LE(std::abs(p - (x > 0 ? 1 : -1)), bound) << "x=" << x;
+    }
+  }
+  EXPECT_THROW(helib::SignApproximation(0, 8), helib::InvalidArgument);
+  EXPECT_THROW(helib::SignApproximation(0.5, 0), helib::InvalidArgument);
+}
+
+TEST(TestCKKS, approximateTopKPacksTheLargestSlotsAndTheirPositions)
+{
+  // 8 slots and enough levels for the two signs of approxTopK
+  helib::Context context = helib::ContextBuilder<helib::CKKS>()
+                               .m(32)
+                               .precision(20)
+                               .bits(1500)
+                               .c(2)
+                               .build();
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  helib::addSome1DMatrices(secretKey);
+  const helib::PubKey& publicKey = secretKey;
+  const helib::EncryptedArrayCx& ea = context.getEA().getCx();
+  ASSERT_EQ(ea.size(), 8);
+
+  std::vector<double> scores = {0.3, 0.9, 0.1, 0.7, 0.5, 0.2, 0.8, 0.4};
+  helib::SignApproximation sign(1.0 / 16, 4);
+  helib::Ctxt encrypted(publicKey), top(publicKey);
+  ea.encrypt(encrypted, publicKey, scores);
+  helib::approxTopK(top, encrypted, 2, ea, sign);
+
+  std::vector<double> decrypted;
+  ea.decrypt(top, secretKey, decrypted);
+  std::vector<double> expected = {0.9, 0.8, 1.0 / 8, 6.0 / 8, 0, 0, 0, 0};
+  for (long i = 0; i < 8; i++)
+    EXPECT_NEAR(decrypted[i], expected[i], 0.05) << "slot " << i;
+
+  EXPECT_THROW(helib::approxTopK(top, encrypted, 5, ea, sign),
+               helib::InvalidArgument);
+  helib::SignApproximation coarse(1.0 / 16, 2);
+  EXPECT_THROW(helib::approxTopK(top, encrypted, 2, ea, coarse),
+               helib::InvalidArgument);
+}
+
+TEST_P(TestCKKS, switchingToBGVAndBackKeepsThePlaintextPolynomial)
+{
+  const long t = 65537;
+  helib::Context bgvContext(
+      helib::ContextBuilder<helib::BGV>().m(m).p(t).r(1).bits(300).build());
+  helib::SecKey bgvKey(bgvContext);
+  bgvKey.GenSecKey();
+  helib::SchemeSwitch toBGV(bgvKey,
+                            helib::SchemeSwitch::addKey(bgvKey, secretKey));
+  helib::SchemeSwitch toCKKS(secretKey,
+                             helib::SchemeSwitch::addKey(secretKey, bgvKey));
+  const long phim = context.getPhiM();
+
+  // Any coefficients mod t, from CKKS to BGV
+  helib::zzX mu(phim);
+  for (long& coeff : mu)
+    coeff = NTL::RandomBnd(t) - t / 2;
+  const double scale = std::ldexp(1.0, 30);
+  helib::zzX scaled(mu);
+  for (long& coeff : scaled)
+    coeff *= long(scale);
+  helib::EncodedPtxt eptxt;
+  eptxt.resetCKKS(scaled, phim * (t / 2.0), scale, 1.0, context);
+  helib::Ctxt ckks(publicKey);
+  publicKey.Encrypt(ckks, eptxt);
+
+  helib::Ctxt bgv(bgvKey);
+  toBGV.apply(bgv, ckks);
+  NTL::ZZX decrypted;
+  bgvKey.Decrypt(decrypted, bgv);
+  for (long i = 0; i < phim; i++)
+    EXPECT_EQ(NTL::rem(NTL::coeff(decrypted, i), t), (mu[i] + t) % t)
+        << "coefficient " << i;
+
+  // Small coefficients, from BGV to CKKS
+  NTL::ZZX small;
+  for (long i = 0; i < phim; i++)
+    NTL::SetCoeff(small, i, NTL::RandomBnd(5) - 2);
+  bgvKey.Encrypt(bgv, small, t);
+  helib::Ctxt back(secretKey);
+  toCKKS.apply(back, bgv, 2.0 * phim);
+  EXPECT_THROW(toCKKS.apply(back, bgv), helib::InvalidArgument);
+  secretKey.Decrypt(decrypted, back);
+  for (long i = 0; i < phim; i++) {
+    NTL::xdouble coeff = NTL::conv<NTL::xdouble>(NTL::coeff(decrypted, i));
+    EXPECT_NEAR(NTL::conv<double>(coeff / back.getRatFactor()),
+                NTL::conv<double>(NTL::coeff(small, i)),
+                1e-3)
+        << "coefficient " << i;
+  }
+}
+
 TEST(TestCKKS, buildingCKKSContextWithMAsNotAPowerOfTwoThrows)
 {
   EXPECT_THROW(
@@ -626,6 +1019,46 @@ TEST(TestCKKS, buildingCKKSContextWithMAsNotAPowerOfTwoThrows)
       helib::InvalidArgument);
 }
 
+TEST(TestCKKS, bootstrappingRestoresTheCapacityOfACiphertext)
+{
+  helib::Context context(helib::ContextBuilder<helib::CKKS>()
+                             .m(1024)
+                             .precision(30)
+                             .bits(1400)
+                             .c(2)
+                             .bootstrappable()
+                             .build());
+  ASSERT_TRUE(context.isBootstrappable());
+  EXPECT_EQ(context.getHwt(), helib::BOOT_DFLT_SK_HWT);
+
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  secretKey.genRecryptData();
+  const helib::PubKey& publicKey = secretKey;
+  ASSERT_TRUE(publicKey.isBootstrappable());
+  const helib::EncryptedArrayCx& ea = context.getEA().getCx();
+
+  std::vector<std::complex<double>> vd, result;
+  ea.random(vd);
+  helib::Ctxt c(publicKey);
+  ea.encrypt(c, publicKey, vd);
+  c.dropToCapacity(60);
+  double capacityBefore = c.capacity();
+
+  publicKey.reCrypt(c);
+  EXPECT_GT(c.capacity(), 2 * capacityBefore);
+  ea.decrypt(c, secretKey, result);
+  EXPECT_TRUE(cx_equals(result, vd, 0.01))
+      << "  maxDiff=" << calcMaxDiff(vd, result) << std::endl;
+
+  // The refreshed ciphertext takes more multiplications
+  c.square();
+  mul(vd, vd);
+  ea.decrypt(c, secretKey, result);
+  EXPECT_TRUE(cx_equals(result, vd, 0.02))
+      << "  maxDiff=" << calcMaxDiff(vd, result) << std::endl;
+}
+
 INSTANTIATE_TEST_SUITE_P(typicalParameters,
                          TestCKKS,
                          ::testing::Values(
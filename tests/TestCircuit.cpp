@@ -0,0 +1,368 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#include <climits>
+#include <numeric>
+#include <sstream>
+#include <vector>
+
+#include <helib/helib.h>
+#include <helib/booleanCircuit.h>
+#include <helib/circuit.h>
+#include <helib/costEstimate.h>
+#include <helib/debugging.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestCircuit : public ::testing::Test
+{
+protected:
+  helib::Context context;
+  helib::SecKey secretKey;
+  helib::PubKey publicKey;
+  const helib::EncryptedArray& ea;
+
+  TestCircuit() :
+      context(helib::ContextBuilder<helib::BGV>()
+                  .m(45)
+                  .p(317)
+                  .r(1)
+                  .bits(500)
+                  .build()),
+      secretKey(context),
+      publicKey((secretKey.GenSecKey(),
+                 addAllMatrices(secretKey),
+                 secretKey)),
+      ea(context.getEA())
+  {}
+
+  helib::Ctxt encrypt(long offset)
+  {
+    std::vector<long> data(ea.size());
+    std::iota(data.begin(), data.end(), offset);
+    helib::Ctxt ctxt(publicKey);
+    publicKey.Encrypt(ctxt, helib::Ptxt<helib::BGV>(context, data));
+    return ctxt;
+  }
+
+  helib::Ptxt<helib::BGV> decrypt(const helib::Ctxt& ctxt)
+  {
+    helib::Ptxt<helib::BGV> ptxt(context);
+    secretKey.Decrypt(ptxt, ctxt);
+    return ptxt;
+  }
+};
+
+TEST_F(TestCircuit, identicalOperationsAreRecordedOnce)
+{
+  helib::Circuit circuit(context);
+  helib::Circuit::Wire x = circuit.input();
+  helib::Circuit::Wire y = circuit.input();
+  helib::Circuit::Wire xy = x * y;
+  helib::Circuit::Wire yx = y * x;
+  helib::Circuit::Wire z = x.automorph(7) + x.automorph(7 + context.getM());
+  circuit.output(xy + yx);
+  circuit.output(z);
+  circuit.output(x.automorph(1));
+
+  // The two inputs, x*y and its double, the automorphism and its double
+  EXPECT_EQ(circuit.numNodes(), 6);
+  EXPECT_EQ(circuit.numInputs(), 2);
+  EXPECT_EQ(circuit.numOutputs(), 3);
+}
+
+TEST_F(TestCircuit, runningACircuitMatchesEagerEvaluation)
+{
+  helib::Circuit circuit(context);
+  helib::Circuit::Wire x = circuit.input();
+  helib::Circuit::Wire y = circuit.input();
+  helib::Circuit::Wire w = circuit.input();
+
+  // A sum of products, hoisted automorphisms, and a dead branch
+  helib::Circuit::Wire inner = x * y + y * w - x.square();
+  helib::Circuit::Wire rotations =
+      x.automorph(2) + x.automorph(4) * 3 + x.automorph(8);
+  helib::Circuit::Wire unused = inner * rotations;
+  (void)unused;
+  circuit.output(inner * w + 5);
+  circuit.output(-rotations);
+  circuit.output(x);
+
+  std::vector<helib::Ctxt> inputs = {encrypt(0), encrypt(3), encrypt(7)};
+  const helib::Ctxt& cx = inputs[0];
+  const helib::Ctxt& cy = inputs[1];
+  const helib::Ctxt& cw = inputs[2];
+
+  helib::Ctxt expected_inner(cx);
+  expected_inner *= cy;
+  helib::Ctxt tmp(cy);
+  tmp *= cw;
+  expected_inner += tmp;
+  tmp = cx;
+  tmp.square();
+  expected_inner -= tmp;
+  expected_inner *= cw;
+  expected_inner.addConstant(NTL::ZZX(5));
+
+  helib::Ctxt expected_rotations(cx);
+  expected_rotations.smartAutomorph(2);
+  tmp = cx;
+  tmp.smartAutomorph(4);
+  tmp.multByConstant(NTL::ZZX(3));
+  expected_rotations += tmp;
+  tmp = cx;
+  tmp.smartAutomorph(8);
+  expected_rotations += tmp;
+  expected_rotations.negate();
+
+  // Replay the circuit twice, to check that it does not keep any state
+  for (int run = 0; run < 2; ++run) {
+    std::vector<helib::Ctxt> outputs = circuit.run(inputs);
+    ASSERT_EQ(outputs.size(), 3u);
+    EXPECT_EQ(decrypt(outputs[0]), decrypt(expected_inner));
+    EXPECT_EQ(decrypt(outputs[1]), decrypt(expected_rotations));
+    EXPECT_EQ(decrypt(outputs[2]), decrypt(cx));
+    for (const auto& output : outputs)
+      EXPECT_TRUE(output.inCanonicalForm());
+  }
+}
+
+TEST_F(TestCircuit, runningWithTheWrongNumberOfInputsThrows)
+{
+  helib::Circuit circuit(context);
+  helib::Circuit::Wire x = circuit.input();
+  circuit.output(x.square());
+  EXPECT_THROW(circuit.run({}), helib::InvalidArgument);
+}
+
+TEST_F(TestCircuit, estimatingACircuitChargesItsOperations)
+{
+  helib::Circuit circuit(context);
+  helib::Circuit::Wire x = circuit.input();
+  helib::Circuit::Wire y = circuit.input();
+  circuit.output(x * y + x.automorph(2));
+  std::vector<helib::Ctxt> inputs = {encrypt(0), encrypt(3)};
+
+  helib::CostModel model;
+  model.nttSeconds = 1;
+  model.arithSeconds = 0.5;
+  model.automorphSeconds = 0.25;
+  helib::CostEstimate estimate = circuit.estimate(inputs, model);
+  EXPECT_FALSE(helib::isDryRun());
+
+  // At least the re-linearization and the automorphism
+  EXPECT_GE(estimate.keySwitches, 2);
+  EXPECT_GT(estimate.nttRows, 0);
+  EXPECT_GT(estimate.arithRows, 0);
+  EXPECT_GT(estimate.automorphRows, 0);
+  EXPECT_GT(estimate.peakBytes, 0);
+  EXPECT_GE(estimate.allocatedBytes, estimate.peakBytes);
+  EXPECT_DOUBLE_EQ(estimate.seconds,
+                   estimate.nttRows + 0.5 * estimate.arithRows +
+                       0.25 * estimate.automorphRows);
+}
+
+TEST_F(TestCircuit, calibratingTheCostModelTimesEveryPrimitive)
+{
+  helib::CostModel model = helib::CostModel::calibrate(context, 2);
+  EXPECT_GT(model.nttSeconds, 0);
+  EXPECT_GT(model.arithSeconds, 0);
+  EXPECT_GT(model.automorphSeconds, 0);
+}
+
+TEST_F(TestCircuit, keySwitchPlansTradeMemoryForTime)
+{
+  helib::CostModel model;
+  model.nttSeconds = 1;
+  model.arithSeconds = 0.5;
+  model.automorphSeconds = 0.25;
+  const long n = context.getZMStar().numOfGens();
+  helib::KeySwitchWorkload workload;
+  workload.rotations.assign(n, 10);
+  workload.matMuls.assign(n, 1);
+
+  helib::KeySwitchPlan roomy =
+      helib::planKeySwitching(context, model, workload, LONG_MAX);
+  helib::KeySwitchPlan tight =
+      helib::planKeySwitching(context, model, workload, 0);
+  ASSERT_EQ(long(roomy.dims.size()), n);
+  ASSERT_EQ(long(tight.dims.size()), n);
+  EXPECT_TRUE(roomy.withinBudget);
+  EXPECT_FALSE(tight.withinBudget);
+  EXPECT_LE(roomy.seconds, tight.seconds);
+  EXPECT_LE(tight.bytes, roomy.bytes);
+
+  // Just enough memory for the smallest plan
+  helib::KeySwitchPlan fitting =
+      helib::planKeySwitching(context, model, workload, tight.bytes);
+  EXPECT_TRUE(fitting.withinBudget);
+  EXPECT_EQ(fitting.bytes, tight.bytes);
+
+  std::ostringstream report;
+  report << roomy;
+  EXPECT_NE(report.str().find("strategy="), std::string::npos);
+
+  helib::SecKey planned(context);
+  planned.GenSecKey();
+  addPlannedMatrices(planned, tight);
+  for (const helib::DimensionPlan& dim : tight.dims)
+    EXPECT_EQ(planned.getKSStrategy(dim.dim), dim.strategy);
+
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 1);
+  helib::Ptxt<helib::BGV> expected(context, data);
+  helib::Ctxt ctxt(planned);
+  planned.Encrypt(ctxt, expected);
+  ea.rotate(ctxt, 1);
+  expected.rotate(1);
+  helib::Ptxt<helib::BGV> decrypted(context);
+  planned.Decrypt(decrypted, ctxt);
+  EXPECT_EQ(decrypted, expected);
+}
+
+
+// Two 4-bit inputs; the AND of all their bits through a chain, behind gates
+// that fold away, and x0&x2 ^ x0&x3, with a gate nothing uses
+const char* const andChainNetlist = R"(16 24
+2 4 4
+1 2
+
+2 1 0 1 8 AND
+2 1 8 2 9 AND
+2 1 9 3 10 AND
+2 1 10 4 11 AND
+2 1 11 5 12 AND
+2 1 12 6 13 AND
+2 1 13 7 14 AND
+2 1 0 0 15 XOR
+1 1 15 16 INV
+2 1 14 16 17 AND
+2 1 0 2 18 AND
+2 1 0 3 19 AND
+2 1 18 19 20 XOR
+2 1 1 2 21 AND
+1 1 17 22 EQW
+1 1 20 23 EQW
+)";
+
+std::vector<long> bitsOf(long x, long n)
+{
+  std::vector<long> bits(n);
+  for (long i = 0; i < n; i++)
+    bits[i] = (x >> i) & 1;
+  return bits;
+}
+
+TEST(TestBooleanCircuit, compilingANetlistRebalancesAndFoldsItsGates)
+{
+  std::istringstream str(andChainNetlist);
+  helib::BooleanCircuit circuit(str);
+  EXPECT_EQ(circuit.getInputSizes(), std::vector<long>({4, 4}));
+  EXPECT_EQ(circuit.getOutputSizes(), std::vector<long>({2}));
+  EXPECT_EQ(circuit.getNetlistStats().ands, 11);
+  EXPECT_EQ(circuit.getNetlistStats().xors, 2);
+  EXPECT_EQ(circuit.getNetlistStats().andDepth, 8);
+  EXPECT_EQ(circuit.getStats().ands, 8);
+  EXPECT_EQ(circuit.getStats().xors, 1);
+  EXPECT_EQ(circuit.getStats().andDepth, 3);
+
+  for (long x = 0; x < 256; x++) {
+    long x0 = x & 1, x2 = (x >> 2) & 1, x3 = (x >> 3) & 1;
+    std::vector<long> expected = {x == 255, x0 & (x2 ^ x3)};
+    EXPECT_EQ(circuit.evaluate(bitsOf(x, 8)), expected) << "x=" << x;
+  }
+}
+
+TEST(TestBooleanCircuit, theOlderBristolFormatIsRead)
+{
+  std::istringstream str("3 7\n2 2 1\n\n"
+                         "2 1 0 1 4 AND\n2 1 2 3 5 XOR\n2 1 4 5 6 XOR\n");
+  helib::BooleanCircuit circuit(str);
+  EXPECT_EQ(circuit.getInputSizes(), std::vector<long>({2, 2}));
+  EXPECT_EQ(circuit.getOutputSizes(), std::vector<long>({1}));
+  for (long x = 0; x < 16; x++) {
+    std::vector<long> bits = bitsOf(x, 4);
+    std::vector<long> expected = {(bits[0] & bits[1]) ^ bits[2] ^ bits[3]};
+    EXPECT_EQ(circuit.evaluate(bits), expected) << "x=" << x;
+  }
+}
+
+TEST(TestBooleanCircuit, malformedNetlistsThrow)
+{
+  for (const char* netlist : {"1 3\n1 2\n1 1\n2 1 0 1 2 NAND\n",
+                              "1 3\n1 2\n1 1\n2 1 0 5 2 AND\n",
+                              "2 4\n1 2\n1 1\n2 1 0 1 2 AND\n"}) {
+    std::istringstream str(netlist);
+    EXPECT_THROW(helib::BooleanCircuit circuit(str), helib::IOError)
+        << netlist;
+  }
+}
+
+TEST(TestBooleanCircuit, cutsRecryptTheFewestBits)
+{
+  std::istringstream str(andChainNetlist);
+  helib::BooleanCircuit circuit(str);
+  long recrypted = -1;
+  EXPECT_EQ(circuit.recryptionCuts(1, &recrypted), std::vector<long>({1, 2}));
+  EXPECT_EQ(recrypted, 6);
+  // After the second layer two products cross, after the first four
+  EXPECT_EQ(circuit.recryptionCuts(2, &recrypted), std::vector<long>({2}));
+  EXPECT_EQ(recrypted, 2);
+  EXPECT_TRUE(circuit.recryptionCuts(3, &recrypted).empty());
+  EXPECT_EQ(recrypted, 0);
+  EXPECT_TRUE(circuit.recryptionCuts(-1).empty());
+}
+
+TEST(TestBooleanCircuit, evaluatingOnEncryptedBitsMatchesTheClearCircuit)
+{
+  std::istringstream str(andChainNetlist);
+  helib::BooleanCircuit circuit(str);
+  helib::Context context = helib::ContextBuilder<helib::BGV>()
+                               .m(105)
+                               .p(2)
+                               .r(1)
+                               .bits(300)
+                               .build();
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  const helib::EncryptedArray& ea = context.getEA();
+
+  // One instance of the circuit per slot
+  const std::vector<long> values = {255, 0x5D, 0xA4, 0x0D};
+  std::vector<std::vector<long>> slotBits(ea.size());
+  for (long i = 0; i < ea.size(); i++)
+    slotBits[i] = bitsOf(values[i % helib::lsize(values)], 8);
+  std::vector<helib::Ctxt> in(8, helib::Ctxt(secretKey));
+  for (long j = 0; j < 8; j++) {
+    std::vector<long> data(ea.size());
+    for (long i = 0; i < ea.size(); i++)
+      data[i] = slotBits[i][j];
+    secretKey.Encrypt(in[j], helib::Ptxt<helib::BGV>(context, data));
+  }
+
+  std::vector<helib::Ctxt> out;
+  helib::CtPtrs_vectorCt outPtrs(out);
+  circuit.evaluate(outPtrs, helib::CtPtrs_vectorCt(in));
+  ASSERT_EQ(long(out.size()), circuit.numOutputBits());
+  for (long k = 0; k < circuit.numOutputBits(); k++) {
+    helib::Ptxt<helib::BGV> decrypted(context);
+    secretKey.Decrypt(decrypted, out[k]);
+    for (long i = 0; i < ea.size(); i++)
+      EXPECT_EQ(decrypted[i], circuit.evaluate(slotBits[i])[k])
+          << "output " << k << ", slot " << i;
+  }
+}
+
+} // namespace
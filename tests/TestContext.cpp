@@ -305,6 +305,85 @@ TEST(TestContextBGV, contextBuilderDoesNotClipDigitsSize)
   EXPECT_EQ(context_built.getDigits().size(), c);
 }
 
+TEST(TestContextBGV, hybridKeySwitchingUsesFewerDigitsWithLargerBudget)
+{
+  helib::Context small_budget = helib::ContextBuilder<helib::BGV>()
+                                    .bits(500)
+                                    .hybridKeySwitching(150)
+                                    .build();
+  helib::Context large_budget = helib::ContextBuilder<helib::BGV>()
+                                    .bits(500)
+                                    .hybridKeySwitching(400)
+                                    .build();
+
+  EXPECT_GE(small_budget.getDigits().size(), 1);
+  EXPECT_LT(large_budget.getDigits().size(), small_budget.getDigits().size());
+  EXPECT_GE(large_budget.logOfProduct(large_budget.getSpecialPrimes()) /
+                std::log(2.0),
+            400);
+}
+
+TEST(TestContextBGV, hybridKeySwitchingHonoursExplicitDigitCount)
+{
+  long c = 2;
+  helib::Context context_built = helib::ContextBuilder<helib::BGV>()
+                                     .bits(500)
+                                     .hybridKeySwitching(300, c)
+                                     .build();
+
+  EXPECT_EQ(context_built.getDigits().size(), c);
+}
+
+TEST(TestContextBGV, maxPrimeBitsBoundsEveryPrimeInTheChain)
+{
+  long maxBits = 45;
+  helib::Context context_built = helib::ContextBuilder<helib::BGV>()
+                                     .bits(300)
+                                     .maxPrimeBits(maxBits)
+                                     .build();
+
+  EXPECT_EQ(context_built.getMaxPrimeBits(), maxBits);
+  for (long i : helib::range(context_built.numPrimes()))
+    EXPECT_LT(context_built.ithPrime(i), 1L << maxBits);
+  EXPECT_GE(context_built.bitSizeOfQ(), 300);
+}
+
+TEST(TestContextBGV, maxPrimeBitsThrowsWhenTooSmall)
+{
+  EXPECT_THROW(helib::ContextBuilder<helib::BGV>().maxPrimeBits(20).build(),
+               helib::InvalidArgument);
+}
+
+TEST(TestContextBGV, cachedLogsOfPrimesMatchTheirPrimes)
+{
+  helib::Context context = helib::ContextBuilder<helib::BGV>().build();
+  double sum = 0.0;
+  for (long i : helib::range(context.numPrimes())) {
+    EXPECT_DOUBLE_EQ(context.logOfPrime(i), std::log(context.ithPrime(i)));
+    sum += std::log(context.ithPrime(i));
+  }
+  EXPECT_DOUBLE_EQ(context.logOfProduct(context.fullPrimes()), sum);
+}
+
+TEST(TestContextBGV, moduliBuiltInParallelMatchSerialOnes)
+{
+  long nthreads = NTL::AvailableThreads();
+  auto buildWith = [](long threads) {
+    NTL::SetNumThreads(threads);
+    return helib::ContextBuilder<helib::BGV>().m(255).bits(300).build();
+  };
+  helib::Context serial = buildWith(1);
+  helib::Context parallel = buildWith(4);
+  NTL::SetNumThreads(nthreads);
+
+  ASSERT_EQ(serial, parallel);
+  for (long i : helib::range(serial.numPrimes())) {
+    EXPECT_EQ(serial.ithModulus(i).getQ(), serial.ithPrime(i));
+    EXPECT_EQ(serial.ithModulus(i).getRoot(),
+              parallel.ithModulus(i).getRoot());
+  }
+}
+
 TEST_P(TestContextBGV, contextBuilderWithBasicParams)
 {
   // clang-format off
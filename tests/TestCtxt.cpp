@@ -15,8 +15,24 @@
 // The older tests with more extensive coverage can be found in the files
 // with names matching "GTest*".
 
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <helib/helib.h>
+#include <helib/async.h>
+#include <helib/batching.h>
+#include <helib/conv2d.h>
+#include <helib/ctxtMatMul.h>
 #include <helib/debugging.h>
+#include <helib/distributed.h>
+#include <helib/Encryptor.h>
+#include <helib/matmul.h>
+#include <helib/randomMatrices.h>
 
 #include "test_common.h"
 #include "gtest/gtest.h"
@@ -141,6 +157,483 @@ TEST_P(TestCtxt, timesEqualsWithEncodedPtxtWorks)
   EXPECT_EQ(decrypted_result, expected_result);
 }
 
+TEST_P(TestCtxt, encodedConstantsCacheTheirEmbeddingNorm)
+{
+  helib::PtxtArray pa(context);
+  pa.random();
+  helib::EncodedPtxt eptxt;
+  pa.encode(eptxt);
+
+  const helib::EncodedPtxt_BGV& bgv = eptxt.getBGV();
+  double size = helib::embeddingLargestCoeff(bgv.getPoly(),
+                                             context.getZMStar());
+  EXPECT_EQ(bgv.getSize(), size);
+  // A copy keeps the cached value, and an expansion reuses it
+  helib::EncodedPtxt copy(eptxt);
+  EXPECT_EQ(copy.getBGV().getSize(), size);
+  helib::FatEncodedPtxt feptxt;
+  feptxt.expand(eptxt, context.getCtxtPrimes());
+  EXPECT_EQ(feptxt.getBGV().getSize(), size);
+
+  // Using the same constant twice gives the same noise bound as once
+  helib::Ctxt ctxt(publicKey);
+  pa.encrypt(ctxt);
+  helib::Ctxt other(ctxt);
+  ctxt *= eptxt;
+  other *= eptxt;
+  EXPECT_EQ(ctxt.getNoiseBound(), other.getNoiseBound());
+
+  helib::PtxtArray expected(pa);
+  expected *= pa;
+  helib::PtxtArray decrypted(context);
+  decrypted.decrypt(ctxt, secretKey);
+  EXPECT_EQ(decrypted, expected);
+}
+
+TEST_P(TestCtxt, encodeBatchMatchesEncodingOneByOne)
+{
+  long nthreads = NTL::AvailableThreads();
+  NTL::SetNumThreads(4);
+
+  std::vector<helib::PtxtArray> arrays(5, helib::PtxtArray(context));
+  for (helib::PtxtArray& pa : arrays)
+    pa.random();
+
+  std::vector<helib::EncodedPtxt> eptxts;
+  helib::encodeBatch(eptxts, arrays);
+  std::vector<helib::FatEncodedPtxt> feptxts;
+  helib::encodeBatch(feptxts, arrays, context.getCtxtPrimes());
+  NTL::SetNumThreads(nthreads);
+
+  ASSERT_EQ(eptxts.size(), arrays.size());
+  ASSERT_EQ(feptxts.size(), arrays.size());
+  for (std::size_t i = 0; i < arrays.size(); i++) {
+    helib::EncodedPtxt expected;
+    arrays[i].encode(expected);
+    EXPECT_EQ(eptxts[i].getBGV().getPoly(), expected.getBGV().getPoly());
+
+    helib::PtxtArray ones(context, 1l);
+    helib::Ctxt ctxt(publicKey);
+    ones.encrypt(ctxt);
+    ctxt *= feptxts[i];
+    helib::PtxtArray decrypted(context);
+    decrypted.decrypt(ctxt, secretKey);
+    EXPECT_EQ(decrypted, arrays[i]);
+  }
+}
+
+TEST_P(TestCtxt, decryptBatchMatchesDecryptingOneByOne)
+{
+  std::vector<helib::PtxtArray> arrays(6, helib::PtxtArray(context));
+  std::vector<helib::Ctxt> ctxts(arrays.size(), helib::Ctxt(publicKey));
+  for (std::size_t i = 0; i < arrays.size(); i++) {
+    arrays[i].random();
+    arrays[i].encrypt(ctxts[i]);
+  }
+  // Mix in lower levels and parts under s^2, which need other key powers
+  ctxts[1].multLowLvl(ctxts[2]);
+  ctxts[3].multiplyBy(ctxts[4]);
+  ctxts[5].modDownToSet(ctxts[3].getPrimeSet());
+
+  long nthreads = NTL::AvailableThreads();
+  NTL::SetNumThreads(4);
+  std::vector<helib::PtxtArray> decrypted;
+  secretKey.DecryptBatch(decrypted, ctxts);
+  NTL::SetNumThreads(nthreads);
+
+  ASSERT_EQ(decrypted.size(), ctxts.size());
+  for (std::size_t i = 0; i < ctxts.size(); i++) {
+    helib::PtxtArray expected(context);
+    expected.decrypt(ctxts[i], secretKey);
+    EXPECT_EQ(decrypted[i], expected);
+  }
+}
+
+TEST_P(TestCtxt, encryptBatchDoesNotDependOnTheNumberOfThreads)
+{
+  std::vector<helib::PtxtArray> arrays(5, helib::PtxtArray(context));
+  for (helib::PtxtArray& pa : arrays)
+    pa.random();
+
+  long nthreads = NTL::AvailableThreads();
+  NTL::SetNumThreads(1);
+  NTL::SetSeed(NTL::ZZ(11));
+  std::vector<helib::Ctxt> serial;
+  publicKey.EncryptBatch(serial, arrays);
+
+  NTL::SetNumThreads(4);
+  NTL::SetSeed(NTL::ZZ(11));
+  std::vector<helib::Ctxt> parallel;
+  std::vector<long> written;
+  publicKey.EncryptBatch(parallel,
+                         arrays,
+                         [&](long i, const helib::Ctxt& ctxt) {
+                           EXPECT_EQ(&ctxt, &parallel[i]);
+                           written.push_back(i);
+                         });
+  NTL::SetNumThreads(nthreads);
+
+  EXPECT_EQ(written, std::vector<long>({0, 1, 2, 3, 4}));
+  ASSERT_EQ(serial.size(), arrays.size());
+  for (std::size_t i = 0; i < arrays.size(); i++) {
+    EXPECT_EQ(serial[i], parallel[i]) << "ciphertext " << i;
+    helib::PtxtArray decrypted(context);
+    decrypted.decrypt(parallel[i], secretKey);
+    EXPECT_EQ(decrypted, arrays[i]) << "ciphertext " << i;
+  }
+}
+
+TEST_P(TestCtxt, encryptorMatchesPubKeyEncryptInReusedStorage)
+{
+  helib::Encryptor encryptor(publicKey);
+  helib::Ctxt reused(publicKey);
+  for (long i = 0; i < 3; i++) {
+    helib::PtxtArray ptxt(context);
+    ptxt.random();
+
+    NTL::SetSeed(NTL::ZZ(23 + i));
+    helib::Ctxt expected(publicKey);
+    ptxt.encrypt(expected);
+
+    NTL::SetSeed(NTL::ZZ(23 + i));
+    encryptor.encrypt(reused, ptxt);
+    EXPECT_EQ(reused, expected) << "message " << i;
+    EXPECT_EQ(reused.getPrimeSet(), expected.getPrimeSet());
+    EXPECT_EQ(reused.getNoiseBound(), expected.getNoiseBound());
+
+    helib::PtxtArray decrypted(context);
+    decrypted.decrypt(reused, secretKey);
+    EXPECT_EQ(decrypted, ptxt) << "message " << i;
+  }
+
+  // A ciphertext of another shape is reshaped first
+  helib::Ctxt product(publicKey);
+  helib::PtxtArray ones(ea, std::vector<long>(ea.size(), 1));
+  encryptor.encrypt(product, ones);
+  product.multiplyBy(reused);
+  helib::PtxtArray ptxt(context);
+  ptxt.random();
+  encryptor.encrypt(product, ptxt);
+  EXPECT_EQ(product.getPrimeSet(), context.getCtxtPrimes());
+  helib::PtxtArray decrypted(context);
+  decrypted.decrypt(product, secretKey);
+  EXPECT_EQ(decrypted, ptxt);
+}
+
+TEST_P(TestCtxt, precomputedZeroEncryptionsAreEachUsedOnce)
+{
+  publicKey.precomputeZeroEncryptions(3);
+  EXPECT_EQ(publicKey.precomputedZeroEncryptions(), 3);
+
+  // The last encryption finds the pool empty and samples its own
+  std::vector<helib::PtxtArray> arrays(4, helib::PtxtArray(context));
+  std::vector<helib::Ctxt> ctxts(arrays.size(), helib::Ctxt(publicKey));
+  for (long i = 0; i < long(arrays.size()); i++) {
+    arrays[i].random();
+    arrays[i].encrypt(ctxts[i]);
+    EXPECT_EQ(publicKey.precomputedZeroEncryptions(), std::max(0L, 2 - i));
+  }
+
+  for (std::size_t i = 0; i < ctxts.size(); i++) {
+    helib::PtxtArray decrypted(context);
+    decrypted.decrypt(ctxts[i], secretKey);
+    EXPECT_EQ(decrypted, arrays[i]) << "ciphertext " << i;
+  }
+  helib::Ctxt zero0(publicKey), zero1(publicKey);
+  publicKey.precomputeZeroEncryptions(2);
+  helib::PtxtArray(context, 0l).encrypt(zero0);
+  helib::PtxtArray(context, 0l).encrypt(zero1);
+  EXPECT_NE(zero0, zero1);
+
+  publicKey.precomputeZeroEncryptions(2);
+  publicKey.clearZeroEncryptions();
+  EXPECT_EQ(publicKey.precomputedZeroEncryptions(), 0);
+}
+
+TEST_P(TestCtxt, recycledCiphertextsOfACtxtPoolComputeCorrectly)
+{
+  helib::CtxtPool pool(publicKey, /*maxSize=*/2);
+  pool.reserve(3);
+  EXPECT_EQ(pool.size(), 2);
+
+  helib::PtxtArray a(context), b(context);
+  a.random();
+  b.random();
+  helib::PtxtArray expectedProduct = a, expectedSum = a;
+  expectedProduct *= b;
+  expectedSum += b;
+  helib::Ctxt ca(publicKey), cb(publicKey);
+  a.encrypt(ca);
+  b.encrypt(cb);
+
+  for (long round = 0; round < 3; round++) {
+    helib::CtxtPool::Handle h1 = pool.acquire();
+    helib::CtxtPool::Handle h2 = pool.acquire();
+    helib::CtxtPool::Handle h3 = pool.acquire(); // the pool is empty
+    EXPECT_EQ(pool.size(), 0);
+
+    *h1 = ca;
+    h1->multiplyBy(cb);
+    *h2 = ca;
+    *h2 += cb;
+    *h3 = cb;
+
+    helib::PtxtArray product(context), sum(context), copy(context);
+    product.decrypt(*h1, secretKey);
+    sum.decrypt(*h2, secretKey);
+    copy.decrypt(*h3, secretKey);
+    EXPECT_EQ(product, expectedProduct) << "round " << round;
+    EXPECT_EQ(sum, expectedSum) << "round " << round;
+    EXPECT_EQ(copy, b) << "round " << round;
+  } // the handles give two of the ciphertexts back, the third is dropped
+
+  EXPECT_EQ(pool.size(), 2);
+  EXPECT_EQ(pool.hits(), 6);
+  EXPECT_EQ(pool.misses(), 3);
+
+  helib::CtxtPool::Handle h = pool.acquire();
+  h.reset();
+  EXPECT_FALSE(h);
+  EXPECT_EQ(pool.size(), 2);
+  pool.clear();
+  EXPECT_EQ(pool.size(), 0);
+}
+
+TEST_P(TestCtxt, droppingToTheRemainingDepthKeepsResultsCorrect)
+{
+  helib::PtxtArray a(context), expected(context);
+  a.random();
+  helib::Ctxt c(publicKey);
+  a.encrypt(c);
+
+  helib::Ctxt dropped = c;
+  dropped.dropToDepth(2);
+  EXPECT_LE(dropped.getPrimeSet().card(), c.getPrimeSet().card());
+  EXPECT_TRUE(dropped.getPrimeSet() <= context.getCtxtPrimes());
+  EXPECT_GE(dropped.bitCapacity(), 2 * long(dropped.bitsPerMultiplication()));
+
+  // Two more levels of squaring still decrypt correctly
+  expected = a;
+  for (long i = 0; i < 2; i++) {
+    c.square();
+    dropped.square();
+    expected *= expected;
+  }
+  helib::PtxtArray fromFull(context), fromDropped(context);
+  fromFull.decrypt(c, secretKey);
+  fromDropped.decrypt(dropped, secretKey);
+  EXPECT_EQ(fromFull, expected);
+  EXPECT_EQ(fromDropped, expected);
+  EXPECT_LE(dropped.getPrimeSet().card(), c.getPrimeSet().card());
+
+  // Asking for more capacity than there is leaves the ctxt primes alone
+  helib::Ctxt fresh(publicKey);
+  a.encrypt(fresh);
+  helib::IndexSet before = fresh.getPrimeSet() & context.getCtxtPrimes();
+  fresh.dropToCapacity(fresh.bitCapacity() + 100);
+  EXPECT_EQ(fresh.getPrimeSet(), before);
+}
+
+TEST_P(TestCtxt, batchedRequestsGetTheirOwnSlotsOfTheResults)
+{
+  long nslots = ea.size();
+  long width = std::max(1L, nslots / 4);
+  helib::BatchOptions options;
+  options.deadline = std::chrono::seconds(60); // only flush() runs them
+  helib::RequestBatcher batcher(
+      ea,
+      /*numInputs=*/2,
+      [](std::vector<helib::Ctxt>& inputs) {
+        inputs[0].multiplyBy(inputs[1]);
+        return std::vector<helib::Ctxt>{inputs[0]};
+      },
+      options);
+
+  std::vector<long> firstSlots(nslots, 0);
+  std::fill_n(firstSlots.begin(), width, 1);
+  helib::PtxtArray mask(ea, firstSlots);
+
+  const long numRequests = 3;
+  std::vector<helib::PtxtArray> expected;
+  std::vector<std::future<std::vector<helib::Ctxt>>> futures;
+  for (long i = 0; i < numRequests; i++) {
+    helib::PtxtArray a(ea), b(ea);
+    a.random();
+    b.random();
+    helib::Ctxt ca(publicKey), cb(publicKey);
+    a.encrypt(ca);
+    b.encrypt(cb);
+    futures.push_back(batcher.submit({ca, cb}, width));
+    a *= b;
+    a *= mask;
+    expected.push_back(a);
+  }
+  batcher.flush();
+
+  for (long i = 0; i < numRequests; i++) {
+    std::vector<helib::Ctxt> results = futures[i].get();
+    ASSERT_EQ(results.size(), 1u);
+    helib::PtxtArray decrypted(ea);
+    decrypted.decrypt(results[0], secretKey);
+    EXPECT_EQ(decrypted, expected[i]);
+  }
+  helib::BatchStats stats = batcher.stats();
+  EXPECT_EQ(stats.requests, numRequests);
+  EXPECT_EQ(stats.batches, 1 + (3 * width > nslots) + (2 * width > nslots));
+  EXPECT_EQ(stats.slots, numRequests * width);
+
+  helib::Ctxt alone(publicKey);
+  EXPECT_THROW(batcher.submit({alone}, width), helib::InvalidArgument);
+  EXPECT_THROW(batcher.submit({alone, alone}, nslots + 1),
+               helib::InvalidArgument);
+}
+
+TEST_P(TestCtxt, batchedRequestsRunAfterTheDeadline)
+{
+  helib::BatchOptions options;
+  options.deadline = std::chrono::milliseconds(1);
+  helib::RequestBatcher batcher(
+      ea,
+      /*numInputs=*/1,
+      [](std::vector<helib::Ctxt>& inputs) {
+        if (inputs[0].isEmpty())
+          throw helib::LogicError("empty input");
+        return inputs;
+      },
+      options);
+
+  helib::PtxtArray ptxt(ea);
+  ptxt.random();
+  helib::Ctxt ctxt(publicKey);
+  ptxt.encrypt(ctxt);
+  std::vector<helib::Ctxt> results = batcher.submit({ctxt}, ea.size()).get();
+  helib::PtxtArray decrypted(ea);
+  decrypted.decrypt(results[0], secretKey);
+  EXPECT_EQ(decrypted, ptxt);
+
+  // An error of the computation is given to every request of the batch
+  helib::Ctxt empty(publicKey);
+  auto failed = batcher.submit({empty}, 1);
+  EXPECT_THROW(failed.get(), helib::LogicError);
+}
+
+TEST_P(TestCtxt, distributedBatchesAndSumsMatchLocalOnes)
+{
+  const long nodes = 3;
+  const long n = 5; // not a multiple of nodes
+  std::vector<helib::PtxtArray> ptxts(n, helib::PtxtArray(ea));
+  std::vector<helib::Ctxt> batch(n, helib::Ctxt(publicKey));
+  for (long i = 0; i < n; i++) {
+    ptxts[i].random();
+    ptxts[i].encrypt(batch[i]);
+  }
+  auto square = [](std::vector<helib::Ctxt>& ctxts) {
+    for (helib::Ctxt& ctxt : ctxts)
+      ctxt.square();
+  };
+
+  std::vector<helib::Ctxt> terms(batch.begin(), batch.begin() + nodes);
+
+  auto endpoints = helib::LocalTransport::group(nodes);
+  std::vector<helib::Ctxt> sums(nodes, helib::Ctxt(publicKey));
+  std::vector<std::thread> threads;
+  for (long k = 0; k < nodes; k++)
+    threads.emplace_back([&, k] {
+      helib::Transport& transport = *endpoints[k];
+      std::vector<helib::Ctxt> ctxts;
+      if (k == 0)
+        ctxts = batch;
+      helib::distributedApply(transport, ctxts, publicKey, square);
+      sums[k] = helib::distributedSum(transport, terms[k], /*keepBits=*/60);
+      if (k == 0)
+        batch = std::move(ctxts);
+    });
+  for (std::thread& thread : threads)
+    thread.join();
+
+  ASSERT_EQ(long(batch.size()), n);
+  helib::PtxtArray expectedSum(ea);
+  for (long i = 0; i < n; i++) {
+    helib::PtxtArray decrypted(ea);
+    decrypted.decrypt(batch[i], secretKey);
+    helib::PtxtArray expected(ptxts[i]);
+    expected *= ptxts[i];
+    EXPECT_EQ(decrypted, expected);
+    if (i < nodes)
+      expectedSum += ptxts[i];
+  }
+  helib::PtxtArray decryptedSum(ea);
+  decryptedSum.decrypt(sums[0], secretKey);
+  EXPECT_EQ(decryptedSum, expectedSum);
+}
+
+TEST_P(TestCtxt, distributedErrorsReachTheCoordinator)
+{
+  auto endpoints = helib::LocalTransport::group(2);
+  helib::PtxtArray ptxt(ea);
+  ptxt.random();
+  std::vector<helib::Ctxt> batch(2, helib::Ctxt(publicKey));
+  for (helib::Ctxt& ctxt : batch)
+    ptxt.encrypt(ctxt);
+
+  bool workerThrew = false;
+  std::thread worker([&] {
+    std::vector<helib::Ctxt> share;
+    try {
+      helib::distributedApply(*endpoints[1],
+                              share,
+                              publicKey,
+                              [](std::vector<helib::Ctxt>&) {
+                                throw helib::LogicError("worker failed");
+                              });
+    } catch (const helib::LogicError&) {
+      workerThrew = true;
+    }
+  });
+  EXPECT_THROW(helib::distributedApply(*endpoints[0],
+                                       batch,
+                                       publicKey,
+                                       [](std::vector<helib::Ctxt>&) {}),
+               helib::LogicError);
+  worker.join();
+  EXPECT_TRUE(workerThrew);
+}
+
+TEST(TestCtxtPowerOfTwo, decryptBatchReducesModThePlaintextSpace)
+{
+  // With m a power of two, DecryptBatch never lifts the coefficients
+  // modulo the product of the primes
+  helib::Context context = helib::ContextBuilder<helib::BGV>()
+                               .m(128)
+                               .p(257)
+                               .r(1)
+                               .bits(300)
+                               .build();
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  helib::addSome1DMatrices(secretKey);
+  const helib::PubKey& publicKey = secretKey;
+
+  std::vector<helib::PtxtArray> arrays(4, helib::PtxtArray(context));
+  std::vector<helib::Ctxt> ctxts(arrays.size(), helib::Ctxt(publicKey));
+  for (std::size_t i = 0; i < arrays.size(); i++) {
+    arrays[i].random();
+    arrays[i].encrypt(ctxts[i]);
+  }
+  ctxts[0].multLowLvl(ctxts[1]);
+  ctxts[2].multiplyBy(ctxts[3]);
+
+  std::vector<helib::PtxtArray> decrypted;
+  secretKey.DecryptBatch(decrypted, ctxts);
+
+  ASSERT_EQ(decrypted.size(), ctxts.size());
+  for (std::size_t i = 0; i < ctxts.size(); i++) {
+    helib::PtxtArray expected(context);
+    expected.decrypt(ctxts[i], secretKey);
+    EXPECT_EQ(decrypted[i], expected);
+  }
+}
+
 TEST_P(TestCtxt, mapTo01WorksCorrectlyForConstantInputs)
 {
   std::vector<long> data(ea.size());
@@ -188,6 +681,63 @@ TEST_P(TestCtxt, mapTo01WorksCorrectlyForNonConstantInputs)
   EXPECT_EQ(ptxt, result);
 }
 
+TEST_P(TestCtxt, mapTo01GivesTheSameResultOnOneOrManyThreads)
+{
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 0);
+  for (auto& num : data)
+    num %= p;
+  helib::Ptxt<helib::BGV> ptxt(context, data);
+  helib::Ctxt ctxt1(publicKey);
+  publicKey.Encrypt(ctxt1, ptxt);
+  helib::Ctxt ctxt2(ctxt1);
+  mapTo01(ea, ctxt1, /*multithread=*/false);
+  mapTo01(ea, ctxt2, /*multithread=*/true);
+
+  helib::Ptxt<helib::BGV> result1(context), result2(context);
+  secretKey.Decrypt(result1, ctxt1);
+  secretKey.Decrypt(result2, ctxt2);
+  EXPECT_EQ(result1, result2);
+}
+
+TEST_P(TestCtxt, incrementalZeroTestOfManyCiphertextsWorks)
+{
+  if (p != 2 || r != 1)
+    return; // only implemented for p=2, r=1
+  const long d = ea.getDegree();
+  const long n = std::min(3L, d);
+
+  // Slot s of ciphertext c holds the polynomial with bits s+c mod 2^n
+  std::vector<helib::Ctxt> ctxts(2, helib::Ctxt(publicKey));
+  std::vector<std::vector<long>> bits(ctxts.size());
+  for (std::size_t c = 0; c < ctxts.size(); c++) {
+    std::vector<NTL::ZZX> slots(ea.size());
+    for (long s = 0; s < ea.size(); s++) {
+      bits[c].push_back((s + c) % (1L << n));
+      for (long j = 0; j < n; j++)
+        NTL::SetCoeff(slots[s], j, (bits[c][s] >> j) & 1);
+    }
+    publicKey.Encrypt(ctxts[c], helib::Ptxt<helib::BGV>(context, slots));
+  }
+
+  std::vector<std::vector<helib::Ctxt>> res;
+  incrementalZeroTest(res, ea, ctxts, n);
+  ASSERT_EQ(res.size(), ctxts.size());
+
+  for (std::size_t c = 0; c < ctxts.size(); c++) {
+    ASSERT_EQ(helib::lsize(res[c]), n);
+    for (long i = 0; i < n; i++) {
+      std::vector<long> expected(ea.size());
+      for (long s = 0; s < ea.size(); s++)
+        expected[s] = (bits[c][s] & ((2L << i) - 1)) ? 1 : 0;
+      helib::Ptxt<helib::BGV> result(context);
+      secretKey.Decrypt(result, res[c][i]);
+      EXPECT_EQ(helib::Ptxt<helib::BGV>(context, expected), result)
+          << "ciphertext " << c << ", bits 0.." << i;
+    }
+  }
+}
+
 TEST_P(TestCtxtWithBadDimensions,
        frobeniusAutomorphWorksCorrectlyWithBadDimensions)
 {
@@ -253,6 +803,879 @@ TEST_P(TestCtxtWithBadDimensions, rotate1DRotatesCorrectlyWithBadDimensions)
   }
 }
 
+TEST_P(TestCtxtWithBadDimensions, rotate1DWithCachedMasksAndHoistingIsCorrect)
+{
+  // With all the 1D matrices, both automorphisms of a bad rotation have
+  // matrices of their own and are hoisted
+  helib::SecKey fullKey(context);
+  fullKey.GenSecKey();
+  helib::add1DMatrices(fullKey);
+  const helib::PubKey& fullPubKey = fullKey;
+
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 0);
+  helib::Ptxt<helib::BGV> ptxt(context, data);
+  helib::Ctxt ctxt(fullPubKey);
+  fullPubKey.Encrypt(ctxt, ptxt);
+  helib::IndexSet fewerPrimes = ctxt.getPrimeSet();
+  fewerPrimes.remove(fewerPrimes.last());
+
+  for (long i = 0; i < context.getZMStar().numOfGens(); ++i) {
+    if (ea.nativeDimension(i))
+      continue;
+    for (long amt = 1; amt < ea.sizeOfDimension(i); ++amt) {
+      helib::Ptxt<helib::BGV> expected_result(ptxt);
+      expected_result.rotate1D(i, amt);
+
+      // The second rotation at each prime set reuses the cached mask
+      for (long rep = 0; rep < 4; ++rep) {
+        helib::Ctxt tmp(ctxt);
+        if (rep >= 2)
+          tmp.modDownToSet(fewerPrimes);
+        ea.rotate1D(tmp, i, amt);
+        helib::Ptxt<helib::BGV> result(context);
+        fullKey.Decrypt(result, tmp);
+        EXPECT_EQ(expected_result, result)
+            << "rotate1D failed with i=" << i << ", amt=" << amt
+            << ", rep=" << rep;
+      }
+    }
+  }
+}
+
+// Check totalSums and runningSums with a fan-out against those of the
+// plaintext, for a few fan-outs
+static void checkSumsWithFanOut(const helib::EncryptedArray& ea,
+                                const helib::PubKey& publicKey,
+                                const helib::SecKey& secretKey)
+{
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 1);
+  helib::Ptxt<helib::BGV> ptxt(ea.getContext(), data);
+  helib::Ctxt ctxt(publicKey);
+  publicKey.Encrypt(ctxt, ptxt);
+
+  helib::Ptxt<helib::BGV> total(ptxt);
+  total.totalSums();
+  helib::Ptxt<helib::BGV> running(ptxt);
+  running.runningSums();
+
+  for (long fanOut : {2, 3, 8}) {
+    helib::Ctxt tmp(ctxt);
+    helib::totalSums(ea, tmp, fanOut);
+    helib::Ptxt<helib::BGV> result(ea.getContext());
+    secretKey.Decrypt(result, tmp);
+    EXPECT_EQ(total, result) << "totalSums failed with fanOut=" << fanOut;
+
+    tmp = ctxt;
+    helib::runningSums(ea, tmp, fanOut);
+    secretKey.Decrypt(result, tmp);
+    EXPECT_EQ(running, result) << "runningSums failed with fanOut=" << fanOut;
+  }
+}
+
+TEST_P(TestCtxt, sumsWithFanOutMatchThePlaintextSums)
+{
+  checkSumsWithFanOut(ea, publicKey, secretKey);
+}
+
+TEST_P(TestCtxtWithBadDimensions, sumsWithFanOutMatchThePlaintextSums)
+{
+  checkSumsWithFanOut(ea, publicKey, secretKey);
+}
+
+TEST_P(TestCtxt, packedSlotsUnpackToTheirSources)
+{
+  long n = ea.size();
+  long width = std::max(1L, n / 4);
+  long count = std::min(3L, n / width);
+
+  std::vector<helib::Ctxt> ctxts(count, helib::Ctxt(publicKey));
+  std::vector<long> expected(n, 0);
+  for (long i = 0; i < count; i++) {
+    std::vector<long> data(n);
+    for (long j = 0; j < n; j++)
+      data[j] = 7 * i + j + 1;
+    for (long j = 0; j < width; j++)
+      expected[i * width + j] = data[j];
+    publicKey.Encrypt(ctxts[i], helib::Ptxt<helib::BGV>(context, data));
+  }
+
+  helib::Ctxt packed(publicKey);
+  helib::packSlots(ea, packed, ctxts, width);
+  helib::Ptxt<helib::BGV> result(context);
+  secretKey.Decrypt(result, packed);
+  EXPECT_EQ(result, helib::Ptxt<helib::BGV>(context, expected));
+
+  std::vector<helib::Ctxt> unpacked;
+  helib::unpackSlots(ea, unpacked, packed, count, width);
+  ASSERT_EQ(helib::lsize(unpacked), count);
+  for (long i = 0; i < count; i++) {
+    std::vector<long> slots(n, 0);
+    for (long j = 0; j < width; j++)
+      slots[j] = expected[i * width + j];
+    secretKey.Decrypt(result, unpacked[i]);
+    EXPECT_EQ(result, helib::Ptxt<helib::BGV>(context, slots)) << "i=" << i;
+  }
+}
+
+TEST_P(TestCtxt, convolutionsMatchThePlaintextConvolution)
+{
+  long n = ea.size();
+  long width = std::max(1L, long(std::sqrt(double(n))));
+  long height = n / width;
+  long kh = 3, kw = 3;
+  long p = context.getP();
+
+  std::vector<std::vector<long>> images(2, std::vector<long>(n, 0));
+  std::vector<helib::Ctxt> in(2, helib::Ctxt(publicKey));
+  for (long c = 0; c < 2; c++) {
+    for (long i = 0; i < height * width; i++)
+      images[c][i] = (5 * c + 3 * i + 1) % p;
+    publicKey.Encrypt(in[c], helib::Ptxt<helib::BGV>(context, images[c]));
+  }
+
+  // weights[k][c], with a zero tap to skip
+  std::vector<std::vector<std::vector<double>>> weights(
+      3,
+      std::vector<std::vector<double>>(2, std::vector<double>(kh * kw)));
+  for (long k = 0; k < 3; k++)
+    for (long c = 0; c < 2; c++)
+      for (long t = 0; t < kh * kw; t++)
+        weights[k][c][t] = (k + 2 * c + t) % 4 - 1;
+
+  auto convolve = [&](long k, long c, const std::vector<double>& kernel) {
+    std::vector<long> result(n, 0);
+    for (long i = 0; i < height; i++)
+      for (long j = 0; j < width; j++)
+        for (long u = 0; u < kh; u++)
+          for (long v = 0; v < kw; v++) {
+            long r = i + u - kh / 2, s = j + v - kw / 2;
+            if (r >= 0 && r < height && s >= 0 && s < width)
+              result[i * width + j] +=
+                  long(kernel[u * kw + v]) * images[c][r * width + s];
+          }
+    return result;
+  };
+
+  helib::Conv2D conv(ea, height, width, kh, kw, weights);
+  std::vector<helib::Ctxt> out;
+  conv.apply(out, in);
+  ASSERT_EQ(helib::lsize(out), 3);
+  helib::Ptxt<helib::BGV> result(context);
+  for (long k = 0; k < 3; k++) {
+    std::vector<long> expected(n, 0);
+    for (long c = 0; c < 2; c++) {
+      std::vector<long> term = convolve(k, c, weights[k][c]);
+      for (long i = 0; i < n; i++)
+        expected[i] += term[i];
+    }
+    secretKey.Decrypt(result, out[k]);
+    EXPECT_EQ(result, helib::Ptxt<helib::BGV>(context, expected)) << "k=" << k;
+  }
+
+  helib::Conv2D depthwise =
+      helib::Conv2D::depthwise(ea, height, width, kh, kw, weights[0]);
+  depthwise.apply(out, in);
+  ASSERT_EQ(helib::lsize(out), 2);
+  for (long c = 0; c < 2; c++) {
+    secretKey.Decrypt(result, out[c]);
+    EXPECT_EQ(result,
+              helib::Ptxt<helib::BGV>(context, convolve(0, c, weights[0][c])))
+        << "c=" << c;
+  }
+
+  // Pooling 2x2 windows of the part of the image that they tile
+  long ph = height - height % 2, pw = width - width % 2;
+  if (ph > 0 && pw > 0) {
+    std::vector<long> image(n, 0), expected(n, 0);
+    for (long i = 0; i < ph; i++)
+      for (long j = 0; j < pw; j++) {
+        image[i * pw + j] = images[0][i * width + j];
+        expected[(i - i % 2) * pw + (j - j % 2)] += image[i * pw + j];
+      }
+    helib::Ctxt pooled(publicKey);
+    publicKey.Encrypt(pooled, helib::Ptxt<helib::BGV>(context, image));
+    helib::avgPool2D(ea, pooled, ph, pw, 2);
+    secretKey.Decrypt(result, pooled);
+    EXPECT_EQ(result, helib::Ptxt<helib::BGV>(context, expected));
+  }
+}
+
+TEST_P(TestCtxt, encryptedMatrixProductsMatchThePlaintextProducts)
+{
+  long d = std::min(4L, long(std::sqrt(double(ea.size()))));
+  helib::CtxtMatMul matmul(ea, d);
+  long n = d * d;
+
+  // 2 x 2 blocks of d x d matrices, and the blocks of their product
+  const long blocks = 2;
+  std::vector<std::vector<long>> a(blocks * blocks), b(blocks * blocks);
+  std::vector<helib::Ctxt> ca, cb;
+  for (long i = 0; i < blocks * blocks; i++) {
+    a[i].assign(ea.size(), 0);
+    b[i].assign(ea.size(), 0);
+    for (long j = 0; j < n; j++) {
+      a[i][j] = NTL::RandomBnd(p);
+      b[i][j] = NTL::RandomBnd(p);
+    }
+    ca.emplace_back(publicKey);
+    cb.emplace_back(publicKey);
+    publicKey.Encrypt(ca.back(), helib::Ptxt<helib::BGV>(context, a[i]));
+    publicKey.Encrypt(cb.back(), helib::Ptxt<helib::BGV>(context, b[i]));
+  }
+  auto product = [&](long I, long J) {
+    std::vector<long> c(ea.size(), 0);
+    for (long K = 0; K < blocks; K++)
+      for (long i = 0; i < d; i++)
+        for (long j = 0; j < d; j++)
+          for (long k = 0; k < d; k++)
+            c[i * d + j] = (c[i * d + j] + a[I * blocks + K][i * d + k] *
+                                               b[K * blocks + J][k * d + j]) %
+                           long(p);
+    return helib::Ptxt<helib::BGV>(context, c);
+  };
+
+  // One block
+  helib::Ctxt single(publicKey);
+  matmul.mul(single, ca[0], cb[0]);
+  helib::Ptxt<helib::BGV> result(context);
+  secretKey.Decrypt(result, single);
+  std::vector<long> expected(ea.size(), 0);
+  for (long i = 0; i < d; i++)
+    for (long j = 0; j < d; j++)
+      for (long k = 0; k < d; k++)
+        expected[i * d + j] =
+            (expected[i * d + j] + a[0][i * d + k] * b[0][k * d + j]) % long(p);
+  EXPECT_EQ(result, helib::Ptxt<helib::BGV>(context, expected));
+
+  // All the blocks
+  std::vector<helib::Ctxt> cc;
+  matmul.mul(cc, ca, cb, blocks, blocks, blocks);
+  ASSERT_EQ(cc.size(), std::size_t(blocks * blocks));
+  for (long I = 0; I < blocks; I++)
+    for (long J = 0; J < blocks; J++) {
+      secretKey.Decrypt(result, cc[I * blocks + J]);
+      EXPECT_EQ(result, product(I, J)) << "block (" << I << ", " << J << ")";
+    }
+}
+
+TEST_P(TestCtxt, fullMatrixProductsAreTheSameInEveryEvaluationOrder)
+{
+  std::unique_ptr<helib::MatMulFull> mat(helib::buildRandomFullMatrix(ea));
+  std::unique_ptr<helib::BlockMatMulFull> blockMat(
+      helib::buildRandomFullBlockMatrix(ea));
+  helib::MatMulFullExec exec(*mat);
+  helib::BlockMatMulFullExec blockExec(*blockMat);
+
+  helib::PtxtArray v(ea);
+  v.random();
+  helib::Ctxt ctxt(publicKey);
+  v.encrypt(ctxt);
+
+  helib::PtxtArray expected = v;
+  helib::PtxtArray expectedBlock = v;
+  helib::mul(expected, *mat);
+  helib::mul(expectedBlock, *blockMat);
+
+  // One dimension after the other (in parallel with several threads), then
+  // flat
+  for (bool flat : {false, true}) {
+    exec.flat = flat;
+    blockExec.flat = flat;
+
+    helib::Ctxt result = ctxt;
+    exec.mul(result);
+    helib::PtxtArray decrypted(ea);
+    decrypted.decrypt(result, secretKey);
+    EXPECT_TRUE(decrypted == expected) << "flat=" << flat;
+
+    result = ctxt;
+    blockExec.mul(result);
+    decrypted.decrypt(result, secretKey);
+    EXPECT_TRUE(decrypted == expectedBlock) << "flat=" << flat;
+  }
+}
+
+TEST_P(TestCtxt, deferredAutomorphsSwitchKeysOncePerKeyWhenMultiplied)
+{
+  // A few automorphisms with a matrix straight to the base key
+  std::vector<long> ks;
+  for (long k = 2; k < context.getM() && ks.size() < 3; k++)
+    if (context.getZMStar().inZmStar(k) &&
+        publicKey.haveKeySWmatrix(1, k, 0, 0))
+      ks.push_back(k);
+  if (ks.empty())
+    return; // nothing to defer with these keys
+
+  helib::PtxtArray v(ea);
+  v.random();
+  helib::Ctxt ctxt(publicKey);
+  v.encrypt(ctxt);
+
+  // Every automorphism twice, so the parts of the same key are merged
+  helib::Ctxt lazy(publicKey);
+  helib::Ctxt eager(publicKey);
+  for (int copy = 0; copy < 2; copy++)
+    for (long k : ks) {
+      helib::Ctxt term = ctxt;
+      term.deferredAutomorph(k);
+      EXPECT_EQ(term.numDeferredKeySwitches(), 1);
+      lazy += term;
+
+      term = ctxt;
+      term.smartAutomorph(k);
+      EXPECT_EQ(term.numDeferredKeySwitches(), 0);
+      eager += term;
+    }
+  EXPECT_EQ(lazy.numDeferredKeySwitches(), helib::lsize(ks));
+
+  helib::PtxtArray expected(ea);
+  helib::PtxtArray decrypted(ea);
+  expected.decrypt(eager, secretKey);
+  decrypted.decrypt(lazy, secretKey);
+  EXPECT_TRUE(decrypted == expected);
+
+  lazy.multiplyBy(ctxt);
+  eager.multiplyBy(ctxt);
+  EXPECT_EQ(lazy.numDeferredKeySwitches(), 0);
+  EXPECT_TRUE(lazy.inCanonicalForm());
+  expected.decrypt(eager, secretKey);
+  decrypted.decrypt(lazy, secretKey);
+  EXPECT_TRUE(decrypted == expected);
+}
+
+TEST_P(TestCtxt, encryptionAtACapacityUsesFewerPrimes)
+{
+  helib::PtxtArray v(ea);
+  v.random();
+  helib::Ctxt full(publicKey);
+  v.encrypt(full);
+
+  long target = full.bitCapacity() / 3;
+  helib::Ctxt reduced(publicKey);
+  v.encryptAtCapacity(reduced, target);
+
+  EXPECT_TRUE(reduced.getPrimeSet() <= context.getCtxtPrimes());
+  EXPECT_LT(reduced.getPrimeSet().card(), full.getPrimeSet().card());
+  EXPECT_GE(reduced.bitCapacity(), target);
+
+  helib::PtxtArray decrypted(ea);
+  decrypted.decrypt(reduced, secretKey);
+  EXPECT_TRUE(decrypted == v);
+
+  // More capacity than there is takes all the primes
+  v.encryptAtCapacity(reduced, full.bitCapacity() + 100);
+  EXPECT_EQ(reduced.getPrimeSet(), context.getCtxtPrimes());
+  decrypted.decrypt(reduced, secretKey);
+  EXPECT_TRUE(decrypted == v);
+}
+
+TEST_P(TestCtxt, cachedConstantsAreTransformedOncePerPrimeSet)
+{
+  helib::PtxtArray v(ea), w(ea);
+  v.random();
+  w.random();
+  helib::EncodedPtxt eptxt;
+  w.encode(eptxt);
+  helib::EncodedPtxtCache cache(eptxt);
+
+  helib::Ctxt ctxt(publicKey);
+  v.encrypt(ctxt);
+  helib::Ctxt lower = ctxt;
+  lower.dropToCapacity(lower.bitCapacity() / 2);
+  ASSERT_TRUE(lower.getPrimeSet() <= ctxt.getPrimeSet());
+  ASSERT_LT(lower.getPrimeSet().card(), ctxt.getPrimeSet().card());
+
+  // The form made for the top level also serves the lower one
+  helib::PtxtArray expected = v;
+  expected *= w;
+  for (helib::Ctxt* c : {&ctxt, &lower, &ctxt}) {
+    helib::Ctxt product = *c;
+    product.multByConstant(cache);
+    helib::PtxtArray decrypted(ea);
+    decrypted.decrypt(product, secretKey);
+    EXPECT_TRUE(decrypted == expected);
+  }
+  EXPECT_EQ(cache.misses(), 1);
+  EXPECT_EQ(cache.hits(), 2);
+  EXPECT_EQ(cache.size(), 1);
+
+  // With no room, only the last form made is kept
+  helib::EncodedPtxtCache small(eptxt, 0);
+  helib::Ctxt product = lower;
+  product.multByConstant(small);
+  product = ctxt;
+  product.multByConstant(small);
+  EXPECT_EQ(small.size(), 1);
+  EXPECT_EQ(small.misses(), 2);
+  helib::PtxtArray decrypted(ea);
+  decrypted.decrypt(product, secretKey);
+  EXPECT_TRUE(decrypted == expected);
+}
+
+TEST_P(TestCtxt, sharedCopiesOfCiphertextsAreIndependent)
+{
+  helib::PtxtArray v(ea), w(ea);
+  v.random();
+  w.random();
+  helib::Ctxt ctxt(publicKey);
+  v.encrypt(ctxt);
+
+  helib::Ctxt copy(helib::SharedCopy, ctxt);
+  EXPECT_TRUE(copy == ctxt);
+
+  helib::PtxtArray decrypted(ea);
+  copy.multByConstant(w);
+  decrypted.decrypt(ctxt, secretKey);
+  EXPECT_TRUE(decrypted == v);
+
+  helib::PtxtArray expected = v;
+  expected *= w;
+  decrypted.decrypt(copy, secretKey);
+  EXPECT_TRUE(decrypted == expected);
+
+  // A shared copy that is overwritten whole
+  helib::Ctxt placeholder(helib::SharedCopy, ctxt);
+  placeholder = copy;
+  decrypted.decrypt(placeholder, secretKey);
+  EXPECT_TRUE(decrypted == expected);
+  decrypted.decrypt(ctxt, secretKey);
+  EXPECT_TRUE(decrypted == v);
+}
+
+TEST_P(TestCtxt, lookupByInterpolationMatchesTheTable)
+{
+  long p = context.getP();
+  long p2r = context.getAlMod().getPPowR();
+  long size = std::min(p, 16L);
+  std::vector<long> table(size);
+  for (long& entry : table)
+    entry = NTL::RandomBnd(p2r);
+  NTL::ZZX poly;
+  helib::buildLookupPoly(poly, table, ea);
+  EXPECT_LT(NTL::deg(poly), size);
+
+  std::vector<std::vector<long>> indices(2, std::vector<long>(ea.size()));
+  std::vector<helib::Ctxt> ctxts(2, helib::Ctxt(publicKey));
+  for (long t = 0; t < 2; t++) {
+    for (long& index : indices[t])
+      index = NTL::RandomBnd(size);
+    ea.encrypt(ctxts[t], publicKey, indices[t]);
+  }
+
+  helib::Ctxt out(publicKey);
+  helib::tableLookupPoly(out, poly, ctxts[0]);
+  std::vector<helib::Ctxt> outs;
+  helib::tableLookupPoly(outs, poly, ctxts);
+  ASSERT_EQ(outs.size(), 2);
+
+  std::vector<long> decrypted;
+  ea.decrypt(out, secretKey, decrypted);
+  for (long i = 0; i < ea.size(); i++)
+    EXPECT_EQ(decrypted[i], table[indices[0][i]]) << "slot " << i;
+  for (long t = 0; t < 2; t++) {
+    ea.decrypt(outs[t], secretKey, decrypted);
+    for (long i = 0; i < ea.size(); i++)
+      EXPECT_EQ(decrypted[i], table[indices[t][i]]) << "slot " << i;
+  }
+
+  std::vector<long> tooLong(p + 1, 0);
+  EXPECT_THROW(helib::buildLookupPoly(poly, tooLong, ea),
+               helib::InvalidArgument);
+}
+
+TEST_P(TestCtxt, cachedAutomorphChainsComposeToTheirAutomorphism)
+{
+  long m = context.getM();
+  for (long k = 2; k < m; k++) {
+    if (!context.getZMStar().inZmStar(k) || !publicKey.isReachable(k))
+      continue;
+    const std::vector<long>& chain = publicKey.getAutomorphChain(k);
+    long product = 1;
+    for (long amt : chain) {
+      EXPECT_TRUE(publicKey.haveKeySWmatrix(1, amt, 0, 0)) << "k=" << k;
+      product = NTL::MulMod(product, amt, m);
+    }
+    EXPECT_EQ(product, k);
+    EXPECT_EQ(&publicKey.getAutomorphChain(k + m), &chain)
+        << "the chain of k=" << k << " is not cached";
+  }
+  EXPECT_TRUE(publicKey.getAutomorphChain(1).empty());
+}
+
+TEST_P(TestCtxt, hoistedAutomorphsMatchSmartAutomorph)
+{
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 0);
+  helib::Ptxt<helib::BGV> ptxt(context, data);
+  helib::Ctxt ctxt(publicKey);
+  publicKey.Encrypt(ctxt, ptxt);
+
+  const helib::PAlgebra& zMStar = context.getZMStar();
+  std::vector<long> ks;
+  for (long i = 0; i < zMStar.numOfGens(); ++i)
+    for (long e = 1; e < std::min(zMStar.OrderOf(i), 4l); ++e)
+      ks.push_back(zMStar.genToPow(i, e));
+  ks.push_back(1);
+
+  std::vector<helib::Ctxt> results;
+  ctxt.hoistedAutomorphs(ks, results);
+  ASSERT_EQ(results.size(), ks.size());
+
+  for (std::size_t i = 0; i < ks.size(); ++i) {
+    helib::Ctxt expected_ctxt(ctxt);
+    expected_ctxt.smartAutomorph(ks[i]);
+    helib::Ptxt<helib::BGV> expected_result(context);
+    secretKey.Decrypt(expected_result, expected_ctxt);
+    helib::Ptxt<helib::BGV> result(context);
+    secretKey.Decrypt(result, results[i]);
+
+    EXPECT_EQ(expected_result, result)
+        << "Hoisted automorph failed with k=" << ks[i] << std::endl;
+  }
+}
+
+TEST_P(TestCtxt, asyncOperationsMatchBlockingOnes)
+{
+#ifdef HELIB_THREADS
+  helib::SetTaskThreads(4);
+#endif
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 0);
+  helib::Ptxt<helib::BGV> ptxt1(context, data);
+  std::reverse(data.begin(), data.end());
+  helib::Ptxt<helib::BGV> ptxt2(context, data);
+  helib::Ctxt ctxt1(publicKey);
+  helib::Ctxt ctxt2(publicKey);
+  publicKey.Encrypt(ctxt1, ptxt1);
+  publicKey.Encrypt(ctxt2, ptxt2);
+
+  // Two independent operations, then one on both of their results
+  auto product = helib::async::multiply(ctxt1, ctxt2);
+  auto rotated = helib::async::rotate(ctxt1, 1);
+  auto sum = helib::async::add(helib::async::get(product),
+                               helib::async::get(rotated));
+  helib::Ctxt result = sum.get();
+
+  helib::Ctxt expected_ctxt(ctxt1);
+  expected_ctxt.multiplyBy(ctxt2);
+  helib::Ctxt rotated_ctxt(ctxt1);
+  helib::rotate(rotated_ctxt, 1);
+  expected_ctxt += rotated_ctxt;
+
+  helib::Ptxt<helib::BGV> decrypted_result(context);
+  helib::Ptxt<helib::BGV> expected_result(context);
+  secretKey.Decrypt(decrypted_result, result);
+  secretKey.Decrypt(expected_result, expected_ctxt);
+  EXPECT_EQ(decrypted_result, expected_result);
+
+  // Exceptions are rethrown by get()
+  auto bad = helib::async::automorph(ctxt1, context.getM());
+  EXPECT_ANY_THROW(bad.get());
+#ifdef HELIB_THREADS
+  helib::SetTaskThreads(1);
+#endif
+}
+
+TEST_P(TestCtxt, operationCountsTrackTheExpensivePrimitives)
+{
+  helib::Ptxt<helib::BGV> ptxt(context, std::vector<long>(ea.size(), 3));
+  helib::Ctxt ctxt1(publicKey);
+  publicKey.Encrypt(ctxt1, ptxt);
+  helib::Ctxt ctxt2(ctxt1);
+
+  const helib::fhe_op_snapshot before = helib::snapshot_op_counts();
+  ctxt1.multiplyBy(ctxt2);
+  helib::rotate(ctxt1, 1);
+  const helib::fhe_op_snapshot counts = helib::snapshot_op_counts() - before;
+
+  EXPECT_EQ(counts.reLinearizations.total, 1);
+  EXPECT_GE(counts.keySwitchParts.total, 2);
+  EXPECT_GE(counts.automorphs.total, 1);
+  EXPECT_GE(counts.keySwitches, 2);
+  EXPECT_GT(counts.ntts, 0);
+  EXPECT_EQ(counts.ntts, counts.ffts + counts.iffts);
+  for (const helib::fhe_op_count* count : {&counts.keySwitchParts,
+                                           &counts.automorphs,
+                                           &counts.reLinearizations}) {
+    long sum = 0;
+    for (long n : count->byPrimes)
+      sum += n;
+    EXPECT_EQ(sum, count->total);
+    // Nothing runs with more primes than the context has
+    long maxPrimes = helib::lsize(count->byPrimes);
+    for (long n = context.numPrimes() + 1; n < maxPrimes; ++n)
+      EXPECT_EQ(count->byPrimes[n], 0);
+  }
+
+  helib::reset_op_counts();
+  const helib::fhe_op_snapshot zero = helib::snapshot_op_counts();
+  EXPECT_EQ(zero.ntts, 0);
+  EXPECT_EQ(zero.keySwitchParts.total, 0);
+}
+
+TEST_P(TestCtxt, opHookSeesCapacityNoiseAndPrimes)
+{
+  helib::Ptxt<helib::BGV> ptxt(context, std::vector<long>(ea.size(), 3));
+  helib::Ctxt ctxt1(publicKey);
+  publicKey.Encrypt(ctxt1, ptxt);
+  helib::Ctxt ctxt2(ctxt1);
+
+  std::mutex mutex;
+  std::vector<helib::CtxtOpReport> reports;
+  helib::setCtxtOpHook([&](const helib::CtxtOpReport& report) {
+    std::lock_guard<std::mutex> lock(mutex);
+    reports.push_back(report);
+  });
+  double capacity = ctxt1.capacity();
+  ctxt1.multiplyBy(ctxt2);
+  helib::setCtxtOpHook(nullptr);
+  ctxt1.multiplyBy(ctxt2); // no longer traced
+
+  // The outermost operation is reported last, after the ones it called
+  ASSERT_FALSE(reports.empty());
+  const helib::CtxtOpReport& mul = reports.back();
+  EXPECT_STREQ(mul.op, "multiplyBy");
+  EXPECT_EQ(mul.ctxt, &ctxt1);
+  EXPECT_EQ(mul.depth, 0);
+  EXPECT_DOUBLE_EQ(mul.capacityBefore, capacity);
+  EXPECT_LT(mul.capacityAfter, mul.capacityBefore);
+  EXPECT_GT(mul.noiseAfter, 0);
+  EXPECT_GT(mul.primesBefore, 0);
+  EXPECT_LE(mul.primesAfter, mul.primesBefore);
+
+  bool sawReLinearize = false;
+  for (const helib::CtxtOpReport& report : reports) {
+    if (report.depth == 0)
+      EXPECT_EQ(&report, &mul);
+    if (std::string(report.op) == "reLinearize") {
+      sawReLinearize = true;
+      EXPECT_GE(report.depth, 1);
+    }
+  }
+  EXPECT_TRUE(sawReLinearize);
+}
+
+TEST_P(TestCtxt, lazySmartAutomorphStaysOverTheSpecialPrimes)
+{
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 0);
+  helib::Ptxt<helib::BGV> ptxt(context, data);
+  helib::Ctxt ctxt(publicKey);
+  publicKey.Encrypt(ctxt, ptxt);
+
+  const helib::PAlgebra& zMStar = context.getZMStar();
+  long k1 = zMStar.genToPow(0, 1);
+  long k2 = zMStar.genToPow(0, 2);
+
+  // A hoisted rotation is still defined over the special primes
+  helib::BasicAutomorphPrecon precon(ctxt);
+  std::shared_ptr<helib::Ctxt> rotated = precon.automorph(k1);
+  ASSERT_TRUE(context.getSpecialPrimes() <= rotated->getPrimeSet());
+
+  helib::Ctxt lazy(*rotated);
+  lazy.lazySmartAutomorph(k2);
+  EXPECT_TRUE(context.getSpecialPrimes() <= lazy.getPrimeSet());
+
+  // Two of them can be added before coming down
+  helib::Ctxt other(lazy);
+  lazy += other;
+  lazy.cleanUp();
+
+  helib::Ctxt expected_ctxt(ctxt);
+  expected_ctxt.smartAutomorph(k1);
+  expected_ctxt.smartAutomorph(k2);
+  expected_ctxt.multByConstant(NTL::ZZ(2));
+
+  helib::Ptxt<helib::BGV> expected_result(context);
+  secretKey.Decrypt(expected_result, expected_ctxt);
+  helib::Ptxt<helib::BGV> result(context);
+  secretKey.Decrypt(result, lazy);
+  EXPECT_EQ(expected_result, result);
+}
+
+TEST_P(TestCtxt, multiplyAccumulateMatchesSumOfProducts)
+{
+  const long n = 4;
+  std::vector<helib::Ptxt<helib::BGV>> xs, ys;
+  std::vector<helib::Ctxt> cxs, cys;
+  for (long i = 0; i < n; ++i) {
+    std::vector<long> xdata(ea.size()), ydata(ea.size());
+    for (long j = 0; j < ea.size(); ++j) {
+      xdata[j] = (i + j) % p;
+      ydata[j] = (3 * i + 2 * j + 1) % p;
+    }
+    xs.emplace_back(context, xdata);
+    ys.emplace_back(context, ydata);
+    cxs.emplace_back(publicKey);
+    cys.emplace_back(publicKey);
+    publicKey.Encrypt(cxs.back(), xs.back());
+    publicKey.Encrypt(cys.back(), ys.back());
+  }
+
+  helib::Ptxt<helib::BGV> expected(context);
+  helib::Ctxt acc(publicKey);
+  for (long i = 0; i < n; ++i) {
+    helib::Ptxt<helib::BGV> term(xs[i]);
+    term *= ys[i];
+    expected += term;
+    acc.multiplyAccumulate(cxs[i], cys[i]);
+  }
+  // A squared term, with both factors the same object
+  helib::Ptxt<helib::BGV> square(xs[0]);
+  square *= xs[0];
+  expected += square;
+  acc.multiplyAccumulate(cxs[0], cxs[0]);
+
+  // The degree-2 part is only key-switched once, at the end
+  EXPECT_FALSE(acc.inCanonicalForm());
+  acc.reLinearize();
+  EXPECT_TRUE(acc.inCanonicalForm());
+
+  helib::Ptxt<helib::BGV> result(context);
+  secretKey.Decrypt(result, acc);
+  EXPECT_EQ(result, expected);
+
+  helib::Ctxt ip(publicKey);
+  helib::innerProduct(ip, cxs, cys);
+  secretKey.Decrypt(result, ip);
+  expected -= square;
+  EXPECT_EQ(result, expected);
+}
+
+TEST_P(TestCtxt, movingMultiplicationsMatchCopyingOnes)
+{
+  std::vector<long> xdata(ea.size()), ydata(ea.size());
+  for (long j = 0; j < ea.size(); ++j) {
+    xdata[j] = j % p;
+    ydata[j] = (2 * j + 1) % p;
+  }
+  helib::Ptxt<helib::BGV> x(context, xdata), y(context, ydata);
+  helib::Ctxt cx(publicKey), cy(publicKey);
+  publicKey.Encrypt(cx, x);
+  publicKey.Encrypt(cy, y);
+  // Different levels, so that the multiplication must change one of them
+  cy.dropSmallAndSpecialPrimes();
+  cy.modDownToSet(cy.naturalPrimeSet());
+
+  helib::Ctxt copied(cx);
+  copied.multiplyBy(cy);
+
+  helib::Ctxt moved(cx), factor(cy);
+  moved.multiplyBy(std::move(factor));
+  EXPECT_EQ(moved.getPrimeSet(), copied.getPrimeSet());
+
+  helib::Ctxt chained = helib::Ctxt(cx) * cy * cx;
+
+  helib::Ptxt<helib::BGV> expected(x), result(context);
+  expected *= y;
+  secretKey.Decrypt(result, copied);
+  EXPECT_EQ(result, expected);
+  secretKey.Decrypt(result, moved);
+  EXPECT_EQ(result, expected);
+  expected *= x;
+  secretKey.Decrypt(result, chained);
+  EXPECT_EQ(result, expected);
+}
+
+TEST_P(TestCtxt, materializedKeySwitchAGivesTheSameCiphertexts)
+{
+  helib::Ptxt<helib::BGV> ptxt(context, std::vector<long>(ea.size(), 3));
+  helib::Ctxt x(publicKey), y(publicKey);
+  publicKey.Encrypt(x, ptxt);
+  publicKey.Encrypt(y, ptxt);
+
+  std::stringstream seeded;
+  publicKey.writeTo(seeded);
+
+  auto squareAndRotate = [&](const helib::Ctxt& in) {
+    helib::Ctxt out(in);
+    out.multiplyBy(y);
+    ea.rotate(out, 1);
+    return out;
+  };
+  helib::Ctxt expected = squareAndRotate(x);
+
+  publicKey.materializeKeySwitchA();
+  for (const helib::KeySwitch& W : publicKey.keySWlist())
+    EXPECT_NE(W.getExpandedA(), nullptr);
+  EXPECT_EQ(squareAndRotate(x), expected);
+
+  // Only the seeds are serialized
+  std::stringstream materialized;
+  publicKey.writeTo(materialized);
+  EXPECT_EQ(materialized.str(), seeded.str());
+
+  publicKey.releaseKeySwitchA();
+  for (const helib::KeySwitch& W : publicKey.keySWlist())
+    EXPECT_EQ(W.getExpandedA(), nullptr);
+  EXPECT_EQ(squareAndRotate(x), expected);
+}
+
+TEST_P(TestCtxt, parallelKeySwitchGenerationDoesNotDependOnThreads)
+{
+  const long savedThreads = NTL::AvailableThreads();
+  auto generate = [&](long nThreads) {
+    helib::SecKey sk(context);
+    NTL::SetNumThreads(savedThreads);
+    NTL::SetSeed(NTL::ZZ(17));
+    sk.GenSecKey();
+    NTL::SetNumThreads(nThreads);
+    addFrbMatrices(sk);
+    addSome1DMatrices(sk);
+    return sk.keySWlist();
+  };
+
+  std::vector<helib::KeySwitch> serial = generate(1);
+  std::vector<helib::KeySwitch> parallel = generate(4);
+  NTL::SetNumThreads(savedThreads);
+  EXPECT_EQ(serial, parallel);
+}
+
+TEST_P(TestCtxt, recordedMatricesSufficeForTheRecordedComputation)
+{
+  auto compute = [this](helib::Ctxt& ctxt) {
+    ea.rotate(ctxt, 1);
+    ea.rotate(ctxt, -2);
+    ctxt.frobeniusAutomorph(1);
+  };
+
+  helib::SecKey minimal(context);
+  minimal.GenSecKey();
+  std::set<long> used;
+  {
+    helib::KeySwitchRecorder recorder(publicKey);
+    helib::Ctxt ctxt(publicKey);
+    publicKey.Encrypt(ctxt, helib::Ptxt<helib::BGV>(context));
+    compute(ctxt);
+    used = recorder.automorphisms();
+    addRecordedMatrices(minimal, recorder);
+  }
+  EXPECT_FALSE(used.empty());
+  EXPECT_LT(used.size(), publicKey.keySWlist().size());
+
+  std::set<long> generated;
+  for (const helib::KeySwitch& W : minimal.keySWlist())
+    if (W.fromKey.getPowerOfS() == 1)
+      generated.insert(W.fromKey.getPowerOfX());
+  EXPECT_EQ(generated, used);
+
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 0);
+  helib::Ptxt<helib::BGV> ptxt(context, data);
+  helib::Ctxt x(minimal), y(publicKey);
+  minimal.Encrypt(x, ptxt);
+  publicKey.Encrypt(y, ptxt);
+  compute(x);
+  compute(y);
+
+  helib::Ptxt<helib::BGV> fromMinimal(context), fromFull(context);
+  minimal.Decrypt(fromMinimal, x);
+  secretKey.Decrypt(fromFull, y);
+  EXPECT_EQ(fromMinimal, fromFull);
+}
+
 // Use this when thoroughly exploring an (m, p) grid of parameters.
 // std::vector<BGVParameters> getParameters(bool good)
 // {
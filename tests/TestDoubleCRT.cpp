@@ -0,0 +1,1219 @@
+/* Copyright (C) 2019-2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <helib/helib.h>
+#include <helib/FlatDoubleCRT.h>
+#include <helib/bluestein.h>
+
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+#include "../src/BluesteinNTT.h"     // Private header
+#include "../src/PrimeFactorFFT.h"   // Private header
+#include "../src/RNSBaseConverter.h" // Private header
+#include "../src/simdKernels.h"      // Private header
+
+namespace {
+
+class TestDoubleCRT : public ::testing::Test
+{
+protected:
+  helib::Context context;
+
+  TestDoubleCRT() :
+      context(helib::ContextBuilder<helib::BGV>()
+                  .m(1023)
+                  .p(2)
+                  .r(1)
+                  .bits(200)
+                  .build())
+  {}
+};
+
+TEST_F(TestDoubleCRT, flatDoubleCRTRoundTripsDoubleCRT)
+{
+  helib::IndexSet s = context.fullPrimes();
+  helib::DoubleCRT d(context, s);
+  d.randomize();
+
+  helib::FlatDoubleCRT flat(d);
+  EXPECT_EQ(flat.getIndexSet(), s);
+  EXPECT_EQ(flat.getRowLength(), context.getPhiM());
+
+  helib::DoubleCRT back = flat.toDoubleCRT();
+  EXPECT_EQ(back, d);
+}
+
+TEST_F(TestDoubleCRT, flatDoubleCRTRowsAreCacheLineAligned)
+{
+  helib::FlatDoubleCRT flat(context, context.getCtxtPrimes());
+  EXPECT_EQ(flat.getStride() * sizeof(long) % helib::FlatDoubleCRT::ALIGNMENT,
+            0ul);
+  for (long i : context.getCtxtPrimes()) {
+    auto row = flat[i];
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(row.data()) %
+                  helib::FlatDoubleCRT::ALIGNMENT,
+              0ul);
+    EXPECT_EQ(row.length(), context.getPhiM());
+  }
+}
+
+TEST_F(TestDoubleCRT, flatDoubleCRTArithmeticMatchesDoubleCRT)
+{
+  helib::IndexSet s = context.getCtxtPrimes();
+  helib::DoubleCRT a(context, s), b(context, s), c(context, s);
+  a.randomize();
+  b.randomize();
+  c.randomize();
+
+  helib::FlatDoubleCRT fa(a), fb(b), fc(c);
+
+  helib::FlatDoubleCRT sum(fa);
+  sum += fb;
+  helib::DoubleCRT expected(a);
+  expected += b;
+  EXPECT_EQ(sum.toDoubleCRT(), expected);
+
+  helib::FlatDoubleCRT diff(fa);
+  diff -= fb;
+  expected = a;
+  expected -= b;
+  EXPECT_EQ(diff.toDoubleCRT(), expected);
+
+  helib::FlatDoubleCRT prod(fa);
+  prod *= fb;
+  expected = a;
+  expected *= b;
+  EXPECT_EQ(prod.toDoubleCRT(), expected);
+
+  // c + a*b
+  fc.addMul(fa, fb);
+  expected += c;
+  EXPECT_EQ(fc.toDoubleCRT(), expected);
+}
+
+TEST_F(TestDoubleCRT, flatDoubleCRTCopyIsDeep)
+{
+  helib::DoubleCRT d(context, context.getCtxtPrimes());
+  d.randomize();
+
+  helib::FlatDoubleCRT flat(d);
+  helib::FlatDoubleCRT copy(flat);
+  copy.setZero();
+
+  EXPECT_EQ(flat.toDoubleCRT(), d);
+  helib::DoubleCRT zero(context, context.getCtxtPrimes());
+  EXPECT_EQ(copy.toDoubleCRT(), zero);
+}
+
+TEST_F(TestDoubleCRT, flatDoubleCRTRejectsMismatchedIndexSets)
+{
+  helib::FlatDoubleCRT a(context, context.getCtxtPrimes());
+  helib::FlatDoubleCRT b(context, context.fullPrimes());
+  EXPECT_THROW(a += b, helib::RuntimeError);
+}
+
+TEST_F(TestDoubleCRT, mulAddMatchesMulThenAdd)
+{
+  helib::IndexSet s = context.getCtxtPrimes();
+  helib::DoubleCRT acc(context, s), a(context, context.fullPrimes()),
+      b(context, context.fullPrimes());
+  acc.randomize();
+  a.randomize();
+  b.randomize();
+
+  helib::DoubleCRT expected(a);
+  expected.removePrimes(context.getSpecialPrimes());
+  expected *= b;
+  expected += acc;
+
+  acc.mulAdd(a, b);
+  EXPECT_EQ(acc.getIndexSet(), s);
+  EXPECT_EQ(acc, expected);
+}
+
+TEST_F(TestDoubleCRT, innerProductMatchesSumOfProducts)
+{
+  helib::IndexSet s = context.fullPrimes();
+  for (long n : {0, 1, 3, 7}) {
+    std::vector<helib::DoubleCRT> a(n, helib::DoubleCRT(context, s));
+    // b may be longer than a
+    std::vector<helib::DoubleCRT> b(n + 1, helib::DoubleCRT(context, s));
+    for (auto& x : a)
+      x.randomize();
+    for (auto& x : b)
+      x.randomize();
+
+    helib::DoubleCRT expected(context, s);
+    for (long i = 0; i < n; i++) {
+      helib::DoubleCRT tmp(a[i]);
+      tmp *= b[i];
+      expected += tmp;
+    }
+
+    helib::DoubleCRT result(context, s);
+    result.randomize(); // previous content must be overwritten
+    result.innerProduct(a, b);
+    EXPECT_EQ(result, expected) << "n = " << n;
+  }
+}
+
+TEST_F(TestDoubleCRT, innerProductRejectsShortKeyVector)
+{
+  helib::IndexSet s = context.getCtxtPrimes();
+  std::vector<helib::DoubleCRT> a(2, helib::DoubleCRT(context, s));
+  std::vector<helib::DoubleCRT> b(1, helib::DoubleCRT(context, s));
+  helib::DoubleCRT result(context, s);
+  EXPECT_THROW(result.innerProduct(a, b), helib::RuntimeError);
+}
+
+TEST_F(TestDoubleCRT, addPrimesFastMatchesExactLiftOfSmallPolys)
+{
+  NTL::ZZX f;
+  for (long i = 0; i < context.getPhiM(); i++)
+    SetCoeff(f, i, NTL::RandomBnd(2001) - 1000);
+
+  for (const helib::IndexSet& s :
+       {context.getCtxtPrimes(), context.getDigit(0), context.getDigit(1)}) {
+    helib::IndexSet rest = context.fullPrimes() / s;
+    helib::DoubleCRT exact(f, context, s);
+    exact.addPrimes(rest);
+
+    helib::DoubleCRT fast(f, context, s);
+    fast.addPrimesFast(rest);
+    EXPECT_EQ(fast.getIndexSet(), context.fullPrimes());
+    EXPECT_EQ(fast, exact);
+  }
+}
+
+TEST_F(TestDoubleCRT, rnsScaleDownMatchesTheBigIntegerScaleDown)
+{
+  const helib::IndexSet& dropped = context.getSpecialPrimes();
+  NTL::xdouble prod = NTL::conv<NTL::xdouble>(context.productOfPrimes(dropped));
+  for (long ptxtSpace : {1L, 2L, 257L}) {
+    helib::DoubleCRT x(context, context.fullPrimes());
+    x.randomize();
+
+    helib::DoubleCRT exact(x);
+    NTL::ZZX delta;
+    exact.scaleDownToSet(context.getCtxtPrimes(), ptxtSpace, delta);
+
+    helib::DoubleCRT fast(x);
+    std::vector<double> fdelta;
+    fast.scaleDownToSet(context.getCtxtPrimes(), ptxtSpace, fdelta);
+
+    EXPECT_EQ(fast.getIndexSet(), context.getCtxtPrimes());
+    EXPECT_EQ(fast, exact);
+    ASSERT_EQ(helib::lsize(fdelta), context.getPhiM());
+    for (long i = 0; i < context.getPhiM(); i++) {
+      double expected = NTL::conv<double>(
+          NTL::conv<NTL::xdouble>(NTL::coeff(delta, i)) / prod);
+      EXPECT_NEAR(fdelta[i], expected, 1e-6);
+      EXPECT_LE(std::fabs(fdelta[i]), ptxtSpace / 2.0 + 1e-6);
+    }
+  }
+}
+
+TEST_F(TestDoubleCRT, sharedRowsAreCopiedOnTheFirstWrite)
+{
+  helib::DoubleCRT x(context, context.getCtxtPrimes());
+  x.randomize();
+  helib::DoubleCRT original(x);
+
+  helib::DoubleCRT copy(context, helib::IndexSet());
+  copy.share(x);
+  EXPECT_EQ(copy, x);
+  for (long i : x.getIndexSet())
+    EXPECT_TRUE(x.getMap().isShared(i));
+
+  // A change to the copy leaves x alone, and only detaches what it touches
+  long first = context.getCtxtPrimes().first();
+  copy.removePrimes(helib::IndexSet(first));
+  copy += original;
+  EXPECT_EQ(x, original);
+  EXPECT_FALSE(x.getMap().isShared(first));
+  for (long i : copy.getIndexSet())
+    EXPECT_FALSE(copy.getMap().isShared(i));
+
+  helib::DoubleCRT doubled(original);
+  doubled += original;
+  doubled.removePrimes(helib::IndexSet(first));
+  EXPECT_EQ(copy, doubled);
+
+  // And the other way around
+  copy.share(x);
+  x.SetZero();
+  EXPECT_EQ(copy, original);
+}
+
+TEST_F(TestDoubleCRT, batchedFFTMatchesOneTransformAtATime)
+{
+  // More polynomials than fit in one run, and a constant among them
+  std::vector<helib::zzX> polys(11);
+  for (helib::zzX& f : polys) {
+    f.SetLength(context.getPhiM());
+    for (long& c : f)
+      c = NTL::RandomBnd(2001) - 1000;
+  }
+  polys[3].SetLength(1);
+
+  std::vector<helib::DoubleCRT> batch;
+  helib::DoubleCRT::FFTBatch(batch, polys, context, context.getCtxtPrimes());
+
+  ASSERT_EQ(batch.size(), polys.size());
+  for (std::size_t k = 0; k < polys.size(); k++) {
+    helib::DoubleCRT expected(polys[k], context, context.getCtxtPrimes());
+    EXPECT_EQ(batch[k].getIndexSet(), context.getCtxtPrimes());
+    EXPECT_EQ(batch[k], expected);
+  }
+}
+
+TEST_F(TestDoubleCRT, digitsRecombineToTheValueTheyWereBrokenFrom)
+{
+  helib::DoubleCRT x(context, context.getCtxtPrimes());
+  x.randomize();
+
+  std::vector<helib::DoubleCRT> digits;
+  x.breakIntoDigits(digits);
+  ASSERT_GT(digits.size(), 1u);
+
+  // x = sum_i digits[i] * prod_{j<i} P_j, with P_j the product of digit j
+  helib::DoubleCRT sum(context, x.getIndexSet());
+  NTL::ZZ weight(1);
+  for (std::size_t i = 0; i < digits.size(); i++) {
+    EXPECT_EQ(digits[i].getIndexSet(),
+              context.getCtxtPrimes() | context.getSpecialPrimes());
+    helib::DoubleCRT term = digits[i];
+    term.removePrimes(term.getIndexSet() / x.getIndexSet());
+    term *= weight;
+    sum += term;
+    weight *= context.productOfPrimes(context.getDigit(i));
+  }
+  EXPECT_EQ(sum, x);
+}
+
+TEST_F(TestDoubleCRT, addPrimesFastLiftsToTheBalancedRepresentative)
+{
+  helib::IndexSet s = context.getDigit(0);
+  helib::IndexSet rest = context.fullPrimes() / s;
+  helib::DoubleCRT d(context, s);
+  d.randomize();
+
+  NTL::ZZX poly;
+  d.toPoly(poly); // the balanced lift, mod the product of the primes in s
+
+  helib::DoubleCRT fast(d);
+  fast.addPrimesFast(rest);
+
+  // The result is exact except with negligible probability
+  helib::DoubleCRT expected(poly, context, context.fullPrimes());
+  EXPECT_EQ(fast, expected);
+}
+
+TEST_F(TestDoubleCRT, toPolyModMatchesReducingTheExactLift)
+{
+  NTL::ZZX f;
+  for (long i = 0; i < context.getPhiM(); i++)
+    SetCoeff(f, i, NTL::RandomBnd(2001) - 1000);
+  helib::DoubleCRT d(f, context, context.getCtxtPrimes());
+
+  for (long modulus : {2l, 257l, 1l << 40}) {
+    helib::zzX poly;
+    d.toPolyMod(poly, modulus);
+
+    NTL::ZZX expected = f;
+    helib::PolyRed(expected, modulus, /*abs=*/true);
+    NTL::ZZX actual;
+    helib::convert(actual, poly);
+    EXPECT_EQ(actual, expected);
+  }
+}
+
+TEST_F(TestDoubleCRT, baseConvertersAreCachedInTheContext)
+{
+  auto a = context.getBaseConverter(context.getCtxtPrimes(),
+                                    context.getSpecialPrimes());
+  auto b = context.getBaseConverter(context.getCtxtPrimes(),
+                                    context.getSpecialPrimes());
+  auto c = context.getBaseConverter(context.getSpecialPrimes(),
+                                    context.getCtxtPrimes());
+  EXPECT_EQ(a, b);
+  EXPECT_NE(a, c);
+  EXPECT_EQ(a->getFrom(), context.getCtxtPrimes());
+  EXPECT_EQ(a->getTo(), context.getSpecialPrimes());
+}
+
+TEST_F(TestDoubleCRT, baseConvertersPastTheCacheBoundAreBuiltAfresh)
+{
+  // Every way of splitting some of the primes between from and to, until
+  // there are more pairs than the cache keeps
+  std::vector<long> primes;
+  for (long i : context.fullPrimes())
+    primes.push_back(i);
+  long n = primes.size();
+  long pairs = 0;
+  std::vector<long> digits(n, 0); // 0: unused, 1: in from, 2: in to
+  std::pair<helib::IndexSet, helib::IndexSet> first, last;
+  while (pairs <= helib::Context::MAX_CACHED_BASE_CONVERTERS) {
+    long d = 0;
+    for (; d < n && digits[d] == 2; d++)
+      digits[d] = 0;
+    ASSERT_LT(d, n) << "too few primes for the test";
+    digits[d]++;
+
+    helib::IndexSet from, to;
+    for (long j = 0; j < n; j++) {
+      if (digits[j] == 1)
+        from.insert(primes[j]);
+      else if (digits[j] == 2)
+        to.insert(primes[j]);
+    }
+    if (helib::empty(from) || helib::empty(to))
+      continue;
+    auto conv = context.getBaseConverter(from, to);
+    EXPECT_EQ(conv->getFrom(), from);
+    EXPECT_EQ(conv->getTo(), to);
+    if (pairs == 0)
+      first = {from, to};
+    last = {from, to};
+    pairs++;
+  }
+
+  EXPECT_NE(context.getBaseConverter(last.first, last.second),
+            context.getBaseConverter(last.first, last.second));
+  EXPECT_EQ(context.getBaseConverter(first.first, first.second),
+            context.getBaseConverter(first.first, first.second));
+}
+
+TEST_F(TestDoubleCRT, automorphMatchesPolynomialAutomorphism)
+{
+  long m = context.getM();
+  NTL::ZZX f;
+  for (long i = 0; i < context.getPhiM(); i++)
+    SetCoeff(f, i, NTL::RandomBnd(2001) - 1000);
+
+  for (long k : {2L, 5L, m - 1}) {
+    // g(X) = f(X^k) mod (X^m - 1, Phi_m(X))
+    NTL::ZZX g;
+    for (long i = 0; i <= deg(f); i++)
+      SetCoeff(g, (i * k) % m, coeff(f, i));
+    NTL::rem(g, g, context.getZMStar().getPhimX());
+
+    helib::DoubleCRT d(f, context, context.fullPrimes());
+    d.automorph(k);
+    EXPECT_EQ(d, helib::DoubleCRT(g, context, context.fullPrimes()))
+        << "k = " << k;
+  }
+}
+
+TEST_F(TestDoubleCRT, automorphIsInvertedByInverseAutomorph)
+{
+  // More values of k than MAX_CACHED_AUTOMORPHS, to also go through the
+  // uncached path
+  const helib::PAlgebra& zMStar = context.getZMStar();
+  long m = zMStar.getM();
+  helib::DoubleCRT d(context, context.getCtxtPrimes());
+  d.randomize();
+
+  for (long k = 1; k < m; k++) {
+    if (!zMStar.inZmStar(k))
+      continue;
+    helib::DoubleCRT e(d);
+    e.automorph(k);
+    e.automorph(NTL::InvMod(k, m));
+    EXPECT_EQ(e, d) << "k = " << k;
+  }
+}
+
+TEST_F(TestDoubleCRT, automorphPermutationsAreCachedInTheContext)
+{
+  auto a = context.getAutomorphPermutation(3);
+  auto b = context.getAutomorphPermutation(3 + context.getM());
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(long(a->size()), context.getPhiM());
+  EXPECT_THROW(context.getAutomorphPermutation(3 * 11),
+               helib::InvalidArgument);
+}
+
+TEST_F(TestDoubleCRT, indexedRandomizeRowsOnlyDependOnTheirPrime)
+{
+  NTL::ZZ seed = NTL::conv<NTL::ZZ>("123456789123456789");
+  helib::IndexSet fewer = context.getCtxtPrimes();
+  fewer.remove(fewer.first());
+
+  helib::DoubleCRT all(context, context.fullPrimes());
+  helib::DoubleCRT some(context, fewer);
+  NTL::SetSeed(NTL::ZZ(1));
+  all.randomize(seed, 3);
+  NTL::SetSeed(NTL::ZZ(2)); // NTL's PRG state does not matter
+  some.randomize(seed, 3);
+  for (long i : fewer)
+    EXPECT_EQ(all.getMap()[i], some.getMap()[i]) << "prime " << i;
+
+  helib::DoubleCRT other(context, fewer);
+  other.randomize(seed, 4);
+  EXPECT_NE(other, some);
+  for (long i : fewer)
+    for (long j = 0; j < context.getPhiM(); j++) {
+      EXPECT_GE(other.getMap()[i][j], 0);
+      EXPECT_LT(other.getMap()[i][j], context.ithPrime(i));
+    }
+}
+
+TEST_F(TestDoubleCRT, keySwitchLegacySeedsKeepTheirSequentialStream)
+{
+  helib::KeySwitch W;
+  NTL::RandomBits(W.prgSeed, 256);
+  EXPECT_FALSE(W.hasIndexedSeed());
+
+  std::vector<helib::DoubleCRT> a(3,
+                                  helib::DoubleCRT(context,
+                                                   context.fullPrimes()));
+  W.generateA(a);
+  std::vector<helib::DoubleCRT> expected = a;
+  {
+    helib::RandomState state;
+    NTL::SetSeed(W.prgSeed);
+    for (helib::DoubleCRT& e : expected)
+      e.randomize();
+  }
+  EXPECT_EQ(a, expected);
+
+  W.newPRGSeed();
+  EXPECT_TRUE(W.hasIndexedSeed());
+  helib::DoubleCRT a1(context, context.getCtxtPrimes());
+  std::vector<helib::DoubleCRT> b(2, a1);
+  W.generateA(b);
+  a1.randomize(W.prgSeed, 1);
+  EXPECT_EQ(b[1], a1);
+}
+
+TEST_F(TestDoubleCRT, keySwitchIndexedSeedsAreRejectedByOlderReaders)
+{
+  // Older readers expect every matrix between the "|KM[" eye catchers,
+  // and would derive the a_i's of an indexed seed from a single stream
+  helib::KeySwitch legacy;
+  NTL::RandomBits(legacy.prgSeed, 256);
+  helib::KeySwitch indexed;
+  indexed.newPRGSeed();
+
+  std::stringstream legacyStr, indexedStr;
+  legacy.writeTo(legacyStr);
+  indexed.writeTo(indexedStr);
+  EXPECT_EQ(legacyStr.str().substr(0, 4), "|KM[");
+  EXPECT_EQ(indexedStr.str().substr(0, 4), "|KI[");
+
+  EXPECT_EQ(helib::KeySwitch::readFrom(legacyStr, context), legacy);
+  helib::KeySwitch back = helib::KeySwitch::readFrom(indexedStr, context);
+  EXPECT_EQ(back, indexed);
+  EXPECT_TRUE(back.hasIndexedSeed());
+
+  // An indexed seed in the older format is not taken for a legacy one
+  std::string forged = indexedStr.str();
+  forged.replace(0, 4, "|KM[");
+  std::istringstream forgedStr(forged);
+  EXPECT_THROW(helib::KeySwitch::readFrom(forgedStr, context),
+               helib::IOError);
+
+  std::stringstream packedStr;
+  indexed.writePackedTo(packedStr);
+  EXPECT_EQ(packedStr.str().substr(0, 4), "|KI[");
+  EXPECT_EQ(helib::KeySwitch::readPackedFrom(packedStr, context), indexed);
+
+  // In JSON, indexed seeds go under a key older readers do not look for
+  std::stringstream json;
+  indexed.writeToJSON(json);
+  EXPECT_EQ(json.str().find("\"prgSeed\""), std::string::npos);
+  EXPECT_NE(json.str().find("\"indexedPrgSeed\""), std::string::npos);
+  EXPECT_EQ(helib::KeySwitch::readFromJSON(json, context), indexed);
+}
+
+TEST_F(TestDoubleCRT, temporariesReuseRowsFromTheScratchPool)
+{
+  helib::IndexSet s = context.fullPrimes();
+  helib::DoubleCRT d(context, s);
+  d.randomize();
+
+  // Warm up the pool of this thread, then count
+  { helib::DoubleCRT tmp(d); }
+  helib::ScratchPoolStats before = helib::ScratchPool::threadStats();
+  for (long i = 0; i < 10; i++) {
+    helib::DoubleCRT tmp(d);
+    tmp *= d;
+    EXPECT_EQ(tmp.getIndexSet(), s);
+  }
+  helib::ScratchPoolStats after = helib::ScratchPool::threadStats();
+
+  EXPECT_EQ(after.hits - before.hits, 10 * card(s));
+  EXPECT_EQ(after.misses, before.misses);
+  EXPECT_EQ(after.returned - before.returned, 10 * card(s));
+  EXPECT_GE(helib::ScratchPool::totalStats().hits, after.hits);
+}
+
+TEST_F(TestDoubleCRT, recycledRowsDoNotLeakValues)
+{
+  helib::IndexSet s = context.getCtxtPrimes();
+  {
+    helib::DoubleCRT d(context, s);
+    d.randomize();
+  } // its rows go back to the pool
+  helib::DoubleCRT zero(context, s);
+  helib::DoubleCRT expected(NTL::ZZX(), context, s);
+  EXPECT_EQ(zero, expected);
+
+  helib::DoubleCRT a(context, s);
+  a.randomize();
+  helib::DoubleCRT b(context, helib::IndexSet::emptySet());
+  b = a; // different index sets, so rows come from the pool
+  EXPECT_EQ(b, a);
+}
+
+TEST_F(TestDoubleCRT, pooledRowsCanBeZeroedOnAcquire)
+{
+  long n = context.getPhiM();
+  NTL::vec_long v;
+  helib::ScratchPool::acquire(v, n);
+  for (long j = 0; j < n; j++)
+    v[j] = j + 1;
+  helib::ScratchPool::release(v);
+
+  helib::ScratchPoolStats before = helib::ScratchPool::threadStats();
+  NTL::vec_long w;
+  helib::ScratchPool::acquire(w, n, /*zero=*/true);
+  ASSERT_EQ(helib::ScratchPool::threadStats().hits - before.hits, 1);
+  ASSERT_EQ(w.length(), n);
+  for (long j = 0; j < n; j++)
+    EXPECT_EQ(w[j], 0) << "j = " << j;
+  helib::ScratchPool::release(w);
+}
+
+TEST_F(TestDoubleCRT, fullScratchPoolDropsRows)
+{
+  long oldMax = helib::ScratchPool::getMaxBytesPerThread();
+  helib::ScratchPool::clear();
+  helib::ScratchPool::setMaxBytesPerThread(0);
+
+  helib::ScratchPoolStats before = helib::ScratchPool::threadStats();
+  { helib::DoubleCRT tmp(context, context.getCtxtPrimes()); }
+  helib::ScratchPoolStats after = helib::ScratchPool::threadStats();
+
+  NTL::vec_long v;
+  v.SetLength(context.getPhiM());
+  helib::ScratchPool::release(v); // dropped, but still emptied
+  EXPECT_EQ(v.length(), 0);
+  helib::ScratchPool::setMaxBytesPerThread(oldMax);
+
+  long n = card(context.getCtxtPrimes());
+  EXPECT_EQ(after.misses - before.misses, n);
+  EXPECT_EQ(after.dropped - before.dropped, n);
+  EXPECT_EQ(after.returned, before.returned);
+}
+
+TEST_F(TestDoubleCRT, memoryReportChargesRowsToTheirOwners)
+{
+  using helib::MemoryCategory;
+  long rowBytes = context.getPhiM() * sizeof(long);
+  helib::MemoryReport before = context.memoryReport();
+
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  helib::MemoryReport keys = context.memoryReport();
+  EXPECT_GT(keys[MemoryCategory::KEYS].bytes,
+            before[MemoryCategory::KEYS].bytes);
+  // The parts of the public encryption key count as keys
+  EXPECT_EQ(keys[MemoryCategory::CIPHERTEXTS].bytes,
+            before[MemoryCategory::CIPHERTEXTS].bytes);
+
+  {
+    helib::Ctxt ctxt(secretKey);
+    secretKey.Encrypt(ctxt, NTL::ZZX(1));
+    helib::Ctxt copy(ctxt);
+    helib::MemoryReport live = context.memoryReport();
+    const helib::MemoryUsage& now = live[MemoryCategory::CIPHERTEXTS];
+    const helib::MemoryUsage& was = keys[MemoryCategory::CIPHERTEXTS];
+    EXPECT_EQ(now.objects - was.objects, 4);
+    EXPECT_EQ(now.rows - was.rows, 4 * card(ctxt.getPrimeSet()));
+    EXPECT_EQ(now.bytes - was.bytes, (now.rows - was.rows) * rowBytes);
+  }
+  helib::MemoryReport after = context.memoryReport();
+  EXPECT_EQ(after[MemoryCategory::CIPHERTEXTS].bytes,
+            keys[MemoryCategory::CIPHERTEXTS].bytes);
+  EXPECT_EQ(after[MemoryCategory::CIPHERTEXTS].objects,
+            keys[MemoryCategory::CIPHERTEXTS].objects);
+}
+
+TEST_F(TestDoubleCRT, memoryScopesNestAndAssignmentsKeepTheirOwner)
+{
+  using helib::MemoryCategory;
+  helib::IndexSet s = context.getCtxtPrimes();
+  long rowBytes = context.getPhiM() * sizeof(long);
+  helib::MemoryReport before = context.memoryReport();
+  {
+    helib::MemoryScope outer(MemoryCategory::MATMUL_CACHE);
+    helib::MemoryScope inner(MemoryCategory::KEYS);
+    helib::DoubleCRT d(context, s);
+    EXPECT_EQ(d.getMemoryCategory(), MemoryCategory::MATMUL_CACHE);
+    helib::MemoryReport report = context.memoryReport();
+    EXPECT_EQ(report[MemoryCategory::MATMUL_CACHE].bytes -
+                  before[MemoryCategory::MATMUL_CACHE].bytes,
+              card(s) * rowBytes);
+    EXPECT_EQ(report[MemoryCategory::MATMUL_CACHE].objects -
+                  before[MemoryCategory::MATMUL_CACHE].objects,
+              1);
+  }
+  EXPECT_EQ(helib::MemoryScope::current(), MemoryCategory::OTHER);
+
+  helib::DoubleCRT a(context, s);
+  helib::DoubleCRT copy(a);
+  EXPECT_EQ(copy.getMemoryCategory(), MemoryCategory::OTHER);
+  helib::DoubleCRT b(context, helib::IndexSet::emptySet());
+  b.setMemoryCategory(MemoryCategory::BOOTSTRAPPING);
+  b = a; // different index sets, so the map of a is copied
+  EXPECT_EQ(b.getMemoryCategory(), MemoryCategory::BOOTSTRAPPING);
+  helib::MemoryReport report = context.memoryReport();
+  EXPECT_EQ(report[MemoryCategory::BOOTSTRAPPING].bytes -
+                before[MemoryCategory::BOOTSTRAPPING].bytes,
+            card(s) * rowBytes);
+  EXPECT_EQ(report[MemoryCategory::MATMUL_CACHE].bytes,
+            before[MemoryCategory::MATMUL_CACHE].bytes);
+}
+
+TEST_F(TestDoubleCRT, movedFromDoubleCRTsCanBeAssignedTo)
+{
+  using helib::MemoryCategory;
+  helib::IndexSet s = context.getCtxtPrimes();
+  helib::DoubleCRT a(context, s), b(context, s);
+  a.randomize();
+  b.randomize();
+  a.setMemoryCategory(MemoryCategory::BOOTSTRAPPING);
+  const helib::DoubleCRT a0(a), b0(b);
+
+  // Through a moved-from temporary, as std::swap does
+  std::swap(a, b);
+  EXPECT_EQ(a, b0);
+  EXPECT_EQ(b, a0);
+
+  // A moved-from object takes the category of what it is assigned
+  helib::DoubleCRT moved(std::move(a));
+  a = a0;
+  EXPECT_EQ(a, a0);
+  EXPECT_EQ(a.getMemoryCategory(), MemoryCategory::BOOTSTRAPPING);
+  helib::DoubleCRT other(std::move(b));
+  b = std::move(moved);
+  EXPECT_EQ(b, b0);
+}
+
+TEST_F(TestDoubleCRT, flatCopiesGoToHugePagesByTheirCategory)
+{
+  using helib::MemoryCategory;
+  long savedMinBytes = helib::HugePagePolicy::getMinBytes();
+  helib::HugePagePolicy::setMinBytes(0); // the rows here are small
+
+  helib::DoubleCRT key(context, context.fullPrimes());
+  key.setMemoryCategory(MemoryCategory::KEYS);
+  key.randomize();
+  helib::FlatDoubleCRT flatKey(key);
+  EXPECT_EQ(flatKey.getMemoryCategory(), MemoryCategory::KEYS);
+  EXPECT_EQ(flatKey.toDoubleCRT(), key);
+  // Which huge pages, if any, depends on the system. Ciphertexts never get
+  // any by default.
+  helib::DoubleCRT part(context, context.fullPrimes());
+  part.setMemoryCategory(MemoryCategory::CIPHERTEXTS);
+  helib::FlatDoubleCRT flatPart(part);
+  EXPECT_EQ(flatPart.getHugePageKind(), helib::HugePageKind::NONE);
+
+  helib::HugePageStats stats = helib::hugePageStats();
+  helib::HugePageKind kind = flatKey.getHugePageKind();
+  EXPECT_GE(stats.buffers[int(kind)], 1);
+  helib::FlatDoubleCRT copy(flatKey);
+  EXPECT_EQ(copy.getHugePageKind(), kind);
+  EXPECT_EQ(helib::hugePageStats().buffers[int(kind)],
+            stats.buffers[int(kind)] + 1);
+
+  helib::HugePagePolicy::setMinBytes(savedMinBytes);
+}
+
+TEST_F(TestDoubleCRT, keySwitchingWithMatricesInHugePagesIsUnchanged)
+{
+  long savedMinBytes = helib::HugePagePolicy::getMinBytes();
+  helib::HugePagePolicy::setMinBytes(0);
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  helib::addSome1DMatrices(secretKey);
+
+  helib::KeySwitch resident = secretKey.keySWlist().front();
+  helib::KeySwitch moved(resident);
+  helib::MemoryReport before = context.memoryReport();
+  EXPECT_TRUE(moved.moveToHugePages());
+  EXPECT_FALSE(moved.moveToHugePages()); // already mapped, left as it is
+  // The buffer is charged to the keys, as the rows it replaces were
+  EXPECT_EQ(context.memoryReport()[helib::MemoryCategory::KEYS].bytes,
+            before[helib::MemoryCategory::KEYS].bytes);
+  EXPECT_TRUE(moved.isMapped());
+  EXPECT_TRUE(moved.b.empty());
+  EXPECT_EQ(moved, resident);
+
+  // The rows of the digits modulo a prime follow each other, and the primes
+  // follow each other, rows padded to cache lines
+  const std::vector<helib::IndexMap<const long*>>& cols = moved.getMappedB();
+  long stride = (context.getPhiM() + 7) / 8 * 8;
+  const long* next = cols[0][cols[0].getIndexSet().first()];
+  for (long i : cols[0].getIndexSet())
+    for (const helib::IndexMap<const long*>& col : cols) {
+      EXPECT_EQ(col[i], next);
+      next += stride;
+    }
+
+  // Rotate, which goes through the rows in their new place
+  const helib::EncryptedArray& ea = context.getEA();
+  helib::PtxtArray values(ea);
+  values.random();
+  helib::Ctxt ctxt(secretKey);
+  values.encrypt(ctxt);
+  secretKey.moveKeySwitchToHugePages();
+  ea.rotate(ctxt, 1);
+  helib::PtxtArray expected(values);
+  rotate(expected, 1);
+  helib::PtxtArray decrypted(ea);
+  decrypted.decrypt(ctxt, secretKey);
+  EXPECT_EQ(decrypted, expected);
+
+  helib::HugePagePolicy::setMinBytes(savedMinBytes);
+}
+
+// Find a prime q = 1 (mod 2n) of about the given size, and a primitive
+// 2n-th root of unity modulo q
+static void findNTTPrime(long bits, long n, long& q, long& psi)
+{
+  long step = 2 * n;
+  q = ((1L << bits) / step) * step + 1;
+  while (!NTL::ProbPrime(q))
+    q += step;
+
+  for (long g = 2;; g++) {
+    psi = NTL::PowerMod(g, (q - 1) / step, q);
+    if (NTL::PowerMod(psi, n, q) == q - 1)
+      return;
+  }
+}
+
+TEST(TestNativeSIMD, nttMatchesNegacyclicEvaluation)
+{
+  for (long logn : {1, 3, 4, 9}) {
+    long n = 1L << logn;
+    long q, psi;
+    findNTTPrime(helib::simd::IFMA_MODULUS_BITS - 1, n, q, psi);
+    helib::simd::NTTTables tables(n, q, psi);
+
+    std::vector<long> a(n);
+    for (long& x : a)
+      x = NTL::RandomBnd(q);
+
+    for (bool enable : {false, true}) {
+      helib::simd::setEnabled(enable);
+      std::vector<long> y(a);
+      tables.forward(y.data());
+
+      // y[j] = a(psi^{2 brv(j) + 1})
+      for (long j = 0; j < n; j++) {
+        long brv = 0;
+        for (long b = 0; b < logn; b++)
+          if ((j >> b) & 1)
+            brv |= 1L << (logn - 1 - b);
+        long e = NTL::PowerMod(psi, 2 * brv + 1, q);
+        long val = 0;
+        for (long i = n - 1; i >= 0; i--)
+          val = NTL::AddMod(NTL::MulMod(val, e, q), a[i], q);
+        EXPECT_EQ(y[j], val) << "n = " << n << ", j = " << j;
+      }
+
+      tables.inverse(y.data());
+      EXPECT_EQ(y, a) << "n = " << n;
+    }
+  }
+  helib::simd::setEnabled(true);
+}
+
+TEST(TestNativeSIMD, splitNTTsMatchSerialOnes)
+{
+  for (long bits : {helib::simd::IFMA_MODULUS_BITS - 1, 55L})
+    for (long logn : {1, 2, 5, 10, 11}) {
+      long n = 1L << logn;
+      long q, psi;
+      findNTTPrime(bits, n, q, psi);
+      helib::simd::NTTTables tables(n, q, psi);
+
+      std::vector<long> a(n);
+      for (long& x : a)
+        x = NTL::RandomBnd(q);
+
+      for (bool enable : {false, true}) {
+        helib::simd::setEnabled(enable);
+        std::vector<long> serial(a), split(a);
+        tables.forward(serial.data());
+        tables.forwardSplit(split.data());
+        EXPECT_EQ(split, serial) << "n = " << n << ", q = " << q;
+
+        tables.inverseSplit(split.data());
+        EXPECT_EQ(split, a) << "n = " << n << ", q = " << q;
+      }
+    }
+  helib::simd::setEnabled(true);
+}
+
+TEST(TestNativeSIMD, eltwiseKernelsMatchNTL)
+{
+  const long n = 1003; // not a multiple of the vector width
+  for (long bits : {20L, 49L, long(NTL_SP_NBITS)}) {
+    long q = NTL::GenPrime_long(bits);
+    NTL::mulmod_t qinv = NTL::PrepMulMod(q);
+    std::vector<long> a(n), b(n), r(n);
+    for (long i = 0; i < n; i++) {
+      a[i] = NTL::RandomBnd(q);
+      b[i] = NTL::RandomBnd(q);
+    }
+    a[0] = b[0] = q - 1;
+    long c = b[1];
+
+    helib::simd::EltwiseAddMod(r.data(), a.data(), b.data(), n, q);
+    for (long i = 0; i < n; i++)
+      EXPECT_EQ(r[i], NTL::AddMod(a[i], b[i], q));
+    helib::simd::EltwiseSubMod(r.data(), a.data(), b.data(), n, q);
+    for (long i = 0; i < n; i++)
+      EXPECT_EQ(r[i], NTL::SubMod(a[i], b[i], q));
+    helib::simd::EltwiseMultMod(r.data(), a.data(), b.data(), n, q, qinv);
+    for (long i = 0; i < n; i++)
+      EXPECT_EQ(r[i], NTL::MulMod(a[i], b[i], q, qinv));
+    helib::simd::EltwiseSubMod(r.data(), a.data(), c, n, q);
+    for (long i = 0; i < n; i++)
+      EXPECT_EQ(r[i], NTL::SubMod(a[i], c, q));
+    helib::simd::EltwiseMultMod(r.data(), a.data(), c, n, q);
+    for (long i = 0; i < n; i++)
+      EXPECT_EQ(r[i], NTL::MulMod(a[i], c, q, qinv));
+  }
+}
+
+TEST(TestNativeSIMD, reducingSignedValuesMatchesNTL)
+{
+  const long n = 1003;
+  for (long bits : {20L, 49L, long(NTL_SP_NBITS)}) {
+    long q = NTL::GenPrime_long(bits);
+    std::vector<long> a(n), r(n);
+    for (long i = 0; i < n; i++)
+      a[i] = NTL::RandomBnd(2 * q - 1) - (q - 1);
+    // Values out of (-q, q) in a few blocks
+    a[3] = q;
+    a[100] = -q;
+    a[501] = LONG_MIN;
+    a[502] = LONG_MAX;
+
+    helib::simd::EltwiseReduceMod(r.data(), a.data(), n, q);
+    for (long i = 0; i < n; i++)
+      EXPECT_EQ(r[i], NTL::rem(NTL::conv<NTL::ZZ>(a[i]), q)) << "i = " << i;
+  }
+}
+
+TEST(TestNativeSIMD, cdtSamplingMatchesAScalarScan)
+{
+  const long n = 1003;
+  const std::uint64_t top = std::uint64_t(1) << 63;
+  // Sorted, with the extreme entries a table can have
+  std::vector<std::uint64_t> cdt = {0, 1, 1000, top / 3, top / 2, top - 1, top};
+  std::vector<std::uint64_t> words(n);
+  for (long i = 0; i < n; i++)
+    words[i] = NTL::RandomWord();
+  words[0] = 0;
+  words[1] = 1;
+  words[2] = 2000;
+  words[3] = ~std::uint64_t(0);
+  words[4] = top - 2;
+
+  std::vector<long> r(n);
+  helib::simd::SampleCDT(r.data(), words.data(), n, cdt.data(), cdt.size());
+  for (long i = 0; i < n; i++) {
+    long x = 0;
+    for (std::uint64_t c : cdt)
+      x += long((words[i] >> 1) >= c);
+    EXPECT_EQ(r[i], (words[i] & 1) ? -x : x) << "i = " << i;
+  }
+}
+
+TEST(TestNativeSIMD, doubleCRTsFromZZXAndzzXAgree)
+{
+  for (long m : {256L, 105L}) {
+    helib::Context context(helib::ContextBuilder<helib::BGV>()
+                               .m(m)
+                               .p(17)
+                               .r(1)
+                               .bits(150)
+                               .build());
+    // Large and negative coefficients, some of degree >= phi(m)
+    long len = 2 * context.getPhiM() + 5;
+    helib::zzX f;
+    f.SetLength(len);
+    for (long i = 0; i < len; i++)
+      f[i] = NTL::RandomBnd(1L << 40) - (1L << 39);
+    f[0] = LONG_MIN / 2;
+    NTL::ZZX g;
+    helib::convert(g, f);
+
+    helib::DoubleCRT df(f, context, context.fullPrimes());
+    helib::DoubleCRT dg(g, context, context.fullPrimes());
+    EXPECT_EQ(df, dg) << "m = " << m;
+  }
+}
+
+TEST(TestNativeSIMD, powerOfTwoTransformIsANegacyclicRingMap)
+{
+  helib::Context context(helib::ContextBuilder<helib::CKKS>()
+                             .m(512)
+                             .precision(20)
+                             .bits(200)
+                             .build());
+  long phim = context.getPhiM();
+  NTL::ZZX f, g, phimX;
+  for (long i = 0; i < phim; i++) {
+    SetCoeff(f, i, NTL::RandomBnd(2001) - 1000);
+    SetCoeff(g, i, NTL::RandomBnd(2001) - 1000);
+  }
+  SetCoeff(phimX, phim);
+  SetCoeff(phimX, 0); // Phi_m(X) = X^phim + 1
+
+  helib::DoubleCRT df(f, context, context.fullPrimes());
+  helib::DoubleCRT dg(g, context, context.fullPrimes());
+  df *= dg;
+  NTL::ZZX prod;
+  df.toPoly(prod);
+  EXPECT_EQ(prod, (f * g) % phimX);
+
+  // Coefficients of degree >= phi(m) are folded in with X^phim = -1
+  NTL::ZZX h = f;
+  SetCoeff(h, phim + 3, 7);
+  SetCoeff(h, 2 * phim + 1, -5);
+  helib::DoubleCRT dh(h, context, context.fullPrimes());
+  EXPECT_EQ(dh, helib::DoubleCRT(h % phimX, context, context.fullPrimes()));
+
+  // The coefficient-vector iFFT matches the zz_pX one
+  helib::DoubleCRT d(context, context.fullPrimes());
+  d.randomize();
+  for (long i : context.fullPrimes()) {
+    const helib::Cmodulus& mod = context.ithModulus(i);
+    NTL::vec_long coeffs;
+    mod.iFFT(coeffs, d.getMap()[i]);
+    NTL::zz_pBak bak;
+    bak.save();
+    mod.restoreModulus();
+    NTL::zz_pX x;
+    mod.iFFT(x, d.getMap()[i]);
+    for (long j = 0; j < phim; j++)
+      EXPECT_EQ(coeffs[j], rep(coeff(x, j)));
+  }
+}
+
+TEST(TestNativeSIMD, doubleCRTResultsDoNotDependOnKernels)
+{
+  helib::Context context(helib::ContextBuilder<helib::BGV>()
+                             .m(256)
+                             .p(17)
+                             .r(1)
+                             .bits(150)
+                             .build());
+  NTL::ZZX f, g;
+  for (long i = 0; i < 128; i++) {
+    SetCoeff(f, i, NTL::RandomBnd(1000));
+    SetCoeff(g, i, NTL::RandomBnd(1000));
+  }
+
+  NTL::ZZX results[2];
+  for (bool enable : {false, true}) {
+    helib::simd::setEnabled(enable);
+    helib::DoubleCRT df(f, context, context.getCtxtPrimes());
+    helib::DoubleCRT dg(g, context, context.getCtxtPrimes());
+    df *= dg;
+    df += dg;
+    df -= 3;
+    df.toPoly(results[enable]);
+  }
+  helib::simd::setEnabled(true);
+  EXPECT_EQ(results[0], results[1]);
+}
+
+TEST(TestPrimeFactorFFT, matchesBluesteinTransforms)
+{
+  // Rader with folding (31), Rader with a cyclic convolution (17),
+  // Bluestein for a prime power (27), direct DFTs (2, 3, 5, 7, 11), even m
+  for (long m : {1023L, 255L, 135L, 7L * 17L, 2L * 3L * 17L}) {
+    helib::PAlgebra zms(m, 101);
+    long q, psi;
+    findNTTPrime(40, m, q, psi);
+    helib::Cmodulus bluestein(zms, q, 0, helib::FFTEngine::BLUESTEIN);
+    helib::Cmodulus primeFactor(zms, q, 0, helib::FFTEngine::PRIME_FACTOR);
+    EXPECT_EQ(primeFactor.getFFTEngine(), helib::FFTEngine::PRIME_FACTOR);
+
+    NTL::zz_pBak bak;
+    bak.save();
+    bluestein.restoreModulus();
+    NTL::zz_pX x;
+    NTL::random(x, zms.getPhiM());
+
+    NTL::zz_pX tmp = x;
+    NTL::vec_long y1, y2;
+    bluestein.FFT(y1, tmp);
+    tmp = x;
+    primeFactor.FFT(y2, tmp);
+    EXPECT_EQ(y1, y2) << "m = " << m;
+
+    NTL::zz_pX x1, x2;
+    bluestein.iFFT(x1, y1);
+    primeFactor.iFFT(x2, y1);
+    EXPECT_EQ(x1, x2) << "m = " << m;
+    EXPECT_EQ(x2, x) << "m = " << m;
+  }
+}
+
+TEST(TestBluesteinNTT, matchesNTLBluesteinTransforms)
+{
+  for (long n : {1023L, 255L, 135L, 7L}) {
+    long K = helib::BluesteinNTT::nttLength(n);
+    long q, psi;
+    findNTTPrime(40, n * K, q, psi);
+    ASSERT_TRUE(helib::BluesteinNTT::isUsable(n, q));
+    long root = NTL::PowerMod(psi, 2 * K, q); // of order n
+    long rInv = NTL::InvMod(root, q);
+    helib::BluesteinNTT native(n, q, root, NTL::PowerMod(psi, n, q));
+
+    NTL::zz_pBak bak;
+    bak.save();
+    NTL::zz_p::init(q);
+    NTL::zz_pX powers, ipowers;
+    NTL::Vec<NTL::mulmod_precon_t> powers_aux, ipowers_aux;
+    NTL::fftRep Rb, iRb;
+    NTL::zz_p rt = NTL::conv<NTL::zz_p>(root);
+    NTL::zz_p irt = NTL::conv<NTL::zz_p>(rInv);
+    helib::BluesteinInit(n, rt, powers, powers_aux, Rb);
+    helib::BluesteinInit(n, irt, ipowers, ipowers_aux, iRb);
+
+    NTL::zz_pX x;
+    NTL::random(x, n);
+    NTL::zz_pX expected = x, actual = x;
+    helib::BluesteinFFT(expected, n, rt, powers, powers_aux, Rb);
+    native.FFT(actual);
+    EXPECT_EQ(actual, expected) << "n = " << n;
+
+    helib::BluesteinFFT(expected, n, irt, ipowers, ipowers_aux, iRb);
+    native.iFFT(actual);
+    EXPECT_EQ(actual, expected) << "n = " << n;
+  }
+
+  // Even lengths are left to NTL
+  EXPECT_FALSE(helib::BluesteinNTT::isUsable(2 * 255, 65537));
+}
+
+TEST_F(TestDoubleCRT, allModuliUseThePlannedFFTEngine)
+{
+  for (long i = 0; i < context.numPrimes(); i++)
+    EXPECT_EQ(context.ithModulus(i).getFFTEngine(), context.getFFTEngine());
+
+  // The planner only considers prime-factor transforms when they may help
+  EXPECT_TRUE(helib::PrimeFactorFFT::isUseful(1023));
+  EXPECT_TRUE(helib::PrimeFactorFFT::isUseful(31));
+  EXPECT_FALSE(helib::PrimeFactorFFT::isUseful(81));
+}
+
+// Counts the transforms it is handed, and runs them on the CPU
+class CountingNTTBackend : public helib::CPUNTTBackend
+{
+public:
+  mutable std::atomic<long> forwards{0}, inverses{0};
+
+  void forward(const helib::Cmodulus& mod, NTL::vec_long& y) const override
+  {
+    forwards++;
+    helib::CPUNTTBackend::forward(mod, y);
+  }
+
+  void inverse(const helib::Cmodulus& mod,
+               NTL::vec_long& x,
+               const NTL::vec_long& y) const override
+  {
+    inverses++;
+    helib::CPUNTTBackend::inverse(mod, x, y);
+  }
+};
+
+// Installs a backend for its lifetime, so that a failed assertion does not
+// leave it installed for the tests that follow
+class NTTBackendGuard
+{
+public:
+  explicit NTTBackendGuard(const helib::NTTBackend& backend)
+  {
+    helib::Cmodulus::setNTTBackend(&backend);
+  }
+  ~NTTBackendGuard() { helib::Cmodulus::setNTTBackend(nullptr); }
+
+  NTTBackendGuard(const NTTBackendGuard&) = delete;
+  NTTBackendGuard& operator=(const NTTBackendGuard&) = delete;
+};
+
+TEST_F(TestDoubleCRT, transformsGoThroughTheInstalledNTTBackend)
+{
+  helib::zzX f;
+  f.SetLength(context.getPhiM());
+  for (long& c : f)
+    c = NTL::RandomBnd(2001) - 1000;
+  NTL::ZZX poly;
+  helib::convert(poly, f);
+
+  helib::fhe_op_snapshot before = helib::snapshot_op_counts();
+  helib::DoubleCRT expected(f, context, context.getCtxtPrimes());
+  helib::DoubleCRT expectedFromZZX(poly, context, context.getCtxtPrimes());
+  NTL::ZZX expectedBack;
+  expected.toPoly(expectedBack);
+  const helib::fhe_op_snapshot cpuCounts =
+      helib::snapshot_op_counts() - before;
+
+  CountingNTTBackend backend;
+  helib::fhe_op_snapshot counts;
+  {
+    NTTBackendGuard guard(backend);
+    before = helib::snapshot_op_counts();
+    helib::DoubleCRT d(f, context, context.getCtxtPrimes());
+    helib::DoubleCRT fromZZX(poly, context, context.getCtxtPrimes());
+    NTL::ZZX back;
+    d.toPoly(back);
+    counts = helib::snapshot_op_counts() - before;
+
+    EXPECT_EQ(d, expected);
+    EXPECT_EQ(fromZZX, expectedFromZZX);
+    EXPECT_EQ(back, expectedBack);
+    EXPECT_EQ(back, poly);
+  }
+
+  EXPECT_GE(backend.forwards.load(), 2 * context.getCtxtPrimes().card());
+  EXPECT_GE(backend.inverses.load(), context.getCtxtPrimes().card());
+  // The counts of the transforms do not depend on where they ran
+  EXPECT_EQ(counts.ffts, cpuCounts.ffts);
+  EXPECT_EQ(counts.iffts, cpuCounts.iffts);
+  // And the guard put the CPU transforms back
+  EXPECT_NE(dynamic_cast<const helib::CPUNTTBackend*>(
+                &helib::Cmodulus::getNTTBackend()),
+            nullptr);
+  EXPECT_NE(&helib::Cmodulus::getNTTBackend(), &backend);
+}
+
+} // namespace
@@ -217,6 +217,77 @@ TEST_P(TestHEXL, CModulusFFT)
   EXPECT_EQ(inverse_conv, poly);
 }
 
+// The kernels of the digit decomposition and mod-down steps, against NTL
+TEST_P(TestHEXL, eltwiseSubMulModMatchesNTL)
+{
+  helib::PrimeGenerator prime_generator(HELIB_SP_NBITS, 2 * N);
+  long q = prime_generator.next();
+  std::vector<long> a(N), b(N), result(N);
+  for (long i = 0; i < N; i++) {
+    a[i] = NTL::RandomBnd(q);
+    b[i] = NTL::RandomBnd(q);
+  }
+  long scalar = NTL::RandomBnd(q);
+
+  intel::EltwiseSubMulMod(result.data(), a.data(), b.data(), scalar, N, q);
+  for (long i = 0; i < N; i++)
+    EXPECT_EQ(result[i], NTL::MulMod(NTL::SubMod(a[i], b[i], q), scalar, q));
+}
+
+// The accumulation of the inner products of key switching, against NTL
+TEST_P(TestHEXL, eltwiseMulAddModMatchesNTL)
+{
+  helib::PrimeGenerator prime_generator(HELIB_SP_NBITS, 2 * N);
+  long q = prime_generator.next();
+  std::vector<long> a(N), b(N), acc(N), expected(N);
+  for (long i = 0; i < N; i++) {
+    a[i] = NTL::RandomBnd(q);
+    b[i] = NTL::RandomBnd(q);
+    acc[i] = NTL::RandomBnd(q);
+    expected[i] = NTL::AddMod(acc[i], NTL::MulMod(a[i], b[i], q), q);
+  }
+
+  intel::EltwiseMulAddMod(acc.data(), a.data(), b.data(), N, q);
+  EXPECT_EQ(acc, expected);
+}
+
+// Key switching, through breakIntoDigits, the inner products and the
+// mod-down, after an automorphism
+TEST_P(TestHEXL_BGV, rotateCtxt)
+{
+  helib::PtxtArray p0(ea);
+  p0.random();
+
+  helib::Ctxt c0(publicKey);
+  p0.encrypt(c0);
+
+  ea.rotate(c0, 1);
+  rotate(p0, 1);
+
+  EXPECT_TRUE(ciphertextMatches(ea, secretKey, p0, c0));
+}
+
+TEST_P(TestHEXL_BGV, modDownAfterMultiplication)
+{
+  helib::PtxtArray p0(ea), p1(ea);
+  p0.random();
+  p1.random();
+
+  helib::Ctxt c0(publicKey), c1(publicKey);
+  p0.encrypt(c0);
+  p1.encrypt(c1);
+
+  p0 *= p1;
+  c0 *= c1;
+  helib::IndexSet s = c0.getPrimeSet();
+  if (s.card() > 1) {
+    s.remove(s.last());
+    c0.modDownToSet(s);
+  }
+
+  EXPECT_TRUE(ciphertextMatches(ea, secretKey, p0, c0));
+}
+
 // clang-format off
 INSTANTIATE_TEST_SUITE_P(typicalParameters, TestHEXL_BGV, ::testing::Values(
     //Parameters(16, 3, 1, 300) // m power of 2.
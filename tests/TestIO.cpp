@@ -365,6 +365,28 @@ TEST(TestIO, fromTypedJSONThrowsWhenMetadataIsWrong)
   EXPECT_EQ(helib::fromTypedJson<helib::Context>(tj), jcont);
 }
 
+TEST(TestIO, base64RoundTripsEveryLength)
+{
+  for (long n = 0; n < 40; n++) {
+    std::string bytes;
+    for (long i = 0; i < n; i++)
+      bytes.push_back(char((37 * i + 11) & 255));
+
+    std::ostringstream text;
+    {
+      helib::Base64OutBuf buf(text);
+      std::ostream out(&buf);
+      out.write(bytes.data(), bytes.size());
+    }
+    EXPECT_EQ(text.str().size(), 4 * ((n + 2) / 3));
+    EXPECT_EQ(helib::base64Decode(text.str()), bytes);
+  }
+  EXPECT_EQ(helib::base64Decode("TWFuIGlzIGRpc3Rpbmd1aXNoZWQ="),
+            "Man is distinguished");
+  EXPECT_THROW(helib::base64Decode("TWF"), helib::IOError);
+  EXPECT_THROW(helib::base64Decode("TW!u"), helib::IOError);
+}
+
 TEST(TestIO, serializeComplexNumbers)
 {
   std::complex<double> cd1 = 0;
@@ -840,6 +862,46 @@ TEST_P(TestIO_BGV, canPerformOperationsOnDeserializedCiphertext)
   EXPECT_NO_THROW(ptxt.decrypt(deserialized_ctxt, secretKey));
 }
 
+TEST_P(TestIO_BGV, hybridJSONRoundTripsCiphertextsAndKeys)
+{
+  helib::PtxtArray ptxt(ea);
+  ptxt.random();
+  helib::Ctxt ctxt(publicKey);
+  ptxt.encrypt(ctxt);
+
+  std::stringstream ss;
+  ctxt.writeToHybridJSON(ss);
+  json header = json::parse(ss.str());
+  EXPECT_EQ(header.at("type"), "Ctxt");
+  EXPECT_EQ(header.at("encoding"), "binio+base64");
+  EXPECT_TRUE(header.at("content").is_string());
+
+  helib::Ctxt deserialized_ctxt =
+      helib::Ctxt::readFromHybridJSON(ss, publicKey);
+  EXPECT_EQ(ctxt, deserialized_ctxt);
+  helib::Ctxt inPlace(publicKey);
+  std::stringstream ss2(header.dump());
+  inPlace.readHybridJSON(ss2);
+  EXPECT_EQ(ctxt, inPlace);
+
+  std::stringstream keyStream;
+  publicKey.writeToHybridJSON(keyStream);
+  helib::PubKey deserialized_pk =
+      helib::PubKey::readFromHybridJSON(keyStream, context);
+  EXPECT_EQ(publicKey, deserialized_pk);
+
+  ASSERT_FALSE(publicKey.keySWlist().empty());
+  const helib::KeySwitch& ksw = publicKey.keySWlist().front();
+  std::stringstream kswStream;
+  ksw.writeToHybridJSON(kswStream);
+  EXPECT_EQ(ksw, helib::KeySwitch::readFromHybridJSON(kswStream, context));
+
+  // The reader checks the type of the object
+  std::stringstream wrongType(header.dump());
+  EXPECT_THROW(helib::PubKey::readFromHybridJSON(wrongType, context),
+               helib::IOError);
+}
+
 TEST_P(TestIO_BGV, ptxtWritesDataCorrectlyToOstream)
 {
   const long p2r = context.getSlotRing()->p2r;
@@ -1963,6 +2025,7 @@ TEST_P(TestIO_BGV, contextBuilderLogsCorrectly)
                          { "skHwt", skHwt },
                          { "resolution", resolution },
                          { "bitsInSpecialPrimes", bitsInSpecialPrimes },
+                         { "maxPrimeBits", 0 },
                          { "bootstrappableFlag", bootstrappableFlag },
                          { "mvec", mvec },
                          { "buildCacheFlag", buildCacheFlag },
@@ -2014,7 +2077,9 @@ TEST_P(TestIO_CKKS, contextBuilderLogsCorrectly)
                           { "bits", bits },
                           { "skHwt", skHwt },
                           { "resolution", resolution },
-                          { "bitsInSpecialPrimes", bitsInSpecialPrimes } 
+                          { "bitsInSpecialPrimes", bitsInSpecialPrimes },
+                          { "maxPrimeBits", 0 },
+                          { "bootstrappableFlag", false }
                        };
 
   EXPECT_EQ(actual_json.at("content"), expected_json);
@@ -0,0 +1,158 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#include <set>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <helib/IndexSet.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+std::set<long> elements(const helib::IndexSet& s)
+{
+  std::set<long> result;
+  for (long i : s)
+    result.insert(i);
+  return result;
+}
+
+// A set of elements below bound, and the same elements as a std::set
+struct RandomSet
+{
+  helib::IndexSet set;
+  std::set<long> expected;
+
+  explicit RandomSet(long bound)
+  {
+    for (long i = NTL::RandomBnd(20); i > 0; i--) {
+      long j = NTL::RandomBnd(bound);
+      set.insert(j);
+      expected.insert(j);
+    }
+    long j = NTL::RandomBnd(bound);
+    set.remove(j);
+    expected.erase(j);
+  }
+};
+
+void expectSet(const helib::IndexSet& s, const std::set<long>& expected)
+{
+  EXPECT_EQ(elements(s), expected);
+  EXPECT_EQ(s.card(), long(expected.size()));
+  EXPECT_EQ(s.first(), expected.empty() ? 0 : *expected.begin());
+  EXPECT_EQ(s.last(), expected.empty() ? -1 : *expected.rbegin());
+  std::set<long> backwards;
+  for (long i = s.last(); i >= s.first(); i = s.prev(i))
+    backwards.insert(i);
+  EXPECT_EQ(backwards, expected);
+}
+
+TEST(TestIndexSet, intervalsCrossingWordBoundaries)
+{
+  for (long low : {0, 1, 63, 64, 200})
+    for (long high : {low, low + 1, 127, 128, 300}) {
+      helib::IndexSet s(low, high);
+      std::set<long> expected;
+      for (long i = low; i <= high; i++)
+        expected.insert(i);
+      expectSet(s, expected);
+      EXPECT_TRUE(s.isInterval());
+      EXPECT_FALSE(s.contains(low - 1));
+      EXPECT_FALSE(s.contains(high + 1));
+    }
+  expectSet(helib::IndexSet(5, 4), {});
+}
+
+TEST(TestIndexSet, setAlgebraMatchesStdSet)
+{
+  // Small sets stay in the inline words, large ones do not
+  for (long bound : {40, 256, 700})
+    for (long trial = 0; trial < 200; trial++) {
+      RandomSet a(bound);
+      RandomSet b(bound);
+      std::set<long> both, either, onlyA, one;
+      for (long i : a.expected)
+        (b.expected.count(i) ? both : onlyA).insert(i);
+      either = a.expected;
+      either.insert(b.expected.begin(), b.expected.end());
+      for (long i : either)
+        if (!both.count(i))
+          one.insert(i);
+
+      expectSet(a.set | b.set, either);
+      expectSet(a.set & b.set, both);
+      expectSet(a.set / b.set, onlyA);
+      expectSet(a.set ^ b.set, one);
+      EXPECT_EQ(disjoint(a.set, b.set), both.empty());
+      EXPECT_EQ(b.set <= a.set, both.size() == b.expected.size());
+      EXPECT_EQ(a.set == b.set, a.expected == b.expected);
+      EXPECT_EQ(a.set | b.set, b.set | a.set);
+    }
+}
+
+TEST(TestIndexSet, copiesAreIndependent)
+{
+  helib::IndexSet small(3, 10);
+  helib::IndexSet large(3, 1000);
+  helib::IndexSet copy = large;
+  copy.remove(500);
+  EXPECT_TRUE(large.contains(500));
+  copy = small;
+  expectSet(copy, elements(small));
+  copy.insert(2000);
+  EXPECT_FALSE(small.contains(2000));
+  copy.clear();
+  expectSet(copy, {});
+  copy.insert(7);
+  expectSet(copy, {7});
+}
+
+TEST(TestIndexSet, movedFromSetsAreEmpty)
+{
+  for (long high : {10L, 1000L}) {
+    helib::IndexSet s(3, high);
+    std::set<long> expected = elements(s);
+    helib::IndexSet moved(std::move(s));
+    expectSet(moved, expected);
+    expectSet(s, {});
+    s.insert(5);
+    expectSet(s, {5});
+
+    helib::IndexSet assigned(1, 2);
+    assigned = std::move(moved);
+    expectSet(assigned, expected);
+    expectSet(moved, {});
+    moved.insert(2000);
+    expectSet(moved, {2000});
+  }
+}
+
+TEST(TestIndexSet, serializationKeepsTheElements)
+{
+  helib::IndexSet s(60, 70);
+  s.insert(300);
+  std::stringstream binary;
+  s.writeTo(binary);
+  EXPECT_EQ(helib::IndexSet::readFrom(binary), s);
+  std::stringstream json;
+  json << s;
+  helib::IndexSet t;
+  json >> t;
+  EXPECT_EQ(t, s);
+}
+
+} // namespace
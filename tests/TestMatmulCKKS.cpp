@@ -15,7 +15,11 @@
  * @brief some matrix / linear algebra stuff
  */
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <numeric>
+#include <sstream>
 
 #include <NTL/BasicThreadPool.h>
 
@@ -218,6 +222,242 @@ TEST_P(TestMatmulCKKS, vectorToMatrixMultiplication)
   }
 }
 
+TEST_P(TestMatmulCKKS, encodedMatrixCanBeWrittenAndMappedBack)
+{
+  std::vector<double> v(ea.size());
+  std::iota(v.begin(), v.end(), 1);
+
+  helib::MatMul_CKKS_Complex mat(context, [&v](long i, long j) {
+    return ((i + j) % v.size()) / double(v.size());
+  });
+
+  helib::EncodedMatMul_CKKS emat(mat);
+  helib::EncodedMatMul_CKKS upgraded(mat);
+  upgraded.upgrade();
+
+  // The constants as zzX, through a stream
+  std::stringstream str;
+  emat.writeTo(str);
+  helib::MatMul1DExec read = helib::MatMul1DExec::readFrom(str, ea);
+
+  // The upgraded constants as DoubleCRT, through a mapped file
+  const std::string path = "TestMatmulCKKS_upgraded.bin";
+  {
+    std::ofstream file(path, std::ios::binary);
+    upgraded.writeTo(file);
+  }
+  helib::MatMul1DExec mapped = helib::MatMul1DExec::readMapped(path, ea);
+  std::remove(path.c_str());
+
+  helib::PtxtArray ptxt(context, v);
+  helib::Ctxt ctxt(publicKey);
+  ptxt.encrypt(ctxt);
+
+  for (const helib::MatMul1DExec* exec : {&read, &mapped}) {
+    helib::Ctxt expected(ctxt), actual(ctxt);
+    emat.mul(expected);
+    exec->mul(actual);
+
+    helib::PtxtArray w(context), w1(context);
+    w.decrypt(expected, secretKey);
+    w1.decrypt(actual, secretKey);
+    std::vector<double> x, x1;
+    w.store(x);
+    w1.store(x1);
+    for (long i = 0; i < ea.size(); ++i)
+      EXPECT_NEAR(x[i], x1[i], 0.015);
+  }
+
+  // Written back out, nothing is lost
+  std::stringstream fromRead, fromOriginal;
+  read.writeTo(fromRead);
+  emat.writeTo(fromOriginal);
+  EXPECT_EQ(fromRead.str(), fromOriginal.str());
+}
+
+TEST_P(TestMatmulCKKS, encodedMatrixIsRejectedByAnotherContext)
+{
+  helib::MatMul_CKKS_Complex mat(context, [](long i, long j) {
+    return double(i == j);
+  });
+  helib::EncodedMatMul_CKKS emat(mat);
+  std::stringstream str;
+  emat.writeTo(str);
+
+  helib::Context other = helib::ContextBuilder<helib::CKKS>()
+                             .m(m)
+                             .precision(r)
+                             .bits(bits + 60)
+                             .build();
+  EXPECT_THROW(helib::MatMul1DExec::readFrom(str, other.getEA()),
+               helib::IOError);
+}
+
+TEST_P(TestMatmulCKKS, memoryBudgetKeepsRecentlyUsedDiagonals)
+{
+  std::vector<double> v(ea.size());
+  std::iota(v.begin(), v.end(), 1);
+  helib::MatMul_CKKS_Complex mat(context, [&v](long i, long j) {
+    return ((i + j) % v.size()) / double(v.size());
+  });
+  helib::EncodedMatMul_CKKS plain(mat);
+  helib::EncodedMatMul_CKKS tiered(mat);
+
+  helib::PtxtArray ptxt(context, v);
+  helib::Ctxt ctxt(publicKey);
+  ptxt.encrypt(ctxt);
+  // Rotated ciphertexts may still be over the special primes, and the
+  // copies are made at the primes of the ciphertext being multiplied
+  const helib::IndexSet& ctxtPrimes = ctxt.getPrimeSet();
+  const helib::IndexSet allPrimes = ctxtPrimes | context.getSpecialPrimes();
+  auto entryBytes = [this](const helib::IndexSet& s) {
+    return long(s.card() * context.getPhiM() * sizeof(long));
+  };
+
+  helib::Ctxt expected(ctxt);
+  plain.mul(expected);
+  helib::PtxtArray w(context);
+  w.decrypt(expected, secretKey);
+  std::vector<double> x;
+  w.store(x);
+
+  // Everything fits: the second multiplication only hits
+  tiered.setMemoryBudget(100 * entryBytes(allPrimes));
+  for (long round = 0; round < 2; round++) {
+    helib::Ctxt actual(ctxt);
+    tiered.mul(actual);
+    helib::PtxtArray w1(context);
+    w1.decrypt(actual, secretKey);
+    std::vector<double> x1;
+    w1.store(x1);
+    for (long i = 0; i < ea.size(); ++i)
+      EXPECT_NEAR(x[i], x1[i], 0.015);
+  }
+  helib::ConstMultiplierCacheStats stats = tiered.getCacheStats();
+  std::vector<helib::IndexSet> sets = tiered.getCachedPrimeSets();
+  EXPECT_GT(stats.misses, 0);
+  EXPECT_EQ(stats.hits, stats.misses);
+  EXPECT_EQ(stats.evictions, 0);
+  ASSERT_EQ(long(sets.size()), stats.misses);
+  long bytes = 0;
+  long minEntryBytes = entryBytes(allPrimes);
+  long maxEntryBytes = 0;
+  for (const helib::IndexSet& s : sets) {
+    EXPECT_TRUE(s == ctxtPrimes || s == allPrimes);
+    bytes += entryBytes(s);
+    minEntryBytes = std::min(minEntryBytes, entryBytes(s));
+    maxEntryBytes = std::max(maxEntryBytes, entryBytes(s));
+  }
+  EXPECT_EQ(stats.bytes, bytes);
+
+  // Room for a single diagonal: every miss but the first evicts the one
+  // copy held before it
+  ASSERT_LT(maxEntryBytes, 2 * minEntryBytes);
+  tiered.setMemoryBudget(maxEntryBytes);
+  helib::Ctxt actual(ctxt);
+  tiered.mul(actual);
+  stats = tiered.getCacheStats();
+  sets = tiered.getCachedPrimeSets();
+  EXPECT_EQ(stats.budget, maxEntryBytes);
+  EXPECT_EQ(stats.hits, 0);
+  EXPECT_EQ(stats.evictions, stats.misses - 1);
+  ASSERT_EQ(sets.size(), 1u);
+  EXPECT_EQ(stats.bytes, entryBytes(sets.front()));
+
+  helib::PtxtArray w1(context);
+  w1.decrypt(actual, secretKey);
+  std::vector<double> x1;
+  w1.store(x1);
+  for (long i = 0; i < ea.size(); ++i)
+    EXPECT_NEAR(x[i], x1[i], 0.015);
+}
+
+TEST_P(TestMatmulCKKS, zeroDiagonalsAreSkipped)
+{
+  std::vector<double> v(ea.size());
+  std::iota(v.begin(), v.end(), 1);
+  long n = v.size();
+
+  // Only the diagonal j == i + 1 (mod n) is nonzero
+  helib::MatMul_CKKS_Complex mat(context, [n](long i, long j) {
+    return double((j - i - 1) % n == 0) * (i + 1) / n;
+  });
+  helib::EncodedMatMul_CKKS emat(mat);
+
+  long nonzero = 0;
+  for (const auto& diag : emat.cache.multiplier)
+    nonzero += bool(diag);
+  EXPECT_EQ(nonzero, 1);
+  EXPECT_EQ(emat.babySteps.size(), 1u);
+  EXPECT_EQ(emat.giantSteps.size(), 1u);
+
+  helib::PtxtArray ptxt(context, v);
+  helib::Ctxt ctxt(publicKey);
+  ptxt.encrypt(ctxt);
+  ctxt *= emat;
+  ptxt *= mat;
+
+  helib::PtxtArray ptxt1(context);
+  ptxt1.decrypt(ctxt, secretKey);
+  std::vector<double> w, w1;
+  ptxt.store(w);
+  ptxt1.store(w1);
+  for (long i = 0; i < ea.size(); ++i)
+    EXPECT_NEAR(w[i], w1[i], 0.015);
+
+  // The zero matrix needs no rotations at all
+  helib::MatMul_CKKS_Complex zero(context, [](long, long) { return 0.0; });
+  helib::EncodedMatMul_CKKS ezero(zero);
+  EXPECT_TRUE(ezero.babySteps.empty());
+  ctxt *= ezero;
+  ptxt1.decrypt(ctxt, secretKey);
+  ptxt1.store(w1);
+  for (long i = 0; i < ea.size(); ++i)
+    EXPECT_NEAR(w1[i], 0.0, 0.015);
+}
+
+TEST_P(TestMatmulCKKS, batchMulMatchesMultiplyingOneByOne)
+{
+  long n = ea.size();
+  helib::MatMul_CKKS_Complex mat(context, [n](long i, long j) {
+    return ((i + 2 * j) % n) / double(n);
+  });
+
+  std::vector<helib::Ctxt> ctxts;
+  for (long c = 0; c < 3; ++c) {
+    std::vector<double> v(n);
+    std::iota(v.begin(), v.end(), c);
+    helib::PtxtArray ptxt(context, v);
+    ctxts.emplace_back(publicKey);
+    ptxt.encrypt(ctxts.back());
+  }
+
+  // With and without the BSGS strategy
+  for (int force_bsgs : {-1, 1}) {
+    setGlobals(force_bsgs, 0);
+    helib::EncodedMatMul_CKKS emat(mat);
+    setGlobals(0, 0);
+
+    std::vector<helib::Ctxt> batch(ctxts);
+    emat.mul(batch);
+    ASSERT_EQ(batch.size(), ctxts.size());
+
+    for (std::size_t c = 0; c < ctxts.size(); ++c) {
+      helib::Ctxt expected(ctxts[c]);
+      emat.mul(expected);
+
+      helib::PtxtArray w(context), w1(context);
+      w.decrypt(expected, secretKey);
+      w1.decrypt(batch[c], secretKey);
+      std::vector<double> x, x1;
+      w.store(x);
+      w1.store(x1);
+      for (long i = 0; i < n; ++i)
+        EXPECT_NEAR(x[i], x1[i], 0.015);
+    }
+  }
+}
+
 // clang-format off
 INSTANTIATE_TEST_SUITE_P(typicalParameters, TestMatmulCKKS, ::testing::Values(
       Parameters(/*m=*/16, /*r=*/10, /*bits=*/200, /*nt=*/1, /*force_bsgs=*/0, /*force_hoist=*/0, /*ks_strategy=*/0)
@@ -1062,6 +1062,92 @@ TEST(TestMatrix, AccessingMatrixViewElementOutOfBound)
   EXPECT_THROW(M(2, 2), helib::OutOfRangeError);
 }
 
+TEST(TestMatrix, ApplyChainAppliesTheFunctionsInOrder)
+{
+  helib::Matrix<int> M = {{0, 1, 2}, {3, 4, 5}};
+  M.applyChain([](auto& x) { x += 1; }, [](auto& x) { x *= 2; });
+  for (std::size_t i = 0; i < 2; ++i)
+    for (std::size_t j = 0; j < 3; ++j)
+      EXPECT_EQ(M(i, j), 2 * (3 * int(i) + int(j) + 1));
+
+  helib::Matrix<int> S = {{0, 1, 2}, {3, 4, 5}};
+  helib::Matrix<int> view = S.columns({2, 0});
+  view.applyChain([](auto& x) { x *= 3; }, [](auto& x) { x -= 1; });
+  helib::Matrix<int> expected = {{-1, 1, 5}, {8, 4, 14}};
+  EXPECT_EQ(S, expected);
+}
+
+TEST(TestMatrix, EntrywiseChainMatchesTheSeparatePasses)
+{
+  helib::Matrix<int> A = {{1, 2, 3}, {4, 5, 6}};
+  helib::Matrix<int> B = {{6, 5, 4}, {3, 2, 1}};
+  helib::Matrix<int> expected = A - B;
+  expected.apply([](auto& x) { x *= x; }).apply([](auto& x) { x += 7; });
+
+  A.entrywiseChain(
+      B,
+      [](auto& lhs, const auto& rhs) { lhs -= rhs; },
+      [](auto& x) { x *= x; },
+      [](auto& x) { x += 7; });
+  EXPECT_EQ(A, expected);
+
+  helib::Matrix<int> C(2, 2);
+  EXPECT_THROW(C.entrywiseChain(B, [](auto&, const auto&) {}),
+               helib::LogicError);
+}
+
+TEST(TestMatrix, TransposedViewSharesTheEntries)
+{
+  helib::Matrix<int> M = {{0, 1, 2}, {3, 4, 5}};
+  helib::Matrix<int> view = M.transposedView();
+  EXPECT_EQ(view.dims(0), 3);
+  EXPECT_EQ(view.dims(1), 2);
+  EXPECT_FALSE(view.fullView());
+  for (std::size_t i = 0; i < 3; ++i)
+    for (std::size_t j = 0; j < 2; ++j)
+      EXPECT_EQ(view(i, j), M(j, i));
+
+  view(2, 1) = 42;
+  EXPECT_EQ(M(1, 2), 42);
+
+  helib::Matrix<int> cols = view.columns({1, 1});
+  for (std::size_t i = 0; i < 3; ++i)
+    for (std::size_t j = 0; j < 2; ++j)
+      EXPECT_EQ(cols(i, j), M(1, i));
+
+  // Transposing a transposed view in place gives back the original layout
+  view.inPlaceTranspose();
+  EXPECT_TRUE(view.fullView());
+  EXPECT_EQ(view, M);
+  EXPECT_THROW(M.columns({0, 2}).transposedView(), helib::LogicError);
+}
+
+TEST(TestMatrix, RepeatedRowsOfARowVector)
+{
+  helib::Matrix<int> row = {{7, 8, 9}};
+  helib::Matrix<int> view = row.repeatedRows(4);
+  EXPECT_EQ(view.dims(0), 4);
+  EXPECT_EQ(view.dims(1), 3);
+  EXPECT_EQ(view.size(), 12);
+  EXPECT_FALSE(view.fullView());
+
+  helib::Matrix<int> copy = view.compact();
+  EXPECT_TRUE(copy.fullView());
+  EXPECT_EQ(copy.data().size(), 12);
+  for (std::size_t i = 0; i < 4; ++i)
+    for (std::size_t j = 0; j < 3; ++j) {
+      EXPECT_EQ(view(i, j), row(0, j));
+      EXPECT_EQ(copy(i, j), row(0, j));
+    }
+
+  // The copy does not share its entries with the row
+  copy(3, 0) = 0;
+  EXPECT_EQ(row(0, 0), 7);
+  EXPECT_EQ(copy(0, 0), 7);
+
+  EXPECT_THROW(view.repeatedRows(2), helib::LogicError);
+}
+
 TEST_P(TestMatrixWithCtxt, ConstructMatrixWithCtxt)
 {
   helib::Matrix<helib::Ctxt> M(helib::Ctxt(pk), 2, 3);
@@ -1219,6 +1305,65 @@ TEST_P(TestMatrixWithCtxt, MultiplyTwoCtxtMatrices)
   EXPECT_TRUE(std::equal(P(1, 1).begin(), P(1, 1).end(), a3.begin()));
 }
 
+TEST_P(TestMatrixWithCtxt, MultiplyCtxtMatrixByPlaintextMatrices)
+{
+  // Long enough inner dimension to span several blocks.
+  const std::size_t rows = 3;
+  const std::size_t inner = 70;
+  const std::size_t cols = 5;
+  const long nslots = ea.size();
+
+  helib::Matrix<helib::Ctxt> M1(helib::Ctxt(pk), rows, inner);
+  helib::Matrix<std::vector<long>> D1(rows, inner);
+  for (std::size_t i = 0; i < rows; ++i)
+    for (std::size_t k = 0; k < inner; ++k) {
+      D1(i, k).resize(nslots);
+      for (long s = 0; s < nslots; ++s)
+        D1(i, k)[s] = (i + 2 * k + 3 * s) % p;
+      ea.encrypt(M1(i, k), pk, D1(i, k));
+    }
+
+  helib::Matrix<long> L(inner, cols);
+  helib::Matrix<helib::Ptxt<helib::BGV>> P(helib::Ptxt<helib::BGV>(context),
+                                           inner,
+                                           cols);
+  helib::Matrix<std::vector<long>> D2(inner, cols);
+  for (std::size_t k = 0; k < inner; ++k)
+    for (std::size_t j = 0; j < cols; ++j) {
+      // Include zeros and ones, which are special-cased for longs.
+      L(k, j) = (k * cols + j) % 4;
+      D2(k, j).resize(nslots);
+      for (long s = 0; s < nslots; ++s)
+        D2(k, j)[s] = (k + j * s + 1) % p;
+      P(k, j) = helib::Ptxt<helib::BGV>(context, D2(k, j));
+    }
+
+  helib::Matrix<helib::Ctxt> RL = M1 * L;
+  helib::Matrix<helib::Ctxt> RP = M1 * P;
+
+  ASSERT_EQ(RL.dims(0), rows);
+  ASSERT_EQ(RL.dims(1), cols);
+  ASSERT_EQ(RP.dims(0), rows);
+  ASSERT_EQ(RP.dims(1), cols);
+
+  for (std::size_t i = 0; i < rows; ++i)
+    for (std::size_t j = 0; j < cols; ++j) {
+      std::vector<long> expectedL(nslots, 0);
+      std::vector<long> expectedP(nslots, 0);
+      for (std::size_t k = 0; k < inner; ++k)
+        for (long s = 0; s < nslots; ++s) {
+          expectedL[s] = (expectedL[s] + D1(i, k)[s] * L(k, j)) % p;
+          expectedP[s] = (expectedP[s] + D1(i, k)[s] * D2(k, j)[s]) % p;
+        }
+
+      std::vector<long> decrypted;
+      ea.decrypt(RL(i, j), sk, decrypted);
+      EXPECT_EQ(decrypted, expectedL) << "at (" << i << ", " << j << ")";
+      ea.decrypt(RP(i, j), sk, decrypted);
+      EXPECT_EQ(decrypted, expectedP) << "at (" << i << ", " << j << ")";
+    }
+}
+
 TEST_P(TestMatrixWithCtxt, TestBasicCtxt)
 {
   helib::Ctxt blank(pk);
@@ -0,0 +1,171 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include <helib/multicore.h>
+
+#include "gtest/gtest.h"
+#include "test_common.h"
+
+namespace {
+
+#ifdef HELIB_THREADS
+
+class TestMulticore : public ::testing::Test
+{
+protected:
+  virtual void TearDown() override
+  {
+    helib::SetTaskThreads(1);
+    helib::setParallelGrainMode(helib::ParallelGrainMode::ADAPTIVE);
+  }
+};
+
+TEST_F(TestMulticore, execRangeCoversTheRangeOnce)
+{
+  helib::SetTaskThreads(4);
+  EXPECT_EQ(helib::AvailableThreads(), 4);
+
+  std::vector<std::atomic_long> hits(1000);
+  HELIB_EXEC_RANGE(long(hits.size()), first, last)
+  for (long i = first; i < last; ++i)
+    hits[i]++;
+  HELIB_EXEC_RANGE_END
+
+  for (std::size_t i = 0; i < hits.size(); ++i)
+    EXPECT_EQ(hits[i].load(), 1) << "*** i = " << i;
+}
+
+TEST_F(TestMulticore, nestedLoopsRunInParallelAndComplete)
+{
+  helib::SetTaskThreads(4);
+
+  constexpr long n = 16;
+  std::vector<std::atomic_long> sums(n);
+  std::atomic_long innerThreads(0);
+  HELIB_EXEC_INDEX(n, i)
+  // Inside a loop, the threads are still available to nested loops
+  if (helib::AvailableThreads() == 4)
+    innerThreads++;
+  HELIB_EXEC_RANGE(100, first, last)
+  for (long j = first; j < last; ++j)
+    sums[i] += j;
+  HELIB_EXEC_RANGE_END
+  HELIB_EXEC_INDEX_END
+
+  EXPECT_EQ(innerThreads.load(), n);
+  for (long i = 0; i < n; ++i)
+    EXPECT_EQ(sums[i].load(), 99 * 100 / 2) << "*** i = " << i;
+}
+
+TEST_F(TestMulticore, tasksKnowTheyRunInsideALoop)
+{
+  helib::SetTaskThreads(4);
+  EXPECT_FALSE(helib::inParallelTask());
+
+  std::atomic_long inside(0);
+  HELIB_EXEC_INDEX(8, i)
+  (void)i;
+  if (helib::inParallelTask())
+    inside++;
+  HELIB_EXEC_INDEX_END
+  EXPECT_EQ(inside.load(), 8);
+  EXPECT_FALSE(helib::inParallelTask());
+}
+
+TEST_F(TestMulticore, exceptionsInTasksAreRethrownAfterTheLoop)
+{
+  helib::SetTaskThreads(3);
+
+  std::atomic_long done(0);
+  auto loop = [&] {
+    HELIB_EXEC_INDEX(8, i)
+    if (i == 5)
+      throw std::runtime_error("task failed");
+    done++;
+    HELIB_EXEC_INDEX_END
+  };
+  EXPECT_THROW(loop(), std::runtime_error);
+  EXPECT_EQ(done.load(), 7);
+}
+
+TEST_F(TestMulticore, loopsFallBackToNTLWithoutAScheduler)
+{
+  helib::SetTaskThreads(1);
+  EXPECT_EQ(helib::GetTaskScheduler(), nullptr);
+  EXPECT_EQ(helib::AvailableThreads(), NTL::AvailableThreads());
+
+  std::atomic_long sum(0);
+  HELIB_EXEC_RANGE(100, first, last)
+  for (long i = first; i < last; ++i)
+    sum += i;
+  HELIB_EXEC_RANGE_END
+  EXPECT_EQ(sum.load(), 99 * 100 / 2);
+}
+
+TEST_F(TestMulticore, adaptiveLoopsRunSmallWorkInlineAndSplitLargeWork)
+{
+  helib::SetTaskThreads(4);
+
+  std::vector<std::atomic_long> hits(100);
+  auto loop = [&](helib::ParallelGrain& grain, long work) {
+    helib::adaptiveExecRange(grain,
+                             work,
+                             long(hits.size()),
+                             [&](long first, long last) {
+                               for (long i = first; i < last; ++i)
+                                 hits[i]++;
+                             });
+  };
+
+  helib::ParallelGrain small, large;
+  loop(small, 100);
+  loop(large, 1L << 20);
+  EXPECT_EQ(small.numInline(), 1);
+  EXPECT_EQ(small.numSplit(), 0);
+  EXPECT_EQ(large.numInline(), 0);
+  EXPECT_EQ(large.numSplit(), 1);
+
+  helib::setParallelGrainMode(helib::ParallelGrainMode::ALWAYS);
+  loop(small, 100);
+  EXPECT_EQ(small.numSplit(), 1);
+
+  for (std::size_t i = 0; i < hits.size(); ++i)
+    EXPECT_EQ(hits[i].load(), 3) << "*** i = " << i;
+}
+
+TEST_F(TestMulticore, timedSitesSplitWhenTheSavingRepaysTheWakeup)
+{
+  helib::SetTaskThreads(4);
+  EXPECT_GT(helib::parallelWakeupSeconds(), 0);
+
+  // A nanosecond for the whole loop is never worth the threads, a second
+  // always is
+  helib::ParallelGrain cheap, costly;
+  cheap.recordInline(1000, 1e-9);
+  costly.recordInline(1000, 1.0);
+  for (auto mode : {helib::ParallelGrainMode::ADAPTIVE,
+                    helib::ParallelGrainMode::LOW_LATENCY}) {
+    helib::setParallelGrainMode(mode);
+    EXPECT_FALSE(cheap.split(1000, 100));
+    EXPECT_TRUE(costly.split(1000, 100));
+    // A single iteration cannot be split
+    EXPECT_FALSE(costly.split(1000, 1));
+  }
+}
+
+#endif // ifdef HELIB_THREADS
+
+} // namespace
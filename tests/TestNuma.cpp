@@ -0,0 +1,135 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#include <atomic>
+#include <numeric>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <helib/helib.h>
+#include <helib/numa.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(TestNuma, topologyCoversEachCpuOnce)
+{
+  ASSERT_GE(helib::NumaNodes(), 1);
+  std::set<long> seen;
+  for (long node = 0; node < helib::NumaNodes(); ++node) {
+    EXPECT_FALSE(helib::NumaNodeCpus(node).empty()) << "*** node " << node;
+    for (long cpu : helib::NumaNodeCpus(node))
+      EXPECT_TRUE(seen.insert(cpu).second) << "*** cpu " << cpu;
+  }
+  EXPECT_THROW(helib::NumaNodeCpus(helib::NumaNodes()),
+               helib::OutOfRangeError);
+
+  long current = helib::CurrentNumaNode();
+  EXPECT_GE(current, 0);
+  EXPECT_LT(current, helib::NumaNodes());
+}
+
+TEST(TestNuma, pinnedThreadsReportTheirNode)
+{
+  for (long node = 0; node < helib::NumaNodes(); ++node)
+    std::thread([node]() {
+      if (helib::PinThreadToNumaNode(node))
+        EXPECT_EQ(helib::CurrentNumaNode(), node);
+    }).join();
+}
+
+TEST(TestNuma, replicasMatchTheOriginalOnEveryNode)
+{
+  std::vector<long> data(1000);
+  std::iota(data.begin(), data.end(), 0);
+  const helib::NumaReplicated<std::vector<long>> replicated(data);
+
+  std::vector<std::thread> threads;
+  std::atomic_long mismatches(0);
+  for (long t = 0; t < 4 * helib::NumaNodes(); ++t)
+    threads.emplace_back([&, t]() {
+      helib::PinThreadToNumaNode(t % helib::NumaNodes());
+      if (replicated.local() != data)
+        mismatches++;
+    });
+  for (auto& thread : threads)
+    thread.join();
+  EXPECT_EQ(mismatches.load(), 0);
+  EXPECT_EQ(replicated.get(), data);
+}
+
+#ifdef HELIB_THREADS
+TEST(TestNuma, pinnedSchedulerRunsEveryTask)
+{
+  helib::SetTaskThreads(4, /*numaPinned=*/true);
+  const helib::TaskScheduler& scheduler = *helib::GetTaskScheduler();
+  for (long i = 1; i < scheduler.NumThreads(); ++i) {
+    EXPECT_GE(scheduler.NumaNodeOf(i), scheduler.NumaNodeOf(i - 1));
+    EXPECT_LT(scheduler.NumaNodeOf(i), helib::NumaNodes());
+  }
+
+  std::vector<std::atomic_long> hits(200);
+  HELIB_EXEC_INDEX(long(hits.size()), i)
+  hits[i]++;
+  HELIB_EXEC_INDEX_END
+  helib::SetTaskThreads(1);
+
+  for (std::size_t i = 0; i < hits.size(); ++i)
+    EXPECT_EQ(hits[i].load(), 1) << "*** i = " << i;
+}
+#endif
+
+TEST(TestNuma, replicatedKeySwitchingMatchesTheOriginal)
+{
+  helib::Context context = helib::ContextBuilder<helib::BGV>()
+                               .m(79)
+                               .p(317)
+                               .r(1)
+                               .bits(300)
+                               .build();
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  addSome1DMatrices(secretKey);
+  helib::PubKey publicKey(secretKey);
+  publicKey.replicateOnNumaNodes();
+  const helib::EncryptedArray& ea = context.getEA();
+
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 1);
+  helib::Ptxt<helib::BGV> ptxt(context, data);
+
+  std::vector<std::thread> threads;
+  std::vector<helib::Ctxt> results(helib::NumaNodes(), helib::Ctxt(publicKey));
+  for (long node = 0; node < helib::NumaNodes(); ++node)
+    threads.emplace_back([&, node]() {
+      helib::PinThreadToNumaNode(node);
+      publicKey.Encrypt(results[node], ptxt);
+      results[node].square();
+      ea.rotate(results[node], 5);
+    });
+  for (auto& thread : threads)
+    thread.join();
+
+  helib::Ptxt<helib::BGV> expected(ptxt);
+  expected.square();
+  expected.rotate(5);
+  for (const helib::Ctxt& result : results) {
+    helib::Ptxt<helib::BGV> decrypted(context);
+    secretKey.Decrypt(decrypted, result);
+    EXPECT_EQ(decrypted, expected);
+  }
+}
+
+} // namespace
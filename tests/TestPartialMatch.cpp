@@ -14,6 +14,7 @@
 
 #include <helib/helib.h>
 #include <helib/partialMatch.h>
+#include <helib/shard.h>
 #include <helib/debugging.h>
 
 #include "gtest/gtest.h"
@@ -903,6 +904,390 @@ TEST_P(TestPartialMatch, databaseLookupWorksWithQueryAPI)
   EXPECT_EQ(plaintext_result, results);
 }
 
+TEST_P(TestPartialMatch, databaseLookupOfManyQueriesMatchesSingleLookups)
+{
+  helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_database(2l, 3l);
+  std::vector<std::vector<long>> plaintext_database_numbers = {
+      {6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6},
+      {7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7},
+      {2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2}};
+  for (int i = 0; i < 3; ++i) {
+    plaintext_database(0, i) =
+        helib::Ptxt<helib::BGV>(context, plaintext_database_numbers[i]);
+    plaintext_database(1, i) =
+        helib::Ptxt<helib::BGV>(context, plaintext_database_numbers[i]);
+  }
+  helib::Database<helib::Ptxt<helib::BGV>> database(plaintext_database,
+                                                    context);
+
+  // Three encrypted query rows
+  std::vector<std::vector<std::vector<long>>> plaintext_query_numbers = {
+      {{6, 6, 6, 6, 6, 1, 6, 9, 6, 6, 6, 6},
+       {4, 8, 1, 6, 9, 4, 3, 8, 2, 9, 2, 5},
+       {2, 3, 2, 1, 2, 2, 2, 2, 2, 2, 2, 2}},
+      {{6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6},
+       {7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7},
+       {2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2}},
+      {{1, 6, 1, 6, 1, 6, 1, 6, 1, 6, 1, 6},
+       {7, 7, 1, 1, 7, 7, 1, 1, 7, 7, 1, 1},
+       {2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2, 2}}};
+  std::vector<helib::Matrix<helib::Ctxt>> encrypted_queries;
+  for (const auto& numbers : plaintext_query_numbers) {
+    helib::Matrix<helib::Ctxt> query(helib::Ctxt(publicKey), 1l, 3l);
+    for (int i = 0; i < 3; ++i)
+      publicKey.Encrypt(query(0, i),
+                        helib::Ptxt<helib::BGV>(context, numbers[i]));
+    encrypted_queries.push_back(query);
+  }
+
+  const helib::QueryExpr& name = helib::makeQueryExpr(0);
+  const helib::QueryExpr& age = helib::makeQueryExpr(1);
+  const helib::QueryExpr& height = helib::makeQueryExpr(2);
+  helib::QueryBuilder qb(name && (age || height));
+  helib::QueryType lookup_query(qb.build(plaintext_database.dims(1)));
+
+  auto many_results = database.contains(lookup_query, encrypted_queries);
+  ASSERT_EQ(many_results.size(), encrypted_queries.size());
+
+  auto decrypt = [&](const helib::Matrix<helib::Ctxt>& encrypted) {
+    helib::Matrix<helib::Ptxt<helib::BGV>> decrypted(
+        helib::Ptxt<helib::BGV>(context),
+        encrypted.dims(0),
+        encrypted.dims(1));
+    decrypted.entrywiseOperation<helib::Ctxt>(
+        encrypted,
+        [&](auto& ptxt, const auto& ctxt) -> decltype(auto) {
+          secretKey.Decrypt(ptxt, ctxt);
+          return ptxt;
+        });
+    return decrypted;
+  };
+  for (std::size_t q = 0; q < encrypted_queries.size(); ++q) {
+    auto single_result = database.contains(lookup_query, encrypted_queries[q]);
+    EXPECT_EQ(decrypt(single_result), decrypt(many_results[q]))
+        << "*** query " << q;
+  }
+}
+
+TEST_P(TestPartialMatch, streamedDatabaseLookupMatchesInMemoryLookup)
+{
+  std::vector<std::vector<std::vector<long>>> plaintext_database_numbers = {
+      {{6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6},
+       {7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7},
+       {2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2}},
+      {{6, 1, 6, 1, 6, 1, 6, 1, 6, 1, 6, 1},
+       {7, 7, 1, 1, 7, 7, 1, 1, 7, 7, 1, 1},
+       {2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2, 2}},
+      {{1, 6, 1, 6, 1, 6, 1, 6, 1, 6, 1, 6},
+       {4, 8, 1, 6, 9, 4, 3, 8, 2, 9, 2, 5},
+       {2, 3, 2, 1, 2, 2, 2, 2, 2, 2, 2, 2}}};
+  long rows = plaintext_database_numbers.size();
+  helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_database(rows, 3l);
+  for (long i = 0; i < rows; ++i)
+    for (int j = 0; j < 3; ++j)
+      plaintext_database(i, j) =
+          helib::Ptxt<helib::BGV>(context, plaintext_database_numbers[i][j]);
+  helib::Database<helib::Ptxt<helib::BGV>> database(plaintext_database,
+                                                    context);
+
+  helib::Matrix<helib::Ctxt> encrypted_query(helib::Ctxt(publicKey), 1l, 3l);
+  for (int j = 0; j < 3; ++j)
+    publicKey.Encrypt(
+        encrypted_query(0, j),
+        helib::Ptxt<helib::BGV>(context, plaintext_database_numbers[0][j]));
+
+  const helib::QueryExpr& name = helib::makeQueryExpr(0);
+  const helib::QueryExpr& age = helib::makeQueryExpr(1);
+  const helib::QueryExpr& height = helib::makeQueryExpr(2);
+  helib::QueryBuilder qb(name && (age || height));
+  helib::QueryType lookup_query(qb.build(plaintext_database.dims(1)));
+
+  // Serve the rows from memory in place of a file
+  std::vector<std::pair<long, long>> requested;
+  auto readChunk = [&](long first, long last) {
+    requested.emplace_back(first, last);
+    helib::Matrix<helib::Ptxt<helib::BGV>> chunk(
+        helib::Ptxt<helib::BGV>(context),
+        last - first,
+        3l);
+    for (long i = first; i < last; ++i)
+      for (int j = 0; j < 3; ++j)
+        chunk(i - first, j) = plaintext_database(i, j);
+    return chunk;
+  };
+
+  auto decrypt = [&](const helib::Matrix<helib::Ctxt>& encrypted) {
+    helib::Matrix<helib::Ptxt<helib::BGV>> decrypted(
+        helib::Ptxt<helib::BGV>(context),
+        encrypted.dims(0),
+        encrypted.dims(1));
+    decrypted.entrywiseOperation<helib::Ctxt>(
+        encrypted,
+        [&](auto& ptxt, const auto& ctxt) -> decltype(auto) {
+          secretKey.Decrypt(ptxt, ctxt);
+          return ptxt;
+        });
+    return decrypted;
+  };
+  auto expected = decrypt(database.contains(lookup_query, encrypted_query));
+
+  for (long chunkRows : {1l, 2l, 4l}) {
+    requested.clear();
+    helib::StreamedDatabase<helib::Ptxt<helib::BGV>> streamed(rows,
+                                                              3l,
+                                                              readChunk,
+                                                              context,
+                                                              chunkRows);
+    auto result = streamed.contains(lookup_query, encrypted_query);
+    EXPECT_EQ(decrypt(result), expected) << "*** chunkRows " << chunkRows;
+    EXPECT_EQ(long(requested.size()), (rows + chunkRows - 1) / chunkRows);
+    for (const auto& [first, last] : requested)
+      EXPECT_LE(last - first, chunkRows);
+  }
+}
+
+TEST(TestPartialMatch, precomputedDatabaseMasksMatchCalculatedMasks)
+{
+  // A small p, for which the powers of the database are cheap to store
+  helib::Context context =
+      helib::ContextBuilder<helib::BGV>().m(171).p(7).r(1).bits(500).build();
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  helib::addSome1DMatrices(secretKey);
+  helib::addFrbMatrices(secretKey);
+  const helib::PubKey& publicKey = secretKey;
+  const helib::EncryptedArray& ea = context.getEA();
+  long nslots = ea.size();
+
+  auto slots = [&](long seed) {
+    std::vector<long> v(nslots);
+    for (long s = 0; s < nslots; ++s)
+      v[s] = (seed * s + s / 3) % 7;
+    return helib::Ptxt<helib::BGV>(context, v);
+  };
+  helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_database(2l, 3l);
+  for (long i = 0; i < 2; ++i)
+    for (long j = 0; j < 3; ++j)
+      plaintext_database(i, j) = slots(i + 2 * j);
+  helib::Matrix<helib::Ctxt> encrypted_query(helib::Ctxt(publicKey), 1l, 3l);
+  for (long j = 0; j < 3; ++j)
+    publicKey.Encrypt(encrypted_query(0, j), slots(2 * j));
+
+  auto decrypt = [&](const helib::Matrix<helib::Ctxt>& encrypted) {
+    helib::Matrix<helib::Ptxt<helib::BGV>> decrypted(
+        helib::Ptxt<helib::BGV>(context),
+        encrypted.dims(0),
+        encrypted.dims(1));
+    decrypted.entrywiseOperation<helib::Ctxt>(
+        encrypted,
+        [&](auto& ptxt, const auto& ctxt) -> decltype(auto) {
+          secretKey.Decrypt(ptxt, ctxt);
+          return ptxt;
+        });
+    return decrypted;
+  };
+
+  helib::DatabasePowers powers(plaintext_database, context.getCtxtPrimes());
+  EXPECT_EQ(powers.degree(), 6);
+  auto expected_mask =
+      decrypt(calculateMasks(ea, encrypted_query, plaintext_database));
+  auto mask = decrypt(calculateMasks(ea, encrypted_query, powers));
+  EXPECT_EQ(mask, expected_mask);
+
+  const helib::QueryExpr& name = helib::makeQueryExpr(0);
+  const helib::QueryExpr& age = helib::makeQueryExpr(1);
+  const helib::QueryExpr& height = helib::makeQueryExpr(2);
+  helib::QueryBuilder qb(name && (age || height));
+  helib::QueryType lookup_query(qb.build(plaintext_database.dims(1)));
+
+  helib::Database<helib::Ptxt<helib::BGV>> database(plaintext_database,
+                                                    context);
+  auto expected = decrypt(database.contains(lookup_query, encrypted_query));
+  database.precomputeMasks(context.getCtxtPrimes());
+  auto result = decrypt(database.contains(lookup_query, encrypted_query));
+  EXPECT_EQ(result, expected);
+}
+
+TEST(TestPartialMatch, appendedAndUpdatedDatabaseMatchesRebuiltDatabase)
+{
+  helib::Context context =
+      helib::ContextBuilder<helib::BGV>().m(171).p(7).r(1).bits(500).build();
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  helib::addSome1DMatrices(secretKey);
+  helib::addFrbMatrices(secretKey);
+  const helib::PubKey& publicKey = secretKey;
+  long nslots = context.getEA().size();
+
+  auto slots = [&](long seed) {
+    std::vector<long> v(nslots);
+    for (long s = 0; s < nslots; ++s)
+      v[s] = (seed * s + s / 3) % 7;
+    return helib::Ptxt<helib::BGV>(context, v);
+  };
+  auto rowsOf = [&](long first, long last, long seed) {
+    helib::Matrix<helib::Ptxt<helib::BGV>> rows(last - first, 3l);
+    for (long i = first; i < last; ++i)
+      for (long j = 0; j < 3; ++j)
+        rows(i - first, j) = slots(seed * i + 2 * j);
+    return rows;
+  };
+  helib::Matrix<helib::Ctxt> encrypted_query(helib::Ctxt(publicKey), 1l, 3l);
+  for (long j = 0; j < 3; ++j)
+    publicKey.Encrypt(encrypted_query(0, j), slots(2 * j));
+
+  const helib::QueryExpr& name = helib::makeQueryExpr(0);
+  const helib::QueryExpr& age = helib::makeQueryExpr(1);
+  const helib::QueryExpr& height = helib::makeQueryExpr(2);
+  helib::QueryBuilder qb(name && (age || height));
+  helib::QueryType lookup_query(qb.build(3));
+
+  auto expectSameLookups = [&](const auto& database, const auto& expected) {
+    auto result = database.contains(lookup_query, encrypted_query);
+    auto reference = expected.contains(lookup_query, encrypted_query);
+    ASSERT_EQ(result.dims(0), reference.dims(0));
+    for (std::size_t i = 0; i < result.dims(0); ++i) {
+      helib::Ptxt<helib::BGV> decrypted(context), decrypted_reference(context);
+      secretKey.Decrypt(decrypted, result(i, 0));
+      secretKey.Decrypt(decrypted_reference, reference(i, 0));
+      EXPECT_EQ(decrypted, decrypted_reference) << "*** row " << i;
+    }
+  };
+
+  // Two rows, with precomputed masks, then three more
+  helib::Database<helib::Ptxt<helib::BGV>> database(rowsOf(0, 2, 1), context);
+  database.precomputeMasks(context.getCtxtPrimes());
+  database.append(rowsOf(2, 5, 1));
+  EXPECT_EQ(database.rows(), 5);
+  EXPECT_EQ(database.numSegments(), 2);
+  helib::Database<helib::Ptxt<helib::BGV>> rebuilt(rowsOf(0, 5, 1), context);
+  expectSameLookups(database, rebuilt);
+
+  // Rows 1 and 2, across the two segments
+  auto replaced = rowsOf(0, 5, 1);
+  auto updated = rowsOf(1, 3, 0);
+  for (long i = 1; i < 3; ++i)
+    for (long j = 0; j < 3; ++j)
+      replaced(i, j) = updated(i - 1, j);
+  database.update(1, updated);
+  EXPECT_EQ(database.numSegments(), 2);
+  helib::Database<helib::Ptxt<helib::BGV>> rebuilt_updated(replaced, context);
+  expectSameLookups(database, rebuilt_updated);
+
+  helib::Matrix<helib::Ptxt<helib::BGV>> narrow(slots(0), 1l, 2l);
+  EXPECT_THROW(database.append(narrow), helib::InvalidArgument);
+  EXPECT_THROW(database.update(4, updated), helib::InvalidArgument);
+}
+
+TEST_P(TestPartialMatch, aggregatesSumAndCountTheMatchingRows)
+{
+  // Row i: key 1 + i%2, value 10*(i+1) and a tag, matched by rows 0 to 2
+  long rows = 5;
+  auto constant = [&](long value) {
+    return helib::Ptxt<helib::BGV>(context,
+                                   std::vector<long>(ea.size(), value));
+  };
+  helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_database(rows - 2, 3l);
+  helib::Matrix<helib::Ptxt<helib::BGV>> appended(2l, 3l);
+  for (long i = 0; i < rows; ++i) {
+    auto& target = (i < 3) ? plaintext_database : appended;
+    long row = (i < 3) ? i : i - 3;
+    target(row, 0) = constant(1 + i % 2);
+    target(row, 1) = constant(10 * (i + 1));
+    target(row, 2) = constant(i < 3 ? 7 : 8);
+  }
+  helib::Database<helib::Ptxt<helib::BGV>> database(plaintext_database,
+                                                    context);
+  database.append(appended);
+
+  helib::Matrix<helib::Ctxt> encrypted_query(helib::Ctxt(publicKey), 1l, 3l);
+  for (long j = 0; j < 3; ++j)
+    publicKey.Encrypt(encrypted_query(0, j), constant(7));
+  const helib::QueryExpr& tag = helib::makeQueryExpr(2);
+  helib::QueryBuilder qb(tag);
+  helib::QueryType lookup_query(qb.build(3));
+
+  auto expectValue = [&](const helib::Ctxt& ctxt, long value) {
+    helib::Ptxt<helib::BGV> decrypted(context);
+    secretKey.Decrypt(decrypted, ctxt);
+    EXPECT_EQ(decrypted, constant(value));
+  };
+  expectValue(database.count(lookup_query, encrypted_query), 3);
+  expectValue(database.sum(lookup_query, encrypted_query, 1), 60);
+  expectValue(database.count(lookup_query, encrypted_query, true),
+              3 * ea.size());
+
+  std::vector<long> groups = {1, 2};
+  auto counts = database.countBy(lookup_query, encrypted_query, 0, groups);
+  ASSERT_EQ(counts.size(), 2u);
+  expectValue(counts[0], 2);
+  expectValue(counts[1], 1);
+  auto sums = database.sumBy(lookup_query, encrypted_query, 1, 0, groups);
+  ASSERT_EQ(sums.size(), 2u);
+  expectValue(sums[0], 40);
+  expectValue(sums[1], 20);
+
+  EXPECT_THROW(database.sum(lookup_query, encrypted_query, 3),
+               helib::InvalidArgument);
+  EXPECT_THROW(database.countBy(lookup_query, encrypted_query, 0, {}),
+               helib::InvalidArgument);
+}
+
+TEST_P(TestPartialMatch, shardedDatabaseLookupMatchesWholeLookup)
+{
+  long rows = 5;
+  helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_database(rows, 3l);
+  for (long i = 0; i < rows; ++i)
+    for (long j = 0; j < 3; ++j)
+      plaintext_database(i, j) = helib::Ptxt<helib::BGV>(
+          context,
+          std::vector<long>(ea.size(), (i % 2) * (j + 1)));
+  helib::Database<helib::Ptxt<helib::BGV>> database(plaintext_database,
+                                                    context);
+
+  helib::Matrix<helib::Ctxt> encrypted_query(helib::Ctxt(publicKey), 1l, 3l);
+  for (long j = 0; j < 3; ++j)
+    publicKey.Encrypt(
+        encrypted_query(0, j),
+        helib::Ptxt<helib::BGV>(context, std::vector<long>(ea.size(), j + 1)));
+
+  const helib::QueryExpr& name = helib::makeQueryExpr(0);
+  const helib::QueryExpr& age = helib::makeQueryExpr(1);
+  const helib::QueryExpr& height = helib::makeQueryExpr(2);
+  helib::QueryBuilder qb(name && (age || height));
+  helib::QueryType lookup_query(qb.build(plaintext_database.dims(1)));
+
+  // Each shard sends its result back over a stream, in reverse order
+  long shards = 3;
+  std::vector<helib::ShardResult> results;
+  for (long index = shards - 1; index >= 0; --index) {
+    helib::Database<helib::Ptxt<helib::BGV>> shard(
+        helib::shardOf(plaintext_database, shards, index),
+        context);
+    std::stringstream ss;
+    helib::ShardResult{helib::shardRows(rows, shards, index).first,
+                       shard.contains(lookup_query, encrypted_query)}
+        .writeTo(ss);
+    results.push_back(helib::ShardResult::readFrom(ss, publicKey));
+  }
+  auto merged = helib::mergeShardResults(results, rows);
+
+  auto expected = database.contains(lookup_query, encrypted_query);
+  ASSERT_EQ(merged.dims(0), expected.dims(0));
+  ASSERT_EQ(merged.dims(1), expected.dims(1));
+  for (std::size_t i = 0; i < merged.dims(0); ++i) {
+    helib::Ptxt<helib::BGV> decrypted_merged(context);
+    helib::Ptxt<helib::BGV> decrypted_expected(context);
+    secretKey.Decrypt(decrypted_merged, merged(i, 0));
+    secretKey.Decrypt(decrypted_expected, expected(i, 0));
+    EXPECT_EQ(decrypted_merged, decrypted_expected) << "*** row " << i;
+  }
+
+  results.pop_back();
+  EXPECT_THROW(helib::mergeShardResults(results, rows),
+               helib::InvalidArgument);
+}
+
 TEST_P(TestPartialMatch, scoringWorksWithDatabaseAndQueryAPIs)
 {
   helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_database(2l, 5l);
@@ -12,6 +12,9 @@
 
 /* TestPermutations.cpp - Applying plaintext permutation to encrypted vector
  */
+#include <cstdio>
+#include <sstream>
+
 #include <NTL/ZZ.h>
 
 #include <helib/NumbTh.h>
@@ -257,6 +260,88 @@ TEST_P(TestPermutationsBGV, ciphertextPermutationsWithNewAPI)
   EXPECT_EQ(w, v);
 }
 
+TEST_P(TestPermutationsBGV, applyingAgainReusesTheMasksOfTheNetwork)
+{
+  helib::PermIndepPrecomp pip(context, depth);
+  helib::Permut pi;
+  helib::randomPerm(pi, context.getNSlots());
+  helib::PermPrecomp pp(pip, pi);
+
+  // The second call, on another ciphertext, uses the masks of the first
+  for (long count = 0; count < 2; ++count) {
+    helib::Ctxt ctxt(publicKey);
+    helib::PtxtArray v(context);
+    v.random();
+    v.encrypt(ctxt);
+
+    pp.apply(ctxt);
+    pp.apply(v);
+
+    helib::PtxtArray w(context);
+    w.decrypt(ctxt, secretKey);
+    EXPECT_EQ(w, v);
+  }
+}
+
+TEST_P(TestPermutationsBGV, readPrecomputationsPermuteLikeTheWrittenOnes)
+{
+  helib::PermIndepPrecomp pip(context, depth);
+  helib::Permut pi;
+  helib::randomPerm(pi, context.getNSlots());
+  helib::PermPrecomp pp(pip, pi);
+
+  std::stringstream str;
+  pp.writeTo(str);
+  std::unique_ptr<helib::PermPrecomp> read =
+      helib::PermPrecomp::readFrom(str, pp.getEA());
+  EXPECT_EQ(read->getPermutation(), pi);
+  EXPECT_EQ(read->getNetwork().depth(), pp.getNetwork().depth());
+
+  helib::Ctxt ctxt(publicKey);
+  helib::PtxtArray v(context);
+  v.random();
+  v.encrypt(ctxt);
+  read->apply(ctxt);
+  pp.apply(v);
+
+  helib::PtxtArray w(context);
+  w.decrypt(ctxt, secretKey);
+  EXPECT_EQ(w, v);
+}
+
+TEST_P(TestPermutationsBGV, precompCacheBuildsEachPermutationOnce)
+{
+  helib::PermIndepPrecomp pip(context, depth);
+  helib::Permut pi, other;
+  helib::randomPerm(pi, context.getNSlots());
+  helib::randomPerm(other, context.getNSlots());
+
+  helib::PermPrecompCache cache(".");
+  std::shared_ptr<const helib::PermPrecomp> first = cache.get(pip, pi);
+  EXPECT_EQ(cache.get(pip, pi), first);
+  EXPECT_EQ(cache.get(pip, other)->getPermutation(), other);
+  EXPECT_EQ(cache.size(), other == pi ? 1 : 2);
+
+  // After clearing, the entry is read back from the directory
+  cache.clear();
+  std::shared_ptr<const helib::PermPrecomp> loaded = cache.get(pip, pi);
+  EXPECT_NE(loaded, first);
+  EXPECT_EQ(loaded->getPermutation(), pi);
+  std::remove(cache.path(pip, pi).c_str());
+  std::remove(cache.path(pip, other).c_str());
+
+  helib::Ctxt ctxt(publicKey);
+  helib::PtxtArray v(context);
+  v.random();
+  v.encrypt(ctxt);
+  loaded->apply(ctxt);
+  first->apply(v);
+
+  helib::PtxtArray w(context);
+  w.decrypt(ctxt, secretKey);
+  EXPECT_EQ(w, v);
+}
+
 // This test is in TestPermutations for now as this is where
 // this issue was discovered.
 TEST(TestPermutationsCKKS, ckksFailIfRBitsTooLarge)
@@ -331,6 +416,29 @@ TEST_P(TestPermutationsGeneral, testCube)
   }
 }
 
+TEST_P(TestPermutationsGeneral, buildingAgainGivesTheSameTreesAndCost)
+{
+  helib::GeneratorTrees trees1;
+  long cost1 = trees1.buildOptimalTrees(gens, depth);
+  // The second search reuses the trees of the generators from the first
+  helib::GeneratorTrees trees2;
+  long cost2 = trees2.buildOptimalTrees(gens, depth);
+
+  EXPECT_EQ(cost1, cost2);
+  EXPECT_EQ(trees1.numLayers(), trees2.numLayers());
+  EXPECT_EQ(trees1.mapToCube(), trees2.mapToCube());
+
+  const helib::PermutationCost& breakdown = trees1.getCost();
+  if (cost1 == NTL_MAX_LONG) {
+    EXPECT_EQ(breakdown.automorphisms, 0);
+    return;
+  }
+  EXPECT_EQ(breakdown.automorphisms, cost1);
+  EXPECT_EQ(breakdown.keySwitches, cost1);
+  EXPECT_EQ(breakdown.depth, trees1.numLayers());
+  EXPECT_LE(breakdown.depth, depth);
+}
+
 INSTANTIATE_TEST_SUITE_P(variousParameters,
                          TestPermutationsBGV,
                          ::testing::Values(BGVParameters(/*m=*/4369,
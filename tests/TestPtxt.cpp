@@ -1736,6 +1736,25 @@ TEST(TestPtxtBGV, automorphWorksCorrectly)
   }
 }
 
+TEST_P(TestPtxtBGV, automorphByAGeneratorOfAGoodDimensionRotatesIt)
+{
+  const helib::PAlgebra& zMStar = context.getZMStar();
+  std::vector<long> data(context.getEA().size());
+  std::iota(data.begin(), data.end(), 0);
+  helib::Ptxt<helib::BGV> ptxt(context, data);
+  for (long i = 0; i < zMStar.numOfGens(); ++i) {
+    if (!zMStar.SameOrd(i))
+      continue;
+    auto automorphed = ptxt;
+    automorphed.automorph(zMStar.ZmStarGen(i));
+    auto rotated = ptxt;
+    rotated.rotate1D(i, 1);
+    for (std::size_t j = 0; j < ptxt.size(); ++j) {
+      ASSERT_EQ(automorphed[j], rotated[j]) << "i = " << i << " j = " << j;
+    }
+  }
+}
+
 TEST_P(TestPtxtBGV, frobeniusAutomorphWithConstantsWorksCorrectly)
 {
   std::vector<long> data(context.getEA().size());
@@ -331,6 +331,56 @@ TEST(TestQuery, BuildQueryBuilderFromTableMultidimensionalColumns)
   }
 }
 
+TEST(TestQuery, OptimizedQueryBuilderSimplifiesClauses)
+{
+  helib::Table t("TABLE(name, age, weight, height)");
+  helib::QueryBuilder qb(
+      t.buildQueryString("( name AND age ) OR ( name AND weight )"));
+
+  // (name OR name) AND (name OR weight) AND (age OR name) AND (age OR weight)
+  helib::QueryType plain = qb.build(t.size());
+  EXPECT_EQ(plain.taus.size(), 4UL);
+
+  // name AND (age OR weight)
+  helib::QueryType optimized = qb.build(t.size(), /*optimize=*/true);
+  std::vector<helib::Matrix<long>> expected_taus{{{1}, {0}, {0}, {0}},
+                                                 {{0}, {1}, {1}, {0}}};
+  ASSERT_EQ(optimized.taus.size(), expected_taus.size());
+  for (size_t i = 0; i < expected_taus.size(); ++i)
+    EXPECT_TRUE(expected_taus[i] == optimized.taus[i]) << "*** i= " << i;
+  EXPECT_EQ(optimized.Fs.size(), expected_taus.size());
+  EXPECT_EQ(optimized.mus, std::vector<long>(expected_taus.size(), 0));
+  EXPECT_TRUE(optimized.containsOR);
+
+  // Repeated clauses are merged
+  helib::QueryBuilder qb2(t.buildQueryString("name AND age AND name"));
+  EXPECT_EQ(qb2.build(t.size(), /*optimize=*/true).taus.size(), 2UL);
+}
+
+TEST(TestQuery, QueryCostEstimatesCountMultiplicationsAndDepth)
+{
+  helib::Table t("TABLE(name, age, weight, height)");
+  helib::QueryBuilder qb(
+      t.buildQueryString("( name AND age ) OR ( name AND weight )"));
+
+  // Four clauses: 3 multiplications in a tree of depth 2
+  helib::QueryCost plain = qb.build(t.size()).estimateCost(2);
+  EXPECT_EQ(plain.multiplications, 3);
+  EXPECT_EQ(plain.depth, 2);
+
+  // Two clauses, plus x^4 for the OR: 1 + 2 multiplications
+  helib::QueryCost optimized =
+      qb.build(t.size(), /*optimize=*/true).estimateCost(5);
+  EXPECT_EQ(optimized.multiplications, 3);
+  EXPECT_EQ(optimized.depth, 3);
+
+  // x^6 = x^2 * x^4 needs x^2, x^4 and x^6
+  helib::QueryBuilder qb2(t.buildQueryString("name OR age"));
+  helib::QueryCost single = qb2.build(t.size()).estimateCost(7);
+  EXPECT_EQ(single.multiplications, 3);
+  EXPECT_EQ(single.depth, 3);
+}
+
 TEST(TestQuery, QueryExprFromPseudoParser)
 {
   long cases = 2;
@@ -0,0 +1,160 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <NTL/BasicThreadPool.h>
+#include <helib/sample.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+#include "../src/simdKernels.h" // Private header
+
+namespace {
+
+class TestSample : public ::testing::Test
+{
+protected:
+  long savedThreads = NTL::AvailableThreads();
+
+  virtual void TearDown() override { NTL::SetNumThreads(savedThreads); }
+};
+
+struct Samples
+{
+  helib::zzX small, hwt, uniform, gaussian;
+  std::vector<double> normals;
+};
+
+Samples sampleAll(long seed)
+{
+  const long n = 5000; // a few blocks, the last one partial
+  Samples s;
+  NTL::SetSeed(NTL::ZZ(seed));
+  helib::sampleSmall(s.small, n);
+  helib::sampleHWt(s.hwt, n, 64);
+  helib::sampleUniform(s.uniform, n, 7);
+  helib::sampleGaussian(s.gaussian, n, 3.2);
+  helib::sampleGaussian(s.normals, n, 3.2);
+  return s;
+}
+
+TEST_F(TestSample, samplesDoNotDependOnTheNumberOfThreads)
+{
+  NTL::SetNumThreads(1);
+  Samples serial = sampleAll(17);
+  NTL::SetNumThreads(4);
+  Samples parallel = sampleAll(17);
+
+  EXPECT_EQ(serial.small, parallel.small);
+  EXPECT_EQ(serial.hwt, parallel.hwt);
+  EXPECT_EQ(serial.uniform, parallel.uniform);
+  EXPECT_EQ(serial.gaussian, parallel.gaussian);
+  EXPECT_EQ(serial.normals, parallel.normals);
+
+  Samples other = sampleAll(18);
+  EXPECT_NE(serial.uniform, other.uniform);
+}
+
+TEST_F(TestSample, samplesDoNotDependOnTheKernels)
+{
+  helib::simd::setEnabled(false);
+  Samples scalar = sampleAll(19);
+  helib::simd::setEnabled(true);
+  Samples vector = sampleAll(19);
+
+  EXPECT_EQ(scalar.gaussian, vector.gaussian);
+  EXPECT_EQ(scalar.small, vector.small);
+  EXPECT_EQ(scalar.uniform, vector.uniform);
+}
+
+TEST_F(TestSample, samplersStayInTheirRanges)
+{
+  Samples s = sampleAll(5);
+
+  long nonzero = 0;
+  for (long c : s.small) {
+    EXPECT_LE(std::abs(c), 1);
+    nonzero += (c != 0);
+  }
+  EXPECT_NEAR(nonzero, s.small.length() / 2, s.small.length() / 20);
+
+  long weight = 0;
+  for (long c : s.hwt) {
+    EXPECT_LE(std::abs(c), 1);
+    weight += (c != 0);
+  }
+  EXPECT_EQ(weight, 64);
+
+  std::vector<long> hits(15);
+  for (long c : s.uniform) {
+    ASSERT_LE(std::abs(c), 7);
+    hits[c + 7]++;
+  }
+  for (long h : hits)
+    EXPECT_GT(h, 0);
+}
+
+TEST_F(TestSample, discreteGaussianHasTheRequestedSpread)
+{
+  const double stdev = 3.2;
+  helib::zzX poly;
+  helib::sampleGaussian(poly, 100000, stdev);
+
+  double sum = 0, sumSquares = 0;
+  for (long c : poly) {
+    EXPECT_LE(std::abs(c), std::ceil(helib::HELIB_GAUSS_TRUNC * stdev));
+    sum += c;
+    sumSquares += double(c) * c;
+  }
+  double mean = sum / poly.length();
+  double variance = sumSquares / poly.length() - mean * mean;
+  EXPECT_NEAR(mean, 0, 0.05);
+  EXPECT_NEAR(variance, stdev * stdev, 0.05 * stdev * stdev);
+}
+
+TEST_F(TestSample, explicitPRGsMatchTheSeededCurrentStream)
+{
+  const long n = 3000;
+  NTL::SetSeed(NTL::ZZ(23));
+  helib::zzX expected;
+  helib::sampleSmall(expected, n);
+
+  // The same samples from PRG(seed), leaving the current stream alone
+  NTL::SetSeed(NTL::ZZ(99));
+  NTL::ZZ untouched = NTL::RandomBits_ZZ(64);
+  NTL::SetSeed(NTL::ZZ(99));
+  helib::PRG prg(NTL::ZZ(23));
+  helib::zzX small;
+  helib::sampleSmall(small, n, 0.5, prg);
+  EXPECT_EQ(small, expected);
+  EXPECT_EQ(NTL::RandomBits_ZZ(64), untouched);
+}
+
+TEST_F(TestSample, substreamsDependOnlyOnTheKeyAndIndex)
+{
+  helib::PRG prg(NTL::ZZ(5));
+  unsigned char a[32], b[32], c[32];
+  prg.substream(3).get(a, sizeof(a));
+  prg.get(c, sizeof(c)); // the parent stream moves on
+  prg.substream(3).get(b, sizeof(b));
+  EXPECT_TRUE(std::equal(a, a + sizeof(a), b));
+  prg.substream(4).get(c, sizeof(c));
+  EXPECT_FALSE(std::equal(a, a + sizeof(a), c));
+
+  EXPECT_TRUE(helib::PRG::current().isCurrent());
+  EXPECT_THROW(helib::PRG::current().substream(0), helib::LogicError);
+}
+
+} // namespace
@@ -10,8 +10,11 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 
+#include <sstream>
+
 #include <helib/helib.h>
 #include <helib/set.h>
+#include <helib/shard.h>
 #include <helib/debugging.h>
 
 #include "gtest/gtest.h"
@@ -185,6 +188,101 @@ TEST_P(TestSet, calculateSetIntersectionCtxtWorksCorrectly)
   EXPECT_EQ(result, expected_result);
 }
 
+TEST_P(TestSet, shardedSetIntersectionMatchesWholeIntersection)
+{
+  constexpr long N = 1 << 7;
+
+  long cnt = 0;
+  std::vector<NTL::ZZX> server_set(N);
+  std::generate(server_set.begin(), server_set.end(), [&cnt]() {
+    return polyFromBinary(++cnt);
+  });
+
+  std::vector<NTL::ZZX> query_numbers = {
+      polyFromBinary(1),
+      polyFromBinary(64),
+      polyFromBinary(100),
+      polyFromBinary(2048),
+  };
+  helib::Ctxt client_set(publicKey);
+  publicKey.Encrypt(client_set,
+                    helib::Ptxt<helib::BGV>(context, query_numbers));
+
+  // The partial masks of the shards are sent back in the compact format,
+  // keeping room for the final multiplication
+  long shards = 3;
+  std::vector<helib::Ctxt> partials;
+  for (long index = 0; index < shards; ++index) {
+    auto [first, last] = helib::shardRows(N, shards, index);
+    std::vector<NTL::ZZX> shard(server_set.begin() + first,
+                                server_set.begin() + last);
+    std::stringstream ss;
+    calculateSetMatches(client_set, shard).writeCompact(ss, 100);
+    partials.push_back(helib::Ctxt::readFrom(ss, publicKey));
+  }
+  auto result = mergeSetIntersection(client_set, partials);
+
+  helib::Ptxt<helib::BGV> decrypted_result(context);
+  helib::Ptxt<helib::BGV> decrypted_expected(context);
+  secretKey.Decrypt(decrypted_result, result);
+  secretKey.Decrypt(decrypted_expected,
+                    calculateSetIntersection(client_set, server_set));
+  EXPECT_EQ(decrypted_result, decrypted_expected);
+}
+
+TEST_P(TestSet, packedSetIntersectionMatchesTheSetIntersection)
+{
+  constexpr long N = 1 << 9;
+  constexpr long width = 4;
+
+  long cnt = 0;
+  std::vector<NTL::ZZX> server_set(N);
+  std::generate(server_set.begin(), server_set.end(), [&cnt]() {
+    return polyFromBinary(++cnt);
+  });
+
+  // The slots past the width of the query are ignored
+  std::vector<NTL::ZZX> query_numbers(ea.size(), polyFromBinary(7));
+  query_numbers[0] = polyFromBinary(1);
+  query_numbers[1] = polyFromBinary(5);
+  query_numbers[2] = polyFromBinary(501);
+  query_numbers[3] = polyFromBinary(2048);
+  helib::Ptxt<helib::BGV> client_set(context, query_numbers);
+
+  std::vector<NTL::ZZX> expected_matches = {
+      polyFromBinary(1),
+      polyFromBinary(5),
+      polyFromBinary(501),
+  };
+  helib::Ptxt<helib::BGV> expected_result(context, expected_matches);
+
+  EXPECT_EQ(calculateSetIntersection(client_set, width, server_set),
+            expected_result);
+
+  // A server set that does not fill its last pack of blocks, and a server
+  // set read from a stream
+  std::vector<NTL::ZZX> partial(server_set.begin(), server_set.begin() + 13);
+  std::stringstream ss;
+  for (const NTL::ZZX& element : partial)
+    ss << element << "\n";
+  auto next = [&ss](NTL::ZZX& element) { return bool(ss >> element); };
+  auto matches = helib::streamSetMatches(client_set, width, next);
+  std::vector<long> expected_mask = {1, 1, 0, 0};
+  EXPECT_EQ(matches, helib::Ptxt<helib::BGV>(context, expected_mask));
+
+  // Encrypted, on a smaller server set
+  std::vector<NTL::ZZX> small_set(server_set.begin(), server_set.begin() + 16);
+  helib::Ctxt encrypted_client_set(publicKey);
+  publicKey.Encrypt(encrypted_client_set, client_set);
+  helib::Ptxt<helib::BGV> result(context);
+  secretKey.Decrypt(
+      result,
+      calculateSetIntersection(encrypted_client_set, width, small_set));
+  std::vector<NTL::ZZX> expected_small = {polyFromBinary(1),
+                                          polyFromBinary(5)};
+  EXPECT_EQ(result, helib::Ptxt<helib::BGV>(context, expected_small));
+}
+
 INSTANTIATE_TEST_SUITE_P(variousParameters,
                          TestSet,
                          ::testing::Values(BGVParameters(771, 2, 1, 700)));
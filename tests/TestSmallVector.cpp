@@ -0,0 +1,103 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#include <string>
+#include <utility>
+
+#include <helib/SmallVector.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using Strings = helib::SmallVector<std::string, 3>;
+
+Strings numbers(long n)
+{
+  Strings v;
+  for (long i = 0; i < n; i++)
+    v.push_back(std::to_string(i));
+  return v;
+}
+
+TEST(TestSmallVector, holdsTheInlineCapacityWithoutGrowing)
+{
+  Strings v = numbers(3);
+  EXPECT_EQ(v.capacity(), 3u);
+  ASSERT_EQ(v.size(), 3u);
+  EXPECT_EQ(v.front(), "0");
+  EXPECT_EQ(v.back(), "2");
+}
+
+TEST(TestSmallVector, growsOntoTheHeapAndKeepsTheElements)
+{
+  Strings v = numbers(10);
+  EXPECT_GE(v.capacity(), 10u);
+  ASSERT_EQ(v.size(), 10u);
+  for (long i = 0; i < 10; i++)
+    EXPECT_EQ(v[i], std::to_string(i));
+}
+
+TEST(TestSmallVector, pushingAnElementOfItselfWhileGrowingCopiesIt)
+{
+  Strings v = numbers(3);
+  v.push_back(v[0]);
+  ASSERT_EQ(v.size(), 4u);
+  EXPECT_EQ(v[3], "0");
+}
+
+TEST(TestSmallVector, eraseMovesTheLaterElementsDown)
+{
+  Strings v = numbers(3);
+  v.erase(v.begin() + 1);
+  ASSERT_EQ(v.size(), 2u);
+  EXPECT_EQ(v[0], "0");
+  EXPECT_EQ(v[1], "2");
+}
+
+TEST(TestSmallVector, assignmentCopiesEitherWay)
+{
+  Strings big = numbers(10);
+  Strings small = numbers(2);
+  Strings v = small;
+  v = big;
+  ASSERT_EQ(v.size(), 10u);
+  EXPECT_EQ(v[9], "9");
+  v = small;
+  ASSERT_EQ(v.size(), 2u);
+  EXPECT_EQ(v[1], "1");
+}
+
+TEST(TestSmallVector, moveLeavesTheSourceEmpty)
+{
+  for (long n : {2, 10}) {
+    Strings source = numbers(n);
+    Strings v(std::move(source));
+    EXPECT_TRUE(source.empty());
+    ASSERT_EQ(long(v.size()), n);
+    EXPECT_EQ(v.back(), std::to_string(n - 1));
+  }
+}
+
+TEST(TestSmallVector, assignAndResizeFillWithTheValue)
+{
+  Strings v = numbers(5);
+  v.assign(2, "x");
+  ASSERT_EQ(v.size(), 2u);
+  EXPECT_EQ(v[1], "x");
+  v.resize(6, v[0]);
+  ASSERT_EQ(v.size(), 6u);
+  EXPECT_EQ(v[5], "x");
+}
+
+} // namespace
@@ -0,0 +1,137 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#include <cmath>
+#include <complex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include <helib/helib.h>
+#include <helib/polyEval.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+// Many threads share one Context and one PubKey, with no locking on the
+// caller's side, and must get the same results as a single thread would.
+// These are best run under a thread sanitizer.
+
+namespace {
+
+constexpr long numThreads = 16;
+
+class TestThreadSafety : public ::testing::Test
+{
+protected:
+  helib::Context context;
+  helib::SecKey secretKey;
+  helib::PubKey publicKey;
+  const helib::EncryptedArray& ea;
+
+  TestThreadSafety() :
+      context(helib::ContextBuilder<helib::BGV>()
+                  .m(79)
+                  .p(317)
+                  .r(1)
+                  .bits(500)
+                  .build()),
+      secretKey(context),
+      publicKey((secretKey.GenSecKey(),
+                 addSome1DMatrices(secretKey),
+                 addFrbMatrices(secretKey),
+                 secretKey)),
+      ea(context.getEA())
+  {}
+
+  helib::Ptxt<helib::BGV> slots(long offset) const
+  {
+    std::vector<long> data(ea.size());
+    std::iota(data.begin(), data.end(), offset);
+    return helib::Ptxt<helib::BGV>(context, data);
+  }
+};
+
+TEST_F(TestThreadSafety, concurrentOperationsOnASharedKeyMatchSerialOnes)
+{
+  // A single set of powers, filled in by all the threads at once
+  helib::Ctxt base(publicKey);
+  publicKey.Encrypt(base, slots(2));
+  helib::DynamicCtxtPowers powers(base, 4);
+
+  std::vector<helib::Ctxt> results(numThreads, helib::Ctxt(publicKey));
+  std::vector<std::thread> threads;
+  for (long t = 0; t < numThreads; ++t)
+    threads.emplace_back([&, t]() {
+      helib::Ctxt x(publicKey), y(publicKey);
+      publicKey.Encrypt(x, slots(t));
+      publicKey.Encrypt(y, slots(3 * t + 1));
+      x.multiplyBy(y);
+      ea.rotate(x, t + 1);
+      x.frobeniusAutomorph(1);
+      x += powers.getPower(1 + t % 4);
+      results[t] = x;
+    });
+  for (auto& thread : threads)
+    thread.join();
+
+  for (long t = 0; t < numThreads; ++t) {
+    helib::Ptxt<helib::BGV> expected = slots(t);
+    expected *= slots(3 * t + 1);
+    expected.rotate(t + 1);
+    expected.frobeniusAutomorph(1);
+    expected += slots(2).power(1 + t % 4);
+
+    helib::Ptxt<helib::BGV> decrypted(context);
+    secretKey.Decrypt(decrypted, results[t]);
+    EXPECT_EQ(decrypted, expected) << "*** thread " << t;
+  }
+}
+
+TEST(TestThreadSafetyCKKS, concurrentImaginaryPartExtractionIsCorrect)
+{
+  // extractImPart encodes i on first use, which all the threads race to do
+  helib::Context context = helib::ContextBuilder<helib::CKKS>()
+                               .m(128)
+                               .precision(20)
+                               .bits(150)
+                               .build();
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  addSomeFrbMatrices(secretKey);
+  const helib::PubKey& publicKey = secretKey;
+  const helib::EncryptedArrayCx& ea = context.getEA().getCx();
+
+  std::vector<std::complex<double>> data(ea.size());
+  for (long i = 0; i < ea.size(); ++i)
+    data[i] = {0.5, double(i) / ea.size()};
+
+  std::vector<helib::Ctxt> results(numThreads, helib::Ctxt(publicKey));
+  std::vector<std::thread> threads;
+  for (long t = 0; t < numThreads; ++t)
+    threads.emplace_back([&, t]() {
+      ea.encrypt(results[t], publicKey, data);
+      ea.extractImPart(results[t]);
+    });
+  for (auto& thread : threads)
+    thread.join();
+
+  for (long t = 0; t < numThreads; ++t) {
+    std::vector<std::complex<double>> decrypted;
+    ea.decrypt(results[t], secretKey, decrypted);
+    for (long i = 0; i < ea.size(); ++i)
+      EXPECT_NEAR(decrypted[i].real(), data[i].imag(), 0.01)
+          << "*** thread " << t << ", slot " << i;
+  }
+}
+
+} // namespace
@@ -0,0 +1,167 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <helib/fhe_stats.h>
+#include <helib/metrics.h>
+#include <helib/timing.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+void tracedLeaf() { HELIB_NTIMER_START(tracedLeaf); }
+
+void tracedRoot()
+{
+  HELIB_NTIMER_START(tracedRoot);
+  HELIB_EXEC_INDEX(8, i)
+  tracedLeaf();
+  HELIB_EXEC_INDEX_END
+}
+
+void countedLeaf()
+{
+  HELIB_NTIMER_START(countedLeaf);
+  volatile long sum = 0;
+  for (long i = 0; i < 100000; i++)
+    sum += i;
+}
+
+long count(const std::string& str, const std::string& pattern)
+{
+  std::regex re(pattern);
+  return std::distance(std::sregex_iterator(str.begin(), str.end(), re),
+                       std::sregex_iterator());
+}
+
+class TestTiming : public ::testing::Test
+{
+protected:
+  virtual void SetUp() override { helib::clearTrace(); }
+  virtual void TearDown() override
+  {
+    helib::setTracing(false);
+    helib::setPerfCounters(false);
+    helib::clearTrace();
+#ifdef HELIB_THREADS
+    helib::SetTaskThreads(1);
+#endif
+  }
+};
+
+TEST_F(TestTiming, spansAreOnlyRecordedWhileTracing)
+{
+  tracedLeaf();
+  helib::setTracing(true);
+  EXPECT_TRUE(helib::isTracing());
+  tracedLeaf();
+  helib::setTracing(false);
+  tracedLeaf();
+
+  std::ostringstream str;
+  helib::writeChromeTrace(str);
+  EXPECT_EQ(count(str.str(), "\"name\":\"tracedLeaf\""), 1);
+  EXPECT_EQ(count(str.str(), "\"parent\":-1"), 1);
+}
+
+TEST_F(TestTiming, tasksInheritTheSpanThatForkedThem)
+{
+#ifdef HELIB_THREADS
+  helib::SetTaskThreads(4);
+#endif
+  helib::setTracing(true);
+  std::thread other(tracedRoot);
+  tracedRoot();
+  other.join();
+  helib::setTracing(false);
+
+  std::ostringstream str;
+  helib::writeChromeTrace(str);
+  const std::string trace = str.str();
+  EXPECT_EQ(count(trace, "\"name\":\"tracedRoot\""), 2);
+  EXPECT_EQ(count(trace, "\"name\":\"tracedLeaf\""), 16);
+  // Only the two roots have no parent
+  EXPECT_EQ(count(trace, "\"parent\":-1"), 2);
+
+  helib::clearTrace();
+  std::ostringstream empty;
+  helib::writeChromeTrace(empty);
+  EXPECT_EQ(count(empty.str(), "\"ph\":\"X\""), 0);
+}
+
+TEST_F(TestTiming, metricsExportHasTimerHistogramsAndOpCounts)
+{
+  tracedLeaf();
+  tracedLeaf();
+  helib::fhe_ops.automorphs.add(3);
+
+  std::ostringstream prometheus;
+  helib::writeMetricsPrometheus(prometheus);
+  const std::string text = prometheus.str();
+  EXPECT_EQ(count(text, "# TYPE helib_timer_seconds histogram"), 1);
+  // All the buckets of a timer are written, the last one holding all calls
+  EXPECT_EQ(count(text, "helib_timer_seconds_bucket\\{name=\"tracedLeaf\""),
+            helib::FHEtimer::numBuckets);
+  EXPECT_EQ(count(text, "name=\"tracedLeaf\",.*,le=\"\\+Inf\"\\} ([0-9]+)"),
+            1);
+  EXPECT_EQ(count(text, "helib_ops_by_primes_total\\{op=\"automorphs\","
+                        "primes=\"3\"\\} [1-9]"),
+            1);
+
+  std::ostringstream json;
+  helib::writeMetricsJSON(json);
+  EXPECT_EQ(count(json.str(), "\"name\":\"tracedLeaf\""), 1);
+  EXPECT_EQ(
+      count(json.str(), "\"automorphs\":\\{\"byPrimes\":\\{\"3\":"),
+      1);
+}
+
+TEST_F(TestTiming, timersOnlyCountEventsWhileTheCountersAreOn)
+{
+  // Nothing to check where the counters cannot be opened (e.g. not Linux, or
+  // forbidden by perf_event_paranoid)
+  if (!helib::setPerfCounters(false))
+    return;
+  countedLeaf();
+  const helib::FHEtimer* timer = helib::getTimerByName("countedLeaf");
+  ASSERT_NE(timer, nullptr);
+  EXPECT_EQ(timer->getPerfCount(helib::PerfEvent::INSTRUCTIONS), 0ul);
+
+  EXPECT_TRUE(helib::setPerfCounters(true));
+  EXPECT_TRUE(helib::arePerfCountersOn());
+  countedLeaf();
+  unsigned long instructions =
+      timer->getPerfCount(helib::PerfEvent::INSTRUCTIONS);
+  EXPECT_GT(instructions, 100000ul);
+
+  helib::setPerfCounters(false);
+  countedLeaf();
+  EXPECT_EQ(timer->getPerfCount(helib::PerfEvent::INSTRUCTIONS), instructions);
+
+  std::ostringstream prometheus;
+  helib::writeMetricsPrometheus(prometheus);
+  EXPECT_EQ(count(prometheus.str(),
+                  "helib_timer_perf_events_total\\{name=\"countedLeaf\",.*,"
+                  "event=\"instructions\"\\} [1-9]"),
+            1);
+  std::ostringstream json;
+  helib::writeMetricsJSON(json);
+  EXPECT_EQ(count(json.str(), "\"perf\":\\{[^}]*\"instructions\":[1-9]"), 1);
+}
+
+} // namespace
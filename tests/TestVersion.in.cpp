@@ -101,4 +101,27 @@ TEST(TestVersion, versionLibString)
   EXPECT_STREQ(libString, "v@PROJECT_VERSION@");
 }
 
+TEST(TestVersion, buildFlagsAgreeWithThePublicDefinitions)
+{
+  const std::string flags = helib::version::buildFlags();
+  EXPECT_NE(flags.find("HEXL="), std::string::npos);
+#ifdef HELIB_THREADS
+  EXPECT_NE(flags.find("THREADS=ON"), std::string::npos);
+#else
+  EXPECT_NE(flags.find("THREADS=OFF"), std::string::npos);
+#endif
+#ifdef HELIB_DEBUG
+  EXPECT_NE(flags.find("DEBUG=ON"), std::string::npos);
+#else
+  EXPECT_NE(flags.find("DEBUG=OFF"), std::string::npos);
+#endif
+}
+
+TEST(TestVersion, kernelsNameEveryDispatchedKernel)
+{
+  const std::string kernels = helib::version::kernels();
+  for (const char* name : {"PGFFT=", " NTT=", " ELTWISE=", " SAMPLE="})
+    EXPECT_NE(kernels.find(name), std::string::npos) << kernels;
+}
+
 } // namespace
@@ -0,0 +1,182 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef MAPPED_READER_H
+#define MAPPED_READER_H
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TOC.h"
+
+// A read-only stream over bytes in memory, which it does not copy
+class MemoryStreambuf : public std::streambuf
+{
+public:
+  MemoryStreambuf(const char* data, std::size_t size)
+  {
+    char* begin = const_cast<char*>(data); // only ever read
+    setg(begin, begin, begin + size);
+  }
+};
+
+// Reads the entries of a TOC file (as written by Writer) from a read-only
+// mapping of the whole file. The entries are only read, and deserialized on
+// demand, when asked for. A single reader can be used by any number of
+// threads at once: a read only touches the mapping and a stream of its own.
+template <typename D>
+class MappedReader
+{
+
+public:
+  // The bytes of an entry in the mapping. They run to the start of the next
+  // entry in the file (or its end), so they may include padding.
+  struct View
+  {
+    const char* data;
+    std::size_t size;
+  };
+
+private:
+  const std::string filepath;
+  const D& scratch;
+  const char* base = nullptr;
+  std::size_t length = 0;
+  TOC toc;
+  std::vector<uint64_t> ends; // ends[i * cols + j] ends entry (i, j)
+
+  // Give advice to the kernel on the pages of [offset, offset + size)
+  void advise(uint64_t offset, std::size_t size, int advice) const
+  {
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset / page * page;
+    madvise(const_cast<char*>(base) + start, offset + size - start, advice);
+  }
+
+  void checkIndex(uint64_t i, uint64_t j) const
+  {
+    if (i >= toc.getRows() || j >= toc.getCols())
+      throw std::out_of_range("Entry (" + std::to_string(i) + ", " +
+                              std::to_string(j) + ") is not in '" + filepath +
+                              "'.");
+  }
+
+public:
+  MappedReader(const std::string& fname, const D& init) :
+      filepath(fname), scratch(init)
+  {
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("Could not open '" + filepath + "'.");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      throw std::runtime_error("Could not map '" + filepath + "'.");
+    }
+    length = st.st_size;
+    void* addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid
+    if (addr == MAP_FAILED)
+      throw std::runtime_error("Could not map '" + filepath + "'.");
+    base = static_cast<const char*>(addr);
+
+    MemoryStreambuf buf(base, length);
+    std::istream str(&buf);
+    toc.read(str);
+    if (!str || uint64_t(toc.memorySize()) > length) {
+      munmap(const_cast<char*>(base), length);
+      throw std::runtime_error("Bad table of contents in '" + filepath +
+                               "'.");
+    }
+
+    // Every entry ends where the next one in the file starts
+    uint64_t n = toc.getRows() * toc.getCols();
+    std::vector<uint64_t> starts(n);
+    for (uint64_t k = 0; k < n; ++k)
+      starts[k] = toc.getIdx(k / toc.getCols(), k % toc.getCols());
+    std::vector<uint64_t> sorted(starts);
+    std::sort(sorted.begin(), sorted.end());
+    ends.resize(n);
+    for (uint64_t k = 0; k < n; ++k) {
+      auto next = std::upper_bound(sorted.begin(), sorted.end(), starts[k]);
+      ends[k] = (next == sorted.end()) ? length : *next;
+    }
+  }
+
+  MappedReader(const MappedReader& other) = delete;
+  MappedReader& operator=(const MappedReader& other) = delete;
+
+  ~MappedReader() { munmap(const_cast<char*>(base), length); }
+
+  // The bytes of entry (i, j), without copying them
+  View view(uint64_t i, uint64_t j) const
+  {
+    checkIndex(i, j);
+    uint64_t start = toc.getIdx(i, j);
+    uint64_t end = ends[i * toc.getCols() + j];
+    if (start < uint64_t(toc.memorySize()) || end > length)
+      throw std::runtime_error("Bad offset of entry in '" + filepath + "'.");
+    return View{base + start, std::size_t(end - start)};
+  }
+
+  void readDatum(D& dest, uint64_t i, uint64_t j) const
+  {
+    View v = view(i, j);
+    MemoryStreambuf buf(v.data, v.size);
+    std::istream str(&buf);
+    dest.read(str);
+  }
+
+  std::unique_ptr<D> readDatum(uint64_t i, uint64_t j) const
+  {
+    std::unique_ptr<D> ptr = std::make_unique<D>(scratch);
+    readDatum(*ptr, i, j);
+    return ptr;
+  }
+
+  // Hints for the kernel: read ahead for a scan through the file in order,
+  // or only read the pages asked for
+  void adviseSequential() const { advise(0, length, MADV_SEQUENTIAL); }
+  void adviseRandom() const { advise(0, length, MADV_RANDOM); }
+
+  // Start reading the pages of row i (or of column j) in the background
+  void prefetchRow(uint64_t i) const
+  {
+    for (uint64_t j = 0; j < toc.getCols(); ++j) {
+      View v = view(i, j);
+      advise(v.data - base, v.size, MADV_WILLNEED);
+    }
+  }
+
+  void prefetchCol(uint64_t j) const
+  {
+    for (uint64_t i = 0; i < toc.getRows(); ++i) {
+      View v = view(i, j);
+      advise(v.data - base, v.size, MADV_WILLNEED);
+    }
+  }
+
+  const TOC& getTOC() const { return toc; }
+};
+
+#endif // MAPPED_READER_H
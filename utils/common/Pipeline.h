@@ -0,0 +1,149 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// A queue of at most capacity items between two threads. Once closed, pop
+// drains what is left; once cancelled, both push and pop give up at once.
+template <typename T>
+class BoundedQueue
+{
+
+private:
+  const std::size_t capacity;
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool closed = false;
+  bool cancelled = false;
+
+public:
+  explicit BoundedQueue(std::size_t capacity) : capacity(capacity) {}
+
+  // Blocks while the queue is full. Returns false if it was cancelled.
+  bool push(T&& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock,
+                 [this] { return cancelled || items.size() < capacity; });
+    if (cancelled)
+      return false;
+    items.push_back(std::move(item));
+    changed.notify_all();
+    return true;
+  }
+
+  // Blocks while the queue is empty and open. Returns false at the end.
+  bool pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock,
+                 [this] { return cancelled || closed || !items.empty(); });
+    if (cancelled || items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    changed.notify_all();
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    changed.notify_all();
+  }
+
+  void cancel()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    cancelled = true;
+    changed.notify_all();
+  }
+};
+
+// Run read, compute and write as three stages with depth batches in flight
+// between each two: read(in) fills the next batch on a reader thread and
+// returns false at the end, compute(in, out) runs on the calling thread (and
+// may use the NTL thread pool), and write(out) runs on a writer thread, in
+// the order of the batches. The first exception thrown by a stage stops the
+// others and is rethrown.
+template <typename In, typename Out>
+void runPipeline(std::size_t depth,
+                 const std::function<bool(In&)>& read,
+                 const std::function<void(In&, Out&)>& compute,
+                 const std::function<void(Out&)>& write)
+{
+  BoundedQueue<In> toCompute(depth);
+  BoundedQueue<Out> toWrite(depth);
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  auto fail = [&](std::exception_ptr e) {
+    {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error)
+        error = e;
+    }
+    toCompute.cancel();
+    toWrite.cancel();
+  };
+
+  std::thread reader([&] {
+    try {
+      In in;
+      while (read(in) && toCompute.push(std::move(in)))
+        in = In();
+      toCompute.close();
+    } catch (...) {
+      fail(std::current_exception());
+    }
+  });
+
+  std::thread writer([&] {
+    try {
+      Out out;
+      while (toWrite.pop(out))
+        write(out);
+    } catch (...) {
+      fail(std::current_exception());
+    }
+  });
+
+  try {
+    In in;
+    while (toCompute.pop(in)) {
+      Out out;
+      compute(in, out);
+      if (!toWrite.push(std::move(out)))
+        break;
+    }
+    toWrite.close();
+  } catch (...) {
+    fail(std::current_exception());
+  }
+
+  reader.join();
+  writer.join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+#endif // PIPELINE_H
@@ -67,7 +67,7 @@ public:
     s.read(reinterpret_cast<char*>(idx.get()), sizeof(uint64_t) * rows * cols);
   }
 
-  long memorySize() { return sizeof(uint64_t) * (2 + rows * cols); }
+  long memorySize() const { return sizeof(uint64_t) * (2 + rows * cols); }
 };
 
 #endif // TOC_H
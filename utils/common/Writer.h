@@ -14,20 +14,44 @@
 #define WRITER_H
 
 #include <string>
+#include <filesystem>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <exception>
+#include <sstream>
 
 #include "TOC.h"
 
+// Writes the records of a TOC file one after the other, in the order they
+// are given. The TOC is kept in memory and written out once on close, so the
+// records go out through one large buffer without a seek between them. The
+// file is first allocated to an estimate of its size, so that large outputs
+// are laid out in one piece, and truncated to what was written on close.
 template <typename D>
 class Writer
 {
 
 private:
-  std::shared_ptr<TOC> toc;
-  std::fstream writeStream;
+  // What a writer and its copies share: the file, the TOC and where the next
+  // record goes
+  struct Output
+  {
+    TOC toc;
+    std::fstream stream;
+    std::unique_ptr<char[]> buffer;
+    uint64_t end;
+    std::mutex mutex;
+
+    Output(uint64_t rows, uint64_t cols) : toc(rows, cols) {}
+  };
+
+  std::shared_ptr<Output> output;
   const std::string filepath;
+  const bool owner; // Whether this writer closes the file
+
+  // Large outputs are written through a buffer of this many bytes
+  static constexpr long bufferSize = 1L << 23;
 
   void allocFile(long sizeInBytes) const
   {
@@ -60,53 +84,86 @@ private:
   }
 
 public:
-  // A fresh writer is responsible for setting the TOC.
+  // recordSizeInBytes is an estimate of the size of a record, used only to
+  // allocate the file
   Writer(const std::string& fpath,
          uint64_t rows,
          uint64_t cols,
          long recordSizeInBytes) :
-      // File needs alloc in body before stream is opened.
-      toc(std::make_shared<TOC>(rows, cols)),
-      filepath(fpath)
+      output(std::make_shared<Output>(rows, cols)),
+      filepath(fpath),
+      owner(true)
   {
-    // Estimate for ctxt sizes.
-    const long tocSize = toc->memorySize();
+    const long tocSize = output->toc.memorySize();
     const long fileSize = (cols * rows * recordSizeInBytes) + tocSize;
     allocFile(fileSize);
 
-    // Set the TOC
-    for (uint64_t j = 0; j < cols; ++j)
-      for (uint64_t i = 0; i < rows; ++i)
-        toc->setIdx(i, j, (i + j * rows) * recordSizeInBytes + tocSize);
-
-    // Write it to file
-    writeStream.open(fpath, std::ios::in | std::ios::out | std::ios::binary);
-    if (!writeStream.is_open())
+    // The buffer must be set before the stream is opened
+    output->buffer = std::make_unique<char[]>(bufferSize);
+    output->stream.rdbuf()->pubsetbuf(output->buffer.get(), bufferSize);
+    output->stream.open(fpath,
+                        std::ios::in | std::ios::out | std::ios::binary);
+    if (!output->stream.is_open())
       throw std::runtime_error("Could not open '" + fpath +
                                "' for writing out TOC.");
-    writeStream.seekp(0);
-    toc->write(writeStream);
+
+    // The records start after the TOC, which is written on close
+    output->stream.seekp(tocSize);
+    output->end = tocSize;
   }
 
-  // A copied writer is not responsible for setting the TOC.
+  // A copied writer appends to the same file, so that threads can each write
+  // through one of their own. It is not responsible for closing the file.
   Writer(const Writer& other) :
-      toc(other.toc),
-      writeStream(other.filepath,
-                  std::ios::in | std::ios::out | std::ios::binary),
-      filepath(other.filepath)
+      output(other.output), filepath(other.filepath), owner(false)
+  {}
+
+  Writer& operator=(const Writer& other) = delete;
+
+  ~Writer()
+  {
+    if (!owner)
+      return;
+    try {
+      close();
+    } catch (...) {
+    }
+  }
+
+  // Append data as the record at (row, col). The record is serialized before
+  // the file is locked, so that copies only wait on each other to copy bytes.
+  void write(const D& data, uint64_t row, uint64_t col)
   {
-    if (!writeStream.is_open())
-      throw std::runtime_error("Could not open file '" + other.filepath +
-                               "' for copied Writer.");
+    std::ostringstream record;
+    data.writeTo(record);
+    const std::string bytes = record.str();
+
+    std::lock_guard<std::mutex> lock(output->mutex);
+    if (!output->stream.is_open())
+      throw std::runtime_error("Writer for '" + filepath + "' is closed.");
+    output->toc.setIdx(row, col, output->end);
+    output->stream.write(bytes.data(), bytes.size());
+    output->end += bytes.size();
+
+    if (!output->stream)
+      throw std::runtime_error("Could not write to '" + filepath + "'.");
   }
 
-  void writeByLocation(const D& data, uint64_t row, uint64_t col)
+  // Write out the TOC, flush the records and cut the file at the last one
+  void close()
   {
-    writeStream.seekp(toc->getIdx(row, col));
-    data.writeTo(writeStream);
+    std::lock_guard<std::mutex> lock(output->mutex);
+    if (!output->stream.is_open())
+      return;
+    output->stream.seekp(0);
+    output->toc.write(output->stream);
+    output->stream.close();
+    if (output->stream.fail())
+      throw std::runtime_error("Could not write to '" + filepath + "'.");
+    std::filesystem::resize_file(filepath, output->end);
   }
 
-  TOC& getTOC() { return *toc; }
+  TOC& getTOC() { return output->toc; }
 };
 
 #endif // WRITER_H
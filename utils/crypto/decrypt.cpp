@@ -12,13 +12,18 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstdlib> // ldiv
+#include <functional>
+#include <vector>
 
 #include <helib/helib.h>
 #include <helib/ArgMap.h>
 
 #include <NTL/BasicThreadPool.h>
 
-#include "Reader.h"
+#include "Pipeline.h"
+#include "MappedReader.h"
 #include "common.h"
 
 struct CmdLineOpts
@@ -51,13 +56,12 @@ void decryptFromTo(const CmdLineOpts& cmdLineOpts,
                              cmdLineOpts.ctxtFilePath + "'.");
   }
 
-  // Read in a batch
-  std::vector<helib::Ptxt<SCHEME>> ptxts;
-  std::vector<helib::Ctxt> ctxts;
   helib::Ctxt zero_ctxt(sk);
   helib::Ptxt<SCHEME> zero_ptxt(context);
 
-  Reader<helib::Ctxt> reader(cmdLineOpts.ctxtFilePath, zero_ctxt);
+  // The ciphertexts are read from a mapping of the file, in order
+  MappedReader<helib::Ctxt> reader(cmdLineOpts.ctxtFilePath, zero_ctxt);
+  reader.adviseSequential();
 
   std::pair<long, long> dims = {reader.getTOC().getRows(),
                                 reader.getTOC().getCols()};
@@ -78,39 +82,49 @@ void decryptFromTo(const CmdLineOpts& cmdLineOpts,
 
   writeDimsHeader(*out, dims);
 
-  for (long remaining = dims.first * dims.second, readBatches = 0;
-       remaining > 0;
-       remaining -= cmdLineOpts.batchSize, ++readBatches) {
-
-    // Read in a batch
-    long bsz =
-        (remaining > cmdLineOpts.batchSize) ? cmdLineOpts.batchSize : remaining;
-    ptxts.resize(bsz, zero_ptxt);
-    ctxts.resize(bsz, zero_ctxt);
-
-    NTL_EXEC_RANGE(ctxts.size(), first, last)
-    Reader<helib::Ctxt> threadReader(reader);
-    for (long i = first; i < last; ++i) {
-      if (dims.second == 1) {
-        threadReader.readDatum(ctxts[i],
-                               readBatches * cmdLineOpts.batchSize + i,
-                               0);
-      } else {
-        ldiv_t qr = ldiv(readBatches * cmdLineOpts.batchSize + i, dims.second);
-        threadReader.readDatum(ctxts[i], qr.quot, qr.rem);
-      }
-    }
-
-    // Decrypt using NTL threads
-    for (long i = first; i < last; ++i) {
-      sk.Decrypt(ptxts[i], ctxts[i]);
-    }
-    NTL_EXEC_RANGE_END
-
-    // Write out to stream
-    for (const auto& ptxt : ptxts)
-      *out << ptxt << std::endl;
-  }
+  const long total = dims.first * dims.second;
+
+  // Three stages, so that reading and writing overlap with decrypting: a
+  // reader thread deserializes a batch of ciphertexts, the NTL threads decrypt
+  // it, and a writer thread writes out the plaintexts, two batches at most
+  // waiting between each two stages.
+  long nextStart = 0;
+  std::function<bool(std::vector<helib::Ctxt>&)> read =
+      [&](std::vector<helib::Ctxt>& ctxts) {
+        if (nextStart >= total)
+          return false;
+        long bsz = std::min(cmdLineOpts.batchSize, total - nextStart);
+        ctxts.resize(bsz, zero_ctxt);
+        for (long i = 0; i < bsz; ++i) {
+          ldiv_t qr = ldiv(nextStart + i, dims.second);
+          reader.readDatum(ctxts[i], qr.quot, qr.rem);
+        }
+        nextStart += bsz;
+        return true;
+      };
+
+  std::function<void(std::vector<helib::Ctxt>&,
+                     std::vector<helib::Ptxt<SCHEME>>&)>
+      decrypt = [&](std::vector<helib::Ctxt>& ctxts,
+                    std::vector<helib::Ptxt<SCHEME>>& ptxts) {
+        ptxts.resize(ctxts.size(), zero_ptxt);
+        NTL_EXEC_RANGE(ctxts.size(), first, last)
+        for (long i = first; i < last; ++i)
+          sk.Decrypt(ptxts[i], ctxts[i]);
+        NTL_EXEC_RANGE_END
+      };
+
+  std::function<void(std::vector<helib::Ptxt<SCHEME>>&)> write =
+      [&](std::vector<helib::Ptxt<SCHEME>>& ptxts) {
+        for (const auto& ptxt : ptxts)
+          *out << ptxt << std::endl;
+      };
+
+  runPipeline<std::vector<helib::Ctxt>, std::vector<helib::Ptxt<SCHEME>>>(
+      2,
+      read,
+      decrypt,
+      write);
 }
 
 int main(int argc, char* argv[])
@@ -131,7 +145,7 @@ int main(int argc, char* argv[])
       .arg("-o", cmdLineOpts.outFilePath,
            "the output file name.", nullptr)
       .arg("-b", cmdLineOpts.batchSize,
-           "batch size, how many ctxts in memory. If not set or 0 defaults to the number of threads used.")
+           "batch size, how many ctxts are processed at a time (a few batches are in memory at once, to overlap I/O with computation). If not set or 0 defaults to the number of threads used.")
       .arg("-n", cmdLineOpts.nthreads,
            "number of threads to use. If not set or 0 defaults to the number of concurrent threads supported.", "num. of cores")
     .parse(argc, argv);
@@ -14,10 +14,16 @@
 #include <fstream>
 #include <cstdio>
 #include <cstdlib> // ldiv, system
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include <helib/helib.h>
 #include <helib/ArgMap.h>
 
+#include "Pipeline.h"
 #include "Writer.h"
 #include "common.h"
 
@@ -33,6 +39,20 @@ struct CmdLineOpts
   long offset = 0;
 };
 
+// A batch of input lines and the ciphertexts made from them, starting at
+// element start of the data (in row-major order)
+struct LineBatch
+{
+  long start = 0;
+  std::vector<std::string> lines;
+};
+
+struct CtxtBatch
+{
+  long start = 0;
+  std::vector<helib::Ctxt> ctxts;
+};
+
 template <typename SCHEME>
 void encryptFromTo(const CmdLineOpts& cmdLineOpts,
                    const helib::Context& context,
@@ -48,59 +68,58 @@ void encryptFromTo(const CmdLineOpts& cmdLineOpts,
 
   std::pair<long, long> dims = parseDimsHeader(readline(dataFile));
 
-  // Here we 'batch'. Read in the batch size into memory.
-  // Then, process with n threads. Repeat.
   // Write the header to file
   Writer<helib::Ctxt> writer(cmdLineOpts.outFilePath,
                              dims.first,
                              dims.second,
                              estimateCtxtSize(context, cmdLineOpts.offset));
 
-  // Setting the stage
-  std::vector<helib::Ptxt<SCHEME>> ptxts;
-  std::vector<helib::Ctxt> ctxts;
-  helib::Ctxt zero_ctxt(pk);
-  helib::Ptxt<SCHEME> zero_ptxt(context);
-
-  // Read in a batch
-  for (long remaining = dims.first * dims.second, writtenBatches = 0;
-       remaining > 0;
-       remaining -= cmdLineOpts.batchSize, ++writtenBatches) {
-
-    // Local batchSize
-    long bsz =
-        (remaining > cmdLineOpts.batchSize) ? cmdLineOpts.batchSize : remaining;
-    ptxts.resize(bsz, zero_ptxt);
-    ctxts.resize(bsz, zero_ctxt);
-
-    std::vector<std::string> ptxt_strings(ptxts.size());
-    for (std::size_t j = 0; j < ptxts.size(); j++) {
-      std::getline(dataFile, ptxt_strings[j], '\n');
-    }
-
-    // Spread across n threads
-    NTL_EXEC_RANGE(ctxts.size(), first, last)
-    Writer<helib::Ctxt> threadWriter(writer);
-    for (long i = first; i < last; ++i) {
-      std::istringstream istr(ptxt_strings[i]);
-      istr >> ptxts[i];
-      pk.Encrypt(ctxts[i], ptxts[i]);
+  const helib::Ctxt zero_ctxt(pk);
+  const helib::Ptxt<SCHEME> zero_ptxt(context);
+  const long total = dims.first * dims.second;
+
+  // Three stages, so that reading the next batch and writing the last one
+  // overlap with encrypting a batch: a reader thread reads in the lines, the
+  // NTL threads parse and encrypt them, and a writer thread writes out the
+  // ciphertexts, two batches at most waiting between each two stages.
+  long nextStart = 0;
+  std::function<bool(LineBatch&)> read = [&](LineBatch& batch) {
+    if (nextStart >= total)
+      return false;
+    long bsz = std::min(cmdLineOpts.batchSize, total - nextStart);
+    batch.start = nextStart;
+    batch.lines.resize(bsz);
+    for (std::string& line : batch.lines)
+      std::getline(dataFile, line, '\n');
+    nextStart += bsz;
+    return true;
+  };
+
+  std::function<void(LineBatch&, CtxtBatch&)> encrypt =
+      [&](LineBatch& batch, CtxtBatch& result) {
+        long bsz = batch.lines.size();
+        std::vector<helib::Ptxt<SCHEME>> ptxts(bsz, zero_ptxt);
+        result.start = batch.start;
+        result.ctxts.resize(bsz, zero_ctxt);
+
+        NTL_EXEC_RANGE(bsz, first, last)
+        for (long i = first; i < last; ++i) {
+          std::istringstream istr(batch.lines[i]);
+          istr >> ptxts[i];
+          pk.Encrypt(result.ctxts[i], ptxts[i]);
+        }
+        NTL_EXEC_RANGE_END
+      };
+
+  std::function<void(CtxtBatch&)> write = [&](CtxtBatch& result) {
+    for (long i = 0; i < long(result.ctxts.size()); ++i) {
+      ldiv_t qr = ldiv(result.start + i, dims.second);
+      writer.write(result.ctxts[i], qr.quot, qr.rem);
     }
+  };
 
-    // Write to file
-    for (long i = first; i < last; ++i) {
-      if (dims.second == 1) {
-        threadWriter.writeByLocation(ctxts[i],
-                                     writtenBatches * cmdLineOpts.batchSize + i,
-                                     0);
-      } else {
-        ldiv_t qr =
-            ldiv(writtenBatches * cmdLineOpts.batchSize + i, dims.second);
-        threadWriter.writeByLocation(ctxts[i], qr.quot, qr.rem);
-      }
-    }
-    NTL_EXEC_RANGE_END
-  }
+  runPipeline<LineBatch, CtxtBatch>(2, read, encrypt, write);
+  writer.close();
 }
 
 int main(int argc, char* argv[])
@@ -121,11 +140,11 @@ int main(int argc, char* argv[])
       .arg("-o", cmdLineOpts.outFilePath,
            "the output file name.", nullptr)
       .arg("-b", cmdLineOpts.batchSize,
-           "batch size, how many ctxts in memory. If not set or 0 defaults to the number of threads used.")
+           "batch size, how many ctxts are processed at a time (a few batches are in memory at once, to overlap I/O with computation). If not set or 0 defaults to the number of threads used.")
       .arg("-n", cmdLineOpts.nthreads,
            "number of threads to use. If not set or 0 defaults to the number of concurrent threads supported.", "num. of cores")
       .arg("--offset", cmdLineOpts.offset,
-           "byte packing offset in output file.")
+           "bytes added to the estimated size of a ciphertext, to allocate the output file.")
     .parse(argc, argv);
   // clang-format on
 
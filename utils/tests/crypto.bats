@@ -33,6 +33,22 @@ function generate-bootstrap-data {
   "${encode}" "${prefix_bootstrap}.dat" "${prefix_bootstrap}.info" "BGV" > "${prefix_bootstrap}.ptxt"
 }
 
+# Check that the entries of a TOC file start right after the TOC and follow
+# one another in row-major order
+function check-appended-layout {
+  python3 - "$1" <<'EOF'
+import os, struct, sys
+with open(sys.argv[1], "rb") as f:
+    rows, cols = struct.unpack("<2Q", f.read(16))
+    idx = struct.unpack("<%dQ" % (rows * cols), f.read(8 * rows * cols))
+size = os.path.getsize(sys.argv[1])
+toc_size = 8 * (2 + rows * cols)
+ok = idx[0] == toc_size and idx[-1] < size
+ok = ok and all(a < b for a, b in zip(idx, idx[1:]))
+sys.exit(0 if ok else 1)
+EOF
+}
+
 function setup {
   mkdir -p $tmp_folder
   cd $tmp_folder
@@ -67,6 +83,13 @@ function teardown {
   assert [ -f "${prefix_bgv}.ctxt" ]
 }
 
+@test "encrypt appends the ciphertexts after the TOC in order" {
+  run $encrypt "${pk_file_bgv}" "${prefix_bgv}.ptxt" -n 4 -b 5
+  assert [ "$status" -eq 0 ]
+  run check-appended-layout "${prefix_bgv}.ctxt"
+  assert [ "$status" -eq 0 ]
+}
+
 @test "decrypt works with batch size greater than 1" {
   run $encrypt "${pk_file_bgv}" "${prefix_bgv}.ptxt"
   assert [ "$status" -eq 0 ]
@@ -161,6 +184,19 @@ function teardown {
   assert [ "$status" -eq 0 ]
 }
 
+@test "BGV: data == decrypt(encrypt(data)) with many ciphertexts written by many threads" {
+  genData "${prefix_bgv}_many.dat" 40 "BGV"
+  "${encode}" "${prefix_bgv}_many.dat" "${prefix_bgv}.info" "BGV" > "${prefix_bgv}_many.ptxt"
+  run $encrypt "${pk_file_bgv}" "${prefix_bgv}_many.ptxt" -n 4 -b 3
+  assert [ "$status" -eq 0 ]
+  run check-appended-layout "${prefix_bgv}_many.ctxt"
+  assert [ "$status" -eq 0 ]
+  run $decrypt "${sk_file_bgv}" "${prefix_bgv}_many.ctxt" -o result_bgv_many.decrypt -n 4 -b 5
+  assert [ "$status" -eq 0 ]
+  diff "${prefix_bgv}_many.ptxt" result_bgv_many.decrypt
+  assert [ "$status" -eq 0 ]
+}
+
 @test "BGV: data == decrypt(encrypt(data)) with bootstrappable context" {
   # This test needs bootstrapping context to work
   generate-bootstrap-data
@@ -226,6 +262,19 @@ function teardown {
   assert [ "$status" -eq 0 ]
 }
 
+@test "CKKS: data == decrypt(encrypt(data)) with many ciphertexts written by many threads" {
+  genData "${prefix_ckks}_many.dat" 40 "CKKS"
+  "${encode}" "${prefix_ckks}_many.dat" "${prefix_ckks}.info" "CKKS" > "${prefix_ckks}_many.ptxt"
+  run $encrypt "${pk_file_ckks}" "${prefix_ckks}_many.ptxt" -n 4 -b 3
+  assert [ "$status" -eq 0 ]
+  run check-appended-layout "${prefix_ckks}_many.ctxt"
+  assert [ "$status" -eq 0 ]
+  run $decrypt "${sk_file_ckks}" "${prefix_ckks}_many.ctxt" -o "${prefix_ckks}_many.decrypt" -n 4 -b 5
+  assert [ "$status" -eq 0 ]
+  ${diff_threshold} --decrypt "${prefix_ckks}_many.ptxt" "${prefix_ckks}_many.decrypt"
+  assert [ "$status" -eq 0 ]
+}
+
 @test "CKKS: encrypt fails if data has more elements than slots" {
   sed 's/nslots = \([0-9][0-9]*\)/nslots = 1\1/' < "${prefix_ckks}.info" > "${prefix_ckks}_more_slots.info"
   "${encode}" "${prefix_ckks}.dat" "${prefix_ckks}_more_slots.info" "CKKS" > "${prefix_ckks}_more_slots.ptxt"
@@ -22,6 +22,7 @@ generate_data="$utils_dir/tests/gen-data.py"
 encode="$utils_dir/coders/encode.py"
 decode="$utils_dir/coders/decode.py"
 create_context="$utils_dir/build/bin/create-context"
+tune_context="$utils_dir/build/bin/tune-context"
 encrypt="$utils_dir/build/bin/encrypt"
 decrypt="$utils_dir/build/bin/decrypt"
 test_bootstrap="$utils_dir/build/test/bin/test_bootstrap"
@@ -91,7 +92,7 @@ function check_python36 {
 
 function check_locations {
   for prog in "$diff_threshold" "$generate_data" "$encode" "$decode"\
-              "$create_context" "$encrypt" "$decrypt"; do
+              "$create_context" "$tune_context" "$encrypt" "$decrypt"; do
     if [ ! -f "$prog" ]; then
       >&2 echo "${prog} does not exist."
       exit 1
@@ -0,0 +1,55 @@
+#!/usr/bin/env bats
+
+# Copyright (C) 2020 IBM Corp.
+# This program is Licensed under the Apache License, Version 2.0
+# (the "License"); you may not use this file except in compliance
+# with the License. You may obtain a copy of the License at
+#   http://www.apache.org/licenses/LICENSE-2.0
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License. See accompanying LICENSE file.
+
+load "std"
+
+function setup {
+  mkdir -p $tmp_folder
+  cd $tmp_folder
+  print-info-location
+  check_python36
+  check_locations
+}
+
+function teardown {
+  cd -
+  remove-test-directory "$tmp_folder"
+}
+
+@test "fails when passing invalid bootstrap option" {
+  run "${tune_context}" --bootstrap INVALID
+  assert [ "$status" -ne 0 ]
+  assert [ "$output" == "Bad boostrap option: INVALID.  Allowed options are NONE, THIN, THICK." ]
+}
+
+@test "recrypt benchmark requires bootstrapping" {
+  run "${tune_context}" --recrypt
+  assert [ "$status" -ne 0 ]
+  assert [ "$output" == "--recrypt requires a bootstrapping option." ]
+}
+
+@test "fails when no m has enough slots" {
+  run "${tune_context}" -p 13 --slots 100 --min-m 3 --max-m 10
+  assert [ "$status" -ne 0 ]
+  assert [ "$output" == "No m in [3, 10] has enough slots at the target security level." ]
+}
+
+@test "tuned toy params can be used by create-context" {
+  run "${tune_context}" -p 13 --security 0 --depth 1 --slots 3 --min-m 7 --max-m 40 --candidates 2 --reps 1 -o tuned.params
+  assert [ "$status" -eq 0 ]
+  assert [ -f "tuned.params" ]
+  run "${create_context}" tuned.params -o tuned
+  assert [ "$status" -eq 0 ]
+  assert [ -f "tuned.pk" ]
+  assert [ -f "tuned.sk" ]
+}
@@ -0,0 +1,408 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+
+// Search for the BGV parameters that give the best throughput on this
+// machine, for a given security level, plaintext space, depth and number of
+// slots. The result is written as a parameters file for create-context.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <memory>
+
+#include <helib/helib.h>
+#include <helib/ArgMap.h>
+
+struct CmdLineOpts
+{
+  long security = 128;
+  long p = 2;
+  long r = 1;
+  long depth = 1;
+  long slots = 1;
+  std::string bootstrappable = "NONE"; // NONE | THIN | THICK
+  bool benchRecrypt = false;
+  long minM = 3;
+  long maxM = 32768;
+  long candidates = 8;
+  long bitsPerLevel = 40;
+  long bootBits = 500;
+  long c = 2;
+  long reps = 3;
+  std::string outputPath;
+};
+
+// A cyclotomic ring that has enough slots, before any context is built
+struct Candidate
+{
+  long m;
+  long phim;
+  long nslots;
+  std::vector<long> mvec; // only for bootstrapping
+};
+
+// A candidate that qualified, with its timings in seconds
+struct Result
+{
+  Candidate cand;
+  long bits;
+  double security;
+  double tMul;
+  double tAutomorph;
+  double tRecrypt;
+  std::vector<long> gens;
+  std::vector<long> ords;
+
+  double score(bool withRecrypt) const
+  {
+    // Time per slot of the operations that were benchmarked
+    double t = tMul + tAutomorph + (withRecrypt ? tRecrypt : 0.0);
+    return t / cand.nslots;
+  }
+};
+
+static bool bootstrapping(const CmdLineOpts& opts)
+{
+  return opts.bootstrappable != "NONE";
+}
+
+// The bits to start the search from, refined by actually running the circuit
+static long startBits(const CmdLineOpts& opts)
+{
+  return opts.bitsPerLevel * (opts.depth + 1) +
+         (bootstrapping(opts) ? opts.bootBits : 0);
+}
+
+// An optimistic estimate of the security of m with the given bits, to prune
+// the rings that cannot qualify (the chain also has special primes)
+static double estimateSecurity(long m, long phim, long bits, bool boot)
+{
+  double s = 3.2;
+  if ((m & (m - 1)) != 0) // not power of two
+    s *= std::sqrt(double(m));
+  double log2AlphaInv = bits - std::log2(s);
+  long hwt = boot ? helib::BOOT_DFLT_SK_HWT : 0;
+  return helib::lweEstimateSecurity(phim, log2AlphaInv, hwt);
+}
+
+static std::vector<Candidate> enumerateCandidates(const CmdLineOpts& opts)
+{
+  std::vector<Candidate> all;
+  for (long m = std::max(opts.minM, 3L); m <= opts.maxM; m++) {
+    if (NTL::GCD(m, opts.p) != 1)
+      continue;
+    long phim = helib::phi_N(m);
+    long nslots = phim / helib::multOrd(opts.p, m);
+    if (nslots < opts.slots)
+      continue;
+    if (opts.security > 0 &&
+        estimateSecurity(m, phim, startBits(opts), bootstrapping(opts)) <
+            opts.security)
+      continue;
+
+    Candidate cand{m, phim, nslots, {}};
+    if (bootstrapping(opts)) {
+      // Bootstrapping needs m split into (at least two) co-prime factors
+      helib::pp_factorize(cand.mvec, m);
+      if (cand.mvec.size() < 2)
+        continue;
+    }
+    all.push_back(cand);
+  }
+
+  // Benchmark the rings with the smallest cost per slot first
+  auto cheaper = [](const Candidate& a, const Candidate& b) {
+    double ca = double(a.phim) / a.nslots;
+    double cb = double(b.phim) / b.nslots;
+    return (ca != cb) ? ca < cb : a.phim < b.phim;
+  };
+  std::sort(all.begin(), all.end(), cheaper);
+  if (long(all.size()) > opts.candidates)
+    all.resize(opts.candidates);
+  return all;
+}
+
+static std::unique_ptr<helib::Context> buildContext(const CmdLineOpts& opts,
+                                                    const Candidate& cand,
+                                                    long bits)
+{
+  helib::ContextBuilder<helib::BGV> cb;
+  cb.m(cand.m).p(opts.p).r(opts.r).bits(bits).c(opts.c);
+  if (bootstrapping(opts)) {
+    cb.bootstrappable(true).mvec(cand.mvec);
+    if (opts.bootstrappable == "THICK")
+      cb.thickboot();
+    else
+      cb.thinboot();
+  }
+  return std::unique_ptr<helib::Context>(cb.buildPtr());
+}
+
+// The average time of fn over opts.reps runs, in seconds
+template <typename Fn>
+static double timeIt(const CmdLineOpts& opts, Fn fn)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < opts.reps; i++)
+    fn();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / opts.reps;
+}
+
+static void recrypt(const CmdLineOpts& opts,
+                    const helib::PubKey& pk,
+                    helib::Ctxt& ctxt)
+{
+  if (opts.bootstrappable == "THIN")
+    pk.thinReCrypt(ctxt);
+  else
+    pk.reCrypt(ctxt);
+}
+
+// An encryption of random integers in the slots, which is also a valid
+// input for thin bootstrapping
+static helib::Ctxt encryptRandom(const helib::PubKey& pk,
+                                 helib::Ptxt<helib::BGV>& ptxt)
+{
+  const helib::Context& context = pk.getContext();
+  long p2r = context.getAlMod().getPPowR();
+  std::vector<long> data(context.getNSlots());
+  for (long& x : data)
+    x = NTL::RandomBnd(p2r);
+  ptxt = helib::Ptxt<helib::BGV>(context, data);
+
+  helib::Ctxt ctxt(pk);
+  pk.Encrypt(ctxt, ptxt);
+  return ctxt;
+}
+
+// Run the circuit of the given depth (after a recryption when
+// bootstrapping), and check that it decrypts correctly
+static bool runsCircuit(const CmdLineOpts& opts, const helib::SecKey& sk)
+{
+  const helib::PubKey& pk = sk;
+  helib::Ptxt<helib::BGV> expected, decrypted(pk.getContext());
+  helib::Ctxt ctxt = encryptRandom(pk, expected);
+  if (bootstrapping(opts))
+    recrypt(opts, pk, ctxt);
+  for (long i = 0; i < opts.depth; i++) {
+    ctxt.square();
+    expected.square();
+  }
+  if (ctxt.bitCapacity() <= 0)
+    return false;
+  sk.Decrypt(decrypted, ctxt);
+  return decrypted == expected;
+}
+
+static bool tune(const CmdLineOpts& opts, const Candidate& cand, Result& res)
+{
+  const long maxAttempts = 5;
+  for (long attempt = 0, bits = startBits(opts); attempt < maxAttempts;
+       attempt++, bits += opts.bitsPerLevel) {
+    std::unique_ptr<helib::Context> context = buildContext(opts, cand, bits);
+    double security = context->securityLevel();
+    if (security < opts.security)
+      return false; // more bits would only lower it
+
+    helib::SecKey sk(*context);
+    sk.GenSecKey();
+    helib::addSome1DMatrices(sk);
+    if (bootstrapping(opts)) {
+      helib::addFrbMatrices(sk);
+      sk.genRecryptData();
+    }
+    if (!runsCircuit(opts, sk))
+      continue;
+
+    helib::Ptxt<helib::BGV> ptxt;
+    const helib::Ctxt fresh = encryptRandom(sk, ptxt);
+
+    const helib::PAlgebra& zMStar = context->getZMStar();
+    long k = (zMStar.numOfGens() > 0) ? zMStar.ZmStarGen(0) : 1;
+
+    res.cand = cand;
+    res.bits = bits;
+    res.security = security;
+    res.tMul = timeIt(opts, [&]() {
+      helib::Ctxt c = fresh;
+      c.multiplyBy(fresh);
+    });
+    res.tAutomorph = timeIt(opts, [&]() {
+      helib::Ctxt c = fresh;
+      c.smartAutomorph(k);
+    });
+    res.tRecrypt = 0.0;
+    if (bootstrapping(opts) && opts.benchRecrypt)
+      res.tRecrypt = timeIt(opts, [&]() {
+        helib::Ctxt c = fresh;
+        recrypt(opts, sk, c);
+      });
+
+    res.gens.clear();
+    res.ords.clear();
+    for (long i = 0; i < zMStar.numOfGens(); i++) {
+      res.gens.push_back(zMStar.ZmStarGen(i));
+      long ord = zMStar.OrderOf(i);
+      res.ords.push_back(zMStar.SameOrd(i) ? ord : -ord);
+    }
+    return true;
+  }
+  return false;
+}
+
+static std::string toVecString(const std::vector<long>& v)
+{
+  std::string s = "[";
+  for (std::size_t i = 0; i < v.size(); i++)
+    s += (i ? " " : "") + std::to_string(v[i]);
+  return s + "]";
+}
+
+// Write the parameters in the format read by create-context
+static void writeParams(std::ostream& out,
+                        const CmdLineOpts& opts,
+                        const Result& res)
+{
+  out << "# Generated by tune-context: security=" << long(res.security)
+      << " nslots=" << res.cand.nslots << " depth=" << opts.depth << "\n";
+  out << "p=" << opts.p << "\n";
+  out << "m=" << res.cand.m << "\n";
+  out << "r=" << opts.r << "\n";
+  out << "c=" << opts.c << "\n";
+  out << "Qbits=" << res.bits << "\n";
+  if (bootstrapping(opts)) {
+    out << "mvec=" << toVecString(res.cand.mvec) << "\n";
+    out << "gens=" << toVecString(res.gens) << "\n";
+    out << "ords=" << toVecString(res.ords) << "\n";
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  CmdLineOpts opts;
+
+  // clang-format off
+  helib::ArgMap()
+        .toggle()
+          .arg("--recrypt", opts.benchRecrypt,
+               "include reCrypt in the benchmark.", nullptr)
+        .separator(helib::ArgMap::Separator::WHITESPACE)
+        .named()
+          .arg("--security", opts.security, "the target security level.")
+          .arg("-p", opts.p, "the plaintext prime.")
+          .arg("-r", opts.r, "the plaintext is modulo p^r.")
+          .arg("--depth", opts.depth, "the required multiplicative depth.")
+          .arg("--slots", opts.slots, "the minimum number of slots.")
+          .arg("--bootstrap", opts.bootstrappable,
+               "choose boostrapping option NONE | THIN | THICK.")
+          .arg("--min-m", opts.minM, "the smallest m to consider.")
+          .arg("--max-m", opts.maxM, "the largest m to consider.")
+          .arg("--candidates", opts.candidates,
+               "how many rings to benchmark.")
+          .arg("--bits-per-level", opts.bitsPerLevel,
+               "the modulus bits to start from (and add) per level.")
+          .arg("--boot-bits", opts.bootBits,
+               "the modulus bits to start from for bootstrapping.")
+          .arg("-c", opts.c, "the number of columns of the key-switching "
+               "matrices.")
+          .arg("--reps", opts.reps, "the number of timed runs of each "
+               "operation.")
+          .arg("-o", opts.outputPath,
+               "write the parameters file here (default: stdout).", nullptr)
+        .parse(argc, argv);
+  // clang-format on
+
+  if (opts.p < 2 || opts.r < 1) {
+    std::cerr << "Invalid plaintext modulus. "
+                 "p must be a prime number greater than 1 and r positive."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (opts.bootstrappable != "NONE" && opts.bootstrappable != "THIN" &&
+      opts.bootstrappable != "THICK") {
+    std::cerr << "Bad boostrap option: " << opts.bootstrappable
+              << ".  Allowed options are NONE, THIN, THICK." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (opts.benchRecrypt && !bootstrapping(opts)) {
+    std::cerr << "--recrypt requires a bootstrapping option." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (opts.depth < 0 || opts.slots < 1 || opts.candidates < 1 ||
+      opts.bitsPerLevel < 1 || opts.reps < 1) {
+    std::cerr << "The depth must be non-negative, and the number of slots, "
+                 "candidates, bits per level and reps positive."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<Candidate> candidates = enumerateCandidates(opts);
+  if (candidates.empty()) {
+    std::cerr << "No m in [" << opts.minM << ", " << opts.maxM
+              << "] has enough slots at the target security level."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<Result> results;
+  for (const Candidate& cand : candidates) {
+    Result res;
+    bool ok = false;
+    try {
+      ok = tune(opts, cand, res);
+    } catch (const std::exception& e) {
+      std::cerr << "m=" << cand.m << ": skipped (" << e.what() << ")"
+                << std::endl;
+      continue;
+    }
+    if (!ok) {
+      std::cerr << "m=" << cand.m << ": does not qualify" << std::endl;
+      continue;
+    }
+    std::cerr << "m=" << cand.m << " nslots=" << cand.nslots
+              << " bits=" << res.bits << " security=" << long(res.security)
+              << " multiplyBy=" << res.tMul
+              << "s smartAutomorph=" << res.tAutomorph << "s";
+    if (opts.benchRecrypt)
+      std::cerr << " reCrypt=" << res.tRecrypt << "s";
+    std::cerr << " per-slot=" << res.score(opts.benchRecrypt) << "s"
+              << std::endl;
+    results.push_back(res);
+  }
+
+  if (results.empty()) {
+    std::cerr << "None of the candidates qualify." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const Result& best = *std::min_element(
+      results.begin(), results.end(), [&](const Result& a, const Result& b) {
+        return a.score(opts.benchRecrypt) < b.score(opts.benchRecrypt);
+      });
+
+  if (opts.outputPath.empty()) {
+    writeParams(std::cout, opts, best);
+  } else {
+    std::ofstream out(opts.outputPath);
+    if (!out.is_open()) {
+      std::cerr << "Cannot write parameters to file at '" << opts.outputPath
+                << "'." << std::endl;
+      return EXIT_FAILURE;
+    }
+    writeParams(out, opts, best);
+  }
+
+  return EXIT_SUCCESS;
+}